@@ -8,16 +8,11 @@
  *
  */
 
-#include <math.h>
 #include "mex.h"
 
 void
 mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 {
-  size_t M, N;
-  UINT64_T *x, *y;
-  int i;
-  
   if (nlhs > 2)
     mexErrMsgTxt ("Invalid number of output arguments");
   if (nrhs > 1)
@@ -26,16 +21,8 @@ mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
   if (!mxIsUint64(prhs[0]))
     mexErrMsgTxt ("Invalid type of input arguments (should be uint64)");
   
-  M = mxGetM(prhs[0]);
-  N = mxGetN(prhs[0]);
-  
-  plhs[0] = (mxArray*)mxCreateNumericMatrix(M, N, mxUINT64_CLASS, mxREAL);
-  x = mxGetData(prhs[0]);
-  y = mxGetData(plhs[0]);
-  
-  for (i=0; i<(M*N); i++)
-    y[i] = x[i];  /* the absolute value of an unsigned integer is identical to the original value */
+  /* the absolute value of an unsigned integer is identical to the original value */
+  plhs[0] = mxDuplicateArray(prhs[0]);
   
   return;
 }
-
@@ -2,57 +2,101 @@
  *
  * Copyright (C) 2007, Robert Oostenveld
  *
- * This implements [y, i] = max(x)
+ * This implements [y, i] = max(x), [y, i] = max(x, [], dim) and c = max(a, b)
+ * for uint64 data types.
  *
- * This function does not check the occurence of integer overflowing.
+ * The first two operate along the first non-singleton dimension or along the
+ * specified dimension, the index is that of the first largest value. For the
+ * last one A and B have the same size or are expanded over their singleton
+ * dimensions, see uint64_binary.h.
  *
  */
 
-#include <math.h>
 #include "mex.h"
+#include "uint64_binary.h"
+
+UINT64_KERNEL(max_kernel, (x > y ? x : y))
 
 void
 mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 {
-  size_t M, N, n;
+  mwSize nd, d, dim, dims[UINT64_MAXDIMS];
+  size_t len, inner, outer, numel, o, l, s;
   UINT64_T *x, *m;
   double *i;
-  
+
+  if (nrhs == 2)
+  {
+    if (nlhs > 1)
+      mexErrMsgTxt ("MAX with two matrices to compare and two output arguments is not supported.");
+    uint64_binary (nlhs, plhs, nrhs, prhs, max_kernel);
+    return;
+  }
+
   if (nlhs > 2)
     mexErrMsgTxt ("Invalid number of output arguments");
-  if (nrhs > 1)
+  if (nrhs < 1 || nrhs > 3)
     mexErrMsgTxt ("Invalid number of input arguments");
-  
+  if (nrhs == 3 && !mxIsEmpty(prhs[1]))
+    mexErrMsgTxt ("MAX with two matrices to compare and a working dimension is not supported.");
+
   if (!mxIsUint64(prhs[0]))
     mexErrMsgTxt ("Invalid type of input arguments (should be uint64)");
-  
-  M = mxGetM(prhs[0]);
-  N = mxGetN(prhs[0]);
-  
-  if (N>1 && M>1)
-    mexErrMsgTxt ("This works only on 1-D arrays (i.e. vectors)");
-  
-  if (N==0 || M==0)
-    mexErrMsgTxt ("This works only on 1-D arrays (i.e. vectors)");
-  
-  
-  plhs[0] = (mxArray*)mxCreateNumericMatrix(1, 1, mxUINT64_CLASS, mxREAL);
-  plhs[1] = (mxArray*)mxCreateDoubleMatrix(1, 1, mxREAL);
+
+  nd    = mxGetNumberOfDimensions(prhs[0]);
+  numel = mxGetNumberOfElements(prhs[0]);
+  if (nd > UINT64_MAXDIMS)
+    mexErrMsgTxt ("Too many dimensions");
+  if (numel==0)
+    mexErrMsgTxt ("This works only on non-empty arrays");
+  memcpy(dims, mxGetDimensions(prhs[0]), nd*sizeof(mwSize));
+
+  if (nrhs == 3)
+  {
+    if (mxGetScalar(prhs[2]) < 1)
+      mexErrMsgTxt ("Dimension argument must be a positive integer scalar.");
+    dim = (mwSize)mxGetScalar(prhs[2]) - 1;
+  }
+  else
+  {
+    /* the first non-singleton dimension */
+    for (dim=0; dim<nd-1 && dims[dim]==1; dim++);
+  }
+
+  len   = (dim<nd ? dims[dim] : 1);
+  inner = 1;
+  for (d=0; d<dim && d<nd; d++)
+    inner *= dims[d];
+  outer = numel/(len*inner);
+  if (dim<nd)
+    dims[dim] = 1;
+
+  plhs[0] = (mxArray*)mxCreateNumericArray(nd, dims, mxUINT64_CLASS, mxREAL);
+  plhs[1] = (mxArray*)mxCreateNumericArray(nd, dims, mxDOUBLE_CLASS, mxREAL);
   x = mxGetData(prhs[0]);
   m = mxGetData(plhs[0]);
   i = mxGetData(plhs[1]);
-  
-  n = 0;
-  m[0] = x[n];
-  i[0] = n+1; /* offset by one */
-  
-  for (n=1; n<(M*N); n++)
-    if (x[n]>m[0])
+
+  /* the innermost loop is over the elements that are contiguous in the output */
+  for (o=0; o<outer; o++)
   {
-    m[0] = x[n];
-    i[0] = n+1; /* offset by one */
+    memcpy(m, x, inner*sizeof(UINT64_T));
+    for (s=0; s<inner; s++)
+      i[s] = 1; /* offset by one */
+    for (l=1; l<len; l++)
+    {
+      const UINT64_T *xl = x + l*inner;
+      for (s=0; s<inner; s++)
+        if (xl[s] > m[s])
+        {
+          m[s] = xl[s];
+          i[s] = l+1; /* offset by one */
+        }
     }
-  
+    x += len*inner;
+    m += inner;
+    i += inner;
+  }
+
   return;
 }
-
@@ -7,3 +7,11 @@ uint64(4)  - uint64(2)
 uint64(4) ./ uint64(2)
 uint64(4) .* uint64(2)
 
+
+% saturation, rounding and expansion over singleton dimensions
+intmax('uint64') + uint64(1)
+uint64(2) - uint64(4)
+uint64(7) ./ uint64(2)
+uint64([1 2 3]) + uint64([10; 20])
+max(uint64([1 5; 4 2]))
+min(uint64([1 5; 4 2]), uint64(3))
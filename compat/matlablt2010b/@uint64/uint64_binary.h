@@ -0,0 +1,230 @@
+/*
+ *
+ * Copyright (C) 2017, Robert Oostenveld
+ *
+ * This implements the elementwise operations on two uint64 arrays that are
+ * shared by plus, minus, times, rdivide, min and max.
+ *
+ * The arguments either have the same size, or are expanded over their
+ * singleton dimensions like in recent MATLAB versions, e.g. a column plus a
+ * row results in a matrix. The dimensions are combined into as few runs as
+ * possible, within each run the element of A and of B either advances or stays
+ * the same, so that the innermost loop does not have any branches. Large arrays
+ * are split over multiple threads.
+ *
+ * Like for the other integer types in MATLAB the results saturate, i.e. they
+ * are limited to the range from 0 to intmax('uint64').
+ *
+ */
+
+#ifndef UINT64_BINARY_H
+#define UINT64_BINARY_H
+
+#include <string.h>
+#include "mex.h"
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <pthread.h>
+#include <unistd.h>
+#define UINT64_THREADS
+#endif
+
+#ifndef UINT64_MAX
+#define UINT64_MAX ((UINT64_T)-1)
+#endif
+
+#define UINT64_MAXDIMS    32
+#define UINT64_MAXTHREADS 16
+#define UINT64_MINSIZE    (1<<18)   /* number of elements per thread */
+
+/* compute c[i] = a[i] op b[i] for n elements, sa and sb are 1 if the element advances and 0 if it stays the same */
+typedef void (*uint64_kernel_t) (const UINT64_T *a, int sa, const UINT64_T *b, int sb, UINT64_T *c, size_t n);
+
+/* the expression OP computes the result from x and y, the four loops are specialized for the strides */
+#define UINT64_KERNEL(NAME, OP) \
+static void NAME (const UINT64_T *a, int sa, const UINT64_T *b, int sb, UINT64_T *c, size_t n) \
+{ \
+  size_t i; \
+  UINT64_T x, y; \
+  if (sa && sb) { \
+    for (i=0; i<n; i++) { x = a[i]; y = b[i]; c[i] = (OP); } \
+  } \
+  else if (sa) { \
+    y = b[0]; \
+    for (i=0; i<n; i++) { x = a[i]; c[i] = (OP); } \
+  } \
+  else if (sb) { \
+    x = a[0]; \
+    for (i=0; i<n; i++) { y = b[i]; c[i] = (OP); } \
+  } \
+  else { \
+    x = a[0]; y = b[0]; \
+    for (i=0; i<n; i++) c[i] = (OP); \
+  } \
+}
+
+typedef struct {
+  const UINT64_T *a, *b;
+  UINT64_T *c;
+  uint64_kernel_t kernel;
+  int ngroup;                     /* the combined dimensions, the first one is the innermost loop */
+  size_t len[UINT64_MAXDIMS];
+  size_t stra[UINT64_MAXDIMS];    /* the step in A and B along each of them */
+  size_t strb[UINT64_MAXDIMS];
+  size_t begin, end;              /* the elements of C that are computed by this thread */
+} uint64_binary_t;
+
+static void *
+uint64_binary_part (void *arg)
+{
+  const uint64_binary_t *s = (const uint64_binary_t *)arg;
+  size_t cnt[UINT64_MAXDIMS], pos = s->begin, inner, outer, offa = 0, offb = 0, n;
+  int g, sa = (s->stra[0]!=0), sb = (s->strb[0]!=0);
+
+  /* determine where this part starts */
+  inner = pos % s->len[0];
+  outer = pos / s->len[0];
+  for (g=1; g<s->ngroup; g++)
+  {
+    cnt[g] = outer % s->len[g];
+    outer  = outer / s->len[g];
+    offa  += cnt[g]*s->stra[g];
+    offb  += cnt[g]*s->strb[g];
+  }
+
+  while (pos<s->end)
+  {
+    n = s->len[0] - inner;
+    if (n > s->end - pos)
+      n = s->end - pos;
+    s->kernel(s->a + offa + inner*sa, sa, s->b + offb + inner*sb, sb, s->c + pos, n);
+    pos  += n;
+    inner = 0;
+
+    /* advance to the next run */
+    for (g=1; g<s->ngroup; g++)
+    {
+      offa += s->stra[g];
+      offb += s->strb[g];
+      if (++cnt[g] < s->len[g])
+        break;
+      offa -= s->len[g]*s->stra[g];
+      offb -= s->len[g]*s->strb[g];
+      cnt[g] = 0;
+    }
+  }
+
+  return NULL;
+}
+
+static void
+uint64_binary (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[], uint64_kernel_t kernel)
+{
+  mwSize dima, dimb, dimc[UINT64_MAXDIMS];
+  size_t numel = 1, stepa = 1, stepb = 1;
+  int nd, d, fa, fb, preva = -1, prevb = -1, t, nthreads = 1;
+  uint64_binary_t s;
+
+  if (nlhs > 1)
+    mexErrMsgTxt ("Invalid number of output arguments");
+  if (nrhs != 2)
+    mexErrMsgTxt ("Invalid number of input arguments");
+
+  if (!mxIsUint64(prhs[0]))
+    mexErrMsgTxt ("Invalid type of input arguments (should be uint64)");
+  if (!mxIsUint64(prhs[1]))
+    mexErrMsgTxt ("Invalid type of input arguments (should be uint64)");
+
+  nd = mxGetNumberOfDimensions(prhs[0]);
+  if (mxGetNumberOfDimensions(prhs[1]) > nd)
+    nd = mxGetNumberOfDimensions(prhs[1]);
+  if (nd > UINT64_MAXDIMS)
+    mexErrMsgTxt ("Too many dimensions");
+
+  /* determine the size of the output and combine the dimensions with the same expansion into one run */
+  s.ngroup = 0;
+  for (d=0; d<nd; d++)
+  {
+    dima = (d<mxGetNumberOfDimensions(prhs[0]) ? mxGetDimensions(prhs[0])[d] : 1);
+    dimb = (d<mxGetNumberOfDimensions(prhs[1]) ? mxGetDimensions(prhs[1])[d] : 1);
+    if (dima!=dimb && dima!=1 && dimb!=1)
+      mexErrMsgTxt ("Matrix dimensions must agree.");
+    dimc[d] = (dima==1 ? dimb : dima);
+    numel  *= dimc[d];
+
+    if (dimc[d]!=1)
+    {
+      fa = (dima!=1);
+      fb = (dimb!=1);
+      if (s.ngroup>0 && fa==preva && fb==prevb)
+        s.len[s.ngroup-1] *= dimc[d];
+      else
+      {
+        s.len[s.ngroup]  = dimc[d];
+        s.stra[s.ngroup] = (fa ? stepa : 0);
+        s.strb[s.ngroup] = (fb ? stepb : 0);
+        s.ngroup++;
+      }
+      preva = fa;
+      prevb = fb;
+    }
+    stepa *= dima;
+    stepb *= dimb;
+  }
+
+  plhs[0] = (mxArray*)mxCreateNumericArray(nd, dimc, mxUINT64_CLASS, mxREAL);
+  if (numel==0)
+    return;
+
+  if (s.ngroup==0)
+  {
+    /* both are scalar */
+    s.len[0]  = 1;
+    s.stra[0] = s.strb[0] = 1;
+    s.ngroup  = 1;
+  }
+
+  s.a      = (const UINT64_T *)mxGetData(prhs[0]);
+  s.b      = (const UINT64_T *)mxGetData(prhs[1]);
+  s.c      = (UINT64_T *)mxGetData(plhs[0]);
+  s.kernel = kernel;
+  s.begin  = 0;
+  s.end    = numel;
+
+#ifdef UINT64_THREADS
+  if (numel>=2*UINT64_MINSIZE)
+  {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = (ncpu>UINT64_MAXTHREADS ? UINT64_MAXTHREADS : (ncpu<1 ? 1 : (int)ncpu));
+    if ((size_t)nthreads > numel/UINT64_MINSIZE)
+      nthreads = (int)(numel/UINT64_MINSIZE);
+  }
+
+  if (nthreads>1)
+  {
+    pthread_t thread[UINT64_MAXTHREADS];
+    uint64_binary_t part[UINT64_MAXTHREADS];
+    int started[UINT64_MAXTHREADS];
+
+    for (t=0; t<nthreads; t++)
+    {
+      part[t]       = s;
+      part[t].begin = (numel*t)/nthreads;
+      part[t].end   = (numel*(t+1))/nthreads;
+      started[t]    = (pthread_create(&thread[t], NULL, uint64_binary_part, &part[t])==0);
+    }
+    for (t=0; t<nthreads; t++)
+    {
+      if (started[t])
+        pthread_join(thread[t], NULL);
+      else
+        uint64_binary_part(&part[t]);
+    }
+  }
+#endif
+
+  if (nthreads==1)
+    uint64_binary_part(&s);
+}
+
+#endif
@@ -3,16 +3,16 @@
 
 switch mexext
   case {'mexmaci64' 'mexmaci' 'mexa64' 'mexglx'}
-    mex -DUSE_PTHREADS alternative.c -leng -output engine
+    mex -DUSE_PTHREADS engine.c -leng -output engine
     mex ft_getopt.c
     
   case 'mexw64'
     % mex -I.\pthreads-win32\include -L.\pthreads-win32\lib\x64 engine.c -leng -lpthreadVC2
-    mex alternative.c -leng -output engine
+    mex engine.c -leng -output engine
     
   case 'mexw32'
     % mex -I.\pthreads-win32\include -L.\pthreads-win32\lib\x86 engine.c -leng -lpthreadVC2
-    mex alternative.c -leng -output engine
+    mex engine.c -leng -output engine
     
   otherwise
     error('unsupported mex platform');
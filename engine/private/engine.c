@@ -16,6 +16,22 @@
  *
  */
 
+/*
+ * This manages a pool of MATLAB engines, each with its own thread. The put,
+ * eval and get commands are placed in the queue of the engine and return a
+ * ticket right away. Each engine thread executes the commands in its queue
+ * in the order in which they were given, so that a get following an eval on
+ * the same engine returns the result of that eval. The completion of a
+ * command can be tested with poll, or waited for with wait, which also
+ * returns the value of a get. The record of a command is only removed when
+ * it has been waited for, or when the engines are closed.
+ *
+ * Large real numeric arrays are not serialized through the engine pipe, but
+ * written to a file in SHM_DIR, which the engine maps with memmapfile. For
+ * get it is the other way around: the engine writes the array to the file,
+ * which the mex file maps. Other arrays use engPutVariable and engGetVariable.
+ */
+
 #include "mex.h"
 #include "engine.h"
 #include "platform.h"
@@ -25,140 +41,602 @@
 #include <string.h>
 #include <ctype.h>
 
-#ifdef USE_PTHREADS
-#include <pthread.h>
+#ifndef PLATFORM_WINDOWS
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define SHM_AVAILABLE
+#endif
+
+#ifdef PLATFORM_LINUX
+#define SHM_DIR     "/dev/shm"  /* this is a memory based filesystem */
 #else
-#include <windows.h>
+#define SHM_DIR     "/tmp"
 #endif
 
-#define STRLEN 256
+#define STRLEN      256
+#define MAX_ENGINES 256
+#define SHM_MINSIZE 1048576     /* smaller arrays are sent through the engine pipe */
 #define FREE(x) {if (x) {free(x); x=NULL;}}
 
 /**************************************************************************************************/
 #ifdef USE_PTHREADS
+#include <pthread.h>
+
 pthread_mutex_t enginemutex   = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t  busycond      = PTHREAD_COND_INITIALIZER;
+pthread_cond_t  startcond[MAX_ENGINES];
+pthread_cond_t  finishcond;
+pthread_t       threadid[MAX_ENGINES];
 #define ENGINEMUTEX_LOCK        pthread_mutex_lock(&enginemutex)
 #define ENGINEMUTEX_UNLOCK      pthread_mutex_unlock(&enginemutex)
-#define BUSYCOND_WAIT           pthread_cond_wait(&busycond, &enginemutex)
-#define BUSYCOND_RELEASE        pthread_cond_signal(&busycond)
-#define THREAD_EXIT             pthread_exit(NULL);
+#define COND_INIT(x)            pthread_cond_init(x, NULL)
+#define COND_WAIT(x)            pthread_cond_wait(x, &enginemutex)
+#define COND_SIGNAL(x)          pthread_cond_signal(x)
+#define COND_BROADCAST(x)       pthread_cond_broadcast(x)
+#define COND_DESTROY(x)         pthread_cond_destroy(x)
+#define THREAD_JOIN(x)          pthread_join(x, NULL)
+#define THREAD_EXIT             pthread_exit(NULL)
 
 #else
-CRITICAL_SECTION enginemutex;
-#define ENGINEMUTEX_LOCK   EnterCriticalSection(&enginemutex)
-#define ENGINEMUTEX_UNLOCK LeaveCriticalSection(&enginemutex)
-#define BUSYCOND_WAIT
-#define BUSYCOND_RELEASE
+#include <windows.h>
+
+CRITICAL_SECTION   enginemutex;
+CONDITION_VARIABLE startcond[MAX_ENGINES];
+CONDITION_VARIABLE finishcond;
+HANDLE             threadid[MAX_ENGINES];
+#define ENGINEMUTEX_LOCK        EnterCriticalSection(&enginemutex)
+#define ENGINEMUTEX_UNLOCK      LeaveCriticalSection(&enginemutex)
+#define COND_INIT(x)            InitializeConditionVariable(x)
+#define COND_WAIT(x)            SleepConditionVariableCS(x, &enginemutex, INFINITE)
+#define COND_SIGNAL(x)          WakeConditionVariable(x)
+#define COND_BROADCAST(x)       WakeAllConditionVariable(x)
+#define COND_DESTROY(x)
+#define THREAD_JOIN(x)          {WaitForSingleObject(x, INFINITE); CloseHandle(x);}
 #define THREAD_EXIT
 
 #endif
 /**************************************************************************************************/
 
-Engine         *engine = NULL;
-unsigned int    initialized = 0;
+/* the state of the engine thread */
+#define ENGINE_STARTING 1
+#define ENGINE_IDLE     2
+#define ENGINE_BUSY     3
+#define ENGINE_INVALID  4
+
+/* the commands that can be queued */
+#define COMMAND_PUT     1
+#define COMMAND_EVAL    2
+#define COMMAND_GET     3
+
+/* the state of the command */
+#define COMMAND_QUEUED  1
+#define COMMAND_RUNNING 2
+#define COMMAND_DONE    3
+
+typedef struct command_s {
+  unsigned int ticket;
+  unsigned int engine;
+  int operation;
+  int status;
+  int retval;
+  char *str;        /* the name of the variable, or the command to evaluate */
+  mxArray *value;   /* the value that is put, or the value that was returned by get */
+  struct command_s *next;
+} command_t;
+
+/* these are all protected by the enginemutex */
+Engine         *engine[MAX_ENGINES];
+unsigned int    state[MAX_ENGINES];
+unsigned int    closing       = 0;
+unsigned int    poolsize      = 0;
+unsigned int    ticket        = 0;
+command_t      *commandlist   = NULL;   /* all commands of all engines, in the order in which they were given */
+unsigned int    initialized   = 0;
+char            matlabcmd[STRLEN];
+
+void free_command(command_t *cmd) {
+  if (cmd) {
+    FREE(cmd->str);
+    if (cmd->value)
+      mxDestroyArray(cmd->value);
+    free(cmd);
+  }
+}
+
+/* this returns the command with the specified ticket, the enginemutex should be locked */
+command_t *lookup_command(unsigned int id, command_t **previous) {
+  command_t *cmd = commandlist;
+  *previous = NULL;
+  while (cmd && cmd->ticket!=id) {
+    *previous = cmd;
+    cmd = cmd->next;
+  }
+  return cmd;
+}
+
+/* this returns the first command in the queue of the engine, the enginemutex should be locked */
+command_t *next_command(unsigned int num) {
+  command_t *cmd = commandlist;
+  while (cmd && !(cmd->engine==num && cmd->status==COMMAND_QUEUED))
+    cmd = cmd->next;
+  return cmd;
+}
+
+#ifdef SHM_AVAILABLE
+/* the name of the variable is part of the string that is evaluated, so it should be a plain variable name */
+int valid_name(const char *name) {
+  const char *ptr = name;
+  if (!isalpha((int)*ptr))
+    return 0;
+  while (*(++ptr))
+    if (!isalnum((int)*ptr) && *ptr!='_')
+      return 0;
+  return (ptr-name < 64);
+}
+
+/* this returns 1 if the array should be transferred through shared memory */
+int shm_applicable(mxClassID classid, size_t bytes) {
+  if (bytes<SHM_MINSIZE)
+    return 0;
+  switch (classid) {
+    case mxDOUBLE_CLASS: case mxSINGLE_CLASS:
+    case mxINT8_CLASS:   case mxUINT8_CLASS:
+    case mxINT16_CLASS:  case mxUINT16_CLASS:
+    case mxINT32_CLASS:  case mxUINT32_CLASS:
+    case mxINT64_CLASS:  case mxUINT64_CLASS:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+/* this puts the array through shared memory, it returns -1 if engPutVariable should be used instead */
+int put_shm(Engine *ep, unsigned int id, const char *name, const mxArray *value) {
+  char file[STRLEN], *str, *ptr;
+  int fd, retval, i, ndims;
+  size_t bytes;
+  void *map;
+  const mwSize *dims;
+
+  bytes = mxGetNumberOfElements(value) * mxGetElementSize(value);
+  if (!valid_name(name) || mxIsComplex(value) || mxIsSparse(value) || !shm_applicable(mxGetClassID(value), bytes))
+    return -1;
+
+  sprintf(file, "%s/engine_%d_%u", SHM_DIR, (int)getpid(), id);
+  if ((fd = open(file, O_RDWR | O_CREAT | O_EXCL, 0600))<0)
+    return -1;
+  if (ftruncate(fd, bytes)!=0 || (map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0))==MAP_FAILED) {
+    close(fd);
+    unlink(file);
+    return -1;
+  }
+  memcpy(map, mxGetData(value), bytes);
+  munmap(map, bytes);
+  close(fd);
+
+  ndims = mxGetNumberOfDimensions(value);
+  dims  = mxGetDimensions(value);
+  if ((str = malloc(3*STRLEN + 24*ndims))==NULL) {
+    unlink(file);
+    return -1;
+  }
+  ptr  = str;
+  ptr += sprintf(ptr, "engine_shm_map = memmapfile('%s', 'Format', {'%s', [", file, mxGetClassName(value));
+  for (i=0; i<ndims; i++)
+    ptr += sprintf(ptr, " %lu", (unsigned long)dims[i]);
+  ptr += sprintf(ptr, "], 'x'}); %s = engine_shm_map.Data.x; clear engine_shm_map", name);
+
+  retval = engEvalString(ep, str);
+  free(str);
+  /* the engine has its own copy of the data now */
+  unlink(file);
+  return retval;
+}
+
+/* this gets the array through shared memory, the fallback flag is set if engGetVariable should be used instead */
+mxArray *get_shm(Engine *ep, unsigned int id, const char *name, int *fallback) {
+  char file[STRLEN], str[3*STRLEN];
+  int fd, i, ndims;
+  size_t bytes;
+  void *map;
+  mxArray *info, *value = NULL;
+  mwSize dims[32];
+  mxClassID classid;
+  struct stat sb;
+
+  *fallback = 1;
+  if (!valid_name(name))
+    return NULL;
+
+  /* the class and size of the variable determine whether it is worth it */
+  sprintf(str, "clear engine_shm_info; engine_shm_info = {class(%s), size(%s), isnumeric(%s) && isreal(%s) && ~issparse(%s)};", name, name, name, name, name);
+  if (engEvalString(ep, str)!=0 || (info = engGetVariable(ep, "engine_shm_info"))==NULL)
+    return NULL;
+  engEvalString(ep, "clear engine_shm_info");
+
+  if (!mxIsCell(info) || mxGetNumberOfElements(info)!=3 || !mxIsLogicalScalarTrue(mxGetCell(info, 2))) {
+    mxDestroyArray(info);
+    return NULL;
+  }
+  mxGetString(mxGetCell(info, 0), str, STRLEN);
+  classid = mxDOUBLE_CLASS;
+  if      (strcmp(str, "single")==0) classid = mxSINGLE_CLASS;
+  else if (strcmp(str, "int8"  )==0) classid = mxINT8_CLASS;
+  else if (strcmp(str, "uint8" )==0) classid = mxUINT8_CLASS;
+  else if (strcmp(str, "int16" )==0) classid = mxINT16_CLASS;
+  else if (strcmp(str, "uint16")==0) classid = mxUINT16_CLASS;
+  else if (strcmp(str, "int32" )==0) classid = mxINT32_CLASS;
+  else if (strcmp(str, "uint32")==0) classid = mxUINT32_CLASS;
+  else if (strcmp(str, "int64" )==0) classid = mxINT64_CLASS;
+  else if (strcmp(str, "uint64")==0) classid = mxUINT64_CLASS;
+  else if (strcmp(str, "double")!=0) {
+    mxDestroyArray(info);
+    return NULL;
+  }
+  ndims = mxGetNumberOfElements(mxGetCell(info, 1));
+  if (ndims>32) {
+    mxDestroyArray(info);
+    return NULL;
+  }
+  for (i=0; i<ndims; i++)
+    dims[i] = mxGetPr(mxGetCell(info, 1))[i];
+  mxDestroyArray(info);
+
+  if ((value = mxCreateNumericArray(ndims, dims, classid, mxREAL))==NULL)
+    return NULL;
+  bytes = mxGetNumberOfElements(value) * mxGetElementSize(value);
+  if (!shm_applicable(classid, bytes)) {
+    mxDestroyArray(value);
+    return NULL;
+  }
+
+  sprintf(file, "%s/engine_%d_%u", SHM_DIR, (int)getpid(), id);
+  sprintf(str, "engine_shm_fid = fopen('%s', 'w'); fwrite(engine_shm_fid, %s, '%s'); fclose(engine_shm_fid); clear engine_shm_fid", file, name, mxGetClassName(value));
+  engEvalString(ep, str);
+
+  if ((fd = open(file, O_RDONLY))<0) {
+    mxDestroyArray(value);
+    return NULL;
+  }
+  if (fstat(fd, &sb)!=0 || (size_t)sb.st_size!=bytes || (map = mmap(NULL, bytes, PROT_READ, MAP_SHARED, fd, 0))==MAP_FAILED) {
+    close(fd);
+    unlink(file);
+    mxDestroyArray(value);
+    return NULL;
+  }
+  memcpy(mxGetData(value), map, bytes);
+  munmap(map, bytes);
+  close(fd);
+  unlink(file);
+
+  *fallback = 0;
+  return value;
+}
+#endif
 
 /* this is called the first time that the mex-file is loaded */
 void initFun(void) {
+  unsigned int num;
   if (!initialized) {
+#ifndef USE_PTHREADS
+    InitializeCriticalSection(&enginemutex);
+#endif
     ENGINEMUTEX_LOCK;
+    for (num=0; num<MAX_ENGINES; num++) {
+      engine[num] = NULL;
+      state[num]  = ENGINE_INVALID;
+      COND_INIT(&startcond[num]);
+    }
+    COND_INIT(&finishcond);
+    poolsize    = 0;
+    closing     = 0;
     initialized = 1;
     ENGINEMUTEX_UNLOCK;
-    mexPrintf("engine init()\n");
   }
   return;
 }
 
-/* this function is called upon unloading of the mex-file */
+/* this function is called upon unloading of the mex-file, and to close the engines */
 void exitFun(void) {
+  unsigned int num, count;
+  command_t *cmd;
+
+  if (!initialized)
+    return;
+
+  /* the engine threads finish the commands in their queue before they close the engine */
+  ENGINEMUTEX_LOCK;
+  closing = 1;
+  count   = poolsize;
+  for (num=0; num<count; num++)
+    COND_SIGNAL(&startcond[num]);
+  ENGINEMUTEX_UNLOCK;
+
+  for (num=0; num<count; num++)
+    THREAD_JOIN(threadid[num]);
+
   ENGINEMUTEX_LOCK;
-  initialized = 0;
+  while (commandlist) {
+    cmd = commandlist->next;
+    free_command(commandlist);
+    commandlist = cmd;
+  }
+  poolsize = 0;
+  closing  = 0;
   ENGINEMUTEX_UNLOCK;
-  mexPrintf("engine exit()\n");
+
+  if (mexIsLocked())
+    mexUnlock();
   return;
 }
 
-/* this function will be started as a seperate thread */
-void evalString(void *argin) {
-  int   retval;
-  char *cmd;
-  
-  mexPrintf("Starting thread\n");
+/* this function is started as a seperate thread for each engine */
+void engineThread(void *argin) {
+  unsigned int num = (unsigned int)(size_t)argin;
+  int retval, fallback;
+  Engine *ep;
+  command_t *cmd;
+
+  /* start the MATLAB engine, this thread will remain responsible for it */
+#ifdef PLATFORM_WINDOWS
+  ep = engOpenSingleUse(NULL, NULL, &retval);
+  if (ep)
+    engSetVisible(ep, 0);
+#else
+  ep = engOpen(matlabcmd);
+#endif
+
   ENGINEMUTEX_LOCK;
-  
-  cmd = (char *) argin;
-  
-  if (engine!=0) {
-    mexPrintf("Executing command \"%s\" on %d\n", cmd, engine);
-    retval = engEvalString(engine, cmd);
-    mexPrintf("Finished executing command, retval = %d\n", retval);
-  }
-  
+  engine[num] = ep;
+  state[num]  = (ep ? ENGINE_IDLE : ENGINE_INVALID);
+  COND_BROADCAST(&finishcond);
+
+  while (ep) {
+    /* note that the enginemutex is locked here */
+    while ((cmd = next_command(num))==NULL && !closing)
+      COND_WAIT(&startcond[num]);
+    if (cmd==NULL)
+      break;
+
+    cmd->status = COMMAND_RUNNING;
+    state[num]  = ENGINE_BUSY;
+    ENGINEMUTEX_UNLOCK;
+
+    /* the engine is not locked while the command is executed, the mex file can queue the next commands */
+    if (cmd->operation==COMMAND_PUT) {
+      retval = -1;
+#ifdef SHM_AVAILABLE
+      retval = put_shm(ep, cmd->ticket, cmd->str, cmd->value);
+#endif
+      if (retval<0)
+        retval = engPutVariable(ep, cmd->str, cmd->value);
+    }
+    else if (cmd->operation==COMMAND_EVAL) {
+      retval = engEvalString(ep, cmd->str);
+    }
+    else if (cmd->operation==COMMAND_GET) {
+      fallback = 1;
+#ifdef SHM_AVAILABLE
+      cmd->value = get_shm(ep, cmd->ticket, cmd->str, &fallback);
+#endif
+      if (fallback)
+        cmd->value = engGetVariable(ep, cmd->str);
+      if (cmd->value)
+        mxMakeArrayPersistent(cmd->value);
+      retval = (cmd->value==NULL);
+    }
+    else {
+      retval = -1;
+    }
+
+    ENGINEMUTEX_LOCK;
+    if (cmd->operation==COMMAND_PUT && cmd->value) {
+      /* the copy of the value is not needed any more */
+      mxDestroyArray(cmd->value);
+      cmd->value = NULL;
+    }
+    cmd->retval = retval;
+    cmd->status = COMMAND_DONE;
+    state[num]  = ENGINE_IDLE;
+    COND_BROADCAST(&finishcond);
+  }
+
+  engine[num] = NULL;
+  state[num]  = ENGINE_INVALID;
   ENGINEMUTEX_UNLOCK;
-  
-  mexPrintf("Finished thread\n");
+
+  if (ep)
+    engClose(ep);
+
   THREAD_EXIT;
   return;
 }
 
+/* this places the command in the queue of the engine and returns its ticket */
+unsigned int queue_command(unsigned int num, int operation, const mxArray *name, const mxArray *value) {
+  command_t *cmd, *last;
+  char *str;
+
+  if ((cmd = (command_t *)calloc(1, sizeof(command_t)))==NULL)
+    mexErrMsgTxt("Could not allocate memory");
+  cmd->engine    = num;
+  cmd->operation = operation;
+  cmd->status    = COMMAND_QUEUED;
+
+  /* the string that is allocated by MATLAB is released at the end of this call */
+  if ((str = mxArrayToString(name))!=NULL) {
+    cmd->str = strdup(str);
+    mxFree(str);
+  }
+  if (cmd->str==NULL) {
+    free(cmd);
+    mexErrMsgTxt("Could not allocate memory");
+  }
+  if (value) {
+    /* the engine thread needs a copy that remains after this call */
+    cmd->value = mxDuplicateArray(value);
+    mxMakeArrayPersistent(cmd->value);
+  }
+
+  ENGINEMUTEX_LOCK;
+  cmd->ticket = ++ticket;
+  if (commandlist==NULL) {
+    commandlist = cmd;
+  }
+  else {
+    last = commandlist;
+    while (last->next)
+      last = last->next;
+    last->next = cmd;
+  }
+  COND_SIGNAL(&startcond[num]);
+  ENGINEMUTEX_UNLOCK;
+
+  return cmd->ticket;
+}
+
+/* this waits for the command to finish and removes it, the value of a get is returned */
+int wait_command(unsigned int id, mxArray **value) {
+  int retval;
+  command_t *cmd, *previous;
+
+  ENGINEMUTEX_LOCK;
+  cmd = lookup_command(id, &previous);
+  while (cmd && cmd->status!=COMMAND_DONE && state[cmd->engine]!=ENGINE_INVALID) {
+    COND_WAIT(&finishcond);
+    /* the list may have changed while waiting */
+    cmd = lookup_command(id, &previous);
+  }
+  if (cmd==NULL) {
+    ENGINEMUTEX_UNLOCK;
+    mexErrMsgTxt("Invalid ticket");
+  }
+  if (previous)
+    previous->next = cmd->next;
+  else
+    commandlist = cmd->next;
+  ENGINEMUTEX_UNLOCK;
+
+  retval = (cmd->status==COMMAND_DONE ? cmd->retval : -1);
+  *value = NULL;
+  if (cmd->value) {
+    /* the array that is returned to MATLAB should not be persistent */
+    *value = mxDuplicateArray(cmd->value);
+  }
+  free_command(cmd);
+  return retval;
+}
+
+unsigned int engine_number(const mxArray *arg) {
+  unsigned int num;
+  if (!mxIsNumeric(arg))
+    mexErrMsgTxt("Argument #2 should be numeric");
+  num = mxGetScalar(arg);
+  if (num < 1 || num > poolsize)
+    mexErrMsgTxt("Invalid engine number");
+  return num - 1; /* switch from MATLAB to C indexing */
+}
+
+int block_flag(int nrhs, const mxArray * prhs[], int index, int block) {
+  if (nrhs > index) {
+    if (!mxIsNumeric(prhs[index]) && !mxIsLogical(prhs[index]))
+      mexErrMsgTxt("Invalid block argument, should be numeric");
+    block = (mxGetScalar(prhs[index])!=0);
+  }
+  return block;
+}
+
 void mexFunction(int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[]) {
   char            command[STRLEN];
-  char            matlabcmd[STRLEN];
-  char            cmd[STRLEN];
   char           *ptr;
-  int             poolsize, retval, block, num, i, status;
-  #ifndef USE_PTHREADS
-          HANDLE TName;
-  InitializeCriticalSection(&enginemutex);
-  #endif
-          
-          initFun();
+  int             retval, block, count, queued;
+  unsigned int    num, id;
+  mxArray        *value;
+  command_t      *cmd, *previous;
+
+  initFun();
   mexAtExit(exitFun);
-  
+
   /* the first argument is always the command string */
   if (nrhs < 1)
     mexErrMsgTxt("invalid number of input arguments");
-  
+
   if (!mxIsChar(prhs[0]))
     mexErrMsgTxt("invalid input argument #1");
   if (mxGetString(prhs[0], command, STRLEN - 1))
     mexErrMsgTxt("invalid input argument #1");
-  
+
   /* convert to lower case */
   ptr = command;
   while (*ptr) {
     *ptr = tolower(*ptr);
     ptr++;
   }
-  
+
   /****************************************************************************/
   if (strcmp(command, "open") == 0) {
-    /* engine open num cmd */
-    
+    /* engine open num cmd block */
+
+    if (poolsize != 0)
+      mexErrMsgTxt("There are already engines running");
+
     if (nrhs < 2)
       mexErrMsgTxt("Invalid number of input arguments");
-    
-    if (nrhs > 1) {
-      if (!mxIsNumeric(prhs[1]))
-        mexErrMsgTxt("Invalid input argument #2, should be numeric");
-      poolsize = mxGetScalar(prhs[1]);
-    }
-    if (nrhs > 2) {
+
+    if (!mxIsNumeric(prhs[1]))
+      mexErrMsgTxt("Invalid input argument #2, should be numeric");
+    count = mxGetScalar(prhs[1]);
+
+    if (nrhs > 2 && !mxIsEmpty(prhs[2])) {
       if (!mxIsChar(prhs[2]))
         mexErrMsgTxt("Invalid input argument #3, should be a string");
+      if (mxGetNumberOfElements(prhs[2])>STRLEN-1)
+        mexErrMsgTxt("Invalid input argument #3, matlab command is too long");
       mxGetString(prhs[2], matlabcmd, STRLEN - 1);
     } else {
-      sprintf(matlabcmd, "matlab");
+      sprintf(matlabcmd, "matlab -nosplash -nodisplay");
     }
-    
-    if (poolsize < 1)
+
+    if (count < 1)
       mexErrMsgTxt("The number of engines in the pool should be positive");
-    
+    if (count > MAX_ENGINES)
+      mexErrMsgTxt("The number of engines in the pool is too large");
+
+    /* the engine threads keep running in between the calls to the mex file */
+    if (!mexIsLocked())
+      mexLock();
+
+    block = block_flag(nrhs, prhs, 3, 1);
+
+    /* the engines start at the same time, the commands for an engine that is still starting are queued */
+    retval = 0;
     ENGINEMUTEX_LOCK;
-    engine = engOpenSingleUse(NULL, NULL, &retval);	/* returns NULL on failure */
+    for (num=0; num<count; num++) {
+      state[num] = ENGINE_STARTING;
+#ifdef USE_PTHREADS
+      retval = pthread_create(&threadid[num], NULL, (void *(*)(void *)) engineThread, (void *)(size_t)num);
+#else
+      threadid[num] = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE) engineThread, (void *)(size_t)num, 0, NULL);
+      retval = (threadid[num]==NULL);
+#endif
+      if (retval) {
+        state[num] = ENGINE_INVALID;
+        break;
+      }
+      poolsize++;
+    }
+    if (block) {
+      for (num=0; num<poolsize; num++) {
+        while (state[num]==ENGINE_STARTING)
+          COND_WAIT(&finishcond);
+        if (state[num]==ENGINE_INVALID)
+          retval = 1;
+      }
+    }
     ENGINEMUTEX_UNLOCK;
-    
-    if (!engine) {
+
+    if (retval) {
       exitFun();	/* this cleans up all engines */
       mexErrMsgTxt("failed to open MATLAB engine");
     }
@@ -166,142 +644,166 @@ void mexFunction(int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[]) {
   /****************************************************************************/
   else if (strcmp(command, "close") == 0) {
     /* engine close */
-    
+
     exitFun();
-    
+
     retval = 0;
     plhs[0] = mxCreateDoubleMatrix(1, 1, mxREAL);
     mxGetPr(plhs[0])[0] = retval;
-    
   }
   /****************************************************************************/
   else if (strcmp(command, "put") == 0) {
-    /* engine put num name val */
-    
-    if (nrhs != 4)
-      mexErrMsgTxt("Exactly four input arguments needed");
-    
-    if (!mxIsNumeric(prhs[1]))
-      mexErrMsgTxt("Argument #2 should be numeric");
-    num = mxGetScalar(prhs[1]);
-    
-    if (num < 1 || num > poolsize)
-      mexErrMsgTxt("Invalid engine number");
-    
+    /* engine put num name val block */
+
+    if (nrhs < 4)
+      mexErrMsgTxt("At least four input arguments needed");
+
+    num = engine_number(prhs[1]);
+
     if (!mxIsChar(prhs[2]))
       mexErrMsgTxt("Argument #3 should be a string");
-    
-    ENGINEMUTEX_LOCK;
-    
-    retval = engPutVariable(engine, mxArrayToString(prhs[2]), prhs[3]);
-    
+
+    block = block_flag(nrhs, prhs, 4, 0);
+    id = queue_command(num, COMMAND_PUT, prhs[2], prhs[3]);
+
     plhs[0] = mxCreateDoubleMatrix(1, 1, mxREAL);
-    mxGetPr(plhs[0])[0] = retval;
-    
-    ENGINEMUTEX_UNLOCK;
+    if (block)
+      mxGetPr(plhs[0])[0] = wait_command(id, &value);
+    else
+      mxGetPr(plhs[0])[0] = id;
   }
   /****************************************************************************/
   else if (strcmp(command, "get") == 0) {
-    /* engine get num name */
-    
-    if (nrhs != 3)
-      mexErrMsgTxt("Exactly three input arguments needed");
-    
-    if (!mxIsNumeric(prhs[1]))
-      mexErrMsgTxt("Argument #2 should be numeric");
-    
+    /* engine get num name block */
+
+    if (nrhs < 3)
+      mexErrMsgTxt("At least three input arguments needed");
+
+    num = engine_number(prhs[1]);
+
     if (!mxIsChar(prhs[2]))
       mexErrMsgTxt("Argument #3 should be a string");
-    
-    num = mxGetScalar(prhs[1]);
-    
-    ENGINEMUTEX_LOCK;
-    
-    plhs[0] = engGetVariable(engine, mxArrayToString(prhs[2]));
-    
-    ENGINEMUTEX_UNLOCK;
-    
+
+    /* this waits for the preceding commands on the same engine, unless specified otherwise */
+    block = block_flag(nrhs, prhs, 3, 1);
+    id = queue_command(num, COMMAND_GET, prhs[2], NULL);
+
+    if (block) {
+      wait_command(id, &value);
+      plhs[0] = (value ? value : mxCreateDoubleMatrix(0, 0, mxREAL));
+    }
+    else {
+      plhs[0] = mxCreateDoubleMatrix(1, 1, mxREAL);
+      mxGetPr(plhs[0])[0] = id;
+    }
   }
   /****************************************************************************/
-  else if (strcmp(command, "isbusy") == 0) {
-    /* engine isbusy num */
-    
+  else if (strcmp(command, "eval") == 0) {
+    /* engine eval num str block */
+
+    if (nrhs < 3)
+      mexErrMsgTxt("At least three input arguments needed");
+
+    num = engine_number(prhs[1]);
+
+    if (!mxIsChar(prhs[2]))
+      mexErrMsgTxt("Invalid input argument #3, should be a string");
+
+    block = block_flag(nrhs, prhs, 3, 0);
+    id = queue_command(num, COMMAND_EVAL, prhs[2], NULL);
+
+    plhs[0] = mxCreateDoubleMatrix(1, 1, mxREAL);
+    if (block)
+      mxGetPr(plhs[0])[0] = wait_command(id, &value);
+    else
+      mxGetPr(plhs[0])[0] = id;
+  }
+  /****************************************************************************/
+  else if (strcmp(command, "poll") == 0) {
+    /* engine poll ticket */
+
     if (nrhs != 2)
       mexErrMsgTxt("Exactly two input arguments needed");
-    
+
     if (!mxIsNumeric(prhs[1]))
       mexErrMsgTxt("Argument #2 should be numeric");
-    num = mxGetScalar(prhs[1]);
-    
+    id = mxGetScalar(prhs[1]);
+
     ENGINEMUTEX_LOCK;
-    plhs[0] = mxCreateDoubleMatrix(1, 1, mxREAL);
-    mxGetPr(plhs[0])[0] = 1;
+    cmd = lookup_command(id, &previous);
+    retval = (cmd ? (cmd->status==COMMAND_DONE || state[cmd->engine]==ENGINE_INVALID) : -1);
     ENGINEMUTEX_UNLOCK;
+
+    if (retval<0)
+      mexErrMsgTxt("Invalid ticket");
+
+    plhs[0] = mxCreateDoubleMatrix(1, 1, mxREAL);
+    mxGetPr(plhs[0])[0] = retval;
   }
   /****************************************************************************/
-  else if (strcmp(command, "eval") == 0) {
-    /* engine eval num str block */
-    
-    if (nrhs < 3)
-      mexErrMsgTxt("At least three input arguments needed");
-    
+  else if (strcmp(command, "wait") == 0) {
+    /* engine wait ticket */
+
+    if (nrhs != 2)
+      mexErrMsgTxt("Exactly two input arguments needed");
+
     if (!mxIsNumeric(prhs[1]))
       mexErrMsgTxt("Argument #2 should be numeric");
-    num = mxGetScalar(prhs[1]);
-    
-    if (!mxIsChar(prhs[2]))
-      mexErrMsgTxt("Invalid input argument #3, should be a string");
-    mxGetString(prhs[2], cmd, STRLEN - 1);
-    
-    if (nrhs > 3) {
-      if (!mxIsNumeric(prhs[3]))
-        mexErrMsgTxt("Invalid input argument #4, should be numeric");
-      block = mxGetScalar(prhs[3]);
-    } else {
-      block = 0;
-    }
-    
-    ENGINEMUTEX_LOCK;
-    
-    if (!block) {
-      
-#ifdef USE_PTHREADS
-      retval = pthread_create(&(enginepool[num - 1].tid), NULL, (void *) &evalString, (void *) (enginepool + num - 1));
-#else
-      TName = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE) evalString, (void *) (cmd), 0, NULL);
-#endif
+    id = mxGetScalar(prhs[1]);
 
-    } else {
-      retval = engEvalString(engine, cmd);
-    }
-    mexPrintf("Finished executing command, retval = %d\n", retval);
+    retval = wait_command(id, &value);
+
+    plhs[0] = mxCreateDoubleMatrix(1, 1, mxREAL);
+    mxGetPr(plhs[0])[0] = retval;
+    if (nlhs > 1)
+      plhs[1] = (value ? value : mxCreateDoubleMatrix(0, 0, mxREAL));
+    else if (value)
+      mxDestroyArray(value);
+  }
+  /****************************************************************************/
+  else if (strcmp(command, "isbusy") == 0) {
+    /* engine isbusy num */
+
+    if (nrhs != 2)
+      mexErrMsgTxt("Exactly two input arguments needed");
+
+    num = engine_number(prhs[1]);
+
+    /* the engine is busy as long as there are commands in its queue */
+    ENGINEMUTEX_LOCK;
+    retval = (state[num]==ENGINE_STARTING || state[num]==ENGINE_BUSY || next_command(num)!=NULL);
     ENGINEMUTEX_UNLOCK;
-    
-    WaitForSingleObject(TName, INFINITE);
-    
-    /* wait for the thread to become busy */
-    mexPrintf("Waiting for engine to become busy\n");
-    BUSYCOND_WAIT;
-    mexPrintf("The engine has become busy\n");
-    
+
     plhs[0] = mxCreateDoubleMatrix(1, 1, mxREAL);
     mxGetPr(plhs[0])[0] = retval;
   }
   /****************************************************************************/
   else if (strcmp(command, "poolsize") == 0) {
     /* engine poolsize */
-    
+
     ENGINEMUTEX_LOCK;
     plhs[0] = mxCreateDoubleMatrix(1, 1, mxREAL);
-    mxGetPr(plhs[0])[0] = (engine!=0);
+    mxGetPr(plhs[0])[0] = poolsize;
     ENGINEMUTEX_UNLOCK;
   }
   /****************************************************************************/
   else if (strcmp(command, "info") == 0) {
     /* engine info */
-    
+
     ENGINEMUTEX_LOCK;
-    mexPrintf("engine = %d\n",   engine);
+    for (num=0; num<poolsize; num++) {
+      queued = 0;
+      count  = 0;
+      for (cmd=commandlist; cmd; cmd=cmd->next) {
+        if (cmd->engine!=num)
+          continue;
+        if (cmd->status==COMMAND_DONE)
+          count++;
+        else
+          queued++;
+      }
+      mexPrintf("engine %d: state = %d, queued = %d, finished = %d\n", num+1, state[num], queued, count);
+    }
     ENGINEMUTEX_UNLOCK;
   }
   /****************************************************************************/
@@ -309,6 +811,6 @@ void mexFunction(int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[]) {
     mexErrMsgTxt("unknown command");
     return;
   }
-  
+
   return;
 }
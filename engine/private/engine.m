@@ -4,14 +4,36 @@
 %
 % Use as
 %   status = engine('open', poolsize, startcmd)
+%   status = engine('open', poolsize, startcmd, false)
 %   status = engine('close')
 %   status = engine('isbusy', num)
-%   status = engine('eval',   num, cmd)
-%   status = engine('put',    num, name, value)
+%   ticket = engine('eval',   num, cmd)
+%   ticket = engine('put',    num, name, value)
 %   value  = engine('get',    num, name)
+%   ticket = engine('get',    num, name, false)
+%   status = engine('poll',   ticket)
+%   [status, value] = engine('wait', ticket)
 %   value  = engine('poolsize')
 %            engine('info')
 %
+% The put, eval and get commands are placed in the queue of the engine and
+% are executed in the order in which they were given. Put and eval return a
+% ticket right away, get waits for the value unless the last argument is
+% false. With poll you can test whether the command with the ticket has
+% finished, wait returns its status and, for get, the value. Each ticket
+% should be waited for once, otherwise its record is kept until the engines
+% are closed. Put and eval block and return the status if the last argument
+% is true. Closing the engines waits for the queued commands.
+%
+% The engines of the pool are started at the same time. Open waits until all
+% of them are running, unless the last argument is false. In that case it
+% returns right away and the commands for an engine that is still starting
+% are queued, so that the time for starting MATLAB overlaps with your own
+% work. The startcmd can be empty to use the default.
+%
+% Large real numeric arrays are passed to and from the engines through a file
+% in shared memory rather than through the engine pipe.
+%
 % See also ENGPOOL, ENGFEVAL, ENGCELLFUN
 
 error('The mex file is not compiled for your platform (%s)', mexext);
@@ -144,7 +144,8 @@ try
   
   
   % start measuring the time and memory requirements
-  memprofile on
+  % the samples are tagged with the job id, and the sampling rate is adjusted to the expected duration
+  memprofile('on', ft_getopt(optin, 'jobid'), timallow);
   timused = toc(stopwatch);
   
   if usediary
@@ -192,7 +193,7 @@ try
   fprintf('executing job took %f seconds and %d bytes\n', timused, memused);
   
   % collect the output options
-  optout = {'timused', timused, 'memused', memused, 'lastwarn', lastwarn, 'lasterr', '', 'diary', diarystring, 'release', version('-release'), 'pwd', pwd, 'path', path, 'hostname', getenv('HOSTNAME')};
+  optout = {'timused', timused, 'memused', memused, 'memprofile', memstat, 'lastwarn', lastwarn, 'lasterr', '', 'diary', diarystring, 'release', version('-release'), 'pwd', pwd, 'path', path, 'hostname', getenv('HOSTNAME')};
   
 catch
   % the "catch me" syntax is broken on MATLAB74, this fixes it
@@ -1,4 +1,4 @@
-function val = ft_getopt(opt, key, default, emptymeaningful)
+function [val, varargout] = ft_getopt(opt, key, default, emptymeaningful)
 
 % FT_GETOPT gets the value of a specified option from a configuration structure
 % or from a cell-array with key-value pairs.
@@ -22,6 +22,13 @@ function val = ft_getopt(opt, key, default, emptymeaningful)
 % If emptymeaningful==true, then the empty array will be returned.
 % If emptymeaningful==false, then the specified default will be returned.
 %
+% Multiple options can be obtained in a single call with
+%   [val1, val2, ...] = ft_getopt(s, {key1, key2, ...}, {default1, default2, ...}, emptymeaningful)
+% where emptymeaningful can be a scalar or a vector with one value per key. The
+% values are returned in separate outputs if the number of outputs is equal to
+% the number of keys, otherwise they are returned together in a cell-array. This
+% is considerably faster than multiple calls if the MEX file is used.
+%
 % See also FT_SETOPT, FT_CHECKOPT
 
 % Copyright (C) 2011-2012, Robert Oostenveld
@@ -52,6 +59,28 @@ if nargin < 4
   emptymeaningful = 0;
 end
 
+if iscell(key)
+  % multiple keys are specified
+  if isempty(default)
+    default = cell(size(key));
+  end
+  if numel(emptymeaningful)==1
+    emptymeaningful = repmat(emptymeaningful, size(key));
+  end
+  vals = cell(size(key));
+  for i=1:numel(key)
+    vals{i} = ft_getopt(opt, key{i}, default{i}, emptymeaningful(i));
+  end
+  if nargout==numel(key) || numel(key)==1
+    [val, varargout{1:numel(key)-1}] = deal(vals{:});
+  elseif nargout<=1
+    val = vals;
+  else
+    error('the number of outputs should be equal to the number of keys');
+  end
+  return
+end
+
 if isa(opt, 'struct') || isa(opt, 'config')
   % get the key-value from the structure
   fn = fieldnames(opt);
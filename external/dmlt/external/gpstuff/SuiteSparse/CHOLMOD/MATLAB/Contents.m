@@ -1,6 +1,7 @@
 % CHOLMOD: a sparse supernodal Cholesky update/downdate package
 %
 %   cholmod2        - supernodal sparse Cholesky backslash, x = A\b
+%   cholsolve       - supernodal sparse Cholesky backslash that keeps the factorization
 %   chol2           - sparse Cholesky factorization, A=R'R.
 %   lchol           - sparse A=L*L' factorization.
 %   ldlchol         - sparse A=LDL' factorization
@@ -51,6 +51,7 @@ void mexFunction
     cm = &Common ;
     cholmod_l_start (cm) ;
     sputil_config (SPUMONI, cm) ;
+    mexAtExit (sputil_analyze_clear) ;
 
     /* convert to packed LL' when done */
     cm->final_asis = FALSE ;
@@ -96,7 +97,7 @@ void mexFunction
     /* analyze and factorize */
     /* ---------------------------------------------------------------------- */
 
-    L = cholmod_l_analyze (A, cm) ;
+    L = sputil_analyze_cached (A, cm) ;
     cholmod_l_factorize (A, L, cm) ;
 
     if (nargout < 2 && cm->status != CHOLMOD_OK)
@@ -71,6 +71,7 @@ void mexFunction
     cm = &Common ;
     cholmod_l_start (cm) ;
     sputil_config (SPUMONI, cm) ;
+    mexAtExit (sputil_analyze_clear) ;
 
     /* There is no supernodal LDL'.  If cm->final_ll = FALSE (the default), then
      * this mexFunction will use a simplicial LDL' when flops/lnz < 40, and a
@@ -217,7 +218,16 @@ void mexFunction
     /* analyze and factorize */
     /* ---------------------------------------------------------------------- */
 
-    L = cholmod_l_analyze_p (A, Perm, NULL, 0, cm) ;
+    if (Perm == NULL)
+    {
+	/* the ordering only depends on the pattern, it may have been computed
+	 * by an earlier call */
+	L = sputil_analyze_cached (A, cm) ;
+    }
+    else
+    {
+	L = cholmod_l_analyze_p (A, Perm, NULL, 0, cm) ;
+    }
     cholmod_l_free (n, sizeof (Int), Perm, cm) ;
     cholmod_l_factorize (A, L, cm) ;
 
@@ -24,7 +24,7 @@ function cholmod_make (metis_path)
 %
 % You must type the cholmod_make command while in the CHOLMOD/MATLAB directory.
 %
-% See also analyze, bisect, chol2, cholmod2, etree2, lchol, ldlchol, ldlsolve,
+% See also analyze, bisect, chol2, cholmod2, cholsolve, etree2, lchol, ldlchol, ldlsolve,
 %   ldlupdate, metis, spsym, nesdis, septree, resymbol, sdmult, sparse2,
 %   symbfact2, mread, mwrite
 
@@ -288,6 +288,7 @@ cholmod_mex_src = { ...
     'bisect', ...
     'chol2', ...
     'cholmod2', ...
+    'cholsolve', ...
     'etree2', ...
     'lchol', ...
     'ldlchol', ...
@@ -2161,3 +2161,197 @@ void sputil_sparse
     if (cm->malloc_count != k) mexErrMsgTxt ("!") ;
     */
 }
+
+
+/* ========================================================================== */
+/* === sputil_analyze_cached ================================================ */
+/* ========================================================================== */
+
+/* The ordering and symbolic analysis only depend on the pattern of A and on
+ * the ordering options in cm, not on the numerical values.  This keeps the
+ * symbolic factorization of the last SPUTIL_CACHE patterns that were analyzed
+ * by this mexFunction, so that repeated solves with the same mesh or the same
+ * covariance pattern only need the numerical factorization.  The cached
+ * factors are kept in persistent memory, they are released with
+ * sputil_analyze_clear, which the mexFunction should pass to mexAtExit. */
+
+#define SPUTIL_CACHE 4
+
+typedef struct
+{
+    unsigned long long key ;	/* hash of the pattern and of the options */
+    Int nrow, ncol, nz, stype ;
+    Int *Ap, *Ai ;		/* the pattern itself, to rule out collisions */
+    cholmod_factor *L ;		/* symbolic factor */
+    double lnz, fl ;
+    int selected ;
+} sputil_cache_entry ;
+
+static sputil_cache_entry sputil_cache [SPUTIL_CACHE] ;
+static Int sputil_cache_count = 0 ;
+static cholmod_common sputil_cache_common ;
+static int sputil_cache_started = FALSE ;
+
+/* hash along the lines of FNV-1a, per byte */
+static unsigned long long sputil_hash (const void *buf, size_t size,
+    unsigned long long hash)
+{
+    const unsigned char *ptr = (const unsigned char *) buf ;
+    size_t i ;
+    for (i = 0 ; i < size ; i++)
+    {
+	hash ^= ptr [i] ;
+	hash *= 0x100000001b3ULL ;
+    }
+    return (hash) ;
+}
+
+/* the options of cholmod_analyze that determine the symbolic factorization */
+static unsigned long long sputil_hash_options (cholmod_common *cm,
+    unsigned long long hash)
+{
+    int k, nmethods = cm->nmethods ;
+    hash = sputil_hash (&(cm->nmethods), sizeof (int), hash) ;
+    hash = sputil_hash (&(cm->postorder), sizeof (int), hash) ;
+    hash = sputil_hash (&(cm->supernodal), sizeof (int), hash) ;
+    hash = sputil_hash (&(cm->supernodal_switch), sizeof (double), hash) ;
+    hash = sputil_hash (&(cm->default_nesdis), sizeof (int), hash) ;
+    for (k = 0 ; k <= MAX (nmethods, 0) && k <= CHOLMOD_MAXMETHODS ; k++)
+    {
+	hash = sputil_hash (&(cm->method [k].ordering), sizeof (int), hash) ;
+	hash = sputil_hash (&(cm->method [k].prune_dense), sizeof (double), hash) ;
+	hash = sputil_hash (&(cm->method [k].nd_oksep), sizeof (double), hash) ;
+	hash = sputil_hash (&(cm->method [k].nd_small), sizeof (size_t), hash) ;
+	hash = sputil_hash (&(cm->method [k].aggressive), sizeof (int), hash) ;
+	hash = sputil_hash (&(cm->method [k].nd_compress), sizeof (int), hash) ;
+	hash = sputil_hash (&(cm->method [k].nd_camd), sizeof (int), hash) ;
+	hash = sputil_hash (&(cm->method [k].nd_components), sizeof (int), hash) ;
+    }
+    return (hash) ;
+}
+
+static void sputil_cache_free (sputil_cache_entry *e)
+{
+    cholmod_common *pm = &sputil_cache_common ;
+    cholmod_l_free_factor (&(e->L), pm) ;
+    cholmod_l_free (e->ncol+1, sizeof (Int), e->Ap, pm) ;
+    cholmod_l_free (e->nz, sizeof (Int), e->Ai, pm) ;
+    e->Ap = NULL ;
+    e->Ai = NULL ;
+}
+
+void sputil_analyze_clear (void)
+{
+    Int k ;
+    for (k = 0 ; k < sputil_cache_count ; k++)
+    {
+	sputil_cache_free (&sputil_cache [k]) ;
+    }
+    sputil_cache_count = 0 ;
+    if (sputil_cache_started)
+    {
+	cholmod_l_finish (&sputil_cache_common) ;
+	sputil_cache_started = FALSE ;
+    }
+}
+
+cholmod_factor *sputil_analyze_cached	/* returns the symbolic factor */
+(
+    cholmod_sparse *A,	/* matrix to analyze, as for cholmod_l_analyze */
+    cholmod_common *cm
+)
+{
+    cholmod_common *pm = &sputil_cache_common ;
+    sputil_cache_entry e, *c ;
+    cholmod_factor *L ;
+    Int *Ap, *Ai, k ;
+
+    if (!A->packed || A->nz != NULL)
+    {
+	/* only packed matrices are compared */
+	return (cholmod_l_analyze (A, cm)) ;
+    }
+
+    Ap = A->p ;
+    Ai = A->i ;
+    e.nrow = A->nrow ;
+    e.ncol = A->ncol ;
+    e.nz = Ap [A->ncol] ;
+    e.stype = A->stype ;
+    e.key = sputil_hash (&(e.nrow), sizeof (Int), 0xcbf29ce484222325ULL) ;
+    e.key = sputil_hash (&(e.stype), sizeof (Int), e.key) ;
+    e.key = sputil_hash (Ap, (e.ncol+1) * sizeof (Int), e.key) ;
+    e.key = sputil_hash (Ai, e.nz * sizeof (Int), e.key) ;
+    e.key = sputil_hash_options (cm, e.key) ;
+
+    /* look for the pattern in the cache */
+    for (k = 0 ; k < sputil_cache_count ; k++)
+    {
+	c = &sputil_cache [k] ;
+	if (c->key == e.key && c->nrow == e.nrow && c->ncol == e.ncol
+	    && c->nz == e.nz && c->stype == e.stype
+	    && memcmp (c->Ap, Ap, (e.ncol+1) * sizeof (Int)) == 0
+	    && memcmp (c->Ai, Ai, e.nz * sizeof (Int)) == 0)
+	{
+	    /* move it to the front, and return a copy in the memory of cm */
+	    e = *c ;
+	    for ( ; k > 0 ; k--)
+	    {
+		sputil_cache [k] = sputil_cache [k-1] ;
+	    }
+	    sputil_cache [0] = e ;
+	    cm->lnz = e.lnz ;
+	    cm->fl = e.fl ;
+	    cm->selected = e.selected ;
+	    return (cholmod_l_copy_factor (e.L, cm)) ;
+	}
+    }
+
+    L = cholmod_l_analyze (A, cm) ;
+    if (L == NULL)
+    {
+	return (NULL) ;
+    }
+
+    /* keep a copy of the symbolic factor, the memory of cm is released when
+     * the mexFunction returns */
+    if (!sputil_cache_started)
+    {
+	cholmod_l_start (pm) ;
+	pm->malloc_memory  = malloc ;
+	pm->free_memory    = free ;
+	pm->realloc_memory = realloc ;
+	pm->calloc_memory  = calloc ;
+	pm->print = -1 ;
+	pm->error_handler = NULL ;
+	sputil_cache_started = TRUE ;
+    }
+    e.L  = cholmod_l_copy_factor (L, pm) ;
+    e.Ap = cholmod_l_malloc (e.ncol+1, sizeof (Int), pm) ;
+    e.Ai = cholmod_l_malloc (e.nz, sizeof (Int), pm) ;
+    e.lnz = cm->lnz ;
+    e.fl = cm->fl ;
+    e.selected = cm->selected ;
+    if (e.L == NULL || e.Ap == NULL || (e.Ai == NULL && e.nz > 0))
+    {
+	/* not enough memory to keep it, which is not an error */
+	sputil_cache_free (&e) ;
+	return (L) ;
+    }
+    memcpy (e.Ap, Ap, (e.ncol+1) * sizeof (Int)) ;
+    memcpy (e.Ai, Ai, e.nz * sizeof (Int)) ;
+
+    /* the least recently used one drops out */
+    if (sputil_cache_count == SPUTIL_CACHE)
+    {
+	sputil_cache_free (&sputil_cache [SPUTIL_CACHE-1]) ;
+	sputil_cache_count-- ;
+    }
+    for (k = sputil_cache_count ; k > 0 ; k--)
+    {
+	sputil_cache [k] = sputil_cache [k-1] ;
+    }
+    sputil_cache [0] = e ;
+    sputil_cache_count++ ;
+    return (L) ;
+}
@@ -177,3 +177,11 @@ cholmod_sparse *sputil_extract_zeros
     cholmod_sparse *A,
     cholmod_common *cm
 ) ;
+
+cholmod_factor *sputil_analyze_cached	/* like cholmod_l_analyze */
+(
+    cholmod_sparse *A,
+    cholmod_common *cm
+) ;
+
+void sputil_analyze_clear (void) ;	/* for mexAtExit */
@@ -0,0 +1,315 @@
+/* ========================================================================== */
+/* === CHOLMOD/MATLAB/cholsolve mexFunction ================================= */
+/* ========================================================================== */
+
+/* -----------------------------------------------------------------------------
+ * CHOLMOD/MATLAB Module.  Copyright (C) 2005-2006, Timothy A. Davis
+ * The CHOLMOD/MATLAB Module is licensed under Version 2.0 of the GNU
+ * General Public License.  See gpl.txt for a text of the license.
+ * CHOLMOD is also available under other licenses; contact authors for details.
+ * http://www.cise.ufl.edu/research/sparse
+ * MATLAB(tm) is a Trademark of The MathWorks, Inc.
+ * -------------------------------------------------------------------------- */
+
+/* Supernodal sparse Cholesky backslash, x = A\b, that keeps the factorization
+ * of A for the next call.  This is for the forward models of FEM and BEM
+ * volume conductors, for which the same large system is solved for thousands
+ * of electrodes or sources, possibly spread over many calls.  Uses the
+ * diagonal and upper triangular part of A only.  A must be sparse and
+ * positive definite.  b can be sparse or dense.
+ *
+ * Usage:
+ *
+ *	x = cholsolve (A, b)
+ *	[x stats] = cholsolve (A, b, blocksize)
+ *	x = cholsolve ([ ], b)		% use the factorization of the last A
+ *	cholsolve ('clear')		% release the factorization
+ *
+ * If A is the same as in the previous call, the factorization is reused.  If
+ * only the values of A changed, the ordering and the symbolic analysis are
+ * reused and only the numerical factorization is done again.  The ordering
+ * is computed with METIS, or with AMD if CHOLMOD was compiled without METIS.
+ * The factorization is always supernodal LL', so that the work is done by the
+ * (multithreaded) dense BLAS of MATLAB.
+ *
+ * The columns of b are solved in blocks of blocksize columns (default 256),
+ * which bounds the workspace that is needed besides x itself.
+ *
+ * stats(1)	estimate of the reciprocal of the condition number
+ * stats(2)	ordering used:
+ *		    0: natural, 1: given, 2:amd, 3:metis, 4:nesdis, 5:colamd,
+ *		    6: natural but postordered.
+ * stats(3)	nnz(L)
+ * stats(4)	1 if the factorization was reused, 2 if only the numerical
+ *		    factorization was done, 0 if A was analyzed and factorized.
+ * stats(5)	memory usage of the factorization in MB.
+ */
+
+#include "cholmod_matlab.h"
+#include <stdlib.h>
+
+#define BLOCKSIZE 256
+
+/* the factorization is kept between calls, hence it cannot be allocated with
+ * mxMalloc, which is released by MATLAB when the mexFunction returns */
+static cholmod_common Common, *cm = NULL ;
+static cholmod_factor *L = NULL ;
+static Int Lnrow = 0, Lnzmax = 0 ;
+static unsigned long long Lpattern = 0, Lvalues = 0 ;
+
+/* hash the array along the lines of FNV-1a, per byte */
+static unsigned long long cholsolve_hash (const void *buf, size_t size,
+    unsigned long long hash)
+{
+    const unsigned char *ptr = (const unsigned char *) buf ;
+    size_t i ;
+    for (i = 0 ; i < size ; i++)
+    {
+	hash ^= ptr [i] ;
+	hash *= 0x100000001b3ULL ;
+    }
+    return (hash) ;
+}
+
+static void cholsolve_clear (void)
+{
+    if (cm != NULL)
+    {
+	cholmod_l_free_factor (&L, cm) ;
+	cholmod_l_finish (cm) ;
+	cm = NULL ;
+    }
+    sputil_analyze_clear ( ) ;
+    L = NULL ;
+    Lnrow = 0 ;
+    Lnzmax = 0 ;
+}
+
+void mexFunction
+(
+    int	nargout,
+    mxArray *pargout [ ],
+    int	nargin,
+    const mxArray *pargin [ ]
+)
+{
+    double dummy = 0, rcond, *p, *Xx ;
+    cholmod_sparse Amatrix, *A ;
+    cholmod_dense Bmatrix, Bblock, *B, *X ;
+    mxArray *Bfull = NULL ;
+    Int n, nrhs, nzmax = 0, blocksize, k, nk, i, reuse ;
+    unsigned long long pattern = 0, values = 0 ;
+
+    mexAtExit (cholsolve_clear) ;
+
+    /* ---------------------------------------------------------------------- */
+    /* release the factorization */
+    /* ---------------------------------------------------------------------- */
+
+    if (nargin == 1 && mxIsChar (pargin [0]))
+    {
+	cholsolve_clear ( ) ;
+	return ;
+    }
+
+    if (nargout > 2 || nargin < 2 || nargin > 3)
+    {
+	mexErrMsgTxt ("usage: [x,stats] = cholsolve (A,b,blocksize)") ;
+    }
+
+    /* ---------------------------------------------------------------------- */
+    /* start CHOLMOD and set parameters */
+    /* ---------------------------------------------------------------------- */
+
+    if (cm == NULL)
+    {
+	cm = &Common ;
+	cholmod_l_start (cm) ;
+	sputil_config (SPUMONI, cm) ;
+
+	/* the factorization and the workspace outlive this call */
+	cm->malloc_memory  = malloc ;
+	cm->free_memory    = free ;
+	cm->realloc_memory = realloc ;
+	cm->calloc_memory  = calloc ;
+
+	/* always a supernodal LL', the triangular solves with many right-hand
+	 * sides then also use the dense BLAS */
+	cm->final_ll = TRUE ;
+	cm->supernodal = CHOLMOD_SUPERNODAL ;
+	cm->quick_return_if_not_posdef = TRUE ;
+
+	cm->nmethods = 1 ;
+#ifndef NPARTITION
+	cm->method [0].ordering = CHOLMOD_METIS ;
+#else
+	cm->method [0].ordering = CHOLMOD_AMD ;
+#endif
+	cm->postorder = TRUE ;
+    }
+
+    /* ---------------------------------------------------------------------- */
+    /* get inputs */
+    /* ---------------------------------------------------------------------- */
+
+    n = mxGetM (pargin [1]) ;
+    nrhs = mxGetN (pargin [1]) ;
+
+    if (mxIsEmpty (pargin [0]))
+    {
+	/* use the factorization of the previous call */
+	if (L == NULL)
+	{
+	    mexErrMsgTxt ("there is no factorization of A to reuse") ;
+	}
+	if (n != Lnrow)
+	{
+	    mexErrMsgTxt ("# of rows of A and B must match") ;
+	}
+	A = NULL ;
+	reuse = 1 ;
+    }
+    else
+    {
+	if (!mxIsSparse (pargin [0]) || (mxGetM (pargin [0]) != mxGetN (pargin [0])))
+	{
+	    mexErrMsgTxt ("A must be square and sparse") ;
+	}
+	if (mxIsComplex (pargin [0]))
+	{
+	    mexErrMsgTxt ("A must be real") ;
+	}
+	if (n != mxGetM (pargin [0]))
+	{
+	    mexErrMsgTxt ("# of rows of A and B must match") ;
+	}
+
+	/* get sparse matrix A.  Use triu(A) only. */
+	A = sputil_get_sparse (pargin [0], &Amatrix, &dummy, 1) ;
+
+	/* compare A with the matrix that was factorized in the previous call */
+	nzmax = ((Int *) A->p) [A->ncol] ;
+	pattern = cholsolve_hash (A->p, (A->ncol+1) * sizeof (Int), 0xcbf29ce484222325ULL) ;
+	pattern = cholsolve_hash (A->i, nzmax * sizeof (Int), pattern) ;
+	values  = cholsolve_hash (A->x, nzmax * sizeof (double), pattern) ;
+
+	if (L != NULL && n == Lnrow && nzmax == Lnzmax && pattern == Lpattern)
+	{
+	    reuse = (values == Lvalues) ? 1 : 2 ;
+	}
+	else
+	{
+	    reuse = 0 ;
+	}
+    }
+
+    if (nargin > 2)
+    {
+	blocksize = mxGetScalar (pargin [2]) ;
+	if (blocksize < 1)
+	{
+	    mexErrMsgTxt ("invalid blocksize") ;
+	}
+    }
+    else
+    {
+	blocksize = BLOCKSIZE ;
+    }
+
+    /* get dense matrix B, a sparse B is converted to dense */
+    if (mxIsSparse (pargin [1]))
+    {
+	Bfull = sputil_sparse_to_dense (pargin [1]) ;
+	B = sputil_get_dense (Bfull, &Bmatrix, &dummy) ;
+    }
+    else
+    {
+	B = sputil_get_dense (pargin [1], &Bmatrix, &dummy) ;
+    }
+    if (B->xtype != CHOLMOD_REAL)
+    {
+	mexErrMsgTxt ("b must be real") ;
+    }
+
+    /* ---------------------------------------------------------------------- */
+    /* analyze and factorize */
+    /* ---------------------------------------------------------------------- */
+
+    if (reuse == 0)
+    {
+	cholmod_l_free_factor (&L, cm) ;
+	Lnrow = 0 ;
+	L = sputil_analyze_cached (A, cm) ;
+    }
+    if (reuse != 1)
+    {
+	cholmod_l_factorize (A, L, cm) ;
+	if (cm->status == CHOLMOD_NOT_POSDEF)
+	{
+	    cholmod_l_free_factor (&L, cm) ;
+	    Lnrow = 0 ;
+	    mexErrMsgTxt ("Matrix is not positive definite") ;
+	}
+	Lnrow   = n ;
+	Lnzmax  = nzmax ;
+	Lpattern = pattern ;
+	Lvalues = values ;
+    }
+
+    rcond = cholmod_l_rcond (L, cm) ;
+
+    if (rcond == 0)
+    {
+	mexWarnMsgTxt ("Matrix is indefinite or singular to working precision");
+    }
+    else if (rcond < DBL_EPSILON)
+    {
+	mexWarnMsgTxt ("Matrix is close to singular or badly scaled.") ;
+	mexPrintf ("         Results may be inaccurate. RCOND = %g.\n", rcond) ;
+    }
+
+    /* ---------------------------------------------------------------------- */
+    /* solve in blocks of columns and return solution to MATLAB */
+    /* ---------------------------------------------------------------------- */
+
+    pargout [0] = mxCreateDoubleMatrix (n, nrhs, mxREAL) ;
+    Xx = mxGetPr (pargout [0]) ;
+
+    Bblock = *B ;
+    for (k = 0 ; k < nrhs ; k += blocksize)
+    {
+	/* the columns of B are contiguous, the block is a view on B */
+	nk = (nrhs - k < blocksize) ? (nrhs - k) : blocksize ;
+	Bblock.ncol  = nk ;
+	Bblock.nzmax = n * nk ;
+	Bblock.x     = ((double *) B->x) + n * k ;
+
+	X = cholmod_l_solve (CHOLMOD_A, L, &Bblock, cm) ;
+	if (X == NULL)
+	{
+	    mexErrMsgTxt ("out of memory") ;
+	}
+	for (i = 0 ; i < n * nk ; i++)
+	{
+	    Xx [n * k + i] = ((double *) X->x) [i] ;
+	}
+	cholmod_l_free_dense (&X, cm) ;
+    }
+
+    if (Bfull != NULL)
+    {
+	mxDestroyArray (Bfull) ;
+    }
+
+    /* return statistics, if requested */
+    if (nargout > 1)
+    {
+	pargout [1] = mxCreateDoubleMatrix (1, 5, mxREAL) ;
+	p = mxGetPr (pargout [1]) ;
+	p [0] = rcond ;
+	p [1] = L->ordering ;
+	p [2] = cm->lnz ;
+	p [3] = reuse ;
+	p [4] = cm->memory_inuse / 1048576. ;
+    }
+}
@@ -0,0 +1,38 @@
+function [x,stats] = cholsolve (A, b, blocksize)			    %#ok
+%CHOLSOLVE supernodal sparse Cholesky backslash that keeps the factorization
+%
+%   Example:
+%   x = cholsolve (A,b)
+%   x = cholsolve ([ ],b)
+%   cholsolve ('clear')
+%
+%   Computes the supernodal LL' factorization of A(p,p), where p is a METIS
+%   ordering, then solves the sparse linear system Ax=b.  A must be sparse,
+%   symmetric, and positive definite.  Uses only the upper triangular part of
+%   A.  The factorization is kept for the next call: if A is the same it is
+%   reused, if only the values of A changed the ordering and the symbolic
+%   analysis are reused.  With an empty A the factorization of the previous
+%   call is used.  cholsolve('clear') releases it.
+%
+%   This is meant for many right-hand sides, e.g. the FEM forward solution for
+%   each of thousands of electrodes.  The columns of b are solved in blocks of
+%   256 columns, or of blocksize columns as the 3rd argument, which bounds the
+%   workspace besides x.  b can be sparse or dense, x is dense.
+%
+%   A second output, [x,stats]=cholsolve(A,b), returns statistics:
+%
+%       stats(1)    estimate of the reciprocal of the condition number
+%       stats(2)    ordering used:
+%                   0: natural, 1: given, 2:amd, 3:metis, 4:nesdis,
+%                   5:colamd, 6: natural but postordered.
+%       stats(3)    nnz(L)
+%       stats(4)    1 if the factorization was reused, 2 if only the numerical
+%                   factorization was done, 0 if A was analyzed and factorized
+%       stats(5)    memory usage in MB.
+%
+%   See also CHOLMOD2, CHOL, MLDIVIDE.
+
+%   Copyright 2006-2007, Timothy A. Davis
+%   http://www.cise.ufl.edu/research/sparse
+
+error ('cholsolve mexFunction not found') ;
@@ -81,6 +81,7 @@ void mexFunction
     cm = &Common ;
     cholmod_l_start (cm) ;
     sputil_config (SPUMONI, cm) ;
+    mexAtExit (sputil_analyze_clear) ;
 
     /* convert to packed LDL' when done */
     cm->final_asis = FALSE ;
@@ -147,7 +148,7 @@ void mexFunction
     /* analyze and factorize */
     /* ---------------------------------------------------------------------- */
 
-    L = cholmod_l_analyze (A, cm) ;
+    L = sputil_analyze_cached (A, cm) ;
     cholmod_l_factorize_p (A, beta, NULL, 0, L, cm) ;
 
     if (nargout < 2 && cm->status != CHOLMOD_OK)
@@ -27,6 +27,69 @@
 #include "matrix.h"
 #define max(a,b) (((a) > (b)) ? (a) : (b))
 
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <pthread.h>
+#include <unistd.h>
+#define DIST_THREADS
+#endif
+
+#define DIST_MAXTHREADS 16
+#define DIST_BLOCK      1024  /* number of rows for which the distances are accumulated together */
+#define DIST_MINSIZE    256   /* number of inputs below which a single thread is used */
+
+typedef struct {
+  const double *x;      /* inputs, m x number of columns */
+  const mwIndex *col;   /* the column of x for each of the n terms */
+  const double *den;    /* the squared length-scale for each of the n terms */
+  const int *delta;     /* whether each of the n terms is a delta distance */
+  mwSize m, n;
+  double *C;
+  mwIndex begin, end;   /* the columns that are computed by this thread */
+} dist_t;
+
+/*
+ * Compute the distances between input j and the inputs k<j for the columns begin
+ * to end. The terms are accumulated one at a time, for blocks of
+ * inputs that remain in the cache.
+ */
+static void *dist_columns(void *arg) {
+  dist_t *s = (dist_t *)arg;
+  mwIndex i, j, k, kb, ke;
+  mwSize m = s->m;
+  const double *xi;
+  double xj, d, den, *c;
+  
+  for (j=s->begin;j<s->end;j++) {
+    c = s->C + j*m;
+    for (kb=0;kb<j;kb+=DIST_BLOCK) {
+      ke = (kb+DIST_BLOCK<j) ? kb+DIST_BLOCK : j;
+      for (i=0;i<s->n;i++) {
+	xi  = s->x + m*s->col[i];
+	xj  = xi[j];
+	den = s->den[i];
+	if (s->delta[i]) {
+	  for (k=kb;k<ke;k++) {
+	    d = xj-xi[k];
+	    c[k] += (d!=0) ? (1/den) : 0;
+	  }
+	}else{
+	  for (k=kb;k<ke;k++) {
+	    d = xj-xi[k];
+	    c[k] += d*d/den;
+	  }
+	}
+      }
+    }
+    for (k=0;k<j;k++) {
+      d=sqrt(c[k]);
+      c[k]=d;
+      s->C[j+k*m]=d;
+    }
+    c[j]=0;
+  }
+  return NULL;
+}
+
 void mexFunction(const int nlhs, mxArray *plhs[],
 		 const int nrhs, const mxArray *prhs[])
 {
@@ -38,14 +101,24 @@ void mexFunction(const int nlhs, mxArray *plhs[],
     mexErrMsgTxt( "Wrong number of input arguments." );
   
   {
-    double *x, *l, *C, rr, d, *cc;
+    double *x, *l, *C, rr, *cc;
     const mwSize *dims;
     mxLogical *deltad;
     char *type;
-    mwIndex i, j, k, i2;
+    mwIndex i, i2;
     mwSize m, n, ncomp, lr;
     mxArray *field;
     const mxArray *components, *components_element;
+    dist_t s, part[DIST_MAXTHREADS];
+    mwIndex *col;
+    double *den;
+    int *delta, t, nthreads = 1;
+    mwSize nterm;
+#ifdef DIST_THREADS
+    pthread_t thread[DIST_MAXTHREADS];
+    int started[DIST_MAXTHREADS];
+    long ncpu;
+#endif
     
     dims = mxGetDimensions(prhs[1]);
     x = mxGetPr(prhs[1]);
@@ -89,37 +162,71 @@ void mexFunction(const int nlhs, mxArray *plhs[],
 	mexErrMsgTxt( "metric.logical must be of the same length as the number of components." );
       deltad = (mxLogical *)mxGetData(field);      
 
-      /* evaluate the distance */
-      plhs[0]=mxCreateDoubleMatrix(m, m, mxREAL);
-      C = mxGetPr(plhs[0]);
+      /* the terms of the distance, in the order of the components */
+      nterm = 0;
+      for (i=0;i<ncomp;i++) {
+	components_element = mxGetCell(components, i);
+	dims = mxGetDimensions(components_element);
+	nterm += max(dims[0],dims[1]);
+      }
+      col   = mxCalloc(nterm>0 ? nterm : 1, sizeof(mwIndex));
+      den   = mxCalloc(nterm>0 ? nterm : 1, sizeof(double));
+      delta = mxCalloc(nterm>0 ? nterm : 1, sizeof(int));
+      nterm = 0;
       for (i=0;i<ncomp;i++) {
 	rr=(lr>1)?(l[i]*l[i]):(l[0]*l[0]);
 	components_element = mxGetCell(components, i);
 	dims = mxGetDimensions(components_element);
 	cc = mxGetPr(components_element);
-	/*printf("hep l[%d]= %.2f \n", i, rr);*/
 	for (i2=0;i2<max(dims[0],dims[1]);i2++) {
-	  /*printf("cc[%d] = %d \n", i2, (mwIndex)cc[i2]);*/	  
-	  for (j=0;j<m;j++) {
-	    for (k=0;k<j;k++) {
-	      d=x[j+m*((mwIndex)cc[i2]-1)]-x[k+m*((mwIndex)cc[i2]-1)];
-	      if (deltad[i]==true){
-		C[j*m+k]+=(d!=0)?(1/rr):(0); 
-	      }else{ 
-		C[j*m+k]+=d*d/rr; 
-	      }
-	    }
-	  }
+	  col[nterm]   = (mwIndex)cc[i2]-1;
+	  den[nterm]   = rr;
+	  delta[nterm] = (deltad[i]==true);
+	  nterm++;
 	}
       }
-      for (j=0;j<m;j++) {
-	for (k=0;k<j;k++) {
-	  d=sqrt(C[j*m+k]);
-	  C[j*m+k]=d;
-	  C[j+k*m]=d;
+      
+      /* evaluate the distance */
+      plhs[0]=mxCreateDoubleMatrix(m, m, mxREAL);
+      C = mxGetPr(plhs[0]);
+      s.x     = x;
+      s.col   = col;
+      s.den   = den;
+      s.delta = delta;
+      s.m     = m;
+      s.n     = nterm;
+      s.C     = C;
+      
+      /* the columns are divided such that each thread has approximately the same number of pairs */
+#ifdef DIST_THREADS
+      if (m>=DIST_MINSIZE) {
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	nthreads = (ncpu>DIST_MAXTHREADS) ? DIST_MAXTHREADS : ((ncpu<1) ? 1 : (int)ncpu);
+      }
+#endif
+      for (t=0;t<nthreads;t++) {
+	part[t] = s;
+	part[t].begin = (mwIndex)(m*sqrt((double)t/nthreads));
+	part[t].end   = (t==nthreads-1) ? m : (mwIndex)(m*sqrt((double)(t+1)/nthreads));
+      }
+#ifdef DIST_THREADS
+      if (nthreads>1) {
+	for (t=0;t<nthreads;t++)
+	  started[t] = (pthread_create(&thread[t], NULL, dist_columns, &part[t])==0);
+	for (t=0;t<nthreads;t++) {
+	  if (started[t])
+	    pthread_join(thread[t], NULL);
+	  else
+	    dist_columns(&part[t]);
 	}
-	C[j*(m+1)]=0;
       }
+#endif
+      if (nthreads==1)
+	dist_columns(&part[0]);
+      
+      mxFree(col);
+      mxFree(den);
+      mxFree(delta);
     }
     else{
       mexErrMsgTxt( "Wrong type of metric." );
@@ -8,6 +8,15 @@
  * Here i1 is to row that is modified in the matrix K = LDL. LD is the
  * LDL Cholesky factorisation of K and C is the added/removed row of K.
  *
+ * i1 can also be a vector with the indices of a block of rows, in which
+ * case column c of C is the row i1(c) that is added, e.g. C = K(:,i1).
+ * The rows are added or removed in the order of i1, which gives the same
+ * factorization as calling ldlrowupdate for each of the rows. When adding,
+ * the elements of C in the rows i1(c+1:end) are skipped, these rows are
+ * not yet part of the factorization and follow from the later columns.
+ * The factorization is copied into CHOLMOD and back only once for the
+ * whole block.
+ *
  * See Davis and Hager 2005 (Row Modification of a sparse Cholesky 
  * factorization) section 4 for details of the algorithm.
  */
@@ -40,11 +49,11 @@ void mexFunction
     const mxArray *pargin [ ]
 )
 {
-    int ki;
-    double dummy = 0 ;
+    Int ki, nk, c, p, Rcol [2], *Rp, *Ri, *Ri2 = NULL, *pending = NULL ;
+    double dummy = 0, *kx, *Rx, *Rx2 = NULL ;
     double *Lx, *Lx2 ;
     Int *Li, *Lp, *Li2, *Lp2, *Lnz2, *ColCount ;
-    cholmod_sparse Cmatrix, *R, *Lsparse ;
+    cholmod_sparse Cmatrix, Rcolumn, *R, *Lsparse ;
     cholmod_factor *L ;
     cholmod_common Common, *cm ;
     Int j, k, s, update, n, lnz ;
@@ -100,10 +109,21 @@ void mexFunction
     }
 
     /* ---------------------------------------------------------------------- */
-    /* get ki: column integer of update */
+    /* get ki: column integers of update */
     /* ---------------------------------------------------------------------- */
-    ki = (int) *mxGetPr(pargin[0]);
-    ki = ki-1;
+    nk = mxGetNumberOfElements (pargin [0]) ;
+    kx = mxGetPr (pargin [0]) ;
+    for (c = 0 ; c < nk ; c++)
+    {
+	if (kx [c] < 1 || kx [c] > n)
+	{
+	    mexErrMsgTxt ("ldlrowupdate: row index out of range") ;
+	}
+    }
+    if (update && k != nk)
+    {
+	mexErrMsgTxt ("ldlrowupdate: R must have a column for each row index") ;
+    }
 
     /* ---------------------------------------------------------------------- */
     /* get R: sparse matrix of incoming/outgoing columns */
@@ -158,22 +178,68 @@ void mexFunction
     /* ---------------------------------------------------------------------- */
     /* update/downdate the LDL' factorization */
     /* ---------------------------------------------------------------------- */
-    /* add row */
-    if (update){
-      if (!cholmod_l_rowadd (ki, R, L, cm))
+    /* column c of R is passed to CHOLMOD as a sparse vector of its own,
+     * without the rows that are added later on */
+    Rcolumn = *R ;
+    Rcolumn.ncol = 1 ;
+    Rcolumn.packed = TRUE ;
+    Rcolumn.p = Rcol ;
+    Rcolumn.nzmax = (n > 0) ? n : 1 ;
+    Rcol [0] = 0 ;
+    if (update)
+    {
+	Rp = (Int *) R->p ;
+	Ri = (Int *) R->i ;
+	Rx = (double *) R->x ;
+	Ri2 = (Int *) mxCalloc (Rcolumn.nzmax, sizeof (Int)) ;
+	Rx2 = (double *) mxCalloc (Rcolumn.nzmax, sizeof (double)) ;
+	pending = (Int *) mxCalloc (Rcolumn.nzmax, sizeof (Int)) ;
+	for (c = 0 ; c < nk ; c++)
 	{
-	  mexErrMsgTxt ("rowadd failed\n") ;
+	    pending [(Int) kx [c] - 1]++ ;
 	}
+	Rcolumn.i = Ri2 ;
+	Rcolumn.x = Rx2 ;
     }
-    /* delete row */
-    else {
-      if (!cholmod_l_rowdel (ki, NULL, L, cm))
+
+    for (c = 0 ; c < nk ; c++)
+    {
+      ki = (Int) kx [c] - 1 ;
+      /* add row */
+      if (update){
+	pending [ki]-- ;
+	Rcol [1] = 0 ;
+	for (p = Rp [c] ; p < Rp [c+1] ; p++)
 	{
-	  mexErrMsgTxt ("rowdel failed\n") ;
+	    if (Ri [p] == ki || !pending [Ri [p]])
+	    {
+		Ri2 [Rcol [1]] = Ri [p] ;
+		Rx2 [Rcol [1]] = Rx [p] ;
+		Rcol [1]++ ;
+	    }
 	}
+	if (!cholmod_l_rowadd (ki, &Rcolumn, L, cm))
+	  {
+	    mexErrMsgTxt ("rowadd failed\n") ;
+	  }
+      }
+      /* delete row */
+      else {
+	if (!cholmod_l_rowdel (ki, NULL, L, cm))
+	  {
+	    mexErrMsgTxt ("rowdel failed\n") ;
+	  }
+      }
     }
       
 
+    if (update)
+    {
+	mxFree (Ri2) ;
+	mxFree (Rx2) ;
+	mxFree (pending) ;
+    }
+
     /* ---------------------------------------------------------------------- */
     /* copy the results back to MATLAB */
     /* ---------------------------------------------------------------------- */
@@ -29,6 +29,203 @@
 #define PI (3.141592653589793)
 void cumsum2(mwIndex *p, mwIndex *c, mwIndex n);
 
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <pthread.h>
+#include <unistd.h>
+#define TRCOV_THREADS
+#endif
+
+#define TRCOV_MAXTHREADS 16
+#define TRCOV_BLOCK      1024  /* number of rows for which the distances are accumulated together */
+#define TRCOV_MINSIZE    256   /* number of inputs below which a single thread is used */
+
+enum { TRCOV_SEXP, TRCOV_EXP, TRCOV_MATERN32, TRCOV_MATERN52, TRCOV_RQ, TRCOV_PPCS };
+
+typedef struct {
+  const double *x;      /* inputs, m x number of columns */
+  const mwIndex *col;   /* the column of x for each of the n variables */
+  const double *den;    /* the denominator of the squared distance for each of the n variables */
+  mwSize m, n;
+  int type;
+  double lms, ms, eps, alpha, c1, c2, c3, D2;
+  int ppcs;             /* order of the piece wise polynomial covariance */
+  double *C;            /* dense covariance matrix */
+  mwIndex *It, *Jt;     /* sparse covariance matrix of this thread, as triplets of the upper triangle */
+  double *Ct;
+  mwSize nnz, ind;
+  int failed;
+  mwIndex begin, end;   /* the columns that are computed by this thread */
+} trcov_t;
+
+/*
+ * Compute the squared distances between input j and the inputs k<j. The distances
+ * are accumulated over the variables one at a time, for blocks of
+ * inputs that remain in the cache. The inner loop is contiguous and has no
+ * branches, so that it can be vectorized.
+ */
+static void trcov_dist(const trcov_t *s, mwIndex j, double *c) {
+  mwIndex i, k, kb, ke;
+  const double *xi;
+  double xj, d, den;
+  
+  for (kb=0;kb<j;kb+=TRCOV_BLOCK) {
+    ke = (kb+TRCOV_BLOCK<j) ? kb+TRCOV_BLOCK : j;
+    for (k=kb;k<ke;k++)
+      c[k] = 0.0;
+    for (i=0;i<s->n;i++) {
+      xi  = s->x + s->m*s->col[i];
+      xj  = xi[j];
+      den = s->den[i];
+      for (k=kb;k<ke;k++) {
+        d = xj-xi[k];
+        c[k] += d*d/den;
+      }
+    }
+  }
+}
+
+/* compute the dense covariance for the columns begin to end */
+static void *trcov_dense(void *arg) {
+  trcov_t *s = (trcov_t *)arg;
+  mwIndex j, k;
+  mwSize m = s->m;
+  double *C = s->C, c, d;
+  
+  for (j=s->begin;j<s->end;j++) {
+    trcov_dist(s, j, C+j*m);
+    for (k=0;k<j;k++) {
+      switch (s->type) {
+        case TRCOV_SEXP:
+          d=exp(s->lms-C[j*m+k]/2.0);
+          break;
+        case TRCOV_EXP:
+          d=exp(s->lms-sqrt(C[j*m+k]));
+          break;
+        case TRCOV_MATERN32:
+          c = sqrt(3.0*C[j*m+k]);
+          d=(1+c)*exp(s->lms-c);
+          break;
+        case TRCOV_MATERN52:
+          c = sqrt(5.0*C[j*m+k]);
+          d=(1+c+5.0*C[j*m+k]/3.0)*exp(s->lms-c);
+          break;
+        default:
+          d=s->ms*pow((C[j*m+k]+1),-s->alpha);
+          break;
+      }
+      d=(d>s->eps) ? d : 0;
+      C[j*m+k]=d;
+      C[j+k*m]=d;
+    }
+    C[j*(m+1)]=s->ms;
+  }
+  return NULL;
+}
+
+/* compute the upper triangle of the sparse covariance for the columns begin to end */
+static void *trcov_sparse(void *arg) {
+  trcov_t *s = (trcov_t *)arg;
+  mwIndex j, k;
+  double *c, d;
+  void *p1, *p2, *p3;
+  
+  s->ind = 0;
+  s->nnz = (s->end>s->begin) ? 4*(s->end-s->begin) : 1;
+  s->It  = malloc(s->nnz*sizeof(mwIndex));
+  s->Jt  = malloc(s->nnz*sizeof(mwIndex));
+  s->Ct  = malloc(s->nnz*sizeof(double));
+  c      = malloc(s->m*sizeof(double));
+  if (!s->It || !s->Jt || !s->Ct || !c) {
+    s->failed = 1;
+    free(c);
+    return NULL;
+  }
+  
+  for (j=s->begin;j<s->end;j++) {
+    trcov_dist(s, j, c);
+    for (k=0;k<j;k++) {
+      if (c[k]<1.0){   /* store the covariance */
+        if (s->ind==s->nnz){ /* allocate more memory */
+          s->nnz=(mwSize)2*s->nnz;
+          p1 = realloc(s->It, s->nnz*sizeof(mwIndex));
+          p2 = realloc(s->Jt, s->nnz*sizeof(mwIndex));
+          p3 = realloc(s->Ct, s->nnz*sizeof(double));
+          if (p1) s->It = p1;
+          if (p2) s->Jt = p2;
+          if (p3) s->Ct = p3;
+          if (!p1 || !p2 || !p3) {
+            s->failed = 1;
+            free(c);
+            return NULL;
+          }
+        }
+        switch (s->ppcs) {
+          case 0:
+            d = s->ms*pow(1.0-sqrt(c[k]), s->D2);
+            break;
+          case 1:
+            d = s->c1*sqrt(c[k]) + 1.0;
+            d = s->ms*pow(1.0-sqrt(c[k]), s->D2)*d;
+            break;
+          case 2:
+            d = s->c1*c[k] + s->c2*sqrt(c[k]) + 3.0;
+            d = s->ms*pow(1.0-sqrt(c[k]), s->D2)*d/3.0;
+            break;
+          default:
+            d = s->c1*c[k]*sqrt(c[k]) + s->c2*c[k] + s->c3*sqrt(c[k]) + 15.0;
+            d = s->ms*pow(1.0-sqrt(c[k]), s->D2)*d/15.0;
+            break;
+        }
+        s->It[s->ind] = k;
+        s->Jt[s->ind] = j;
+        s->Ct[s->ind] = d;
+        s->ind++;
+      }
+    }
+  }
+  free(c);
+  return NULL;
+}
+
+/*
+ * Compute the covariance, the columns are divided over multiple threads such that
+ * each thread has approximately the same number of pairs of inputs.
+ */
+static int trcov_run(trcov_t *s, void *(*fun)(void *), trcov_t *part) {
+  int t, nthreads = 1;
+#ifdef TRCOV_THREADS
+  pthread_t thread[TRCOV_MAXTHREADS];
+  int started[TRCOV_MAXTHREADS];
+  long ncpu;
+  
+  if (s->m>=TRCOV_MINSIZE) {
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = (ncpu>TRCOV_MAXTHREADS) ? TRCOV_MAXTHREADS : ((ncpu<1) ? 1 : (int)ncpu);
+  }
+#endif
+  for (t=0;t<nthreads;t++) {
+    part[t] = *s;
+    part[t].failed = 0;
+    part[t].begin  = (mwIndex)(s->m*sqrt((double)t/nthreads));
+    part[t].end    = (t==nthreads-1) ? s->m : (mwIndex)(s->m*sqrt((double)(t+1)/nthreads));
+  }
+#ifdef TRCOV_THREADS
+  if (nthreads>1) {
+    for (t=0;t<nthreads;t++)
+      started[t] = (pthread_create(&thread[t], NULL, fun, &part[t])==0);
+    for (t=0;t<nthreads;t++) {
+      if (started[t])
+        pthread_join(thread[t], NULL);
+      else
+        fun(&part[t]);
+    }
+    return nthreads;
+  }
+#endif
+  fun(&part[0]);
+  return nthreads;
+}
+
 void mexFunction(const int nlhs, mxArray *plhs[],
         const int nrhs, const mxArray *prhs[]) {
   
@@ -39,14 +236,18 @@ void mexFunction(const int nlhs, mxArray *plhs[],
     mexErrMsgTxt( "Wrong number of input arguments." );
   
   {
-    double *x, lms, ms, *l, rr, *rr2, *C, d, eps, c, *Ct, c1, c2, c3, D, D2;
-    double percent_sparse, alpha, *period, decay, *cc, *s_sexp, pp, *s_sexp2;
+    double *x, lms, ms, *l, rr, *C, d, eps, *Ct, D;
+    double alpha, *period, decay, *cc, *s_sexp, pp, *s_sexp2;
     const mwSize *dims;
     const mxArray *selectedVariables;
     char *type;
     mwIndex i, j, k, ind, *I, *J, *It, *Jt, *Jc, *w2, *w;
     mwSize m, n, nnz, lr, pr;
     mxArray *field;
+    trcov_t s, part[TRCOV_MAXTHREADS];
+    mwIndex *col;
+    double *den;
+    int t, nthreads, failed;
     
     dims = mxGetDimensions(prhs[1]);
     x = mxGetPr(prhs[1]);
@@ -87,145 +288,59 @@ void mexFunction(const int nlhs, mxArray *plhs[],
       mexErrMsgTxt( "gpcf.type must be a string." );
     type = mxArrayToString(field);
     
-    /*
-     * squared exponential covariance
-     */
-    if( strcmp( type, "gpcf_sexp" ) == 0 ) {
-      plhs[0]=mxCreateDoubleMatrix(m, m, mxREAL);
-      C = mxGetPr(plhs[0]);
-      eps=mxGetEps();
-      
-      for (i=0;i<n;i++) {
-        rr=(lr>1)?(l[i]*l[i]):(l[0]*l[0]);   
-        for (j=0;j<m;j++) {
-          for (k=0;k<j;k++) {
-            if(cc!=NULL) {
-              d=x[j+m*((mwIndex)cc[i]-1)]-x[k+m*((mwIndex)cc[i]-1)];
-            }else{
-              d=x[j]-x[k];
-            }
-            C[j*m+k]+=d*d/rr/2.0;
-          }
-        }
-        if(cc==NULL)
-          x+=m;
-      }
-      for (j=0;j<m;j++) {
-        for (k=0;k<j;k++) {
-          d=exp(lms-C[j*m+k]);
-          d=(d>eps) ? d : 0;
-          C[j*m+k]=d;
-          C[j+k*m]=d;
-        }
-        C[j*(m+1)]=ms;
-      }
+    /* the variables that are used */
+    col = mxCalloc(n>0 ? n : 1, sizeof(mwIndex));
+    den = mxCalloc(n>0 ? n : 1, sizeof(double));
+    for (i=0;i<n;i++) {
+      col[i] = (cc!=NULL) ? (mwIndex)cc[i]-1 : i;
+      den[i] = (lr>1)?(l[i]*l[i]):(l[0]*l[0]);
     }
+    s.x   = x;
+    s.col = col;
+    s.den = den;
+    s.m   = m;
+    s.n   = n;
+    s.lms = lms;
+    s.ms  = ms;
+    s.eps = mxGetEps();
+    
     /*
-     * exponential covariance
+     * squared exponential, exponential, matern nu = 3/2 and 5/2,
+     * and rational quadratic covariance
      */
-    else if(strcmp( type, "gpcf_exp" ) == 0 ){
-      plhs[0]=mxCreateDoubleMatrix(m, m, mxREAL);
-      C = mxGetPr(plhs[0]);
-      eps=mxGetEps();
-      
-      for (i=0;i<n;i++) {
-        rr=(lr>1)?(l[i]*l[i]):(l[0]*l[0]);
-        for (j=0;j<m;j++) {
-          for (k=0;k<j;k++) {
-            if(cc!=NULL) {
-              d=x[j+m*((mwIndex)cc[i]-1)]-x[k+m*((mwIndex)cc[i]-1)];
-            }else{
-              d=x[j]-x[k];
-            }
-            C[j*m+k]+=d*d/rr;
-          }
-        }
-        if (cc==NULL)
-          x+=m;
-      }
-      
-      for (j=0;j<m;j++) {
-        for (k=0;k<j;k++) {
-          d=exp(lms-sqrt(C[j*m+k]));
-          d=(d>eps) ? d : 0;
-          C[j*m+k]=d;
-          C[j+k*m]=d;
-        }
-        C[j*(m+1)]=ms;
+    if( strcmp( type, "gpcf_sexp" ) == 0 ||
+        strcmp( type, "gpcf_exp" ) == 0 ||
+        strcmp( type, "gpcf_matern32" ) == 0 ||
+        strcmp( type, "gpcf_matern52" ) == 0 ||
+        strcmp( type, "gpcf_rq" ) == 0 ) {
+      if( strcmp( type, "gpcf_sexp" ) == 0 )
+        s.type = TRCOV_SEXP;
+      else if( strcmp( type, "gpcf_exp" ) == 0 )
+        s.type = TRCOV_EXP;
+      else if( strcmp( type, "gpcf_matern32" ) == 0 )
+        s.type = TRCOV_MATERN32;
+      else if( strcmp( type, "gpcf_matern52" ) == 0 )
+        s.type = TRCOV_MATERN52;
+      else {
+        if((field=mxGetField(*prhs, 0, "alpha"))==NULL)
+          mexErrMsgTxt("Could not get gpcf.alpha");
+        alpha = mxGetScalar(field);
+        s.type  = TRCOV_RQ;
+        s.alpha = alpha;
+        for (i=0;i<n;i++)
+          den[i] *= 2.0*alpha;
       }
-    }
-    /*
-     * matern nu = 3/2 covariance
-     */
-    else if(strcmp( type, "gpcf_matern32" ) == 0 ){
       plhs[0]=mxCreateDoubleMatrix(m, m, mxREAL);
-      C = mxGetPr(plhs[0]);
-      eps=mxGetEps();
-      
-      for (i=0;i<n;i++) {
-        rr=(lr>1)?(l[i]*l[i]):(l[0]*l[0]);
-        for (j=0;j<m;j++) {
-          for (k=0;k<j;k++) {
-            if(cc!=NULL) {
-              d=x[j+m*((mwIndex)cc[i]-1)]-x[k+m*((mwIndex)cc[i]-1)];
-            }else{
-              d=x[j]-x[k];
-            }
-            C[j*m+k]+=d*d/rr;
-          }
-        }
-        if(cc==NULL)
-          x+=m;
-      }
-      for (j=0;j<m;j++) {
-        for (k=0;k<j;k++) {
-          c = sqrt(3.0*C[j*m+k]);
-          d=(1+c)*exp(lms-c);
-          d=(d>eps) ? d : 0;
-          C[j*m+k]=d;
-          C[j+k*m]=d;
-        }
-        C[j*(m+1)]=ms;
-      }
-    }
-    /*
-     * matern nu = 5/2 covariance
-     */
-    else if(strcmp( type, "gpcf_matern52" ) == 0 ){
-      plhs[0]=mxCreateDoubleMatrix(m, m, mxREAL);
-      C = mxGetPr(plhs[0]);
-      eps=mxGetEps();
-      
-      for (i=0;i<n;i++) {
-        rr=(lr>1)?(l[i]*l[i]):(l[0]*l[0]);
-        for (j=0;j<m;j++) {
-          for (k=0;k<j;k++) {
-            if(cc!=NULL) {
-              d=x[j+m*((mwIndex)cc[i]-1)]-x[k+m*((mwIndex)cc[i]-1)];
-            }else{
-              d=x[j]-x[k];
-            }
-            C[j*m+k]+=d*d/rr;
-          }
-        }
-        if(cc==NULL)
-          x+=m;
-      }
-      for (j=0;j<m;j++) {
-        for (k=0;k<j;k++) {
-          c = sqrt(5.0*C[j*m+k]);
-          d=(1+c+5.0*C[j*m+k]/3.0)*exp(lms-c);
-          d=(d>eps) ? d : 0;
-          C[j*m+k]=d;
-          C[j+k*m]=d;
-        }
-        C[j*(m+1)]=ms;
-      }
+      s.C = mxGetPr(plhs[0]);
+      trcov_run(&s, trcov_dense, part);
     }
     /*
-     * piece wise polynomial 0 covariance
+     * piece wise polynomial 0, 1, 2 and 3 covariance
      */
-    else if(strcmp( type, "gpcf_ppcs0" ) == 0 ){
+    else if( strcmp( type, "gpcf_ppcs0" ) == 0 ||
+             strcmp( type, "gpcf_ppcs1" ) == 0 ||
+             strcmp( type, "gpcf_ppcs2" ) == 0 ||
+             strcmp( type, "gpcf_ppcs3" ) == 0 ) {
       if((field=mxGetField(*prhs, 0, "l"))==NULL)
         mexErrMsgTxt("Could not get gpcf.l");
       dims = mxGetDimensions(field);
@@ -233,375 +348,57 @@ void mexFunction(const int nlhs, mxArray *plhs[],
         mexErrMsgTxt( "gpcf.l must be a scalar." );
       D = mxGetScalar(field);
       
-      percent_sparse = 0.05;
-      nnz = (mwSize) max(1, floor(percent_sparse*(double)m*(double)m));
-      It = mxCalloc(nnz, sizeof(mwIndex));
-      Jt = mxCalloc(nnz, sizeof(mwIndex));
-      Ct = mxCalloc(nnz, sizeof(double));
-      ind = 0;
-      
-      /* Set the length-scales in vector of length of number of inputs */
-      rr2 = mxCalloc(n, sizeof(double));
-      for (i=0;i<n;i++) {
-        rr2[i]=(lr>1)?(l[i]*l[i]):(l[0]*l[0]);
+      s.type = TRCOV_PPCS;
+      s.ppcs = type[9]-'0';
+      switch (s.ppcs) {
+        case 0:
+          s.D2 = D;
+          break;
+        case 1:
+          s.c1 = D + 1;
+          s.D2 = D+1.0;
+          break;
+        case 2:
+          s.c1 = D*D + 4.0*D + 3.0;
+          s.c2 = 3.0*D + 6.0;
+          s.D2 = D+2.0;
+          break;
+        default:
+          s.c1 = D*D*D + 9.0*D*D + 23.0*D + 15.0;
+          s.c2 = 6.0*D*D + 36.0*D + 45.0;
+          s.c3 = 15.0*D + 45.0;
+          s.D2 = D+3.0;
+          break;
       }
       
       /* Evaluate the distances that are less than one,
        * and evaluate the covariance at them.
        * This is strictly upper triangular matrix */
-      D2 = D;
-      for (j=0;j<m;j++) {
-        for (k=0;k!=j;k++) {
-          c = 0.0;
-          for (i=0;i<n;i++) {
-            if(cc!=NULL) {
-              d=x[j+m*((mwIndex)cc[i]-1)]-x[k+m*((mwIndex)cc[i]-1)];
-            }else{
-              d=x[j+i*m]-x[k+i*m];
-            }
-            c+=d*d/rr2[i];
-          }
-          if (c<1.0){   /* store the covariance */
-            if (ind==nnz){ /* allocate more memory */
-              nnz=(mwSize)2*nnz;
-              It = mxRealloc(It, nnz*sizeof(mwIndex));
-              Jt = mxRealloc(Jt, nnz*sizeof(mwIndex));
-              Ct = mxRealloc(Ct, nnz*sizeof(double));
-            }
-            d = ms*pow(1.0-sqrt(c), D2);
-            It[ind] = k;
-            Jt[ind] = j;
-            Ct[ind] = d;
-            ind++;
-          }
-        }
-      }
-      
-      /* resize the vectors */
-      It = mxRealloc(It, (mwSize)ind*sizeof(mwIndex));
-      Jt = mxRealloc(Jt, (mwSize)ind*sizeof(mwIndex));
-      Ct = mxRealloc(Ct, (mwSize)ind*sizeof(double));
+      nthreads = trcov_run(&s, trcov_sparse, part);
       
-      /* evaluate the row and column counts */
-      w = mxCalloc(m, sizeof(mwIndex));              /* workspace */
-      w2 = mxCalloc(m, sizeof(mwIndex));             /* workspace */
-      for (k=0;k<ind;k++) w[It[k]]++;               /* row counts of the upper triangular */
-      for (k=0;k<ind;k++) w2[Jt[k]]++;              /* column counts of the upper triangular */
-      for (k=0;k<m;k++) w[k] += w2[k] + (mwIndex)1; /* column counts of the covariance matrix */
-      Jc = mxCalloc(m+(mwSize)1, sizeof(mwIndex));
-      cumsum2(Jc, w2, m);                           /* column starting points of the upper triangle */
-      
-      /* Create sparse matrix. Note! The matrix can contain only real numbers  */
-      nnz = (mwSize)2*(mwSize)ind+m;
-      plhs[0] = mxCreateSparse(m, m, nnz, mxREAL);
-      I = mxGetIr(plhs[0]);
-      J = mxGetJc(plhs[0]);
-      C = mxGetPr(plhs[0]);
-      
-      /* Set the elements in the sparse matrix */
-      cumsum2(J, w, m);                      /* column starting points */
-      for (j = 0 ; j < m ; j++){             /* fill the upper triangular */
-        for (k = Jc[j] ; k != Jc[j+1] ; k++){
-          I[i = w[j]++] = It[k] ;
-          if (C) C[i] = Ct[k] ;
-        }
-      }
-      for (j = 0 ; j < m ; j++){             /* fill the diagonal */
-        I[i = w[j]++] = j ;
-        if (C) C[i] = ms;
-      }
-      for (j = 0 ; j < m ; j++){             /* fill the lower triangular */
-        for (k = Jc[j] ; k != Jc[j+1] ; k++){
-          I[i = w[ It[k]]++] = j ;
-          if (C) C[i] = Ct[k] ;
-        }
-      }
-      
-      mxFree(It);
-      mxFree(Jt);
-      mxFree(Jc);
-      mxFree(Ct);
-      mxFree(rr2);
-      mxFree(w);
-      mxFree(w2);
-      
-    }
-    /*
-     * piece wise polynomial 1 covariance
-     */
-    else if(strcmp( type, "gpcf_ppcs1" ) == 0 ){
-      if((field=mxGetField(*prhs, 0, "l"))==NULL)
-        mexErrMsgTxt("Could not get gpcf.l");
-      dims = mxGetDimensions(field);
-      if (dims[0]!=1 || dims[1]!=1)
-        mexErrMsgTxt( "gpcf.l must be a scalar." );
-      D = mxGetScalar(field);
-      
-      percent_sparse = 0.05;
-      nnz = (mwSize) max(1, floor(percent_sparse*(double)m*(double)m));
-      It = mxCalloc(nnz, sizeof(mwIndex));
-      Jt = mxCalloc(nnz, sizeof(mwIndex));
-      Ct = mxCalloc(nnz, sizeof(double));
-      ind = 0;
-      
-      /* Set the length-scales in vector of length of number of inputs */
-      rr2 = mxCalloc(n, sizeof(double));
-      for (i=0;i<n;i++) {
-        rr2[i]=(lr>1)?(l[i]*l[i]):(l[0]*l[0]);
-      }
-      
-      /* Evaluate the distances that are less than one,
-       * and evaluate the covariance at them.
-       * This is strictly upper triangular matrix */
-      c1 = D + 1;
-      D2 = D+1.0;
-      for (j=0;j<m;j++) {
-        for (k=0;k!=j;k++) {
-          c = 0.0;
-          for (i=0;i<n;i++) {
-            if(cc!=NULL) {
-              d=x[j+m*((mwIndex)cc[i]-1)]-x[k+m*((mwIndex)cc[i]-1)];
-            }else{
-              d=x[j+i*m]-x[k+i*m];
-            }
-            c+=d*d/rr2[i];
-          }
-          if (c<1.0){   /* store the covariance */
-            if (ind==nnz){ /* allocate more memory */
-              nnz=(mwSize)2*nnz;
-              It = mxRealloc(It, nnz*sizeof(mwIndex));
-              Jt = mxRealloc(Jt, nnz*sizeof(mwIndex));
-              Ct = mxRealloc(Ct, nnz*sizeof(double));
-            }
-            d = c1*sqrt(c) + 1.0;
-            d = ms*pow(1.0-sqrt(c), D2)*d;
-            It[ind] = k;
-            Jt[ind] = j;
-            Ct[ind] = d;
-            ind++;
-          }
-        }
-      }
-      
-      /* resize the vectors */
-      It = mxRealloc(It, (mwSize)ind*sizeof(mwIndex));
-      Jt = mxRealloc(Jt, (mwSize)ind*sizeof(mwIndex));
-      Ct = mxRealloc(Ct, (mwSize)ind*sizeof(double));
-      
-      /* evaluate the row and column counts */
-      w = mxCalloc(m, sizeof(mwIndex));              /* workspace */
-      w2 = mxCalloc(m, sizeof(mwIndex));             /* workspace */
-      for (k=0;k<ind;k++) w[It[k]]++;               /* row counts of the upper triangular */
-      for (k=0;k<ind;k++) w2[Jt[k]]++;              /* column counts of the upper triangular */
-      for (k=0;k<m;k++) w[k] += w2[k] + (mwIndex)1; /* column counts of the covariance matrix */
-      Jc = mxCalloc(m+(mwSize)1, sizeof(mwIndex));
-      cumsum2(Jc, w2, m);                           /* column starting points of the upper triangle */
-      
-      /* Create sparse matrix. Note! The matrix can contain only real numbers  */
-      nnz = (mwSize)2*(mwSize)ind+m;
-      plhs[0] = mxCreateSparse(m, m, nnz, mxREAL);
-      I = mxGetIr(plhs[0]);
-      J = mxGetJc(plhs[0]);
-      C = mxGetPr(plhs[0]);
-      
-      /* Set the elements in the sparse matrix */
-      cumsum2(J, w, m);                      /* column starting points */
-      for (j = 0 ; j < m ; j++){             /* fill the upper triangular */
-        for (k = Jc[j] ; k != Jc[j+1] ; k++){
-          I[i = w[j]++] = It[k] ;
-          if (C) C[i] = Ct[k] ;
-        }
-      }
-      for (j = 0 ; j < m ; j++){             /* fill the diagonal */
-        I[i = w[j]++] = j ;
-        if (C) C[i] = ms;
-      }
-      for (j = 0 ; j < m ; j++){             /* fill the lower triangular */
-        for (k = Jc[j] ; k != Jc[j+1] ; k++){
-          I[i = w[ It[k]]++] = j ;
-          if (C) C[i] = Ct[k] ;
-        }
-      }
-      
-      mxFree(It);
-      mxFree(Jt);
-      mxFree(Jc);
-      mxFree(Ct);
-      mxFree(rr2);
-      mxFree(w);
-      mxFree(w2);
-      
-    }
-    /*
-     * piece wise polynomial 2 covariance
-     */
-    else if(strcmp( type, "gpcf_ppcs2" ) == 0 ){
-      if((field=mxGetField(*prhs, 0, "l"))==NULL)
-        mexErrMsgTxt("Could not get gpcf.l");
-      dims = mxGetDimensions(field);
-      if (dims[0]!=1 || dims[1]!=1)
-        mexErrMsgTxt( "gpcf.l must be a scalar." );
-      D = mxGetScalar(field);
-      
-      percent_sparse = 0.05;
-      nnz = (mwSize) max(1, floor(percent_sparse*(double)m*(double)m));
-      It = mxCalloc(nnz, sizeof(mwIndex));
-      Jt = mxCalloc(nnz, sizeof(mwIndex));
-      Ct = mxCalloc(nnz, sizeof(double));
+      /* combine the parts in the order of the columns */
       ind = 0;
-      
-      /* Set the length-scales in vector of length of number of inputs */
-      rr2 = mxCalloc(n, sizeof(double));
-      for (i=0;i<n;i++) {
-        rr2[i]=(lr>1)?(l[i]*l[i]):(l[0]*l[0]);
-      }
-      
-      /* Evaluate the distances that are less than one,
-       * and evaluate the covariance at them.
-       * This is strictly upper triangular matrix */
-      c1 = D*D + 4.0*D + 3.0;
-      c2 = 3.0*D + 6.0;
-      D2 = D+2.0;
-      for (j=0;j<m;j++) {
-        for (k=0;k!=j;k++) {
-          c = 0.0;
-          for (i=0;i<n;i++) {
-            if(cc!=NULL) {
-              d=x[j+m*((mwIndex)cc[i]-1)]-x[k+m*((mwIndex)cc[i]-1)];
-            }else{
-              d=x[j+i*m]-x[k+i*m];
-            }
-            c+=d*d/rr2[i];
-          }
-          if (c<1.0){   /* store the covariance */
-            if (ind==nnz){ /* allocate more memory */
-              nnz=(mwSize)2*nnz;
-              It = mxRealloc(It, nnz*sizeof(mwIndex));
-              Jt = mxRealloc(Jt, nnz*sizeof(mwIndex));
-              Ct = mxRealloc(Ct, nnz*sizeof(double));
-            }
-            d = c1*c + c2*sqrt(c) + 3.0;
-            d = ms*pow(1.0-sqrt(c), D2)*d/3.0;
-            It[ind] = k;
-            Jt[ind] = j;
-            Ct[ind] = d;
-            ind++;
-          }
-        }
-      }
-      
-      /* resize the vectors */
-      It = mxRealloc(It, (mwSize)ind*sizeof(mwIndex));
-      Jt = mxRealloc(Jt, (mwSize)ind*sizeof(mwIndex));
-      Ct = mxRealloc(Ct, (mwSize)ind*sizeof(double));
-      
-      /* evaluate the row and column counts */
-      w = mxCalloc(m, sizeof(mwIndex));              /* workspace */
-      w2 = mxCalloc(m, sizeof(mwIndex));             /* workspace */
-      for (k=0;k<ind;k++) w[It[k]]++;               /* row counts of the upper triangular */
-      for (k=0;k<ind;k++) w2[Jt[k]]++;              /* column counts of the upper triangular */
-      for (k=0;k<m;k++) w[k] += w2[k] + (mwIndex)1; /* column counts of the covariance matrix */
-      Jc = mxCalloc(m+(mwSize)1, sizeof(mwIndex));
-      cumsum2(Jc, w2, m);                           /* column starting points of the upper triangle */
-      
-      /* Create sparse matrix. Note! The matrix can contain only real numbers  */
-      nnz = (mwSize)2*(mwSize)ind+m;
-      plhs[0] = mxCreateSparse(m, m, nnz, mxREAL);
-      I = mxGetIr(plhs[0]);
-      J = mxGetJc(plhs[0]);
-      C = mxGetPr(plhs[0]);
-      
-      /* Set the elements in the sparse matrix */
-      cumsum2(J, w, m);                      /* column starting points */
-      for (j = 0 ; j < m ; j++){             /* fill the upper triangular */
-        for (k = Jc[j] ; k != Jc[j+1] ; k++){
-          I[i = w[j]++] = It[k] ;
-          if (C) C[i] = Ct[k] ;
-        }
-      }
-      for (j = 0 ; j < m ; j++){             /* fill the diagonal */
-        I[i = w[j]++] = j ;
-        if (C) C[i] = ms;
-      }
-      for (j = 0 ; j < m ; j++){             /* fill the lower triangular */
-        for (k = Jc[j] ; k != Jc[j+1] ; k++){
-          I[i = w[ It[k]]++] = j ;
-          if (C) C[i] = Ct[k] ;
-        }
-      }
-      
-      mxFree(It);
-      mxFree(Jt);
-      mxFree(Jc);
-      mxFree(Ct);
-      mxFree(rr2);
-      mxFree(w);
-      mxFree(w2);
-      
-    }
-    /*
-     * piece wise polynomial 3 covariance
-     */
-    else if(strcmp( type, "gpcf_ppcs3" ) == 0 ){
-      if((field=mxGetField(*prhs, 0, "l"))==NULL)
-        mexErrMsgTxt("Could not get gpcf.l");
-      dims = mxGetDimensions(field);
-      if (dims[0]!=1 || dims[1]!=1)
-        mexErrMsgTxt( "gpcf.l must be a scalar." );
-      D = mxGetScalar(field);
-      
-      percent_sparse = 0.05;
-      nnz = (mwSize) max(1, floor(percent_sparse*(double)m*(double)m));
-      It = mxCalloc(nnz, sizeof(mwIndex));
-      Jt = mxCalloc(nnz, sizeof(mwIndex));
-      Ct = mxCalloc(nnz, sizeof(double));
+      for (t=0;t<nthreads;t++)
+        ind += part[t].ind;
+      It = mxCalloc(ind>0 ? ind : 1, sizeof(mwIndex));
+      Jt = mxCalloc(ind>0 ? ind : 1, sizeof(mwIndex));
+      Ct = mxCalloc(ind>0 ? ind : 1, sizeof(double));
+      failed = 0;
       ind = 0;
-      
-      /* Set the length-scales in vector of length of number of inputs */
-      rr2 = mxCalloc(n, sizeof(double));
-      for (i=0;i<n;i++) {
-        rr2[i]=(lr>1)?(l[i]*l[i]):(l[0]*l[0]);
-      }
-      
-      /* Evaluate the distances that are less than one,
-       * and evaluate the covariance at them.
-       * This is strictly upper triangular matrix */
-      c1 = D*D*D + 9.0*D*D + 23.0*D + 15.0;
-      c2 = 6.0*D*D + 36.0*D + 45.0;
-      c3 = 15.0*D + 45.0;
-      D2 = D+3.0;
-      for (j=0;j<m;j++) {
-        for (k=0;k!=j;k++) {
-          c = 0.0;
-          for (i=0;i<n;i++) {
-            if(cc!=NULL) {
-              d=x[j+m*((mwIndex)cc[i]-1)]-x[k+m*((mwIndex)cc[i]-1)];
-            }else{
-              d=x[j+i*m]-x[k+i*m];
-            }
-            c+=d*d/rr2[i];
-          }
-          if (c<1.0){   /* store the covariance */
-            if (ind==nnz){ /* allocate more memory */
-              nnz=(mwSize)2*nnz;
-              It = mxRealloc(It, nnz*sizeof(mwIndex));
-              Jt = mxRealloc(Jt, nnz*sizeof(mwIndex));
-              Ct = mxRealloc(Ct, nnz*sizeof(double));
-            }
-            d = c1*c*sqrt(c) + c2*c + c3*sqrt(c) + 15.0;
-            d = ms*pow(1.0-sqrt(c), D2)*d/15.0;
-            It[ind] = k;
-            Jt[ind] = j;
-            Ct[ind] = d;
-            ind++;
-          }
+      for (t=0;t<nthreads;t++) {
+        failed |= part[t].failed;
+        if (!part[t].failed) {
+          memcpy(It+ind, part[t].It, part[t].ind*sizeof(mwIndex));
+          memcpy(Jt+ind, part[t].Jt, part[t].ind*sizeof(mwIndex));
+          memcpy(Ct+ind, part[t].Ct, part[t].ind*sizeof(double));
+          ind += part[t].ind;
         }
+        free(part[t].It);
+        free(part[t].Jt);
+        free(part[t].Ct);
       }
-      
-      /* resize the vectors */
-      It = mxRealloc(It, (mwSize)ind*sizeof(mwIndex));
-      Jt = mxRealloc(Jt, (mwSize)ind*sizeof(mwIndex));
-      Ct = mxRealloc(Ct, (mwSize)ind*sizeof(double));
+      if (failed)
+        mexErrMsgTxt("Could not allocate memory for the sparse covariance matrix.");
       
       /* evaluate the row and column counts */
       w = mxCalloc(m, sizeof(mwIndex));              /* workspace */
@@ -642,47 +439,10 @@ void mexFunction(const int nlhs, mxArray *plhs[],
       mxFree(Jt);
       mxFree(Jc);
       mxFree(Ct);
-      mxFree(rr2);
       mxFree(w);
       mxFree(w2);
       
     }
-    /*
-     * Rational quadratic covariance
-     */
-    else if( strcmp( type, "gpcf_rq" ) == 0 ) {
-      if((field=mxGetField(*prhs, 0, "alpha"))==NULL)
-        mexErrMsgTxt("Could not get gpcf.alpha");
-      alpha = mxGetScalar(field);
-      dims = mxGetDimensions(field);
-      plhs[0]=mxCreateDoubleMatrix(m, m, mxREAL);
-      C = mxGetPr(plhs[0]);
-      eps=mxGetEps();
-      for (i=0;i<n;i++) {
-        rr=(lr>1)?(l[i]*l[i]):(l[0]*l[0]);    
-        for (j=0;j<m;j++) {
-          for (k=0;k<j;k++) {
-            if(cc!=NULL) {
-              d=x[j+m*((mwIndex)cc[i]-1)]-x[k+m*((mwIndex)cc[i]-1)];
-            }else{
-            d=x[j]-x[k];
-            }
-            C[j*m+k]+=d*d/(2.0*alpha*rr);
-          }
-        }
-        if(cc==NULL)
-          x+=m;
-      }
-      for (j=0;j<m;j++) {
-        for (k=0;k<j;k++) {
-          d=ms*pow((C[j*m+k]+1),-alpha);
-          d=(d>eps) ? d : 0;
-          C[j*m+k]=d;
-          C[j+k*m]=d;
-        }
-        C[j*(m+1)]=ms;
-      }
-    }
     /*
      * Periodic covariance
      */
@@ -744,6 +504,8 @@ void mexFunction(const int nlhs, mxArray *plhs[],
     else{
       mexErrMsgTxt( "Undefined type of covariance function." );
     }
+    mxFree(col);
+    mxFree(den);
   }
     return;
 }
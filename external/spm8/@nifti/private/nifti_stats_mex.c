@@ -4,13 +4,32 @@ static char svnid[] = "$Id$";
 /* 
  * This is a Matlab mex interface for Bob Cox's extensive nifti_stats.c
  * functionality.  See nifti_stats.m for documentation.
+ *
+ * The t, F, chi-squared and normal distributions are also implemented here,
+ * without the static variables of the cdflib code in nifti_stats.c, so that
+ * large arrays can be converted with multiple threads.  The constants that
+ * only depend on the degrees of freedom are computed once per call.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include "mex.h"
 
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <pthread.h>
+#include <unistd.h>
+#define STATS_THREADS
+#endif
+
+#define STATS_MAXTHREADS 16
+#define STATS_MINSIZE    16384      /* number of elements per thread */
+#define STATS_MAXITER    100000
+#define STATS_EPS        1.0e-16
+#define STATS_TINY       1.0e-300
+#define BIGG             9.99e+37   /* as in nifti_stats.c */
+
 #include "nifti1.h"
 extern int     nifti_intent_code( char *name );
 extern double     nifti_stat2cdf( double val, int code, double p1,double p2,double p3 );
@@ -20,12 +39,241 @@ extern double     nifti_cdf2stat( double val, int code, double p1,double p2,doub
 extern double  nifti_stat2zscore( double val, int code, double p1,double p2,double p3 );
 extern double nifti_stat2hzscore( double val, int code, double p1,double p2,double p3 );
 
+typedef struct { double p,q; } stats_pq;
+
+typedef struct
+{
+   const double *val;
+   double *p;
+   size_t begin, end;   /* the elements that are computed by this thread */
+   int code, opt;       /* opt is one of the letters of the options */
+   double p1, p2;
+   double a, b, lbeta;  /* the constants of the incomplete beta or gamma function */
+} stats_t;
+
+/* continued fraction for the incomplete beta function, see Numerical Recipes */
+static double stats_betacf(double a, double b, double x)
+{
+   double c=1.0, d, h, aa, del, m2;
+   int m;
+
+   d = 1.0-(a+b)*x/(a+1.0);
+   if (fabs(d)<STATS_TINY) d = STATS_TINY;
+   d = 1.0/d;
+   h = d;
+   for (m=1; m<=STATS_MAXITER; m++)
+   {
+      m2 = 2.0*m;
+      aa = m*(b-m)*x/((a+m2-1.0)*(a+m2));
+      d  = 1.0+aa*d; if (fabs(d)<STATS_TINY) d = STATS_TINY;
+      c  = 1.0+aa/c; if (fabs(c)<STATS_TINY) c = STATS_TINY;
+      d  = 1.0/d;
+      h *= d*c;
+      aa = -(a+m)*(a+b+m)*x/((a+m2)*(a+m2+1.0));
+      d  = 1.0+aa*d; if (fabs(d)<STATS_TINY) d = STATS_TINY;
+      c  = 1.0+aa/c; if (fabs(c)<STATS_TINY) c = STATS_TINY;
+      d  = 1.0/d;
+      del = d*c;
+      h  *= del;
+      if (fabs(del-1.0)<STATS_EPS) break;
+   }
+   return h;
+}
+
+/* regularized incomplete beta function I_x(a,b), with y = 1-x given separately to keep the precision of small y */
+static stats_pq stats_betainc(double x, double y, double a, double b, double lbeta)
+{
+   stats_pq pq;
+   double front;
+
+   if (x<=0.0) { pq.p = 0.0; pq.q = 1.0; return pq; }
+   if (y<=0.0) { pq.p = 1.0; pq.q = 0.0; return pq; }
+   front = exp(a*log(x) + b*log(y) - lbeta);
+   if (x < (a+1.0)/(a+b+2.0))
+   {
+      pq.p = front*stats_betacf(a, b, x)/a;
+      pq.q = 1.0-pq.p;
+   }
+   else
+   {
+      pq.q = front*stats_betacf(b, a, y)/b;
+      pq.p = 1.0-pq.q;
+   }
+   return pq;
+}
+
+/* regularized incomplete gamma function P(a,x), lgam = lgamma(a) */
+static stats_pq stats_gammainc(double x, double a, double lgam)
+{
+   stats_pq pq;
+   double sum, del, ap, b, c, d, h, an;
+   int i;
+
+   if (x<=0.0) { pq.p = 0.0; pq.q = 1.0; return pq; }
+   if (x < a+1.0)
+   {
+      /* series */
+      ap  = a;
+      sum = del = 1.0/a;
+      for (i=1; i<=STATS_MAXITER; i++)
+      {
+         ap  += 1.0;
+         del *= x/ap;
+         sum += del;
+         if (fabs(del)<fabs(sum)*STATS_EPS) break;
+      }
+      pq.p = sum*exp(-x + a*log(x) - lgam);
+      pq.q = 1.0-pq.p;
+   }
+   else
+   {
+      /* continued fraction */
+      b = x+1.0-a;
+      c = 1.0/STATS_TINY;
+      d = 1.0/b;
+      h = d;
+      for (i=1; i<=STATS_MAXITER; i++)
+      {
+         an = -i*(i-a);
+         b += 2.0;
+         d  = an*d+b; if (fabs(d)<STATS_TINY) d = STATS_TINY;
+         c  = b+an/c; if (fabs(c)<STATS_TINY) c = STATS_TINY;
+         d  = 1.0/d;
+         del = d*c;
+         h  *= del;
+         if (fabs(del-1.0)<STATS_EPS) break;
+      }
+      pq.q = exp(-x + a*log(x) - lgam)*h;
+      pq.p = 1.0-pq.q;
+   }
+   return pq;
+}
+
+/* inverse of the standard normal cdf, algorithm AS241 (Wichura, 1988) */
+static double stats_norminv(stats_pq pq)
+{
+   double q, r, z;
+
+   if (pq.p<=0.0) return -BIGG;
+   if (pq.q<=0.0) return  BIGG;
+   q = pq.p-0.5;
+   if (fabs(q)<=0.425)
+   {
+      r = 0.180625-q*q;
+      return q*(((((((r*2509.0809287301226727+33430.575583588128105)*r+67265.770927008700853)*r
+         +45921.953931549871457)*r+13731.693765509461125)*r+1971.5909503065514427)*r+133.14166789178437745)*r
+         +3.387132872796366608)/(((((((r*5226.495278852545925+28729.085735721942674)*r+39307.89580009271061)*r
+         +21213.794301586595867)*r+5394.1960214247511077)*r+687.1870074920579083)*r+42.313330701600911252)*r+1.0);
+   }
+   r = sqrt(-log(q<0.0 ? pq.p : pq.q));
+   if (r<=5.0)
+   {
+      r -= 1.6;
+      z = (((((((r*7.7454501427834140764e-4+0.0227238449892691845833)*r+0.24178072517745061177)*r
+         +1.27045825245236838258)*r+3.64784832476320460504)*r+5.7694972214606914055)*r+4.6303378461565452959)*r
+         +1.42343711074968357734)/(((((((r*1.05075007164441684324e-9+5.475938084995344946e-4)*r
+         +0.0151986665636164571966)*r+0.14810397642748007459)*r+0.68976733498510000455)*r+1.6763848301838038494)*r
+         +2.05319162663775882187)*r+1.0);
+   }
+   else
+   {
+      r -= 5.0;
+      z = (((((((r*2.01033439929228813265e-7+2.71155556874348757815e-5)*r+0.0012426609473880784386)*r
+         +0.026532189526576123093)*r+0.29656057182850489123)*r+1.7848265399172913358)*r+5.4637849111641143699)*r
+         +6.6579046435011037772)/(((((((r*2.04426310338993978564e-15+1.4215117583164458887e-7)*r
+         +1.8463183175100546818e-5)*r+7.868691311456132591e-4)*r+0.0148753612908506148525)*r
+         +0.13692988092273580531)*r+0.59983220655588793769)*r+1.0);
+   }
+   return (q<0.0 ? -z : z);
+}
+
+/* the cdf and 1-cdf of the distributions that have a fast path */
+static stats_pq stats_s2pq(const stats_t *s, double val)
+{
+   stats_pq pq = {0.0, 1.0};
+   double x, y;
+
+   switch (s->code)
+   {
+      case NIFTI_INTENT_TTEST:
+         if (s->p1<=0.0) break;
+         x  = s->p1/(s->p1+val*val);
+         y  = val*val/(s->p1+val*val);
+         pq = stats_betainc(x, y, s->a, s->b, s->lbeta);
+         /* pq.p is now the two-sided tail */
+         x  = 0.5*pq.p;
+         if (val>0.0) { pq.p = 1.0-x; pq.q = x; }
+         else         { pq.p = x; pq.q = 1.0-x; }
+         break;
+      case NIFTI_INTENT_FTEST:
+         if (val<=0.0 || s->p1<=0.0 || s->p2<=0.0) break;
+         x  = s->p1*val/(s->p1*val+s->p2);
+         y  = s->p2/(s->p1*val+s->p2);
+         pq = stats_betainc(x, y, s->a, s->b, s->lbeta);
+         break;
+      case NIFTI_INTENT_CHISQ:
+         if (val<=0.0 || s->p1<=0.0) break;
+         pq = stats_gammainc(0.5*val, s->a, s->lbeta);
+         break;
+      case NIFTI_INTENT_ZSCORE:
+         pq.p = 0.5*erfc(-val/sqrt(2.0));
+         pq.q = 0.5*erfc( val/sqrt(2.0));
+         break;
+      case NIFTI_INTENT_NORMAL:
+         if (s->p2<=0.0) break;
+         pq.p = 0.5*erfc(-(val-s->p1)/(s->p2*sqrt(2.0)));
+         pq.q = 0.5*erfc( (val-s->p1)/(s->p2*sqrt(2.0)));
+         break;
+   }
+   return pq;
+}
+
+static void *stats_part(void *arg)
+{
+   const stats_t *s = (const stats_t *)arg;
+   stats_pq pq;
+   size_t i;
+
+   for (i=s->begin; i<s->end; i++)
+   {
+      switch (s->opt)
+      {
+         case 'p':
+            s->p[i] = stats_s2pq(s, s->val[i]).p;
+            break;
+         case 'q':
+            s->p[i] = stats_s2pq(s, s->val[i]).q;
+            break;
+         case 'd':
+            s->p[i] = 1000.0*(stats_s2pq(s, s->val[i]+.001).p - stats_s2pq(s, s->val[i]).p);
+            break;
+         case 'z':
+            if (s->code==NIFTI_INTENT_ZSCORE)
+               s->p[i] = s->val[i];
+            else if (s->code==NIFTI_INTENT_NORMAL)
+               s->p[i] = (s->val[i]-s->p1)/s->p2;
+            else
+               s->p[i] = stats_norminv(stats_s2pq(s, s->val[i]));
+            break;
+         case 'h':
+            /* 0.5*q instead of 0.5*(1-p) keeps the precision in the upper tail */
+            pq   = stats_s2pq(s, s->val[i]);
+            pq.p = 0.5*(1.0+pq.p); pq.q = 0.5*pq.q;
+            s->p[i] = stats_norminv(pq);
+            break;
+      }
+   }
+   return NULL;
+}
+
 void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 {
    double *val, *p, p1=0.0,p2=0.0,p3=0.0 ;
    int code=5, dop=1, doq=0, dod=0, doi=0, doz=0, doh=0 ;
-   int ndim, i, n;
-   const int *dim;
+   int ndim, t, nthreads=1;
+   size_t i, n;
+   const mwSize *dim;
+   stats_t s;
 
    if (nlhs>1) mexErrMsgTxt("Too many output arguments.");
    if (nrhs<1) mexErrMsgTxt("Not enough input arguments.");
@@ -36,10 +284,8 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
       mexErrMsgTxt("Wrong datatype for 1st argument.");
    ndim = mxGetNumberOfDimensions(prhs[0]);
    dim  = mxGetDimensions(prhs[0]);
-   n    = 1;
-   for(i=0,n=1; i<ndim; i++)
-      n = n*dim[i];
-   val = mxGetPr(prhs[0]);
+   n    = mxGetNumberOfElements(prhs[0]);
+   val  = mxGetPr(prhs[0]);
 
    /* CODE */
    if (nrhs>=2)
@@ -103,6 +349,71 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
    plhs[0] = mxCreateNumericArray(ndim,dim,mxDOUBLE_CLASS,mxREAL);
    p       = mxGetData(plhs[0]);
 
+   if (!doi && (code==NIFTI_INTENT_TTEST || code==NIFTI_INTENT_FTEST || code==NIFTI_INTENT_CHISQ
+             || code==NIFTI_INTENT_ZSCORE || code==NIFTI_INTENT_NORMAL))
+   {
+      /* the fast path, the constants are computed here and not for every element */
+      s.val   = val;
+      s.p     = p;
+      s.code  = code;
+      s.opt   = dop ? 'p' : doq ? 'q' : dod ? 'd' : doz ? 'z' : 'h';
+      s.p1    = p1;
+      s.p2    = p2;
+      s.a     = s.b = 1.0;
+      s.lbeta = 0.0;
+      if (code==NIFTI_INTENT_TTEST && p1>0.0)
+      {
+         s.a = 0.5*p1; s.b = 0.5;
+         s.lbeta = lgamma(s.a)+lgamma(s.b)-lgamma(s.a+s.b);
+      }
+      else if (code==NIFTI_INTENT_FTEST && p1>0.0 && p2>0.0)
+      {
+         s.a = 0.5*p1; s.b = 0.5*p2;
+         s.lbeta = lgamma(s.a)+lgamma(s.b)-lgamma(s.a+s.b);
+      }
+      else if (code==NIFTI_INTENT_CHISQ && p1>0.0)
+      {
+         s.a = 0.5*p1;
+         s.lbeta = lgamma(s.a);
+      }
+      s.begin = 0;
+      s.end   = n;
+
+#ifdef STATS_THREADS
+      if (n>=2*STATS_MINSIZE)
+      {
+         long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+         nthreads = (ncpu>STATS_MAXTHREADS ? STATS_MAXTHREADS : (ncpu<1 ? 1 : (int)ncpu));
+         if ((size_t)nthreads > n/STATS_MINSIZE)
+            nthreads = (int)(n/STATS_MINSIZE);
+      }
+      if (nthreads>1)
+      {
+         pthread_t thread[STATS_MAXTHREADS];
+         stats_t part[STATS_MAXTHREADS];
+         int started[STATS_MAXTHREADS];
+
+         for (t=0; t<nthreads; t++)
+         {
+            part[t]       = s;
+            part[t].begin = (n*t)/nthreads;
+            part[t].end   = (n*(t+1))/nthreads;
+            started[t]    = (pthread_create(&thread[t], NULL, stats_part, &part[t])==0);
+         }
+         for (t=0; t<nthreads; t++)
+         {
+            if (started[t])
+               pthread_join(thread[t], NULL);
+            else
+               stats_part(&part[t]);
+         }
+      }
+#endif
+      if (nthreads==1)
+         stats_part(&s);
+      return;
+   }
+
    /* Call Bob's code */
    for(i=0; i<n; i++)
    {
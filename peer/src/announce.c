@@ -32,6 +32,11 @@
    only wants to use multiple peers on a single computer, an additional
    localhost packet is sent which communicates the presence of multiple
    peers to each other.
+
+   The full host details are only announced when the strings in them
+   change, after ANNOUNCEREFRESH, or when a new peer joined. Otherwise
+   a compact update with the numbers is announced, which refers to the
+   strings of the last full announcement by their hash, see discover.c
  */
 
 #define USE_MULTICAST
@@ -126,6 +131,7 @@ void *announce(void *arg) {
 				/* this should be done while the mutexhost and the mutexpeerlist are unlocked */
 				smartmem_update();
 				smartcpu_update();
+				smartgpu_update();
 
 				/* send the UDP packet with the host information */
 				announce_once();
@@ -144,10 +150,34 @@ cleanup:
 }
 
 
+/* the hash of the strings in the host details, the compact updates only carry the numbers */
+UINT64_T announce_hash(const hostdef_t *def) {
+		UINT64_T h = def->port;
+		h = 31*h + argcache_hash(def->name,          strnlen(def->name,          STRLEN));
+		h = 31*h + argcache_hash(def->user,          strnlen(def->user,          STRLEN));
+		h = 31*h + argcache_hash(def->group,         strnlen(def->group,         STRLEN));
+		h = 31*h + argcache_hash(def->socket,        strnlen(def->socket,        STRLEN));
+		h = 31*h + argcache_hash(def->current.name,  strnlen(def->current.name,  STRLEN));
+		h = 31*h + argcache_hash(def->current.user,  strnlen(def->current.user,  STRLEN));
+		h = 31*h + argcache_hash(def->current.group, strnlen(def->current.group, STRLEN));
+		return h;
+}
+
+/* the next announcement contains the full host details, e.g. for a peer that just joined */
+void announce_refresh(void) {
+		pthread_mutex_lock(&mutexannounce);
+		announcement.refreshed = 0;
+		pthread_mutex_unlock(&mutexannounce);
+}
+
 int announce_once(void) {
-		int fd = 0;
+		int fd = 0, usetracker, full;
 		struct sockaddr_in multicastAddr, localhostAddr;
 		hostdef_t *message = NULL;
+		hostupdate_t update;
+		UINT64_T strhash;
+		void *packet;
+		size_t packetsize;
 		unsigned char ttl = 3;
 
 		/* create what looks like an ordinary UDP socket */
@@ -176,6 +206,45 @@ int announce_once(void) {
 
 		pthread_mutex_unlock(&mutexhost);
 
+		strhash = announce_hash(message);
+
+		pthread_mutex_lock(&mutexannounce);
+		full  = (strhash!=announcement.strhash);
+		full  = full || (walltime() - announcement.refreshed >= ANNOUNCEREFRESH);
+		if (full) {
+				announcement.strhash   = strhash;
+				announcement.refreshed = walltime();
+		}
+		announcement.sequence++;
+		update.sequence = announcement.sequence;
+		pthread_mutex_unlock(&mutexannounce);
+
+		if (full) {
+				packet     = message;
+				packetsize = sizeof(hostdef_t);
+		}
+		else {
+				update.version  = message->version;
+				update.id       = message->id;
+				update.status   = message->status;
+				update.strhash  = strhash;
+				update.timavail = message->timavail;
+				update.memavail = message->memavail;
+				update.cpuavail = message->cpuavail;
+				update.hostid   = message->current.hostid;
+				update.jobid    = message->current.jobid;
+				update.timreq   = message->current.timreq;
+				update.memreq   = message->current.memreq;
+				update.cpureq   = message->current.cpureq;
+				update.backlog  = message->backlog;
+				update.queued   = message->queued;
+				update.gpuavail    = message->gpuavail;
+				update.gpumemavail = message->gpumemavail;
+				update.gpuload     = message->gpuload;
+				packet     = &update;
+				packetsize = sizeof(hostupdate_t);
+		}
+
 		/*  the TTL (time to live/hop count) for the send can be
 		 *  ----------------------------------------------------------------------
 		 *  0      Restricted to the same host. Won't be output by any interface.
@@ -191,6 +260,14 @@ int announce_once(void) {
 				DEBUG(LOG_ERR, "error: announce_once setsockopt");
 		}
 
+		/* the peers that report to a tracker do not multicast */
+		pthread_mutex_lock(&mutextrackerlist);
+		usetracker = (trackerlist!=NULL);
+		pthread_mutex_unlock(&mutextrackerlist);
+
+		if (usetracker)
+				tracker_announce(fd, message);
+
 #ifdef USE_MULTICAST
 		/* set up destination address for multicast announce packet */
 		memset(&multicastAddr,0,sizeof(multicastAddr));
@@ -198,7 +275,7 @@ int announce_once(void) {
 		multicastAddr.sin_addr.s_addr = inet_addr(ANNOUNCE_GROUP);
 		multicastAddr.sin_port        = htons(ANNOUNCE_PORT);
 
-		if (sendto(fd,message,sizeof(hostdef_t),0,(struct sockaddr *) &multicastAddr,sizeof(multicastAddr)) < 0) {
+		if (!usetracker && sendto(fd,packet,packetsize,0,(struct sockaddr *) &multicastAddr,sizeof(multicastAddr)) < 0) {
 				perror("announce_once sendto (multicast)");
 				DEBUG(LOG_ERR, "error: announce_once sendto (multicast)");
 				goto cleanup;
@@ -212,7 +289,7 @@ int announce_once(void) {
 		localhostAddr.sin_addr.s_addr = inet_addr("127.0.0.1");
 		localhostAddr.sin_port        = htons(ANNOUNCE_PORT);
 
-		if (sendto(fd,message,sizeof(hostdef_t),0,(struct sockaddr *) &localhostAddr,sizeof(localhostAddr)) < 0) {
+		if (sendto(fd,packet,packetsize,0,(struct sockaddr *) &localhostAddr,sizeof(localhostAddr)) < 0) {
 				perror("announce_once sendto (localhost)");
 				DEBUG(LOG_ERR, "error: announce_once sendto (localhost)");
 				goto cleanup;
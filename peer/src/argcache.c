@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/
+ *
+ */
+
+/*
+ * The slaves keep the serialized arguments of the jobs that they executed,
+ * up to the size that is specified with --cache. The master sends a hash of
+ * the serialized arguments along with the job, and if the slave has the same
+ * arguments in its cache it replies with HANDSHAKE_CACHED after the jobdef,
+ * in which case the arguments are not sent again. This is for parameter
+ * sweeps where only the options differ between the jobs. The results of the
+ * jobs that were put with 'keep' are kept in the same cache, see chain.c.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "peer.h"
+#include "extern.h"
+#include "platform_includes.h"
+
+/* hash the buffer along the lines of FNV-1a, but per 64-bit word to keep up with the network */
+UINT64_T argcache_hash(const void *buf, UINT32_T size) {
+		UINT64_T hash = 0xcbf29ce484222325ULL ^ size, word;
+		const unsigned char *ptr = (const unsigned char *)buf;
+		UINT32_T i;
+
+		for (i=0; i+sizeof(UINT64_T)<=size; i+=sizeof(UINT64_T)) {
+				memcpy(&word, ptr+i, sizeof(UINT64_T));
+				hash ^= word;
+				hash *= 0x100000001b3ULL;
+				hash ^= hash >> 29;
+		}
+		for (; i<size; i++) {
+				hash ^= ptr[i];
+				hash *= 0x100000001b3ULL;
+		}
+
+		/* zero means that the arguments are not to be cached */
+		return (hash ? hash : 1);
+}
+
+/* this returns a copy of the cached arguments, or NULL if they are not in the cache */
+void *argcache_lookup(UINT64_T hash, UINT32_T size) {
+		void *arg = NULL;
+		argcachelist_t *listitem, *previous = NULL;
+
+		pthread_mutex_lock(&mutexargcache);
+		listitem = argcachelist;
+		while (listitem) {
+				if (listitem->hash==hash && listitem->size==size)
+						break;
+				previous = listitem;
+				listitem = listitem->next;
+		}
+		if (listitem && (arg = malloc(size))!=NULL) {
+				memcpy(arg, listitem->arg, size);
+				/* move the item to the beginning of the list */
+				if (previous) {
+						previous->next = listitem->next;
+						listitem->next = argcachelist;
+						argcachelist   = listitem;
+				}
+		}
+		pthread_mutex_unlock(&mutexargcache);
+
+		return arg;
+}
+
+/* move the buffer into the cache under the hash, this returns 1 if the same arguments are in the cache afterwards */
+/* and sets taken if the buffer was moved, which is not the case if they were already in the cache */
+static int argcache_insert(UINT64_T hash, void *arg, UINT32_T size, int *taken) {
+		UINT64_T limit;
+		argcachelist_t *listitem, *previous;
+		int cached;
+
+		*taken = 0;
+
+		pthread_mutex_lock(&mutexhost);
+		limit = host->memavail;
+		pthread_mutex_unlock(&mutexhost);
+
+		pthread_mutex_lock(&mutexargcache);
+		if (argcache.size < limit)
+				limit = argcache.size;
+
+		/* check whether the arguments are already in the cache */
+		listitem = argcachelist;
+		while (listitem) {
+				if (listitem->hash==hash && listitem->size==size)
+						break;
+				listitem = listitem->next;
+		}
+
+		cached = (listitem!=NULL);
+
+		if (listitem==NULL && size<=limit) {
+				/* remove the least recently used items until it fits */
+				while (argcachelist && argcache.used+size>limit) {
+						previous = NULL;
+						listitem = argcachelist;
+						while (listitem->next) {
+								previous = listitem;
+								listitem = listitem->next;
+						}
+						DEBUG(LOG_DEBUG, "argcache: removing %u bytes", listitem->size);
+						argcache.used -= listitem->size;
+						FREE(listitem->arg);
+						FREE(listitem);
+						if (previous)
+								previous->next = NULL;
+						else
+								argcachelist = NULL;
+				}
+
+				if ((listitem = (argcachelist_t *)malloc(sizeof(argcachelist_t)))!=NULL) {
+						listitem->hash = hash;
+						listitem->size = size;
+						listitem->arg  = arg;
+						*taken = 1;
+						cached = 1;
+						/* add the item to the beginning of the list */
+						listitem->next = argcachelist;
+						argcachelist   = listitem;
+						argcache.used += listitem->size;
+						DEBUG(LOG_DEBUG, "argcache: keeping %u bytes, %llu in use", listitem->size, (unsigned long long) argcache.used);
+				}
+		}
+		pthread_mutex_unlock(&mutexargcache);
+
+		return cached;
+}
+
+/* move the arguments of the job into the cache */
+void argcache_store(joblist_t *job) {
+		int taken;
+
+		if (job->arg==NULL || job->job->arghash==0)
+				return;
+		argcache_insert(job->job->arghash, job->arg, job->job->argsize, &taken);
+		if (taken)
+				job->arg = NULL;
+}
+
+/* move the serialized results of a job into the cache, they are the input of a following job, see chain.c */
+/* this returns 1 if the results are in the cache and the buffer is taken over, otherwise it remains with the caller */
+int argcache_keep(UINT64_T hash, void *arg, UINT32_T size) {
+		int taken;
+
+		if (arg==NULL || hash==0)
+				return 0;
+		if (!argcache_insert(hash, arg, size, &taken))
+				return 0;
+		if (!taken)
+				FREE(arg);
+		return 1;
+}
@@ -0,0 +1,262 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/
+ *
+ */
+
+/*
+ * Inside a container or a SLURM allocation the peer can only use part of the
+ * computer, which is not reflected in /proc/cpuinfo and /proc/meminfo. These
+ * functions return the CPU affinity mask and the limits of the cgroup that the
+ * peer runs in, for both cgroup v1 and v2. They return -1 if there is no limit
+ * or on unsupported platforms, in which case the computer as a whole is used.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE		/* for sched_getaffinity */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "peer.h"
+#include "extern.h"
+#include "platform_includes.h"
+
+#if defined (PLATFORM_LINUX)
+#include <sched.h>
+#include <sys/stat.h>
+
+#define CGROUP_ROOT "/sys/fs/cgroup"
+
+/* determine the directory of the cgroup for the specified controller, the mount point is returned in root */
+static int cgroup_dir(const char *controller, char *dir, char *root, int len) {
+		FILE *fp;
+		char line[MAXPATHSIZE], *controllers, *path;
+		struct stat sb;
+		int found = 0;
+
+		if ((fp = fopen("/proc/self/cgroup", "r"))==NULL)
+				return -1;
+
+		/* each line is hierarchy-ID:controller-list:cgroup-path, cgroup v2 has an empty controller list */
+		while (!found && fgets(line, MAXPATHSIZE, fp)) {
+				line[strcspn(line, "\n")] = 0;
+				if ((controllers = strchr(line, ':'))==NULL || (path = strchr(controllers+1, ':'))==NULL)
+						continue;
+				*(path++) = 0;
+				controllers++;
+
+				if (strlen(controllers)==0) {
+						/* cgroup v2, the file is only there if the controller is enabled */
+						snprintf(root, len, "%s", CGROUP_ROOT);
+						found = 1;
+				}
+				else {
+						char *token, *saveptr = NULL;
+						for (token = strtok_r(controllers, ",", &saveptr); token; token = strtok_r(NULL, ",", &saveptr))
+								if (strcmp(token, controller)==0)
+										found = 1;
+						if (found) {
+								/* the controllers are often mounted together, e.g. cpu,cpuacct */
+								snprintf(root, len, "%s/%s", CGROUP_ROOT, line+strcspn(line, ":")+1);
+								if (stat(root, &sb)!=0)
+										snprintf(root, len, "%s/%s", CGROUP_ROOT, controller);
+						}
+				}
+				if (found) {
+						snprintf(dir, len, "%s%s", root, path);
+						/* without a cgroup namespace the path is that of the host, the container sees its own cgroup as the root */
+						if (stat(dir, &sb)!=0)
+								snprintf(dir, len, "%s", root);
+				}
+		}
+		fclose(fp);
+
+		return (found ? 0 : -1);
+}
+
+/* read the first one or two numbers from a file in the cgroup, "max" is returned as UINT64_MAX */
+static int cgroup_read(const char *dir, const char *name, UINT64_T *val1, UINT64_T *val2) {
+		FILE *fp;
+		char fname[MAXPATHSIZE], str[64];
+		int n = 0;
+
+		snprintf(fname, MAXPATHSIZE, "%s/%s", dir, name);
+		if ((fp = fopen(fname, "r"))==NULL)
+				return -1;
+		if (fscanf(fp, "%63s", str)==1) {
+				*val1 = (strcmp(str, "max")==0 ? UINT64_MAX : strtoull(str, NULL, 10));
+				n++;
+				if (val2 && fscanf(fp, "%llu", (unsigned long long *)val2)==1)
+						n++;
+		}
+		fclose(fp);
+		return n;
+}
+
+/* read a single value from a file with key-value pairs, like memory.stat or cpu.stat */
+static int cgroup_stat(const char *dir, const char *name, const char *key, UINT64_T *val) {
+		FILE *fp;
+		char fname[MAXPATHSIZE], str[256];
+		unsigned long long value;
+		int found = 0;
+
+		snprintf(fname, MAXPATHSIZE, "%s/%s", dir, name);
+		if ((fp = fopen(fname, "r"))==NULL)
+				return -1;
+		while (!found && fscanf(fp, "%255s %llu", str, &value)==2) {
+				if (strcmp(str, key)==0) {
+						*val  = value;
+						found = 1;
+				}
+		}
+		fclose(fp);
+		return (found ? 0 : -1);
+}
+
+/* remove the last component of the path, this returns 0 when the root is reached */
+static int cgroup_parent(char *dir, const char *root) {
+		char *ptr;
+		if (strlen(dir)<=strlen(root) || (ptr = strrchr(dir, '/'))==NULL)
+				return 0;
+		*ptr = 0;
+		return (strlen(dir)>=strlen(root));
+}
+#endif
+
+/* this returns the number of CPUs that the process is allowed to run on, and marks them in allowed */
+int cpu_affinity(unsigned char *allowed, int maxcpu) {
+#if defined (PLATFORM_LINUX)
+		cpu_set_t mask;
+		int i, count = 0;
+
+		CPU_ZERO(&mask);
+		if (sched_getaffinity(0, sizeof(cpu_set_t), &mask)!=0)
+				return -1;
+		for (i=0; i<maxcpu && i<CPU_SETSIZE; i++) {
+				allowed[i] = (CPU_ISSET(i, &mask) ? 1 : 0);
+				count += allowed[i];
+		}
+		return count;
+#else
+		return -1;
+#endif
+}
+
+/* the CPU quota of the cgroup as number of CPUs, the lowest limit along the hierarchy applies */
+int cgroup_cpulimit(float *ncpu) {
+#if defined (PLATFORM_LINUX)
+		char dir[MAXPATHSIZE], root[MAXPATHSIZE];
+		UINT64_T quota, period;
+		float limit = 0;
+		int found = 0;
+
+		if (cgroup_dir("cpu", dir, root, MAXPATHSIZE)!=0)
+				return -1;
+		do {
+				if (cgroup_read(dir, "cpu.max", &quota, &period)==2 && quota!=UINT64_MAX && period>0) {
+						/* cgroup v2, e.g. "200000 100000" for two CPUs */
+						if (!found || (float)quota/period < limit)
+								limit = (float)quota/period;
+						found = 1;
+				}
+				else if (cgroup_read(dir, "cpu.cfs_quota_us", &quota, NULL)==1 && (INT64_T)quota>0 && cgroup_read(dir, "cpu.cfs_period_us", &period, NULL)==1 && period>0) {
+						/* cgroup v1, the quota is -1 if there is no limit */
+						if (!found || (float)quota/period < limit)
+								limit = (float)quota/period;
+						found = 1;
+				}
+		} while (cgroup_parent(dir, root));
+
+		if (found)
+				*ncpu = limit;
+		return (found ? 0 : -1);
+#else
+		return -1;
+#endif
+}
+
+/* the CPU time used by all processes in the cgroup, in microseconds */
+int cgroup_cpuusage(UINT64_T *usage) {
+#if defined (PLATFORM_LINUX)
+		char dir[MAXPATHSIZE], root[MAXPATHSIZE];
+		UINT64_T nsec;
+
+		if (cgroup_dir("cpuacct", dir, root, MAXPATHSIZE)==0 && cgroup_read(dir, "cpuacct.usage", &nsec, NULL)==1) {
+				/* cgroup v1 */
+				*usage = nsec/1000;
+				return 0;
+		}
+		if (cgroup_dir("cpu", dir, root, MAXPATHSIZE)==0 && cgroup_stat(dir, "cpu.stat", "usage_usec", usage)==0) {
+				/* cgroup v2 */
+				return 0;
+		}
+		return -1;
+#else
+		return -1;
+#endif
+}
+
+/* the memory limit of the cgroup and the memory in use, excluding the page cache that can be reclaimed */
+int cgroup_memlimit(UINT64_T *limit, UINT64_T *used) {
+#if defined (PLATFORM_LINUX)
+		char dir[MAXPATHSIZE], root[MAXPATHSIZE], own[MAXPATHSIZE];
+		UINT64_T value, inactive = 0;
+		int found = 0, v2 = 0;
+
+		if (cgroup_dir("memory", dir, root, MAXPATHSIZE)!=0)
+				return -1;
+		strncpy(own, dir, MAXPATHSIZE);
+
+		*limit = UINT64_MAX;
+		do {
+				if (cgroup_read(dir, "memory.max", &value, NULL)==1) {
+						/* cgroup v2 */
+						v2 = 1;
+						if (value<*limit) {
+								*limit = value;
+								found = 1;
+						}
+				}
+				else if (cgroup_read(dir, "memory.limit_in_bytes", &value, NULL)==1) {
+						/* cgroup v1, without a limit this is a very large number */
+						if (value<*limit && value<((UINT64_T)1<<62)) {
+								*limit = value;
+								found = 1;
+						}
+				}
+		} while (cgroup_parent(dir, root));
+
+		if (!found)
+				return -1;
+
+		if (v2) {
+				if (cgroup_read(own, "memory.current", used, NULL)!=1)
+						return -1;
+				cgroup_stat(own, "memory.stat", "inactive_file", &inactive);
+		}
+		else {
+				if (cgroup_read(own, "memory.usage_in_bytes", used, NULL)!=1)
+						return -1;
+				cgroup_stat(own, "memory.stat", "total_inactive_file", &inactive);
+		}
+		*used = (*used > inactive ? *used - inactive : 0);
+		return 0;
+#else
+		return -1;
+#endif
+}
@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/
+ *
+ */
+
+/*
+ * A job that is put with 'keep' leaves its results on the slave, in the cache
+ * of argcache.c, and only returns an empty argout to the master. The slave
+ * reports the hash and size of the kept results with the jobdef of the empty
+ * results, and the master remembers which slave keeps them. A following job
+ * that is put with 'input' takes these results as input: they are appended to
+ * its own arguments on the slave, without passing through the master. The
+ * master puts the job to the slave that keeps the results if that slave is
+ * idle, otherwise the slave that executes the job fetches them from the
+ * other slave with a JOBFLAG_FETCH jobdef.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "peer.h"
+#include "extern.h"
+#include "platform_includes.h"
+
+/* remember which slave keeps the results of the job, this is called on the master when the results arrive */
+void chain_arrived(joblist_t *job) {
+		chainlist_t *listitem, *previous;
+		int count;
+
+		if (job->job->chainhash==0)
+				return;
+
+		pthread_mutex_lock(&mutexchainlist);
+		/* the results of another copy of the same job replace the earlier ones */
+		previous = NULL;
+		for (listitem = chainlist; listitem; previous = listitem, listitem = listitem->next)
+				if (listitem->jobid==job->job->id)
+						break;
+		if (listitem) {
+				if (previous)
+						previous->next = listitem->next;
+				else
+						chainlist = listitem->next;
+		}
+		else if ((listitem = (chainlist_t *)malloc(sizeof(chainlist_t)))==NULL) {
+				pthread_mutex_unlock(&mutexchainlist);
+				return;
+		}
+		listitem->jobid  = job->job->id;
+		listitem->peerid = job->job->chainpeer;
+		listitem->hash   = job->job->chainhash;
+		listitem->size   = job->job->chainsize;
+		listitem->next   = chainlist;
+		chainlist        = listitem;
+
+		/* forget the oldest ones */
+		for (count = 1, listitem = chainlist; listitem->next; listitem = listitem->next)
+				if (++count>CHAIN_RESULTS) {
+						previous = listitem->next;
+						listitem->next = previous->next;
+						FREE(previous);
+						break;
+				}
+		pthread_mutex_unlock(&mutexchainlist);
+
+		DEBUG(LOG_INFO, "chain_arrived: the results of job %u are kept by peer %u", job->job->id, job->job->chainpeer);
+}
+
+/* this returns 1 if the results of the job are kept by a slave, and which one */
+int chain_lookup(UINT32_T jobid, UINT32_T *peerid, UINT64_T *hash, UINT32_T *size) {
+		chainlist_t *listitem;
+		int found = 0;
+
+		pthread_mutex_lock(&mutexchainlist);
+		for (listitem = chainlist; listitem; listitem = listitem->next)
+				if (listitem->jobid==jobid)
+						break;
+		if (listitem) {
+				found   = 1;
+				*peerid = listitem->peerid;
+				*hash   = listitem->hash;
+				*size   = listitem->size;
+		}
+		pthread_mutex_unlock(&mutexchainlist);
+
+		return found;
+}
+
+/* request the kept results from the specified peer, this returns them from malloc, or NULL */
+void *chain_fetch(UINT32_T peerid, UINT64_T hash, UINT32_T size) {
+		int server, handshake, success;
+		jobdef_t def;
+		void *buf = NULL;
+
+		memset(&def, 0, sizeof(jobdef_t));
+		def.version = VERSION;
+		def.flags   = JOBFLAG_FETCH;
+		def.arghash = hash;
+		def.argsize = size;
+
+		if ((server = open_peer_connection(peerid))<0)
+				return NULL;
+
+		/* the hostdef and the jobdef are sent, the handshake after the jobdef tells whether the results follow */
+		if (bufread(server, &handshake, sizeof(int))!=sizeof(int) || !handshake)
+				goto cleanup;
+		pthread_mutex_lock(&mutexhost);
+		success = (bufwrite(server, host, sizeof(hostdef_t))==sizeof(hostdef_t));
+		pthread_mutex_unlock(&mutexhost);
+		if (!success)
+				goto cleanup;
+		if (bufread(server, &handshake, sizeof(int))!=sizeof(int) || !handshake)
+				goto cleanup;
+		if (bufwrite(server, &def, sizeof(jobdef_t))!=sizeof(jobdef_t))
+				goto cleanup;
+		if (bufread(server, &handshake, sizeof(int))!=sizeof(int) || !handshake)
+				goto cleanup;
+		if ((buf = malloc(size))==NULL)
+				goto cleanup;
+		if (bufread(server, buf, size)!=size || argcache_hash(buf, size)!=hash) {
+				DEBUG(LOG_ERR, "chain_fetch: failed to read %u bytes from peer %u", size, peerid);
+				FREE(buf);
+		}
+
+cleanup:
+		close_connection(server);
+		return buf;
+}
+
+/* this returns the kept results that are the input of the job from malloc, or NULL if they are not available anymore */
+void *chain_input(const jobdef_t *def) {
+		UINT32_T hostid;
+		void *buf;
+
+		if ((buf = argcache_lookup(def->chainhash, def->chainsize))!=NULL)
+				return buf;
+
+		pthread_mutex_lock(&mutexhost);
+		hostid = host->id;
+		pthread_mutex_unlock(&mutexhost);
+
+		/* the results were removed from the cache on this slave */
+		if (def->chainpeer==hostid)
+				return NULL;
+
+		DEBUG(LOG_INFO, "chain_input: fetching %u bytes from peer %u", def->chainsize, def->chainpeer);
+		return chain_fetch(def->chainpeer, def->chainhash, def->chainsize);
+}
+
+void clear_chainlist(void) {
+		chainlist_t *listitem;
+
+		pthread_mutex_lock(&mutexchainlist);
+		while (chainlist) {
+				listitem  = chainlist->next;
+				FREE(chainlist);
+				chainlist = listitem;
+		}
+		pthread_mutex_unlock(&mutexchainlist);
+}
@@ -21,6 +21,9 @@
 #include <stdlib.h>
 #include <string.h>       /* for strerror */
 
+#ifndef WIN32
+#include <poll.h>
+#endif
 #include "peer.h"
 #include "extern.h"
 #include "platform_includes.h"
@@ -163,3 +166,191 @@ int close_connection(int s) {
 		return retval;
 }
 
+
+/* open a connection to the peer with the specified id, using the UDS socket if it is on the same computer */
+int open_peer_connection(UINT32_T hostid) {
+		int hasuds, hastcp, port = 0;
+		char ipaddr[INET_ADDRSTRLEN], socket[STRLEN];
+		peerlist_t *peer;
+
+		/* copy the address, the peerlist should not be locked while connecting */
+		pthread_mutex_lock(&mutexpeerlist);
+		if ((peer = lookup_peerlist(hostid))==NULL) {
+				pthread_mutex_unlock(&mutexpeerlist);
+				DEBUG(LOG_ERR, "open_peer_connection: failed to locate peer %u", hostid);
+				return -1;
+		}
+		pthread_mutex_lock(&mutexhost);
+		hasuds = (strlen(peer->host->socket)>0 && strcmp(peer->host->name, host->name)==0);
+		hastcp = (peer->host->port>0);
+		pthread_mutex_unlock(&mutexhost);
+		strncpy(ipaddr, peer->ipaddr, INET_ADDRSTRLEN);
+		strncpy(socket, peer->host->socket, STRLEN);
+		port = peer->host->port;
+		pthread_mutex_unlock(&mutexpeerlist);
+
+		if (hasuds)
+				return open_uds_connection(socket);
+		else if (hastcp)
+				return open_tcp_connection(ipaddr, port);
+		else
+				return -1;
+}
+
+/* this returns 1 if the kept connection has not been closed by the peer in the meantime */
+static int connection_alive(int s) {
+#ifndef WIN32
+		struct pollfd pfd;
+		pfd.fd      = s;
+		pfd.events  = POLLIN;
+		pfd.revents = 0;
+		/* nothing is expected from the peer, anything that can be read means that it has been closed */
+		return (poll(&pfd, 1, 0)==0);
+#else
+		return 0;
+#endif
+}
+
+/* take a kept connection to the peer, or open a new one, reused tells whether the first handshake is to be skipped */
+int reuse_peer_connection(UINT32_T hostid, int *reused) {
+		int s = -1;
+		keepalivelist_t *listitem, *previous = NULL;
+
+		pthread_mutex_lock(&mutexkeepalive);
+		listitem = keepalivelist;
+		while (listitem) {
+				if (listitem->hostid==hostid)
+						break;
+				previous = listitem;
+				listitem = listitem->next;
+		}
+		if (listitem) {
+				/* the connection is used by one thread at a time */
+				if (previous)
+						previous->next = listitem->next;
+				else
+						keepalivelist = listitem->next;
+		}
+		pthread_mutex_unlock(&mutexkeepalive);
+
+		if (listitem) {
+				/* the peer closes the connection after KEEPALIVETIME, it is not used near the end of that */
+				if (walltime() - listitem->time < KEEPALIVETIME/2 && connection_alive(listitem->fd))
+						s = listitem->fd;
+				else
+						close_connection(listitem->fd);
+				FREE(listitem);
+		}
+
+		if (s>=0) {
+				DEBUG(LOG_DEBUG, "reuse_peer_connection: reusing socket %d for peer %u", s, hostid);
+				*reused = 1;
+				return s;
+		}
+		*reused = 0;
+		return open_peer_connection(hostid);
+}
+
+/* keep the connection for the next message to the peer, the oldest one is closed if there are too many */
+void keep_peer_connection(UINT32_T hostid, int s) {
+		int count = 0;
+		keepalivelist_t *listitem, *previous = NULL;
+
+		if ((listitem = (keepalivelist_t *)malloc(sizeof(keepalivelist_t)))==NULL) {
+				close_connection(s);
+				return;
+		}
+		listitem->hostid = hostid;
+		listitem->fd     = s;
+		listitem->time   = walltime();
+
+		pthread_mutex_lock(&mutexkeepalive);
+		listitem->next = keepalivelist;
+		keepalivelist  = listitem;
+		while (listitem) {
+				if (++count>KEEPALIVE_MAX) {
+						previous->next = NULL;
+						while (listitem) {
+								previous = listitem->next;
+								close_connection(listitem->fd);
+								FREE(listitem);
+								listitem = previous;
+						}
+						break;
+				}
+				previous = listitem;
+				listitem = listitem->next;
+		}
+		pthread_mutex_unlock(&mutexkeepalive);
+}
+
+void clear_keepalivelist(void) {
+		keepalivelist_t *listitem;
+
+		pthread_mutex_lock(&mutexkeepalive);
+		while (keepalivelist) {
+				listitem = keepalivelist->next;
+				close_connection(keepalivelist->fd);
+				FREE(keepalivelist);
+				keepalivelist = listitem;
+		}
+		pthread_mutex_unlock(&mutexkeepalive);
+}
+
+/* write the message over the connection, this returns 1 on success, 0 on failure and -1 if the peer closed the connection before reading the hostdef */
+static int write_message(int server, int reused, jobdef_t *def, const void *arg, const void *opt) {
+		int handshake, success;
+
+		/* write the message (hostdef, jobdef, arg, opt) with handshakes in between */
+		/* the slave may close the connection between the message segments in case the job is refused */
+		if (!reused && (bufread(server, &handshake, sizeof(int))!=sizeof(int) || !handshake))
+				return 0;
+		pthread_mutex_lock(&mutexhost);
+		success = (bufwrite(server, host, sizeof(hostdef_t))==sizeof(hostdef_t));
+		pthread_mutex_unlock(&mutexhost);
+		if (!success)
+				return (reused ? -1 : 0);
+		if (bufread(server, &handshake, sizeof(int))!=sizeof(int))
+				return (reused ? -1 : 0);
+		if (!handshake)
+				return 0;
+		if (bufwrite(server, def, sizeof(jobdef_t))!=sizeof(jobdef_t))
+				return 0;
+		if (bufread(server, &handshake, sizeof(int))!=sizeof(int) || !handshake)
+				return 0;
+		/* the arguments are not sent again if the slave has them in its cache */
+		if (handshake==HANDSHAKE_SHM && bufwrite_shm(server, arg, NULL, def->argsize)!=def->argsize)
+				return 0;
+		if (handshake!=HANDSHAKE_CACHED && handshake!=HANDSHAKE_SHM && bufwrite(server, (void *)arg, def->argsize)!=def->argsize)
+				return 0;
+		if (bufread(server, &handshake, sizeof(int))!=sizeof(int) || !handshake)
+				return 0;
+		if (bufwrite(server, (void *)opt, def->optsize)!=def->optsize)
+				return 0;
+		if (bufread(server, &handshake, sizeof(int))!=sizeof(int) || !handshake)
+				return 0;
+		return 1;
+}
+
+/* write the serialized job to the specified peer, this returns 1 on success */
+int write_job(UINT32_T peerid, jobdef_t *def, const void *arg, const void *opt) {
+		int server, reused, success;
+
+		if ((server = reuse_peer_connection(peerid, &reused))<0)
+				return 0;
+
+		success = write_message(server, reused, def, arg, opt);
+		if (success<0) {
+				/* the kept connection was closed by the peer, nothing has been received yet */
+				close_connection(server);
+				if ((server = open_peer_connection(peerid))<0)
+						return 0;
+				success = write_message(server, 0, def, arg, opt);
+		}
+
+		if (success>0)
+				keep_peer_connection(peerid, server);
+		else
+				close_connection(server);
+		return (success>0);
+}
@@ -44,10 +44,10 @@ char *inet_ntop(int af, const void *src, char *dst, socklen_t maxlen) {
 typedef struct {
 		void **discovery;
 		int *fd;
+		int *qfd;
 } threadlocal_t;
 
 void cleanup_discover(void *arg) {
-		peerlist_t *next = NULL;
 		threadlocal_t *threadlocal = NULL;
 		threadlocal = (threadlocal_t *)arg;
 
@@ -65,14 +65,12 @@ void cleanup_discover(void *arg) {
 				*threadlocal->fd = 0;
 		}
 
-		pthread_mutex_lock(&mutexpeerlist);
-		while (peerlist) {
-				next = peerlist->next;
-				FREE(peerlist->host);
-				FREE(peerlist);
-				peerlist = next;
+		if (threadlocal && (*threadlocal->qfd)>0) {
+				closesocket(*threadlocal->qfd);
+				*threadlocal->qfd = 0;
 		}
-		pthread_mutex_unlock(&mutexpeerlist);
+
+		clear_peerlist();
 
 		pthread_mutex_lock(&mutexstatus);
 		discoverStatus = 0;
@@ -87,14 +85,19 @@ void cleanup_discover(void *arg) {
 
 void *discover(void *arg) {
 		int accept = 1;
-		int fd = 0;
+		int fd = 0, qfd = 0, sock;
 		int i = 0;
 		int localhost = 0;
-		int nbytes, found = 0;
+		int nbytes;
 		int one = 1;
+		int usetracker, needpeers;
+		double queried = 0;
 		hostdef_t  *discovery = NULL;
-		peerlist_t *peer = NULL, *next = NULL;
+		hostupdate_t *update;
+		peerlist_t *peer = NULL;
 		unsigned int addrlen;
+		fd_set readfds;
+		struct timeval timeout;
 
 		/* these variables are for the socket */
 		struct sockaddr_in addr;
@@ -104,6 +107,7 @@ void *discover(void *arg) {
 		threadlocal_t threadlocal;
 		threadlocal.discovery = &discovery;
 		threadlocal.fd        = &fd;
+		threadlocal.qfd       = &qfd;
 
 		/* this is for debugging */
 		pthread_mutex_lock(&mutexthreadcount);
@@ -169,33 +173,104 @@ void *discover(void *arg) {
 				goto cleanup;
 		}
 
+		/* the trackers are queried from a separate socket, so that the replies are not shared with the other peers on this computer */
+		if ((qfd=socket(AF_INET,SOCK_DGRAM,0)) < 0) {
+				perror("discover socket");
+				DEBUG(LOG_ERR, "error: discover socket");
+				goto cleanup;
+		}
+
 		/* now just enter an infinite loop */
 		while (1) {
 				char ipaddr[INET_ADDRSTRLEN];
-				
-				if ((discovery = malloc(sizeof(hostdef_t)))==NULL) {
+
+				/* this is large enough for the details that are relayed by a tracker */
+				if ((discovery = malloc(sizeof(trackerentry_t)))==NULL) {
 						perror("discover malloc");
 						DEBUG(LOG_ERR, "error: discover malloc");
 						goto cleanup;
 				}
 
-				/* note that this might be thread cancelation point, but I am not sure */
+				if (walltime()-queried >= ANNOUNCESLEEP) {
+						pthread_mutex_lock(&mutextrackerlist);
+						usetracker = (trackerlist!=NULL);
+						pthread_mutex_unlock(&mutextrackerlist);
+
+						/* the idle slaves do not need to know about the other peers */
+						pthread_mutex_lock(&mutexhost);
+						needpeers = (host->status==STATUS_MASTER);
+						pthread_mutex_unlock(&mutexhost);
+						pthread_mutex_lock(&mutexworksteal);
+						needpeers = (needpeers || worksteal.enabled);
+						pthread_mutex_unlock(&mutexworksteal);
+
+						if (usetracker && needpeers)
+								tracker_query(qfd);
+						queried = walltime();
+				}
+
+				/* note that this is a thread cancelation point */
+				FD_ZERO(&readfds);
+				FD_SET(fd, &readfds);
+				FD_SET(qfd, &readfds);
+				timeout.tv_sec  = (long)ANNOUNCESLEEP;
+				timeout.tv_usec = (long)(1000000*(ANNOUNCESLEEP-(long)ANNOUNCESLEEP));
+				if ((nbytes = select((fd>qfd ? fd : qfd)+1, &readfds, NULL, NULL, &timeout)) <= 0) {
+						FREE(discovery);
+						continue;
+				}
+				sock = (FD_ISSET(fd, &readfds) ? fd : qfd);
+
 				addrlen=sizeof(addr);
-				if ((nbytes=recvfrom(fd,discovery,sizeof(hostdef_t),0,(struct sockaddr *)&addr,&addrlen)) < 0) {
+				if ((nbytes=recvfrom(sock,discovery,sizeof(trackerentry_t),0,(struct sockaddr *)&addr,&addrlen)) < 0) {
 						perror("discover recvfrom");
 						DEBUG(LOG_ERR, "error: discover recvfrom");
 						goto cleanup;
 				}
 
-				if (discovery->version!=VERSION) {
+				/* the details of a host are either announced by the host itself, or relayed by a tracker */
+				if (!(nbytes==sizeof(hostdef_t) || (sock==fd && nbytes==sizeof(hostupdate_t)) || (sock==qfd && nbytes==sizeof(trackerentry_t))) || discovery->version!=VERSION) {
+						FREE(discovery);
+						continue;
+				}
+
+				if (nbytes==sizeof(hostupdate_t)) {
+						/* the compact update only applies to a peer of which the full details are known */
+						update = (hostupdate_t *)discovery;
+						pthread_mutex_lock(&mutexpeerlist);
+						peer = lookup_peerlist(update->id);
+						if (peer && peer->strhash==update->strhash && (INT32_T)(update->sequence - peer->sequence)>0) {
+								peer->host->status         = update->status;
+								peer->host->timavail       = update->timavail;
+								peer->host->memavail       = update->memavail;
+								peer->host->cpuavail       = update->cpuavail;
+								peer->host->current.hostid = update->hostid;
+								peer->host->current.jobid  = update->jobid;
+								peer->host->current.timreq = update->timreq;
+								peer->host->current.memreq = update->memreq;
+								peer->host->current.cpureq = update->cpureq;
+								peer->host->backlog        = update->backlog;
+								peer->host->queued         = update->queued;
+								peer->host->gpuavail       = update->gpuavail;
+								peer->host->gpumemavail    = update->gpumemavail;
+								peer->host->gpuload        = update->gpuload;
+								peer->sequence             = update->sequence;
+								peer->time                 = time(NULL);
+						}
+						pthread_mutex_unlock(&mutexpeerlist);
 						FREE(discovery);
 						continue;
 				}
 
 				/* the UDP packet specifies the IP address of the sender */
-				
 				inet_ntop(AF_INET, &addr.sin_addr, ipaddr, INET_ADDRSTRLEN);
 
+				if (nbytes==sizeof(trackerentry_t)) {
+						/* the peers on the same computer as the tracker can be reached at the address of the tracker */
+						if (strncmp(((trackerentry_t *)discovery)->ipaddr, "127.", 4)!=0)
+								strncpy(ipaddr, ((trackerentry_t *)discovery)->ipaddr, INET_ADDRSTRLEN);
+				}
+
 				/* there seems to be a thread cancelation point inside check_localhost  */
 				/* therefore it should be called only when all mutexes are unlocked */
 				localhost = check_localhost(ipaddr);
@@ -208,10 +283,7 @@ void *discover(void *arg) {
 				 */
 
 				/* check whether the peer should be listed */
-				accept = 1;
-				accept = (accept && ismember_userlist (discovery->user));
-				accept = (accept && ismember_grouplist(discovery->group));
-				accept = (accept && ismember_hostlist (discovery->name));
+				accept = security_check(discovery);
 
 				if (!accept) {
 						DEBUG(LOG_DEBUG, "discover: rejecting %s:%u, id = lu", discovery->name, discovery->port, discovery->id);
@@ -224,42 +296,22 @@ void *discover(void *arg) {
 
 				pthread_mutex_lock(&mutexpeerlist);
 
-				/* remove previous observations of this discovery from the list */
-				/* test the first item on the list */
-				if (peerlist)	{
-						found = (peerlist->host->id==discovery->id);
-						if (found) {
-								/* delete the first item in the list */
-								next = peerlist->next;
-								FREE(peerlist->host);
-								FREE(peerlist);
-								peerlist = next;
-						}
+				/* update the previous observation of this discovery, or add it to the list */
+				peer = lookup_peerlist(discovery->id);
+				if (!peer) {
+						peer       = (peerlist_t *)malloc(sizeof(peerlist_t));
+						peer->host = (hostdef_t *)malloc(sizeof(hostdef_t));
+						memcpy(peer->host, discovery, sizeof(hostdef_t));
+						peer->sequence = 0;
+						insert_peerlist(peer);
+						/* the new peer only learns about this one from the full host details */
+						if (nbytes==sizeof(hostdef_t))
+								announce_refresh();
 				}
-
-				/* remove previous observations of this discovery from the list */
-				/* traverse the list */
-				peer = peerlist;
-				while(peer) {
-						/* test the next item on the list */
-						next = peer->next;
-						if (next) {
-								found = (next->host->id==discovery->id);
-								if (found) {
-										/* delete the next item in the list */
-										peer->next = next->next;
-										FREE(next->host);
-										FREE(next);
-										break;
-								}
-						}
-						peer = peer->next;
+				else {
+						memcpy(peer->host, discovery, sizeof(hostdef_t));
 				}
-
-				/* add the new discovery to the list */
-				peer       = (peerlist_t *)malloc(sizeof(peerlist_t));
-				peer->host = (hostdef_t *)malloc(sizeof(hostdef_t));
-				memcpy(peer->host, discovery, sizeof(hostdef_t));
+				peer->strhash = announce_hash(peer->host);
 
 				FREE(discovery);
 
@@ -271,8 +323,6 @@ void *discover(void *arg) {
 						strncpy(peer->ipaddr, ipaddr, INET_ADDRSTRLEN);
 
 				peer->time      = time(NULL);
-				peer->next      = peerlist;
-				peerlist        = peer;
 
 				/* give some debug output
 				   i = 0;
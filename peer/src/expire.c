@@ -22,6 +22,9 @@
 #include <sys/types.h>
 #include <signal.h>
 #include <time.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
 
 #include "peer.h"
 #include "extern.h"
@@ -81,52 +84,30 @@ void *expire(void *arg) {
 				pthread_mutex_lock(&mutexpeerlist);
 
 				/* remove expired observations from the list */
-				/* test the first item on the list */
-				if (peerlist)
-				{
-						found = difftime(time(NULL), peerlist->time) > EXPIRETIME;
-						found = found || !ismember_userlist (peerlist->host->user);
-						found = found || !ismember_grouplist(peerlist->host->group);
-						found = found || !ismember_hostlist (peerlist->host->name);
-						if (found) {
-								DEBUG(LOG_INFO, "expire: name = %s", peerlist->host->name);
-								DEBUG(LOG_INFO, "expire: port = %u", peerlist->host->port);
-								DEBUG(LOG_INFO, "expire: time = %s", ctime(&(peerlist->time)));
-								/* delete the first item in the list */
-								next = peerlist->next;
-								FREE(peerlist->host);
-								FREE(peerlist);
-								peerlist = next;
-						}
-				}
-
-				/* remove expired observations from the list */
-				/* traverse the list */
 				peer = peerlist;
 				while(peer) {
-						/* test the next item on the list, remember the current one */
+						/* remember the next item on the list, the current one might be deleted */
 						next = peer->next;
-						if (next) {
-								found = difftime(time(NULL), next->time) > EXPIRETIME;
-								found = found || !ismember_userlist (next->host->user);
-								found = found || !ismember_grouplist(next->host->group);
-								found = found || !ismember_hostlist (next->host->name);
-								if (found) {
-										DEBUG(LOG_INFO, "expire: name = %s", next->host->name);
-										DEBUG(LOG_INFO, "expire: port = %u", next->host->port);
-										DEBUG(LOG_INFO, "expire: time = %s", ctime(&(next->time)));
-										/* delete the next item in the list, stitch the list back together */
-										peer->next = next->next;
-										FREE(next->host);
-										FREE(next);
-										continue;
-								}
+						found = difftime(time(NULL), peer->time) > EXPIRETIME;
+						found = found || !ismember_userlist (peer->host->user);
+						found = found || !ismember_grouplist(peer->host->group);
+						found = found || !ismember_hostlist (peer->host->name);
+						if (found) {
+								DEBUG(LOG_INFO, "expire: name = %s", peer->host->name);
+								DEBUG(LOG_INFO, "expire: port = %u", peer->host->port);
+								DEBUG(LOG_INFO, "expire: time = %s", ctime(&(peer->time)));
+								remove_peerlist(peer);
+								FREE(peer->host);
+								FREE(peer);
 						}
-						peer = peer->next;
+						peer = next;
 				}
 
 				pthread_mutex_unlock(&mutexpeerlist);
 
+				/* the usage of the pool by each user is derived from the busy peers */
+				smartshare_update();
+
 				/* run the watchdog on every iteration, this can result in an exit() call */
 				check_watchdog();
 
@@ -145,9 +126,10 @@ cleanup:
 }
 
 void check_watchdog() {
-		int found;
+		int found, pressure;
 		peerlist_t *peer = NULL;
 		uint64_t rss, vs;
+		UINT64_T limit, used;
 
 		pthread_mutex_lock(&mutexwatchdog);
 
@@ -200,10 +182,35 @@ void check_watchdog() {
 				}
 		}
 
+		/* the job is warned in advance, it can check this with watchdog() and stop earlier */
+		if (watchdog.timsoft && !(watchdog.soft & WATCHDOG_SOFT_TIME)) {
+				if (difftime(time(NULL), watchdog.timsoft)>0) {
+						DEBUG(LOG_WARNING, "expire: watchdog soft limit passed (time)");
+						watchdog.soft |= WATCHDOG_SOFT_TIME;
+				}
+		}
+
 		/* check whether the watchdog should be triggered for the memory */
-		if (watchdog.memory) {
+		if (watchdog.memory || watchdog.memsoft) {
 				getmem (&rss, &vs);
-				if (rss>watchdog.memory) {
+
+				/* in a cgroup the job can run out of memory before it reaches its own limit */
+				pressure = (cgroup_memlimit(&limit, &used)==0 && used>WATCHDOG_CGROUPFRACTION*limit);
+
+				if ((watchdog.memsoft && rss>watchdog.memsoft) || (watchdog.memory && rss>watchdog.memory) || pressure) {
+#if defined(__GLIBC__)
+						/* first give the memory that has been freed back to the operating system */
+						malloc_trim(0);
+						getmem (&rss, &vs);
+						pressure = (cgroup_memlimit(&limit, &used)==0 && used>WATCHDOG_CGROUPFRACTION*limit);
+#endif
+						if (((watchdog.memsoft && rss>watchdog.memsoft) || pressure) && !(watchdog.soft & WATCHDOG_SOFT_MEMORY)) {
+								DEBUG(LOG_WARNING, "expire: watchdog soft limit passed (memory, rss = %lu)", rss);
+								watchdog.soft |= WATCHDOG_SOFT_MEMORY;
+						}
+				}
+
+				if (watchdog.memory && rss>watchdog.memory) {
 						/* the maximum allowed memory has been exceeded */
 						DEBUG(LOG_CRIT, "expire: watchdog triggered (memory)");
 						exit(0);
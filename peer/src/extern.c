@@ -28,6 +28,9 @@ int tcpserverStatus = 0;
 int announceStatus  = 0;
 int discoverStatus  = 0;
 int expireStatus    = 0;
+int workstealStatus = 0;
+int trackerserverStatus = 0;
+int speculatorStatus = 0;
 
 pthread_mutex_t mutexappendcount = PTHREAD_MUTEX_INITIALIZER;
 int appendcount = 0;
@@ -46,9 +49,19 @@ hostdef_t *host = NULL;
 
 pthread_mutex_t mutexpeerlist = PTHREAD_MUTEX_INITIALIZER;
 peerlist_t *peerlist = NULL;
+peerlist_t *peerindex[INDEXSIZE];
+int peerlistcount = 0;
 
 pthread_mutex_t mutexjoblist = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t condjoblist = PTHREAD_COND_INITIALIZER;
 joblist_t *joblist = NULL;
+joblist_t *joblisttail = NULL;
+joblist_t *jobindex[INDEXSIZE];
+int joblistcount = 0;
+struct {
+		UINT32_T hostid;
+		UINT32_T jobid;
+} cancelled = {0, 0};
 
 pthread_mutex_t mutexallowuserlist = PTHREAD_MUTEX_INITIALIZER;
 userlist_t *allowuserlist = NULL;
@@ -75,6 +88,9 @@ struct {
 		UINT32_T masterid;
 		time_t time;
 		UINT64_T memory;
+		time_t timsoft;     /* the job is warned when it passes these, before the hard limits are reached */
+		UINT64_T memsoft;
+		int soft;           /* the soft limits that have been passed, see WATCHDOG_SOFT_xxx */
 } watchdog;
 
 pthread_mutex_t mutexsmartmem = PTHREAD_MUTEX_INITIALIZER;
@@ -92,19 +108,104 @@ struct {
 		int evidence;
 } smartcpu;
 
+pthread_mutex_t mutexsmartgpu = PTHREAD_MUTEX_INITIALIZER;
+struct {
+		int enabled;
+		time_t probed;
+		UINT64_T gpuavail;
+} smartgpu;
+
 pthread_mutex_t mutexprevcpu = PTHREAD_MUTEX_INITIALIZER;
 struct {
-		int user, nice, system, idle, iowait, irq, softirq, unknown;
+		UINT64_T idle[SMARTCPU_MAXCPU];  /* per CPU, idle and iowait in jiffies */
+		UINT64_T total[SMARTCPU_MAXCPU];
+		UINT64_T usage;                  /* of the cgroup, in microseconds */
+		double   time;
 } prevcpu;
 
 pthread_mutex_t mutexsmartshare = PTHREAD_MUTEX_INITIALIZER;
 smartsharelist_t *smartsharelist = NULL;
+fairsharelist_t *fairsharelist = NULL;
 struct {
 		int enabled;
 		int prevhostcount;
 		int prevhostid;
 		int n;
 		time_t time;
+		double updated;
 } smartshare;
 
+pthread_mutex_t mutexworksteal = PTHREAD_MUTEX_INITIALIZER;
+durationlist_t *durationlist = NULL;
+struct {
+		int enabled;
+		int queue;
+		time_t started;
+		UINT64_T spill;
+} worksteal;
+
+pthread_mutex_t mutexsecurity = PTHREAD_MUTEX_INITIALIZER;
+struct {
+		UINT32_T changed;
+		UINT32_T built;
+		UINT32_T count[SECURITY_SETS];
+		securityset_t *set[SECURITY_SETS][SECURITY_HASHSIZE];
+		securitycache_t cache[SECURITY_CACHESIZE];
+} security = {1, 0};
+
+pthread_mutex_t mutexargcache = PTHREAD_MUTEX_INITIALIZER;
+argcachelist_t *argcachelist = NULL;
+struct {
+		UINT64_T size;
+		UINT64_T used;
+} argcache;
+
+pthread_mutex_t mutexchainlist = PTHREAD_MUTEX_INITIALIZER;
+chainlist_t *chainlist = NULL;
+
+pthread_mutex_t mutexjobstat = PTHREAD_MUTEX_INITIALIZER;
+jobstatlist_t *jobstatlist = NULL;
 
+pthread_mutex_t mutexreduce = PTHREAD_MUTEX_INITIALIZER;
+reducelist_t *reducelist = NULL;
+slavestatlist_t *slavestatlist = NULL;
+struct {
+		float factor;
+		UINT32_T launched;
+		UINT32_T discarded;
+} speculate = {SPECULATE_FACTOR, 0, 0};
+
+pthread_mutex_t mutexupload = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t condupload = PTHREAD_COND_INITIALIZER;
+uploadlist_t *uploadlist = NULL;
+struct {
+		UINT64_T maxmem;
+		UINT64_T queued;
+		UINT32_T pending;
+		UINT32_T sent;
+		UINT32_T numfailed;
+		UINT32_T failed[UPLOAD_FAILED];
+		int numthread;
+		int stop;
+} upload = {UPLOAD_MAXMEM, 0, 0, 0, 0, {0}, 0, 0};
+
+pthread_mutex_t mutexspool = PTHREAD_MUTEX_INITIALIZER;
+struct {
+		UINT64_T maxmem;
+} spool = {0};
+
+pthread_mutex_t mutexkeepalive = PTHREAD_MUTEX_INITIALIZER;
+keepalivelist_t *keepalivelist = NULL;
+
+pthread_mutex_t mutexannounce = PTHREAD_MUTEX_INITIALIZER;
+struct {
+		UINT64_T strhash;
+		UINT32_T sequence;
+		double refreshed;
+} announcement;
+pthread_mutex_t mutextrackerlist = PTHREAD_MUTEX_INITIALIZER;
+trackerlist_t *trackerlist = NULL;
+struct {
+		hostdef_t announced;
+		time_t refreshed;
+} tracker;
@@ -10,6 +10,9 @@ extern int tcpserverStatus;
 extern int announceStatus;
 extern int discoverStatus;
 extern int expireStatus;
+extern int workstealStatus;
+extern int trackerserverStatus;
+extern int speculatorStatus;
 
 extern pthread_mutex_t mutexappendcount;
 extern int appendcount;
@@ -31,9 +34,19 @@ extern hostdef_t *host;
 
 extern pthread_mutex_t mutexpeerlist;
 extern peerlist_t *peerlist;
+extern peerlist_t *peerindex[INDEXSIZE];
+extern int peerlistcount;
 
 extern pthread_mutex_t mutexjoblist;
+extern pthread_cond_t condjoblist;
 extern joblist_t *joblist;
+extern joblist_t *joblisttail;
+extern joblist_t *jobindex[INDEXSIZE];
+extern int joblistcount;
+extern struct {
+		UINT32_T hostid;     /* the master of the job that is being executed and that was cancelled */
+		UINT32_T jobid;
+} cancelled;
 
 extern pthread_mutex_t mutexallowuserlist;
 extern userlist_t *allowuserlist;
@@ -60,6 +73,9 @@ extern struct {
 		UINT32_T masterid;
 		time_t time;
 		UINT64_T memory;
+		time_t timsoft;     /* the job is warned when it passes these, before the hard limits are reached */
+		UINT64_T memsoft;
+		int soft;           /* the soft limits that have been passed, see WATCHDOG_SOFT_xxx */
 } watchdog;
 
 extern pthread_mutex_t mutexsmartmem;
@@ -77,20 +93,107 @@ extern struct {
 		int evidence;
 } smartcpu;
 
+extern pthread_mutex_t mutexsmartgpu;
+extern struct {
+		int enabled;
+		time_t probed;       /* when the GPUs were last probed */
+		UINT64_T gpuavail;   /* the number of GPUs is at most this, see --gpuavail */
+} smartgpu;
+
 extern pthread_mutex_t mutexprevcpu;
 extern struct {
-		int user, nice, system, idle, iowait, irq, softirq, unknown;
+		UINT64_T idle[SMARTCPU_MAXCPU];  /* per CPU, idle and iowait in jiffies */
+		UINT64_T total[SMARTCPU_MAXCPU];
+		UINT64_T usage;                  /* of the cgroup, in microseconds */
+		double   time;
 } prevcpu;
 
 extern pthread_mutex_t mutexsmartshare;
 extern smartsharelist_t *smartsharelist;
+extern fairsharelist_t *fairsharelist;
 extern struct {
 		int enabled;
 		int prevhostcount;
 		int prevhostid;
 		int n;
 		time_t time;
+		double updated;  /* when the usage of the users was last updated */
 } smartshare;
 
 
+extern pthread_mutex_t mutexworksteal;
+extern durationlist_t *durationlist;
+extern struct {
+		int enabled;     /* hand queued jobs over to idle peers */
+		int queue;       /* number of jobs that may wait behind the current one */
+		time_t started;  /* when the current job was started, or 0 */
+		UINT64_T spill;  /* queued jobs with larger arguments are kept on disk, 0 means never */
+} worksteal;
+
+extern pthread_mutex_t mutexsecurity;
+extern struct {
+		UINT32_T changed;    /* incremented whenever one of the allow or refuse lists changes, never 0 */
+		UINT32_T built;      /* the value of changed when the sets were built */
+		UINT32_T count[SECURITY_SETS];   /* number of names in each set */
+		securityset_t *set[SECURITY_SETS][SECURITY_HASHSIZE];
+		securitycache_t cache[SECURITY_CACHESIZE];
+} security;
+
+extern pthread_mutex_t mutexargcache;
+extern argcachelist_t *argcachelist;
+extern struct {
+		UINT64_T size;   /* maximum number of bytes in the cache, 0 means no cache */
+		UINT64_T used;   /* number of bytes in the cache */
+} argcache;
+
+extern pthread_mutex_t mutexchainlist;
+extern chainlist_t *chainlist;
+
+extern pthread_mutex_t mutexjobstat;
+extern jobstatlist_t *jobstatlist;
+
+extern pthread_mutex_t mutexreduce;
+extern reducelist_t *reducelist;
+extern slavestatlist_t *slavestatlist;
+extern struct {
+		float factor;        /* re-launch a job when it takes this many times longer than expected, see speculate.c */
+		UINT32_T launched;   /* number of speculative copies that were put */
+		UINT32_T discarded;  /* number of results that arrived after those of the other copy */
+} speculate;
+
+extern pthread_mutex_t mutexupload;
+extern pthread_cond_t condupload;
+extern uploadlist_t *uploadlist;
+extern struct {
+		UINT64_T maxmem;     /* put waits while the queued jobs take more than this many bytes */
+		UINT64_T queued;     /* bytes of the jobs that are queued or being sent */
+		UINT32_T pending;    /* number of jobs that are queued or being sent */
+		UINT32_T sent;       /* number of jobs that were sent */
+		UINT32_T numfailed;  /* number of jobs that could not be sent since the last status request */
+		UINT32_T failed[UPLOAD_FAILED];  /* and the ids of the first of them */
+		int numthread;       /* number of upload threads that are running */
+		int stop;            /* the upload threads should stop */
+} upload;
+
+extern pthread_mutex_t mutexspool;
+extern struct {
+		UINT64_T maxmem;     /* the master keeps the results on disk while those in memory take more than this many bytes, 0 means never */
+} spool;
+
+extern pthread_mutex_t mutexkeepalive;
+extern keepalivelist_t *keepalivelist;
+
+extern pthread_mutex_t mutexannounce;
+extern struct {
+		UINT64_T strhash;  /* of the host details that were last announced in full */
+		UINT32_T sequence;
+		double refreshed;  /* when the host details were last announced in full */
+} announcement;
+extern pthread_mutex_t mutextrackerlist;
+extern trackerlist_t *trackerlist;
+extern struct {
+		hostdef_t announced;  /* the host details that were last sent to the trackers */
+		time_t refreshed;     /* when they were sent */
+} tracker;
+
 #endif
@@ -15,6 +15,14 @@
  * configuration option will be returned if present. If emptymeaningful = 0,
  * then the specified default will be returned if an empty value is
  * encountered. The default value for emptymeaningful = 0.
+ *
+ * Multiple options can be obtained in a single call with
+ *   [val1, val2, ...] = ft_getopt(s, {key1, key2, ...}, {default1, default2, ...})
+ * where emptymeaningful can be a scalar or a vector with one value per key. The
+ * values are returned in separate outputs if the number of outputs is equal to the
+ * number of keys, otherwise they are returned together in a cell array. For a
+ * structure, the field numbers of the keys are cached for the most recent
+ * combinations of fields and keys, so that repeated calls don't search for each key.
  * 
  * Copyright (C) 2011, Robert Oostenveld
  *
@@ -33,6 +41,200 @@
 #include <strings.h>
 #endif
 
+#include <stdlib.h>
+#include <string.h>
+
+#define GETOPT_CACHESIZE 16
+
+/* The cache is found with the pointer to the field names of the structure, but
+ * the field names are always compared as well. Since a structure that has been
+ * cleared can be followed by another one at the same address, the pointer by
+ * itself cannot tell whether the fields are the same. */
+typedef struct {
+		const char *table; /* the name of the first field */
+		int nfields, nkeys;
+		char **name;       /* copy of the field names, followed by the keys */
+		int *index;        /* the field number of each key, or -1 */
+} getopt_cache_t;
+
+static getopt_cache_t cache[GETOPT_CACHESIZE];
+static int cachenext = 0, cacheinit = 0;
+
+static char *copystring(const char *str) {
+		char *copy = (char *)malloc(strlen(str)+1);
+		if (copy)
+				strcpy(copy, str);
+		return copy;
+}
+
+static void cache_free(getopt_cache_t *entry) {
+		int i;
+		if (entry->name) {
+				for (i=0; i<entry->nfields+entry->nkeys; i++)
+						free(entry->name[i]);
+				free(entry->name);
+		}
+		free(entry->index);
+		entry->name  = NULL;
+		entry->index = NULL;
+}
+
+static void cache_clear(void) {
+		int c;
+		for (c=0; c<GETOPT_CACHESIZE; c++)
+				cache_free(&cache[c]);
+}
+
+/* determine the field number of each key in the structure */
+static void struct_index(const mxArray *opt, int nkeys, char **key, int *index) {
+		int nfields = mxGetNumberOfFields(opt);
+		const char *table = (nfields>0 ? mxGetFieldNameByNumber(opt, 0) : NULL);
+		getopt_cache_t *entry;
+		int c, i, k;
+
+		for (c=0; c<GETOPT_CACHESIZE; c++) {
+				entry = &cache[c];
+				if (entry->name==NULL || entry->table!=table || entry->nfields!=nfields || entry->nkeys!=nkeys)
+						continue;
+				for (i=0; i<nfields; i++)
+						if (strcmp(entry->name[i], mxGetFieldNameByNumber(opt, i))!=0)
+								break;
+				for (k=0; i==nfields && k<nkeys; k++)
+						if (strcmp(entry->name[nfields+k], key[k])!=0)
+								break;
+				if (i==nfields && k==nkeys) {
+						memcpy(index, entry->index, nkeys*sizeof(int));
+						return;
+				}
+		}
+
+		for (k=0; k<nkeys; k++)
+				index[k] = mxGetFieldNumber(opt, key[k]);
+
+		/* remember the field numbers for the next call */
+		if (!cacheinit) {
+				mexAtExit(cache_clear);
+				cacheinit = 1;
+		}
+		entry = &cache[cachenext];
+		cachenext = (cachenext+1) % GETOPT_CACHESIZE;
+		cache_free(entry);
+		entry->name  = (char **)calloc(nfields+nkeys, sizeof(char *));
+		entry->index = (int *)malloc((nkeys>0 ? nkeys : 1)*sizeof(int));
+		if (entry->name==NULL || entry->index==NULL) {
+				cache_free(entry);
+				return;
+		}
+		for (i=0; i<nfields+nkeys; i++) {
+				entry->name[i] = copystring(i<nfields ? mxGetFieldNameByNumber(opt, i) : key[i-nfields]);
+				if (entry->name[i]==NULL) {
+						/* the remaining names are still NULL, which is fine for free */
+						cache_free(entry);
+						return;
+				}
+		}
+		memcpy(entry->index, index, nkeys*sizeof(int));
+		entry->table   = table;
+		entry->nfields = nfields;
+		entry->nkeys   = nkeys;
+}
+
+/* look up multiple keys in a single call */
+static void getopt_multiple(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+		const mxArray *opt = prhs[0], *keys = prhs[1];
+		const mxArray *defaults = (nrhs>=3 && !mxIsEmpty(prhs[2]) ? prhs[2] : NULL);
+		const mxArray **field, *defaultval;
+		mxArray *val;
+		char **key, *str;
+		int *index, nkeys, num, i, k, emptymeaningful;
+
+		nkeys = mxGetNumberOfElements(keys);
+		num   = mxGetNumberOfElements(opt);
+
+		if (defaults && (!mxIsCell(defaults) || mxGetNumberOfElements(defaults)!=nkeys))
+				mexErrMsgTxt("the defaults should be specified as a cell-array with one value per key");
+		if (nrhs==4 && mxGetNumberOfElements(prhs[3])!=1 && mxGetNumberOfElements(prhs[3])!=nkeys)
+				mexErrMsgTxt("emptymeaningful should be specified as a scalar or with one value per key");
+		if (nrhs==4 && mxGetNumberOfElements(prhs[3])>1 && !mxIsDouble(prhs[3]) && !mxIsLogical(prhs[3]))
+				mexErrMsgTxt("emptymeaningful should be a logical or double precision vector");
+		if (nlhs>1 && nlhs!=nkeys)
+				mexErrMsgTxt("the number of outputs should be equal to the number of keys");
+
+		key   = (char **)mxCalloc(nkeys>0 ? nkeys : 1, sizeof(char *));
+		index = (int *)mxCalloc(nkeys>0 ? nkeys : 1, sizeof(int));
+		field = (const mxArray **)mxCalloc(nkeys>0 ? nkeys : 1, sizeof(mxArray *));
+
+		for (k=0; k<nkeys; k++) {
+				if ((key[k] = mxArrayToString(mxGetCell(keys, k)))==NULL)
+						mexErrMsgTxt("the keys should be specified as a cell-array of strings");
+		}
+
+		if (mxIsStruct(opt)) {
+				if (num!=1)
+						mexErrMsgTxt("the first input should be a single structure");
+
+				struct_index(opt, nkeys, key, index);
+				for (k=0; k<nkeys; k++)
+						field[k] = (index[k]<0 ? NULL : mxGetFieldByNumber(opt, 0, index[k]));
+		}
+		else if (mxIsCell(opt)) {
+				if ((num % 2)!=0)
+						mexErrMsgTxt("the first input should contain key-value pairs");
+
+				/* go over the key-value pairs only once, the first occurence of each key is used */
+				for (k=0; k<nkeys; k++)
+						index[k] = -1;
+				for (i=0; i<num; i+=2) {
+						if ((str = mxArrayToString(mxGetCell(opt, i)))==NULL)
+								mexErrMsgTxt("the first input should contain key-value pairs");
+						for (k=0; k<nkeys; k++) {
+								if (index[k]<0 && strcasecmp(str, key[k])==0) {
+										index[k] = i;
+										field[k] = mxGetCell(opt, i+1);
+								}
+						}
+						mxFree(str);
+				}
+		}
+		else if (!mxIsEmpty(opt)) {
+				mexErrMsgTxt("the first input argument should be a cell-array or structure");
+		}
+
+		if (nlhs<=1 && nkeys!=1)
+				plhs[0] = mxCreateCellArray(mxGetNumberOfDimensions(keys), mxGetDimensions(keys));
+
+		for (k=0; k<nkeys; k++) {
+				if (nrhs<4)
+						emptymeaningful = 0;
+				else if (mxGetNumberOfElements(prhs[3])==1)
+						emptymeaningful = (int)mxGetScalar(prhs[3]);
+				else if (mxIsLogical(prhs[3]))
+						emptymeaningful = mxGetLogicals(prhs[3])[k];
+				else
+						emptymeaningful = (int)mxGetPr(prhs[3])[k];
+
+				defaultval = (defaults ? mxGetCell(defaults, k) : NULL);
+
+				if (field[k]!=NULL && (!mxIsEmpty(field[k]) || emptymeaningful))
+						val = mxDuplicateArray(field[k]);
+				else if (defaultval!=NULL)
+						val = mxDuplicateArray(defaultval);
+				else
+						val = mxCreateDoubleMatrix(0,0,mxREAL);
+
+				if (nlhs<=1 && nkeys!=1)
+						mxSetCell(plhs[0], k, val);
+				else
+						plhs[k] = val;
+
+				mxFree(key[k]);
+		}
+
+		mxFree(key);
+		mxFree(index);
+		mxFree(field);
+}
+
 void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 		int num, i, emptymeaningful;
 		char *key = NULL, *str = NULL;
@@ -42,13 +244,28 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 		if (nrhs<2 || nrhs>4)
 				mexErrMsgTxt("incorrect number of input arguments");
 
-		if (!mxIsChar(prhs[1]))
+		if (!mxIsChar(prhs[1]) && !mxIsCell(prhs[1]))
 				mexErrMsgTxt("the key should be specified as a string");
                 
         if (nrhs == 4 && !(mxIsLogical(prhs[3]) || mxIsNumeric(prhs[3]))) {
             mexErrMsgTxt("if specified, input argument emptymeaningful should be a logical or numeric value");
         }
         
+		if (mxIsClass(prhs[0], "config")) {
+				/* the config object has to be converted to a struct object */
+                /* this fixes bug 885 */
+				mexPutVariable("caller", "bcks4i37yr3_cwb", prhs[0]);
+				mexEvalString("bcks4i37yr3_cwb = struct(bcks4i37yr3_cwb);");
+				prhs[0] = mexGetVariable("caller", "bcks4i37yr3_cwb");
+				mexEvalString("clear bcks4i37yr3_cwb;");
+		}
+
+		if (mxIsCell(prhs[1])) {
+				/* multiple keys are specified */
+				getopt_multiple(nlhs, plhs, nrhs, prhs);
+				return;
+		}
+
         if (nrhs < 4) {
             emptymeaningful = 0;
         } else {
@@ -61,15 +278,6 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 		/* the default output will be dealt with later */
 		plhs[0] = NULL;
 
-		if (mxIsClass(prhs[0], "config")) {
-				/* the config object has to be converted to a struct object */
-                /* this fixes bug 885 */
-				mexPutVariable("caller", "bcks4i37yr3_cwb", prhs[0]);
-				mexEvalString("bcks4i37yr3_cwb = struct(bcks4i37yr3_cwb);");
-				prhs[0] = mexGetVariable("caller", "bcks4i37yr3_cwb");
-				mexEvalString("clear bcks4i37yr3_cwb;");
-		}
-
 		if (mxIsStruct(prhs[0])) {
 				/* it will also end up here if the input is an object, in which case this code fails */
 				if (num!=1)
@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/
+ *
+ */
+
+/*
+ * The master remembers how long it took to serialize and send each job. When
+ * the results arrive, tcpsocket calls jobstat_arrived, which completes the
+ * timing of the job and adds it to the statistics of the slave that returned
+ * it. The slave itself adds the timing of the phases that took place on its
+ * side to the output options, see peerslave.c. The roundtrip times are kept
+ * in a histogram with logarithmic bins, the first bin ends at JOBSTAT_MINTIME
+ * and each following bin is twice as wide.
+ *
+ * While the speculator thread is running, the master also keeps a copy of
+ * each job, so that it can be put once more to another slave when it takes
+ * too long. Only the first results that arrive are passed on, see speculate.c.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "peer.h"
+#include "extern.h"
+#include "platform_includes.h"
+
+/* free the record, the copy of the job is owned by the speculator while it is being sent */
+static void free_jobstat(jobstatlist_t *listitem) {
+		if (!listitem->sending) {
+				FREE(listitem->def);
+				FREE(listitem->arg);
+				FREE(listitem->opt);
+		}
+		FREE(listitem);
+}
+
+/* remember the timing of a job that was put to a slave */
+void jobstat_put(UINT32_T peerid, const jobdef_t *def, const void *arg, const void *opt, const jobtiming_t *timing) {
+		int count = 0, copy;
+		jobstatlist_t *listitem, *next;
+
+		if ((listitem = (jobstatlist_t *)calloc(1, sizeof(jobstatlist_t)))==NULL)
+				return;
+		listitem->jobid    = def->id;
+		listitem->size     = (UINT64_T)def->argsize + def->optsize;
+		listitem->peerid   = peerid;
+		listitem->expected = duration_estimate(def);
+		memcpy(&listitem->timing, timing, sizeof(jobtiming_t));
+
+		pthread_mutex_lock(&mutexstatus);
+		copy = speculatorStatus;
+		pthread_mutex_unlock(&mutexstatus);
+
+		/* the copy is needed to put the job once more, without it the job is never re-launched */
+		if (copy) {
+				listitem->def = malloc(sizeof(jobdef_t));
+				listitem->arg = malloc(def->argsize);
+				listitem->opt = malloc(def->optsize);
+				if (listitem->def && listitem->arg && listitem->opt) {
+						memcpy(listitem->def, def, sizeof(jobdef_t));
+						memcpy(listitem->arg, arg, def->argsize);
+						memcpy(listitem->opt, opt, def->optsize);
+				}
+				else {
+						FREE(listitem->def);
+						FREE(listitem->arg);
+						FREE(listitem->opt);
+				}
+		}
+
+		pthread_mutex_lock(&mutexjobstat);
+		listitem->next = jobstatlist;
+		jobstatlist    = listitem;
+
+		/* forget about the oldest jobs, their results may never arrive */
+		while (listitem) {
+				if (++count==JOBSTAT_PENDING) {
+						next = listitem->next;
+						listitem->next = NULL;
+						while (next) {
+								listitem = next->next;
+								free_jobstat(next);
+								next = listitem;
+						}
+						break;
+				}
+				listitem = listitem->next;
+		}
+		pthread_mutex_unlock(&mutexjobstat);
+}
+
+/* complete the timing of the job whose results have arrived and add it to the statistics of the slave */
+/* this returns 1 if the results of another copy of the job arrived earlier, in which case they should be discarded */
+int jobstat_arrived(joblist_t *job) {
+		int bin, keep;
+		double edge;
+		jobstatlist_t *listitem, *previous = NULL;
+		slavestatlist_t *slave;
+
+		pthread_mutex_lock(&mutexjobstat);
+
+		listitem = jobstatlist;
+		while (listitem) {
+				if (listitem->jobid==job->job->id)
+						break;
+				previous = listitem;
+				listitem = listitem->next;
+		}
+
+		if (listitem==NULL) {
+				/* the job was not put by this master, or it was forgotten */
+				pthread_mutex_unlock(&mutexjobstat);
+				return 0;
+		}
+
+		if (listitem->done) {
+				/* these are the results of the slower copy */
+				if (previous)
+						previous->next = listitem->next;
+				else
+						jobstatlist = listitem->next;
+				speculate.discarded++;
+				free_jobstat(listitem);
+				pthread_mutex_unlock(&mutexjobstat);
+				return 1;
+		}
+
+		/* with another copy underway, the record remains to recognize its results */
+		keep = (listitem->spareid || listitem->sending);
+		if (keep) {
+				listitem->done   = 1;
+				listitem->cancel = 1;
+				/* the slave that returned the results does not have to be cancelled */
+				if (listitem->peerid==job->host->id)
+						listitem->peerid = 0;
+				if (listitem->spareid==job->host->id)
+						listitem->spareid = 0;
+		}
+		else if (previous)
+				previous->next = listitem->next;
+		else
+				jobstatlist = listitem->next;
+
+		job->timing.submitted = listitem->timing.submitted;
+		job->timing.serialize = listitem->timing.serialize;
+		job->timing.send      = listitem->timing.send;
+		job->timing.roundtrip = job->timing.arrived - listitem->timing.submitted;
+
+		/* the results come back from the slave that executed the job, which is not always the one to which it was put */
+		slave = slavestatlist;
+		while (slave) {
+				if (slave->hostid==job->host->id)
+						break;
+				slave = slave->next;
+		}
+		if (slave==NULL && (slave = (slavestatlist_t *)calloc(1, sizeof(slavestatlist_t)))!=NULL) {
+				slave->hostid = job->host->id;
+				slave->next   = slavestatlist;
+				slavestatlist = slave;
+		}
+
+		if (slave) {
+				strncpy(slave->name, job->host->name, STRLEN);
+				slave->name[STRLEN-1] = 0;
+				slave->count++;
+				slave->bytesout  += listitem->size;
+				slave->bytesin   += (UINT64_T)job->job->argsize + job->job->optsize;
+				slave->send      += job->timing.send;
+				slave->receive   += job->timing.receive;
+				slave->roundtrip += job->timing.roundtrip;
+				for (bin=0, edge=JOBSTAT_MINTIME; bin<JOBSTAT_BINS-1 && job->timing.roundtrip>edge; bin++)
+						edge *= 2;
+				slave->histogram[bin]++;
+		}
+
+		if (keep && !listitem->sending) {
+				FREE(listitem->def);
+				FREE(listitem->arg);
+				FREE(listitem->opt);
+		}
+		else if (!keep) {
+				free_jobstat(listitem);
+		}
+		pthread_mutex_unlock(&mutexjobstat);
+
+		/* the expected duration of the following jobs with the same function includes the transfer */
+		duration_update(job->job->name, job->timing.roundtrip);
+		return 0;
+}
+
+void clear_jobstat(void) {
+		jobstatlist_t *listitem;
+		slavestatlist_t *slave;
+
+		pthread_mutex_lock(&mutexjobstat);
+		while (jobstatlist) {
+				listitem = jobstatlist->next;
+				free_jobstat(jobstatlist);
+				jobstatlist = listitem;
+		}
+		while (slavestatlist) {
+				slave = slavestatlist->next;
+				FREE(slavestatlist);
+				slavestatlist = slave;
+		}
+		pthread_mutex_unlock(&mutexjobstat);
+}
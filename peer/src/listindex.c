@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/
+ *
+ */
+
+/*
+ * The peerlist and the joblist are doubly linked lists in the order of
+ * discovery and arrival, which is what most of the code walks through. Besides
+ * that, the items are kept in a hash table with their id as key, so that the
+ * discovery of a known peer and the lookup of a returned job do not have to
+ * walk the list. The list, the index and the count should only be changed with
+ * these functions, and only while holding mutexpeerlist or mutexjoblist.
+ */
+
+#include "peer.h"
+#include "extern.h"
+
+static unsigned int bucket(UINT32_T id) {
+		/* the hostid is a hash and the jobid is random, but user-specified jobids are often sequential */
+		return (unsigned int)((id*2654435761U)>>24) & (INDEXSIZE-1);
+}
+
+peerlist_t *lookup_peerlist(UINT32_T hostid) {
+		peerlist_t *peer = peerindex[bucket(hostid)];
+		while (peer && peer->host->id!=hostid)
+				peer = peer->hashnext;
+		return peer;
+}
+
+/* add the peer to the beginning of the list */
+void insert_peerlist(peerlist_t *peer) {
+		unsigned int i = bucket(peer->host->id);
+		peer->prev = NULL;
+		peer->next = peerlist;
+		if (peerlist)
+				peerlist->prev = peer;
+		peerlist = peer;
+		peer->hashnext = peerindex[i];
+		peerindex[i] = peer;
+		peerlistcount++;
+}
+
+/* detach the peer from the list, the caller should free it */
+void remove_peerlist(peerlist_t *peer) {
+		peerlist_t **item = &peerindex[bucket(peer->host->id)];
+		while (*item && *item!=peer)
+				item = &(*item)->hashnext;
+		if (*item)
+				*item = peer->hashnext;
+		if (peer->prev)
+				peer->prev->next = peer->next;
+		else
+				peerlist = peer->next;
+		if (peer->next)
+				peer->next->prev = peer->prev;
+		peer->next = peer->prev = peer->hashnext = NULL;
+		peerlistcount--;
+}
+
+/* jobs with the same id are found in the order of arrival */
+joblist_t *lookup_joblist(UINT32_T jobid) {
+		joblist_t *job = jobindex[bucket(jobid)];
+		while (job && job->job->id!=jobid)
+				job = job->hashnext;
+		return job;
+}
+
+/* add the job to the end of the list, the jobs are executed in the order of arrival */
+void append_joblist(joblist_t *job) {
+		joblist_t **item = &jobindex[bucket(job->job->id)];
+		job->next = NULL;
+		job->prev = joblisttail;
+		if (joblisttail)
+				joblisttail->next = job;
+		else
+				joblist = job;
+		joblisttail = job;
+		while (*item)
+				item = &(*item)->hashnext;
+		job->hashnext = NULL;
+		*item = job;
+		joblistcount++;
+}
+
+/* detach the job from the list, the caller should free it */
+void remove_joblist(joblist_t *job) {
+		joblist_t **item = &jobindex[bucket(job->job->id)];
+		while (*item && *item!=job)
+				item = &(*item)->hashnext;
+		if (*item)
+				*item = job->hashnext;
+		if (job->prev)
+				job->prev->next = job->next;
+		else
+				joblist = job->next;
+		if (job->next)
+				job->next->prev = job->prev;
+		else
+				joblisttail = job->prev;
+		job->next = job->prev = job->hashnext = NULL;
+		joblistcount--;
+}
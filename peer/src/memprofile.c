@@ -2,7 +2,8 @@
  * MEMPROFILE is a MATLAB mex file which can be used to sample the
  * memory useage while MATLAB is running arbitrary commands. A thread
  * is started in the background, which takes a sample of the memory
- * use every second.
+ * use and of the page faults, starting at 10x per second. The samples
+ * are tagged with the job id that is specified when profiling starts.
  *
  * Copyright (C) 2010, Robert Oostenveld
  * 
@@ -24,68 +25,110 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/time.h>
 
 #include "mex.h"
 #include "matrix.h"
 #include "platform.h"
 #include "platform_includes.h"
 
+#if defined(PLATFORM_LINUX) || defined(PLATFORM_OSX)
+#include <sys/resource.h>
+#endif
+
 #define FREE(x) {if (x) {free(x); x=NULL;}}
 
 /* how often to record a sample, start with 10x per second */
 #define SAMPLINGDELAY 100000
 
-/* the list will be thinned out with a factor 2x if it exceeds this length and the sampling delay will be doubled */
+/* the buffer will be thinned out with a factor 2x if it is full and the sampling delay will be doubled */
 #define MAXLISTLENGTH 3600  
 
-typedef struct memlist_s {
-		uint64_t rss;  /* size of resident memory */
-		uint64_t vs;   /* size of virtual memory */
-		time_t   time; /* time at which the measurement was taken */
-		struct memlist_s *next;
-} memlist_t;
+typedef struct {
+		double   time;    /* time at which the measurement was taken, relative to the start */
+		uint64_t rss;     /* size of resident memory */
+		uint64_t vs;      /* size of virtual memory */
+		uint64_t minflt;  /* page faults that did not require I/O */
+		uint64_t majflt;  /* page faults that did require I/O */
+		uint32_t jobid;   /* job that was executing, or 0 if not known */
+} memsample_t;
+
+/* the samples are kept in a fixed-size buffer, which is cheaper than a linked list with a malloc per sample */
+struct {
+		memsample_t sample[MAXLISTLENGTH];
+		int count;
+		int pause;        /* current sampling delay in microseconds */
+		uint32_t jobid;   /* the job id with which the new samples are tagged */
+} memlist;
 
-time_t reftime = 0;
-memlist_t *memlist = NULL;
+double reftime = 0;
 pthread_mutex_t mutexmemlist = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t mutexmemprofile  = PTHREAD_MUTEX_INITIALIZER;
 pthread_t memprofileThread;
 int memprofileStatus = 0;
 
+double memprofile_time(void) {
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		return tv.tv_sec + tv.tv_usec/1000000.0;
+}
+
 void memprofile_cleanup(void *arg) {
 		pthread_mutex_lock(&mutexmemprofile);	
 		memprofileStatus = 0;
 		pthread_mutex_unlock(&mutexmemprofile);	
 }
 
-/* this function takes a sample of the memory use and adds it to the list */
+/* clear the samples and set the job id and the initial sampling delay */
+void memprofile_clear(uint32_t jobid, int pause) {
+		pthread_mutex_lock(&mutexmemlist);
+		memlist.count = 0;
+		memlist.jobid = jobid;
+		memlist.pause = pause;
+		pthread_mutex_unlock(&mutexmemlist);
+}
+
+/* this function takes a sample of the memory use and adds it to the buffer */
 void memprofile_sample(void) {
-		uint64_t rss, vs;
-		memlist_t *memitem;
+		uint64_t rss, vs, minflt = 0, majflt = 0;
+		int i;
+#if defined(PLATFORM_LINUX) || defined(PLATFORM_OSX)
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage)==0) {
+				minflt = usage.ru_minflt;
+				majflt = usage.ru_majflt;
+		}
+#endif
 
 		if (getmem(&rss, &vs)!=0) {
 				rss = 0;
 				vs  = 0;
 		}
 
-		memitem = (memlist_t *)malloc(sizeof(memlist_t));
-		memitem->rss  = rss;
-		memitem->vs   = vs;
-		memitem->time = time(NULL) - reftime;
-
 		pthread_mutex_lock(&mutexmemlist);
-		memitem->next = memlist;
-		memlist       = memitem;
+		if (memlist.count==MAXLISTLENGTH) {
+				/* keep every 2nd sample, the recording then spans twice as long at half the resolution */
+				for (i=0; i<MAXLISTLENGTH/2; i++)
+						memlist.sample[i] = memlist.sample[2*i+1];
+				memlist.count = MAXLISTLENGTH/2;
+				memlist.pause = memlist.pause*2;
+		}
+		memlist.sample[memlist.count].time   = memprofile_time() - reftime;
+		memlist.sample[memlist.count].rss    = rss;
+		memlist.sample[memlist.count].vs     = vs;
+		memlist.sample[memlist.count].minflt = minflt;
+		memlist.sample[memlist.count].majflt = majflt;
+		memlist.sample[memlist.count].jobid  = memlist.jobid;
+		memlist.count++;
 		pthread_mutex_unlock(&mutexmemlist);
 }
 
-/* this is the thread that records the memory usage in a linked list */
+/* this is the thread that records the memory usage in the buffer */
 void *memprofile(void *arg) {
-		int count;
-		int pause = SAMPLINGDELAY;
-		memlist_t *memitem, *next;
+		int pause;
 
 		pthread_mutex_lock(&mutexmemprofile);	
 		if (memprofileStatus) {
@@ -101,36 +144,12 @@ void *memprofile(void *arg) {
 		pthread_cleanup_push(memprofile_cleanup, NULL);
 
 		while (1) {
-				/* count the number of items on the list */
-				count = 0;
-				pthread_mutex_lock(&mutexmemlist);
-				memitem = memlist;
-				while (memitem) {
-						count++;
-						memitem = memitem->next ;
-				}
-				pthread_mutex_unlock(&mutexmemlist);
-
-				if (count>MAXLISTLENGTH) {
-						/* remove every 2nd item from the list */
-						pthread_mutex_lock(&mutexmemlist);
-						memitem = memlist;
-						next    = memitem->next;
-						while (memitem && next) {
-								memitem->next = next->next;
-								FREE(next);
-								memitem = memitem->next;
-								next    = memitem->next;
-						}
-						pthread_mutex_unlock(&mutexmemlist);
-						/* wait an extra delay before taking the next sample */
-						usleep(pause);
-						/* increment the subsequent sampling delay with a factor 2x */
-						pause = pause*2;
-				}
-
 				memprofile_sample();
 				pthread_testcancel();
+
+				pthread_mutex_lock(&mutexmemlist);
+				pause = memlist.pause;
+				pthread_mutex_unlock(&mutexmemlist);
 				usleep(pause);
 		}
 
@@ -154,10 +173,11 @@ void exitFun(void) {
 
 void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[]) {
 		char *command = NULL;
-		int rc, i;
-		memlist_t *memitem = NULL;
-		const char *fieldnames[3] = {"time", "mem"};
-		int numfields = 2;
+		int rc, i, pause;
+		uint32_t jobid = 0;
+		double duration;
+		const char *fieldnames[6] = {"time", "mem", "vs", "minflt", "majflt", "jobid"};
+		int numfields = 6;
 
 		/* this function will be called upon unloading of the mex file */
 		mexAtExit(exitFun);
@@ -172,18 +192,23 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 		/****************************************************************************/
 		if      (strcasecmp(command, "on")==0) {
 
-				/* clear the existing list */
-				pthread_mutex_lock(&mutexmemlist);
-				memitem = memlist;
-				while (memitem) {
-						memlist = memitem->next;
-						FREE(memitem);
-						memitem = memlist;
+				/* the optional second argument is the job id with which the samples are tagged */
+				if (nrhs>1 && mxIsNumeric(prhs[1]) && !mxIsEmpty(prhs[1]))
+						jobid = (uint32_t)mxGetScalar(prhs[1]);
+
+				/* the optional third argument is the expected duration, the buffer should span the whole job */
+				pause = SAMPLINGDELAY;
+				if (nrhs>2 && mxIsNumeric(prhs[2]) && !mxIsEmpty(prhs[2])) {
+						duration = mxGetScalar(prhs[2]);
+						if (duration*1000000/MAXLISTLENGTH > pause)
+								pause = (int)(duration*1000000/MAXLISTLENGTH);
 				}
-				pthread_mutex_unlock(&mutexmemlist);
+
+				/* clear the existing samples */
+				memprofile_clear(jobid, pause);
 
 				/* set the reference time */
-				reftime = time(NULL);
+				reftime = memprofile_time();
 
 				/* include the current memory use in the list */
 				memprofile_sample();
@@ -241,17 +266,23 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 						mexErrMsgTxt("problem with return code from pthread_create()");
 		}
 
+		/****************************************************************************/
+		else if (strcasecmp(command, "tag")==0) {
+
+				/* the subsequent samples are attributed to another job */
+				if (nrhs<2 || !mxIsNumeric(prhs[1]) || mxIsEmpty(prhs[1]))
+						mexErrMsgTxt ("invalid input argument #2");
+				pthread_mutex_lock(&mutexmemlist);
+				memlist.jobid = (uint32_t)mxGetScalar(prhs[1]);
+				pthread_mutex_unlock(&mutexmemlist);
+		}
+
 		/****************************************************************************/
 		else if (strcasecmp(command, "clear")==0) {
 
-				/* clear the existing list */
+				/* clear the existing samples */
 				pthread_mutex_lock(&mutexmemlist);
-				memitem = memlist;
-				while (memitem) {
-						memlist = memitem->next;
-						FREE(memitem);
-						memitem = memlist;
-				}
+				memlist.count = 0;
 				pthread_mutex_unlock(&mutexmemlist);
 		}
 
@@ -262,23 +293,16 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 				memprofile_sample();
 
 				pthread_mutex_lock(&mutexmemlist);
-				/* count the number of items on the list */
-				i = 0;
-				memitem = memlist;
-				while (memitem) {
-						i++;
-						memitem = memitem->next ;
-				}
-
-				plhs[0] = mxCreateStructMatrix(i, 1, numfields, fieldnames);
-
-				/* return the items in a Matlab structure array */
-				memitem = memlist;
-				while (memitem) {
-						i--;
-						mxSetFieldByNumber(plhs[0], i, 0, mxCreateDoubleScalar((uint64_t)(memitem->time)));
-						mxSetFieldByNumber(plhs[0], i, 1, mxCreateDoubleScalar((uint64_t)(memitem->rss)));
-						memitem = memitem->next ;
+				plhs[0] = mxCreateStructMatrix(memlist.count, 1, numfields, fieldnames);
+
+				/* return the samples in a Matlab structure array, the oldest first */
+				for (i=0; i<memlist.count; i++) {
+						mxSetFieldByNumber(plhs[0], i, 0, mxCreateDoubleScalar(memlist.sample[i].time));
+						mxSetFieldByNumber(plhs[0], i, 1, mxCreateDoubleScalar((double)memlist.sample[i].rss));
+						mxSetFieldByNumber(plhs[0], i, 2, mxCreateDoubleScalar((double)memlist.sample[i].vs));
+						mxSetFieldByNumber(plhs[0], i, 3, mxCreateDoubleScalar((double)memlist.sample[i].minflt));
+						mxSetFieldByNumber(plhs[0], i, 4, mxCreateDoubleScalar((double)memlist.sample[i].majflt));
+						mxSetFieldByNumber(plhs[0], i, 5, mxCreateDoubleScalar((double)memlist.sample[i].jobid));
 				}
 				pthread_mutex_unlock(&mutexmemlist);
 		}
@@ -286,42 +310,36 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 		/****************************************************************************/
 		else if (strcasecmp(command, "report")==0) {
 				uint64_t begmem, endmem, minmem, maxmem;
-				time_t mintime, maxtime;
-				int  num = 0;
+				double mintime, maxtime;
 				float summem = 0;
-				memprofile_sample();
 
 				/* include the current memory use in the list */
 				memprofile_sample();
 
 				pthread_mutex_lock(&mutexmemlist);
-				if (memlist==NULL) {
+				if (memlist.count==0) {
 						pthread_mutex_unlock(&mutexmemlist);
 						mexErrMsgTxt ("memory profiling is disabled");
 				}
-				memitem = memlist;
-				endmem = memitem->rss;
-				minmem = memitem->rss;
-				maxmem = memitem->rss;
-				mintime = memitem->time;
-				maxtime = memitem->time;
-				while (memitem) {
-						begmem  = memitem->rss; /* this will eventually contain the latest value on the list */
-						minmem  = (memitem->rss < minmem ? memitem->rss : minmem);
-						maxmem  = (memitem->rss > maxmem ? memitem->rss : maxmem);
-						mintime = (memitem->time < mintime ? memitem->time : mintime);
-						maxtime = (memitem->time > maxtime ? memitem->time : maxtime);
-						summem += memitem->rss;
-						num++;
-						memitem = memitem->next ;
+				begmem  = memlist.sample[0].rss;
+				endmem  = memlist.sample[memlist.count-1].rss;
+				minmem  = begmem;
+				maxmem  = begmem;
+				mintime = memlist.sample[0].time;
+				maxtime = memlist.sample[memlist.count-1].time;
+				for (i=0; i<memlist.count; i++) {
+						minmem  = (memlist.sample[i].rss < minmem ? memlist.sample[i].rss : minmem);
+						maxmem  = (memlist.sample[i].rss > maxmem ? memlist.sample[i].rss : maxmem);
+						summem += memlist.sample[i].rss;
 				}
-				pthread_mutex_unlock(&mutexmemlist);
 				mexPrintf("duration of the recording  = %6u s\n", (int)(maxtime-mintime+1));
-				mexPrintf("memory in use at the begin = %6u MB\n", begmem/1048576);
-				mexPrintf("memory in use at the end   = %6u MB\n", endmem/1048576);
-				mexPrintf("minimum memory in use      = %6u MB\n", minmem/1048576);
-				mexPrintf("maximum memory in use      = %6u MB\n", maxmem/1048576);
-				mexPrintf("average memory in use      = %6u MB\n", (int)(summem/num)/1048576);
+				mexPrintf("memory in use at the begin = %6u MB\n", (int)(begmem/1048576));
+				mexPrintf("memory in use at the end   = %6u MB\n", (int)(endmem/1048576));
+				mexPrintf("minimum memory in use      = %6u MB\n", (int)(minmem/1048576));
+				mexPrintf("maximum memory in use      = %6u MB\n", (int)(maxmem/1048576));
+				mexPrintf("average memory in use      = %6u MB\n", (int)(summem/memlist.count)/1048576);
+				mexPrintf("major page faults          = %6u\n", (int)(memlist.sample[memlist.count-1].majflt - memlist.sample[0].majflt));
+				pthread_mutex_unlock(&mutexmemlist);
 		}
 
 		/****************************************************************************/
@@ -331,4 +349,3 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 
 		return;
 }
-
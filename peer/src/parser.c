@@ -55,8 +55,23 @@ void initconfig(config_t *cconf) {
 				cconf->smartshare  = NULL;
 				cconf->smartmem    = NULL;
 				cconf->smartcpu    = NULL;
+				cconf->smartgpu    = NULL;
+				cconf->gpuavail    = NULL;
 				cconf->udsserver   = NULL;
 				cconf->verbose     = NULL;
+				cconf->engines     = NULL;
+				cconf->warm        = NULL;
+				cconf->clearall    = NULL;
+				cconf->queue       = NULL;
+				cconf->steal       = NULL;
+				cconf->spill       = NULL;
+				cconf->cache       = NULL;
+				cconf->tracker     = NULL;
+				cconf->trackerhost = NULL;
+				cconf->cores       = NULL;
+				cconf->numanode    = NULL;
+				cconf->partition   = NULL;
+				cconf->fairshare   = NULL;
 		}
 }
 
@@ -140,10 +155,40 @@ int parsefile(char* fname, config_t** config) {
 										cconf->smartmem    = parseline(line, "smartmem");
 								if (!cconf->smartcpu) 
 										cconf->smartcpu    = parseline(line, "smartcpu");
+								if (!cconf->smartgpu) 
+										cconf->smartgpu    = parseline(line, "smartgpu");
+								if (!cconf->gpuavail) 
+										cconf->gpuavail    = parseline(line, "gpuavail");
 								if (!cconf->udsserver) 
 										cconf->udsserver   = parseline(line, "udsserver");
 								if (!cconf->verbose) 
 										cconf->verbose     = parseline(line, "verbose");
+								if (!cconf->engines) 
+										cconf->engines     = parseline(line, "engines");
+								if (!cconf->warm) 
+										cconf->warm        = parseline(line, "warm");
+								if (!cconf->clearall) 
+										cconf->clearall    = parseline(line, "clearall");
+								if (!cconf->queue) 
+										cconf->queue       = parseline(line, "queue");
+								if (!cconf->steal) 
+										cconf->steal       = parseline(line, "steal");
+								if (!cconf->spill) 
+										cconf->spill       = parseline(line, "spill");
+								if (!cconf->cache) 
+										cconf->cache       = parseline(line, "cache");
+								if (!cconf->tracker) 
+										cconf->tracker     = parseline(line, "tracker");
+								if (!cconf->trackerhost) 
+										cconf->trackerhost = parseline(line, "trackerhost");
+								if (!cconf->cores) 
+										cconf->cores       = parseline(line, "cores");
+								if (!cconf->numanode) 
+										cconf->numanode    = parseline(line, "numanode");
+								if (!cconf->partition) 
+										cconf->partition   = parseline(line, "partition");
+								if (!cconf->fairshare) 
+										cconf->fairshare   = parseline(line, "fairshare");
 						}
 
 				} /* while */
@@ -163,3 +208,26 @@ int parsefile(char* fname, config_t** config) {
 		return numread;				
 }
 
+/* expandconfig replaces each item that specifies engines=N by N
+ * identical items, so that a pool of slaves can be started with a
+ * single [peer] section, it returns the number of items afterwards */
+int expandconfig(config_t *config) {
+		int numitem = 0, i, n;
+		config_t *cconf = config, *copy;
+
+		while (cconf) {
+				n = (cconf->engines ? atoi(cconf->engines) : 1);
+				numitem++;
+				/* the copies share the strings, each slave tokenizes its own after the fork */
+				for (i=1; i<n; i++) {
+						copy = (config_t *)malloc(sizeof(config_t));
+						memcpy(copy, cconf, sizeof(config_t));
+						copy->next  = cconf->next;
+						cconf->next = copy;
+						cconf       = copy;
+						numitem++;
+				}
+				cconf = cconf->next;
+		}
+		return numitem;
+}
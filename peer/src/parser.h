@@ -24,13 +24,29 @@ typedef struct config_s {
 		char *smartshare;
 		char *smartmem;
 		char *smartcpu;
+		char *smartgpu;
+		char *gpuavail;
 		char *udsserver;
 		char *verbose;
+		char *engines;
+		char *warm;
+		char *clearall;
+		char *queue;
+		char *steal;
+		char *spill;
+		char *cache;
+		char *tracker;
+		char *trackerhost;
+		char *cores;
+		char *numanode;
+		char *partition;
+		char *fairshare;
 		struct config_s *next; /* pointer to the next record */
 } config_t;
 
 int parsefile(char* fname, config_t** config);
 void initconfig(config_t* config);
+int expandconfig(config_t* config);
 
 #endif
 
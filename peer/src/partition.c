@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/
+ *
+ */
+
+/*
+ * Many slaves on a single large computer compete for the caches and the memory
+ * bandwidth. These functions bind a slave to a set of cores and to a NUMA node.
+ * The binding is inherited by the MATLAB engine, which is started by the slave.
+ * The supervisor process in peerslave can also divide the allowed cores of the
+ * computer over the slaves, keeping each slave within a single NUMA node where
+ * possible.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE		/* for sched_setaffinity */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "peer.h"
+#include "extern.h"
+#include "platform_includes.h"
+
+#if defined (PLATFORM_LINUX)
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#ifndef MPOL_BIND
+#define MPOL_BIND 2		/* from linux/mempolicy.h, this avoids the dependency on libnuma */
+#endif
+
+#define NODE_ROOT "/sys/devices/system/node"
+#endif
+
+/* parse a list like "0-3,8,10-11" and mark the cores in cpus, this returns the number of cores */
+int parse_cpulist(const char *str, unsigned char *cpus, int maxcpu) {
+		int i, first, last, count = 0;
+		char *end;
+
+		memset(cpus, 0, maxcpu);
+		while (str && *str) {
+				first = strtol(str, &end, 10);
+				if (end==str)
+						return -1;
+				last = first;
+				str  = end;
+				if (*str=='-') {
+						str++;
+						last = strtol(str, &end, 10);
+						if (end==str)
+								return -1;
+						str = end;
+				}
+				for (i=first; i<=last && i<maxcpu; i++)
+						if (i>=0 && !cpus[i]) {
+								cpus[i] = 1;
+								count++;
+						}
+				while (*str==',' || *str==' ' || *str=='\n')
+						str++;
+		}
+		return count;
+}
+
+/* this returns the number of NUMA nodes, or 0 if they are not known */
+int numa_nodes(void) {
+#if defined (PLATFORM_LINUX)
+		char fname[MAXPATHSIZE];
+		int count = 0;
+
+		while (1) {
+				snprintf(fname, MAXPATHSIZE, "%s/node%d", NODE_ROOT, count);
+				if (access(fname, F_OK)!=0)
+						break;
+				count++;
+		}
+		return count;
+#else
+		return 0;
+#endif
+}
+
+/* mark the cores of the NUMA node, this returns the number of cores */
+int numa_cpulist(int node, unsigned char *cpus, int maxcpu) {
+#if defined (PLATFORM_LINUX)
+		FILE *fp;
+		char fname[MAXPATHSIZE], str[MAXPATHSIZE];
+		int count = -1;
+
+		snprintf(fname, MAXPATHSIZE, "%s/node%d/cpulist", NODE_ROOT, node);
+		if ((fp = fopen(fname, "r"))==NULL)
+				return -1;
+		if (fgets(str, MAXPATHSIZE, fp))
+				count = parse_cpulist(str, cpus, maxcpu);
+		fclose(fp);
+		return count;
+#else
+		return -1;
+#endif
+}
+
+/* the total memory of the NUMA node in bytes, or 0 if it is not known */
+UINT64_T numa_memtotal(int node) {
+#if defined (PLATFORM_LINUX)
+		FILE *fp;
+		char fname[MAXPATHSIZE], str[STRLEN];
+		unsigned long long value;
+		UINT64_T memtotal = 0;
+
+		/* Node 0 MemTotal:       32949684 kB */
+		snprintf(fname, MAXPATHSIZE, "%s/node%d/meminfo", NODE_ROOT, node);
+		if ((fp = fopen(fname, "r"))==NULL)
+				return 0;
+		while (fgets(str, STRLEN, fp)) {
+				if (strstr(str, "MemTotal:") && sscanf(strstr(str, "MemTotal:")+9, "%llu", &value)==1) {
+						memtotal = value*1024;
+						break;
+				}
+		}
+		fclose(fp);
+		return memtotal;
+#else
+		return 0;
+#endif
+}
+
+/* bind this process and the processes that it starts to the cores and to the memory of the NUMA node */
+int bind_partition(const unsigned char *cpus, int maxcpu, int node) {
+#if defined (PLATFORM_LINUX)
+		cpu_set_t mask;
+		unsigned long nodemask;
+		int i, count = 0;
+
+		if (cpus) {
+				CPU_ZERO(&mask);
+				for (i=0; i<maxcpu && i<CPU_SETSIZE; i++)
+						if (cpus[i]) {
+								CPU_SET(i, &mask);
+								count++;
+						}
+				if (count==0 || sched_setaffinity(0, sizeof(cpu_set_t), &mask)!=0) {
+						DEBUG(LOG_ERR, "bind_partition: could not set the CPU affinity");
+						return -1;
+				}
+		}
+
+		if (node>=0 && node<8*sizeof(unsigned long)) {
+				nodemask = 1UL << node;
+				if (syscall(SYS_set_mempolicy, MPOL_BIND, &nodemask, 8*sizeof(unsigned long))!=0) {
+						DEBUG(LOG_ERR, "bind_partition: could not bind the memory to NUMA node %d", node);
+						return -1;
+				}
+		}
+		return 0;
+#else
+		return -1;
+#endif
+}
+
+/* determine the cores, the NUMA node and the memory for slave number index out of count slaves */
+int partition_host(int index, int count, unsigned char *cpus, int maxcpu, int *node, UINT64_T *memory) {
+		unsigned char *allowed = NULL, *nodecpus = NULL;
+		int i, n, first, last, numallowed, numnodes, numslaves, numcpu = 0, success = -1;
+		UINT64_T MemTotal, MemFree, Buffers, Cached;
+
+		*node   = -1;
+		*memory = 0;
+		memset(cpus, 0, maxcpu);
+
+		if (index<0 || index>=count)
+				return -1;
+
+		if ((allowed = (unsigned char *)malloc(maxcpu))==NULL)
+				goto cleanup;
+		if ((nodecpus = (unsigned char *)malloc(maxcpu))==NULL)
+				goto cleanup;
+		if ((numallowed = cpu_affinity(allowed, maxcpu))<1)
+				goto cleanup;
+
+		numnodes = numa_nodes();
+		if (numnodes>1 && count>=numnodes) {
+				/* the slaves are divided over the nodes, and the cores of each node over its slaves */
+				*node = (index*numnodes)/count;
+				if (numa_cpulist(*node, nodecpus, maxcpu)<1)
+						goto cleanup;
+				/* the slaves first..last share this node */
+				first = (*node*count + numnodes - 1)/numnodes;
+				last  = ((*node+1)*count + numnodes - 1)/numnodes - 1;
+				numslaves = last - first + 1;
+				index -= first;
+				for (i=0; i<maxcpu; i++)
+						nodecpus[i] = nodecpus[i] && allowed[i];
+				numallowed = 0;
+				for (i=0; i<maxcpu; i++)
+						numallowed += nodecpus[i];
+				memcpy(allowed, nodecpus, maxcpu);
+				*memory = numa_memtotal(*node)/numslaves;
+		}
+		else {
+				/* all slaves share the memory of the computer, or of the container */
+				numslaves = count;
+				if (smartmem_info(&MemTotal, &MemFree, &Buffers, &Cached)==0)
+						*memory = MemTotal/numslaves;
+		}
+
+		if (numallowed<1)
+				goto cleanup;
+
+		/* each slave gets a contiguous range of the allowed cores, with more slaves than cores they are shared */
+		n = 0;
+		for (i=0; i<maxcpu; i++) {
+				if (!allowed[i])
+						continue;
+				if (numallowed>=numslaves) {
+						if ((n*numslaves)/numallowed==index) {
+								cpus[i] = 1;
+								numcpu++;
+						}
+				}
+				else if (n==(index*numallowed)/numslaves) {
+						cpus[i] = 1;
+						numcpu++;
+				}
+				n++;
+		}
+		success = (numcpu>0 ? numcpu : -1);
+
+cleanup:
+		FREE(allowed);
+		FREE(nodecpus);
+		return success;
+}
@@ -22,26 +22,31 @@
 
 #include "peer.h"
 #include "extern.h"
+#include "serialize.h"
 #include "platform_includes.h"
 
-mxArray *mxSerialize(const mxArray*);
-mxArray *mxDeserialize(const void*, size_t);
 
 #define JOB_FIELDNUMBER 4
 const char* job_fieldnames[JOB_FIELDNUMBER] = {"version", "jobid", "argsize", "optsize"};
 
-#define JOBLIST_FIELDNUMBER 9
-const char* joblist_fieldnames[JOBLIST_FIELDNUMBER] = {"version", "jobid", "argsize", "optsize", "hostid", "hostname", "user", "memreq", "timreq"};
+#define JOBLIST_FIELDNUMBER 10
+const char* joblist_fieldnames[JOBLIST_FIELDNUMBER] = {"version", "jobid", "argsize", "optsize", "hostid", "hostname", "user", "memreq", "timreq", "name"};
 
 #define PEERINFO_FIELDNUMBER 16
 const char* peerinfo_fieldnames[PEERINFO_FIELDNUMBER] = {"hostid", "hostname", "user", "group", "socket", "port", "status", "timavail", "memavail", "cpuavail", "allowuser", "allowgroup", "allowhost", "refuseuser", "refusegroup", "refusehost"};
 
-#define PEERLIST_FIELDNUMBER 11
-const char* peerlist_fieldnames[PEERLIST_FIELDNUMBER] = {"hostid", "hostname", "user", "group", "socket", "port", "status", "timavail", "memavail", "cpuavail", "current"};
+#define PEERLIST_FIELDNUMBER 16
+const char* peerlist_fieldnames[PEERLIST_FIELDNUMBER] = {"hostid", "hostname", "user", "group", "socket", "port", "status", "timavail", "memavail", "cpuavail", "current", "queued", "backlog", "gpuavail", "gpumemavail", "gpuload"};
 
 #define CURRENT_FIELDNUMBER 8
 const char* current_fieldnames[CURRENT_FIELDNUMBER] = {"hostid", "jobid", "hostname", "user", "group", "timreq", "memreq", "cpureq"};
 
+#define TIMING_FIELDNUMBER 6
+const char* timing_fieldnames[TIMING_FIELDNUMBER] = {"submitted", "serialize", "send", "arrived", "receive", "roundtrip"};
+
+#define JOBSTATS_FIELDNUMBER 11
+const char* jobstats_fieldnames[JOBSTATS_FIELDNUMBER] = {"hostid", "hostname", "count", "bytesout", "bytesin", "send", "receive", "roundtrip", "sendrate", "receiverate", "histogram"};
+
 int peerInitialized = 0;
 
 /* the thread IDs are needed for cancelation at cleanup */
@@ -50,6 +55,8 @@ pthread_t tcpserverThread;
 pthread_t announceThread;
 pthread_t discoverThread;
 pthread_t expireThread;
+pthread_t trackerserverThread;
+pthread_t speculatorThread;
 
 /* this is called the first time that the mex-file is loaded */
 void initFun(void) {
@@ -129,6 +136,31 @@ void exitFun(void) {
 				pthread_mutex_unlock(&mutexstatus);
 		}
 
+		pthread_mutex_lock(&mutexstatus);
+		if (trackerserverStatus) {
+				pthread_mutex_unlock(&mutexstatus);
+				mexPrintf("peer: requesting cancelation of trackerserver thread\n");
+				pthread_cancel(trackerserverThread);
+				pthread_join(trackerserverThread, NULL);
+		}
+		else {
+				pthread_mutex_unlock(&mutexstatus);
+		}
+
+		pthread_mutex_lock(&mutexstatus);
+		if (speculatorStatus) {
+				pthread_mutex_unlock(&mutexstatus);
+				mexPrintf("peer: requesting cancelation of speculator thread\n");
+				pthread_cancel(speculatorThread);
+				pthread_join(speculatorThread, NULL);
+		}
+		else {
+				pthread_mutex_unlock(&mutexstatus);
+		}
+
+		/* the upload threads are not cancelled halfway a job, they stop after the jobs that they are sending */
+		upload_stop();
+
 		/* free the shared dynamical memory */
 		peerexit(NULL);
 		peerInitialized = 0;
@@ -141,20 +173,91 @@ void exitFun(void) {
 		return;
 }
 
+/* the name of the function is used by the slaves to estimate how long the job takes */
+void job_name(const mxArray *argin, char *name) {
+		mxArray *fname, *fstr;
+		bzero(name, STRLEN);
+		if (mxIsCell(argin) && mxGetNumberOfElements(argin)>0 && (fname = mxGetCell(argin, 0))!=NULL) {
+				if (mxIsChar(fname)) {
+						mxGetString(fname, name, STRLEN);
+				}
+				else if (mxIsClass(fname, "function_handle") && mexCallMATLAB(1, &fstr, 1, &fname, "func2str")==0) {
+						mxGetString(fstr, name, STRLEN);
+						mxDestroyArray(fstr);
+				}
+		}
+}
+
+/* the priority of the job is specified as 'low', 'normal' or 'high', or as a number */
+UINT64_T job_priority(const mxArray *val) {
+		char str[STRLEN];
+		if (mxIsChar(val)) {
+				mxGetString(val, str, STRLEN);
+				if (strcmp(str, "low")==0)
+						return PRIORITY_LOW;
+				else if (strcmp(str, "high")==0)
+						return PRIORITY_HIGH;
+				else if (strcmp(str, "normal")==0)
+						return PRIORITY_NORMAL;
+				else
+						mexErrMsgTxt("invalid priority, should be 'low', 'normal' or 'high'");
+		}
+		else if (mxIsNumeric(val) && mxGetNumberOfElements(val)==1) {
+				if (mxGetScalar(val)<PRIORITY_LOW)
+						return PRIORITY_LOW;
+				else if (mxGetScalar(val)>PRIORITY_HIGH)
+						return PRIORITY_HIGH;
+				else
+						return (UINT64_T)(mxGetScalar(val)+0.5);
+		}
+		else
+				mexErrMsgTxt("invalid priority");
+		return PRIORITY_NORMAL;
+}
+
+/* return the timing of the job as a structure */
+mxArray *job_timing(const jobtiming_t *timing) {
+		mxArray *val = mxCreateStructMatrix(1, 1, TIMING_FIELDNUMBER, timing_fieldnames);
+		mxSetFieldByNumber(val, 0, 0, mxCreateDoubleScalar(timing->submitted));
+		mxSetFieldByNumber(val, 0, 1, mxCreateDoubleScalar(timing->serialize));
+		mxSetFieldByNumber(val, 0, 2, mxCreateDoubleScalar(timing->send));
+		mxSetFieldByNumber(val, 0, 3, mxCreateDoubleScalar(timing->arrived));
+		mxSetFieldByNumber(val, 0, 4, mxCreateDoubleScalar(timing->receive));
+		mxSetFieldByNumber(val, 0, 5, mxCreateDoubleScalar(timing->roundtrip));
+		return val;
+}
+
+/* return the output arguments of the job, the spooled ones are read from disk, this returns NULL if that fails */
+mxArray *job_results(const joblist_t *job) {
+		mxArray *val;
+		void *arg;
+		if (job->spill==NULL)
+				return (mxArray *)peer_deserialize(job->arg, job->job->argsize);
+		if ((arg = spill_read(job))==NULL)
+				return NULL;
+		val = (mxArray *)peer_deserialize(arg, job->job->argsize);
+		FREE(arg);
+		return val;
+}
+
 void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[]) {
 		char command[STRLEN];
 		char argument[STRLEN];
 		char *ptr;
-		int i, j, n, rc, t, found, handshake, success, count, server, status;
+		int i, j, n, rc, found, success, status;
 		UINT32_T peerid, jobid;
-		UINT64_T memreq, cpureq, timreq;
+		UINT64_T memreq, cpureq, timreq, gpureq, gpumemreq, priority;
+		jobtiming_t timing;
+		double sendstart;
 
 		jobdef_t    *def;
-		joblist_t   *job, *nextjob;
+		joblist_t   *job;
 		peerlist_t  *peer;
 		userlist_t  *allowuser, *refuseuser;
+		fairsharelist_t *fairshare;
 		grouplist_t *allowgroup, *refusegroup;
 		hostlist_t  *allowhost, *refusehost;
+		trackerlist_t *trackerhost;
 		mxArray     *arg, *opt, *key, *val, *current;
 
 		initFun();
@@ -314,6 +417,138 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 				return;
 		}
 
+		/****************************************************************************/
+		else if (strcmp(command, "speculate")==0) {
+				/* the input arguments should be "speculate <start|stop|status> [factor]" */
+				/* a job that takes factor times longer than expected is put once more to another idle slave */
+				if (nrhs<2)
+						mexErrMsgTxt ("invalid number of input arguments");
+				if (!mxIsChar(prhs[1]))
+						mexErrMsgTxt ("invalid input argument #2");
+				if (mxGetString(prhs[1], argument, STRLEN-1))
+						mexErrMsgTxt ("invalid input argument #2");
+				if (nrhs>2) {
+						if (!mxIsNumeric(prhs[2]) || !mxIsScalar(prhs[2]) || mxGetScalar(prhs[2])<=1)
+								mexErrMsgTxt ("invalid input argument #3");
+						pthread_mutex_lock(&mutexjobstat);
+						speculate.factor = mxGetScalar(prhs[2]);
+						pthread_mutex_unlock(&mutexjobstat);
+				}
+				if (strcmp(argument, "start")==0) {
+						if (speculatorStatus) {
+								mexWarnMsgTxt("thread is already running");
+								return;
+						}
+						mexPrintf("peer: spawning speculator thread\n");
+						rc = pthread_create(&speculatorThread, NULL, speculator, (void *)NULL);
+						if (rc)
+								mexErrMsgTxt("problem with return code from pthread_create()");
+						else {
+								/* wait until the thread has properly started */
+								pthread_mutex_lock(&mutexstatus);
+								if (!speculatorStatus)
+										pthread_cond_wait(&condstatus, &mutexstatus);
+								pthread_mutex_unlock(&mutexstatus);
+						}
+				}
+				else if (strcmp(argument, "stop")==0) {
+						if (!speculatorStatus) {
+								mexWarnMsgTxt("thread is not running");
+								return;
+						}
+						mexPrintf("peer: requesting cancelation of speculator thread\n");
+						rc = pthread_cancel(speculatorThread);
+						if (rc)
+								mexErrMsgTxt("problem with return code from pthread_cancel()");
+				}
+				else if (strcmp(argument, "status")==0) {
+						/* the optional outputs are the number of jobs that were put once more, and the number of results that were discarded */
+						plhs[0] = mxCreateDoubleScalar(speculatorStatus);
+						pthread_mutex_lock(&mutexjobstat);
+						if (nlhs>1)
+								plhs[1] = mxCreateDoubleScalar(speculate.launched);
+						if (nlhs>2)
+								plhs[2] = mxCreateDoubleScalar(speculate.discarded);
+						pthread_mutex_unlock(&mutexjobstat);
+				}
+				else
+						mexErrMsgTxt ("invalid input argument #2");
+				return;
+		}
+
+		/****************************************************************************/
+		else if (strcmp(command, "tracker")==0) {
+				/* the input arguments should be "tracker <start|stop|status>" */
+				if (nrhs<2)
+						mexErrMsgTxt ("invalid number of input arguments");
+				if (!mxIsChar(prhs[1]))
+						mexErrMsgTxt ("invalid input argument #2");
+				if (mxGetString(prhs[1], argument, STRLEN-1))
+						mexErrMsgTxt ("invalid input argument #2");
+				if (strcmp(argument, "start")==0) {
+						if (trackerserverStatus) {
+								mexWarnMsgTxt("thread is already running");
+								return;
+						}
+						mexPrintf("peer: spawning trackerserver thread\n");
+						rc = pthread_create(&trackerserverThread, NULL, trackerserver, (void *)NULL);
+						if (rc)
+								mexErrMsgTxt("problem with return code from pthread_create()");
+						else {
+								/* wait until the thread has properly started */
+								pthread_mutex_lock(&mutexstatus);
+								if (!trackerserverStatus)
+										pthread_cond_wait(&condstatus, &mutexstatus);
+								pthread_mutex_unlock(&mutexstatus);
+						}
+				}
+				else if (strcmp(argument, "stop")==0) {
+						if (!trackerserverStatus) {
+								mexWarnMsgTxt("thread is not running");
+								return;
+						}
+						mexPrintf("peer: requesting cancelation of trackerserver thread\n");
+						rc = pthread_cancel(trackerserverThread);
+						if (rc)
+								mexErrMsgTxt("problem with return code from pthread_cancel()");
+				}
+				else if (strcmp(argument, "status")==0) {
+						plhs[0] = mxCreateDoubleScalar(trackerserverStatus);
+				}
+				else
+						mexErrMsgTxt ("invalid input argument #2");
+				return;
+		}
+
+		/****************************************************************************/
+		else if (strcmp(command, "trackerhost")==0) {
+				/* the input arguments should be "trackerhost {<string>, <string>, ...}" */
+				/* an empty cell-array switches back to multicast discovery */
+				if (nrhs<2)
+						mexErrMsgTxt ("invalid number of input arguments");
+				if (!mxIsCell(prhs[1]))
+						mexErrMsgTxt ("invalid input argument #2");
+				/* check that all elements of the cell array are strings */
+				for (i=0; i<mxGetNumberOfElements(prhs[1]); i++) {
+						arg = mxGetCell(prhs[1], i);
+						if (!mxIsChar(arg))
+								mexErrMsgTxt ("invalid input argument #2, the cell-array should contain strings");
+				}
+
+				/* erase the existing list */
+				clear_trackerlist();
+
+				/* add all elements to the list */
+				for (i=0; i<mxGetNumberOfElements(prhs[1]); i++) {
+						arg = mxGetCell(prhs[1], i);
+						if (mxGetString(arg, argument, STRLEN-1))
+								mexErrMsgTxt ("invalid input argument #2");
+						if (add_trackerlist(argument)!=0)
+								mexWarnMsgTxt("could not resolve the name of the tracker");
+				}
+				return;
+		}
+
 		/****************************************************************************/
 		else if (strcmp(command, "udsserver")==0) {
 				/* the input arguments should be "udsserver <start|stop|status>" */
@@ -465,6 +700,11 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 						mxSetFieldByNumber(current, 0, 6, mxCreateDoubleScalar(peer->host->current.memreq));
 						mxSetFieldByNumber(current, 0, 7, mxCreateDoubleScalar(peer->host->current.cpureq));
 						mxSetFieldByNumber(plhs[0], i, j++, current);
+						mxSetFieldByNumber(plhs[0], i, j++, mxCreateDoubleScalar((UINT64_T)(peer->host->queued)));
+						mxSetFieldByNumber(plhs[0], i, j++, mxCreateDoubleScalar((UINT64_T)(peer->host->backlog)));
+						mxSetFieldByNumber(plhs[0], i, j++, mxCreateDoubleScalar((UINT64_T)(peer->host->gpuavail)));
+						mxSetFieldByNumber(plhs[0], i, j++, mxCreateDoubleScalar((UINT64_T)(peer->host->gpumemavail)));
+						mxSetFieldByNumber(plhs[0], i, j++, mxCreateDoubleScalar((UINT64_T)(peer->host->gpuload)));
 
 						i++;
 						peer = peer->next ;
@@ -496,6 +736,7 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 						mxSetFieldByNumber(plhs[0], i, 6, mxCreateString(job->host->user));
 						mxSetFieldByNumber(plhs[0], i, 7, mxCreateDoubleScalar((UINT64_T)(job->job->memreq)));
 						mxSetFieldByNumber(plhs[0], i, 8, mxCreateDoubleScalar((UINT64_T)(job->job->timreq)));
+						mxSetFieldByNumber(plhs[0], i, 9, mxCreateString(job->job->name));
 						job = job->next;
 						i++;
 				}
@@ -534,6 +775,8 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 				mexPrintf("announceStatus  = %d\n", announceStatus);
 				mexPrintf("discoverStatus  = %d\n", discoverStatus);
 				mexPrintf("expireStatus    = %d\n", expireStatus);
+				mexPrintf("trackerserverStatus = %d\n", trackerserverStatus);
+				mexPrintf("speculatorStatus = %d\n", speculatorStatus);
 				pthread_mutex_unlock(&mutexstatus);
 
 				pthread_mutex_lock(&mutexhost);
@@ -546,18 +789,34 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 				mexPrintf("host.timavail   = %llu\n", host->timavail);
 				mexPrintf("host.memavail   = %llu\n", host->memavail);
 				mexPrintf("host.cpuavail   = %llu\n", host->cpuavail);
+				mexPrintf("host.queued     = %llu\n", host->queued);
+				mexPrintf("host.backlog    = %llu\n", host->backlog);
+				mexPrintf("host.gpuavail   = %llu\n", host->gpuavail);
+				mexPrintf("host.gpumemavail = %llu\n", host->gpumemavail);
+				mexPrintf("host.gpuload    = %llu\n", host->gpuload);
 				pthread_mutex_unlock(&mutexhost);
 
 				pthread_mutex_lock(&mutexsmartmem);
 				mexPrintf("smartmem.enabled = %d\n", smartmem.enabled);
 				pthread_mutex_unlock(&mutexsmartmem);
 
+				pthread_mutex_lock(&mutexargcache);
+				mexPrintf("argcache.size    = %llu\n", argcache.size);
+				mexPrintf("argcache.used    = %llu\n", argcache.used);
+				pthread_mutex_unlock(&mutexargcache);
+
 				pthread_mutex_lock(&mutexsmartcpu);
 				mexPrintf("smartcpu.enabled = %d\n", smartcpu.enabled);
 				pthread_mutex_unlock(&mutexsmartcpu);
 
+				pthread_mutex_lock(&mutexsmartgpu);
+				mexPrintf("smartgpu.enabled = %d\n", smartgpu.enabled);
+				pthread_mutex_unlock(&mutexsmartgpu);
+
 				pthread_mutex_lock(&mutexsmartshare);
 				mexPrintf("smartshare.enabled = %d\n", smartshare.enabled);
+				for (fairshare = fairsharelist; fairshare; fairshare = fairshare->next)
+						mexPrintf("fairshare = %s, weight = %g, usage = %g\n", fairshare->user, fairshare->weight, fairshare->usage);
 				pthread_mutex_unlock(&mutexsmartshare);
 
 				pthread_mutex_lock(&mutexallowuserlist);
@@ -608,6 +867,14 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 				}
 				pthread_mutex_unlock(&mutexrefusehostlist);
 
+				pthread_mutex_lock(&mutextrackerlist);
+				trackerhost = trackerlist;
+				while (trackerhost) {
+						mexPrintf("trackerhost = %s:%u\n", trackerhost->name, ntohs(trackerhost->addr.sin_port));
+						trackerhost = trackerhost->next;
+				}
+				pthread_mutex_unlock(&mutextrackerlist);
+
 				i = 0;
 				pthread_mutex_lock(&mutexpeerlist);
 				peer = peerlist;
@@ -622,6 +889,8 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 						mexPrintf("  host.timavail = %llu\n", peer->host->timavail);
 						mexPrintf("  host.memavail = %llu\n", peer->host->memavail);
 						mexPrintf("  host.cpuavail = %llu\n", peer->host->cpuavail);
+						mexPrintf("  host.queued   = %llu\n", peer->host->queued);
+						mexPrintf("  host.backlog  = %llu\n", peer->host->backlog);
 						mexPrintf("  ipaddr        = %s\n", peer->ipaddr);
 						mexPrintf("  time          = %s",   ctime(&(peer->time)));
 						peer = peer->next ;       
@@ -687,6 +956,26 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 				}
 		}
 
+		/****************************************************************************/
+		else if (strcmp(command, "smartgpu")==0) {
+				/* the input arguments should be "smartgpu <0|1> */
+				if (nrhs<2) {
+						mexErrMsgTxt ("invalid number of input arguments");
+				}
+				else {
+
+						if (!mxIsNumeric(prhs[1]))
+								mexErrMsgTxt ("invalid input argument #2");
+						if (!mxIsScalar(prhs[1]))
+								mexErrMsgTxt ("invalid input argument #2");
+
+						pthread_mutex_lock(&mutexsmartgpu);
+						smartgpu.enabled = mxGetScalar(prhs[1]);
+						smartgpu.probed  = 0;
+						pthread_mutex_unlock(&mutexsmartgpu);
+				}
+		}
+
 		/****************************************************************************/
 		else if (strcmp(command, "smartshare")==0) {
 				/* the input arguments should be "smartshare <0|1> */
@@ -760,6 +1049,30 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 				}
 		}
 
+		/****************************************************************************/
+		else if (strcmp(command, "gpuavail")==0) {
+				/* the input arguments should be "gpuavail <number>", with smartgpu this is the maximum */
+				if (nrhs<2) {
+						mexErrMsgTxt ("invalid number of input arguments");
+				}
+				else {
+						if (!mxIsNumeric(prhs[1]))
+								mexErrMsgTxt ("invalid input argument #2");
+						if (!mxIsScalar(prhs[1]))
+								mexErrMsgTxt ("invalid input argument #2");
+
+						pthread_mutex_lock(&mutexhost);
+						host->gpuavail    = (UINT64_T)(mxGetScalar(prhs[1])+0.5);
+						host->gpumemavail = (host->gpuavail>0 ? UINT64_MAX : 0);
+						pthread_mutex_unlock(&mutexhost);
+
+						pthread_mutex_lock(&mutexsmartgpu);
+						smartgpu.gpuavail = (UINT64_T)(mxGetScalar(prhs[1])+0.5);
+						smartgpu.probed   = 0;
+						pthread_mutex_unlock(&mutexsmartgpu);
+				}
+		}
+
 		/****************************************************************************/
 		else if (strcmp(command, "tcpport")==0) {
 				/* the input arguments should be "tcpport <number>" */
@@ -856,6 +1169,7 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 						allowuserlist = allowuser;
 				}
 				pthread_mutex_unlock(&mutexallowuserlist);
+				security_changed();
 
 				/* erase the list of known peers, the updated filtering will be done upon discovery */
 				clear_peerlist();
@@ -890,6 +1204,7 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 						allowgrouplist = allowgroup;
 				}
 				pthread_mutex_unlock(&mutexallowgrouplist);
+				security_changed();
 
 				/* flush the list of known peers, the updated filtering will be done upon discovery */
 				clear_peerlist();
@@ -924,6 +1239,7 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 						allowhostlist = allowhost;
 				}
 				pthread_mutex_unlock(&mutexallowhostlist);
+				security_changed();
 
 				/* flush the list of known peers, the updated filtering will be done upon discovery */
 				clear_peerlist();
@@ -958,6 +1274,7 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 						refuseuserlist = refuseuser;
 				}
 				pthread_mutex_unlock(&mutexrefuseuserlist);
+				security_changed();
 
 				/* erase the list of known peers, the updated filtering will be done upon discovery */
 				clear_peerlist();
@@ -992,6 +1309,7 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 						refusegrouplist = refusegroup;
 				}
 				pthread_mutex_unlock(&mutexrefusegrouplist);
+				security_changed();
 
 				/* flush the list of known peers, the updated filtering will be done upon discovery */
 				clear_peerlist();
@@ -1026,6 +1344,7 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 						refusehostlist = refusehost;
 				}
 				pthread_mutex_unlock(&mutexrefusehostlist);
+				security_changed();
 
 				/* flush the list of known peers, the updated filtering will be done upon discovery */
 				clear_peerlist();
@@ -1033,9 +1352,16 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 
 		/****************************************************************************/
 		else if (strcmp(command, "put")==0) {
-				int hasuds, hastcp;
 				/* the input arguments should be "put <peerid> <arg> <opt> ... "   */
 				/* where additional options should be specified as key-value pairs */
+				/* with 'async' the job is sent in the background, see upload.c    */
+				/* with 'keep' the results stay on the slave for the job that is   */
+				/* put later with 'input' and this jobid, see chain.c              */
+				int async = 0, keep = 0, chained = 0;
+				UINT32_T input = 0, chainpeer = 0, chainsize = 0;
+				UINT64_T chainhash = 0;
+				void *argbuf, *optbuf;
+				size_t argsize, optsize;
 
 				if (nrhs<2)
 						mexErrMsgTxt("invalid argument #2");
@@ -1053,6 +1379,9 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 				memreq = 0; 		/* default assumption */
 				cpureq = 0; 		/* default assumption */
 				timreq = 0; 		/* default assumption */
+				gpureq = 0; 		/* default assumption */
+				gpumemreq = 0; 		/* default assumption */
+				priority = PRIORITY_NORMAL;
 
 				i = 4;
 				while ((i+1)<nrhs) {
@@ -1073,30 +1402,90 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 								cpureq = (UINT64_T)(mxGetScalar(val)+0.5);
 						else if (strcmp(argument, "timreq")==0)
 								timreq = (UINT64_T)(mxGetScalar(val)+0.5);
+						else if (strcmp(argument, "gpureq")==0)
+								gpureq = (UINT64_T)(mxGetScalar(val)+0.5);
+						else if (strcmp(argument, "gpumemreq")==0)
+								gpumemreq = (UINT64_T)(mxGetScalar(val)+0.5);
+						else if (strcmp(argument, "priority")==0)
+								priority = job_priority(val);
+						else if (strcmp(argument, "async")==0)
+								async = (mxGetScalar(val)!=0);
+						else if (strcmp(argument, "keep")==0)
+								keep = (mxGetScalar(val)!=0);
+						else if (strcmp(argument, "input")==0) {
+								input   = (UINT32_T)mxGetScalar(val);
+								chained = 1;
+						}
 				}
 
-				found = 0;
+				if (chained && !chain_lookup(input, &chainpeer, &chainhash, &chainsize))
+						mexErrMsgTxt("the results of the input job are not kept by a slave\n");
+
 				pthread_mutex_lock(&mutexpeerlist);
-				peer = peerlist;
-				while(peer) {
-						if (peer->host->id==peerid) {
-								found = 1;
-								break;
-						}
-						peer = peer->next ;
+				/* the slave that keeps the input is preferred, otherwise it sends the input to the specified slave */
+				if (chained && chainpeer!=peerid && (peer = lookup_peerlist(chainpeer))!=NULL && peer->host->status==STATUS_IDLE) {
+						DEBUG(LOG_INFO, "peer: putting job %u to peer %u that keeps its input", jobid, chainpeer);
+						peerid = chainpeer;
 				}
+				found = (lookup_peerlist(peerid)!=NULL);
+				pthread_mutex_unlock(&mutexpeerlist);
 
-				if (!found) {
-						pthread_mutex_unlock(&mutexpeerlist);
+				if (!found)
 						mexErrMsgTxt("failed to locate specified peer\n");
+
+				memset(&timing, 0, sizeof(jobtiming_t));
+				timing.submitted = walltime();
+
+				if (async) {
+						/* the serialized arguments and options are taken over by the upload thread */
+						argbuf = peer_serialize_malloc(prhs[2], &argsize);
+						optbuf = (argbuf ? peer_serialize_malloc(prhs[3], &optsize) : NULL);
+						def    = (optbuf ? (jobdef_t *)malloc(sizeof(jobdef_t)) : NULL);
+						if (!def) {
+								FREE(argbuf);
+								FREE(optbuf);
+								mexErrMsgTxt("could not serialize job arguments and options");
+						}
+
+						def->version  = VERSION;
+						def->id       = jobid;
+						def->memreq   = memreq;
+						def->cpureq   = cpureq;
+						def->timreq   = timreq;
+						def->gpureq   = gpureq;
+						def->gpumemreq = gpumemreq;
+						def->argsize  = argsize;
+						def->optsize  = optsize;
+						job_name(prhs[2], def->name);
+						def->arghash  = (def->argsize>=ARGCACHE_MINSIZE ? argcache_hash(argbuf, def->argsize) : 0);
+						def->flags    = (keep ? JOBFLAG_KEEP : 0);
+						def->priority = priority;
+						def->chainhash = chainhash;
+						def->chainsize = chainsize;
+						def->chainpeer = chainpeer;
+						timing.serialize = walltime() - timing.submitted;
+
+						/* this only waits if the jobs that are still to be sent take too much memory */
+						if (!upload_put(peerid, def, argbuf, optbuf, &timing)) {
+								FREE(def);
+								mexErrMsgTxt ("failed to queue job arguments");
+						}
+
+						plhs[0] = mxCreateStructMatrix(1, 1, JOB_FIELDNUMBER, job_fieldnames);
+						mxSetFieldByNumber(plhs[0], 0, 0, mxCreateDoubleScalar((UINT32_T)(def->version)));
+						mxSetFieldByNumber(plhs[0], 0, 1, mxCreateDoubleScalar((UINT32_T)(def->id)));
+						mxSetFieldByNumber(plhs[0], 0, 2, mxCreateDoubleScalar((UINT32_T)(def->argsize)));
+						mxSetFieldByNumber(plhs[0], 0, 3, mxCreateDoubleScalar((UINT32_T)(def->optsize)));
+						FREE(def);
+						return;
 				}
 
-				arg = (mxArray *) mxSerialize(prhs[2]);
+				arg = (mxArray *) peer_serialize(prhs[2]);
 				if (!arg) {
 						mexErrMsgTxt("could not serialize job arguments");
 				}
 
-				opt = (mxArray *) mxSerialize(prhs[3]);
+				opt = (mxArray *) peer_serialize(prhs[3]);
 				if (!opt) {
 						mxDestroyArray(arg);
 						arg = NULL;
@@ -1112,117 +1501,36 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 						mexErrMsgTxt("could not allocate memory");
 				}
 
-				pthread_mutex_lock(&mutexhost);
-				hasuds = (strlen(peer->host->socket)>0 && strcmp(peer->host->name, host->name)==0);
-				hastcp = (peer->host->port>0);
-				pthread_mutex_unlock(&mutexhost);
-
-				if (hasuds) {
-						/* open the UDS socket */
-						if ((server = open_uds_connection(peer->host->socket)) < 0) {
-								pthread_mutex_unlock(&mutexpeerlist);
-								mexErrMsgTxt("failed to create socket\n");
-						}
-				}
-				else if (hastcp) {
-						/* open the TCP socket */
-						if ((server = open_tcp_connection(peer->ipaddr, peer->host->port)) < 0) {
-								pthread_mutex_unlock(&mutexpeerlist);
-								mexErrMsgTxt("failed to create socket\n");
-						}
-				}
-				else {
-						pthread_mutex_unlock(&mutexpeerlist);
-						mexErrMsgTxt("failed to create socket\n");
-				}
-
-				/* the connection was opened without error */
-				pthread_mutex_unlock(&mutexpeerlist);
-
-				if ((n = bufread(server, &handshake, sizeof(int))) != sizeof(int)) {
-						close_connection(server);
-						mexErrMsgTxt("tcpsocket: could not write handshake");
-				}
-
-				if (!handshake) {
-						close_connection(server);
-						mexErrMsgTxt("failed to negociate connection");
-				}
-
-				/* the message that will be written consists of
-				   message->host
-				   message->job
-				   message->arg
-				   message->opt
-				 */
-
 				def->version  = VERSION;
 				def->id       = jobid;
 				def->memreq   = memreq;
 				def->cpureq   = cpureq;
 				def->timreq   = timreq;
+				def->gpureq   = gpureq;
+				def->gpumemreq = gpumemreq;
 				def->argsize  = mxGetNumberOfElements(arg);
 				def->optsize  = mxGetNumberOfElements(opt);
 
-				/* write the message  (hostdef, jobdef, arg, opt) with handshakes in between */
-				/* the slave may close the connection between the message segments in case the job is refused */
-				success = 1;
+				job_name(prhs[2], def->name);
 
-				pthread_mutex_lock(&mutexhost);
-				if (success) 
-						success = (bufwrite(server, host, sizeof(hostdef_t)) == sizeof(hostdef_t));
-				pthread_mutex_unlock(&mutexhost);
+				/* large arguments are identified by their hash, the slave may have them in its cache */
+				def->arghash  = (def->argsize>=ARGCACHE_MINSIZE ? argcache_hash(mxGetData(arg), def->argsize) : 0);
+				def->flags    = (keep ? JOBFLAG_KEEP : 0);
+				def->priority = priority;
+				def->chainhash = chainhash;
+				def->chainsize = chainsize;
+				def->chainpeer = chainpeer;
 
-				if ((n = bufread(server, &handshake, sizeof(int))) != sizeof(int)) {
-						close_connection(server);
-						mexErrMsgTxt("could not write handshake");
-				}
+				timing.serialize = walltime() - timing.submitted;
+				sendstart = walltime();
 
-				if (!handshake) {
-						close_connection(server);
-						mexErrMsgTxt("failed to write hostdef");
-				}
+				/* the connection to the peer is kept open for the next job */
+				success = write_job(peerid, def, mxGetData(arg), mxGetData(opt));
+				timing.send = walltime() - sendstart;
 
+				/* the timing is completed when the results arrive */
 				if (success)
-						success = (bufwrite(server, def, sizeof(jobdef_t)) == sizeof(jobdef_t));
-
-				if ((n = bufread(server, &handshake, sizeof(int))) != sizeof(int)) {
-						close_connection(server);
-						mexErrMsgTxt("could not write handshake");
-				}
-
-				if (!handshake) {
-						close_connection(server);
-						mexErrMsgTxt("failed to write jobdef");
-				}
-
-				if (success) 
-						success = (bufwrite(server, (void *)mxGetData(arg), def->argsize) == def->argsize);
-
-				if ((n = bufread(server, &handshake, sizeof(int))) != sizeof(int)) {
-						close_connection(server);
-						mexErrMsgTxt("could not write handshake");
-				}
-
-				if (!handshake) {
-						close_connection(server);
-						mexErrMsgTxt("failed to write arg");
-				}
-
-				if (success) 
-						success = (bufwrite(server, (void *)mxGetData(opt), def->optsize) == def->optsize);
-
-				if ((n = bufread(server, &handshake, sizeof(int))) != sizeof(int)) {
-						close_connection(server);
-						mexErrMsgTxt("could not write handshake");
-				}
-
-				if (!handshake) {
-						close_connection(server);
-						mexErrMsgTxt("failed to write opt");
-				}
-
-				close_connection(server);
+						jobstat_put(peerid, def, mxGetData(arg), mxGetData(opt), &timing);
 
 				mxDestroyArray(arg);
 				arg = NULL;
@@ -1259,15 +1567,17 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 
 				found = 0;
 				pthread_mutex_lock(&mutexjoblist);
-				job = joblist;
-				while(job) {
-						found = (job->job->id==jobid);
-						if (found) {
-								plhs[0] = (mxArray *)mxDeserialize(job->arg, job->job->argsize);
-								plhs[1] = (mxArray *)mxDeserialize(job->opt, job->job->optsize);
-								break;
-						}
-						job = job->next ;
+				job = lookup_joblist(jobid);
+				found = (job!=NULL);
+				if (found && (plhs[0] = job_results(job))==NULL) {
+						pthread_mutex_unlock(&mutexjoblist);
+						mexErrMsgTxt("failed to read the spooled results of the job\n");
+				}
+				if (found) {
+						plhs[1] = (mxArray *)peer_deserialize(job->opt, job->job->optsize);
+						/* the timing on the slave is part of the options, this is the timing on the master */
+						if (nlhs>2)
+								plhs[2] = job_timing(&job->timing);
 				}
 
 				if (!found) {
@@ -1279,6 +1589,456 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 				return;
 		}
 
+		/****************************************************************************/
+		else if (strcmp(command, "upload")==0) {
+				/* the input arguments should be "upload <status|flush|maxmem> [bytes]", this is about the jobs that were put with 'async' */
+				if (nrhs<2)
+						mexErrMsgTxt ("invalid number of input arguments");
+				if (!mxIsChar(prhs[1]))
+						mexErrMsgTxt ("invalid input argument #2");
+				if (mxGetString(prhs[1], argument, STRLEN-1))
+						mexErrMsgTxt ("invalid input argument #2");
+				if (strcmp(argument, "status")==0) {
+						/* the outputs are the number of jobs that are still to be sent, their size in bytes, */
+						/* the number of jobs that were sent, and the ids of the jobs that failed since the last call */
+						pthread_mutex_lock(&mutexupload);
+						plhs[0] = mxCreateDoubleScalar(upload.pending);
+						if (nlhs>1)
+								plhs[1] = mxCreateDoubleScalar((double)upload.queued);
+						if (nlhs>2)
+								plhs[2] = mxCreateDoubleScalar(upload.sent);
+						if (nlhs>3) {
+								n = (upload.numfailed<UPLOAD_FAILED ? upload.numfailed : UPLOAD_FAILED);
+								plhs[3] = mxCreateDoubleMatrix(n, 1, mxREAL);
+								for (i=0; i<n; i++)
+										mxGetPr(plhs[3])[i] = upload.failed[i];
+						}
+						if (upload.numfailed>UPLOAD_FAILED)
+								DEBUG(LOG_ERR, "upload: only the first %d of %u failed jobs are returned", UPLOAD_FAILED, upload.numfailed);
+						upload.numfailed = 0;
+						pthread_mutex_unlock(&mutexupload);
+				}
+				else if (strcmp(argument, "flush")==0) {
+						upload_flush();
+				}
+				else if (strcmp(argument, "maxmem")==0) {
+						if (nrhs<3 || !mxIsNumeric(prhs[2]) || mxGetScalar(prhs[2])<0)
+								mexErrMsgTxt ("invalid input argument #3");
+						pthread_mutex_lock(&mutexupload);
+						upload.maxmem = (UINT64_T)(mxGetScalar(prhs[2])+0.5);
+						/* put may wait for less memory than before */
+						pthread_cond_broadcast(&condupload);
+						pthread_mutex_unlock(&mutexupload);
+				}
+				else
+						mexErrMsgTxt ("invalid input argument #2");
+				return;
+		}
+
+		/****************************************************************************/
+		else if (strcmp(command, "spool")==0) {
+				/* the input arguments should be "spool <status|maxmem> [bytes]", this is about the results that are kept on disk */
+				UINT32_T spooled;
+				UINT64_T used;
+				if (nrhs<2)
+						mexErrMsgTxt ("invalid number of input arguments");
+				if (!mxIsChar(prhs[1]))
+						mexErrMsgTxt ("invalid input argument #2");
+				if (mxGetString(prhs[1], argument, STRLEN-1))
+						mexErrMsgTxt ("invalid input argument #2");
+				if (strcmp(argument, "status")==0) {
+						/* the outputs are the number of jobs whose results are on disk, the bytes of those in memory, and the threshold */
+						used    = joblist_memory(&spooled);
+						plhs[0] = mxCreateDoubleScalar(spooled);
+						if (nlhs>1)
+								plhs[1] = mxCreateDoubleScalar((double)used);
+						if (nlhs>2) {
+								pthread_mutex_lock(&mutexspool);
+								plhs[2] = mxCreateDoubleScalar((double)spool.maxmem);
+								pthread_mutex_unlock(&mutexspool);
+						}
+				}
+				else if (strcmp(argument, "maxmem")==0) {
+						/* this applies to the results that arrive from now on, zero means that they are always kept in memory */
+						if (nrhs<3 || !mxIsNumeric(prhs[2]) || mxGetScalar(prhs[2])<0)
+								mexErrMsgTxt ("invalid input argument #3");
+						pthread_mutex_lock(&mutexspool);
+						spool.maxmem = (UINT64_T)(mxGetScalar(prhs[2])+0.5);
+						pthread_mutex_unlock(&mutexspool);
+				}
+				else
+						mexErrMsgTxt ("invalid input argument #2");
+				return;
+		}
+
+		/****************************************************************************/
+		else if (strcmp(command, "put_batch")==0) {
+				size_t numjob, numpeer;
+				const mxArray *jobids = NULL, *argin;
+				UINT32_T *batchid = NULL, reduceid = 0;
+				int reduce = 0, dim = 1;
+				/* the input arguments should be "put_batch <peerid> <args> <opt> ... ", where args is a cell-array */
+				/* with the input arguments of each job and where all jobs share the same options */
+				/* the peerid is either a scalar or a vector with one peer per job, the optional key-value */
+				/* pairs are the same as for "put", except that the jobid should be a vector with one jobid per job */
+				/* with 'reduce' being 'sum', 'mean', 'max', 'min' or 'concat' and the optional 'dim' for concat, */
+				/* the results are reduced while they arrive, the third output is the id for "get_reduce" */
+
+				if (nrhs<2)
+						mexErrMsgTxt("invalid argument #2");
+				if (!mxIsDouble(prhs[1]))
+						mexErrMsgTxt ("invalid input argument #2");
+
+				if (nrhs<3)
+						mexErrMsgTxt("invalid argument #3");
+				if (!mxIsCell(prhs[2]))
+						mexErrMsgTxt ("invalid input argument #3");
+
+				if (nrhs<4)
+						mexErrMsgTxt("invalid argument #4");
+
+				numjob  = mxGetNumberOfElements(prhs[2]);
+				numpeer = mxGetNumberOfElements(prhs[1]);
+				if (numpeer!=1 && numpeer!=numjob)
+						mexErrMsgTxt ("the number of peers should be one or the same as the number of jobs");
+
+				memreq = 0; 		/* default assumption */
+				cpureq = 0; 		/* default assumption */
+				timreq = 0; 		/* default assumption */
+				gpureq = 0; 		/* default assumption */
+				gpumemreq = 0; 		/* default assumption */
+				priority = PRIORITY_NORMAL;
+
+				i = 4;
+				while ((i+1)<nrhs) {
+						key = (mxArray *)prhs[i++];
+						val = (mxArray *)prhs[i++];
+
+						if (!mxIsChar(key))
+								mexErrMsgTxt ("optional arguments should come in key-value pairs");
+						if (mxGetString(key, argument, STRLEN-1))
+								mexErrMsgTxt ("optional arguments should come in key-value pairs");
+
+						/* use the optional parameter value, beware of the typecasting to 32 and 64 bit integers */
+						if      (strcmp(argument, "jobid")==0)
+								jobids = val;
+						else if (strcmp(argument, "memreq")==0)
+								memreq = (UINT64_T)(mxGetScalar(val)+0.5);
+						else if (strcmp(argument, "cpureq")==0)
+								cpureq = (UINT64_T)(mxGetScalar(val)+0.5);
+						else if (strcmp(argument, "timreq")==0)
+								timreq = (UINT64_T)(mxGetScalar(val)+0.5);
+						else if (strcmp(argument, "gpureq")==0)
+								gpureq = (UINT64_T)(mxGetScalar(val)+0.5);
+						else if (strcmp(argument, "gpumemreq")==0)
+								gpumemreq = (UINT64_T)(mxGetScalar(val)+0.5);
+						else if (strcmp(argument, "priority")==0)
+								priority = job_priority(val);
+						else if (strcmp(argument, "dim")==0)
+								dim = (int)(mxGetScalar(val)+0.5);
+						else if (strcmp(argument, "reduce")==0) {
+								if (!mxIsChar(val) || mxGetString(val, argument, STRLEN-1))
+										mexErrMsgTxt ("invalid reduction");
+								if      (strcmp(argument, "sum")==0)
+										reduce = REDUCE_SUM;
+								else if (strcmp(argument, "mean")==0)
+										reduce = REDUCE_MEAN;
+								else if (strcmp(argument, "max")==0)
+										reduce = REDUCE_MAX;
+								else if (strcmp(argument, "min")==0)
+										reduce = REDUCE_MIN;
+								else if (strcmp(argument, "concat")==0)
+										reduce = REDUCE_CONCAT;
+								else
+										mexErrMsgTxt ("invalid reduction, should be sum, mean, max, min or concat");
+						}
+				}
+
+				if (jobids && (!mxIsDouble(jobids) || mxGetNumberOfElements(jobids)!=numjob))
+						mexErrMsgTxt ("the jobid should be a vector with one jobid per job");
+				if (dim<1 || dim>32)
+						mexErrMsgTxt ("invalid dimension for concatenation");
+
+				/* the options are the same for all jobs, hence they are serialized only once */
+				opt = (mxArray *) peer_serialize(prhs[3]);
+				if (!opt) {
+						mexErrMsgTxt("could not serialize job options");
+				}
+
+				def = (jobdef_t *)malloc(sizeof(jobdef_t));
+				if (!def) {
+						mxDestroyArray(opt);
+						opt = NULL;
+						mexErrMsgTxt("could not allocate memory");
+				}
+
+				/* the results can arrive before all jobs have been put, hence the reduction is started first */
+				if (reduce) {
+						if ((batchid = (UINT32_T *)malloc(numjob*sizeof(UINT32_T)))==NULL) {
+								FREE(def);
+								mxDestroyArray(opt);
+								opt = NULL;
+								mexErrMsgTxt("could not allocate memory");
+						}
+						for (i=0; i<numjob; i++)
+								batchid[i] = (jobids ? (UINT32_T)(mxGetPr(jobids)[i]) : rand());
+						reduceid = rand();
+						if (reduce_batch(reduceid, reduce, dim-1, numjob, batchid)!=0) {
+								FREE(batchid);
+								FREE(def);
+								mxDestroyArray(opt);
+								opt = NULL;
+								mexErrMsgTxt("could not allocate memory");
+						}
+				}
+
+				/* the errors are not fatal from here on, the jobs that failed are returned as such */
+				plhs[0] = mxCreateStructMatrix(numjob, 1, JOB_FIELDNUMBER, job_fieldnames);
+				if (nlhs>1)
+						plhs[1] = mxCreateLogicalMatrix(numjob, 1);
+				if (nlhs>2)
+						plhs[2] = mxCreateDoubleScalar(reduceid);
+
+				for (i=0; i<numjob; i++) {
+						peerid = (UINT32_T)(mxGetPr(prhs[1])[numpeer==1 ? 0 : i]);
+						if (batchid)
+								jobid = batchid[i];
+						else
+								jobid = (jobids ? (UINT32_T)(mxGetPr(jobids)[i]) : rand());
+
+						memset(&timing, 0, sizeof(jobtiming_t));
+						timing.submitted = walltime();
+
+						argin = mxGetCell(prhs[2], i);
+						arg   = (argin ? (mxArray *) peer_serialize(argin) : NULL);
+						if (!arg) {
+								DEBUG(LOG_ERR, "could not serialize the arguments of job %d", i+1);
+								if (reduce)
+										reduce_skip(reduceid, jobid);
+								continue;
+						}
+
+						def->version  = VERSION;
+						def->id       = jobid;
+						def->memreq   = memreq;
+						def->cpureq   = cpureq;
+						def->timreq   = timreq;
+						def->gpureq   = gpureq;
+						def->gpumemreq = gpumemreq;
+						def->argsize  = mxGetNumberOfElements(arg);
+						def->optsize  = mxGetNumberOfElements(opt);
+						job_name(argin, def->name);
+						/* the jobs of a parameter sweep often share the same large arguments */
+						def->arghash  = (def->argsize>=ARGCACHE_MINSIZE ? argcache_hash(mxGetData(arg), def->argsize) : 0);
+						def->flags    = 0;
+						def->priority = priority;
+						def->chainhash = 0;
+						def->chainsize = 0;
+						def->chainpeer = 0;
+
+						timing.serialize = walltime() - timing.submitted;
+						sendstart = walltime();
+
+						success = write_job(peerid, def, mxGetData(arg), mxGetData(opt));
+						timing.send = walltime() - sendstart;
+
+						if (success)
+								jobstat_put(peerid, def, mxGetData(arg), mxGetData(opt), &timing);
+
+						mxDestroyArray(arg);
+						arg = NULL;
+
+						if (!success) {
+								DEBUG(LOG_ERR, "failed to put job %u to peer %u", jobid, peerid);
+								if (reduce)
+										reduce_skip(reduceid, jobid);
+								continue;
+						}
+
+						mxSetFieldByNumber(plhs[0], i, 0, mxCreateDoubleScalar((UINT32_T)(def->version)));
+						mxSetFieldByNumber(plhs[0], i, 1, mxCreateDoubleScalar((UINT32_T)(def->id)));
+						mxSetFieldByNumber(plhs[0], i, 2, mxCreateDoubleScalar((UINT32_T)(def->argsize)));
+						mxSetFieldByNumber(plhs[0], i, 3, mxCreateDoubleScalar((UINT32_T)(def->optsize)));
+						if (nlhs>1)
+								mxGetLogicals(plhs[1])[i] = 1;
+				}
+
+				FREE(batchid);
+				FREE(def);
+				mxDestroyArray(opt);
+				opt = NULL;
+				return;
+		}
+
+		/****************************************************************************/
+		else if (strcmp(command, "get_reduce")==0) {
+				UINT64_T size;
+				UINT32_T count, pending;
+				int clearjob = 0;
+				void *buf;
+				/* the input arguments should be "get_reduce <id> ..." with the optional key-value pair 'clear' */
+				/* this returns the reduced output arguments of the batch, the number of results that were */
+				/* reduced and the number of results that are still expected */
+				if (nrhs<2)
+						mexErrMsgTxt ("invalid number of input arguments");
+				if (!mxIsDouble(prhs[1]))
+						mexErrMsgTxt ("invalid input argument #2");
+
+				i = 2;
+				while ((i+1)<nrhs) {
+						key = (mxArray *)prhs[i++];
+						val = (mxArray *)prhs[i++];
+
+						if (!mxIsChar(key))
+								mexErrMsgTxt ("optional arguments should come in key-value pairs");
+						if (mxGetString(key, argument, STRLEN-1))
+								mexErrMsgTxt ("optional arguments should come in key-value pairs");
+
+						if (strcmp(argument, "clear")==0)
+								clearjob = (mxGetScalar(val)!=0);
+				}
+
+				buf = reduce_result((UINT32_T)mxGetScalar(prhs[1]), &size, &count, &pending, clearjob);
+				if (buf) {
+						plhs[0] = peer_deserialize(buf, size);
+						FREE(buf);
+				}
+				else {
+						plhs[0] = NULL;
+				}
+				if (plhs[0]==NULL)
+						plhs[0] = mxCreateCellMatrix(0, 0);
+				if (nlhs>1)
+						plhs[1] = mxCreateDoubleScalar(count);
+				if (nlhs>2)
+						plhs[2] = mxCreateDoubleScalar(pending);
+				return;
+		}
+
+		/****************************************************************************/
+		else if (strcmp(command, "get_batch")==0) {
+				size_t numjob;
+				int clearjob = 0;
+				mxArray *argout;
+				/* the input arguments should be "get_batch <jobids> ..." with the optional key-value pair 'clear' */
+				/* this returns cell-arrays with the output arguments and the options of the specified jobs, */
+				/* which are empty for the jobs that have not returned yet, and a logical vector with those that have */
+				if (nrhs<2)
+						mexErrMsgTxt ("invalid number of input arguments");
+				if (!mxIsDouble(prhs[1]))
+						mexErrMsgTxt ("invalid input argument #2");
+
+				i = 2;
+				while ((i+1)<nrhs) {
+						key = (mxArray *)prhs[i++];
+						val = (mxArray *)prhs[i++];
+
+						if (!mxIsChar(key))
+								mexErrMsgTxt ("optional arguments should come in key-value pairs");
+						if (mxGetString(key, argument, STRLEN-1))
+								mexErrMsgTxt ("optional arguments should come in key-value pairs");
+
+						if (strcmp(argument, "clear")==0)
+								clearjob = (mxGetScalar(val)!=0);
+				}
+
+				numjob  = mxGetNumberOfElements(prhs[1]);
+				plhs[0] = mxCreateCellMatrix(mxGetM(prhs[1]), mxGetN(prhs[1]));
+				plhs[1] = mxCreateCellMatrix(mxGetM(prhs[1]), mxGetN(prhs[1]));
+				if (nlhs>2)
+						plhs[2] = mxCreateLogicalMatrix(mxGetM(prhs[1]), mxGetN(prhs[1]));
+
+				/* all results are collected while holding the lock only once */
+				pthread_mutex_lock(&mutexjoblist);
+				for (i=0; i<numjob; i++) {
+						jobid = (UINT32_T)(mxGetPr(prhs[1])[i]);
+						if ((job = lookup_joblist(jobid))==NULL)
+								continue;
+
+						/* the results that cannot be read from disk are not found, and are not cleared */
+						if ((argout = job_results(job))==NULL)
+								continue;
+						mxSetCell(plhs[0], i, argout);
+						mxSetCell(plhs[1], i, (mxArray *)peer_deserialize(job->opt, job->job->optsize));
+						if (nlhs>2)
+								mxGetLogicals(plhs[2])[i] = 1;
+
+						if (clearjob) {
+								/* remove the job from the list, this is the same as "clear" */
+								remove_joblist(job);
+								FREE(job->job);
+								FREE(job->host);
+								FREE(job->arg);
+								FREE(job->opt);
+								spill_remove(&job->spill);
+								FREE(job);
+						}
+				}
+				pthread_mutex_unlock(&mutexjoblist);
+				return;
+		}
+
+		/****************************************************************************/
+		else if (strcmp(command, "wait_any")==0) {
+				size_t numjob = 0;
+				double timeout = mxGetInf();
+				struct timeval now;
+				struct timespec deadline;
+				/* the input arguments should be "wait_any <jobids> <timeout>", where the timeout is in seconds */
+				/* this blocks until one of the specified jobs has returned, or any job if jobids is empty, */
+				/* and returns its jobid, or an empty array if the timeout passed before that */
+				if (nrhs>1) {
+						if (!mxIsDouble(prhs[1]))
+								mexErrMsgTxt ("invalid input argument #2");
+						numjob = mxGetNumberOfElements(prhs[1]);
+				}
+				if (nrhs>2) {
+						if (!mxIsNumeric(prhs[2]) || !mxIsScalar(prhs[2]))
+								mexErrMsgTxt ("invalid input argument #3");
+						timeout = mxGetScalar(prhs[2]);
+				}
+
+				if (!mxIsInf(timeout)) {
+						if (timeout<0)
+								timeout = 0;
+						gettimeofday(&now, NULL);
+						deadline.tv_sec  = now.tv_sec + (time_t)timeout;
+						deadline.tv_nsec = now.tv_usec*1000 + (long)((timeout-(time_t)timeout)*1000000000);
+						if (deadline.tv_nsec>=1000000000) {
+								deadline.tv_sec++;
+								deadline.tv_nsec -= 1000000000;
+						}
+				}
+
+				found = 0;
+				rc = 0;
+				pthread_mutex_lock(&mutexjoblist);
+				while (!found && rc==0) {
+						if (numjob==0 && joblist) {
+								found = 1;
+								jobid = joblist->job->id;
+						}
+						for (i=0; i<numjob && !found; i++) {
+								jobid = (UINT32_T)(mxGetPr(prhs[1])[i]);
+								found = (lookup_joblist(jobid)!=NULL);
+						}
+						if (found)
+								break;
+						/* tcpsocket signals the condition when a job has been added to the list */
+						if (mxIsInf(timeout))
+								rc = pthread_cond_wait(&condjoblist, &mutexjoblist);
+						else
+								rc = pthread_cond_timedwait(&condjoblist, &mutexjoblist, &deadline);
+				}
+				pthread_mutex_unlock(&mutexjoblist);
+
+				if (found)
+						plhs[0] = mxCreateDoubleScalar(jobid);
+				else
+						plhs[0] = mxCreateDoubleMatrix(0, 0, mxREAL);
+				return;
+		}
+
 		/****************************************************************************/
 		else if (strcmp(command, "clear")==0) {
 				/* the input arguments should be "clear <jobid>" */
@@ -1293,42 +2053,16 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 				found = 0;
 				pthread_mutex_lock(&mutexjoblist);
 
-				/* test the first item on the list */
-				if (joblist)
-				{
-						if (joblist->job->id==jobid) {
-								found = 1;
-								/* delete the first item in the list */
-								nextjob = joblist->next;
-								FREE(joblist->job);
-								FREE(joblist->host);
-								FREE(joblist->arg);
-								FREE(joblist->opt);
-								FREE(joblist);
-								joblist = nextjob;
-						}
-				}
-
-				/* traverse the list */
-				job = joblist;
-				while(job) {
-						/* test the next item on the list, remember the current one */
-						nextjob = job->next;
-						if (nextjob) {
-								if (nextjob->job->id==jobid) {
-										found = 1;
-										/* skip the next item in the list */
-										job->next = nextjob->next;
-										/* delete the next item in the list */
-										FREE(nextjob->job);
-										FREE(nextjob->host);
-										FREE(nextjob->arg);
-										FREE(nextjob->opt);
-										FREE(nextjob);
-										break;
-								}
-						}
-						job = job->next;
+				job = lookup_joblist(jobid);
+				if (job) {
+						found = 1;
+						remove_joblist(job);
+						FREE(job->job);
+						FREE(job->host);
+						FREE(job->arg);
+						FREE(job->opt);
+						spill_remove(&job->spill);
+						FREE(job);
 				}
 
 				pthread_mutex_unlock(&mutexjoblist);
@@ -1340,6 +2074,50 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 				return;
 		}
 
+		/****************************************************************************/
+		else if (strcmp(command, "jobstats")==0) {
+				slavestatlist_t *slave;
+				/* this returns the throughput and the roundtrip time per slave, with "jobstats clear" they are reset */
+				if (nrhs>1) {
+						if (!mxIsChar(prhs[1]))
+								mexErrMsgTxt ("invalid input argument #2");
+						if (mxGetString(prhs[1], argument, STRLEN-1))
+								mexErrMsgTxt ("invalid input argument #2");
+						if (strcmp(argument, "clear")!=0)
+								mexErrMsgTxt ("invalid input argument #2");
+						clear_jobstat();
+						return;
+				}
+
+				pthread_mutex_lock(&mutexjobstat);
+				i = 0;
+				for (slave = slavestatlist; slave; slave = slave->next)
+						i++;
+				plhs[0] = mxCreateStructMatrix(i, 1, JOBSTATS_FIELDNUMBER, jobstats_fieldnames);
+				i = 0;
+				for (slave = slavestatlist; slave; slave = slave->next, i++) {
+						j = 0;
+						mxSetFieldByNumber(plhs[0], i, j++, mxCreateDoubleScalar((UINT32_T)(slave->hostid)));
+						mxSetFieldByNumber(plhs[0], i, j++, mxCreateString(slave->name));
+						mxSetFieldByNumber(plhs[0], i, j++, mxCreateDoubleScalar((UINT32_T)(slave->count)));
+						mxSetFieldByNumber(plhs[0], i, j++, mxCreateDoubleScalar((UINT64_T)(slave->bytesout)));
+						mxSetFieldByNumber(plhs[0], i, j++, mxCreateDoubleScalar((UINT64_T)(slave->bytesin)));
+						mxSetFieldByNumber(plhs[0], i, j++, mxCreateDoubleScalar(slave->send));
+						mxSetFieldByNumber(plhs[0], i, j++, mxCreateDoubleScalar(slave->receive));
+						mxSetFieldByNumber(plhs[0], i, j++, mxCreateDoubleScalar(slave->roundtrip));
+						/* in bytes per second */
+						mxSetFieldByNumber(plhs[0], i, j++, mxCreateDoubleScalar(slave->send>0 ? slave->bytesout/slave->send : 0));
+						mxSetFieldByNumber(plhs[0], i, j++, mxCreateDoubleScalar(slave->receive>0 ? slave->bytesin/slave->receive : 0));
+						/* the first bin ends at JOBSTAT_MINTIME, each following bin is twice as wide */
+						val = mxCreateDoubleMatrix(1, JOBSTAT_BINS, mxREAL);
+						for (n=0; n<JOBSTAT_BINS; n++)
+								mxGetPr(val)[n] = slave->histogram[n];
+						mxSetFieldByNumber(plhs[0], i, j++, val);
+				}
+				pthread_mutex_unlock(&mutexjobstat);
+				return;
+		}
+
 		/****************************************************************************/
 		else if (strcmp(command, "peerinfo")==0) {
 				pthread_mutex_lock(&mutexhost);
@@ -39,10 +39,12 @@
 #define STATUS_MASTER            1			/* status = 1 means master mode, accept everything       */
 #define STATUS_IDLE              2			/* status = 2 means idle slave, accept only a single job */
 #define STATUS_BUSY              3 			/* status = 3 means busy slave, don't accept a new job   */
+												/* unless it has a job queue with room for it, see worksteal.c */
 
-#define VERSION                  21			/* this should be a decimal number, not a hex */
+#define VERSION                  30			/* this should be a decimal number, not a hex */
 #define ANNOUNCE_GROUP           "225.0.0.88"
 #define ANNOUNCE_PORT 	         1700		/* it will auto-increment if the port is not available */
+#define TRACKER_PORT             1699		/* the tracker receives the announcements and queries on this UDP port */
 #define DEFAULT_GROUP            "unknown"
 #define DEFAULT_USER             "unknown"
 #define DEFAULT_HOST             "localhost"
@@ -55,18 +57,96 @@
 #define ACCEPTSLEEP              0.010		/* float, in seconds */
 #define ANNOUNCESLEEP            1.000		/* float, in seconds */
 #define ANNOUNCEJITTER           0.010 		/* float, in seconds */
+#define ANNOUNCEREFRESH          5.000		/* float, in seconds, the full host details are announced at least this often */
 #define EXPIRESLEEP              1.500		/* float, in seconds, should be longer than ANNOUNCESLEEP+ANNOUNCEJITTER */
 #define EXPIRETIME               3.000		/* float, in seconds */
+#define TRACKERREFRESH           10.000		/* float, in seconds, the unchanged host details are sent to the trackers at least this often */
+#define WORKSTEALSLEEP           0.100		/* float, in seconds */
+#define SPECULATESLEEP           0.500		/* float, in seconds */
+#define SPECULATE_FACTOR         2.0		/* float, a job is a straggler when it takes this many times longer than expected */
+#define SPECULATE_MINTIME        5.0		/* float, in seconds, faster jobs are never re-launched */
+#define DURATION_HISTORY         32			/* int, number of functions for which the job duration is remembered */
+#define DURATION_WEIGHT          0.25		/* float, weight of the last job in the average duration of a function */
 #define MATLABEXECUTABLESIZE     805306368  /* integer, in bytes */
 
 #define BACKLOG                  16
+#define SERVER_WORKERS           8			/* int, number of threads that read the incoming messages, see serverloop.c */
+#define SERVER_QUEUE             64			/* int, number of accepted connections that can wait for a worker */
+#define KEEPALIVE_MAX            64			/* int, number of idle connections that are kept open on either side */
+#define KEEPALIVETIME            10.000		/* float, in seconds, idle connections are closed after this */
 #define SMARTMEM_MINIMUM         104857600	/* int, lower boundary in bytes */
 #define SMARTSHARE_HISTORY       2			/* int, number if history items peer peer */
 #define SMARTSHARE_PREVHOSTCOUNT 3			/* int, number of times that a host has to "knock" */
 #define SMARTSHARE_TIMEOUT       3			/* int, idle time in seconds after which smartshare is disabled */
+#define SMARTSHARE_HALFLIFE      3600.0		/* float, in seconds, the usage of the pool by each user decays by half in this time */
+#define SMARTSHARE_TOLERANCE     0.1		/* float, relative difference in the weighted usage that still counts as equal */
+#define PRIORITY_LOW             0			/* the priority classes of the jobs, see smartshare.c */
+#define PRIORITY_NORMAL          1
+#define PRIORITY_HIGH            2
 #define SMARTCPU_TOLERANCE       0.05		/* float, the ideal load of a computer is N+0.05, with N the number of CPUs */
-#define SO_RCVBUF_SIZE           16384
-#define SO_SNDBUF_SIZE           16384
+#define SMARTCPU_MAXCPU          1024		/* int, the per-CPU load is only computed for these */
+#define SMARTGPU_INTERVAL        10			/* int, in seconds, the GPUs are probed at most this often */
+#define SMARTGPU_MAXLOAD         50			/* int, in percent, a GPU that is used more than this by other processes is not available */
+#define SMARTGPU_QUERY           "nvidia-smi --query-gpu=memory.free,utilization.gpu --format=csv,noheader,nounits 2>/dev/null"
+#define SO_RCVBUF_SIZE           262144		/* int, in bytes, large enough to keep the link busy with multi-MB job arguments */
+#define SO_SNDBUF_SIZE           262144
+#define CHUNKSIZE                1048576	/* int, in bytes, for streaming the job arguments from and to a file */
+#define ARGCACHE_MINSIZE         1048576	/* int, in bytes, smaller arguments are always sent along with the job */
+#define HANDSHAKE_CACHED         2			/* handshake after the jobdef if the slave has the arguments in its cache */
+#define HANDSHAKE_SHM            3			/* handshake after the jobdef if the arguments are to be passed through shared memory, see shm.c */
+#define JOBFLAG_CANCEL           1			/* the jobdef does not describe a new job, but cancels an earlier one, see speculate.c */
+#define JOBFLAG_FETCH            2			/* the jobdef does not describe a new job, but requests the kept results of one, see chain.c */
+#define JOBFLAG_KEEP             4			/* the slave keeps the results of the job for the jobs that take them as input, see chain.c */
+#define SHM_MINSIZE              1048576	/* int, in bytes, smaller arguments are always sent over the socket */
+#define SPILLDIR                 "/tmp"		/* where the arguments of queued jobs and the spooled results are kept, see --spill and peer('spool') */
+#define JOBSTAT_BINS             24			/* int, number of bins of the roundtrip time histogram */
+#define JOBSTAT_MINTIME          0.010		/* float, in seconds, upper edge of the first bin, the others double in width */
+#define JOBSTAT_PENDING          4096		/* int, the timing of at most this number of jobs is kept until their results arrive */
+#define CHAIN_RESULTS            4096		/* int, the master remembers which slave keeps the results of at most this number of jobs */
+#define UPLOAD_THREADS           4			/* int, number of threads that send the jobs that were put with 'async', see upload.c */
+#define UPLOAD_MAXMEM            1073741824	/* int, in bytes, put waits while the jobs that are still to be sent take more than this */
+#define UPLOAD_FAILED            64			/* int, number of failed jobs that are remembered until the next status request */
+#define INDEXSIZE                256		/* int, number of buckets for looking up the peers and jobs by their id, a power of two */
+#define SECURITY_HASHSIZE        256		/* int, number of buckets of the hashed allow and refuse lists, a power of two, see security.c */
+#define SECURITY_SETS            6			/* the allowed and refused users, groups and hosts */
+#define SECURITY_CACHESIZE       256		/* int, number of hosts for which the access decision is remembered, a power of two */
+#define REDUCE_SUM               1			/* the operations with which the results of a batch can be reduced, see reduce.c */
+#define REDUCE_MEAN              2
+#define REDUCE_MAX               3
+#define REDUCE_MIN               4
+#define REDUCE_CONCAT            5
+#define REDUCE_PENDING           0			/* the state of the results of each job in the batch */
+#define REDUCE_DONE              1
+#define REDUCE_FAILED            2			/* these results were returned as usual */
+#define REDUCE_SKIPPED           3			/* the job was not put */
+#define WATCHDOG_SOFT_MEMORY     1			/* the soft limits that the job has passed, see watchdog.c */
+#define WATCHDOG_SOFT_TIME       2
+#define WATCHDOG_SOFTFRACTION    0.9		/* float, by default the soft limits are at this fraction of the time and memory that are allowed */
+#define WATCHDOG_CGROUPFRACTION  0.9		/* float, the soft memory limit is also passed when the cgroup is filled up to this fraction */
+
+/* the layout of the serialized arrays, see serialize.c and reduce.c */
+#define SERIALIZE_MAGIC          "FTPEER01"	/* the first 8 bytes of the serialized arguments */
+#define TYPE_NULL     0
+#define TYPE_DOUBLE   1
+#define TYPE_SINGLE   2
+#define TYPE_INT8     3
+#define TYPE_UINT8    4
+#define TYPE_INT16    5
+#define TYPE_UINT16   6
+#define TYPE_INT32    7
+#define TYPE_UINT32   8
+#define TYPE_INT64    9
+#define TYPE_UINT64   10
+#define TYPE_LOGICAL  11
+#define TYPE_CHAR     12
+#define TYPE_CELL     13
+#define TYPE_STRUCT   14
+#define TYPE_MATLAB   15	/* serialized with mxSerialize */
+
+#define FLAG_COMPLEX  1
+#define FLAG_SPARSE   2
+
+#define PADDED(n)     ((((n)+7)/8)*8)
 
 #define MAXPWDSIZE		 		 16384
 #define MAXPATHSIZE		 		 16384
@@ -172,8 +252,35 @@ typedef struct {
 		UINT64_T memavail; 
 		UINT64_T cpuavail; 
 		current_t current;		/* details of the current job when busy */
+		UINT64_T backlog;		/* estimated time in seconds until the current and the queued jobs are done */
+		UINT64_T queued;		/* number of jobs waiting behind the current one */
+		UINT64_T gpuavail;		/* number of GPUs that are available, see smartgpu.c */
+		UINT64_T gpumemavail;	/* free memory in bytes of the available GPU that has the most */
+		UINT64_T gpuload;		/* average utilization of all GPUs in percent */
 } hostdef_t;
 
+/* this is announced in between the full host details when only the numbers changed, see announce.c */
+typedef struct {
+		UINT32_T version;
+		UINT32_T id;
+		UINT32_T sequence;		/* incremented with every announcement, to detect reordered packets */
+		UINT32_T status;
+		UINT64_T strhash;		/* of the strings in the host details that were last announced in full */
+		UINT64_T timavail; 
+		UINT64_T memavail; 
+		UINT64_T cpuavail; 
+		UINT32_T hostid;		/* of the current job when busy */
+		UINT32_T jobid;
+		UINT64_T timreq; 
+		UINT64_T memreq; 
+		UINT64_T cpureq; 
+		UINT64_T backlog;
+		UINT64_T queued;
+		UINT64_T gpuavail;
+		UINT64_T gpumemavail;
+		UINT64_T gpuload;
+} hostupdate_t;
+
 typedef struct {
 		UINT32_T version;
 		UINT32_T id;
@@ -182,28 +289,140 @@ typedef struct {
 		UINT64_T cpureq; 
 		UINT32_T argsize;   	/* size of the job arguments in bytes */
 		UINT32_T optsize;   	/* size of the job options in bytes */
+		char name[STRLEN];		/* name of the function that the job evaluates, or empty if not known */
+		UINT64_T arghash;		/* hash of the serialized arguments, or 0 if they are not to be cached */
+		UINT64_T flags;			/* JOBFLAG_CANCEL, JOBFLAG_FETCH, JOBFLAG_KEEP or 0 */
+		UINT64_T priority;		/* PRIORITY_LOW, PRIORITY_NORMAL or PRIORITY_HIGH */
+		UINT64_T chainhash;		/* hash of the kept results that are the input of the job, or that the slave kept of it, or 0 */
+		UINT32_T chainsize;		/* size of these results in bytes */
+		UINT32_T chainpeer;		/* id of the slave that keeps them */
+		UINT64_T gpureq;		/* number of GPUs */
+		UINT64_T gpumemreq;		/* bytes of memory on one GPU */
 } jobdef_t;
 
+/* the duration of the phases of a job in seconds, see jobstat.c */
+typedef struct {
+		double submitted;		/* master: walltime at which the job was put */
+		double serialize;		/* master: serializing the arguments and options */
+		double send;			/* master: writing the job to the slave */
+		double arrived;			/* walltime at which the job or the results were read completely */
+		double receive;			/* reading the job or the results from the socket */
+		double roundtrip;		/* master: from putting the job until the results arrived */
+} jobtiming_t;
+
 typedef struct joblist_s {
 		jobdef_t  *job;
 		hostdef_t *host;
 		void      *arg;
 		void      *opt;
+		char      *spill;		/* file that contains the arguments while the job is queued, or the spooled results, or NULL */
+		jobtiming_t timing;
 		struct joblist_s *next;
+		struct joblist_s *prev;
+		struct joblist_s *hashnext;	/* next job in the same bucket of the index, see listindex.c */
 } joblist_t;
 
 typedef struct peerlist_s {
 		hostdef_t *host;
 		time_t time;        /* time in seconds since January 1, 1970, Coordinated Universal Time */
 		char ipaddr[INET_ADDRSTRLEN];
+		UINT64_T strhash;   /* of the strings in the host details, the compact updates only apply to these */
+		UINT32_T sequence;  /* of the last compact update */
 		struct peerlist_s *next;
+		struct peerlist_s *prev;
+		struct peerlist_s *hashnext;	/* next peer in the same bucket of the index, see listindex.c */
 } peerlist_t;
 
+/* this keeps the average duration of the jobs that evaluated a certain function */
+typedef struct durationlist_s {
+		char name[STRLEN];
+		float duration;      /* in seconds */
+		unsigned int count;
+		struct durationlist_s *next;
+} durationlist_t;
+
+/* this keeps the serialized arguments of recent jobs, the most recently used first */
+typedef struct argcachelist_s {
+		UINT64_T hash;
+		UINT32_T size;       /* in bytes */
+		void     *arg;
+		struct argcachelist_s *next;
+} argcachelist_t;
+
+/* the master remembers which slave keeps the results of a job, the most recent first, see chain.c */
+typedef struct chainlist_s {
+		UINT32_T jobid;
+		UINT32_T peerid;
+		UINT64_T hash;
+		UINT32_T size;       /* in bytes */
+		struct chainlist_s *next;
+} chainlist_t;
+
+/* the master keeps the timing of the jobs that it has put until their results arrive */
+typedef struct jobstatlist_s {
+		UINT32_T jobid;
+		UINT64_T size;			/* of the arguments and options in bytes */
+		jobtiming_t timing;
+		UINT32_T peerid;		/* the slave to which the job was put */
+		UINT32_T spareid;		/* the slave that executes the speculative copy, or 0 */
+		float expected;			/* the expected roundtrip time in seconds */
+		jobdef_t *def;			/* copy of the job for re-launching it, or NULL, see speculate.c */
+		void     *arg;
+		void     *opt;
+		int sending;			/* the copy is being sent, the speculator owns def, arg and opt */
+		int done;				/* the first results arrived, those of the other copy are discarded */
+		int cancel;				/* the other copy is still to be cancelled */
+		struct jobstatlist_s *next;
+} jobstatlist_t;
+
+/* the master reduces the results of the jobs of a batch while they arrive, see reduce.c */
+typedef struct reducelist_s {
+		UINT32_T id;
+		int operation;			/* REDUCE_SUM, REDUCE_MEAN, REDUCE_MAX, REDUCE_MIN or REDUCE_CONCAT */
+		int dim;				/* for concatenation, starting at 0 */
+		UINT32_T numjob;
+		UINT32_T *jobid;		/* the jobs of the batch */
+		UINT8_T  *state;		/* REDUCE_PENDING, REDUCE_DONE, REDUCE_FAILED or REDUCE_SKIPPED for each job */
+		UINT32_T count;			/* number of results that were reduced */
+		void     *acc;			/* the serialized result of the reduction so far */
+		UINT64_T accsize;
+		void    **piece;		/* for concatenation, the serialized results of each job */
+		UINT64_T *piecesize;
+		struct reducelist_s *next;
+} reducelist_t;
+
+/* the master aggregates the timing of the jobs per slave */
+typedef struct slavestatlist_s {
+		UINT32_T hostid;
+		char name[STRLEN];
+		UINT32_T count;			/* number of jobs that returned */
+		UINT64_T bytesout;		/* arguments and options sent to the slave */
+		UINT64_T bytesin;		/* results received from the slave */
+		double send;			/* total time spent sending */
+		double receive;			/* total time spent receiving */
+		double roundtrip;		/* total time from putting the jobs until the results arrived */
+		UINT32_T histogram[JOBSTAT_BINS];	/* of the roundtrip time, see jobstat.c */
+		struct slavestatlist_s *next;
+} slavestatlist_t;
+
 typedef struct smartsharelist_s {
 		UINT64_T timreq; 
+		UINT64_T priority;
+		UINT32_T hostid;
+		char user[STRLEN];
+		time_t time;			/* when the job request was observed */
 		struct smartsharelist_s *next;
 } smartsharelist_t;
 
+/* the usage of the pool by each user, which decays over time, see smartshare.c */
+typedef struct fairsharelist_s {
+		char user[STRLEN];
+		float weight;			/* the relative share of the pool that the user is entitled to */
+		int fixed;				/* the weight was configured, the item is not removed */
+		double usage;			/* in seconds times the number of slaves */
+		struct fairsharelist_s *next;
+} fairsharelist_t;
+
 /* this is for restricting the access to a peer to one user or a list of users */
 typedef struct userlist_s {
 		char *name;
@@ -222,11 +441,75 @@ typedef struct hostlist_s {
 		struct hostlist_s *next;
 } hostlist_t;
 
+/* the user, group and host lists are looked up in hashed sets that are built from them, see security.c */
+typedef struct securityset_s {
+		UINT64_T hash;
+		char *name;
+		struct securityset_s *next;
+} securityset_t;
+
+/* the access decision for a host, it is valid as long as the lists did not change */
+typedef struct {
+		UINT32_T hostid;
+		UINT64_T strhash;		/* of the user, group and host name of the host */
+		UINT32_T changed;		/* the value of security.changed when the decision was made, 0 if unused */
+		int allowed;
+} securitycache_t;
+
+/* the peers can report to one or more trackers instead of multicasting, see tracker.c */
+typedef struct trackerlist_s {
+		char name[STRLEN];
+		struct sockaddr_in addr;
+		struct trackerlist_s *next;
+} trackerlist_t;
+
+#define TRACKER_KEEPALIVE        1			/* the host details did not change since the last announcement */
+#define TRACKER_QUERY            2			/* request for the peers that the tracker knows about */
+
+typedef struct {
+		UINT32_T version;
+		UINT32_T id;			/* of the peer that sends the message */
+		UINT32_T type;
+} trackermsg_t;
+
+/* this is what the tracker sends back for each of the peers in reply to a query */
+typedef struct {
+		hostdef_t host;
+		char ipaddr[INET_ADDRSTRLEN];
+} trackerentry_t;
+
+/* an incoming connection that is handled by tcpsocket */
+typedef struct {
+		int fd;
+		int reused;      /* an earlier message was received over this connection */
+		int keep;        /* tcpsocket sets this when the connection can be used for the next message */
+} connection_t;
+
+/* the jobs that were put with 'async' and that are still to be sent to the slave, see upload.c */
+typedef struct uploadlist_s {
+		UINT32_T peerid;
+		jobdef_t def;
+		void *arg;
+		void *opt;
+		jobtiming_t timing;
+		int sending;			/* one of the upload threads is sending the job */
+		struct uploadlist_s *next;
+} uploadlist_t;
+
+/* the outgoing connections that are kept open for the next message to the same peer */
+typedef struct keepalivelist_s {
+		UINT32_T hostid;
+		int fd;
+		double time;     /* walltime at which the connection was last used */
+		struct keepalivelist_s *next;
+} keepalivelist_t;
+
 typedef struct {
 		hostdef_t *host; /* this defines the host details                 */
 		jobdef_t  *job;  /* this defines the job contents                 */
 		void      *arg;  /* this contains the input or output arguments   */
 		void      *opt;  /* this contains the options for the job         */
+		char      *spill; /* file that contains the arguments, or NULL    */
 } message_t;
 
 #ifdef __cplusplus
@@ -240,34 +523,121 @@ void *tcpsocket (void *);
 void *announce  (void *);
 void *discover  (void *);
 void *expire    (void *);
+void *workstealer(void *);
+void *trackerserver(void *);
+void *speculator(void *);
 void  peerinit (void *);
 void  peerexit (void *);
 int   announce_once(void);
+UINT64_T announce_hash(const hostdef_t *);
+void  announce_refresh(void);
+
+/* functions from tracker.c */
+int  add_trackerlist(const char *name);
+void tracker_announce(int fd, const hostdef_t *message);
+void tracker_query(int fd);
 
 /* functions from smartshare.c */
 void smartshare_reset   (void);
-int  smartshare_check   (float timreq, int hostid);
-void smartshare_history (jobdef_t *job);
+int  smartshare_check   (const jobdef_t *job, const hostdef_t *from);
+void smartshare_history (const jobdef_t *job, const hostdef_t *from);
+void smartshare_update  (void);
+void smartshare_weight  (const char *user, float weight);
+
+/* functions from worksteal.c */
+float duration_estimate (const jobdef_t *job);
+void  duration_update   (const char *name, float duration);
+void  worksteal_update  (void);
+int   worksteal_forward (joblist_t *job, const char *ipaddr, int port, const char *socket);
+
+/* functions from argcache.c */
+UINT64_T argcache_hash   (const void *buf, UINT32_T size);
+void    *argcache_lookup (UINT64_T hash, UINT32_T size);
+void     argcache_store  (joblist_t *job);
+int      argcache_keep   (UINT64_T hash, void *arg, UINT32_T size);
+
+/* functions from chain.c */
+void  chain_arrived    (joblist_t *job);
+int   chain_lookup     (UINT32_T jobid, UINT32_T *peerid, UINT64_T *hash, UINT32_T *size);
+void *chain_fetch      (UINT32_T peerid, UINT64_T hash, UINT32_T size);
+void *chain_input      (const jobdef_t *def);
+void  clear_chainlist  (void);
+
+/* functions from cgroup.c */
+int cpu_affinity(unsigned char *allowed, int maxcpu);
+int cgroup_cpulimit(float *ncpu);
+int cgroup_cpuusage(UINT64_T *usage);
+int cgroup_memlimit(UINT64_T *limit, UINT64_T *used);
+
+/* functions from jobstat.c */
+void jobstat_put     (UINT32_T peerid, const jobdef_t *def, const void *arg, const void *opt, const jobtiming_t *timing);
+int  jobstat_arrived (joblist_t *job);
+void clear_jobstat   (void);
+
+/* functions from reduce.c */
+int   reduce_batch      (UINT32_T id, int operation, int dim, UINT32_T numjob, const UINT32_T *jobid);
+void  reduce_skip       (UINT32_T id, UINT32_T jobid);
+int   reduce_arrived    (joblist_t *job);
+void *reduce_result     (UINT32_T id, UINT64_T *size, UINT32_T *count, UINT32_T *pending, int clear);
+void  clear_reducelist  (void);
+
+/* functions from upload.c */
+int  upload_put   (UINT32_T peerid, const jobdef_t *def, void *arg, void *opt, const jobtiming_t *timing);
+void upload_flush (void);
+void upload_stop  (void);
+
+/* functions from speculate.c */
+int  write_cancel (UINT32_T peerid, UINT32_T jobid);
+int  cancel_job   (UINT32_T hostid, UINT32_T jobid);
+int  cancel_check (UINT32_T hostid, UINT32_T jobid);
+
+/* functions from shm.c */
+int shm_supported(int s);
+int bufwrite_shm (int s, const void *buf, FILE *fp, int numel);
+int bufread_shm  (int s, void *buf, int numel);
+
+/* functions from partition.c */
+int      parse_cpulist (const char *str, unsigned char *cpus, int maxcpu);
+int      numa_nodes    (void);
+int      numa_cpulist  (int node, unsigned char *cpus, int maxcpu);
+UINT64_T numa_memtotal (int node);
+int      bind_partition(const unsigned char *cpus, int maxcpu, int node);
+int      partition_host(int index, int count, unsigned char *cpus, int maxcpu, int *node, UINT64_T *memory);
 
 /* fnuctions from smartmem.c */
+int smartmem_info(UINT64_T *MemTotal, UINT64_T *MemFree, UINT64_T *Buffers, UINT64_T *Cached);
 int smartmem_update(void);
+int smartcpu_info(int *ProcessorCount, float *BogoMips, float *AvgLoad, float *CpuLoad);
 int smartcpu_update(void);
+int smartgpu_info(UINT64_T *GpuCount, UINT64_T *GpuMemFree, UINT64_T *GpuLoad);
+int smartgpu_update(void);
 
 /* functions from security.c */
 int security_check(hostdef_t *host);
 int ismember_userlist(char *);
 int ismember_grouplist(char *);
 int ismember_hostlist(char *);
+void security_changed(void);
+void security_clear(void);
 
 /* functions from util.c and elsewhere */
 int  append(void **buf1, int bufsize1, void *buf2, int bufsize2);
 int  bufread(int s, void *buf, int numel);
 int  bufwrite(int s, void *buf, int numel);
+int  bufread_file(int s, FILE *fp, int numel);
+int  bufwrite_file(int s, FILE *fp, int numel);
 int  close_connection(int s);
 int  hoststatus(void);
 int  jobcount(void);
+UINT64_T joblist_memory(UINT32_T *spooled);
 int  open_tcp_connection(const char *hostname, int port);
 int  open_uds_connection(const char *socketname);
+int  open_peer_connection(UINT32_T hostid);
+int  reuse_peer_connection(UINT32_T hostid, int *reused);
+void keep_peer_connection(UINT32_T hostid, int s);
+void clear_keepalivelist(void);
+void serverloop(int fd, const char *name);
+int  write_job(UINT32_T peerid, jobdef_t *def, const void *arg, const void *opt);
 int  peercount(void);
 int  check_localhost(const char *ipaddr);
 void  check_watchdog(void);
@@ -279,9 +649,25 @@ void clear_refuseuserlist(void);
 void clear_refusegrouplist(void);
 void clear_refusehostlist(void);
 void clear_joblist(void);
+void pop_joblist(void);
+int  spill_open(char **name, FILE **fp);
+int  spill_load(joblist_t *job);
+void *spill_read(const joblist_t *job);
+void spill_remove(char **name);
 void clear_peerlist(void);
+peerlist_t *lookup_peerlist(UINT32_T hostid);
+void insert_peerlist(peerlist_t *peer);
+void remove_peerlist(peerlist_t *peer);
+joblist_t *lookup_joblist(UINT32_T jobid);
+void append_joblist(joblist_t *job);
+void remove_joblist(joblist_t *job);
 void clear_smartsharelist(void);
+void clear_fairsharelist(void);
+void clear_durationlist(void);
+void clear_argcachelist(void);
+void clear_trackerlist(void);
 int threadsleep(float);
+double walltime(void);
 int getmem (uint64_t *, uint64_t *);
 
 #ifdef __cplusplus
@@ -73,6 +73,9 @@ void peerinit(void *arg) {
 		host->memavail = DEFAULT_MEMAVAIL;
 		host->cpuavail = DEFAULT_CPUAVAIL;
 		host->timavail = DEFAULT_TIMAVAIL;
+		host->gpuavail    = 0;
+		host->gpumemavail = 0;
+		host->gpuload     = 0;
 
 		/* initialize the string elements as empty */
 		bzero(host->name, STRLEN);
@@ -82,6 +85,8 @@ void peerinit(void *arg) {
 
 		/* initialize the current job details as empty */
 		bzero(&(host->current), sizeof(current_t));
+		host->backlog  = 0;
+		host->queued   = 0;
 
 #if defined (PLATFORM_LINUX) || defined (PLATFORM_OSX)
 
@@ -144,6 +149,9 @@ void peerinit(void *arg) {
 		watchdog.masterid = 0;
 		watchdog.memory   = 0;
 		watchdog.time     = 0;
+		watchdog.memsoft  = 0;
+		watchdog.timsoft  = 0;
+		watchdog.soft     = 0;
 		pthread_mutex_unlock(&mutexwatchdog);
 
 		pthread_mutex_lock(&mutexsmartmem);
@@ -159,15 +167,14 @@ void peerinit(void *arg) {
 		smartcpu.evidence   = 0;
 		pthread_mutex_unlock(&mutexsmartcpu);
 
+		pthread_mutex_lock(&mutexsmartgpu);
+		smartgpu.enabled  = 0;
+		smartgpu.probed   = 0;
+		smartgpu.gpuavail = UINT64_MAX;
+		pthread_mutex_unlock(&mutexsmartgpu);
+
 		pthread_mutex_lock(&mutexprevcpu);
-		prevcpu.user    = 0;
-		prevcpu.nice    = 0;
-		prevcpu.system  = 0;
-		prevcpu.idle    = 0;
-		prevcpu.iowait  = 0;
-		prevcpu.irq     = 0;
-		prevcpu.softirq = 0;
-		prevcpu.unknown = 0;
+		bzero(&prevcpu, sizeof(prevcpu));
 		pthread_mutex_unlock(&mutexprevcpu);
 
 		pthread_mutex_lock(&mutexsmartshare);
@@ -178,6 +185,18 @@ void peerinit(void *arg) {
 		smartshare.time          = time(NULL);
 		pthread_mutex_unlock(&mutexsmartshare);
 
+		pthread_mutex_lock(&mutexworksteal);
+		worksteal.enabled = 0;
+		worksteal.queue   = 0;
+		worksteal.started = 0;
+		worksteal.spill   = 0;
+		pthread_mutex_unlock(&mutexworksteal);
+
+		pthread_mutex_lock(&mutexargcache);
+		argcache.size = 0;
+		argcache.used = 0;
+		pthread_mutex_unlock(&mutexargcache);
+
 		return;
 }
 
@@ -197,7 +216,16 @@ void peerexit(void *arg) {
 		clear_refuseuserlist();
 		clear_refusegrouplist();
 		clear_refusehostlist();
+		security_clear();
+		clear_trackerlist();
 		clear_smartsharelist();
+		clear_fairsharelist();
+		clear_durationlist();
+		clear_argcachelist();
+		clear_chainlist();
+		clear_jobstat();
+		clear_reducelist();
+		clear_keepalivelist();
 
 		pthread_mutex_lock(&mutexwatchdog);
 		watchdog.enabled  = 0;
@@ -205,6 +233,9 @@ void peerexit(void *arg) {
 		watchdog.masterid = 0;
 		watchdog.memory   = 0;
 		watchdog.time     = 0;
+		watchdog.memsoft  = 0;
+		watchdog.timsoft  = 0;
+		watchdog.soft     = 0;
 		pthread_mutex_unlock(&mutexwatchdog);
 
 		pthread_mutex_lock(&mutexsmartmem);
@@ -220,15 +251,14 @@ void peerexit(void *arg) {
 		smartcpu.evidence   = 0;
 		pthread_mutex_unlock(&mutexsmartcpu);
 
+		pthread_mutex_lock(&mutexsmartgpu);
+		smartgpu.enabled  = 0;
+		smartgpu.probed   = 0;
+		smartgpu.gpuavail = UINT64_MAX;
+		pthread_mutex_unlock(&mutexsmartgpu);
+
 		pthread_mutex_lock(&mutexprevcpu);
-		prevcpu.user    = 0;
-		prevcpu.nice    = 0;
-		prevcpu.system  = 0;
-		prevcpu.idle    = 0;
-		prevcpu.iowait  = 0;
-		prevcpu.irq     = 0;
-		prevcpu.softirq = 0;
-		prevcpu.unknown = 0;
+		bzero(&prevcpu, sizeof(prevcpu));
 		pthread_mutex_unlock(&mutexprevcpu);
 
 		pthread_mutex_lock(&mutexsmartshare);
@@ -239,6 +269,18 @@ void peerexit(void *arg) {
 		smartshare.time          = time(NULL);
 		pthread_mutex_unlock(&mutexsmartshare);
 
+		pthread_mutex_lock(&mutexworksteal);
+		worksteal.enabled = 0;
+		worksteal.queue   = 0;
+		worksteal.started = 0;
+		worksteal.spill   = 0;
+		pthread_mutex_unlock(&mutexworksteal);
+
+		pthread_mutex_lock(&mutexargcache);
+		argcache.size = 0;
+		argcache.used = 0;
+		pthread_mutex_unlock(&mutexargcache);
+
 		/*
 		   pthread_cond_destroy(&condstatus);
 		   pthread_mutex_destroy(&mutexstatus);
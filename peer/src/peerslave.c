@@ -31,31 +31,35 @@
 #include "peer.h"
 #include "parser.h"
 #include "extern.h"
+#include "serialize.h"
 #include "platform_includes.h"
 
-mxArray *mxSerialize(const mxArray*);
-mxArray *mxDeserialize(const void*, size_t);
 
 #define ENGINETIMEOUT     180    /* int, in seconds */
 #define ZOMBIETIMEOUT     900    /* int, in seconds */
 #define SLEEPTIME         0.010  /* float, in seconds */
 
 #define STARTCMD "matlab -nosplash"
+#define CLEARCMD "clear argin optin argout optout"  /* only the variables of the job, see --clearall */
 
 int main(int argc, char *argv[]) {
 		Engine *en;
 		mxArray *argin = NULL, *argout = NULL, *optin = NULL, *optout = NULL, *arg = NULL, *opt = NULL, *previous;
 		joblist_t  *job  = NULL;
-		peerlist_t *peer = NULL;
 		jobdef_t   *def  = NULL;
+		jobdef_t   chain;
 		pid_t childpid;
 
-		int matlabRunning = 0, matlabStart, matlabFinished, engineFailed = 0;
-		int i, n, c, rc, status, found, handshake, success, server, jobnum = 0, engineAborted = 0, jobFailed = 0, timallow, memallow;
+		int matlabRunning = 0, matlabFinished, engineFailed = 0, warm = 0, clearall = 0;
+		double jobStart, jobTime, evalStart, evalFinished, engineStart, engineStartup = 0;
+		double jobQueued, jobReceive, jobDeserialize, jobSerialize;
+		int i, n, c, rc, status, found, jobnum = 0, engineAborted = 0, jobFailed = 0, timallow, memallow, keep;
+		void *kept;
+		size_t keptsize;
 		unsigned int enginetimeout = ENGINETIMEOUT;
 		unsigned int zombietimeout = ZOMBIETIMEOUT;
 		unsigned int peerid, jobid, numpeer;
-		char *str = NULL, *startcmd = NULL;
+		char *str = NULL, *startcmd = NULL, jobname[STRLEN];
 
 		config_t *cconf, *pconf; /* for the configuration file or command line options */
 
@@ -69,6 +73,8 @@ int main(int argc, char *argv[]) {
 		pthread_t announceThread;
 		pthread_t discoverThread;
 		pthread_t expireThread;
+		pthread_t workstealThread;
+		pthread_t trackerserverThread;
 
 #if SYSLOG==1
 		openlog("peerslave", LOG_PID | LOG_PERROR, LOG_USER);
@@ -95,6 +101,7 @@ int main(int argc, char *argv[]) {
 				printf("  --memavail    = number, amount of memory available       (default = inf)\n");
 				printf("  --cpuavail    = number, speed of the CPU                 (default = inf)\n");
 				printf("  --timavail    = number, maximum duration of a single job (default = inf)\n");
+				printf("  --gpuavail    = number, GPUs available for the jobs      (default = 0, or all with smartgpu)\n");
 				printf("  --allowuser   = {...}\n");
 				printf("  --allowgroup  = {...}\n");
 				printf("  --allowhost   = {...}\n");
@@ -102,9 +109,23 @@ int main(int argc, char *argv[]) {
 				printf("  --hostname    = string\n");
 				printf("  --matlab      = string\n");
 				printf("  --timeout     = number, time to keep the engine running after the job finished\n");
+				printf("  --engines     = number, how many slaves to start, each with its own engine (default = 1)\n");
+				printf("  --warm        = 0|1, start the engine beforehand and keep it running (default = 0)\n");
+				printf("  --clearall    = 0|1, clear all instead of only the job variables after a job (default = 0)\n");
+				printf("  --queue       = number, how many jobs may wait behind the current one (default = 0)\n");
+				printf("  --steal       = 0|1, hand the waiting jobs over to idle slaves (default = 1)\n");
+				printf("  --spill       = number, waiting jobs with larger arguments are kept on disk (default = 0, never)\n");
+				printf("  --cache       = number, bytes of job arguments to keep for the next jobs (default = 0)\n");
+				printf("  --tracker     = 0|1, keep track of the peers that report to this one (default = 0)\n");
+				printf("  --trackerhost = {...}, report to these trackers instead of using multicast\n");
+				printf("  --cores       = string, bind the slave and its engine to these cores, e.g. 0-3,8\n");
+				printf("  --numanode    = number, bind the slave and its engine to this NUMA node\n");
+				printf("  --partition   = 0|1, divide the cores and memory of the computer over the slaves (default = 0)\n");
 				printf("  --smartshare  = 0|1\n");
+				printf("  --fairshare   = {...}, the relative share of the pool per user, e.g. alice:2,bob:1 (default = 1)\n");
 				printf("  --smartmem    = 0|1\n");
 				printf("  --smartcpu    = 0|1\n");
+				printf("  --smartgpu    = 0|1, announce the idle GPUs and their free memory, using nvidia-smi (default = 0)\n");
 				printf("  --verbose     = number, between 0 and 7 (default = 4)\n");
 				printf("\n");
 				printf("Using the configuration file, you can start multiple peerslaves at once.\n");
@@ -112,7 +133,10 @@ int main(int argc, char *argv[]) {
 				printf("forked children keep running or restart them if they exit (which happens\n");
 				printf("upon a MATLAB engine error). The configuration file contains the same\n");
 				printf("options as on the command line and should be formatted like the following\n");
-				printf("example, which starts 4 slaves on a quad-core computer.\n");
+				printf("example, which starts 4 slaves on a quad-core computer. A section with\n");
+				printf("engines=N starts N identical slaves. With partition=1 each of the slaves\n");
+				printf("is bound to its own share of the cores, within a single NUMA node where\n");
+				printf("possible, and its memavail and cpuavail follow from that share.\n");
 				printf("\n");
 				printf("  [peer]\n");
 				printf("  # allow jobs of up to 12 hours with no more than 1GB memory required\n");
@@ -182,6 +206,21 @@ int main(int argc, char *argv[]) {
 								{"refuseuser",  required_argument, 0, 15}, /* single or multiple string argument */
 								{"refusehost",  required_argument, 0, 16}, /* single or multiple string argument */
 								{"refusegroup", required_argument, 0, 17}, /* single or multiple string argument */
+								{"engines",     required_argument, 0, 18}, /* numeric argument */
+								{"warm",        required_argument, 0, 19}, /* boolean, 0 or 1 */
+								{"clearall",    required_argument, 0, 20}, /* boolean, 0 or 1 */
+								{"queue",       required_argument, 0, 21}, /* numeric argument */
+								{"steal",       required_argument, 0, 22}, /* boolean, 0 or 1 */
+								{"spill",       required_argument, 0, 23}, /* numeric argument */
+								{"cache",       required_argument, 0, 24}, /* numeric argument */
+								{"tracker",     required_argument, 0, 25}, /* boolean, 0 or 1 */
+								{"trackerhost", required_argument, 0, 26}, /* single or multiple string argument */
+								{"cores",       required_argument, 0, 27}, /* single string argument */
+								{"numanode",    required_argument, 0, 28}, /* numeric argument */
+								{"partition",   required_argument, 0, 29}, /* boolean, 0 or 1 */
+								{"fairshare",   required_argument, 0, 30}, /* single or multiple string argument */
+								{"smartgpu",    required_argument, 0, 31}, /* boolean, 0 or 1 */
+								{"gpuavail",    required_argument, 0, 32}, /* numeric argument */
 								{0, 0, 0, 0}
 						};
 
@@ -287,6 +326,81 @@ int main(int argc, char *argv[]) {
 										pconf->verbose = optarg;
 										break;
 
+								case 18:
+										DEBUG(LOG_NOTICE, "option --engines with value `%s'", optarg);
+										pconf->engines = optarg;
+										break;
+
+								case 19:
+										DEBUG(LOG_NOTICE, "option --warm with value `%s'", optarg);
+										pconf->warm = optarg;
+										break;
+
+								case 20:
+										DEBUG(LOG_NOTICE, "option --clearall with value `%s'", optarg);
+										pconf->clearall = optarg;
+										break;
+
+								case 21:
+										DEBUG(LOG_NOTICE, "option --queue with value `%s'", optarg);
+										pconf->queue = optarg;
+										break;
+
+								case 22:
+										DEBUG(LOG_NOTICE, "option --steal with value `%s'", optarg);
+										pconf->steal = optarg;
+										break;
+
+								case 23:
+										DEBUG(LOG_NOTICE, "option --spill with value `%s'", optarg);
+										pconf->spill = optarg;
+										break;
+
+								case 24:
+										DEBUG(LOG_NOTICE, "option --cache with value `%s'", optarg);
+										pconf->cache = optarg;
+										break;
+
+								case 25:
+										DEBUG(LOG_NOTICE, "option --tracker with value `%s'", optarg);
+										pconf->tracker = optarg;
+										break;
+
+								case 26:
+										DEBUG(LOG_NOTICE, "option --trackerhost with value `%s'", optarg);
+										pconf->trackerhost = optarg;
+										break;
+
+								case 27:
+										DEBUG(LOG_NOTICE, "option --cores with value `%s'", optarg);
+										pconf->cores = optarg;
+										break;
+
+								case 28:
+										DEBUG(LOG_NOTICE, "option --numanode with value `%s'", optarg);
+										pconf->numanode = optarg;
+										break;
+
+								case 29:
+										DEBUG(LOG_NOTICE, "option --partition with value `%s'", optarg);
+										pconf->partition = optarg;
+										break;
+
+								case 30:
+										DEBUG(LOG_NOTICE, "option --fairshare with value `%s'", optarg);
+										pconf->fairshare = optarg;
+										break;
+
+								case 31:
+										DEBUG(LOG_NOTICE, "option --smartgpu with value `%s'", optarg);
+										pconf->smartgpu = optarg;
+										break;
+
+								case 32:
+										DEBUG(LOG_NOTICE, "option --gpuavail with value `%s'", optarg);
+										pconf->gpuavail = optarg;
+										break;
+
 								default:
 										PANIC("invalid command line options\n");
 										break;
@@ -294,6 +408,9 @@ int main(int argc, char *argv[]) {
 				} /* while(1) for getopt */
 		} /* if config file or getopt */
 
+		/* each configuration with engines=N results in N slaves */
+		numpeer = expandconfig(pconf);
+
 		if (pconf->verbose) {
 				/* although the configuration file allows setting the verbose for each peer */
 				/* the first ocurrence determines what will be used the parent and all children */
@@ -422,6 +539,59 @@ int main(int argc, char *argv[]) {
 		 * from here onward the code deals with starting a single peer in slave mode
 		 ************************************************************************************/
 
+		/* bind the slave and the engine that it will start to a subset of the computer */
+		if (cconf->partition && atol(cconf->partition))
+		{
+				unsigned char cores[SMARTCPU_MAXCPU];
+				int index = 0, count = 0, node, numcores;
+				UINT64_T memory;
+				config_t *item;
+
+				/* the position of this slave among the ones that share the computer */
+				for (item = pconf; item; item = item->next)
+						if (item->partition && atol(item->partition)) {
+								if (item==cconf)
+										index = count;
+								count++;
+						}
+
+				if ((numcores = partition_host(index, count, cores, SMARTCPU_MAXCPU, &node, &memory))<1 || bind_partition(cores, SMARTCPU_MAXCPU, node)!=0) {
+						DEBUG(LOG_ERR, "could not bind slave %d out of %d", index+1, count);
+				}
+				else {
+						DEBUG(LOG_NOTICE, "bound slave %d out of %d to %d cores on NUMA node %d", index+1, count, numcores, node);
+						/* the explicit memavail and cpuavail options below take precedence */
+						pthread_mutex_lock(&mutexhost);
+						host->cpuavail = numcores;
+						if (memory>0)
+								host->memavail = memory;
+						pthread_mutex_unlock(&mutexhost);
+						if (memory>0) {
+								pthread_mutex_lock(&mutexsmartmem);
+								smartmem.memavail = memory;
+								pthread_mutex_unlock(&mutexsmartmem);
+						}
+				}
+		}
+		else if (cconf->cores || cconf->numanode)
+		{
+				unsigned char cores[SMARTCPU_MAXCPU];
+				int node = (cconf->numanode ? atol(cconf->numanode) : -1), numcores = 0;
+
+				if (cconf->cores)
+						numcores = parse_cpulist(cconf->cores, cores, SMARTCPU_MAXCPU);
+				else
+						/* use all cores of the NUMA node */
+						numcores = numa_cpulist(node, cores, SMARTCPU_MAXCPU);
+
+				if (numcores<1 || bind_partition(cores, SMARTCPU_MAXCPU, node)!=0) {
+						DEBUG(LOG_ERR, "could not bind to cores '%s' and NUMA node %d", (cconf->cores ? cconf->cores : ""), node);
+				}
+				else {
+						DEBUG(LOG_NOTICE, "bound to %d cores on NUMA node %d", numcores, node);
+				}
+		}
+
 		/* get the values from the configuration structure */
 		if (cconf->memavail)
 		{
@@ -468,6 +638,19 @@ int main(int argc, char *argv[]) {
 				pthread_mutex_unlock(&mutexhost);
 		}
 
+		if (cconf->gpuavail)
+		{
+				/* with smartgpu this is the maximum, without it the GPUs are not probed and their memory is not limited */
+				pthread_mutex_lock(&mutexhost);
+				host->gpuavail    = atol(cconf->gpuavail);
+				host->gpumemavail = (host->gpuavail>0 ? UINT64_MAX : 0);
+				pthread_mutex_unlock(&mutexhost);
+
+				pthread_mutex_lock(&mutexsmartgpu);
+				smartgpu.gpuavail = atol(cconf->gpuavail);
+				pthread_mutex_unlock(&mutexsmartgpu);
+		}
+
 		if (cconf->hostname)
 		{
 				pthread_mutex_lock(&mutexhost);
@@ -572,6 +755,9 @@ int main(int argc, char *argv[]) {
 				pthread_mutex_unlock(&mutexrefusegrouplist);
 		}
 
+		/* the allow and refuse lists have been filled in from the options */
+		security_changed();
+
 		if (cconf->matlab)
 		{
 				startcmd = malloc(STRLEN);
@@ -598,6 +784,13 @@ int main(int argc, char *argv[]) {
 				pthread_mutex_unlock(&mutexsmartcpu);
 		}
 
+		if (cconf->smartgpu)
+		{
+				pthread_mutex_lock(&mutexsmartgpu);
+				smartgpu.enabled = atol(cconf->smartgpu);
+				pthread_mutex_unlock(&mutexsmartgpu);
+		}
+
 		if (cconf->smartshare)
 		{
 				pthread_mutex_lock(&mutexsmartshare);
@@ -605,11 +798,73 @@ int main(int argc, char *argv[]) {
 				pthread_mutex_unlock(&mutexsmartshare);
 		}
 
+		if (cconf->fairshare)
+		{
+				/* each item is user:weight, the users that are not listed have weight 1 */
+				str = strtok(cconf->fairshare, ",");
+				while (str) {
+						char *sep = strchr(str, ':');
+						if (sep) {
+								*sep = 0;
+								smartshare_weight(str, atof(sep+1));
+						}
+						str = strtok(NULL, ",");
+				}
+		}
+
 		if (cconf->timeout)
 		{
 				enginetimeout = atol(cconf->timeout);
 		}
 
+		if (cconf->warm)
+		{
+				warm = atol(cconf->warm);
+		}
+
+		if (cconf->clearall)
+		{
+				clearall = atol(cconf->clearall);
+		}
+
+		if (cconf->cache)
+		{
+				pthread_mutex_lock(&mutexargcache);
+				argcache.size = atol(cconf->cache);
+				pthread_mutex_unlock(&mutexargcache);
+		}
+
+		if (cconf->queue)
+		{
+				pthread_mutex_lock(&mutexworksteal);
+				worksteal.queue   = atol(cconf->queue);
+				/* the waiting jobs are handed over to idle slaves, unless specified otherwise */
+				worksteal.enabled = (worksteal.queue>0) && (cconf->steal ? atol(cconf->steal) : 1);
+				/* the size of the arguments in bytes */
+				worksteal.spill   = (cconf->spill ? atol(cconf->spill) : 0);
+				pthread_mutex_unlock(&mutexworksteal);
+		}
+
+		if (cconf->trackerhost)
+		{
+				str = strtok(cconf->trackerhost, ",");
+				while (str) {
+						if (add_trackerlist(str)!=0)
+								DEBUG(LOG_ERR, "could not add tracker %s", str);
+						str = strtok(NULL, ",");
+				}
+		}
+
+		if (cconf->tracker && atol(cconf->tracker))
+		{
+				if ((rc = pthread_create(&trackerserverThread, NULL, trackerserver, (void *)NULL))>0) {
+						PANIC("failed to start trackerserver thread\n");
+				}
+				else {
+						DEBUG(LOG_NOTICE, "started trackerserver thread");
+				}
+		}
+
 		if ((rc = pthread_create(&tcpserverThread, NULL, tcpserver, (void *)NULL))>0) {
 				PANIC("failed to start tcpserver thread\n");
 		}
@@ -650,6 +905,15 @@ int main(int argc, char *argv[]) {
 				DEBUG(LOG_NOTICE, "started expire thread");
 		}
 
+		/* the worksteal thread also keeps the announced backlog up to date */
+		if ((rc = pthread_create(&workstealThread, NULL, workstealer, (void *)NULL))>0) {
+				DEBUG(LOG_NOTICE, "failed to start worksteal thread");
+				exit(1);
+		}
+		else {
+				DEBUG(LOG_NOTICE, "started worksteal thread");
+		}
+
 		pthread_mutex_lock(&mutexhost);
 		/* switch the peer to idle slave, note that this should be followed by an announce_once() */
 		host->status = STATUS_IDLE;
@@ -662,8 +926,8 @@ int main(int argc, char *argv[]) {
 		/* engine aborted indicates that matlab crashed, in which case the peerslave should exit */
 		while (!engineAborted) {
 
-				/* switch the engine off after being idle for a certain time */
-				if ((matlabRunning!=0) && (difftime(time(NULL), matlabFinished)>enginetimeout)) {
+				/* switch the engine off after being idle for a certain time, unless it is to be kept warm */
+				if ((matlabRunning!=0) && !warm && (difftime(time(NULL), matlabFinished)>enginetimeout)) {
 						if (engClose(en)!=0) {
 								DEBUG(LOG_ERR, "could not stop the MATLAB engine");
 								matlabRunning = 0;
@@ -689,33 +953,46 @@ int main(int argc, char *argv[]) {
 						continue;
 				}
 
-				if (jobcount()>0) {
-						/* there is a job to be executed */
-
-						if (matlabRunning==0) {
-								/* start the matlab engine */
-								DEBUG(LOG_NOTICE, "starting MATLAB engine");
-								if ((en = engOpen(startcmd)) == NULL) {
-										/* this is probably due to a licensing problem */
-										/* do not start again during the timeout period */
-										DEBUG(LOG_ERR, "could not start MATLAB engine, deleting job and switching to zombie");
-										engineFailed  = time(NULL);
-										matlabRunning = 0;
+				/* a warm engine is started while idle, otherwise only when there is a job */
+				/* during the zombie period a warm engine is only retried for an incoming job */
+				if ((matlabRunning==0) && ((jobcount()>0) || (warm && !engineFailed))) {
+						/* start the matlab engine */
+						DEBUG(LOG_NOTICE, "starting MATLAB engine");
+						engineStart = walltime();
+						if ((en = engOpen(startcmd)) == NULL) {
+								/* this is probably due to a licensing problem */
+								/* do not start again during the timeout period */
+								DEBUG(LOG_ERR, "could not start MATLAB engine, deleting any job and switching to zombie");
+								engineFailed  = time(NULL);
+								matlabRunning = 0;
 
-										pthread_mutex_lock(&mutexhost);
-										/* switch the mode to busy slave, note that this should be followed by an announce_once() */
-										host->status = STATUS_ZOMBIE;
-										/* update the current job description */
-										bzero(&(host->current), sizeof(current_t));
-										pthread_mutex_unlock(&mutexhost);
-										/* inform the other peers of the updated status */
-										announce_once();
-								}
-								else {
-										engineFailed  = 0;
-										matlabRunning = 1;
-								}
+								pthread_mutex_lock(&mutexhost);
+								/* switch the mode to busy slave, note that this should be followed by an announce_once() */
+								host->status = STATUS_ZOMBIE;
+								/* update the current job description */
+								bzero(&(host->current), sizeof(current_t));
+								pthread_mutex_unlock(&mutexhost);
+								/* inform the other peers of the updated status */
+								announce_once();
+						}
+						else {
+								engineFailed  = 0;
+								matlabRunning = 1;
+								matlabFinished = time(NULL);
+								/* this only counts as overhead of the next job if it was waiting for it */
+								engineStartup = (jobcount()>0) ? walltime() - engineStart : 0;
+								DEBUG(LOG_NOTICE, "starting MATLAB engine took %.3f seconds", walltime() - engineStart);
 						}
+				}
+
+				if (jobcount()>0) {
+						/* there is a job to be executed */
+						jobStart = walltime();
+						evalStart = evalFinished = jobStart;
+						jobQueued = jobReceive = jobDeserialize = jobSerialize = 0;
+						jobname[0] = 0;
+						keep = 0;
+						memset(&chain, 0, sizeof(jobdef_t));
 
 						if (matlabRunning) {
 								/* get the first job input arguments and options */
@@ -748,22 +1025,40 @@ int main(int argc, char *argv[]) {
 
 								pthread_mutex_unlock(&mutexhost);
 
+								pthread_mutex_lock(&mutexworksteal);
+								worksteal.started = time(NULL);
+								pthread_mutex_unlock(&mutexworksteal);
+
 								/* inform the other peers of the updated status */
+								worksteal_update();
 								announce_once();
 
-								matlabStart = time(NULL);
+								/* the time that the job spent waiting and being received, see tcpsocket.c */
+								jobQueued  = jobStart - job->timing.arrived;
+								jobReceive = job->timing.receive;
 
-								argin   = (mxArray *)mxDeserialize(job->arg, job->job->argsize);
-								optin   = (mxArray *)mxDeserialize(job->opt, job->job->optsize);
+								/* the arguments of a job that was queued can be on disk */
+								jobDeserialize = walltime();
+								if (spill_load(job)!=0)
+										argin = NULL;
+								else
+										argin = (mxArray *)peer_deserialize(job->arg, job->job->argsize);
+								optin   = (mxArray *)peer_deserialize(job->opt, job->job->optsize);
+								jobDeserialize = walltime() - jobDeserialize;
 								jobid   = job->job->id;
 								peerid  = job->host->id;
+								strncpy(jobname, job->job->name, STRLEN);
+								jobname[STRLEN-1] = 0;
+								/* the results of an earlier job that are the input of this one, and whether its own are to be kept, see chain.c */
+								memcpy(&chain, job->job, sizeof(jobdef_t));
+								keep    = ((job->job->flags & JOBFLAG_KEEP)!=0);
 								DEBUG(LOG_NOTICE, "executing job %d from %s@%s (jobid=%u, memreq=%lu, timreq=%lu)", ++jobnum, job->host->user, job->host->name, job->job->id, job->job->memreq, job->job->timreq);
 								pthread_mutex_unlock(&mutexjoblist);
 
 								/* create a copy of the optin cell-array */
-								n = mxGetM(optin) * mxGetN(optin);
+								n = (optin ? mxGetM(optin) * mxGetN(optin) : 0);
 								previous = optin;
-								optin    = mxCreateCellMatrix(1, n+6);
+								optin    = mxCreateCellMatrix(1, n+8);
 								for (i=0; i<n; i++)
 										mxSetCell(optin, i, mxGetCell(previous, i));
 								/* add the masterid, timallow and memallow options, these are used for the watchdog */
@@ -773,8 +1068,41 @@ int main(int argc, char *argv[]) {
 								mxSetCell(optin, n+3, mxCreateDoubleScalar(timallow));
 								mxSetCell(optin, n+4, mxCreateString("memallow\0"));
 								mxSetCell(optin, n+5, mxCreateDoubleScalar(memallow));
-
-								jobFailed = 0;
+								/* add the jobid option, the memory profile of the job is tagged with it */
+								mxSetCell(optin, n+6, mxCreateString("jobid\0"));
+								mxSetCell(optin, n+7, mxCreateDoubleScalar(jobid));
+
+								jobFailed = (argin==NULL ? 1 : (previous==NULL ? 2 : 0));
+
+								/* append the kept results of the earlier job to the input arguments, these may have to be fetched from another slave */
+								if (!jobFailed && chain.chainhash) {
+										mxArray *input = NULL;
+										if ((kept = chain_input(&chain))!=NULL) {
+												input = (mxArray *)peer_deserialize(kept, chain.chainsize);
+												FREE(kept);
+										}
+										if (input && mxIsCell(input) && mxIsCell(argin)) {
+												n = mxGetNumberOfElements(argin);
+												c = mxGetNumberOfElements(input);
+												previous = argin;
+												argin    = mxCreateCellMatrix(1, n+c);
+												for (i=0; i<n; i++) {
+														mxSetCell(argin, i, mxGetCell(previous, i));
+														mxSetCell(previous, i, NULL);
+												}
+												for (i=0; i<c; i++) {
+														mxSetCell(argin, n+i, mxGetCell(input, i));
+														mxSetCell(input, i, NULL);
+												}
+												mxDestroyArray(previous);
+										}
+										else {
+												DEBUG(LOG_ERR, "the results of the earlier job are not available anymore");
+												jobFailed = 7;
+										}
+										if (input)
+												mxDestroyArray(input);
+								}
 
 								/* copy the input arguments and options over to the engine */
 								if (!jobFailed && (engPutVariable(en, "argin", argin) != 0)) {
@@ -782,7 +1110,8 @@ int main(int argc, char *argv[]) {
 										jobFailed = 1;
 								}
 
-								mxDestroyArray(argin);
+								if (argin)
+										mxDestroyArray(argin);
 								argin = NULL;
 
 								if (!jobFailed && (engPutVariable(en, "optin", optin) != 0)) {
@@ -806,11 +1135,13 @@ int main(int argc, char *argv[]) {
 #endif
 
 								/* execute the job */
+								evalStart = walltime();
 								if (!jobFailed && (engEvalString(en, "[argout, optout] = peerexec(argin, optin);") != 0)) {
 										DEBUG(LOG_ERR, "error evaluating string in engine");
 										jobFailed = 3;
 										engineAborted = 1;
 								}
+								evalFinished = walltime();
 
 #ifdef WATCHDOG
 								/* the job has copleted (either succesful ot not), disable the watchdog */
@@ -836,7 +1167,8 @@ int main(int argc, char *argv[]) {
 										engineAborted = 1;
 								}
 
-								if (!jobFailed && (engEvalString(en, "clear all") != 0)) {
+								/* clearing only the job variables keeps the functions and the path cache loaded */
+								if (!jobFailed && (engEvalString(en, clearall ? "clear all" : CLEARCMD) != 0)) {
 										DEBUG(LOG_ERR, "error clearing workspace");
 										jobFailed = 6;
 										engineAborted = 1;
@@ -871,6 +1203,9 @@ int main(int argc, char *argv[]) {
 								else if (jobFailed==6) {
 										DEBUG(LOG_ERR, "failed to execute job %d from %s@%s (clear)", jobnum, job->host->user, job->host->name);
 								}
+								else if (jobFailed==7) {
+										DEBUG(LOG_ERR, "failed to execute job %d from %s@%s (input)", jobnum, job->host->user, job->host->name);
+								}
 								else {
 										DEBUG(LOG_ERR, "failed to execute job %d from %s@%s", jobnum, job->host->user, job->host->name);
 								}
@@ -903,6 +1238,8 @@ int main(int argc, char *argv[]) {
 										mxSetCell(optout, 1, mxCreateString("failed to execute the job (optout)\0"));
 								else if (jobFailed==6)
 										mxSetCell(optout, 1, mxCreateString("failed to execute the job (clear)\0"));
+								else if (jobFailed==7)
+										mxSetCell(optout, 1, mxCreateString("failed to execute the job (input)\0"));
 								else
 										mxSetCell(optout, 1, mxCreateString("failed to execute the job\0"));
 						}
@@ -911,90 +1248,89 @@ int main(int argc, char *argv[]) {
 						 * send the results back to the master
 						 * the following code is largely shared with the put-option in the peer mex file
 						 *****************************************************************************/
-						found = 0;
 						pthread_mutex_lock(&mutexpeerlist);
-						peer = peerlist;
-						while(peer) {
-								if (peer->host->id==peerid) {
-										found = 1;
-										break;
-								}
-								peer = peer->next ;
-						}
+						found = (lookup_peerlist(peerid)!=NULL);
+						pthread_mutex_unlock(&mutexpeerlist);
 
 						if (!found) {
-								pthread_mutex_unlock(&mutexpeerlist);
 								DEBUG(LOG_ERR, "failed to locate specified peer");
 								goto cleanup;
 						}
 
+						/* the master has received the results from another slave in the meantime, see speculate.c */
+						if (cancel_check(peerid, jobid)) {
+								DEBUG(LOG_NOTICE, "job %d was cancelled, not returning the results", jobnum);
+								goto cleanup;
+						}
+
 						/* these have to be initialized to NULL to ensure that the cleanup works */
-						server = 0;
 						def = NULL;
 						arg = NULL;
 						opt = NULL;
 
-						if ((arg = (mxArray *) mxSerialize(argout))==NULL) {
-								DEBUG(LOG_ERR, "could not serialize job arguments");
-								goto cleanup;
-						}
+						jobSerialize = walltime();
 
-						if ((opt = (mxArray *) mxSerialize(optout))==NULL) {
-								DEBUG(LOG_ERR, "could not serialize job options");
-								goto cleanup;
+						/* the results of a job that was put with 'keep' stay on this slave, the master only receives where they are */
+						memset(&chain, 0, sizeof(jobdef_t));
+						if (keep && !engineFailed && !jobFailed && (kept = peer_serialize_malloc(argout, &keptsize))!=NULL) {
+								chain.chainhash = argcache_hash(kept, keptsize);
+								chain.chainsize = keptsize;
+								if (keptsize<=MAXARGSIZE && argcache_keep(chain.chainhash, kept, keptsize)) {
+										pthread_mutex_lock(&mutexhost);
+										chain.chainpeer = host->id;
+										pthread_mutex_unlock(&mutexhost);
+										mxDestroyArray(argout);
+										argout = mxCreateCellMatrix(1, 0);
+								}
+								else {
+										/* with --cache 0 or when they do not fit, the results are returned as usual */
+										DEBUG(LOG_INFO, "could not keep the results of job %d", jobnum);
+										FREE(kept);
+										chain.chainhash = 0;
+										chain.chainsize = 0;
+								}
 						}
 
-						if ((def = (jobdef_t *)malloc(sizeof(jobdef_t)))==NULL) {
-								DEBUG(LOG_ERR, "could not allocate memory");
+						if ((arg = (mxArray *) peer_serialize(argout))==NULL) {
+								DEBUG(LOG_ERR, "could not serialize job arguments");
 								goto cleanup;
 						}
-
-						pthread_mutex_lock(&mutexhost);
-						int hasuds = (strlen(peer->host->socket)>0 && strcmp(peer->host->name, host->name)==0);
-						int hastcp = (peer->host->port>0);
-						pthread_mutex_unlock(&mutexhost);
-
-						if (hasuds) {
-								/* open the UDS socket */
-								if ((server = open_uds_connection(peer->host->socket)) < 0) {
-										pthread_mutex_unlock(&mutexpeerlist);
-										DEBUG(LOG_ERR, "failed to create socket");
-										goto cleanup;
-								}
-						}
-						else if (hastcp) {
-								/* open the TCP socket */
-								if ((server = open_tcp_connection(peer->ipaddr, peer->host->port)) < 0) {
-										pthread_mutex_unlock(&mutexpeerlist);
-										DEBUG(LOG_ERR, "failed to create socket");
-										goto cleanup;
+						jobSerialize = walltime() - jobSerialize;
+
+						/* add the timing of the phases on this slave to the options, these are durations since the clocks of the peers differ */
+						if (optout && mxIsCell(optout)) {
+								const char *fieldnames[6] = {"queued", "receive", "deserialize", "engine", "eval", "serialize"};
+								mxArray *timing = mxCreateStructMatrix(1, 1, 6, fieldnames);
+								mxSetFieldByNumber(timing, 0, 0, mxCreateDoubleScalar(jobQueued));
+								mxSetFieldByNumber(timing, 0, 1, mxCreateDoubleScalar(jobReceive));
+								mxSetFieldByNumber(timing, 0, 2, mxCreateDoubleScalar(jobDeserialize));
+								mxSetFieldByNumber(timing, 0, 3, mxCreateDoubleScalar(engineStartup));
+								mxSetFieldByNumber(timing, 0, 4, mxCreateDoubleScalar(evalFinished - evalStart));
+								mxSetFieldByNumber(timing, 0, 5, mxCreateDoubleScalar(jobSerialize));
+
+								/* create a copy of the optout cell-array, the original elements move to the copy */
+								n = mxGetM(optout) * mxGetN(optout);
+								previous = optout;
+								optout   = mxCreateCellMatrix(1, n+2);
+								for (i=0; i<n; i++) {
+										mxSetCell(optout, i, mxGetCell(previous, i));
+										mxSetCell(previous, i, NULL);
 								}
+								mxDestroyArray(previous);
+								mxSetCell(optout, n+0, mxCreateString("timing\0"));
+								mxSetCell(optout, n+1, timing);
 						}
-						else {
-								pthread_mutex_unlock(&mutexpeerlist);
-								DEBUG(LOG_ERR, "failed to create socket");
-								goto cleanup;
-						}
-
-						/* the connection was opened without error */
-						pthread_mutex_unlock(&mutexpeerlist);
 
-						if ((n = bufread(server, &handshake, sizeof(int))) != sizeof(int)) {
-								DEBUG(LOG_ERR, "could not read handshake");
+						if ((opt = (mxArray *) peer_serialize(optout))==NULL) {
+								DEBUG(LOG_ERR, "could not serialize job options");
 								goto cleanup;
 						}
-						else if (!handshake) {
-								DEBUG(LOG_ERR, "failed to negociate connection");
+
+						if ((def = (jobdef_t *)malloc(sizeof(jobdef_t)))==NULL) {
+								DEBUG(LOG_ERR, "could not allocate memory");
 								goto cleanup;
 						}
 
-						/* the message that will be written consists of
-						   message->host
-						   message->job
-						   message->arg
-						   message->opt
-						 */
-
 						def->version  = VERSION;
 						def->id       = jobid;
 						def->memreq   = 0;
@@ -1002,67 +1338,23 @@ int main(int argc, char *argv[]) {
 						def->timreq   = 0;
 						def->argsize  = mxGetNumberOfElements(arg);
 						def->optsize  = mxGetNumberOfElements(opt);
-
-						/* write the message  (hostdef, jobdef, arg, opt) with handshakes in between */
-						/* the slave may close the connection between the message segments in case the job is refused */
-						success = 1;
-
-						pthread_mutex_lock(&mutexhost);
-						if (success) 
-								success = (bufwrite(server, host, sizeof(hostdef_t)) == sizeof(hostdef_t));
-						pthread_mutex_unlock(&mutexhost);
-
-						if ((n = bufread(server, &handshake, sizeof(int))) != sizeof(int)) {
-								DEBUG(LOG_ERR, "could not read handshake");
-								goto cleanup;
-						}
-						else if (!handshake) {
-								DEBUG(LOG_ERR, "failed to write hostdef");
-								goto cleanup;
-						}
-
-						if (success)
-								success = (bufwrite(server, def, sizeof(jobdef_t)) == sizeof(jobdef_t));
-
-						if ((n = bufread(server, &handshake, sizeof(int))) != sizeof(int)) {
-								DEBUG(LOG_ERR, "could not read handshake");
-								goto cleanup;
-						}
-						else if (!handshake) {
-								DEBUG(LOG_ERR, "failed to write jobdef");
-								goto cleanup;
-						}
-
-						if (success) 
-								success = (bufwrite(server, (void *)mxGetData(arg), def->argsize) == def->argsize);
-
-						if ((n = bufread(server, &handshake, sizeof(int))) != sizeof(int)) {
-								DEBUG(LOG_ERR, "could not read handshake");
-								goto cleanup;
-						}
-						else if (!handshake) {
-								DEBUG(LOG_ERR, "failed to write arg");
-								goto cleanup;
-						}
-
-						if (success) 
-								success = (bufwrite(server, (void *)mxGetData(opt), def->optsize) == def->optsize);
-
-						if ((n = bufread(server, &handshake, sizeof(int))) != sizeof(int)) {
-								DEBUG(LOG_ERR, "could not read handshake");
-								goto cleanup;
-						}
-						else if (!handshake) {
-								DEBUG(LOG_ERR, "failed to write opt");
+						strncpy(def->name, jobname, STRLEN);
+						def->arghash  = 0;
+						def->flags    = 0;
+						def->priority = PRIORITY_NORMAL;
+						def->chainhash = chain.chainhash;
+						def->chainsize = chain.chainsize;
+						def->chainpeer = chain.chainpeer;
+						def->gpureq    = 0;
+						def->gpumemreq = 0;
+
+						/* the peer might have expired in the meantime, the connection is kept open for the next results */
+						if (!write_job(peerid, def, mxGetData(arg), mxGetData(opt))) {
+								DEBUG(LOG_ERR, "failed to write the results of job %d", jobnum);
 								goto cleanup;
 						}
 
 cleanup:
-						if (server>0) {
-								close_connection(server);
-								server = 0;
-						}
-
 						if (argin) {
 								mxDestroyArray(argin);
 								argin = NULL;
@@ -1097,22 +1389,40 @@ cleanup:
 
 						/*****************************************************************************/
 
-						/* clear the joblist */
-						clear_joblist();
+						/* keep the arguments for the following jobs with the same ones */
+						pthread_mutex_lock(&mutexjoblist);
+						if (joblist)
+								argcache_store(joblist);
+						pthread_mutex_unlock(&mutexjoblist);
+
+						/* remove the job from the joblist, the queued jobs remain */
+						pop_joblist();
+
+						pthread_mutex_lock(&mutexworksteal);
+						worksteal.started = 0;
+						pthread_mutex_unlock(&mutexworksteal);
 
 						if (!engineFailed) {
+								if (!jobFailed)
+										duration_update(jobname, evalFinished - evalStart);
+
 								pthread_mutex_lock(&mutexhost);
 								/* make the slave available again, note that this should be followed by an announce_once() */
-								host->status = STATUS_IDLE;
+								/* it remains busy if there are queued jobs, these are not to be refused */
+								host->status = (jobcount()>0 ? STATUS_BUSY : STATUS_IDLE);
 								/* update the current job description */
 								bzero(&(host->current), sizeof(current_t));
 								pthread_mutex_unlock(&mutexhost);
 								/* inform the other peers of the updated status */
+								worksteal_update();
 								announce_once();
 
 								matlabFinished = time(NULL);
-								DEBUG(LOG_NOTICE, "executing job %d took %d seconds", jobnum, matlabFinished - matlabStart);
+								/* the overhead is everything but evaluating the job, incl. starting the engine for it */
+								jobTime = walltime() - jobStart + engineStartup;
+								DEBUG(LOG_NOTICE, "executing job %d took %.3f seconds, compute %.3f, overhead %.3f (engine startup %.3f)", jobnum, jobTime, evalFinished - evalStart, jobTime - (evalFinished - evalStart), engineStartup);
 						}
+						engineStartup = 0;
 				}
 				else {
 						threadsleep(SLEEPTIME);
@@ -0,0 +1,543 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/
+ *
+ */
+
+/*
+ * The results of the jobs of a batch that is put with a reduction are not
+ * added to the joblist of the master. Instead tcpsocket calls reduce_arrived,
+ * which combines them with the results of the batch that arrived earlier,
+ * so that only a single reduced result is kept. This works directly on the
+ * serialized arrays, see serialize.c, so that it does not need MATLAB.
+ *
+ * The results are reduced per element of the output cell-array, which should
+ * consist of real numeric arrays with the same size and type for all jobs.
+ * Sum and mean are only supported for double and single, max and min for
+ * all numeric types. Concatenation takes place when the result is requested,
+ * in the order of the jobs in the batch. The results that cannot be reduced,
+ * such as those of jobs that failed, are added to the joblist as usual.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "peer.h"
+#include "extern.h"
+#include "platform_includes.h"
+
+#define MAXDIM 32
+
+typedef struct {
+		UINT32_T type;
+		UINT32_T flags;
+		UINT64_T ndim;
+		UINT64_T dims[MAXDIM];
+		UINT64_T numel;
+		const char *data;     /* the payload that follows the header */
+		const char *next;     /* the item that follows this one */
+} item_t;
+
+static size_t element_size(UINT32_T type) {
+		switch (type) {
+				case TYPE_DOUBLE:  return 8;
+				case TYPE_SINGLE:  return 4;
+				case TYPE_INT8:    return 1;
+				case TYPE_UINT8:   return 1;
+				case TYPE_INT16:   return 2;
+				case TYPE_UINT16:  return 2;
+				case TYPE_INT32:   return 4;
+				case TYPE_UINT32:  return 4;
+				case TYPE_INT64:   return 8;
+				case TYPE_UINT64:  return 8;
+				case TYPE_LOGICAL: return 1;
+				case TYPE_CHAR:    return 2;
+				default:           return 0;
+		}
+}
+
+/* parse the item at ptr, this returns -1 if it is invalid or truncated */
+static int parse_item(const char *ptr, const char *end, item_t *item) {
+		UINT64_T i, n, nnz, numfield, f;
+		size_t elsize;
+		item_t sub;
+
+		if (end-ptr<16)
+				return -1;
+		memcpy(&item->type,  ptr,   4);
+		memcpy(&item->flags, ptr+4, 4);
+		memcpy(&item->ndim,  ptr+8, 8);
+		ptr += 16;
+		if (item->ndim>MAXDIM || end-ptr<8*item->ndim)
+				return -1;
+		item->numel = (item->type==TYPE_NULL ? 0 : 1);
+		for (i=0; i<item->ndim; i++) {
+				memcpy(&item->dims[i], ptr, 8);
+				item->numel *= item->dims[i];
+				ptr += 8;
+		}
+		item->data = ptr;
+
+		switch (item->type) {
+				case TYPE_NULL:
+						break;
+
+				case TYPE_MATLAB:
+						if (end-ptr<8)
+								return -1;
+						memcpy(&n, ptr, 8);
+						ptr += 8 + PADDED(n);
+						break;
+
+				case TYPE_CELL:
+						for (i=0; i<item->numel; i++) {
+								if (parse_item(ptr, end, &sub)!=0)
+										return -1;
+								ptr = sub.next;
+						}
+						break;
+
+				case TYPE_STRUCT:
+						if (end-ptr<8)
+								return -1;
+						memcpy(&numfield, ptr, 8);
+						ptr += 8;
+						for (f=0; f<numfield; f++) {
+								if (end-ptr<8)
+										return -1;
+								memcpy(&n, ptr, 8);
+								ptr += 8 + PADDED(n);
+						}
+						for (i=0; i<item->numel*numfield; i++) {
+								if (parse_item(ptr, end, &sub)!=0)
+										return -1;
+								ptr = sub.next;
+						}
+						break;
+
+				default:
+						if ((elsize = element_size(item->type))==0)
+								return -1;
+						n = item->numel;
+						if (item->flags & FLAG_SPARSE) {
+								if (item->ndim!=2 || end-ptr<8)
+										return -1;
+								memcpy(&nnz, ptr, 8);
+								ptr += 8 + 8*(item->dims[1]+1) + 8*nnz;
+								n = nnz;
+						}
+						ptr += PADDED(n*elsize);
+						if (item->flags & FLAG_COMPLEX)
+								ptr += PADDED(n*elsize);
+						break;
+		}
+
+		if (ptr>end)
+				return -1;
+		item->next = ptr;
+		return 0;
+}
+
+static int reducible_type(int operation, UINT32_T type) {
+		if (type<TYPE_DOUBLE || type>TYPE_UINT64)
+				return 0;
+		if (operation==REDUCE_SUM || operation==REDUCE_MEAN)
+				return (type==TYPE_DOUBLE || type==TYPE_SINGLE);
+		return 1;
+}
+
+#define COMBINE(T, op) { \
+		T *a = (T *)dst; const T *b = (const T *)src; \
+		if (op==REDUCE_MAX) { for (i=0; i<n; i++) if (b[i]>a[i]) a[i] = b[i]; } \
+		else if (op==REDUCE_MIN) { for (i=0; i<n; i++) if (b[i]<a[i]) a[i] = b[i]; } \
+		else { for (i=0; i<n; i++) a[i] += b[i]; } }
+
+static void combine_data(int operation, UINT32_T type, void *dst, const void *src, UINT64_T n) {
+		UINT64_T i;
+		switch (type) {
+				case TYPE_DOUBLE: COMBINE(FLOAT64_T, operation); break;
+				case TYPE_SINGLE: COMBINE(FLOAT32_T, operation); break;
+				case TYPE_INT8:   COMBINE(INT8_T,    operation); break;
+				case TYPE_UINT8:  COMBINE(UINT8_T,   operation); break;
+				case TYPE_INT16:  COMBINE(INT16_T,   operation); break;
+				case TYPE_UINT16: COMBINE(UINT16_T,  operation); break;
+				case TYPE_INT32:  COMBINE(INT32_T,   operation); break;
+				case TYPE_UINT32: COMBINE(UINT32_T,  operation); break;
+				case TYPE_INT64:  COMBINE(INT64_T,   operation); break;
+				case TYPE_UINT64: COMBINE(UINT64_T,  operation); break;
+		}
+}
+
+/* this checks that the items match, and combines the second into the first if apply is set */
+static int combine_item(int operation, char *acc, const char *buf, const char *accend, const char *bufend, int apply, const char **next) {
+		item_t a, b;
+		UINT64_T i;
+		const char *pa, *pb;
+
+		if (parse_item(acc, accend, &a)!=0 || parse_item(buf, bufend, &b)!=0)
+				return -1;
+		/* the type, flags and dimensions should be the same */
+		if (a.data-acc!=b.data-buf || memcmp(acc, buf, a.data-acc)!=0)
+				return -1;
+
+		if (a.type==TYPE_CELL) {
+				pa = a.data;
+				pb = b.data;
+				for (i=0; i<a.numel; i++) {
+						if (combine_item(operation, (char *)pa, pb, accend, bufend, apply, &pa)!=0)
+								return -1;
+						parse_item(pb, bufend, &b);
+						pb = b.next;
+				}
+		}
+		else if (a.type==TYPE_NULL) {
+				/* an empty element of the cell-array */
+		}
+		else if (a.flags==0 && reducible_type(operation, a.type)) {
+				if (apply && operation!=REDUCE_CONCAT)
+						combine_data(operation, a.type, (char *)a.data, b.data, a.numel);
+		}
+		else {
+				return -1;
+		}
+
+		if (next)
+				*next = a.next;
+		return 0;
+}
+
+/* this returns 0 if the serialized result can be reduced with the operation */
+static int check_result(int operation, const void *buf, UINT64_T size) {
+		if (size<8 || memcmp(buf, SERIALIZE_MAGIC, 8)!=0)
+				return -1;
+		return combine_item(operation, (char *)buf+8, (const char *)buf+8, (const char *)buf+size, (const char *)buf+size, 0, NULL);
+}
+
+/* the concatenation of the items of all pieces, this computes the size if dst is NULL */
+static UINT64_T concat_item(int dim, const char **src, const char **end, UINT32_T count, char *dst) {
+		item_t first, item;
+		UINT64_T i, j, k, inner, outer, len, total = 0, size = 0, n;
+		UINT32_T p;
+		const char **sub;
+		size_t elsize;
+
+		if (parse_item(src[0], end[0], &first)!=0)
+				return 0;
+		if (first.type==TYPE_CELL) {
+				/* the cell-arrays should have the same size */
+				for (p=1; p<count; p++)
+						if (parse_item(src[p], end[p], &item)!=0 || item.data-src[p]!=first.data-src[0] || memcmp(src[p], src[0], first.data-src[0])!=0)
+								return 0;
+				if ((sub = (const char **)malloc(count*sizeof(char *)))==NULL)
+						return 0;
+				for (p=0; p<count; p++)
+						sub[p] = src[p] + (first.data-src[0]);
+				size = first.data-src[0];
+				if (dst)
+						memcpy(dst, src[0], size);
+				for (i=0; i<first.numel; i++) {
+						if ((n = concat_item(dim, sub, end, count, (dst ? dst+size : NULL)))==0) {
+								FREE(sub);
+								return 0;
+						}
+						size += n;
+						/* continue with the next element of each piece */
+						for (p=0; p<count; p++) {
+								parse_item(sub[p], end[p], &item);
+								sub[p] = item.next;
+						}
+				}
+				FREE(sub);
+				return size;
+		}
+
+		if (first.flags!=0 || first.type<TYPE_DOUBLE || first.type>TYPE_UINT64)
+				return 0;
+		elsize = element_size(first.type);
+
+		/* the dimensions other than the one along which they are concatenated should match */
+		n = (first.ndim>dim ? first.ndim : dim+1);
+		for (p=0; p<count; p++) {
+				if (parse_item(src[p], end[p], &item)!=0 || item.type!=first.type || item.flags!=0)
+						return 0;
+				if (item.ndim>n)
+						n = item.ndim;
+		}
+		for (p=0; p<count; p++) {
+				parse_item(src[p], end[p], &item);
+				for (k=0; k<n; k++) {
+						if (k==dim)
+								continue;
+						if ((k<item.ndim ? item.dims[k] : 1) != (k<first.ndim ? first.dims[k] : 1))
+								return 0;
+				}
+				total += (dim<item.ndim ? item.dims[dim] : 1);
+		}
+
+		inner = 1;
+		for (k=0; k<dim; k++)
+				inner *= (k<first.ndim ? first.dims[k] : 1);
+		outer = 1;
+		for (k=dim+1; k<first.ndim; k++)
+				outer *= first.dims[k];
+
+		size = 16 + 8*n + PADDED(inner*total*outer*elsize);
+		if (dst==NULL)
+				return size;
+
+		memcpy(dst, &first.type, 4);
+		memcpy(dst+4, &first.flags, 4);
+		memcpy(dst+8, &n, 8);
+		for (k=0; k<n; k++) {
+				len = (k==dim ? total : (k<first.ndim ? first.dims[k] : 1));
+				memcpy(dst+16+8*k, &len, 8);
+		}
+		dst += 16 + 8*n;
+		memset(dst, 0, PADDED(inner*total*outer*elsize));
+
+		/* the data is in column-major order, the pieces are interleaved per block of the outer dimensions */
+		for (j=0; j<outer; j++)
+				for (p=0; p<count; p++) {
+						parse_item(src[p], end[p], &item);
+						len = inner * (dim<item.ndim ? item.dims[dim] : 1) * elsize;
+						memcpy(dst, item.data + j*len, len);
+						dst += len;
+				}
+		return size;
+}
+
+/* divide the sums by the number of results to complete the mean */
+static void finish_mean(char *ptr, const char *end, UINT32_T count) {
+		item_t item;
+		UINT64_T i;
+
+		if (parse_item(ptr, end, &item)!=0)
+				return;
+		if (item.type==TYPE_CELL) {
+				ptr = (char *)item.data;
+				for (i=0; i<item.numel; i++) {
+						finish_mean(ptr, end, count);
+						parse_item(ptr, end, &item);
+						ptr = (char *)item.next;
+				}
+		}
+		else if (item.type==TYPE_DOUBLE) {
+				for (i=0; i<item.numel; i++)
+						((FLOAT64_T *)item.data)[i] /= count;
+		}
+		else if (item.type==TYPE_SINGLE) {
+				for (i=0; i<item.numel; i++)
+						((FLOAT32_T *)item.data)[i] /= count;
+		}
+}
+
+static reducelist_t *lookup_reduce(UINT32_T id) {
+		reducelist_t *listitem = reducelist;
+		while (listitem && listitem->id!=id)
+				listitem = listitem->next;
+		return listitem;
+}
+
+static void free_reduce(reducelist_t *listitem) {
+		UINT32_T i;
+		if (listitem->piece)
+				for (i=0; i<listitem->numjob; i++)
+						FREE(listitem->piece[i]);
+		FREE(listitem->piece);
+		FREE(listitem->piecesize);
+		FREE(listitem->acc);
+		FREE(listitem->jobid);
+		FREE(listitem->state);
+		FREE(listitem);
+}
+
+/* start the reduction of the results of the jobs of a batch, this returns 0 on success */
+int reduce_batch(UINT32_T id, int operation, int dim, UINT32_T numjob, const UINT32_T *jobid) {
+		reducelist_t *listitem;
+
+		if ((listitem = (reducelist_t *)calloc(1, sizeof(reducelist_t)))==NULL)
+				return -1;
+		listitem->id        = id;
+		listitem->operation = operation;
+		listitem->dim       = dim;
+		listitem->numjob    = numjob;
+		listitem->jobid     = (UINT32_T *)malloc(numjob*sizeof(UINT32_T));
+		listitem->state     = (UINT8_T *)calloc(numjob, sizeof(UINT8_T));
+		if (operation==REDUCE_CONCAT) {
+				listitem->piece     = (void **)calloc(numjob, sizeof(void *));
+				listitem->piecesize = (UINT64_T *)calloc(numjob, sizeof(UINT64_T));
+		}
+		if (!listitem->jobid || !listitem->state || (operation==REDUCE_CONCAT && (!listitem->piece || !listitem->piecesize))) {
+				free_reduce(listitem);
+				return -1;
+		}
+		memcpy(listitem->jobid, jobid, numjob*sizeof(UINT32_T));
+
+		pthread_mutex_lock(&mutexreduce);
+		listitem->next = reducelist;
+		reducelist     = listitem;
+		pthread_mutex_unlock(&mutexreduce);
+		return 0;
+}
+
+/* the job was not put, its results are not to be expected */
+void reduce_skip(UINT32_T id, UINT32_T jobid) {
+		reducelist_t *listitem;
+		UINT32_T i;
+
+		pthread_mutex_lock(&mutexreduce);
+		if ((listitem = lookup_reduce(id))!=NULL)
+				for (i=0; i<listitem->numjob; i++)
+						if (listitem->jobid[i]==jobid && listitem->state[i]==REDUCE_PENDING) {
+								listitem->state[i] = REDUCE_SKIPPED;
+								break;
+						}
+		pthread_mutex_unlock(&mutexreduce);
+}
+
+/* this returns 1 if the results were combined with the others, in which case the job can be discarded */
+int reduce_arrived(joblist_t *job) {
+		reducelist_t *listitem;
+		UINT32_T i = 0;
+		int reduced = 0;
+
+		pthread_mutex_lock(&mutexreduce);
+		for (listitem = reducelist; listitem; listitem = listitem->next) {
+				for (i=0; i<listitem->numjob; i++)
+						if (listitem->jobid[i]==job->job->id && listitem->state[i]==REDUCE_PENDING)
+								break;
+				if (i<listitem->numjob)
+						break;
+		}
+
+		/* the results that were spooled to disk are combined in memory */
+		if (listitem && job->spill && spill_load(job)!=0)
+				DEBUG(LOG_ERR, "reduce_arrived: could not load the results of job %u", job->job->id);
+
+		if (listitem==NULL || job->arg==NULL || check_result(listitem->operation, job->arg, job->job->argsize)!=0) {
+				/* these results are returned as usual */
+				if (listitem)
+						listitem->state[i] = REDUCE_FAILED;
+				pthread_mutex_unlock(&mutexreduce);
+				return 0;
+		}
+
+		if (listitem->operation==REDUCE_CONCAT) {
+				/* the pieces are only concatenated when the result is requested */
+				listitem->piece[i]     = job->arg;
+				listitem->piecesize[i] = job->job->argsize;
+				job->arg = NULL;
+				reduced = 1;
+		}
+		else if (listitem->acc==NULL) {
+				/* the results of the first job are the start of the reduction */
+				listitem->acc     = job->arg;
+				listitem->accsize = job->job->argsize;
+				job->arg = NULL;
+				reduced = 1;
+		}
+		else if (listitem->accsize==job->job->argsize && combine_item(listitem->operation, (char *)listitem->acc+8, (const char *)job->arg+8, (const char *)listitem->acc+listitem->accsize, (const char *)job->arg+job->job->argsize, 0, NULL)==0) {
+				combine_item(listitem->operation, (char *)listitem->acc+8, (const char *)job->arg+8, (const char *)listitem->acc+listitem->accsize, (const char *)job->arg+job->job->argsize, 1, NULL);
+				reduced = 1;
+		}
+
+		listitem->state[i] = (reduced ? REDUCE_DONE : REDUCE_FAILED);
+		if (reduced)
+				listitem->count++;
+		pthread_mutex_unlock(&mutexreduce);
+
+		if (reduced) {
+				DEBUG(LOG_INFO, "reduce_arrived: reduced the results of job %u into batch %u", job->job->id, listitem->id);
+		}
+		return reduced;
+}
+
+/* this returns a copy of the serialized result of the reduction, or NULL if no results were reduced yet */
+void *reduce_result(UINT32_T id, UINT64_T *size, UINT32_T *count, UINT32_T *pending, int clear) {
+		reducelist_t *listitem, *previous = NULL;
+		const char **src = NULL, **end = NULL;
+		char *buf = NULL;
+		UINT32_T i, n;
+
+		*size    = 0;
+		*count   = 0;
+		*pending = 0;
+
+		pthread_mutex_lock(&mutexreduce);
+		for (listitem = reducelist; listitem && listitem->id!=id; listitem = listitem->next)
+				previous = listitem;
+		if (listitem==NULL) {
+				pthread_mutex_unlock(&mutexreduce);
+				return NULL;
+		}
+
+		*count = listitem->count;
+		for (i=0; i<listitem->numjob; i++)
+				*pending += (listitem->state[i]==REDUCE_PENDING);
+
+		if (listitem->operation==REDUCE_CONCAT && listitem->count>0) {
+				src = (const char **)malloc(listitem->count*sizeof(char *));
+				end = (const char **)malloc(listitem->count*sizeof(char *));
+				if (src && end) {
+						for (i=0, n=0; i<listitem->numjob; i++)
+								if (listitem->piece[i]) {
+										src[n] = (const char *)listitem->piece[i] + 8;
+										end[n] = (const char *)listitem->piece[i] + listitem->piecesize[i];
+										n++;
+								}
+						/* the size is computed first */
+						if ((*size = concat_item(listitem->dim, src, end, n, NULL))>0 && (buf = malloc(*size+8))!=NULL) {
+								memcpy(buf, SERIALIZE_MAGIC, 8);
+								concat_item(listitem->dim, src, end, n, buf+8);
+								*size += 8;
+						}
+						else {
+								DEBUG(LOG_ERR, "reduce_result: the results of batch %u cannot be concatenated", id);
+								*size = 0;
+						}
+				}
+				FREE(src);
+				FREE(end);
+		}
+		else if (listitem->acc && (buf = malloc(listitem->accsize))!=NULL) {
+				memcpy(buf, listitem->acc, listitem->accsize);
+				*size = listitem->accsize;
+				if (listitem->operation==REDUCE_MEAN)
+						finish_mean(buf+8, buf+*size, listitem->count);
+		}
+
+		if (clear) {
+				if (previous)
+						previous->next = listitem->next;
+				else
+						reducelist = listitem->next;
+				free_reduce(listitem);
+		}
+		pthread_mutex_unlock(&mutexreduce);
+		return buf;
+}
+
+void clear_reducelist(void) {
+		reducelist_t *listitem;
+
+		pthread_mutex_lock(&mutexreduce);
+		while (reducelist) {
+				listitem = reducelist->next;
+				free_reduce(reducelist);
+				reducelist = listitem;
+		}
+		pthread_mutex_unlock(&mutexreduce);
+}
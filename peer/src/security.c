@@ -16,99 +16,217 @@
  *
  */
 
+/*
+ * The allow and refuse lists of users, groups and hosts are kept as linked
+ * lists, but they are looked up in hashed sets that are built from them when
+ * they are needed after a change. Every function that changes the lists calls
+ * security_changed afterwards. The decision for a host is remembered by its id
+ * and the hash of its user, group and host name until the lists change again,
+ * so that the repeated announcements and requests of the same peer do not have
+ * to be checked over and over.
+ */
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "peer.h"
 #include "extern.h"
 
-/* returns 1 if the host is in the userlist, grouplist and hostlist, 0 if not */
-int security_check(hostdef_t *host) {
-		int ismember = 1;
-		ismember = ismember && ismember_userlist(host->user);
-		ismember = ismember && ismember_grouplist(host->group);
-		ismember = ismember && ismember_hostlist(host->name);
-		return ismember;
+#define ALLOWUSER   0
+#define REFUSEUSER  1
+#define ALLOWGROUP  2
+#define REFUSEGROUP 3
+#define ALLOWHOST   4
+#define REFUSEHOST  5
+
+/* the names are compared with strncmp over STRLEN characters, hence only those are hashed */
+static UINT64_T name_hash(const char *str) {
+		UINT32_T len = 0;
+		while (len<STRLEN && str[len])
+				len++;
+		return argcache_hash(str, len);
 }
 
-int ismember_userlist(char *str) {
-		int ismember = 1;
-		userlist_t *user = NULL;
-		pthread_mutex_lock(&mutexallowuserlist);
-		if (allowuserlist) {
-				ismember = 0;
-				user = allowuserlist;
-				while (user) {
-						if (strncmp(user->name, str, STRLEN)==0)
-								ismember = 1;
-						user = user->next;
+static UINT32_T name_bucket(UINT64_T hash) {
+		return (UINT32_T)(hash ^ (hash>>32)) & (SECURITY_HASHSIZE-1);
+}
+
+/* this should be called with mutexsecurity locked */
+static void free_sets(void) {
+		securityset_t *item;
+		int i, j;
+		for (i=0; i<SECURITY_SETS; i++) {
+				for (j=0; j<SECURITY_HASHSIZE; j++) {
+						while ((item = security.set[i][j])) {
+								security.set[i][j] = item->next;
+								FREE(item->name);
+								FREE(item);
+						}
 				}
+				security.count[i] = 0;
 		}
+}
+
+/* this should be called with mutexsecurity locked */
+static int add_set(int which, const char *name) {
+		securityset_t *item;
+		UINT32_T bucket;
+		if ((item = (securityset_t *)malloc(sizeof(securityset_t)))==NULL)
+				return 0;
+		if ((item->name = strdup(name))==NULL) {
+				FREE(item);
+				return 0;
+		}
+		item->hash = name_hash(name);
+		bucket     = name_bucket(item->hash);
+		item->next = security.set[which][bucket];
+		security.set[which][bucket] = item;
+		security.count[which]++;
+		return 1;
+}
+
+/* this should be called with mutexsecurity locked */
+static int in_set(int which, UINT64_T hash, const char *str) {
+		securityset_t *item;
+		for (item = security.set[which][name_bucket(hash)]; item; item = item->next)
+				if (item->hash==hash && strncmp(item->name, str, STRLEN)==0)
+						return 1;
+		return 0;
+}
+
+/* rebuild the sets if the lists changed since they were built, this returns 0 if out of memory */
+/* this should be called with mutexsecurity locked */
+static int update_sets(void) {
+		userlist_t  *user;
+		grouplist_t *group;
+		hostlist_t  *host;
+		int success = 1;
+
+		if (security.built==security.changed)
+				return 1;
+		free_sets();
+
+		pthread_mutex_lock(&mutexallowuserlist);
+		for (user = allowuserlist; user; user = user->next)
+				success = success && add_set(ALLOWUSER, user->name);
 		pthread_mutex_unlock(&mutexallowuserlist);
 		pthread_mutex_lock(&mutexrefuseuserlist);
-		if (refuseuserlist) {
-				user = refuseuserlist;
-				while (user) {
-						if (strncmp(user->name, str, STRLEN)==0)
-								ismember = 0;
-						user = user->next;
-				}
-		}
+		for (user = refuseuserlist; user; user = user->next)
+				success = success && add_set(REFUSEUSER, user->name);
 		pthread_mutex_unlock(&mutexrefuseuserlist);
-		return ismember;
-}
 
-int ismember_grouplist(char *str) {
-		int ismember = 1; 
-		grouplist_t *group = NULL;
 		pthread_mutex_lock(&mutexallowgrouplist);
-		if (allowgrouplist) {
-				ismember = 0;
-				group = allowgrouplist;
-				while (group) {
-						if (strncmp(group->name, str, STRLEN)==0)
-								ismember = 1;
-						group = group->next;
-				}
-		}
+		for (group = allowgrouplist; group; group = group->next)
+				success = success && add_set(ALLOWGROUP, group->name);
 		pthread_mutex_unlock(&mutexallowgrouplist);
 		pthread_mutex_lock(&mutexrefusegrouplist);
-		if (refusegrouplist) {
-				group = refusegrouplist;
-				while (group) {
-						if (strncmp(group->name, str, STRLEN)==0)
-								ismember = 0;
-						group = group->next;
-				}
-		}
+		for (group = refusegrouplist; group; group = group->next)
+				success = success && add_set(REFUSEGROUP, group->name);
 		pthread_mutex_unlock(&mutexrefusegrouplist);
-		return ismember;
-}
 
-int ismember_hostlist(char *str) {
-		int ismember = 1; 
-		hostlist_t *host = NULL;
 		pthread_mutex_lock(&mutexallowhostlist);
-		if (allowhostlist) {
-				ismember = 0;
-				host = allowhostlist;
-				while (host) {
-						if (strncmp(host->name, str, STRLEN)==0)
-								ismember = 1;
-						host = host->next;
-				}
-		}
+		for (host = allowhostlist; host; host = host->next)
+				success = success && add_set(ALLOWHOST, host->name);
 		pthread_mutex_unlock(&mutexallowhostlist);
 		pthread_mutex_lock(&mutexrefusehostlist);
-		if (refusehostlist) {
-				host = refusehostlist;
-				while (host) {
-						if (strncmp(host->name, str, STRLEN)==0)
-								ismember = 0;
-						host = host->next;
-				}
-		}
+		for (host = refusehostlist; host; host = host->next)
+				success = success && add_set(REFUSEHOST, host->name);
 		pthread_mutex_unlock(&mutexrefusehostlist);
+
+		if (!success) {
+				/* an incomplete allow list would let everyone in */
+				DEBUG(LOG_ERR, "security: out of memory while building the allow and refuse sets");
+				free_sets();
+				return 0;
+		}
+		security.built = security.changed;
+		return 1;
+}
+
+/* an empty allow list allows everyone, the refuse list overrules the allow list */
+/* this should be called with mutexsecurity locked */
+static int ismember_set(int allow, int refuse, const char *str) {
+		UINT64_T hash = name_hash(str);
+		if (security.count[allow] && !in_set(allow, hash, str))
+				return 0;
+		if (security.count[refuse] && in_set(refuse, hash, str))
+				return 0;
+		return 1;
+}
+
+/* this should be called after each change of the allow or refuse lists, and not while they are locked */
+void security_changed(void) {
+		pthread_mutex_lock(&mutexsecurity);
+		/* the remembered decisions are recognized by the value of changed, 0 marks them as unused */
+		if (++security.changed==0)
+				security.changed = 1;
+		pthread_mutex_unlock(&mutexsecurity);
+}
+
+/* free the sets and forget the decisions */
+void security_clear(void) {
+		pthread_mutex_lock(&mutexsecurity);
+		free_sets();
+		memset(security.cache, 0, sizeof(security.cache));
+		security.built = 0;
+		if (++security.changed==0)
+				security.changed = 1;
+		pthread_mutex_unlock(&mutexsecurity);
+}
+
+/* returns 1 if the host is in the userlist, grouplist and hostlist, 0 if not */
+int security_check(hostdef_t *host) {
+		securitycache_t *entry;
+		UINT64_T strhash;
+		int ismember;
+
+		strhash = name_hash(host->user);
+		strhash = strhash*1099511628211ULL ^ name_hash(host->group);
+		strhash = strhash*1099511628211ULL ^ name_hash(host->name);
+
+		pthread_mutex_lock(&mutexsecurity);
+		entry = &security.cache[(host->id*2654435761U)>>24 & (SECURITY_CACHESIZE-1)];
+		if (entry->changed==security.changed && entry->hostid==host->id && entry->strhash==strhash) {
+				ismember = entry->allowed;
+		}
+		else if (!update_sets()) {
+				ismember = 0;
+		}
+		else {
+				ismember = 1;
+				ismember = ismember && ismember_set(ALLOWUSER,  REFUSEUSER,  host->user);
+				ismember = ismember && ismember_set(ALLOWGROUP, REFUSEGROUP, host->group);
+				ismember = ismember && ismember_set(ALLOWHOST,  REFUSEHOST,  host->name);
+				entry->hostid  = host->id;
+				entry->strhash = strhash;
+				entry->changed = security.changed;
+				entry->allowed = ismember;
+		}
+		pthread_mutex_unlock(&mutexsecurity);
 		return ismember;
 }
 
+int ismember_userlist(char *str) {
+		int ismember;
+		pthread_mutex_lock(&mutexsecurity);
+		ismember = update_sets() && ismember_set(ALLOWUSER, REFUSEUSER, str);
+		pthread_mutex_unlock(&mutexsecurity);
+		return ismember;
+}
+
+int ismember_grouplist(char *str) {
+		int ismember;
+		pthread_mutex_lock(&mutexsecurity);
+		ismember = update_sets() && ismember_set(ALLOWGROUP, REFUSEGROUP, str);
+		pthread_mutex_unlock(&mutexsecurity);
+		return ismember;
+}
+
+int ismember_hostlist(char *str) {
+		int ismember;
+		pthread_mutex_lock(&mutexsecurity);
+		ismember = update_sets() && ismember_set(ALLOWHOST, REFUSEHOST, str);
+		pthread_mutex_unlock(&mutexsecurity);
+		return ismember;
+}
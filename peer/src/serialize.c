@@ -0,0 +1,519 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/
+ *
+ */
+
+/*
+ * Serialization of the job arguments and options into a uint8 array, to
+ * replace the undocumented mxSerialize and mxDeserialize functions.
+ *
+ * The size of the serialized array is computed first, after which the
+ * numeric payloads are copied once from mxGetData into their final place,
+ * large ones with multiple threads. Every item starts with
+ *   UINT32 type, UINT32 flags, UINT64 ndim, UINT64 dims[ndim]
+ * followed by the real and imaginary data for numeric, logical and char arrays,
+ * nnz, jc, ir and the data for sparse arrays, the elements for cell arrays, and
+ * the field names and the elements for struct arrays. Everything is aligned
+ * at 8 bytes and in the byte order of the computer, like the rest of the
+ * messages. Function handles and objects use mxSerialize for that item.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "mex.h"
+#include "matrix.h"
+#include "peer.h"
+#include "extern.h"
+#include "serialize.h"
+
+mxArray *mxSerialize(const mxArray*);
+mxArray *mxDeserialize(const void*, size_t);
+
+typedef struct {
+		char       *ptr;     /* where the next item is written */
+		mxArray   **blob;    /* the items that were serialized with mxSerialize */
+		int         numblob;
+		int         nextblob;
+} writer_t;
+
+typedef struct {
+		const char *ptr;     /* from where the next item is read */
+		size_t      left;
+} reader_t;
+
+typedef struct {
+		char       *dst;
+		const char *src;
+		size_t      size;
+} copyjob_t;
+
+static void *copy_thread(void *arg) {
+		copyjob_t *job = (copyjob_t *)arg;
+		memcpy(job->dst, job->src, job->size);
+		return NULL;
+}
+
+/* a single thread does not keep up with the memory bandwidth for large arrays */
+static void copy_data(void *dst, const void *src, size_t size) {
+		pthread_t thread[SERIALIZE_THREADS];
+		copyjob_t job[SERIALIZE_THREADS];
+		int i, started[SERIALIZE_THREADS];
+		size_t part;
+
+		if (size<SERIALIZE_PARALLEL) {
+				memcpy(dst, src, size);
+				return;
+		}
+
+		part = PADDED(size/SERIALIZE_THREADS);
+		for (i=0; i<SERIALIZE_THREADS; i++) {
+				job[i].dst  = (char *)dst + i*part;
+				job[i].src  = (const char *)src + i*part;
+				job[i].size = (i<SERIALIZE_THREADS-1 ? part : size - i*part);
+				/* the last part is copied by this thread */
+				started[i] = (i<SERIALIZE_THREADS-1) && (pthread_create(&thread[i], NULL, copy_thread, &job[i])==0);
+				if (!started[i])
+						copy_thread(&job[i]);
+		}
+		for (i=0; i<SERIALIZE_THREADS; i++)
+				if (started[i])
+						pthread_join(thread[i], NULL);
+}
+
+static int array_type(const mxArray *array) {
+		if (array==NULL)
+				return TYPE_NULL;
+		switch (mxGetClassID(array)) {
+				case mxDOUBLE_CLASS:  return TYPE_DOUBLE;
+				case mxSINGLE_CLASS:  return TYPE_SINGLE;
+				case mxINT8_CLASS:    return TYPE_INT8;
+				case mxUINT8_CLASS:   return TYPE_UINT8;
+				case mxINT16_CLASS:   return TYPE_INT16;
+				case mxUINT16_CLASS:  return TYPE_UINT16;
+				case mxINT32_CLASS:   return TYPE_INT32;
+				case mxUINT32_CLASS:  return TYPE_UINT32;
+				case mxINT64_CLASS:   return TYPE_INT64;
+				case mxUINT64_CLASS:  return TYPE_UINT64;
+				case mxLOGICAL_CLASS: return TYPE_LOGICAL;
+				case mxCHAR_CLASS:    return TYPE_CHAR;
+				case mxCELL_CLASS:    return TYPE_CELL;
+				case mxSTRUCT_CLASS:  return TYPE_STRUCT;
+				default:              return TYPE_MATLAB;
+		}
+}
+
+static mxClassID type_class(int type) {
+		switch (type) {
+				case TYPE_DOUBLE:     return mxDOUBLE_CLASS;
+				case TYPE_SINGLE:     return mxSINGLE_CLASS;
+				case TYPE_INT8:       return mxINT8_CLASS;
+				case TYPE_UINT8:      return mxUINT8_CLASS;
+				case TYPE_INT16:      return mxINT16_CLASS;
+				case TYPE_UINT16:     return mxUINT16_CLASS;
+				case TYPE_INT32:      return mxINT32_CLASS;
+				case TYPE_UINT32:     return mxUINT32_CLASS;
+				case TYPE_INT64:      return mxINT64_CLASS;
+				case TYPE_UINT64:     return mxUINT64_CLASS;
+				default:              return mxUNKNOWN_CLASS;
+		}
+}
+
+/* compute the number of bytes for the item, this returns 0 on errors */
+static size_t item_size(const mxArray *array, writer_t *w) {
+		size_t size, numel, elsize, nnz, i, f, n, numfield;
+		int type = array_type(array);
+
+		if (type==TYPE_NULL)
+				return 16;
+
+		numel  = mxGetNumberOfElements(array);
+		size   = 16 + 8*mxGetNumberOfDimensions(array);
+
+		switch (type) {
+				case TYPE_MATLAB:
+						w->blob = (mxArray **)realloc(w->blob, (w->numblob+1)*sizeof(mxArray *));
+						if (w->blob==NULL || (w->blob[w->numblob] = mxSerialize(array))==NULL)
+								return 0;
+						size += 8 + PADDED(mxGetNumberOfElements(w->blob[w->numblob++]));
+						break;
+
+				case TYPE_CELL:
+						for (i=0; i<numel; i++) {
+								if ((n = item_size(mxGetCell(array, i), w))==0)
+										return 0;
+								size += n;
+						}
+						break;
+
+				case TYPE_STRUCT:
+						numfield = mxGetNumberOfFields(array);
+						size += 8;
+						for (f=0; f<numfield; f++)
+								size += 8 + PADDED(strlen(mxGetFieldNameByNumber(array, f)));
+						for (i=0; i<numel; i++)
+								for (f=0; f<numfield; f++) {
+										if ((n = item_size(mxGetFieldByNumber(array, i, f), w))==0)
+												return 0;
+										size += n;
+								}
+						break;
+
+				default:
+						elsize = mxGetElementSize(array);
+						if (mxIsSparse(array)) {
+								nnz   = mxGetJc(array)[mxGetN(array)];
+								size += 8 + 8*(mxGetN(array)+1) + 8*nnz;
+								numel = nnz;
+						}
+						size += PADDED(numel*elsize);
+						if (mxIsComplex(array))
+								size += PADDED(numel*elsize);
+						break;
+		}
+		return size;
+}
+
+static void put_uint32(writer_t *w, UINT32_T value) {
+		memcpy(w->ptr, &value, 4);
+		w->ptr += 4;
+}
+
+static void put_uint64(writer_t *w, UINT64_T value) {
+		memcpy(w->ptr, &value, 8);
+		w->ptr += 8;
+}
+
+static void put_data(writer_t *w, const void *data, size_t size) {
+		if (size>0)
+				copy_data(w->ptr, data, size);
+		w->ptr += PADDED(size);
+}
+
+static void write_item(const mxArray *array, writer_t *w) {
+		size_t numel, elsize, nnz, i, f, numfield, ndim;
+		const mwSize *dims;
+		const char *name;
+		mwIndex *jc, *ir;
+		mxArray *blob;
+		int type = array_type(array);
+		int flags = 0;
+
+		if (type==TYPE_NULL) {
+				put_uint32(w, TYPE_NULL);
+				put_uint32(w, 0);
+				put_uint64(w, 0);
+				return;
+		}
+
+		if (mxIsComplex(array))
+				flags |= FLAG_COMPLEX;
+		if (mxIsSparse(array))
+				flags |= FLAG_SPARSE;
+
+		ndim  = mxGetNumberOfDimensions(array);
+		dims  = mxGetDimensions(array);
+		numel = mxGetNumberOfElements(array);
+		put_uint32(w, type);
+		put_uint32(w, flags);
+		put_uint64(w, ndim);
+		for (i=0; i<ndim; i++)
+				put_uint64(w, dims[i]);
+
+		switch (type) {
+				case TYPE_MATLAB:
+						blob = w->blob[w->nextblob++];
+						put_uint64(w, mxGetNumberOfElements(blob));
+						put_data(w, mxGetData(blob), mxGetNumberOfElements(blob));
+						break;
+
+				case TYPE_CELL:
+						for (i=0; i<numel; i++)
+								write_item(mxGetCell(array, i), w);
+						break;
+
+				case TYPE_STRUCT:
+						numfield = mxGetNumberOfFields(array);
+						put_uint64(w, numfield);
+						for (f=0; f<numfield; f++) {
+								name = mxGetFieldNameByNumber(array, f);
+								put_uint64(w, strlen(name));
+								put_data(w, name, strlen(name));
+						}
+						for (i=0; i<numel; i++)
+								for (f=0; f<numfield; f++)
+										write_item(mxGetFieldByNumber(array, i, f), w);
+						break;
+
+				default:
+						elsize = mxGetElementSize(array);
+						if (flags & FLAG_SPARSE) {
+								jc  = mxGetJc(array);
+								ir  = mxGetIr(array);
+								nnz = jc[mxGetN(array)];
+								put_uint64(w, nnz);
+								for (i=0; i<=mxGetN(array); i++)
+										put_uint64(w, jc[i]);
+								for (i=0; i<nnz; i++)
+										put_uint64(w, ir[i]);
+								numel = nnz;
+						}
+						put_data(w, mxGetData(array), numel*elsize);
+						if (flags & FLAG_COMPLEX)
+								put_data(w, mxGetImagData(array), numel*elsize);
+						break;
+		}
+}
+
+/* this serializes into a uint8 array, or into memory from malloc if result is NULL */
+static void *serialize(const mxArray *array, mxArray **result, size_t *numbytes) {
+		void *buf = NULL;
+		size_t size;
+		writer_t w;
+		int i;
+
+		w.ptr      = NULL;
+		w.blob     = NULL;
+		w.numblob  = 0;
+		w.nextblob = 0;
+
+		if ((size = item_size(array, &w))>0) {
+				size += 8;
+				if (result) {
+						if ((*result = mxCreateNumericMatrix(1, size, mxUINT8_CLASS, mxREAL))!=NULL)
+								buf = mxGetData(*result);
+				}
+				else
+						buf = malloc(size);
+				if (buf) {
+						w.ptr = (char *)buf;
+						memcpy(w.ptr, SERIALIZE_MAGIC, 8);
+						w.ptr += 8;
+						write_item(array, &w);
+						*numbytes = size;
+				}
+		}
+
+		for (i=0; i<w.numblob; i++)
+				mxDestroyArray(w.blob[i]);
+		FREE(w.blob);
+		return buf;
+}
+
+mxArray *peer_serialize(const mxArray *array) {
+		mxArray *result = NULL;
+		size_t size;
+		serialize(array, &result, &size);
+		return result;
+}
+
+void *peer_serialize_malloc(const mxArray *array, size_t *size) {
+		return serialize(array, NULL, size);
+}
+
+static const void *get_data(reader_t *r, size_t size) {
+		const void *ptr = r->ptr;
+		if (PADDED(size)>r->left)
+				return NULL;
+		r->ptr  += PADDED(size);
+		r->left -= PADDED(size);
+		return ptr;
+}
+
+/* the 32 bit values come in pairs, hence these keep the alignment */
+static int get_uint32(reader_t *r, UINT32_T *value) {
+		if (r->left<4)
+				return -1;
+		memcpy(value, r->ptr, 4);
+		r->ptr  += 4;
+		r->left -= 4;
+		return 0;
+}
+
+static int get_uint64(reader_t *r, UINT64_T *value) {
+		if (r->left<8)
+				return -1;
+		memcpy(value, r->ptr, 8);
+		r->ptr  += 8;
+		r->left -= 8;
+		return 0;
+}
+
+/* this returns the array, or NULL with *error set */
+static mxArray *read_item(reader_t *r, int *error) {
+		UINT32_T type, flags;
+		UINT64_T ndim, value, nnz, numfield, i, f;
+		mwSize dims[32];
+		mwIndex *jc, *ir;
+		char **names = NULL;
+		const void *data;
+		mxArray *array = NULL, *item;
+		size_t numel, elsize;
+
+		if (get_uint32(r, &type) || get_uint32(r, &flags) || get_uint64(r, &ndim) || ndim>32) {
+				*error = 1;
+				return NULL;
+		}
+		if (type==TYPE_NULL)
+				return NULL;
+
+		numel = 1;
+		for (i=0; i<ndim; i++) {
+				if (get_uint64(r, &value)) {
+						*error = 1;
+						return NULL;
+				}
+				dims[i] = (mwSize)value;
+				numel  *= value;
+		}
+
+		switch (type) {
+				case TYPE_MATLAB:
+						if (get_uint64(r, &value) || (data = get_data(r, value))==NULL || (array = mxDeserialize(data, value))==NULL)
+								*error = 1;
+						break;
+
+				case TYPE_CELL:
+						if ((array = mxCreateCellArray(ndim, dims))==NULL)
+								*error = 1;
+						for (i=0; i<numel && !*error; i++)
+								if ((item = read_item(r, error))!=NULL)
+										mxSetCell(array, i, item);
+						break;
+
+				case TYPE_STRUCT:
+						if (get_uint64(r, &numfield) || (names = (char **)calloc(numfield+1, sizeof(char *)))==NULL) {
+								*error = 1;
+								break;
+						}
+						for (f=0; f<numfield && !*error; f++) {
+								if (get_uint64(r, &value) || value>=MAXPATHSIZE || (data = get_data(r, value))==NULL || (names[f] = (char *)calloc(value+1, 1))==NULL)
+										*error = 1;
+								else
+										memcpy(names[f], data, value);
+						}
+						if (!*error) {
+								if ((array = mxCreateStructArray(ndim, dims, numfield, (const char **)names))==NULL)
+										*error = 1;
+								for (i=0; i<numel && !*error; i++)
+										for (f=0; f<numfield && !*error; f++)
+												if ((item = read_item(r, error))!=NULL)
+														mxSetFieldByNumber(array, i, f, item);
+						}
+						for (f=0; f<numfield; f++)
+								FREE(names[f]);
+						FREE(names);
+						break;
+
+				case TYPE_LOGICAL:
+				case TYPE_CHAR:
+				case TYPE_DOUBLE:
+				case TYPE_SINGLE:
+				case TYPE_INT8:
+				case TYPE_UINT8:
+				case TYPE_INT16:
+				case TYPE_UINT16:
+				case TYPE_INT32:
+				case TYPE_UINT32:
+				case TYPE_INT64:
+				case TYPE_UINT64:
+						if (flags & FLAG_SPARSE) {
+								if (ndim!=2 || get_uint64(r, &nnz) || (type!=TYPE_DOUBLE && type!=TYPE_LOGICAL)) {
+										*error = 1;
+										break;
+								}
+								if (type==TYPE_LOGICAL)
+										array = mxCreateSparseLogicalMatrix(dims[0], dims[1], (nnz>0 ? nnz : 1));
+								else
+										array = mxCreateSparse(dims[0], dims[1], (nnz>0 ? nnz : 1), (flags & FLAG_COMPLEX ? mxCOMPLEX : mxREAL));
+								if (array==NULL) {
+										*error = 1;
+										break;
+								}
+								jc = mxGetJc(array);
+								ir = mxGetIr(array);
+								for (i=0; i<=dims[1] && !*error; i++) {
+										*error = get_uint64(r, &value);
+										jc[i] = (mwIndex)value;
+								}
+								for (i=0; i<nnz && !*error; i++) {
+										*error = get_uint64(r, &value);
+										ir[i] = (mwIndex)value;
+								}
+								numel = nnz;
+						}
+						else if (type==TYPE_LOGICAL)
+								array = mxCreateLogicalArray(ndim, dims);
+						else if (type==TYPE_CHAR)
+								array = mxCreateCharArray(ndim, dims);
+						else
+								array = mxCreateNumericArray(ndim, dims, type_class(type), (flags & FLAG_COMPLEX ? mxCOMPLEX : mxREAL));
+
+						if (*error || array==NULL) {
+								*error = 1;
+								break;
+						}
+						elsize = mxGetElementSize(array);
+						if ((data = get_data(r, numel*elsize))==NULL) {
+								*error = 1;
+								break;
+						}
+						if (numel>0)
+								copy_data(mxGetData(array), data, numel*elsize);
+						if (flags & FLAG_COMPLEX) {
+								if ((data = get_data(r, numel*elsize))==NULL) {
+										*error = 1;
+										break;
+								}
+								if (numel>0)
+										copy_data(mxGetImagData(array), data, numel*elsize);
+						}
+						break;
+
+				default:
+						*error = 1;
+						break;
+		}
+
+		if (*error && array) {
+				mxDestroyArray(array);
+				array = NULL;
+		}
+		return array;
+}
+
+mxArray *peer_deserialize(const void *buf, size_t size) {
+		reader_t r;
+		mxArray *array;
+		int error = 0;
+
+		/* the arguments of older versions are serialized by MATLAB */
+		if (size<8 || memcmp(buf, SERIALIZE_MAGIC, 8)!=0)
+				return mxDeserialize(buf, size);
+
+		r.ptr  = (const char *)buf + 8;
+		r.left = size - 8;
+		array = read_item(&r, &error);
+		if (error) {
+				DEBUG(LOG_ERR, "peer_deserialize: invalid or truncated array");
+				return NULL;
+		}
+		/* an empty cell or struct element is serialized as NULL, the top-level array should not be */
+		if (array==NULL)
+				array = mxCreateDoubleMatrix(0, 0, mxREAL);
+		return array;
+}
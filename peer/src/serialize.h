@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/
+ *
+ */
+
+#ifndef SERIALIZE_H
+#define SERIALIZE_H
+
+#include "matrix.h"
+
+#define SERIALIZE_PARALLEL       33554432	/* int, in bytes, larger payloads are copied with multiple threads */
+#define SERIALIZE_THREADS        4
+
+/* these have the same interface as the undocumented mxSerialize and mxDeserialize
+ * functions, which are still used for the objects and function handles that are
+ * part of the array */
+mxArray *peer_serialize  (const mxArray *array);
+mxArray *peer_deserialize(const void *buf, size_t size);
+
+/* the same as peer_serialize, but into memory from malloc that can be passed on to another thread */
+void *peer_serialize_malloc(const mxArray *array, size_t *size);
+
+#endif
@@ -0,0 +1,288 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/
+ *
+ */
+
+/*
+ * The tcpserver and udsserver threads wait in poll for incoming connections
+ * and hand them over to a fixed number of worker threads, which read the
+ * messages with tcpsocket. After a complete message the connection is not
+ * closed, but returned to the server, which waits for the next message on it.
+ * The peers on the other side keep these connections for the next job or the
+ * next results, see reuse_peer_connection. Idle connections are closed after
+ * KEEPALIVETIME seconds.
+ */
+
+#ifndef WIN32
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#include "peer.h"
+#include "extern.h"
+#include "platform_includes.h"
+
+typedef struct {
+		int fd;									/* the listening socket */
+		int wakeup[2];							/* the workers write to this pipe to wake up the server */
+		pthread_mutex_t mutex;
+		pthread_cond_t cond;
+		connection_t queue[SERVER_QUEUE];		/* accepted connections waiting for a worker */
+		int head, count;
+		int returned[SERVER_QUEUE];				/* connections that are to be kept open */
+		int numreturned;
+		struct pollfd pfd[2+KEEPALIVE_MAX];		/* the listening socket, the pipe and the kept connections */
+		double idle[2+KEEPALIVE_MAX];			/* when the kept connection was last used */
+		int numkeep;
+		pthread_t worker[SERVER_WORKERS];
+		int numworker;
+} serverpool_t;
+
+static void unlock_serverpool(void *arg) {
+		pthread_mutex_unlock((pthread_mutex_t *)arg);
+}
+
+static void cleanup_serverworker(void *arg) {
+		pthread_mutex_lock(&mutexthreadcount);
+		threadcount--;
+		pthread_mutex_unlock(&mutexthreadcount);
+}
+
+static void *serverworker(void *arg) {
+		serverpool_t *pool = (serverpool_t *)arg;
+		connection_t conn;
+		char c = 0;
+
+		pthread_cleanup_push(cleanup_serverworker, NULL);
+
+		/* this is for debugging */
+		pthread_mutex_lock(&mutexthreadcount);
+		threadcount++;
+		pthread_mutex_unlock(&mutexthreadcount);
+
+		while (1) {
+				pthread_mutex_lock(&pool->mutex);
+				pthread_cleanup_push(unlock_serverpool, &pool->mutex);
+				/* note that this is a thread cancelation point */
+				while (pool->count==0)
+						pthread_cond_wait(&pool->cond, &pool->mutex);
+				conn = pool->queue[pool->head];
+				pool->head = (pool->head+1) % SERVER_QUEUE;
+				pool->count--;
+				pthread_cleanup_pop(1);
+
+				/* there is room in the queue again */
+				if (write(pool->wakeup[1], &c, 1)) {};
+
+				conn.keep = 0;
+				tcpsocket(&conn);
+
+				if (conn.keep) {
+						pthread_mutex_lock(&pool->mutex);
+						if (pool->numreturned<SERVER_QUEUE)
+								pool->returned[pool->numreturned++] = conn.fd;
+						else
+								closesocket(conn.fd);
+						pthread_mutex_unlock(&pool->mutex);
+						if (write(pool->wakeup[1], &c, 1)) {};
+				}
+		}
+
+		pthread_cleanup_pop(1);
+		return NULL;
+}
+
+static void cleanup_serverloop(void *arg) {
+		serverpool_t *pool = (serverpool_t *)arg;
+		int i;
+
+		DEBUG(LOG_DEBUG, "cleanup_serverloop()");
+
+		for (i=0; i<pool->numworker; i++)
+				pthread_cancel(pool->worker[i]);
+		for (i=0; i<pool->numworker; i++)
+				pthread_join(pool->worker[i], NULL);
+
+		for (i=0; i<pool->count; i++)
+				closesocket(pool->queue[(pool->head+i) % SERVER_QUEUE].fd);
+		for (i=0; i<pool->numreturned; i++)
+				closesocket(pool->returned[i]);
+		for (i=2; i<2+pool->numkeep; i++)
+				closesocket(pool->pfd[i].fd);
+
+		if (pool->wakeup[0]>0)
+				close(pool->wakeup[0]);
+		if (pool->wakeup[1]>0)
+				close(pool->wakeup[1]);
+		pthread_mutex_destroy(&pool->mutex);
+		pthread_cond_destroy(&pool->cond);
+		FREE(pool);
+}
+
+/* add a connection to the queue for the workers, this returns 0 if the queue is full */
+static int serverloop_dispatch(serverpool_t *pool, int fd, int reused) {
+		int success = 0;
+		pthread_mutex_lock(&pool->mutex);
+		if (pool->count<SERVER_QUEUE) {
+				pool->queue[(pool->head+pool->count) % SERVER_QUEUE].fd     = fd;
+				pool->queue[(pool->head+pool->count) % SERVER_QUEUE].reused = reused;
+				pool->count++;
+				pthread_cond_signal(&pool->cond);
+				success = 1;
+		}
+		pthread_mutex_unlock(&pool->mutex);
+		return success;
+}
+
+/* this serves the connections on the listening socket until the thread is cancelled */
+void serverloop(int fd, const char *name) {
+		serverpool_t *pool;
+		int c, i, rc, full, optval;
+		char buf[64];
+		double now;
+
+		if ((pool = (serverpool_t *)calloc(1, sizeof(serverpool_t)))==NULL) {
+				DEBUG(LOG_ERR, "%s: could not allocate memory", name);
+				return;
+		}
+		pool->fd = fd;
+		pthread_mutex_init(&pool->mutex, NULL);
+		pthread_cond_init(&pool->cond, NULL);
+
+		pthread_cleanup_push(cleanup_serverloop, pool);
+
+		if (pipe(pool->wakeup)!=0) {
+				perror("serverloop pipe");
+				DEBUG(LOG_ERR, "error: %s pipe", name);
+				goto cleanup;
+		}
+		fcntl(pool->wakeup[0], F_SETFL, fcntl(pool->wakeup[0], F_GETFL, NULL) | O_NONBLOCK);
+		fcntl(pool->wakeup[1], F_SETFL, fcntl(pool->wakeup[1], F_GETFL, NULL) | O_NONBLOCK);
+
+		/* the listening socket should not block when another thread or process accepted the connection first */
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, NULL) | O_NONBLOCK);
+
+		for (i=0; i<SERVER_WORKERS; i++) {
+				if ((rc = pthread_create(&pool->worker[i], NULL, serverworker, (void *)pool))!=0) {
+						DEBUG(LOG_ERR, "%s: return code from pthread_create() is %d", name, rc);
+						break;
+				}
+				pool->numworker++;
+		}
+		if (pool->numworker==0)
+				goto cleanup;
+
+		for (;;) {
+				pthread_mutex_lock(&pool->mutex);
+				full = (pool->count>=SERVER_QUEUE);
+				pthread_mutex_unlock(&pool->mutex);
+
+				/* new connections remain in the backlog of the socket while all workers are busy */
+				pool->pfd[0].fd      = fd;
+				pool->pfd[0].events  = (full ? 0 : POLLIN);
+				pool->pfd[0].revents = 0;
+				pool->pfd[1].fd      = pool->wakeup[0];
+				pool->pfd[1].events  = POLLIN;
+				pool->pfd[1].revents = 0;
+				for (i=2; i<2+pool->numkeep; i++) {
+						pool->pfd[i].events  = (full ? 0 : POLLIN);
+						pool->pfd[i].revents = 0;
+				}
+
+				/* note that this is a thread cancelation point */
+				rc = poll(pool->pfd, 2+pool->numkeep, 1000);
+				if (rc<0 && errno!=EINTR) {
+						perror("serverloop poll");
+						DEBUG(LOG_ERR, "error: %s poll", name);
+						goto cleanup;
+				}
+				now = walltime();
+
+				/* a message arrives over one of the kept connections, or the peer closed it */
+				for (i=2+pool->numkeep-1; i>=2; i--) {
+						if (pool->pfd[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+								closesocket(pool->pfd[i].fd);
+						}
+						else if (pool->pfd[i].revents & POLLIN) {
+								if (!serverloop_dispatch(pool, pool->pfd[i].fd, 1))
+										continue;
+						}
+						else if (now - pool->idle[i] > KEEPALIVETIME) {
+								closesocket(pool->pfd[i].fd);
+						}
+						else {
+								continue;
+						}
+						/* remove it from the set */
+						pool->numkeep--;
+						pool->pfd[i]  = pool->pfd[2+pool->numkeep];
+						pool->idle[i] = pool->idle[2+pool->numkeep];
+				}
+
+				if (pool->pfd[1].revents & POLLIN) {
+						while (read(pool->wakeup[0], buf, sizeof(buf))>0);
+						/* the workers are done with these connections, the next message may follow */
+						pthread_mutex_lock(&pool->mutex);
+						for (i=0; i<pool->numreturned; i++) {
+								if (pool->numkeep<KEEPALIVE_MAX) {
+										pool->pfd[2+pool->numkeep].fd = pool->returned[i];
+										pool->idle[2+pool->numkeep]   = now;
+										pool->numkeep++;
+								}
+								else {
+										closesocket(pool->returned[i]);
+								}
+						}
+						pool->numreturned = 0;
+						pthread_mutex_unlock(&pool->mutex);
+				}
+
+				if (pool->pfd[0].revents & POLLIN) {
+						/* accept all pending connections for which there is room in the queue */
+						while (1) {
+								pthread_mutex_lock(&pool->mutex);
+								full = (pool->count>=SERVER_QUEUE);
+								pthread_mutex_unlock(&pool->mutex);
+								if (full)
+										break;
+								if ((c = accept(fd, NULL, NULL))<0) {
+										if (errno!=EWOULDBLOCK && errno!=EAGAIN && errno!=EINTR && errno!=ECONNABORTED) {
+												perror("serverloop accept");
+												DEBUG(LOG_ERR, "error: %s accept", name);
+												goto cleanup;
+										}
+										break;
+								}
+								DEBUG(LOG_DEBUG, "%s: opened connection to client on socket %d", name, c);
+								/* place the socket in blocking mode, this is needed for tcpsocket */
+								optval = fcntl(c, F_GETFL, NULL);
+								fcntl(c, F_SETFL, optval & ~O_NONBLOCK);
+								serverloop_dispatch(pool, c, 0);
+						}
+				}
+		}
+
+cleanup:
+		printf(""); /* otherwise the pthread_cleanup_pop won't compile */
+		pthread_cleanup_pop(1);
+		return;
+}
+
+#endif
@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/
+ *
+ */
+
+/*
+ * When the master and the slave are on the same computer, they are connected
+ * through the unix domain socket. For large arguments the receiving side then
+ * replies with HANDSHAKE_SHM after the jobdef, and the sending side copies the
+ * arguments into an anonymous shared memory segment. Instead of the arguments,
+ * only the file descriptor of that segment is sent over the socket. The
+ * segment is sealed before it is sent, so that the receiving side does not
+ * have to trust the sending side not to shrink it while it is being copied.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE		/* for the memfd seals */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "peer.h"
+#include "extern.h"
+#include "platform_includes.h"
+
+#if defined (PLATFORM_LINUX)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+/* these are from linux/memfd.h and linux/fcntl.h, which are not always available */
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC       0x0001U
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS       1033
+#define F_GET_SEALS       1034
+#define F_SEAL_SHRINK     0x0002
+#define F_SEAL_GROW       0x0004
+#define F_SEAL_WRITE      0x0008
+#endif
+
+#if defined (SYS_memfd_create)
+#define SHM_AVAILABLE 1
+#endif
+#endif
+
+/* this returns 1 if the arguments can be passed through shared memory over this connection */
+int shm_supported(int s) {
+#if defined (SHM_AVAILABLE)
+		struct sockaddr_storage addr;
+		socklen_t len = sizeof(addr);
+
+		if (getsockname(s, (struct sockaddr *)&addr, &len)!=0)
+				return 0;
+		return (addr.ss_family==AF_UNIX);
+#else
+		return 0;
+#endif
+}
+
+/* copy the buffer, or numel bytes from the file, into a shared memory segment and send its descriptor */
+int bufwrite_shm(int s, const void *buf, FILE *fp, int numel) {
+#if defined (SHM_AVAILABLE)
+		int fd, n, total = 0;
+		UINT32_T size = numel;
+		char *ptr = MAP_FAILED;
+		char control[CMSG_SPACE(sizeof(int))];
+		struct iovec iov;
+		struct msghdr msg;
+		struct cmsghdr *cmsg;
+
+		if ((fd = syscall(SYS_memfd_create, "peer", MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0) {
+				DEBUG(LOG_ERR, "bufwrite_shm: could not create shared memory");
+				return -1;
+		}
+		if (ftruncate(fd, numel)!=0 || (ptr = mmap(NULL, numel, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0))==MAP_FAILED) {
+				DEBUG(LOG_ERR, "bufwrite_shm: could not map %d bytes of shared memory", numel);
+				goto cleanup;
+		}
+
+		if (buf) {
+				memcpy(ptr, buf, numel);
+				total = numel;
+		}
+		else {
+				while (total<numel && (n = fread(ptr+total, 1, numel-total, fp))>0)
+						total += n;
+		}
+		munmap(ptr, numel);
+		if (total!=numel)
+				goto cleanup;
+
+		/* the segment cannot be changed any more after it has been sent */
+		if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE)!=0) {
+				DEBUG(LOG_ERR, "bufwrite_shm: could not seal the shared memory");
+				total = 0;
+				goto cleanup;
+		}
+
+		/* the size is sent along with the descriptor */
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base       = &size;
+		iov.iov_len        = sizeof(UINT32_T);
+		msg.msg_iov        = &iov;
+		msg.msg_iovlen     = 1;
+		msg.msg_control    = control;
+		msg.msg_controllen = sizeof(control);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level   = SOL_SOCKET;
+		cmsg->cmsg_type    = SCM_RIGHTS;
+		cmsg->cmsg_len     = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+		if (sendmsg(s, &msg, 0)!=sizeof(UINT32_T)) {
+				DEBUG(LOG_ERR, "bufwrite_shm: could not send the descriptor");
+				total = 0;
+		}
+
+cleanup:
+		/* the receiving side keeps the segment alive until it closes its own descriptor */
+		close(fd);
+		return total;
+#else
+		return -1;
+#endif
+}
+
+/* receive the descriptor of a shared memory segment and copy its content into the buffer */
+int bufread_shm(int s, void *buf, int numel) {
+#if defined (SHM_AVAILABLE)
+		int fd = -1, seals, total = 0;
+		UINT32_T size = 0;
+		char *ptr;
+		char control[CMSG_SPACE(sizeof(int))];
+		struct iovec iov;
+		struct msghdr msg;
+		struct cmsghdr *cmsg;
+		struct stat sb;
+
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base       = &size;
+		iov.iov_len        = sizeof(UINT32_T);
+		msg.msg_iov        = &iov;
+		msg.msg_iovlen     = 1;
+		msg.msg_control    = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (recvmsg(s, &msg, MSG_WAITALL)!=sizeof(UINT32_T)) {
+				DEBUG(LOG_ERR, "bufread_shm: could not receive the descriptor");
+				return -1;
+		}
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+				if (cmsg->cmsg_level==SOL_SOCKET && cmsg->cmsg_type==SCM_RIGHTS)
+						memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+		if (fd<0) {
+				DEBUG(LOG_ERR, "bufread_shm: the message does not contain a descriptor");
+				return -1;
+		}
+
+		/* the segment should have the expected size and should not be able to shrink while it is being copied */
+		seals = fcntl(fd, F_GET_SEALS);
+		if (size!=numel || fstat(fd, &sb)!=0 || sb.st_size!=numel || seals<0 || !(seals & F_SEAL_SHRINK)) {
+				DEBUG(LOG_ERR, "bufread_shm: the shared memory does not match the job");
+				goto cleanup;
+		}
+
+		if ((ptr = mmap(NULL, numel, PROT_READ, MAP_SHARED, fd, 0))==MAP_FAILED) {
+				DEBUG(LOG_ERR, "bufread_shm: could not map %d bytes of shared memory", numel);
+				goto cleanup;
+		}
+		memcpy(buf, ptr, numel);
+		munmap(ptr, numel);
+		total = numel;
+
+cleanup:
+		close(fd);
+		return total;
+#else
+		return -1;
+#endif
+}
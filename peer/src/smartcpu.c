@@ -18,6 +18,8 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
 
 #include "peer.h"
 #include "extern.h"
@@ -89,7 +91,7 @@ int smartcpu_info(int *ProcessorCount, float *BogoMips, float *AvgLoad, float *C
 		fclose(fp);
 
 		/*
-		 * The columns represent: user nice system idle iowait irq softirq
+		 * The columns represent: user nice system idle iowait irq softirq steal
 		 *
 		 * cpu  9181729 7423661 2979069 893321421 705481 21805 268125 0
 		 * cpu0 2846118 1899136 677048 222954488 90347 0 8216 0
@@ -97,84 +99,90 @@ int smartcpu_info(int *ProcessorCount, float *BogoMips, float *AvgLoad, float *C
 		 * cpu2 2411028 1865444 647992 223263483 254241 8639 24482 0
 		 * cpu3 1802453 1842141 1076522 223212640 296899 13163 231485 0
 		 * ...
+		 *
+		 * The load average also counts the processes that wait for the disk
+		 * and the ones on the CPUs that this process is not allowed to use,
+		 * hence the load is computed from the per-CPU counters since the
+		 * previous call.
 		 */
 
+		unsigned char allowed[SMARTCPU_MAXCPU];
+		unsigned long long val[8];
+		int cpu, first, numallowed, numcpu = 0;
+		float busy = 0, cgroupbusy = 0, available, limit, delta;
+		UINT64_T idle, total, usage;
+		struct timeval tv;
+		double now;
+
+		/* the process can be restricted to some of the CPUs, e.g. with taskset or by SLURM */
+		if ((numallowed = cpu_affinity(allowed, SMARTCPU_MAXCPU)) < 0) {
+				memset(allowed, 1, SMARTCPU_MAXCPU);
+				numallowed = *ProcessorCount;
+		}
+
 		if ((fp = fopen("/proc/stat", "r")) == NULL) {
 				DEBUG(LOG_ERR, "smartcpu_info: could not open /proc/stat");
 				return -1;
 		}
 
-		int ok, numcpu = 0, elapsed;
-		int user, nice, system, idle, iowait, irq, softirq, unknown;
-		float load;
-		while (!feof(fp)) {
-				if (fscanf(fp, "%s ", str) != 1) {
+		gettimeofday(&tv, NULL);
+		now = tv.tv_sec + tv.tv_usec/1000000.0;
+
+		pthread_mutex_lock(&mutexprevcpu);
+		/* on the first measurement the previous values are missing */
+		first = (prevcpu.time==0);
+
+		while (fgets(str, 256, fp)) {
+				if (strncmp(str, "cpu", 3)!=0 || str[3]<'0' || str[3]>'9')
+						continue;
+				if (sscanf(str+3, "%d %llu %llu %llu %llu %llu %llu %llu %llu", &cpu, &val[0], &val[1], &val[2], &val[3], &val[4], &val[5], &val[6], &val[7]) != 9) {
 						DEBUG(LOG_ERR, "smartcpu_info: problem reading from /proc/stat");
 						continue;
 				}
+				numcpu++;
+				if (cpu<0 || cpu>=SMARTCPU_MAXCPU || !allowed[cpu])
+						continue;
 
-				if (strcmp(str, "cpu")==0) {
-						ok = 1;
-						ok = ok && (fscanf(fp, "%d", &user    ) == 1);
-						ok = ok && (fscanf(fp, "%d", &nice    ) == 1);
-						ok = ok && (fscanf(fp, "%d", &system  ) == 1);
-						ok = ok && (fscanf(fp, "%d", &idle    ) == 1);
-						ok = ok && (fscanf(fp, "%d", &iowait  ) == 1);
-						ok = ok && (fscanf(fp, "%d", &irq     ) == 1);
-						ok = ok && (fscanf(fp, "%d", &softirq ) == 1);
-						ok = ok && (fscanf(fp, "%d", &unknown ) == 1);
-						if (!ok) {
-								DEBUG(LOG_ERR, "smartcpu_info: problem reading from /proc/stat");
-								return -1;
-						}
-
-						pthread_mutex_lock(&mutexprevcpu);
-						/* compute the current sum, the previous sum, and the difference */
-						elapsed  = user+nice+system+idle+iowait+irq+softirq+unknown;
-						elapsed -= prevcpu.user+prevcpu.nice+prevcpu.system+prevcpu.idle+prevcpu.iowait+prevcpu.irq+prevcpu.softirq+prevcpu.unknown;
-
-						if (prevcpu.user==0)
-								/* this is the first measurement, the previous values are missing */
-								load = 0;
-						else
-								/* the load is the relative fraction of idle time */
-								load = 1.0 -((float)(idle - prevcpu.idle))/((float)elapsed);
-
-						/* update the values that will be used the next time */
-						prevcpu.user    = user   ;
-						prevcpu.nice    = nice   ;
-						prevcpu.system  = system ;
-						prevcpu.idle    = idle   ;
-						prevcpu.iowait  = iowait ;
-						prevcpu.irq     = irq    ;
-						prevcpu.softirq = softirq;
-						prevcpu.unknown = unknown;
-						pthread_mutex_unlock(&mutexprevcpu);
-
-				}
-				else if (strncmp(str, "cpu", 3)==0) {
-						numcpu++;
-						ok = 1;
-						ok = ok && (fscanf(fp, "%d", &user    ) == 1);
-						ok = ok && (fscanf(fp, "%d", &nice    ) == 1);
-						ok = ok && (fscanf(fp, "%d", &system  ) == 1);
-						ok = ok && (fscanf(fp, "%d", &idle    ) == 1);
-						ok = ok && (fscanf(fp, "%d", &iowait  ) == 1);
-						ok = ok && (fscanf(fp, "%d", &irq     ) == 1);
-						ok = ok && (fscanf(fp, "%d", &softirq ) == 1);
-						ok = ok && (fscanf(fp, "%d", &unknown ) == 1);
-						if (!ok) {
-								DEBUG(LOG_ERR, "smartcpu_info: problem reading from /proc/stat");
-								return -1;
-						}
+				idle  = val[3]+val[4];
+				total = val[0]+val[1]+val[2]+val[3]+val[4]+val[5]+val[6]+val[7];
+				if (!first && prevcpu.total[cpu]>0 && total>prevcpu.total[cpu] && idle>=prevcpu.idle[cpu]) {
+						/* the load is the relative fraction of non-idle time */
+						delta = 1.0 - ((float)(idle - prevcpu.idle[cpu]))/((float)(total - prevcpu.total[cpu]));
+						busy += (delta>0 ? delta : 0);
 				}
+				prevcpu.idle[cpu]  = idle;
+				prevcpu.total[cpu] = total;
 		} /* while */
 
-		*CpuLoad =  load*numcpu;
-		DEBUG(LOG_INFO, "smartcpu_info: load = %f %%, numcpu = %d", 100*load, numcpu);
-
 		fclose(fp);
 
+		if (*ProcessorCount > numallowed)
+				*ProcessorCount = numallowed;
+		available = numallowed - busy;
+
+		/* the CPU time that the container or SLURM job can use can be less than that of the allowed CPUs */
+		if (cgroup_cpulimit(&limit)==0) {
+				if (*ProcessorCount > (int)(limit+SMARTCPU_TOLERANCE))
+						*ProcessorCount = ((int)(limit+SMARTCPU_TOLERANCE) > 1 ? (int)(limit+SMARTCPU_TOLERANCE) : 1);
+				if (cgroup_cpuusage(&usage)==0) {
+						if (!first && usage>=prevcpu.usage && now>prevcpu.time)
+								cgroupbusy = (usage - prevcpu.usage)/(1000000.0*(now - prevcpu.time));
+						prevcpu.usage = usage;
+				}
+				if (limit - cgroupbusy < available)
+						available = limit - cgroupbusy;
+		}
+
+		prevcpu.time = now;
+		pthread_mutex_unlock(&mutexprevcpu);
+
+		/* the load is expressed relative to the number of processors, so that their difference is the available CPU */
+		*CpuLoad = *ProcessorCount - available;
+		if (*CpuLoad < 0)
+				*CpuLoad = 0;
+
+		DEBUG(LOG_INFO, "smartcpu_info: numcpu = %d, allowed = %d, processors = %d, available = %f", numcpu, numallowed, *ProcessorCount, available);
+
 		return 0;
 #else
 		return -1;
@@ -261,7 +269,7 @@ int smartcpu_update(void) {
 				DEBUG(LOG_DEBUG, "smartcpu_update: NumPeers       = %d", NumPeers);
 				DEBUG(LOG_DEBUG, "smartcpu_update: BogoMips       = %.2f", BogoMips);
 				DEBUG(LOG_DEBUG, "smartcpu_update: AvgLoad        = %.2f", AvgLoad);
-				DEBUG(LOG_DEBUG, "smartcpu_update: CpuLoad        = %.2f %%", CpuLoad*100);
+				DEBUG(LOG_DEBUG, "smartcpu_update: CpuLoad        = %.2f", CpuLoad);
 				DEBUG(LOG_DEBUG, "smartcpu_update: host->status   = %u", host->status);
 		} /* if evidence */
 
@@ -274,7 +282,7 @@ int smartcpu_update(void) {
 				DEBUG(LOG_DEBUG, "smartcpu_update: NumPeers       = %d", NumPeers);
 				DEBUG(LOG_DEBUG, "smartcpu_update: BogoMips       = %.2f", BogoMips);
 				DEBUG(LOG_DEBUG, "smartcpu_update: AvgLoad        = %.2f", AvgLoad);
-				DEBUG(LOG_DEBUG, "smartcpu_update: CpuLoad        = %.2f %%", CpuLoad*100);
+				DEBUG(LOG_DEBUG, "smartcpu_update: CpuLoad        = %.2f", CpuLoad);
 				DEBUG(LOG_DEBUG, "smartcpu_update: host->status   = %u", host->status);
 		} /* if evidence */
 
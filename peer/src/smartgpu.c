@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2010, Robert Oostenveld
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/
+ *
+ */
+
+/*
+ * The GPUs of the computer are probed with nvidia-smi and announced along
+ * with the memory and CPUs. A GPU that is already busy with other work would
+ * not run the job fast, hence only the GPUs that are used less than
+ * SMARTGPU_MAXLOAD percent count as available. A job that specifies gpureq
+ * or gpumemreq is only accepted by a slave with enough of them, see
+ * tcpsocket.c.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "peer.h"
+#include "extern.h"
+#include "platform_includes.h"
+
+/* return value 0 if ok, -1 if error or unsupported platform */
+int smartgpu_info(UINT64_T *GpuCount, UINT64_T *GpuMemFree, UINT64_T *GpuLoad) {
+		FILE *fp;
+		unsigned long long memfree;
+		unsigned int load, numgpu = 0;
+		UINT64_T sumload = 0;
+
+		*GpuCount   = 0;
+		*GpuMemFree = 0;
+		*GpuLoad    = 0;
+
+#if defined (PLATFORM_LINUX)
+
+		/* get the free memory in MiB and the utilization in percent of each GPU
+		 *
+		 * 11019, 0
+		 * 2048, 97
+		 */
+
+		if ((fp = popen(SMARTGPU_QUERY, "r")) == NULL) {
+				DEBUG(LOG_ERR, "smartgpu_info: could not run nvidia-smi");
+				return -1;
+		}
+
+		while (fscanf(fp, "%llu, %u", &memfree, &load) == 2) {
+				numgpu++;
+				sumload += load;
+				if (load<=SMARTGPU_MAXLOAD) {
+						(*GpuCount)++;
+						if (memfree*1024*1024 > *GpuMemFree)
+								*GpuMemFree = memfree*1024*1024;
+				}
+		} /* while */
+
+		if (pclose(fp)!=0 || numgpu==0)
+				return -1;
+
+		*GpuLoad = sumload/numgpu;
+		return 0;
+#else
+		return -1;
+#endif
+} /* smartgpu_info */
+
+/* return value 0 if ok, -1 if error or unsupported platform */
+int smartgpu_update(void) {
+		UINT64_T GpuCount=0, GpuMemFree=0, GpuLoad=0, GpuAvail;
+		time_t now = time(NULL);
+
+		pthread_mutex_lock(&mutexsmartgpu);
+		if (!smartgpu.enabled || now-smartgpu.probed<SMARTGPU_INTERVAL) {
+				pthread_mutex_unlock(&mutexsmartgpu);
+				return 0;
+		}
+		smartgpu.probed = now;
+		GpuAvail = smartgpu.gpuavail;
+		pthread_mutex_unlock(&mutexsmartgpu);
+
+		pthread_mutex_lock(&mutexhost);
+		if (host->status!=STATUS_IDLE) {
+				/* don't update if the status is something else than IDLE, the current job may be using the GPUs */
+				pthread_mutex_unlock(&mutexhost);
+				return 0;
+		}
+		pthread_mutex_unlock(&mutexhost);
+
+		/* running nvidia-smi takes some time, this is done without holding the locks */
+		if (smartgpu_info(&GpuCount, &GpuMemFree, &GpuLoad) < 0) {
+				/* don't try again on a computer without GPUs */
+				DEBUG(LOG_NOTICE, "smartgpu: no GPUs found, disabling smartgpu");
+				pthread_mutex_lock(&mutexsmartgpu);
+				smartgpu.enabled = 0;
+				pthread_mutex_unlock(&mutexsmartgpu);
+				return -1;
+		}
+
+		if (GpuCount>GpuAvail)
+				GpuCount = GpuAvail;
+
+		pthread_mutex_lock(&mutexhost);
+		if (host->status==STATUS_IDLE) {
+				host->gpuavail    = GpuCount;
+				host->gpumemavail = (GpuCount>0 ? GpuMemFree : 0);
+				host->gpuload     = GpuLoad;
+		}
+		DEBUG(LOG_INFO, "smartgpu: host->gpuavail = %llu, host->gpumemavail = %llu, host->gpuload = %llu", (unsigned long long) host->gpuavail, (unsigned long long) host->gpumemavail, (unsigned long long) host->gpuload);
+		pthread_mutex_unlock(&mutexhost);
+
+		return 0;
+} /* smartgpu_update */
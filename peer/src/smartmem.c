@@ -27,6 +27,9 @@
 int smartmem_info(UINT64_T *MemTotal, UINT64_T *MemFree, UINT64_T *Buffers, UINT64_T *Cached) {
 		void *fp;
 		char str[256];
+		unsigned long long MemAvailable = 0;
+		UINT64_T limit, used;
+		int available = 0;
 
 		*MemTotal = UINT32_MAX;
 		*MemFree  = 0;
@@ -77,6 +80,8 @@ int smartmem_info(UINT64_T *MemTotal, UINT64_T *MemFree, UINT64_T *Buffers, UINT
 		while (fscanf(fp, "%s", str) != EOF) {
 				if (strcmp(str, "MemTotal:")==0) 
 						fscanf(fp, "%llu", MemTotal);
+				if (strcmp(str, "MemAvailable:")==0) 
+						available = (fscanf(fp, "%llu", &MemAvailable)==1);
 				if (strcmp(str, "MemFree:")==0) 
 						fscanf(fp, "%llu", MemFree);
 				if (strcmp(str, "Buffers:")==0) 
@@ -94,6 +99,24 @@ int smartmem_info(UINT64_T *MemTotal, UINT64_T *MemFree, UINT64_T *Buffers, UINT
 		(*Buffers)  *= 1024;
 		(*Cached)   *= 1024;
 
+		if (available) {
+				/* recent kernels estimate this better, not all of the buffers and cache can be reclaimed */
+				*MemFree = MemAvailable*1024;
+				*Buffers = 0;
+				*Cached  = 0;
+		}
+
+		/* inside a container or SLURM job the memory limit of the cgroup applies */
+		if (cgroup_memlimit(&limit, &used)==0 && limit<*MemTotal) {
+				*MemTotal = limit;
+				if (limit-(used<limit ? used : limit) < (*MemFree)+(*Buffers)+(*Cached)) {
+						/* the reclaimable page cache is already excluded from the usage */
+						*MemFree = limit-(used<limit ? used : limit);
+						*Buffers = 0;
+						*Cached  = 0;
+				}
+		}
+
 		return 0;
 #else
 		return -1;
@@ -16,6 +16,8 @@
  *
  */
 
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <time.h>
 
@@ -33,10 +35,113 @@ void smartshare_reset(void) {
 		pthread_mutex_unlock(&mutexsmartshare);
 }
 
-/* use a probabilistic approach to determine whether the connection should be dropped */
-int smartshare_check(float t, int hostid) {
-		float p, r;
-		UINT64_T mintimreq;
+/*
+ * The slaves decide themselves which of the competing job requests they accept,
+ * no central scheduler is involved. Each slave keeps track of the usage of the
+ * pool by every user, based on the busy slaves that are announced. Since all
+ * slaves see the same announcements, they arrive at the same shares. The usage
+ * decays with SMARTSHARE_HALFLIFE, so that the past is gradually forgotten.
+ *
+ * A job request with a higher priority is accepted before the requests with a
+ * lower priority. Within the same priority the request of the user with the
+ * smallest usage relative to their weight is accepted. Jobs that are already
+ * running are never interrupted.
+ */
+
+/* find the usage of the user, this should be called with mutexsmartshare locked */
+static fairsharelist_t *fairshare_find(const char *user, int create) {
+		fairsharelist_t *listitem;
+		for (listitem = fairsharelist; listitem; listitem = listitem->next)
+				if (strncmp(listitem->user, user, STRLEN)==0)
+						return listitem;
+		if (!create)
+				return NULL;
+		if ((listitem = (fairsharelist_t *)malloc(sizeof(fairsharelist_t)))==NULL)
+				return NULL;
+		strncpy(listitem->user, user, STRLEN);
+		listitem->user[STRLEN-1] = 0;
+		listitem->weight = 1;
+		listitem->fixed  = 0;
+		listitem->usage  = 0;
+		listitem->next   = fairsharelist;
+		fairsharelist    = listitem;
+		return listitem;
+}
+
+/* the usage relative to the weight, this should be called with mutexsmartshare locked */
+static double fairshare_usage(const char *user) {
+		fairsharelist_t *listitem = fairshare_find(user, 0);
+		if (!listitem)
+				return 0;
+		return (listitem->weight>0 ? listitem->usage/listitem->weight : listitem->usage*1e6);
+}
+
+/* specify the share of the pool to which a user is entitled, the default weight is 1 */
+void smartshare_weight(const char *user, float weight) {
+		fairsharelist_t *listitem;
+		pthread_mutex_lock(&mutexsmartshare);
+		if ((listitem = fairshare_find(user, 1))!=NULL) {
+				listitem->weight = weight;
+				listitem->fixed  = 1;
+		}
+		pthread_mutex_unlock(&mutexsmartshare);
+		DEBUG(LOG_INFO, "smartshare_weight: user = %s, weight = %f", user, weight);
+}
+
+/* update the decaying usage of each user with the busy peers, this is called periodically */
+void smartshare_update(void) {
+		double now, dt, decay;
+		fairsharelist_t *listitem, *prev, *next;
+		peerlist_t *peer;
+
+		now = walltime();
+
+		pthread_mutex_lock(&mutexsmartshare);
+		if (smartshare.updated<=0 || now<smartshare.updated) {
+				smartshare.updated = now;
+				pthread_mutex_unlock(&mutexsmartshare);
+				return;
+		}
+		dt    = now - smartshare.updated;
+		decay = pow(0.5, dt/SMARTSHARE_HALFLIFE);
+		smartshare.updated = now;
+
+		for (listitem = fairsharelist; listitem; listitem = listitem->next)
+				listitem->usage *= decay;
+
+		pthread_mutex_lock(&mutexpeerlist);
+		for (peer = peerlist; peer; peer = peer->next)
+				if (peer->host->status==STATUS_BUSY && peer->host->current.user[0])
+						if ((listitem = fairshare_find(peer->host->current.user, 1))!=NULL)
+								listitem->usage += dt;
+		pthread_mutex_unlock(&mutexpeerlist);
+
+		/* the users that have not been seen for a long time are forgotten */
+		prev = NULL;
+		listitem = fairsharelist;
+		while (listitem) {
+				next = listitem->next;
+				if (!listitem->fixed && listitem->usage<1) {
+						if (prev)
+								prev->next = next;
+						else
+								fairsharelist = next;
+						FREE(listitem);
+				}
+				else {
+						prev = listitem;
+				}
+				listitem = next;
+		}
+		pthread_mutex_unlock(&mutexsmartshare);
+}
+
+/* determine whether the job request should be accepted, given the competing requests from other users */
+int smartshare_check(const jobdef_t *job, const hostdef_t *from) {
+		int accept = 1, competing = 0;
+		UINT64_T maxpriority = 0;
+		double usage, minusage = 0;
+		time_t now = time(NULL);
 		smartsharelist_t *listitem;
 
 		DEBUG(LOG_DEBUG, "smartshare_check()");
@@ -56,19 +161,19 @@ int smartshare_check(float t, int hostid) {
 		}
 
 		/* accept the job if it does not take any time, e.g. writing results back to the master */
-		if (t<=0) {
+		if (job->timreq<=0) {
 				pthread_mutex_unlock(&mutexsmartshare);
 				return 1;
 		}
 
         /* count the number of subsequent requests from the same host */
-		if (smartshare.prevhostid==hostid)
+		if (smartshare.prevhostid==from->id)
 				smartshare.prevhostcount++;
 		else
 				smartshare.prevhostcount = 0;
 
 		smartshare.n++;
-		smartshare.prevhostid = hostid;
+		smartshare.prevhostid = from->id;
 
 		/* accept the job if all previous requests originated from the same host */
 		if (smartshare.prevhostcount >= SMARTSHARE_PREVHOSTCOUNT) {
@@ -78,59 +183,64 @@ int smartshare_check(float t, int hostid) {
 				return 1;
 		}
 
-		/* accept the job if all previous jobs were too long ago */
-		if (difftime(time(NULL), smartshare.time) > SMARTSHARE_TIMEOUT) {
-				DEBUG(LOG_DEBUG, "smartshare_check: timer has elapsed");
-				pthread_mutex_unlock(&mutexsmartshare);
-				return 1;
+		/* the recent requests from other users are competing with this one */
+		for (listitem = smartsharelist; listitem; listitem = listitem->next) {
+				if (difftime(now, listitem->time) > SMARTSHARE_TIMEOUT)
+						continue;
+				if (strncmp(listitem->user, from->user, STRLEN)==0)
+						continue;
+				usage = fairshare_usage(listitem->user);
+				if (!competing || listitem->priority>maxpriority) {
+						maxpriority = listitem->priority;
+						minusage    = usage;
+				}
+				else if (listitem->priority==maxpriority && usage<minusage) {
+						minusage    = usage;
+				}
+				competing++;
 		}
 
-		/* determine the baseline for the time, based on the recent job history */
-		if (smartsharelist) {
-				listitem = smartsharelist;
-				mintimreq = (float)listitem->timreq;
-				while (listitem) {
-						if (listitem->timreq < mintimreq)
-								mintimreq = listitem->timreq;
-						listitem = listitem->next;
-				}
-				/* scale the time of this job request with the minimal time required */
-				t = t/((float)mintimreq);
+		/* accept the job if there are no recent requests from other users */
+		if (!competing) {
+				DEBUG(LOG_DEBUG, "smartshare_check: no competing requests");
+		}
+		else if (job->priority>maxpriority) {
+				DEBUG(LOG_DEBUG, "smartshare_check: higher priority than the competing requests");
+		}
+		else if (job->priority<maxpriority) {
+				DEBUG(LOG_DEBUG, "smartshare_check: lower priority than the competing requests");
+				accept = 0;
 		}
 		else {
-				/* the scale factor cannot be determined from the list of known jobs */
-				t = 1;
-		}  
-
-		/* compute the probability of accepting the job */
-		if (t<=1)
-				p = 1.0;
-		else
-				p = 1.0 / t;
-
-		/* compute random number between 0 and 1 */
-		r = ((float)rand()) / ((float)RAND_MAX);
-
-		DEBUG(LOG_DEBUG, "smartshare_check: t = %f, p = %f, r = %f, n = %d", t, p, r, smartshare.n);
+				/* the user that used the pool the least so far goes first */
+				usage  = fairshare_usage(from->user);
+				accept = (usage <= minusage*(1+SMARTSHARE_TOLERANCE) + 1);
+				DEBUG(LOG_DEBUG, "smartshare_check: usage = %f, minusage = %f, competing = %d", usage, minusage, competing);
+		}
 
 		pthread_mutex_unlock(&mutexsmartshare);
 
 		/* return 1 if the connection should be accepted, 0 if it should not be accepted */
-		p = (p>r);
-		DEBUG(LOG_INFO, "smartshare_check: return value = %d", p);
-		return p;
+		DEBUG(LOG_INFO, "smartshare_check: return value = %d", accept);
+		return accept;
 }
 
 
-/* keep a short history of the jobs that are currently submidded */
-void smartshare_history(jobdef_t *job) {
+/* keep a short history of the jobs that are currently submitted */
+void smartshare_history(const jobdef_t *job, const hostdef_t *from) {
 		int historycount = 0;
 		int peercount = 0;
 		smartsharelist_t *listitem;
 		peerlist_t *peer;
 
-		listitem = malloc(sizeof(smartsharelist_t));
-		listitem->timreq = job->timreq;
+		if ((listitem = malloc(sizeof(smartsharelist_t)))==NULL)
+				return;
+		listitem->timreq   = job->timreq;
+		listitem->priority = job->priority;
+		listitem->hostid   = from->id;
+		listitem->time     = time(NULL);
+		strncpy(listitem->user, from->user, STRLEN);
+		listitem->user[STRLEN-1] = 0;
 
 		pthread_mutex_lock(&mutexsmartshare);
 		if (smartsharelist==NULL) {
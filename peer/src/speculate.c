@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/
+ *
+ */
+
+/*
+ * In a large batch the last results often wait for a single slow or overloaded
+ * slave. This thread runs on the master and puts a job once more to an idle
+ * slave when it takes more than speculate.factor times longer than expected.
+ * The expected duration is the average roundtrip time of the earlier jobs with
+ * the same function, or the requested time. The results that arrive first are
+ * passed on, after which the other copy is cancelled and its results, if they
+ * still arrive, are discarded, see jobstat.c.
+ *
+ * A cancelled job is removed from the queue of the slave. A job that is being
+ * executed cannot be interrupted, but the slave does not return its results.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "peer.h"
+#include "extern.h"
+#include "platform_includes.h"
+
+#define MAXCANCEL 16
+
+typedef struct {
+		UINT32_T jobid;
+		UINT32_T peerid;
+		UINT32_T spareid;
+} cancel_t;
+
+/* write a jobdef that cancels the job to the specified peer, this returns 1 if the peer cancelled it */
+int write_cancel(UINT32_T peerid, UINT32_T jobid) {
+		int server, handshake, success = 0;
+		jobdef_t def;
+
+		memset(&def, 0, sizeof(jobdef_t));
+		def.version = VERSION;
+		def.id      = jobid;
+		def.flags   = JOBFLAG_CANCEL;
+
+		if ((server = open_peer_connection(peerid))<0)
+				return 0;
+
+		/* only the hostdef and the jobdef are sent, the handshake after the jobdef tells whether the job was found */
+		if (bufread(server, &handshake, sizeof(int))!=sizeof(int) || !handshake)
+				goto cleanup;
+		pthread_mutex_lock(&mutexhost);
+		success = (bufwrite(server, host, sizeof(hostdef_t))==sizeof(hostdef_t));
+		pthread_mutex_unlock(&mutexhost);
+		if (!success)
+				goto cleanup;
+		success = 0;
+		if (bufread(server, &handshake, sizeof(int))!=sizeof(int) || !handshake)
+				goto cleanup;
+		if (bufwrite(server, &def, sizeof(jobdef_t))!=sizeof(jobdef_t))
+				goto cleanup;
+		if (bufread(server, &handshake, sizeof(int))!=sizeof(int))
+				goto cleanup;
+		success = (handshake!=0);
+
+cleanup:
+		close_connection(server);
+		return success;
+}
+
+/* remove the job of the specified master from the joblist, this returns 1 if the job was found */
+int cancel_job(UINT32_T hostid, UINT32_T jobid) {
+		int found = 0, running;
+		joblist_t *job;
+
+		pthread_mutex_lock(&mutexjoblist);
+		for (job = joblist; job; job = job->next)
+				if (job->job->id==jobid && job->host->id==hostid)
+						break;
+
+		if (job) {
+				found = 1;
+				/* the first job on the list is the one that is being executed */
+				pthread_mutex_lock(&mutexhost);
+				running = (job==joblist && host->status==STATUS_BUSY && host->current.jobid==jobid && host->current.hostid==hostid);
+				pthread_mutex_unlock(&mutexhost);
+
+				if (running) {
+						/* its results will not be returned, see peerslave.c */
+						cancelled.hostid = hostid;
+						cancelled.jobid  = jobid;
+				}
+				else {
+						remove_joblist(job);
+						FREE(job->job);
+						FREE(job->host);
+						FREE(job->arg);
+						FREE(job->opt);
+						spill_remove(&job->spill);
+						FREE(job);
+				}
+		}
+		pthread_mutex_unlock(&mutexjoblist);
+
+		if (found) {
+				DEBUG(LOG_NOTICE, "cancel_job: cancelled job %u from %u", jobid, hostid);
+				/* the backlog that is announced has changed */
+				worksteal_update();
+		}
+		return found;
+}
+
+/* this returns 1 if the job that has been executed was cancelled in the meantime */
+int cancel_check(UINT32_T hostid, UINT32_T jobid) {
+		int found;
+		pthread_mutex_lock(&mutexjoblist);
+		found = (cancelled.hostid==hostid && cancelled.jobid==jobid);
+		if (found) {
+				cancelled.hostid = 0;
+				cancelled.jobid  = 0;
+		}
+		pthread_mutex_unlock(&mutexjoblist);
+		return found;
+}
+
+void cleanup_speculator(void *arg) {
+		DEBUG(LOG_DEBUG, "cleanup_speculator()");
+
+		pthread_mutex_lock(&mutexstatus);
+		speculatorStatus = 0;
+		pthread_mutex_unlock(&mutexstatus);
+
+		pthread_mutex_lock(&mutexthreadcount);
+		threadcount--;
+		pthread_mutex_unlock(&mutexthreadcount);
+}
+
+void *speculator(void *arg) {
+		int i, numcancel, success;
+		double now, threshold;
+		UINT32_T jobid, peerid, spareid;
+		jobdef_t *def;
+		void *jobarg, *jobopt;
+		cancel_t cancel[MAXCANCEL];
+		jobstatlist_t *listitem;
+		peerlist_t *peer;
+
+		pthread_cleanup_push(cleanup_speculator, NULL);
+
+		/* this is for debugging */
+		pthread_mutex_lock(&mutexthreadcount);
+		threadcount++;
+		pthread_mutex_unlock(&mutexthreadcount);
+
+		pthread_mutex_lock(&mutexstatus);
+		if (speculatorStatus==0) {
+				speculatorStatus = 1;
+				/* signal that this thread has started */
+				pthread_cond_signal(&condstatus);
+				pthread_mutex_unlock(&mutexstatus);
+		}
+		else {
+				pthread_mutex_unlock(&mutexstatus);
+				goto cleanup;
+		}
+
+		while (1) {
+				/* the copy of the job should not be left behind halfway */
+				pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+				numcancel = 0;
+				jobid     = 0;
+				peerid    = 0;
+				def       = NULL;
+				jobarg    = NULL;
+				jobopt    = NULL;
+				now       = walltime();
+
+				pthread_mutex_lock(&mutexjobstat);
+				for (listitem = jobstatlist; listitem; listitem = listitem->next) {
+						if (listitem->done && listitem->cancel && !listitem->sending && numcancel<MAXCANCEL) {
+								/* the results of the other copy arrived first */
+								cancel[numcancel].jobid   = listitem->jobid;
+								cancel[numcancel].peerid  = listitem->peerid;
+								cancel[numcancel].spareid = listitem->spareid;
+								listitem->cancel = 0;
+								numcancel++;
+						}
+						else if (!def && !listitem->done && !listitem->sending && !listitem->spareid && listitem->def) {
+								/* only one copy is put, and only one job per iteration */
+								threshold = speculate.factor*listitem->expected;
+								if (threshold<SPECULATE_MINTIME)
+										threshold = SPECULATE_MINTIME;
+								if (now - listitem->timing.submitted > threshold) {
+										listitem->sending = 1;
+										jobid  = listitem->jobid;
+										peerid = listitem->peerid;
+										def    = listitem->def;
+										jobarg = listitem->arg;
+										jobopt = listitem->opt;
+								}
+						}
+				}
+				pthread_mutex_unlock(&mutexjobstat);
+
+				for (i=0; i<numcancel; i++) {
+						if (cancel[i].peerid)
+								write_cancel(cancel[i].peerid, cancel[i].jobid);
+						if (cancel[i].spareid)
+								write_cancel(cancel[i].spareid, cancel[i].jobid);
+				}
+
+				if (def) {
+						/* find an idle slave other than the one that has the job */
+						spareid = 0;
+						pthread_mutex_lock(&mutexpeerlist);
+						pthread_mutex_lock(&mutexhost);
+						for (peer = peerlist; peer && !spareid; peer = peer->next) {
+								if (peer->host->status!=STATUS_IDLE || peer->host->id==peerid || peer->host->id==host->id)
+										continue;
+								if (peer->host->memavail<def->memreq || peer->host->cpuavail<def->cpureq || peer->host->timavail<def->timreq)
+										continue;
+								if (peer->host->gpuavail<def->gpureq || peer->host->gpumemavail<def->gpumemreq)
+										continue;
+								spareid = peer->host->id;
+						}
+						pthread_mutex_unlock(&mutexhost);
+						pthread_mutex_unlock(&mutexpeerlist);
+
+						success = (spareid ? write_job(spareid, def, jobarg, jobopt) : 0);
+						if (success) {
+								DEBUG(LOG_NOTICE, "speculator: put job %u once more to %u", jobid, spareid);
+						}
+
+						/* the record may have been removed in the meantime, see jobstat_put */
+						pthread_mutex_lock(&mutexjobstat);
+						for (listitem = jobstatlist; listitem; listitem = listitem->next)
+								if (listitem->jobid==jobid && listitem->sending)
+										break;
+						if (listitem) {
+								listitem->sending = 0;
+								if (success) {
+										listitem->spareid = spareid;
+										speculate.launched++;
+										/* the original results arrived while sending */
+										if (listitem->done)
+												listitem->cancel = 1;
+								}
+								if (listitem->done) {
+										FREE(listitem->def);
+										FREE(listitem->arg);
+										FREE(listitem->opt);
+								}
+						}
+						pthread_mutex_unlock(&mutexjobstat);
+
+						if (!listitem) {
+								if (success)
+										write_cancel(spareid, jobid);
+								FREE(def);
+								FREE(jobarg);
+								FREE(jobopt);
+						}
+				}
+
+				pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+
+				/* note that this is a thread cancelation point */
+				pthread_testcancel();
+				threadsleep(SPECULATESLEEP);
+		}
+
+cleanup:
+		printf(""); /* otherwise the pthread_cleanup_pop won't compile */
+		pthread_cleanup_pop(1);
+		return NULL;
+}
@@ -55,12 +55,24 @@ void cleanup_tcpserver(void *arg) {
 		pthread_mutex_unlock(&mutexthreadcount);
 }
 
+#ifdef WIN32
+/* without the server loop, each connection is handled in its own thread and closed after the message */
+void *tcpsocket_thread(void *arg) {
+		connection_t *conn = (connection_t *)arg;
+		tcpsocket(conn);
+		if (conn->keep)
+				closesocket(conn->fd);
+		FREE(conn);
+		return NULL;
+}
+#endif
+
 /***********************************************************************
  * this thread listens to incoming TCP connections
- * if a connection is made by a client, it starts the tcpsocket function
+ * the connections and the messages are handled in serverloop
  ***********************************************************************/
 void *tcpserver(void *arg) {
-		int c, retry;
+		int retry;
 		int fd = 0;
 
 		/* these variables are for the socket */
@@ -68,11 +80,11 @@ void *tcpserver(void *arg) {
 		unsigned int b;
 		int optval;
 
+#ifdef WIN32
 		/* these variables are for the threading */
-		int rc;
+		int c, rc;
 		pthread_t tid;
-
-#ifdef WIN32
+		connection_t *conn;
 		unsigned long enable = 0;
 		WSADATA wsa;
 #endif
@@ -217,19 +229,11 @@ void *tcpserver(void *arg) {
 				goto cleanup;
 		}
 
+#ifdef WIN32
 		for (;;) {
-				/*
-				 * If no pending connections are present on the queue, and the socket
-				 * is not marked as non-blocking, accept() blocks the caller until a
-				 * connection is present.  If the socket is marked non-blocking and
-				 * no pending connections are present on the queue, accept() returns
-				 * an error as described below.
-				 */
-
 				c = accept(fd, (struct sockaddr *)&sa, &b);
 
 				if (c<0) {
-#ifdef WIN32
 						if(errno==0) {
 								pthread_testcancel();
 								threadsleep(ACCEPTSLEEP);
@@ -239,39 +243,22 @@ void *tcpserver(void *arg) {
 								DEBUG(LOG_ERR, "error: tcpserver accept");
 								goto cleanup;
 						}
-#else
-						if (errno==EWOULDBLOCK) {
-								pthread_testcancel();
-								threadsleep(ACCEPTSLEEP);
-						}
-						else {
-								perror("tcpserver accept");
-								perror("tcpserver accept");
-								goto cleanup;
-						}
-#endif
 				}
 
 				else {
 						DEBUG(LOG_DEBUG, "tcpserver: opened connection to client on socket %d", c);
 
 						/* place the socket back in blocking mode, this is needed for tcpsocket  */
-#ifdef WIN32
 						enable = 0;
 						ioctlsocket(c, FIONBIO, &enable);
-#else
-						optval = fcntl(c, F_GETFL, NULL);
-						optval = optval & (!O_NONBLOCK);
-						if (fcntl(c, F_SETFL, optval)<0) {
-								perror("tcpserver fcntl");
-								perror("tcpserver fcntl");
-								goto cleanup;
-						}
-#endif
 
 						/* deal with the incoming connection on the TCP socket in a seperate thread */
-						/* rc = pthread_create(&tid, &attr, tcpsocket, (void *)c); */
-						rc = pthread_create(&tid, NULL, tcpsocket, (void *)c);
+						if ((conn = (connection_t *)calloc(1, sizeof(connection_t)))==NULL) {
+								closesocket(c);
+								continue;
+						}
+						conn->fd = c;
+						rc = pthread_create(&tid, NULL, tcpsocket_thread, (void *)conn);
 
 						if (rc) {
 								/* the code should never arrive here */
@@ -283,6 +270,10 @@ void *tcpserver(void *arg) {
 						pthread_detach(tid);
 				}
 		}
+#else
+		/* wait for the connections and the messages, these are handled by a pool of threads */
+		serverloop(fd, "tcpserver");
+#endif
 
 cleanup:
 		printf(""); /* otherwise the pthread_cleanup_pop won't compile */
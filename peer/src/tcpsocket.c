@@ -19,6 +19,7 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 #include "peer.h"
@@ -28,6 +29,7 @@
 typedef struct {
 		void **message;
 		int *fd;
+		int *keep;
 } threadlocal_t;
 
 void cleanup_tcpsocket(void *arg) {
@@ -43,7 +45,8 @@ void cleanup_tcpsocket(void *arg) {
 				FREE(*threadlocal->message);
 		}
 
-		if (threadlocal && (*threadlocal->fd)>0) {
+		/* the connection remains open for the next message after a complete one, see serverloop.c */
+		if (threadlocal && (*threadlocal->fd)>0 && !(*threadlocal->keep)) {
 				closesocket(*threadlocal->fd);
 				*threadlocal->fd = 0;
 		}
@@ -57,10 +60,14 @@ void cleanup_tcpsocket(void *arg) {
 		pthread_mutex_unlock(&mutexthreadcount);
 }
 
-/* this function deals with the incoming message */
+/* this function deals with the incoming message on the connection */
 /* the return value is always NULL */
 void *tcpsocket(void *arg) {
-		int n, jobcount;
+		connection_t *conn = (connection_t *)arg;
+		int n, jobcount, queue, queued = 0, cached = 0, shm = 0, master;
+		double started;
+		UINT64_T spillsize, spoolsize;
+		FILE *fp = NULL;
 		int connect_accept = 1, connect_continue = 1, handshake;
 		joblist_t *job;
 
@@ -71,9 +78,11 @@ void *tcpsocket(void *arg) {
 		threadlocal_t threadlocal;
 		threadlocal.message = &message;
 		threadlocal.fd      = &fd;
+		threadlocal.keep    = &conn->keep;
 
 		/* the connection to the client has been made by the server */
-		fd = ((int)arg);
+		fd = conn->fd;
+		conn->keep = 0;
 
 		pthread_cleanup_push(cleanup_tcpsocket, &threadlocal);
 
@@ -100,30 +109,40 @@ void *tcpsocket(void *arg) {
 		DEBUG(LOG_DEBUG, "tcpsocket: fd = %d, socketcount = %d, threadcount = %d", fd, socketcount, threadcount);
 
 		pthread_mutex_lock(&mutexjoblist);
-		jobcount = 0;
-		job = joblist;
-		while (job) {
-				jobcount++;
-				job = job->next;
-		}
+		jobcount = joblistcount;
 		pthread_mutex_unlock(&mutexjoblist);
 
+		pthread_mutex_lock(&mutexworksteal);
+		queue = worksteal.queue;
+		spillsize = worksteal.spill;
+		pthread_mutex_unlock(&mutexworksteal);
+
+		pthread_mutex_lock(&mutexspool);
+		spoolsize = spool.maxmem;
+		pthread_mutex_unlock(&mutexspool);
+
 		pthread_mutex_lock(&mutexhost);
+		master = (host->status==STATUS_MASTER);
 		if (host->status==STATUS_MASTER) {
 				connect_accept = 1;
 		}
 		else if (host->status==STATUS_IDLE && jobcount==0) {
 				connect_accept = 1;
 		}
+		else if (host->status==STATUS_BUSY && jobcount>0 && jobcount<=queue) {
+				/* there is room in the queue behind the current job */
+				connect_accept = 1;
+				queued = 1;
+		}
 		else {
 				DEBUG(LOG_INFO, "tcpsocket: failed on status (%d) and/or jobcount (%d)", host->status, jobcount);
 				connect_accept = 0;
 		}
 		pthread_mutex_unlock(&mutexhost);
 
-		/* give a handshake */
+		/* give a handshake, this is skipped for the following messages over the same connection */
 		handshake = connect_accept || connect_continue;
-		if ((n = bufwrite(fd, &handshake, sizeof(int))) != sizeof(int)) {
+		if (!conn->reused && (n = bufwrite(fd, &handshake, sizeof(int))) != sizeof(int)) {
 				DEBUG(LOG_ERR, "tcpsocket: could not write handshake, n = %d, should be %d", n, sizeof(int));
 				goto cleanup;
 		}
@@ -138,6 +157,10 @@ void *tcpsocket(void *arg) {
 		message->job  = (jobdef_t*)malloc(sizeof(jobdef_t));
 		message->arg  = NULL;
 		message->opt  = NULL;
+		message->spill = NULL;
+
+		/* the time that it takes to read the job is part of its timing */
+		started = walltime();
 
 		/* read the host details */
 		if ((n = bufread(fd, message->host, sizeof(hostdef_t))) != sizeof(hostdef_t)) {
@@ -186,6 +209,30 @@ void *tcpsocket(void *arg) {
 				connect_continue = 0; /* prevent another read request */
 		}
 
+		/* a job that was put to another slave as well can be cancelled, see speculate.c */
+		if (message->job->flags & JOBFLAG_CANCEL) {
+				handshake = (connect_continue && security_check(message->host) && cancel_job(message->host->id, message->job->id));
+				bufwrite(fd, &handshake, sizeof(int));
+				FREE(message->host);
+				FREE(message->job);
+				goto cleanup;
+		}
+
+		/* another slave requests the results of a job that were kept on this one, see chain.c */
+		if (message->job->flags & JOBFLAG_FETCH) {
+				void *kept = NULL;
+				if (connect_continue && security_check(message->host))
+						kept = argcache_lookup(message->job->arghash, message->job->argsize);
+				handshake = (kept!=NULL);
+				if (bufwrite(fd, &handshake, sizeof(int))==sizeof(int) && kept)
+						bufwrite(fd, kept, message->job->argsize);
+				DEBUG(LOG_INFO, "tcpsocket: %s %u bytes of kept results", kept ? "sending" : "not having", message->job->argsize);
+				FREE(kept);
+				FREE(message->host);
+				FREE(message->job);
+				goto cleanup;
+		}
+
 		pthread_mutex_lock(&mutexhost);
 		if (message->job->memreq > host->memavail) {
 				DEBUG(LOG_INFO, "tcpsocket: memory request too large");
@@ -199,6 +246,14 @@ void *tcpsocket(void *arg) {
 				DEBUG(LOG_INFO, "tcpsocket: time request too large");
 				connect_accept = 0;
 		}
+		if (message->job->gpureq > host->gpuavail) {
+				DEBUG(LOG_INFO, "tcpsocket: gpu request too large");
+				connect_accept = 0;
+		}
+		if (message->job->gpumemreq > host->gpumemavail) {
+				DEBUG(LOG_INFO, "tcpsocket: gpu memory request too large");
+				connect_accept = 0;
+		}
 		pthread_mutex_unlock(&mutexhost);
 
 		if (message->job->argsize>MAXARGSIZE) {
@@ -212,20 +267,60 @@ void *tcpsocket(void *arg) {
 		}
 
 		/* remember the job characteristics for the smartshare algorithm */
-		smartshare_history(message->job);
+		smartshare_history(message->job, message->host);
 
 		/* use a probabilistic approach to determine whether the connection should be dropped */
-		if (!smartshare_check(message->job->timreq, message->host->id)) {
+		if (!smartshare_check(message->job, message->host)) {
 				DEBUG(LOG_INFO, "tcpsocket: failed smartshare_check");
 				connect_accept = 0;
 		}
 
+		/* the arguments may already be in the cache, in which case they are not sent again */
+		if (connect_accept && message->job->arghash && message->job->argsize>0) {
+				if ((message->arg = argcache_lookup(message->job->arghash, message->job->argsize))!=NULL) {
+						DEBUG(LOG_INFO, "tcpsocket: using %u bytes of cached arguments", message->job->argsize);
+						cached = 1;
+				}
+		}
+
+		/* the arguments of a job that has to wait in the queue can be kept on disk */
+		if (connect_accept && !cached && queued && spillsize>0 && message->job->argsize>spillsize) {
+				if (spill_open(&message->spill, &fp)!=0)
+						DEBUG(LOG_ERR, "tcpsocket: keeping the arguments in memory");
+		}
+
+		/* the results that arrive on the master are kept on disk when the others in memory already take too much, see peer('spool') */
+		if (connect_accept && !cached && master && spoolsize>0 && message->job->argsize>0 && joblist_memory(NULL)+message->job->argsize>spoolsize) {
+				if (spill_open(&message->spill, &fp)!=0) {
+						DEBUG(LOG_ERR, "tcpsocket: keeping the results in memory");
+				}
+				else {
+						DEBUG(LOG_INFO, "tcpsocket: spooling %u bytes of results to %s", message->job->argsize, message->spill);
+				}
+		}
+
+		/* a job whose arguments do not fit in memory is refused rather than read */
+		if (connect_accept && message->job->argsize>0 && message->spill==NULL && message->arg==NULL) {
+				if ((message->arg = malloc(message->job->argsize))==NULL) {
+						DEBUG(LOG_ERR, "tcpsocket: could not allocate memory for the arguments");
+						connect_accept = 0;
+				}
+		}
+
+		/* large arguments from a peer on the same computer are passed through shared memory */
+		if (connect_accept && !cached && message->spill==NULL && message->job->argsize>=SHM_MINSIZE)
+				shm = shm_supported(fd);
+
 		/* don't continue reading the content of the job, drop the connection before the job arguments are sent */
 		if (!connect_accept)
 				connect_continue = 0; /* prevent another read request */
 
-		/* give a handshake */
+		/* give a handshake, this tells the master whether the arguments are to be sent */
 		handshake = connect_accept || connect_continue;
+		if (connect_accept && cached)
+				handshake = HANDSHAKE_CACHED;
+		else if (connect_accept && shm)
+				handshake = HANDSHAKE_SHM;
 		if ((n = bufwrite(fd, &handshake, sizeof(int))) != sizeof(int)) {
 				DEBUG(LOG_ERR, "tcpsocket: could not write handshake, n = %d, should be %d", n, sizeof(int));
 				goto cleanup;
@@ -237,9 +332,20 @@ void *tcpsocket(void *arg) {
 		}
 
 		/* read the job request arguments */
-		if (message->job->argsize>0) {
-				message->arg = malloc(message->job->argsize);
-				if ((n = bufread(fd, message->arg, message->job->argsize)) != message->job->argsize) {
+		if (message->job->argsize>0 && !cached) {
+				if (message->spill) {
+						/* stream the arguments to the file, they are only read back when the job is executed or the results are retrieved */
+						n = bufread_file(fd, fp, message->job->argsize);
+						fclose(fp);
+						fp = NULL;
+				}
+				else if (shm) {
+						n = bufread_shm(fd, message->arg, message->job->argsize);
+				}
+				else {
+						n = bufread(fd, message->arg, message->job->argsize);
+				}
+				if (n != message->job->argsize) {
 						DEBUG(LOG_ERR, "tcpsocket: read size = %d, should be %d", n, message->job->argsize);
 						goto cleanup;
 				}
@@ -284,11 +390,46 @@ void *tcpsocket(void *arg) {
 		job->host = message->host;
 		job->arg  = message->arg;
 		job->opt  = message->opt;
+		job->spill = message->spill;
+		message->spill = NULL;
+		memset(&job->timing, 0, sizeof(jobtiming_t));
+		job->timing.arrived = walltime();
+		job->timing.receive = job->timing.arrived - started;
+
+		/* the joblist of the master contains the results, these complete the timing of the job */
+		/* the message was read completely, the connection can be used for the next one */
+		conn->keep = 1;
+
+		if (master && jobstat_arrived(job)) {
+				/* the results of another copy of the job were already received */
+				DEBUG(LOG_INFO, "tcpsocket: discarding the results of job %u from %s", job->job->id, job->host->name);
+				FREE(job->job);
+				FREE(job->host);
+				FREE(job->arg);
+				FREE(job->opt);
+				spill_remove(&job->spill);
+				FREE(job);
+				goto cleanup;
+		}
+
+		/* the results of a job that was put with 'keep' remain on the slave */
+		if (master)
+				chain_arrived(job);
+
+		if (master && reduce_arrived(job)) {
+				/* the results were combined with those of the other jobs of the batch */
+				FREE(job->job);
+				FREE(job->host);
+				FREE(job->arg);
+				FREE(job->opt);
+				spill_remove(&job->spill);
+				FREE(job);
+				goto cleanup;
+		}
 
 		pthread_mutex_lock(&mutexjoblist);
-		/* add the item to the beginning of the list */
-		job->next = joblist;
-		joblist = job;
+		/* add the item to the end of the list, the jobs are executed in the order of arrival */
+		append_joblist(job);
 
 		DEBUG(LOG_DEBUG, "tcpsocket: job.version  = %u", job->job->version);
 		DEBUG(LOG_DEBUG, "tcpsocket: job.id       = %u", job->job->id);
@@ -298,10 +439,21 @@ void *tcpsocket(void *arg) {
 		DEBUG(LOG_DEBUG, "tcpsocket: host.port    = %u", job->host->port);
 		DEBUG(LOG_DEBUG, "tcpsocket: host.id      = %u", job->host->id);
 
+		/* wake up the master that is waiting for the results, see peer wait_any */
+		pthread_cond_broadcast(&condjoblist);
 		pthread_mutex_unlock(&mutexjoblist);
 
+		/* the queued job adds to the backlog that is announced */
+		worksteal_update();
+
 cleanup:
 
+		/* remove the file with the arguments of a job that was not completely read */
+		if (fp)
+				fclose(fp);
+		if (message)
+				spill_remove(&message->spill);
+
 		/* from now on it is again allowed to use smartcpu_update */
 		pthread_mutex_lock(&mutexsmartcpu);
 		smartcpu.freeze = 0;
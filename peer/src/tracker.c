@@ -0,0 +1,320 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/
+ *
+ */
+
+/*
+ * Every peer multicasts its host details and every peer processes all of
+ * them, which does not scale to large clusters and which does not work on
+ * networks where multicast is blocked. Instead of that, the peers can report
+ * to one or more trackers. A tracker is an ordinary peer that also runs the
+ * trackerserver thread. The host details are only sent to the trackers when
+ * they change, or after TRACKERREFRESH, otherwise a small keepalive message is
+ * sent. The masters, and the slaves that hand their queued jobs over to idle
+ * slaves, query the trackers for the peers that they know about, see discover.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "peer.h"
+#include "extern.h"
+#include "platform_includes.h"
+
+/* add a tracker, specified as hostname or hostname:port, this returns 0 on success */
+int add_trackerlist(const char *name) {
+		char *ptr;
+		struct hostent *server;
+		trackerlist_t *listitem;
+
+		if ((listitem = (trackerlist_t *)malloc(sizeof(trackerlist_t)))==NULL)
+				return -1;
+
+		strncpy(listitem->name, name, STRLEN);
+		listitem->name[STRLEN-1] = 0;
+		bzero(&listitem->addr, sizeof(struct sockaddr_in));
+		listitem->addr.sin_family = AF_INET;
+		listitem->addr.sin_port   = htons(TRACKER_PORT);
+
+		if ((ptr = strchr(listitem->name, ':'))!=NULL) {
+				*ptr = 0;
+				listitem->addr.sin_port = htons(atoi(ptr+1));
+		}
+
+		if ((server = gethostbyname(listitem->name))==NULL || server->h_length==0) {
+				DEBUG(LOG_ERR, "add_trackerlist: nslookup failed on '%s'", listitem->name);
+				FREE(listitem);
+				return -1;
+		}
+		memcpy(&(listitem->addr.sin_addr.s_addr), server->h_addr_list[0], sizeof(listitem->addr.sin_addr.s_addr));
+
+		pthread_mutex_lock(&mutextrackerlist);
+		listitem->next = trackerlist;
+		trackerlist = listitem;
+		/* the next announcement should contain the full host details */
+		tracker.refreshed = 0;
+		pthread_mutex_unlock(&mutextrackerlist);
+
+		DEBUG(LOG_NOTICE, "add_trackerlist: %s:%u", listitem->name, ntohs(listitem->addr.sin_port));
+		return 0;
+}
+
+/* send the host details to the trackers if they changed, otherwise a keepalive */
+void tracker_announce(int fd, const hostdef_t *message) {
+		int changed;
+		trackermsg_t keepalive;
+		trackerlist_t *listitem;
+
+		pthread_mutex_lock(&mutextrackerlist);
+
+		changed = (memcmp(&tracker.announced, message, sizeof(hostdef_t))!=0);
+		changed = changed || (difftime(time(NULL), tracker.refreshed) >= TRACKERREFRESH);
+		if (changed) {
+				memcpy(&tracker.announced, message, sizeof(hostdef_t));
+				tracker.refreshed = time(NULL);
+		}
+
+		keepalive.version = VERSION;
+		keepalive.id      = message->id;
+		keepalive.type    = TRACKER_KEEPALIVE;
+
+		listitem = trackerlist;
+		while (listitem) {
+				if (changed) {
+						if (sendto(fd, message, sizeof(hostdef_t), 0, (struct sockaddr *)&listitem->addr, sizeof(struct sockaddr_in)) < 0)
+								DEBUG(LOG_ERR, "tracker_announce: sendto failed for %s", listitem->name);
+				}
+				else {
+						if (sendto(fd, &keepalive, sizeof(trackermsg_t), 0, (struct sockaddr *)&listitem->addr, sizeof(struct sockaddr_in)) < 0)
+								DEBUG(LOG_ERR, "tracker_announce: sendto failed for %s", listitem->name);
+				}
+				listitem = listitem->next;
+		}
+
+		pthread_mutex_unlock(&mutextrackerlist);
+}
+
+/* ask the trackers for the peers that they know about, the replies arrive on the same socket */
+void tracker_query(int fd) {
+		trackermsg_t query;
+		trackerlist_t *listitem;
+
+		pthread_mutex_lock(&mutexhost);
+		query.version = VERSION;
+		query.id      = host->id;
+		query.type    = TRACKER_QUERY;
+		pthread_mutex_unlock(&mutexhost);
+
+		pthread_mutex_lock(&mutextrackerlist);
+		listitem = trackerlist;
+		while (listitem) {
+				if (sendto(fd, &query, sizeof(trackermsg_t), 0, (struct sockaddr *)&listitem->addr, sizeof(struct sockaddr_in)) < 0)
+						DEBUG(LOG_ERR, "tracker_query: sendto failed for %s", listitem->name);
+				listitem = listitem->next;
+		}
+		pthread_mutex_unlock(&mutextrackerlist);
+}
+
+typedef struct {
+		int *fd;
+		peerlist_t **registry;
+		void **message;
+} threadlocal_t;
+
+void cleanup_trackerserver(void *arg) {
+		peerlist_t *next;
+		threadlocal_t *threadlocal;
+		threadlocal = (threadlocal_t *)arg;
+
+		DEBUG(LOG_DEBUG, "cleanup_trackerserver()");
+
+		if (trackerserverStatus==0)
+				return;
+
+		if (threadlocal && *threadlocal->message) {
+				FREE(*threadlocal->message);
+		}
+
+		if (threadlocal && (*threadlocal->fd)>0) {
+				closesocket(*threadlocal->fd);
+				*threadlocal->fd = 0;
+		}
+
+		while (threadlocal && *threadlocal->registry) {
+				next = (*threadlocal->registry)->next;
+				FREE((*threadlocal->registry)->host);
+				FREE(*threadlocal->registry);
+				*threadlocal->registry = next;
+		}
+
+		pthread_mutex_lock(&mutexstatus);
+		trackerserverStatus = 0;
+		pthread_mutex_unlock(&mutexstatus);
+
+		pthread_mutex_lock(&mutexthreadcount);
+		threadcount--;
+		pthread_mutex_unlock(&mutexthreadcount);
+}
+
+void *trackerserver(void *arg) {
+		int fd = 0, nbytes, optval;
+		unsigned int addrlen;
+		struct sockaddr_in addr;
+		char ipaddr[INET_ADDRSTRLEN];
+		trackerentry_t *message = NULL;
+		trackermsg_t *request;
+		peerlist_t *registry = NULL, *peer, *next, *previous;
+
+		threadlocal_t threadlocal;
+		threadlocal.fd       = &fd;
+		threadlocal.registry = &registry;
+		threadlocal.message  = (void **)&message;
+
+		/* this is for debugging */
+		pthread_mutex_lock(&mutexthreadcount);
+		threadcount++;
+		pthread_mutex_unlock(&mutexthreadcount);
+
+		pthread_cleanup_push(cleanup_trackerserver, &threadlocal);
+
+		/* the status contains the thread id when running, or zero when not running */
+		pthread_mutex_lock(&mutexstatus);
+		if (trackerserverStatus==0) {
+				trackerserverStatus = 1;
+				/* signal that this thread has started */
+				pthread_cond_signal(&condstatus);
+				pthread_mutex_unlock(&mutexstatus);
+		}
+		else {
+				pthread_mutex_unlock(&mutexstatus);
+				goto cleanup;
+		}
+
+		if ((message = (trackerentry_t *)malloc(sizeof(trackerentry_t)))==NULL) {
+				perror("trackerserver malloc");
+				DEBUG(LOG_ERR, "error: trackerserver malloc");
+				goto cleanup;
+		}
+
+		if ((fd=socket(AF_INET,SOCK_DGRAM,0)) < 0) {
+				perror("trackerserver socket");
+				DEBUG(LOG_ERR, "error: trackerserver socket");
+				goto cleanup;
+		}
+
+		/* prevent "bind: Address already in use" */
+		optval = 1;
+		if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (const char*)&optval, sizeof(optval)) < 0) {
+				perror("trackerserver setsockopt");
+				DEBUG(LOG_ERR, "error: trackerserver setsockopt");
+				goto cleanup;
+		}
+
+		/* only a single tracker can run on a computer, hence SO_REUSEPORT is not used here */
+		memset(&addr,0,sizeof(addr));
+		addr.sin_family=AF_INET;
+		addr.sin_addr.s_addr=htonl(INADDR_ANY);
+		addr.sin_port=htons(TRACKER_PORT);
+
+		if (bind(fd,(struct sockaddr *)&addr,sizeof(addr)) < 0) {
+				perror("trackerserver bind");
+				DEBUG(LOG_ERR, "error: trackerserver bind");
+				goto cleanup;
+		}
+
+		while (1) {
+
+				/* note that this is a thread cancelation point */
+				addrlen=sizeof(addr);
+				if ((nbytes=recvfrom(fd,message,sizeof(trackerentry_t),0,(struct sockaddr *)&addr,&addrlen)) < 0) {
+						perror("trackerserver recvfrom");
+						DEBUG(LOG_ERR, "error: trackerserver recvfrom");
+						goto cleanup;
+				}
+
+				/* both the hostdef and the request start with the version and the id */
+				if (nbytes<sizeof(trackermsg_t) || message->host.version!=VERSION)
+						continue;
+
+				inet_ntop(AF_INET, &addr.sin_addr, ipaddr, INET_ADDRSTRLEN);
+				request = (trackermsg_t *)message;
+
+				/* look up the peer that sent the message, and remove the expired ones along the way */
+				previous = NULL;
+				peer = registry;
+				while (peer) {
+						next = peer->next;
+						if (difftime(time(NULL), peer->time) > EXPIRETIME) {
+								if (previous)
+										previous->next = next;
+								else
+										registry = next;
+								FREE(peer->host);
+								FREE(peer);
+								peer = next;
+								continue;
+						}
+						if (peer->host->id==message->host.id)
+								break;
+						previous = peer;
+						peer = next;
+				}
+
+				if (nbytes==sizeof(hostdef_t)) {
+						/* the host details have changed */
+						if (!peer) {
+								if ((peer = (peerlist_t *)malloc(sizeof(peerlist_t)))==NULL)
+										continue;
+								if ((peer->host = (hostdef_t *)malloc(sizeof(hostdef_t)))==NULL) {
+										FREE(peer);
+										continue;
+								}
+								peer->next = registry;
+								registry = peer;
+								DEBUG(LOG_INFO, "trackerserver: adding %s:%u from %s", message->host.name, message->host.port, ipaddr);
+						}
+						memcpy(peer->host, &message->host, sizeof(hostdef_t));
+						strncpy(peer->ipaddr, ipaddr, INET_ADDRSTRLEN);
+						peer->time = time(NULL);
+				}
+				else if (nbytes==sizeof(trackermsg_t) && request->type==TRACKER_KEEPALIVE) {
+						/* the host details are the same as before, unless the tracker was restarted */
+						if (peer)
+								peer->time = time(NULL);
+				}
+				else if (nbytes==sizeof(trackermsg_t) && request->type==TRACKER_QUERY) {
+						/* send the details of each peer back, as if they were announced to the one asking */
+						peer = registry;
+						while (peer) {
+								memcpy(&message->host, peer->host, sizeof(hostdef_t));
+								strncpy(message->ipaddr, peer->ipaddr, INET_ADDRSTRLEN);
+								if (sendto(fd, message, sizeof(trackerentry_t), 0, (struct sockaddr *)&addr, addrlen) < 0) {
+										DEBUG(LOG_ERR, "trackerserver: sendto failed for %s", ipaddr);
+										break;
+								}
+								peer = peer->next;
+						}
+				}
+		}
+
+cleanup:
+		printf(""); /* otherwise the pthread_cleanup_pop won't compile */
+		pthread_cleanup_pop(1);
+		return NULL;
+}
@@ -71,23 +71,18 @@ void cleanup_udsserver(void *arg) {
 
 /***********************************************************************
  * this thread listens to incoming UDS connections
- * if a connection is made by a client, it starts the udssocket function
+ * the connections and the messages are handled in serverloop
  ***********************************************************************/
 void *udsserver(void *arg) {
 #ifdef WIN32
 		/* this is not yet implemented on windows */
 #else
-		int c;
 		int fd = 0;
 
 		/* these variables are for the socket */
-		struct sockaddr_un local, remote;
+		struct sockaddr_un local;
 		socklen_t len;
 
-		/* these variables are for the threading */
-		int rc;
-		pthread_t tid;
-
 		threadlocal_t threadlocal;
 		threadlocal.fd = &fd;
 
@@ -119,7 +114,6 @@ void *udsserver(void *arg) {
 		}
 
 		bzero(&local, sizeof local);
-		bzero(&remote, sizeof remote);
 
 		pthread_mutex_lock(&mutexhost);
 		local.sun_family = AF_UNIX;
@@ -154,49 +148,8 @@ void *udsserver(void *arg) {
 				goto cleanup;
 		}
 
-		for (;;) {
-				/*
-				 * If no pending connections are present on the queue, and the socket
-				 * is not marked as non-blocking, accept() blocks the caller until a
-				 * connection is present.  If the socket is marked non-blocking and
-				 * no pending connections are present on the queue, accept() returns
-				 * an error as described below.
-				 */
-
-				len = sizeof remote;
-				c = accept(fd, (struct sockaddr *)&remote, &len);
-
-				DEBUG(LOG_DEBUG, "udsserver: c = %d", c);
-
-				if (c<0) {
-						if (errno==EWOULDBLOCK) {
-								pthread_testcancel();
-								threadsleep(ACCEPTSLEEP);
-						}
-						else {
-								perror("udsserver accept");
-								DEBUG(LOG_ERR, "error: udsserver accept");
-								goto cleanup;
-						}
-				}
-
-				else {
-						DEBUG(LOG_DEBUG, "udsserver: opened connection to client on socket %d", c);
-
-						/* deal with the incoming connection on the UDS socket in a seperate thread */
-						/* rc = pthread_create(&tid, &attr, udssocket, (void *)c); */
-						rc = pthread_create(&tid, NULL, tcpsocket, (void *)c);
-
-						if (rc) {
-								/* the code should never arrive here */
-								DEBUG(LOG_ERR, "udsserver: return code from pthread_create() is %d", rc);
-								goto cleanup;
-						}
-
-						DEBUG(LOG_DEBUG, "udsserver: c = %d, threadcount = %d", c, threadcount);
-						pthread_detach(tid);
-				}
-		}
+		/* wait for the connections and the messages, these are handled by a pool of threads */
+		serverloop(fd, "udsserver");
 
 cleanup:
 		printf(""); /* otherwise the pthread_cleanup_pop won't compile */
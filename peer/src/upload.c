@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/
+ *
+ */
+
+/*
+ * The jobs that are put with the 'async' option are sent to the slaves by
+ * UPLOAD_THREADS background threads, so that peer('put') returns as soon as
+ * the arguments are serialized and MATLAB can continue with the next job.
+ * The jobs for different slaves are sent concurrently, those for the same
+ * slave one after the other and in the order in which they were put. The
+ * jobs that are queued or being sent take at most upload.maxmem bytes, beyond
+ * that upload_put waits until enough of them have been sent. A job that cannot
+ * be sent is not retried, its id is kept for peer('upload', 'status').
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "peer.h"
+#include "extern.h"
+#include "platform_includes.h"
+
+static pthread_t uploadThread[UPLOAD_THREADS];
+
+static void free_upload(uploadlist_t *listitem) {
+		FREE(listitem->arg);
+		FREE(listitem->opt);
+		FREE(listitem);
+}
+
+/* the oldest queued job whose slave is not being sent to by another thread, or NULL */
+static uploadlist_t *next_upload(void) {
+		UINT32_T busy[UPLOAD_THREADS];
+		int i, numbusy = 0;
+		uploadlist_t *listitem;
+
+		/* the jobs for the same slave are sent in order, hence the jobs that are being sent come first */
+		for (listitem = uploadlist; listitem; listitem = listitem->next) {
+				if (listitem->sending) {
+						if (numbusy<UPLOAD_THREADS)
+								busy[numbusy++] = listitem->peerid;
+						continue;
+				}
+				for (i=0; i<numbusy; i++)
+						if (busy[i]==listitem->peerid)
+								break;
+				if (i==numbusy)
+						return listitem;
+		}
+		return NULL;
+}
+
+static void *uploader(void *arg) {
+		uploadlist_t *listitem, *previous;
+		double sendstart;
+		int success;
+
+		pthread_mutex_lock(&mutexthreadcount);
+		threadcount++;
+		pthread_mutex_unlock(&mutexthreadcount);
+
+		pthread_mutex_lock(&mutexupload);
+		while (1) {
+				while (!upload.stop && (listitem = next_upload())==NULL)
+						pthread_cond_wait(&condupload, &mutexupload);
+				if (upload.stop)
+						break;
+				listitem->sending = 1;
+				pthread_mutex_unlock(&mutexupload);
+
+				sendstart = walltime();
+				success = write_job(listitem->peerid, &listitem->def, listitem->arg, listitem->opt);
+				listitem->timing.send = walltime() - sendstart;
+
+				/* the timing is completed when the results arrive */
+				if (success)
+						jobstat_put(listitem->peerid, &listitem->def, listitem->arg, listitem->opt, &listitem->timing);
+				else
+						DEBUG(LOG_ERR, "uploader: failed to put job %u to peer %u", listitem->def.id, listitem->peerid);
+
+				pthread_mutex_lock(&mutexupload);
+				if (uploadlist==listitem)
+						uploadlist = listitem->next;
+				else {
+						for (previous = uploadlist; previous->next!=listitem; previous = previous->next);
+						previous->next = listitem->next;
+				}
+				upload.queued -= (UINT64_T)listitem->def.argsize + listitem->def.optsize;
+				upload.pending--;
+				if (success)
+						upload.sent++;
+				else if (upload.numfailed++<UPLOAD_FAILED)
+						upload.failed[upload.numfailed-1] = listitem->def.id;
+				free_upload(listitem);
+
+				/* this wakes up put when it waits for memory, and the threads that wait for this slave */
+				pthread_cond_broadcast(&condupload);
+		}
+		pthread_mutex_unlock(&mutexupload);
+
+		pthread_mutex_lock(&mutexthreadcount);
+		threadcount--;
+		pthread_mutex_unlock(&mutexthreadcount);
+		return NULL;
+}
+
+/* queue the serialized job for one of the upload threads, the arguments and options from malloc are */
+/* taken over, also if this fails, this returns 1 on success */
+int upload_put(UINT32_T peerid, const jobdef_t *def, void *arg, void *opt, const jobtiming_t *timing) {
+		uploadlist_t *listitem, *last;
+		UINT64_T size;
+
+		if ((listitem = (uploadlist_t *)calloc(1, sizeof(uploadlist_t)))==NULL) {
+				FREE(arg);
+				FREE(opt);
+				return 0;
+		}
+		listitem->peerid = peerid;
+		listitem->arg    = arg;
+		listitem->opt    = opt;
+		memcpy(&listitem->def, def, sizeof(jobdef_t));
+		memcpy(&listitem->timing, timing, sizeof(jobtiming_t));
+		size = (UINT64_T)def->argsize + def->optsize;
+
+		pthread_mutex_lock(&mutexupload);
+
+		/* the threads are started when they are needed for the first time */
+		while (upload.numthread<UPLOAD_THREADS) {
+				if (pthread_create(&uploadThread[upload.numthread], NULL, uploader, NULL)!=0)
+						break;
+				upload.numthread++;
+		}
+		if (upload.numthread==0) {
+				pthread_mutex_unlock(&mutexupload);
+				free_upload(listitem);
+				return 0;
+		}
+
+		/* a single job that is larger than the budget is still accepted when nothing else is queued */
+		while (upload.queued>0 && upload.queued+size>upload.maxmem)
+				pthread_cond_wait(&condupload, &mutexupload);
+
+		for (last = uploadlist; last && last->next; last = last->next);
+		if (last)
+				last->next = listitem;
+		else
+				uploadlist = listitem;
+		upload.queued += size;
+		upload.pending++;
+		pthread_cond_broadcast(&condupload);
+		pthread_mutex_unlock(&mutexupload);
+		return 1;
+}
+
+/* wait until all queued jobs have been sent */
+void upload_flush(void) {
+		pthread_mutex_lock(&mutexupload);
+		while (upload.pending>0 && upload.numthread>0)
+				pthread_cond_wait(&condupload, &mutexupload);
+		pthread_mutex_unlock(&mutexupload);
+}
+
+/* stop the upload threads after the jobs that they are sending, the jobs that are still queued are discarded */
+void upload_stop(void) {
+		uploadlist_t *listitem;
+		int i, numthread, discarded = 0;
+
+		pthread_mutex_lock(&mutexupload);
+		numthread   = upload.numthread;
+		upload.stop = 1;
+		pthread_cond_broadcast(&condupload);
+		pthread_mutex_unlock(&mutexupload);
+
+		for (i=0; i<numthread; i++)
+				pthread_join(uploadThread[i], NULL);
+
+		pthread_mutex_lock(&mutexupload);
+		while (uploadlist) {
+				listitem   = uploadlist->next;
+				free_upload(uploadlist);
+				uploadlist = listitem;
+				discarded++;
+		}
+		if (discarded)
+				DEBUG(LOG_ERR, "upload_stop: discarded %d jobs that were not sent yet", discarded);
+		upload.numthread = 0;
+		upload.stop      = 0;
+		upload.queued    = 0;
+		upload.pending   = 0;
+		pthread_mutex_unlock(&mutexupload);
+}
@@ -20,6 +20,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>       /* for strerror */
+#include <errno.h>
 
 #include "peer.h"
 #include "extern.h"
@@ -34,6 +35,10 @@
 #elif defined(PLATFORM_LINUX)
 #endif
 
+#if defined (PLATFORM_LINUX) || defined (PLATFORM_OSX)
+#include <sys/time.h>     /* for gettimeofday */
+#endif
+
 int threadsleep(float t) {
 	#ifdef WIN32
 		Sleep((int) (t*1000.0));
@@ -44,18 +49,29 @@ int threadsleep(float t) {
 		/* split in seconds and nanoseconds */
 		req.tv_sec  = (int)t;
 		req.tv_nsec = (int)(1000000000.0 * (t - (int)t));
-		retval = nanosleep(&req, &rem);
+		/* continue after a signal, otherwise the sleep may be cut short */
+		while ((retval = nanosleep(&req, &rem)) != 0 && errno == EINTR)
+			req = rem;
 		return retval;
 	#endif
 }
 
+/* returns the wall-clock time in seconds, with sub-second resolution */
+double walltime(void) {
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		return tv.tv_sec + 1e-6 * tv.tv_usec;
+}
+
 int bufread(int s, void *buf, int numel) {
 		int numcall = 0, numthis = 0, numread = 0;
 
 		while (numread<numel) {
 
 				numthis = recv(s, (char*)buf+numread, numel-numread, 0);
-				if (numthis<0) {
+				if (numthis<0 && errno==EINTR)
+						continue;
+				else if (numthis<0) {
 						perror("bufread");
 						DEBUG(LOG_ERR, "error: bufread");
 						break;
@@ -66,7 +82,6 @@ int bufread(int s, void *buf, int numel) {
 				DEBUG(LOG_DEBUG, "bufread: read %d bytes", numthis);
 				numread += numthis;
 				numcall++;
-				threadsleep(0.001);
 		}
 		DEBUG(LOG_DEBUG, "bufread: reading the complete buffer required %d calls", numcall);
 		return numread;
@@ -80,7 +95,9 @@ int bufwrite(int s, void *buf, int numel) {
 		while (numwrite<numel) {
 
 				numthis = send(s, (char*)buf+numwrite, numel-numwrite, 0);
-				if (numthis<0) {
+				if (numthis<0 && errno==EINTR)
+						continue;
+				else if (numthis<0) {
 						perror("bufwrite");
 						DEBUG(LOG_ERR, "error: bufwrite");
 						break;
@@ -91,12 +108,59 @@ int bufwrite(int s, void *buf, int numel) {
 				DEBUG(LOG_DEBUG, "bufwrite: wrote %d bytes", numthis);
 				numwrite += numthis;
 				numcall++;
-				threadsleep(0.001);
 		}
 		DEBUG(LOG_DEBUG, "bufwrite: writing the complete buffer required %d calls", numcall);
 		return numwrite;
 }
 
+/* read from the socket and write to the file in chunks, this returns the number of bytes written to the file */
+int bufread_file(int s, FILE *fp, int numel) {
+		int numthis = 0, numread = 0;
+		char *chunk;
+
+		if ((chunk = malloc(CHUNKSIZE))==NULL) {
+				DEBUG(LOG_ERR, "error: bufread_file");
+				return 0;
+		}
+		while (numread<numel) {
+				numthis = (numel-numread < CHUNKSIZE ? numel-numread : CHUNKSIZE);
+				if (bufread(s, chunk, numthis)!=numthis)
+						break;
+				if (fwrite(chunk, 1, numthis, fp)!=numthis) {
+						perror("bufread_file");
+						DEBUG(LOG_ERR, "error: bufread_file");
+						break;
+				}
+				numread += numthis;
+		}
+		FREE(chunk);
+		return numread;
+}
+
+/* read from the file and write to the socket in chunks, this returns the number of bytes written to the socket */
+int bufwrite_file(int s, FILE *fp, int numel) {
+		int numthis = 0, numwrite = 0;
+		char *chunk;
+
+		if ((chunk = malloc(CHUNKSIZE))==NULL) {
+				DEBUG(LOG_ERR, "error: bufwrite_file");
+				return 0;
+		}
+		while (numwrite<numel) {
+				numthis = (numel-numwrite < CHUNKSIZE ? numel-numwrite : CHUNKSIZE);
+				if (fread(chunk, 1, numthis, fp)!=numthis) {
+						perror("bufwrite_file");
+						DEBUG(LOG_ERR, "error: bufwrite_file");
+						break;
+				}
+				if (bufwrite(s, chunk, numthis)!=numthis)
+						break;
+				numwrite += numthis;
+		}
+		FREE(chunk);
+		return numwrite;
+}
+
 int append(void **buf1, int bufsize1, void *buf2, int bufsize2) {
 
 		pthread_mutex_lock(&mutexappendcount);
@@ -129,27 +193,36 @@ int append(void **buf1, int bufsize1, void *buf2, int bufsize2) {
 }
 
 int jobcount(void) {
-		int jobcount = 0;
+		int jobcount;
+		pthread_mutex_lock(&mutexjoblist);
+		jobcount = joblistcount;
+		pthread_mutex_unlock(&mutexjoblist);
+		return jobcount;
+}
+
+/* the number of bytes of the jobs in the joblist that are kept in memory, and the number of jobs that are kept on disk */
+UINT64_T joblist_memory(UINT32_T *spooled) {
+		UINT64_T used = 0;
+		UINT32_T count = 0;
 		joblist_t *job;
 		pthread_mutex_lock(&mutexjoblist);
-		job = joblist;
-		while (job) {
-				jobcount++;
-				job = job->next;
+		for (job = joblist; job; job = job->next) {
+				if (job->spill)
+						count++;
+				else
+						used += job->job->argsize;
+				used += job->job->optsize;
 		}
 		pthread_mutex_unlock(&mutexjoblist);
-		return jobcount;
+		if (spooled)
+				*spooled = count;
+		return used;
 }
 
 int peercount(void) {
-		int peercount = 0;
-		peerlist_t *peer;
+		int peercount;
 		pthread_mutex_lock(&mutexpeerlist);
-		peer = peerlist;
-		while (peer) {
-				peercount++;
-				peer = peer->next;
-		}
+		peercount = peerlistcount;
 		pthread_mutex_unlock(&mutexpeerlist);
 		return peercount;
 }
@@ -166,32 +239,133 @@ int hoststatus(void) {
 void clear_peerlist(void) {
 		peerlist_t *peer = NULL;
 		pthread_mutex_lock(&mutexpeerlist);
-		peer = peerlist;
-		while (peer) {
-				peerlist = peer->next;
+		while ((peer = peerlist)!=NULL) {
+				remove_peerlist(peer);
 				FREE(peer->host);
 				FREE(peer);
-				peer = peerlist;
 		}
 		pthread_mutex_unlock(&mutexpeerlist);
 }
 
-void clear_joblist(void) {
+/* remove the first job from the list, i.e. the one that has been executed */
+void pop_joblist(void) {
 		joblist_t *job = NULL;
 		pthread_mutex_lock(&mutexjoblist);
 		job = joblist;
-		while (job) {
-				joblist = job->next;
+		if (job) {
+				remove_joblist(job);
 				FREE(job->job);
 				FREE(job->host);
 				FREE(job->arg);
 				FREE(job->opt);
+				spill_remove(&job->spill);
 				FREE(job);
-				job = joblist;
 		}
 		pthread_mutex_unlock(&mutexjoblist);
 }
 
+/* create a file for the arguments of a queued job, this returns 0 on success */
+int spill_open(char **name, FILE **fp) {
+#if defined (PLATFORM_LINUX) || defined (PLATFORM_OSX)
+		int fd;
+		*name = malloc(STRLEN);
+		*fp   = NULL;
+		if (*name==NULL)
+				return -1;
+		snprintf(*name, STRLEN, "%s/peerslave_XXXXXX", SPILLDIR);
+		if ((fd = mkstemp(*name))<0 || (*fp = fdopen(fd, "w+b"))==NULL) {
+				DEBUG(LOG_ERR, "spill_open: could not create %s", *name);
+				if (fd>=0) {
+						close(fd);
+						unlink(*name);
+				}
+				FREE(*name);
+				return -1;
+		}
+		return 0;
+#else
+		/* the arguments are always kept in memory */
+		*name = NULL;
+		*fp   = NULL;
+		return -1;
+#endif
+}
+
+/* this returns a copy of the arguments of the job from its file, or NULL, the file is kept */
+void *spill_read(const joblist_t *job) {
+		FILE *fp;
+		void *arg;
+		int success = 0;
+
+		if ((arg = malloc(job->job->argsize))!=NULL && (fp = fopen(job->spill, "rb"))!=NULL) {
+				success = (fread(arg, 1, job->job->argsize, fp)==job->job->argsize);
+				fclose(fp);
+		}
+		if (!success) {
+				DEBUG(LOG_ERR, "spill_read: could not read %s", job->spill);
+				FREE(arg);
+		}
+		return arg;
+}
+
+/* read the arguments of the job from its file into memory and remove the file, this returns 0 on success */
+int spill_load(joblist_t *job) {
+		if (job->spill==NULL)
+				return 0;
+		job->arg = spill_read(job);
+		spill_remove(&job->spill);
+		return (job->arg ? 0 : -1);
+}
+
+/* remove the file with the arguments of a job */
+void spill_remove(char **name) {
+		if (*name) {
+				unlink(*name);
+				FREE(*name);
+		}
+}
+
+void clear_joblist(void) {
+		joblist_t *job = NULL;
+		pthread_mutex_lock(&mutexjoblist);
+		while ((job = joblist)!=NULL) {
+				remove_joblist(job);
+				FREE(job->job);
+				FREE(job->host);
+				FREE(job->arg);
+				FREE(job->opt);
+				spill_remove(&job->spill);
+				FREE(job);
+		}
+		pthread_mutex_unlock(&mutexjoblist);
+}
+
+void clear_durationlist(void) {
+		durationlist_t *listitem = NULL;
+		pthread_mutex_lock(&mutexworksteal);
+		listitem = durationlist;
+		while (listitem) {
+				durationlist = listitem->next;
+				FREE(listitem);
+				listitem = durationlist;
+		}
+		pthread_mutex_unlock(&mutexworksteal);
+}
+
+void clear_argcachelist(void) {
+		argcachelist_t *listitem = NULL;
+		pthread_mutex_lock(&mutexargcache);
+		listitem = argcachelist;
+		while (listitem) {
+				argcachelist = listitem->next;
+				FREE(listitem->arg);
+				FREE(listitem);
+				listitem = argcachelist;
+		}
+		argcache.used = 0;
+		pthread_mutex_unlock(&mutexargcache);
+}
+
 void clear_smartsharelist(void) {
 		smartsharelist_t *listitem = NULL;
 		pthread_mutex_lock(&mutexsmartshare);
@@ -204,6 +378,19 @@ void clear_smartsharelist(void) {
 		pthread_mutex_unlock(&mutexsmartshare);
 }
 
+void clear_fairsharelist(void) {
+		fairsharelist_t *listitem = NULL;
+		pthread_mutex_lock(&mutexsmartshare);
+		listitem = fairsharelist;
+		while (listitem) {
+				fairsharelist = listitem->next;
+				FREE(listitem);
+				listitem = fairsharelist;
+		}
+		smartshare.updated = 0;
+		pthread_mutex_unlock(&mutexsmartshare);
+}
+
 void clear_allowuserlist(void) {
 		userlist_t *user = NULL;
 		pthread_mutex_lock(&mutexallowuserlist);
@@ -215,6 +402,7 @@ void clear_allowuserlist(void) {
 				user = allowuserlist;
 		}
 		pthread_mutex_unlock(&mutexallowuserlist);
+		security_changed();
 }
 
 void clear_allowgrouplist(void) {
@@ -228,6 +416,7 @@ void clear_allowgrouplist(void) {
 				group = allowgrouplist;
 		}
 		pthread_mutex_unlock(&mutexallowgrouplist);
+		security_changed();
 }
 
 void clear_allowhostlist(void) {
@@ -241,6 +430,19 @@ void clear_allowhostlist(void) {
 				listitem = allowhostlist;
 		}
 		pthread_mutex_unlock(&mutexallowhostlist);
+		security_changed();
+}
+
+void clear_trackerlist(void) {
+		trackerlist_t *listitem = NULL;
+		pthread_mutex_lock(&mutextrackerlist);
+		listitem = trackerlist;
+		while (listitem) {
+				trackerlist = listitem->next;
+				FREE(listitem);
+				listitem = trackerlist;
+		}
+		pthread_mutex_unlock(&mutextrackerlist);
 }
 
 void clear_refuseuserlist(void) {
@@ -254,6 +456,7 @@ void clear_refuseuserlist(void) {
 				user = refuseuserlist;
 		}
 		pthread_mutex_unlock(&mutexrefuseuserlist);
+		security_changed();
 }
 
 void clear_refusegrouplist(void) {
@@ -267,6 +470,7 @@ void clear_refusegrouplist(void) {
 				group = refusegrouplist;
 		}
 		pthread_mutex_unlock(&mutexrefusegrouplist);
+		security_changed();
 }
 
 void clear_refusehostlist(void) {
@@ -280,6 +484,7 @@ void clear_refusehostlist(void) {
 				listitem = refusehostlist;
 		}
 		pthread_mutex_unlock(&mutexrefusehostlist);
+		security_changed();
 }
 
 void check_datatypes() {
@@ -296,7 +501,7 @@ void check_datatypes() {
 		if (WORDSIZE_FLOAT32 !=4) { PANIC("invalid size of FLOAT32 (%lu)", WORDSIZE_FLOAT32);  }
 		if (WORDSIZE_FLOAT64 !=8) { PANIC("invalid size of FLOAT64 (%lu)", WORDSIZE_FLOAT64);  }
 		if (sizeof(current_t)!=(416)) { PANIC("invalid size of current_t (%lu)", sizeof(current_t) );  }
-		if (sizeof(hostdef_t)!=(552+416)) { PANIC("invalid size of hostdef_t (%lu)", sizeof(hostdef_t) );  }
+		if (sizeof(hostdef_t)!=(552+416+40)) { PANIC("invalid size of hostdef_t (%lu)", sizeof(hostdef_t) );  }
 }
 
 #if defined (PLATFORM_OSX)
@@ -2,6 +2,20 @@
  * WATCHDOG is a MATLAB mex file which is used to exit Matlab
  * when the running peer process should be aborted.
  *
+ * Use as
+ *   watchdog(masterid, timallow, memallow)
+ *   watchdog(masterid, timallow, memallow, memsoft)
+ *   status = watchdog
+ *
+ * Before the time or memory is exceeded, the soft limits are passed at 90%
+ * of the allowed time and memory, or at memsoft bytes more than the current
+ * memory use. The memory that was freed is then first returned to the
+ * operating system, and if that is not sufficient a long running job can
+ * check status.soft and for example save its intermediate results or
+ * continue with less memory, instead of being killed once the hard limit
+ * is reached. The soft memory limit is also passed when the cgroup in which
+ * MATLAB runs is nearly full.
+ *
  * Copyright (C) 2010, Robert Oostenveld
  * 
  * This program is free software: you can redistribute it and/or modify
@@ -46,6 +60,9 @@ void exitFun(void) {
 		watchdog.masterid = 0;
 		watchdog.memory   = 0;
 		watchdog.time     = 0;
+		watchdog.memsoft  = 0;
+		watchdog.timsoft  = 0;
+		watchdog.soft     = 0;
 		mexPrintf("watchdog: disabled\n");
 		pthread_mutex_unlock(&mutexwatchdog);
 
@@ -84,14 +101,32 @@ void exitFun(void) {
 void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[]) {
 		int rc, enabled;
 		UINT32_T masterid = 0;
-		time_t timallow = 0;
-		UINT64_T memallow = 0;
+		time_t timallow = 0, timsoft = 0;
+		UINT64_T memallow = 0, memsoft = 0;
 		UINT64_T rss, vs;
 
 		/* this function will be called upon unloading of the mex file */
 		mexAtExit(exitFun);
 
-		if (nrhs<3)
+		if (nrhs==0) {
+				/* return the status, this allows the job to check whether it passed the soft limits */
+				const char *field[] = {"enabled", "masterid", "time", "memory", "timsoft", "memsoft", "soft", "memused"};
+				getmem(&rss, &vs);
+				plhs[0] = mxCreateStructMatrix(1, 1, 8, field);
+				pthread_mutex_lock(&mutexwatchdog);
+				mxSetFieldByNumber(plhs[0], 0, 0, mxCreateDoubleScalar(watchdog.enabled));
+				mxSetFieldByNumber(plhs[0], 0, 1, mxCreateDoubleScalar(watchdog.masterid));
+				mxSetFieldByNumber(plhs[0], 0, 2, mxCreateDoubleScalar(watchdog.time));
+				mxSetFieldByNumber(plhs[0], 0, 3, mxCreateDoubleScalar(watchdog.memory));
+				mxSetFieldByNumber(plhs[0], 0, 4, mxCreateDoubleScalar(watchdog.timsoft));
+				mxSetFieldByNumber(plhs[0], 0, 5, mxCreateDoubleScalar(watchdog.memsoft));
+				mxSetFieldByNumber(plhs[0], 0, 6, mxCreateDoubleScalar(watchdog.soft));
+				mxSetFieldByNumber(plhs[0], 0, 7, mxCreateDoubleScalar(rss));
+				pthread_mutex_unlock(&mutexwatchdog);
+				return;
+		}
+
+		if (nrhs<3 || nrhs>4)
 				mexErrMsgTxt ("invalid number of input arguments");
 
 		if (mxIsScalar(prhs[0]))
@@ -115,14 +150,21 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 		else
 				mexErrMsgTxt ("invalid input argument #3");
 
-		if (masterid!=0 || timallow!=0 || memallow!=0) {
+		if (nrhs<4 || mxIsEmpty(prhs[3]))
+				memsoft = WATCHDOG_SOFTFRACTION*memallow;
+		else if (mxIsScalar(prhs[3]))
+				memsoft = mxGetScalar(prhs[3]);
+		else
+				mexErrMsgTxt ("invalid input argument #4");
+
+		if (masterid!=0 || timallow!=0 || memallow!=0 || memsoft!=0) {
 				enabled = 1;
 				/* in this case the mex file is not allowed to be cleared from memory */
 				if (!mexIsLocked())
 						mexLock(); 
 		}
 
-		if (masterid==0 && timallow==0 && memallow==0) {
+		if (masterid==0 && timallow==0 && memallow==0 && memsoft==0) {
 				enabled = 0;
 				/* in this case the mex file is allowed to be cleared from memory */
 #ifdef SOLUTION_FOR_UNEXPLAINED_CRASH
@@ -179,13 +221,17 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 
 		if (timallow>0) {
 				/* timallow should be relative to now */
+				timsoft   = time(NULL) + WATCHDOG_SOFTFRACTION*timallow;
 				timallow += time(NULL);
 		}
 
-		if (memallow>0) {
+		if (memallow>0 || memsoft>0) {
 				/* memallow should be in absolute numbers, add the current memory footprint */
 				getmem(&rss, &vs);
-				memallow += rss;
+				if (memallow>0)
+						memallow += rss;
+				if (memsoft>0)
+						memsoft += rss;
 		}
 
 		/* enable the watchdog: the expire thread will exit if the master is not seen any more */
@@ -195,6 +241,9 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 		watchdog.masterid = masterid;
 		watchdog.memory   = memallow;
 		watchdog.time     = timallow;
+		watchdog.memsoft  = (enabled ? memsoft : 0);
+		watchdog.timsoft  = (enabled ? timsoft : 0);
+		watchdog.soft     = 0;
 		pthread_mutex_unlock(&mutexwatchdog);
 
 		if (enabled)
@@ -0,0 +1,365 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/
+ *
+ */
+
+/*
+ * A busy slave can accept a number of jobs in a queue behind the one that it
+ * is executing. This thread hands the last job of that queue over to another
+ * slave as soon as one of them announces itself as idle, so that the jobs
+ * that turn out to take long do not hold up the ones that were put after them.
+ * The job is forwarded with the hostdef of the original master, hence the
+ * results go straight back to the master.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "peer.h"
+#include "extern.h"
+#include "platform_includes.h"
+
+/* the average duration of earlier jobs with the same function, or the requested time */
+float duration_estimate(const jobdef_t *job) {
+		float duration = job->timreq;
+		durationlist_t *listitem;
+
+		pthread_mutex_lock(&mutexworksteal);
+		if (strlen(job->name)>0) {
+				listitem = durationlist;
+				while (listitem) {
+						if (strncmp(listitem->name, job->name, STRLEN)==0) {
+								duration = listitem->duration;
+								break;
+						}
+						listitem = listitem->next;
+				}
+		}
+		pthread_mutex_unlock(&mutexworksteal);
+
+		return duration;
+}
+
+/* update the average duration of the jobs with the same function */
+void duration_update(const char *name, float duration) {
+		int count = 0;
+		durationlist_t *listitem, *previous = NULL;
+
+		if (name==NULL || strlen(name)==0)
+				return;
+
+		pthread_mutex_lock(&mutexworksteal);
+
+		listitem = durationlist;
+		while (listitem) {
+				if (strncmp(listitem->name, name, STRLEN)==0)
+						break;
+				previous = listitem;
+				listitem = listitem->next;
+		}
+
+		if (listitem) {
+				/* the recent jobs weigh more, the input data of the same function can change */
+				listitem->duration = (1-DURATION_WEIGHT)*listitem->duration + DURATION_WEIGHT*duration;
+				listitem->count++;
+				/* move the item to the beginning of the list */
+				if (previous) {
+						previous->next = listitem->next;
+						listitem->next = durationlist;
+						durationlist   = listitem;
+				}
+		}
+		else if ((listitem = (durationlist_t *)malloc(sizeof(durationlist_t)))!=NULL) {
+				strncpy(listitem->name, name, STRLEN);
+				listitem->name[STRLEN-1] = 0;
+				listitem->duration = duration;
+				listitem->count    = 1;
+				/* add the item to the beginning of the list */
+				listitem->next = durationlist;
+				durationlist   = listitem;
+		}
+
+		/* only remember the functions that were used most recently */
+		listitem = durationlist;
+		while (listitem) {
+				count++;
+				if (count==DURATION_HISTORY && listitem->next) {
+						previous = listitem->next;
+						listitem->next = NULL;
+						listitem = previous;
+						while (listitem) {
+								previous = listitem->next;
+								FREE(listitem);
+								listitem = previous;
+						}
+						break;
+				}
+				listitem = listitem->next;
+		}
+
+		pthread_mutex_unlock(&mutexworksteal);
+}
+
+/* update the queue length and the backlog of the host, these are announced to the other peers */
+void worksteal_update(void) {
+		float duration;
+		UINT64_T backlog = 0;
+		UINT64_T queued  = 0;
+		time_t started;
+		joblist_t *job;
+
+		pthread_mutex_lock(&mutexworksteal);
+		started = worksteal.started;
+		pthread_mutex_unlock(&mutexworksteal);
+
+		pthread_mutex_lock(&mutexjoblist);
+		/* the first job in the list is the one that is being executed */
+		job = joblist;
+		while (job) {
+				duration = duration_estimate(job->job);
+				if (job==joblist) {
+						if (started)
+								duration -= difftime(time(NULL), started);
+						if (duration<0)
+								duration = 0;
+				}
+				else {
+						queued++;
+				}
+				backlog += (UINT64_T)(duration+0.5);
+				job = job->next;
+		}
+		pthread_mutex_unlock(&mutexjoblist);
+
+		pthread_mutex_lock(&mutexhost);
+		if (host->status==STATUS_MASTER) {
+				/* the joblist of the master contains the results */
+				backlog = 0;
+				queued  = 0;
+		}
+		host->backlog = backlog;
+		host->queued  = queued;
+		pthread_mutex_unlock(&mutexhost);
+}
+
+/* write the job to another peer, this returns 1 on success */
+int worksteal_forward(joblist_t *job, const char *ipaddr, int port, const char *socket) {
+		int server, handshake, n, success = 0;
+		FILE *fp;
+
+		if (socket && strlen(socket)>0)
+				server = open_uds_connection(socket);
+		else if (port>0)
+				server = open_tcp_connection(ipaddr, port);
+		else
+				server = -1;
+
+		if (server<0) {
+				DEBUG(LOG_ERR, "worksteal: failed to create socket");
+				return 0;
+		}
+
+		/* the message consists of the hostdef of the master, the jobdef, arg and opt, with handshakes in between */
+		/* the slave may close the connection between the message segments in case the job is refused */
+		if (bufread(server, &handshake, sizeof(int))!=sizeof(int) || !handshake)
+				goto cleanup;
+		if (bufwrite(server, job->host, sizeof(hostdef_t))!=sizeof(hostdef_t))
+				goto cleanup;
+		if (bufread(server, &handshake, sizeof(int))!=sizeof(int) || !handshake)
+				goto cleanup;
+		if (bufwrite(server, job->job, sizeof(jobdef_t))!=sizeof(jobdef_t))
+				goto cleanup;
+		if (bufread(server, &handshake, sizeof(int))!=sizeof(int) || !handshake)
+				goto cleanup;
+		if (handshake==HANDSHAKE_CACHED) {
+				/* the other slave has the arguments in its cache */
+				n = job->job->argsize;
+		}
+		else if (job->spill) {
+				/* the arguments of a queued job can be on disk, see tcpsocket */
+				if ((fp = fopen(job->spill, "rb"))==NULL)
+						goto cleanup;
+				if (handshake==HANDSHAKE_SHM)
+						n = bufwrite_shm(server, NULL, fp, job->job->argsize);
+				else
+						n = bufwrite_file(server, fp, job->job->argsize);
+				fclose(fp);
+		}
+		else if (handshake==HANDSHAKE_SHM) {
+				/* the other slave is on the same computer */
+				n = bufwrite_shm(server, job->arg, NULL, job->job->argsize);
+		}
+		else {
+				n = bufwrite(server, job->arg, job->job->argsize);
+		}
+		if (n!=job->job->argsize)
+				goto cleanup;
+		if (bufread(server, &handshake, sizeof(int))!=sizeof(int) || !handshake)
+				goto cleanup;
+		if (bufwrite(server, job->opt, job->job->optsize)!=job->job->optsize)
+				goto cleanup;
+		if (bufread(server, &handshake, sizeof(int))!=sizeof(int) || !handshake)
+				goto cleanup;
+		success = 1;
+
+cleanup:
+		close_connection(server);
+		return success;
+}
+
+void cleanup_worksteal(void *arg) {
+		DEBUG(LOG_DEBUG, "cleanup_worksteal()");
+
+		pthread_mutex_lock(&mutexstatus);
+		if (workstealStatus==0) {
+				pthread_mutex_unlock(&mutexstatus);
+				return;
+		}
+		else {
+				pthread_mutex_unlock(&mutexstatus);
+		}
+
+		/* normally this is the place where the thread cleanup is done
+		   but this thread does not require any cleanup */
+
+		pthread_mutex_lock(&mutexstatus);
+		workstealStatus = 0;
+		pthread_mutex_unlock(&mutexstatus);
+
+		pthread_mutex_lock(&mutexthreadcount);
+		threadcount--;
+		pthread_mutex_unlock(&mutexthreadcount);
+}
+
+void *workstealer(void *arg) {
+		int enabled, found, port, success;
+		UINT32_T hostid;
+		char ipaddr[INET_ADDRSTRLEN], socket[STRLEN], hostname[STRLEN];
+		joblist_t *job = NULL;
+		peerlist_t *peer = NULL;
+
+		pthread_cleanup_push(cleanup_worksteal, NULL);
+
+		/* this is for debugging */
+		pthread_mutex_lock(&mutexthreadcount);
+		threadcount++;
+		pthread_mutex_unlock(&mutexthreadcount);
+
+		/* the status contains the thread id when running, or zero when not running */
+		pthread_mutex_lock(&mutexstatus);
+		if (workstealStatus==0) {
+				workstealStatus = 1;
+				/* signal that this thread has started */
+				pthread_cond_signal(&condstatus);
+				pthread_mutex_unlock(&mutexstatus);
+		}
+		else {
+				pthread_mutex_unlock(&mutexstatus);
+				goto cleanup;
+		}
+
+		while (1) {
+
+				/* note that this is a thread cancelation point */
+				pthread_testcancel();
+
+				threadsleep(WORKSTEALSLEEP);
+
+				/* the backlog of the current job decreases while it is being executed */
+				worksteal_update();
+
+				pthread_mutex_lock(&mutexworksteal);
+				enabled = worksteal.enabled;
+				pthread_mutex_unlock(&mutexworksteal);
+
+				if (!enabled)
+						continue;
+
+				/* detach the last job from the list, the first one is being executed */
+				pthread_mutex_lock(&mutexjoblist);
+				if (joblist==NULL || joblist->next==NULL) {
+						pthread_mutex_unlock(&mutexjoblist);
+						continue;
+				}
+				job = joblisttail;
+				remove_joblist(job);
+				pthread_mutex_unlock(&mutexjoblist);
+
+				pthread_mutex_lock(&mutexhost);
+				hostid = host->id;
+				strncpy(hostname, host->name, STRLEN);
+				pthread_mutex_unlock(&mutexhost);
+
+				/* look for an idle slave that can execute the job */
+				found = 0;
+				pthread_mutex_lock(&mutexpeerlist);
+				peer = peerlist;
+				while (peer) {
+						found = 1;
+						found = found && (peer->host->id != hostid);
+						found = found && (peer->host->status == STATUS_IDLE);
+						found = found && (peer->host->memavail >= job->job->memreq);
+						found = found && (peer->host->cpuavail >= job->job->cpureq);
+						found = found && (peer->host->timavail >= job->job->timreq);
+						found = found && (peer->host->gpuavail >= job->job->gpureq);
+						found = found && (peer->host->gpumemavail >= job->job->gpumemreq);
+						if (found)
+								break;
+						peer = peer->next;
+				}
+				if (found) {
+						strncpy(ipaddr, peer->ipaddr, INET_ADDRSTRLEN);
+						port = peer->host->port;
+						/* use the UDS socket if the slave is on the same computer */
+						if (strlen(peer->host->socket)>0 && strcmp(peer->host->name, hostname)==0)
+								strncpy(socket, peer->host->socket, STRLEN);
+						else
+								socket[0] = 0;
+				}
+				pthread_mutex_unlock(&mutexpeerlist);
+
+				success = found && worksteal_forward(job, ipaddr, port, socket);
+
+				if (success) {
+						DEBUG(LOG_NOTICE, "worksteal: handed job %u from %s@%s over to %s", job->job->id, job->host->user, job->host->name, ipaddr);
+						FREE(job->job);
+						FREE(job->host);
+						FREE(job->arg);
+						FREE(job->opt);
+						FREE(job);
+				}
+				else {
+						/* put the job back at the end of the list */
+						pthread_mutex_lock(&mutexjoblist);
+						append_joblist(job);
+						pthread_mutex_unlock(&mutexjoblist);
+				}
+
+				if (success) {
+						/* inform the other peers of the shorter queue */
+						worksteal_update();
+						announce_once();
+				}
+
+		} /* while (1) */
+
+cleanup:
+		printf(""); /* otherwise the pthread_cleanup_pop won't compile */
+		pthread_cleanup_pop(1);
+		return NULL;
+}
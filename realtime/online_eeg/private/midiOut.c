@@ -22,26 +22,78 @@
  * $Id$
  **********************************************************************/
 
+#include <string.h>
 #include <portmidi.h>
 #include <porttime.h>
 #include <mex.h>
 
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+CRITICAL_SECTION scheduleMutex;
+#define SCHEDULE_INIT   InitializeCriticalSection(&scheduleMutex)
+#define SCHEDULE_LOCK   EnterCriticalSection(&scheduleMutex)
+#define SCHEDULE_UNLOCK LeaveCriticalSection(&scheduleMutex)
+#else
+#include <pthread.h>
+pthread_mutex_t scheduleMutex = PTHREAD_MUTEX_INITIALIZER;
+#define SCHEDULE_INIT
+#define SCHEDULE_LOCK   pthread_mutex_lock(&scheduleMutex)
+#define SCHEDULE_UNLOCK pthread_mutex_unlock(&scheduleMutex)
+#endif
+
 #define OUTPUT_BUFFER_SIZE 20000
+#define SCHEDULE_SIZE      20000  /* messages that are waiting for their time */
+#define SENT_BUFFER_SIZE   20000  /* the most recent scheduled messages that were sent */
+
+typedef struct {
+  PmTimestamp when;   /* the PortTime at which the message should be sent */
+  PmTimestamp sent;   /* the PortTime at which it was actually sent */
+  PmMessage   msg;
+} scheduled_t;
 
 void reportPmError(PmError err);
 
 int isInit = 0, openID = -1;
 PortMidiStream *outStream = NULL;
 
+/* these are shared with the PortTime thread and protected by the scheduleMutex */
+scheduled_t schedule[SCHEDULE_SIZE], sentList[SENT_BUFFER_SIZE];
+unsigned int numScheduled = 0, numSent = 0;
+
+/* this is called every millisecond by the PortTime thread, which has a high priority on most platforms */
+void send_scheduled(PtTimestamp ts, void *userData) {
+  unsigned int i, n = 0;
+  
+  SCHEDULE_LOCK;
+  /* the schedule is sorted, the messages that are due are at the start */
+  while (n<numScheduled && schedule[n].when<=ts) {
+    if (outStream != NULL)
+      Pm_WriteShort(outStream, 0, schedule[n].msg);
+    schedule[n].sent = Pt_Time();
+    i = numSent % SENT_BUFFER_SIZE;
+    sentList[i] = schedule[n];
+    numSent++;
+    n++;
+  }
+  if (n>0) {
+    numScheduled -= n;
+    memmove(schedule, schedule+n, numScheduled*sizeof(scheduled_t));
+  }
+  SCHEDULE_UNLOCK;
+}
+
 void exitFunction() {
   if (isInit) {
     printf("Terminating PortMidi\n");
+    /* stop the PortTime thread before the stream is closed */
+    Pt_Stop();
     if (outStream != NULL) {
       Pm_Close(outStream);
       outStream = NULL;
     }
-    Pt_Stop();
     Pm_Terminate();
+    numScheduled = 0;
+    numSent = 0;
     isInit = 0;
   }
 }
@@ -55,7 +107,9 @@ void init() {
   err = Pm_Initialize();
   reportPmError(err);
   
-  if (Pt_Start(1,NULL,NULL) == 0) {
+  /* the PortTime thread uses the mutex right away */
+  SCHEDULE_INIT;
+  if (Pt_Start(1, send_scheduled, NULL) == 0) {
     mexAtExit(exitFunction);
     isInit = 1;
   } else {
@@ -186,6 +240,65 @@ void playRaw(const mxArray *A) {
   }
 }
 
+void scheduleRaw(const mxArray *T, const mxArray *A) {
+  int N = mxGetNumberOfElements(A);
+  unsigned char *data = mxGetData(A);
+  const double *when;
+  scheduled_t item;
+  unsigned int i;
+  int n;
+  
+  if (!mxIsDouble(T)) mexErrMsgTxt("Timestamps (2nd arg.) must be a 'double' array");
+  if (!mxIsUint8(A)) mexErrMsgTxt("Messages (3rd arg.) must be of type 'uint8'");
+  if (N % 3 != 0) mexErrMsgTxt("Raw arguments must be a multiple of 3 elements long.");
+  N/=3;
+  if (N != mxGetNumberOfElements(T)) mexErrMsgTxt("There must be one timestamp for every 3 bytes of the messages");
+  when = mxGetPr(T);
+  
+  SCHEDULE_LOCK;
+  if (numScheduled + N > SCHEDULE_SIZE) {
+    SCHEDULE_UNLOCK;
+    mexErrMsgTxt("Too many scheduled messages");
+  }
+  for (n=0;n<N;n++) {
+    item.when = (PmTimestamp) when[n];
+    item.sent = 0;
+    item.msg  = Pm_Message(data[0], data[1], data[2]);
+    data+=3;
+    /* insert after the messages with the same or an earlier time, so that these keep their order */
+    i = numScheduled;
+    while (i>0 && schedule[i-1].when>item.when)
+      i--;
+    memmove(schedule+i+1, schedule+i, (numScheduled-i)*sizeof(scheduled_t));
+    schedule[i] = item;
+    numScheduled++;
+  }
+  SCHEDULE_UNLOCK;
+}
+
+mxArray *getSent() {
+  unsigned int i, j, n, first;
+  double *ptr;
+  mxArray *R;
+  
+  SCHEDULE_LOCK;
+  n = (numSent < SENT_BUFFER_SIZE ? numSent : SENT_BUFFER_SIZE);
+  first = numSent - n;
+  R = mxCreateDoubleMatrix(n, 5, mxREAL);
+  ptr = (double *)mxGetData(R);
+  for (i=0; i<n; i++) {
+    j = (first + i) % SENT_BUFFER_SIZE;
+    ptr[i + 0*n] = Pm_MessageStatus(sentList[j].msg);
+    ptr[i + 1*n] = Pm_MessageData1(sentList[j].msg);
+    ptr[i + 2*n] = Pm_MessageData2(sentList[j].msg);
+    ptr[i + 3*n] = sentList[j].when;
+    ptr[i + 4*n] = sentList[j].sent;
+  }
+  numSent = 0;
+  SCHEDULE_UNLOCK;
+  return R;
+}
+
 void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
   int code = 'L';
   PmError err;
@@ -250,12 +363,35 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
         if (err!=pmNoError) reportPmError(err);
       }
       break;
+    case 'S':	/* Schedule raw messages */
+      if (outStream == NULL) {
+        mexErrMsgTxt("No MIDI output device is opened");
+      } else {
+        if (nrhs < 3) mexErrMsgTxt("Usage for 'schedule': midiOut('S', timestamps, msg)");
+        scheduleRaw(prhs[1], prhs[2]);
+      }
+      break;
+    case 'T':	/* Current PortTime */
+      plhs[0] = mxCreateDoubleScalar(Pt_Time());
+      break;
+    case 'G':	/* Get the scheduled messages that were sent */
+      plhs[0] = getSent();
+      break;
+    case 'F':	/* Flush the scheduled messages that were not sent yet */
+      SCHEDULE_LOCK;
+      numScheduled = 0;
+      SCHEDULE_UNLOCK;
+      break;
     case 'C':   /* Close output stream */
       if (outStream == NULL) {
         mexWarnMsgTxt("No MIDI output device is opened - ignoring 'close' command");
       } else {
+        /* the scheduled messages are discarded */
+        SCHEDULE_LOCK;
+        numScheduled = 0;
         err = Pm_Close(outStream);
         outStream = NULL;
+        SCHEDULE_UNLOCK;
       }
       break;
     case 'O':	/* Open output stream */
@@ -274,17 +410,21 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
           return;
         }
         mexWarnMsgTxt("Another MIDI output device is open - closing that one");
+        SCHEDULE_LOCK;
+        numScheduled = 0;
         err = Pm_Close(outStream);
         outStream = NULL;
+        SCHEDULE_UNLOCK;
         if (err != pmNoError) reportPmError(err);
       }
       
       /* last parameter = latency = 0 means that timestamps are ignored */
+      /* the scheduled messages are timed by the PortTime thread instead */
+      SCHEDULE_LOCK;
       err = Pm_OpenOutput(&outStream, device, NULL, OUTPUT_BUFFER_SIZE, NULL, NULL, 0);
-      if (err != pmNoError) {
-        outStream = NULL;
-        reportPmError(err);
-      }
+      if (err != pmNoError) outStream = NULL;
+      SCHEDULE_UNLOCK;
+      if (err != pmNoError) reportPmError(err);
       openID = device;
     }
     break;
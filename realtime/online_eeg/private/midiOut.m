@@ -32,10 +32,31 @@ function varargout = midiOut(varargin)
 % >> midiOut(msg)
 % Send raw data. 'msg' must be of type 'uint8' and have a multiple of 3 elements.
 %
+% >> t = midiOut('T')
+% Returns the current time of the MIDI clock in miliseconds.
+%
+% >> midiOut('S', timestamps, msg)
+% Schedule raw messages to be sent at the given times of the MIDI clock.
+% 'msg' must be of type 'uint8' with 3 bytes for every timestamp. The
+% messages are sent in the order of their timestamps by a separate thread
+% that checks the schedule every milisecond, independent of MATLAB.
+%
+% >> A = midiOut('G')
+% Get the scheduled messages that were sent since the previous call. This
+% returns a matrix with 5 columns representing the status, the two data bytes,
+% the scheduled time and the time at which the message was actually sent.
+%
+% >> midiOut('F')
+% Flush the scheduled messages that were not sent yet.
+%
 % For example, play the note C4 (261.63 Hz) on the piano
 % >> midiOut('O', 2)
 % >> midiOut('+', 1, 60, 127)
 %
+% or play it for 200 ms, starting 500 ms from now
+% >> t = midiOut('T');
+% >> midiOut('S', t + [500 700], uint8([144 60 127 128 60 0]))
+%
 % See also MIDIIN
 
 % Copyright (C) 2010, Stefan Klanke
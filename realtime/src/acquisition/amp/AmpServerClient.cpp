@@ -25,6 +25,8 @@
 #include <unistd.h>
 #include <string.h>
 #include <sys/types.h>
+#include <sys/time.h>
+#include <errno.h>
 
 #include "platform_includes.h"
 #ifndef COMPILER_MINGW
@@ -40,6 +42,16 @@ AmpServerClient::AmpServerClient(struct AmpServerClientConfig * config) {
 	this->config = config;
 	this->connected = false;
 	this->rcvbuffer = NULL;
+	this->rcvsize = 0;
+	this->decoded = NULL;
+	this->receiving = false;
+	this->lastdin1 = 0;
+	this->lastdin2 = 0;
+	/* the amplifier sends big-endian data */
+	this->swapBytes = (htonl(1) != 1);
+	pthread_mutex_init(&this->dataMutex, NULL);
+	pthread_cond_init(&this->dataCond, NULL);
+	pthread_mutex_init(&this->cmdMutex, NULL);
 
 	/* Get 1 sample each every 1000/sfreq samples
 	 * cause AmpServer always sends 1000 samples per sec
@@ -55,6 +67,12 @@ AmpServerClient::~AmpServerClient() {
 	if (this->rcvbuffer != NULL) {
 		free((void*)this->rcvbuffer);
 	}
+	if (this->decoded != NULL) {
+		free((void*)this->decoded);
+	}
+	pthread_mutex_destroy(&this->dataMutex);
+	pthread_cond_destroy(&this->dataCond);
+	pthread_mutex_destroy(&this->cmdMutex);
 }
 
 bool AmpServerClient::connectClient() {
@@ -82,7 +100,6 @@ bool AmpServerClient::connectClient() {
     if (connect(this->strsockfd,(struct sockaddr *) &serv_addr,sizeof(serv_addr)) < 0)
         error("ERROR connecting");
 
-    this->strstreamin = fdopen(this->strsockfd, "r");
     this->strstreamout = fdopen(this->strsockfd, "w");
 
 
@@ -95,15 +112,22 @@ bool AmpServerClient::connectClient() {
 	getAmpId();
 
 	getAmpDetails();
+	if (AMP_SAMP_HEADER + this->nchannels*sizeof(int32_t) > AMP_SAMP_SIZE) {
+		error("ERROR too many channels for the packet format");
+	}
 
 	this->rcvbuffer = (char*)malloc(RCV_BUFFER_SIZE);
 	if (this->rcvbuffer == NULL) error("ERROR not enough memory for receive buffer");
+	this->rcvsize = RCV_BUFFER_SIZE;
+	this->decoded = (int32_t*)malloc(DECODED_SAMPLES*this->nchannels*sizeof(int32_t));
+	if (this->decoded == NULL) error("ERROR not enough memory for decoded samples");
 	DPRINTF("Receive buffer at %p\n", this->rcvbuffer);
 	memset(r_buffer, 0, COMMAND_SIZE);
 
 
 	sendCommand("SetDecimatedRate", 0, 0, this->config->sfreq);
 
+	this->connected = true;
 	return true;
 }
 
@@ -112,7 +136,10 @@ int AmpServerClient::getSubsample() {
 }
 
 void AmpServerClient::disconnectClient() {
-	close(this->strsockfd);
+	if (this->receiving) {
+		this->stop();
+	}
+	fclose(this->strstreamout); // this also closes strsockfd
 	close(this->cmdsockfd);
 	this->connected = false;
 
@@ -122,11 +149,28 @@ void AmpServerClient::start() {
 	sendCommand("Start", this->ampId, 0, 0);
 	sendCommand("DefaultAcquisitionState", 0, 0, 0);
 	sendStrCommand("ListenToAmp", this->ampId, 0, 0);
+
+	this->decodedHead = 0;
+	this->decodedTail = 0;
+	this->dinEvents.clear();
+	this->stopReceiving = false;
+	if (pthread_create(&this->rcvThread, NULL, receiveThread, this)) {
+		error("ERROR starting the receive thread");
+	}
+	this->receiving = true;
 	usleep(3000);
 }
 
 void AmpServerClient::stop() {
 	sendStrCommand("StopListeningToAmp", this->ampId, 0, 0);
+	if (this->receiving) {
+		pthread_mutex_lock(&this->dataMutex);
+		this->stopReceiving = true;
+		pthread_cond_broadcast(&this->dataCond);
+		pthread_mutex_unlock(&this->dataMutex);
+		pthread_join(this->rcvThread, NULL);
+		this->receiving = false;
+	}
 	sendCommand("Stop", this->ampId, 0, 0);
 	sendCommand("DefaultAcquisitionState", 0, 0, 0);
 	sendCommand("SetPower", this->ampId, 0, 0);
@@ -138,29 +182,42 @@ void AmpServerClient::error(std::string msg) {
 }
 
 void AmpServerClient::sendCommand(std::string cmd, int param1, int param2, int param3) {
+	pthread_mutex_lock(&this->cmdMutex);
+	sendCommandLocked(cmd, param1, param2, param3);
+	pthread_mutex_unlock(&this->cmdMutex);
+}
+
+/* sends a command and reads the response into r_buffer, cmdMutex should be locked */
+void AmpServerClient::sendCommandLocked(std::string cmd, int param1, int param2, int param3) {
 	DPRINTF("Sending command %s\n", cmd.c_str());
-	int n;
+	int n, l = 0;
 	this->prepareCommand(cmd, param1, param2, param3);
 	DPRINTF("Sending command %s => %s", cmd.c_str(), this->s_buffer);
 	n = write(this->cmdsockfd, this->s_buffer, strlen(this->s_buffer));
 	if (n < 0)
 		error("ERROR writing to socket");
 
-	fsync(this->strsockfd);
-
-	/*do {
-		n = read(this->cmdsockfd, &r_buffer[l], 1);
-		if (n > 0) {
-			l++;
+	/* the response is a single line, which can arrive in more than one piece */
+	do {
+		n = read(this->cmdsockfd, &r_buffer[l], COMMAND_SIZE - 1 - l);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			error("ERROR reading response");
 		}
-	} while (n == 0 || n > 0 && r_buffer[l-1] != '\0' && r_buffer[l-1] != '\n');
-	r_buffer[l>1?l-1:l]='\0';*/
-	n = read(this->cmdsockfd, r_buffer, COMMAND_SIZE);
-	if (n < 0) {
-		error("ERROR reading response");
-	}
-	r_buffer[n>1?n-1:0] = '\0';
-	DPRINTF("Received %d bytes in buffer\nContent >>>\n%s \n<<< End Content\n", n, r_buffer);
+		l += n;
+	} while (n > 0 && l < COMMAND_SIZE - 1 && r_buffer[l-1] != '\n' && r_buffer[l-1] != '\0');
+	r_buffer[l>1?l-1:0] = '\0';
+	DPRINTF("Received %d bytes in buffer\nContent >>>\n%s \n<<< End Content\n", l, r_buffer);
+}
+
+/* sends a command and parses one value of the response, without another thread getting in between */
+bool AmpServerClient::queryInt(std::string cmd, int param1, std::string param, unsigned int* result) {
+	bool ok;
+	pthread_mutex_lock(&this->cmdMutex);
+	sendCommandLocked(cmd, param1, 0, 0);
+	ok = getResponseInt(param, result);
+	pthread_mutex_unlock(&this->cmdMutex);
+	return ok;
 }
 
 
@@ -168,6 +225,7 @@ void AmpServerClient::sendStrCommand(std::string cmd, int param1, int param2, in
 	DPRINTF("Sending stream command %s\n", cmd.c_str());
 
 	int n;
+	pthread_mutex_lock(&this->cmdMutex);
 	this->prepareCommand(cmd, param1, param2, param3);
 	DPRINTF("Sending command %s => %s", cmd.c_str(), this->s_buffer);
 	n = fwrite(this->s_buffer, sizeof(char), strlen(this->s_buffer), this->strstreamout);
@@ -175,14 +233,13 @@ void AmpServerClient::sendStrCommand(std::string cmd, int param1, int param2, in
 		error("ERROR writing to socket");
 
 	fflush(this->strstreamout);
+	pthread_mutex_unlock(&this->cmdMutex);
 
 }
 
 void AmpServerClient::getAmpId() {
 	DPRINTF("Getting number of amps\n");
-	sendCommand("NumberOfAmps", 0, 0, 0);
-
-	if (! getResponseInt("number_of_amps", &this->nAmp)) {
+	if (! queryInt("NumberOfAmps", 0, "number_of_amps", &this->nAmp)) {
 		error("ERROR Cannot get number of amps");
 	}
 
@@ -193,8 +250,7 @@ void AmpServerClient::getAmpId() {
 
 void AmpServerClient::getAmpDetails() {
 	DPRINTF("Getting details of amp\n");
-	sendCommand("GetAmpDetails", this->ampId, 0, 0);
-	if (! getResponseInt("number_of_channels", &this->nchannels)) {
+	if (! queryInt("GetAmpDetails", this->ampId, "number_of_channels", &this->nchannels)) {
 		error("ERROR Cannot get number of channels");
 	}
 	this->nchannels += AMP_ANALOG_CHANNELS;
@@ -207,95 +263,163 @@ int AmpServerClient::getNumChannels() {
 int AmpServerClient::getSamplingFreq() {
 	return config->sfreq;
 }
-unsigned int AmpServerClient::checkNewData() {
-	//DPRINTF("Checking for new data\n");
-	if (fread((char *)&(this->ampDataPacketHeader), sizeof(AmpDataPacketHeader), 1, this->strstreamin) == 1) {
-		this->toHostOrder((char*)&(this->ampDataPacketHeader), 2);
-		//DPRINTF("New data from amp %lu (%lu bytes %lu samples)\n", \
-			this->ampDataPacketHeader.ampId, this->ampDataPacketHeader.length, this->ampDataPacketHeader.length/AMP_SAMP_SIZE);
-		return this->ampDataPacketHeader.length/AMP_SAMP_SIZE;
+unsigned int AmpServerClient::checkNewData(int timeout) {
+	unsigned int available;
+	pthread_mutex_lock(&this->dataMutex);
+	available = this->decodedHead - this->decodedTail;
+	if (available == 0 && timeout > 0) {
+		struct timeval now;
+		struct timespec until;
+		gettimeofday(&now, NULL);
+		until.tv_sec  = now.tv_sec + timeout/1000;
+		until.tv_nsec = (now.tv_usec + (timeout%1000)*1000)*1000;
+		if (until.tv_nsec >= 1000000000) {
+			until.tv_sec++;
+			until.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&this->dataCond, &this->dataMutex, &until);
+		available = this->decodedHead - this->decodedTail;
 	}
-	return 0;
+	pthread_mutex_unlock(&this->dataMutex);
+	return available;
 }
 
-unsigned int AmpServerClient::readNewData(int32_t * ptr, unsigned int topass, FtEventList elist) {
-	//DPRINTF("Reading new data\n");
-	uint64_t size = this->ampDataPacketHeader.length;
-	size_t readed;
-	unsigned int retorno = 0;
-	unsigned int vsamp = 0;
-	unsigned int rsamp = 0;
-	unsigned int pcount = topass;
-	unsigned int startsamp = this->nsamples;
-	while (startsamp % this->subsample != 0) {
-		startsamp++;
-		rsamp++;
+unsigned int AmpServerClient::readNewData(int32_t * ptr, unsigned int topass, FtEventList &elist) {
+	unsigned int tail, n, first, n1, k;
+
+	pthread_mutex_lock(&this->dataMutex);
+	tail = this->decodedTail;
+	n = this->decodedHead - tail;
+	if (n > topass) n = topass;
+	for (k = 0; k < this->dinEvents.size() && this->dinEvents[k].sample - tail < n; k++) {
+		elist.add(this->dinEvents[k].sample - tail, this->dinEvents[k].type, this->dinEvents[k].value);
 	}
-	unsigned char din1;
-	unsigned char din2;
-	if (size > 0) {
-		if ((readed = fread(this->rcvbuffer, size, 1, this->strstreamin)) > 0) {
-			//~ DPRINTF("Got %lu bytes (%lu samples) starting at sample %d\n", size, size/AMP_SAMP_SIZE, rsamp);
-			while (rsamp < size/AMP_SAMP_SIZE && pcount > 0) {
-				//DPRINTF("Processing real sample %d (v sample %d)\n", rsamp, vsamp);
-				int offset = (rsamp * AMP_SAMP_SIZE);
-				din1 = decodeDin(this->rcvbuffer[offset+24]);
-				din2 = decodeDin(this->rcvbuffer[offset+25]);
-				if (this->lastdin1 != din1) {
-					elist.add(vsamp, "DIN1", din1);
-					this->lastdin1 = din1;
-				}
-				if (this->lastdin2 != din2) {
-					elist.add(vsamp, "DIN2", din2);
-					this->lastdin2 = din2;
-				}
-				offset+= 32;
-				for (unsigned int chan = 0; chan < this->nchannels; chan++) {
-					//~ DPRINTF("Processing channel %d\n", chan);
-					int32_t * p = reinterpret_cast<int32_t*>( this->rcvbuffer + offset);
-					*p = ntohl( *p );
-					ptr[vsamp * this->nchannels + chan] = *p;
-					offset += sizeof(int);
-
-				}
-				vsamp++;
-				rsamp += this->subsample;
-				pcount --;
+	this->dinEvents.erase(this->dinEvents.begin(), this->dinEvents.begin() + k);
+	pthread_mutex_unlock(&this->dataMutex);
+
+	/* the receive thread does not touch these samples until decodedTail is increased */
+	first = tail % DECODED_SAMPLES;
+	n1 = DECODED_SAMPLES - first;
+	if (n1 > n) n1 = n;
+	memcpy(ptr, this->decoded + first*this->nchannels, n1*this->nchannels*sizeof(int32_t));
+	memcpy(ptr + n1*this->nchannels, this->decoded, (n-n1)*this->nchannels*sizeof(int32_t));
+
+	pthread_mutex_lock(&this->dataMutex);
+	this->decodedTail = tail + n;
+	pthread_cond_broadcast(&this->dataCond);
+	pthread_mutex_unlock(&this->dataMutex);
+	return n;
+}
+
+void *AmpServerClient::receiveThread(void *arg) {
+	AmpServerClient *client = (AmpServerClient *) arg;
+	while (!client->stopReceiving) {
+		if (!client->receivePacket()) {
+			if (!client->stopReceiving) {
+				fprintf(stderr, "Lost the stream of the AmpServer\n");
 			}
-			this->nsamples += size/AMP_SAMP_SIZE;
-			retorno = vsamp;
-		} else {
-			DPRINTF("Nothing to read! (%lu of %lu)\n", readed, size)
+			break;
 		}
-
 	}
+	return NULL;
+}
 
-	return retorno;
+/* reads len bytes from the stream port, returns false on errors or when the client stops */
+bool AmpServerClient::readFully(char *buf, size_t len) {
+	while (len > 0) {
+		fd_set readSet;
+		struct timeval tv;
+		int n;
+
+		FD_ZERO(&readSet);
+		FD_SET(this->strsockfd, &readSet);
+		tv.tv_sec  = 0;
+		tv.tv_usec = 100000;
+		n = select(this->strsockfd + 1, &readSet, NULL, NULL, &tv);
+		if (this->stopReceiving) return false;
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) return false;
+		if (n == 0) continue;
+
+		n = recv(this->strsockfd, buf, len, 0);
+		if (n <= 0) return false;
+		buf += n;
+		len -= n;
+	}
+	return true;
 }
 
+bool AmpServerClient::receivePacket() {
+	if (!readFully((char *)&(this->ampDataPacketHeader), sizeof(AmpDataPacketHeader))) return false;
+	/* both fields are 64 bit big-endian */
+	if (this->swapBytes) ft_swap64(2, &(this->ampDataPacketHeader));
 
-inline void AmpServerClient::toHostOrder(char *data, int len) {
-	int32_t *tmpData = reinterpret_cast<int32_t *>(data);
-	int location;
-	int32_t tmpValue;
-	for(int i=0;i<len; i++) {
-		location = i*2;
-		tmpValue = -1;
-		tmpData[location] =ntohl(tmpData[location]);
-		tmpData[location+1] =ntohl(tmpData[location+1]);
-		tmpValue = tmpData[location];
-		tmpData[location] = tmpData[location+1];
-		tmpData[location+1] = tmpValue;
+	uint64_t size = this->ampDataPacketHeader.length;
+	if (size > this->rcvsize) {
+		char *buf = (char*)realloc(this->rcvbuffer, size);
+		if (buf == NULL) {
+			fprintf(stderr, "Not enough memory for a packet of %lu bytes\n", (unsigned long) size);
+			return false;
+		}
+		this->rcvbuffer = buf;
+		this->rcvsize = size;
 	}
+	if (!readFully(this->rcvbuffer, size)) return false;
+	decodePacket(size/AMP_SAMP_SIZE);
+	return true;
 }
 
+/* converts the samples of the packet in rcvbuffer to host order, keeping one in every subsample */
+void AmpServerClient::decodePacket(unsigned int nsamp) {
+	unsigned int rsamp = (this->subsample - this->nsamples % this->subsample) % this->subsample;
+	unsigned int room, head, n;
+
+	this->nsamples += nsamp;
+	while (rsamp < nsamp) {
+		pthread_mutex_lock(&this->dataMutex);
+		while ((room = DECODED_SAMPLES - (this->decodedHead - this->decodedTail)) == 0 && !this->stopReceiving) {
+			pthread_cond_wait(&this->dataCond, &this->dataMutex);
+		}
+		head = this->decodedHead;
+		pthread_mutex_unlock(&this->dataMutex);
+		if (room == 0) return;
+
+		for (n = 0; rsamp < nsamp && n < room; n++, rsamp += this->subsample) {
+			const char *src = this->rcvbuffer + rsamp*AMP_SAMP_SIZE;
+			int32_t *dest = this->decoded + ((head + n) % DECODED_SAMPLES)*this->nchannels;
+			unsigned char din1 = decodeDin(src[24]);
+			unsigned char din2 = decodeDin(src[25]);
+			if (this->lastdin1 != din1) {
+				AmpDinEvent E = {head + n, "DIN1", din1};
+				this->newEvents.push_back(E);
+				this->lastdin1 = din1;
+			}
+			if (this->lastdin2 != din2) {
+				AmpDinEvent E = {head + n, "DIN2", din2};
+				this->newEvents.push_back(E);
+				this->lastdin2 = din2;
+			}
+			if (this->swapBytes) {
+				ft_swap_copy32(this->nchannels, dest, src + AMP_SAMP_HEADER);
+			} else {
+				memcpy(dest, src + AMP_SAMP_HEADER, this->nchannels*sizeof(int32_t));
+			}
+		}
+
+		pthread_mutex_lock(&this->dataMutex);
+		this->decodedHead = head + n;
+		this->dinEvents.insert(this->dinEvents.end(), this->newEvents.begin(), this->newEvents.end());
+		pthread_cond_broadcast(&this->dataCond);
+		pthread_mutex_unlock(&this->dataMutex);
+		this->newEvents.clear();
+	}
+}
 
 
 int AmpServerClient::getCurrentTime() {
 	unsigned int result;
 	DPRINTF("Getting current time\n");
-	sendCommand("GetCurrentTime", this->ampId, 0, 0);
-	if (! getResponseInt("current_time", &result)) {
+	if (! queryInt("GetCurrentTime", this->ampId, "current_time", &result)) {
 		error("ERROR Cannot get current time");
 	}
 	return result;
@@ -24,7 +24,9 @@
 #define __AMP_SERVER_CLIENT_H__
 
 #include <string>
+#include <vector>
 #include <stdint.h>
+#include <pthread.h>
 #include <OnlineDataManager.h>
 #include <FtBuffer.h>
 
@@ -50,6 +52,8 @@ typedef struct {
 #define AMP_ANALOG_CHANNELS_OFFSET 0
 #define AMP_ANALOG_CHANNELS 8
 #define AMP_CONSTANT_RATE 1000
+#define AMP_SAMP_HEADER 32 // bytes before the channels of each sample, with the DINs at 24 and 25
+#define DECODED_SAMPLES 8192 // decoded samples that can wait for the acquisition loop
 
 #ifdef DEBUG
 	#define PREFIX "DEBUG::%s:%d "
@@ -60,6 +64,21 @@ typedef struct {
 
 #define COMMAND_FORMAT "(sendCommand cmd_%s %d %d %d)\n"
 
+/* A change of one of the DINs, at the sample number counted by the receive thread */
+struct AmpDinEvent {
+	unsigned int	sample;
+	const char *	type;
+	unsigned char	value;
+};
+
+/*
+ * The packets of the stream port are read, byte swapped and subsampled by a
+ * separate receive thread, which keeps the decoded samples in a ring until
+ * readNewData() copies them. The commands go over the command port under
+ * their own lock, so they can be sent by any thread without stalling the
+ * stream.
+ */
+
 class AmpServerClient {
 	public:
 		AmpServerClient(struct AmpServerClientConfig * config);
@@ -86,17 +105,15 @@ class AmpServerClient {
 
 		int	getCurrentTime();
 
-		unsigned int checkNewData();
-		unsigned int readNewData(int32_t * ptr, unsigned int topass, FtEventList elist);
-
-		inline void toHostOrder(char *data, int len);
+		/* returns the number of decoded samples, waits at most timeout ms if there are none */
+		unsigned int checkNewData(int timeout = 0);
+		unsigned int readNewData(int32_t * ptr, unsigned int topass, FtEventList &elist);
 
 	private:
 		struct 	AmpServerClientConfig * config;
 		AmpDataPacketHeader	ampDataPacketHeader;
 		int 			cmdsockfd;
 		int 			strsockfd;
-		FILE*			strstreamin;
 		FILE*			strstreamout;
 		bool 			connected;
 		char *	 		rcvbuffer;
@@ -107,10 +124,31 @@ class AmpServerClient {
 		unsigned int	nchannels;
 		int				lastdin1;
 		int				lastdin2;
+		size_t			rcvsize;
 		void 			prepareCommand(std::string cmd, int param1, int param2, int param3);
+		void			sendCommandLocked(std::string cmd, int param1, int param2, int param3);
+		bool			queryInt(std::string cmd, int param1, std::string param, unsigned int* result);
 		unsigned char	decodeDin(unsigned char din);
 		unsigned int	subsample;
 		unsigned int 	nsamples;
+
+		/* receive thread and the ring of decoded samples */
+		static void *	receiveThread(void *arg);
+		bool			readFully(char *buf, size_t len);
+		bool			receivePacket();
+		void			decodePacket(unsigned int nsamp);
+		pthread_t		rcvThread;
+		bool			receiving;
+		volatile bool	stopReceiving;
+		pthread_mutex_t	dataMutex;
+		pthread_cond_t	dataCond;
+		pthread_mutex_t	cmdMutex;
+		int32_t *		decoded;
+		unsigned int	decodedHead;	// written by the receive thread
+		unsigned int	decodedTail;	// written by readNewData
+		std::vector<AmpDinEvent> dinEvents;
+		std::vector<AmpDinEvent> newEvents;	// only used by the receive thread
+		bool			swapBytes;
 };
 
 
@@ -129,32 +129,18 @@ void acquisition(AmpServerClient& client, int numHwChan, int fSample) {
 			}
 		}
 		ctrlServ.checkRequests(ODM);
-		int readed;
-		char * ptr;
-		int subsample = client.getSubsample();
-		if ((readed = client.checkNewData()) > 0) {
-			int topass = readed/subsample;
-			int passed = 0;
-			if ((readed+sampleCounter) % subsample < sampleCounter % subsample) {
-				topass++;
+		// the receive thread of the client has already decoded and subsampled the packets
+		unsigned int topass = client.checkNewData(10);
+		if (topass > 0) {
+			int32_t *ptr = ODM.provideBlock(topass);
+			if (ptr == NULL) {
+				fprintf(stderr, "Out of memory\n");
+				break;
 			}
-			if (topass > 0) {
-				ptr = (char*)ODM.provideBlock(topass);
-				if (ptr == NULL) {
-					fprintf(stderr, "Out of memory\n");
-					break;
-				}
-			}
-			passed = client.readNewData((int32_t*)ptr, topass, ODM.getEventList());
-			if (passed > 0) {
-				if (!ODM.handleBlock()) break;
-			}
-
-			if (passed != topass) {DPRINTF("WTF\n");}
-
+			int passed = client.readNewData(ptr, topass, ODM.getEventList());
+			if (!ODM.handleBlock()) break;
 			sampleCounter += passed;
 		}
-		usleep(10);
 	}
 
 	 client.stop();
@@ -1,48 +1,96 @@
 /*
  * Acquisition tool to stream audio signals to a FieldTrip buffer,
  * based on PortAudio for grabbing the data from the sound card.
+ *
+ * The PortAudio callback only copies the frames into a ring that is
+ * allocated beforehand and needs no locks, the streaming thread takes
+ * them from there and hands them to the OnlineDataManager.
  * 	
  * (C) 2010 S. Klanke
 */
 
 #include <portaudio.h>
 #include <stdio.h>
+#include <pthread.h>
 #include <OnlineDataManager.h>
 #include <ConsoleInput.h>
 #include <StringServer.h>
 
 #define FSAMPLE 44100.0
+#define RING_SECONDS  2.0          // length of the ring between callback and streaming thread
+#define STREAM_SLEEP  2000000      // ns the streaming thread waits when the ring is empty
 
 PaStream *stream = NULL;
 int numInputs = 0;
+double fSample = FSAMPLE;
 OnlineDataManager<float, float> *ODM = 0;
-long numTotal = 0;
 
+/* Ring of frames that is filled by the callback and emptied by the streaming thread */
+float *ring = NULL;
+UINT32_T ringFrames = 0;
+volatile UINT32_T ringHead = 0;   // number of frames written, only changed by the callback
+volatile UINT32_T ringTail = 0;   // number of frames streamed, only changed by the streaming thread
+volatile unsigned int numOverruns = 0;    // callbacks whose frames did not fit into the ring
+volatile unsigned int numOverflows = 0;   // callbacks for which PortAudio reported an input overflow
+volatile int keepStreaming = 0;
+volatile int streamError = 0;
 
+
+/* Nothing in here may allocate memory or block, this is called from the audio thread */
 static int audioCallback(const void *input, void *output, unsigned long frameCount, 
                   const PaStreamCallbackTimeInfo *timeInfo, PaStreamCallbackFlags statusFlags,
                   void *userData) {
-				  
-	
-	if (ODM==0) return paAbort;
-	
-	float *block = ODM->provideBlock(frameCount);
-	if (block == 0) {
-		fprintf(stderr, "Out of memory\n");
-		return paAbort;
+	UINT32_T head = ringHead;
+
+	if (statusFlags & paInputOverflow) numOverflows++;
+	if (input == NULL) return paContinue;
+
+	if (frameCount > ringFrames - (head - ringTail)) {
+		// the streaming thread does not keep up, the frames are lost
+		numOverruns++;
+		return paContinue;
 	}
-	memcpy(block, input, frameCount * numInputs * sizeof(float));
-		
-	if (!ODM->handleBlock()) {
-		fprintf(stderr, "Error in handling this data block - stopping\n");
-		return paAbort;
+
+	// copy in at most two pieces, up to the end of the ring and from its start
+	UINT32_T pos = head % ringFrames;
+	UINT32_T n1  = (frameCount < ringFrames - pos) ? frameCount : ringFrames - pos;
+	memcpy(ring + pos*numInputs, input, n1 * numInputs * sizeof(float));
+	if (n1 < frameCount) {
+		memcpy(ring, (const float *) input + n1*numInputs, (frameCount - n1) * numInputs * sizeof(float));
 	}
-	numTotal += frameCount;
-	printf("%4lu / %8lu\r", frameCount, numTotal);
+	MEMORY_BARRIER(); // the frames are complete before the streaming thread can see them
+	ringHead = head + frameCount;
 	return paContinue;
 }
 
 
+/* Hands the frames in the ring to the OnlineDataManager, which converts, filters and streams them */
+void *streamingThread(void *arg) {
+	while (keepStreaming) {
+		UINT32_T tail = ringTail;
+		UINT32_T avail = ringHead - tail;
+
+		if (avail == 0) {
+			ft_clock_sleep(STREAM_SLEEP);
+			continue;
+		}
+		MEMORY_BARRIER(); // read the frames only after seeing the head
+
+		// the samples are passed where they are, also if they wrap around the end of the ring
+		ODM->provideView(avail);
+		if (!ODM->handleView(ring, ringFrames * numInputs, (tail % ringFrames) * numInputs, numInputs)) {
+			fprintf(stderr, "Error in handling this data block - stopping\n");
+			streamError = 1;
+			break;
+		}
+
+		MEMORY_BARRIER(); // done with the frames before the tail
+		ringTail = tail + avail;
+	}
+	return NULL;
+}
+
+
 int listDevices() {
 	int numInputDevs = 0;
 	
@@ -91,7 +139,7 @@ int openDevice(int nr) {
 	parIn.suggestedLatency = 0.0;
 	parIn.hostApiSpecificStreamInfo = NULL;
 
-	PaError err = Pa_OpenStream(&stream, &parIn, NULL, FSAMPLE, 0, paNoFlag, audioCallback, NULL);
+	PaError err = Pa_OpenStream(&stream, &parIn, NULL, fSample, paFramesPerBufferUnspecified, paNoFlag, audioCallback, NULL);
 	if (err != paNoError) return 0;
 	
 	const PaStreamInfo *info = Pa_GetStreamInfo(stream);
@@ -106,7 +154,9 @@ int main(int argc, char *argv[]) {
 	ConsoleInput conIn;
 	char hostname[256] = "localhost";
 	int port = 1972;
-   int device;
+	int device;
+	pthread_t streamThread;
+	unsigned int overrunsReported = 0, overflowsReported = 0;
 	
 	err = Pa_Initialize();
 	if( err != paNoError ) {
@@ -116,24 +166,36 @@ int main(int argc, char *argv[]) {
 	
 	if (argc<2) {
 		listDevices();
-		printf("\nUsage: audio2ft deviceNr [hostname [port]]\n");
+		printf("\nUsage: audio2ft deviceNr [hostname [port [fsample]]]\n");
 		printf("The 2nd parameter (device number) must be one of the numbers listed above.\n");
 		goto cleanup;
 	}
 	
-	device = atoi(argv[1]);
-	if (!openDevice(device)) {
-		goto cleanup;
-	}
-	
 	if (argc>2) {
 		strncpy(hostname, argv[2], sizeof(hostname));
 	}
 	if (argc>3) {
 		port = atoi(argv[3]);
 	}
+	if (argc>4) {
+		fSample = atof(argv[4]);
+		if (fSample <= 0) {
+			fprintf(stderr, "Invalid sampling rate %s\n", argv[4]);
+			goto cleanup;
+		}
+	}
+	
+	device = atoi(argv[1]);
+	if (!openDevice(device)) {
+		goto cleanup;
+	}
+	
+	// a power of two, so that the positions stay valid when the counters wrap around
+	ringFrames = 1024;
+	while (ringFrames < RING_SECONDS * fSample) ringFrames *= 2;
+	ring = new float[ringFrames * numInputs];
 	
-	ODM = new OnlineDataManager<float, float>(0, numInputs, FSAMPLE, FSAMPLE);
+	ODM = new OnlineDataManager<float, float>(0, numInputs, fSample, fSample);
 	
 	if (0==strcmp(hostname, "-")) {
 		if (!ODM->useOwnServer(port)) {
@@ -154,6 +216,13 @@ int main(int argc, char *argv[]) {
 
 	ODM->enableStreaming();
 	
+	keepStreaming = 1;
+	if (pthread_create(&streamThread, NULL, streamingThread, NULL)) {
+		fprintf(stderr, "Could not spawn streaming thread.\n");
+		keepStreaming = 0;
+		goto cleanup;
+	}
+	
 	err = Pa_StartStream(stream);
 	if (err != paNoError) {
 		fprintf(stderr, "Could not start stream\n");
@@ -161,11 +230,21 @@ int main(int argc, char *argv[]) {
 	}
 	
 	printf("Starting - press ESC to quit\n");
-	while (1) {
+	while (!streamError) {
 		if (conIn.checkKey()) {
 			int c = conIn.getKey();
 			if (c==27) break; // quit
 		}
+		// the callback only counts the problems, they are reported from here
+		if (numOverruns != overrunsReported) {
+			overrunsReported = numOverruns;
+			fprintf(stderr, "\nWarning: the ring was full, %u blocks of audio have been dropped\n", overrunsReported);
+		}
+		if (numOverflows != overflowsReported) {
+			overflowsReported = numOverflows;
+			fprintf(stderr, "\nWarning: PortAudio reported %u input overflows\n", overflowsReported);
+		}
+		printf("%8u frames in ring / %10u streamed\r", ringHead - ringTail, ringTail);
 		conIn.milliSleep(100);
 	}
 	
@@ -174,8 +253,13 @@ cleanup:
 		err = Pa_StopStream(stream);   
 		err = Pa_CloseStream(stream);
 	}
+	if (keepStreaming) {
+		keepStreaming = 0;
+		pthread_join(streamThread, NULL);
+	}
 	err = Pa_Terminate();
 	delete ODM;
+	delete[] ring;
 	return 0;
 }
 
@@ -213,6 +213,7 @@ bool BioSemiClient::openDevice() {
 
 	lastPointerRead  = 0;
 	lastStartPtr  = 0;
+	lastBlockTime = getCurrentTime();
 	deviceOpen = true;
 	/*
 	for (int i=0;i<pointer;i+=4) {
@@ -300,6 +301,24 @@ bool BioSemiClient::checkNewBlock(BioSemiBlock &block) {
 	
 	lastPointerRead = pointer;
 	lastStartPtr = nextStartPtr;
+	lastBlockTime = getCurrentTime();
 	return true;
 }
 
+/** Sleeps until about numSamples new samples can be expected, judging from the
+	sampling rate and the time at which the last block came in. If they are late
+	already, it sleeps for a quarter of that time, so that the polling follows the
+	rate at which the USB driver actually delivers the samples.
+*/
+void BioSemiClient::waitForSamples(int numSamples) {
+	double interval = (double) numSamples / sampleFreq;
+	double wait = lastBlockTime + interval - getCurrentTime();
+	
+	if (wait < 0.25*interval) wait = 0.25*interval;
+	#ifdef WIN32
+	Sleep((DWORD) (wait*1000.0 + 0.5));
+	#else
+	usleep((useconds_t) (wait*1e6));
+	#endif
+}
+
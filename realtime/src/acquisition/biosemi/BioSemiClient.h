@@ -38,6 +38,7 @@ class BioSemiClient {
 	int  getCurPointer()  ;
 	
 	bool checkNewBlock(BioSemiBlock &block);
+	void waitForSamples(int numSamples);
 	
 	void msleep(int millis) const {
 		#ifdef WIN32
@@ -52,6 +53,11 @@ class BioSemiClient {
 	    return ringBuffer[index & (BUFFER_LEN-1)]; //  ? index - BUFFER_LEN : index];
 	}	
 	
+	// changes a value that has already been read, e.g. the status word
+	void setValue(int index, int value) {
+	    ringBuffer[index & (BUFFER_LEN-1)] = value;
+	}
+	
 	double getCurrentTime() {
 		#ifdef WIN32
 		return timeGetTime() * 0.001;
@@ -82,6 +88,7 @@ class BioSemiClient {
 	int stride;
 	int lastPointerRead;
 	int lastStartPtr;
+	double lastBlockTime;
 	
 	OPEN_DRIVER_ASYNC_T    lv_open_driver_async;
 	USB_WRITE_T            lv_usb_write;
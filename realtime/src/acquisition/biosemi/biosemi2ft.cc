@@ -34,6 +34,9 @@ void acquisition(BioSemiClient& BS, int numHwChan, int fSample, int fSampleSavin
 	OnlineDataManager<int, float> ODM(1, numHwChan, (float) fSample, (float) fSampleSaving);
 	// just for reporting: print current time relative to time when we started this
 	double T0 = BS.getCurrentTime();
+	// poll the driver about every 2 ms worth of samples
+	int pollSamples = fSample / 500;
+	if (pollSamples < 1) pollSamples = 1;
 	
 	if (ODM.configureFromFile(cfgname) != 0) {
 		fprintf(stderr, "Configuration file is invalid\n");
@@ -70,7 +73,6 @@ void acquisition(BioSemiClient& BS, int numHwChan, int fSample, int fSampleSavin
 	
 	while (1) {
 		BioSemiBlock block;
-		int *ptr;
 		const SignalConfiguration& config = ODM.getSignalConfiguration();
 		double batt = 0.0;
 		if (conIn.checkKey()) {
@@ -96,7 +98,7 @@ void acquisition(BioSemiClient& BS, int numHwChan, int fSample, int fSampleSavin
 		ctrlServ.checkRequests(ODM);
 		
 		if (!BS.checkNewBlock(block)) {
-			BS.msleep(1);
+			BS.waitForSamples(pollSamples);
 			continue;
 		}
 		
@@ -113,11 +115,8 @@ void acquisition(BioSemiClient& BS, int numHwChan, int fSample, int fSampleSavin
 			break;
 		}
 		
-		ptr = ODM.provideBlock(block.numSamples);
-		if (ptr == NULL) {
-			fprintf(stderr, "Out of memory\n");
-			break;
-		}
+		// the samples are read from the ring buffer of the driver by the ODM, see handleView below
+		ODM.provideView(block.numSamples);
 		
 		if (nsBattery >= 0) {
 			if (nsBattery<block.numSamples) {
@@ -136,9 +135,6 @@ void acquisition(BioSemiClient& BS, int numHwChan, int fSample, int fSampleSavin
 
         bool printnewline = true;
 		for (int j=0;j<block.numSamples;j++) {
-			// dest_j points to j-th sample in block provided by ODM
-            
-			int *dest_j = ptr + j*(1+numHwChan);
 			// source offset, j-th sample
 			int soff   = block.startIndex + j*block.stride; 
 			// status word (incl. triggers)
@@ -221,23 +217,14 @@ void acquisition(BioSemiClient& BS, int numHwChan, int fSample, int fSampleSavin
                         copied_trigger = 0;
                     }
                 }
-                dest_j[0] = copied_trigger;
+                // the sample has been read already, so its status word can be replaced in the ring
+                BS.setValue(soff + 1, copied_trigger);
             }
-            else {
-                // copy status value
-                dest_j[0] = orig_trigger;
-            }
-            
-			// copy continuous channels into memory provided by ODM
-			// selection, scaling, streaming + saving will be handled from there
-			for (int i=0;i<numHwChan;i++) {
-				// a memcpy would be a bit faster, but then we'd need to handle 
-				// the wrapping-around of the BS ringbuffer here
-				dest_j[1+i] = BS.getValue(soff + i + 2);
-			}
 		}
 			
-		if (!ODM.handleBlock()) {
+		// selection, scaling, streaming + saving are done straight from the ring buffer,
+		// each sample starts with the status word after the sync word
+		if (!ODM.handleView(BS.getRingbuffer(), BUFFER_LEN, block.startIndex + 1, block.stride)) {
 			fprintf(stderr, "Error in handling this data block - stopping\n");
 			break;
 		}
@@ -1,18 +1,29 @@
 /*
  * (C) 2010 Stefan Klanke
+ *
+ * A receive thread reads the RDA packets into a pool of buffers that are reused,
+ * while the main thread converts them and writes them to the buffer. Packets that
+ * are waiting are combined into one block, so that the samples and their markers
+ * go out in a single request once the main thread has caught up.
  */
 #include <signal.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "buffer.h"
 #include "socketserver.h"
 #include "rdadefs.h"
 #include "platform.h"
+#if defined(PLATFORM_LINUX) || defined(PLATFORM_OSX)
+#include <sys/time.h>
+#endif
 
 #define MAXLINE 		256
 #define MAX_PRINT_CHN 	300
 #define WAIT_INFINITELY	{while (1) {sleep(1);}}
 #define ABORT			{exit(1);}
+#define POOLSIZE		64		/* RDA packets that can wait for the main thread */
+#define MAX_BLOCK_SEC	0.1		/* at most this much data is combined into one block */
 
 const UINT8_T _rda_guid[16]={
 		0x8E,0x45,0x58,0x43,0x96,0xC9,0x86,0x4C,0xAF,0x4A,0x98,0xBB,0xF6,0xC9,0x14,0x50
@@ -21,6 +32,30 @@ const UINT8_T _rda_guid[16]={
 int keepRunning = 1;
 int numChannels, ftSocket = -1, goodToSend = 0;
 int samplesWritten;
+int maxBlockSamples;
+FLOAT32_T *resolutions = NULL;	/* resolution of each channel, for converting the int16 packets to microvolt */
+
+/* The pool of packets between the receive thread and the main thread. The buffers
+   are kept, and only grow when a larger packet comes in. */
+typedef struct {
+		char *buf;
+		UINT32_T size;
+} rda_packet_t;
+
+rda_packet_t pool[POOLSIZE];
+unsigned int poolHead = 0, poolTail = 0;	/* packets received, and packets handled */
+int receiveFailed = 0;
+pthread_mutex_t poolMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t poolCond = PTHREAD_COND_INITIALIZER;
+
+/* The block that is being collected, as a PUT_DAT message that is preceded by its
+   messagedef_t, so that it can also be sent as the first part of a PUT_BATCH with
+   the events. The memory of both is kept for the next block. */
+char *block = NULL;
+UINT32_T blockSize = 0;
+int blockSamples = 0;
+char *evbuf = NULL;
+UINT32_T evbufSize = 0, evsiz = 0;
 
 static char usage[] = 
 "\n" \
@@ -51,19 +86,114 @@ void abortHandler(int sig) {
 		keepRunning = 0;
 }
 
+/* makes sure that buf can hold size bytes, returns 0 on success */
+int growBuffer(char **buf, UINT32_T *allocSize, UINT32_T size) {
+		char *newBuf;
+		if (size <= *allocSize) return 0;
+		newBuf = (char *) realloc(*buf, size);
+		if (newBuf == NULL) return -1;
+		*buf = newBuf;
+		*allocSize = size;
+		return 0;
+}
+
+void clearResponse(message_t *response) {
+		free(response->def);
+		if (response->buf) free(response->buf);
+		free(response);
+}
+
+/* Writes the collected samples, together with their events if there are any */
+void flushBlock(int ftSocket) {
+		message_t request, *response;
+		messagedef_t reqdef, *subdef;
+		datadef_t *ddef;
+		UINT32_T sizeData;
+
+		if (blockSamples == 0 && evsiz == 0) return;
+		if (!goodToSend) {
+				blockSamples = 0;
+				evsiz = 0;
+				return;
+		}
+
+		sizeData = blockSamples * numChannels * sizeof(FLOAT32_T);
+		subdef = (messagedef_t *) block;
+		ddef   = (datadef_t *) (block + sizeof(messagedef_t));
+		subdef->version = VERSION;
+		subdef->command = PUT_DAT;
+		subdef->bufsize = sizeof(datadef_t) + sizeData;
+		ddef->nsamples  = blockSamples;
+		ddef->nchans    = numChannels;
+		ddef->data_type = DATATYPE_FLOAT32;
+		ddef->bufsize   = sizeData;
+
+		request.def = &reqdef;
+		reqdef.version = VERSION;
+
+		if (evsiz == 0) {
+				reqdef.command = PUT_DAT;
+				reqdef.bufsize = subdef->bufsize;
+				request.buf = ddef;
+		} else {
+				/* the events follow right after the samples */
+				UINT32_T offset = sizeof(messagedef_t) + subdef->bufsize;
+				if (growBuffer(&block, &blockSize, offset + sizeof(messagedef_t) + evsiz)) {
+						fprintf(stderr, "Out of memory -- dropping block\n");
+						blockSamples = 0;
+						evsiz = 0;
+						return;
+				}
+				subdef = (messagedef_t *) (block + offset);
+				subdef->version = VERSION;
+				subdef->command = PUT_EVT;
+				subdef->bufsize = evsiz;
+				memcpy(block + offset + sizeof(messagedef_t), evbuf, evsiz);
+
+				/* a block with only events has no PUT_DAT part */
+				if (blockSamples == 0) {
+						reqdef.command = PUT_EVT;
+						reqdef.bufsize = evsiz;
+						request.buf = block + offset + sizeof(messagedef_t);
+				} else {
+						reqdef.command = PUT_BATCH;
+						reqdef.bufsize = offset + sizeof(messagedef_t) + evsiz;
+						request.buf = block;
+				}
+		}
+
+		if (clientrequest(ftSocket, &request, &response)) {
+				fprintf(stderr, "Error when writing samples to buffer.\n");
+		} else {
+				if (response->def->command != PUT_OK) {
+						fprintf(stderr, "Buffer server returned an error (writing samples).\n");
+				} else {
+						samplesWritten += blockSamples;
+				}
+				clearResponse(response);
+		}
+		printf("Samples written: %8i  \r", samplesWritten);
+		fflush(stdout);
+
+		blockSamples = 0;
+		evsiz = 0;
+}
+
 void handleStartPacket(int ftSocket, int size, void *buf) {
 		rda_msg_start_t *header = (rda_msg_start_t *) buf;
 		double *dRes = (double *) ((char *) buf + sizeof(rda_msg_start_t));
 		char *nameStart;
-		int sizeNames;
+		int sizeNames, i;
+
+		/* the samples of the previous acquisition go out with the previous header */
+		flushBlock(ftSocket);
 
 		printf("\nRDA start packet (%i bytes) -- %i channels, Ts=%.1fus\n\n", size, header->nChannels, header->dSamplingInterval);
 		numChannels = header->nChannels;
 
 		goodToSend = 0;
 
-		if (numChannels > 0) {
-				int i;
+		if (numChannels > 0 && sizeof(rda_msg_start_t) + numChannels*sizeof(double) <= size) {
 				char *name = (char *) buf + sizeof(rda_msg_start_t) + numChannels*sizeof(double);
 
 				nameStart = name;
@@ -94,6 +224,23 @@ void handleStartPacket(int ftSocket, int size, void *buf) {
 				return;
 		}
 
+		free(resolutions);
+		resolutions = (FLOAT32_T *) malloc(numChannels * sizeof(FLOAT32_T));
+		if (resolutions == NULL) {
+				fprintf(stderr, "Out of memory -- not sending header\n");
+				return;
+		}
+		for (i=0;i<numChannels;i++) {
+				double r;
+				/* the resolutions are not necessarily aligned */
+				memcpy(&r, (char *) buf + sizeof(rda_msg_start_t) + i*sizeof(double), sizeof(double));
+				resolutions[i] = (FLOAT32_T) r;
+		}
+		maxBlockSamples = (int) (MAX_BLOCK_SEC * 1.0e6/header->dSamplingInterval);
+		if (maxBlockSamples < 1) maxBlockSamples = 1;
+		blockSamples = 0;
+		evsiz = 0;
+
 		if (ftSocket != -1) {
 				message_t request, *response;
 				messagedef_t msgdef;
@@ -142,66 +289,70 @@ void handleStartPacket(int ftSocket, int size, void *buf) {
 								goodToSend = 1;
 								samplesWritten = 0;
 						}
-						free(response->def);
-						if (response->buf) free(response->buf);
-						free(response);
+						clearResponse(response);
 				}
 		}
 }
 
 void handleDataPacket(int ftSocket, int size, void *buf) {
 		rda_msg_data_t *data = (rda_msg_data_t *) buf;
-		int isInt, sizeData;
+		int isInt, sizeData, offset, j;
+		char *src;
+		FLOAT32_T *dest;
 
-		message_t request, *response;
-		messagedef_t reqdef;
-		request.def = &reqdef;
+		if (numChannels <= 0 || resolutions == NULL) return;
 
 		isInt = (data->hdr.nType == RDA_INT_MSG) ? 1 : 0;
 		sizeData = (isInt ? sizeof(INT16_T) : sizeof(float)) * data->nPoints * numChannels;
 
-		printf("RDA data block %4i (%i bytes):  %4i samples, %2i markers\n", data->nBlock, data->hdr.nSize, data->nPoints, data->nMarkers);	
+		if (sizeof(rda_msg_data_t) + sizeData > size) {
+				fprintf(stderr, "Invalid data packet received (%i bytes for %i samples) -- ignoring.\n", size, data->nPoints);
+				return;
+		}
 
-		if (data->nMarkers > 0) {
-				char *evbuf;
+		/* the block is written first if this packet does not fit into it anymore */
+		if (blockSamples > 0 && blockSamples + data->nPoints > maxBlockSamples) {
+				flushBlock(ftSocket);
+		}
 
+		if (data->nMarkers > 0) {
 				/* offset of markers into RDA packet */
-				int offset = sizeof(rda_msg_data_t) + sizeData;
-				/* maximum length of all the "type" strings combined (actually a bit more because of trailing zeros) */
-				int maxSizeTypes = size - offset - sizeof(rda_marker_t)*data->nMarkers;
-				/* offset + size of events in evbuf */
-				int evsiz = 0;
-
-				evbuf = (char *) malloc(data->nMarkers*(sizeof(eventdef_t) + sizeof(INT32_T)) + maxSizeTypes);
-				if (evbuf == NULL) {
-						fprintf(stderr, "Out of memory\n");
-						return;
-				}
+				offset = sizeof(rda_msg_data_t) + sizeData;
 
-				while (offset + sizeof(rda_marker_t) <= size) {
+				/* the events take at most as much space as the markers, plus their definitions */
+				if (growBuffer(&evbuf, &evbufSize, evsiz + data->nMarkers*sizeof(eventdef_t) + size - offset)) {
+						fprintf(stderr, "Out of memory -- dropping markers\n");
+				} else while (offset + sizeof(rda_marker_t) <= size) {
 						eventdef_t *evdef;
 						rda_marker_t *marker = (rda_marker_t *) ((char *) buf + offset);
 						char *markerType     = (char *) buf + offset + sizeof(rda_marker_t);
 						int maxLen           = size - (markerType - (char *) buf);
 						int typeLen          = strnlen(markerType, maxLen);
-						char *markerValue    = (char *) buf + offset + sizeof(rda_marker_t) + typeLen + 1;
-						int valueLen         = strnlen(markerValue, maxLen);
+						char *markerValue    = markerType + typeLen + 1;
+						int valueLen         = (typeLen < maxLen) ? strnlen(markerValue, maxLen - typeLen - 1) : 0;
 
 						/* The type and the value are both strings that are represented in each marker like this "Stimulus\0S  1\0"
 						 * which codes for a Marker type "Stimulus" and the value "S  1". 
 						 */ 
 
-						printf("Marker: Pos=%i  Length=%i  Size=%i  Channel=%i  maxLen=%i  markerType=%s  typeLen=%d  markerValue=%s  valueLen=%d\n",
-										marker->nPosition, marker->nPoints, marker->nSize, marker->nChannel, maxLen, markerType, typeLen, markerValue, valueLen);
-
+						if (marker->nSize < sizeof(rda_marker_t) || offset + marker->nSize > size) {
+								fprintf(stderr, "Invalid marker in data packet -- ignoring the remaining markers.\n");
+								break;
+						}
 						offset += marker->nSize;
 
-						evdef = (eventdef_t *) evbuf + evsiz;
+						printf("\nMarker: Pos=%i  Length=%i  Channel=%i  markerType=%s  markerValue=%s\n",
+										marker->nPosition, marker->nPoints, marker->nChannel, markerType, markerValue);
+
+						/* events without a type or value are not accepted by the buffer */
+						if (typeLen == 0 || valueLen == 0) continue;
+
+						evdef = (eventdef_t *) (evbuf + evsiz);
 						evdef->type_type = DATATYPE_CHAR;
 						evdef->type_numel = typeLen;
 						evdef->value_type = DATATYPE_CHAR;
 						evdef->value_numel = valueLen;
-						evdef->sample = samplesWritten + marker->nPosition;
+						evdef->sample = samplesWritten + blockSamples + marker->nPosition;
 						evdef->offset = 0;
 						evdef->duration = marker->nPoints;
 						evdef->bufsize = typeLen + valueLen;
@@ -211,62 +362,92 @@ void handleDataPacket(int ftSocket, int size, void *buf) {
 
 						evsiz += evdef->bufsize + sizeof(eventdef_t);
 				}
+		}
 
-				reqdef.version = VERSION;
-				reqdef.command = PUT_EVT;
-				reqdef.bufsize = evsiz;
-				request.buf = evbuf;
-				if (clientrequest(ftSocket, &request, &response)) {
-						fprintf(stderr, "Error when writing events to buffer.\n");
-				} else {
-						if (response->def->command != PUT_OK) {
-								fprintf(stderr, "Buffer server returned an error (writing events).\n");
-						}
-						free(response->def);
-						if (response->buf) free(response->buf);
-						free(response);
+		if (data->nPoints == 0) return;
+
+		if (growBuffer(&block, &blockSize, sizeof(messagedef_t) + sizeof(datadef_t) + (blockSamples + data->nPoints) * numChannels * sizeof(FLOAT32_T))) {
+				fprintf(stderr, "Out of memory -- dropping samples\n");
+				return;
+		}
+
+		/* the int16 samples are scaled to microvolt, the same as in the float packets */
+		src  = (char *) (data + 1);
+		dest = (FLOAT32_T *) (block + sizeof(messagedef_t) + sizeof(datadef_t)) + blockSamples*numChannels;
+		if (isInt) {
+				for (j=0;j<data->nPoints;j++) {
+						ft_convert_float32(numChannels, dest + j*numChannels, DATATYPE_INT16, src + j*numChannels*sizeof(INT16_T), resolutions);
 				}
-				free(evbuf);
-		}	
-
-		if (goodToSend && data->nPoints > 0) {
-				/* Write samples to FieldTrip buffer */
-				datadef_t *ddef = (datadef_t *) malloc(sizeof(datadef_t) + sizeData);
-				if (ddef == NULL) {
-						fprintf(stderr, "Out of memory!\n");
-						return;
+		} else {
+				ft_convert_float32(data->nPoints * numChannels, dest, DATATYPE_FLOAT32, src, NULL);
+		}
+		blockSamples += data->nPoints;
+}
+
+/* Reads the RDA packets into the pool, until the connection fails */
+void *receiveThread(void *arg) {
+		int rdaSocket = *((int *) arg);
+
+		while (1) {
+				rda_msg_hdr_t header;
+				rda_packet_t *P;
+				int n,s;
+
+				/* wait for a free buffer, meanwhile TCP holds back the Recorder */
+				pthread_mutex_lock(&poolMutex);
+				while (poolHead - poolTail == POOLSIZE) {
+						pthread_cond_wait(&poolCond, &poolMutex);
 				}
-				ddef->nsamples = data->nPoints;
-				ddef->nchans = numChannels;
-				ddef->data_type = isInt ? DATATYPE_INT16 : DATATYPE_FLOAT32;
-				ddef->bufsize = sizeData;
-				/* ddef+1 points at first byte after datadef, data+1 points at first byte after RDA data */
-				memcpy(ddef + 1, data + 1, sizeData);
-
-				reqdef.version = VERSION;
-				reqdef.command = PUT_DAT;
-				reqdef.bufsize = sizeof(datadef_t) + sizeData;
-				request.buf = ddef;
-				if (clientrequest(ftSocket, &request, &response)) {
-						fprintf(stderr, "Error when writing samples to buffer.\n");
-				} else {
-						if (response->def->command != PUT_OK) {
-								fprintf(stderr, "Buffer server returned an error (writing samples).\n");
-						} else {
-								samplesWritten += data->nPoints;
+				P = &pool[poolHead % POOLSIZE];
+				pthread_mutex_unlock(&poolMutex);
+
+				n = bufread(rdaSocket, &header, sizeof(header));
+
+				if (n!=sizeof(header)) {
+						fprintf(stderr, "Error while reading packet header from the RDA server\n");
+						break;
+				}
+
+				if (memcmp(_rda_guid, header.guid, 16)!=0) {
+						int i;
+						fprintf(stderr, "Incorrect GUID in received packet:\n");
+						for (i=0;i<16;i++) {
+								fprintf(stderr, "0x%02x   should be 0x%02x\n", header.guid[i], _rda_guid[i]);
 						}
-						free(response->def);
-						if (response->buf) free(response->buf);
-						free(response);
+						break;
 				}
-				free(ddef);
-		}	
+
+				if (header.nSize < sizeof(header) || growBuffer(&P->buf, &P->size, header.nSize)) {
+						fprintf(stderr, "Out of memory\n");
+						break;
+				}
+
+				memcpy(P->buf, &header, sizeof(header));
+				s = header.nSize - sizeof(header);
+				n = bufread(rdaSocket, P->buf + sizeof(header), s);
+				if (s!=n) {
+						fprintf(stderr, "Error while reading packet remainder from the RDA server\n");
+						break;
+				}
+
+				pthread_mutex_lock(&poolMutex);
+				poolHead++;
+				pthread_cond_broadcast(&poolCond);
+				pthread_mutex_unlock(&poolMutex);
+		}
+
+		pthread_mutex_lock(&poolMutex);
+		receiveFailed = 1;
+		pthread_cond_broadcast(&poolCond);
+		pthread_mutex_unlock(&poolMutex);
+		return NULL;
 }
 
 int main(int argc, char **argv) {
 		host_t ftHost, rdaHost;
 		int rdaSocket;
 		ft_buffer_server_t *S;
+		pthread_t receiver;
 
 		if (sizeof(rda_msg_hdr_t)!=24) {
 				fprintf(stderr, "Compiled-in datatypes do not match RDA protocol\n");
@@ -300,88 +481,79 @@ int main(int argc, char **argv) {
 		}
 
 		/* Spawn tcpserver or connect to remote buffer */
-		if (strcmp(ftHost.name, "-") == 0) {
-				S = ft_start_buffer_server(ftHost.port, NULL, NULL, NULL);
-				if (S==NULL) {
-						fprintf(stderr, "Could not start up a FieldTrip buffer serving at port %i\n", ftHost.port);
-						return 1;
-				}
-				ftSocket = 0; 
+		ftSocket = ft_open_buffer(ftHost.name, ftHost.port, &S);
+		if (ftSocket < 0) return 1;
+		if (S != NULL) {
 				printf("Streaming from %s:%i to local buffer on port %i\n", rdaHost.name, rdaHost.port, ftHost.port);
 		} else {
-				ftSocket = open_connection(ftHost.name, ftHost.port);
-
-				if (ftSocket < 0) {
-						fprintf(stderr, "Could not connect to FieldTrip buffer at %s:%i\n", ftHost.name, ftHost.port);
-						return 1;
-				}
 				printf("Streaming from %s:%i to remote buffer at %s:%i\n", rdaHost.name, rdaHost.port, ftHost.name, ftHost.port);
-		}		
+		}
 
 		/* register CTRL-C handler */
 		signal(SIGINT, abortHandler);
 
 		printf("Starting to listen - press CTRL-C to quit\n");
 
-		while (keepRunning) {
-				rda_msg_hdr_t header;
-				char *buf;
-				int n,s;
-
-				n = bufread(rdaSocket, &header, sizeof(header));
-
-				if (n!=sizeof(header)) {
-						fprintf(stderr, "Error while reading packet header from the RDA server\n");
-						break;
-				}
-
-				if (memcmp(_rda_guid, header.guid, 16)!=0) {
-						int i;
-						fprintf(stderr, "Incorrect GUID in received packet:\n");
-						for (i=0;i<16;i++) {
-								fprintf(stderr, "0x%02x   should be 0x%02x\n", header.guid[i], _rda_guid[i]);
-						}
-						break;
-				}
+		if (pthread_create(&receiver, NULL, receiveThread, &rdaSocket)) {
+				fprintf(stderr, "Could not spawn the receive thread\n");
+				return 1;
+		}
 
-				buf = (char *) malloc(header.nSize);
-				if (buf == NULL) {
-						fprintf(stderr, "Out of memory\n");
-						break;
+		while (keepRunning) {
+				rda_packet_t *P;
+				rda_msg_hdr_t *header;
+				int waiting;
+
+				/* wait for a packet, up to 100 ms to notice CTRL-C */
+				pthread_mutex_lock(&poolMutex);
+				if (poolHead == poolTail && !receiveFailed) {
+						struct timespec ts;
+						UINT64_T deadline;
+						struct timeval tv;
+						gettimeofday(&tv, NULL);
+						deadline = (UINT64_T) tv.tv_sec*1000000000 + (UINT64_T) tv.tv_usec*1000 + 100000000;
+						ts.tv_sec  = deadline / 1000000000;
+						ts.tv_nsec = deadline % 1000000000;
+						pthread_cond_timedwait(&poolCond, &poolMutex, &ts);
 				}
-
-				memcpy(buf, &header, sizeof(header));
-				s = header.nSize - sizeof(header);
-				n = bufread(rdaSocket, buf + sizeof(header), s);
-				if (s!=n) {
-						fprintf(stderr, "Error while reading packet remainder from the RDA server\n");
-						free(buf);
-						break;
+				if (poolHead == poolTail) {
+						if (receiveFailed) keepRunning = 0;
+						pthread_mutex_unlock(&poolMutex);
+						continue;
 				}
+				P = &pool[poolTail % POOLSIZE];
+				pthread_mutex_unlock(&poolMutex);
 
-				switch(header.nType) {
+				header = (rda_msg_hdr_t *) P->buf;
+				switch(header->nType) {
 						case RDA_START_MSG:
-								handleStartPacket(ftSocket, header.nSize, buf);
+								handleStartPacket(ftSocket, header->nSize, P->buf);
 								break;
 						case RDA_INT_MSG:
 						case RDA_FLOAT_MSG:			
-								handleDataPacket(ftSocket, header.nSize, buf);
+								handleDataPacket(ftSocket, header->nSize, P->buf);
 								break;
 						case RDA_STOP_MSG:
+								flushBlock(ftSocket);
 								printf("\nRemote Data Acquisition stopped\n\n");
 								break;
 				}
 
-				free(buf);
+				pthread_mutex_lock(&poolMutex);
+				poolTail++;
+				waiting = poolHead - poolTail;
+				pthread_cond_broadcast(&poolCond);
+				pthread_mutex_unlock(&poolMutex);
+
+				/* write the block once there is no packet waiting anymore */
+				if (waiting == 0) flushBlock(ftSocket);
 		}
 
+		flushBlock(ftSocket);
+
 		close_connection(rdaSocket);
 
-		if (ftSocket > 0) {
-				close_connection(ftSocket);
-		} else {
-				ft_stop_buffer_server(S);
-		}
+		ft_close_buffer(ftSocket, S);
 
 		return 0;
 }
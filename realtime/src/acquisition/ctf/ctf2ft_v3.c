@@ -11,15 +11,19 @@
  * next slot in those cases, such that Acq finds a perfectly valid slot for the next
  * data packet.
  *
- * Using a socket pair, a seperate thread is notified of the incoming data packets,
- * which are then being pulled out of the internal ringbuffer, analysed for triggers,
- * and then written to a local or remote FieldTrip buffer (samples + events).
+ * The internal ringbuffer is shared with a seperate thread without locks. That thread
+ * pulls the packets out, analyses them for triggers, and writes them to a local or
+ * remote FieldTrip buffer (samples + events), it is only woken up through a condition
+ * variable if it ran out of packets. If it falls behind, more packets are allocated
+ * instead of dropping data. With more than one output, each additional output gets a
+ * thread of its own, so the outputs are selected, downsampled and written in parallel.
  * 
  * The program is stopped by pressing CTRL-C after which a clean shutdown is performed.
  */
 #include <stdio.h>
 #include "ctf.h"
 #include <buffer.h>
+#include <atomicutil.h>
 #include <sys/shm.h>
 #include <sys/types.h>
 #include <sys/ipc.h>
@@ -32,7 +36,8 @@
 #define CTF_TRIGGER_TYPE   11
 
 #define OVERALLOC   1000    /* to overcome Acq bug */
-#define INT_RB_SIZE   10    /* Length of internal ring buffer of (overallocated) packets */
+#define INT_RB_INIT   10    /* Number of (overallocated) packets that are allocated at the start */
+#define INT_RB_SIZE  256    /* Maximum number of packets, the internal ring buffer grows up to this */
 #define MAX_CHANNEL  512
 #define MAX_TRIGGER   16
 #define MAX_OUT        4
@@ -60,6 +65,14 @@ typedef struct {
 	int data[28160 + OVERALLOC];
 } ACQ_OverAllocType;
 
+/* Single producer, single consumer ring of packets. The main thread passes
+   filled packets to the converter thread in one ring, and gets them back in
+   another one once they have been written. */
+typedef struct {
+	ACQ_OverAllocType *slot[INT_RB_SIZE];
+	volatile unsigned int head, tail;
+} PacketRing;
+
 /* This is used internally to store events in the same format that is being sent to the buffer.
    The memory pointed to by 'evs' is not free'd between handling different slots, but instead 
    reused. 'sizeAlloc' keeps track of the amount of reserved memory, whereas 'size' contains
@@ -69,6 +82,14 @@ typedef struct {
 	int num, size, sizeAlloc;
 } EventChain;
 
+typedef struct {
+	datadef_t ddef;
+	union {
+		int data[28160 + OVERALLOC];
+		float fData[28160 + OVERALLOC];
+	};
+} PutDatBuffer;
+
 typedef struct {
 	int ftSocket;
 	int writeEvents;
@@ -82,15 +103,30 @@ typedef struct {
 	int skipSamples;
 	int headerOk;
 	float fSample;
+	PutDatBuffer *putDat;
+	pthread_t thread;	/* writes this output in parallel, not used for the first one */
 } OutputConfig;
 
 
 
 volatile int keepRunning = 1;
 int ownBuffer = 0;
-int mySockets[2];	/* a socket pair for communication between the two threads */
 
-ACQ_OverAllocType intPackets[INT_RB_SIZE];
+PacketRing fullPackets;	/* filled by the main thread, emptied by the converter thread */
+PacketRing freePackets;	/* written packets that the main thread can use again */
+int numIntPackets = 0;	/* only used by the main thread */
+volatile int converterSleeping = 0;
+volatile int converterStop = 0;
+pthread_mutex_t converterMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t converterCond = PTHREAD_COND_INITIALIZER;
+
+/* the converter thread hands each data packet to the output threads */
+const ACQ_OverAllocType *outputPacket = NULL;
+int outputSeq = 0, outputsDone = 0;
+pthread_mutex_t outputMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t outputCond = PTHREAD_COND_INITIALIZER;
+pthread_cond_t outputDoneCond = PTHREAD_COND_INITIALIZER;
+
 OutputConfig outConf[MAX_OUT];
 int numOutputs = 0;
 
@@ -105,14 +141,6 @@ char *triggerChannelName[MAX_TRIGGER];	/* points into channelNames */
 int triggerChannelNameLen[MAX_TRIGGER];
 int lastValue[MAX_TRIGGER];
 
-struct {
-	datadef_t ddef;
-	union {
-		int data[28160 + OVERALLOC];
-		float fData[28160 + OVERALLOC];
-	};
-} putDatBuf;
-
 /* prototypes for helper functions defined below */
 ACQ_MessagePacketType *createSharedMem();
 void closeSharedMem(ACQ_MessagePacketType *packet);
@@ -121,6 +149,8 @@ ACQ_MessageType waitPacket(volatile ACQ_MessageType *msgtyp, double *time);
 void abortHandler(int sig);
 void alarmHandler(int sig);
 void *dataToFieldTripThread(void *arg);
+void *outputThread(void *arg);
+int queuePacket(const ACQ_MessagePacketType *packet, int size);
 ft_chunk_t *handleRes4(const char *dsname, int *numChannels, float *fSample);
 void addTriggerEvent(EventChain *EC, int trigChan, UINT32_T sample, int value);
 void matchChannels(int numChannels);
@@ -128,12 +158,37 @@ void writeHeader(OutputConfig *oc, int numChannels, float fSample, const ft_chun
 void writeSamples(OutputConfig *oc, const ACQ_OverAllocType *pack);
 void writeEvents(OutputConfig *oc, const EventChain *EC, EventChain *ECd);
 
+/** Adds a packet to the ring, this may only be called by one thread. The ring never
+	overflows, because there are at most INT_RB_SIZE packets in total.
+*/
+static void pushPacket(PacketRing *R, ACQ_OverAllocType *pack) {
+	R->slot[R->head % INT_RB_SIZE] = pack;
+	MEMORY_BARRIER();	/* the packet is complete before the other thread sees it */
+	R->head++;
+	MEMORY_BARRIER();
+}
+
+/** Takes the oldest packet out of the ring, or returns NULL if it is empty. This may
+	only be called by one thread.
+*/
+static ACQ_OverAllocType *popPacket(PacketRing *R) {
+	ACQ_OverAllocType *pack;
+	
+	if (R->tail == R->head) return NULL;
+	MEMORY_BARRIER();
+	pack = R->slot[R->tail % INT_RB_SIZE];
+	MEMORY_BARRIER();	/* the slot is read before the other thread may reuse it */
+	R->tail++;
+	return pack;
+}
+
 int main(int argc, char **argv) {
 	ACQ_MessagePacketType *packet;
-	int currentPacket, intSlot;
+	int currentPacket;
 	int lastId;
 	int numChannels, numSamples, sampleNumber;
 	pthread_t tcpserverThread, convertThread;
+	ACQ_OverAllocType *intPacket;
 	int i, rc;
 	double sumT, sumT2;
 	int numT;
@@ -248,6 +303,11 @@ int main(int argc, char **argv) {
 			}
 		}
 		outConf[numOutputs].downSample = decimate;
+		outConf[numOutputs].putDat = (PutDatBuffer *) malloc(sizeof(PutDatBuffer));
+		if (outConf[numOutputs].putDat == NULL) {
+			fprintf(stderr, "Cannot allocate output buffer -- out of memory\n");
+			return 1;
+		}
 		if (channelList[0]=='*') {
 			outConf[numOutputs].channelList = NULL;
 			outConf[numOutputs].numChannelsGiven = -1; /* means all channels!!! */
@@ -299,26 +359,30 @@ int main(int argc, char **argv) {
 		fprintf(stderr, "Warning: No output buffers defined - will only monitor acquisition...\n");
 	}
 		
-	/* Create socket pair */
-	if (socketpair(AF_UNIX, SOCK_STREAM, 0, mySockets)) {
-		perror("Could not create socket pair for internal communication: ");
-		return 1;
-	}
-	
-	/*  Internal ringbuffer uses same mechanism as Acq: free slots are
-		marked with ACQ_MSGQ_INVALID. To avoid polling in the converter thread,
-		the main thread sends the index of the latest slot over the socket pair.
-		If the converter thread does not manage to clear the ringbuffer quickly
-		enough, the program will report an error. */
-	for (intSlot=0;intSlot<INT_RB_SIZE;intSlot++) {
-		intPackets[intSlot].message_type = ACQ_MSGQ_INVALID;
+	/*  Start with a few free packets in the internal ringbuffer, more are
+		allocated once the converter thread does not manage to clear them
+		quickly enough. Only if that fails, the program will report an error. */
+	for (numIntPackets=0;numIntPackets<INT_RB_INIT;numIntPackets++) {
+		intPacket = (ACQ_OverAllocType *) malloc(sizeof(ACQ_OverAllocType));
+		if (intPacket == NULL) {
+			fprintf(stderr, "Cannot allocate internal ringbuffer -- out of memory\n");
+			return 1;
+		}
+		intPacket->message_type = ACQ_MSGQ_INVALID;
+		pushPacket(&freePackets, intPacket);
 	}
 	
-	/* Spawn conversion thread */
+	/* Spawn conversion thread, and one thread for each additional output */
 	if (pthread_create(&convertThread, NULL, dataToFieldTripThread, NULL)) {
 		fprintf(stderr, "Could not spawn conversion thread\n");
 		return 1;
 	}
+	for (i=1;i<numOutputs;i++) {
+		if (pthread_create(&outConf[i].thread, NULL, outputThread, &outConf[i])) {
+			fprintf(stderr, "Could not spawn output thread\n");
+			return 1;
+		}
+	}
 	
 
 	
@@ -345,8 +409,8 @@ int main(int argc, char **argv) {
 	setitimer(ITIMER_REAL, &timerOpts, NULL);
 	signal(SIGALRM, alarmHandler);
 	
-	/* Both ringbuffers start at 0 */
-	currentPacket = intSlot = 0;
+	/* The shared memory ringbuffer starts at 0 */
+	currentPacket = 0;
 	
 	printf("Entering main loop. Press CTRL-C to stop operation.\n\n");
 	while (keepRunning) {
@@ -366,13 +430,7 @@ int main(int argc, char **argv) {
 					continue;
 				}
 				
-				if (intPackets[intSlot].message_type != ACQ_MSGQ_INVALID) {
-					fprintf(stderr, "Internal converter thread does not keep up with the load.\n");
-				} else {
-					memcpy(&intPackets[intSlot], &packet[currentPacket], size);
-					write(mySockets[0], &intSlot, sizeof(int));
-					if (++intSlot == INT_RB_SIZE) intSlot=0;
-				}
+				queuePacket(&packet[currentPacket], size);
 				
 				packet[currentPacket].message_type = ACQ_MSGQ_INVALID;
 				if (++currentPacket == ACQ_MSGQ_SIZE) currentPacket=0;
@@ -406,13 +464,7 @@ int main(int argc, char **argv) {
 				if (size > sizeof(ACQ_OverAllocType)) {
 					fprintf(stderr, "Acq wrote far too much data -- cannot handle this\n");
 				} else {
-					if (intPackets[intSlot].message_type != ACQ_MSGQ_INVALID) {
-						fprintf(stderr, "Internal converter thread does not keep up with the load.\n");
-					} else {
-						memcpy(&intPackets[intSlot], &packet[currentPacket], size);
-						write(mySockets[0], &intSlot, sizeof(int));
-						if (++intSlot == INT_RB_SIZE) intSlot=0;
-					}
+					queuePacket(&packet[currentPacket], size);
 				}				
 				
 				if (numSamples * numChannels > 28160) {
@@ -451,8 +503,14 @@ int main(int argc, char **argv) {
 				break;
 		}
 	}
+	printf("Joining conversion thread...\n");
+	pthread_mutex_lock(&converterMutex);
+	converterStop = 1;
+	pthread_cond_signal(&converterCond);
+	pthread_mutex_unlock(&converterMutex);
+	pthread_join(convertThread, NULL);
+	
 	printf("Closing sockets / stopping tcpserver...\n");
-	close(mySockets[0]); /* the other one will be closed in the thread */
 	for (i=0;i<numOutputs;i++) {
 		if (outConf[i].ftSocket > 0) {
 			close_connection(outConf[i].ftSocket);
@@ -463,11 +521,12 @@ int main(int argc, char **argv) {
 		if (outConf[i].channelList != NULL) {
 			free(outConf[i].channelList);
 		}
+		free(outConf[i].putDat);
 	}
 	printf("Closing shared memory...\n");
 	closeSharedMem(packet);
-	printf("Joining conversion thread...\n");
-	pthread_join(convertThread, NULL);
+	while ((intPacket = popPacket(&freePackets)) != NULL) free(intPacket);
+	while ((intPacket = popPacket(&fullPackets)) != NULL) free(intPacket);
 	printf("Done.\n");
 	return 0;
 }
@@ -555,13 +614,130 @@ void abortHandler(int sig) {
 void alarmHandler(int sig) {
 }
 
+/** Copies a packet from the shared memory into the internal ringbuffer and hands it to
+	the converter thread, which is woken up if it waits for packets. Returns 0 on success.
+*/
+int queuePacket(const ACQ_MessagePacketType *packet, int size) {
+	ACQ_OverAllocType *pack = popPacket(&freePackets);
+	
+	if (pack == NULL && numIntPackets < INT_RB_SIZE) {
+		pack = (ACQ_OverAllocType *) malloc(sizeof(ACQ_OverAllocType));
+		if (pack != NULL) {
+			numIntPackets++;
+			printf("Internal converter thread falls behind, using %i packets now.\n", numIntPackets);
+		}
+	}
+	if (pack == NULL) {
+		fprintf(stderr, "Internal converter thread does not keep up with the load.\n");
+		return -1;
+	}
+	memcpy(pack, packet, size);
+	pushPacket(&fullPackets, pack);
+	
+	/* the converter thread checks the ring again after announcing that it sleeps */
+	if (converterSleeping) {
+		pthread_mutex_lock(&converterMutex);
+		pthread_cond_signal(&converterCond);
+		pthread_mutex_unlock(&converterMutex);
+	}
+	return 0;
+}
+
+/** Takes the next packet out of the internal ringbuffer, and waits for one if it is empty.
+	Returns NULL if the main thread wants to stop.
+*/
+ACQ_OverAllocType *waitForPacket() {
+	ACQ_OverAllocType *pack;
+	
+	while ((pack = popPacket(&fullPackets)) == NULL) {
+		pthread_mutex_lock(&converterMutex);
+		converterSleeping = 1;
+		MEMORY_BARRIER();
+		if (fullPackets.tail == fullPackets.head && !converterStop) {
+			pthread_cond_wait(&converterCond, &converterMutex);
+		}
+		converterSleeping = 0;
+		pthread_mutex_unlock(&converterMutex);
+		if (converterStop && fullPackets.tail == fullPackets.head) return NULL;
+	}
+	return pack;
+}
+
+/** Background thread for one of the additional outputs, waits for the converter thread
+	to hand over a data packet, and writes its samples.
+*/
+void *outputThread(void *arg) {
+	OutputConfig *oc = (OutputConfig *) arg;
+	int seq = 0;
+	
+	pthread_mutex_lock(&outputMutex);
+	while (1) {
+		while (outputSeq == seq) pthread_cond_wait(&outputCond, &outputMutex);
+		seq = outputSeq;
+		if (outputPacket == NULL) break; /* stop */
+		pthread_mutex_unlock(&outputMutex);
+		
+		if (oc->numChannelsFound != 0) {
+			writeSamples(oc, outputPacket);
+		}
+		
+		pthread_mutex_lock(&outputMutex);
+		if (++outputsDone == numOutputs - 1) pthread_cond_signal(&outputDoneCond);
+	}
+	pthread_mutex_unlock(&outputMutex);
+	return NULL;
+}
+
+/** Writes the samples of a data packet to all outputs, the first one in this
+	thread, the others in parallel in their own threads. Returns once all are done.
+*/
+void writeAllSamples(const ACQ_OverAllocType *pack) {
+	if (numOutputs > 1) {
+		pthread_mutex_lock(&outputMutex);
+		outputPacket = pack;
+		outputsDone = 0;
+		outputSeq++;
+		pthread_cond_broadcast(&outputCond);
+		pthread_mutex_unlock(&outputMutex);
+	}
+	
+	if (numOutputs > 0 && outConf[0].numChannelsFound != 0) {
+		writeSamples(&outConf[0], pack);
+	}
+	
+	if (numOutputs > 1) {
+		pthread_mutex_lock(&outputMutex);
+		while (outputsDone < numOutputs - 1) pthread_cond_wait(&outputDoneCond, &outputMutex);
+		pthread_mutex_unlock(&outputMutex);
+	}
+}
+
+/** Returns non-zero if any of the trigger channels changes within the packet. This is
+	the common case that decides whether the packet needs to be looked at sample by sample,
+	the loop over the samples has no branches so the compiler can vectorize it.
+*/
+int triggersChanged(const ACQ_OverAllocType *pack, int numChannels) {
+	int i, j;
+	
+	for (i=0;i<numTriggerChannels;i++) {
+		const int *src = pack->data + triggerChannel[i];
+		int prev = lastValue[i];
+		int changed = 0;
+		for (j=0;j<pack->numSamples;j++) {
+			changed |= src[j*numChannels] ^ prev;
+		}
+		if (changed) return 1;
+	}
+	return 0;
+}
+
 /** Background thread for grabbing setup and data packets from the internal, overallocated ringbuffer.
-    This thread stops automatically if the socket pair is closed in the main thread.
+    This thread stops once the main thread sets converterStop and all packets have been written.
 */
 void *dataToFieldTripThread(void *arg) {
 	ACQ_OverAllocType *pack;
 	EventChain EC, ECd;
-	int slot, res, i,j;
+	int i,j;
 	int numChannels = 0, numSamples;
 	int warningGiven = 0;
 	
@@ -573,31 +749,13 @@ void *dataToFieldTripThread(void *arg) {
 	ECd.evs = NULL;
 	ECd.sizeAlloc = 0;
 		
-	while (1) {
-		res = read(mySockets[1], &slot, sizeof(int));
-		
-		if (res == 0) break; /* socket pair was closed - exit */
-		
-		if (res != sizeof(int)) {
-			fprintf(stderr, "Error when reading from socket pair\n");
-			break;
-		}
-		
-		if (slot<0 || slot>=INT_RB_SIZE) {
-			fprintf(stderr, "Got errorneous slot number from socket pair\n");
-			break;
-		}
-		
-		pack = &intPackets[slot];
-		
+	while ((pack = waitForPacket()) != NULL) {
 		if (pack->message_type == ACQ_MSGQ_SETUP_COLLECTION) {
 			int i, nChans;
 			float fSample;
 			ft_chunk_t *chunk;
 			
 			chunk = handleRes4((const char *) pack->data, &nChans, &fSample);
-			/* clear internal ringbuffer slot */
-			pack->message_type = ACQ_MSGQ_INVALID;
 			
 			if (chunk == NULL) {
 				/* problem while picking up header -- ignore this packet */
@@ -618,6 +776,7 @@ void *dataToFieldTripThread(void *arg) {
 			if (numChannels == 0) {
 				fprintf(stderr, "No header written yet -- ignoring data packet\n");
 				pack->message_type = ACQ_MSGQ_INVALID;
+				pushPacket(&freePackets, pack);
 				continue;
 			}
 			
@@ -630,20 +789,18 @@ void *dataToFieldTripThread(void *arg) {
 			sampleNumber = pack->sampleNumber;
 			numSamples   = pack->numSamples;
 			
-			for (i=0;i<numOutputs;i++) {
-				if (outConf[i].numChannelsFound != 0) {
-					writeSamples(&outConf[i], pack);
-				}
-			}
+			writeAllSamples(pack);
 			
 			/* look at trigger channels and add events to chain, clear this first */
 			EC.size = EC.num = 0;
-			for (j=0;j<numSamples;j++) {
-				int *sj = pack->data + j*numChannels;
-				for (i=0;i<numTriggerChannels;i++) {
-					int sji = sj[triggerChannel[i]];
-					if (sji != lastValue[i] && sji > 0) addTriggerEvent(&EC, i, sampleNumber + j, sji);
-					lastValue[i] = sji;
+			if (triggersChanged(pack, numChannels)) {
+				for (j=0;j<numSamples;j++) {
+					int *sj = pack->data + j*numChannels;
+					for (i=0;i<numTriggerChannels;i++) {
+						int sji = sj[triggerChannel[i]];
+						if (sji != lastValue[i] && sji > 0) addTriggerEvent(&EC, i, sampleNumber + j, sji);
+						lastValue[i] = sji;
+					}
 				}
 			}
 			if (EC.size > 0) {
@@ -657,9 +814,21 @@ void *dataToFieldTripThread(void *arg) {
 			fprintf(stderr,"Converter thread: Packet contains neither SETUP nor DATA (%i)...\n", pack->message_type);
 		}
 		pack->message_type = ACQ_MSGQ_INVALID;
+		pushPacket(&freePackets, pack);
 	}
 	printf("Leaving converter thread...\n");
-	close(mySockets[1]);
+	
+	/* stop the output threads */
+	if (numOutputs > 1) {
+		pthread_mutex_lock(&outputMutex);
+		outputPacket = NULL;
+		outputSeq++;
+		pthread_cond_broadcast(&outputCond);
+		pthread_mutex_unlock(&outputMutex);
+		for (i=1;i<numOutputs;i++) {
+			pthread_join(outConf[i].thread, NULL);
+		}
+	}
 	if (EC.sizeAlloc > 0) free(EC.evs);
 	if (ECd.sizeAlloc > 0) free(ECd.evs);
 	return NULL;
@@ -1054,15 +1223,17 @@ void writeSamples(OutputConfig *oc, const ACQ_OverAllocType *pack) {
 	message_t request, *response;
 	int i,j, res;
 	
+	PutDatBuffer *putDatBuf = oc->putDat;
+	
 	request.def = &reqdef;
-	request.buf = &putDatBuf;
+	request.buf = putDatBuf;
 	
 	nsamp = 0;
 		
 	if (oc->applyGains) {
 		/* write samples to floating point data buffer pointed to by 'dest' */
-		float *dest = putDatBuf.fData;
-		putDatBuf.ddef.data_type = DATATYPE_FLOAT32;
+		float *dest = putDatBuf->fData;
+		putDatBuf->ddef.data_type = DATATYPE_FLOAT32;
 		
 		if (oc->numChannelsFound == -1) {
 			/* transmit all channels, but with gains applied */
@@ -1089,8 +1260,8 @@ void writeSamples(OutputConfig *oc, const ACQ_OverAllocType *pack) {
 		
 	} else {
 		/* write samples to integer data buffer pointed to by 'dest' */
-		int *dest = putDatBuf.data;
-		putDatBuf.ddef.data_type = DATATYPE_INT32;
+		int *dest = putDatBuf->data;
+		putDatBuf->ddef.data_type = DATATYPE_INT32;
 		
 		if (oc->numChannelsFound == -1) {
 			/* transmit all channels without gains */
@@ -1115,14 +1286,14 @@ void writeSamples(OutputConfig *oc, const ACQ_OverAllocType *pack) {
 		}
 	}
 	oc->skipSamples = j - pack->numSamples;
-	putDatBuf.ddef.nchans   = nchans;
-	putDatBuf.ddef.nsamples = nsamp;
-	putDatBuf.ddef.bufsize  = 4 * nsamp * nchans; /* both int32 + float32 are 4 bytes wide */
+	putDatBuf->ddef.nchans   = nchans;
+	putDatBuf->ddef.nsamples = nsamp;
+	putDatBuf->ddef.bufsize  = 4 * nsamp * nchans; /* both int32 + float32 are 4 bytes wide */
 			
 	reqdef.version = VERSION;
 	reqdef.command = PUT_DAT;
-	reqdef.bufsize = putDatBuf.ddef.bufsize + sizeof(datadef_t);
-	request.buf    = &putDatBuf.ddef; 
+	reqdef.bufsize = putDatBuf->ddef.bufsize + sizeof(datadef_t);
+	request.buf    = &putDatBuf->ddef; 
 			
 	res = clientrequest(oc->ftSocket, &request, &response);
 			
@@ -1149,7 +1320,7 @@ void writeEvents(OutputConfig *oc, const EventChain *EC, EventChain *ECd) {
 	int res;
 	
 	request.def = &reqdef;
-	request.buf = &putDatBuf;
+	request.buf = NULL;
 	
 	reqdef.version = VERSION;
 	reqdef.command = PUT_EVT;
@@ -15,9 +15,7 @@
     }
 #endif
 
-#include <OnlineDataManager.h>
-#include <ConsoleInput.h>
-#include <StringServer.h>
+#include <AcquisitionDriver.h>
 
 #include "edk.h"
 #include "edkErrorCode.h"
@@ -64,67 +62,93 @@ unsigned int userID	= 0;
 
 int port, ctrlPort;
 char hostname[256];
-StringServer ctrlServ;
 ConsoleInput conIn;
 
-void acquisition(const char *configFile, unsigned int fSample) {
-	int sampleCounter = 0;
-	
-	OnlineDataManager<double, double> ODM(0, TOTAL_CHANNELS, (float) fSample);
-	
-	if (ODM.configureFromFile(configFile) != 0) {
-		fprintf(stderr, "Configuration %s file is invalid\n", configFile);
-		return;
-	} else {
-		printf("Streaming %i out of %i channels\n", ODM.getSignalConfiguration().getStreamingSelection().getSize(), TOTAL_CHANNELS);
+/** The EmoEngine hands out all samples it has at once, they are kept here until
+	the driver asks for them */
+class EmotivDevice : public AcquisitionDevice<double> {
+public:
+	EmotivDevice(unsigned int fSample) {
+		this->fSample = fSample;
+		hData = NULL;
+		numPending = 0;
+		firstPending = 0;
 	}
-	if (!strcmp(hostname, "-")) {
-		if (!ODM.useOwnServer(port)) {
-			fprintf(stderr, "Could not spawn buffer server on port %d.\n",port);
-			return;
-		}
-	} else {
-		if (!ODM.connectToServer(hostname, port)) {
-			fprintf(stderr, "Could not connect to buffer server at %s:%d.\n",hostname, port);
-			return;
-		}
+
+	int getNumStatus() const { return 0; }
+	int getNumContinuous() const { return TOTAL_CHANNELS; }
+	float getSampleRate() const { return (float) fSample; }
+
+	bool start() {
+		hData = EE_DataCreate();
+		EE_DataSetBufferSizeInSec(1.0);
+		return hData != NULL;
 	}
-	
-	ODM.enableStreaming();
 
-	DataHandle hData = EE_DataCreate();
-	EE_DataSetBufferSizeInSec(1.0);
-	
-	printf("Starting to transfer data - press [Escape] to quit\n");
+	void stop() {
+		if (hData != NULL) EE_DataFree(hData);
+		hData = NULL;
+	}
 
-	while (1) {
-		if (conIn.checkKey() && conIn.getKey()==27) break;	
-		ctrlServ.checkRequests(ODM);
-	
-		EE_DataUpdateHandle(0, hData);
+	int read(double *dest, int maxSamples, int timeoutMs, FtEventList &events) {
+		if (numPending == 0) {
+			EE_DataUpdateHandle(0, hData);
 
-		unsigned int nSamplesTaken=0;
-		EE_DataGetNumberOfSample(hData,&nSamplesTaken);
+			unsigned int nSamplesTaken=0;
+			EE_DataGetNumberOfSample(hData,&nSamplesTaken);
+
+			if (nSamplesTaken == 0) {
+				dosleep(timeoutMs < 10 ? timeoutMs : 10);
+				return 0;
+			}
+			// the buffers grow to the largest number of samples, and are kept
+			if (data.size() < nSamplesTaken) data.resize(nSamplesTaken);
+			if (pending.size() < nSamplesTaken*TOTAL_CHANNELS) pending.resize(nSamplesTaken*TOTAL_CHANNELS);
 
-		if (nSamplesTaken != 0) {
-			double* data = new double[nSamplesTaken];
-			double* dest = ODM.provideBlock(nSamplesTaken); 
 			for (int i=0;i<TOTAL_CHANNELS;i++) {
-				EE_DataGet(hData, targetChannelList[i], data, nSamplesTaken);
+				EE_DataGet(hData, targetChannelList[i], &data[0], nSamplesTaken);
 					
 				for (unsigned int j=0;j<nSamplesTaken;j++) {
-					dest[i + j*TOTAL_CHANNELS] = data[j];
+					pending[i + j*TOTAL_CHANNELS] = data[j];
 				}
 			}
-			delete[] data;
-			
-			if (!ODM.handleBlock()) break;
-			sampleCounter += nSamplesTaken;
-			printf("Wrote %2i samples (%i total)\n", nSamplesTaken, sampleCounter);
+			numPending = nSamplesTaken;
+			firstPending = 0;
 		}
-		dosleep(10);
+
+		int n = (numPending < maxSamples) ? numPending : maxSamples;
+		memcpy(dest, &pending[firstPending*TOTAL_CHANNELS], n*TOTAL_CHANNELS*sizeof(double));
+		firstPending += n;
+		numPending -= n;
+		return n;
+	}
+
+protected:
+	unsigned int fSample;
+	DataHandle hData;
+	std::vector<double> data, pending;
+	int numPending, firstPending;
+};
+
+void acquisition(const char *configFile, unsigned int fSample) {
+	EmotivDevice device(fSample);
+	AcquisitionDriver<double, double> driver(device);
+	
+	if (driver.configure(configFile) != 0) {
+		fprintf(stderr, "Configuration %s file is invalid\n", configFile);
+		return;
+	} else {
+		printf("Streaming %i out of %i channels\n", driver.getODM().getSignalConfiguration().getStreamingSelection().getSize(), TOTAL_CHANNELS);
 	}
-	EE_DataFree(hData);
+	if (!driver.connect(hostname, port)) {
+		return;
+	}
+	if (!driver.listen(ctrlPort)) {
+		return;
+	}
+	
+	printf("Starting to transfer data - press [Escape] to quit\n");
+	driver.run();
 }
 
 					  
@@ -156,11 +180,6 @@ int main(int argc, char** argv) {
 		ctrlPort = 8000;
 	}	
 	
-	if (!ctrlServ.startListening(ctrlPort)) {
-		fprintf(stderr, "Cannot listen on port %d for configuration commands\n", ctrlPort);
-		return 1;
-	}
-	
 	eEvent = EE_EmoEngineEventCreate();
 	eState = EE_EmoStateCreate();
 		
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+#include <cstdlib>
+#include <new>
+#include <stdint.h>
+
+#include "gdsnetworkinterfacedemo_platform_specific.hpp"
+
+// Counts the allocations through operator new of the whole program, including those of
+// std::string and the other containers, so that the allocations in the loop that reads
+// the measurement data show up in its progress report.
+
+static volatile int32_t allocation_count = 0;
+
+uint32_t AllocationCount()
+{
+	return (uint32_t) allocation_count;
+}
+
+static void *CountedAllocation(size_t size)
+{
+#if defined(PLATFORM_WINDOWS) && !defined(__GNUC__)
+	InterlockedIncrement((volatile LONG *) &allocation_count);
+#else
+	__sync_fetch_and_add(&allocation_count, 1);
+#endif
+	void *ptr = malloc(size ? size : 1);
+	if (ptr == 0)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void *operator new(size_t size)
+{
+	return CountedAllocation(size);
+}
+
+void *operator new[](size_t size)
+{
+	return CountedAllocation(size);
+}
+
+void operator delete(void *ptr)
+{
+	free(ptr);
+}
+
+void operator delete[](void *ptr)
+{
+	free(ptr);
+}
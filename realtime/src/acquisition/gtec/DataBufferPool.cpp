@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+#include <iostream>
+
+#include "DataBufferPool.hpp"
+
+#define POOL_WAIT_MILLISECONDS 100
+
+DataBufferPool::DataBufferPool(size_t count, size_t capacity_bytes, size_t channels_count, size_t values_per_scan, int ft_server, FILE *file)
+	: buffers_(count),
+	capacity_bytes_(capacity_bytes),
+	channels_count_(channels_count),
+	values_per_scan_(values_per_scan),
+	ft_server_(ft_server),
+	file_(file),
+	writing_thread_(0),
+	writing_(false),
+	write_failed_(false)
+{
+	free_.reserve(count);
+	filled_.reserve(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		buffers_[i].memory_ = new char[WRITE_DATA_RESERVED + capacity_bytes];
+		buffers_[i].scans_ = 0;
+		free_.push_back(&buffers_[i]);
+	}
+
+	InitializeEvent(&buffer_freed_);
+	InitializeEvent(&buffer_filled_);
+	MKR_MUTEX_INIT(mutex_);
+
+	writing_ = true;
+	if (!MKR_THREAD_CREATE(&writing_thread_, &DoWrite, (void*) this))
+	{
+		std::cerr << "ERROR: could not start the thread that writes the measurement data" << std::endl;
+		writing_ = false;
+	}
+}
+
+DataBufferPool::~DataBufferPool(void)
+{
+	if (writing_)
+	{
+		// let the writer empty the queue first
+		MKR_MUTEX_LOCK(mutex_);
+		while (!filled_.empty())
+		{
+			MKR_MUTEX_UNLOCK(mutex_);
+			WaitForEvent(&buffer_freed_, POOL_WAIT_MILLISECONDS);
+			MKR_MUTEX_LOCK(mutex_);
+		}
+		writing_ = false;
+		MKR_MUTEX_UNLOCK(mutex_);
+
+		SetEvent(&buffer_filled_);
+		MKR_THREAD_JOIN(writing_thread_);
+		MKR_THREAD_DESTROY(writing_thread_);
+	}
+
+	DestroyEvent(&buffer_freed_);
+	DestroyEvent(&buffer_filled_);
+	MKR_MUTEX_DESTROY(mutex_);
+
+	for (size_t i = 0; i < buffers_.size(); i++)
+		delete[] buffers_[i].memory_;
+}
+
+DataBufferPool::Buffer *DataBufferPool::Acquire()
+{
+	Buffer *buffer = 0;
+
+	MKR_MUTEX_LOCK(mutex_);
+	while (free_.empty())
+	{
+		MKR_MUTEX_UNLOCK(mutex_);
+		WaitForEvent(&buffer_freed_, POOL_WAIT_MILLISECONDS);
+		MKR_MUTEX_LOCK(mutex_);
+	}
+	buffer = free_.back();
+	free_.pop_back();
+	MKR_MUTEX_UNLOCK(mutex_);
+
+	return buffer;
+}
+
+void DataBufferPool::Submit(Buffer *buffer, size_t scans)
+{
+	buffer->scans_ = scans;
+
+	if (!writing_)
+	{
+		// without the thread the buffer is written right away
+		Write(buffer);
+		Discard(buffer);
+		return;
+	}
+
+	MKR_MUTEX_LOCK(mutex_);
+	filled_.push_back(buffer);
+	MKR_MUTEX_UNLOCK(mutex_);
+	SetEvent(&buffer_filled_);
+}
+
+void DataBufferPool::Discard(Buffer *buffer)
+{
+	MKR_MUTEX_LOCK(mutex_);
+	free_.push_back(buffer);
+	MKR_MUTEX_UNLOCK(mutex_);
+	SetEvent(&buffer_freed_);
+}
+
+bool DataBufferPool::Write(Buffer *buffer)
+{
+	size_t values = buffer->scans_ * values_per_scan_;
+
+	if (file_ != 0)
+		fwrite((void*) Samples(buffer), sizeof(float), values, file_);
+
+	// the samples are sent from where they are, behind the reserved bytes
+	return (write_data_reserved(ft_server_, DATATYPE_FLOAT32, channels_count_, values / channels_count_, buffer->memory_) == 0);
+}
+
+THREAD_CALLBACK_RETURN_TYPE THREAD_CALLBACK_CALLING_CONVENTION DataBufferPool::DoWrite(void *data)
+{
+	DataBufferPool *pool = reinterpret_cast<DataBufferPool*>(data);
+
+	for (;;)
+	{
+		Buffer *buffer = 0;
+
+		MKR_MUTEX_LOCK(pool->mutex_);
+		if (!pool->filled_.empty())
+		{
+			buffer = pool->filled_.front();
+			pool->filled_.erase(pool->filled_.begin());
+		}
+		bool stop = !pool->writing_;
+		MKR_MUTEX_UNLOCK(pool->mutex_);
+
+		if (buffer == 0)
+		{
+			if (stop)
+				break;
+			WaitForEvent(&pool->buffer_filled_, POOL_WAIT_MILLISECONDS);
+			continue;
+		}
+
+		if (!pool->Write(buffer))
+			pool->write_failed_ = true;
+		pool->Discard(buffer);
+	}
+
+	MKR_THREAD_EXIT();
+	return 0;
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+#ifndef DATABUFFERPOOL_HPP_INCLUDED
+#define DATABUFFERPOOL_HPP_INCLUDED
+
+#include <cstdio>
+#include <vector>
+
+#include "gdsnetworkinterfacedemo_platform_specific.hpp"
+#include "interface.h"
+
+// Returns the number of heap allocations through operator new so far (modulo 2^32), see AllocationCount.cpp
+uint32_t AllocationCount();
+
+// A fixed set of buffers for the measurement data, which are allocated once. The data
+// socket is read straight into a buffer, behind room for the datadef_t, so that the buffer
+// can be written to the FieldTrip buffer with write_data_reserved without copying. A writer
+// thread takes the filled buffers in order, writes them to the file and the FieldTrip
+// buffer and hands them back, so that the network is read again while the samples are
+// written.
+class DataBufferPool
+{
+public:
+	struct Buffer
+	{
+		char *memory_;          // WRITE_DATA_RESERVED bytes followed by the samples
+		size_t scans_;          // number of scans in the samples
+	};
+
+	// Allocates count buffers of capacity_bytes samples each and starts the writer thread.
+	DataBufferPool(size_t count, size_t capacity_bytes, size_t channels_count, size_t values_per_scan, int ft_server, FILE *file);
+
+	// Writes the remaining buffers and stops the writer thread.
+	virtual ~DataBufferPool(void);
+
+	// Returns the memory for the samples of a free buffer, waits until the writer hands one back.
+	Buffer *Acquire();
+
+	// Queues a buffer from Acquire for writing, its first scans scans are valid.
+	void Submit(Buffer *buffer, size_t scans);
+
+	// Hands a buffer from Acquire back without writing it.
+	void Discard(Buffer *buffer);
+
+	// Returns the pointer to the samples of the buffer.
+	static float *Samples(Buffer *buffer) { return (float *) (buffer->memory_ + WRITE_DATA_RESERVED); }
+
+	size_t CapacityBytes() const { return capacity_bytes_; }
+
+	// Returns true if the writer failed to write to the FieldTrip buffer.
+	bool WriteFailed() const { return write_failed_; }
+
+private:
+	static THREAD_CALLBACK_RETURN_TYPE THREAD_CALLBACK_CALLING_CONVENTION DoWrite(void *data);
+	bool Write(Buffer *buffer);
+
+	std::vector<Buffer> buffers_;
+	std::vector<Buffer*> free_;     // buffers that can be acquired
+	std::vector<Buffer*> filled_;   // buffers waiting for the writer, oldest first
+	size_t capacity_bytes_;
+	size_t channels_count_;
+	size_t values_per_scan_;
+	int ft_server_;
+	FILE *file_;
+
+	mutex_t mutex_;
+	event_t buffer_freed_;
+	event_t buffer_filled_;
+	thread_t writing_thread_;
+	volatile bool writing_;
+	volatile bool write_failed_;
+};
+
+#endif // DATABUFFERPOOL_HPP_INCLUDED
@@ -1,7 +1,7 @@
 //COPYRIGHT © 2013 G.TEC MEDICAL ENGINEERING GMBH, AUSTRIA
 #include "ParseXML.hpp"
 
-std::string ParseXML(std::string xml, std::string xml_node, size_t* pos_finally, size_t pos_begin = 0) 
+std::string ParseXML(const std::string& xml, const std::string& xml_node, size_t* pos_finally, size_t pos_begin = 0) 
 {
     if (xml.find(GDS_XML_DOCTYPE) == std::string::npos)
 	{
@@ -32,7 +32,7 @@ std::string ParseXML(std::string xml, std::string xml_node, size_t* pos_finally,
     return ret;
 }
 
-std::string ParseXML(std::string xml, std::string xml_node) 
+std::string ParseXML(const std::string& xml, const std::string& xml_node) 
 {
     size_t dummy = 0;
     return ParseXML(xml, xml_node, &dummy, dummy);
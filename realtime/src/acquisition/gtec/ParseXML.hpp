@@ -14,8 +14,8 @@
 // This method returns the value which is stored within the XML element defined
 // by the xml_node paramter.
 //-------------------------------------------------------------------------------------
-std::string ParseXML(std::string xml, std::string xml_node, size_t* pos_finally, size_t pos_begin);
-std::string ParseXML(std::string xml, std::string xml_node);
+std::string ParseXML(const std::string& xml, const std::string& xml_node, size_t* pos_finally, size_t pos_begin);
+std::string ParseXML(const std::string& xml, const std::string& xml_node);
 
 // Retrieves the information about the devices connected to the server stored in an XML message.
 //-------------------------------------------------------------------------------------
@@ -5,6 +5,54 @@
 // FieldTrip buffer
 extern int ft_server;
 
+// Reads exactly size bytes from the data socket, returns false if the connection fails
+static bool ReadFully(socketd_t data_socketfd, char *buffer, uint64_t size)
+{
+	uint64_t bytes_read = 0;
+
+	while (bytes_read < size)
+	{
+		uint64_t transfer_part_size = size - bytes_read;
+		if (transfer_part_size > MAX_TRANSFER_SIZE)
+			transfer_part_size = MAX_TRANSFER_SIZE;
+
+		int ret = MKR_READ( data_socketfd, buffer + bytes_read, transfer_part_size );
+		if (ret == SOCKET_ERROR || ret == 0)
+		{
+			std::cout << "ERROR: on reading data from the socket" << std::endl;
+			return false;
+		}
+		bytes_read += ret;
+	}
+	return true;
+}
+
+// Receives one block of measurement data into the given buffer and acknowledges it. This is
+// the binary data path, the reply with the number of scans comes via the control connection.
+static bool ReceiveDataBlock(socketd_t data_socketfd, char *buffer, size_t capacity_bytes)
+{
+	// receive data header
+	MetaHeader data_header;
+	if (!ReadFully(data_socketfd, (char*) &data_header, sizeof( MetaHeader )))
+	{
+		std::cerr << "ERROR: was not able to read the header" << std::endl;
+		return false;
+	}
+
+	if (data_header.size_ > capacity_bytes)
+	{
+		std::cerr << "ERROR: the data block of " << data_header.size_ << " bytes does not fit in " << capacity_bytes << " bytes" << std::endl;
+		return false;
+	}
+
+	// receive data payload
+	if (!ReadFully(data_socketfd, buffer, data_header.size_))
+		return false;
+
+	// confirm data reception with acknowledge message (header only with acknowledge flag set)
+	return Transceiver::SendAcknowledge(data_socketfd, data_header);
+}
+
 void ReadMeasurementData(Transceiver *control_command_transceiver,
 	socketd_t data_socketfd,
 	std::string session_id,
@@ -33,10 +81,9 @@ void ReadMeasurementData(Transceiver *control_command_transceiver,
 		//std::cerr << "DEBUG: buffer_size_per_scan   = " << buffer_size_per_scan << std::endl;
 
 		scan_count = 0;
-		uint64_t buffer_size_seconds = 5;
+		uint64_t buffer_size_seconds = 1;
 		uint64_t sample_rate = atoi(ParseXML(xml_config, sample_rate_parent_node).c_str());
 		size_t buffer_size_in_samples = buffer_size_seconds * sample_rate * buffer_size_per_scan;
-		float* buffer = new float[buffer_size_in_samples];
 
 		// std::cerr << "DEBUG: buffer_size_seconds    = " << buffer_size_seconds << std::endl;
 		// std::cerr << "DEBUG: sample_rate            = " << sample_rate << std::endl;
@@ -52,81 +99,73 @@ void ReadMeasurementData(Transceiver *control_command_transceiver,
 		if (disp)
 		std::cout << std::endl << "Start reading measurement data: Expect about " << total_scans_to_acquire << " scans" << std::endl;
 
-		while (total_acquired_scans < total_scans_to_acquire)
-		{
-			std::string data_info = SetupXMLMessage(scan_count, 0, buffer_size_in_samples);
-			std::string cmd = SetupXMLMessage(session_id, CMD_GET_DATA, EscapeXML(data_info));
-			std::string reply;
+		// the data request is the same every time, so the XML is only set up once
+		std::string data_info = SetupXMLMessage(scan_count, 0, buffer_size_in_samples);
+		const std::string cmd = SetupXMLMessage(session_id, CMD_GET_DATA, EscapeXML(data_info));
+		std::string reply;
 
-			// send data request
-			if (!control_command_transceiver->Send(cmd))
-			continue;
+		uint32_t allocations = AllocationCount();
+		time_t report_time = time(0);
 
-			// receive data header
-			MetaHeader data_header;
-			size_t bytes_read = MKR_READ( data_socketfd, (char*) &data_header, sizeof( MetaHeader ) );
+		{
+			// the samples are read into these buffers and then written by the writer thread of the pool
+			DataBufferPool pool(DATA_BUFFER_COUNT, buffer_size_in_samples * sizeof(float), channels_count, buffer_size_per_scan, ft_server, file);
 
-			if (bytes_read != sizeof(MetaHeader))
+			while (total_acquired_scans < total_scans_to_acquire)
 			{
-				std::cerr << "ERROR: was not able to read the header. read " << bytes_read << " instead of  " << sizeof(MetaHeader) << std::endl;
+				// send data request
+				if (!control_command_transceiver->Send(cmd))
 				continue;
-			}
 
-			// receive data payload
-			uint64_t transfer_parts_count = (uint64_t) floor(data_header.size_ / (double) MAX_TRANSFER_SIZE);
-			uint64_t last_transfer_part_size = data_header.size_ % MAX_TRANSFER_SIZE;
+				DataBufferPool::Buffer *data = pool.Acquire();
+				if (!ReceiveDataBlock(data_socketfd, (char*) DataBufferPool::Samples(data), pool.CapacityBytes()))
+				{
+					pool.Discard(data);
+					continue;
+				}
 
-			for (uint64_t i = 0; i < transfer_parts_count + 1; i++)
-			{
-				uint64_t transfer_part_size = (i < transfer_parts_count) ? MAX_TRANSFER_SIZE : last_transfer_part_size;
-				bytes_read = 0;
+				// receive reply for data request
+				if (!control_command_transceiver->Receive(CMD_GET_DATA, "", &reply))
+				reply = "";
 
-				while (bytes_read != transfer_part_size)
+				try
 				{
-					int ret = MKR_READ( data_socketfd, (char*) buffer + i*MAX_TRANSFER_SIZE + bytes_read, transfer_part_size - bytes_read );
-					if (ret == SOCKET_ERROR)
-					std::cout << "ERROR: on reading data from the socket" << std::endl;
-
-					bytes_read += ((ret < 0) ? 0 : ret);
+					CheckServerReply(reply);
+				}
+				catch (...)
+				{
+					pool.Discard(data);
+					throw;
 				}
-			}
 
-			// confirm data reception with acknowledge message (header only with acknowledge flag set)
-			if (!Transceiver::SendAcknowledge(data_socketfd, data_header))
-			continue;
+				std::string payload = EscapeXML(ParseXML(reply, GDS_XML_PAYLOAD_NODE), false);
+				size_t scans_available = atoi(ParseXML(payload, GDS_XML_VALUE_NODE).c_str());
 
-			// receive reply for data request
-			if (!control_command_transceiver->Receive(CMD_GET_DATA, "", &reply))
-			reply = "";
+				total_acquired_scans += scans_available;
 
-			try
-			{
-				CheckServerReply(reply);
-			}
-			catch (...)
-			{
-				delete[] buffer;
-				buffer = 0;
-				throw;
-			}
-
-			std::string payload = EscapeXML(ParseXML(reply, GDS_XML_PAYLOAD_NODE), false);
-			size_t scans_available = atoi(ParseXML(payload, GDS_XML_VALUE_NODE).c_str());
+				if (scans_available > 0)
+					pool.Submit(data, scans_available);
+				else
+					pool.Discard(data);
 
-			total_acquired_scans += scans_available;
+				if (pool.WriteFailed()) exit(-1);
 
-			if (scans_available > 0) {
-				// std::cerr << "DEBUG: scans_available = " << scans_available << std::endl;
-				fwrite((void*) buffer, sizeof(float), scans_available * buffer_size_per_scan, file);
-				ft_status = write_data(ft_server, DATATYPE_FLOAT32, channels_count, scans_available * buffer_size_per_scan / channels_count, (void *)buffer);
-				// std::cerr << "DEBUG: write_data  = " << ft_status << std::endl;
-				if (ft_status!=0) exit(-1);
+				if (disp && time(0) != report_time)
+				{
+					// the allocations per second show whether the loop itself causes heap churn
+					uint32_t now_allocations = AllocationCount();
+					time_t now = time(0);
+					std::cout << TERMINAL_CARRIAGE_RETURN_ESCAPE_CODE << total_acquired_scans << " / " << total_scans_to_acquire << " scans acquired, "
+						<< (uint32_t) ((now_allocations - allocations) / difftime(now, report_time)) << " allocations/s   " << std::flush;
+					allocations = now_allocations;
+					report_time = now;
+				}
 			}
-
-			if (disp)
-			std::cout << TERMINAL_CARRIAGE_RETURN_ESCAPE_CODE << total_acquired_scans << " / " << total_scans_to_acquire << " scans acquired" << std::flush;
 		}
 
+		if (disp)
+		std::cout << TERMINAL_CARRIAGE_RETURN_ESCAPE_CODE << total_acquired_scans << " / " << total_scans_to_acquire << " scans acquired" << std::flush;
+
 		ft_status = close_connection(ft_server);
 		// std::cerr << "DEBUG: close_connection  = " << ft_status << std::endl;
 		if (ft_status!=0) exit(-1);
@@ -134,9 +173,6 @@ void ReadMeasurementData(Transceiver *control_command_transceiver,
 		if (disp)
 		std::cout << std::endl;
 
-		delete[] buffer;
-		buffer = 0;
-
 		if (file != 0)
 		{
 			fclose(file);
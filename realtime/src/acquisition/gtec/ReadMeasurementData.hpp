@@ -10,10 +10,12 @@
 #include "SetupXMLMessage.hpp"
 #include "Transceiver.hpp"
 #include "CheckServerReply.hpp"
+#include "DataBufferPool.hpp"
 
 #define TERMINAL_CLEAR_TO_THE_LEFT_ESCAPE_CODE "\0"
 #define TERMINAL_CARRIAGE_RETURN_ESCAPE_CODE "\r"
 #define MAX_TRANSFER_SIZE (64*1024 - 1)
+#define DATA_BUFFER_COUNT 4 // blocks of measurement data that can wait for the writer
 
 // This method is responsible for the whole process of reading the
 // measurement data transfered via the network
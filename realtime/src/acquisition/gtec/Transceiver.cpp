@@ -10,7 +10,9 @@ Transceiver::Transceiver(const socketd_t &socket)
 	received_messages_mutex_(),
 	received_acknowledge_id_mutex_(),
 	received_messages_(),
-	received_acknowledge_id_(0)
+	received_acknowledge_id_(0),
+	send_buffer_(),
+	receive_buffer_()
 	
 {
 	InitializeEvent(&message_received_);
@@ -52,9 +54,11 @@ bool Transceiver::Send(const std::string& command_message)
     if (command.empty())
         return false;
 
-    // allocate memory for the buffer to be sent
+    // the buffer to be sent only grows if a message is larger than all previous ones
     size_t buffer_size = command_message.size() + sizeof(MetaHeader);
-    char* buffer = new char[buffer_size];
+    if (send_buffer_.size() < buffer_size)
+        send_buffer_.resize(buffer_size);
+    char* buffer = &send_buffer_[0];
 
     // prepare the header
     MetaHeader header(command_message.size());
@@ -67,9 +71,6 @@ bool Transceiver::Send(const std::string& command_message)
     // write the whole header and payload to the socket
     int n = MKR_WRITE( socket_, buffer, buffer_size );
 
-    delete[] buffer;
-    buffer = 0;
-
     if (n == SOCKET_ERROR)
 	{
         std::cerr << "ERROR: could not write to socketfd " << socket_ << std::endl;
@@ -262,7 +263,9 @@ THREAD_CALLBACK_RETURN_TYPE THREAD_CALLBACK_CALLING_CONVENTION Transceiver::DoRe
 			try
 			{
 				// prepare the buffer to save the payload
-				char *buffer = new char[received_header.size_];
+				if (transceiver->receive_buffer_.size() < received_header.size_)
+					transceiver->receive_buffer_.resize(received_header.size_);
+				char *buffer = &transceiver->receive_buffer_[0];
 
 				// read the expected amount of data ( given by the header )
 				int n = MKR_READ(transceiver->socket_, buffer, received_header.size_);
@@ -284,8 +287,6 @@ THREAD_CALLBACK_RETURN_TYPE THREAD_CALLBACK_CALLING_CONVENTION Transceiver::DoRe
 
 				// notify pending user that a message has been received
 				SetEvent(&transceiver->message_received_);
-
-				delete[] buffer;
 			} 
 			catch (const std::bad_alloc&) 
 			{
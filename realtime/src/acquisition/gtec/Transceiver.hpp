@@ -5,6 +5,7 @@
 #include <ctime>
 #include <string>
 #include <list>
+#include <vector>
 #include <iostream>
 
 #include "gdsnetworkinterfacedemo_platform_specific.hpp"
@@ -66,6 +67,10 @@ private:
 
 	std::list<std::string> received_messages_;
 	uint64_t received_acknowledge_id_;
+
+	// reused for every message so that sending and receiving do not allocate each time
+	std::vector<char> send_buffer_;
+	std::vector<char> receive_buffer_;
 };
 
 #endif // TRANSCEIVER_HPP_INCLUDED
\ No newline at end of file
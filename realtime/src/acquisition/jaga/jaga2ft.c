@@ -239,7 +239,7 @@ int main(int argc, char *argv[]) {
 
   /* these are used in the communication with the FT buffer and represent statefull information */
   int ftSocket            = -1;
-  ft_buffer_server_t *ftServer;
+  ft_buffer_server_t *ftServer = NULL;
   message_t     *request  = NULL;
   message_t     *response = NULL;
   header_t      *header   = NULL;
@@ -371,24 +371,13 @@ int main(int argc, char *argv[]) {
   fprintf(stderr, "jaga2ft: nchans       =  %d\n", nchans);
 
   /* Spawn tcpserver or connect to remote buffer */
-  if (strcmp(host.name, "-") == 0) {
-    ftServer = ft_start_buffer_server(host.port, NULL, NULL, NULL);
-    if (ftServer==NULL) {
-      fprintf(stderr, "jaga2ft: could not start up a local buffer serving at port %i\n", host.port);
-      return 1;
-    }
-    ftSocket = 0;
+  ftSocket = ft_open_buffer(host.name, host.port, &ftServer);
+  if (ftSocket < 0)
+    return 1;
+  if (ftServer != NULL)
     printf("jaga2ft: streaming to local buffer on port %i\n", host.port);
-  }
-  else {
-    ftSocket = open_connection(host.name, host.port);
-
-    if (ftSocket < 0) {
-      fprintf(stderr, "jaga2ft: could not connect to remote buffer at %s:%i\n", host.name, host.port);
-      return 1;
-    }
+  else
     printf("jaga2ft: streaming to remote buffer at %s:%i\n", host.name, host.port);
-  }
 
   /* open the UDP server */
   if ((udpsocket=socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP))==-1)
@@ -808,10 +797,7 @@ int main(int argc, char *argv[]) {
   cleanup_data(&data);
   close(udpsocket);
 
-  if (ftSocket > 0)
-    close_connection(ftSocket);
-  else
-    ft_stop_buffer_server(ftServer);
+  ft_close_buffer(ftSocket, ftServer);
 
   return 0;
 
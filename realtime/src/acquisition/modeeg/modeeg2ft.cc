@@ -6,13 +6,12 @@
 
 #include <serial.h>
 
-#include <OnlineDataManager.h>
-#include <ConsoleInput.h>
-#include <StringServer.h>
+#include <AcquisitionDriver.h>
 
 #define NUM_HW_CHAN 6
 #define FSAMPLE     256
 #define PACKET_LEN  17
+#define TIMEOUT     5.0   // seconds without input before the serial port is re-opened
 
 
 static char usageInfo[]=
@@ -29,24 +28,30 @@ static char usageInfo[]=
 "  spawn a buffer server within this application by passing a minus (-)\n" \
 "  instead of the hostname parameter.\n";
 
-unsigned char serialBuffer[1024];
-int leftOverBytes = 0;
+/** Frame function for the receive buffer, each packet starts with 0xA5 0x5A */
+int modeegFrame(const unsigned char *data, int length, void *user) {
+	if (data[0] != 0xA5) return -1;
+	if (length < 2) return 0;
+	if (data[1] != 0x5A) return -1;
+	if (length < PACKET_LEN) return 0;
+	return PACKET_LEN;
+}
 
 /** Read data from serial port until 0xA5 0x5A shows up.
     Those two bytes will be written to the beginning of
-	the global array "serialBuffer". Also, leftOverBytes
-	will be set to 2 if this functions returns successfully.
+	the receive buffer, so that the first packet is complete.
 	Returns 2 on success, 0 or 1 on error.
 */
-int readSyncBytes(SerialPort *SP) {
+int readSyncBytes(SerialStream *S) {
 	// printf("Looking for sync bytes 0xA5 0x5A (%c%c)\n", 0xA5, 0x5A);
+	S->start = S->end = 0;
 
 	// read bytes until we get 0xA5,0x5A,...
 	for (int iter = 0;iter < 200; iter++) {
 		unsigned char byte;
 		int nr;
 
-		nr = serialRead(SP, 1, &byte);
+		nr = serialRead(S->port, 1, &byte);
 		if (nr<0) {
 			fprintf(stderr, "Error when reading from serial port - exiting\n");
 			return 1;
@@ -60,243 +65,205 @@ int readSyncBytes(SerialPort *SP) {
 		// printf("%02X %c\n", byte, byte);
 
 		if (byte == 0xA5) {
-			serialBuffer[0] = byte;
-			leftOverBytes = 1;
-		} else if (leftOverBytes == 1 && byte == 0x5A) {
-			serialBuffer[1] = byte;
-			leftOverBytes = 2;
+			S->buf[0] = byte;
+			S->end = 1;
+		} else if (S->end == 1 && byte == 0x5A) {
+			S->buf[1] = byte;
+			S->end = 2;
 			break; // success !
 		} else {
-			leftOverBytes = 0;
+			S->end = 0;
 		}
 	}
-	return leftOverBytes;
+	return S->end;
 }
 
 
-int main(int argc, char *argv[]) {
-	int sampleCounter = 0;
-	char hostname[256];
-	int port;
-	short switchState = 0;
-	StringServer ctrlServ;
-	ConsoleInput ConIn;
-	SerialPort SP;
-	int keepRunning = 1;
-	int numTimeouts = 0;
-	int numChannels;
+/** The ModularEEG on a serial port, with the switches as status channel. If nothing
+	arrives for a while, the port is re-opened and a TIMEOUT event is written, with
+	one fake sample.
+*/
+class ModularEEGDevice : public AcquisitionDevice<short> {
+public:
+	ModularEEGDevice(const char *device) {
+		this->device = device;
+		switchState = 0;
+		numSkipped = 0;
+		sampleCounter = 0;
+		ready = serialStreamInit(&stream, &SP, 4096);
+	}
 
-	if (argc<3) {
-		puts(usageInfo);
-		return 0;
+	~ModularEEGDevice() {
+		serialStreamFree(&stream);
 	}
 
-	OnlineDataManager<short,float> ODM(1, NUM_HW_CHAN, FSAMPLE, FSAMPLE);
-	ctrlServ.startListening(8000);
+	bool isReady() const { return ready; }
 
-	if (convertToInt(argv[2], numChannels)) {
-		// user gave the number of channels instead of a configuration file
-		char label[16];
-		SignalConfiguration sigConf;
+	int getNumStatus() const { return 1; }
+	int getNumContinuous() const { return NUM_HW_CHAN; }
+	float getSampleRate() const { return FSAMPLE; }
 
-		if (numChannels<1 || numChannels > NUM_HW_CHAN) {
-			fprintf(stderr, "Number of channels must be within 1..%i\n", NUM_HW_CHAN);
-			return 1;
-		}
-		for (int i=0;i<numChannels;i++) {
-			sprintf(label, "%i", i+1);
-			sigConf.selectForStreaming(i,label);
-			sigConf.selectForSaving(i,label);
-		}
-		if (!ODM.setSignalConfiguration(sigConf)) {
-			fprintf(stderr, "Could not set configuration - weird!\n");
-			return 1;
+	/** Opens the serial port and waits for the first packet, returns true on success */
+	bool open() {
+		if (!serialOpenByName(&SP, device)) {
+			fprintf(stderr, "Could not open serial port %s\n", device);
+			return false;
 		}
-	} else {
-		// user specified something else as configuration, treat it as a filename
-		int err = ODM.configureFromFile(argv[2]);
-		if (err == -1) {
-			fprintf(stderr, "Could not read configuration file %s\n", argv[2]);
-			return 1;
+		fprintf(stderr, "Opened serial port %s\n", device);
+
+		// last parameter is timeout in 1/10 of a second
+		if (!serialSetParameters(&SP, 57600, 8, 0, 1, 0)) {
+			fprintf(stderr, "Could not modify serial port parameters\n");
+			serialClose(&SP);
+			return false;
 		}
-		if (err > 0) {
-			fprintf(stderr, "Encountered %i errors in configuration file - aborting\n", err);
-			return 1;
+		if (readSyncBytes(&stream) != 2) {
+			fprintf(stderr, "Could not read synchronisation bytes from ModularEEG\n");
+			serialClose(&SP);
+			return false;
 		}
+		lastInput = ft_clock_seconds();
+		return true;
 	}
 
-	if (argc>3) {
-		strncpy(hostname, argv[3], sizeof(hostname));
-	} else {
-		strcpy(hostname, "localhost");
-	}
-
-	if (argc>4) {
-		port = atoi(argv[4]);
-	} else {
-		port = 1972;
-	}
-
-	if (!serialOpenByName(&SP, argv[1])) {
-		fprintf(stderr, "Could not open serial port %s\n", argv[1]);
-		return 1;
-	}
-	else {
-		fprintf(stderr, "Opened serial port %s\n", argv[1]);
+	void stop() {
+		serialClose(&SP);
 	}
 
-	// last parameter is timeout in 1/10 of a second
-	if (!serialSetParameters(&SP, 57600, 8, 0, 1, 0)) {
-		fprintf(stderr, "Could not modify serial port parameters\n");
-		return 1;
-	}
+	int read(short *dest, int maxSamples, int timeoutMs, FtEventList &events) {
+		int numSamples = decode(dest, maxSamples, events);
+		if (numSamples > 0) return numSamples;
 
-	if (!strcmp(hostname, "-")) {
-		if (!ODM.useOwnServer(port)) {
-			fprintf(stderr, "Could not spawn buffer server on port %d\n",port);
-			return 0;
+		// wait for input, then read everything that has arrived
+		int numRead = serialStreamFill(&stream, timeoutMs);
+		if (numRead < 0) {
+			fprintf(stderr, "Error when reading from serial port - exiting\n");
+			return -1;
 		}
-		else {
-			fprintf(stderr, "Spawned TCP server on port %i\n", port);
+		if (numRead > 0) {
+			lastInput = ft_clock_seconds();
+			return decode(dest, maxSamples, events);
 		}
-	} else {
-		if (!ODM.connectToServer(hostname, port)) {
-			fprintf(stderr, "Could not connect to buffer server at %s:%d\n",hostname, port);
-			return 0;
+		if (ft_clock_seconds() - lastInput < TIMEOUT) return 0;
+
+		fprintf(stderr, "Timeout -- re-opening serial port\n");
+		serialClose(&SP);
+		if (!open()) {
+			fprintf(stderr, "Could not re-start acquisition - exiting.\n");
+			return -1;
 		}
-	}
+		fprintf(stderr, "Got synchronization bytes - re-starting acquisition\n");
 
-	if (readSyncBytes(&SP) != 2) {
-		fprintf(stderr, "Could not read synchronisation bytes from ModularEEG\n");
-		goto cleanup;
+		// write one fake sample and a timeout event
+		events.add(0, "TIMEOUT", 0);
+		dest[0] = 0; // status
+		for (int i=0;i<NUM_HW_CHAN;i++) dest[1+i] = 0x7FFF;
+		sampleCounter++;
+		return 1;
 	}
 
-	ODM.enableStreaming();
+protected:
 
-	printf("\nGot synchronization bytes - starting acquisition\n");
-	printf("\nPress <Esc> to quit\n\n");
-
-	while (keepRunning) {
-		int numRead, numTotal, numSamples, numPending, maxReadNow;
-
-		if (ConIn.checkKey()) {
-			int c = ConIn.getKey();
-			if (c==27) break; // quit
-		}
+	/** Decodes the packets where they are in the receive buffer, into switch + data */
+	int decode(short *dest, int maxSamples, FtEventList &events) {
+		int numSamples = 0, len;
 
-		ctrlServ.checkRequests(ODM);
-
-		numPending = serialInputPending(&SP);
-		if (numPending < 0) {
-			fprintf(stderr, "Error when reading from serial port - exiting\n");
-			break;
-		}
+		while (numSamples < maxSamples) {
+			const unsigned char *packet = serialStreamNext(&stream, modeegFrame, NULL, &len);
+			if (packet == NULL) break;
 
-		if (numPending == 0) {
-			if (++numTimeouts > 250) {
-				// write one fake sample and a timeout event
-				short *block = ODM.provideBlock(1);
-				ODM.getEventList().add(0, "TIMEOUT", 0);
-				block[0] = 0; // status
-				for (int i=0;i<NUM_HW_CHAN;i++) block[i] = 0x7FFF;
-				ODM.handleBlock();
-
-				fprintf(stderr, "Timeout -- re-opening serial port\n");
-				serialClose(&SP);
-
-				if (!serialOpenByName(&SP, argv[1])) {
-					fprintf(stderr, "Could not open serial port %s\n", argv[1]);
-					break;
-				}
-				if (!serialSetParameters(&SP, 57600, 8, 0, 1, 0)) {
-					fprintf(stderr, "Could not modify serial port parameters\n");
-					break;
-				}
-				if (readSyncBytes(&SP) != 2) {
-					fprintf(stderr, "Got synchronization bytes - re-starting acquisition\n");
-					continue;
-				} else {
-					fprintf(stderr, "Could not read synchronization bytes - exiting.\n");
-					break;
+			short switchVal = packet[16];
+			if (switchVal != switchState) {
+				switchState = switchVal;
+				if (switchState!=0) {
+					events.add(numSamples, "Switch", switchState);
 				}
-				numTimeouts = 0;
-			} else {
-				usleep(20000);
 			}
-			continue;
-		}
-
-		numTimeouts = 0; // we read something, so reset timeout counter
+			dest[0] = switchVal;
 
-		// printf("%i left over, %i pending\n", leftOverBytes, numPending);
-
-		maxReadNow = sizeof(serialBuffer) - leftOverBytes;
-		if (numPending > maxReadNow) {
-			numPending = maxReadNow;
+			for (int i=0;i<NUM_HW_CHAN;i++) {
+				short sampleData = packet[4+2*i]*256 + packet[5+2*i];
+				dest[1 + i] = sampleData;
+			}
+			dest += 1+NUM_HW_CHAN;
+			numSamples++;
 		}
 
-		numRead = serialRead(&SP, numPending, serialBuffer + leftOverBytes);
-		if (numRead != numPending) {
-		    fprintf(stderr, "Error when reading from serial port - exiting\n");
-			break;
+		if (stream.skipped != numSkipped) {
+			fprintf(stderr, "ModularEEG out of sync before sample %i - skipped %lu bytes.\n", sampleCounter + numSamples, stream.skipped - numSkipped);
+			numSkipped = stream.skipped;
 		}
+		sampleCounter += numSamples;
+		return numSamples;
+	}
 
-		numTotal   = leftOverBytes + numRead;
-		numSamples = numTotal / PACKET_LEN;
+	const char *device;
+	SerialPort SP;
+	SerialStream stream;
+	bool ready;
+	short switchState;
+	unsigned long numSkipped;
+	int sampleCounter;
+	double lastInput;
+};
 
-		if (numSamples > FSAMPLE) {
-			fprintf(stderr, "Received too much data from serial port - exiting.\n");
-			break;
-		}
 
-		if (numSamples == 0) {
-			leftOverBytes += numRead;
-			continue;
-		}
+int main(int argc, char *argv[]) {
+	char hostname[256];
+	int port;
 
-		short *block = ODM.provideBlock(numSamples);
+	if (argc<3) {
+		puts(usageInfo);
+		return 0;
+	}
 
-		// first decode into switch + data
-		for (int j=0;j<numSamples;j++) {
-			int soff = j*PACKET_LEN;
-			int doff = j*(1+NUM_HW_CHAN);
+	ModularEEGDevice device(argv[1]);
+	if (!device.isReady()) {
+		fprintf(stderr, "Could not allocate the receive buffer\n");
+		return 1;
+	}
 
-			if (serialBuffer[soff] != 0xA5 || serialBuffer[soff+1] != 0x5A) {
-				fprintf(stderr, "ModularEEG out of sync in sample %i - exiting.\n", sampleCounter + j);
-				keepRunning = 0;
-				break;
-			}
+	AcquisitionDriver<short,float> driver(device);
+	driver.listen(8000);
 
-			short switchVal = serialBuffer[soff+16];
-			if (switchVal != switchState) {
-				switchState = switchVal;
-				if (switchState!=0) {
-					ODM.getEventList().add(j, "Switch", switchState);
-				}
-			}
-			block[doff] = switchVal;
+	// the configuration can also be the number of channels
+	int err = driver.configure(argv[2]);
+	if (err == -1) {
+		fprintf(stderr, "Could not read configuration file %s\n", argv[2]);
+		return 1;
+	}
+	if (err > 0) {
+		fprintf(stderr, "Encountered %i errors in configuration - aborting\n", err);
+		return 1;
+	}
 
-			for (int i=0;i<NUM_HW_CHAN;i++) {
-				short sampleData = serialBuffer[soff+4+2*i]*256 + serialBuffer[soff+5+2*i];
-				block[doff + 1 + i] = sampleData;
-			}
-		}
+	if (argc>3) {
+		strncpy(hostname, argv[3], sizeof(hostname));
+	} else {
+		strcpy(hostname, "localhost");
+	}
 
-		if (!ODM.handleBlock()) {
-			fprintf(stderr, "Error in handling this data block - stopping\n");
-			break;
-		}
+	if (argc>4) {
+		port = atoi(argv[4]);
+	} else {
+		port = 1972;
+	}
 
-		sampleCounter += numSamples;
-		leftOverBytes = numTotal - numSamples * PACKET_LEN;
+	if (!device.open()) {
+		return 1;
+	}
 
-		// copy left-over bytes to the beginning of the serialBuffer
-		if (leftOverBytes > 0) {
-			memcpy(serialBuffer, serialBuffer + numSamples*PACKET_LEN, leftOverBytes);
-		}
+	if (!driver.connect(hostname, port)) {
+		device.stop();
+		return 0;
+	}
+	if (!strcmp(hostname, "-")) {
+		fprintf(stderr, "Spawned TCP server on port %i\n", port);
 	}
 
-cleanup:
-	serialClose(&SP);
+	printf("\nGot synchronization bytes - starting acquisition\n");
+	printf("\nPress <Esc> to quit\n\n");
+
+	driver.run();
 	return 0;
 }
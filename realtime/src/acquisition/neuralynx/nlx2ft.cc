@@ -14,23 +14,31 @@
 
 #define MAX_OBJ  5000
 #define MAX_LEN  100
-#define RB_SIZE  50
+#define RB_SIZE  256                // records, events and spikes that can be underway
+#define SPIKE_WIRES    4            // spikes are padded to the number of wires of a tetrode
+#define SPIKE_STREAM   "spikes"     // name of the buffer stream that receives the spike waveforms
+#define DEFAULT_LATENCY_MS  50
 
 int keepRunning = 1;
 char hostname[256];
 int port, numChannels, blockSize;
 int ftSocket = -1;
-int maxCscSamples, recordBufferSize, maxEventStringLength;
+ft_buffer_server_t *ftServer = NULL;	// spawned if the hostname is a minus (-)
+int maxCscSamples, recordBufferSize, maxEventStringLength, spikeWindow, maxSpikeFeatures;
+int maxLatencyMs = DEFAULT_LATENCY_MS;
 HANDLE pipeWrite, pipeRead;
 
 char cheetahObjects[MAX_OBJ][MAX_LEN];
 char cheetahTypes[MAX_OBJ][MAX_LEN];
 int cscIndex[MAX_OBJ];
 int evcIndex[MAX_OBJ];
-int numCSC = 0, numEvC = 0;
+int spkIndex[MAX_OBJ];
+int spkWires[MAX_OBJ];
+int numCSC = 0, numEvC = 0, numSpk = 0;
 int fSamp = -1;
 volatile int numBlocksComplete = 0, numBlocksWritten = 0;
 int numEventsRead = 0, numEventsWritten = 0;
+int numSpikesRead = 0, numSpikesWritten = 0;
 uint64_t refTimeStamp = 0;
 int refSample = 0;
 double samplesPerTimeStamp = 0.0;
@@ -45,17 +53,33 @@ int *retBufSamplingFreq;
 int *retBufEventIDs;
 int *retBufTTL;
 char **retBufEventString;
+int *retBufScNumbers;
+int *retBufCellNumbers;
+int *retBufFeatures;
+short *retBufSpikeSamples;
 
+/* Messages from the acquisition loop to the thread that writes to the buffer,
+   each one hands over 'count' consecutive slots of one of the ring buffers */
+enum { MSG_CSC = 1, MSG_EVENT = 2, MSG_SPIKE = 3 };
 
 typedef struct {
-	int status; 	// 0=empty, 1=being filled, 2=being sent
+	int kind;
+	int slot;
+	int count;
+} PipeMessage;
+
+/* Record slots of the CSC ring buffer. Record r of each channel goes into slot
+   r % RB_SIZE, and its samples into the same slot of cscRingSamples, where the
+   records follow each other without gaps. Consecutive complete records can
+   therefore be written to the buffer in one go. */
+typedef struct {
+	volatile int status; 	// 0=empty, 1=being filled, 2=complete, 3=being sent
 	int chansFilled;
 	uint64_t timeStamp;
-	short *samples; /* numChannels x maxCscSamples */
-} MultiChannelBlock;
+} RecordSlot;
 
 typedef struct {
-	int status;		// 0=empty, 1=being sent
+	volatile int status;	// 0=empty, 1=waiting or being sent
 	// uint64_t timeStamp;
 	int sample;
 	char *name;
@@ -63,11 +87,32 @@ typedef struct {
 	int ttl;
 } EventBlock;
 
-int *rbStart; /* start of ringbuffer per channel */
-int *rbNumEl; /* number of elements in RB per channel */
-MultiChannelBlock mcbRingBuf[RB_SIZE];
-int evIndex = 0; // write position in event ring buffer
+typedef struct {
+	volatile int status;	// 0=empty, 1=waiting or being sent
+	const char *name;		// name of the acquisition entity
+	INT32_T value[2];		// CSC sample of the spike, and cell number
+} SpikeSlot;
+
+/* Records, events or spikes that have been received but not been handed to
+   the thread yet, from 'first' (counting since the start) up to 'end'. They
+   are handed over when there are 'blockSize' of them, or when the first one
+   has been waiting for maxLatencyMs. */
+typedef struct {
+	int first;
+	int end;
+	int blockSize;
+	uint64_t firstTime;		// when 'first' came in, see ft_clock_ns
+} PendingRange;
+
+int *cscNextRecord; /* number of records received per channel */
+RecordSlot cscRing[RB_SIZE];
+short *cscRingSamples; /* RB_SIZE x maxCscSamples x numCSC */
+PendingRange cscPending;
 EventBlock evRingBuf[RB_SIZE];
+PendingRange evPending;
+SpikeSlot spkRing[RB_SIZE];
+short *spkRingSamples; /* RB_SIZE x spikeWindow x SPIKE_WIRES */
+PendingRange spkPending;
 
 int getObjectsAndTypes() {
 	char *objPtr[MAX_OBJ], *typPtr[MAX_OBJ];
@@ -101,6 +146,23 @@ int getObjectsAndTypes() {
 			evcIndex[numEvC++] = n;
 			continue;
 		}
+
+		// single electrodes, stereotrodes and tetrodes
+		if (!strcmp(cheetahTypes[n], "SEScAcqEnt")) {
+			spkWires[numSpk] = 1;
+			spkIndex[numSpk++] = n;
+			continue;
+		}
+		if (!strcmp(cheetahTypes[n], "STScAcqEnt")) {
+			spkWires[numSpk] = 2;
+			spkIndex[numSpk++] = n;
+			continue;
+		}
+		if (!strcmp(cheetahTypes[n], "TTScAcqEnt")) {
+			spkWires[numSpk] = 4;
+			spkIndex[numSpk++] = n;
+			continue;
+		}
 	}
 
 	if (numCSC>0) {
@@ -118,58 +180,129 @@ int getObjectsAndTypes() {
 }
 
 
+void initPending(PendingRange *P, int blockSize) {
+	P->first = P->end = 0;
+	P->blockSize = blockSize;
+	P->firstTime = 0;
+}
+
+/* Marks one more element of the range as received */
+void addPending(PendingRange *P) {
+	if (P->end == P->first) P->firstTime = ft_clock_ns();
+	P->end++;
+}
+
+/* Hands the pending elements over to the thread if the block is full, if the
+   oldest one has waited long enough, or if 'force' is set. Ranges that cross
+   the end of the ring buffer are handed over in two parts. Returns 0 on success. */
+int flushPending(PendingRange *P, int kind, int force) {
+	while (P->end > P->first) {
+		int count = P->end - P->first;
+		int slot  = P->first % RB_SIZE;
+		PipeMessage msg;
+		DWORD numWritten = 0;
+
+		if (!force && count < P->blockSize && ft_clock_ns() - P->firstTime < (uint64_t) maxLatencyMs * 1000000) return 0;
+
+		if (count > RB_SIZE - slot) count = RB_SIZE - slot;
+		msg.kind  = kind;
+		msg.slot  = slot;
+		msg.count = count;
+
+		// write the range to the pipe so the other thread picks it up
+		int ok = WriteFile(pipeWrite, &msg, sizeof(msg), &numWritten, NULL);
+		if (!ok || numWritten != sizeof(msg)) {
+			fprintf(stderr, "Error when writing to pipe\n");
+			return -1;
+		}
+		P->first += count;
+		P->firstTime = ft_clock_ns();
+	}
+	return 0;
+}
+
+
 void *dataToFieldTripThread(void *arg) {
-	int slot, maxLag = 0;
+	int maxLag = 0;
 	float avgLag = 0.0;
 	float W = 0.0;
 	DWORD numRead;
-	FtBufferRequest req;
+	PipeMessage msg;
+	FtBufferRequest req, batch;
 	FtBufferResponse resp;
+	FtEventList events;
 
 	printf("Thread started...\n");
 
 	while (1) {
-		ReadFile(pipeRead, &slot, sizeof(slot), &numRead, NULL);
+		ReadFile(pipeRead, &msg, sizeof(msg), &numRead, NULL);
 		if (numRead == 0) continue;
-		if (numRead != sizeof(slot)) break;
-
-		if (slot & 0x7FFF0000) {
-			// this is an event
-			slot &= 0xFFFF;
-			if (slot < 0 || slot >= RB_SIZE) break;
-
-			// offset = duration = 0, type = name (???), value = ttl
-			req.prepPutEvent(evRingBuf[slot].sample, 0, 0, evRingBuf[slot].name, evRingBuf[slot].ttl);
+		if (numRead != sizeof(msg)) break;
+		if (msg.slot < 0 || msg.count < 1 || msg.slot + msg.count > RB_SIZE) break;
+
+		if (msg.kind == MSG_EVENT) {
+			events.clear();
+			for (int j=msg.slot;j<msg.slot+msg.count;j++) {
+				// type = name (???), value = ttl
+				events.add(evRingBuf[j].sample, evRingBuf[j].name, (INT32_T) evRingBuf[j].ttl);
+			}
 
-			int r = tcprequest(ftSocket, req.out(), resp.in());
+			int r = clientrequest(ftSocket, events.asRequest(), resp.in());
 			if (r < 0 || !resp.checkPut()) {
 				fprintf(stderr, "Could not write event to FieldTrip buffer - aborting\n");
 				break;
 			}
-			evRingBuf[slot].status = 0;
+			for (int j=msg.slot;j<msg.slot+msg.count;j++) {
+				evRingBuf[j].status = 0;
+			}
 
-			++numEventsWritten;
-			printf("\nEvents: %i received, %i sent out, Name=%s, TTL=%i\n", numEventsRead, numEventsWritten, evRingBuf[slot].name, evRingBuf[slot].ttl);
+			numEventsWritten += msg.count;
+			printf("\nEvents: %i received, %i sent out, Name=%s, TTL=%i\n", numEventsRead, numEventsWritten, evRingBuf[msg.slot+msg.count-1].name, evRingBuf[msg.slot+msg.count-1].ttl);
 
-		} else {
-			if (slot < 0 || slot >= RB_SIZE) break;
+		} else if (msg.kind == MSG_SPIKE) {
+			// the waveforms and their events go into the spike stream together
+			events.clear();
+			for (int j=0;j<msg.count;j++) {
+				const SpikeSlot *S = &spkRing[msg.slot+j];
+				events.add(numSpikesWritten + j, DATATYPE_CHAR, strlen(S->name), S->name, DATATYPE_INT32, 2, S->value);
+			}
+			req.prepPutData(SPIKE_WIRES*spikeWindow, msg.count, DATATYPE_INT16, spkRingSamples + msg.slot*spikeWindow*SPIKE_WIRES);
+			batch.prepPutBatch();
+			batch.prepBatchAdd(req);
+			batch.prepBatchAdd(events.asRequest());
 
-			req.prepPutData(numCSC, maxCscSamples, DATATYPE_INT16, mcbRingBuf[slot].samples);
-			int r = tcprequest(ftSocket, req.out(), resp.in());
+			int r = streamrequest(ftSocket, SPIKE_STREAM, batch.out(), resp.in());
+			if (r < 0 || !resp.checkPut()) {
+				fprintf(stderr, "Could not write spikes to FieldTrip buffer - aborting\n");
+				break;
+			}
+			for (int j=msg.slot;j<msg.slot+msg.count;j++) {
+				spkRing[j].status = 0;
+			}
+			numSpikesWritten += msg.count;
+
+		} else if (msg.kind == MSG_CSC) {
+			// the records of one range follow each other in the ring buffer
+			req.prepPutData(numCSC, msg.count*maxCscSamples, DATATYPE_INT16, cscRingSamples + msg.slot*maxCscSamples*numCSC);
+			int r = clientrequest(ftSocket, req.out(), resp.in());
 			if (r < 0 || !resp.checkPut()) {
 				fprintf(stderr, "Could not write samples to FieldTrip buffer - aborting\n");
 				break;
 			}
-			mcbRingBuf[slot].status = 0;
+			for (int j=msg.slot;j<msg.slot+msg.count;j++) {
+				cscRing[j].status = 0;
+			}
 
-			++numBlocksWritten;
+			numBlocksWritten += msg.count;
 			int lag = numBlocksComplete - numBlocksWritten;
 			if (lag>maxLag) maxLag = lag;
 
 			avgLag = (W*avgLag + lag)/(1.0+W);
 			W = 0.99*W + 1.0;
 
-			printf("CSC blocks written: %i (lag=%i, max=%i, avg=%.2f)  \r", numBlocksWritten, lag, maxLag, avgLag);
+			printf("CSC records written: %i (lag=%i, max=%i, avg=%.2f, spikes=%i)  \r", numBlocksWritten, lag, maxLag, avgLag, numSpikesWritten);
+		} else {
+			break;
 		}
 	}
 
@@ -184,6 +317,20 @@ void abortHandler(int sig) {
 	keepRunning = 0;
 }
 
+/* Reads the new records of a spike acquisition entity */
+int getNewSpikeData(int nSpk, int *numRecordsReturned, int *numRecordsDropped) {
+	char *stream = cheetahObjects[spkIndex[nSpk]];
+
+	switch (spkWires[nSpk]) {
+		case 1:
+			return GetNewSEData(stream, &retBufTimeStamps, &retBufScNumbers, &retBufCellNumbers, &retBufFeatures, &retBufSpikeSamples, numRecordsReturned, numRecordsDropped);
+		case 2:
+			return GetNewSTData(stream, &retBufTimeStamps, &retBufScNumbers, &retBufCellNumbers, &retBufFeatures, &retBufSpikeSamples, numRecordsReturned, numRecordsDropped);
+		default:
+			return GetNewTTData(stream, &retBufTimeStamps, &retBufScNumbers, &retBufCellNumbers, &retBufFeatures, &retBufSpikeSamples, numRecordsReturned, numRecordsDropped);
+	}
+}
+
 int main(int argc, char *argv[]) {
 	FtBufferRequest req;
 	FtBufferResponse resp;
@@ -203,6 +350,10 @@ int main(int argc, char *argv[]) {
 	} else {
 		port = atoi(argv[2]);
 	}
+	if (argc>3) {
+		maxLatencyMs = atoi(argv[3]);
+		if (maxLatencyMs < 0) maxLatencyMs = 0;
+	}
 
 	r = CreatePipe(&pipeRead, &pipeWrite, NULL, 0);
 	if (!r) {
@@ -211,7 +362,7 @@ int main(int argc, char *argv[]) {
 	}
 
 	printf("Trying to connect to FieldTrip buffer on %s:%i\n", hostname, port);
-	ftSocket = open_connection(hostname, port);
+	ftSocket = ft_open_buffer(hostname, port, &ftServer);
 	if (ftSocket < 0) {
 		fprintf(stderr, "Connection failed - aborting\n");
 		exit(1);
@@ -237,12 +388,17 @@ int main(int argc, char *argv[]) {
 	recordBufferSize = GetRecordBufferSize();
 	maxCscSamples = GetMaxCSCSamples();
 	maxEventStringLength = GetMaxEventStringLength();
+	spikeWindow = GetSpikeSampleWindowSize();
+	maxSpikeFeatures = GetMaxSpikeFeatures();
 
 	printf("Number of CSC streams......: %i\n", numCSC);
 	printf("Number of event streams....: %i\n", numEvC);
+	printf("Number of spike streams....: %i\n", numSpk);
 	printf("Samples per block..........: %i\n", maxCscSamples);
+	printf("Samples per spike..........: %i\n", spikeWindow);
 	printf("Record buffer size.........: %i\n", recordBufferSize);
 	printf("Max. length event strings..: %i\n", maxEventStringLength);
+	printf("Max. latency (ms)..........: %i\n", maxLatencyMs);
 	printf("Server PC name.............: %s\n", GetServerPCName());
 	printf("Server IP address..........: %s\n", GetServerIPAddress());
 	printf("Server application.........: %s\n", GetServerApplicationName());
@@ -265,25 +421,35 @@ int main(int argc, char *argv[]) {
 	for (int j=0;j<recordBufferSize;j++) {
 		retBufEventString[j] = new char[maxEventStringLength+1];
 	}
-	rbStart = new int[numCSC];
-	rbNumEl = new int[numCSC];
+	retBufScNumbers       = new int[recordBufferSize];
+	retBufCellNumbers     = new int[recordBufferSize];
+	retBufFeatures        = new int[recordBufferSize * maxSpikeFeatures];
+	retBufSpikeSamples    = new short[recordBufferSize * spikeWindow * SPIKE_WIRES];
+	cscNextRecord = new int[numCSC];
 
 	printf("Preparing internal ring buffer\n");
 
+	cscRingSamples = new short[RB_SIZE * maxCscSamples * numCSC];
+	spkRingSamples = new short[RB_SIZE * spikeWindow * SPIKE_WIRES];
 	for (int j=0;j<RB_SIZE;j++) {
-		mcbRingBuf[j].status = 0; // empty
-		mcbRingBuf[j].timeStamp = 0;
-		mcbRingBuf[j].chansFilled = 0;
-		mcbRingBuf[j].samples = new short[numCSC * maxCscSamples];
+		cscRing[j].status = 0; // empty
+		cscRing[j].timeStamp = 0;
+		cscRing[j].chansFilled = 0;
 
 		evRingBuf[j].status = 0;
 		evRingBuf[j].sample = 0;
 		evRingBuf[j].name = new char[maxEventStringLength+1];
+
+		spkRing[j].status = 0;
 	}
+	// flush at least every quarter of the ring buffer
+	initPending(&cscPending, RB_SIZE/4);
+	initPending(&evPending,  RB_SIZE/4);
+	initPending(&spkPending, RB_SIZE/4);
 
 	printf("Opening CSC channels...\n");
 	for (int j=0;j<numCSC;j++) {
-		rbStart[j] = rbNumEl[j] = 0;
+		cscNextRecord[j] = 0;
 		r = OpenStream(cheetahObjects[cscIndex[j]]);
 		if (!r) {
 			fprintf(stderr, "Could not open CSC channel %s\n", cheetahObjects[cscIndex[j]]);
@@ -300,6 +466,15 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
+	printf("Opening spike channels...\n");
+	for (int j=0;j<numSpk;j++) {
+		r = OpenStream(cheetahObjects[spkIndex[j]]);
+		if (!r) {
+			fprintf(stderr, "Could not open spike channel %s\n", cheetahObjects[spkIndex[j]]);
+			goto cleanup;
+		}
+	}
+
 	/* register CTRL-C handler */
 	signal(SIGINT, abortHandler);
 
@@ -334,13 +509,14 @@ int main(int argc, char *argv[]) {
 			doneSomething = 1;
 
 			for (int i=0;i<numRecordsReturned;i++) {
-				// TODO: check if using this channel number is right and preferable to nCSC
-				int chan = retBufChannelNumbers[i];
+				// the row in the buffer follows the order of the streams, the channel
+				// number of the record is that of the A/D converter and can be anything
+				int chan = nCSC;
 				int freq = retBufSamplingFreq[i];
 				int vals = retBufValidSamples[i];
 				uint64_t ts = retBufTimeStamps[i];
 
-				// printf("#%i/%i  chan = %3i  Time = %8u  fSamp = %6i  valid = %4i\n", i+1, numRecordsReturned, chan, (uint32_t) ts, freq, vals);
+				// printf("#%i/%i  chan = %3i  Time = %8u  fSamp = %6i  valid = %4i\n", i+1, numRecordsReturned, retBufChannelNumbers[i], (uint32_t) ts, freq, vals);
 
 				if (fSamp == -1) {
 					fSamp = freq;
@@ -358,11 +534,21 @@ int main(int argc, char *argv[]) {
 					if (channelNamesForChunk != NULL) {
 						req.prepPutHeaderAddChunk(FT_CHUNK_CHANNEL_NAMES, channelNamesSize, channelNamesForChunk);
 					}
-					int r = tcprequest(ftSocket, req.out(), resp.in());
+					int r = clientrequest(ftSocket, req.out(), resp.in());
 					if (r < 0 || !resp.checkPut()) {
 						fprintf(stderr, "Could not write header to FieldTrip buffer - aborting\n");
 						goto cleanup;
 					}
+
+					if (numSpk > 0) {
+						// one sample per spike, the events of the spikes refer to the samples of the CSC channels
+						req.prepPutHeader(SPIKE_WIRES*spikeWindow, DATATYPE_INT16, (float) fSampleDP);
+						int r = streamrequest(ftSocket, SPIKE_STREAM, req.out(), resp.in());
+						if (r < 0 || !resp.checkPut()) {
+							fprintf(stderr, "Could not write header of the spike stream - aborting\n");
+							goto cleanup;
+						}
+					}
 					headerWritten = 1;
 				} else if (fSamp != freq) {
 					fprintf(stderr, "Inconsistent sampling frequency in stream '%s' - aborting!\n", stream);
@@ -374,54 +560,41 @@ int main(int argc, char *argv[]) {
 				}
 
 				// ok, everything looks fine, add to ring buffer
-				// this is the index where we need to put it, wrap around if necessary
-				int index = rbStart[chan] + rbNumEl[chan];
-				if (index>=RB_SIZE) index-=RB_SIZE;
+				// this is the slot of the next record of this channel
+				int record = cscNextRecord[chan];
+				int index = record % RB_SIZE;
 
-				if (mcbRingBuf[index].status == 2) {
+				if (cscRing[index].status >= 2) {
 					fprintf(stderr, "Streaming thread cannot keep up with data load - aborting\n");
 					goto cleanup;
 				}
-				if (mcbRingBuf[index].status == 0) {
-					mcbRingBuf[index].timeStamp = ts;
-					mcbRingBuf[index].status = 1;
+				if (cscRing[index].status == 0) {
+					cscRing[index].timeStamp = ts;
+					cscRing[index].status = 1;
 					// always base our timing reference on most recent block
 					refTimeStamp = ts;
-					refSample = numBlocksComplete * maxCscSamples;
-				} else if (mcbRingBuf[index].timeStamp != ts) {
+					refSample = record * maxCscSamples;
+				} else if (cscRing[index].timeStamp != ts) {
 					fprintf(stderr, "Inconsistent time stamps in stream '%s' records and internal ring buffer - aborting\n", stream);
 					goto cleanup;
 				}
 				// fine, write samples at right channel
 				// have 'dest' point to proper row in ring buffer slot
-				short *dest = mcbRingBuf[index].samples + chan;
+				short *dest = cscRingSamples + index*maxCscSamples*numCSC + chan;
 				// have 'src' point to first sample in current record
 				short *src  = retBufSamples + i*maxCscSamples;
 				for (int n=0;n<maxCscSamples;n++) {
 					dest[n*numCSC] = src[n];
 				}
-				rbNumEl[chan]++;
-				// see if all channels are filled in this slot, and if so, write out
-				if (++mcbRingBuf[index].chansFilled == numCSC) {
-					DWORD numWritten = 0;
-
+				cscNextRecord[chan]++;
+				// see if all channels are filled in this slot, the records complete in order
+				if (++cscRing[index].chansFilled == numCSC) {
 					++numBlocksComplete;
 					// printf("CSC block %i completed\n", numBlocksComplete);
 
-					mcbRingBuf[index].chansFilled = 0;
-					mcbRingBuf[index].status = 2;
-
-					// write index to pipe so the other thread picks it up
-					int ok = WriteFile(pipeWrite, &index, sizeof(index), &numWritten, NULL);
-					if (!ok || numWritten != sizeof(index)) {
-						fprintf(stderr, "Error when writing to pipe\n");
-						goto cleanup;
-					}
-
-					for (int j=0;j<numCSC;j++) {
-						if (++rbStart[j] == RB_SIZE) rbStart[j] = 0;
-						rbNumEl[j]--;
-					}
+					cscRing[index].chansFilled = 0;
+					cscRing[index].status = 2;
+					addPending(&cscPending);
 				}
 			}
 		}  // end of loop over cont. channels
@@ -447,8 +620,7 @@ int main(int argc, char *argv[]) {
 			doneSomething = 1;
 
 			for (int i=0;i<numRecordsReturned;i++) {
-				int index = evIndex;
-				DWORD numWritten = 0;
+				int index = evPending.end % RB_SIZE;
 
 				if (!headerWritten) {
 					fprintf(stderr, "No header written yet - ignoring event\n");
@@ -467,19 +639,60 @@ int main(int argc, char *argv[]) {
 				evRingBuf[index].eventID = retBufEventIDs[i];
 				evRingBuf[index].ttl     = retBufTTL[i];
 				evRingBuf[index].status  = 1; // ready to be sent
+				addPending(&evPending);
+			}
+
+		}
+
+		for (int nSpk = 0; nSpk < numSpk; nSpk++) {
+			char *stream = cheetahObjects[spkIndex[nSpk]];
+			int numValues = spkWires[nSpk] * spikeWindow;
+
+			r = getNewSpikeData(nSpk, &numRecordsReturned, &numRecordsDropped);
 
-				index += 0x10000; // this tells the thread to look for events, not CSC
+			if (r==0) {
+				fprintf(stderr, "Error in reading spikes from stream '%s' - aborting\n", stream);
+				goto cleanup;
+			}
+
+			if (numRecordsDropped > 0) {
+				fprintf(stderr, "Records dropped in stream '%s' - cancelling operation.\n", stream);
+				goto cleanup;
+			}
+
+			if (numRecordsReturned == 0) continue;
 
-				// write index to pipe so the other thread picks it up
-				int ok = WriteFile(pipeWrite, &index, sizeof(index), &numWritten, NULL);
-				if (!ok || numWritten != sizeof(index)) {
-					fprintf(stderr, "Error when writing to pipe\n");
+			doneSomething = 1;
+
+			for (int i=0;i<numRecordsReturned;i++) {
+				int index = spkPending.end % RB_SIZE;
+
+				// the spikes need the sampling rate of the CSC channels
+				if (!headerWritten) continue;
+
+				++numSpikesRead;
+
+				if (spkRing[index].status == 1) {
+					fprintf(stderr, "Streaming thread cannot keep up with spike load - aborting\n");
 					goto cleanup;
 				}
 
-				if (++evIndex == RB_SIZE) evIndex = 0;
+				// the samples of the wires are interleaved, the missing wires are zero
+				short *dest = spkRingSamples + index*spikeWindow*SPIKE_WIRES;
+				memcpy(dest, retBufSpikeSamples + i*numValues, numValues*sizeof(short));
+				memset(dest + numValues, 0, (SPIKE_WIRES*spikeWindow - numValues)*sizeof(short));
+
+				spkRing[index].name     = stream;
+				spkRing[index].value[0] = refSample + (int) (0.5 + (retBufTimeStamps[i] - refTimeStamp) * samplesPerTimeStamp);
+				spkRing[index].value[1] = retBufCellNumbers[i];
+				spkRing[index].status   = 1;
+				addPending(&spkPending);
 			}
+		}
 
+		// hand over the blocks that are full or have waited long enough
+		if (flushPending(&cscPending, MSG_CSC, 0) || flushPending(&evPending, MSG_EVENT, 0) || flushPending(&spkPending, MSG_SPIKE, 0)) {
+			goto cleanup;
 		}
 
 		// if we're not to busy, let other processes use the machine
@@ -490,7 +703,7 @@ cleanup:
 
 	DisconnectFromServer();
 
-	if (ftSocket != -1) close_connection(ftSocket);
+	if (ftSocket != -1) ft_close_buffer(ftSocket, ftServer);
 
 	delete[] retBufSamples;
 	delete[] retBufTimeStamps;
@@ -499,10 +712,14 @@ cleanup:
 	delete[] retBufValidSamples;
 	delete[] retBufTTL;
 	delete[] retBufEventIDs;
-	delete[] rbStart;
-	delete[] rbNumEl;
+	delete[] retBufScNumbers;
+	delete[] retBufCellNumbers;
+	delete[] retBufFeatures;
+	delete[] retBufSpikeSamples;
+	delete[] cscNextRecord;
+	delete[] cscRingSamples;
+	delete[] spkRingSamples;
 	for (int j=0;j<RB_SIZE;j++) {
-		delete[] mcbRingBuf[j].samples;
 		delete[] evRingBuf[j].name;
 	}
 	if (channelNamesForChunk) {
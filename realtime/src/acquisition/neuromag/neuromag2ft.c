@@ -468,6 +468,10 @@ int main (int argc, char **argv)
     fieldtrip_sock = 0;
   }
 
+  /* The data buffers are converted and written in a separate thread */
+  if (start_data_thread())
+    return(4);
+
   /* Mainloop */
   dacq_log("Will scale up MEG mags by %g, grads by %g and EEG data by %g\n",
       meg_mag_multiplier, meg_grad_multiplier, eeg_multiplier);
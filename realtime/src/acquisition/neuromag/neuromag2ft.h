@@ -18,7 +18,10 @@ extern int version_minor;
 extern int version_patch;
 extern int fieldtrip_sock;
 extern int process_tag(fiffTag tag);
-extern void process_data(float **data, int nchan, int nsamp, fiffChInfo *ch_info);
+extern int start_data_thread();
+extern void queue_data(fiffTag tag, int nchan, int nsamp);
+extern void flush_data();
+extern int set_calibration(int nchan, fiffChInfo *ch_info);
 extern void clean_up();
 extern float meg_mag_multiplier;
 extern float meg_grad_multiplier;
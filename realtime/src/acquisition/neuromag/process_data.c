@@ -8,79 +8,273 @@
  * its use.
  */
 
+#include <pthread.h>
+#include <signal.h>
 #include <fiff.h>
+#include <dacq.h>
 #include <buffer.h>
 #include "neuromag2ft.h"
 
+/*
+ * The data buffers are converted and written to the FieldTrip buffer in a
+ * separate thread, so that the thread that receives the tags from the data
+ * server only has to copy them. The raw samples are kept in a small queue of
+ * blocks until the conversion thread gets to them.
+ */
+
+#define NUM_BLOCKS 32   /* data buffers that can wait for the conversion */
+
+typedef struct {
+  int type;             /* FIFFT_DAU_PACK16 or FIFFT_INT */
+  int nchan;
+  int nsamp;
+  int size;             /* allocated bytes of data */
+  void *data;
+} raw_block_t;
+
+static raw_block_t blocks[NUM_BLOCKS];
+static unsigned int head = 0;  /* next block to be filled by the receiving thread */
+static unsigned int tail = 0;  /* next block to be converted */
+static int waiting = 0;        /* did the receiving thread have to wait? */
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t data_tid;
+
+static float *gain     = NULL; /* calibration of each channel, only changed while the queue is empty */
+static int gain_nchan  = 0;
+static char *request_buf = NULL;
+static int request_size  = 0;
+
 /* --------------------------------------------------------------------------
- * Process one data buffer. 
- * 
- * Do your processing here. Note that if it takes too long, a buffer
- * overflow may occur.
+ * The conversion kernels. The samples come in with all channels of the first
+ * sample, then all channels of the second sample, etc, which is also how the
+ * FieldTrip buffer stores them, so either loop runs over contiguous memory
+ * and can be vectorized by the compiler.
  */
 
-void process_data(float **scannerData, int nchan, int nsamp, fiffChInfo *ch_info)
+static void convert_pack16(float *dest, const fiff_dau_pack16_t *src, const float *cal, int nchan, int nsamp)
 {
+  int ch, ns;
 
-  int ch = 0, samp;
+  for (ns = 0; ns < nsamp; ns++) {
+    for (ch = 0; ch < nchan; ch++)
+      dest[ch] = cal[ch] * (float) src[ch];
+    dest += nchan;
+    src  += nchan;
+  }
+}
 
-  //printf("Data buffer: %d channels, %d samples\n", nchan, nsamp);
+static void convert_int(float *dest, const fiff_int_t *src, const float *cal, int nchan, int nsamp)
+{
+  int ch, ns;
 
-  // writing data to fiedltrip buffer
-  data_t       *data     = NULL;
-  message_t    *request  = NULL;
-  message_t    *response = NULL;
-  int		status = 0;
-
-  // allocate the elements that will be used in the communication
-  data      = malloc(sizeof(data_t));
-  data->def = malloc(sizeof(datadef_t));
-  data->buf = NULL;
-
-  // define the constant part of the data and allocate space for the variable part 
-  data->def->nchans    = nchan;
-  data->def->nsamples  = nsamp;
-  data->def->data_type = DATATYPE_FLOAT32;
-  data->def->bufsize   = WORDSIZE_FLOAT32*nchan*nsamp;
-  FREE(data->buf);
-  data->buf            = malloc(WORDSIZE_FLOAT32*nchan*nsamp);
-
-  // the buffer is organized with the first sample for all channels, then the second
-  // sample for all channels, etc
-  for (samp = 0; samp < nsamp; samp++) {
+  for (ns = 0; ns < nsamp; ns++) {
     for (ch = 0; ch < nchan; ch++)
-      ((FLOAT32_T *)(data->buf))[samp*nchan+ch] = scannerData[ch][samp];
+      dest[ch] = cal[ch] * (float) src[ch];
+    dest += nchan;
+    src  += nchan;
+  }
+}
+
+/* converts the samples [first, first+n) of a block, see ft_put_data_direct */
+static void convert_block(void *dest, UINT32_T first, UINT32_T n, void *arg)
+{
+  const raw_block_t *B = (const raw_block_t *) arg;
+
+  if (B->type == FIFFT_DAU_PACK16)
+    convert_pack16((float *) dest, (const fiff_dau_pack16_t *) B->data + first*B->nchan, gain, B->nchan, n);
+  else
+    convert_int((float *) dest, (const fiff_int_t *) B->data + first*B->nchan, gain, B->nchan, n);
+}
+
+/* --------------------------------------------------------------------------
+ * Process one data buffer.
+ *
+ * Do your processing here. Note that if it takes too long, the queue fills up
+ * and the data server may overflow.
+ */
+
+static void process_data(raw_block_t *B)
+{
+  datadef_t    *datadef;
+  messagedef_t  reqdef;
+  message_t     request;
+  message_t    *response = NULL;
+  int           bufsize;
+
+  if (B->nchan != gain_nchan) {
+    fprintf(stderr, "Data buffer with %d channels does not match the header (%d channels).\n", B->nchan, gain_nchan);
+    return;
+  }
+
+  if (fieldtrip_sock == 0) {
+    /* we are hosting the buffer, the samples are converted straight into its ring */
+    if (ft_put_data_direct(B->nchan, B->nsamp, DATATYPE_FLOAT32, convert_block, B))
+      fprintf(stderr, "Something wrong with FieldTrip buffer while writing.\n");
+    return;
   }
 
-  // create the request
-  request      = malloc(sizeof(message_t));
-  request->def = malloc(sizeof(messagedef_t));
-  request->buf = NULL;
-  request->def->version = VERSION;
-  request->def->bufsize = 0;
-  request->def->command = PUT_DAT;
-  request->def->bufsize = append(&request->buf, request->def->bufsize, data->def, sizeof(datadef_t));
-  request->def->bufsize = append(&request->buf, request->def->bufsize, data->buf, data->def->bufsize);
+  /* the request is kept between the data buffers to avoid allocating it every time */
+  bufsize = sizeof(datadef_t) + WORDSIZE_FLOAT32*B->nchan*B->nsamp;
+  if (bufsize > request_size) {
+    char *buf = realloc(request_buf, bufsize);
+    if (buf == NULL) {
+      fprintf(stderr, "Out of memory for the data buffer.\n");
+      return;
+    }
+    request_buf  = buf;
+    request_size = bufsize;
+  }
+  datadef = (datadef_t *) request_buf;
+  datadef->nchans    = B->nchan;
+  datadef->nsamples  = B->nsamp;
+  datadef->data_type = DATATYPE_FLOAT32;
+  datadef->bufsize   = WORDSIZE_FLOAT32*B->nchan*B->nsamp;
+  convert_block(datadef + 1, 0, B->nsamp, B);
 
-  status = clientrequest(fieldtrip_sock, request, &response);
+  reqdef.version = VERSION;
+  reqdef.command = PUT_DAT;
+  reqdef.bufsize = bufsize;
+  request.def = &reqdef;
+  request.buf = request_buf;
 
-  if (status) {
+  if (clientrequest(fieldtrip_sock, &request, &response) || response == NULL || response->def == NULL || response->def->command != PUT_OK)
     fprintf(stderr, "Something wrong with FieldTrip buffer while writing.\n");
+
+  if (response) {
+    FREE(response->def);
+    FREE(response->buf);
+    free(response);
+  }
+}
+
+/* --------------------------------------------------------------------------
+ * The conversion thread
+ */
+
+static void *data_thread(void *arg)
+{
+  sigset_t blocked_set;
+
+  /* Block the termination signals in this thread so that the main thread gets them */
+  sigemptyset(&blocked_set);
+  sigaddset(&blocked_set, SIGINT);
+  sigaddset(&blocked_set, SIGHUP);
+  sigaddset(&blocked_set, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &blocked_set, NULL);
+
+  for (;;) {
+    pthread_mutex_lock(&queue_mutex);
+    while (head == tail)
+      pthread_cond_wait(&queue_cond, &queue_mutex);
+    pthread_mutex_unlock(&queue_mutex);
+
+    process_data(&blocks[tail % NUM_BLOCKS]);
+
+    pthread_mutex_lock(&queue_mutex);
+    tail++;
+    pthread_cond_broadcast(&queue_cond);
+    pthread_mutex_unlock(&queue_mutex);
+  }
+  return NULL;
+}
+
+int start_data_thread()
+{
+  if (pthread_create(&data_tid, NULL, data_thread, NULL)) {
+    dacq_log("Failed to start the data conversion thread\n");
+    return(FAIL);
+  }
+  return(OK);
+}
+
+/* --------------------------------------------------------------------------
+ * Wait until all queued data buffers have been written
+ */
+
+void flush_data()
+{
+  pthread_mutex_lock(&queue_mutex);
+  while (head != tail)
+    pthread_cond_wait(&queue_cond, &queue_mutex);
+  pthread_mutex_unlock(&queue_mutex);
+}
+
+/* --------------------------------------------------------------------------
+ * Compute the calibration of each channel for the coming data buffers
+ */
+
+int set_calibration(int nchan, fiffChInfo *ch_info)
+{
+  int ch;
+  float a, *newgain;
+
+  flush_data();
+
+  newgain = realloc(gain, (nchan > 0 ? nchan : 1) * sizeof(float));
+  if (newgain == NULL) {
+    dacq_log("Failed to allocate the calibration of %d channels\n", nchan);
+    return(FAIL);
+  }
+  gain = newgain;
+  gain_nchan = nchan;
+
+  for (ch = 0; ch < nchan; ch++) {
+    switch(ch_info[ch]->kind) {
+      case FIFFV_MAGN_CH:
+        if (ch_info[ch]->unit == FIFF_UNIT_T_M)
+          a = meg_grad_multiplier;
+        else
+          a = meg_mag_multiplier;
+        break;
+      case FIFFV_EL_CH:
+        a = eeg_multiplier;
+        break;
+      default:
+        a = 1.0;
+    }
+    gain[ch] = a * ch_info[ch]->cal * ch_info[ch]->range;
+  }
+  return(OK);
+}
+
+/* --------------------------------------------------------------------------
+ * Copy one data buffer into the queue for the conversion thread
+ */
+
+void queue_data(fiffTag tag, int nchan, int nsamp)
+{
+  raw_block_t *B;
+
+  pthread_mutex_lock(&queue_mutex);
+  if (head - tail == NUM_BLOCKS) {
+    if (!waiting)
+      dacq_log("Writing to the FieldTrip buffer falls behind, waiting for the conversion\n");
+    waiting = 1;
+    while (head - tail == NUM_BLOCKS)
+      pthread_cond_wait(&queue_cond, &queue_mutex);
+  } else if (head == tail)
+    waiting = 0;
+  pthread_mutex_unlock(&queue_mutex);
+
+  /* the conversion thread does not touch this block until head is increased */
+  B = &blocks[head % NUM_BLOCKS];
+  if (tag->size > B->size) {
+    void *data = realloc(B->data, tag->size);
+    if (data == NULL) {
+      dacq_log("Failed to allocate %d bytes for a data buffer\n", tag->size);
+      return;
+    }
+    B->data = data;
+    B->size = tag->size;
   }
+  memcpy(B->data, tag->data, tag->size);
+  B->type  = tag->type;
+  B->nchan = nchan;
+  B->nsamp = nsamp;
 
-  // FIXME do someting with the response, i.e. check that it is OK 
-  free(request->def);
-  request->def = NULL;
-  free(request->buf);
-  request->buf = NULL;
-  free(request);
-  request = NULL;
-  free(data->def);
-  data->def = NULL;
-  free(data->buf);
-  data->buf = NULL;
-  free(data);	
-  data = NULL;
-  free(response);
-  response = NULL;
+  pthread_mutex_lock(&queue_mutex);
+  head++;
+  pthread_cond_broadcast(&queue_cond);
+  pthread_mutex_unlock(&queue_mutex);
 }
@@ -30,7 +30,6 @@ static int ch_count           = 0;    /* General channel counter */
 static fiffChInfo *ch_info    = NULL; /* Channel information */
 static float sfreq            = -1.0; /* Sampling frequency (Hz) */
 static int bufcnt             = 0;    /* How many buffers processed? */
-static float **databuf        = NULL; /* Internal storage for one databuffer */
 static int collect_data       = 1;    /* Really use the data? */
 static int collect_headerfile = 1;    /* Should tags be added to the headerfile? */
 static FILE *headerfile       = NULL; /* see http://bugzilla.fcdonders.nl/show_bug.cgi?id=1792, this is a temporary file that is copied to a chunk in the buffer */
@@ -51,60 +50,6 @@ static void set_data_filter(int state)
 }
 #endif
 
-/* -------------------------------------------------------------------------
- * Get one data buffer, apply calibration coefficients and store the data
- */
-
-static void catch_data(fiffTag tag,     /* Our data tag */
-    float **ch_data, /* (nchan x nsamp) data matrix */
-    int nchan,       /* Total number of channels */
-    int nsamp)       /* Number of samples in data buffer */
-{
-  int ch, ns;
-  float a;
-
-  if (tag->type == FIFFT_DAU_PACK16) {
-    fiff_dau_pack16_t *data16 = (fiff_dau_pack16_t *)tag->data;
-    for (ch = 0; ch < nchan; ch++) {
-      switch(ch_info[ch]->kind) {
-        case FIFFV_MAGN_CH:
-          if (ch_info[ch]->unit == FIFF_UNIT_T_M)
-            a = meg_grad_multiplier;
-          else
-            a = meg_mag_multiplier;
-          break;
-        case FIFFV_EL_CH:
-          a = eeg_multiplier;
-          break;
-        default:
-          a = 1.0;
-      }
-      for (ns = 0; ns < nsamp; ns++)
-        ch_data[ch][ns] = a * ch_info[ch]->cal * ch_info[ch]->range * data16[nchan*ns+ch];
-    }
-  }
-  else {
-    fiff_int_t *data32 = (fiff_int_t *)tag->data;
-    for (ch = 0; ch < nchan; ch++) {
-      switch(ch_info[ch]->kind) {
-        case FIFFV_MAGN_CH:
-          if (ch_info[ch]->unit == FIFF_UNIT_T_M)
-            a = meg_grad_multiplier;
-          else
-            a = meg_mag_multiplier;
-          break;
-        case FIFFV_EL_CH:
-          a = eeg_multiplier;
-          break;
-        default:
-          a = 1.0;
-      }
-      for (ns = 0; ns < nsamp; ns++)
-        ch_data[ch][ns] = a * ch_info[ch]->cal * ch_info[ch]->range * data32[nchan*ns+ch];
-    }
-  }
-}
-
 /* -------------------------------------------
  * Read the header file and append it as chunk
  */
@@ -309,18 +254,10 @@ int process_tag (fiffTag tag)
 								nsamp = nchan > 0 ? tag->size / (nchan * sizeof(fiff_int_t)) : 0;
 						bufcnt++;
 
-						if (collect_data) {
-
-								if (databuf == NULL) {
-										databuf = calloc(nchan, sizeof(float *));
-										for (c = 0; c < nchan; c++)
-												databuf[c] = calloc(nsamp, sizeof(float));
-								}
-
-								catch_data(tag,databuf,nchan,nsamp);
-								process_data(databuf,nchan,nsamp,ch_info);
-
-						} else
+						if (collect_data)
+								/* the conversion thread calibrates the data and writes it to the buffer */
+								queue_data(tag,nchan,nsamp);
+						else
 								printf("Data buffer not sent\n");
 
 						break;
@@ -354,7 +291,10 @@ int process_tag (fiffTag tag)
 												headerfile = NULL;
 												collect_headerfile = 0;
 										}
+										/* the data of the previous measurement has to be written with the previous header */
+										flush_data();
 										send_header_to_FT();
+										set_calibration(nchan, ch_info);
 										break;
 						}
 						break;
@@ -366,16 +306,8 @@ int process_tag (fiffTag tag)
 								case FIFFB_MEAS :
 										dacq_log("Measurement ended (%d buffers).\n", bufcnt);
 
-										// data was acquired, so we need to clear the data and the channel info
-										if (databuf != NULL) {
-												for (c = 0; c < nchan; c++) {
-														free(databuf[c]);
-														free(ch_info[c]);
-												}
-												free(databuf); databuf = NULL;
-												free(ch_info); ch_info = NULL;
-										}
-										// channel info was created, but data was not acquired
+										// write the remaining data, and clear the channel info
+										flush_data();
 										if (ch_info != NULL) {
 												for (c = 0; c < nchan; c++)
 														free(ch_info[c]);
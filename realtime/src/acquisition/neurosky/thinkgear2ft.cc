@@ -4,9 +4,7 @@
 */
 #include <serial.h>
 
-#include <OnlineDataManager.h>
-#include <ConsoleInput.h>
-#include <StringServer.h>
+#include <AcquisitionDriver.h>
 
 /**
 ThinkCap is a 7 channel dry-sensor EEG device. It is basically using
@@ -17,70 +15,100 @@ sampling rate, i.e. Thinkcap: 7ch/250Hz; Mindset: 1ch/512Hz.
 
 #define NUMCHANS    7
 #define FSAMPLE     250.0
-#define MAXBLOCK    20
-
-unsigned char packet[170];
-
-
-int tryReadPacket(SerialPort *SP) {
-	unsigned char byte;
-	unsigned char checksum;
-	int len;
-	int nr, syncBytes = 0;
-   
-sync:
-	while (syncBytes < 2) {
-		nr = serialRead(SP, 1, &byte);
-		if (nr<0) return nr;
-		if (nr==0) continue;
-		if (byte == 0xAA) {
-			syncBytes++;
-		} else {
-			syncBytes = 0;
-		}
-	}
-   
-	do {
-		nr = serialRead(SP, 1, &byte);
-		if (nr < 0) return -1;
-		if (nr==0) continue;
-		if (byte > 0xAA) {
-			syncBytes = 0;
-			goto sync;
-		}
-	} while (!nr || byte==0xAA);
-
-	len = byte;
-	checksum = 0;
 
+/** Frame function for the receive buffer. A packet starts with two sync bytes 0xAA,
+	followed by the length of the payload, the payload itself and a checksum.
+*/
+int thinkgearFrame(const unsigned char *data, int length, void *user) {
+	if (data[0] != 0xAA) return -1;
+	if (length < 2) return 0;
+	if (data[1] != 0xAA) return -1;
+	if (length < 3) return 0;
+	
+	int len = data[2];
+	if (len >= 0xAA) return -1; // more sync bytes, or not a packet at all
+	if (length < 4 + len) return 0;
+	
+	unsigned char checksum = 0;
 	for (int i=0;i<len;i++) {
-		do {
-			nr = serialRead(SP, 1, packet + i);
-			if (nr==0) continue;
-			if (nr < 0) return -1;
-		} while (!nr);
-		checksum += packet[i];
+		checksum += data[3+i];
 	}
 	checksum = ~checksum;
-	do {
-		nr = serialRead(SP, 1, &byte);
-		if (nr < 0) return -1;
-	} while (!nr);
-	if (byte != checksum) {
-		syncBytes = 0;
-		goto sync;
-	}
-	return len;
+	if (data[3+len] != checksum) return -1;
+	return 4 + len;
 }
 
+/** The ThinkCap on a serial port, the samples are decoded from the packets in the receive buffer */
+class ThinkGearDevice : public AcquisitionDevice<short> {
+public:
+	ThinkGearDevice(SerialPort *SP) {
+		port = SP;
+		ready = serialStreamInit(&stream, SP, 64*(6+2*NUMCHANS));
+	}
+
+	~ThinkGearDevice() {
+		serialStreamFree(&stream);
+	}
+
+	bool isReady() const { return ready; }
+
+	int getNumStatus() const { return 0; }
+	int getNumContinuous() const { return NUMCHANS; }
+	float getSampleRate() const { return FSAMPLE; }
+
+	int read(short *dest, int maxSamples, int timeoutMs, FtEventList &events) {
+		int nSamples = decode(dest, maxSamples);
+		if (nSamples > 0) return nSamples;
+
+		// wait for more input, the driver keeps an eye on the keyboard and control port
+		if (serialStreamFill(&stream, timeoutMs) < 0) return -1;
+		return decode(dest, maxSamples);
+	}
+
+protected:
+
+	int decode(short *dest, int maxSamples) {
+		int nSamples = 0;
+
+		while (nSamples < maxSamples) {
+			int len;
+			const unsigned char *packet = serialStreamNext(&stream, thinkgearFrame, NULL, &len);
+			
+			if (packet == NULL) break;
+			// skip the sync bytes and the length, and leave out the checksum
+			packet += 3;
+			len -= 4;
+
+			if (len != 2*NUMCHANS+2 || packet[0] != 0xB0 || packet[1] != 2*NUMCHANS) {
+				printf("Unrecognized packet: %2d %02X %02X\n", len, packet[0], packet[1]);
+				continue;
+			}
+
+			for (int i=0;i<NUMCHANS;i++) {
+				short high = packet[2+i*2];
+				short low  = packet[3+i*2];
+				if (high & 0x10 && low==3) {
+					low=2;
+				}
+				high &= 0x0F;
+				short val = (high << 8) | low;
+				dest[i] = val;
+			}
+			dest += NUMCHANS;
+			nSamples++;
+		}
+		return nSamples;
+	}
+
+	SerialPort *port;
+	SerialStream stream;
+	bool ready;
+};
+
 int main(int argc, char *argv[]) {
-	ConsoleInput conIn;
-	StringServer ctrlServ;
 	SerialPort SP;
 	char hostname[256];
 	int port, ctrlPort;
-	int counter = 0;
-	OnlineDataManager<short, float> ODM(0, NUMCHANS, FSAMPLE);
 
 	if (argc<3) {
 		printf("Usage: thinkgear2ft <device> <config-file> [hostname=localhost [port=1972 [[ctrlPort=8000]]]\n");
@@ -116,74 +144,24 @@ int main(int argc, char *argv[]) {
 		return 1;
 	}
 
-	if (!strcmp(hostname, "-")) {
-		if (!ODM.useOwnServer(port)) {
-			fprintf(stderr, "Could not spawn buffer server on port %d.\n",port);
-			return 0;
-		}
-	} else {
-		if (!ODM.connectToServer(hostname, port)) {
-			fprintf(stderr, "Could not connect to buffer server at %s:%d.\n",hostname, port);
-			return 0;
-		}
-	}
-	if (ODM.configureFromFile(argv[2]) != 0) {
-		fprintf(stderr, "Configuration file is invalid\n");
-		return 0;
+	ThinkGearDevice device(&SP);
+	if (!device.isReady()) {
+		fprintf(stderr, "Could not allocate the receive buffer\n");
+		return 1;
 	}
 
-	ctrlServ.startListening(ctrlPort);
-	ODM.enableStreaming();
+	AcquisitionDriver<short, float> driver(device);
 
-	printf("Starting - press ESC to quit\n");
-	while (1) {
-		short samples[MAXBLOCK*NUMCHANS];
-		int nSamples = 0;
-
-		if (conIn.checkKey()) {
-			int c = conIn.getKey();
-			if (c==27) break; // quit
-		}
-
-		ctrlServ.checkRequests(ODM);
-
-		while (nSamples < MAXBLOCK && serialInputPending(&SP)>=6+2*NUMCHANS) {
-			int len = tryReadPacket(&SP);
-
-			if (len != 2*NUMCHANS+2 || packet[0] != 0xB0 || packet[1] != 2*NUMCHANS) {
-				printf("Unrecognized packet: %2d %02X %02X\n", len, packet[0], packet[1]);
-				continue;
-			}
-			short *dest = samples + nSamples * NUMCHANS;
-
-			for (int i=0;i<NUMCHANS;i++) {
-				short high = packet[2+i*2];
-				short low  = packet[3+i*2];
-				if (high & 0x10 && low==3) {
-					low=2;
-				}
-				high &= 0x0F;
-				short val = (high << 8) | low;
-				dest[i] = val;
-			}
-			nSamples++;
-		} 
-		
-		if (nSamples == 0) {
-			conIn.milliSleep(10);
-		} else {
-			short *block = ODM.provideBlock(nSamples);
-			memcpy(block, samples, nSamples*NUMCHANS*sizeof(short));
-			if (!ODM.handleBlock()) {
-				fprintf(stderr, "Error in handling this data block - stopping\n");
-				break;
-			}
-			counter+=nSamples;
-			printf("Samples: %i\r", counter);
-		}
+	if (!driver.connect(hostname, port)) {
+		return 0;
+	}
+	if (driver.configure(argv[2]) != 0) {
+		fprintf(stderr, "Configuration file is invalid\n");
+		return 0;
 	}
+	driver.listen(ctrlPort);
 
-	ODM.disableStreaming();
+	driver.run();
 
 	serialClose(&SP);
 	return 0;
@@ -167,6 +167,17 @@ int interpret16bitAsInt32(char *byteArray) {
     return newInt;
   }
 
+/* Frame function for the receive buffer, each packet is 33 bytes between 0xA0 and 0xC0 */
+static int openbciFrame(const unsigned char *data, int length, void *user) {
+  if (data[0] != 0xA0)
+    return -1;
+  if (length < OPENBCI_BUFLEN)
+    return 0;
+  if (data[OPENBCI_BUFLEN-1] != 0xC0)
+    return -1;
+  return OPENBCI_BUFLEN;
+}
+
 int serialWriteSlow(SerialPort *SP, int size, void *buffer) {
   int i, retval = 0;
   for (i=0; i<size; i++) {
@@ -333,9 +344,10 @@ void abortHandler(int sig) {
 
 int main(int argc, char *argv[]) {
   int n, i, c, prevsample = 0, thissample = 0, sample = 0, count = 0, chan = 0, status = 0, labelSize;
-  unsigned char buf[OPENBCI_BUFLEN], byte;
+  unsigned char *buf, byte;
   char *labelString;
   SerialPort SP;
+  SerialStream stream;
   host_t host;
   struct timespec tic, toc;
 
@@ -345,7 +357,7 @@ int main(int argc, char *argv[]) {
 
   /* these are used in the communication with the FT buffer and represent statefull information */
   int ftSocket           = -1;
-  ft_buffer_server_t *ftServer;
+  ft_buffer_server_t *ftServer = NULL;
   message_t     *request  = NULL;
   message_t     *response = NULL;
   header_t      *header   = NULL;
@@ -533,24 +545,13 @@ int main(int argc, char *argv[]) {
   fprintf(stderr, "openbci2ft: daisy        =  %s\n", config.daisy);
 
   /* Spawn tcpserver or connect to remote buffer */
-  if (strcmp(host.name, "-") == 0) {
-    ftServer = ft_start_buffer_server(host.port, NULL, NULL, NULL);
-    if (ftServer==NULL) {
-      fprintf(stderr, "openbci2ft: could not start up a local buffer serving at port %i\n", host.port);
-      return 1;
-    }
-    ftSocket = 0;
+  ftSocket = ft_open_buffer(host.name, host.port, &ftServer);
+  if (ftSocket < 0)
+    return 1;
+  if (ftServer != NULL)
     printf("openbci2ft: streaming to local buffer on port %i\n", host.port);
-  }
-  else {
-    ftSocket = open_connection(host.name, host.port);
-
-    if (ftSocket < 0) {
-      fprintf(stderr, "openbci2ft: could not connect to remote buffer at %s:%i\n", host.name, host.port);
-      return 1;
-    }
+  else
     printf("openbci2ft: streaming to remote buffer at %s:%i\n", host.name, host.port);
-  }
 
   /* allocate the elements that will be used in the communication to the FT buffer */
   request      = malloc(sizeof(message_t));
@@ -860,6 +861,12 @@ int main(int argc, char *argv[]) {
   /* register CTRL-C handler */
   signal (SIGINT, abortHandler);
 
+  /* the receive buffer holds a few hundred packets, which is more than a second at 16 channels */
+  if (!serialStreamInit (&stream, &SP, 256 * OPENBCI_BUFLEN)) {
+    fprintf (stderr, "openbci2ft: could not allocate the receive buffer\n");
+    return 1;
+  }
+
   /* start streaming data */
   serialWrite (&SP, 1, "b");
 
@@ -890,14 +897,17 @@ int main(int argc, char *argv[]) {
 
     while (sample < config.blocksize) {
 
-      /* wait for the first byte of the following packet */
-      buf[0] = 0;
-      while (buf[0] != 0xA0) {
-        if (serialInputPending (&SP))
-          n = serialRead (&SP, 1, buf);
-        else
-          usleep (1000);
-      }			/* while */
+      /* take the next packet from the receive buffer, or read all that came in since the last time */
+      buf = (unsigned char *) serialStreamNext (&stream, openbciFrame, NULL, &n);
+      if (buf == NULL) {
+        if (serialStreamFill (&stream, 100) < 0) {
+          fprintf (stderr, "openbci2ft: error while reading from the serial port\n");
+          keepRunning = 0;
+        }
+        if (!keepRunning)
+          break;
+        continue;
+      }
 
       /*
        * Header
@@ -926,22 +936,12 @@ int main(int argc, char *argv[]) {
        *
        */
 
-      /* read the remaining 32 bytes of the packet */
-      while (n < OPENBCI_BUFLEN)
-        if (serialInputPending (&SP))
-          n += serialRead (&SP, (OPENBCI_BUFLEN - n), buf + n);
-        else
-          usleep (1000);
-
       if (config.verbose > 1) {
         for (i = 0; i < OPENBCI_BUFLEN; i++)
           printf ("%02x ", buf[i]);
         printf ("\n");
       }
 
-      if (buf[32]!=0xC0)
-        continue;
-
       /* these two booleans are both false if there is no daisy board */
       char lower = (ISTRUE(config.daisy) && (buf[1] % 2 == 1)); /* odd samples are for the lower 8 channels */
       char upper = (ISTRUE(config.daisy) && (buf[1] % 2 == 0)); /* even samples are for the upper 8 channels from the daisy board */
@@ -1045,8 +1045,13 @@ int main(int argc, char *argv[]) {
       }
     }	/* while sample<config.blocksize */
 
+    if (!keepRunning)
+      break;
+
     count += sample;
     printf ("openbci2ft: sample count = %i\n", count);
+    if (stream.skipped > 0 && config.verbose > 0)
+      fprintf (stderr, "openbci2ft: skipped %lu bytes outside of packets\n", stream.skipped);
 
     /* create the request */
     request = malloc (sizeof (message_t));
@@ -1085,12 +1090,10 @@ int main(int argc, char *argv[]) {
   /* stop streaming data */
   serialWrite (&SP, 1, "s");
 
+  serialStreamFree (&stream);
   cleanup_data (&data);
 
-  if (ftSocket > 0)
-    close_connection (ftSocket);
-  else
-    ft_stop_buffer_server (ftServer);
+  ft_close_buffer (ftSocket, ftServer);
 
   return 0;
 }	/* main */
@@ -8,6 +8,7 @@
 #define __Brain3dWindow_h
 
 #include <math.h>
+#include <vector>
 
 #include <FL/Fl_Gl_Window.H>
 
@@ -63,6 +64,7 @@ class Brain3dWindow : public Fl_Gl_Window {
 	void setWarp(float factor, float offset) {
 		warpFactor = factor;
 		warpOffset = offset;
+		quadsValid = false;
 	}
 
 	void setDist(double dist) {
@@ -127,6 +129,21 @@ class Brain3dWindow : public Fl_Gl_Window {
 		} else {
 			this->numSlices = numSlices;
 			this->texture = textures;
+			this->volumeTexture = 0;
+			quadsValid = false;
+		}
+	}
+	
+	/** Draw the slices from a single 3D texture instead, which holds all slices of the volume.
+		The slices are then drawn in one go, each sampling the texture at the centre of its slice. */
+	void setVolumeTexture(int numSlices, GLuint texture3d) {
+		if (numSlices<=0 || texture3d == 0) {
+			this->numSlices = 0;
+		} else {
+			this->numSlices = numSlices;
+			this->volumeTexture = texture3d;
+			this->texture = NULL;
+			quadsValid = false;
 		}
 	}
 
@@ -146,6 +163,13 @@ class Brain3dWindow : public Fl_Gl_Window {
 	
 	int numSlices;
 	const GLuint *texture;	
+	GLuint volumeTexture;	// 3D texture, used instead of 'texture' if non-zero
+	
+	/** Fill the vertex and texture coordinate arrays with one quad per slice */
+	void makeQuads();
+	std::vector<float> quadVertices;	// 4 vertices (x,y,z) per slice
+	std::vector<float> quadTexCoords;	// 4 texture coordinates (s,t,r) per slice
+	bool quadsValid;
 
 	private:
 
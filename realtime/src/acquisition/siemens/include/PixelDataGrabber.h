@@ -15,6 +15,8 @@
 #include <SimpleStorage.h>
 #include <FtBuffer.h>
 #include <nifti1.h>
+#include <mosaic.h>
+#include <RigidRealigner.h>
 
 class FolderWatcher;
 
@@ -68,9 +70,23 @@ class PixelDataGrabber {
 	/** Determines how much status messages should be printed to stderr */
 	void setVerbosity(int howMuch) { verbosity = howMuch; }
 	
+	/** Set the weights for combining the echos of a multi-echo scan, one per echo.
+		Without weights (the default), the echos are summed.
+	*/
+	void setEchoWeights(const std::vector<double> &weights) { echoWeights = weights; }
+	
+	/** Realign each scan with the given realigner before it is written, or write the scans
+		as they are if realigner == NULL. The first scan after the header becomes the reference,
+		and the motion of each scan is written as a "MOTION" event with the 6 parameters
+		(see RigidRealigner) as float64 values. The realigner is not deleted by this class.
+	*/
+	void setRealigner(RigidRealigner *realigner) { this->realigner = realigner; }
+	
 	/** Runs the PixelDataGrabber by waiting for 'ms' milliseconds for changes in the directory,
 		and in case something relevant happened, carrying out the corresponding actions. When
 		this function returns 1, you can get more detailed information using getLastAction().
+		While a pixel data file is still being written, the wait is shortened so that the
+		file is picked up as soon as the scanner closed it.
 		
 		@param ms 		Maximum time to wait for directory events
 		@return  	-1 	in case of the PixelDataGrabber is not properly set up
@@ -101,6 +117,8 @@ class PixelDataGrabber {
 	int getNumWritten() { return samplesWritten; }
 	/** Returns a code for errors or the action carried out during the last run() */
 	Action getLastAction() const { return lastAction; }
+	/** Returns the time in milliseconds it took to reshape (and combine the echos of) the last scan */
+	double getReshapeTime() const { return reshapeTime; }
 
 	protected:	
 	
@@ -134,6 +152,20 @@ class PixelDataGrabber {
 	*/
 	bool writeTimestampEvent(const struct timeval &tv);
 	
+	/** This function writes the motion parameters of the latest scan as an event to the
+		FieldTrip buffer. Only call this if a FieldTrip buffer is connected and a realigner is set.
+		The function will set lastAction to TransmissionError in case of errors.
+		@return true 	on success
+		@return false 	in case of errors
+	*/
+	bool writeMotionEvent();
+	
+	/** Realign sliceBuffer into realignBuffer, or make it the reference if there is none yet.
+		@return true 	if realignBuffer contains the realigned scan
+				false 	if sliceBuffer should be written as it is
+	*/
+	bool realignSlices();
+	
 	/** This function is used to transmit a new scan to the FieldTrip buffer. Only call this
 		if a buffer is connected (ftbSocket != -1). If no header has been written since we 
 		connected to the FieldTrip buffer, writeHeader() is called.
@@ -149,7 +181,8 @@ class PixelDataGrabber {
 	
 	/** Handle new protocol information as detected from monitoring the directory, and previously
 		read into memory using tryReadFile(). This function will parse the ASCII representation
-		into the linked list pointed to by protInfo, and try to retrieve values for
+		into the linked list pointed to by protInfo, unless it is identical to the protocol
+		that was parsed before, and try to retrieve values for
 		readResolution, phaseResolution, numSlices, phaseFOV and readoutFOV;
 		On errors, the xxxResolution and numSlices are set to 0.
 		@param  info   		ASCII representation, not necessarily 0-terminated
@@ -166,8 +199,7 @@ class PixelDataGrabber {
 	void fillXFormFromSAP(const double *pos, const double *norm, double inPlane);
 	
 	/** Try to read the complete contents of a file into a given SimpleStorage object.
-		This is used internally for pixel data (->pixBuffer) and protocol information
-		(->protBuffer). If the file cannot be opened, the sBuf is not modified,
+		This is used internally for protocol information (->protBuffer). If the file cannot be opened, the sBuf is not modified,
 		otherwise, sBuf is resized to the number of bytes that could actually be read.
 		@param filename		Name of the file to be read
 		@param sBuf			SimpleBuffer to receive the contents
@@ -177,6 +209,29 @@ class PixelDataGrabber {
 	*/
 	bool tryReadFile(const char *filename, SimpleStorage &sBuf, bool checkAge);
 	
+	/** Try to map a pixel data file into memory, so that its mosaic can be reshaped
+		without reading it first. On success, pixData and pixSize point to the contents
+		until unmapPixelData() is called. A file that is still being written by the
+		scanner can not be opened exclusively (or is still empty), which is reported
+		in 'busy', so that the caller can try again without waiting for another
+		change notification.
+		@param filename		Name of the file to be mapped
+		@param busy			Set to true if the file is still being written
+		@return	true		On success
+				false		In case of errors, or if the file is busy or older than the last one
+	*/
+	bool tryMapPixelData(const char *filename, bool &busy);
+	
+	/** Release the view and mapping set up by tryMapPixelData() */
+	void unmapPixelData();
+	
+	/** Read, reshape and (when all echos are there) transmit one pixel data file.
+		@param name 		Name of the file relative to the monitored directory
+		@return false 		if the file is still being written and should be tried again
+				true 		otherwise (also on errors, or when the file was ignored)
+	*/
+	bool tryPixelDataToBuffer(const std::string &name);
+	
 	/** Try to read the protocol from the default location,which is <watch_directory>/mrprot.txt.
 		@return true 	on success (irrespective of the protocol contents)
 				false	in case the protocol file is not present
@@ -187,20 +242,29 @@ class PixelDataGrabber {
 		eventually call sendFrameToBuffer() in case new pixel data could be read, or 
 		writeHeader() in case new protocol data has been detected. If pixel data
 		comes in without having read protocol information, this function will call 
-		tryReadProtocol() before reshapeToSlices().
+		tryReadProtocol() before reshapeToSlices(). Pixel data files that were
+		still being written are tried again first, in the order they were reported.
+		@param vfn 		Names of the changed files, may be empty to only retry
 	*/
-	void tryFolderToBuffer();
+	void tryFolderToBuffer(const std::vector<std::string> &vfn);
 	
-	/** This function reshapes the contents of pixBuffer (where new pixel data is read into,
-		and where slices are tiles of a 2D mosaic) to sliceBuffer (where slices are contiguous 
+	/** This function reshapes the pixel data at pixData (the mapped file, where slices 
+		are tiles of a 2D mosaic) to sliceBuffer (where slices are contiguous 
 		in memory). If errors occur, the sliceBuffer will be empty.		
 	*/
 	void reshapeToSlices();
 	
-	/** This function reshapes the contents of pixBuffer and adds it to the sliceBuffer.
+	/** This function reshapes the pixel data at pixData and adds it to the sliceBuffer.
 	*/
 	void addEchoToSlices();
 	
+	/** Reshape pixData into sliceBuffer for the current echo, using mosaic_to_slices()
+		with the weight of the echo, and add the time it took to reshapeTime.
+		@param accumulate	Whether to add to the slices of the previous echos
+		@return false 		if the mosaic does not match the protocol information
+	*/
+	bool mosaicToSlices(bool accumulate);
+	
 	/** This function is for writing a message into the log file for each file we 
 		picked up (and possibly streamed out)
 	*/
@@ -210,6 +274,8 @@ class PixelDataGrabber {
 	std::string sourceDir;	/**< Contains the path of the directory that is being monitored */
 	std::string fullName;	/**< Contains the full path of the latest read file */
 	std::vector<std::string> lastName;	/**< Contains the full path of the last pixeldata files transmitted */
+	std::vector<std::string> pendingName;	/**< Pixel data files (relative names) that were still being written */
+	DWORD pendingSince;		/**< Tick count when the oldest pending file was reported */
 	unsigned int lastNamePos; /**< The current position within the lastName array (acts like a ring buffer) */
 	FolderWatcher *FW;		/**< Points to a FolderWatcher object */
 	HANDLE fwEventHandle;	/**< WIN32 event handle used for the FolderWatcher */
@@ -220,6 +286,7 @@ class PixelDataGrabber {
 	
 	unsigned int samplesWritten;	/**< Number of samples written to the currently connected buffer */
 	sap_item_t *protInfo;			/**< Linked list of protocol information */
+	std::string protText;			/**< ASCII protocol information that protInfo was parsed from */
 	unsigned int readResolution;	/**< Number of pixels in readout direction (X) */
 	unsigned int phaseResolution;	/**< Number of pixels in phase direction (Y) */
 	unsigned int numSlices;			/**< Number of slices */
@@ -228,13 +295,20 @@ class PixelDataGrabber {
 	unsigned int numEchos;          /**< Number of echos per scan */
 	unsigned int curFileIndex;      /**< Count files per scan: 0 for magnitude part of first echo, ... */
 	unsigned int filesPerEcho;		/**< =1 normally, =2 for Magnitude-Phase reconstruction etc., we ignore the phase part */
+	std::vector<double> echoWeights;	/**< Weights for combining the echos, summed if empty */
+	double reshapeTime;				/**< Time spent in reshaping the current scan, in milliseconds */
 	double phaseFOV, readoutFOV;	/**< Size of the field of view in mm */
 	Action lastAction;				/**< Contains last action or error that occured */
 	
 	nifti_1_header nifti;           /**< Contains the NIFTI-1 header after parsing the protocol */
 	
-	SimpleStorage pixBuffer;	/**< Simple buffer that contains pixel data as read from file (e.g., mosaic) */
+	HANDLE pixMapping;			/**< File mapping of the pixel data file, or NULL */
+	const void *pixData;		/**< View of the pixel data as mapped from file (e.g., mosaic) */
+	unsigned int pixSize;		/**< Size of the pixel data in bytes */
 	SimpleStorage sliceBuffer;	/**< Simple buffer that contains slice-shaped pixel data */
+	SimpleStorage realignBuffer;	/**< Simple buffer that contains the realigned slices */
+	RigidRealigner *realigner;	/**< Realigns the scans before they are written, or NULL */
+	bool realigned;				/**< Whether realignBuffer contains the latest scan */
 	SimpleStorage protBuffer;	/**< Simple buffer that contains ASCII protocol information */
 	FtBufferRequest ftReq;		/**< For sending request to the buffer */
 	
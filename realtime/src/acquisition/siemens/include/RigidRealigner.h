@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+#ifndef __RigidRealigner_h
+#define __RigidRealigner_h
+
+#include <vector>
+#include <stdint.h>
+
+/** Realigns volumes to a reference volume with a rigid body (6 parameter) transformation,
+	so that the scans can be corrected for head motion before they are written to the buffer.
+
+	The parameters are estimated with Gauss-Newton iterations on the squared difference
+	to the reference, evaluated on a subsampled grid of the voxels above the background,
+	after smoothing both volumes a little.
+	As in SPM, the derivatives are taken from the gradient of the reference, so that the
+	Hessian is computed only once, when the reference is set. The samples are distributed
+	over a number of threads, and so are the slices when reslicing the volume.
+
+	The parameters are translations along x, y and z in mm, followed by rotations about
+	the x, y and z axis in radians, around the centre of the volume. They map the voxels
+	of the reference onto the volume, and each volume starts from the parameters of the
+	previous one.
+*/
+class RigidRealigner {
+	public:
+
+	/** Construct a realigner that uses the given number of threads */
+	RigidRealigner(int numThreads = 4);
+	~RigidRealigner();
+
+	/** Set the number of voxels between the samples in each direction (default = 2) */
+	void setSampling(int step) { sampling = (step > 0) ? step : 1; }
+
+	/** Set how often the volumes are smoothed with a [1 2 1]/4 kernel along each direction
+		before estimating the parameters (default = 2), the realigned volume is not smoothed */
+	void setSmoothing(int passes) { smoothing = (passes >= 0) ? passes : 0; }
+
+	/** Set the maximum number of iterations per volume (default = 16) */
+	void setMaxIterations(int n) { maxIterations = n; }
+
+	/** Use the given volume as the reference for the following volumes.
+		@param vol			Voxels, nx*ny*nz values with x running fastest
+		@param nx,ny,nz		Dimensions of the volume
+		@param dx,dy,dz		Voxel size in mm
+		@return	true		on success
+				false 		if the volume is too small, or has no voxels above the background
+	*/
+	bool setReference(const int16_t *vol, int nx, int ny, int nz, double dx, double dy, double dz);
+
+	/** Returns true if a reference has been set */
+	bool hasReference() const { return !sampleRef.empty(); }
+
+	/** Drop the reference, the next volume can then be used as a new one */
+	void reset();
+
+	/** Estimate the motion of a volume with respect to the reference, and reslice it.
+		@param vol 		Voxels of the volume, with the same dimensions as the reference
+		@param out 		Receives the realigned voxels, must not be the same as vol
+		@return 		number of iterations, or -1 if no reference has been set
+	*/
+	int realign(const int16_t *vol, int16_t *out);
+
+	/** Returns the 6 parameters that were estimated for the last volume */
+	const double *getParameters() const { return params; }
+
+	/** Returns the time in milliseconds the last call to realign took */
+	double getRealignTime() const { return realignTime; }
+
+	protected:
+
+	struct Job;
+
+	/** Run the given stage of the job on total items, split over the threads */
+	void runParallel(int stage, int total, Job *jobs);
+	static void *threadFunction(void *arg);
+	void accumulate(Job *job);
+	void reslice(Job *job);
+
+	/** Compute the rotation matrix R and translation T for the given parameters,
+		in voxel coordinates of the volume, so that a reference voxel x maps onto R*x+T */
+	void voxelTransform(const double *p, double *R, double *T) const;
+
+	int numThreads;
+	int sampling;
+	int smoothing;
+	int maxIterations;
+
+	int nx, ny, nz;
+	double vox[3];			/**< Voxel size in mm */
+	const int16_t *curVol;	/**< Volume that is being realigned */
+	std::vector<float> volSmooth;	/**< Smoothed copy of curVol, for estimating the parameters */
+	std::vector<float> refSmooth, smoothTmp;
+	int16_t *curOut;		/**< Receives the realigned volume */
+	double curR[9], curT[3];	/**< Current transformation in voxel coordinates */
+
+	// samples of the reference, as separate arrays so that the loops over them vectorize
+	std::vector<float> sampleX, sampleY, sampleZ;	/**< Voxel coordinates */
+	std::vector<float> sampleRef;					/**< Intensity of the reference */
+	std::vector<float> sampleJac[6];				/**< Derivative with respect to each parameter */
+	double invHessian[36];
+
+	double params[6];
+	double realignTime;
+};
+
+#endif
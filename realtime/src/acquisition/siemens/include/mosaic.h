@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+#ifndef __mosaic_h
+#define __mosaic_h
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Layout of a Siemens mosaic image, where the slices are tiles of a 2D image with
+	mosaicWidth x mosaicWidth tiles, filled row by row.
+*/
+typedef struct mosaic_layout {
+	unsigned int readResolution;	/**< Number of pixels of one slice in readout direction (X) */
+	unsigned int phaseResolution;	/**< Number of pixels of one slice in phase direction (Y) */
+	unsigned int numSlices;			/**< Number of slices, at most mosaicWidth^2 */
+	unsigned int mosaicWidth;		/**< Number of tiles per row (and column) of the mosaic */
+	int flipPhase;					/**< Non-zero if the rows of each slice are stored in reverse order */
+} mosaic_layout_t;
+
+/** Fill in the layout of a mosaic with the given number of pixels.
+	@param layout		readResolution, phaseResolution, numSlices and flipPhase must be set, mosaicWidth is filled in
+	@param numPixels	Total number of pixels in the mosaic
+	@return 0 			if the mosaic matches the resolution and is large enough for the slices
+			-1			otherwise
+*/
+int mosaic_check_layout(mosaic_layout_t *layout, unsigned int numPixels);
+
+/** Reshape the mosaic at 'src' into contiguous slices at 'dest', or combine it with the
+	slices that are there already. The mosaic is processed in the order of its rows, so that
+	the source is read sequentially while mosaicWidth slices are written at the same time.
+	@param layout		Layout of the mosaic, see mosaic_check_layout
+	@param src			Pixels of the mosaic
+	@param dest			Slices, readResolution x phaseResolution x numSlices pixels
+	@param weight		Factor for the pixels of this mosaic, 1.0 copies (or sums) them exactly
+	@param accumulate	If non-zero, add to dest instead of overwriting it (saturating at the limits of int16)
+*/
+void mosaic_to_slices(const mosaic_layout_t *layout, const int16_t *src, int16_t *dest, float weight, int accumulate);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -137,6 +137,36 @@ int sap_get_essentials(const sap_item_t *list, sap_essentials_t *E);
 
 void sap_remove_empty_arrays(sap_item_t **list);
 
+/** Hash table with the full names of all fields in a list, for looking up many fields
+	in a large protocol without searching through the list for each of them.
+*/
+typedef struct sap_index sap_index_t;
+
+/** Creates an index of all fields in the list, including the fields in sub-structures.
+	The list must not be changed or destroyed while the index is in use.
+	@param list		Linked list of fieldname/value items
+	@return		Pointer to the new index, or NULL if out of memory
+*/
+sap_index_t *sap_index_create(const sap_item_t *list);
+
+/** Looks up a field such as "foo[13].bar[3].element" in the index, with the same result
+	as sap_search_deep on the list from which the index was created.
+	@param	index		Index created with sap_index_create, may be NULL
+	@param	fieldname	0-terminated string describing the desired field
+	@return		The corresponding item within the list, or NULL if not found
+*/
+const sap_item_t *sap_index_lookup(const sap_index_t *index, const char *fieldname);
+
+/** Same as sap_get_essentials, but using an index.
+	@return 	The number of detected parameters, or -1 if one of the parameters is NULL
+*/
+int sap_index_get_essentials(const sap_index_t *index, sap_essentials_t *E);
+
+/** Destroys the index and frees memory, the list itself is not affected.
+	@param	index		Index to be destroyed (can also be NULL)
+*/
+void sap_index_destroy(sap_index_t *index);
+
 #ifdef __cplusplus
 }
 #endif
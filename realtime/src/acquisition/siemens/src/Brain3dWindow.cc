@@ -18,6 +18,10 @@
 
 #include <Brain3dWindow.h>
 
+#ifndef GL_TEXTURE_3D
+#define GL_TEXTURE_3D 0x806F
+#endif
+
 Brain3dWindow::Brain3dWindow(int X, int Y, int W, int H, const char *L) : Fl_Gl_Window(X,Y,W,H,L) {
 
 	bgcolor[0] = bgcolor[1] = bgcolor[2] = 0.0;
@@ -52,31 +56,70 @@ Brain3dWindow::Brain3dWindow(int X, int Y, int W, int H, const char *L) : Fl_Gl_
 	
 	numSlices = 0;
 	texture = NULL;
+	volumeTexture = 0;
+	warpFactor = warpOffset = 0.0;
+	quadsValid = false;
 }
 
 
 
-void Brain3dWindow::drawBrain() {
-	if (numSlices<=0) return;
-	
+void Brain3dWindow::makeQuads() {
+	static const float corner[4][2] = { {-1,-1}, {+1,-1}, {+1,+1}, {-1,+1} };
 	float z_min = 0;
 	float dz = 1.0/numSlices;
-		
-	glColor3f(1,1,1);
+	
+	quadVertices.resize(12*numSlices);
+	quadTexCoords.resize(12*numSlices);
+	
 	for (int i=0;i<numSlices;i++) {
 		float z_org = z_min + i*dz;
-		
 		float z = -0.7 + 1.4*((1-warpFactor)*z_org + warpFactor/(1+exp(-50*(z_org - warpOffset))));
+		// the centre of slice i in the 3D texture
+		float r = (i + 0.5f) * dz;
 		
-		glBindTexture(GL_TEXTURE_2D, texture[i]);
-		
-		glBegin(GL_QUADS);
-		glTexCoord2f(0,0); glVertex3f(-1,-1,z);
-		glTexCoord2f(1,0); glVertex3f(+1,-1,z);
-		glTexCoord2f(1,1); glVertex3f(+1,+1,z);
-		glTexCoord2f(0,1); glVertex3f(-1,+1,z);
-		glEnd();
+		for (int k=0;k<4;k++) {
+			float *v = &quadVertices[12*i + 3*k];
+			float *t = &quadTexCoords[12*i + 3*k];
+			v[0] = corner[k][0];
+			v[1] = corner[k][1];
+			v[2] = z;
+			t[0] = 0.5f*(corner[k][0] + 1);
+			t[1] = 0.5f*(corner[k][1] + 1);
+			t[2] = r;
+		}
 	}
+	quadsValid = true;
+}
+
+
+void Brain3dWindow::drawBrain() {
+	if (numSlices<=0) return;
+	if (!quadsValid) makeQuads();
+	
+	glColor3f(1,1,1);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glVertexPointer(3, GL_FLOAT, 0, &quadVertices[0]);
+	
+	if (volumeTexture != 0) {
+		glDisable(GL_TEXTURE_2D);
+		glEnable(GL_TEXTURE_3D);
+		glBindTexture(GL_TEXTURE_3D, volumeTexture);
+		glTexCoordPointer(3, GL_FLOAT, 0, &quadTexCoords[0]);
+		glDrawArrays(GL_QUADS, 0, 4*numSlices);
+		glDisable(GL_TEXTURE_3D);
+		glEnable(GL_TEXTURE_2D);
+	} else {
+		// s,t of the 3D coordinates
+		glTexCoordPointer(2, GL_FLOAT, 3*sizeof(float), &quadTexCoords[0]);
+		for (int i=0;i<numSlices;i++) {
+			glBindTexture(GL_TEXTURE_2D, texture[i]);
+			glDrawArrays(GL_QUADS, 4*i, 4);
+		}
+	}
+	
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
 }
    
    
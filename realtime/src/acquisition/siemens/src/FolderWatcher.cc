@@ -41,7 +41,7 @@ bool FolderWatcher::startListenForChanges() {
 	
 	activeBuffer = 1 - activeBuffer;
 	
-	if (ReadDirectoryChangesW(dirHandle, fileInfoBuffer[activeBuffer], FILE_INFO_BUFFER_SIZE, TRUE, FILE_NOTIFY_CHANGE_LAST_WRITE, NULL, &overlap, NULL)) {
+	if (ReadDirectoryChangesW(dirHandle, fileInfoBuffer[activeBuffer], FILE_INFO_BUFFER_SIZE, TRUE, FILE_NOTIFY_CHANGE_LAST_WRITE|FILE_NOTIFY_CHANGE_FILE_NAME, NULL, &overlap, NULL)) {
 		isListening = true;
 		return true;
 	}
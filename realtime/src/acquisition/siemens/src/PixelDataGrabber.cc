@@ -12,6 +12,9 @@
 #include <PixelDataGrabber.h>
 #include <FolderWatcher.h>
 
+#define PENDING_RETRY_MS    2       // wait between attempts to read a file that is still being written
+#define PENDING_TIMEOUT_MS  5000    // give up on a file that is not closed within this time
+
 PixelDataGrabber::PixelDataGrabber() : lastName(10) { // keep 10 file names for comparision
 	ftbSocket = -1;
 	FW = NULL;
@@ -30,6 +33,13 @@ PixelDataGrabber::PixelDataGrabber() : lastName(10) { // keep 10 file names for
 	headerWritten = false;
 	verbosity = 1;
 	lastNamePos = 0;
+	pendingSince = 0;
+	pixMapping = NULL;
+	pixData = NULL;
+	pixSize = 0;
+	reshapeTime = 0.0;
+	realigner = NULL;
+	realigned = false;
 	tCreateFirstFile.QuadPart = tCreateLastFile.QuadPart = -1;
 
 	char logname[128];
@@ -44,6 +54,7 @@ PixelDataGrabber::PixelDataGrabber() : lastName(10) { // keep 10 file names for
 
 PixelDataGrabber::~PixelDataGrabber() {
 	if (FW) delete FW;
+	unmapPixelData();
 		
 	if (ftbSocket > 0) close_connection(ftbSocket);
 	sap_destroy(protInfo);
@@ -55,8 +66,10 @@ bool PixelDataGrabber::monitorDirectory(const char *directory) {
 		sap_destroy(protInfo);
 		protInfo = NULL;
 	}
+	protText.clear();
 	
 	curFileIndex = 0;
+	pendingName.clear();
 	
 	if (FW) {
 		FW->stopListenForChanges();
@@ -96,10 +109,14 @@ int PixelDataGrabber::run(unsigned int ms) {
 		return -1;
 	}
 	
+	if (!pendingName.empty() && ms > PENDING_RETRY_MS) ms = PENDING_RETRY_MS;
+	
 	int numChg = FW->checkHasChanged(ms);
 
 	if (numChg > 0) {
-		tryFolderToBuffer();
+		tryFolderToBuffer(FW->getFilenames());
+	} else if (!pendingName.empty()) {
+		tryFolderToBuffer(std::vector<std::string>());
 	}
 	return 1;
 }
@@ -132,6 +149,8 @@ bool PixelDataGrabber::writeHeader() {
 		}
 		headerWritten = true;
 		samplesWritten = 0;
+		// the first scan of the new header becomes the reference
+		if (realigner != NULL) realigner->reset();
 		return true;
 	} else {
 		// one of the prepPutHeader* calls failed
@@ -144,7 +163,9 @@ bool PixelDataGrabber::writePixelData() {
 	FtBufferResponse resp;
 	UINT32_T nchans = numSlices*readResolution*phaseResolution;
 	
-	if (!ftReq.prepPutData(nchans, 1, DATATYPE_INT16, sliceBuffer.data())) {
+	const void *pixels = realigned ? realignBuffer.data() : sliceBuffer.data();
+	
+	if (!ftReq.prepPutData(nchans, 1, DATATYPE_INT16, pixels)) {
 		if (verbosity > 0) fprintf(stderr, "Out of memory!\n");
 		lastAction = OutOfMemory;
 		return false;
@@ -193,14 +214,63 @@ bool PixelDataGrabber::writeTimestampEvent(const struct timeval &tv) {
 	return true;
 }
 
+bool PixelDataGrabber::writeMotionEvent() {
+	FtBufferResponse resp;
+	FtEventList motion;
+	const char *type = "MOTION";
+	
+	motion.add(samplesWritten-1, DATATYPE_CHAR, strlen(type), type, DATATYPE_FLOAT64, 6, realigner->getParameters());
+	
+	int result = tcprequest(ftbSocket, motion.asRequest(), resp.in());
+	
+	if (result < 0) {
+		if (verbosity>0) fprintf(stderr, "Communication error when sending motion parameters to fieldtrip buffer\n");
+		lastAction = TransmissionError;
+		return false;
+	}
+	if (!resp.checkPut()) {
+		if (verbosity>0) fprintf(stderr, "PUT_EVT: error from buffer server\n");
+		lastAction = TransmissionError;
+		return false;
+	}
+	return true;
+}
+
+bool PixelDataGrabber::realignSlices() {
+	if (!realigner->hasReference()) {
+		if (!realigner->setReference((const int16_t *) sliceBuffer.data(), readResolution, phaseResolution, numSlices, 
+				nifti.pixdim[1], nifti.pixdim[2], nifti.pixdim[3])) {
+			if (verbosity>0) fprintf(stderr, "Could not use this scan as the reference for realignment\n");
+		}
+		return false;
+	}
+	if (!realignBuffer.resize(sliceBuffer.size())) {
+		if (verbosity>0) fprintf(stderr, "Out of memory in realignSlices !!!\n");
+		return false;
+	}
+	
+	int iter = realigner->realign((const int16_t *) sliceBuffer.data(), (int16_t *) realignBuffer.data());
+	if (iter < 0) return false;
+	
+	if (verbosity>2) {
+		const double *p = realigner->getParameters();
+		fprintf(stderr, "Realigned in %i iterations, %.1f ms: %.3f %.3f %.3f mm, %.3f %.3f %.3f deg\n", iter, realigner->getRealignTime(),
+			p[0], p[1], p[2], p[3]*180.0/M_PI, p[4]*180.0/M_PI, p[5]*180.0/M_PI);
+	}
+	return true;
+}
+
 bool PixelDataGrabber::sendFrameToBuffer(const struct timeval &tv) {
 	if (!headerWritten) {
 		if (!writeHeader()) return false;
 	}
+	realigned = (realigner != NULL) ? realignSlices() : false;
 	if (!writePixelData()) return false;
 	
 	if (logFile != NULL) writeLogMessage(true);
 	samplesWritten++;
+	// the reference scan has zero motion
+	if (realigner != NULL && realigner->hasReference() && !writeMotionEvent()) return false;
 	lastAction = PixelsTransmitted;
 	// if (!writeTimestampEvent(tv)) return false;
 	return true;
@@ -215,10 +285,16 @@ void PixelDataGrabber::handleProtocol(const char *info, unsigned int sizeInBytes
 	bool haveTrafo = false;
 	long ucMode = 1;	
 	
-	sap_item_t *PI = sap_parse(info, sizeInBytes);
+	sap_item_t *PI;
 	
-	
-	if (PI == NULL) return;
+	// the same protocol is usually written again for every run, only parse it if it changed
+	if (protInfo != NULL && protText.size() == sizeInBytes && memcmp(protText.data(), info, sizeInBytes) == 0) {
+		PI = protInfo;
+	} else {
+		PI = sap_parse(info, sizeInBytes);
+		if (PI == NULL) return;
+		protText.assign(info, sizeInBytes);
+	}
 	
 	tCreateFirstFile.QuadPart = -1;
 	
@@ -226,7 +302,7 @@ void PixelDataGrabber::handleProtocol(const char *info, unsigned int sizeInBytes
 	phaseFOV = readoutFOV = 0.0;
 	
 	// new info? replace the old one, if present
-	if (protInfo != NULL) {
+	if (protInfo != NULL && protInfo != PI) {
 		sap_destroy(protInfo);
 	}
 	protInfo = PI;	
@@ -670,6 +746,72 @@ bool PixelDataGrabber::tryReadFile(const char *filename, SimpleStorage &sBuf, bo
 }
 
 
+bool PixelDataGrabber::tryMapPixelData(const char *filename, bool &busy) {
+	HANDLE fHandle;
+	LARGE_INTEGER creationThisFile;
+	FILETIME fileTime;
+	DWORD size;
+	
+	busy = false;
+	unmapPixelData();
+	
+	// without sharing, opening fails as long as the scanner has the file open for writing
+	fHandle = CreateFileA(filename, GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (fHandle == INVALID_HANDLE_VALUE) {
+		busy = (GetLastError() == ERROR_SHARING_VIOLATION);
+		return false;
+	}
+	
+	GetFileTime(fHandle, &fileTime, NULL, NULL);
+	creationThisFile.LowPart  = fileTime.dwLowDateTime;
+	creationThisFile.HighPart = fileTime.dwHighDateTime;
+	
+	if (creationThisFile.QuadPart <= tCreateLastFile.QuadPart) {
+		printf("Warning: file %s is older than another we've read - ignoring\n", filename);
+		CloseHandle(fHandle);
+		return false;
+	}
+	
+	size = GetFileSize(fHandle, NULL);  // ignore higher DWORD - our files are not that big
+	if (size == 0) {
+		// just created, an empty file can not be mapped
+		CloseHandle(fHandle);
+		busy = true;
+		return false;
+	}
+	
+	// the view keeps the mapping alive, and the mapping keeps the file open
+	pixMapping = CreateFileMappingA(fHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(fHandle);
+	if (pixMapping == NULL) {
+		if (verbosity>0) fprintf(stderr, "Could not map %s into memory.\n", filename);
+		return false;
+	}
+	pixData = MapViewOfFile(pixMapping, FILE_MAP_READ, 0, 0, 0);
+	if (pixData == NULL) {
+		if (verbosity>0) fprintf(stderr, "Could not map %s into memory.\n", filename);
+		unmapPixelData();
+		return false;
+	}
+	pixSize = size;
+	
+	tCreateLastFile = creationThisFile;
+	GetSystemTimeAsFileTime(&fileTime);
+	tAccessLastFile.LowPart  = fileTime.dwLowDateTime;
+	tAccessLastFile.HighPart = fileTime.dwHighDateTime;	
+	return true;
+}
+
+
+void PixelDataGrabber::unmapPixelData() {
+	if (pixData != NULL) UnmapViewOfFile(pixData);
+	if (pixMapping != NULL) CloseHandle(pixMapping);
+	pixData = NULL;
+	pixMapping = NULL;
+	pixSize = 0;
+}
+
+
 bool PixelDataGrabber::tryReadProtocol() {
 	std::string defProtFile = sourceDir + "mrprot.txt";
 	
@@ -680,69 +822,92 @@ bool PixelDataGrabber::tryReadProtocol() {
 }
 
 
-void PixelDataGrabber::tryFolderToBuffer() {
-	const std::vector<std::string>& vfn = FW->getFilenames();
+bool PixelDataGrabber::tryPixelDataToBuffer(const std::string &name) {
+	struct timeval tv;
+	bool busy;
+	
+	fullName = sourceDir + name;
+	
+	// first, check if this modification in the monitored directory
+	// really corresponds to a new file
+	for (unsigned int k=0;k<lastName.size();k++) {
+		//printf("%s\n", lastName[k].c_str());
+		if (lastName[k] == fullName) {
+			printf("Warning: another change on file %s detected - ignoring\n", fullName.c_str());
+			// if this was not a new filename, continue with 
+			// looping through list of modifications
+			return true;
+		}
+	}
+
+	gettimeofday(&tv, NULL);
+	if (!tryMapPixelData(fullName.c_str(), busy)) return !busy;
+				
+	if (protInfo == NULL) tryReadProtocol();
+	
+	if (curFileIndex == 0) {
+		reshapeToSlices();
+	} else {
+		if (filesPerEcho==1 || (curFileIndex & 1) == 0) {
+			addEchoToSlices();
+		}
+	}
+	// the pixels are in sliceBuffer now, so the file can be released right away
+	unmapPixelData();
+	if (sliceBuffer.size()==0) return true;
+	
+	if  (tCreateFirstFile.QuadPart == -1) {
+		tCreateFirstFile = tCreateLastFile;
+	}
+	
+	if (logFile != NULL) writeLogMessage(false);
+	curFileIndex++;
+	// printf("curFileIndex = %i\n", curFileIndex);
+
+	// add current file name to ring buffer of processed names
+	// just overwrite old entries if buffer wraps around
+	lastName[lastNamePos] = fullName;
+	if (++lastNamePos == lastName.size()) lastNamePos = 0;
+	
+	if (curFileIndex == filesPerEcho * numEchos) {
+		if (ftbSocket != -1) sendFrameToBuffer(tv);
+		curFileIndex = 0;
+	}
+	return true;
+}
+
+
+void PixelDataGrabber::tryFolderToBuffer(const std::vector<std::string> &vfn) {
+	// files that were still being written when they were reported come first,
+	// the scanner writes the files of one scan in order
+	while (!pendingName.empty()) {
+		if (!tryPixelDataToBuffer(pendingName[0])) {
+			if (GetTickCount() - pendingSince < PENDING_TIMEOUT_MS) break;
+			if (verbosity>0) fprintf(stderr, "Giving up on %s, it is not closed by the scanner.\n", pendingName[0].c_str());
+		}
+		pendingName.erase(pendingName.begin());
+		pendingSince = GetTickCount();
+	}
 	
 	for (unsigned int i=0;i<vfn.size();i++) {
 		// both .PixelData and "mrprot.txt" are at least 10 characters long
 		if (vfn[i].size() < 10) continue;
 		
-		fullName = sourceDir + vfn[i];
-		
 		if (vfn[i].compare(vfn[i].size()-10,10, ".PixelData") == 0) {
-			struct timeval tv;
-			
-			// first, check if this modification in the monitored directory
-			// really corresponds to a new file
-			boolean newFile = true;
-			for (unsigned int k=0;k<lastName.size();k++) {
-				//printf("%s\n", lastName[k].c_str());
-				if (lastName[k] == fullName) {
-					printf("Warning: another change on file %s detected - ignoring\n", fullName.c_str());
-					newFile = false;
-					break;
-				}
-			}
-			if (!newFile) {
-				// if this was not a new filename, continue with 
-				// looping through list of modifications
-				continue;
-			}
-			
-
-			gettimeofday(&tv, NULL);
-			if (!tryReadFile(fullName.c_str(), pixBuffer, true)) continue;
-						
-			if (protInfo == NULL) tryReadProtocol();
-			
-			if (curFileIndex == 0) {
-				reshapeToSlices();
-			} else {
-				if (filesPerEcho==1 || (curFileIndex & 1) == 0) {
-					addEchoToSlices();
-				}
+			bool known = false;
+			for (unsigned int k=0;k<pendingName.size();k++) {
+				if (pendingName[k] == vfn[i]) known = true;
 			}
-			if (sliceBuffer.size()==0) continue;
-			
-			if  (tCreateFirstFile.QuadPart == -1) {
-				tCreateFirstFile = tCreateLastFile;
-			}
-			
-			if (logFile != NULL) writeLogMessage(false);
-			curFileIndex++;
-			// printf("curFileIndex = %i\n", curFileIndex);
-
-			// add current file name to ring buffer of processed names
-			// just overwrite old entries if buffer wraps around
-			lastName[lastNamePos] = fullName;
-			if (++lastNamePos == lastName.size()) lastNamePos = 0;
+			if (known) continue;
 			
-			if (curFileIndex == filesPerEcho * numEchos) {
-				if (ftbSocket != -1) sendFrameToBuffer(tv);
-				curFileIndex = 0;
+			if (!pendingName.empty() || !tryPixelDataToBuffer(vfn[i])) {
+				// try again on the next run(), this is as soon as the scanner closes the file
+				if (pendingName.empty()) pendingSince = GetTickCount();
+				pendingName.push_back(vfn[i]);
 			}
 		} 
 		else if (vfn[i].compare(vfn[i].size()-10,10, "mrprot.txt") == 0) {
+			fullName = sourceDir + vfn[i];
 			if (!tryReadFile(fullName.c_str(), protBuffer, false)) return;
 	
 			handleProtocol((char *) protBuffer.data(), protBuffer.size());
@@ -773,10 +938,10 @@ void PixelDataGrabber::writeLogMessage(bool sentOut) {
 		int dt_stream = (int) ((tDone.QuadPart - tCreateLastFile.QuadPart)/10000L);
 		
 		// sample index, dt_file_creation, dt_fileproc, dt_file_creation in TR, dt_stream, dt_streamproc, dt_stream_in_TR
-		fprintf(logFile, "%4i %2i  %8i %6i %8.3f  # streaming took %i ms\n", 
+		fprintf(logFile, "%4i %2i  %8i %6i %8.3f  # streaming took %i ms, reshaping %.3f ms\n", 
 					samplesWritten, -1,
 					dt_file, dt_fileproc, dt_file_in_TR, 
-					dt_stream);
+					dt_stream, reshapeTime);
 	} else {
 		// sample index, dt_file_creation, dt_fileproc, dt_file_creation in TR, curFileIndex, file name
 		fprintf(logFile, "%4i %2i  %8i %6i %8.3f  # %s\n", 
@@ -789,9 +954,11 @@ void PixelDataGrabber::writeLogMessage(bool sentOut) {
 
 
 void PixelDataGrabber::reshapeToSlices() {
-	unsigned int pixels = pixBuffer.size() >> 1;
+	unsigned int pixels = pixSize >> 1;
 	unsigned int root   = (unsigned int) round(sqrt(pixels));
 	
+	reshapeTime = 0.0;
+	
 	if (readResolution == 0 || phaseResolution == 0 || numSlices == 0) {
 		// if for some reason we don't have proper protocol information,
 		// we just spit out square images (one slice)
@@ -799,55 +966,22 @@ void PixelDataGrabber::reshapeToSlices() {
 			// source image not square? don't know what to do
 			sliceBuffer.resize(0);
 			lastAction = BadPixelData;
-		} else	{
-			readResolution = phaseResolution = root;
-			numSlices = 1;
-			if (sliceBuffer.resize(pixels*sizeof(INT16_T))) {
-				memcpy(sliceBuffer.data(), pixBuffer.data(), pixels*sizeof(INT16_T));
-			} else {
-				if (verbosity>0) fprintf(stderr, "Out of memory in reshapeToSlices !!!\n");
-				sliceBuffer.resize(0);
-				lastAction = OutOfMemory;
-			}
-		}
-	} else {
-		unsigned int tiles  = pixels / (readResolution * phaseResolution);
-		unsigned int mosw = (unsigned int) round(sqrt(tiles));
-		
-		if ((pixels != readResolution * phaseResolution * tiles) || (mosw*mosw != tiles) || (numSlices > tiles)) {
-			// mosaic does not match readResolution, or is too small - do nothing...
-			if (verbosity>0) fprintf(stderr, "PixelData (%i) does not match protocol information (%i x %i x %i)\n",pixels,readResolution,phaseResolution,numSlices);
-			sliceBuffer.resize(0);
-			lastAction = BadPixelData;
-		} else if (!sliceBuffer.resize(readResolution*phaseResolution*numSlices*sizeof(INT16_T))) {
-			if (verbosity>0) fprintf(stderr, "Out of memory in reshapeToSlices !!!\n");
-			sliceBuffer.resize(0);
-			lastAction = OutOfMemory;
-		} else {
-			const int16_t *src	= (const int16_t *) pixBuffer.data();
-			int16_t *dest   	= (int16_t *) sliceBuffer.data();
-			
-			// row and column in source mosaic
-			unsigned int i = 0, j = 0;
-			
-			for (unsigned int n=0; n<numSlices; n++) {
-				int16_t *dest_n = dest + readResolution*phaseResolution*n;
-				const int16_t *src_n = src + readResolution*(phaseResolution*mosw*i + j);
-				
-				// copy one line (=readResolution pixels) at a time
-				for (unsigned int m=0; m<phaseResolution; m++) {
-					int off_m = readResolution*(phaseResolution-1-m);	// flip along phase direction !
-					memcpy(dest_n + off_m, src_n + mosw*readResolution*m, sizeof(INT16_T) * readResolution);
-				}
-				
-				// increase source column index
-				if (++j == mosw) {
-					// and shift to next row eventually
-					++i;
-					j = 0;
-				}
-			}
+			return;
 		}
+		readResolution = phaseResolution = root;
+		numSlices = 1;
+	}
+	
+	if (!sliceBuffer.resize(readResolution*phaseResolution*numSlices*sizeof(INT16_T))) {
+		if (verbosity>0) fprintf(stderr, "Out of memory in reshapeToSlices !!!\n");
+		sliceBuffer.resize(0);
+		lastAction = OutOfMemory;
+		return;
+	}
+	
+	if (!mosaicToSlices(false)) {
+		sliceBuffer.resize(0);
+		lastAction = BadPixelData;
 	}
 }
 
@@ -856,42 +990,40 @@ void PixelDataGrabber::addEchoToSlices() {
 	// In contrast to reshapeToSlices, this is only called when 
 	// a) we have protocol information (otherwise we wouldn't know about echos and
 	// b) the sliceBuffer is already big enough
-	unsigned int pixels = pixBuffer.size() >> 1;
-	unsigned int tiles  = pixels / (readResolution * phaseResolution);
-	unsigned int mosw   = (unsigned int) round(sqrt(tiles));
-		
-	if ((pixels != readResolution * phaseResolution * tiles) || (mosw*mosw != tiles) || (numSlices > tiles)) {
-		// mosaic does not match readResolution, or is too small - do nothing...
-		if (verbosity>0) fprintf(stderr, "PixelData (%i) does not match protocol information (%i x %i x %i)\n",pixels,readResolution,phaseResolution,numSlices);
+	if (!mosaicToSlices(true)) {
 		sliceBuffer.resize(0);
 		lastAction = BadPixelData;
-	} else {
-		const int16_t *src	= (const int16_t *) pixBuffer.data();
-		int16_t *dest   	= (int16_t *) sliceBuffer.data();
-			
-		// row and column in source mosaic
-		unsigned int i = 0, j = 0;
-			
-		for (unsigned int n=0; n<numSlices; n++) {
-			int16_t *dest_n = dest + readResolution*phaseResolution*n;
-			const int16_t *src_n = src + readResolution*(phaseResolution*mosw*i + j);
-				
-			// add one line (=readResolution pixels) at a time
-			for (unsigned int m=0; m<phaseResolution; m++) {
-				int16_t      *dest_mn = dest_n + readResolution*(phaseResolution-1-m);	// flip along phase direction !
-				const int16_t *src_mn = src_n  + m*mosw*readResolution;
-			
-				for (unsigned int v=0; v<readResolution; v++) {
-					dest_mn[v] += src_mn[v];
-				}
-			}
-				
-			// increase source column index
-			if (++j == mosw) {
-				// and shift to next row eventually
-				++i;
-				j = 0;
-			}
-		}
 	}
 }
+
+
+bool PixelDataGrabber::mosaicToSlices(bool accumulate) {
+	LARGE_INTEGER tStart, tEnd, freq;
+	mosaic_layout_t layout;
+	unsigned int pixels = pixSize >> 1;
+	
+	layout.readResolution  = readResolution;
+	layout.phaseResolution = phaseResolution;
+	layout.numSlices       = numSlices;
+	layout.flipPhase       = 1;		// flip along phase direction !
+	
+	if (mosaic_check_layout(&layout, pixels) != 0) {
+		// mosaic does not match readResolution, or is too small - do nothing...
+		if (verbosity>0) fprintf(stderr, "PixelData (%i) does not match protocol information (%i x %i x %i)\n",pixels,readResolution,phaseResolution,numSlices);
+		return false;
+	}
+	
+	// the magnitude and phase files of one echo share the index of the echo
+	unsigned int echo = curFileIndex / filesPerEcho;
+	float weight = (echo < echoWeights.size()) ? (float) echoWeights[echo] : 1.0f;
+	
+	QueryPerformanceCounter(&tStart);
+	mosaic_to_slices(&layout, (const int16_t *) pixData, (int16_t *) sliceBuffer.data(), weight, accumulate ? 1 : 0);
+	QueryPerformanceCounter(&tEnd);
+	QueryPerformanceFrequency(&freq);
+	
+	double dt = 1000.0 * (double) (tEnd.QuadPart - tStart.QuadPart) / (double) freq.QuadPart;
+	reshapeTime += dt;
+	if (verbosity>2) fprintf(stderr, "Reshaping echo %i took %.3f ms\n", echo, dt);
+	return true;
+}
@@ -0,0 +1,371 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <pthread.h>
+
+#include <buffer.h>
+#include <RigidRealigner.h>
+
+#define REALIGN_MIN_SAMPLES   1000	// fewer samples above the background are not enough for 6 parameters
+#define REALIGN_TOL_MM        1e-3	// stop when the translations change less than this
+#define REALIGN_TOL_RAD       1e-5	// and the rotations change less than this
+
+struct RigidRealigner::Job {
+	RigidRealigner *self;
+	int stage;				// 0 = accumulate residuals, 1 = reslice
+	int begin, end;			// samples or slices
+	double b[6];			// J' * residual
+	double ss;				// sum of squared residuals
+	int count;				// samples inside the volume
+	pthread_t thread;
+};
+
+/* trilinear interpolation, returns false if (x,y,z) is outside the volume */
+template<typename T> static inline bool interpolate(const T *vol, int nx, int ny, int nz, double x, double y, double z, float *value) {
+	if (x < 0 || y < 0 || z < 0 || x > nx-1 || y > ny-1 || z > nz-1) return false;
+	
+	int ix = (int) x, iy = (int) y, iz = (int) z;
+	if (ix == nx-1) ix--;
+	if (iy == ny-1) iy--;
+	if (iz == nz-1) iz--;
+	float fx = (float) (x - ix), fy = (float) (y - iy), fz = (float) (z - iz);
+	
+	const T *p = vol + ix + nx*(iy + ny*iz);
+	int sy = nx, sz = nx*ny;
+	
+	float c00 = p[0]     + fx*(p[1]       - p[0]);
+	float c10 = p[sy]    + fx*(p[sy+1]    - p[sy]);
+	float c01 = p[sz]    + fx*(p[sz+1]    - p[sz]);
+	float c11 = p[sy+sz] + fx*(p[sy+sz+1] - p[sy+sz]);
+	float c0  = c00 + fy*(c10 - c00);
+	float c1  = c01 + fy*(c11 - c01);
+	*value = c0 + fz*(c1 - c0);
+	return true;
+}
+
+/* smooths the volume with a [1 2 1]/4 kernel along x, y and z, the given number of times */
+static void smooth(std::vector<float> &vol, std::vector<float> &tmp, int nx, int ny, int nz, int passes) {
+	int stride[3] = { 1, nx, nx*ny };
+	int dim[3] = { nx, ny, nz };
+	
+	tmp.resize(vol.size());
+	for (int pass=0;pass<passes;pass++) {
+		for (int d=0;d<3;d++) {
+			int s = stride[d], n = dim[d];
+			// the lines along dimension d start at the voxels with index 0 along d
+			for (int iz=0;iz<(d==2 ? 1 : nz);iz++) {
+				for (int iy=0;iy<(d==1 ? 1 : ny);iy++) {
+					for (int ix=0;ix<(d==0 ? 1 : nx);ix++) {
+						const float *src = &vol[ix + nx*(iy + ny*iz)];
+						float *dest = &tmp[ix + nx*(iy + ny*iz)];
+						
+						dest[0] = 0.75f*src[0] + 0.25f*src[s];
+						for (int k=1;k<n-1;k++) {
+							dest[k*s] = 0.25f*(src[(k-1)*s] + src[(k+1)*s]) + 0.5f*src[k*s];
+						}
+						dest[(n-1)*s] = 0.75f*src[(n-1)*s] + 0.25f*src[(n-2)*s];
+					}
+				}
+			}
+			vol.swap(tmp);
+		}
+	}
+}
+
+/* inverts the symmetric positive definite 6x6 matrix A by Gauss-Jordan elimination */
+static bool invert6(const double *A, double *inv) {
+	double M[6][12];
+	
+	for (int i=0;i<6;i++) {
+		for (int j=0;j<6;j++) {
+			M[i][j] = A[6*i+j];
+			M[i][j+6] = (i==j) ? 1.0 : 0.0;
+		}
+	}
+	for (int c=0;c<6;c++) {
+		int piv = c;
+		for (int r=c+1;r<6;r++) if (fabs(M[r][c]) > fabs(M[piv][c])) piv = r;
+		if (fabs(M[piv][c]) < 1e-12) return false;
+		if (piv != c) for (int j=0;j<12;j++) { double t = M[c][j]; M[c][j] = M[piv][j]; M[piv][j] = t; }
+		
+		double d = 1.0 / M[c][c];
+		for (int j=0;j<12;j++) M[c][j] *= d;
+		for (int r=0;r<6;r++) {
+			if (r == c || M[r][c] == 0.0) continue;
+			double f = M[r][c];
+			for (int j=0;j<12;j++) M[r][j] -= f*M[c][j];
+		}
+	}
+	for (int i=0;i<6;i++) for (int j=0;j<6;j++) inv[6*i+j] = M[i][j+6];
+	return true;
+}
+
+
+RigidRealigner::RigidRealigner(int numThreads) {
+	this->numThreads = (numThreads > 0) ? numThreads : 1;
+	sampling = 2;
+	smoothing = 2;
+	maxIterations = 16;
+	nx = ny = nz = 0;
+	curVol = NULL;
+	curOut = NULL;
+	realignTime = 0.0;
+	reset();
+}
+
+RigidRealigner::~RigidRealigner() {
+}
+
+void RigidRealigner::reset() {
+	sampleX.clear();
+	sampleY.clear();
+	sampleZ.clear();
+	sampleRef.clear();
+	for (int k=0;k<6;k++) {
+		sampleJac[k].clear();
+		params[k] = 0.0;
+	}
+}
+
+bool RigidRealigner::setReference(const int16_t *vol, int nx, int ny, int nz, double dx, double dy, double dz) {
+	reset();
+	if (nx < 3 || ny < 3 || nz < 3) return false;
+	
+	this->nx = nx;
+	this->ny = ny;
+	this->nz = nz;
+	vox[0] = (dx > 0) ? dx : 1.0;
+	vox[1] = (dy > 0) ? dy : 1.0;
+	vox[2] = (dz > 0) ? dz : 1.0;
+	
+	// the parameters are estimated on smoothed copies, which keeps sharp edges
+	// from biasing the estimates
+	refSmooth.assign(vol, vol + (size_t) nx*ny*nz);
+	smooth(refSmooth, smoothTmp, nx, ny, nz, smoothing);
+	
+	// like the global mean in SPM: the mean of the voxels above 1/8 of the mean,
+	// and a fraction of that separates the head from the background
+	size_t numVoxels = (size_t) nx*ny*nz;
+	double sum = 0.0, sumAbove = 0.0;
+	size_t numAbove = 0;
+	for (size_t i=0;i<numVoxels;i++) sum += vol[i];
+	for (size_t i=0;i<numVoxels;i++) {
+		if (vol[i] > sum/(8.0*numVoxels)) {
+			sumAbove += vol[i];
+			numAbove++;
+		}
+	}
+	if (numAbove == 0) return false;
+	float threshold = (float) (0.8 * sumAbove / numAbove);
+	
+	double cx = 0.5*(nx-1), cy = 0.5*(ny-1), cz = 0.5*(nz-1);
+	int sy = nx, sz = nx*ny;
+	
+	for (int iz=1;iz<nz-1;iz+=sampling) {
+		for (int iy=1;iy<ny-1;iy+=sampling) {
+			for (int ix=1;ix<nx-1;ix+=sampling) {
+				size_t i = ix + nx*(iy + ny*iz);
+				if (vol[i] < threshold) continue;
+				const float *p = &refSmooth[i];
+				
+				// gradient in intensity per mm, and position in mm from the centre
+				double gx = 0.5*(p[1]  - p[-1])  / vox[0];
+				double gy = 0.5*(p[sy] - p[-sy]) / vox[1];
+				double gz = 0.5*(p[sz] - p[-sz]) / vox[2];
+				double ux = (ix - cx)*vox[0];
+				double uy = (iy - cy)*vox[1];
+				double uz = (iz - cz)*vox[2];
+				
+				sampleX.push_back((float) ix);
+				sampleY.push_back((float) iy);
+				sampleZ.push_back((float) iz);
+				sampleRef.push_back((float) *p);
+				sampleJac[0].push_back((float) gx);
+				sampleJac[1].push_back((float) gy);
+				sampleJac[2].push_back((float) gz);
+				// derivatives of the rotations about x, y and z at zero angle
+				sampleJac[3].push_back((float) (-gy*uz + gz*uy));
+				sampleJac[4].push_back((float) ( gx*uz - gz*ux));
+				sampleJac[5].push_back((float) (-gx*uy + gy*ux));
+			}
+		}
+	}
+	
+	std::vector<float>().swap(refSmooth);
+	
+	if (sampleRef.size() < REALIGN_MIN_SAMPLES) {
+		fprintf(stderr, "RigidRealigner: only %i voxels above the background\n", (int) sampleRef.size());
+		reset();
+		return false;
+	}
+	
+	double H[36];
+	for (int k=0;k<6;k++) {
+		for (int l=k;l<6;l++) {
+			const float *jk = &sampleJac[k][0], *jl = &sampleJac[l][0];
+			double h = 0.0;
+			for (size_t i=0;i<sampleRef.size();i++) h += (double) jk[i]*jl[i];
+			H[6*k+l] = H[6*l+k] = h;
+		}
+	}
+	if (!invert6(H, invHessian)) {
+		fprintf(stderr, "RigidRealigner: the reference does not constrain all parameters\n");
+		reset();
+		return false;
+	}
+	return true;
+}
+
+void RigidRealigner::voxelTransform(const double *p, double *R, double *T) const {
+	double ca = cos(p[3]), sa = sin(p[3]);
+	double cb = cos(p[4]), sb = sin(p[4]);
+	double cc = cos(p[5]), sc = sin(p[5]);
+	
+	// rotation in mm, Rz*Ry*Rx
+	double Q[9] = {
+		cb*cc, sa*sb*cc - ca*sc, ca*sb*cc + sa*sc,
+		cb*sc, sa*sb*sc + ca*cc, ca*sb*sc - sa*cc,
+		-sb,   sa*cb,            ca*cb
+	};
+	double c[3] = { 0.5*(nx-1), 0.5*(ny-1), 0.5*(nz-1) };
+	
+	// the same in voxels: y = c + D^-1 (Q D (x - c) + t)
+	for (int i=0;i<3;i++) {
+		T[i] = c[i] + p[i] / vox[i];
+		for (int j=0;j<3;j++) {
+			R[3*i+j] = Q[3*i+j] * vox[j] / vox[i];
+			T[i] -= R[3*i+j] * c[j];
+		}
+	}
+}
+
+void RigidRealigner::accumulate(Job *job) {
+	const double *R = curR, *T = curT;
+	const float *X = &sampleX[0], *Y = &sampleY[0], *Z = &sampleZ[0], *ref = &sampleRef[0];
+	double b[6] = {0,0,0,0,0,0}, ss = 0.0;
+	int count = 0;
+	
+	for (int i=job->begin;i<job->end;i++) {
+		double x = R[0]*X[i] + R[1]*Y[i] + R[2]*Z[i] + T[0];
+		double y = R[3]*X[i] + R[4]*Y[i] + R[5]*Z[i] + T[1];
+		double z = R[6]*X[i] + R[7]*Y[i] + R[8]*Z[i] + T[2];
+		float v;
+		
+		if (!interpolate(&volSmooth[0], nx, ny, nz, x, y, z, &v)) continue;
+		double r = v - ref[i];
+		for (int k=0;k<6;k++) b[k] += sampleJac[k][i] * r;
+		ss += r*r;
+		count++;
+	}
+	for (int k=0;k<6;k++) job->b[k] = b[k];
+	job->ss = ss;
+	job->count = count;
+}
+
+void RigidRealigner::reslice(Job *job) {
+	const double *R = curR, *T = curT;
+	
+	for (int iz=job->begin;iz<job->end;iz++) {
+		for (int iy=0;iy<ny;iy++) {
+			int16_t *dest = curOut + nx*(iy + ny*iz);
+			// the position moves along a line within a row
+			double x = R[1]*iy + R[2]*iz + T[0];
+			double y = R[4]*iy + R[5]*iz + T[1];
+			double z = R[7]*iy + R[8]*iz + T[2];
+			
+			for (int ix=0;ix<nx;ix++, x+=R[0], y+=R[3], z+=R[6]) {
+				float v;
+				if (!interpolate(curVol, nx, ny, nz, x, y, z, &v)) {
+					dest[ix] = 0;
+				} else {
+					int w = (int) floorf(v + 0.5f);
+					dest[ix] = (w > 32767) ? 32767 : (w < -32768) ? -32768 : (int16_t) w;
+				}
+			}
+		}
+	}
+}
+
+void *RigidRealigner::threadFunction(void *arg) {
+	Job *job = (Job *) arg;
+	
+	if (job->stage == 0) {
+		job->self->accumulate(job);
+	} else {
+		job->self->reslice(job);
+	}
+	return NULL;
+}
+
+void RigidRealigner::runParallel(int stage, int total, Job *jobs) {
+	for (int t=0;t<numThreads;t++) {
+		jobs[t].self  = this;
+		jobs[t].stage = stage;
+		jobs[t].begin = (int) (((long long) total * t) / numThreads);
+		jobs[t].end   = (int) (((long long) total * (t+1)) / numThreads);
+	}
+	// the calling thread takes the first part itself
+	for (int t=1;t<numThreads;t++) {
+		if (pthread_create(&jobs[t].thread, NULL, threadFunction, &jobs[t]) != 0) {
+			threadFunction(&jobs[t]);
+			jobs[t].stage = -1;
+		}
+	}
+	threadFunction(&jobs[0]);
+	for (int t=1;t<numThreads;t++) {
+		if (jobs[t].stage >= 0) pthread_join(jobs[t].thread, NULL);
+	}
+}
+
+int RigidRealigner::realign(const int16_t *vol, int16_t *out) {
+	if (!hasReference()) return -1;
+	
+	UINT64_T tStart = ft_clock_ns();
+	std::vector<Job> jobs(numThreads);
+	int iter;
+	
+	curVol = vol;
+	curOut = out;
+	volSmooth.assign(vol, vol + (size_t) nx*ny*nz);
+	smooth(volSmooth, smoothTmp, nx, ny, nz, smoothing);
+	
+	for (iter=0;iter<maxIterations;) {
+		voxelTransform(params, curR, curT);
+		runParallel(0, (int) sampleRef.size(), &jobs[0]);
+		iter++;
+		
+		double b[6] = {0,0,0,0,0,0};
+		int count = 0;
+		for (int t=0;t<numThreads;t++) {
+			for (int k=0;k<6;k++) b[k] += jobs[t].b[k];
+			count += jobs[t].count;
+		}
+		if (count < REALIGN_MIN_SAMPLES) {
+			fprintf(stderr, "RigidRealigner: the volume moved out of the reference\n");
+			break;
+		}
+		
+		// Gauss-Newton step, dp = -inv(J'J) * J'r
+		double dp[6];
+		for (int k=0;k<6;k++) {
+			dp[k] = 0.0;
+			for (int l=0;l<6;l++) dp[k] -= invHessian[6*k+l] * b[l];
+			params[k] += dp[k];
+		}
+		if (fabs(dp[0]) < REALIGN_TOL_MM && fabs(dp[1]) < REALIGN_TOL_MM && fabs(dp[2]) < REALIGN_TOL_MM &&
+			fabs(dp[3]) < REALIGN_TOL_RAD && fabs(dp[4]) < REALIGN_TOL_RAD && fabs(dp[5]) < REALIGN_TOL_RAD) break;
+	}
+	
+	voxelTransform(params, curR, curT);
+	runParallel(1, nz, &jobs[0]);
+	
+	curVol = NULL;
+	curOut = NULL;
+	realignTime = 1e-6 * (double) (ft_clock_ns() - tStart);
+	return iter;
+}
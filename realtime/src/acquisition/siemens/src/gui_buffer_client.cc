@@ -29,13 +29,13 @@ class PixelData2Image {
 		if (image) free(image);
 	}
 	
-	void getFromBuffer(void *pixelData, int w, int h, int ns) {
-		int16_t *pixels;
+	void getFromBuffer(const void *pixelData, int w, int h, int ns) {
+		const int16_t *pixels;
 		int numPixels = w*h*ns;
 		
 		if (numPixels < 1) return;
 		
-		pixels = (int16_t *) pixelData;
+		pixels = (const int16_t *) pixelData;
 				
 		if (numPixels > numAlloc) {
 			if (image != 0) free(image);
@@ -122,8 +122,8 @@ sap_essentials_t essProtInfo;
 
 
 bool readHeader() {
-	SimpleStorage protBuffer;
 	headerdef_t header_def;
+	unsigned int protSize;
 	FtBufferRequest request;
 	FtBufferResponse response;
 	
@@ -134,7 +134,8 @@ bool readHeader() {
 		return false;
 	}
 	
-	if (!response.checkGetHeader(header_def, &protBuffer)) {
+	const void *protBuffer = response.getHeaderView(header_def, protSize);
+	if (protBuffer == NULL) {
 		fprintf(stderr, "Error in received packet.\n");
 		return false;
 	}
@@ -146,7 +147,7 @@ bool readHeader() {
 	
 	printf("\nHeader information: %i samples / %i channels\n\n", header_def.nsamples, header_def.nchans);
 	
-	const ft_chunk_t *chunk = find_chunk(protBuffer.data(), 0, protBuffer.size(), FT_CHUNK_NIFTI1);
+	const ft_chunk_t *chunk = find_chunk(protBuffer, 0, protSize, FT_CHUNK_NIFTI1);
 	if (chunk != NULL && chunk->def.size == sizeof(nifti_1_header)) {
 		nifti_1_header *NH = (nifti_1_header *) chunk->data;
 		if (!strcmp(NH->magic, "ni1") || !strcmp(NH->magic,"n+1")) {
@@ -159,7 +160,7 @@ bool readHeader() {
 			return true;
 		}
 	}
-	chunk = find_chunk(protBuffer.data(), 0, protBuffer.size(), FT_CHUNK_SIEMENS_AP);
+	chunk = find_chunk(protBuffer, 0, protSize, FT_CHUNK_SIEMENS_AP);
 	if (chunk != NULL) {
 		sap_item_t *PI = sap_parse(chunk->data, chunk->def.size);
 		printf("Got Siemens ASCII protocol information!\n");
@@ -180,7 +181,6 @@ bool readHeader() {
 
 // this will get called repeatedly from the GUI loop, use this to poll for new data
 void idleCall(void *dummy) {
-	SimpleStorage pixBuffer;
 	datadef_t data_def;
 	FtBufferRequest request;
 	FtBufferResponse response;
@@ -216,12 +216,13 @@ void idleCall(void *dummy) {
 		fprintf(stderr, "Error in communication. Buffer server aborted??\n");
 		return;
 	}
-	if (!response.checkGetData(data_def, &pixBuffer)) {
+	const void *pixBuffer = response.getDataView(data_def);
+	if (pixBuffer == NULL) {
 		fprintf(stderr, "Error in received packet.\n");
 		return;
 	}
 	
-	px2i.getFromBuffer(pixBuffer.data(), essProtInfo.readoutPixels, essProtInfo.phasePixels, essProtInfo.numberOfSlices);
+	px2i.getFromBuffer(pixBuffer, essProtInfo.readoutPixels, essProtInfo.phasePixels, essProtInfo.numberOfSlices);
 	IW->redraw();
 }
 
@@ -26,6 +26,7 @@ Fl_Button *butConnect, *butListen, *butUdpEnable;
 Fl_Browser *msgBrowser;
 Fl_Box *piBox;
 PixelDataGrabber pdg;
+RigidRealigner *realigner = NULL;
 char hostname[256];
 int port;
 char directory[256];
@@ -244,6 +245,12 @@ int main(int argc, char *argv[]) {
 		strncpy(directory, "E:\\IMAGE", 256);
 	}
 	
+	// optionally realign the scans against the first one, using this many threads
+	if (argc>=5 && atoi(argv[4]) > 0) {
+		realigner = new RigidRealigner(atoi(argv[4]));
+		pdg.setRealigner(realigner);
+	}
+	
 	Fl::visual(FL_RGB);
 	window = new Fl_Window(100,100,400,350,"Realtime fMRI streamer, (C) Stefan Klanke & Tim van Mourik");
 	inpHostname = new Fl_Input(20,30,200,25,"Hostname");
@@ -318,6 +325,8 @@ int main(int argc, char *argv[]) {
 	}
 	
 	delete window;
+	pdg.setRealigner(NULL);
+	if (realigner != NULL) delete realigner;
 	
 	WSACleanup();
 	
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+#include <string.h>
+#include <math.h>
+
+#include <mosaic.h>
+
+int mosaic_check_layout(mosaic_layout_t *layout, unsigned int numPixels) {
+	unsigned int slicePixels = layout->readResolution * layout->phaseResolution;
+	unsigned int tiles, mosw;
+	
+	if (slicePixels == 0 || numPixels % slicePixels != 0) return -1;
+	
+	tiles = numPixels / slicePixels;
+	mosw  = (unsigned int) floor(sqrt((double) tiles) + 0.5);
+	if (mosw*mosw != tiles || layout->numSlices > tiles) return -1;
+	
+	layout->mosaicWidth = mosw;
+	return 0;
+}
+
+static int16_t saturate(int32_t x) {
+	if (x > 32767) return 32767;
+	if (x < -32768) return -32768;
+	return (int16_t) x;
+}
+
+/* one row of a slice, the loops are simple enough for the compiler to vectorize */
+static void combine_row(const int16_t *src, int16_t *dest, unsigned int n, float weight, int accumulate) {
+	unsigned int v;
+	
+	if (weight == 1.0f) {
+		if (!accumulate) {
+			memcpy(dest, src, n * sizeof(int16_t));
+		} else {
+			for (v=0;v<n;v++) dest[v] = saturate((int32_t) dest[v] + src[v]);
+		}
+	} else {
+		if (!accumulate) {
+			for (v=0;v<n;v++) dest[v] = saturate((int32_t) floorf(weight*src[v] + 0.5f));
+		} else {
+			for (v=0;v<n;v++) dest[v] = saturate((int32_t) dest[v] + (int32_t) floorf(weight*src[v] + 0.5f));
+		}
+	}
+}
+
+void mosaic_to_slices(const mosaic_layout_t *layout, const int16_t *src, int16_t *dest, float weight, int accumulate) {
+	unsigned int rr   = layout->readResolution;
+	unsigned int pr   = layout->phaseResolution;
+	unsigned int mosw = layout->mosaicWidth;
+	unsigned int i, j, m;
+	
+	/* row i of tiles, line m within these tiles, tile j within the row:
+	   the lines of the tiles j=0..mosw-1 follow each other in the source */
+	for (i=0; i<mosw && i*mosw < layout->numSlices; i++) {
+		for (m=0; m<pr; m++) {
+			const int16_t *src_m = src + rr*mosw*(pr*i + m);
+			unsigned int off_m = rr * (layout->flipPhase ? pr-1-m : m);
+			
+			for (j=0; j<mosw; j++) {
+				unsigned int n = i*mosw + j;
+				if (n >= layout->numSlices) break;
+				combine_row(src_m + rr*j, dest + rr*pr*n + off_m, rr, weight, accumulate);
+			}
+		}
+	}
+}
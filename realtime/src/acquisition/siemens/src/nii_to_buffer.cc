@@ -3,33 +3,72 @@
  * Donders Institute for Donders Institute for Brain, Cognition and Behaviour,
  * Centre for Cognitive Neuroimaging, Radboud University Nijmegen,
  * Kapittelweg 29, 6525 EN Nijmegen, The Netherlands
+ *
+ * Replays a series of NIFTI-1 files, or the volumes of a single 4D file, to a
+ * FieldTrip buffer at a fixed interval. A reader thread maps the files in
+ * memory and prepares the next volumes while the main thread waits for the
+ * time of the next scan, so that the volumes are written on time also when the
+ * files are large or have to be reshaped from a mosaic. Each volume is written
+ * in one request together with its event, and carries the time at which it was
+ * scheduled, see ft_clock_ns.
  */
 
 #include <vector>
 #include <string>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include <ctype.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 #ifdef WIN32
 #include <windows.h>
 #else
 #include <unistd.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #endif
 
 #include <nifti1.h>
+#include <mosaic.h>
 #include <FtBuffer.h>
+#include <ftclock.h>
+
+#define NUM_PREFETCH 8	// number of volumes that the reader thread prepares ahead of time
+
+typedef struct {
+	const char *data;
+	size_t size;
+#ifdef WIN32
+	HANDLE file, mapping;
+#else
+	int fd;
+#endif
+} mapped_file_t;
+
+typedef struct {
+	void *data;		// the voxels of one volume, as they are written to the buffer
+	bool ready;		// set by the reader thread, cleared when the volume has been written
+} prefetch_slot_t;
 
 nifti_1_header commonHeader;
 std::vector<std::string> niiFiles;
-void *dataBuffer;
+unsigned int volumesPerFile = 1;
+unsigned int numVolumes;
 unsigned int dataSize;
 int nChans;
 int ftSocket;
-FtBufferRequest ftReq;
+FtBufferRequest ftReq, evReq, batchReq;
 int interval = 2000; // in milliseconds
+mosaic_layout_t mosaic; // used if the files contain a mosaic (mosaic.numSlices > 0)
+
+prefetch_slot_t slots[NUM_PREFETCH];
+pthread_mutex_t slotMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t slotCond = PTHREAD_COND_INITIALIZER;
+bool stopReader = false;
 
 bool isRelative(const char *fn) {
 	while (*fn != 0) {
@@ -50,13 +89,38 @@ bool areEqual(const nifti_1_header &A, const nifti_1_header &B) {
 	return true;
 }
 
-int readAndCheckScannerFile(char *filename) {
+bool addFile(const std::string &fullname) {
 	nifti_1_header thisHeader;
+
+	FILE *nf = fopen(fullname.c_str(), "rb");
+	if (nf==NULL) {
+		fprintf(stderr,"Cannot open %s\n", fullname.c_str());
+		return false;
+	}
+
+	int read = fread(&thisHeader, 1, sizeof(thisHeader), nf);
+	fclose(nf);
+
+	if (read != sizeof(thisHeader)) {
+		fprintf(stderr,"Could not read NIFTI-1 header from %s\n", fullname.c_str());
+		return false;
+	}
+	if (niiFiles.size() == 0 && strcmp(thisHeader.magic, "n+1")==0) {
+		commonHeader = thisHeader;
+	} else if (!areEqual(thisHeader, commonHeader)) {
+		fprintf(stderr, "Header of %s does not equal header of %s\n",fullname.c_str(), niiFiles.size() ? niiFiles[0].c_str() : "the first file");
+		return false;
+	}
+	niiFiles.push_back(fullname);
+	return true;
+}
+
+int readAndCheckScannerFile(char *filename) {
 	std::string path;
 	FILE *f;
 	int len = 0;
 	char *last;
-	
+
 	last = strrchr(filename,'\\');
 	if (last != NULL) {
 		len = last-filename;
@@ -69,67 +133,138 @@ int readAndCheckScannerFile(char *filename) {
 	if (len>0) {
 		path.assign(filename, len+1);
 	}
-	
+
 	f = fopen(filename, "r");
 	if (f==NULL) return -1;
-	
+
 	while (!feof(f)) {
 		char line[512];
-		
-		fgets(line, 512, f);
+
+		if (fgets(line, 512, f) == NULL) break;
 		len = strlen(line);
 		while (len>0 && isspace(line[len-1])) len--;
-		
+
 		if (len==0) continue;
-		
+
 		std::string fullname = path;
 		fullname.append(line,len);
-		
-		FILE *nf = fopen(fullname.c_str(), "rb");
-		if (nf==NULL) {
-			fprintf(stderr,"Cannot open %s\n", fullname.c_str());
-			continue;
-		}
-		
-		int read = fread(&thisHeader, 1, sizeof(thisHeader), nf);
-		if (read == sizeof(thisHeader)) {
-			if (niiFiles.size() == 0 && strcmp(thisHeader.magic, "n+1")==0) {
-				commonHeader = thisHeader;
-				niiFiles.push_back(fullname);
-			} else {
-				if (!areEqual(thisHeader, commonHeader)) {
-					fprintf(stderr, "Header of %s does not equal header of %s\n",fullname.c_str(), niiFiles[0].c_str());
-				} else {
-					niiFiles.push_back(fullname);
-				}
-			}
-		} else {
-			fprintf(stderr,"Could not read NIFTI-1 header from %s\n", fullname.c_str());
-		}
-		fclose(nf);
+		addFile(fullname);
 	}
-	
+
 	fclose(f);
 	return niiFiles.size();
 }
 
-bool grabScan(int i) {
-	FILE *nf = fopen(niiFiles[i].c_str(),"rb");
-	if (nf == NULL) return false;
-	
-	fseek(nf, 352, SEEK_SET);
-	if (fread(dataBuffer, 1, dataSize, nf) != dataSize) {
-		printf("Warning: Could not read all voxels from %s\n", niiFiles[i].c_str());
+bool mapFile(const char *filename, mapped_file_t *M) {
+#ifdef WIN32
+	LARGE_INTEGER size;
+	M->file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (M->file == INVALID_HANDLE_VALUE) return false;
+	if (!GetFileSizeEx(M->file, &size) || size.QuadPart == 0) {
+		CloseHandle(M->file);
+		return false;
 	}
-	
-	fclose(nf);
+	M->size = (size_t) size.QuadPart;
+	M->mapping = CreateFileMapping(M->file, NULL, PAGE_READONLY, 0, 0, NULL);
+	M->data = (const char *) (M->mapping ? MapViewOfFile(M->mapping, FILE_MAP_READ, 0, 0, 0) : NULL);
+	if (M->data == NULL) {
+		if (M->mapping) CloseHandle(M->mapping);
+		CloseHandle(M->file);
+		return false;
+	}
+#else
+	struct stat st;
+	void *data;
+	M->fd = open(filename, O_RDONLY);
+	if (M->fd < 0) return false;
+	if (fstat(M->fd, &st) != 0 || st.st_size == 0) {
+		close(M->fd);
+		return false;
+	}
+	M->size = (size_t) st.st_size;
+	data = mmap(NULL, M->size, PROT_READ, MAP_PRIVATE, M->fd, 0);
+	if (data == MAP_FAILED) {
+		close(M->fd);
+		return false;
+	}
+#ifdef MADV_SEQUENTIAL
+	madvise(data, M->size, MADV_SEQUENTIAL);
+#endif
+	M->data = (const char *) data;
+#endif
 	return true;
 }
 
+void unmapFile(mapped_file_t *M) {
+	if (M->data == NULL) return;
+#ifdef WIN32
+	UnmapViewOfFile(M->data);
+	CloseHandle(M->mapping);
+	CloseHandle(M->file);
+#else
+	munmap((void *) M->data, M->size);
+	close(M->fd);
+#endif
+	M->data = NULL;
+}
+
+// copies (or reshapes) volume i from the mapped file into dest
+void grabScan(unsigned int i, const mapped_file_t *M, void *dest) {
+	size_t offset = (commonHeader.vox_offset >= 352) ? (size_t) commonHeader.vox_offset : 352;
+	size_t volSize = (mosaic.numSlices == 0) ? dataSize : sizeof(INT16_T) * mosaic.readResolution * mosaic.phaseResolution * mosaic.mosaicWidth * mosaic.mosaicWidth;
+
+	offset += volSize * (i % volumesPerFile);
+	if (M->data == NULL || offset + volSize > M->size) {
+		printf("Warning: Could not read all voxels of scan %u from %s\n", i, niiFiles[i / volumesPerFile].c_str());
+		memset(dest, 0, dataSize);
+		return;
+	}
+	if (mosaic.numSlices == 0) {
+		memcpy(dest, M->data + offset, dataSize);
+	} else {
+		// same layout as the .PixelData files, but without flipping the slices
+		mosaic_to_slices(&mosaic, (const int16_t *) (M->data + offset), (int16_t *) dest, 1.0f, 0);
+	}
+}
+
+void *readerThread(void *arg) {
+	mapped_file_t M;
+	int current = -1;
+
+	M.data = NULL;
+	for (unsigned int i=0;i<numVolumes;i++) {
+		prefetch_slot_t *S = &slots[i % NUM_PREFETCH];
+		int file = i / volumesPerFile;
+
+		pthread_mutex_lock(&slotMutex);
+		while (S->ready && !stopReader) pthread_cond_wait(&slotCond, &slotMutex);
+		bool stop = stopReader;
+		pthread_mutex_unlock(&slotMutex);
+		if (stop) break;
+
+		if (file != current) {
+			unmapFile(&M);
+			if (!mapFile(niiFiles[file].c_str(), &M)) {
+				fprintf(stderr, "Cannot map %s\n", niiFiles[file].c_str());
+				M.data = NULL;
+			}
+			current = file;
+		}
+		grabScan(i, &M, S->data);
+
+		pthread_mutex_lock(&slotMutex);
+		S->ready = true;
+		pthread_cond_broadcast(&slotCond);
+		pthread_mutex_unlock(&slotMutex);
+	}
+	unmapFile(&M);
+	return NULL;
+}
+
 bool writeHeader() {
 	FtBufferResponse resp;
-	
-	if (ftReq.prepPutHeader(nChans, DATATYPE_INT16, 1000.0 / (float) interval) && 
+
+	if (ftReq.prepPutHeader(nChans, DATATYPE_INT16, 1000.0 / (float) interval) &&
 		ftReq.prepPutHeaderAddChunk(FT_CHUNK_NIFTI1, sizeof(commonHeader), &commonHeader)) {
 
 		tcprequest(ftSocket, ftReq.out(), resp.in());
@@ -140,124 +275,182 @@ bool writeHeader() {
 	return resp.checkPut();
 }
 
-bool writeScan(int i, const struct timeval &tv) {
+// writes the volume and its event in one go, with the time at which it was scheduled
+bool writeScan(int i, const void *data, UINT64_T time) {
 	FtBufferResponse resp;
-	//char ts[20];
-	
-	if (!ftReq.prepPutData(nChans, 1, DATATYPE_INT16, dataBuffer)) {
-		fprintf(stderr, "Out of memory!\n");
-		exit(1);
-	}
-	
-	tcprequest(ftSocket, ftReq.out(), resp.in());
-	
-	if (!resp.checkPut()) return false;
-	
-	//sprintf(ts, "%11li.%06li", tv.tv_sec, tv.tv_usec);
-	
-	if (!ftReq.prepPutEvent(i, 0, 0, "scan","ready")) {
+
+	batchReq.prepPutBatch();
+	if (!ftReq.prepPutDataTimestamp(nChans, 1, DATATYPE_INT16, data, time) || !batchReq.prepBatchAdd(ftReq) ||
+		!evReq.prepPutEvent(i, 0, 0, "scan","ready") || !batchReq.prepBatchAdd(evReq)) {
 		fprintf(stderr, "Out of memory!\n");
 		exit(1);
 	}
-	tcprequest(ftSocket, ftReq.out(), resp.in());
+
+	if (tcprequest(ftSocket, batchReq.out(), resp.in()) < 0) return false;
 	return resp.checkPut();
 }
 
 int main(int argc, char *argv[]) {
 	char hostname[256];
-	int port;
-	struct timeval tvBefore, tvAfter;
-	
+	int port, numFiles;
+	struct timeval tvWrite;
+	pthread_t reader;
+	UINT64_T start, deadline;
+
 	if (sizeof(nifti_1_header) != 348) {
-		fprintf(stderr, "Struct nifti_1_header has bad size (%i bytes, should be 348)\n", sizeof(nifti_1_header));
+		fprintf(stderr, "Struct nifti_1_header has bad size (%i bytes, should be 348)\n", (int) sizeof(nifti_1_header));
 	}
-	
+
 	#ifdef WIN32
 	timeBeginPeriod(1);
 	#endif
-	
+
 	if (argc<2) {
-		printf("Usage:\n  nii_to_buffer  path_to/niscanner.txt  [deltaMilliSec=2000 [hostname=localhost [port=1972]]]");
+		printf("Usage:\n  nii_to_buffer  path_to/niscanner.txt  [deltaMilliSec=2000 [hostname=localhost [port=1972 [mosaicSlices=0]]]]\n");
+		printf("  nii_to_buffer  path_to/volumes.nii    [deltaMilliSec=2000 [hostname=localhost [port=1972 [mosaicSlices=0]]]]\n");
+		printf("The first form transmits the files listed in niscanner.txt, the second one all volumes of a 4D file.\n");
+		printf("With mosaicSlices > 0, the files contain a single mosaic image with that many slices as tiles.\n");
 		return 1;
 	}
-	
-	printf("Reading %s and checking listed files...\n", argv[1]);
-	int numFiles = readAndCheckScannerFile(argv[1]);
-	
-	if (numFiles == -1) {
-		fprintf(stderr, "Could not open scanner description file %s\n",argv[1]);
-		return 1;
+
+	size_t len = strlen(argv[1]);
+	if (len > 4 && strcmp(argv[1] + len - 4, ".nii") == 0) {
+		printf("Checking %s...\n", argv[1]);
+		numFiles = addFile(argv[1]) ? 1 : 0;
+		if (numFiles == 1 && commonHeader.dim[0] >= 4 && commonHeader.dim[4] > 1) {
+			volumesPerFile = commonHeader.dim[4];
+		}
+	} else {
+		printf("Reading %s and checking listed files...\n", argv[1]);
+		numFiles = readAndCheckScannerFile(argv[1]);
+		if (numFiles == -1) {
+			fprintf(stderr, "Could not open scanner description file %s\n",argv[1]);
+			return 1;
+		}
 	}
 	if (numFiles == 0) {
 		fprintf(stderr, "Could not read a single NII file :-(\n");
+		return 1;
 	}
-	printf("Will transmit %i scans\n", numFiles);
-	
+	numVolumes = numFiles * volumesPerFile;
+	printf("Will transmit %u scans\n", numVolumes);
+
+	// the header in the buffer describes a single volume
+	if (volumesPerFile > 1) {
+		commonHeader.dim[0] = 3;
+		commonHeader.dim[4] = 1;
+	}
+
 	if (argc>=3) {
 		interval = atoi(argv[2]);
 	}
-	
+
 	if (argc>=4) {
 		strncpy(hostname, argv[3], 256);
 	} else {
 		strncpy(hostname, "localhost", 256);
 	}
-	
+
 	if (argc>=5) {
 		port = atoi(argv[4]);
 	} else {
 		port = 1972;
 	}
-	
-	if (commonHeader.datatype != DT_INT16) { 
+
+	if (commonHeader.datatype != DT_INT16) {
 		fprintf(stderr, "Sorry, datatype != DT_INT16, don't know what to do.\n");
 		return 1;
 	}
+
+	memset(&mosaic, 0, sizeof(mosaic));
+	if (argc>=6 && atoi(argv[5]) > 0) {
+		unsigned int slices = atoi(argv[5]);
+		unsigned int mosw = (unsigned int) ceil(sqrt((double) slices));
+
+		if (commonHeader.dim[3] != 1 || commonHeader.dim[1] % mosw != 0 || commonHeader.dim[2] % mosw != 0) {
+			fprintf(stderr, "Sorry, the images are not a mosaic of %u slices.\n", slices);
+			return 1;
+		}
+		mosaic.readResolution  = commonHeader.dim[1] / mosw;
+		mosaic.phaseResolution = commonHeader.dim[2] / mosw;
+		mosaic.numSlices       = slices;
+		mosaic.flipPhase       = 0;
+		mosaic_check_layout(&mosaic, commonHeader.dim[1]*commonHeader.dim[2]);
+
+		// the buffer receives the slices
+		commonHeader.dim[1] = mosaic.readResolution;
+		commonHeader.dim[2] = mosaic.phaseResolution;
+		commonHeader.dim[3] = slices;
+		printf("Reshaping mosaic into %u slices of %u x %u\n", slices, mosaic.readResolution, mosaic.phaseResolution);
+	}
+
 	nChans = commonHeader.dim[1]*commonHeader.dim[2]*commonHeader.dim[3];
 	if (nChans == 0) {
 		fprintf(stderr, "Sorry, one of the dimensions is 0 - don't know what to do.\n");
 		return 1;
 	}
 	dataSize = sizeof(UINT16_T) * nChans;
-	dataBuffer = calloc(dataSize,1);
-	if (dataBuffer == NULL) {
-		fprintf(stderr, "Sorry, could not allocate memory for caching voxel data.\n");
-		return 1;
+	for (int k=0;k<NUM_PREFETCH;k++) {
+		slots[k].ready = false;
+		slots[k].data = calloc(dataSize,1);
+		if (slots[k].data == NULL) {
+			fprintf(stderr, "Sorry, could not allocate memory for caching voxel data.\n");
+			return 1;
+		}
 	}
-	
+
 	printf("Trying to connect to fieldtrip buffer on %s:%d\n", hostname, port);
 	ftSocket = open_connection(hostname, port);
 	if (ftSocket == -1) {
 		fprintf(stderr, "Sorry, connection to FieldTrip failed.\n");
-		free(dataBuffer);
 		return 1;
 	}
 	printf("Ok!\n\n");
-				
-	gettimeofday(&tvBefore, NULL);
+
+	if (pthread_create(&reader, NULL, readerThread, NULL) != 0) {
+		fprintf(stderr, "Sorry, could not start the reader thread.\n");
+		close_connection(ftSocket);
+		return 1;
+	}
+
+	start = ft_clock_ns();
+	gettimeofday(&tvWrite, NULL);
 	if (writeHeader()) {
-		printf("Wrote header at unixtime = %li.%06li\n", tvBefore.tv_sec, tvBefore.tv_usec);
-		gettimeofday(&tvAfter, NULL);
-		
-		for (unsigned int i=0;i<niiFiles.size();i++) {
-			#ifdef WIN32
-			int milliSec = interval - 1000*(tvAfter.tv_sec - tvBefore.tv_sec) - (tvAfter.tv_usec - tvBefore.tv_usec)/1000;
-			if (milliSec>0) Sleep(milliSec);
-			#else
-			int usec = 1000*(interval - 1000*(tvAfter.tv_sec - tvBefore.tv_sec)) - (tvAfter.tv_usec - tvBefore.tv_usec);
-			if (usec>0) usleep(usec);
-			#endif
-		
-			gettimeofday(&tvBefore, NULL);
-			grabScan(i);
-			if (!writeScan(i,tvBefore)) continue;
-			printf("Wrote scan %i at unixtime = %li.%06li\n", i, tvBefore.tv_sec, tvBefore.tv_usec);
-			
-			gettimeofday(&tvAfter, NULL);
+		printf("Wrote header at unixtime = %li.%06li\n", (long) tvWrite.tv_sec, (long) tvWrite.tv_usec);
+
+		for (unsigned int i=0;i<numVolumes;i++) {
+			prefetch_slot_t *S = &slots[i % NUM_PREFETCH];
+
+			// the scans are scheduled relative to the header, so that the delays do not add up
+			deadline = start + (UINT64_T) (i+1) * interval * 1000000;
+
+			pthread_mutex_lock(&slotMutex);
+			while (!S->ready) pthread_cond_wait(&slotCond, &slotMutex);
+			pthread_mutex_unlock(&slotMutex);
+
+			ft_clock_sleep_until(deadline);
+			double late = (ft_clock_ns() - deadline)*1e-6;
+
+			gettimeofday(&tvWrite, NULL);
+			bool ok = writeScan(i, S->data, deadline);
+
+			pthread_mutex_lock(&slotMutex);
+			S->ready = false;
+			pthread_cond_broadcast(&slotCond);
+			pthread_mutex_unlock(&slotMutex);
+
+			if (!ok) continue;
+			printf("Wrote scan %i at unixtime = %li.%06li, %.3f ms late\n", i, (long) tvWrite.tv_sec, (long) tvWrite.tv_usec, late);
 		}
 	}
-	
+
+	pthread_mutex_lock(&slotMutex);
+	stopReader = true;
+	pthread_cond_broadcast(&slotCond);
+	pthread_mutex_unlock(&slotMutex);
+	pthread_join(reader, NULL);
+
 	close_connection(ftSocket);
-	free(dataBuffer);
+	for (int k=0;k<NUM_PREFETCH;k++) free(slots[k].data);
 	return 0;
 }
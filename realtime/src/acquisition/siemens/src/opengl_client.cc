@@ -8,15 +8,24 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include <pthread.h>
+#include <vector>
 
 #include <platform.h>
 #if defined (PLATFORM_OSX)
 #include <OpenGL/gl.h>
 #include <OpenGL/glu.h>
+#include <dlfcn.h>
+#elif defined (PLATFORM_WINDOWS)
+#include <windows.h>
+#include <GL/gl.h>
+#include <GL/glu.h>
 #else
 #include <GL/gl.h>
 #include <GL/glu.h>
+#include <GL/glx.h>
 #endif
 
 #include <FL/Fl.H>
@@ -26,33 +35,193 @@
 #include <Brain3dWindow.h>
 
 #include <buffer.h>
+#include <asyncrequest.h>
 #include <siemensap.h>
 #include <SimpleStorage.h>
 #include <FtBuffer.h>
 #include <nifti1.h>
 
+// OpenGL 1.2 / 1.5 constants, which are missing from the 1.1 headers on Windows
+#ifndef GL_TEXTURE_3D
+#define GL_TEXTURE_3D			0x806F
+#endif
+#ifndef GL_TEXTURE_WRAP_R
+#define GL_TEXTURE_WRAP_R		0x8072
+#endif
+#ifndef GL_CLAMP_TO_EDGE
+#define GL_CLAMP_TO_EDGE		0x812F
+#endif
+#ifndef GL_PIXEL_UNPACK_BUFFER
+#define GL_PIXEL_UNPACK_BUFFER	0x88EC
+#endif
+#ifndef GL_STREAM_DRAW
+#define GL_STREAM_DRAW			0x88E0
+#endif
+#ifndef GL_WRITE_ONLY
+#define GL_WRITE_ONLY			0x88B9
+#endif
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+
+#define NUM_UPLOAD_BUFFERS	2	// pixel buffer objects that are used in turn
+
+
+typedef void (APIENTRY *texImage3D_t)(GLenum, GLint, GLint, GLsizei, GLsizei, GLsizei, GLint, GLenum, GLenum, const GLvoid *);
+typedef void (APIENTRY *texSubImage3D_t)(GLenum, GLint, GLint, GLint, GLint, GLsizei, GLsizei, GLsizei, GLenum, GLenum, const GLvoid *);
+typedef void (APIENTRY *genBuffers_t)(GLsizei, GLuint *);
+typedef void (APIENTRY *deleteBuffers_t)(GLsizei, const GLuint *);
+typedef void (APIENTRY *bindBuffer_t)(GLenum, GLuint);
+typedef void (APIENTRY *bufferData_t)(GLenum, ptrdiff_t, const GLvoid *, GLenum);
+typedef GLvoid* (APIENTRY *mapBuffer_t)(GLenum, GLenum);
+typedef GLboolean (APIENTRY *unmapBuffer_t)(GLenum);
+
+/** Look up an OpenGL entry point, this needs a current context on Windows */
+static void *getGLProc(const char *name) {
+#if defined (PLATFORM_WINDOWS)
+	return (void *) wglGetProcAddress(name);
+#elif defined (PLATFORM_OSX)
+	return dlsym(RTLD_DEFAULT, name);
+#else
+	return (void *) glXGetProcAddressARB((const GLubyte *) name);
+#endif
+}
+
+
+/** Converts the int16 voxels of a volume to luminance-alpha pairs for the textures */
+void convertPixels(const int16_t *pixels, int numPixels, unsigned char *image) {
+	for (int i=0;i<numPixels;i++) {
+		int v32 = pixels[i]*255;
+		image[2*i] = v32 / 1500; /* use proper scaling sometime */
+		image[2*i+1] = v32 / 1500;
+	}
+}
+
+
+/** Uploads the converted volumes into textures. If the OpenGL implementation
+	supports 3D textures and pixel buffer objects, the volume goes into a single
+	3D texture that is updated through PBOs. Each PBO is orphaned before it is
+	filled, so the driver can hand out fresh memory while the previous upload
+	is still being transferred, and glTexSubImage3D returns without waiting
+	for the copy. Otherwise each slice is uploaded as a 2D texture.
+*/
 class PixelData2Texture {
 	public:
 	
 	PixelData2Texture() {
-		numAlloc = 0;
 		NS = 0;
 		NT = 0;
-		image = 0;
+		W = H = 0;
+		volumeTexture = 0;
+		nextUpload = 0;
+		haveExtensions = false;
+		checkedExtensions = false;
 	}
 	
 	~PixelData2Texture() {
-		if (image) free(image);
 		if (NT>0) {
 			glDeleteTextures(NT, texture);
 		}
+		if (volumeTexture != 0) {
+			glDeleteTextures(1, &volumeTexture);
+			pDeleteBuffers(NUM_UPLOAD_BUFFERS, uploadBuffer);
+		}
+	}
+	
+	/** Load the entry points of OpenGL 1.2 and 1.5, must be called with the context current */
+	bool checkExtensions() {
+		if (checkedExtensions) return haveExtensions;
+		checkedExtensions = true;
+		
+		pTexImage3D = (texImage3D_t) getGLProc("glTexImage3D");
+		pTexSubImage3D = (texSubImage3D_t) getGLProc("glTexSubImage3D");
+		pGenBuffers = (genBuffers_t) getGLProc("glGenBuffers");
+		pDeleteBuffers = (deleteBuffers_t) getGLProc("glDeleteBuffers");
+		pBindBuffer = (bindBuffer_t) getGLProc("glBindBuffer");
+		pBufferData = (bufferData_t) getGLProc("glBufferData");
+		pMapBuffer = (mapBuffer_t) getGLProc("glMapBuffer");
+		pUnmapBuffer = (unmapBuffer_t) getGLProc("glUnmapBuffer");
+		
+		haveExtensions = pTexImage3D && pTexSubImage3D && pGenBuffers && pDeleteBuffers 
+			&& pBindBuffer && pBufferData && pMapBuffer && pUnmapBuffer;
+		if (!haveExtensions) {
+			printf("No support for 3D textures and pixel buffer objects, uploading slice by slice\n");
+		}
+		return haveExtensions;
+	}
+	
+	/** Upload a converted volume of w*h*ns luminance-alpha pairs */
+	void upload(const unsigned char *image, int w, int h, int ns) {
+		if (w*h*ns < 1) return;
+		
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glPixelTransferf(GL_RED_BIAS, 0.0);
+		glPixelTransferf(GL_GREEN_BIAS, 0.0);
+		glPixelTransferf(GL_BLUE_BIAS, 0.0);
+		
+		if (checkExtensions()) {
+			uploadVolume(image, w, h, ns);
+		} else {
+			uploadSlices(image, w, h, ns);
+		}
+		W = w;
+		H = h;
+		NS = ns;
+	}
+	
+	/** Hand the textures of the last upload to the window */
+	void attach(Brain3dWindow *bw) const {
+		if (volumeTexture != 0) {
+			bw->setVolumeTexture(NS, volumeTexture);
+		} else {
+			bw->setSliceTextures(NS, texture);
+		}
 	}
+	
+	int getW() const { return W; }
+	int getH() const {	return H; }
+	int getNumSlices() const {	return NS;	}	
+	
+	protected:
+	
+	void uploadVolume(const unsigned char *image, int w, int h, int ns) {
+		ptrdiff_t size = 2*w*h*ns;
 		
-	void getFromBuffer(void *pixelData, int w, int h, int ns) {
-		int16_t *pixels;
-		int numPixels = w*h*ns;
+		if (volumeTexture == 0) {
+			glGenTextures(1, &volumeTexture);
+			pGenBuffers(NUM_UPLOAD_BUFFERS, uploadBuffer);
+		}
+		glBindTexture(GL_TEXTURE_3D, volumeTexture);
+		
+		if (w != W || h != H || ns != NS) {
+			// (re)allocate the texture only when the dimensions change
+			pTexImage3D(GL_TEXTURE_3D, 0, GL_LUMINANCE_ALPHA, w, h, ns, 0, GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, NULL);
+			if (glGetError()!=GL_NO_ERROR) printf("Error in texImage3D!\n");
+			glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);	// Linear Filtering
+			glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);	// Linear Filtering
+			glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_WRAP_R,GL_CLAMP_TO_EDGE);
+		}
+		
+		pBindBuffer(GL_PIXEL_UNPACK_BUFFER, uploadBuffer[nextUpload]);
+		nextUpload = (nextUpload + 1) % NUM_UPLOAD_BUFFERS;
 		
-		if (numPixels < 1) return;
+		// orphan the previous contents, so mapping does not wait for their transfer
+		pBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+		void *dest = pMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+		if (dest != NULL) {
+			memcpy(dest, image, size);
+			pUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			// with a bound unpack buffer, the pointer is an offset into it
+			pTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, w, h, ns, GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, (const GLvoid *) 0);
+		} else {
+			printf("Error in mapBuffer!\n");
+		}
+		pBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		if (glGetError()!=GL_NO_ERROR) printf("Error in texSubImage3D!\n");
+	}
+	
+	void uploadSlices(const unsigned char *image, int w, int h, int ns) {
+		if (ns > MAX_SLICE_TEXTURES) ns = MAX_SLICE_TEXTURES;
 		
 		if (NT < ns) {
 			for (int i=NT;i<ns;i++) {
@@ -63,85 +232,73 @@ class PixelData2Texture {
 			}
 			NT = ns;
 		}
-			
-		pixels = (int16_t *) pixelData;
-				
-		if (numPixels > numAlloc) {
-			if (image != 0) free(image);
-			image = (unsigned char *) malloc(2*numPixels);
-			if (image == 0) {
-				numAlloc = 0;
-				W = H = NS = 0;
-				return;
-			}
-			numAlloc = numPixels;
-			W = w; 
-			H = h;
-			NS = ns;
-		}
-		
-		for (int i=0;i<numPixels;i++) {
-			int v32 = pixels[i]*255;
-			image[2*i] = v32 / 1500; /* use proper scaling sometime */
-			image[2*i+1] = v32 / 1500;
-		}
 		
 		for (int i=0;i<ns; i++) {
 			// Generate The Texture
 			glBindTexture(GL_TEXTURE_2D, texture[i]);
 			if (glGetError()!=GL_NO_ERROR) printf("Error in bind %i!\n",i);
 			
-			glPixelTransferf(GL_RED_BIAS, 0.0);
-			glPixelTransferf(GL_GREEN_BIAS, 0.0);
-			glPixelTransferf(GL_BLUE_BIAS, 0.0);
-			
 			glTexImage2D(GL_TEXTURE_2D, 0, 4, w, h, 0, GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, image + i*w*h*2);
 			if (glGetError()!=GL_NO_ERROR) printf("Error in texImage %i!\n",i);
 			glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);	// Linear Filtering
 			glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);	// Linear Filtering
 		}
 	}
-			
-	const unsigned char *getImage() const {	return image; }
-	int getW() const { return W; }
-	int getH() const {	return H; }
-	int getNumSlices() const {	return NS;	}	
-	const GLuint *getTextures() const {	return texture;	}
-	
-	protected:
 	
-	GLuint texture[64];	
+	enum { MAX_SLICE_TEXTURES = 64 };
+	GLuint texture[MAX_SLICE_TEXTURES];	
+	GLuint volumeTexture;
+	GLuint uploadBuffer[NUM_UPLOAD_BUFFERS];
+	int nextUpload;
 	
-	unsigned char *image;
-	int numAlloc;
 	int W, H, NS, NT;
+	
+	bool checkedExtensions, haveExtensions;
+	texImage3D_t pTexImage3D;
+	texSubImage3D_t pTexSubImage3D;
+	genBuffers_t pGenBuffers;
+	deleteBuffers_t pDeleteBuffers;
+	bindBuffer_t pBindBuffer;
+	bufferData_t pBufferData;
+	mapBuffer_t pMapBuffer;
+	unmapBuffer_t pUnmapBuffer;
 };
 
 
+/** Volume that has been converted by the fetch thread, but not uploaded yet */
+struct StagedVolume {
+	std::vector<unsigned char> image;
+	int w, h, ns;
+};
+
 
 Brain3dWindow *BW;
 Fl_Value_Slider *sliFactor, *sliOffset;
 PixelData2Texture px2tex;
-unsigned int prevSamples = 0;
-int ftbSocket = -1;
 
+// the state below is only touched by the fetch thread
+ft_async_conn_t *asyncCon = NULL;
+unsigned int prevSamples = 0;
+bool retryHeader = false;
 sap_essentials_t essProtInfo;
+StagedVolume fetched;
 
+// handed from the fetch thread to the GUI under stagingMutex
+pthread_mutex_t stagingMutex = PTHREAD_MUTEX_INITIALIZER;
+StagedVolume staged;
+bool stagedNew = false;
+StagedVolume uploaded;		// only touched by the GUI thread
 
-bool readHeader() {
-	SimpleStorage protBuffer;
+pthread_t fetchThread;
+volatile int fetchRunning = 0;
+
+
+bool readHeader(const FtBufferResponse &response) {
 	headerdef_t header_def;
-	FtBufferRequest request;
-	FtBufferResponse response;
+	unsigned int protSize;
 	
-	request.prepGetHeader();
-	
-	if (tcprequest(ftbSocket, request.out(), response.in()) < 0) {
-		fprintf(stderr, "Error in communication. Buffer server aborted??\n");
-		return false;
-	}
-	
-	if (!response.checkGetHeader(header_def, &protBuffer)) {
+	const void *protBuffer = response.getHeaderView(header_def, protSize);
+	if (protBuffer == NULL) {
 		fprintf(stderr, "Error in received packet.\n");
 		return false;
 	}
@@ -154,7 +311,7 @@ bool readHeader() {
 	printf("\nHeader information: %i samples / %i channels\n\n", header_def.nsamples, header_def.nchans);
 	
 	
-	const ft_chunk_t *chunk = find_chunk(protBuffer.data(), 0, protBuffer.size(), FT_CHUNK_NIFTI1);
+	const ft_chunk_t *chunk = find_chunk(protBuffer, 0, protSize, FT_CHUNK_NIFTI1);
 	if (chunk != NULL && chunk->def.size == sizeof(nifti_1_header)) {
 		nifti_1_header *NH = (nifti_1_header *) chunk->data;
 		if (!strcmp(NH->magic, "ni1") || !strcmp(NH->magic,"n+1")) {
@@ -167,7 +324,7 @@ bool readHeader() {
 			return true;
 		}
 	}
-	chunk = find_chunk(protBuffer.data(), 0, protBuffer.size(), FT_CHUNK_SIEMENS_AP);
+	chunk = find_chunk(protBuffer, 0, protSize, FT_CHUNK_SIEMENS_AP);
 	if (chunk != NULL) {
 		sap_item_t *PI = sap_parse(chunk->data, chunk->def.size);
 		printf("Got Siemens ASCII protocol information!\n");
@@ -187,52 +344,148 @@ bool readHeader() {
 }
 
 
-// this will get called repeatedly from the GUI loop, use this to poll for new data
-void idleCall(void *dummy) {
-	SimpleStorage pixBuffer;
-	datadef_t data_def;
-	FtBufferRequest request;
-	FtBufferResponse response;
-	unsigned int newSamples, newEvents;
-	
-	if (essProtInfo.numberOfSlices == 0) {
-		if (!readHeader()) return;
+// called in the GUI thread through Fl::awake, uploads the most recent volume
+void uploadCallback(void *dummy) {
+	pthread_mutex_lock(&stagingMutex);
+	bool haveNew = stagedNew;
+	if (haveNew) {
+		uploaded.image.swap(staged.image);
+		uploaded.w  = staged.w;
+		uploaded.h  = staged.h;
+		uploaded.ns = staged.ns;
+		stagedNew = false;
 	}
+	pthread_mutex_unlock(&stagingMutex);
 	
-	request.prepWaitData(prevSamples, 0xFFFFFFFF, 50);
+	if (!haveNew) return;
 	
-	if (tcprequest(ftbSocket, request.out(), response.in()) < 0) {
+	BW->make_current();
+	px2tex.upload(&uploaded.image[0], uploaded.w, uploaded.h, uploaded.ns);
+	px2tex.attach(BW);
+	BW->redraw();
+}
+
+
+// the responses of the requests below are handled in the fetch thread
+void headerCallback(int status, message_t *msg, void*);
+void waitCallback(int status, message_t *msg, void*);
+void dataCallback(int status, message_t *msg, void*);
+
+void submit(const FtBufferRequest &request, ft_async_callback_t callback) {
+	if (ft_async_submit(asyncCon, request.out(), callback, NULL) != 0) {
 		fprintf(stderr, "Error in communication. Buffer server aborted??\n");
+	}
+}
+
+void requestHeader() {
+	FtBufferRequest request;
+	request.prepGetHeader();
+	submit(request, headerCallback);
+}
+
+void requestWait() {
+	FtBufferRequest request;
+	request.prepWaitData(prevSamples, 0xFFFFFFFF, 500);
+	submit(request, waitCallback);
+}
+
+void headerCallback(int status, message_t *msg, void*) {
+	FtBufferResponse response;
+	*response.in() = msg;
+	
+	if (status != 0) return;
+	if (!readHeader(response) || essProtInfo.numberOfSlices == 0) {
+		// try again a bit later, e.g. when there is no header yet
+		retryHeader = true;
 		return;
 	}
+	prevSamples = 0;
+	requestWait();
+}
+
+void waitCallback(int status, message_t *msg, void*) {
+	FtBufferResponse response;
+	unsigned int newSamples, newEvents;
+	*response.in() = msg;
+	
+	if (status != 0) return;
 	if (!response.checkWait(newSamples, newEvents)) {
 		fprintf(stderr, "Error in received packet.\n");
 		return;
 	}
-	
-	if (newSamples == prevSamples) return; // nothing new
 	if (newSamples < prevSamples) {
 		// oops ? do we have a new header?
-		if (!readHeader()) return;
+		requestHeader();
+		return;
 	}
-	prevSamples = newSamples;
-	
-	if (prevSamples == 0) return;
-	
-	request.prepGetData(prevSamples-1, prevSamples-1);
+	if (newSamples > prevSamples) {
+		// only the most recent scan is shown, the ones in between are skipped
+		FtBufferRequest request;
+		request.prepGetData(newSamples-1, newSamples-1);
+		submit(request, dataCallback);
+		prevSamples = newSamples;
+	}
+	requestWait();
+}
+
+void dataCallback(int status, message_t *msg, void*) {
+	datadef_t data_def;
+	FtBufferResponse response;
+	*response.in() = msg;
 	
-	if (tcprequest(ftbSocket, request.out(), response.in()) < 0) {
-		fprintf(stderr, "Error in communication. Buffer server aborted??\n");
+	if (status != 0) return;
+	const void *pixBuffer = response.getDataView(data_def);
+	if (pixBuffer == NULL) {
+		fprintf(stderr, "Error in received packet.\n");
 		return;
 	}
-	if (!response.checkGetData(data_def, &pixBuffer)) {
-		fprintf(stderr, "Error in received packet.\n");
+	
+	int w  = essProtInfo.readoutPixels;
+	int h  = essProtInfo.phasePixels;
+	int ns = essProtInfo.numberOfSlices;
+	int numPixels = w*h*ns;
+	
+	if (numPixels < 1 || data_def.data_type != DATATYPE_INT16 || data_def.nchans < (unsigned int) numPixels) {
+		fprintf(stderr, "Scan does not match the resolution in the header.\n");
 		return;
 	}
 	
-	px2tex.getFromBuffer(pixBuffer.data(), essProtInfo.readoutPixels, essProtInfo.phasePixels, essProtInfo.numberOfSlices);
-	BW->setSliceTextures(px2tex.getNumSlices(), px2tex.getTextures());
-	BW->redraw();
+	// convert straight from the received message, while the GUI keeps drawing
+	fetched.image.resize(2*numPixels);
+	convertPixels((const int16_t *) pixBuffer, numPixels, &fetched.image[0]);
+	fetched.w  = w;
+	fetched.h  = h;
+	fetched.ns = ns;
+	
+	pthread_mutex_lock(&stagingMutex);
+	staged.image.swap(fetched.image);
+	staged.w  = fetched.w;
+	staged.h  = fetched.h;
+	staged.ns = fetched.ns;
+	stagedNew = true;
+	pthread_mutex_unlock(&stagingMutex);
+	
+	Fl::awake(uploadCallback, NULL);
+}
+
+// keeps the requests to the buffer going, so that the GUI thread only uploads and draws
+void *fetchFunction(void *arg) {
+	requestHeader();
+	
+	while (fetchRunning) {
+		if (ft_async_poll(&asyncCon, 1, 100) < 0) break;
+		
+		if (ft_async_pending(asyncCon) == 0) {
+			if (!retryHeader) break; // the connection failed
+			retryHeader = false;
+			ft_clock_sleep(50000000ULL);
+			requestHeader();
+		}
+	}
+	if (fetchRunning) {
+		fprintf(stderr, "Error in communication. Buffer server aborted??\n");
+	}
+	return NULL;
 }
 
 
@@ -248,16 +501,22 @@ int main(int argc, char *argv[]) {
 	if (argc>1) hostname = argv[1];
 	if (argc>2) port = atoi(argv[2]);
 	
-	// this will trigger reading the header during the idleCall
+	// this will trigger reading the header in the fetch thread
 	essProtInfo.numberOfSlices = 0;
 	
 	printf("Trying to connect to fieldtrip buffer at %s:%d\n",hostname,port);
 	
-	ftbSocket = open_connection(hostname, port);
+	int ftbSocket = open_connection(hostname, port);
 	if (ftbSocket<=0) {
 		fprintf(stderr,"Failed\n");
 		exit(1);
 	}
+	asyncCon = ft_async_open(ftbSocket);
+	if (asyncCon == NULL) {
+		fprintf(stderr,"Failed\n");
+		close_connection(ftbSocket);
+		exit(1);
+	}
 		
 	Fl::visual(FL_RGB);
 	Fl_Window *window = new Fl_Window(100,100,600,700,"fMRI 3D client");
@@ -290,14 +549,25 @@ int main(int argc, char *argv[]) {
 	// an OpenGL context before trying to generate textures etc.
 	Fl::wait(0);		
 	
-	Fl::add_idle(idleCall);
+	// enables Fl::awake from the fetch thread
+	Fl::lock();
+	
+	fetchRunning = 1;
+	if (pthread_create(&fetchThread, NULL, fetchFunction, NULL)) {
+		fprintf(stderr, "Could not start the thread that reads from the buffer\n");
+		exit(1);
+	}
 	
 	BW->redraw();
 	
 	Fl::run();
+	
+	fetchRunning = 0;
+	pthread_join(fetchThread, NULL);
+	
 	//delete window;
 	delete BW;
 	
 	printf("Closing connection...\n");
-	close_connection(ftbSocket);
+	ft_async_close(asyncCon);
 }
@@ -4,13 +4,64 @@
  * Donders Institute for Donders Institute for Brain, Cognition and Behaviour,
  * Centre for Cognitive Neuroimaging, Radboud University Nijmegen,
  * Kapittelweg 29, 6525 EN Nijmegen, The Netherlands
+ *
+ * Use as
+ *   S = sap2matlab(protocol)
+ *   V = sap2matlab(protocol, 'sSliceArray.asSlice[0].dThickness')
+ *   C = sap2matlab(protocol, {'alTR', 'sKSpace.lBaseResolution'})
+ * where the first returns the complete protocol as a structure, and the others
+ * only convert the requested fields, or return [] for fields that are not present.
  */
 
 #include <mex.h>
 #include <siemensap.h>
 #include <string.h>
 
-mxArray *createStructFromSAP(sap_item_t *item) {
+mxArray *createStructFromSAP(const sap_item_t *item);
+
+/* converts the value of a single item, sub-structures are converted recursively */
+mxArray *createValueFromSAP(const sap_item_t *item) {
+	mxArray *F = NULL;
+	
+	switch(item->type) {
+		case SAP_DOUBLE:
+			F = mxCreateDoubleMatrix(item->num_elements, 1, mxREAL);
+			memcpy(mxGetPr(F), item->value, item->num_elements*sizeof(double));
+			break;
+		case SAP_LONG:
+			if (sizeof(long) == 4) {
+				/* 32 bit machine */
+				F = mxCreateNumericMatrix(item->num_elements, 1, mxINT32_CLASS, mxREAL);
+			} else {
+				F = mxCreateNumericMatrix(item->num_elements, 1, mxINT64_CLASS, mxREAL);
+			}
+			memcpy(mxGetPr(F), item->value, item->num_elements*sizeof(long));
+			break;
+		case SAP_TEXT:
+			F = mxCreateString((char *) item->value);
+			break;
+		case SAP_STRUCT:
+			if (item->is_array) {
+				sap_item_t **children = (sap_item_t **) item->value;
+				int i;
+				/*  We need to use a cell array here, since we're not guaranteed to have 
+					the same fields in each element
+				*/
+				F = mxCreateCellMatrix(item->num_elements,1);
+				for (i=0;i<item->num_elements;i++) {
+					mxArray *Fi = createStructFromSAP(children[i]);
+					mxSetCell(F,i,Fi);
+				}
+			} else {
+				sap_item_t **children = (sap_item_t **) item->value;
+				F = createStructFromSAP(children[0]);
+			}
+			break;
+	}
+	return F;
+}
+
+mxArray *createStructFromSAP(const sap_item_t *item) {
 	mxArray *A;
 	
 	if (item==NULL) {
@@ -20,7 +71,7 @@ mxArray *createStructFromSAP(sap_item_t *item) {
 	A = mxCreateStructMatrix(1,1,0,NULL);
 	
 	while (item!=NULL) {
-		mxArray *F = NULL;
+		mxArray *F;
 		int nr;
 		
 		nr = mxAddField(A, item->fieldname);
@@ -30,41 +81,7 @@ mxArray *createStructFromSAP(sap_item_t *item) {
 			continue;
 		}
 		
-		switch(item->type) {
-			case SAP_DOUBLE:
-				F = mxCreateDoubleMatrix(item->num_elements, 1, mxREAL);
-				memcpy(mxGetPr(F), item->value, item->num_elements*sizeof(double));
-				break;
-			case SAP_LONG:
-				if (sizeof(long) == 4) {
-					/* 32 bit machine */
-					F = mxCreateNumericMatrix(item->num_elements, 1, mxINT32_CLASS, mxREAL);
-				} else {
-					F = mxCreateNumericMatrix(item->num_elements, 1, mxINT64_CLASS, mxREAL);
-				}
-				memcpy(mxGetPr(F), item->value, item->num_elements*sizeof(long));
-				break;
-			case SAP_TEXT:
-				F = mxCreateString((char *) item->value);
-				break;
-			case SAP_STRUCT:
-				if (item->is_array) {
-					sap_item_t **children = (sap_item_t **) item->value;
-					int i;
-					/*  We need to use a cell array here, since we're not guaranteed to have 
-						the same fields in each element
-					*/
-					F = mxCreateCellMatrix(item->num_elements,1);
-					for (i=0;i<item->num_elements;i++) {
-						mxArray *Fi = createStructFromSAP(children[i]);
-						mxSetCell(F,i,Fi);
-					}
-				} else {
-					sap_item_t **children = (sap_item_t **) item->value;
-					F = createStructFromSAP(children[0]);
-				}
-				break;
-		}
+		F = createValueFromSAP(item);
 		if (F!=NULL) mxSetFieldByNumber(A,0,nr,F);
 		
 		item = item->next;
@@ -73,12 +90,28 @@ mxArray *createStructFromSAP(sap_item_t *item) {
 	return A;
 }
 
+/* looks up a single field like "sSliceArray.asSlice[0].dThickness", or returns [] if it is not present */
+mxArray *createFieldFromSAP(const sap_index_t *index, const mxArray *name) {
+	const sap_item_t *item;
+	mxArray *F = NULL;
+	char *fieldname;
+	
+	if (!mxIsChar(name)) mexErrMsgTxt("Field names must be given as a string or as a cell array of strings.");
+	
+	fieldname = mxArrayToString(name);
+	item = sap_index_lookup(index, fieldname);
+	mxFree(fieldname);
+	
+	if (item!=NULL) F = createValueFromSAP(item);
+	return (F!=NULL) ? F : mxCreateDoubleMatrix(0,0,mxREAL);
+}
+
 void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 	char *buffer;
 	int size;
 	sap_item_t *L = NULL;
 	
-	if (nrhs!=1) mexErrMsgTxt("This function needs exactly one (string or uint8) argument.");
+	if (nrhs<1 || nrhs>2) mexErrMsgTxt("This function needs one (string or uint8) argument, optionally followed by the field names.");
 	
 	size = (int) mxGetNumberOfElements(prhs[0]);
 	
@@ -95,7 +128,40 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 	
 	sap_reverse_in_place(&L);
 	
-	plhs[0] = createStructFromSAP(L);
+	if (nrhs==1) {
+		plhs[0] = createStructFromSAP(L);
+	} else {
+		/* only convert the requested fields, these are looked up in the index */
+		sap_index_t *I = sap_index_create(L);
+		
+		if (I==NULL) {
+			sap_destroy(L);
+			mexErrMsgTxt("Out of memory");
+		}
+		
+		if (mxIsCell(prhs[1])) {
+			int i, n = (int) mxGetNumberOfElements(prhs[1]);
+			
+			plhs[0] = mxCreateCellArray(mxGetNumberOfDimensions(prhs[1]), mxGetDimensions(prhs[1]));
+			for (i=0;i<n;i++) {
+				const mxArray *name = mxGetCell(prhs[1], i);
+				if (name==NULL || !mxIsChar(name)) {
+					sap_index_destroy(I);
+					sap_destroy(L);
+					mexErrMsgTxt("Field names must be given as a string or as a cell array of strings.");
+				}
+				mxSetCell(plhs[0], i, createFieldFromSAP(I, name));
+			}
+		} else if (mxIsChar(prhs[1])) {
+			plhs[0] = createFieldFromSAP(I, prhs[1]);
+		} else {
+			sap_index_destroy(I);
+			sap_destroy(L);
+			mexErrMsgTxt("Field names must be given as a string or as a cell array of strings.");
+		}
+		
+		sap_index_destroy(I);
+	}
 	
 	sap_destroy(L);
 }
@@ -267,8 +267,13 @@ int sap_handle_line(sap_item_t **first, const char *line, const char *line_end)
     printf("Still here. Typ=%i, size=%i longVal=%i\n", typ, size_value, longVal);
 #endif
     
-    /* the following cast is for removing the constness warning */
-    item = (sap_item_t *) sap_search_field(*first, len_name, name);
+    /* consecutive lines mostly describe the same (sub)structure, which then is the most recent item */
+    if (*first != NULL && 0==strncmp((*first)->fieldname, name, len_name) && (*first)->fieldname[len_name] == 0) {
+        item = *first;
+    } else {
+        /* the following cast is for removing the constness warning */
+        item = (sap_item_t *) sap_search_field(*first, len_name, name);
+    }
 #ifdef _DEBUG_
     printf("Still here. Typ=%i, size=%i longVal=%i\n", typ, size_value, longVal);
 #endif
@@ -480,8 +485,8 @@ const sap_item_t *sap_search_deep(const sap_item_t *list, const char *fieldname)
     if (item == NULL) return NULL; 	/* not found */
     if (dotLen == len) return item; /* user did not search for a sub-struct */
     
-    if (brkLen < len) {
-        /* user is looking for sub-struct of an array */
+    if (brkLen < dotLen) {
+        /* user is looking for sub-struct of an array, a bracket after the dot belongs to a deeper field */
         long val = strtol(brkPos+1, NULL, 10);
         if (val < 0) return NULL;
         index = (int) val;
@@ -489,13 +494,25 @@ const sap_item_t *sap_search_deep(const sap_item_t *list, const char *fieldname)
         index = 0;
     }
     
+    if (item->type != SAP_STRUCT || index >= item->num_elements) return NULL;
     item = ((sap_item_t **) item->value)[index];
     
     return sap_search_deep(item, dotPos+1);
 }
 
 
-int sap_get_essentials(const sap_item_t *list, sap_essentials_t *E) {
+/* the essentials are looked up in the same way in a list and in an index */
+typedef const sap_item_t *(*sap_lookup_t)(const void *source, const char *fieldname);
+
+static const sap_item_t *sap_lookup_list(const void *source, const char *fieldname) {
+    return sap_search_deep((const sap_item_t *) source, fieldname);
+}
+
+static const sap_item_t *sap_lookup_index(const void *source, const char *fieldname) {
+    return sap_index_lookup((const sap_index_t *) source, fieldname);
+}
+
+static int sap_lookup_essentials(sap_lookup_t lookup, const void *list, sap_essentials_t *E) {
     const sap_item_t *item;
     int numFound = 0;
     
@@ -503,13 +520,13 @@ int sap_get_essentials(const sap_item_t *list, sap_essentials_t *E) {
     
     memset(E, 0, sizeof(sap_essentials_t));
     
-    item = sap_search_deep(list, "alTR");
+    item = lookup(list, "alTR");
     if (item!=NULL && item->type == SAP_LONG) {
         E->TR = ((long *) item->value)[0];
         numFound++;
     }
     
-    item = sap_search_deep(list, "lContrasts");
+    item = lookup(list, "lContrasts");
     if (item!=NULL && item->type == SAP_LONG) {
         long cs = *((long *) item->value);
         if (cs>=0) {
@@ -518,7 +535,7 @@ int sap_get_essentials(const sap_item_t *list, sap_essentials_t *E) {
         }
     }
     
-    item = sap_search_deep(list, "sKSpace.lBaseResolution");
+    item = lookup(list, "sKSpace.lBaseResolution");
     if (item!=NULL && item->type == SAP_LONG) {
         long res = *((long *) item->value);
         if (res>0) {
@@ -527,7 +544,7 @@ int sap_get_essentials(const sap_item_t *list, sap_essentials_t *E) {
         }
     }
     
-    item = sap_search_deep(list, "sSliceArray.lSize");
+    item = lookup(list, "sSliceArray.lSize");
     if (item!=NULL && item->type == SAP_LONG) {
         long slices = *((long *) item->value);
         if (slices > 0) {
@@ -536,13 +553,13 @@ int sap_get_essentials(const sap_item_t *list, sap_essentials_t *E) {
         }
     }
     
-    item = sap_search_deep(list, "sSliceArray.asSlice[0].dPhaseFOV");
+    item = lookup(list, "sSliceArray.asSlice[0].dPhaseFOV");
     if (item!=NULL && item->type == SAP_DOUBLE) {
         E->phaseFOV = *((double *) item->value);
         numFound++;
     }
     
-    item = sap_search_deep(list, "sSliceArray.asSlice[0].dReadoutFOV");
+    item = lookup(list, "sSliceArray.asSlice[0].dReadoutFOV");
     if (item!=NULL && item->type == SAP_DOUBLE) {
         E->readoutFOV = *((double *) item->value);
         numFound++;
@@ -553,7 +570,7 @@ int sap_get_essentials(const sap_item_t *list, sap_essentials_t *E) {
         numFound++;
     }
     
-    item = sap_search_deep(list, "sSliceArray.asSlice[0].dThickness");
+    item = lookup(list, "sSliceArray.asSlice[0].dThickness");
     if (item!=NULL && item->type == SAP_DOUBLE) {
         E->sliceThickness = *((double *) item->value);
         numFound++;
@@ -562,6 +579,14 @@ int sap_get_essentials(const sap_item_t *list, sap_essentials_t *E) {
     return numFound;
 }
 
+int sap_get_essentials(const sap_item_t *list, sap_essentials_t *E) {
+    return sap_lookup_essentials(sap_lookup_list, list, E);
+}
+
+int sap_index_get_essentials(const sap_index_t *index, sap_essentials_t *E) {
+    return sap_lookup_essentials(sap_lookup_index, index, E);
+}
+
 void sap_remove_empty_arrays(sap_item_t **list)
 {
     sap_item_t *item = *list;
@@ -591,3 +616,183 @@ void sap_remove_empty_arrays(sap_item_t **list)
         sap_remove_empty_arrays(&item->next);
     }
 }
+
+/* Growing buffer, used for the names in the index and for the prefix while building it */
+typedef struct {
+    char *buf;
+    unsigned int len, size;
+} sap_buffer_t;
+
+static int sap_buffer_append(sap_buffer_t *B, const char *str, unsigned int len) {
+    if (B->len + len > B->size) {
+        unsigned int newSize = 2*(B->len + len) + 256;
+        char *newBuf = (char *) realloc(B->buf, newSize);
+        if (newBuf == NULL) return 0;
+        B->buf = newBuf;
+        B->size = newSize;
+    }
+    memcpy(B->buf + B->len, str, len);
+    B->len += len;
+    return 1;
+}
+
+/* The index is a hash table with the full names of all fields, e.g. "sSliceArray.asSlice[0].dThickness".
+ * All names are stored one after the other in a single buffer, the entries refer to them by their offset.
+ */
+typedef struct {
+    unsigned int name;          /* offset of the full name in the buffer */
+    unsigned int hash;
+    const sap_item_t *item;
+} sap_index_entry_t;
+
+struct sap_index {
+    sap_index_entry_t *entries;
+    unsigned int num_entries, max_entries;
+    unsigned int *table;        /* entry+1 for each slot, or 0 if the slot is empty */
+    unsigned int mask;          /* number of slots minus one, the number of slots is a power of 2 */
+    sap_buffer_t names;
+};
+
+static unsigned int sap_hash(const char *str) {
+    /* FNV-1a */
+    unsigned int h = 2166136261u;
+    while (*str) {
+        h ^= (unsigned char) *str++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* adds the items in the list with the given prefix, and recursively the items in their sub-structures */
+static int sap_index_add(sap_index_t *index, sap_buffer_t *prefix, const sap_item_t *item) {
+    for (;item!=NULL;item = item->next) {
+        sap_index_entry_t *E;
+        unsigned int len_name = (unsigned int) strlen(item->fieldname);
+        int i;
+        
+        if (index->num_entries == index->max_entries) {
+            unsigned int newMax = 2*index->max_entries + 256;
+            E = (sap_index_entry_t *) realloc(index->entries, newMax*sizeof(sap_index_entry_t));
+            if (E == NULL) return 0;
+            index->entries = E;
+            index->max_entries = newMax;
+        }
+        E = index->entries + index->num_entries++;
+        E->name = index->names.len;
+        E->item = item;
+        if (!sap_buffer_append(&index->names, prefix->buf, prefix->len)) return 0;
+        if (!sap_buffer_append(&index->names, item->fieldname, len_name + 1)) return 0;
+        E->hash = sap_hash(index->names.buf + E->name);
+        
+        if (item->type != SAP_STRUCT) continue;
+        
+        /* the elements of a sub-structure always get an index, also if it is not an array */
+        for (i=0;i<item->num_elements;i++) {
+            unsigned int len_prefix = prefix->len;
+            char brk[32];
+            
+            sprintf(brk, "[%i].", i);
+            if (!sap_buffer_append(prefix, item->fieldname, len_name)) return 0;
+            if (!sap_buffer_append(prefix, brk, (unsigned int) strlen(brk))) return 0;
+            if (!sap_index_add(index, prefix, ((sap_item_t **) item->value)[i])) return 0;
+            prefix->len = len_prefix;
+        }
+    }
+    return 1;
+}
+
+sap_index_t *sap_index_create(const sap_item_t *list) {
+    sap_index_t *index = (sap_index_t *) calloc(1, sizeof(sap_index_t));
+    sap_buffer_t prefix = {NULL, 0, 0};
+    unsigned int i, size = 16;
+    int ok;
+    
+    if (index == NULL) return NULL;
+    
+    ok = sap_index_add(index, &prefix, list);
+    free(prefix.buf);
+    
+    /* at most half of the slots are used */
+    while (size < 2*index->num_entries) size *= 2;
+    index->mask = size - 1;
+    index->table = ok ? (unsigned int *) calloc(size, sizeof(unsigned int)) : NULL;
+    if (index->table == NULL) {
+        sap_index_destroy(index);
+        return NULL;
+    }
+    
+    for (i=0;i<index->num_entries;i++) {
+        unsigned int slot = index->entries[i].hash & index->mask;
+        while (index->table[slot] != 0) slot = (slot + 1) & index->mask;
+        index->table[slot] = i+1;
+    }
+    return index;
+}
+
+const sap_item_t *sap_index_lookup(const sap_index_t *index, const char *fieldname) {
+    char local[256];
+    char *key = local, *dst;
+    const char *src;
+    const sap_item_t *found = NULL;
+    size_t len, num_dots = 0;
+    unsigned int h, slot;
+    
+    if (index == NULL || fieldname == NULL) return NULL;
+    
+    /* convert to the form of the full names in the index, i.e. every sub-structure gets
+       an index and the last field does not, so that "foo.bar", "foo[0].bar[2]" and
+       "foo[0].bar" are the same, like in sap_search_deep */
+    len = strlen(fieldname);
+    for (src = fieldname; *src; src++) {
+        if (*src == '.') num_dots++;
+    }
+    if (len + 24*(num_dots+1) + 1 > sizeof(local)) {
+        key = (char *) malloc(len + 24*(num_dots+1) + 1);
+        if (key == NULL) return NULL;
+    }
+    
+    src = fieldname;
+    dst = key;
+    while (*src) {
+        const char *seg_end = src, *brk = NULL;
+        
+        for (; *seg_end && *seg_end != '.'; seg_end++) {
+            if (*seg_end == '[' && brk == NULL) brk = seg_end;
+        }
+        memcpy(dst, src, (brk ? brk : seg_end) - src);
+        dst += (brk ? brk : seg_end) - src;
+        if (*seg_end != '.') break;
+        
+        if (brk) {
+            long val = strtol(brk+1, NULL, 10);
+            if (val < 0) goto cleanup;
+            dst += sprintf(dst, "[%li].", val);
+        } else {
+            memcpy(dst, "[0].", 4);
+            dst += 4;
+        }
+        src = seg_end + 1;
+    }
+    *dst = 0;
+    
+    h = sap_hash(key);
+    for (slot = h & index->mask; index->table[slot] != 0; slot = (slot + 1) & index->mask) {
+        const sap_index_entry_t *E = index->entries + index->table[slot] - 1;
+        if (E->hash == h && strcmp(index->names.buf + E->name, key) == 0) {
+            found = E->item;
+            break;
+        }
+    }
+    
+cleanup:
+    if (key != local) free(key);
+    return found;
+}
+
+void sap_index_destroy(sap_index_t *index) {
+    if (index == NULL) return;
+    free(index->entries);
+    free(index->table);
+    free(index->names.buf);
+    free(index);
+}
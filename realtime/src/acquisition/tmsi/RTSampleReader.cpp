@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+
+#include <Windows.h>
+#include <stdio.h>
+
+#include "RTSampleReader.h"
+
+
+RTSampleReader::RTSampleReader(RTDevice *Device, ULONG BufferSize)
+{	this->Device = Device;
+	this->BufferSize = BufferSize;
+	Head = Tail = 0;
+	Running = 0;
+	StallCount = 0;
+	OverflowCount = 0;
+	Thread = NULL;
+
+	for (int i = 0; i < SAMPLE_READER_BUFFERS; i++)
+	{	Buffers[i] = (PULONG) malloc(BufferSize);
+		Bytes[i] = 0;
+	}
+
+	Filled   = CreateEvent(NULL, FALSE, FALSE, NULL);
+	Released = CreateEvent(NULL, FALSE, FALSE, NULL);
+}
+
+
+RTSampleReader::~RTSampleReader()
+{	Stop();
+
+	for (int i = 0; i < SAMPLE_READER_BUFFERS; i++)
+		free(Buffers[i]);
+
+	CloseHandle(Filled);
+	CloseHandle(Released);
+}
+
+
+BOOLEAN RTSampleReader::Start()
+{	if (Thread != NULL) return TRUE;
+
+	for (int i = 0; i < SAMPLE_READER_BUFFERS; i++)
+		if (Buffers[i] == NULL) return FALSE;
+
+	Head = Tail = 0;
+	Running = 1;
+	Thread = CreateThread(NULL, 0, ReadThread, this, 0, NULL);
+	if (Thread == NULL)
+	{	Running = 0;
+		return FALSE;
+	}
+	// the device should be drained even when the application is busy
+	SetThreadPriority(Thread, THREAD_PRIORITY_TIME_CRITICAL);
+	return TRUE;
+}
+
+
+void RTSampleReader::Stop()
+{	if (Thread == NULL) return;
+
+	InterlockedExchange(&Running, 0);
+	SetEvent(Released);
+	WaitForSingleObject(Thread, INFINITE);
+	CloseHandle(Thread);
+	Thread = NULL;
+}
+
+
+PULONG RTSampleReader::Next(ULONG Timeout, ULONG *BytesReturned)
+{	if (Head == Tail)
+	{	WaitForSingleObject(Filled, Timeout);
+		if (Head == Tail) return NULL;
+	}
+
+	*BytesReturned = Bytes[Tail % SAMPLE_READER_BUFFERS];
+	return Buffers[Tail % SAMPLE_READER_BUFFERS];
+}
+
+
+void RTSampleReader::Release(PULONG Buffer)
+{	if (Head == Tail || Buffer != Buffers[Tail % SAMPLE_READER_BUFFERS])
+	{	fprintf(stderr, "RTSampleReader: buffers should be released in the order of Next()\n");
+		return;
+	}
+	InterlockedIncrement(&Tail);
+	SetEvent(Released);
+}
+
+
+DWORD WINAPI RTSampleReader::ReadThread(LPVOID Param)
+{	((RTSampleReader *) Param)->Read();
+	return 0;
+}
+
+
+void RTSampleReader::Read()
+{	ULONG PercentFull, Overflow;
+
+	while (Running)
+	{	// wait for a free buffer, meanwhile the device keeps buffering
+		if (Head - Tail == SAMPLE_READER_BUFFERS)
+		{	StallCount++;
+			while (Running && Head - Tail == SAMPLE_READER_BUFFERS)
+				WaitForSingleObject(Released, 10);
+			continue;
+		}
+
+		Device->GetBufferInfo(&Overflow, &PercentFull);
+		if (Overflow != OverflowCount)
+		{	fprintf(stderr, "RTSampleReader: the signal buffer of the device overflowed (%lu)\n", Overflow);
+			OverflowCount = Overflow;
+		}
+
+		ULONG BytesReturned = 0;
+		if (PercentFull > 0)
+		{	// GetSamples returns the number of bytes written in the buffer,
+			// this is always a multiple of the bytes per sample
+			BytesReturned = Device->GetSamples(Buffers[Head % SAMPLE_READER_BUFFERS], BufferSize);
+		}
+
+		if (BytesReturned == 0)
+		{	Sleep(1);
+			continue;
+		}
+
+		// the buffer becomes visible to Next() only after it has been filled
+		Bytes[Head % SAMPLE_READER_BUFFERS] = BytesReturned;
+		InterlockedIncrement(&Head);
+		SetEvent(Filled);
+	}
+}
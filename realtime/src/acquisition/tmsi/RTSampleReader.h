@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+#ifndef __RTSAMPLEREADER_H__
+#define __RTSAMPLEREADER_H__
+
+#include <Windows.h>
+#include "RTDevice.h"
+
+#define SAMPLE_READER_BUFFERS 8     // buffers that are being filled or wait for the application
+
+/*
+	RTSampleReader
+		Keeps a thread that drains the signal buffer of the device into a queue of
+		buffers, so that the samples keep being read while the application converts
+		and streams the previous ones. GetSamples of the RTINST DLL does not offer
+		overlapped I/O, so the thread polls the device and sleeps a millisecond when
+		there is nothing new.
+
+		The application takes the filled buffers in order with Next() and gives them
+		back with Release(). If all buffers are waiting for the application, the
+		thread stops reading until one is released and the device buffers the samples.
+*/
+class RTSampleReader {
+	public:
+		// BufferSize is the size of each of the buffers in bytes
+		RTSampleReader(RTDevice *Device, ULONG BufferSize);
+		~RTSampleReader();
+
+		// Starts the thread, the device should have been started already
+		BOOLEAN Start();
+
+		// Stops the thread, afterwards the device can be stopped
+		void Stop();
+
+		// Returns the next filled buffer and its number of bytes, or NULL if there is
+		// none within Timeout milliseconds
+		PULONG Next(ULONG Timeout, ULONG *BytesReturned);
+
+		// Hands the buffer returned by Next() back to the thread
+		void Release(PULONG Buffer);
+
+		// The number of times the thread found all buffers waiting for the application,
+		// and the overflow counter of the device
+		ULONG Stalls()   { return StallCount; }
+		ULONG Overflow() { return OverflowCount; }
+
+	private:
+		static DWORD WINAPI ReadThread(LPVOID Param);
+		void Read();
+
+		RTDevice *Device;
+		ULONG BufferSize;
+		PULONG Buffers[SAMPLE_READER_BUFFERS];
+		ULONG Bytes[SAMPLE_READER_BUFFERS];
+
+		// buffers [Tail, Head) are filled, counted modulo SAMPLE_READER_BUFFERS
+		volatile LONG Head;
+		volatile LONG Tail;
+		volatile LONG Running;
+		volatile ULONG StallCount;
+		volatile ULONG OverflowCount;
+
+		HANDLE Thread;
+		HANDLE Filled;		// auto-reset event, set when a buffer is filled
+		HANDLE Released;	// auto-reset event, set when a buffer is released
+};
+
+#endif  // __RTSAMPLEREADER_H__
@@ -48,6 +48,7 @@ Revision History:
 
 #include "RtDevice.h"
 #include "Feature.h" 
+#include "RTSampleReader.h"
 #include <math.h>
 
 //#include "buffer.h" 
@@ -260,16 +261,13 @@ int main(int argc, char* argv[]) {
 	int triggerStatus  = 0;
 	
 	RTDeviceEx *Master;
+	RTSampleReader *Reader = NULL;
 	ULONG SampleRate = MAX_SAMPLE_RATE;
 	ULONG BufferSize = MAX_BUFFER_SIZE;
 	
-	ULONG PercentFull,Overflow;
 	ULONG BytesPerSample=0;
 	ULONG BytesReturned;
 	ULONG numHwChans;
-
-	// Buffer for storing the samples; 
-	ULONG SignalBuffer[MY_BUFFER_SIZE];
 	
 	if (argc<2) {
 		fprintf(stderr, "Usage: tmsi2ft configfile [hostname=localhost [port=1972 [ctrlPort=8000]]]\n");
@@ -365,6 +363,14 @@ int main(int argc, char* argv[]) {
 		
 	ODM->enableStreaming();
 	
+	// The samples are read from the device in a separate thread, into a queue of
+	// buffers, so that the device is drained while the previous block is streamed
+	Reader = new RTSampleReader(Master, MY_BUFFER_SIZE * sizeof(ULONG));
+	if (!Reader->Start()) {
+		fprintf(stderr, "Unable to start reading from the device\n");
+		goto cleanup;
+	}
+	
 	printf("\nPress [Escape] to quit...\n");
 	
 	while (1) {
@@ -375,50 +381,50 @@ int main(int argc, char* argv[]) {
 		// Process any incoming request on the control port
 		ctrlServ.checkRequests(*ODM);
 		
-		//Get Signal buffer information
-		Master->GetBufferInfo(&Overflow,&PercentFull);
+		// Wait at most 1 ms for the next block of samples from the reader thread.
+		// The number of bytes is always a multiple of BytesPerSample.
+		ULONG *SignalBuffer = Reader->Next(1, &BytesReturned);
 			
-		if (PercentFull > 0) {
-			// If there is data available, get samples from the device
-			// GetSamples returns the number of bytes written in the signal buffer
-			// This will always be a multiple op BytesPerSample. 
+		if (SignalBuffer != NULL) {
+			nBufferSamp=BytesReturned/BytesPerSample;
+			nTotalSamp+=nBufferSamp;
 			
-			// Divide the result by BytesPerSamples to get the number of samples returned
-			BytesReturned = Master->GetSamples((PULONG)SignalBuffer,sizeof(SignalBuffer));
-				
-			if (BytesReturned != 0) {
-				// wprintf(L"\rSampleCounter = %8d, ,Sampwritten=%8d,Samp[%d]=%d, %d ,Buffer  = %d, Overflow = %d      " , Total /BytesPerSample ,sample, ShowChannel,SignalBuffer[ShowChannel], SignalBuffer[ShowChannel + 1],PercentFull,Overflow);
-				nBufferSamp=BytesReturned/BytesPerSample;
-				nTotalSamp+=nBufferSamp;
-				
-				int32_t *data = ODM->provideBlock(nBufferSamp);
-				if (data==0) {
-					fprintf(stderr, "Out of memory\n");
-					break;
-				}
-				memcpy(data, SignalBuffer, nBufferSamp * BytesPerSample);
-				
-				// TODO: allow for multiple trigger channels
-				if (triggerChannel >= 0) {
-					for (int j=0;j<nBufferSamp;j++) {
-						int trigVal = SignalBuffer[triggerChannel + j*numHwChans];
-						
-						if (trigVal != triggerStatus && trigVal != 0) {
-							// TODO: maybe use the channel label as the event type instead of "Digi"
-							ODM->getEventList().add(j, "Digi", trigVal);
-						}
-						triggerStatus = trigVal;
+			int32_t *data = ODM->provideBlock(nBufferSamp);
+			if (data==0) {
+				fprintf(stderr, "Out of memory\n");
+				Reader->Release(SignalBuffer);
+				break;
+			}
+			memcpy(data, SignalBuffer, nBufferSamp * BytesPerSample);
+			
+			// TODO: allow for multiple trigger channels
+			if (triggerChannel >= 0) {
+				for (int j=0;j<nBufferSamp;j++) {
+					int trigVal = SignalBuffer[triggerChannel + j*numHwChans];
+					
+					if (trigVal != triggerStatus && trigVal != 0) {
+						// TODO: maybe use the channel label as the event type instead of "Digi"
+						ODM->getEventList().add(j, "Digi", trigVal);
 					}
+					triggerStatus = trigVal;
 				}
-				
-				ODM->handleBlock();
 			}
-		} else {
-			Sleep(1);
+			
+			// the reader thread can fill this buffer again while the block is streamed
+			Reader->Release(SignalBuffer);
+			ODM->handleBlock();
 		}
 	}
 
 cleanup:
+	if (Reader != NULL) {
+		Reader->Stop();
+		if (Reader->Stalls() > 0) {
+			printf("The reader thread had to wait for the application %lu times.\n", Reader->Stalls());
+		}
+		delete Reader;
+	}
+	
 	//Stop the device
 	if (Master->Stop()) {	
 		printf("Device stopped.\n");
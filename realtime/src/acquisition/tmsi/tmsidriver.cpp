@@ -46,6 +46,7 @@ Revision History:
 
 #include "RtDevice.h"
 #include "Feature.h"
+#include "RTSampleReader.h"
 #include "buffer.h"
 #include "pthread.h"
 #include <math.h>
@@ -285,13 +286,13 @@ int main(int argc, char* argv[])
 
 
 	ULONG NrOfSamples=0,Total=0;
-	ULONG PercentFull,Overflow;
 	ULONG BytesPerSample=72;
 	ULONG BytesReturned;
 	ULONG TotalNrChannelsInDevice;
 
-// Buffer for storing the samples;
-	ULONG SignalBuffer[1000];
+// Buffer for storing the samples, filled by the reader thread;
+	ULONG *SignalBuffer;
+	RTSampleReader *Reader = NULL;
 	SampleRate = MAX_SAMPLE_RATE;
 	BufferSize = MAX_BUFFER_SIZE;
 
@@ -584,24 +585,29 @@ int main(int argc, char* argv[])
 		//ULONG ShowChannel = 1;
 		wprintf(L"\nPress any key to quit \n");
 
+		// the device is drained by a separate thread into a queue of buffers,
+		// so that it keeps being read while the samples below are written
+		Reader = new RTSampleReader(Master, 1000 * sizeof(ULONG));
+		if (!Reader->Start())
+		{	wprintf(L"\nUnable to start reading from the device\n");
+			goto cleanup;
+		}
+
 		// Stop the program if we hit any key
 		i=0; j=0; char intstr[5];
 		while(!_kbhit())
 		{	//beginwhile
-			//Get Signal buffer information
-			Master->GetBufferInfo(&Overflow,&PercentFull);
+			//Get the next buffer of the reader thread, wait at most 10 ms
+			SignalBuffer = Reader->Next(10, &BytesReturned);
 
-			if( PercentFull > 0)
+			if( SignalBuffer != NULL)
 			{	//beginPF
-				// if there is data available get samples from the device
+				// The reader thread got samples from the device
 				// GetSamples returns the number of bytes written in the signal buffer
 				// This will always be a multiple op BytesPerSample.
 
 				// Divide the result by BytesPerSamples to get the number of samples returned
 
-
-				BytesReturned = Master->GetSamples((PULONG)SignalBuffer,sizeof(SignalBuffer));
-
 				if( BytesReturned != 0)
 				{	Total += BytesReturned;
 	//				wprintf(L"\rSampleCounter = %8d, ,Sampwritten=%8d,Samp[%d]=%d, %d ,Buffer  = %d, Overflow = %d      " , Total /BytesPerSample ,sample, ShowChannel,SignalBuffer[ShowChannel], SignalBuffer[ShowChannel + 1],PercentFull,Overflow);
@@ -681,10 +687,8 @@ int main(int argc, char* argv[])
 		}//endK
 
 		}//endBytesreturned
-			else
-			{	//allow other applications some extra process time
-				Sleep(10);
-			}
+			// the reader thread can fill the buffer again
+			Reader->Release(SignalBuffer);
 		}//end PercentFull
 
 
@@ -698,6 +702,11 @@ int main(int argc, char* argv[])
      		goto cleanup;
 		}
         cleanup:
+		if (Reader != NULL)
+		{	Reader->Stop();
+			delete Reader;
+			Reader = NULL;
+		}
 		cleanup_event(reinterpret_cast<void**>(&event));
 		cleanup_data(reinterpret_cast<void**>(&data));
 		cleanup_header(reinterpret_cast<void**>(&header));
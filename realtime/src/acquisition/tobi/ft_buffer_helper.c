@@ -100,9 +100,9 @@ int ft_put_hdr(int ft_buffer_handle, int nchann, int fsample,
   /* Request. */
   req.def = req_hdr;  /* bit of hack to get pointers into the same packet :/ */
   req.buf = hdr; 
-  if (!clientrequest(ft_buffer_handle, &req, &response))
+  if (clientrequest(ft_buffer_handle, &req, &response))
     status = -1;
-  if (!response->def->command == PUT_OK)
+  else if (response->def->command != PUT_OK)
     status = -2;
 
   /* Cleanup */
@@ -145,9 +145,9 @@ int ft_put_data(int ft_buffer_handle, int nchannels, int nsamples, const float
   memcpy(req.buf, &data_hdr, sizeof(data_hdr));
   memcpy((char *) req.buf + sizeof(data_hdr), chan_samp, data_hdr.bufsize);
 
-  if (!clientrequest(ft_buffer_handle, &req, &response))
+  if (clientrequest(ft_buffer_handle, &req, &response))
     status = -1;
-  if (response->def->command != PUT_OK)
+  else if (response->def->command != PUT_OK)
     status = -2;
 
   free(req.buf);
@@ -158,3 +158,109 @@ int ft_put_data(int ft_buffer_handle, int nchannels, int nsamples, const float
   return status;
 }
 
+
+
+/* Number of bytes that ft_fill_event needs for an event with the given type.
+ */
+int ft_event_size(const char *type)
+{
+  return sizeof(eventdef_t) + strlen(type) + sizeof(INT32_T);
+}
+
+
+/* Serialize an event with a string type and a single int32 value in dest,
+ * which should have room for ft_event_size(type) bytes. Returns the number of
+ * bytes written, several events can be placed one after the other.
+ * FIXME: This depends on byte alignment of structs. Use proper serialization.
+ */
+int ft_fill_event(void *dest, int sample, const char *type, INT32_T value)
+{
+  eventdef_t *evt = (eventdef_t *) dest;
+  char *p = (char *) dest + sizeof(eventdef_t);
+
+  evt->type_type = DATATYPE_CHAR;
+  evt->type_numel = strlen(type);
+  evt->value_type = DATATYPE_INT32;
+  evt->value_numel = 1;
+  evt->sample = sample;
+  evt->offset = 0;
+  evt->duration = 0;
+  evt->bufsize = evt->type_numel + sizeof(INT32_T);
+
+  memcpy(p, type, evt->type_numel);
+  memcpy(p + evt->type_numel, &value, sizeof(INT32_T));
+
+  return sizeof(eventdef_t) + evt->bufsize;
+}
+
+
+/* Write a block of samples and the events that belong to it in a single
+ * request (PUT_BATCH), so that several TiA packets cost one round trip. The
+ * events are optional, set evtsize to 0 to write the samples only.
+ * FIXME: This depends on byte alignment of structs. Use proper serialization.
+ */
+int ft_put_batch(int ft_buffer_handle, int nchannels, int nsamples, const float
+  *chan_samp, int evtsize, const void *events)
+{
+  int status = 0;
+  message_t req = {0}, *response = NULL;
+  messagedef_t req_hdr = {0}, *sub_hdr;
+  datadef_t *data_hdr;
+  char *packet, *p;
+  size_t data_size = nchannels * nsamples * sizeof(float);
+
+  /* Find packet size: the PUT_DAT and optional PUT_EVT sub-requests. */
+  req_hdr.version = VERSION;
+  req_hdr.command = PUT_BATCH;
+  req_hdr.bufsize = sizeof(messagedef_t) + sizeof(datadef_t) + data_size;
+  if (evtsize > 0)
+    req_hdr.bufsize += sizeof(messagedef_t) + evtsize;
+
+  packet = (char *) malloc(req_hdr.bufsize);
+  if (!packet)
+    return -1;
+
+  /* PUT_DAT */
+  p = packet;
+  sub_hdr = (messagedef_t *) p;
+  sub_hdr->version = VERSION;
+  sub_hdr->command = PUT_DAT;
+  sub_hdr->bufsize = sizeof(datadef_t) + data_size;
+  p += sizeof(messagedef_t);
+
+  data_hdr = (datadef_t *) p;
+  data_hdr->nchans = nchannels;
+  data_hdr->nsamples = nsamples;
+  data_hdr->data_type = DATATYPE_FLOAT32;
+  data_hdr->bufsize = data_size;
+  p += sizeof(datadef_t);
+
+  memcpy(p, chan_samp, data_size);
+  p += data_size;
+
+  /* PUT_EVT */
+  if (evtsize > 0) {
+    sub_hdr = (messagedef_t *) p;
+    sub_hdr->version = VERSION;
+    sub_hdr->command = PUT_EVT;
+    sub_hdr->bufsize = evtsize;
+    p += sizeof(messagedef_t);
+    memcpy(p, events, evtsize);
+  }
+
+  req.def = &req_hdr;
+  req.buf = packet;
+  if (clientrequest(ft_buffer_handle, &req, &response) || response == NULL)
+    status = -1;
+  else if (response->def->command != PUT_OK)
+    status = -2;
+
+  free(packet);
+  if (response) {
+    free(response->buf);
+    free(response->def);
+    free(response);
+  }
+
+  return status;
+}
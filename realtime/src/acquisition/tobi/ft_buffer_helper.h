@@ -12,6 +12,13 @@ int ft_put_hdr(int ft_buffer_handle, int nchann, int fsample, ft_chunk_t
 
 ft_chunk_t *ft_create_chanlab_chunk(int n, const char **labels);
 
+int ft_event_size(const char *type);
+
+int ft_fill_event(void *dest, int sample, const char *type, INT32_T value);
+
+int ft_put_batch(int ft_buffer_handle, int nchannels, int nsamples, const float
+  *chan_samp, int evtsize, const void *events);
+
 void ft_buffer_serve(int port);
 
 #endif
@@ -29,11 +29,14 @@
 
 // STL
 #include <iostream>
+#include <vector>
+#include <algorithm>
 
 // Boost
 #include <boost/asio.hpp>
 #include <boost/thread.hpp>
 #include <boost/program_options.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 
 // TiA
 #include "tia/data_packet_interface.h"
@@ -49,16 +52,43 @@ using namespace std;
 namespace po = boost::program_options;
 
 
+/* Samples of consecutive TiA packets that are written to the FieldTrip buffer
+ * in a single request, together with the events that belong to them. */
+struct PacketBatch {
+  int nchannels;
+  int block_size;          // flush when the block holds this many samples
+  boost::posix_time::time_duration max_latency;  // or when the oldest is this old
+
+  std::vector<float> block;  // multiplexed samples, as in the FieldTrip buffer
+  int nsamples;              // samples in the block
+  boost::posix_time::ptime first_arrival;  // of the oldest packet in the block
+  std::vector<char> events;  // serialized events, see ft_fill_event
+
+  // Start of each FieldTrip channel in the data of a TiA packet, computed
+  // for packets with map_nsamples samples per channel.
+  std::vector<size_t> chan_map;
+  int map_nsamples;
+
+  boost::uint64_t packet_nr;  // connection packet number of the last packet
+  bool have_packet_nr;
+  unsigned int nwritten;      // samples written to the buffer so far
+};
+
 bool connect_tia_client(tia::TiAClient &client, const string tia_serv_addr, int
   tia_serv_port);
-int  sync_meta_info(tia::TiAClient &tia_client, int ft_buffer_handle);
-int  forward_packet(tia::DataPacket &packet, int ft_buffer_handle);
+int  sync_meta_info(tia::TiAClient &tia_client, int ft_buffer_handle,
+  int &nchann, float &fsample);
+void init_batch(PacketBatch &batch, int nchannels, int block_size,
+  int max_latency_ms);
+int  accumulate_packet(tia::DataPacket &packet, PacketBatch &batch);
+bool batch_due(const PacketBatch &batch);
+int  flush_batch(PacketBatch &batch, int ft_buffer_handle);
 
 int main(int argc, char *argv[])
 {
   // Variables for CLI config:
   string tia_host, ft_host;
-  int tia_port, ft_port;
+  int tia_port, ft_port, block_size, max_latency;
   bool serve_ft_buffer, verbose;
 
   // Since boost is used in TiA's header files, we might use exploit that fact
@@ -80,6 +110,11 @@ int main(int argc, char *argv[])
     ("serve-ft-buffer",
      po::value<bool>(&serve_ft_buffer)->default_value(false)->zero_tokens(),
      "Start a new FieldTrip buffer instead of connecting to an existing one.")
+    ("block-size", po::value<int>(&block_size)->default_value(0),
+     "Write to the FieldTrip buffer once this many samples are collected, "
+     "0 derives it from the maximum latency.")
+    ("max-latency", po::value<int>(&max_latency)->default_value(20),
+     "Write the collected samples at the latest after this many ms.")
     ;
 
   po::variables_map vm;
@@ -123,12 +158,26 @@ int main(int argc, char *argv[])
   }
 
   // Sync information on data stream:
-  sync_meta_info(tia_client, ft_buffer_handle);
+  int nchann = 0;
+  float fsample = 0;
+  if (sync_meta_info(tia_client, ft_buffer_handle, nchann, fsample) != 0) {
+    cerr << "Could not write the header to the FieldTrip buffer. Closing."
+         << endl;
+    exit(-1);
+  }
+
+  // Several packets are merged into one block to save round trips to the
+  // buffer when the TiA server sends many small packets.
+  if (block_size <= 0)
+    block_size = std::max(1, (int) (fsample * max_latency / 1000));
+  PacketBatch batch;
+  init_batch(batch, nchann, block_size, max_latency);
+  cout << "Writing blocks of " << block_size << " samples or at most "
+       << max_latency << " ms." << endl;
 
   // Main loop
   tia::DataPacket *packet = tia_client.getEmptyDataPacket();
   while (true) {
-    cout << "." << flush;
     tia_client.getDataPacket(*packet);
 
     if (verbose) {
@@ -138,7 +187,12 @@ int main(int argc, char *argv[])
       cout << "samp/chan: " << packet->getNrSamplesPerChannel()[0] << endl;
     }
 
-    forward_packet(*packet, ft_buffer_handle);
+    accumulate_packet(*packet, batch);
+    if (batch_due(batch)) {
+      cout << "." << flush;
+      if (flush_batch(batch, ft_buffer_handle) != 0)
+        cerr << "Writing to the FieldTrip buffer failed." << endl;
+    }
   }
 
   try {
@@ -169,7 +223,8 @@ bool connect_tia_client(tia::TiAClient &client, const string tia_serv_addr,
 
 /* Read meta information (channel configuration etc.) from TiA, and write this
  * to a FieldTrip buffer. So far, it only *prints* the meta info. */
-int sync_meta_info(tia::TiAClient &tia_client, int ft_buffer_handle)
+int sync_meta_info(tia::TiAClient &tia_client, int ft_buffer_handle,
+  int &nchann, float &fsample)
 {
   // Request TiA config:
   try {
@@ -183,13 +238,13 @@ int sync_meta_info(tia::TiAClient &tia_client, int ft_buffer_handle)
   tia::SignalInfo sigInfo = tia_client.config().signal_info;
 
   // Print some signal statistics
-  float fsample = sigInfo.masterSamplingRate();
+  fsample = sigInfo.masterSamplingRate();
   cout << "Detected the following meta information:" << endl;
   cout << "Sampling rate: " << fsample << endl;
   cout << "Block size: " << sigInfo.masterBlockSize() << endl;
 
   tia::Signal signal = sigInfo.signals().begin()->second;
-  int nchann = signal.channels().size();
+  nchann = signal.channels().size();
 
   // Extract channel names:
   const char **labels = (const char **) malloc(nchann * sizeof(char *));
@@ -208,8 +263,22 @@ int sync_meta_info(tia::TiAClient &tia_client, int ft_buffer_handle)
 }
 
 
-/* Take a TiA packet, and append it in the FieldTrip buffer. Apparently, the
- * packet *cannot be const*.
+void init_batch(PacketBatch &batch, int nchannels, int block_size,
+  int max_latency_ms)
+{
+  batch.nchannels = nchannels;
+  batch.block_size = block_size;
+  batch.max_latency = boost::posix_time::milliseconds(max_latency_ms);
+  batch.block.resize((size_t) nchannels * block_size);
+  batch.nsamples = 0;
+  batch.map_nsamples = -1;
+  batch.have_packet_nr = false;
+  batch.nwritten = 0;
+}
+
+
+/* Take a TiA packet, and append it to the block that is written to the
+ * FieldTrip buffer next. Apparently, the packet *cannot be const*.
  *
  * Note that TiA support streaming of heterogeneous data streams, that can have
  * different sampling rates and block-sizes. Since the FT-buffer only supports
@@ -224,25 +293,92 @@ int sync_meta_info(tia::TiAClient &tia_client, int ft_buffer_handle)
  * does not guarantee that an equal amount of samples per signal stream is
  * present in a data packet.
  */
-int forward_packet(tia::DataPacket &packet, int ft_buffer_handle)
+int accumulate_packet(tia::DataPacket &packet, PacketBatch &batch)
 {
   if (packet.getNrOfSignalTypes() != 1) {
     cerr << "Heterogeneous signal streams are not yet supported :/." << endl;
     exit(2);
   }
 
-  /* Vector tia_raw contains the data. The values are multiplexed as follows:
-   * [channel 1 sample 1...n, channel 2 sample 1..n, ...]
-   */
-  std::vector<double> tia_raw = packet.getData();
   int nchannels = packet.getNrOfChannels()[0];
   int nsamples = packet.getNrSamplesPerChannel()[0];
+  if (nchannels != batch.nchannels) {
+    cerr << "The number of channels in the packet does not match the header."
+         << endl;
+    return -1;
+  }
+
+  // An interruption in the packet numbers means that TiA dropped packets,
+  // this is marked with an event at the first sample after the gap.
+  boost::uint64_t packet_nr = packet.getConnectionPacketNr();
+  if (batch.have_packet_nr && packet_nr > batch.packet_nr + 1) {
+    const char *type = "TIA_PACKETS_LOST";
+    size_t offset = batch.events.size();
+    batch.events.resize(offset + ft_event_size(type));
+    ft_fill_event(&batch.events[offset], batch.nwritten + batch.nsamples, type,
+      (INT32_T) (packet_nr - batch.packet_nr - 1));
+  }
+  batch.packet_nr = packet_nr;
+  batch.have_packet_nr = true;
+
+  /* The data of the packet contains the samples of each channel one after the
+   * other: [channel 1 sample 1...n, channel 2 sample 1..n, ...]. Where each
+   * channel starts only depends on the number of samples per channel, which
+   * is usually the same for every packet.
+   */
+  if (nsamples != batch.map_nsamples) {
+    batch.chan_map.resize(nchannels);
+    for (int ci = 0; ci < nchannels; ++ci)
+      batch.chan_map[ci] = (size_t) ci * nsamples;
+    batch.map_nsamples = nsamples;
+  }
+
+  size_t needed = (size_t) (batch.nsamples + nsamples) * nchannels;
+  if (needed > batch.block.size())
+    batch.block.resize(needed);  // a packet larger than the block size
+  if (batch.nsamples == 0)
+    batch.first_arrival = boost::posix_time::microsec_clock::universal_time();
+
+  // Convert to FT-buffer byte-order, writing the multiplexed samples in order.
+  const std::vector<double> &tia_raw = packet.getData();
+  const double *src = &tia_raw[0];
+  const size_t *map = &batch.chan_map[0];
+  float *dst = &batch.block[(size_t) batch.nsamples * nchannels];
+  for (int si = 0; si < nsamples; ++si, ++src)
+    for (int ci = 0; ci < nchannels; ++ci)
+      *dst++ = (float) src[map[ci]];
+
+  batch.nsamples += nsamples;
+  return 0;
+}
 
-  // Convert to FT-buffer byte-order.
-  std::vector<float> ft_raw(tia_raw.size(), 0);
-  for (int ci=0; ci < nchannels; ++ci)
-    for (int si=0; si < nsamples; ++si)
-      ft_raw[ci + si * nchannels] = tia_raw[si + ci * nsamples];
 
-  return ft_put_data(ft_buffer_handle, nchannels, nsamples, &ft_raw[0]);
+/* The block is written when it is full, or when its oldest packet waited
+ * for the maximum latency. Since the TiA client blocks until the next packet,
+ * the latency is checked whenever a packet arrives. */
+bool batch_due(const PacketBatch &batch)
+{
+  if (batch.nsamples == 0)
+    return false;
+  if (batch.nsamples >= batch.block_size)
+    return true;
+  return boost::posix_time::microsec_clock::universal_time()
+    - batch.first_arrival >= batch.max_latency;
+}
+
+
+/* Write the collected samples and events in a single request. */
+int flush_batch(PacketBatch &batch, int ft_buffer_handle)
+{
+  if (batch.nsamples == 0)
+    return 0;
+
+  int status = ft_put_batch(ft_buffer_handle, batch.nchannels, batch.nsamples,
+    &batch.block[0], batch.events.size(),
+    batch.events.empty() ? NULL : &batch.events[0]);
+
+  batch.nwritten += batch.nsamples;
+  batch.nsamples = 0;
+  batch.events.clear();
+  return status;
 }
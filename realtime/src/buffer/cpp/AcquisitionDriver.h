@@ -0,0 +1,391 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+#include <OnlineDataManager.h>
+#include <ConsoleInput.h>
+#include <StringServer.h>
+#include <SignalConfiguration.h>
+#include <ftclock.h>
+#include <vector>
+
+#ifndef __AcquisitionDriver_h
+#define __AcquisitionDriver_h
+
+#define ADAPT_BLOCKS 8      /* number of blocks over which the latency is averaged before the block size is adapted */
+
+/** Interface of a device for the AcquisitionDriver below. The device only has to
+    deliver its samples, the driver takes care of the buffer connection, the header,
+    the configuration and control port, and of streaming the samples in blocks.
+
+    To is the type of the samples as they come out of the device, each sample has the
+    status channels first, followed by the continuous channels.
+ */
+template <typename To>
+class AcquisitionDevice {
+public:
+    virtual ~AcquisitionDevice() {}
+
+    /** Number of status and continuous channels, and the sampling rate in Hz,
+     these must be known when the AcquisitionDriver is constructed */
+    virtual int getNumStatus() const = 0;
+    virtual int getNumContinuous() const = 0;
+    virtual float getSampleRate() const = 0;
+
+    /** Smallest and largest number of samples per block when the AcquisitionDriver
+     adapts the block size (see setTargetLatency), e.g. the number of samples the
+     device delivers at once. A largest size of 0 means one second of samples. */
+    virtual int getMinBlockSize() const { return 1; }
+    virtual int getMaxBlockSize() const { return 0; }
+
+    /** Starts the acquisition, returns false on errors */
+    virtual bool start() { return true; }
+
+    /** Stops the acquisition, this is called once after run() is done */
+    virtual void stop() {}
+
+    /** Reads at most maxSamples new samples into dest, one row of getNumStatus() +
+     getNumContinuous() values per sample, and waits at most timeoutMs milliseconds
+     if there are none yet. Events can be added to 'events', with the sample index
+     counted from the first sample written to dest.
+     Returns the number of samples, 0 if there was nothing new, or -1 on errors,
+     which stops the acquisition.
+     */
+    virtual int read(To *dest, int maxSamples, int timeoutMs, FtEventList &events) = 0;
+};
+
+
+/** Main loop for the acquisition drivers on top of OnlineDataManager.
+
+    The samples of the device are collected into blocks of the given latency
+    (50 ms by default), so that a device that delivers a single sample at a time
+    is not streamed with a PUT_DAT per sample. A block is handed to the
+    OnlineDataManager when it is full, or when its first sample has waited for the
+    latency. With enablePipeline(), which is the default, the OnlineDataManager
+    streams and saves the blocks from its worker threads, and the loop returns to
+    reading the device right away.
+
+    With setTargetLatency(), the block size is adapted while streaming, so that a
+    sample arrives in the buffer after about the target latency. Larger blocks cost
+    less per sample, hence the block size is increased as long as the latency stays
+    below the target, and when the blocks are not written as fast as they are read.
+    The latency is measured from reading the first sample of a block until the buffer
+    acknowledged it, see OnlineDataManager::getStreamingLatency().
+
+    The loop stops when ESC is pressed, when stop() is called, or on errors.
+ */
+template <typename To, typename Ts>
+class AcquisitionDriver {
+public:
+
+    AcquisitionDriver(AcquisitionDevice<To> &device) :
+        device(device),
+        ODM(device.getNumStatus(), device.getNumContinuous(), device.getSampleRate(), device.getSampleRate()) {
+        rowLen = device.getNumStatus() + device.getNumContinuous();
+        latency = 0.05;
+        targetLatency = 0.0;
+        deadline = latency;
+        blockSize = minBlockSize = maxBlockSize = 1;
+        stagingSum = latencySum = 0.0;
+        numStagingBlocks = numLatencyBlocks = 0;
+        readTimeout = 10;
+        listening = false;
+        keepRunning = true;
+        pipelined = true;
+        numSamples = 0;
+        numBlocks = 0;
+    }
+
+    /** The OnlineDataManager, e.g. for setting the labels and limits for saving */
+    OnlineDataManager<To, Ts>& getODM() {
+        return ODM;
+    }
+
+    /** Sets the maximum time a sample waits before its block is streamed */
+    void setLatency(double seconds) {
+        latency = (seconds > 0.0) ? seconds : 0.0;
+    }
+
+    /** Adapts the block size while streaming so that the samples arrive in the buffer
+     after about this many seconds, within the bounds of the device, 0 keeps the block
+     size of setLatency() (default). The block size starts from that of setLatency(). */
+    void setTargetLatency(double seconds) {
+        targetLatency = (seconds > 0.0) ? seconds : 0.0;
+    }
+
+    /** Sets for how long the device is asked to wait for new samples when no
+     block is waiting, which determines how responsive the keyboard and control
+     port are (default = 10 ms) */
+    void setReadTimeout(int ms) {
+        readTimeout = (ms > 0) ? ms : 1;
+    }
+
+    /** Streams and saves the blocks in the thread of the loop instead of in the worker
+     threads of the OnlineDataManager, this must be called before run() */
+    void disablePipeline() {
+        pipelined = false;
+    }
+
+    /** Configures the OnlineDataManager from the given file, or selects the first N
+     continuous channels for streaming and saving if 'config' is a number N.
+     Returns 0 on success, -1 if the file could not be read, or the number of errors.
+     */
+    int configure(const char *config) {
+        int numChannels;
+
+        if (!convertToInt(config, numChannels)) {
+            return ODM.configureFromFile(config);
+        }
+
+        if (numChannels < 1 || numChannels > device.getNumContinuous()) {
+            fprintf(stderr, "Number of channels must be within 1..%i\n", device.getNumContinuous());
+            return 1;
+        }
+        SignalConfiguration sigConf;
+        char label[16];
+        for (int i=0;i<numChannels;i++) {
+            sprintf(label, "%i", i+1);
+            sigConf.selectForStreaming(i, label);
+            sigConf.selectForSaving(i, label);
+        }
+        return ODM.setSignalConfiguration(sigConf) ? 0 : 1;
+    }
+
+    /** Connects to the buffer server, or spawns one on the given port if the
+     hostname is a minus (-). The blocks then go into the ring of that server
+     directly, while other clients still connect to the port over TCP, see
+     FtConnection::embedServer. Returns true on success. */
+    bool connect(const char *hostname, int port) {
+        if (!strcmp(hostname, "-")) {
+            if (!ODM.useOwnServer(port)) {
+                fprintf(stderr, "Could not spawn buffer server on port %d.\n", port);
+                return false;
+            }
+        } else {
+            if (!ODM.connectToServer(hostname, port)) {
+                fprintf(stderr, "Could not connect to buffer server at %s:%d.\n", hostname, port);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /** Listens for configuration commands on the given port, see OnlineDataManager */
+    bool listen(int ctrlPort) {
+        listening = ctrlServ.startListening(ctrlPort);
+        if (!listening) {
+            fprintf(stderr, "Cannot listen on port %d for configuration commands\n", ctrlPort);
+        }
+        return listening;
+    }
+
+    /** Makes run() return after the current block, this can be called from a signal handler */
+    void stop() {
+        keepRunning = false;
+    }
+
+    /** Starts the device and streams its samples until ESC is pressed, stop() is called,
+     or an error occurs. Returns 0 if the acquisition was stopped, or -1 on errors. */
+    int run() {
+        ConsoleInput conIn;
+        int result = 0;
+
+        blockSize = (int) (latency * device.getSampleRate() + 0.5);
+        if (blockSize < 1) blockSize = 1;
+        deadline = latency;
+        if (targetLatency > 0.0) {
+            minBlockSize = device.getMinBlockSize();
+            maxBlockSize = device.getMaxBlockSize();
+            if (minBlockSize < 1) minBlockSize = 1;
+            if (maxBlockSize <= 0) maxBlockSize = (int) (device.getSampleRate() + 0.5);
+            if (maxBlockSize < minBlockSize) maxBlockSize = minBlockSize;
+            setBlockSize(blockSize);
+            stagingSum = 0.0;
+            numStagingBlocks = 0;
+            latencySum = 0.0;
+            numLatencyBlocks = 0;
+            block.resize(maxBlockSize * rowLen);
+        } else {
+            block.resize(blockSize * rowLen);
+        }
+        numStaged = 0;
+        stagedEvents.clear();
+
+        if (pipelined && !ODM.enablePipeline()) {
+            fprintf(stderr, "Could not start the streaming threads, streaming from the acquisition loop\n");
+        }
+        if (!device.start()) {
+            fprintf(stderr, "Could not start the acquisition\n");
+            ODM.disablePipeline();
+            return -1;
+        }
+        ODM.enableStreaming();
+
+        printf("Starting - press ESC to quit\n");
+        while (keepRunning) {
+            if (conIn.checkKey() && conIn.getKey()==27) break; // quit
+            if (listening) ctrlServ.checkRequests(ODM);
+
+            // do not wait beyond the deadline of the samples that are waiting
+            int timeout = readTimeout;
+            if (numStaged > 0) {
+                double left = deadline - (ft_clock_seconds() - firstStaged);
+                timeout = (int) (1000.0 * left);
+                if (timeout < 0) timeout = 0;
+            }
+
+            readEvents.clear();
+            int n = device.read(&block[numStaged * rowLen], blockSize - numStaged, timeout, readEvents);
+            if (n < 0) {
+                fprintf(stderr, "Error when reading from the device - stopping\n");
+                result = -1;
+                break;
+            }
+            if (n > 0) {
+                if (numStaged == 0) {
+                    firstStagedNs = ft_clock_ns();
+                    firstStaged = 1e-9 * (double) firstStagedNs;
+                }
+                if (readEvents.count() > 0) {
+                    readEvents.transform(numStaged, 1);
+                    stagedEvents.append(readEvents);
+                }
+                numStaged += n;
+            }
+
+            if (numStaged >= blockSize || (numStaged > 0 && ft_clock_seconds() - firstStaged >= deadline)) {
+                if (!flush()) {
+                    result = -1;
+                    break;
+                }
+                if (targetLatency > 0.0) adaptBlockSize();
+            }
+        }
+
+        if (result == 0) flush();
+        device.stop();
+        ODM.disableStreaming();
+        ODM.disablePipeline();
+        printf("\n");
+        return result;
+    }
+
+    /** Number of samples and blocks that have been handed to the OnlineDataManager */
+    unsigned long getNumSamples() const { return numSamples; }
+    unsigned long getNumBlocks() const { return numBlocks; }
+
+    /** Number of samples per block, which changes while streaming with setTargetLatency() */
+    int getBlockSize() const { return blockSize; }
+
+protected:
+
+    /** Hands the collected samples and their events to the OnlineDataManager */
+    bool flush() {
+        if (numStaged == 0) return true;
+
+        To *dest = ODM.provideBlock(numStaged);
+        if (dest == 0) {
+            fprintf(stderr, "Out of memory\n");
+            return false;
+        }
+        memcpy(dest, &block[0], numStaged * rowLen * sizeof(To));
+        ODM.setBlockReadTime(firstStagedNs);
+        stagingSum += ft_clock_seconds() - firstStaged;
+        numStagingBlocks++;
+        if (stagedEvents.count() > 0) {
+            ODM.getEventList().append(stagedEvents);
+        }
+        bool ok = ODM.handleBlock();
+
+        numSamples += numStaged;
+        numBlocks++;
+        numStaged = 0;
+        stagedEvents.clear();
+
+        if (!ok) {
+            fprintf(stderr, "Error in handling this data block - stopping\n");
+            return false;
+        }
+        printf("Samples: %lu (%lu blocks)\r", numSamples, numBlocks);
+        return true;
+    }
+
+    /** Sets the block size within the bounds of the device, a block that is not full
+     is streamed once its first sample has waited for as long as a full block takes */
+    void setBlockSize(int n) {
+        if (n < minBlockSize) n = minBlockSize;
+        if (n > maxBlockSize) n = maxBlockSize;
+        blockSize = n;
+        deadline = blockSize / device.getSampleRate();
+    }
+
+    /** Called after every block with setTargetLatency(). The latency of a block is the
+     time its first sample waited for the block to be complete (the staging time), plus
+     the time it took to process and write the block. Only the first scales with the
+     block size, so the block size is scaled such that the staging time fills what the
+     target leaves after the writing. If writing takes longer than a block lasts, the
+     queue of the OnlineDataManager grows; then the block size is increased instead,
+     to spread the cost of each block over more samples.
+     */
+    void adaptBlockSize() {
+        double mean, max;
+        unsigned int count = ODM.getStreamingLatency(mean, max);
+        latencySum += mean * count;
+        numLatencyBlocks += count;
+        if (numLatencyBlocks < ADAPT_BLOCKS || numStagingBlocks == 0) return;
+
+        double latest  = latencySum / numLatencyBlocks;
+        double staging = stagingSum / numStagingBlocks;
+        double writing = latest - staging;
+        double duration = blockSize / device.getSampleRate();
+        stagingSum = latencySum = 0.0;
+        numStagingBlocks = numLatencyBlocks = 0;
+
+        double factor;
+        if (writing > duration) {
+            factor = 1.5;
+        } else if (staging <= 0.0) {
+            // the device delivers whole blocks at once, only the writing adds to the latency
+            factor = (latest > targetLatency) ? 0.5 : 1.25;
+        } else {
+            factor = (targetLatency - writing) / staging;
+            if (factor < 0.5) factor = 0.5;
+            if (factor > 1.25) factor = 1.25;
+        }
+        // small corrections are not worth the change of the block size
+        if (factor > 0.9 && factor < 1.1) return;
+
+        int previous = blockSize;
+        setBlockSize((int) (blockSize * factor + 0.5));
+        if (blockSize != previous) {
+            printf("\nBlock size %d samples, the latency was %.1f ms\n", blockSize, 1000.0 * latest);
+        }
+    }
+
+    AcquisitionDevice<To> &device;
+    OnlineDataManager<To, Ts> ODM;
+    StringServer ctrlServ;
+
+    int rowLen;             /**< Number of values per sample */
+    double latency;         /**< Seconds a sample may wait before its block is streamed */
+    double targetLatency;   /**< Seconds until a sample is in the buffer, for adapting the block size, or 0 */
+    double deadline;        /**< Seconds a sample may wait in the current block, see setBlockSize */
+    int blockSize, minBlockSize, maxBlockSize;
+    double stagingSum, latencySum;  /**< Of the blocks since the last change of the block size, see adaptBlockSize */
+    unsigned int numStagingBlocks, numLatencyBlocks;
+    int readTimeout;        /**< Milliseconds to wait for the device if no samples are waiting */
+    bool listening;
+    volatile bool keepRunning;
+    bool pipelined;
+
+    std::vector<To> block;  /**< Samples that are collected for the next block */
+    int numStaged;          /**< Number of samples in the block */
+    double firstStaged;     /**< When the first sample of the block came in, see ft_clock_seconds */
+    UINT64_T firstStagedNs; /**< The same in ft_clock_ns, for the trace of the latency */
+    FtEventList readEvents, stagedEvents;
+
+    unsigned long numSamples, numBlocks;
+};
+
+#endif
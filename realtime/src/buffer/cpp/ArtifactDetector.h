@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+
+#ifndef __ArtifactDetector_h
+#define __ArtifactDetector_h
+
+#include <math.h>
+#include <vector>
+#include <MultiChannelFilter.h>
+
+/** Templated class for detecting artifacts in a multi-channel signal while it
+	is acquired, with the criteria of ft_artifact_clip, ft_artifact_jump,
+	ft_artifact_threshold and ft_artifact_zvalue. Tex is the type of the
+	externally used signal (say, "float"), Tin is the internally used type
+	(say, "double").
+
+	CLIP       a channel stays within "tolerance" of the same value for at
+	           least "duration" seconds
+	JUMP       a channel changes by more than "step" from one sample to the next
+	THRESHOLD  a channel is below "min" or above "max"
+	ZVALUE     the z-values of the rectified channels, after an optional
+	           Butterworth bandpass filter, summed over the channels and divided
+	           by the square root of their number, go above "cutoff"
+
+	The mean and variance of each channel for ZVALUE are updated incrementally
+	with Welford's method, from the samples that are not marked by ZVALUE, and
+	after setMemory() they forget the samples that are older than the memory
+	exponentially. The z-values are only used once the statistics cover one
+	second of samples.
+
+	Each criterion that is enabled marks samples on its own. An artifact starts
+	with the first marked sample and stops with the first sample after "hold"
+	seconds without marked samples, this keeps a short artifact from being split.
+	process() returns these starts and stops as transitions, with the number of
+	the sample since the last reset(), which the caller can turn into events.
+*/
+
+template <typename Tex, typename Tin>
+class ArtifactDetector {
+	public:
+
+	enum Kind { CLIP = 0, JUMP = 1, THRESHOLD = 2, ZVALUE = 3, NUM_KINDS = 4 };
+
+	struct Transition {
+		int sample;		// the first sample of the artifact, or the first sample after it
+		int kind;
+		bool start;
+	};
+
+	// Create detector without any criteria
+	ArtifactDetector(int nChans, double fSample);
+	~ArtifactDetector();
+
+	// Enable the criteria, a duration, step, cutoff or range of 0 disables them
+	void setClip(double duration, double tolerance = 0.0) { clipDuration = duration; clipTolerance = tolerance; }
+	void setJump(double step) { jumpStep = step; }
+	void setThreshold(double minV, double maxV) { thrMin = minV; thrMax = maxV; }
+	// The bandpass filter is left out if both frequencies (in Hz) are 0. This
+	// clears the statistics.
+	void setZValue(double cutoff, double low = 0.0, double high = 0.0, int order = 4) {
+		zCutoff = cutoff; zLow = low; zHigh = high; zOrder = order;
+		setupZValue();
+	}
+	void setMemory(double seconds) { memory = seconds; }
+	void setHold(double seconds) { hold = seconds; }
+
+	bool isEnabled() const {
+		return clipDuration > 0 || jumpStep > 0 || thrMin < thrMax || zCutoff > 0;
+	}
+
+	// Name of the criterion, as used for the events of OnlineDataManager
+	static const char *getName(int kind) {
+		static const char *names[NUM_KINDS] = {"clip", "jump", "threshold", "zvalue"};
+		return (kind >= 0 && kind < NUM_KINDS) ? names[kind] : "";
+	}
+
+	// Clear the statistics and the artifacts, and continue with another number of
+	// channels or sampling rate. The samples are counted from 0 again.
+	void reset(int nChans, double fSample);
+
+	// Process multiple samples, returns the number of transitions, see getTransition()
+	int process(int nSamples, const Tex *source);
+
+	// Returns one of the transitions of the previous call of process()
+	const Transition& getTransition(int i) const { return transitions[i]; }
+
+	// Returns true if an artifact of this kind has started but not stopped
+	bool isActive(int kind) const { return active[kind]; }
+
+	protected:
+
+	void mark(int kind);
+	void setupZValue();
+
+	int nChans;
+	double fSample;
+	double clipDuration, clipTolerance, jumpStep, thrMin, thrMax;
+	double zCutoff, zLow, zHigh;
+	int zOrder;
+	double memory, hold;
+
+	int counter;			// number of samples since reset
+	bool hit[NUM_KINDS];		// marks of the current sample
+	bool active[NUM_KINDS];
+	int lastHit[NUM_KINDS];
+	std::vector<Transition> transitions;
+
+	Tin *prev;			// the previous sample
+	int *flat;			// number of samples that each channel stayed within clipTolerance
+	Tin *ref;			// the value that each channel stays close to
+	std::vector<Tin> work;		// the filtered block
+	MultiChannelFilter<Tin,Tin> *bandpass;
+	double numStats;		// number of samples in the statistics
+	Tin *mean, *var;
+};
+
+template <typename Tex, typename Tin>
+ArtifactDetector<Tex,Tin>::ArtifactDetector(int nChans, double fSample) {
+	clipDuration = clipTolerance = jumpStep = thrMin = thrMax = 0.0;
+	zCutoff = zLow = zHigh = 0.0;
+	zOrder = 4;
+	memory = hold = 0.0;
+	prev = ref = mean = var = NULL;
+	flat = NULL;
+	bandpass = NULL;
+	this->nChans = 0;
+	reset(nChans, fSample);
+}
+
+template <typename Tex, typename Tin>
+ArtifactDetector<Tex,Tin>::~ArtifactDetector() {
+	delete[] prev;
+	delete[] flat;
+	delete[] ref;
+	delete[] mean;
+	delete[] var;
+	delete bandpass;
+}
+
+template <typename Tex, typename Tin>
+void ArtifactDetector<Tex,Tin>::reset(int nChans, double fSample) {
+	if (nChans != this->nChans || prev == NULL) {
+		delete[] prev;
+		delete[] flat;
+		delete[] ref;
+		delete[] mean;
+		delete[] var;
+		prev = new Tin[nChans];
+		flat = new int[nChans];
+		ref  = new Tin[nChans];
+		mean = new Tin[nChans];
+		var  = new Tin[nChans];
+	}
+	this->nChans = nChans;
+	this->fSample = fSample;
+
+	for (int i=0;i<nChans;i++) {
+		prev[i] = ref[i] = 0;
+		flat[i] = 0;
+	}
+	setupZValue();
+	counter = 0;
+	for (int k=0;k<NUM_KINDS;k++) {
+		active[k] = false;
+		lastHit[k] = 0;
+	}
+	transitions.clear();
+}
+
+// Set up the bandpass filter for ZVALUE, and clear the statistics
+template <typename Tex, typename Tin>
+void ArtifactDetector<Tex,Tin>::setupZValue() {
+	delete bandpass;
+	bandpass = NULL;
+	if (zCutoff > 0 && (zLow > 0 || zHigh > 0)) {
+		// a lowpass if only the upper frequency is given, and a highpass if only the lower
+		double nyquist = 0.5*fSample;
+		bandpass = new MultiChannelFilter<Tin,Tin>(nChans, zOrder);
+		bandpass->setButterBP(zLow/nyquist, (zHigh > 0) ? zHigh/nyquist : 1.0);
+	}
+	for (int i=0;i<nChans;i++) mean[i] = var[i] = 0;
+	numStats = 0;
+}
+
+template <typename Tex, typename Tin>
+void ArtifactDetector<Tex,Tin>::mark(int kind) {
+	if (!hit[kind]) return;
+	lastHit[kind] = counter;
+	if (active[kind]) return;
+	Transition t = {counter, kind, true};
+	transitions.push_back(t);
+	active[kind] = true;
+}
+
+template <typename Tex, typename Tin>
+int ArtifactDetector<Tex,Tin>::process(int nSamples, const Tex *source) {
+	int clipSamples = (int) ceil(clipDuration*fSample);
+	int holdSamples = (int) floor(hold*fSample + 0.5);
+	double memorySamples = memory*fSample;
+	double sqrtChans = sqrt((double) nChans);
+
+	transitions.clear();
+	if (zCutoff > 0) {
+		// the whole block is filtered at once
+		work.resize(nSamples*nChans);
+		for (int i=0;i<nSamples*nChans;i++) work[i] = (Tin) source[i];
+		if (bandpass && nSamples > 0) bandpass->process(nSamples, &work[0], &work[0]);
+	}
+
+	for (int t=0;t<nSamples;t++) {
+		const Tex *x = source + t*nChans;
+
+		for (int k=0;k<NUM_KINDS;k++) hit[k] = false;
+		for (int i=0;i<nChans;i++) {
+			Tin xi = (Tin) x[i];
+			if (clipDuration > 0) {
+				// the channel is flat while it stays close to the value at which it got flat
+				if (fabs(xi - ref[i]) <= clipTolerance && counter > 0) {
+					if (++flat[i] >= clipSamples) hit[CLIP] = true;
+				} else {
+					ref[i] = xi;
+					flat[i] = 1;
+				}
+			}
+			if (jumpStep > 0 && counter > 0 && fabs(xi - prev[i]) > jumpStep) hit[JUMP] = true;
+			if (thrMin < thrMax && (xi < thrMin || xi > thrMax)) hit[THRESHOLD] = true;
+			prev[i] = xi;
+		}
+
+		if (zCutoff > 0) {
+			const Tin *y = &work[t*nChans];
+			double z = 0.0;
+			if (numStats >= fSample) {
+				for (int i=0;i<nChans;i++) {
+					double sd = sqrt((double) var[i]);
+					if (sd > 0) z += (fabs((double) y[i]) - mean[i])/sd;
+				}
+				if (z/sqrtChans > zCutoff) hit[ZVALUE] = true;
+			}
+			if (!hit[ZVALUE]) {
+				// Welford's update, with exponential forgetting once the memory is full
+				numStats++;
+				double w = (memorySamples > 0 && numStats > memorySamples) ? 1.0/memorySamples : 1.0/numStats;
+				for (int i=0;i<nChans;i++) {
+					double delta = fabs((double) y[i]) - mean[i];
+					mean[i] += (Tin) (w*delta);
+					var[i] = (Tin) ((1.0 - w)*(var[i] + w*delta*delta));
+				}
+			}
+		}
+
+		for (int k=0;k<NUM_KINDS;k++) {
+			mark(k);
+			if (active[k] && !hit[k] && counter - lastHit[k] > holdSamples) {
+				Transition s = {lastHit[k] + 1, k, false};
+				transitions.push_back(s);
+				active[k] = false;
+			}
+		}
+		counter++;
+	}
+	return (int) transitions.size();
+}
+
+#endif
@@ -9,6 +9,7 @@
 #define __FtBuffer_h
 
 #include <buffer.h>
+#include <socketserver.h>
 #include <SimpleStorage.h>
 
 struct FtDataType {
@@ -119,6 +120,34 @@ class FtBufferRequest {
 		return true;
 	}
 
+	/** Like prepPutData, but the block carries the time of its first sample in nanoseconds (PUT_DAT_T).
+		All blocks in a buffer should use the same clock, e.g. ft_clock_ns().
+	*/
+	bool prepPutDataTimestamp(UINT32_T numChannels, UINT32_T numSamples, UINT32_T dataType, const void *data, UINT64_T time) {
+		m_def.command = GET_ERR;
+		m_def.bufsize = 0;
+
+		unsigned int wordSize = wordsize_from_type(dataType);
+		if (wordSize == 0) return false;
+
+		UINT32_T  dataSize = wordSize * numSamples * numChannels;
+		UINT32_T  totalSize = sizeof(UINT64_T) + sizeof(datadef_t) + dataSize;
+		datadef_t *dd;
+
+		if (!m_buf.resize(totalSize)) return false;
+		m_msg.buf = m_buf.data();
+		memcpy(m_buf.data(), &time, sizeof(UINT64_T));
+		dd = (datadef_t *) ((char *) m_buf.data() + sizeof(UINT64_T));
+		dd->nchans = numChannels;
+		dd->nsamples = numSamples;
+		dd->data_type = dataType;
+		dd->bufsize = dataSize;
+		memcpy(dd+1, data, dataSize);
+		m_def.command = PUT_DAT_T;
+		m_def.bufsize = totalSize;
+		return true;
+	}
+
 	bool prepPutEvent(INT32_T sample, INT32_T offset, INT32_T duration, const char *type=NULL, const char *value=NULL) {
 		// This is for safety: If a user ignores this function returning false,
 		// and just sends this request to the buffer server, we need to make sure
@@ -195,6 +224,40 @@ class FtBufferRequest {
 		return true;
 	}
 
+	/** Start an empty PUT_BATCH request. Add PUT_DAT, PUT_DAT_T and PUT_EVT requests to it using
+		prepBatchAdd (e.g. FtSampleBlock::asRequest() and FtEventList::asRequest()),
+		the server then stores all of them in one go, or none at all.
+	*/
+	void prepPutBatch() {
+		m_buf.resize(0);
+		m_def.command = PUT_BATCH;
+		m_def.bufsize = 0;
+		m_msg.buf = NULL;
+	}
+
+	bool prepBatchAdd(const message_t *req) {
+		if (m_def.command != PUT_BATCH) return false;
+		if (req == NULL || req->def == NULL) return false;
+		if (req->def->command != PUT_DAT && req->def->command != PUT_DAT_T && req->def->command != PUT_EVT) return false;
+
+		UINT32_T oldSize = m_def.bufsize;
+		UINT32_T newSize = oldSize + sizeof(messagedef_t) + req->def->bufsize;
+
+		if (!m_buf.resize(newSize)) return false;
+
+		m_def.bufsize = newSize;
+		m_msg.buf = m_buf.data();
+
+		char *dest = (char *) m_msg.buf + oldSize;
+		memcpy(dest, req->def, sizeof(messagedef_t));
+		if (req->def->bufsize > 0) memcpy(dest + sizeof(messagedef_t), req->buf, req->def->bufsize);
+		return true;
+	}
+
+	bool prepBatchAdd(const FtBufferRequest &req) {
+		return prepBatchAdd(req.out());
+	}
+
 	void prepGetData(UINT32_T begsample, UINT32_T endsample) {
 		m_def.command = GET_DAT;
 		m_msg.buf = &m_extras.ds;
@@ -203,6 +266,29 @@ class FtBufferRequest {
 		m_extras.ds.endsample = endsample;
 	}
 
+	// Asks for every stride-th sample of the given channels only (all channels if numChannels=0),
+	// converted to dataType on the server (DATATYPE_UNKNOWN to keep the original type)
+	bool prepGetDataSelection(UINT32_T begsample, UINT32_T endsample, UINT32_T stride, UINT32_T dataType, UINT32_T numChannels = 0, const UINT32_T *channels = NULL) {
+		m_def.command = GET_ERR;
+		m_def.bufsize = 0;
+
+		UINT32_T totalSize = sizeof(datasel_ext_t) + numChannels*sizeof(UINT32_T);
+		datasel_ext_t *ds;
+
+		if (!m_buf.resize(totalSize)) return false;
+		m_msg.buf = m_buf.data();
+		ds = (datasel_ext_t *) m_buf.data();
+		ds->begsample = begsample;
+		ds->endsample = endsample;
+		ds->stride = stride;
+		ds->data_type = dataType;
+		ds->nchans = numChannels;
+		if (numChannels > 0) memcpy(ds+1, channels, numChannels*sizeof(UINT32_T));
+		m_def.command = GET_DAT;
+		m_def.bufsize = totalSize;
+		return true;
+	}
+
 	void prepGetEvents(UINT32_T begevent, UINT32_T endevent) {
 		m_def.command = GET_EVT;
 		m_msg.buf = &m_extras.es;
@@ -211,6 +297,58 @@ class FtBufferRequest {
 		m_extras.es.endevent = endevent;
 	}
 
+	/** Asks for the events from begevent to endevent that match the criteria
+		that are added afterwards with prepEventFilter. The selection is limited
+		to the events that are still in the buffer.
+	*/
+	bool prepGetEventsFiltered(UINT32_T begevent, UINT32_T endevent) {
+		m_def.command = GET_ERR;
+		m_def.bufsize = 0;
+
+		if (!m_buf.resize(sizeof(eventsel_t))) return false;
+		m_msg.buf = m_buf.data();
+		eventsel_t *es = (eventsel_t *) m_buf.data();
+		es->begevent = begevent;
+		es->endevent = endevent;
+		m_def.command = GET_EVT;
+		m_def.bufsize = sizeof(eventsel_t);
+		return true;
+	}
+
+	bool prepEventFilter(UINT32_T what, UINT32_T dataType, UINT32_T numel, const void *data) {
+		if (m_def.command == GET_EVT && m_def.bufsize < sizeof(eventsel_t)) return false;
+		if (m_def.command == WAIT_DAT && m_def.bufsize < sizeof(waitdef_t) + sizeof(waitevt_t)) return false;
+		if (m_def.command != GET_EVT && m_def.command != WAIT_DAT) return false;
+
+		unsigned int wordSize = wordsize_from_type(dataType);
+		if (wordSize == 0) return false;
+
+		UINT32_T oldSize = m_def.bufsize;
+		UINT32_T newSize = oldSize + sizeof(eventfilter_t) + wordSize*numel;
+
+		if (!m_buf.resize(newSize)) return false;
+		m_msg.buf = m_buf.data();
+
+		eventfilter_t *ef = (eventfilter_t *) ((char *) m_buf.data() + oldSize);
+		ef->what = what;
+		ef->data_type = dataType;
+		ef->numel = numel;
+		ef->bufsize = wordSize*numel;
+		memcpy(ef+1, data, ef->bufsize);
+		m_def.bufsize = newSize;
+		return true;
+	}
+
+	// for EVENTSEL_TYPE or EVENTSEL_VALUE with a string
+	bool prepEventFilter(UINT32_T what, const char *str) {
+		return prepEventFilter(what, DATATYPE_CHAR, strlen(str), str);
+	}
+
+	// for EVENTSEL_SAMPLE, EVENTSEL_MINSAMPLE and EVENTSEL_MAXSAMPLE
+	bool prepEventFilter(UINT32_T what, INT32_T sample) {
+		return prepEventFilter(what, DATATYPE_INT32, 1, &sample);
+	}
+
 	void prepWaitData(UINT32_T nSamples, UINT32_T nEvents, UINT32_T milliseconds) {
 		m_def.command = WAIT_DAT;
 		m_msg.buf = &m_extras.wd;
@@ -220,6 +358,29 @@ class FtBufferRequest {
 		m_extras.wd.milliseconds = milliseconds;
 	}
 
+	/** Waits like prepWaitData, but also until an event from begEvent onwards
+		matches the criteria that are added afterwards with prepEventFilter,
+		and postSamples samples after that event are in the buffer. Use
+		0xFFFFFFFF for nSamples and nEvents to only wait for the event.
+	*/
+	bool prepWaitEvent(UINT32_T nSamples, UINT32_T nEvents, UINT32_T milliseconds, UINT32_T begEvent, UINT32_T postSamples) {
+		m_def.command = WAIT_ERR;
+		m_def.bufsize = 0;
+
+		if (!m_buf.resize(sizeof(waitdef_t) + sizeof(waitevt_t))) return false;
+		m_msg.buf = m_buf.data();
+		waitdef_t *wd = (waitdef_t *) m_buf.data();
+		wd->threshold.nsamples = nSamples;
+		wd->threshold.nevents = nEvents;
+		wd->milliseconds = milliseconds;
+		waitevt_t *we = (waitevt_t *) (wd+1);
+		we->begevent = begEvent;
+		we->postsamples = postSamples;
+		m_def.command = WAIT_DAT;
+		m_def.bufsize = sizeof(waitdef_t) + sizeof(waitevt_t);
+		return true;
+	}
+
 	const message_t *out() const {
 		return &m_msg;
 	}
@@ -239,6 +400,87 @@ class FtBufferRequest {
 };
 
 
+/** Walks through a sequence of chunks, as found after the headerdef_t of a
+	GET_HDR response. Nothing is copied, the pointers that getNext returns point
+	into the given buffer, which must stay around while the chunks are used.
+*/
+class FtChunkIterator {
+	public:
+
+	FtChunkIterator(const void *buf, unsigned int size) {
+		this->buf = (const char *) buf;
+		this->size = (buf == NULL) ? 0 : size;
+		pos = 0;
+	}
+
+	FtChunkIterator(SimpleStorage& store) {
+		buf = (const char *) store.data();
+		size = store.size();
+		pos = 0;
+	}
+
+	/** Returns the next chunk, or NULL if there are no more (complete) chunks */
+	const ft_chunk_t *getNext() {
+		if (pos + sizeof(ft_chunkdef_t) > size) return NULL;
+		const ft_chunk_t *chunk = (const ft_chunk_t *) (buf + pos);
+		if (chunk->def.size > size - pos - sizeof(ft_chunkdef_t)) return NULL;
+		pos += sizeof(ft_chunkdef_t) + chunk->def.size;
+		return chunk;
+	}
+
+	/** Returns the first chunk of the given type, or NULL if there is none */
+	const ft_chunk_t *find(UINT32_T chunkType) const {
+		return find_chunk(buf, 0, size, chunkType);
+	}
+
+	void rewind() { pos = 0; }
+
+	protected:
+	const char *buf;
+	unsigned int size, pos;
+};
+
+
+/** Walks through a sequence of events, as found in a GET_EVT response or in
+	the list of an FtEventList. The event definitions and their type and value
+	fields are not copied, they point into the given buffer.
+*/
+class FtEventIterator {
+	public:
+
+	FtEventIterator(const void *buf, unsigned int size) {
+		this->buf = (const char *) buf;
+		this->size = (buf == NULL) ? 0 : size;
+		pos = 0;
+	}
+
+	/** Returns the next event, or NULL if there are no more (complete) events */
+	const eventdef_t *getNext() {
+		if (pos + sizeof(eventdef_t) > size) return NULL;
+		const eventdef_t *evdef = (const eventdef_t *) (buf + pos);
+		if (evdef->bufsize > size - pos - sizeof(eventdef_t)) return NULL;
+		pos += sizeof(eventdef_t) + evdef->bufsize;
+		return evdef;
+	}
+
+	/** Returns a pointer to the type field of an event from getNext */
+	static const void *getType(const eventdef_t *evdef) {
+		return (const char *) evdef + sizeof(eventdef_t);
+	}
+
+	/** Returns a pointer to the value field of an event from getNext */
+	static const void *getValue(const eventdef_t *evdef) {
+		return (const char *) getType(evdef) + evdef->type_numel * wordsize_from_type(evdef->type_type);
+	}
+
+	void rewind() { pos = 0; }
+
+	protected:
+	const char *buf;
+	unsigned int size, pos;
+};
+
+
 /** Simple wrapper class for FieldTrip buffer responses. Not complete yet.
 */
 class FtBufferResponse {
@@ -304,7 +546,7 @@ class FtBufferResponse {
 		if (m_response->def == NULL) return false;
 		if (m_response->def->version != VERSION) return false;
 		if (m_response->def->command != WAIT_OK) return false;
-		if (m_response->def->bufsize != sizeof(samples_events_t)) return false;
+		if (m_response->def->bufsize < sizeof(samples_events_t)) return false;
 		if (m_response->buf == NULL) return false;
 		samples_events_t *nse = (samples_events_t *) m_response->buf;
 		nSamples = nse->nsamples;
@@ -312,6 +554,70 @@ class FtBufferResponse {
 		return true;
 	}
 
+	/** Returns true if the response to prepWaitEvent was caused by a matching
+		event, and stores its number. The event itself is copied to evtStore,
+		which is left empty if the event is no longer in the buffer.
+	*/
+	bool checkWaitEvent(UINT32_T &eventNumber, SimpleStorage *evtStore = NULL) const {
+		unsigned int nSamples, nEvents;
+		if (!checkWait(nSamples, nEvents)) return false;
+		if (m_response->def->bufsize < sizeof(samples_events_t) + sizeof(UINT32_T)) return false;
+
+		const char *ptr = (const char *) m_response->buf + sizeof(samples_events_t);
+		memcpy(&eventNumber, ptr, sizeof(UINT32_T));
+		if (evtStore != NULL) {
+			unsigned int len = m_response->def->bufsize - sizeof(samples_events_t) - sizeof(UINT32_T);
+			if (!evtStore->resize(len)) return false;
+			memcpy(evtStore->data(), ptr + sizeof(UINT32_T), len);
+		}
+		return true;
+	}
+
+	/** The getXxxView methods are like the checkGetXxx methods above, but instead of
+		copying the payload they return a pointer into the received message, or NULL
+		if the response is not valid. The pointer remains valid until the next call
+		of in() or clearResponse(), or until this object is destroyed, unless the
+		payload has been taken over with releaseBuffer().
+	*/
+
+	/** Returns the chunks that follow the header, their total size is written to chunkSize */
+	const void *getHeaderView(headerdef_t &hdr, unsigned int &chunkSize) const {
+		if (!checkGetHeader(hdr)) return NULL;
+		chunkSize = m_response->def->bufsize - sizeof(headerdef_t);
+		return (const char *) m_response->buf + sizeof(headerdef_t);
+	}
+
+	/** Returns the nsamples x nchans matrix of samples, in the type given by datadef.data_type */
+	const void *getDataView(datadef_t &datadef) const {
+		if (!checkGetData(datadef)) return NULL;
+		if (datadef.bufsize > m_response->def->bufsize - sizeof(datadef_t)) return NULL;
+		return (const char *) m_response->buf + sizeof(datadef_t);
+	}
+
+	/** Returns the events in the response, which can be walked with FtEventIterator.
+		The number of events is written to numEvents, their total size to size.
+	*/
+	const void *getEventView(int &numEvents, unsigned int &size) const {
+		numEvents = checkGetEvents();
+		if (numEvents < 0 || m_response == NULL) return NULL;
+		size = m_response->def->bufsize;
+		return m_response->buf;
+	}
+
+	/** Hands over the payload of the response to the caller, who should release
+		it with free() later on. Pointers from the views that were taken before
+		remain valid until then, so they can be kept around after the next request. The size of the payload
+		is written to size, if given. Returns NULL if there is no payload.
+	*/
+	void *releaseBuffer(unsigned int *size = NULL) {
+		if (m_response == NULL || m_response->def == NULL) return NULL;
+		void *buf = m_response->buf;
+		if (size != NULL) *size = m_response->def->bufsize;
+		m_response->buf = NULL;
+		m_response->def->bufsize = 0;
+		return buf;
+	}
+
 	message_t **in() {
 		if (m_response != NULL) clearResponse();
 		return &m_response;
@@ -346,28 +652,6 @@ class FtBufferResponse {
 };
 
 
-/*
-class FtChunkIterator {
-	public:
-
-	FtChunkIterator(SimpleStorage& buf) : store(buf) {
-		pos = 0;
-	}
-
-	ft_chunk_t *getNext() {
-		if (pos + sizeof(ft_chunkdef_t) > store.size()) return NULL;
-		ft_chunk_t *chunk = (ft_chunk_t * ) ((char *) store.data() + pos);
-		pos += sizeof(ft_chunkdef_t) + chunk->def.size;
-		return chunk;
-	}
-
-	protected:
-	SimpleStorage &store;
-	int pos;
-};
-*/
-
-
 /** Small class for generating PUT_EVT requests.
 	In comparison to the prepPutEvent method in FtBufferRequest,
 	this class allows multiple events in one request.
@@ -403,6 +687,28 @@ class FtEventList {
 		buf = 0;
 		reqdef.bufsize = 0;
 		numEvs = 0;
+		sizeAlloc = 0;
+	}
+
+	/* Makes sure that events of "size" bytes in total fit without re-allocating,
+	   where each event takes sizeof(eventdef_t) plus the size of its type and value */
+	bool reserve(unsigned int size) {
+		if (sizeAlloc >= size) return true;
+		char *newBuf = (char *) realloc(buf, size);
+		if (newBuf == NULL) return false;
+		buf = newBuf;
+		sizeAlloc = size;
+		return true;
+	}
+
+	/* Appends all events of the other list */
+	bool append(const FtEventList &other) {
+		if (other.reqdef.bufsize == 0) return true;
+		if (!grow(reqdef.bufsize + other.reqdef.bufsize)) return false;
+		memcpy(buf + reqdef.bufsize, other.buf, other.reqdef.bufsize);
+		reqdef.bufsize += other.reqdef.bufsize;
+		numEvs += other.numEvs;
+		return true;
 	}
 
 	/* Add an event of general type to the list, will silently ignore invalid types */
@@ -414,19 +720,9 @@ class FtEventList {
 
 		if (typeSize == 0 || valueSize == 0) return;
 
-		if (sizeAlloc < newSize) {
-			char *newBuf;
-			if (sizeAlloc == 0) {
-				newBuf = (char *) malloc(newSize);
-			} else {
-				newBuf = (char *) realloc(buf, newSize);
-			}
-			if (newBuf == NULL) {
-				fprintf(stderr, "Warning: out of memory in re-allocating event list.\n");
-				return;
-			}
-			sizeAlloc = newSize;
-			buf = newBuf;
+		if (!grow(newSize)) {
+			fprintf(stderr, "Warning: out of memory in re-allocating event list.\n");
+			return;
 		}
 
 		ne = (eventdef_t *) (buf + reqdef.bufsize);
@@ -476,6 +772,11 @@ class FtEventList {
 		return numEvs;
 	}
 
+	/* Returns the size of the events currently in the list, in bytes */
+	unsigned int size() const {
+		return reqdef.bufsize;
+	}
+
 	/* Transforms sample indices of events by first adding "offset", then dividing by divisor */
 	void transform(int offset, int divisor) {
 		unsigned int pos = 0;
@@ -489,6 +790,19 @@ class FtEventList {
 
 	protected:
 
+	/* The memory is kept when the list is cleared, and grows by doubling, so that
+	   an acquisition loop stops allocating once it has seen its largest block */
+	bool grow(unsigned int size) {
+		if (sizeAlloc >= size) return true;
+		unsigned int newAlloc = (sizeAlloc < 256) ? 256 : sizeAlloc;
+		while (newAlloc < size) newAlloc *= 2;
+		return reserve(newAlloc);
+	}
+
+	// the list owns its memory, and can not be copied
+	FtEventList(const FtEventList &);
+	FtEventList& operator=(const FtEventList &);
+
 	messagedef_t reqdef;
 	message_t request;
 	char *buf;
@@ -566,36 +880,110 @@ class FtSampleBlock {
 };
 
 
+/** Persistent connection to a FieldTrip buffer, this wraps an ft_connection_t
+	(see clientrequest.c). Requests that are sent with request() transparently
+	re-establish a broken connection and, if nothing in the buffer is changed by
+	the request, send it again (see setReconnect).
+*/
 class FtConnection {
 	public:
 
 	FtConnection(int retry=0) {
-		this->retry  = (retry < 0) ? 0 : retry;
-		this->sock   = -1;
-		this->type   = -1;
+		// without memory for the handle, the connection can never be opened
+		this->conn = ft_connection_create(NULL);
+		if (this->conn != NULL) this->conn->opt.retry = (retry < 0) ? 0 : retry;
+		this->server = NULL;
 		++numConnections;
 	}
 
 	~FtConnection();
 
-	void setRetry(int retry) 	{ this->retry = (retry < 0) ? 0 : retry; }
-	int getSocket() const 		{ return sock; }
-	int getType() const 		{ return type; }
-	bool isOpen() const 		{ return (sock > -1); }
+	void setRetry(int retry) 	{ if (conn != NULL) conn->opt.retry = (retry < 0) ? 0 : retry; }
+	int getSocket() const 		{ return (conn == NULL) ? -1 : conn->sock; }
+	int getType() const 		{ return (conn == NULL || conn->sock < 0) ? -1 : conn->type; }
+	/** True if a socket (or direct memory access) is there, a broken connection
+		that request() would re-establish does not count as open. */
+	bool isOpen() const 		{ return conn != NULL && conn->sock > -1; }
+	ft_connection_t *getHandle() const { return conn; }
+
+	/** Options of the socket, these are applied immediately if the connection is open. */
+	void setNoDelay(bool on) {
+		if (conn == NULL) return;
+		conn->opt.nodelay = on;
+		ft_connection_configure(conn);
+	}
+	void setKeepAlive(bool on, int idleSeconds=0) {
+		if (conn == NULL) return;
+		conn->opt.keepalive = on;
+		conn->opt.keepidle  = idleSeconds;
+		ft_connection_configure(conn);
+	}
+	void setTimeouts(int sendMilliseconds, int recvMilliseconds) {
+		if (conn == NULL) return;
+		conn->opt.sendtimeout = sendMilliseconds;
+		conn->opt.recvtimeout = recvMilliseconds;
+		ft_connection_configure(conn);
+	}
+	void setReconnect(bool on, int retryDelayMilliseconds=5) {
+		if (conn == NULL) return;
+		conn->opt.reconnect  = on;
+		conn->opt.retrydelay = retryDelayMilliseconds;
+	}
+	/** Compress the samples over TCP if the server supports it (see compress.h) */
+	void setCompression(bool on) {
+		if (conn == NULL) return;
+		conn->opt.compress = on;
+		ft_connection_negotiate(conn);
+	}
+	bool isCompressing() const	{ return conn != NULL && conn->codecs != 0; }
 
 	bool connect(const char *address);
 	bool connectDirect() {
-		disconnect();
-		sock = type = 0;
-		return true;
+		return conn != NULL && ft_connection_direct(conn) == 0;
 	}
 
 	bool connectTcp(const char *hostname, int port);
 	bool connectUnix(const char *pathname);
+
+	/** Starts a buffer server in this process on the given port, and connects to it
+		directly, so that requests made through this connection go into the ring
+		without passing a socket. Other clients connect to the port as usual.
+		The server is stopped again on disconnect(). Returns true on success.
+	*/
+	bool embedServer(int port);
+	bool isEmbedded() const		{ return server != NULL; }
+
 	void disconnect() {
-		if (sock > 0) closesocket(sock);
-		sock = -1;
-		type = -1;
+		if (conn != NULL) {
+			ft_connection_close(conn);
+			conn->type = -1; // do not re-establish the connection on the next request
+		}
+		if (server != NULL) {
+			ft_stop_buffer_server(server);
+			server = NULL;
+		}
+	}
+
+	/** Like clientrequest, returns 0 on success */
+	int request(const message_t *request, message_t **response) {
+		return (conn == NULL) ? -1 : ft_connection_request(conn, request, response);
+	}
+
+	/** Hands over the socket of the connection, e.g. to ft_async_open, after which
+		the socket is closed by the new owner. The connection is not re-established,
+		it can be used again after the next connect. Returns -1 if it is not open.
+	*/
+	int releaseSocket() {
+		if (conn == NULL) return -1;
+		int sock = (conn->type > 0) ? conn->sock : -1;
+		conn->sock = -1;
+		conn->type = -1;
+		return sock;
+	}
+
+	/** Sends a small request to check that the buffer is still there. */
+	bool ping() {
+		return conn != NULL && ft_connection_ping(conn) == 0;
 	}
 
 	protected:
@@ -604,7 +992,14 @@ class FtConnection {
 	static WSADATA wsa;
 	#endif
 	static int numConnections;
-	int sock, type, retry;
+	ft_connection_t *conn;
+	ft_buffer_server_t *server;	/**< Embedded server, see embedServer() */
+
+	private:
+
+	// the handle is owned by this object, so it cannot be copied
+	FtConnection(const FtConnection &);
+	FtConnection &operator=(const FtConnection &);
 };
 
 #endif
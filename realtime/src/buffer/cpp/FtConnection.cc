@@ -14,7 +14,8 @@ int FtConnection::numConnections = 0;
 
 
 FtConnection::~FtConnection() {
-	disconnect();
+	if (server != NULL) ft_stop_buffer_server(server);
+	ft_connection_destroy(conn);
 	if (--numConnections == 0) {
 		#ifdef WIN32
 		if (wsa.wVersion > 0) {
@@ -26,10 +27,8 @@ FtConnection::~FtConnection() {
 }
 
 bool FtConnection::connectTcp(const char *hostname, int port) {
-	struct sockaddr_in sa;
-	struct hostent *host;
-
 	disconnect();
+	if (conn == NULL || port <= 0) return false;
 
 #ifdef WIN32
 	if (wsa.wVersion == 0) {
@@ -41,71 +40,31 @@ bool FtConnection::connectTcp(const char *hostname, int port) {
 	}
 #endif
 
-	if ((host = gethostbyname(hostname)) == NULL) {
-		fprintf(stderr, "connectTcp: nslookup1 failed on '%s'\n", hostname);
-		return false;
-	}
+	return ft_connection_tcp(conn, hostname, port) == 0;
+}
 
-	if (host->h_length == 0) {
-		fprintf(stderr, "connectTcp: nslookup2 failed on '%s'\n", hostname);
-		return false;
-	}
+bool FtConnection::embedServer(int port) {
+	disconnect();
+	if (conn == NULL || port <= 0) return false;
 
-	bzero(&sa, sizeof(sa));
-	sa.sin_family = AF_INET;
-	sa.sin_port = htons(port);
-	memcpy(&(sa.sin_addr.s_addr), host->h_addr_list[0], sizeof(sa.sin_addr.s_addr));
+	server = ft_start_buffer_server(port, NULL, NULL, NULL);
+	if (server == NULL) return false;
 
-	sock = socket(PF_INET, SOCK_STREAM, 0);
-	if (sock < 0) {
-		perror("connectTcp: socket");
+	if (ft_connection_direct(conn) != 0) {
+		ft_stop_buffer_server(server);
+		server = NULL;
 		return false;
 	}
-
-	for (int r = 0;r<=retry;r++) {
-		if (::connect(sock, (struct sockaddr *)&sa, sizeof(sa))==0) {
-			type = 1;
-			return true;
-		}
-		if (r==retry) break;
-		/* wait 5 miliseconds and try again */
-		perror("connectTcp:connect");
-		usleep(5000);
-	}
-	closesocket(sock);
-	sock = -1;
-	return false;
+	return true;
 }
 
 bool FtConnection::connectUnix(const char *pathname) {
 	disconnect();
 #ifndef WIN32
-	struct sockaddr_un sa;
-
-	bzero(&sa, sizeof(sa));
-	sa.sun_family = AF_UNIX;
-	strncpy(sa.sun_path, pathname, sizeof(sa.sun_path));
-
-	sock = socket(AF_UNIX, SOCK_STREAM, 0);
-	if (sock < 0) {
-		perror("connectUnix: socket");
-		return false;
-	}
-
-	for (int r = 0;r<=retry;r++) {
-		if (::connect(sock, (struct sockaddr *)&sa, sizeof(sa))==0) {
-			type = 2;
-			return true;
-		}
-		if (r==retry) break;
-		/* wait 5 miliseconds and try again */
-		perror("connectUnix:connect");
-		usleep(5000);
-	}
-	closesocket(sock);
-	sock = -1;
-#endif
+	return conn != NULL && ft_connection_unix(conn, pathname) == 0;
+#else
 	return false;
+#endif
 }
 
 bool FtConnection::connect(const char *address) {
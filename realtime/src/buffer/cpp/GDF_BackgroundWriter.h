@@ -11,36 +11,73 @@
 #include <GdfWriter.h>
 #include <stdio.h>
 #include <pthread.h>
-#include <LocalPipe.h>
+#include <atomicutil.h>
 #include <string>
 
+/** Writes the samples in a separate thread. The acquisition thread fills slots of
+	a ring buffer and publishes them with commitBlock(), which only takes a lock if the
+	saving thread is waiting for samples. The fill level of the ring is tracked for
+	every file, so that one can see whether the disk keeps up, see getRingStatistics().
+
+	Long recordings are split into files of at most setMaxFileSize() bytes or
+	setMaxFileDuration() seconds. A second thread opens the next file while the current
+	one is being written, and closes the previous one after the switch, so the saving
+	thread only swaps the two files between two committed blocks. The next file is
+	removed again if the recording stops before it is used.
+*/
+
 template <typename To>
 class GDF_BackgroundWriter {
 	public:
 
-	GDF_BackgroundWriter(int nChans,  int sampleRate, GDF_Type gdfType, int seconds=5) : gdfWriter(nChans, sampleRate, gdfType) {
+	GDF_BackgroundWriter(int nChans,  int sampleRate, GDF_Type gdfType, int seconds=5) : gdfWriter(nChans, sampleRate, gdfType), spareWriter(nChans, sampleRate, gdfType) {
 		running = threadStarted = false;
 		this->nChans = nChans;
+		this->sampleRate = sampleRate;
 		rbSize = seconds*sampleRate; // 5 seconds of data for saving ring buffer
 		rbData = new To[rbSize*nChans];
-		rbWritePos = rbReadPos = 0;
+		rbWritePos = rbCommitPos = rbReadPos = 0;
 		maxFileSize = 1024*1024*1024;
+		maxFileSamples = 0;
 		fileCounter = 0;
+		current = &gdfWriter;
+		spare = &spareWriter;
+		stopRequest = 0;
+		sleeping = 0;
+		numFull = 0;
+		resetRingStatistics();
+		pthread_mutex_init(&wakeMutex, NULL);
+		pthread_cond_init(&wakeCond, NULL);
+		pthread_mutex_init(&rotateMutex, NULL);
+		pthread_cond_init(&rotateCond, NULL);
+		pthread_cond_init(&rotateDone, NULL);
 	}
 
 	GDF_Writer& gdf() {
 		return gdfWriter;
 	}
 
+	/** Start a new file before the current one grows beyond maxSize bytes, 0 for no limit */
 	void setMaxFileSize(int64_t maxSize) {
 		maxFileSize = maxSize;
 	}
 
+	/** Start a new file before the current one holds more than the given number of
+		seconds of samples, 0 for no limit */
+	void setMaxFileDuration(double seconds) {
+		maxFileSamples = (seconds > 0) ? (int64_t) (seconds * sampleRate) : 0;
+	}
+
 	virtual ~GDF_BackgroundWriter() {
 		stopSync();
 
 		// clean up variables
 		delete[] rbData;
+		pthread_mutex_destroy(&wakeMutex);
+		pthread_cond_destroy(&wakeCond);
+		pthread_mutex_destroy(&rotateMutex);
+		pthread_cond_destroy(&rotateCond);
+		pthread_cond_destroy(&rotateDone);
 	}
 
 	bool start(const char *name) {
@@ -62,6 +99,11 @@ class GDF_BackgroundWriter {
 		filename.append(name, lenBasename);
 
 		fileCounter = 0;
+		resetRingStatistics();
+		// the other files of this recording get the same channels as the first
+		spareWriter.copySettings(gdfWriter);
+		current = &gdfWriter;
+		spare = &spareWriter;
 
 		if (pthread_create(&savingThread, NULL, staticSavingThreadFunction, this)) {
 			fprintf(stderr, "Could not spawn GDF saving thread.\n");
@@ -74,8 +116,7 @@ class GDF_BackgroundWriter {
 	void stopSync() {
 		if (running) {
 			// stop saving thread
-			int64_t minusOne = -1;
-			locPipe.write(sizeof(int64_t), &minusOne);
+			requestStop(-1);
 		}
 		pthread_join(savingThread, 0);
 		threadStarted = false;
@@ -85,13 +126,14 @@ class GDF_BackgroundWriter {
 		if (running) {
 			// stop saving thread asynch
 			pthread_detach(savingThread);
-			int64_t minusTwo = -2;
-			locPipe.write(sizeof(int64_t), &minusTwo);
+			requestStop(-2);
 		}
 	}
 
 	bool checkFreeBlock(int nSamples) {
-		return (rbWritePos - rbReadPos <= rbSize - nSamples);
+		if (rbWritePos - ATOMIC_ADD64(&rbReadPos, 0) <= rbSize - nSamples) return true;
+		ATOMIC_ADD32(&numFull, 1);
+		return false;
 	}
 
 	To *getSampleSlot() {
@@ -100,12 +142,24 @@ class GDF_BackgroundWriter {
 	}
 
 	void commitBlock() {
-		int n = locPipe.write(sizeof(int64_t), &rbWritePos);
-		if (n!=sizeof(int64_t)) {
-			fprintf(stderr, "GDF_BackgroundWriter.commitBlock: Error when writing to pipe.\n");
+		// only this thread changes rbCommitPos, the addition makes the store atomic
+		ATOMIC_ADD64(&rbCommitPos, rbWritePos - rbCommitPos);
+		MEMORY_BARRIER();
+		if (sleeping) {
+			pthread_mutex_lock(&wakeMutex);
+			pthread_cond_signal(&wakeCond);
+			pthread_mutex_unlock(&wakeMutex);
 		}
 	}
 
+	/** Fill level of the ring buffer for the current file, as a fraction of its size:
+		the maximum and mean over all writes, and how often a block did not fit at all. */
+	void getRingStatistics(double& maxFill, double& meanFill, int& numRingFull) const {
+		maxFill     = (double) statMaxFill / rbSize;
+		meanFill    = (statNumWrites > 0) ? (double) statSumFill / ((double) statNumWrites * rbSize) : 0.0;
+		numRingFull = numFull - statNumFullBefore;
+	}
+
 	bool isRunning() const {
 		return running;
 	}
@@ -120,27 +174,162 @@ class GDF_BackgroundWriter {
 
 	protected:
 
-	bool createAndWriteHeader() {
-		filename.resize(lenBasename);
-		if (fileCounter == 0) {
-			filename.append(".gdf");
+	void resetRingStatistics() {
+		statMaxFill = statNumWrites = 0;
+		statSumFill = 0;
+		statNumFullBefore = numFull;
+	}
+
+	/** Closes a file, with the ring statistics of the time that it was written */
+	static void closeFile(GDF_Writer& writer, const std::string& name, double maxFill, double meanFill, int numRingFull) {
+		writer.close();
+		printf("Closed %s, ring buffer filled up to %.0f%% (mean %.0f%%), full %d times\n",
+				name.c_str(), 100.0*maxFill, 100.0*meanFill, numRingFull);
+	}
+
+	void closeCurrentFile() {
+		double maxFill, meanFill;
+		int numRingFull;
+
+		getRingStatistics(maxFill, meanFill, numRingFull);
+		closeFile(*current, filename, maxFill, meanFill, numRingFull);
+	}
+
+	void requestStop(int code) {
+		stopRequest = code;
+		MEMORY_BARRIER();
+		pthread_mutex_lock(&wakeMutex);
+		pthread_cond_signal(&wakeCond);
+		pthread_mutex_unlock(&wakeMutex);
+	}
+
+	/** Waits until new samples have been committed, and returns the new write position.
+		The samples are written before a stop request is returned, which is negative. */
+	int64_t waitForSamples() {
+		while (1) {
+			int64_t pos = ATOMIC_ADD64(&rbCommitPos, 0);
+			if (pos != rbReadPos) return pos;
+			if (stopRequest) return stopRequest;
+
+			pthread_mutex_lock(&wakeMutex);
+			sleeping = 1;
+			MEMORY_BARRIER();
+			if (ATOMIC_ADD64(&rbCommitPos, 0) == rbReadPos && !stopRequest) {
+				pthread_cond_wait(&wakeCond, &wakeMutex);
+			}
+			sleeping = 0;
+			pthread_mutex_unlock(&wakeMutex);
+		}
+	}
+
+	/** Name of the given file of this recording, the first one has no number */
+	std::string makeFilename(int counter) const {
+		std::string name(filename, 0, lenBasename);
+		if (counter == 0) {
+			name.append(".gdf");
 		} else {
 			char suffix[12];
-			snprintf(suffix,12,"_%i.gdf", fileCounter);
-			filename.append(suffix);
+			snprintf(suffix,12,"_%i.gdf", counter);
+			name.append(suffix);
 		}
-		if (!gdfWriter.createAndWriteHeader(filename.c_str())) {
-			fprintf(stderr, "Could not open GDF file %s for writing\n", filename.c_str());
+		return name;
+	}
+
+	static bool openFile(GDF_Writer& writer, const std::string& name) {
+		if (!writer.createAndWriteHeader(name.c_str())) {
+			fprintf(stderr, "Could not open GDF file %s for writing\n", name.c_str());
 			return false;
 		}
 		return true;
 	}
 
+	/** Starts the thread that opens the next file and closes the previous one */
+	bool startRotation() {
+		spareName = makeFilename(fileCounter + 1);
+		retiredName.clear();
+		spareReady = false;
+		rotateBusy = true;
+		rotateStop = false;
+		if (pthread_create(&rotateThread, NULL, staticRotationThreadFunction, this)) {
+			fprintf(stderr, "Could not spawn GDF rotation thread.\n");
+			return false;
+		}
+		return true;
+	}
+
+	/** Stops the rotation thread, after it has finished its work, and removes the next
+		file, which has not been used. */
+	void stopRotation() {
+		pthread_mutex_lock(&rotateMutex);
+		rotateStop = true;
+		pthread_cond_signal(&rotateCond);
+		pthread_mutex_unlock(&rotateMutex);
+		pthread_join(rotateThread, 0);
+		if (spareReady) {
+			spare->close();
+			remove(spareName.c_str());
+			spareReady = false;
+		}
+	}
+
+	/** Continues with the file that the rotation thread has opened, and lets it close
+		the current one and open the file after the next. This only waits if the
+		rotation thread is still busy since the previous switch. Returns false if
+		the next file could not be opened. */
+	bool switchFile() {
+		pthread_mutex_lock(&rotateMutex);
+		while (rotateBusy) pthread_cond_wait(&rotateDone, &rotateMutex);
+		if (!spareReady) {
+			pthread_mutex_unlock(&rotateMutex);
+			return false;
+		}
+		getRingStatistics(retiredMaxFill, retiredMeanFill, retiredRingFull);
+		retiredName = filename;
+		filename = spareName;
+		GDF_Writer *previous = current;
+		current = spare;
+		spare = previous;
+		fileCounter++;
+		spareName = makeFilename(fileCounter + 1);
+		spareReady = false;
+		rotateBusy = true;
+		pthread_cond_signal(&rotateCond);
+		pthread_mutex_unlock(&rotateMutex);
+		resetRingStatistics();
+		return true;
+	}
+
+	void rotationThreadFunc() {
+		pthread_mutex_lock(&rotateMutex);
+		while (1) {
+			while (!rotateBusy && !rotateStop) pthread_cond_wait(&rotateCond, &rotateMutex);
+			if (!rotateBusy) break;
+
+			// the spare is only touched by this thread while rotateBusy is set
+			pthread_mutex_unlock(&rotateMutex);
+			if (!retiredName.empty()) {
+				closeFile(*spare, retiredName, retiredMaxFill, retiredMeanFill, retiredRingFull);
+			}
+			bool ok = openFile(*spare, spareName);
+			pthread_mutex_lock(&rotateMutex);
+
+			spareReady = ok;
+			rotateBusy = false;
+			pthread_cond_signal(&rotateDone);
+		}
+		pthread_mutex_unlock(&rotateMutex);
+	}
 
 	void savingThreadFunc() {
 		int64_t fileSize = 256*(1+nChans);
+		int64_t fileSamples = 0;
 
-		if (!createAndWriteHeader()) return;
+		filename = makeFilename(fileCounter);
+		if (!openFile(*current, filename)) return;
+		if (!startRotation()) {
+			closeCurrentFile();
+			return;
+		}
 
 		running = true;
 
@@ -149,19 +338,13 @@ class GDF_BackgroundWriter {
 			To *rbPtr;
 			int64_t newSize, newWritePos;
 
-			int n = locPipe.read(sizeof(int64_t), &newWritePos);
+			newWritePos = waitForSamples();
 
-			if (n!=sizeof(int64_t)) {
-				// this should never happen for blocking sockets/pipes
-				fprintf(stderr, "Unexpected error in pipe communication\n");
-				gdfWriter.close();
-				break;
-			}
 			if (newWritePos < 0) {
-				gdfWriter.close();
+				closeCurrentFile();
+				stopRotation();
 				if (newWritePos == -2) {
 					printf("Stopping GDF writing and killing myself...\n");
-					gdfWriter.close();
 					delete this;
 					return;
 				} else {
@@ -170,6 +353,11 @@ class GDF_BackgroundWriter {
 				}
 			}
 
+			int fill = (int) (newWritePos - rbReadPos);
+			if (fill > statMaxFill) statMaxFill = fill;
+			statSumFill += fill;
+			statNumWrites++;
+
 			int writePtr = newWritePos % rbSize;
 			int readPtr  = rbReadPos % rbSize;
 
@@ -187,24 +375,36 @@ class GDF_BackgroundWriter {
 			int64_t addSize = (newSamplesA+newSamplesB) * nChans * sizeof(To);
 
 			newSize = fileSize + addSize;
-			if (newSize > maxFileSize) {
-				gdfWriter.close();
-				fileCounter++;
-				if (!createAndWriteHeader()) break;
-				newSize = 256*(1+nChans) + addSize;
+			// the committed samples end with a block, so the files are split between blocks
+			if (fileSamples > 0 && ((maxFileSize > 0 && newSize > maxFileSize) ||
+					(maxFileSamples > 0 && fileSamples + newSamplesA + newSamplesB > maxFileSamples))) {
+				if (switchFile()) {
+					newSize = 256*(1+nChans) + addSize;
+					fileSamples = 0;
+				} else {
+					fprintf(stderr, "Could not start the next GDF file, continuing with %s\n", filename.c_str());
+					maxFileSize = maxFileSamples = 0;
+				}
 			}
 
-			gdfWriter.addSamples(newSamplesA, rbPtr);
+			current->addSamples(newSamplesA, rbPtr);
 			if (newSamplesB > 0) {
-				gdfWriter.addSamples(newSamplesB, rbData);
+				current->addSamples(newSamplesB, rbData);
 			}
-			rbReadPos = newWritePos;
+			ATOMIC_ADD64(&rbReadPos, newWritePos - rbReadPos);
 			readPtr   = writePtr;
 			fileSize  = newSize;
+			fileSamples += newSamplesA + newSamplesB;
 		}
 		running = false;
 	}
 
+	static void *staticRotationThreadFunction(void *arg) {
+		GDF_BackgroundWriter<To> *GOW = (GDF_BackgroundWriter<To> *) arg;
+		GOW->rotationThreadFunc();
+		return NULL;
+	}
+
 	static void *staticSavingThreadFunction(void *arg) {
 		if (arg == 0) return NULL;
 
@@ -214,20 +414,42 @@ class GDF_BackgroundWriter {
 	}
 
 	GDF_Writer gdfWriter;
-	int nChans;
+	GDF_Writer spareWriter;
+	GDF_Writer *current;			// the file that the saving thread writes to
+	GDF_Writer *spare;				// the next file, or the previous one while it is closed
+	int nChans, sampleRate;
 	bool running, threadStarted;
 
 	To *rbData;
 	int rbSize;
-	int64_t rbReadPos, rbWritePos;
-
-	LocalPipe locPipe;
+	int64_t rbWritePos;				// next slot to fill, only used by the acquisition thread
+	volatile int64_t rbCommitPos;	// samples that have been handed to the saving thread
+	volatile int64_t rbReadPos;		// samples that the saving thread has written
+
+	volatile int stopRequest;		// -1 to stop, -2 to stop and delete this object
+	volatile int sleeping;			// set while the saving thread waits, see waitForSamples
+	pthread_mutex_t wakeMutex;
+	pthread_cond_t wakeCond;
 	pthread_t savingThread;
 
-	int64_t maxFileSize;
+	int statMaxFill, statNumWrites;	// fill level of the ring for the current file,
+	int64_t statSumFill;			// seen by the saving thread before each write
+	volatile int numFull;			// number of times that checkFreeBlock failed
+	int statNumFullBefore;
+
+	int64_t maxFileSize, maxFileSamples;
 	std::string filename;
 	int lenBasename;
 	int fileCounter;
+
+	// the rotation thread works on the spare file while rotateBusy is set
+	pthread_mutex_t rotateMutex;
+	pthread_cond_t rotateCond, rotateDone;
+	pthread_t rotateThread;
+	bool rotateBusy, rotateStop, spareReady;
+	std::string spareName, retiredName;
+	double retiredMaxFill, retiredMeanFill;
+	int retiredRingFull;
 };
 
 #endif
@@ -0,0 +1,403 @@
+/** Simple C++ class for reading GDF 2.x files.
+	WARNING: This will only work on little-endian machines!
+
+	Copyright (C) 2017, Robert Oostenveld
+	Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+*/
+
+#include <GdfReader.h>
+
+#include <stdlib.h>
+#include <algorithm>
+
+#ifdef WIN32
+#define fseeko _fseeki64
+#define ftello _ftelli64
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+// number of bytes of the records that are converted together if the channels differ in type
+#define GDF_READER_BLOCK (256*1024)
+
+template <typename Ts>
+static inline double loadSample(const char *p) {
+	Ts v;
+	memcpy(&v, p, sizeof(Ts));	// the samples of a record need not be aligned
+	return (double) v;
+}
+
+// Converts n samples of one channel that are stride bytes apart in the records
+template <typename Ts, typename Td>
+static void convertStrided(const char *src, int stride, int64_t n, Td *dest, int destStride, double cal, double off) {
+	for (int64_t k=0;k<n;k++) {
+		dest[k*destStride] = (Td) (cal*loadSample<Ts>(src + k*stride) + off);
+	}
+}
+
+template <typename Td>
+static void convertChannel(uint32_t type, const char *src, int stride, int64_t n, Td *dest, int destStride, double cal, double off) {
+	switch(type) {
+		case GDF_INT8:    convertStrided<int8_t,Td>(src, stride, n, dest, destStride, cal, off); break;
+		case GDF_UINT8:   convertStrided<uint8_t,Td>(src, stride, n, dest, destStride, cal, off); break;
+		case GDF_INT16:   convertStrided<int16_t,Td>(src, stride, n, dest, destStride, cal, off); break;
+		case GDF_UINT16:  convertStrided<uint16_t,Td>(src, stride, n, dest, destStride, cal, off); break;
+		case GDF_INT32:   convertStrided<int32_t,Td>(src, stride, n, dest, destStride, cal, off); break;
+		case GDF_UINT32:  convertStrided<uint32_t,Td>(src, stride, n, dest, destStride, cal, off); break;
+		case GDF_INT64:   convertStrided<int64_t,Td>(src, stride, n, dest, destStride, cal, off); break;
+		case GDF_UINT64:  convertStrided<uint64_t,Td>(src, stride, n, dest, destStride, cal, off); break;
+		case GDF_FLOAT32: convertStrided<float,Td>(src, stride, n, dest, destStride, cal, off); break;
+		case GDF_FLOAT64: convertStrided<double,Td>(src, stride, n, dest, destStride, cal, off); break;
+	}
+}
+
+/* Converts n records with one sample per channel, where all selected channels
+   have the same type and are aligned. A run of consecutive channels is a plain
+   loop over the row, which the compiler vectorizes, other selections are
+   gathered through their offsets. */
+template <typename Ts, typename Td>
+static void convertRows(const char *src, int recordSize, int64_t n, int nSel, const int *offsets, bool consecutive, Td *dest, const double *cal, const double *off) {
+	for (int64_t k=0;k<n;k++) {
+		const char *row = src + k*recordSize;
+		Td *y = dest + k*nSel;
+		if (consecutive) {
+			const Ts *x = (const Ts *) (row + offsets[0]);
+			for (int j=0;j<nSel;j++) y[j] = (Td) (cal[j]*x[j] + off[j]);
+		} else {
+			for (int j=0;j<nSel;j++) y[j] = (Td) (cal[j]*(*(const Ts *) (row + offsets[j])) + off[j]);
+		}
+	}
+}
+
+template <typename Td>
+static void convertRowsByType(uint32_t type, const char *src, int recordSize, int64_t n, int nSel, const int *offsets, bool consecutive, Td *dest, const double *cal, const double *off) {
+	switch(type) {
+		case GDF_INT8:    convertRows<int8_t,Td>(src, recordSize, n, nSel, offsets, consecutive, dest, cal, off); break;
+		case GDF_UINT8:   convertRows<uint8_t,Td>(src, recordSize, n, nSel, offsets, consecutive, dest, cal, off); break;
+		case GDF_INT16:   convertRows<int16_t,Td>(src, recordSize, n, nSel, offsets, consecutive, dest, cal, off); break;
+		case GDF_UINT16:  convertRows<uint16_t,Td>(src, recordSize, n, nSel, offsets, consecutive, dest, cal, off); break;
+		case GDF_INT32:   convertRows<int32_t,Td>(src, recordSize, n, nSel, offsets, consecutive, dest, cal, off); break;
+		case GDF_UINT32:  convertRows<uint32_t,Td>(src, recordSize, n, nSel, offsets, consecutive, dest, cal, off); break;
+		case GDF_INT64:   convertRows<int64_t,Td>(src, recordSize, n, nSel, offsets, consecutive, dest, cal, off); break;
+		case GDF_UINT64:  convertRows<uint64_t,Td>(src, recordSize, n, nSel, offsets, consecutive, dest, cal, off); break;
+		case GDF_FLOAT32: convertRows<float,Td>(src, recordSize, n, nSel, offsets, consecutive, dest, cal, off); break;
+		case GDF_FLOAT64: convertRows<double,Td>(src, recordSize, n, nSel, offsets, consecutive, dest, cal, off); break;
+	}
+}
+
+static bool compareEvents(const GDF_Event& a, const GDF_Event& b) {
+	return a.sample < b.sample;
+}
+
+
+GDF_Reader::GDF_Reader() {
+	fp = NULL;
+	map = NULL;
+	mapSize = 0;
+	nChans = 0;
+	samplesPerRecord = 0;
+	nRecords = nSamples = 0;
+	dataOffset = 0;
+	recordSize = 0;
+	fSample = eventRate = 0.0;
+	memset(&hdr, 0, sizeof(hdr));
+}
+
+GDF_Reader::~GDF_Reader() {
+	close();
+}
+
+void GDF_Reader::close() {
+#ifndef WIN32
+	if (map != NULL) munmap(map, mapSize);
+#endif
+	map = NULL;
+	mapSize = 0;
+	if (fp != NULL) fclose(fp);
+	fp = NULL;
+	nChans = 0;
+	nRecords = nSamples = 0;
+	fallback.clear();
+	events.clear();
+	eventsByType.clear();
+}
+
+bool GDF_Reader::open(const char *filename) {
+	close();
+	error.clear();
+
+	fp = fopen(filename, "rb");
+	if (fp == NULL) {
+		error = "could not open file";
+		return false;
+	}
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || memcmp(hdr.version, "GDF 2.", 6) != 0) {
+		error = "not a GDF 2.x file";
+		close();
+		return false;
+	}
+	nChans = hdr.numChannels;
+	dataOffset = 256*(int64_t) hdr.headerLengthInBlocks;
+	if (nChans == 0 || dataOffset < 256*(1+nChans)) {
+		error = "invalid header length or number of channels";
+		close();
+		return false;
+	}
+
+	// the variable header, in the layout of GDF_Writer::createAndWriteHeader
+	std::vector<char> vh(256*nChans);
+	if (fread(&vh[0], 256, nChans, fp) != (size_t) nChans) {
+		error = "could not read channel headers";
+		close();
+		return false;
+	}
+	const char *p = &vh[0];
+	labels.resize(nChans);
+	for (int i=0;i<nChans;i++) {
+		const char *lab = p + 16*i;
+		labels[i].assign(lab, strnlen(lab, 16));
+	}
+	p += (16 + 80 + 6)*nChans;	// labels, transducer types, old physical dimensions
+
+	physDimCode.resize(nChans);
+	physMin.resize(nChans);
+	physMax.resize(nChans);
+	digMin.resize(nChans);
+	digMax.resize(nChans);
+	memcpy(&physDimCode[0], p, 2*nChans); p += 2*nChans;
+	memcpy(&physMin[0], p, 8*nChans); p += 8*nChans;
+	memcpy(&physMax[0], p, 8*nChans); p += 8*nChans;
+	memcpy(&digMin[0], p, 8*nChans); p += 8*nChans;
+	memcpy(&digMax[0], p, 8*nChans); p += 8*nChans;
+	p += (68 + 4 + 4 + 4)*nChans;	// pre-filtering, lowpass, highpass, notch
+
+	std::vector<uint32_t> spr(nChans);
+	types.resize(nChans);
+	memcpy(&spr[0], p, 4*nChans); p += 4*nChans;
+	memcpy(&types[0], p, 4*nChans);
+
+	samplesPerRecord = spr[0];
+	chanOffset.resize(nChans);
+	chanSize.resize(nChans);
+	cal.resize(nChans);
+	off.resize(nChans);
+	recordSize = 0;
+	for (int i=0;i<nChans;i++) {
+		double minV, maxV;
+		if (spr[i] != (uint32_t) samplesPerRecord || samplesPerRecord <= 0) {
+			error = "channels with different numbers of samples per record are not supported";
+			close();
+			return false;
+		}
+		chanSize[i] = GDF_Writer::getSizeAndRangeByType((GDF_Type) types[i], minV, maxV);
+		if (chanSize[i] == 0) {
+			error = "unsupported data type";
+			close();
+			return false;
+		}
+		chanOffset[i] = recordSize;
+		recordSize += samplesPerRecord*chanSize[i];
+
+		if (digMax[i] != digMin[i]) {
+			cal[i] = (physMax[i] - physMin[i]) / (digMax[i] - digMin[i]);
+			off[i] = physMin[i] - digMin[i]*cal[i];
+		} else {
+			cal[i] = 1.0;
+			off[i] = 0.0;
+		}
+	}
+
+	// the duration of a record is durDataRecord[0]/durDataRecord[1] seconds
+	fSample = (hdr.durDataRecord[0] > 0) ? samplesPerRecord * (double) hdr.durDataRecord[1] / hdr.durDataRecord[0] : 0.0;
+
+	if (fseeko(fp, 0, SEEK_END) != 0) {
+		error = "could not determine file size";
+		close();
+		return false;
+	}
+	int64_t fileSize = ftello(fp);
+	int64_t available = (fileSize > dataOffset) ? (fileSize - dataOffset) / recordSize : 0;
+	eventRate = fSample;
+
+	if (hdr.numDataRecords >= 0 && hdr.numDataRecords <= available) {
+		nRecords = hdr.numDataRecords;
+		int64_t eventPos = dataOffset + nRecords*recordSize;
+		if (fileSize - eventPos >= 8 && !readEventTable(eventPos, fileSize - eventPos)) {
+			close();
+			return false;
+		}
+	} else {
+		// still being written, or truncated
+		nRecords = available;
+	}
+	nSamples = nRecords * samplesPerRecord;
+
+#ifndef WIN32
+	if (fileSize > 0 && (uint64_t) fileSize <= (uint64_t) ((size_t) -1)) {
+		void *m = mmap(NULL, (size_t) fileSize, PROT_READ, MAP_SHARED, fileno(fp), 0);
+		if (m != MAP_FAILED) {
+			map = (char *) m;
+			mapSize = fileSize;
+		}
+	}
+#endif
+	return true;
+}
+
+/* GDF 2.x event table: mode, number of events (24 bit), sampling rate (float),
+   then the positions (1-based) and types, and for mode 3 also the channels
+   and durations. */
+bool GDF_Reader::readEventTable(int64_t pos, int64_t size) {
+	unsigned char head[8];
+	float rate;
+
+	if (fseeko(fp, pos, SEEK_SET) != 0 || fread(head, 8, 1, fp) != 1) {
+		error = "could not read event table";
+		return false;
+	}
+	int mode = head[0];
+	int num = head[1] | (head[2] << 8) | (head[3] << 16);
+	memcpy(&rate, head+4, 4);
+
+	if ((mode != 1 && mode != 3) || 8 + (int64_t) num * ((mode == 3) ? 12 : 6) > size) {
+		error = "invalid event table";
+		return false;
+	}
+	if (rate > 0) eventRate = rate;
+	if (num == 0) return true;
+
+	std::vector<uint32_t> position(num), duration(num, 0);
+	std::vector<uint16_t> type(num), channel(num, 0);
+	bool ok = fread(&position[0], 4, num, fp) == (size_t) num && fread(&type[0], 2, num, fp) == (size_t) num;
+	if (ok && mode == 3) {
+		ok = fread(&channel[0], 2, num, fp) == (size_t) num && fread(&duration[0], 4, num, fp) == (size_t) num;
+	}
+	if (!ok) {
+		error = "could not read event table";
+		return false;
+	}
+
+	events.resize(num);
+	for (int i=0;i<num;i++) {
+		events[i].sample = (int64_t) position[i] - 1;
+		events[i].type = type[i];
+		events[i].channel = channel[i];
+		events[i].duration = duration[i];
+	}
+	// the table is usually in order already, the stable sort keeps the order of simultaneous events
+	std::stable_sort(events.begin(), events.end(), compareEvents);
+	for (int i=0;i<num;i++) eventsByType[events[i].type].push_back(i);
+	return true;
+}
+
+int GDF_Reader::findEvents(int64_t begin, int64_t end, int& first) const {
+	GDF_Event b, e;
+	b.sample = begin;
+	e.sample = end;
+	std::vector<GDF_Event>::const_iterator lo = std::lower_bound(events.begin(), events.end(), b, compareEvents);
+	std::vector<GDF_Event>::const_iterator hi = std::lower_bound(lo, events.end(), e, compareEvents);
+	first = (int) (lo - events.begin());
+	return (int) (hi - lo);
+}
+
+const std::vector<int>& GDF_Reader::getEventsOfType(uint16_t type) const {
+	std::map<uint16_t, std::vector<int> >::const_iterator it = eventsByType.find(type);
+	return (it == eventsByType.end()) ? noEvents : it->second;
+}
+
+int64_t GDF_Reader::readSamples(int64_t begin, int64_t end, int nSel, const int *chans, double *dest, bool scale) {
+	return readSamplesT(begin, end, nSel, chans, dest, scale);
+}
+
+int64_t GDF_Reader::readSamples(int64_t begin, int64_t end, int nSel, const int *chans, float *dest, bool scale) {
+	return readSamplesT(begin, end, nSel, chans, dest, scale);
+}
+
+template <typename T>
+int64_t GDF_Reader::readSamplesT(int64_t begin, int64_t end, int nSel, const int *chans, T *dest, bool scale) {
+	if (fp == NULL) {
+		error = "no file opened";
+		return -1;
+	}
+	if (begin < 0 || end > nSamples || begin > end) {
+		error = "invalid range of samples";
+		return -1;
+	}
+	if (chans == NULL) nSel = nChans;
+
+	std::vector<int> sel(nSel), offsets(nSel);
+	std::vector<double> c(nSel), o(nSel);
+	bool uniform = true, consecutive = true;
+	for (int j=0;j<nSel;j++) {
+		int ch = (chans == NULL) ? j : chans[j];
+		if (ch < 0 || ch >= nChans) {
+			error = "invalid channel";
+			return -1;
+		}
+		sel[j] = ch;
+		offsets[j] = chanOffset[ch];
+		c[j] = scale ? cal[ch] : 1.0;
+		o[j] = scale ? off[ch] : 0.0;
+		if (types[ch] != types[sel[0]] || chanOffset[ch] % chanSize[ch] != 0) uniform = false;
+		if (ch != sel[0] + j) consecutive = false;
+	}
+	int64_t n = end - begin;
+	if (n == 0 || nSel == 0) return n;
+
+	int64_t r0 = begin / samplesPerRecord;
+	int64_t r1 = (end - 1) / samplesPerRecord + 1;
+	size_t bytes = (size_t) ((r1 - r0) * recordSize);
+	const char *rec;
+
+	if (map != NULL) {
+		rec = map + dataOffset + r0*recordSize;
+#ifndef WIN32
+		// start reading all pages of the request at once instead of faulting them in one by one
+		size_t page = (size_t) sysconf(_SC_PAGESIZE);
+		size_t skip = (size_t) (rec - map) % page;
+		madvise((void *) (rec - skip), bytes + skip, MADV_WILLNEED);
+#endif
+	} else {
+		fallback.resize(bytes);
+		if (fseeko(fp, dataOffset + r0*recordSize, SEEK_SET) != 0 || fread(&fallback[0], 1, bytes, fp) != bytes) {
+			error = "could not read samples";
+			return -1;
+		}
+		rec = &fallback[0];
+	}
+
+	if (samplesPerRecord == 1 && uniform && recordSize % chanSize[sel[0]] == 0) {
+		convertRowsByType(types[sel[0]], rec, recordSize, n, nSel, &offsets[0], consecutive, dest, &c[0], &o[0]);
+		return n;
+	}
+
+	// otherwise convert the channels one by one, in blocks of records that stay in the cache
+	int64_t blockRecords = GDF_READER_BLOCK / recordSize;
+	if (blockRecords < 1) blockRecords = 1;
+	for (int64_t rb = r0; rb < r1; rb += blockRecords) {
+		int64_t sBeg = std::max(begin, rb*samplesPerRecord);
+		int64_t sEnd = std::min(end, (rb + blockRecords)*samplesPerRecord);
+		const char *block = rec + (rb - r0)*recordSize;
+		T *out = dest + (sBeg - begin)*nSel;
+
+		for (int j=0;j<nSel;j++) {
+			int ch = sel[j];
+			if (samplesPerRecord == 1) {
+				convertChannel(types[ch], block + chanOffset[ch], recordSize, sEnd - sBeg, out + j, nSel, c[j], o[j]);
+				continue;
+			}
+			// runs of consecutive samples within each record
+			int64_t s = sBeg;
+			while (s < sEnd) {
+				int64_t r = s / samplesPerRecord;
+				int64_t i = s - r*samplesPerRecord;
+				int64_t m = std::min(sEnd - s, samplesPerRecord - i);
+				const char *src = rec + (r - r0)*recordSize + chanOffset[ch] + i*chanSize[ch];
+				convertChannel(types[ch], src, chanSize[ch], m, out + (s - sBeg)*nSel + j, nSel, c[j], o[j]);
+				s += m;
+			}
+		}
+	}
+	return n;
+}
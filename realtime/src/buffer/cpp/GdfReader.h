@@ -0,0 +1,133 @@
+/** Simple C++ class for reading GDF 2.x files, such as the ones written by
+	GDF_Writer and GDF_BackgroundWriter.
+	WARNING: This will only work on little-endian machines!
+
+	Copyright (C) 2017, Robert Oostenveld
+	Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+*/
+
+#ifndef __GdfReader_h
+#define __GdfReader_h
+
+#include <GdfWriter.h>
+#include <vector>
+#include <string>
+#include <map>
+
+/** One entry of the event table. The sample is counted from 0, unlike in the
+	file, and channel and duration are 0 if the table does not contain them.
+*/
+struct GDF_Event {
+	int64_t sample;
+	uint16_t type;
+	uint16_t channel;
+	uint32_t duration;
+};
+
+/** Reads the header when a file is opened, memory-maps the records, and keeps
+	the events sorted by sample, with an additional index per type, so that
+	looking up a range of samples or events does not scan the file. Where the
+	file cannot be mapped (e.g. on Windows), only the records of every request
+	are read.
+
+	All channels must have the same number of samples per record, which is 1
+	for the files of GDF_Writer. If the number of records in the header is
+	unknown (-1) or larger than the file, it follows from the size of the file,
+	so a file that is still being written can be read, but then without events.
+*/
+class GDF_Reader {
+	public:
+
+	GDF_Reader();
+	~GDF_Reader();
+
+	/** Opens the file and reads the header and the event table, returns false
+		on error, see getError().
+	*/
+	bool open(const char *filename);
+
+	void close();
+
+	bool isOpen() const { return fp != NULL; }
+
+	/** Reason why open() or readSamples() failed */
+	const char *getError() const { return error.c_str(); }
+
+	int getNumChannels() const { return nChans; }
+	int64_t getNumSamples() const { return nSamples; }
+	double getSampleRate() const { return fSample; }
+
+	const std::string& getLabel(int channel) const { return labels[channel]; }
+	GDF_Type getType(int channel) const { return (GDF_Type) types[channel]; }
+	int getPhysDimCode(int channel) const { return physDimCode[channel]; }
+	double getPhysicalMin(int channel) const { return physMin[channel]; }
+	double getPhysicalMax(int channel) const { return physMax[channel]; }
+	double getDigitalMin(int channel) const { return digMin[channel]; }
+	double getDigitalMax(int channel) const { return digMax[channel]; }
+
+	/** Physical values are calibration*digital + offset */
+	double getCalibration(int channel) const { return cal[channel]; }
+	double getOffset(int channel) const { return off[channel]; }
+
+	/** Reads the samples begin to end-1 of the given channels (0..N-1), or of
+		all channels if chans is NULL, into dest, in the same order as for
+		GDF_Writer::addSamples: all selected channels of the first sample, then
+		of the second sample, and so on. The values are converted to physical
+		units unless scale is false. Returns the number of samples, or -1 on
+		error.
+	*/
+	int64_t readSamples(int64_t begin, int64_t end, int nSel, const int *chans, double *dest, bool scale = true);
+	int64_t readSamples(int64_t begin, int64_t end, int nSel, const int *chans, float *dest, bool scale = true);
+
+	/** The events, sorted by sample */
+	int getNumEvents() const { return (int) events.size(); }
+	const GDF_Event& getEvent(int i) const { return events[i]; }
+
+	/** Sampling rate of the event table, usually the same as getSampleRate() */
+	double getEventSampleRate() const { return eventRate; }
+
+	/** Returns the number of events with begin <= sample < end, and the index of
+		the first of them in first.
+	*/
+	int findEvents(int64_t begin, int64_t end, int& first) const;
+
+	/** Indices of the events of the given type, in order of their sample */
+	const std::vector<int>& getEventsOfType(uint16_t type) const;
+
+	GDF_Header hdr;
+
+	protected:
+
+	template <typename T>
+	int64_t readSamplesT(int64_t begin, int64_t end, int nSel, const int *chans, T *dest, bool scale);
+
+	bool readEventTable(int64_t pos, int64_t size);
+
+	std::string error;
+	FILE *fp;
+	char *map;			// the whole file, or NULL if it is not mapped
+	int64_t mapSize;
+	std::vector<char> fallback;	// records of the current request if the file is not mapped
+
+	int nChans;
+	int samplesPerRecord;
+	int64_t nRecords, nSamples;
+	int64_t dataOffset;		// file position of the first record
+	int recordSize;			// bytes per record
+	double fSample;
+
+	std::vector<std::string> labels;
+	std::vector<uint16_t> physDimCode;
+	std::vector<double> physMin, physMax, digMin, digMax;
+	std::vector<double> cal, off;
+	std::vector<uint32_t> types;
+	std::vector<int> chanOffset;	// position of the samples of each channel in a record
+	std::vector<int> chanSize;	// bytes per sample of each channel
+
+	std::vector<GDF_Event> events;
+	std::map<uint16_t, std::vector<int> > eventsByType;
+	std::vector<int> noEvents;
+	double eventRate;
+};
+
+#endif
@@ -9,6 +9,13 @@
 #define _USE_MATH_DEFINES
 #include <math.h>
 #include <float.h>
+#include <stdlib.h>
+
+#ifndef WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#endif
 
 
 GDF_Writer::GDF_Writer(int nChans, int sampleRate, GDF_Type gdfType) {
@@ -45,6 +52,11 @@ GDF_Writer::GDF_Writer(int nChans, int sampleRate, GDF_Type gdfType) {
 
 	nSamplesWritten = 0;
 	fp = NULL;
+	fd = -1;
+	chunk = NULL;
+	chunkSize = chunkFill = 0;
+	preallocSize = 0;
+	updateSamples = 0;
 
 	bytesPerSample = nChans * getSizeAndRangeByType(gdfType, minV, maxV);
 
@@ -86,10 +98,77 @@ GDF_Writer::~GDF_Writer() {
 	delete[] mGdfType;
 	delete[] mSensorPosition;
 	delete[] mSensorDescr;
+	close();
+	free(chunk);
+}
+
+bool GDF_Writer::setLargeBlockMode(unsigned int chunkSize, int64_t preallocSize, double updateSeconds) {
+#ifdef WIN32
+	return (chunkSize == 0);
+#else
+	if (fp != NULL) return false;
+	free(chunk);
+	chunk = NULL;
+	// a chunk holds at least one sample
+	if (chunkSize > 0 && chunkSize < (unsigned int) bytesPerSample) chunkSize = bytesPerSample;
+	if (chunkSize > 0) {
+		chunk = (char *) malloc(chunkSize);
+		if (chunk == NULL) chunkSize = 0;
+	}
+	this->chunkSize = chunkSize;
+	this->preallocSize = (preallocSize > 0) ? preallocSize : 0;
+	updateSamples = (int64_t) (updateSeconds * hdr.durDataRecord[1]);
+	if (updateSamples < 1) updateSamples = 1;
+	return (chunk != NULL || chunkSize == 0);
+#endif
+}
+
+bool GDF_Writer::copySettings(const GDF_Writer& other) {
+	if (fp != NULL || other.nChans != nChans) return false;
+
+	hdr = other.hdr;
+	hdr.numDataRecords = 0;
+	bytesPerSample = other.bytesPerSample;
+	memcpy(mLabels, other.mLabels, 16*nChans);
+	memcpy(mTypes, other.mTypes, 80*nChans);
+	memcpy(mPhysDim, other.mPhysDim, 6*nChans);
+	memcpy(mPhysDimCode, other.mPhysDimCode, sizeof(uint16_t)*nChans);
+	memcpy(mPhysMin, other.mPhysMin, sizeof(double)*nChans);
+	memcpy(mPhysMax, other.mPhysMax, sizeof(double)*nChans);
+	memcpy(mDigMin, other.mDigMin, sizeof(double)*nChans);
+	memcpy(mDigMax, other.mDigMax, sizeof(double)*nChans);
+	memcpy(mPreFiltering, other.mPreFiltering, 68*nChans);
+	memcpy(mLowpass, other.mLowpass, sizeof(float)*nChans);
+	memcpy(mHighpass, other.mHighpass, sizeof(float)*nChans);
+	memcpy(mNotch, other.mNotch, sizeof(float)*nChans);
+	memcpy(mSamplesPerRecord, other.mSamplesPerRecord, sizeof(uint32_t)*nChans);
+	memcpy(mGdfType, other.mGdfType, sizeof(uint32_t)*nChans);
+	memcpy(mSensorPosition, other.mSensorPosition, 3*sizeof(float)*nChans);
+	memcpy(mSensorDescr, other.mSensorDescr, sizeof(GDF_SensorDescription)*nChans);
+
+	if (other.chunkSize == 0) return setLargeBlockMode(0);
+	return setLargeBlockMode(other.chunkSize, other.preallocSize, (double) other.updateSamples / hdr.durDataRecord[1]);
 }
 
 int GDF_Writer::createAndWriteHeader(const char *filename) {
 	nSamplesWritten = 0;
+#ifndef WIN32
+	if (chunkSize > 0) {
+		// the header is still written through stdio, the samples directly
+		fd = open(filename, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+		if (fd < 0) return 0;
+		fp = fdopen(fd, "wb");
+		if (fp == NULL) {
+			::close(fd);
+			fd = -1;
+			return 0;
+		}
+		chunkFill = 0;
+		samplesInChunk = 0;
+		chunkOffset = preallocEnd = 256*(1+nChans);
+		prevSize = 0;
+	} else
+#endif
 	fp = fopen(filename, "wb");
 	if (fp==NULL) return 0;
 
@@ -119,17 +198,108 @@ int GDF_Writer::addSamples(int nSamples, const void *data) {
 	int nw;
 	if (fp==NULL) return 0;
 
+	if (fd >= 0) {
+		const char *ptr = (const char *) data;
+		for (nw = 0; nw < nSamples; nw++) {
+			if (chunkFill + bytesPerSample > chunkSize) {
+				if (!flushChunk()) break;
+			}
+			memcpy(chunk + chunkFill, ptr, bytesPerSample);
+			chunkFill += bytesPerSample;
+			samplesInChunk++;
+			ptr += bytesPerSample;
+			nSamplesWritten++;
+		}
+		if (samplesInChunk >= updateSamples) flushChunk();
+		return nw;
+	}
+
 	nw = fwrite(data, bytesPerSample, nSamples, fp);
 	nSamplesWritten += nw;
 
 	return nw;
 }
 
+/* Writes the chunk at its place in the file, and then the number of records in the
+   header, which then only counts samples that have been handed to the OS. */
+int GDF_Writer::flushChunk() {
+#ifndef WIN32
+	unsigned int done = 0;
+
+	if (chunkFill == 0) return 1;
+
+#ifdef FALLOC_FL_KEEP_SIZE
+	if (preallocSize > 0 && chunkOffset + chunkFill > preallocEnd) {
+		// the file does not grow here, so it never contains more than the samples written so far
+		int64_t len = preallocSize;
+		while (preallocEnd + len < chunkOffset + chunkFill) len += preallocSize;
+		if (fallocate(fd, FALLOC_FL_KEEP_SIZE, preallocEnd, len) == 0) {
+			preallocEnd += len;
+		} else {
+			// not supported by the file system, do not try again
+			preallocSize = 0;
+		}
+	}
+#endif
+
+	while (done < chunkFill) {
+		ssize_t n = pwrite(fd, chunk + done, chunkFill - done, chunkOffset + done);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) {
+			perror("GDF_Writer: could not write samples");
+			return 0;
+		}
+		done += n;
+	}
+
+#ifdef SYNC_FILE_RANGE_WRITE
+	// start writing back this chunk now, and wait for the previous one, so that the
+	// dirty pages do not pile up. The previous chunk is then dropped from the cache.
+	sync_file_range(fd, chunkOffset, chunkFill, SYNC_FILE_RANGE_WRITE);
+	if (prevSize > 0) {
+		sync_file_range(fd, prevOffset, prevSize, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+		posix_fadvise(fd, prevOffset, prevSize, POSIX_FADV_DONTNEED);
+	}
+#endif
+	prevOffset   = chunkOffset;
+	prevSize     = chunkFill;
+	chunkOffset += chunkFill;
+	chunkFill = 0;
+	samplesInChunk = 0;
+
+	writeRecordCount((chunkOffset - 256*(1+nChans)) / bytesPerSample);
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+int GDF_Writer::writeRecordCount(int64_t numRecords) {
+#ifndef WIN32
+	return pwrite(fd, &numRecords, 8, 236) == 8;
+#else
+	return 0;
+#endif
+}
+
 int GDF_Writer::close() {
 	int nw;
 
 	if (fp==NULL) return 0;
 
+#ifndef WIN32
+	if (fd >= 0) {
+		flushChunk();
+		nw = writeRecordCount(nSamplesWritten);
+		// give back the space that was preallocated beyond the last sample
+		if (preallocEnd > chunkOffset && ftruncate(fd, chunkOffset) != 0) perror("GDF_Writer: could not truncate file");
+		fclose(fp);
+		fp = NULL;
+		fd = -1;
+		return nw;
+	}
+#endif
+
 	fseek(fp, 236, SEEK_SET);
 	nw = fwrite(&nSamplesWritten, 8, 1, fp);
 	fclose(fp);
@@ -147,6 +147,21 @@ class GDF_Writer {
 	/** Update the sample counter (=number of records) and close the file */
 	int close();
 
+	/** Write the samples in chunks of chunkSize bytes, with a single system call per chunk,
+		instead of through stdio. The file is preallocated in extents of preallocSize bytes,
+		and the number of records in the header is updated after every chunk, so that the file
+		stays valid if the program is killed. A partial chunk is written after updateSeconds
+		worth of samples. A chunkSize of 0 switches back to stdio. This must be called before
+		createAndWriteHeader, and returns false if it is not supported on this platform.
+	*/
+	bool setLargeBlockMode(unsigned int chunkSize, int64_t preallocSize = 256*1024*1024, double updateSeconds = 10.0);
+
+	/** Copy the header, the settings of all channels and the large-block mode of another
+		writer with the same number of channels, e.g. to prepare the next file of a
+		recording. This must be called before createAndWriteHeader.
+	*/
+	bool copySettings(const GDF_Writer& other);
+
 	void setPhysicalLimits(int channel, double minV, double maxV) {
 		mPhysMin[channel] = minV;
 		mPhysMax[channel] = maxV;
@@ -212,6 +227,19 @@ class GDF_Writer {
 	GDF_SensorDescription *mSensorDescr;
 
 	int64_t nSamplesWritten;
+
+	// for setLargeBlockMode
+	int flushChunk();
+	int writeRecordCount(int64_t numRecords);
+
+	int fd;
+	char *chunk;
+	unsigned int chunkSize, chunkFill;
+	int64_t chunkOffset;	// file position of the chunk
+	int64_t prevOffset;		// and of the previous chunk, which is being written back
+	unsigned int prevSize;
+	int64_t preallocSize, preallocEnd;
+	int64_t updateSamples, samplesInChunk;
 };
 
 #endif
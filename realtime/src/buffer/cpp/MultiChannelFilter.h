@@ -18,6 +18,14 @@
 /** Templated class for IIR filtering of a multi-channel signal.
     Tex is the type of the externally used signal (say, "float").
 	Tin is the internally used type for the filter states (say, "double").
+
+	The Butterworth filters (setButterLP, setButterHP, setButterBP) and notch
+	filters (addNotch) are run as a cascade of second-order sections, which
+	stays accurate at high orders. Their states are kept per section with all
+	channels next to each other, so that the loops over the channels can be
+	vectorized by the compiler. Blocks of samples are processed in groups of
+	channels that fit in the cache together with their states. Coefficients
+	that are given with setCoefficients are run in direct form instead.
 */
 
 template <typename Tex, typename Tin> 
@@ -34,9 +42,20 @@ class MultiChannelFilter {
 	// Calculate Butterworth highpass filter coefficients
 	// from normalised cutoff frequency (0<cutoff<1=Fnyquist)
 	void setButterHP(double cutoff); 
+	// Calculate Butterworth bandpass filter coefficients from
+	// normalised cutoff frequencies, as a cascade of a highpass
+	// and lowpass filter of the given order each
+	void setButterBP(double low, double high);
+	// Add a notch filter at the normalised frequency, with the given
+	// normalised bandwidth (-3 dB), after the current filter. A direct form
+	// filter from setCoefficients becomes the first section, this returns
+	// false and leaves the filter as it is if that has more than 2 poles or zeros
+	bool addNotch(double freq, double bandwidth);
 	
 	// Copy coefficients. A and B must point to 1+order doubles
 	void setCoefficients(const double *B, const double *A) {
+		nSections = 0;
+		sosEnabled = false;
 		if (A[0]==1.0) {
 			for (int i=0;i<=order;i++) {
 				this->B[i] = B[i];
@@ -50,9 +69,27 @@ class MultiChannelFilter {
 		}
 	}
 	
+	// Use the given second-order sections instead, SOS points to num rows
+	// of b0 b1 b2 a0 a1 a2 (as returned by MATLAB's zp2sos)
+	void setSOS(int num, const double *sos);
+	
+	// Number of second-order sections that are currently used
+	int getNumSections() const {
+		return sosEnabled ? nSections : 0;
+	}
+	
+	// Set the states of the sections to their steady state for a constant
+	// input x (with nChans values), this suppresses the transient at the
+	// start of a signal. The states of direct form filters are cleared.
+	void setSteadyState(const Tex *x);
+	
 	// Run single input sample through filter without computing
 	// output. This is mostly useful for downsampling purposes.
 	void process(const Tex *source) {
+		if (sosEnabled) {
+			processSections(1, NULL, source);
+			return;
+		}
 		for (int j=0;j<=order;j++) {
 			z[j] = states + pos*nChans;
 			if (++pos>order) pos=0;
@@ -68,6 +105,10 @@ class MultiChannelFilter {
 	// Run single input sample through filter and write output
 	// to "dest". Both source and dest must point to an nChans-array of T.
 	void process(Tex *dest, const Tex *source) {
+		if (sosEnabled) {
+			processSections(1, dest, source);
+			return;
+		}
 		process(source);
 		tvmSetScaledVector<Tex,double,Tin>(dest, B[0], z[0], nChans);
 		for (int j=1;j<=order;j++) {
@@ -77,6 +118,10 @@ class MultiChannelFilter {
 	
 	// Process multiple samples and write output to "dest"
 	void process(int nSamples, Tex *dest, const Tex *source) {
+		if (sosEnabled) {
+			processSections(nSamples, dest, source);
+			return;
+		}
 		for (int i=0;i<nSamples;i++) {
 			process(dest + i*nChans, source + i*nChans);
 		}
@@ -87,10 +132,25 @@ class MultiChannelFilter {
 	
 	protected:
 	
+	// number of channels that are filtered together, see processSections
+	enum { TILE = 64 };
+	
+	void setSections(int num);
+	void setButterSections(int first, double cutoff, bool highpass);
+	void processSections(int nSamples, Tex *dest, const Tex *source);
+	
 	Tin **z;
 	Tin *states;
 	double *B, *A;
 	int order, nChans, pos;
+	
+	// the second-order sections, each with b0 b1 b2 a1 a2
+	Tin *sos;
+	// for each section the two states of all channels
+	Tin *sosStates;
+	Tin work[TILE];
+	int nSections, maxSections;
+	bool sosEnabled;
 };
 
 template <typename Tex, typename Tin> 
@@ -100,12 +160,17 @@ MultiChannelFilter<Tex,Tin>::MultiChannelFilter(int nChans, int order) {
 	this->pos = 0;
 
 	states = new Tin[nChans*(1+order)];
+	sos = NULL;
+	sosStates = NULL;
+	nSections = maxSections = 0;
+	sosEnabled = false;
 	clear();
 	B = new double[1+order];
 	A = new double[1+order];
 	z = new Tin*[1+order];
 	B[0] = 1.0;
 	A[0] = 1.0;
+	for (int i=1;i<=order;i++) A[i]=B[i]=0.0;
 }
 
 template <typename Tex, typename Tin> 
@@ -114,44 +179,60 @@ MultiChannelFilter<Tex,Tin>::~MultiChannelFilter() {
 	delete[] A;
 	delete[] B;
 	delete[] z;
+	delete[] sos;
+	delete[] sosStates;
 }
 
 template <typename Tex, typename Tin> 
 void MultiChannelFilter<Tex,Tin>::clear() {
 	for (int i=0;i<nChans*(1+order);i++) states[i]=0;
+	for (int i=0;i<2*nSections*nChans;i++) sosStates[i]=0;
 	pos = 0;
 }
 
+// Resize the cascade to num sections, the states of the existing
+// sections are kept and those of new sections are cleared
 template <typename Tex, typename Tin> 
-void MultiChannelFilter<Tex,Tin>::setButterLP(double cutoff) {
-	int n;
-		
+void MultiChannelFilter<Tex,Tin>::setSections(int num) {
+	if (num > maxSections) {
+		Tin *newSos    = new Tin[5*num];
+		Tin *newStates = new Tin[2*num*nChans];
+		for (int i=0;i<5*nSections;i++) newSos[i] = sos[i];
+		for (int i=0;i<2*nSections*nChans;i++) newStates[i] = sosStates[i];
+		delete[] sos;
+		delete[] sosStates;
+		sos = newSos;
+		sosStates = newStates;
+		maxSections = num;
+	}
+	for (int i=2*nSections*nChans;i<2*num*nChans;i++) sosStates[i]=0;
+	nSections = num;
+	sosEnabled = true;
+}
+
+// Fill in the Butterworth sections of the given order from section "first" onwards
+template <typename Tex, typename Tin> 
+void MultiChannelFilter<Tex,Tin>::setButterSections(int first, double cutoff, bool highpass) {
 	// warping factor for bilinear transform
 	// number inside tan( ) is pi/2
 	double f = 1.0/tan(0.5*M_PI*cutoff);
-
-	// nominator is sth. like prodB0*[1 4 6 4 1] later
-	double prodB0;
-
-	// init coefficients with unit response
-	A[0] = 1.0;
-	B[0] = 1.0;
-	for (int i=1;i<=order;i++) A[i]=B[i]=0.0;
-	
-	// for safety: very high cutoff-frequency (almost Nyquist) -> unit response
-	if (cutoff > 0.95) return;
+	Tin *c = sos + 5*first;
+	int n;
 	
 	// if odd order, handle 1. pole separately
 	if (order & 1) {
-		prodB0 = 1.0/(1.0+f);
-		A[1] = (1-f)/(1.0+f);
-		B[1] = 1.0;
+		double g = highpass ? f/(1.0+f) : 1.0/(1.0+f);
+		c[0] = (Tin) g;
+		c[1] = (Tin) (highpass ? -g : g);
+		c[2] = 0;
+		c[3] = (Tin) ((1-f)/(1.0+f));
+		c[4] = 0;
+		c += 5;
 		n=1;
 	} else {
-		prodB0 = 1.0;
 		n=0;
-	}	
-
+	}
+	
 	// add 2 poles at a time (complex conjugates)
 	for (int i=n;i<order;i+=2) {
 		// location of pole on analog unit circle
@@ -165,71 +246,162 @@ void MultiChannelFilter<Tex,Tin>::setButterLP(double cutoff) {
 		// 1 + 2z^-1 + z-^2
 		// --------------------------------------------
 		// (1+qf+f^2) + (2-2f^2)*z-^1 + (1-qf+f^2)*z-^2
+		//
+		// for the highpass, the nominator is f^2*(1 - 2z^-1 + z^-2)
 		double b0 = 1.0/(1.0 + q*f + f*f);
-		//double b1 = 2.0*b0; 
-		//double b2 = b0;
-		//double a0 = 1.0;
-		double a1 = (2.0-2.0*f*f)*b0;
-		double a2 = (1.0-q*f+f*f)*b0;
-		// convolve A by [a0 a1 a2] and B by b0*[1 2 1]
-		// we can do this in place if we start at the back
-		for (int j=i;j>=0;j--) {
-			A[j+2] += a2*A[j];
-			A[j+1] += a1*A[j];
-			B[j+2] += B[j];
-			B[j+1] += 2*B[j];
-		}
-		prodB0 *= b0;
+		double g  = highpass ? f*f*b0 : b0;
+		c[0] = (Tin) g;
+		c[1] = (Tin) (highpass ? -2.0*g : 2.0*g);
+		c[2] = (Tin) g;
+		c[3] = (Tin) ((2.0-2.0*f*f)*b0);
+		c[4] = (Tin) ((1.0-q*f+f*f)*b0);
+		c += 5;
 	}
-	for (int i=0;i<=order;i++) B[i] *= prodB0;
 }
 
 template <typename Tex, typename Tin> 
-void MultiChannelFilter<Tex,Tin>::setButterHP(double cutoff) {
-	int n;
-	
-	// see setButterLP for explanation
-	double f = 1.0/tan(0.5*M_PI*cutoff);
-	double prodB0;
+void MultiChannelFilter<Tex,Tin>::setButterLP(double cutoff) {
+	// for safety: very high cutoff-frequency (almost Nyquist) -> unit response
+	if (cutoff > 0.95 || order == 0) {
+		setSections(0);
+		return;
+	}
+	setSections((order+1)/2);
+	setButterSections(0, cutoff, false);
+}
 
-	// init coefficients with unit response
-	A[0] = 1.0;
-	B[0] = 1.0;
-	for (int i=1;i<=order;i++) A[i]=B[i]=0.0;
-	
+template <typename Tex, typename Tin> 
+void MultiChannelFilter<Tex,Tin>::setButterHP(double cutoff) {
 	// for safety: very low cutoff-frequency -> unit response
-	if (cutoff < 0.001) return;
+	if (cutoff < 0.001 || order == 0) {
+		setSections(0);
+		return;
+	}
+	setSections((order+1)/2);
+	setButterSections(0, cutoff, true);
+}
+
+template <typename Tex, typename Tin> 
+void MultiChannelFilter<Tex,Tin>::setButterBP(double low, double high) {
+	int n = (order+1)/2;
+	int num = 0;
 	
-	// if odd order, handle 1. pole separately
-	if (order & 1) {
-		prodB0 = f/(1.0+f);
-		A[1] = (1-f)/(1.0+f);
-		B[1] = -1.0;
-		n=1;
-	} else {
-		prodB0 = 1.0;
-		n=0;
-	}	
+	// either side is left out if its cutoff is outside of the safe range, see above
+	if (order > 0 && low >= 0.001) num += n;
+	if (order > 0 && high <= 0.95) num += n;
+	setSections(num);
+	if (order > 0 && low >= 0.001) setButterSections(0, low, true);
+	if (order > 0 && high <= 0.95) setButterSections(num-n, high, false);
+}
 
-	// add 2 poles at a time (complex conjugates)
-	for (int i=n;i<order;i+=2) {
-		double ang = M_PI * (1.0 - (double)(i+1)/(double)(2*order));
-		double q = -2.0*cos(ang);
+template <typename Tex, typename Tin> 
+bool MultiChannelFilter<Tex,Tin>::addNotch(double freq, double bandwidth) {
+	// (1 - 2cos(w0)z^-1 + z^-2) / ((1+alpha) - 2cos(w0)z^-1 + (1-alpha)z^-2)
+	// has its zeros on the unit circle at w0, and is 3 dB down at a distance
+	// of bandwidth/2 on either side if alpha = tan(bandwidth/2)
+	double w0 = M_PI*freq;
+	double alpha = tan(0.5*M_PI*bandwidth);
+	double a0 = 1.0 + alpha;
+	Tin *c;
 	
-		double b0 = 1.0/(1.0 + q*f + f*f);
-		double a1 = (2.0-2.0*f*f)*b0;
-		double a2 = (1.0-q*f+f*f)*b0;
-		for (int j=i;j>=0;j--) {
-			A[j+2] += a2*A[j];
-			A[j+1] += a1*A[j];
-			B[j+2] += B[j];
-			B[j+1] -= 2*B[j];
+	if (!sosEnabled) {
+		// the direct form filter is run as the first section, its states are
+		// cleared, unless it is the unit response that the filter starts with
+		bool unit = (B[0] == 1.0);
+		for (int i=1;i<=order;i++) {
+			if (B[i] != 0.0 || A[i] != 0.0) unit = false;
+			if (i>2 && (B[i] != 0.0 || A[i] != 0.0)) return false;
+		}
+		setSections(unit ? 0 : 1);
+		if (!unit) {
+			for (int i=0;i<5;i++) sos[i] = 0;
+			for (int i=0;i<=order && i<=2;i++) sos[i] = (Tin) B[i];
+			for (int i=1;i<=order && i<=2;i++) sos[2+i] = (Tin) A[i];
 		}
-		prodB0 *= f*f*b0;
 	}
-	for (int i=0;i<=order;i++) B[i] *= prodB0;
+	setSections(nSections+1);
+	c = sos + 5*(nSections-1);
+	c[0] = (Tin) (1.0/a0);
+	c[1] = (Tin) (-2.0*cos(w0)/a0);
+	c[2] = (Tin) (1.0/a0);
+	c[3] = (Tin) (-2.0*cos(w0)/a0);
+	c[4] = (Tin) ((1.0 - alpha)/a0);
+	return true;
 }
 
+template <typename Tex, typename Tin> 
+void MultiChannelFilter<Tex,Tin>::setSOS(int num, const double *sos) {
+	setSections(num);
+	for (int k=0;k<num;k++) {
+		const double *r = sos + 6*k;
+		Tin *c = this->sos + 5*k;
+		c[0] = (Tin) (r[0]/r[3]);
+		c[1] = (Tin) (r[1]/r[3]);
+		c[2] = (Tin) (r[2]/r[3]);
+		c[3] = (Tin) (r[4]/r[3]);
+		c[4] = (Tin) (r[5]/r[3]);
+	}
+}
 
-#endif
+template <typename Tex, typename Tin> 
+void MultiChannelFilter<Tex,Tin>::setSteadyState(const Tex *x) {
+	if (!sosEnabled) {
+		clear();
+		return;
+	}
+	for (int i=0;i<nChans;i++) {
+		// input of the current section
+		double u = (double) x[i];
+		
+		for (int k=0;k<nSections;k++) {
+			const Tin *c = sos + 5*k;
+			Tin *s1 = sosStates + 2*k*nChans;
+			Tin *s2 = s1 + nChans;
+			// DC gain of the section, which is also the output for an input of one
+			double den = 1.0 + c[3] + c[4];
+			double g = (den != 0.0) ? (c[0] + c[1] + c[2])/den : 0.0;
+			
+			s1[i] = (Tin) ((g - c[0])*u);
+			s2[i] = (Tin) ((c[2] - c[4]*g)*u);
+			u *= g;
+		}
+	}
+}
 
+// Run the cascade of second-order sections (transposed direct form II)
+// over the samples. Dest can be equal to source, or NULL to only update
+// the states.
+template <typename Tex, typename Tin> 
+void MultiChannelFilter<Tex,Tin>::processSections(int nSamples, Tex *dest, const Tex *source) {
+	for (int c0=0;c0<nChans;c0+=TILE) {
+		int nc = (nChans-c0 < TILE) ? nChans-c0 : TILE;
+		
+		for (int t=0;t<nSamples;t++) {
+			const Tex *x = source + t*nChans + c0;
+			Tin *v = work;
+			
+			for (int i=0;i<nc;i++) v[i] = (Tin) x[i];
+			for (int k=0;k<nSections;k++) {
+				const Tin *c = sos + 5*k;
+				const Tin b0 = c[0], b1 = c[1], b2 = c[2], a1 = c[3], a2 = c[4];
+				Tin *s1 = sosStates + 2*k*nChans + c0;
+				Tin *s2 = s1 + nChans;
+				
+				for (int i=0;i<nc;i++) {
+					Tin xi = v[i];
+					Tin yi = b0*xi + s1[i];
+					s1[i] = b1*xi - a1*yi + s2[i];
+					s2[i] = b2*xi - a2*yi;
+					v[i] = yi;
+				}
+			}
+			if (dest != NULL) {
+				Tex *y = dest + t*nChans + c0;
+				for (int i=0;i<nc;i++) y[i] = (Tex) v[i];
+			}
+		}
+	}
+}
+
+
+#endif
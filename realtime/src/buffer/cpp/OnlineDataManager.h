@@ -1,10 +1,20 @@
 #include <FtBuffer.h>
 #include <socketserver.h>
+#include <TemplateVectorMath.h>
 #include <MultiChannelFilter.h>
+#include <PolyphaseDecimator.h>
+#include <SlidingSpectrum.h>
+#include <ArtifactDetector.h>
 #include <StringServer.h>
 #include <GDF_BackgroundWriter.h>
 #include <SignalConfiguration.h>
+#include <LocalPipe.h>
+#include <atomicutil.h>
+#include <ftclock.h>
+#include <fttrace.h>
+#include <pthread.h>
 #include <assert.h>
+#include <vector>
 
 #ifndef __OnlineDataManager_h
 #define __OnlineDataManager_h
@@ -14,6 +24,17 @@
 
     The GDF_Type for writing to disk and the FieldTrip data type for streaming
     will be automatically deduced from these template parameters.
+
+    By default, handleBlock() streams and saves the block in the thread of the
+    acquisition driver. After enablePipeline(), the blocks are queued instead,
+    and streaming and saving are done by two worker threads. The driver thread
+    then only fills the slots of the queue, which does not take any locks. If
+    the workers do not keep up and the queue is full, the block is dropped.
+
+    After enableSpectrum(), the streaming thread also computes sliding spectra
+    of the streamed channels, and writes them to a named stream of the buffer.
+    After setArtifactDetector(), it marks the artifacts in the streamed channels
+    with events.
  */
 
 template <typename To, typename Ts>
@@ -42,8 +63,6 @@ public:
 
         pBlock = 0;
         allocSizeBlock = 0;
-        auxVec  = new Ts[nCont];
-        auxVec2 = new Ts[nCont];
 
         gdfPhysMin = new double[nStatus + nCont];
         gdfPhysMax = new double[nStatus + nCont];
@@ -87,26 +106,56 @@ public:
         }
 
         ftSocket = -1;
-        ftServer = 0;
 
         sampleCounter = 0;
+        streamOffset = 0;
         skipSamples = 0;
         skipSamples2 = 0;
 
         curWriter = 0;
+        savingChunkSize = 0;
+        savingMaxBytes = 1024*1024*1024;
+        savingMaxSeconds = 0.0;
+        batchMaxBytes = 0;
+        batchMaxDelay = 0.0;
+        pendingSince = 0.0;
         lpFilter = 0;
         lpFilter2 = 0;
+        firFilter = 0;
+        pendingConf = 0;
+        pendingLP = 0;
+        pendingFIR = 0;
+        spectrum = 0;
+        artifacts = 0;
+        artifactBase = 0;
+        numStreamed = 0;
+        blockReadTime = 0;
+        latencySum = latencyMax = 0.0;
+        latencyCount = 0;
+        spectrumMethod = 0;
+        spectrumNum = 0;
+        spectrumWindow = 0.0;
+        spectrumHop = 0.0;
 
         streamingEnabled = false;
         savingEnabled = false;
+
+        pthread_mutex_init(&streamMutex, NULL);
+        pthread_mutex_init(&saveMutex, NULL);
+        pthread_mutex_init(&latencyMutex, NULL);
+        slots = 0;
+        numSlots = 0;
+        curSlot = 0;
+        workerError = false;
     }
 
     virtual ~OnlineDataManager() {
         // TODO: some more of this
 
-        // stop buffer server, if spawned
-        if (ftServer) ft_stop_buffer_server(ftServer);
-        // FtConnection is cleaned up automatically, if needed
+        // stop the worker threads first, they may still be streaming or saving
+        disablePipeline();
+
+        // FtConnection is cleaned up automatically, if needed, and so is the buffer server if spawned
 
         // clean up GDF writer, if needed
         if (curWriter) {
@@ -116,8 +165,10 @@ public:
         // clean up variables
         delete lpFilter;
         delete lpFilter2;
-        delete[] auxVec;
-        delete[] auxVec2;
+        delete firFilter;
+        delete spectrum;
+        delete artifacts;
+        discardPendingStreaming();
         delete[] pBlock;
         delete[] gdfPhysMin;
         delete[] gdfPhysMax;
@@ -130,6 +181,9 @@ public:
             delete[] statusLabels;
         }
         delete sampleBlock;
+        pthread_mutex_destroy(&streamMutex);
+        pthread_mutex_destroy(&saveMutex);
+        pthread_mutex_destroy(&latencyMutex);
     }
 
     virtual std::string handleStringRequest(const std::string& request) {
@@ -177,7 +231,7 @@ public:
                      signalConf.getBandwidth(),
                      signalConf.getOrder());
 
-            return static_cast<std::string>(response);
+            return static_cast<std::string>(response) + pipelineStatus();
         } else {
             return unknown;
         }
@@ -207,19 +261,33 @@ public:
             }
             return ok;
         } else if (token2.compare("SELECT") == 0) {
-            if ((target==1 && streamingEnabled) || (target==2 && savingEnabled)) {
-                return stopFirst;
-            }
+            if (target==2 && savingEnabled) return stopFirst;
+
             ChannelSelection cs;
             if (!cs.parseString(request.size() - pos, request.data() + pos)) return malform;
             if (cs.getMaxIndex() >= nCont) return chanOutOfRange;
 
-            if (target==1) {
+            if (target==1 && streamingEnabled) {
+                // the new selection is swapped in by the streaming thread
+                SignalConfiguration cfg = getStreamingConfiguration();
+                cfg.setStreamingSelection(cs);
+                updateStreaming(cfg);
+            } else if (target==1) {
                 signalConf.setStreamingSelection(cs);
             } else {
                 signalConf.setSavingSelection(cs);
             }
             return ok;
+        } else if (target == 2 && token2.compare("ROTATE") == 0) {
+            // SAVE ROTATE megabytes seconds, 0 for no limit
+            double megabytes = 0.0, seconds = 0.0;
+            if (savingEnabled) return stopFirst;
+            if (!(convertToDouble(StringServer::getNextToken(request, pos), megabytes) && megabytes >= 0
+                  && convertToDouble(StringServer::getNextToken(request, pos), seconds) && seconds >= 0)) return malform;
+            if (!StringServer::getNextToken(request, pos).empty()) return malform;
+
+            setFileRotation((int64_t) (megabytes*1024*1024), seconds);
+            return ok;
         } else if (target == 2 && token2.compare("FILE") == 0) {
             if (savingEnabled) return stopFirst;
 
@@ -229,59 +297,144 @@ public:
             setFilename(filename);
             return ok;
         } else if (target == 1 && token2.compare("FILTER") == 0) {
-            if (streamingEnabled) return stopFirst;
-
             double bandwidth = 0.0;
             int order = 0;
             int factor = 0;
+            int numTaps = 0;
 
+            // the optional 4th argument selects the FIR decimator of that length
             if (convertToDouble(StringServer::getNextToken(request, pos), bandwidth)
                 && (bandwidth >= 0)
                 && convertToInt(StringServer::getNextToken(request, pos), order)
                 && (order >= 0)
                 && convertToInt(StringServer::getNextToken(request, pos), factor)
-                && (factor >= 1)
-                && StringServer::getNextToken(request, pos).empty()) {
+                && (factor >= 1)) {
+
+                std::string taps = StringServer::getNextToken(request, pos);
+                if (!taps.empty() && !(convertToInt(taps, numTaps) && numTaps >= 0)) return malform;
+                if (!StringServer::getNextToken(request, pos).empty()) return malform;
 
-                signalConf.setDownsampling(factor);
-                if (bandwidth < 0.5*fSample) {
-                    signalConf.setBandwidth(bandwidth);
-                    signalConf.setOrder(order);
+                if (streamingEnabled) {
+                    SignalConfiguration cfg = getStreamingConfiguration();
+                    setStreamingFilter(cfg, bandwidth, order, factor, numTaps);
+                    updateStreaming(cfg);
                 } else {
-                    signalConf.setOrder(0);
+                    setStreamingFilter(signalConf, bandwidth, order, factor, numTaps);
+                    configureStreaming();
                 }
-                configureStreaming();
-
                 return ok;
             } else {
                 return malform;
             }
+        } else if (target == 1 && token2.compare("SPECTRUM") == 0) {
+            // STREAM SPECTRUM name welch|multitaper|goertzel window hop num f1 f2 [f3 f4 ...], or STREAM SPECTRUM OFF
+            std::string name = StringServer::getNextToken(request, pos);
+            if (name.compare("OFF") == 0) {
+                if (!StringServer::getNextToken(request, pos).empty()) return malform;
+                disableSpectrum();
+                return ok;
+            }
+            std::string method = StringServer::getNextToken(request, pos);
+            double window = 0.0, hop = 0.0;
+            int num = 0, m;
+
+            if (method.compare("welch") == 0) {
+                m = SlidingSpectrum<Ts,double>::WELCH;
+            } else if (method.compare("multitaper") == 0) {
+                m = SlidingSpectrum<Ts,double>::MULTITAPER;
+            } else if (method.compare("goertzel") == 0) {
+                m = SlidingSpectrum<Ts,double>::GOERTZEL;
+            } else {
+                return malform;
+            }
+            if (!(convertToDouble(StringServer::getNextToken(request, pos), window)
+                && convertToDouble(StringServer::getNextToken(request, pos), hop)
+                && convertToInt(StringServer::getNextToken(request, pos), num)
+                && (num >= 1))) return malform;
+
+            std::vector<double> freqs((m == SlidingSpectrum<Ts,double>::GOERTZEL) ? 2*num : 2);
+            for (unsigned int i=0;i<freqs.size();i++) {
+                if (!convertToDouble(StringServer::getNextToken(request, pos), freqs[i])) return malform;
+            }
+            if (!StringServer::getNextToken(request, pos).empty()) return malform;
+            if (!enableSpectrum(name.c_str(), m, window, hop, num, &freqs[0])) return malform;
+            return ok;
+        } else if (target == 1 && token2.compare("ARTIFACT") == 0) {
+            // STREAM ARTIFACT [clip duration tolerance] [jump step] [threshold min max]
+            //     [zvalue cutoff low high] [hold seconds] [memory seconds], or STREAM ARTIFACT OFF
+            const SignalConfiguration& cfg = signalConf;
+            ArtifactDetector<Ts,double> *detector = new ArtifactDetector<Ts,double>(cfg.getStreamingSelection().getSize(), fSample/cfg.getDownsampling());
+            std::string key = StringServer::getNextToken(request, pos);
+            bool valid = !key.empty();
+
+            if (key.compare("OFF") == 0) {
+                valid = StringServer::getNextToken(request, pos).empty();
+                delete detector;
+                detector = 0;
+            }
+            for (; valid && detector && !key.empty(); key = StringServer::getNextToken(request, pos)) {
+                double a = 0.0, b = 0.0, c = 0.0;
+                int n = (key == "clip" || key == "threshold") ? 2 : (key == "zvalue") ? 3 : 1;
+
+                valid = convertToDouble(StringServer::getNextToken(request, pos), a)
+                    && (n < 2 || convertToDouble(StringServer::getNextToken(request, pos), b))
+                    && (n < 3 || convertToDouble(StringServer::getNextToken(request, pos), c));
+                if (!valid) break;
+                if (key == "clip") {
+                    detector->setClip(a, b);
+                } else if (key == "jump") {
+                    detector->setJump(a);
+                } else if (key == "threshold") {
+                    detector->setThreshold(a, b);
+                } else if (key == "zvalue") {
+                    detector->setZValue(a, b, c);
+                } else if (key == "hold") {
+                    detector->setHold(a);
+                } else if (key == "memory") {
+                    detector->setMemory(a);
+                } else {
+                    valid = false;
+                }
+            }
+            if (!valid) {
+                delete detector;
+                return malform;
+            }
+            setArtifactDetector(detector);
+            return ok;
         } else if (token2.compare("STATUS") == 0) {
             if (target == 1) {
                 // STREAM STATUS
                 snprintf(response, sizeof(response)-1,
-                         "numacquired=%d numstreamed=%d downsample=%d bandwidth=%f bworder=%d\n",
+                         "numacquired=%d numstreamed=%d downsample=%d bandwidth=%f bworder=%d firtaps=%d groupdelay=%f\n",
                          nCont, // number of continuous channels from hardware
                          signalConf.getStreamingSelection().getSize(),
                          signalConf.getDownsampling(),
                          signalConf.getBandwidth(),
-                         signalConf.getOrder());
+                         signalConf.getOrder(),
+                         firFilter ? firFilter->getNumTaps() : 0,
+                         getGroupDelay());
+                return static_cast<std::string>(response) + pipelineStatus();
             } else {
                 // SAVE STATUS
+                double ringMax = 0.0, ringMean = 0.0;
+                int ringFull = 0;
                 if (savingEnabled && curWriter!=NULL && curWriter->isRunning()) {
                     saveTrueFalse = trueStr;
                     filenameStr   = curWriter->getFilename().c_str();
+                    curWriter->getRingStatistics(ringMax, ringMean, ringFull);
                 } else {
                     saveTrueFalse = falseStr;
                     filenameStr   = noFile;
                 }
 
                 snprintf(response, sizeof(response)-1,
-                         "numacquired=%d numsaved=%d saving=%s savingto=\"%s\"\n",
+                         "numacquired=%d numsaved=%d saving=%s savingto=\"%s\" ringmax=%.2f ringmean=%.2f ringfull=%d\n",
                          nCont, // number of continuous channels from hardware
                          signalConf.getSavingSelection().getSize(),
                          saveTrueFalse,
-                         filenameStr);
+                         filenameStr,
+                         ringMax, ringMean, ringFull);
             }
             return static_cast<std::string>(response);
         }
@@ -408,18 +561,23 @@ public:
     bool useOwnServer(int port) {
         if (ftSocket != -1) return false;
 
-        ftServer = ft_start_buffer_server(port, NULL, NULL, NULL);
-        if (ftServer == 0) return false;
-
+        if (!ftConnection.embedServer(port)) return false;
         ftSocket = 0; // => dma
         return true;
     }
 
     /** Read channel selections and other parameters from the given configuration file,
      and configure the streaming of data on success. Returns the number of parsing
-     errors (0 on success).
+     errors (0 on success). While streaming, only the selection and filter for
+     streaming are taken from the file, see updateStreaming().
      */
     int configureFromFile(const char *filename) {
+        if (streamingEnabled) {
+            SignalConfiguration cfg;
+            int numErr = cfg.parseFile(filename);
+            if (numErr == 0 && !updateStreaming(cfg)) numErr = 1;
+            return numErr;
+        }
         int numErr = signalConf.parseFile(filename);
         if (numErr == 0) {
             configureStreaming();
@@ -433,31 +591,219 @@ public:
      */
     To *provideBlock(int N) {
         int needed = N * (nStatus + nCont);
+        nThisBlock = N;
+        blockReadTime = 0;
+
+        if (slots) {
+            // the slot is only reused after both workers are done with it
+            unsigned int depth = writePos - minReadPos();
+            if (depth < numSlots) {
+                curSlot = &slots[writePos % numSlots];
+                if (needed > curSlot->allocSize) {
+                    delete[] curSlot->block;
+                    curSlot->block = new To[needed];
+                    curSlot->allocSize = needed;
+                }
+                curSlot->numSamples = N;
+                curSlot->events.clear();
+                return curSlot->block;
+            }
+            // the queue is full, the driver still gets a block but it is thrown away
+            if (numDropped++ == numDroppedReported) {
+                fprintf(stderr, "Warning: streaming or saving does not keep up, dropping blocks\n");
+            }
+            curSlot = 0;
+        }
+
         if (needed > allocSizeBlock) {
             delete[] pBlock;
             pBlock = new To[needed];
             allocSizeBlock = needed;
         }
-        nThisBlock = N;
 
         eventList.clear();
         return pBlock;
     }
 
+    /** Tells when the first sample of the block of provideBlock() or provideView() was
+     read from the device, in ft_clock_ns() time. This is only used for the trace of
+     the latency (see fttrace.h) and for getStreamingLatency().
+     */
+    void setBlockReadTime(UINT64_T ns) {
+        blockReadTime = ns;
+    }
+
+    /** Returns the number of blocks with a read time (see setBlockReadTime) that were
+     written to the buffer since the previous call, and the mean and largest time in
+     seconds from reading their first sample until the buffer acknowledged them. This
+     includes the time in the queue of the pipelined mode, see AcquisitionDriver.
+     */
+    unsigned int getStreamingLatency(double &mean, double &max) {
+        MutexLock lock(latencyMutex);
+        unsigned int count = latencyCount;
+        mean = (count > 0) ? latencySum / count : 0.0;
+        max = latencyMax;
+        latencySum = latencyMax = 0.0;
+        latencyCount = 0;
+        return count;
+    }
+
     /** This function should be called by the acquisition driver after data has been filled
      into the provided block, in order to stream out and save the selected channels.
-     Returns true on success, false if errors occured.
+     Returns true on success, false if errors occured. In pipelined mode, the errors
+     of the worker threads are returned by the next call.
      */
     bool handleBlock() {
+        UINT64_T handleTime = ft_trace_enabled() ? ft_clock_ns() : 0;
+        if (slots) {
+            if (curSlot) {
+                curSlot->readTime = blockReadTime;
+                curSlot->handleTime = handleTime;
+                // publish the slot, and wake up the workers
+                MEMORY_BARRIER();
+                writePos++;
+                unsigned int depth = writePos - minReadPos();
+                if (depth > maxQueueDepth) maxQueueDepth = depth;
+                char token = 0;
+                streamPipe.write(1, &token);
+                savePipe.write(1, &token);
+                curSlot = 0;
+                // warn again if blocks are dropped after this one
+                numDroppedReported = numDropped;
+            }
+            return !workerError;
+        }
+        RingView view = blockView(pBlock);
+        if (streamingEnabled) {
+            MutexLock lock(streamMutex);
+            if (!handleStreaming(view, nThisBlock, eventList, blockReadTime, handleTime)) return false;
+        }
+        if (savingEnabled) {
+            return handleSaving(view, nThisBlock);
+        }
+        return true;
+    }
+
+    /** Alternative to provideBlock() for drivers that can hand over the samples where
+     they are, see handleView(). The events of the N samples are added to getEventList()
+     as usual, after this call.
+     */
+    void provideView(int N) {
+        if (slots) {
+            // the samples are copied into the queue by handleView()
+            provideBlock(N);
+            return;
+        }
+        nThisBlock = N;
+        blockReadTime = 0;
+        eventList.clear();
+    }
+
+    /** Streams and saves the samples announced by provideView(), without copying them
+     into a block first. Sample j starts at ring[(start + j*stride) % ringLen], with the
+     status and continuous channels in the same order as in a provided block, and may
+     wrap around the end of the ring. That way a driver can pass a view into the ring
+     buffer of the device, whose samples also hold other words (e.g. a sync word). Use
+     ringLen = 0 if the samples do not wrap. The memory only has to stay valid during
+     this call; in pipelined mode the samples are copied into the queue.
+     */
+    bool handleView(const To *ring, int ringLen, int start, int stride) {
+        RingView view;
+        view.ring    = ring;
+        view.ringLen = ringLen;
+        view.start   = start;
+        view.stride  = stride;
+        view.rowLen  = nStatus + nCont;
+        if ((int) viewRow.size() < view.rowLen) viewRow.resize(view.rowLen);
+        view.scratch = &viewRow[0];
+
+        if (slots) {
+            if (curSlot) {
+                for (int j=0;j<nThisBlock;j++) {
+                    memcpy(curSlot->block + j*view.rowLen, view.row(j), view.rowLen*sizeof(To));
+                }
+            }
+            return handleBlock();
+        }
         if (streamingEnabled) {
-            if (!handleStreaming()) return false;
+            UINT64_T handleTime = ft_trace_enabled() ? ft_clock_ns() : 0;
+            MutexLock lock(streamMutex);
+            if (!handleStreaming(view, nThisBlock, eventList, blockReadTime, handleTime)) return false;
         }
         if (savingEnabled) {
-            return handleSaving();
+            return handleSaving(view, nThisBlock);
         }
         return true;
     }
 
+    /** Switches to pipelined mode, in which handleBlock() only queues the block for
+     the worker threads that do the streaming and saving. The queue holds numBlocks
+     blocks, if it is full the next block is dropped. Returns true on success.
+     */
+    bool enablePipeline(int numBlocks = 32) {
+        if (slots) return true;
+        if (numBlocks < 2) return false;
+
+        slots = new Slot[numBlocks];
+        numSlots = numBlocks;
+        writePos = streamPos = savePos = 0;
+        numDropped = numDroppedReported = 0;
+        maxQueueDepth = 0;
+        curSlot = 0;
+        workerError = false;
+        stopWorkers = false;
+
+        if (pthread_create(&streamThread, NULL, staticStreamThreadFunction, this)) {
+            fprintf(stderr, "Could not spawn streaming thread.\n");
+            delete[] slots;
+            slots = 0;
+            return false;
+        }
+        if (pthread_create(&saveThread, NULL, staticSaveThreadFunction, this)) {
+            fprintf(stderr, "Could not spawn saving thread.\n");
+            stopWorkers = true;
+            char token = 0;
+            streamPipe.write(1, &token);
+            pthread_join(streamThread, 0);
+            delete[] slots;
+            slots = 0;
+            return false;
+        }
+        return true;
+    }
+
+    /** Returns to handling the blocks in the thread of the driver. The blocks that
+     are still queued are streamed and saved first.
+     */
+    void disablePipeline() {
+        if (!slots) return;
+        stopWorkers = true;
+        MEMORY_BARRIER();
+        char token = 0;
+        streamPipe.write(1, &token);
+        savePipe.write(1, &token);
+        pthread_join(streamThread, 0);
+        pthread_join(saveThread, 0);
+        delete[] slots;
+        slots = 0;
+        numSlots = 0;
+        curSlot = 0;
+    }
+
+    /** Returns the number of blocks that were dropped because the queue was full,
+     and the current and largest number of queued blocks since enablePipeline().
+     All are 0 if the pipeline is not used.
+     */
+    void getPipelineStatistics(unsigned int &dropped, unsigned int &queueDepth, unsigned int &maxDepth) {
+        if (!slots) {
+            dropped = queueDepth = maxDepth = 0;
+            return;
+        }
+        dropped = numDropped;
+        queueDepth = writePos - minReadPos();
+        maxDepth = maxQueueDepth;
+    }
+
     /** Call this to enable saving to a GDF file. You must have called "setFilename"
      before. Once a filename is set, multiple calls to enableSaving() will increase
      a file counter which is appended to the name of the target GDF file.
@@ -465,6 +811,7 @@ public:
      */
     bool enableSaving() {
         if (curFilename.empty()) return false;
+        MutexLock lock(saveMutex);
         if (curWriter == 0) {
             configureSaving();
             if (curWriter == 0) return false;
@@ -488,6 +835,7 @@ public:
 
     /** Call this to disable saving to GDF. */
     void disableSaving() {
+        MutexLock lock(saveMutex);
         savingEnabled = false;
         if (!curWriter) return;
         curWriter->stopAsync();
@@ -497,6 +845,9 @@ public:
     /** Call this to enable streaming to a FieldTrip buffer. */
     bool enableStreaming() {
         if (streamingEnabled) return true; // silently ignore
+        MutexLock lock(streamMutex);
+        if (pendingConf) swapStreamingConfiguration();
+        streamOffset = 0;
         if (!writeHeader()) return false;
         streamingEnabled = true;
         return true;
@@ -505,14 +856,89 @@ public:
     /** Call this to disable streaming */
     void disableStreaming() {
         // if (!streamingEnabled) return;
+        MutexLock lock(streamMutex);
+        if (streamingEnabled) writeEvents(pendingEvents);
+        pendingEvents.clear();
         streamingEnabled = false;
     }
 
+    /** Call this to publish sliding spectra of the streamed channels to the named
+     stream of the FieldTrip buffer (see STREAM_REQ), one for every "hop" seconds,
+     of the last "window" seconds. Method is one of WELCH, MULTITAPER or GOERTZEL of
+     SlidingSpectrum, and num the number of averaged hops, of tapers, or of bands.
+     For WELCH and MULTITAPER, freqs points to the lowest and highest frequency in Hz,
+     for GOERTZEL to num such pairs, one per band. Each sample of the stream holds
+     the values of all frequencies of the first streamed channel, then those of the
+     second, etc., which are labelled like "Cz@10Hz" or "Cz@8-12Hz".
+     The spectra are computed once per hop in the streaming thread, so clients no
+     longer need to fetch and transform the overlapping windows themselves. The header
+     of the stream is written again with that of the streamed channels. If it cannot be
+     written, the spectra are stopped, but the streaming continues.
+     Returns false if the arguments are not valid.
+     */
+    bool enableSpectrum(const char *stream, int method, double window, double hop, int num, const double *freqs) {
+        if (stream == NULL || stream[0] == 0 || strlen(stream) >= FT_STREAM_NAMELEN) return false;
+        if (method < SlidingSpectrum<Ts,double>::WELCH || method > SlidingSpectrum<Ts,double>::GOERTZEL) return false;
+        if (!(window > 0.0 && hop > 0.0 && num >= 1)) return false;
+
+        int numFreqs = (method == SlidingSpectrum<Ts,double>::GOERTZEL) ? 2*num : 2;
+        MutexLock lock(streamMutex);
+        spectrumStream = stream;
+        spectrumMethod = method;
+        spectrumWindow = window;
+        spectrumHop = hop;
+        spectrumNum = num;
+        spectrumFreqs.assign(freqs, freqs + numFreqs);
+        if (streamingEnabled) writeSpectrumHeader();
+        return true;
+    }
+
+    /** Call this to stop publishing the spectra */
+    void disableSpectrum() {
+        MutexLock lock(streamMutex);
+        spectrumStream.clear();
+        delete spectrum;
+        spectrum = 0;
+    }
+
+    /** Detect artifacts in the streamed channels with the criteria of the given
+     detector, which this object takes over, or stop detecting them with NULL.
+     The thresholds are in the calibrated units of the streamed samples. For every
+     artifact, the streaming thread writes an event of type "artifact_start" at its
+     first sample, and one of type "artifact_stop" at the first sample after it,
+     with the criterion as the value ("clip", "jump", "threshold" or "zvalue").
+     The events are written after the samples of the block, so that classification
+     clients can skip the marked windows without scanning the samples themselves.
+     The detector is reset whenever the header is written.
+     */
+    void setArtifactDetector(ArtifactDetector<Ts,double> *detector) {
+        MutexLock lock(streamMutex);
+        delete artifacts;
+        artifacts = detector;
+        if (artifacts == 0) return;
+        artifacts->reset(signalConf.getStreamingSelection().getSize(), fSample / signalConf.getDownsampling());
+        artifactBase = numStreamed;
+    }
+
+    /** Collect the events of several blocks, and write them together with the samples
+     once maxBytes of events have been collected, or the oldest one has waited for
+     maxDelay seconds. With 0 for both (the default), the events of every block
+     are written right away.
+     */
+    void setEventBatching(unsigned int maxBytes, double maxDelay) {
+        MutexLock lock(streamMutex);
+        batchMaxBytes = maxBytes;
+        batchMaxDelay = maxDelay;
+        if (batchMaxBytes > 0) pendingEvents.reserve(batchMaxBytes + 1024);
+    }
+
     /** Returns a reference to the event list, which the acquisition driver
      should add events to. The event list will be flushed after every call
-     to handleBlock()
+     to handleBlock(). In pipelined mode, every block has its own event list,
+     so this should be called again after every call to provideBlock().
      */
     FtEventList& getEventList() {
+        if (curSlot) return curSlot->events;
         return eventList;
     }
 
@@ -525,6 +951,25 @@ public:
         return 0;
     }
 
+    /** Write GDF files in chunks of the given size (in bytes) and keep them valid while
+     writing, see GDF_Writer::setLargeBlockMode. Use 0 to write through stdio. Changes
+     will not take effect before the saving has been reconfigured.
+     */
+    void setSavingChunkSize(unsigned int chunkSize) {
+        savingChunkSize = chunkSize;
+    }
+
+    /** Split the recording into GDF files of at most maxBytes (default 1 GB) or
+     maxSeconds of samples, 0 for no limit. The background writer opens the next
+     file ahead of time and switches between two blocks, so the splits do not stall
+     the saving, see GDF_BackgroundWriter. Changes will not take effect before the
+     saving has been reconfigured.
+     */
+    void setFileRotation(int64_t maxBytes, double maxSeconds) {
+        savingMaxBytes = maxBytes;
+        savingMaxSeconds = maxSeconds;
+    }
+
     /** Set the filename for writing to GDF. Changes will note take effect
      before calling enableSaving()
      */
@@ -558,8 +1003,158 @@ public:
         return true;
     }
 
+    /** Changes the channel selection, downsampling and filter for streaming, without
+     stopping the stream. The filters are set up in the calling thread, and swapped in
+     by the streaming thread before its next block. The header is only written again
+     if the streamed channels, their sampling rate or the delay of the FIR filter
+     change. Its keyval chunk then contains "firstsample", the number of hardware
+     samples that were streamed before the new header, so that clients can keep
+     counting. The first sample with the new configuration is marked by an event of
+     type "reconfigure", with value "header" if clients should read the header again,
+     or "filter" if only the filter changed. The saving is not affected.
+     If streaming is not enabled, the new configuration is used right away.
+     Returns false if the selection contains channels that do not exist.
+     */
+    bool updateStreaming(const SignalConfiguration& newCfg) {
+        if (newCfg.getStreamingSelection().getMaxIndex() >= nCont) return false;
+
+        SignalConfiguration *cfg = new SignalConfiguration(newCfg);
+        float bw = cfg->getBandwidth();
+        if (bw < 0 || bw >= 0.5*fSample) {
+            cfg->setOrder(0);
+        }
+        MultiChannelFilter<Ts,Ts> *lp;
+        PolyphaseDecimator<Ts,Ts> *fir;
+        createStreamingFilters(*cfg, lp, fir);
+
+        MutexLock lock(streamMutex);
+        // a configuration that has not been swapped in yet is replaced
+        discardPendingStreaming();
+        pendingConf = cfg;
+        pendingLP = lp;
+        pendingFIR = fir;
+        if (!streamingEnabled) swapStreamingConfiguration();
+        return true;
+    }
+
 protected:
 
+    /** A block in the queue of the pipelined mode, see enablePipeline() */
+    struct Slot {
+        Slot() : block(0), allocSize(0), numSamples(0), readTime(0), handleTime(0) {}
+        ~Slot() { delete[] block; }
+        To *block;
+        int allocSize;
+        int numSamples;
+        UINT64_T readTime, handleTime;	// for the trace of the latency, or 0
+        FtEventList events;
+    };
+
+    /** Where the samples of a block are, see handleView(). Samples that wrap around the
+     end of the ring are put together in scratch, which holds rowLen values.
+     */
+    struct RingView {
+        const To *ring;
+        int ringLen;	/**< Length of the ring, or 0 if the samples do not wrap */
+        int start;		/**< Index of the first value of the first sample */
+        int stride;		/**< Distance between the samples, at least rowLen */
+        int rowLen;		/**< Number of status + continuous channels */
+        To *scratch;
+
+        /** Returns the status + continuous channels of sample j */
+        const To *row(int j) const {
+            if (ringLen == 0) return ring + start + j*stride;
+            int off = (int) (((INT64_T) start + (INT64_T) j*stride) % ringLen);
+            if (off + rowLen <= ringLen) return ring + off;
+            int n1 = ringLen - off;
+            memcpy(scratch, ring + off, n1*sizeof(To));
+            memcpy(scratch + n1, ring, (rowLen - n1)*sizeof(To));
+            return scratch;
+        }
+    };
+
+    /** The view of a block from provideBlock() */
+    RingView blockView(const To *block) const {
+        RingView view;
+        view.ring    = block;
+        view.ringLen = 0;
+        view.start   = 0;
+        view.stride  = nStatus + nCont;
+        view.rowLen  = nStatus + nCont;
+        view.scratch = 0;
+        return view;
+    }
+
+    /** Locks a mutex for the lifetime of this object */
+    class MutexLock {
+        public:
+        MutexLock(pthread_mutex_t &m) : mutex(m) { pthread_mutex_lock(&mutex); }
+        ~MutexLock() { pthread_mutex_unlock(&mutex); }
+        protected:
+        pthread_mutex_t &mutex;
+    };
+
+    /** The position of the worker that is furthest behind */
+    unsigned int minReadPos() const {
+        unsigned int s = streamPos, v = savePos;
+        return (writePos - s > writePos - v) ? s : v;
+    }
+
+    /** The queue statistics that are appended to the STATUS responses in pipelined mode */
+    std::string pipelineStatus() {
+        char status[100];
+        unsigned int dropped, queueDepth, maxDepth;
+        if (!slots) return std::string();
+        getPipelineStatistics(dropped, queueDepth, maxDepth);
+        snprintf(status, sizeof(status), "dropped=%u queue=%u maxqueue=%u\n", dropped, queueDepth, maxDepth);
+        return std::string(status);
+    }
+
+    static void *staticStreamThreadFunction(void *arg) {
+        OnlineDataManager *ODM = (OnlineDataManager *) arg;
+        ODM->workerThreadFunc(true);
+        return 0;
+    }
+
+    static void *staticSaveThreadFunction(void *arg) {
+        OnlineDataManager *ODM = (OnlineDataManager *) arg;
+        ODM->workerThreadFunc(false);
+        return 0;
+    }
+
+    /** Streams or saves the queued blocks, until disablePipeline() is called and the
+     queue is empty. The worker holds its mutex while handling a block, so that the
+     streaming or saving is not reconfigured in the meantime.
+     */
+    void workerThreadFunc(bool streaming) {
+        volatile unsigned int &readPos = streaming ? streamPos : savePos;
+        LocalPipe &pipe = streaming ? streamPipe : savePipe;
+        pthread_mutex_t &mutex = streaming ? streamMutex : saveMutex;
+
+        while (1) {
+            if (readPos == writePos) {
+                char tokens[64];
+                if (stopWorkers) break;
+                if (pipe.read(sizeof(tokens), tokens) <= 0) break;
+                continue;
+            }
+            MEMORY_BARRIER();
+            Slot &S = slots[readPos % numSlots];
+
+            pthread_mutex_lock(&mutex);
+            if (streaming) {
+                if (streamingEnabled && !handleStreaming(blockView(S.block), S.numSamples, S.events, S.readTime, S.handleTime)) workerError = true;
+            } else {
+                if (savingEnabled && !handleSaving(blockView(S.block), S.numSamples)) workerError = true;
+            }
+            pthread_mutex_unlock(&mutex);
+
+            // hand the slot back to the driver
+            MEMORY_BARRIER();
+            readPos++;
+        }
+    }
+
     /** Helper function for writing a header to the FieldTrip buffer that corresponds
      to the current channel selection for streaming. Returns true on success,
      false on error.
@@ -588,7 +1183,25 @@ protected:
 
         delete[] chunk_data;
 
-        int err = clientrequest(ftSocket, req.out(), resp.in());
+        std::string keyval;
+        char value[32];
+        if (firFilter) {
+            // the delay of the FIR filter is constant, clients can use it to align the data
+            snprintf(value, sizeof(value), "%f", getGroupDelay());
+            keyval.append("groupdelay", 11).append(value, strlen(value)+1);
+            firFilter->clear();
+        }
+        if (streamOffset > 0) {
+            // the header was replaced by updateStreaming()
+            snprintf(value, sizeof(value), "%d", streamOffset);
+            keyval.append("firstsample", 12).append(value, strlen(value)+1);
+        }
+        if (!keyval.empty()) {
+            keyval.push_back(0);
+            req.prepPutHeaderAddChunk(FT_CHUNK_ASCII_KEYVAL, keyval.size(), keyval.data());
+        }
+
+        int err = ftConnection.request(req.out(), resp.in());
         if (err || !resp.checkPut()) {
             fprintf(stderr, "Could not write header to FieldTrip buffer\n");
             return false;
@@ -596,86 +1209,318 @@ protected:
         sampleCounter = 0;
         skipSamples = 0;
         skipSamples2 = 0;
+        pendingEvents.clear();
+        numStreamed = 0;
+        if (artifacts) {
+            artifacts->reset(streamSel.getSize(), fSample / signalConf.getDownsampling());
+            artifactBase = 0;
+        }
+        writeSpectrumHeader();
+        return true;
+    }
+
+    /** Called by handleStreaming() with the streamed samples of a block, after these
+     have been written, writes the starts and stops of the artifacts as events.
+     */
+    bool writeArtifacts(const Ts *samples, int nSamples) {
+        numStreamed += nSamples;
+        if (artifacts == 0 || !artifacts->isEnabled()) return true;
+
+        int num = artifacts->process(nSamples, samples);
+        if (num == 0) return true;
+
+        // the detector counts the samples from its last reset
+        artifactEvents.clear();
+        for (int i=0;i<num;i++) {
+            const typename ArtifactDetector<Ts,double>::Transition& t = artifacts->getTransition(i);
+            artifactEvents.add(artifactBase + t.sample, t.start ? "artifact_start" : "artifact_stop", ArtifactDetector<Ts,double>::getName(t.kind));
+        }
+        return writeEvents(artifactEvents);
+    }
+
+    /** Sets up the spectra for the current streaming configuration, and writes the
+     header of their stream, see enableSpectrum(). Returns false on error, in which
+     case the spectra are stopped.
+     */
+    bool writeSpectrumHeader() {
+        const ChannelSelection& streamSel = signalConf.getStreamingSelection();
+        int nStream = streamSel.getSize();
+
+        delete spectrum;
+        spectrum = 0;
+        if (spectrumStream.empty() || nStream == 0) return true;
+
+        double fStream = fSample / signalConf.getDownsampling();
+        double nyquist = 0.5*fStream;
+        int winLen = (int) floor(spectrumWindow*fStream + 0.5);
+        int hop = (int) floor(spectrumHop*fStream + 0.5);
+        std::vector<double> freqs(spectrumFreqs.size());
+
+        for (unsigned int i=0;i<freqs.size();i++) freqs[i] = spectrumFreqs[i] / nyquist;
+        spectrum = new SlidingSpectrum<Ts,double>(nStream, winLen, hop);
+        if (spectrumMethod == SlidingSpectrum<Ts,double>::GOERTZEL) {
+            spectrum->setBands(spectrumNum, &freqs[0]);
+        } else {
+            if (spectrumMethod == SlidingSpectrum<Ts,double>::MULTITAPER) {
+                spectrum->setMultitaper(spectrumNum);
+            } else {
+                spectrum->setWelch(spectrumNum);
+            }
+            spectrum->setFrequencyRange(freqs[0], freqs[1]);
+        }
+
+        int numFreqs = spectrum->getNumFreqs();
+        std::string labels;
+        char suffix[64];
+        for (int n=0;n<nStream;n++) {
+            for (int k=0;k<numFreqs;k++) {
+                if (spectrumMethod == SlidingSpectrum<Ts,double>::GOERTZEL) {
+                    snprintf(suffix, sizeof(suffix), "@%g-%gHz", spectrumFreqs[2*k], spectrumFreqs[2*k+1]);
+                } else {
+                    snprintf(suffix, sizeof(suffix), "@%gHz", spectrum->getFrequency(k)*nyquist);
+                }
+                labels.append(streamSel.getLabel(n)).append(suffix, strlen(suffix)+1);
+            }
+        }
+
+        FtBufferRequest req;
+        req.prepPutHeader(nStream*numFreqs, ftType, fStream / spectrum->getHop());
+        req.prepPutHeaderAddChunk(FT_CHUNK_CHANNEL_NAMES, labels.size(), labels.data());
+
+        int err = streamrequest(ftConnection.getSocket(), spectrumStream.c_str(), req.out(), resp.in());
+        if (err || !resp.checkPut()) {
+            fprintf(stderr, "Could not write header to stream %s of FieldTrip buffer, the spectra are stopped\n", spectrumStream.c_str());
+            delete spectrum;
+            spectrum = 0;
+            return false;
+        }
         return true;
     }
 
+    /** Called by handleStreaming() with the streamed samples of a block, writes the
+     spectra that are due to their stream.
+     */
+    void writeSpectrum(const Ts *samples, int nSamples) {
+        if (spectrum == 0) return;
+
+        int rowSize = signalConf.getStreamingSelection().getSize() * spectrum->getNumFreqs();
+        int numOut = spectrum->getNumOutputs(nSamples);
+        Ts *out = (numOut > 0) ? getWork(spectrumWork, numOut*rowSize) : NULL;
+
+        if (numOut > 0 && out == NULL) return;
+        spectrum->process(nSamples, out, samples);
+        if (numOut == 0) return;
+
+        FtBufferRequest req;
+        req.prepPutData(rowSize, numOut, ftType, out);
+        int err = streamrequest(ftConnection.getSocket(), spectrumStream.c_str(), req.out(), resp.in());
+        if (err || !resp.checkPut()) {
+            fprintf(stderr, "Could not write spectra to stream %s of FieldTrip buffer, they are stopped\n", spectrumStream.c_str());
+            delete spectrum;
+            spectrum = 0;
+        }
+    }
+
+    /** A run of consecutive channels in a channel selection */
+    struct ChannelRun {
+        int first;	/**< Index of the first channel in the hardware sample */
+        int count;	/**< Number of channels */
+    };
+
+    /** Splits the selection into runs of consecutive channels, so that the channels
+     can be copied and calibrated run by run in calibrateRows().
+     */
+    static void planRuns(const ChannelSelection& sel, std::vector<ChannelRun>& runs) {
+        runs.clear();
+        for (int i=0;i<sel.getSize();i++) {
+            int idx = sel.getIndex(i);
+            if (!runs.empty() && runs.back().first + runs.back().count == idx) {
+                runs.back().count++;
+            } else {
+                ChannelRun r = {idx, 1};
+                runs.push_back(r);
+            }
+        }
+    }
+
+    /** Writes "num" calibrated samples of the selected channels to dest, taken from
+     the rows first, first+step, ... of the block. The selections are scattered over
+     the hardware channels in only a few runs, which are converted in one go each.
+     */
+    void calibrateRows(Ts *dest, const RingView& block, int first, int step, int num, const std::vector<ChannelRun>& runs) {
+        for (int j=0;j<num;j++) {
+            const To *src = block.row(first + j*step) + nStatus;
+            for (unsigned int k=0;k<runs.size();k++) {
+                const ChannelRun& r = runs[k];
+                tvmSetScaledOffsetVector<Ts,Ts,To>(dest, slope + r.first, src + r.first, offset + r.first, r.count);
+                dest += r.count;
+            }
+        }
+    }
+
+    /** Returns the work space for the given number of values, or NULL on allocation errors */
+    static Ts *getWork(SimpleStorage& work, int num) {
+        if (!work.resize(num*sizeof(Ts))) return NULL;
+        return (Ts *) work.data();
+    }
+
     /** Called by handleBlock() to deal with streaming out samples and events.
      The raw data are first transformed by subtracting offsets and multiplying
      slope factors. If selected, the signal will then be filtered and optionally
-     downsampled.
+     downsampled. Each of these steps is done for the whole block at once. The times
+     at which the block was read and handed over are only used for the trace and
+     for getStreamingLatency().
      */
-    bool handleStreaming() {
-        int stride = nStatus + nCont;
+    bool handleStreaming(const RingView& block, int nThisBlock, FtEventList &eventList, UINT64_T readTime = 0, UINT64_T handleTime = 0) {
         int err;
+        if (pendingConf) {
+            // reconfigure at the start of this block, see updateStreaming()
+            bool newHeader = swapStreamingConfiguration();
+            if (newHeader) {
+                // the collected events still belong to the old header
+                if (!writeEvents(pendingEvents)) return false;
+                streamOffset += sampleCounter;
+                if (!writeHeader()) return false;
+            }
+            eventList.add(0, "reconfigure", newHeader ? "header" : "filter");
+        }
+
         const ChannelSelection& streamSel = signalConf.getStreamingSelection();
         int nStream  = streamSel.getSize();
 
-        // write events, if any
+        // events are written together with the samples below, if possible
         if (eventList.count() > 0) {
             eventList.transform(sampleCounter, signalConf.getDownsampling());
-            err = clientrequest(ftSocket, eventList.asRequest(), resp.in());
-            if (err || !resp.checkPut()) {
-                fprintf(stderr, "Could not write events to FieldTrip buffer.\n");
-                return false;
-            }
         }
 
         sampleCounter += nThisBlock; // sampleCounter ticks at original speed
 
+        FtEventList &events = batchEvents(eventList);
+
         // write samples, if channels selected
-        if (nStream == 0) return true;
+        if (nStream == 0) return writeEvents(events);
 
         int deci        = signalConf.getDownsampling();
-        int numThisTime = (nThisBlock - skipSamples + deci - 1)/deci;
+        int numThisTime = firFilter ? firFilter->getNumOutputs(nThisBlock) : (nThisBlock - skipSamples + deci - 1)/deci;
 
         Ts *dest = (Ts *) sampleBlock->getMatrix(nStream, numThisTime);
-
-        if (lpFilter) {
-            for (int j=0;j<nThisBlock;j++) {
-                To *src = pBlock + nStatus + j*stride;
-                for (int i=0;i<nStream;i++) {
-                    int idx = streamSel.getIndex(i);
-                    auxVec[i] = slope[idx]*(src[idx] - offset[idx]);
-                }
-
-                if (skipSamples == 0) {
-                    lpFilter->process(dest, auxVec);
+        const Ts *streamed = dest;
+
+        planRuns(streamSel, streamRuns);
+        if (firFilter) {
+            // the decimator only computes the samples that are kept
+            Ts *work = getWork(streamWork, nThisBlock*nStream);
+            if (work == NULL) return false;
+            calibrateRows(work, block, 0, 1, nThisBlock, streamRuns);
+            firFilter->process(nThisBlock, dest, work);
+        } else if (lpFilter) {
+            // without downsampling, the block is filtered in place
+            Ts *work = (deci == 1) ? dest : getWork(streamWork, nThisBlock*nStream);
+            if (work == NULL) return false;
+            calibrateRows(work, block, 0, 1, nThisBlock, streamRuns);
+            lpFilter->process(nThisBlock, work, work);
+            if (work != dest) {
+                for (int j=skipSamples;j<nThisBlock;j+=deci) {
+                    memcpy(dest, work + j*nStream, nStream*sizeof(Ts));
                     dest += nStream;
-                } else {
-                    lpFilter->process(auxVec);
                 }
-                if (--skipSamples < 0) skipSamples = deci-1;
             }
         } else {
-            for (int j=0;j<nThisBlock;j++) {
-                To *src = pBlock + nStatus + j*stride;
-                if (skipSamples == 0) {
-                    for (int i=0;i<nStream;i++) {
-                        int idx = streamSel.getIndex(i);
-                        dest[i] = slope[idx]*(src[idx] - offset[idx]);
-                    }
-                    dest += nStream;
+            calibrateRows(dest, block, skipSamples, deci, numThisTime, streamRuns);
+        }
+        skipSamples = (skipSamples + deci - nThisBlock % deci) % deci;
+
+        if (numThisTime == 0) return writeEvents(events); // only send samples if there is actual data.
+
+        if (events.count() > 0) {
+            // one round trip for both, which also guarantees that the events arrive with their samples
+            batchRequest.prepPutBatch();
+            if (batchRequest.prepBatchAdd(events.asRequest()) && batchRequest.prepBatchAdd(sampleBlock->asRequest())) {
+                traceBlock(readTime, handleTime, numThisTime);
+                err = ftConnection.request(batchRequest.out(), resp.in());
+                if (err || !resp.checkPut()) {
+                    fprintf(stderr, "Could not write samples and events to FieldTrip buffer\n");
+                    return false;
                 }
-                if (--skipSamples < 0) skipSamples = deci-1;
+                recordLatency(readTime);
+                if (&events == &pendingEvents) pendingEvents.clear();
+                writeSpectrum(streamed, numThisTime);
+                return writeArtifacts(streamed, numThisTime);
             }
+            if (!writeEvents(events)) return false;
         }
 
-        if (numThisTime > 0) { // only send packet if there is actual data.
-            err = clientrequest(ftSocket, sampleBlock->asRequest(), resp.in());
-            if (err || !resp.checkPut()) {
-                fprintf(stderr, "Could not write samples to FieldTrip buffer\n");
-                return false;
-            }
+        traceBlock(readTime, handleTime, numThisTime);
+        err = ftConnection.request(sampleBlock->asRequest(), resp.in());
+        if (err || !resp.checkPut()) {
+            fprintf(stderr, "Could not write samples to FieldTrip buffer\n");
+            return false;
+        }
+        recordLatency(readTime);
+        writeSpectrum(streamed, numThisTime);
+        return writeArtifacts(streamed, numThisTime);
+    }
+
+    /** Called by handleStreaming() right before the samples of a block are sent, records
+     when the block was read, handed over and sent, if these are traced (see fttrace.h).
+     The block is identified by its samples in the buffer, numStreamed onwards.
+     */
+    void traceBlock(UINT64_T readTime, UINT64_T handleTime, int nSamples) {
+        if (!ft_trace_enabled()) return;
+        UINT32_T begsample = numStreamed;
+        if (readTime) ft_trace_point(FT_TRACE_READ, begsample, begsample + nSamples, readTime);
+        if (handleTime) ft_trace_point(FT_TRACE_HANDLE, begsample, begsample + nSamples, handleTime);
+        ft_trace_point(FT_TRACE_SEND, begsample, begsample + nSamples, 0);
+    }
+
+    /** Called by handleStreaming() once the samples of a block that was read at readTime
+     have been written, see getStreamingLatency() */
+    void recordLatency(UINT64_T readTime) {
+        if (readTime == 0) return;
+        double latency = 1e-9 * (double) (ft_clock_ns() - readTime);
+        MutexLock lock(latencyMutex);
+        latencySum += latency;
+        if (latency > latencyMax) latencyMax = latency;
+        latencyCount++;
+    }
+
+    /** Called by handleStreaming() to write the events in a separate request */
+    bool writeEvents(FtEventList &eventList) {
+        if (eventList.count() == 0) return true;
+        int err = ftConnection.request(eventList.asRequest(), resp.in());
+        if (err || !resp.checkPut()) {
+            fprintf(stderr, "Could not write events to FieldTrip buffer.\n");
+            return false;
         }
+        if (&eventList == &pendingEvents) pendingEvents.clear();
         return true;
     }
 
+    /** Called by handleStreaming() with the (transformed) events of the block, returns
+     the events that should be written now. With batching, these are either all the
+     collected events or none, see setEventBatching().
+     */
+    FtEventList& batchEvents(FtEventList &eventList) {
+        if (batchMaxBytes == 0 && batchMaxDelay <= 0.0) return eventList;
+
+        if (eventList.count() > 0) {
+            if (pendingEvents.count() == 0) pendingSince = ft_clock_seconds();
+            if (!pendingEvents.append(eventList)) {
+                fprintf(stderr, "Warning: out of memory in collecting events, writing them right away.\n");
+                return eventList;
+            }
+        }
+        if (pendingEvents.count() == 0) return pendingEvents;
+        if (batchMaxBytes > 0 && pendingEvents.size() >= batchMaxBytes) return pendingEvents;
+        if (batchMaxDelay > 0.0 && ft_clock_seconds() - pendingSince >= batchMaxDelay) return pendingEvents;
+        return noEvents;
+    }
+
 
     /** Called by handleBlock to deal with saving data to GDF. Actually this function
      doesn't save to disk itself, but copies the relevant channels to the
      internal ring buffer of the current GDF_BackgroundWriter instance. */
-    bool handleSaving() {
-        int stride = nStatus + nCont;
+    bool handleSaving(const RingView& block, int nThisBlock) {
         const ChannelSelection& saveSel = signalConf.getSavingSelection();
         int nSave  = saveSel.getSize();
 
@@ -684,8 +1529,6 @@ protected:
         int deci        = (int)(fSample/fSampleSaving);
         int numThisTime = (nThisBlock - skipSamples2 + deci - 1)/deci;
 
-        Ts *dest_filt = NULL; // to hold the filtered data
-
         if (numThisTime > 0) {
             if (!curWriter->checkFreeBlock(numThisTime)) {
                 fprintf(stderr, "Error: saving data thread does not keep up with load\n");
@@ -694,41 +1537,35 @@ protected:
         }
         if (lpFilter2) {
             // without nStatus: STATUS channel not filtered!
-            dest_filt = (Ts *) sampleBlock->getMatrix(nSave, numThisTime);
-
-            for (int j=0;j<nThisBlock;j++) {
-                To *src = pBlock + nStatus + j*stride;
+            Ts *work = getWork(saveWork, nThisBlock*nSave);
+            if (work == NULL) return false;
+
+            planRuns(saveSel, saveRuns);
+            calibrateRows(work, block, 0, 1, nThisBlock, saveRuns);
+            lpFilter2->process(nThisBlock, work, work);
+
+            // STATUS channel(s) need(s) to be duplicated from calling client in order to make sure
+            // no trigger information is missing after decimation
+            for (int j=skipSamples2;j<nThisBlock;j+=deci) {
+                const To *src = block.row(j); // points to STATUS channel for this sample in the data
+                const Ts *filt = work + j*nSave;
+                To *dest = curWriter->getSampleSlot(); // dest for saving this data sample (for all channels)
+                for (int i=0;i<nStatus;i++) {
+                    *dest++ = *src++;
+                }
                 for (int i=0;i<nSave;i++) {
                     int idx = saveSel.getIndex(i);
-                    auxVec2[i] = slope[idx]*(src[idx] - offset[idx]);
-                }
-                // STATUS channel(s) need(s) to be duplicated from calling client in order to make sure
-                // no trigger information is missing after decimation
-                if (skipSamples2 == 0) {
-                    lpFilter2->process(dest_filt, auxVec2);
-                    // save the data ***
-                    src = pBlock + j*stride; // src2: points to STATUS channel for this sample in the data
-                    To *dest = curWriter->getSampleSlot(); // dest for saving this data sample (for all channels)
-                    for (int i=0;i<nStatus;i++) {
-                        *dest++ = *src++;
-                    }
-                    for (int i=0;i<nSave;i++) {
-                        int idx = saveSel.getIndex(i);
-                        // convert EEG sample back to original digital values
-                        dest[i] = (To)((Ts)dest_filt[i]/slope[idx] + offset[idx]);
-                    }
-                    dest_filt += nSave;
-                } else {
-                    lpFilter2->process(auxVec2);
+                    // convert EEG sample back to original digital values
+                    dest[i] = (To)(filt[i]/slope[idx] + offset[idx]);
                 }
-                if (--skipSamples2 < 0) skipSamples2 = deci-1;
             }
+            skipSamples2 = (skipSamples2 + deci - nThisBlock % deci) % deci;
         } else {
             // no filtering required
             for (int j=0;j<nThisBlock;j++) {
                 To *dest = curWriter->getSampleSlot();
-                To *src = pBlock + j*stride;
                 if (skipSamples2 == 0) {
+                    const To *src = block.row(j);
                     for (int i=0;i<nStatus;i++) {
                         *dest++ = *src++;
                     }
@@ -766,6 +1603,11 @@ protected:
         }
 
         curWriter = new GDF_BackgroundWriter<To>(nStatus + nSave, fSampleSaving, gdfType);
+        curWriter->setMaxFileSize(savingMaxBytes);
+        curWriter->setMaxFileDuration(savingMaxSeconds);
+        if (savingChunkSize > 0 && !curWriter->gdf().setLargeBlockMode(savingChunkSize)) {
+            fprintf(stderr, "Warning: writing GDF files in large chunks is not supported here\n");
+        }
 
         for (int i=0;i<nStatus;i++) {
             curWriter->gdf().setLabel(i, statusLabels[i]);
@@ -788,26 +1630,127 @@ protected:
      Delete the current filter first, if any.
      */
     void configureStreaming() {
-        const ChannelSelection& streamSel = signalConf.getStreamingSelection();
-        int nStream = streamSel.getSize();
+        MutexLock lock(streamMutex);
+        int nStream = signalConf.getStreamingSelection().getSize();
+        discardPendingStreaming();
         delete lpFilter;
+        delete firFilter;
+        createStreamingFilters(signalConf, lpFilter, firFilter);
 
-        if (signalConf.getOrder() > 0) {
-            lpFilter = new MultiChannelFilter<Ts,Ts>(signalConf.getStreamingSelection().getSize(), signalConf.getOrder());
-            lpFilter->setButterLP(signalConf.getBandwidth() / (0.5*fSample));
-        } else {
-            lpFilter = 0;
-        }
         printf("Sampling frequency (streamed)....: %.0f Hz\n", fSample/signalConf.getDownsampling());
         printf("Number of streamed channels......: %d\n", nStream);
+        if (firFilter) printf("FIR decimation delay (streamed)..: %.1f samples\n", getGroupDelay());
+    }
+
+    /** Creates the filters for streaming with the given configuration, which are NULL if not used */
+    void createStreamingFilters(const SignalConfiguration& cfg, MultiChannelFilter<Ts,Ts> *&lp, PolyphaseDecimator<Ts,Ts> *&fir) const {
+        int nStream = cfg.getStreamingSelection().getSize();
+        lp = 0;
+        fir = 0;
+
+        if (cfg.getFirTaps() > 0) {
+            // the FIR filter replaces the Butterworth filter, by default it cuts off just below the new Nyquist frequency
+            int deci = cfg.getDownsampling();
+            double bw = cfg.getBandwidth();
+            fir = new PolyphaseDecimator<Ts,Ts>(nStream, deci, cfg.getFirTaps());
+            fir->setLowpass((bw > 0 && bw < 0.5*fSample) ? bw / (0.5*fSample) : 0.9 / deci);
+        } else if (cfg.getOrder() > 0) {
+            lp = new MultiChannelFilter<Ts,Ts>(nStream, cfg.getOrder());
+            lp->setButterLP(cfg.getBandwidth() / (0.5*fSample));
+        }
+    }
+
+    /** Sets the downsampling and filter parameters of a STREAM FILTER command */
+    void setStreamingFilter(SignalConfiguration& cfg, double bandwidth, int order, int factor, int numTaps) const {
+        cfg.setDownsampling(factor);
+        cfg.setFirTaps(numTaps);
+        if (bandwidth < 0.5*fSample) {
+            cfg.setBandwidth(bandwidth);
+            cfg.setOrder(order);
+        } else {
+            cfg.setOrder(0);
+        }
+    }
+
+    /** Returns a copy of the streaming configuration, including changes that were
+     not swapped in yet, which can be changed and passed to updateStreaming().
+     */
+    SignalConfiguration getStreamingConfiguration() {
+        MutexLock lock(streamMutex);
+        return pendingConf ? *pendingConf : signalConf;
+    }
+
+    /** Installs the configuration and filters from updateStreaming(), with streamMutex
+     held. Returns true if the header must be written again.
+     */
+    bool swapStreamingConfiguration() {
+        const SignalConfiguration& cfg = *pendingConf;
+        double delay = pendingFIR ? pendingFIR->getGroupDelay() / cfg.getDownsampling() : 0.0;
+        bool newHeader = !cfg.getStreamingSelection().equals(signalConf.getStreamingSelection())
+            || cfg.getDownsampling() != signalConf.getDownsampling()
+            || delay != getGroupDelay();
+
+        signalConf.setStreamingSelection(cfg.getStreamingSelection());
+        signalConf.setDownsampling(cfg.getDownsampling());
+        signalConf.setBandwidth(cfg.getBandwidth());
+        signalConf.setOrder(cfg.getOrder());
+        signalConf.setFirTaps(cfg.getFirTaps());
+
+        delete lpFilter;
+        delete firFilter;
+        lpFilter = pendingLP;
+        firFilter = pendingFIR;
+        // with the same downsampling, the decimator continues on the old grid
+        if (firFilter && !newHeader) firFilter->clear(skipSamples);
+
+        delete pendingConf;
+        pendingConf = 0;
+        pendingLP = 0;
+        pendingFIR = 0;
+        return newHeader;
+    }
+
+    /** Deletes the configuration from updateStreaming() if it was not swapped in yet */
+    void discardPendingStreaming() {
+        delete pendingConf;
+        delete pendingLP;
+        delete pendingFIR;
+        pendingConf = 0;
+        pendingLP = 0;
+        pendingFIR = 0;
+    }
+
+    /** Returns the delay of the FIR decimator in streamed samples, or 0 if it is not used */
+    double getGroupDelay() const {
+        if (firFilter == 0) return 0.0;
+        return firFilter->getGroupDelay() / signalConf.getDownsampling();
     }
 
     ////////////////////////////////////////////////////////////////
     // Class members
     ////////////////////////////////////////////////////////////////
     GDF_BackgroundWriter<To> *curWriter;	/**< currently active GDF writer (in background thread) */
+    unsigned int savingChunkSize;	/**< see setSavingChunkSize, 0 to write GDF files through stdio */
+    int64_t savingMaxBytes;			/**< see setFileRotation */
+    double savingMaxSeconds;
     MultiChannelFilter<Ts,Ts> *lpFilter;	/**< currently active low-pass filter for streamed data */
     MultiChannelFilter<Ts,Ts> *lpFilter2;	/**< currently active low-pass filter for saved data */
+    PolyphaseDecimator<Ts,Ts> *firFilter;	/**< currently active FIR decimator for streamed data, replaces lpFilter */
+    SignalConfiguration *pendingConf;	/**< Streaming configuration from updateStreaming() that is not used yet, or NULL */
+    MultiChannelFilter<Ts,Ts> *pendingLP;	/**< lpFilter that goes with pendingConf */
+    PolyphaseDecimator<Ts,Ts> *pendingFIR;	/**< firFilter that goes with pendingConf */
+    SlidingSpectrum<Ts,double> *spectrum;	/**< Spectra of the streamed channels, or NULL, see enableSpectrum */
+    std::string spectrumStream;	/**< Named stream that receives the spectra, empty if none */
+    int spectrumMethod, spectrumNum;	/**< Method of the spectra, and the number of averages, tapers or bands */
+    double spectrumWindow, spectrumHop;	/**< Length of the window and of the hop in seconds */
+    std::vector<double> spectrumFreqs;	/**< Frequency range or bands in Hz */
+    ArtifactDetector<Ts,double> *artifacts;	/**< Detector for the streamed channels, or NULL, see setArtifactDetector */
+    int artifactBase;	/**< Number of streamed samples before the last reset of the detector */
+    int numStreamed;	/**< Number of samples streamed out since the last writeHeader, after downsampling */
+    UINT64_T blockReadTime;	/**< When the current block was read from the device, see setBlockReadTime */
+    double latencySum, latencyMax;	/**< Of the blocks written since the last getStreamingLatency */
+    unsigned int latencyCount;
+    FtEventList artifactEvents;	/**< Used for writing the events of the detector */
 
     UINT32_T ftType;	/**< FieldTrip buffer data type */
     GDF_Type gdfType;	/**< GDF data type */
@@ -818,13 +1761,18 @@ protected:
     int nThisBlock;		/**< Number of samples in this block (as requested by provideBlock) */
     int allocSizeBlock; /**< Size of buffer that is allocated for providing blocks */
     To *pBlock;			/**< Points to buffer that is allocated for providing blocks */
-    Ts *auxVec;			/**< Big enough for keeping one sample of data (streaming format) */
-    Ts *auxVec2;		/**< Big enough for keeping one sample of data (saving format) */
+    SimpleStorage streamWork;	/**< Holds the calibrated block of streamed channels, see handleStreaming */
+    SimpleStorage saveWork;	/**< Same for the saved channels, separate since saving may run in another thread */
+    SimpleStorage spectrumWork;	/**< Holds the spectra of a block, see writeSpectrum */
+    std::vector<ChannelRun> streamRuns;	/**< Runs of consecutive channels in the streaming selection */
+    std::vector<ChannelRun> saveRuns;	/**< Runs of consecutive channels in the saving selection */
+    std::vector<To> viewRow;	/**< Scratch space for a sample that wraps around the ring of handleView() */
     Ts *offset;         /**< Offset subtracted from raw data before streaming */
     Ts *slope;          /**< Factor to multiply data with before streaming (after subtracting offset) */
 
     int ftSocket;		/**< The FT buffer socket identifier or 0 for dmarequests, -1 for none */
     int sampleCounter;	/**< Number of samples streamed out since last writeHeader */
+    int streamOffset;	/**< Number of samples streamed out before the last writeHeader, since enableStreaming */
     int skipSamples;	/**< Helper variable to keep track of downsampling operation for steamed data */
     int skipSamples2;	/**< Helper variable to keep track of downsampling operation for saved data */
 
@@ -838,8 +1786,13 @@ protected:
     FtConnection ftConnection;	/**< Handles the connection to the FieldTrip buffer (either socket or dma) */
     FtBufferResponse resp;		/**< Receives responses from the buffer server */
     FtEventList eventList;		/**< Used for writing events to the buffer server, is flushed after each handleBlock() */
+    FtEventList pendingEvents;	/**< Events of previous blocks that have not been written yet, see setEventBatching() */
+    FtEventList noEvents;		/**< Always empty, written by handleStreaming() while collecting events */
+    unsigned int batchMaxBytes;	/**< Write the collected events once they take this many bytes, or 0 */
+    double batchMaxDelay;		/**< Write the collected events once the oldest is this many seconds old, or 0 */
+    double pendingSince;		/**< Time at which the oldest collected event was added */
+    FtBufferRequest batchRequest;	/**< Used for writing events and samples in one PUT_BATCH request */
     FtSampleBlock *sampleBlock;	/**< Used for writing data to the buffer server */
-    ft_buffer_server_t *ftServer;	/**< Handles the server sockets and background threads in case an own server is spawned */
 
     SignalConfiguration signalConf;	/**< Maintains the channel selection for streaming and saving, as well as a few other parameters */
 
@@ -847,6 +1800,23 @@ protected:
 
     std::string curFilename;	/**< Current filename for writing GDF to disk */
     int fileCounter;			/**< Current running ID for the file name, auto-incremented after every disableSaving() call */
+
+    Slot *slots;				/**< Queue of blocks in pipelined mode, or NULL */
+    unsigned int numSlots;		/**< Number of blocks in the queue */
+    Slot *curSlot;				/**< The slot that was returned by provideBlock(), or NULL if the block is dropped */
+    volatile unsigned int writePos;		/**< Number of blocks that were queued, only changed by the driver thread */
+    volatile unsigned int streamPos;	/**< Number of blocks that were handled by the streaming thread */
+    volatile unsigned int savePos;		/**< Number of blocks that were handled by the saving thread */
+    volatile bool stopWorkers;	/**< Tells the workers to exit once the queue is empty */
+    volatile bool workerError;	/**< Set if streaming or saving failed in one of the workers */
+    unsigned int numDropped;	/**< Number of blocks that were dropped because the queue was full */
+    unsigned int numDroppedReported;	/**< Value of numDropped at the last warning */
+    unsigned int maxQueueDepth;	/**< Largest number of queued blocks */
+    pthread_t streamThread, saveThread;
+    LocalPipe streamPipe, savePipe;	/**< Wake up the workers when a block has been queued */
+    pthread_mutex_t streamMutex;	/**< Held while streaming a block or changing the streaming configuration */
+    pthread_mutex_t saveMutex;		/**< Held while saving a block or changing the saving configuration */
+    pthread_mutex_t latencyMutex;	/**< Protects latencySum, latencyMax and latencyCount */
 };
 
 #endif
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+
+#ifndef __PolyphaseDecimator_h
+#define __PolyphaseDecimator_h
+
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.141592653589793
+#endif
+
+/** Templated class for lowpass filtering and downsampling a multi-channel signal
+	with a linear-phase FIR filter. Tex is the type of the externally used signal
+	(say, "float"), Tin is the internally used type (say, "double").
+
+	Only the samples that are kept after downsampling are computed. The input
+	samples in between are merely stored, so that the cost per input sample is
+	about numTaps/factor multiplications per channel, instead of the full filter
+	as with MultiChannelFilter followed by skipping samples. The kernel is
+	symmetric and has an odd number of taps, so the output is delayed by exactly
+	getGroupDelay() input samples at all frequencies.
+
+	The first output is computed from the first input sample, and then one out
+	of every "factor" input samples, just like skipping samples after an IIR filter.
+*/
+
+template <typename Tex, typename Tin>
+class PolyphaseDecimator {
+	public:
+
+	// Create decimator, numTaps is rounded up to an odd number
+	PolyphaseDecimator(int nChans, int factor, int numTaps);
+	~PolyphaseDecimator();
+
+	// Calculate the kernel as a Blackman-windowed sinc, with the
+	// normalised cutoff frequency (0<cutoff<1=Fnyquist of the input)
+	void setLowpass(double cutoff);
+
+	// Number of taps of the kernel, i.e., the length of the impulse response
+	int getNumTaps() const { return numTaps; }
+
+	// Delay of the filtered signal, in input samples
+	double getGroupDelay() const { return 0.5*(numTaps-1); }
+
+	// Number of outputs that process() will write for the next nSamples inputs
+	int getNumOutputs(int nSamples) const {
+		return (nSamples - phase + factor - 1)/factor;
+	}
+
+	// Run single input sample through the decimator, if this sample is kept
+	// the output is written to "dest" and true is returned.
+	// Both source and dest must point to an nChans-array of T.
+	bool process(Tex *dest, const Tex *source);
+
+	// Process multiple samples and write the outputs to "dest", which should
+	// have space for getNumOutputs(nSamples) samples. Returns the number written.
+	int process(int nSamples, Tex *dest, const Tex *source) {
+		int num = 0;
+		for (int i=0;i<nSamples;i++) {
+			if (process(dest + num*nChans, source + i*nChans)) num++;
+		}
+		return num;
+	}
+
+	// Clear the stored input samples (all zero), the input after the next
+	// "skip" inputs will be kept
+	void clear(int skip = 0);
+
+	protected:
+
+	double *h;
+	Tin *history;	// two copies of the last numTaps inputs, see process
+	Tin *acc;
+	int nChans, factor, numTaps, pos, phase;
+};
+
+template <typename Tex, typename Tin>
+PolyphaseDecimator<Tex,Tin>::PolyphaseDecimator(int nChans, int factor, int numTaps) {
+	this->nChans = nChans;
+	this->factor = (factor < 1) ? 1 : factor;
+	this->numTaps = (numTaps < 1) ? 1 : (numTaps | 1);
+
+	h = new double[this->numTaps];
+	history = new Tin[2*this->numTaps*nChans];
+	acc = new Tin[nChans];
+	clear();
+	setLowpass(1.0/this->factor);
+}
+
+template <typename Tex, typename Tin>
+PolyphaseDecimator<Tex,Tin>::~PolyphaseDecimator() {
+	delete[] h;
+	delete[] history;
+	delete[] acc;
+}
+
+template <typename Tex, typename Tin>
+void PolyphaseDecimator<Tex,Tin>::clear(int skip) {
+	for (int i=0;i<2*numTaps*nChans;i++) history[i]=0;
+	pos = 0;
+	phase = skip % factor;
+}
+
+template <typename Tex, typename Tin>
+void PolyphaseDecimator<Tex,Tin>::setLowpass(double cutoff) {
+	int c = numTaps/2;
+	double sum = 0.0;
+
+	if (cutoff > 1.0) cutoff = 1.0;
+	for (int k=0;k<numTaps;k++) {
+		double t = M_PI*cutoff*(k-c);
+		double w = (numTaps == 1) ? 1.0 : 2.0*M_PI*k/(numTaps-1);
+		double s = (k == c) ? 1.0 : sin(t)/t;
+		h[k] = s * (0.42 - 0.5*cos(w) + 0.08*cos(2.0*w));
+		sum += h[k];
+	}
+	// unit gain at DC
+	for (int k=0;k<numTaps;k++) h[k] /= sum;
+}
+
+template <typename Tex, typename Tin>
+bool PolyphaseDecimator<Tex,Tin>::process(Tex *dest, const Tex *source) {
+	// every input is written twice, numTaps rows apart, so that the last
+	// numTaps inputs are always next to each other, starting at row pos+1
+	Tin *row1 = history + pos*nChans;
+	Tin *row2 = row1 + numTaps*nChans;
+
+	for (int i=0;i<nChans;i++) row1[i] = row2[i] = (Tin) source[i];
+	if (++pos == numTaps) pos = 0;
+
+	bool keep = (phase == 0);
+	if (--phase < 0) phase = factor-1;
+	if (!keep) return false;
+
+	// the kernel is symmetric, so the oldest and newest inputs are added first
+	const Tin *x = history + pos*nChans;
+	int c = numTaps/2;
+	const Tin *mid = x + c*nChans;
+
+	for (int i=0;i<nChans;i++) acc[i] = (Tin) h[c]*mid[i];
+	for (int k=0;k<c;k++) {
+		const Tin *x1 = x + k*nChans;
+		const Tin *x2 = x + (numTaps-1-k)*nChans;
+		const Tin hk = (Tin) h[k];
+		for (int i=0;i<nChans;i++) acc[i] += hk*(x1[i] + x2[i]);
+	}
+	for (int i=0;i<nChans;i++) dest[i] = (Tex) acc[i];
+	return true;
+}
+
+#endif
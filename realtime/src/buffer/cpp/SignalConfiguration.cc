@@ -296,6 +296,12 @@ int SignalConfiguration::parseFile(const char *filename) {
 				order = bwOrder;
 				continue;
 			}
+			if (TS[0].equals("firtaps")) {
+				int nt;
+				if (!convertToInt(TS[1].text, nt) || nt<0) goto reportError;
+				firTaps = nt;
+				continue;
+			}
 			if (TS[0].equals("bandwidth")) {
 				double bw;
 				if (!convertToDouble(TS[1].text, bw) || bw < 0) goto reportError;
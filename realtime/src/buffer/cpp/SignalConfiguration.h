@@ -51,6 +51,10 @@ struct ChannelSelection {
 		return index[n];
 	}
 
+	const int *getIndices() const {
+		return index.empty() ? 0 : &index[0];
+	}
+
 	const char *getLabel(unsigned int n) const {
 		return label[n].c_str();
 	}
@@ -69,6 +73,10 @@ struct ChannelSelection {
 		return cs;
 	}
 
+	bool equals(const ChannelSelection& other) const {
+		return index == other.index && label == other.label;
+	}
+
 	int getMinIndex() const {
 		if (index.empty()) return -1;
 		int idx = index[0];
@@ -92,7 +100,7 @@ class SignalConfiguration {
 
 	SignalConfiguration() : splitTrigger(0), chanSelSave(), chanSelStream(),
 							downSample(1), maxChanSave(0), maxChanStream(0),
-							order(0), bandwidth(-1.0), sampleRate(0.0),
+							order(0), firTaps(0), bandwidth(-1.0), sampleRate(0.0),
 							batteryRefresh(10), statusRefresh(2) {};
 	~SignalConfiguration() {};
 
@@ -119,10 +127,19 @@ class SignalConfiguration {
 		}
 	}
 
+	/** Select a linear-phase FIR filter of the given length for downsampling
+		instead of the Butterworth filter, or switch back to the latter with 0 */
+	void setFirTaps(int numTaps) {
+		if (numTaps>=0) {
+			this->firTaps = numTaps;
+		}
+	}
+
 	int getDownsampling() const { return downSample; }
 	double getBandwidth() const { return bandwidth; }
 	double getSampleRate() const { return sampleRate; }
 	int getOrder() const { return order; }
+	int getFirTaps() const { return firTaps; }
 	int getBatteryRefresh() const { return batteryRefresh; }
 	int getStatusRefresh() const { return statusRefresh; }
 	int getMaxSavingChannel() const { return maxChanSave; }
@@ -168,6 +185,7 @@ class SignalConfiguration {
 	int maxChanSave;
 	int maxChanStream;
 	int order;
+	int firTaps;
 	double bandwidth;
 	double sampleRate;
 	int batteryRefresh, statusRefresh;
@@ -0,0 +1,452 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+
+#ifndef __SlidingSpectrum_h
+#define __SlidingSpectrum_h
+
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.141592653589793
+#endif
+
+/** Templated class for estimating the power spectrum of a multi-channel signal
+	over a sliding window. Tex is the type of the externally used signal (say,
+	"float"), Tin is the internally used type (say, "double").
+
+	A spectrum of the last winLen input samples is computed once every "hop"
+	input samples, starting as soon as the first winLen samples are in. Each
+	spectrum has getNumFreqs() values per channel, first those of channel 0,
+	then those of channel 1, etc. The methods are
+
+	WELCH       the periodogram of the Hann-tapered window, averaged over the
+	            last numAverages hops. Only the periodogram of the newest
+	            window is computed, those of the previous hops are kept.
+	MULTITAPER  the periodograms of numTapers sine tapers of the window,
+	            averaged. This has less variance than a single taper, at the
+	            cost of numTapers transforms per hop.
+	GOERTZEL    the power in a few bands only, each the sum over the bins of
+	            the band, computed with the Goertzel recursion on the Hann-tapered
+	            window. This is cheaper than a transform for a handful of bins.
+
+	The values are the power per bin of the one-sided spectrum, so that they
+	add up to the mean square of the signal (e.g. 0.5 over the bins of a sine
+	with unit amplitude). The transforms are zero-padded to a power of two,
+	their twiddle factors and the tapers are computed once when the method is
+	set. The channels are transformed in pairs, one as the real and one as the
+	imaginary part of a complex transform.
+
+	All frequencies are normalised (0<f<1=Fnyquist), as with MultiChannelFilter.
+*/
+
+template <typename Tex, typename Tin>
+class SlidingSpectrum {
+	public:
+
+	enum Method { WELCH = 0, MULTITAPER = 1, GOERTZEL = 2 };
+
+	// Create the stage for windows of winLen samples that slide by hop samples,
+	// by default with WELCH without averaging, and all frequencies
+	SlidingSpectrum(int nChans, int winLen, int hop);
+	~SlidingSpectrum();
+
+	// Average the periodograms of the last numAverages hops
+	void setWelch(int numAverages);
+	// Average the periodograms of numTapers sine tapers
+	void setMultitaper(int numTapers);
+	// Keep the bins between the normalised frequencies lo and hi (for WELCH and MULTITAPER)
+	void setFrequencyRange(double lo, double hi);
+	// Compute the power in num bands instead, BANDS points to num pairs of normalised
+	// frequencies lo and hi. A band that is narrower than a bin gets the nearest bin.
+	void setBands(int num, const double *bands);
+
+	int getMethod() const { return method; }
+	int getWindowLength() const { return winLen; }
+	int getHop() const { return hop; }
+
+	// Number of bins or bands per channel, and the normalised centre frequency of each
+	int getNumFreqs() const { return numFreqs; }
+	double getFrequency(int k) const;
+
+	// Number of spectra that process() will write for the next nSamples inputs
+	int getNumOutputs(int nSamples) const {
+		return (nSamples < untilNext) ? 0 : 1 + (nSamples - untilNext)/hop;
+	}
+
+	// Process multiple samples and write the spectra to "dest", which should have
+	// space for getNumOutputs(nSamples) rows of nChans*getNumFreqs(). Returns the number written.
+	int process(int nSamples, Tex *dest, const Tex *source);
+
+	// Clear the stored input samples and periodograms, the next spectrum is computed
+	// once winLen new samples are in
+	void clear();
+
+	protected:
+
+	void setTapers(int num, bool sine);
+	void computeSpectrum(Tex *dest);
+	void computeBands(Tex *dest);
+	void fft(Tin *re, Tin *im) const;
+
+	int nChans, winLen, hop, method;
+	int pos, untilNext;
+	Tin *history;		// two copies of the last winLen inputs, as in PolyphaseDecimator
+
+	// the transform, of nfft points
+	int nfft;
+	int *bitrev;
+	double *cosTab, *sinTab;
+	Tin *re, *im;
+
+	// the tapers, each of winLen samples and scaled to unit energy
+	double *tapers;
+	int numTapers;
+
+	// bins of the transform that are kept, or those of the bands for GOERTZEL
+	int firstBin, numFreqs;
+	int numBands, numBandBins;
+	int *bandOf;		// for each bin of the bands its band
+	double *bandFreq;	// the bins of the bands, as normalised frequencies
+	double *bandRange;	// lo and hi of each band
+	Tin *s1, *s2;
+
+	// kept periodograms for WELCH, and their sum
+	int numAverages, numStored, avgPos;
+	Tin *periodograms;
+	Tin *acc;
+};
+
+template <typename Tex, typename Tin>
+SlidingSpectrum<Tex,Tin>::SlidingSpectrum(int nChans, int winLen, int hop) {
+	this->nChans = nChans;
+	this->winLen = (winLen < 2) ? 2 : winLen;
+	this->hop = (hop < 1) ? 1 : hop;
+
+	for (nfft=2;nfft<this->winLen;nfft*=2) {}
+
+	history = new Tin[2*this->winLen*nChans];
+	bitrev = new int[nfft];
+	cosTab = new double[nfft/2];
+	sinTab = new double[nfft/2];
+	re = new Tin[nfft];
+	im = new Tin[nfft];
+
+	int bits = 0;
+	while ((1<<bits) < nfft) bits++;
+	for (int i=0;i<nfft;i++) {
+		int r = 0;
+		for (int b=0;b<bits;b++) if (i & (1<<b)) r |= 1<<(bits-1-b);
+		bitrev[i] = r;
+	}
+	for (int k=0;k<nfft/2;k++) {
+		cosTab[k] = cos(2.0*M_PI*k/nfft);
+		sinTab[k] = sin(2.0*M_PI*k/nfft);
+	}
+
+	tapers = NULL;
+	numTapers = 0;
+	bandOf = NULL;
+	bandFreq = NULL;
+	bandRange = NULL;
+	numBands = numBandBins = 0;
+	s1 = new Tin[nChans];
+	s2 = new Tin[nChans];
+	periodograms = NULL;
+	acc = NULL;
+
+	method = WELCH;
+	numAverages = 1;
+	setTapers(1, false);
+	setFrequencyRange(0.0, 1.0);
+}
+
+template <typename Tex, typename Tin>
+SlidingSpectrum<Tex,Tin>::~SlidingSpectrum() {
+	delete[] history;
+	delete[] bitrev;
+	delete[] cosTab;
+	delete[] sinTab;
+	delete[] re;
+	delete[] im;
+	delete[] acc;
+	delete[] tapers;
+	delete[] bandOf;
+	delete[] bandFreq;
+	delete[] bandRange;
+	delete[] s1;
+	delete[] s2;
+	delete[] periodograms;
+}
+
+template <typename Tex, typename Tin>
+void SlidingSpectrum<Tex,Tin>::clear() {
+	for (int i=0;i<2*winLen*nChans;i++) history[i]=0;
+	pos = 0;
+	untilNext = winLen;
+	numStored = 0;
+	avgPos = 0;
+}
+
+// Fill in the Hann taper, or num sine tapers, each with unit energy
+template <typename Tex, typename Tin>
+void SlidingSpectrum<Tex,Tin>::setTapers(int num, bool sine) {
+	delete[] tapers;
+	numTapers = num;
+	tapers = new double[num*winLen];
+	for (int j=0;j<num;j++) {
+		double *w = tapers + j*winLen;
+		double sum = 0.0;
+		for (int n=0;n<winLen;n++) {
+			if (sine) {
+				w[n] = sin(M_PI*(j+1)*(n+1)/(winLen+1));
+			} else {
+				w[n] = 0.5 - 0.5*cos(2.0*M_PI*n/(winLen-1));
+			}
+			sum += w[n]*w[n];
+		}
+		sum = sqrt(sum);
+		for (int n=0;n<winLen;n++) w[n] /= sum;
+	}
+}
+
+template <typename Tex, typename Tin>
+void SlidingSpectrum<Tex,Tin>::setWelch(int numAverages) {
+	bool bands = (method == GOERTZEL);
+	double lo = bands ? 0.0 : getFrequency(0);
+	double hi = bands ? 1.0 : getFrequency(numFreqs-1);
+
+	method = WELCH;
+	this->numAverages = (numAverages < 1) ? 1 : numAverages;
+	setTapers(1, false);
+	setFrequencyRange(lo, hi);
+}
+
+template <typename Tex, typename Tin>
+void SlidingSpectrum<Tex,Tin>::setMultitaper(int numTapers) {
+	bool bands = (method == GOERTZEL);
+	double lo = bands ? 0.0 : getFrequency(0);
+	double hi = bands ? 1.0 : getFrequency(numFreqs-1);
+
+	method = MULTITAPER;
+	setTapers((numTapers < 1) ? 1 : numTapers, true);
+	setFrequencyRange(lo, hi);
+}
+
+template <typename Tex, typename Tin>
+void SlidingSpectrum<Tex,Tin>::setFrequencyRange(double lo, double hi) {
+	int last;
+
+	if (method == GOERTZEL) return;
+	firstBin = (int) ceil(0.5*lo*nfft - 1e-9);
+	last = (int) floor(0.5*hi*nfft + 1e-9);
+	if (firstBin < 0) firstBin = 0;
+	if (last > nfft/2) last = nfft/2;
+	if (last < firstBin) {
+		// narrower than a bin, take the nearest one
+		firstBin = last = (int) floor(0.25*(lo+hi)*nfft + 0.5);
+		if (firstBin > nfft/2) firstBin = last = nfft/2;
+	}
+	numFreqs = last - firstBin + 1;
+
+	delete[] periodograms;
+	delete[] acc;
+	periodograms = (method == WELCH) ? new Tin[numAverages*nChans*numFreqs] : NULL;
+	acc = new Tin[nChans*numFreqs];
+	clear();
+}
+
+template <typename Tex, typename Tin>
+void SlidingSpectrum<Tex,Tin>::setBands(int num, const double *bands) {
+	method = GOERTZEL;
+	setTapers(1, false);
+	delete[] bandRange;
+	delete[] periodograms;
+	periodograms = NULL;
+
+	// the bins are those of a transform of winLen points, without zero-padding
+	numBands = num;
+	numBandBins = 0;
+	bandRange = new double[2*num];
+	for (int b=0;b<num;b++) {
+		int k1 = (int) ceil(0.5*bands[2*b]*winLen - 1e-9);
+		int k2 = (int) floor(0.5*bands[2*b+1]*winLen + 1e-9);
+		if (k1 < 0) k1 = 0;
+		if (k2 > winLen/2) k2 = winLen/2;
+		numBandBins += (k2 < k1) ? 1 : k2 - k1 + 1;
+		bandRange[2*b]   = bands[2*b];
+		bandRange[2*b+1] = bands[2*b+1];
+	}
+
+	delete[] bandOf;
+	delete[] bandFreq;
+	bandOf = new int[numBandBins];
+	bandFreq = new double[numBandBins];
+	for (int b=0, j=0;b<num;b++) {
+		int k1 = (int) ceil(0.5*bands[2*b]*winLen - 1e-9);
+		int k2 = (int) floor(0.5*bands[2*b+1]*winLen + 1e-9);
+		if (k1 < 0) k1 = 0;
+		if (k2 > winLen/2) k2 = winLen/2;
+		if (k2 < k1) {
+			k1 = k2 = (int) floor(0.25*(bands[2*b]+bands[2*b+1])*winLen + 0.5);
+			if (k1 > winLen/2) k1 = k2 = winLen/2;
+		}
+		for (int k=k1;k<=k2;k++,j++) {
+			bandOf[j] = b;
+			bandFreq[j] = 2.0*k/winLen;
+		}
+	}
+	numFreqs = num;
+	delete[] acc;
+	acc = new Tin[nChans*numFreqs];
+	clear();
+}
+
+template <typename Tex, typename Tin>
+double SlidingSpectrum<Tex,Tin>::getFrequency(int k) const {
+	if (method == GOERTZEL) return 0.5*(bandRange[2*k] + bandRange[2*k+1]);
+	return 2.0*(firstBin + k)/nfft;
+}
+
+template <typename Tex, typename Tin>
+int SlidingSpectrum<Tex,Tin>::process(int nSamples, Tex *dest, const Tex *source) {
+	int num = 0;
+
+	for (int t=0;t<nSamples;t++) {
+		// every input is written twice, winLen rows apart, so that the last
+		// winLen inputs are always next to each other, starting at row pos
+		const Tex *x = source + t*nChans;
+		Tin *row1 = history + pos*nChans;
+		Tin *row2 = row1 + winLen*nChans;
+
+		for (int i=0;i<nChans;i++) row1[i] = row2[i] = (Tin) x[i];
+		if (++pos == winLen) pos = 0;
+		if (--untilNext > 0) continue;
+		untilNext = hop;
+
+		if (method == GOERTZEL) {
+			computeBands(dest + num*nChans*numFreqs);
+		} else {
+			computeSpectrum(dest + num*nChans*numFreqs);
+		}
+		num++;
+	}
+	return num;
+}
+
+// In-place complex transform of nfft points (iterative radix-2)
+template <typename Tex, typename Tin>
+void SlidingSpectrum<Tex,Tin>::fft(Tin *re, Tin *im) const {
+	for (int i=0;i<nfft;i++) {
+		int j = bitrev[i];
+		if (j > i) {
+			Tin t = re[i]; re[i] = re[j]; re[j] = t;
+			t = im[i]; im[i] = im[j]; im[j] = t;
+		}
+	}
+	for (int len=2;len<=nfft;len*=2) {
+		int half = len/2;
+		int step = nfft/len;
+		for (int i=0;i<nfft;i+=len) {
+			for (int k=0;k<half;k++) {
+				const Tin wr = (Tin) cosTab[k*step];
+				const Tin wi = (Tin) -sinTab[k*step];
+				int a = i+k, b = a+half;
+				Tin tr = wr*re[b] - wi*im[b];
+				Tin ti = wr*im[b] + wi*re[b];
+				re[b] = re[a] - tr;
+				im[b] = im[a] - ti;
+				re[a] += tr;
+				im[a] += ti;
+			}
+		}
+	}
+}
+
+template <typename Tex, typename Tin>
+void SlidingSpectrum<Tex,Tin>::computeSpectrum(Tex *dest) {
+	const Tin *x = history + pos*nChans;
+	Tin *P = (method == WELCH) ? periodograms + avgPos*nChans*numFreqs : acc;
+
+	for (int i=0;i<nChans*numFreqs;i++) P[i] = 0;
+
+	for (int c=0;c<nChans;c+=2) {
+		bool pair = (c+1 < nChans);
+		Tin *Pa = P + c*numFreqs;
+		Tin *Pb = Pa + numFreqs;
+
+		for (int j=0;j<numTapers;j++) {
+			const double *w = tapers + j*winLen;
+			for (int n=0;n<winLen;n++) {
+				re[n] = (Tin) w[n]*x[n*nChans + c];
+				im[n] = pair ? (Tin) w[n]*x[n*nChans + c+1] : 0;
+			}
+			for (int n=winLen;n<nfft;n++) re[n] = im[n] = 0;
+			fft(re, im);
+
+			// Z = A + iB for the real signals a and b, so A[k] = (Z[k] + conj(Z[-k]))/2
+			// and B[k] = (Z[k] - conj(Z[-k]))/2i
+			for (int f=0;f<numFreqs;f++) {
+				int k = firstBin + f;
+				int m = (nfft - k) & (nfft - 1);
+				Tin scale = (Tin) (((k == 0 || 2*k == nfft) ? 0.25 : 0.5)/nfft);
+				Tin ar = re[k] + re[m], ai = im[k] - im[m];
+				Tin br = im[k] + im[m], bi = re[k] - re[m];
+				Pa[f] += scale*(ar*ar + ai*ai);
+				if (pair) Pb[f] += scale*(br*br + bi*bi);
+			}
+		}
+	}
+
+	if (method == MULTITAPER) {
+		Tin scale = (Tin) (1.0/numTapers);
+		for (int i=0;i<nChans*numFreqs;i++) dest[i] = (Tex) (scale*acc[i]);
+		return;
+	}
+
+	// WELCH: the mean of the periodograms that are kept, including this one
+	if (numStored < numAverages) numStored++;
+	if (++avgPos == numAverages) avgPos = 0;
+	for (int i=0;i<nChans*numFreqs;i++) acc[i] = 0;
+	for (int a=0;a<numStored;a++) {
+		const Tin *Pa = periodograms + a*nChans*numFreqs;
+		for (int i=0;i<nChans*numFreqs;i++) acc[i] += Pa[i];
+	}
+	Tin scale = (Tin) (1.0/numStored);
+	for (int i=0;i<nChans*numFreqs;i++) dest[i] = (Tex) (scale*acc[i]);
+}
+
+template <typename Tex, typename Tin>
+void SlidingSpectrum<Tex,Tin>::computeBands(Tex *dest) {
+	const Tin *x = history + pos*nChans;
+	const double *w = tapers;
+
+	for (int i=0;i<nChans*numBands;i++) acc[i] = 0;
+
+	for (int j=0;j<numBandBins;j++) {
+		// s[n] = w[n]x[n] + 2cos(omega)s[n-1] - s[n-2] for all channels at once
+		const Tin coef = (Tin) (2.0*cos(M_PI*bandFreq[j]));
+		bool edge = (bandFreq[j] == 0.0 || bandFreq[j] == 1.0);
+		const Tin scale = (Tin) ((edge ? 1.0 : 2.0)/winLen);
+		int b = bandOf[j];
+
+		for (int i=0;i<nChans;i++) s1[i] = s2[i] = 0;
+		for (int n=0;n<winLen;n++) {
+			const Tin *xn = x + n*nChans;
+			const Tin wn = (Tin) w[n];
+			for (int i=0;i<nChans;i++) {
+				Tin s = wn*xn[i] + coef*s1[i] - s2[i];
+				s2[i] = s1[i];
+				s1[i] = s;
+			}
+		}
+		for (int i=0;i<nChans;i++) {
+			acc[i*numBands + b] += scale*(s1[i]*s1[i] + s2[i]*s2[i] - coef*s1[i]*s2[i]);
+		}
+	}
+	for (int i=0;i<nChans*numBands;i++) dest[i] = (Tex) acc[i];
+}
+
+#endif
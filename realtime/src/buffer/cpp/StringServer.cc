@@ -6,6 +6,9 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
+#include <pthread.h>
+#include <deque>
+#include <vector>
 
 #include <StringServer.h>
 
@@ -15,53 +18,118 @@
 #define SD_BOTH   0x02
 #endif
 
+#include <winsock2.h>
 #include <windows.h>
+#include <sys/timeb.h>
 #define socklen_t       int
 #define shutdown_rw(s)  shutdown(s, SD_BOTH)
+#define poll            WSAPoll
+#define MSG_NOSIGNAL    0
 
 #else // Linux and OS X
 
 #include <arpa/inet.h>
 #include <sys/socket.h>
-#include <sys/select.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
 
 #define SOCKET          int
 #define INVALID_SOCKET  -1
 #define closesocket     close
 #define shutdown_rw(s)  shutdown(s, SHUT_RDWR)
 
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL    0
 #endif
 
-#define MAXCLIENTS 32
+#endif
 
 static int numStringServers = 0;
 
 struct StringServerClientCtrl {
 	SOCKET sock;
+	unsigned int id;
 	std::string req;
 	std::string resp;
 };
 
+/** A request or response, together with the client it belongs to */
+struct StringServerMessage {
+	unsigned int client;
+	std::string text;
+};
+
 struct StringServerCtrl {
 	SOCKET sock;
+	pthread_t thread;
+	pthread_mutex_t mutex;		// protects the two queues and stop
+	pthread_cond_t cond;		// signalled when requests are queued
+	std::deque<StringServerMessage> requests;
+	std::deque<StringServerMessage> responses;
+	bool stop;
+#ifndef WIN32
+	int wakeFD[2];				// wakes up the thread when responses are queued
+#endif
+	// the fields below are only used by the thread
+	std::vector<StringServerClientCtrl *> clients;
+	unsigned int nextId;
+	char rcvBuf[16*1024];
 };
 
+/* places the socket in non-blocking mode */
+static bool setNonBlocking(SOCKET s) {
+#ifdef WIN32
+	unsigned long enable = 1;
+	return ioctlsocket(s, FIONBIO, &enable) == 0;
+#else
+	int flags = fcntl(s, F_GETFL, NULL);
+	return flags >= 0 && fcntl(s, F_SETFL, flags | O_NONBLOCK) >= 0;
+#endif
+}
+
+/* sends as much of the pending response as possible without blocking */
+static void sendResponse(StringServerClientCtrl *cli) {
+	while (!cli->resp.empty()) {
+		int r = send(cli->sock, cli->resp.data(), cli->resp.size(), MSG_NOSIGNAL);
+		if (r<=0) return;
+		cli->resp.erase(0,r);
+	}
+}
+
+/* absolute time after the given number of milliseconds, for pthread_cond_timedwait */
+static void getDeadline(struct timespec *ts, int milliSeconds) {
+#ifdef WIN32
+	struct _timeb tb;
+	_ftime(&tb);
+	ts->tv_sec  = tb.time;
+	ts->tv_nsec = tb.millitm * 1000000L;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	ts->tv_sec  = tv.tv_sec;
+	ts->tv_nsec = tv.tv_usec * 1000L;
+#endif
+	ts->tv_sec  += milliSeconds / 1000;
+	ts->tv_nsec += (milliSeconds % 1000) * 1000000L;
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
 StringServer::StringServer(int bufSize) {
 	defaultBufSize = bufSize;
 	server = new StringServerCtrl;
-	client = new StringServerClientCtrl*[MAXCLIENTS];
 	listening = false;
-	numClients = 0;
-	maxFD = 0;
 
 	if (numStringServers++ == 0) {
 		#ifdef WIN32
 		WSADATA wsa = {0,0};
-		if(WSAStartup(MAKEWORD(1, 1), &wsa)) {
+		if(WSAStartup(MAKEWORD(2, 2), &wsa)) {
 			fprintf(stderr, "StringServer: cannot start WIN32 sockets.\n");
 		}
 		#endif
@@ -70,7 +138,6 @@ StringServer::StringServer(int bufSize) {
 
 StringServer::~StringServer() {
 	stopListening();
-	delete[] client;
 	delete server;
 
 	if (--numStringServers == 0) {
@@ -83,14 +150,30 @@ StringServer::~StringServer() {
 void StringServer::stopListening() {
 	if (!listening) return;
 
-	for (int i=0;i<numClients;i++) {
-		shutdown_rw(client[i]->sock);
-		closesocket(client[i]->sock);
-		delete client[i];
-		client[i] = NULL;
+	pthread_mutex_lock(&server->mutex);
+	server->stop = true;
+	pthread_mutex_unlock(&server->mutex);
+#ifndef WIN32
+	char token = 0;
+	if (write(server->wakeFD[1], &token, 1) < 0) perror("StringServer::stopListening -> write");
+#endif
+	pthread_join(server->thread, NULL);
+
+	for (unsigned int i=0;i<server->clients.size();i++) {
+		shutdown_rw(server->clients[i]->sock);
+		closesocket(server->clients[i]->sock);
+		delete server->clients[i];
 	}
-	numClients = 0;
+	server->clients.clear();
+	server->requests.clear();
+	server->responses.clear();
 	closesocket(server->sock);
+#ifndef WIN32
+	close(server->wakeFD[0]);
+	close(server->wakeFD[1]);
+#endif
+	pthread_cond_destroy(&server->cond);
+	pthread_mutex_destroy(&server->mutex);
 	listening = false;
 }
 
@@ -123,29 +206,46 @@ bool StringServer::startListening(int port) {
 		return false;
 	}
 
-	/* place the socket in non-blocking mode, required to do thread cancelation */
-#ifdef WIN32
-	{
-		unsigned long enable = 0;
-		ioctlsocket(server->sock, FIONBIO, &enable);
-	}
-#else
-	optval = fcntl(server->sock, F_GETFL, NULL);
-	optval = optval | O_NONBLOCK;
-	if (fcntl(server->sock, F_SETFL, optval)<0) {
+	/* place the socket in non-blocking mode, so that accept() does not block the thread */
+	if (!setNonBlocking(server->sock)) {
 		perror("StringServer::listen -> fcntl");
 		closesocket(server->sock);
 		return false;
 	}
-	maxFD = server->sock;
-#endif
 
-	if (listen(server->sock, 5)<0) {
+	if (listen(server->sock, SOMAXCONN)<0) {
 		perror("StringServer::listen -> listen");
 		closesocket(server->sock);
 		return false;
 	}
 
+#ifndef WIN32
+	if (pipe(server->wakeFD) < 0) {
+		perror("StringServer::listen -> pipe");
+		closesocket(server->sock);
+		return false;
+	}
+	fcntl(server->wakeFD[0], F_SETFL, O_NONBLOCK);
+	fcntl(server->wakeFD[1], F_SETFL, O_NONBLOCK);
+#endif
+
+	pthread_mutex_init(&server->mutex, NULL);
+	pthread_cond_init(&server->cond, NULL);
+	server->stop = false;
+	server->nextId = 0;
+
+	if (pthread_create(&server->thread, NULL, threadFunction, this)) {
+		fprintf(stderr, "StringServer::listen -> could not spawn thread\n");
+		pthread_cond_destroy(&server->cond);
+		pthread_mutex_destroy(&server->mutex);
+#ifndef WIN32
+		close(server->wakeFD[0]);
+		close(server->wakeFD[1]);
+#endif
+		closesocket(server->sock);
+		return false;
+	}
+
 	listening = true;
 
 	return true;
@@ -153,109 +253,198 @@ bool StringServer::startListening(int port) {
 
 
 int StringServer::checkRequests(StringRequestHandler& handler, int milliSeconds) {
-	fd_set readSet;
-	fd_set writeSet;
-	struct timeval tv;
+	std::deque<StringServerMessage> batch;
 	int requests = 0;
 
 	if (!listening) return -1;
 
-	tv.tv_sec = milliSeconds / 1000;
-	tv.tv_usec = (milliSeconds % 1000) * 1000;
-
-	FD_ZERO(&readSet);
-	FD_ZERO(&writeSet);
-
-	if (numClients < MAXCLIENTS) {
-		FD_SET(server->sock, &readSet);
+	pthread_mutex_lock(&server->mutex);
+	if (server->requests.empty() && milliSeconds > 0) {
+		struct timespec deadline;
+		getDeadline(&deadline, milliSeconds);
+		while (server->requests.empty()) {
+			if (pthread_cond_timedwait(&server->cond, &server->mutex, &deadline) != 0) break;
+		}
 	}
-	for (int i=0;i<numClients;i++) {
-		FD_SET(client[i]->sock, &readSet);
-		if (client[i]->resp.size() > 0) FD_SET(client[i]->sock, &writeSet);
+	batch.swap(server->requests);
+	pthread_mutex_unlock(&server->mutex);
+
+	if (batch.empty()) return 0;
+
+	// the responses to consecutive requests of the same client are sent in one go
+	std::deque<StringServerMessage> responses;
+	for (unsigned int i=0;i<batch.size();i++) {
+		std::string out = handler.handleStringRequest(batch[i].text);
+		requests++;
+		if (out.empty()) continue;
+		if (!responses.empty() && responses.back().client == batch[i].client) {
+			responses.back().text.append(out);
+		} else {
+			StringServerMessage msg;
+			msg.client = batch[i].client;
+			msg.text = out;
+			responses.push_back(msg);
+		}
 	}
 
-	int n = select(maxFD+1, &readSet, &writeSet, NULL, &tv);
+	if (!responses.empty()) {
+		pthread_mutex_lock(&server->mutex);
+		server->responses.insert(server->responses.end(), responses.begin(), responses.end());
+		pthread_mutex_unlock(&server->mutex);
+#ifndef WIN32
+		char token = 0;
+		// if the pipe is full, the thread is going to wake up anyway
+		if (write(server->wakeFD[1], &token, 1) < 0 && errno != EAGAIN) perror("StringServer::checkRequests -> write");
+#endif
+	}
+	return requests;
+}
 
-	if (n==0) return 0;
+void *StringServer::threadFunction(void *arg) {
+	StringServer *SS = (StringServer *) arg;
+	SS->serveClients();
+	return NULL;
+}
 
-	// first iterate through client connections
-	int idx = 0;
-	while (idx<numClients) {
-		StringServerClientCtrl *cli = client[idx];
-		bool startResponse = cli->resp.empty();
+void StringServer::serveClients() {
+	std::vector<struct pollfd> fds;
+	std::deque<StringServerMessage> responses;
 
-		if (FD_ISSET(cli->sock, &readSet)) {
-			int r = recv(cli->sock, rcvBuf, sizeof(rcvBuf), 0);
-			if (r<=0) {
-				// printf("Closing client %i\n", idx);
-				closeClient(idx);
-				continue;
+	while (1) {
+		pthread_mutex_lock(&server->mutex);
+		bool stop = server->stop;
+		responses.swap(server->responses);
+		pthread_mutex_unlock(&server->mutex);
+		if (stop) break;
+
+		// hand the new responses to their clients, these may have gone in the meantime
+		for (unsigned int i=0;i<responses.size();i++) {
+			for (unsigned int k=0;k<server->clients.size();k++) {
+				StringServerClientCtrl *cli = server->clients[k];
+				if (cli->id != responses[i].client) continue;
+				cli->resp.append(responses[i].text);
+				sendResponse(cli);
+				break;
 			}
+		}
+		responses.clear();
+
+		fds.clear();
+		struct pollfd pfd;
+#ifndef WIN32
+		pfd.fd = server->wakeFD[0];
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		fds.push_back(pfd);
+#endif
+		pfd.fd = server->sock;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		fds.push_back(pfd);
+		unsigned int first = fds.size();
+		for (unsigned int k=0;k<server->clients.size();k++) {
+			pfd.fd = server->clients[k]->sock;
+			pfd.events = server->clients[k]->resp.empty() ? POLLIN : (POLLIN | POLLOUT);
+			pfd.revents = 0;
+			fds.push_back(pfd);
+		}
+
+#ifdef WIN32
+		// there is no pipe to wake up the thread, so it looks for responses every 10ms
+		int n = poll(&fds[0], fds.size(), 10);
+#else
+		int n = poll(&fds[0], fds.size(), -1);
+#endif
+		if (n < 0) {
+#ifndef WIN32
+			if (errno == EINTR) continue;
+#endif
+			perror("StringServer::serveClients -> poll");
+			break;
+		}
+		if (n == 0) continue;
 
-			cli->req.append(rcvBuf, r);
-			// startResponse = "empty before" and "non-empty now"
-			startResponse &= checkCompletion(handler, cli);
+#ifndef WIN32
+		if (fds[0].revents & POLLIN) {
+			char tokens[64];
+			while (read(server->wakeFD[0], tokens, sizeof(tokens)) > 0);
 		}
+#endif
 
-		if (FD_ISSET(cli->sock, &writeSet) || startResponse) {
-			int r = send(cli->sock, cli->resp.data(), cli->resp.size(), 0);
-			if (r>0) {
-				cli->resp.erase(0,r);
+		// walk backwards, so that closing a client does not disturb the others
+		for (int k=(int) server->clients.size()-1;k>=0;k--) {
+			StringServerClientCtrl *cli = server->clients[k];
+			short revents = fds[first+k].revents;
+
+			if (revents & POLLOUT) sendResponse(cli);
+			if (revents & (POLLIN | POLLHUP | POLLERR)) {
+				int r = recv(cli->sock, server->rcvBuf, sizeof(server->rcvBuf), 0);
+				if (r<=0) {
+					// printf("Closing client %i\n", k);
+					shutdown_rw(cli->sock);
+					closesocket(cli->sock);
+					delete cli;
+					server->clients.erase(server->clients.begin() + k);
+					continue;
+				}
+				cli->req.append(server->rcvBuf, r);
+				readClient(cli);
 			}
 		}
 
-		++idx;
+		if (fds[first-1].revents & POLLIN) acceptClients();
 	}
+}
 
-	// accept new connection, if any
-	if (FD_ISSET(server->sock, &readSet)) {
-		struct sockaddr_in sa;
-		socklen_t size_sa = sizeof(sa);
-
-		SOCKET c = accept(server->sock, (struct sockaddr *)&sa, &size_sa);
+/* queues all complete lines of the client as requests */
+void StringServer::readClient(StringServerClientCtrl *cli) {
+	std::deque<StringServerMessage> lines;
+	size_t pos = 0;
 
-		if (c == INVALID_SOCKET) {
-			perror("StringServer::checkRequests -> accept");
-		} else {
-			client[numClients] = new StringServerClientCtrl;
-			client[numClients]->req.reserve(defaultBufSize);
-			client[numClients]->sock = c;
-			numClients++;
-
-			#ifndef WIN32
-			if (c > maxFD) maxFD = c;
-			#endif
-		}
+	while (1) {
+		size_t p0 = cli->req.find('\n', pos);
+		if (p0 == cli->req.npos) break;
+
+		size_t len = p0 - pos;
+		// also accept lines that end in CR LF
+		if (len > 0 && cli->req[p0-1] == '\r') len--;
+
+		StringServerMessage msg;
+		msg.client = cli->id;
+		msg.text.assign(cli->req, pos, len);
+		lines.push_back(msg);
+		pos = p0+1;
 	}
+	if (lines.empty()) return;
+	cli->req.erase(0, pos);
 
-	return requests;
+	pthread_mutex_lock(&server->mutex);
+	server->requests.insert(server->requests.end(), lines.begin(), lines.end());
+	pthread_cond_signal(&server->cond);
+	pthread_mutex_unlock(&server->mutex);
 }
 
-bool StringServer::checkCompletion(StringRequestHandler& handler, StringServerClientCtrl *cli) {
-	bool newResp = false;
+void StringServer::acceptClients() {
 	while (1) {
-		size_t p0 = cli->req.find('\n');
-		if (p0 == cli->req.npos) return newResp;
-
-		std::string out(cli->req, 0, p0);
-		std::string in = handler.handleStringRequest(out);
-		cli->req.erase(0, p0+1);
-		if (!in.empty()) {
-			newResp = true;
-			cli->resp.append(in);
-		}
-	}
-}
-
-void StringServer::closeClient(int idx) {
-	shutdown_rw(client[idx]->sock);
-	closesocket(client[idx]->sock);
-	delete client[idx];
+		struct sockaddr_in sa;
+		socklen_t size_sa = sizeof(sa);
 
-	if (idx < numClients - 1) {
-		client[idx] = client[numClients-1];
-	} else {
-		client[idx] = NULL;
+		SOCKET c = accept(server->sock, (struct sockaddr *)&sa, &size_sa);
+		if (c == INVALID_SOCKET) {
+#ifndef WIN32
+			if (errno != EAGAIN && errno != EWOULDBLOCK) perror("StringServer::acceptClients -> accept");
+#endif
+			return;
+		}
+		if (!setNonBlocking(c)) {
+			perror("StringServer::acceptClients -> fcntl");
+			closesocket(c);
+			continue;
+		}
+		StringServerClientCtrl *cli = new StringServerClientCtrl;
+		cli->req.reserve(defaultBufSize);
+		cli->sock = c;
+		cli->id = server->nextId++;
+		server->clients.push_back(cli);
 	}
-	numClients--;
 }
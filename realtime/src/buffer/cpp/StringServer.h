@@ -1,6 +1,14 @@
 /** Simple C++ class for managing ASCII requests from a TCP port.
 
 	(C) 2010 S. Klanke
+
+	The connections are served by a background thread, which is started by
+	startListening(). It splits the input of every client into lines, and
+	queues these as requests. The requests of all clients are handled in the
+	order in which they arrived, in the thread that calls checkRequests(),
+	and the responses are sent back by the background thread. A client can
+	therefore send many lines at once (e.g., a script that selects a lot of
+	channels), without waiting for the response to each of them.
 */
 
 #ifndef __StringServer_h
@@ -26,9 +34,14 @@ class StringServer {
 	bool startListening(int port);
 	void stopListening();
 
+	/** Handles the queued requests, waiting at most milliSeconds for the first one
+		if there are none yet. Returns the number of requests that were handled,
+		or -1 if the server is not listening.
+	*/
 	int checkRequests(StringRequestHandler& handler, int milliSeconds = 0);
 
 	static std::string getNextToken(const std::string& in, unsigned int& pos) {
+		if (pos >= in.size()) return std::string();
 		while (isspace(in[pos])) {
 			if (++pos == in.size()) {
 				return std::string();
@@ -43,16 +56,14 @@ class StringServer {
 
 	protected:
 
-	void closeClient(int idx);
-	bool checkCompletion(StringRequestHandler& handler, StringServerClientCtrl *cli);
+	static void *threadFunction(void *arg);
+	void serveClients();
+	void readClient(StringServerClientCtrl *cli);
+	void acceptClients();
 
 	int defaultBufSize;
 	bool listening;
-	int numClients;
-	int maxFD;
-	StringServerClientCtrl **client;
 	StringServerCtrl *server;
-	char rcvBuf[16*1024];
 };
 
 #endif
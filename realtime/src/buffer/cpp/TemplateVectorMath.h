@@ -1,6 +1,17 @@
 #ifndef __TemplateVectorMath_h
 #define __TemplateVectorMath_h
 
+/* The generic templates below are specialized for the common combinations
+   of types further down. With SSE2 these use explicit vector instructions,
+   without it they fall back to the generic code. Since the specializations
+   are selected by the compiler, the callers do not have to know about them.
+   None of the functions require aligned arrays. */
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TVM_SSE2
+#endif
+
 template <typename Tout, typename Ts, typename Tin>
 void tvmSetScaledVector(Tout *y, Ts a, const Tin *x, int n) {
    /* for (i=0;i<n;i++) y[i] = a*x[i]; */
@@ -55,4 +66,99 @@ void tvmAddScaledVector(Tout *y, Ts a, const Tin *x, int n) {
    }
 }
 
+template <typename Tout, typename Ts, typename Tin>
+void tvmSetScaledOffsetVector(Tout *y, const Ts *a, const Tin *x, const Ts *b, int n) {
+   /* for (i=0;i<n;i++) y[i] = a[i]*(x[i]-b[i]); */
+   for (int i=0;i<n;i++) y[i] = a[i]*(x[i] - b[i]);
+}
+
+/* Same as above for the channels in index, i.e., y[i] = a[k]*(x[k]-b[k]) with k=index[i].
+   If the indices are consecutive, this is passed on to tvmSetScaledOffsetVector. */
+template <typename Tout, typename Ts, typename Tin>
+void tvmGatherScaledOffsetVector(Tout *y, const Ts *a, const Tin *x, const Ts *b, const int *index, int n) {
+   int i;
+
+   if (n == 0) return;
+   for (i=1;i<n;i++) {
+      if (index[i] != index[0] + i) break;
+   }
+   if (i == n) {
+      tvmSetScaledOffsetVector<Tout,Ts,Tin>(y, a + index[0], x + index[0], b + index[0], n);
+      return;
+   }
+   for (i=0;i<n;i++) {
+      int k = index[i];
+      y[i] = a[k]*(x[k] - b[k]);
+   }
+}
+
+#ifdef TVM_SSE2
+
+/* loads 4 values of the given type and converts them to float */
+inline __m128 tvmLoad4(const float *x)  { return _mm_loadu_ps(x); }
+inline __m128 tvmLoad4(const int *x)    { return _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *) x)); }
+inline __m128 tvmLoad4(const short *x)  {
+   __m128i v = _mm_loadl_epi64((const __m128i *) x);
+   return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+}
+
+template <typename Tin>
+inline void tvmSetScaledVectorSSE(float *y, float a, const Tin *x, int n) {
+   __m128 va = _mm_set1_ps(a);
+   for (;n>=4;n-=4,x+=4,y+=4) _mm_storeu_ps(y, _mm_mul_ps(va, tvmLoad4(x)));
+   for (int i=0;i<n;i++) y[i] = a*x[i];
+}
+
+template <typename Tin>
+inline void tvmAddScaledVectorSSE(float *y, float a, const Tin *x, int n) {
+   __m128 va = _mm_set1_ps(a);
+   for (;n>=4;n-=4,x+=4,y+=4) _mm_storeu_ps(y, _mm_add_ps(_mm_loadu_ps(y), _mm_mul_ps(va, tvmLoad4(x))));
+   for (int i=0;i<n;i++) y[i] += a*x[i];
+}
+
+template <typename Tin>
+inline void tvmSetScaledOffsetVectorSSE(float *y, const float *a, const Tin *x, const float *b, int n) {
+   for (;n>=4;n-=4,a+=4,b+=4,x+=4,y+=4) {
+      _mm_storeu_ps(y, _mm_mul_ps(_mm_loadu_ps(a), _mm_sub_ps(tvmLoad4(x), _mm_loadu_ps(b))));
+   }
+   for (int i=0;i<n;i++) y[i] = a[i]*(x[i] - b[i]);
+}
+
+/* doubles are multiplied in double precision, like in the generic code */
+inline void tvmSetScaledVectorSSE(float *y, float a, const double *x, int n) {
+   __m128d va = _mm_set1_pd(a);
+   for (;n>=4;n-=4,x+=4,y+=4) {
+      __m128 lo = _mm_cvtpd_ps(_mm_mul_pd(va, _mm_loadu_pd(x)));
+      __m128 hi = _mm_cvtpd_ps(_mm_mul_pd(va, _mm_loadu_pd(x+2)));
+      _mm_storeu_ps(y, _mm_movelh_ps(lo, hi));
+   }
+   for (int i=0;i<n;i++) y[i] = a*x[i];
+}
+
+inline void tvmAddScaledVectorSSE(float *y, float a, const double *x, int n) {
+   __m128d va = _mm_set1_pd(a);
+   for (;n>=4;n-=4,x+=4,y+=4) {
+      __m128d lo = _mm_add_pd(_mm_cvtps_pd(_mm_loadl_pi(_mm_setzero_ps(), (const __m64 *) y)), _mm_mul_pd(va, _mm_loadu_pd(x)));
+      __m128d hi = _mm_add_pd(_mm_cvtps_pd(_mm_loadl_pi(_mm_setzero_ps(), (const __m64 *) (y+2))), _mm_mul_pd(va, _mm_loadu_pd(x+2)));
+      _mm_storeu_ps(y, _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi)));
+   }
+   for (int i=0;i<n;i++) y[i] += a*x[i];
+}
+
+template <> inline void tvmSetScaledVector<float,float,float>(float *y, float a, const float *x, int n)   { tvmSetScaledVectorSSE(y, a, x, n); }
+template <> inline void tvmSetScaledVector<float,float,double>(float *y, float a, const double *x, int n) { tvmSetScaledVectorSSE(y, a, x, n); }
+template <> inline void tvmSetScaledVector<float,float,int>(float *y, float a, const int *x, int n)       { tvmSetScaledVectorSSE(y, a, x, n); }
+template <> inline void tvmSetScaledVector<float,float,short>(float *y, float a, const short *x, int n)   { tvmSetScaledVectorSSE(y, a, x, n); }
+
+template <> inline void tvmAddScaledVector<float,float,float>(float *y, float a, const float *x, int n)   { tvmAddScaledVectorSSE(y, a, x, n); }
+template <> inline void tvmAddScaledVector<float,float,double>(float *y, float a, const double *x, int n) { tvmAddScaledVectorSSE(y, a, x, n); }
+template <> inline void tvmAddScaledVector<float,float,int>(float *y, float a, const int *x, int n)       { tvmAddScaledVectorSSE(y, a, x, n); }
+template <> inline void tvmAddScaledVector<float,float,short>(float *y, float a, const short *x, int n)   { tvmAddScaledVectorSSE(y, a, x, n); }
+
+template <> inline void tvmSetScaledOffsetVector<float,float,float>(float *y, const float *a, const float *x, const float *b, int n) { tvmSetScaledOffsetVectorSSE(y, a, x, b, n); }
+template <> inline void tvmSetScaledOffsetVector<float,float,int>(float *y, const float *a, const int *x, const float *b, int n)     { tvmSetScaledOffsetVectorSSE(y, a, x, b, n); }
+template <> inline void tvmSetScaledOffsetVector<float,float,short>(float *y, const float *a, const short *x, const float *b, int n) { tvmSetScaledOffsetVectorSSE(y, a, x, b, n); }
+
+#endif /* TVM_SSE2 */
+
 #endif
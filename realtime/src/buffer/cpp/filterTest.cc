@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ * Use as
+ *   filterTest
+ *
+ * Switches a MultiChannelFilter between second-order sections and direct form
+ * coefficients, and checks that the last filter that was set is the one that
+ * is applied, and that a notch is added after a direct form filter.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <MultiChannelFilter.h>
+
+#define NCHAN  3
+#define NSAMP  200
+
+typedef MultiChannelFilter<float,double> Filter;
+
+static float x[NSAMP*NCHAN];
+
+// returns the largest difference between the outputs of two filters for the same input
+static double compare(Filter &f1, Filter &f2) {
+	float y1[NSAMP*NCHAN], y2[NSAMP*NCHAN];
+	double maxdiff = 0;
+
+	f1.process(NSAMP, y1, x);
+	f2.process(NSAMP, y2, x);
+	for (int i=0;i<NSAMP*NCHAN;i++) {
+		if (fabs(y1[i] - y2[i]) > maxdiff) maxdiff = fabs(y1[i] - y2[i]);
+	}
+	return maxdiff;
+}
+
+// checks that the output of the filter is the input times the given gain
+static int check_gain(Filter &f, double gain, const char *what) {
+	float y[NSAMP*NCHAN];
+
+	f.process(NSAMP, y, x);
+	for (int i=0;i<NSAMP*NCHAN;i++) {
+		if (fabs(y[i] - gain*x[i]) > 1e-5) {
+			fprintf(stderr, "FAILED: %s is not applied\n", what);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	const double half[3] = {0.5, 0, 0};
+	const double unit[3] = {1, 0, 0};
+	const double B[3] = {0.2, 0.3, 0.1}, A[3] = {1, -0.5, 0.2};
+	const double sos[6] = {0.2, 0.3, 0.1, 1, -0.5, 0.2};
+	const double B4[5] = {0.1, 0.2, 0.3, 0.2, 0.1}, A4[5] = {1, -0.3, 0.1, 0.05, 0.01};
+	int failed = 0;
+
+	for (int i=0;i<NSAMP*NCHAN;i++) x[i] = (float) sin(0.37*i) + (float) (i % 7);
+
+	// direct form coefficients replace the Butterworth sections
+	Filter lp(NCHAN, 2);
+	lp.setButterLP(0.2);
+	lp.setCoefficients(half, unit);
+	failed |= check_gain(lp, 0.5, "setCoefficients after setButterLP");
+	if (lp.getNumSections() != 0) {
+		fprintf(stderr, "FAILED: the sections are still in use after setCoefficients\n");
+		failed = 1;
+	}
+
+	Filter bp(NCHAN, 2);
+	bp.setButterBP(0.1, 0.3);
+	bp.setSOS(1, sos);
+	bp.setCoefficients(half, unit);
+	failed |= check_gain(bp, 0.5, "setCoefficients after setSOS");
+
+	// and the other way around
+	Filter dir(NCHAN, 2), ref(NCHAN, 2);
+	dir.setCoefficients(half, unit);
+	dir.setButterHP(0.1);
+	ref.setButterHP(0.1);
+	if (compare(dir, ref) > 1e-6) {
+		fprintf(stderr, "FAILED: setButterHP after setCoefficients differs\n");
+		failed = 1;
+	}
+
+	// a notch after a direct form filter of second order keeps that filter in front
+	Filter notch(NCHAN, 2), sosNotch(NCHAN, 2);
+	notch.setCoefficients(B, A);
+	sosNotch.setSOS(1, sos);
+	if (!notch.addNotch(0.1, 0.02) || !sosNotch.addNotch(0.1, 0.02) || notch.getNumSections() != 2 || compare(notch, sosNotch) > 1e-6) {
+		fprintf(stderr, "FAILED: the notch after a direct form filter differs\n");
+		failed = 1;
+	}
+
+	// a higher order direct form filter cannot be combined with a notch
+	Filter high(NCHAN, 4), highRef(NCHAN, 4);
+	high.setCoefficients(B4, A4);
+	highRef.setCoefficients(B4, A4);
+	if (high.addNotch(0.1, 0.02) || high.getNumSections() != 0 || compare(high, highRef) > 1e-6) {
+		fprintf(stderr, "FAILED: the fourth order direct form filter was not kept\n");
+		failed = 1;
+	}
+
+	// a new filter has nothing in front of the notch
+	Filter single(NCHAN, 2);
+	if (!single.addNotch(0.1, 0.02) || single.getNumSections() != 1) {
+		fprintf(stderr, "FAILED: a single notch has %i sections\n", single.getNumSections());
+		failed = 1;
+	}
+
+	if (!failed) printf("OK\n");
+	return failed;
+}
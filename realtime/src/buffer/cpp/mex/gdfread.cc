@@ -0,0 +1,184 @@
+/*
+ * MEX interface to GDF_Reader, for reading the files of GDF_Writer and
+ * GDF_BackgroundWriter from MATLAB
+ *
+ *   hdr = gdfread(filename)
+ *   dat = gdfread(filename, begsample, endsample, chanindx, precision, scale)
+ *   evt = gdfread(filename, 'event', begsample, endsample, type)
+ *
+ * The samples and channels are counted from 1, and begsample and endsample
+ * are both included. An empty chanindx selects all channels, precision is
+ * 'double' (default) or 'single', and scale=false returns the digital values
+ * instead of the physical ones. dat is a channels x samples matrix. The
+ * events are a struct array with the fields sample, type, channel and
+ * duration, optionally of a range of samples and a single type.
+ *
+ * The last file stays opened and mapped in memory until it changes on disk
+ * or another file is read, so that reading many segments only converts the
+ * samples. Compile with
+ *
+ *   mex -I.. -I../../src gdfread.cc ../GdfReader.cc ../GdfWriter.cc
+ *
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ */
+
+#include <mex.h>
+#include <GdfReader.h>
+#include <sys/stat.h>
+#include <string>
+
+static GDF_Reader *reader = NULL;
+static std::string openedName;
+static struct stat openedStat;
+
+static void closeReader(void) {
+	delete reader;
+	reader = NULL;
+	openedName.clear();
+}
+
+// Returns the reader of the file, which is opened again if it has changed
+static GDF_Reader *getReader(const mxArray *arg) {
+	struct stat st;
+	char *name = mxArrayToString(arg);
+	if (name == NULL) mexErrMsgTxt("the first argument must be the name of a file");
+	std::string filename(name);
+	mxFree(name);
+
+	if (stat(filename.c_str(), &st) != 0) mexErrMsgTxt("file does not exist");
+	if (reader != NULL && filename == openedName && st.st_size == openedStat.st_size && st.st_mtime == openedStat.st_mtime) {
+		return reader;
+	}
+	if (reader == NULL) {
+		reader = new GDF_Reader();
+		mexAtExit(closeReader);
+	}
+	openedName.clear();
+	if (!reader->open(filename.c_str())) mexErrMsgTxt(reader->getError());
+	openedName = filename;
+	openedStat = st;
+	return reader;
+}
+
+static mxArray *columnVector(int n, double (GDF_Reader::*get)(int) const, const GDF_Reader *R) {
+	mxArray *v = mxCreateDoubleMatrix(n, 1, mxREAL);
+	double *pr = mxGetPr(v);
+	for (int i=0;i<n;i++) pr[i] = (R->*get)(i);
+	return v;
+}
+
+static mxArray *createHeader(const GDF_Reader *R) {
+	const char *fields[] = {"Fs", "nChans", "nSamples", "label", "gdfType", "physDimCode", "physMin", "physMax", "digMin", "digMax", "nEvents"};
+	int n = R->getNumChannels();
+	mxArray *hdr = mxCreateStructMatrix(1, 1, 11, fields);
+	mxArray *label = mxCreateCellMatrix(n, 1);
+	mxArray *type = mxCreateDoubleMatrix(n, 1, mxREAL);
+	mxArray *code = mxCreateDoubleMatrix(n, 1, mxREAL);
+
+	for (int i=0;i<n;i++) {
+		mxSetCell(label, i, mxCreateString(R->getLabel(i).c_str()));
+		mxGetPr(type)[i] = R->getType(i);
+		mxGetPr(code)[i] = R->getPhysDimCode(i);
+	}
+	mxSetField(hdr, 0, "Fs", mxCreateDoubleScalar(R->getSampleRate()));
+	mxSetField(hdr, 0, "nChans", mxCreateDoubleScalar(n));
+	mxSetField(hdr, 0, "nSamples", mxCreateDoubleScalar((double) R->getNumSamples()));
+	mxSetField(hdr, 0, "label", label);
+	mxSetField(hdr, 0, "gdfType", type);
+	mxSetField(hdr, 0, "physDimCode", code);
+	mxSetField(hdr, 0, "physMin", columnVector(n, &GDF_Reader::getPhysicalMin, R));
+	mxSetField(hdr, 0, "physMax", columnVector(n, &GDF_Reader::getPhysicalMax, R));
+	mxSetField(hdr, 0, "digMin", columnVector(n, &GDF_Reader::getDigitalMin, R));
+	mxSetField(hdr, 0, "digMax", columnVector(n, &GDF_Reader::getDigitalMax, R));
+	mxSetField(hdr, 0, "nEvents", mxCreateDoubleScalar(R->getNumEvents()));
+	return hdr;
+}
+
+static mxArray *createEvents(const GDF_Reader *R, int nrhs, const mxArray *prhs[]) {
+	const char *fields[] = {"sample", "type", "channel", "duration"};
+	std::vector<int> index;
+	int64_t begin = 0, end = R->getNumSamples();
+
+	if (nrhs > 2) begin = (int64_t) mxGetScalar(prhs[2]) - 1;
+	if (nrhs > 3) end = (int64_t) mxGetScalar(prhs[3]);
+
+	if (nrhs > 4 && !mxIsEmpty(prhs[4])) {
+		const std::vector<int>& ofType = R->getEventsOfType((uint16_t) mxGetScalar(prhs[4]));
+		for (size_t k=0;k<ofType.size();k++) {
+			int64_t s = R->getEvent(ofType[k]).sample;
+			if (s >= begin && s < end) index.push_back(ofType[k]);
+		}
+	} else {
+		int first;
+		int num = R->findEvents(begin, end, first);
+		for (int k=0;k<num;k++) index.push_back(first + k);
+	}
+
+	mxArray *evt = mxCreateStructMatrix((mwSize) index.size(), 1, 4, fields);
+	for (size_t k=0;k<index.size();k++) {
+		const GDF_Event& E = R->getEvent(index[k]);
+		mxSetField(evt, k, "sample", mxCreateDoubleScalar((double) (E.sample + 1)));
+		mxSetField(evt, k, "type", mxCreateDoubleScalar(E.type));
+		mxSetField(evt, k, "channel", mxCreateDoubleScalar(E.channel));
+		mxSetField(evt, k, "duration", mxCreateDoubleScalar(E.duration));
+	}
+	return evt;
+}
+
+static mxArray *createData(GDF_Reader *R, int nrhs, const mxArray *prhs[]) {
+	std::vector<int> chans;
+	bool single = false, scale = true;
+	int64_t begin, end, n;
+
+	if (nrhs < 3) mexErrMsgTxt("call gdfread(filename, begsample, endsample, ...)");
+	begin = (int64_t) mxGetScalar(prhs[1]) - 1;
+	end = (int64_t) mxGetScalar(prhs[2]);
+	if (begin < 0 || end > R->getNumSamples() || begin > end) mexErrMsgTxt("invalid range of samples");
+
+	if (nrhs > 3 && !mxIsEmpty(prhs[3])) {
+		mwSize num = mxGetNumberOfElements(prhs[3]);
+		if (!mxIsDouble(prhs[3])) mexErrMsgTxt("chanindx must be a double array");
+		const double *pr = mxGetPr(prhs[3]);
+		for (mwSize i=0;i<num;i++) chans.push_back((int) pr[i] - 1);
+	}
+	if (nrhs > 4 && !mxIsEmpty(prhs[4])) {
+		char *prec = mxArrayToString(prhs[4]);
+		if (prec == NULL) mexErrMsgTxt("precision must be 'single' or 'double'");
+		single = (strcmp(prec, "single") == 0);
+		mxFree(prec);
+	}
+	if (nrhs > 5) scale = mxGetScalar(prhs[5]) != 0;
+
+	int nSel = chans.empty() ? R->getNumChannels() : (int) chans.size();
+	const int *sel = chans.empty() ? NULL : &chans[0];
+	mxArray *dat = mxCreateNumericMatrix(nSel, (mwSize) (end - begin), single ? mxSINGLE_CLASS : mxDOUBLE_CLASS, mxREAL);
+	if (single) {
+		n = R->readSamples(begin, end, nSel, sel, (float *) mxGetData(dat), scale);
+	} else {
+		n = R->readSamples(begin, end, nSel, sel, (double *) mxGetData(dat), scale);
+	}
+	if (n < 0) {
+		mxDestroyArray(dat);
+		mexErrMsgTxt(R->getError());
+	}
+	return dat;
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+	if (nrhs < 1) mexErrMsgTxt("call gdfread(filename, ...)");
+
+	GDF_Reader *R = getReader(prhs[0]);
+
+	if (nrhs == 1) {
+		plhs[0] = createHeader(R);
+	} else if (mxIsChar(prhs[1])) {
+		char *what = mxArrayToString(prhs[1]);
+		bool isEvent = (what != NULL && strcmp(what, "event") == 0);
+		mxFree(what);
+		if (!isEvent) mexErrMsgTxt("the second argument must be a sample or 'event'");
+		plhs[0] = createEvents(R, nrhs, prhs);
+	} else {
+		plhs[0] = createData(R, nrhs, prhs);
+	}
+}
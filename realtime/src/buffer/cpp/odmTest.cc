@@ -5,9 +5,10 @@
  * Kapittelweg 29, 6525 EN Nijmegen, The Netherlands
  *
  * Use as
- *   odmTest [hostname=localhost [port=1972]]
+ *   odmTest [hostname=localhost [port=1972 [pipeline]]]
  *
- * If you specify - as hostname, it will spawn a buffer server.
+ * If you specify - as hostname, it will spawn a buffer server. With the
+ * option pipeline, the blocks are streamed and saved in worker threads.
  */
 
 #include <OnlineDataManager.h>
@@ -63,6 +64,13 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
+	if (argc>3 && !strcmp(argv[3], "pipeline")) {
+		if (!ODM.enablePipeline()) {
+			fprintf(stderr, "Could not start the worker threads.\n");
+			return 1;
+		}
+	}
+
 	if (ODM.configureFromFile("config.txt") != 0) {
 		fprintf(stderr, "Configuration file is invalid\n");
 		return 0;
@@ -99,6 +107,10 @@ int main(int argc, char *argv[]) {
 		conIn.milliSleep(100);
 	}
 
+	unsigned int dropped, queueDepth, maxDepth;
+	ODM.getPipelineStatistics(dropped, queueDepth, maxDepth);
+	if (maxDepth > 0) printf("Dropped %u blocks, at most %u blocks were queued\n", dropped, maxDepth);
+	ODM.disablePipeline();
 	ODM.disableStreaming();
 	ODM.disableSaving();
 }
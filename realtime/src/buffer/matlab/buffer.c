@@ -12,9 +12,11 @@
 #include "buffer.h"
 #include <pthread.h>
 #include "extern.h"
+#include "buffer_prefetch.h"
 
 #define DEFAULT_HOST "localhost"
 #define DEFAULT_PORT 1972
+#define DEFAULT_PREFETCH_BYTES (16*1024*1024)
 
 
 #ifdef WIN32 
@@ -30,17 +32,32 @@
    The list is kept until the MEX-file is unloaded and automatically cleaned up 
    inside the MEX-file exit routine. TCP communication errors on a specific socket
    will trigger closing the connection and removing the corresponding list item.
+   If prefetch!=NULL, a background thread copies the newest samples and events
+   of that buffer into memory, see buffer_prefetch.h
+   The items are also kept in a hash table on hostname and port, so that the
+   lookup on every call does not depend on the number of connections.
 */
 typedef struct host_port_sock_list_item {
 	char *hostname;
 	int port;
 	int sock; 	 							
+	unsigned int hash;						/* of hostname and port, see hash_host_port */
+	ft_prefetch_t *prefetch;
 	struct host_port_sock_list_item *next;	/* NULL if last elemenent  */
 } host_port_sock_list_item_t;
 
 /* This is the head of the list */
 host_port_sock_list_item_t *firstHostPortSock = NULL;
 
+/* Open addressing with linear probing, the size is a power of two and at
+   least twice the number of items */
+#define HPS_HASH_MINSIZE 16
+host_port_sock_list_item_t **hpsHash = NULL;
+unsigned int hpsHashSize = 0, hpsHashCount = 0;
+
+/* The item of the previous call, most calls are for the same connection */
+host_port_sock_list_item_t *lastHostPortSock = NULL;
+
 /* This keeps track of the running thread */
 pthread_t tcpserverThread;
 
@@ -59,7 +76,10 @@ host_t host_for_server;
 */
 int buffer_gethdr(int, mxArray **, const mxArray **);
 int buffer_getdat(int, mxArray **, const mxArray **);
+int buffer_getdat_into(int, mxArray **, const mxArray **);
 int buffer_getevt(int, mxArray **, const mxArray **);
+int buffer_getevt_columns(int, mxArray **, const mxArray **);
+int buffer_getlatest(int, mxArray **, const mxArray **);
 int buffer_getprp(int, mxArray **, const mxArray **);
 int buffer_puthdr(int, mxArray **, const mxArray **);
 int buffer_putdat(int, mxArray **, const mxArray **);
@@ -69,6 +89,7 @@ int buffer_flushhdr(int, mxArray **, const mxArray **);
 int buffer_flushdat(int, mxArray **, const mxArray **);
 int buffer_flushevt(int, mxArray **, const mxArray **);
 int buffer_waitdat(int, mxArray **, const mxArray **);
+void buffer_gethdr_forget(int);
 
 /* this function is called upon unloading of the mex-file */
 void exitFun(void) {
@@ -83,8 +104,13 @@ void exitFun(void) {
     pthread_mutex_lock(&mutexstatus);
     if (tcpserverStatus) {
             pthread_mutex_unlock(&mutexstatus);
-            mexPrintf("requesting cancelation of tcpserver thread\n");
+            mexPrintf("requesting the tcpserver thread to stop\n");
+            /* the clients are disconnected as well, the threads of those that do not stop in time are left behind */
+            if ((rc = tcpserver_stop())>0)
+                mexPrintf("%d clients of the tcpserver did not disconnect\n", rc);
+#if defined(PLATFORM_WIN32) || defined(PLATFORM_WIN64)
             pthread_cancel(tcpserverThread);
+#endif
             pthread_join(tcpserverThread, NULL);
     }
     else {
@@ -97,6 +123,9 @@ void exitFun(void) {
 	free_header();
 
 	/* clean up host/address/socket list and close open sockets */
+	FREE(hpsHash);
+	hpsHashSize = hpsHashCount = 0;
+	lastHostPortSock = NULL;
 	while (firstHostPortSock != NULL) {
 		host_port_sock_list_item_t *hpsli = firstHostPortSock;
 
@@ -109,6 +138,7 @@ void exitFun(void) {
 		if (verbose) {
 			printf("cleaning up list entry %s:%i\n",hpsli->hostname, hpsli->port);
 		}
+		ft_prefetch_stop(hpsli->prefetch);
 		FREE(hpsli->hostname);
 
 		firstHostPortSock = hpsli->next;
@@ -117,20 +147,105 @@ void exitFun(void) {
 	return;
 }
 
-/** This function searches through the linked list to retrieve the socket number
-	of the first (and only) item with matching hostname and port. 
-	Returns -1 if no item matched.
+/* FNV-1a over the hostname and the port */
+unsigned int hash_host_port(const char *hostname, int port) {
+	unsigned int h = 2166136261U;
+	int i;
+	
+	while (*hostname) {
+		h = (h ^ (unsigned char) *hostname++) * 16777619U;
+	}
+	for (i=0; i<4; i++) {
+		h = (h ^ ((port >> (8*i)) & 0xFF)) * 16777619U;
+	}
+	return h;
+}
+
+/* Puts an item in the first free slot of its probe sequence */
+void hps_hash_put(host_port_sock_list_item_t *hpsli) {
+	unsigned int mask = hpsHashSize - 1;
+	unsigned int i = hpsli->hash & mask;
+	
+	while (hpsHash[i] != NULL) i = (i+1) & mask;
+	hpsHash[i] = hpsli;
+}
+
+/* Adds an item to the hash table, which is rebuilt from the list if it gets too full.
+	Returns 0 if out of memory.
 */
-int lookup_hps_item(const char *hostname, int port) {
-	host_port_sock_list_item_t *hpsli = firstHostPortSock;
+int hps_hash_insert(host_port_sock_list_item_t *hpsli) {
+	if (2*(hpsHashCount+1) > hpsHashSize) {
+		host_port_sock_list_item_t *item;
+		unsigned int size = (hpsHashSize == 0) ? HPS_HASH_MINSIZE : 2*hpsHashSize;
+		host_port_sock_list_item_t **table = (host_port_sock_list_item_t **) calloc(size, sizeof(host_port_sock_list_item_t *));
+		
+		if (table == NULL) return 0;
+		FREE(hpsHash);
+		hpsHash = table;
+		hpsHashSize = size;
+		/* the items that are already in the list */
+		for (item = firstHostPortSock; item != NULL; item = item->next) {
+			if (item != hpsli) hps_hash_put(item);
+		}
+	}
+	hps_hash_put(hpsli);
+	hpsHashCount++;
+	return 1;
+}
+
+/* Removes an item from the hash table, the items after it in the same cluster
+	are moved up so that no lookup stops early at the empty slot.
+*/
+void hps_hash_remove(host_port_sock_list_item_t *hpsli) {
+	unsigned int mask = hpsHashSize - 1;
+	unsigned int i, j, k;
 	
-	while (hpsli != NULL) {
-		if ((strcmp(hpsli->hostname, hostname)==0) && (hpsli->port == port)) {
-			return hpsli->sock;
+	if (hpsHashSize == 0) return;
+	i = hpsli->hash & mask;
+	while (hpsHash[i] != hpsli) {
+		if (hpsHash[i] == NULL) return;
+		i = (i+1) & mask;
+	}
+	for (j = (i+1) & mask; hpsHash[j] != NULL; j = (j+1) & mask) {
+		k = hpsHash[j]->hash & mask;
+		/* move the item if its home slot k is not in the cyclic range (i, j] */
+		if ((i <= j) ? (k <= i || k > j) : (k <= i && k > j)) {
+			hpsHash[i] = hpsHash[j];
+			i = j;
 		}
-		hpsli = hpsli->next;
 	}
-	return -1;
+	hpsHash[i] = NULL;
+	hpsHashCount--;
+}
+
+/** This function searches the hash table for the first (and only) item with
+	matching hostname and port. Returns NULL if no item matched.
+*/
+host_port_sock_list_item_t *get_hps_item(const char *hostname, int port) {
+	unsigned int hash, mask, i;
+	
+	if (lastHostPortSock != NULL && lastHostPortSock->port == port && strcmp(lastHostPortSock->hostname, hostname)==0)
+		return lastHostPortSock;
+	if (hpsHashSize == 0) return NULL;
+	
+	hash = hash_host_port(hostname, port);
+	mask = hpsHashSize - 1;
+	for (i = hash & mask; hpsHash[i] != NULL; i = (i+1) & mask) {
+		host_port_sock_list_item_t *hpsli = hpsHash[i];
+		if (hpsli->hash == hash && hpsli->port == port && strcmp(hpsli->hostname, hostname)==0) {
+			lastHostPortSock = hpsli;
+			return hpsli;
+		}
+	}
+	return NULL;
+}
+
+/** This function retrieves the socket number of the item with matching
+	hostname and port. Returns -1 if no item matched.
+*/
+int lookup_hps_item(const char *hostname, int port) {
+	host_port_sock_list_item_t *hpsli = get_hps_item(hostname, port);
+	return (hpsli != NULL) ? hpsli->sock : -1;
 }
 
 /* This function adds a new item to the host/port/socket list without checking if
@@ -157,9 +272,19 @@ int add_hps_item(const char *hostname, int port, int sock) {
 	
 	hpsli->port = port;
 	hpsli->sock = sock;
+	hpsli->hash = hash_host_port(hostname, port);
+	hpsli->prefetch = NULL;
 	hpsli->next = firstHostPortSock;
 	firstHostPortSock = hpsli;
 	
+	if (!hps_hash_insert(hpsli)) {
+		/* out of memory - probably never */
+		firstHostPortSock = hpsli->next;
+		free(hpsli->hostname);
+		free(hpsli);
+		return 0;
+	}
+	
 	mexAtExit(exitFun);   /* register cleanup routine so the list get's properly destroyed */
 	return 1;
 }
@@ -174,6 +299,11 @@ void remove_hps_item(int sock) {
 	
 	while (hpsli != NULL) {
 		if (hpsli->sock == sock) {
+			/* the socket number may be reused for another server */
+			buffer_gethdr_forget(sock);
+			ft_prefetch_stop(hpsli->prefetch);
+			hps_hash_remove(hpsli);
+			if (lastHostPortSock == hpsli) lastHostPortSock = NULL;
 			*prev_next = hpsli->next;
 			free(hpsli->hostname);			
 			free(hpsli);
@@ -184,6 +314,59 @@ void remove_hps_item(int sock) {
 	}
 }
 
+/** Returns the list item of the connection on socket sock, or NULL if there is none.
+*/
+host_port_sock_list_item_t *find_hps_item(int sock) {
+	host_port_sock_list_item_t *hpsli = firstHostPortSock;
+	
+	if (lastHostPortSock != NULL && lastHostPortSock->sock == sock) return lastHostPortSock;
+	while (hpsli != NULL) {
+		if (hpsli->sock == sock) return hpsli;
+		hpsli = hpsli->next;
+	}
+	return NULL;
+}
+
+/** Like clientrequest, but GET_DAT and GET_EVT requests are answered by the
+	prefetch thread of the connection if it already has the samples or events.
+	The other responses are passed on to the prefetch thread, which empties its
+	ring when the header has changed.
+*/
+int buffer_clientrequest(int server, const message_t *request, message_t **response_ptr) {
+	host_port_sock_list_item_t *hpsli = find_hps_item(server);
+	int result;
+	
+	if (hpsli == NULL || hpsli->prefetch == NULL)
+		return clientrequest(server, request, response_ptr);
+	if (ft_prefetch_request(hpsli->prefetch, request, response_ptr) == 0)
+		return 0;
+	result = clientrequest(server, request, response_ptr);
+	if (result == 0)
+		ft_prefetch_observe(hpsli->prefetch, request, *response_ptr);
+	return result;
+}
+
+/** Like clientrequest_multi, which sends all requests before it reads the
+	responses. With a prefetch thread, the requests are passed one by one to
+	buffer_clientrequest, since the thread answers some of them and has to
+	see the responses to the others. On error, no responses are returned.
+*/
+int buffer_clientrequest_multi(int server, int nreq, const message_t **request, message_t **response) {
+	host_port_sock_list_item_t *hpsli = find_hps_item(server);
+	int i, result;
+	
+	if (hpsli == NULL || hpsli->prefetch == NULL)
+		return clientrequest_multi(server, nreq, request, response);
+	for (i=0; i<nreq; i++) {
+		result = buffer_clientrequest(server, request[i], &response[i]);
+		if (result != 0) {
+			while (i-- > 0) cleanup_message((void **) &response[i]);
+			return result;
+		}
+	}
+	return 0;
+}
+
 /** This is a MEX-specific wrapper for the open_connection call.
 	If the requested host+port combination is already in the linked list,
 	it means that the connection is still open (at least from this side), and
@@ -340,10 +523,16 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
     else if (strcasecmp(argument, "exit")==0) {
       if (!tcpserverStatus)
         mexErrMsgTxt("thread is not running");
-      mexPrintf("In main: requesting cancelation of tcpserver thread\n");
+      mexPrintf("In main: requesting the tcpserver thread to stop\n");
+#if defined(PLATFORM_WIN32) || defined(PLATFORM_WIN64)
       rc = pthread_cancel(tcpserverThread);
       if (rc)
         mexErrMsgTxt("problem with return code from pthread_cancel()");
+#else
+      if ((rc = tcpserver_stop())>0)
+        mexPrintf("In main: %d clients of the tcpserver did not disconnect\n", rc);
+      pthread_join(tcpserverThread, NULL);
+#endif
 	  /* remove sock=0 connection from host/port/socket list */
 	  remove_hps_item(0);
     }
@@ -352,6 +541,57 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 	}
   }
   
+  else if (strcasecmp(command, "prefetch")==0) {
+    host_port_sock_list_item_t *hpsli;
+    argument = mxArrayToString(prhs[1]);
+    if (argument==NULL)
+      mexErrMsgTxt ("invalid input argument #2");
+    server = open_connection_with_list(hostname, port);
+    if (server == 0)
+      mexErrMsgTxt("the local buffer does not need a prefetch thread");
+    hpsli = find_hps_item(server);
+    
+    if (strcasecmp(argument, "init")==0) {
+      UINT32_T maxbytes = DEFAULT_PREFETCH_BYTES;
+      if (nrhs>4) {
+        /* fifth argument is the size of the ring in bytes (optional) */
+        if (mxIsEmpty(prhs[4]) || !mxIsNumeric(prhs[4]) || mxGetScalar(prhs[4]) < 0)
+          mexErrMsgTxt ("invalid input argument #5");
+        maxbytes = (UINT32_T) mxGetScalar(prhs[4]);
+      }
+      if (hpsli->prefetch != NULL)
+        mexErrMsgTxt("prefetch thread is already running");
+      hpsli->prefetch = ft_prefetch_start(hostname, port, maxbytes);
+      if (hpsli->prefetch == NULL)
+        mexErrMsgTxt("could not start the prefetch thread");
+    }
+    else if (strcasecmp(argument, "exit")==0) {
+      if (hpsli->prefetch == NULL)
+        mexErrMsgTxt("prefetch thread is not running");
+      ft_prefetch_stop(hpsli->prefetch);
+      hpsli->prefetch = NULL;
+    }
+    else if (strcasecmp(argument, "status")==0) {
+      const char *field_names[] = {"running", "firstsample", "nsamples", "firstevent", "nevents", "hits", "misses"};
+      ft_prefetch_status_t status;
+      
+      memset(&status, 0, sizeof(status));
+      if (hpsli->prefetch != NULL)
+        ft_prefetch_get_status(hpsli->prefetch, &status);
+      plhs[0] = mxCreateStructMatrix(1, 1, 7, field_names);
+      mxSetFieldByNumber(plhs[0], 0, 0, mxCreateDoubleScalar((double) status.running));
+      mxSetFieldByNumber(plhs[0], 0, 1, mxCreateDoubleScalar((double) status.firstsample));
+      mxSetFieldByNumber(plhs[0], 0, 2, mxCreateDoubleScalar((double) status.nsamples));
+      mxSetFieldByNumber(plhs[0], 0, 3, mxCreateDoubleScalar((double) status.firstevent));
+      mxSetFieldByNumber(plhs[0], 0, 4, mxCreateDoubleScalar((double) status.nevents));
+      mxSetFieldByNumber(plhs[0], 0, 5, mxCreateDoubleScalar((double) status.hits));
+      mxSetFieldByNumber(plhs[0], 0, 6, mxCreateDoubleScalar((double) status.misses));
+    }
+    else {
+      mexErrMsgTxt ("invalid input argument #2");
+    }
+  }
+  
   else if (strcasecmp(command, "get_hdr")==0) {
 	server = open_connection_with_list(hostname, port);
     errorCode = buffer_gethdr(server, &(plhs[0]), &(prhs[1]));
@@ -362,11 +602,26 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
     errorCode = buffer_getdat(server, &(plhs[0]), &(prhs[1]));
   }
   
+  else if (strcasecmp(command, "get_dat_into")==0) {
+    server = open_connection_with_list(hostname, port);
+    errorCode = buffer_getdat_into(server, &(plhs[0]), &(prhs[1]));
+  }
+  
   else if (strcasecmp(command, "get_evt")==0) {
     server = open_connection_with_list(hostname, port);
     errorCode = buffer_getevt(server, &(plhs[0]), &(prhs[1]));
   }
     
+  else if (strcasecmp(command, "get_evt_columns")==0) {
+    server = open_connection_with_list(hostname, port);
+    errorCode = buffer_getevt_columns(server, &(plhs[0]), &(prhs[1]));
+  }
+  
+  else if (strcasecmp(command, "get_latest")==0) {
+    server = open_connection_with_list(hostname, port);
+    errorCode = buffer_getlatest(server, &(plhs[0]), &(prhs[1]));
+  }
+  
   else if (strcasecmp(command, "put_hdr")==0) {
     server = open_connection_with_list(hostname, port);
     errorCode = buffer_puthdr(server, &(plhs[0]), &(prhs[1]));
@@ -15,6 +15,46 @@ function [varargout] = buffer(varargin)
 %   datsel = [begsample endsample]
 %   evtsel = [begevent  endevent ]
 %
+% To read data into an existing array, e.g. a window that is reused in
+% every iteration of a realtime loop
+%   n = buffer('get_dat_into', {datsel, dat}, host, port)
+%   n = buffer('get_dat_into', {datsel, dat, chansel}, host, port)
+% The array dat should be double, single or of the type in the buffer, and
+% have one row per selected channel and at least as many columns as samples.
+% The channels (one-offset, all if empty) are selected and converted while
+% copying, n is the number of samples that were written. The array is changed
+% in place, so it should not share its memory with another variable, e.g.
+% allocate it with dat = zeros(nchans, nsamples) and do not copy it.
+%
+% To read many events at once, with one array per property instead of one
+% structure per event
+%   evt = buffer('get_evt_columns', evtsel, host, port)
+% where evt.sample, evt.offset and evt.duration are 1xN arrays, and evt.type
+% and evt.value are 1xN cell-arrays.
+%
+% To read the header, the events from begevent onwards and the last nsamples
+% samples in a single round trip, e.g. once per iteration of a realtime loop
+%   s = buffer('get_latest', [begevent nsamples], host, port)
+% where s.hdr, s.evt and s.dat are as returned by get_hdr, get_evt and get_dat.
+% The begevent is zero-offset, use hdr.nevents of the previous iteration to
+% get only the new events. s.dat also contains the zero-offset begsample and
+% endsample of the samples, it has fewer samples if the buffer does not have
+% that many, and it is empty if the buffer has none. The samples and events
+% are read after the header, hence there can be more than hdr.nsamples and
+% hdr.nevents.
+%
+% To let a background thread copy the newest samples and events into memory,
+% so that get_dat and get_evt of a recent window do not have to wait for the
+% network, and to stop it again
+%   buffer('prefetch', 'init', host, port)
+%   buffer('prefetch', 'init', host, port, maxbytes)
+%   buffer('prefetch', 'exit', host, port)
+%   s = buffer('prefetch', 'status', host, port)
+% The thread keeps at most maxbytes of samples (16 MB by default) and the
+% last 1024 events. Older samples and events are read from the server as
+% usual. The status contains the range of samples and events that are kept,
+% and the number of requests that were answered from memory (hits) or not.
+%
 % To write data to a buffer server over the network
 %   buffer('put_hdr', hdr, host, port)
 %   buffer('put_dat', dat, host, port)
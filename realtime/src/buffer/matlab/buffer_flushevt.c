@@ -9,6 +9,7 @@
 #include "mex.h"
 #include "matrix.h"
 #include "buffer.h"
+#include "buffer_prefetch.h"
 
 int buffer_flushevt(int server, mxArray *plhs[], const mxArray *prhs[])
 {
@@ -27,7 +28,7 @@ int buffer_flushevt(int server, mxArray *plhs[], const mxArray *prhs[])
 	request->def->bufsize = 0;
 
 	if (verbose) print_request(request->def);
-	result = clientrequest(server, request, &response);
+	result = buffer_clientrequest(server, request, &response);
 	if (verbose) print_response(response->def);
 
 	if (result == 0) {
@@ -9,9 +9,16 @@
 #include "mex.h"
 #include "matrix.h"
 #include "buffer.h"
+#include "buffer_mxutils.h"
+#include "buffer_prefetch.h"
+#include <pthread.h>
 
 #define NUMBER_OF_FIELDS 5
 
+/* large conversions are split over a few threads, which do not call any mx functions */
+#define PARALLEL_MIN_ELEMENTS (1<<20)
+#define PARALLEL_MAX_THREADS  4
+
 int buffer_getdat(int server, mxArray *plhs[], const mxArray *prhs[])
 {
   int verbose = 0;
@@ -43,7 +50,7 @@ int buffer_getdat(int server, mxArray *plhs[], const mxArray *prhs[])
   }
    
   if (verbose) print_request(request->def);
-  result = clientrequest(server, request, &response);
+  result = buffer_clientrequest(server, request, &response);
   if (verbose) print_response(response->def);
   
   if (result == 0) {
@@ -54,51 +61,11 @@ int buffer_getdat(int server, mxArray *plhs[], const mxArray *prhs[])
       
       if (verbose) print_datadef(data_def);
 
-      switch (data_def->data_type) {
-        case DATATYPE_UINT8:
-        datp = mxCreateNumericMatrix(data_def->nchans, data_def->nsamples, mxUINT8_CLASS, mxREAL);
-        memcpy(mxGetPr(datp), data_buf, data_def->nchans*data_def->nsamples*WORDSIZE_UINT8);
-        break;
-        case DATATYPE_UINT16:
-        datp = mxCreateNumericMatrix(data_def->nchans, data_def->nsamples, mxUINT16_CLASS, mxREAL);
-        memcpy(mxGetPr(datp), data_buf, data_def->nchans*data_def->nsamples*WORDSIZE_UINT16);
-        break;
-        case DATATYPE_UINT32:
-        datp = mxCreateNumericMatrix(data_def->nchans, data_def->nsamples, mxUINT32_CLASS, mxREAL);
-        memcpy(mxGetPr(datp), data_buf, data_def->nchans*data_def->nsamples*WORDSIZE_UINT32);
-        break;
-        case DATATYPE_UINT64:
-        datp = mxCreateNumericMatrix(data_def->nchans, data_def->nsamples, mxUINT64_CLASS, mxREAL);
-        memcpy(mxGetPr(datp), data_buf, data_def->nchans*data_def->nsamples*WORDSIZE_UINT64);
-        break;	  
-        case DATATYPE_INT8:
-        datp = mxCreateNumericMatrix(data_def->nchans, data_def->nsamples, mxINT8_CLASS, mxREAL);
-        memcpy(mxGetPr(datp), data_buf, data_def->nchans*data_def->nsamples*WORDSIZE_INT8);
-        break;
-        case DATATYPE_INT16:
-        datp = mxCreateNumericMatrix(data_def->nchans, data_def->nsamples, mxINT16_CLASS, mxREAL);
-        memcpy(mxGetPr(datp), data_buf, data_def->nchans*data_def->nsamples*WORDSIZE_INT16);
-        break;
-        case DATATYPE_INT32:
-        datp = mxCreateNumericMatrix(data_def->nchans, data_def->nsamples, mxINT32_CLASS, mxREAL);
-        memcpy(mxGetPr(datp), data_buf, data_def->nchans*data_def->nsamples*WORDSIZE_INT32);
-        break;
-        case DATATYPE_INT64:
-        datp = mxCreateNumericMatrix(data_def->nchans, data_def->nsamples, mxINT64_CLASS, mxREAL);
-        memcpy(mxGetPr(datp), data_buf, data_def->nchans*data_def->nsamples*WORDSIZE_INT64);
-        break;
-        case DATATYPE_FLOAT32:
-        datp = mxCreateNumericMatrix(data_def->nchans, data_def->nsamples, mxSINGLE_CLASS, mxREAL);
-        memcpy(mxGetPr(datp), data_buf, data_def->nchans*data_def->nsamples*WORDSIZE_FLOAT32);
-        break;
-        case DATATYPE_FLOAT64:
-        datp = mxCreateNumericMatrix(data_def->nchans, data_def->nsamples, mxDOUBLE_CLASS, mxREAL);
-        memcpy(mxGetPr(datp), data_buf, data_def->nchans*data_def->nsamples*WORDSIZE_FLOAT64);
-        break;
-        default:
-          result = -4;  /* mexErrMsgTxt("ERROR; unsupported data type\n"); */
-          goto cleanup;
+      if (class_id_from_ft_type(data_def->data_type) == mxUNKNOWN_CLASS || data_def->data_type == DATATYPE_CHAR) {
+        result = -4;  /* mexErrMsgTxt("ERROR; unsupported data type\n"); */
+        goto cleanup;
       }
+      datp = matrix_from_ft_type_data(data_def->data_type, data_def->nchans, data_def->nsamples, data_buf);
 
       plhs[0] = mxCreateStructMatrix(1, 1, NUMBER_OF_FIELDS, field_names);
       mxSetFieldByNumber(plhs[0], 0, 0, mxCreateDoubleScalar((double)data_def->nchans));
@@ -127,3 +94,219 @@ cleanup:
   return result;
 }
 
+
+/* copies the selected channels of nsamples samples, converting from TS to TD */
+#define COPY_SELECTION(TS, TD) { \
+  const TS *src = (const TS *) src_buf; \
+  TD *dst = (TD *) dst_buf; \
+  for (j=0; j<nsamples; j++) { \
+    for (i=0; i<nsel; i++) dst[i] = (TD) src[chanidx ? chanidx[i] : i]; \
+    src += nchans; \
+    dst += nsel; \
+  } \
+}
+
+#define COPY_TO(TD) \
+  switch (data_type) { \
+    case DATATYPE_UINT8:   COPY_SELECTION(UINT8_T,   TD); break; \
+    case DATATYPE_UINT16:  COPY_SELECTION(UINT16_T,  TD); break; \
+    case DATATYPE_UINT32:  COPY_SELECTION(UINT32_T,  TD); break; \
+    case DATATYPE_UINT64:  COPY_SELECTION(UINT64_T,  TD); break; \
+    case DATATYPE_INT8:    COPY_SELECTION(INT8_T,    TD); break; \
+    case DATATYPE_INT16:   COPY_SELECTION(INT16_T,   TD); break; \
+    case DATATYPE_INT32:   COPY_SELECTION(INT32_T,   TD); break; \
+    case DATATYPE_INT64:   COPY_SELECTION(INT64_T,   TD); break; \
+    case DATATYPE_FLOAT32: COPY_SELECTION(float,     TD); break; \
+    case DATATYPE_FLOAT64: COPY_SELECTION(double,    TD); break; \
+  }
+
+/* writes the selected channels to dst_buf, which has nsel rows and is of type dst_type */
+static void copy_selection(void *dst_buf, UINT32_T dst_type, const void *src_buf, UINT32_T data_type, UINT32_T nchans, UINT32_T nsamples, const UINT32_T *chanidx, UINT32_T nsel)
+{
+  UINT32_T i, j;
+  
+  if (dst_type == DATATYPE_FLOAT64) {
+    COPY_TO(double);
+  }
+  else if (dst_type == DATATYPE_FLOAT32) {
+    COPY_TO(float);
+  }
+  else if (chanidx == NULL) {
+    /* same type and all channels, the samples are contiguous */
+    memcpy(dst_buf, src_buf, nchans*nsamples*wordsize_from_type(data_type));
+  }
+  else {
+    UINT32_T wordsize = wordsize_from_type(data_type);
+    const char *src = (const char *) src_buf;
+    char *dst = (char *) dst_buf;
+    for (j=0; j<nsamples; j++) {
+      for (i=0; i<nsel; i++) memcpy(dst + i*wordsize, src + chanidx[i]*wordsize, wordsize);
+      src += nchans*wordsize;
+      dst += nsel*wordsize;
+    }
+  }
+}
+
+typedef struct {
+  void *dst_buf;
+  UINT32_T dst_type;
+  const void *src_buf;
+  UINT32_T data_type, nchans, nsamples;
+  const UINT32_T *chanidx;
+  UINT32_T nsel;
+} copy_job_t;
+
+static void *copy_thread(void *arg)
+{
+  copy_job_t *job = (copy_job_t *) arg;
+  copy_selection(job->dst_buf, job->dst_type, job->src_buf, job->data_type, job->nchans, job->nsamples, job->chanidx, job->nsel);
+  return NULL;
+}
+
+/* like copy_selection, but large conversions are done by several threads that each copy a range of samples */
+static void copy_selection_parallel(void *dst_buf, UINT32_T dst_type, const void *src_buf, UINT32_T data_type, UINT32_T nchans, UINT32_T nsamples, const UINT32_T *chanidx, UINT32_T nsel)
+{
+  copy_job_t job[PARALLEL_MAX_THREADS];
+  pthread_t thread[PARALLEL_MAX_THREADS];
+  int started[PARALLEL_MAX_THREADS];
+  UINT32_T src_size = nchans * wordsize_from_type(data_type);
+  UINT32_T dst_size = nsel * wordsize_from_type(dst_type);
+  UINT32_T begsample = 0;
+  int k, nthreads = PARALLEL_MAX_THREADS;
+  
+  /* a plain copy is limited by the memory bandwidth anyway */
+  if ((dst_type == data_type && chanidx == NULL) || (double) nsamples * nsel < PARALLEL_MIN_ELEMENTS || nsamples < (UINT32_T) nthreads) {
+    copy_selection(dst_buf, dst_type, src_buf, data_type, nchans, nsamples, chanidx, nsel);
+    return;
+  }
+  
+  for (k=0; k<nthreads; k++) {
+    UINT32_T endsample = (UINT32_T) (((double) nsamples * (k+1)) / nthreads);
+    job[k].dst_buf   = (char *) dst_buf + (size_t) begsample * dst_size;
+    job[k].dst_type  = dst_type;
+    job[k].src_buf   = (const char *) src_buf + (size_t) begsample * src_size;
+    job[k].data_type = data_type;
+    job[k].nchans    = nchans;
+    job[k].nsamples  = endsample - begsample;
+    job[k].chanidx   = chanidx;
+    job[k].nsel      = nsel;
+    begsample = endsample;
+  }
+  /* the first range is done by the calling thread, and so is any range for which no thread could be started */
+  for (k=1; k<nthreads; k++) {
+    started[k] = (pthread_create(&thread[k], NULL, copy_thread, &job[k]) == 0);
+  }
+  copy_thread(&job[0]);
+  for (k=1; k<nthreads; k++) {
+    if (started[k])
+      pthread_join(thread[k], NULL);
+    else
+      copy_thread(&job[k]);
+  }
+}
+
+/* Reads the samples into an existing array, instead of creating a new one for every call.
+ * The detail is a cell-array {datsel, dat} or {datsel, dat, chansel}, where dat should be
+ * double, single or of the type in the buffer, with one row per selected channel and at
+ * least as many columns as samples. The channels (one-offset, all if empty) are selected
+ * and converted while copying. The number of samples that were written is returned.
+ */
+int buffer_getdat_into(int server, mxArray *plhs[], const mxArray *prhs[])
+{
+  static char msg[256];
+  const mxArray *datsel, *dat, *chansel = NULL;
+  UINT32_T *chanidx = NULL;
+  UINT32_T dst_type, nsel = 0, i;
+  int result = 0;
+  
+  message_t request;
+  messagedef_t reqdef;
+  message_t *response = NULL;
+  datasel_t sel;
+  
+  msg[0] = 0;
+  if (prhs[0]==NULL || !mxIsCell(prhs[0]) || mxGetNumberOfElements(prhs[0])<2 || mxGetNumberOfElements(prhs[0])>3)
+    mexErrMsgTxt("invalid input argument #2, should be {datsel, dat} or {datsel, dat, chansel}");
+  datsel = mxGetCell(prhs[0], 0);
+  dat    = mxGetCell(prhs[0], 1);
+  if (mxGetNumberOfElements(prhs[0])==3) chansel = mxGetCell(prhs[0], 2);
+  
+  if (datsel==NULL || mxGetNumberOfElements(datsel)!=2 || !mxIsDouble(datsel) || mxIsComplex(datsel))
+    mexErrMsgTxt("invalid data selection, should be [begsample endsample]");
+  if (dat==NULL || !mxIsNumeric(dat) || mxIsComplex(dat) || mxIsSparse(dat) || mxGetNumberOfDimensions(dat)!=2)
+    mexErrMsgTxt("invalid output array, should be a real numeric matrix");
+  
+  /* the channel selection is converted to zero-offset indices right away */
+  if (chansel!=NULL && !mxIsEmpty(chansel)) {
+    const double *ch;
+    if (!mxIsDouble(chansel) || mxIsComplex(chansel))
+      mexErrMsgTxt("invalid channel selection, should be a vector of channel numbers");
+    ch   = (const double *) mxGetData(chansel);
+    nsel = mxGetNumberOfElements(chansel);
+    chanidx = (UINT32_T *) mxMalloc(nsel*sizeof(UINT32_T));
+    for (i=0; i<nsel; i++) {
+      if (ch[i] < 1 || ch[i] != (double)(UINT32_T) ch[i])
+        mexErrMsgTxt("invalid channel selection, should be a vector of channel numbers");
+      chanidx[i] = (UINT32_T) ch[i] - 1;
+    }
+  }
+  
+  sel.begsample = (UINT32_T) mxGetPr(datsel)[0];
+  sel.endsample = (UINT32_T) mxGetPr(datsel)[1];
+  
+  reqdef.version = VERSION;
+  reqdef.command = GET_DAT;
+  reqdef.bufsize = sizeof(datasel_t);
+  request.def = &reqdef;
+  request.buf = &sel;
+  
+  result = buffer_clientrequest(server, &request, &response);
+  
+  if (result == 0) {
+    if (response->def->command==GET_OK && response->def->bufsize >= sizeof(datadef_t)) {
+      datadef_t *data_def = (datadef_t *) response->buf;
+      void *data_buf      = (void *)((char *)response->buf + sizeof(datadef_t));
+      
+      dst_type = ft_type_from_array(dat);
+      if (chanidx == NULL) nsel = data_def->nchans;
+      
+      if (class_id_from_ft_type(data_def->data_type) == mxUNKNOWN_CLASS || data_def->data_type == DATATYPE_CHAR) {
+        result = -4;  /* unsupported data type, as in buffer_getdat */
+      }
+      else if (response->def->bufsize - sizeof(datadef_t) < data_def->nchans*data_def->nsamples*wordsize_from_type(data_def->data_type)) {
+        result = -4;
+      }
+      else if (dst_type != DATATYPE_FLOAT64 && dst_type != DATATYPE_FLOAT32 && dst_type != data_def->data_type) {
+        sprintf(msg, "output array should be double, single or of the type in the buffer (%u)", data_def->data_type);
+      }
+      else if (mxGetM(dat) != nsel || mxGetN(dat) < data_def->nsamples) {
+        sprintf(msg, "output array should be at least %u x %u", nsel, data_def->nsamples);
+      }
+      else {
+        for (i=0; chanidx!=NULL && i<nsel; i++) {
+          if (chanidx[i] >= data_def->nchans) {
+            sprintf(msg, "channel %u is not in the buffer, which has %u channels", chanidx[i]+1, data_def->nchans);
+            break;
+          }
+        }
+        if (msg[0] == 0) {
+          copy_selection_parallel(mxGetData(dat), dst_type, data_buf, data_def->data_type, data_def->nchans, data_def->nsamples, chanidx, nsel);
+          plhs[0] = mxCreateDoubleScalar((double) data_def->nsamples);
+        }
+      }
+    }
+    else {
+      result = response->def->command;
+    }
+  }
+  
+  if (response) {
+    FREE(response->def);
+    FREE(response->buf);
+    FREE(response);
+  }
+  if (chanidx) mxFree(chanidx);
+  if (msg[0]) mexErrMsgTxt(msg);
+  
+  return result;
+}
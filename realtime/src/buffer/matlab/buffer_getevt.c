@@ -7,105 +7,191 @@
  */
 
 #include "buffer_mxutils.h"
+#include "buffer_prefetch.h"
 
 #define NUMBER_OF_FIELDS 5
 
 
 
-int buffer_getevt(int server, mxArray *plhs[], const mxArray *prhs[])
+/* sends the GET_EVT request for the selection in prhs[0] (all events if empty),
+   returns the error code as in buffer_getevt, or 0 if the response is GET_OK */
+static int getevt_request(int server, const mxArray *evtsel, message_t **response)
 {
   int verbose = 0;
-  int i, nevents;
-  int offset;
   double *val;
   int result;
   
-  mxArray *bufptr;
-  
-  
-  message_t *request  = NULL;
-  message_t *response = NULL;
+  message_t request;
+  messagedef_t reqdef;
   eventsel_t eventsel;
   
-  /* this is for the Matlab specific output */
-  const char *field_names[] = {
-    "type",
-    "value",
-    "sample",
-    "offset",
-    "duration"
-  };
+  request.def = &reqdef;
+  request.buf = NULL;
+  reqdef.version = VERSION;
+  reqdef.command = GET_EVT;
+  reqdef.bufsize = 0;
   
-  /* allocate the elements that will be used in the communication */
-  request      = malloc(sizeof(message_t));
-  request->def = malloc(sizeof(messagedef_t));
-  request->buf = NULL;
-  request->def->version = VERSION;
-  request->def->command = GET_EVT;
-  request->def->bufsize = 0;
-  
-  if ((prhs[0]!=NULL) && (mxGetNumberOfElements(prhs[0])==2) && (mxIsDouble(prhs[0])) && (!mxIsComplex(prhs[0]))) {
-    /* fprintf(stderr, "args OK\n"); */
-    val = (double *)mxGetData(prhs[0]);
+  if ((evtsel!=NULL) && (mxGetNumberOfElements(evtsel)==2) && (mxIsDouble(evtsel)) && (!mxIsComplex(evtsel))) {
+    val = (double *)mxGetData(evtsel);
     eventsel.begevent = (UINT32_T)(val[0]);
     eventsel.endevent = (UINT32_T)(val[1]);
     if (verbose) print_eventsel(&eventsel);
-    request->def->bufsize = append(&request->buf, request->def->bufsize, &eventsel, sizeof(eventsel_t));
+    request.buf = &eventsel;
+    reqdef.bufsize = sizeof(eventsel_t);
   }
   
-  if (verbose) print_request(request->def);
-  result = clientrequest(server, request, &response);
-  if (verbose) print_response(response->def);
+  if (verbose) print_request(request.def);
+  result = buffer_clientrequest(server, &request, response);
   
   if (result == 0) {
-    if (response->def->command==GET_OK) {
-	  eventdef_t *event_def;
-      /* first count the number of events */
-      nevents = 0;
-      offset = 0;
-      while (offset<response->def->bufsize) {
-        event_def = (eventdef_t *)((char *)response->buf + offset);
-        /* event_buf = (char *)response->buf + offset + sizeof(eventdef_t); */
-        if (verbose) print_eventdef(event_def);
-        offset += sizeof(eventdef_t) + event_def->bufsize;
-        nevents++;
-      }
-      
-      /* create a structure array that can hold all events */
-      plhs[0] = mxCreateStructMatrix(1, nevents, NUMBER_OF_FIELDS, field_names);
-      
-      offset = 0;
-      for (i=0; i<nevents; i++) {
-	  	char *buf_type,*buf_value;
-		
-        event_def = (eventdef_t *) ((char *)response->buf + offset);
-		buf_type = (char *) response->buf + offset + sizeof(eventdef_t);
-		buf_value = buf_type + event_def->type_numel * wordsize_from_type(event_def->type_type);
-                
-		mxSetFieldByNumber(plhs[0], i, 0, matrix_from_ft_type_data(event_def->type_type, 1, event_def->type_numel, buf_type));
-		mxSetFieldByNumber(plhs[0], i, 1, matrix_from_ft_type_data(event_def->value_type, 1, event_def->value_numel, buf_value));
-        mxSetFieldByNumber(plhs[0], i, 2, mxCreateDoubleScalar((double)event_def->sample+1)); /* 1-based in Matlab, 0-based in protocol */
-        mxSetFieldByNumber(plhs[0], i, 3, mxCreateDoubleScalar((double)event_def->offset));
-        mxSetFieldByNumber(plhs[0], i, 4, mxCreateDoubleScalar((double)event_def->duration));
-        offset += sizeof(eventdef_t) + event_def->bufsize;
-      }
-    }
-    else {
-      result = response->def->command;
+    if (verbose) print_response((*response)->def);
+    if ((*response)->def->command!=GET_OK) {
+      result = (*response)->def->command;
     }
   }
+  return result;
+}
+
+/* counts the events in the response, and stops at the first one that is incomplete */
+static int count_events(const message_t *response)
+{
+  int nevents = 0;
+  UINT32_T offset = 0;
   
-  if (request) {
-    FREE(request->def);
-    FREE(request->buf);
-    FREE(request);
+  while (offset + sizeof(eventdef_t) <= response->def->bufsize) {
+    const eventdef_t *event_def = (const eventdef_t *)((const char *)response->buf + offset);
+    UINT32_T size = sizeof(eventdef_t) + event_def->bufsize;
+    if (offset + size > response->def->bufsize) break;
+    offset += size;
+    nevents++;
   }
+  return nevents;
+}
+
+static void free_response(message_t *response)
+{
   if (response) {
     FREE(response->def);
     FREE(response->buf);
     FREE(response);
   }
+}
+
+/* returns the structure array with the events in the response to GET_EVT */
+mxArray *buffer_getevt_struct(const message_t *response)
+{
+  int i, nevents;
+  int offset;
+  mxArray *S;
+  eventdef_t *event_def;
+  
+  /* this is for the Matlab specific output */
+  const char *field_names[] = {
+    "type",
+    "value",
+    "sample",
+    "offset",
+    "duration"
+  };
+  
+  nevents = count_events(response);
+  
+  /* create a structure array that can hold all events */
+  S = mxCreateStructMatrix(1, nevents, NUMBER_OF_FIELDS, field_names);
+  
+  offset = 0;
+  for (i=0; i<nevents; i++) {
+    char *buf_type,*buf_value;
+    
+    event_def = (eventdef_t *) ((char *)response->buf + offset);
+    buf_type = (char *) response->buf + offset + sizeof(eventdef_t);
+    buf_value = buf_type + event_def->type_numel * wordsize_from_type(event_def->type_type);
+    
+    mxSetFieldByNumber(S, i, 0, matrix_from_ft_type_data(event_def->type_type, 1, event_def->type_numel, buf_type));
+    mxSetFieldByNumber(S, i, 1, matrix_from_ft_type_data(event_def->value_type, 1, event_def->value_numel, buf_value));
+    mxSetFieldByNumber(S, i, 2, mxCreateDoubleScalar((double)event_def->sample+1)); /* 1-based in Matlab, 0-based in protocol */
+    mxSetFieldByNumber(S, i, 3, mxCreateDoubleScalar((double)event_def->offset));
+    mxSetFieldByNumber(S, i, 4, mxCreateDoubleScalar((double)event_def->duration));
+    offset += sizeof(eventdef_t) + event_def->bufsize;
+  }
+  return S;
+}
+
+int buffer_getevt(int server, mxArray *plhs[], const mxArray *prhs[])
+{
+  int result;
   
+  message_t *response = NULL;
+  
+  result = getevt_request(server, prhs[0], &response);
+  
+  if (result == 0) {
+    plhs[0] = buffer_getevt_struct(response);
+  }
+  
+  free_response(response);
   return result;
 }
 
+/* Like buffer_getevt, but returns a single structure with one field per property,
+ * in which sample, offset and duration are 1xN double arrays, and type and value
+ * are 1xN cell-arrays. The arrays are allocated once, and filled in one pass over
+ * the events, which is much faster than a structure array for many events.
+ */
+int buffer_getevt_columns(int server, mxArray *plhs[], const mxArray *prhs[])
+{
+  int i, nevents;
+  UINT32_T offset;
+  int result;
+  
+  message_t *response = NULL;
+  
+  const char *field_names[] = {
+    "type",
+    "value",
+    "sample",
+    "offset",
+    "duration"
+  };
+  
+  result = getevt_request(server, prhs[0], &response);
+  
+  if (result == 0) {
+    mxArray *type, *value, *sample, *offs, *duration;
+    double *psample, *poffs, *pduration;
+    
+    nevents = count_events(response);
+    type     = mxCreateCellMatrix(1, nevents);
+    value    = mxCreateCellMatrix(1, nevents);
+    sample   = mxCreateDoubleMatrix(1, nevents, mxREAL);
+    offs     = mxCreateDoubleMatrix(1, nevents, mxREAL);
+    duration = mxCreateDoubleMatrix(1, nevents, mxREAL);
+    psample   = mxGetPr(sample);
+    poffs     = mxGetPr(offs);
+    pduration = mxGetPr(duration);
+    
+    offset = 0;
+    for (i=0; i<nevents; i++) {
+      const eventdef_t *event_def = (const eventdef_t *) ((char *)response->buf + offset);
+      const char *buf_type = (const char *) (event_def + 1);
+      const char *buf_value = buf_type + event_def->type_numel * wordsize_from_type(event_def->type_type);
+      
+      mxSetCell(type,  i, matrix_from_ft_type_data(event_def->type_type, 1, event_def->type_numel, buf_type));
+      mxSetCell(value, i, matrix_from_ft_type_data(event_def->value_type, 1, event_def->value_numel, buf_value));
+      psample[i]   = (double)event_def->sample+1; /* 1-based in Matlab, 0-based in protocol */
+      poffs[i]     = (double)event_def->offset;
+      pduration[i] = (double)event_def->duration;
+      offset += sizeof(eventdef_t) + event_def->bufsize;
+    }
+    
+    plhs[0] = mxCreateStructMatrix(1, 1, NUMBER_OF_FIELDS, field_names);
+    mxSetFieldByNumber(plhs[0], 0, 0, type);
+    mxSetFieldByNumber(plhs[0], 0, 1, value);
+    mxSetFieldByNumber(plhs[0], 0, 2, sample);
+    mxSetFieldByNumber(plhs[0], 0, 3, offs);
+    mxSetFieldByNumber(plhs[0], 0, 4, duration);
+  }
+  
+  free_response(response);
+  return result;
+}
@@ -9,6 +9,7 @@
 #include "mex.h"
 #include "matrix.h"
 #include "buffer.h"
+#include "buffer_prefetch.h"
 
 #define NUMBER_OF_FIELDS 6
 #define MAX_NUM_BLOBS  32
@@ -177,6 +178,137 @@ void addChunksToMatrix(mxArray *S, const char *buf, int bufsize, int numChannels
 }
 
 
+/* The chunks of the last header that was read from each server are kept, so
+   that GET_HDR_GEN only has to send them again if the header has changed.
+   Servers that do not know GET_HDR_GEN are asked with GET_HDR instead.
+*/
+typedef struct header_cache_s {
+  int server;
+  int unsupported;      /* the server does not know GET_HDR_GEN */
+  UINT32_T generation;  /* 0 if there are no chunks yet */
+  char *chunks;
+  UINT32_T size;
+  struct header_cache_s *next;
+} header_cache_t;
+
+header_cache_t *firstHeaderCache = NULL;
+
+header_cache_t *lookup_header_cache(int server) {
+  header_cache_t *hc;
+  for (hc = firstHeaderCache; hc != NULL; hc = hc->next) {
+    if (hc->server == server) return hc;
+  }
+  hc = (header_cache_t *) calloc(1, sizeof(header_cache_t));
+  if (hc == NULL) return NULL;
+  hc->server = server;
+  hc->next = firstHeaderCache;
+  firstHeaderCache = hc;
+  return hc;
+}
+
+/* this is called when the connection to the server is closed */
+void buffer_gethdr_forget(int server) {
+  header_cache_t **prev = &firstHeaderCache;
+  while (*prev != NULL) {
+    header_cache_t *hc = *prev;
+    if (hc->server == server) {
+      *prev = hc->next;
+      FREE(hc->chunks);
+      free(hc);
+      return;
+    }
+    prev = &hc->next;
+  }
+}
+
+mxArray *headerToStruct(const headerdef_t *headerdef, const char *chunks, UINT32_T size) {
+  /* this is for the MATLAB specific output */
+  const char *field_names[NUMBER_OF_FIELDS] = {"nchans", "nsamples", "nevents", "fsample", "data_type", "bufsize"};
+  mxArray *S = mxCreateStructMatrix(1, 1, NUMBER_OF_FIELDS, field_names);
+
+  mxSetFieldByNumber(S, 0, 0, mxCreateDoubleScalar((double)(headerdef->nchans)));
+  mxSetFieldByNumber(S, 0, 1, mxCreateDoubleScalar((double)(headerdef->nsamples)));
+  mxSetFieldByNumber(S, 0, 2, mxCreateDoubleScalar((double)(headerdef->nevents)));
+  mxSetFieldByNumber(S, 0, 3, mxCreateDoubleScalar((double)(headerdef->fsample)));
+  mxSetFieldByNumber(S, 0, 4, mxCreateDoubleScalar((double)(headerdef->data_type)));
+  mxSetFieldByNumber(S, 0, 5, mxCreateDoubleScalar((double)(headerdef->bufsize)));
+
+  addChunksToMatrix(S, chunks, size, headerdef->nchans);
+  return S;
+}
+
+/* returns the header from the response to GET_HDR_GEN and updates the cache, or NULL if the response is not GET_OK */
+mxArray *headerFromGeneration(header_cache_t *hc, const message_t *response) {
+  headergen_t *hgen;
+  UINT32_T size;
+
+  if (response->def->command!=GET_OK || response->def->bufsize < sizeof(headergen_t))
+    return NULL;
+  hgen = (headergen_t *) response->buf;
+  size = response->def->bufsize - sizeof(headergen_t);
+
+  if (hgen->generation != hc->generation) {
+    /* the header has changed, the response contains the new chunks */
+    char *chunks = (char *) malloc(size > 0 ? size : 1);
+    if (chunks != NULL) {
+      memcpy(chunks, hgen+1, size);
+      FREE(hc->chunks);
+      hc->chunks = chunks;
+      hc->size = size;
+      hc->generation = hgen->generation;
+    }
+    return headerToStruct(&hgen->def, (const char *) (hgen+1), size);
+  }
+  return headerToStruct(&hgen->def, hc->chunks, hc->size);
+}
+
+/* Fills in a GET_HDR_GEN request for the header of the server, whose response
+   should be passed to buffer_gethdr_response. Returns 0 if the server does not
+   know GET_HDR_GEN, in which case buffer_gethdr should be used.
+*/
+int buffer_gethdr_request(int server, messagedef_t *def, message_t *request) {
+  header_cache_t *hc = lookup_header_cache(server);
+
+  if (hc == NULL || hc->unsupported) return 0;
+  def->version = VERSION;
+  def->command = GET_HDR_GEN;
+  def->bufsize = sizeof(UINT32_T);
+  request->def = def;
+  request->buf = &hc->generation;
+  return 1;
+}
+
+/* returns the header from the response to the request of buffer_gethdr_request, or NULL */
+mxArray *buffer_gethdr_response(int server, const message_t *response) {
+  header_cache_t *hc = lookup_header_cache(server);
+  return (hc != NULL) ? headerFromGeneration(hc, response) : NULL;
+}
+
+/* returns 1 if the header could be read with GET_HDR_GEN, 0 if GET_HDR should be used */
+int buffer_gethdr_cached(int server, header_cache_t *hc, mxArray *plhs[], int *result) {
+  message_t request;
+  messagedef_t def;
+  message_t *response = NULL;
+  int done = 0;
+
+  def.version = VERSION;
+  def.command = GET_HDR_GEN;
+  def.bufsize = sizeof(UINT32_T);
+  request.def = &def;
+  request.buf = &hc->generation;
+
+  *result = buffer_clientrequest(server, &request, &response);
+  if (*result != 0) return 1;
+
+  if ((plhs[0] = headerFromGeneration(hc, response)) != NULL)
+    done = 1;
+
+  FREE(response->def);
+  FREE(response->buf);
+  FREE(response);
+  return done;
+}
+
 int buffer_gethdr(int server, mxArray *plhs[], const mxArray *prhs[])
 {
   int verbose = 0;
@@ -185,8 +317,11 @@ int buffer_gethdr(int server, mxArray *plhs[], const mxArray *prhs[])
   message_t *request  = NULL;
   message_t *response = NULL;
 
-  /* this is for the MATLAB specific output */
-  const char *field_names[NUMBER_OF_FIELDS] = {"nchans", "nsamples", "nevents", "fsample", "data_type", "bufsize"};
+  header_cache_t *hc = lookup_header_cache(server);
+
+  /* most of the time only the counters have changed */
+  if (hc != NULL && !hc->unsupported && buffer_gethdr_cached(server, hc, plhs, &result))
+    return result;
 
   /* allocate the elements that will be used in the communication */
   request      = malloc(sizeof(message_t));
@@ -197,7 +332,7 @@ int buffer_gethdr(int server, mxArray *plhs[], const mxArray *prhs[])
   request->def->bufsize = 0;
 
   if (verbose) print_request(request->def);
-  result = clientrequest(server, request, &response);
+  result = buffer_clientrequest(server, request, &response);
 
   if (result == 0) {
     if (verbose) print_response(response->def);
@@ -207,15 +342,10 @@ int buffer_gethdr(int server, mxArray *plhs[], const mxArray *prhs[])
 
       if (verbose) print_headerdef(headerdef);
 
-      plhs[0] = mxCreateStructMatrix(1, 1, NUMBER_OF_FIELDS, field_names);
-      mxSetFieldByNumber(plhs[0], 0, 0, mxCreateDoubleScalar((double)(headerdef->nchans)));
-      mxSetFieldByNumber(plhs[0], 0, 1, mxCreateDoubleScalar((double)(headerdef->nsamples)));
-      mxSetFieldByNumber(plhs[0], 0, 2, mxCreateDoubleScalar((double)(headerdef->nevents)));
-      mxSetFieldByNumber(plhs[0], 0, 3, mxCreateDoubleScalar((double)(headerdef->fsample)));
-      mxSetFieldByNumber(plhs[0], 0, 4, mxCreateDoubleScalar((double)(headerdef->data_type)));
-      mxSetFieldByNumber(plhs[0], 0, 5, mxCreateDoubleScalar((double)(headerdef->bufsize)));
+      plhs[0] = headerToStruct(headerdef, (const char *) response->buf + sizeof(headerdef_t), headerdef->bufsize);
 
-      addChunksToMatrix(plhs[0], (const char *) response->buf + sizeof(headerdef_t), headerdef->bufsize, headerdef->nchans);
+      /* GET_HDR_GEN failed although there is a header */
+      if (hc != NULL) hc->unsupported = 1;
     }
     else {
       result = response->def->command;
@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ * Reads the header, the new events and the latest samples in one round trip.
+ * The GET_HDR_GEN, GET_EVT and GET_DAT_M requests are written together, and
+ * none of them depends on the response to another: the events are selected
+ * with a filter, for which the server limits the selection to the events that
+ * are in the buffer, and the samples with DATAMULTI_LATEST.
+ */
+
+#include "buffer_mxutils.h"
+#include "buffer_prefetch.h"
+
+#define NUMBER_OF_FIELDS 3
+#define NUMBER_OF_DAT_FIELDS 7
+
+int buffer_gethdr(int, mxArray **, const mxArray **);
+int buffer_gethdr_request(int server, messagedef_t *def, message_t *request);
+mxArray *buffer_gethdr_response(int server, const message_t *response);
+mxArray *buffer_getevt_struct(const message_t *response);
+
+/* the events from begevent onwards, the filter matches all of them */
+typedef struct {
+  eventsel_t sel;
+  eventfilter_t filter;
+  INT32_T minsample;
+} evtrequest_t;
+
+/* returns the samples in the response to GET_DAT_M as in get_dat, or [] if there are none */
+static int data_from_response(const message_t *response, mxArray **dat)
+{
+  const char *field_names[NUMBER_OF_DAT_FIELDS] = {"nchans", "nsamples", "data_type", "bufsize", "buf", "begsample", "endsample"};
+  const datasel_t *range;
+  const datadef_t *data_def;
+  
+  if (response->def->bufsize < sizeof(datasel_t) + sizeof(datadef_t)) {
+    *dat = mxCreateDoubleMatrix(0, 0, mxREAL);
+    return 0;
+  }
+  range    = (const datasel_t *) response->buf;
+  data_def = (const datadef_t *) (range + 1);
+  if (class_id_from_ft_type(data_def->data_type) == mxUNKNOWN_CLASS || data_def->data_type == DATATYPE_CHAR)
+    return -4;  /* unsupported data type, as in buffer_getdat */
+  
+  *dat = mxCreateStructMatrix(1, 1, NUMBER_OF_DAT_FIELDS, field_names);
+  mxSetFieldByNumber(*dat, 0, 0, mxCreateDoubleScalar((double)data_def->nchans));
+  mxSetFieldByNumber(*dat, 0, 1, mxCreateDoubleScalar((double)data_def->nsamples));
+  mxSetFieldByNumber(*dat, 0, 2, mxCreateDoubleScalar((double)data_def->data_type));
+  mxSetFieldByNumber(*dat, 0, 3, mxCreateDoubleScalar((double)data_def->bufsize));
+  mxSetFieldByNumber(*dat, 0, 4, matrix_from_ft_type_data(data_def->data_type, data_def->nchans, data_def->nsamples, data_def + 1));
+  mxSetFieldByNumber(*dat, 0, 5, mxCreateDoubleScalar((double)range->begsample));
+  mxSetFieldByNumber(*dat, 0, 6, mxCreateDoubleScalar((double)range->endsample));
+  return 0;
+}
+
+int buffer_getlatest(int server, mxArray *plhs[], const mxArray *prhs[])
+{
+  const char *field_names[NUMBER_OF_FIELDS] = {"hdr", "evt", "dat"};
+  const message_t *request[3];
+  message_t *response[3];
+  message_t hdrmsg, evtmsg, datmsg;
+  messagedef_t hdrdef, evtdef, datdef;
+  evtrequest_t evtreq;
+  datamulti_t dmulti;
+  mxArray *hdr = NULL, *evt = NULL, *dat = NULL;
+  double *val;
+  int i, nreq = 0, first, result;
+  
+  if (prhs[0]==NULL || mxGetNumberOfElements(prhs[0])!=2 || !mxIsDouble(prhs[0]) || mxIsComplex(prhs[0]))
+    mexErrMsgTxt("invalid input argument #2, should be [begevent nsamples]");
+  val = (double *)mxGetData(prhs[0]);
+  if (val[0] < 0 || val[1] < 0)
+    mexErrMsgTxt("invalid input argument #2, should be [begevent nsamples]");
+  
+  /* servers that do not know GET_HDR_GEN are asked for the header first */
+  if (buffer_gethdr_request(server, &hdrdef, &hdrmsg)) {
+    request[nreq++] = &hdrmsg;
+  }
+  else if ((result = buffer_gethdr(server, &hdr, NULL)) != 0) {
+    return result;
+  }
+  first = (hdr == NULL) ? 1 : 0;
+  
+  evtreq.sel.begevent    = (UINT32_T) val[0];
+  evtreq.sel.endevent    = 0xFFFFFFFF;
+  evtreq.filter.what      = EVENTSEL_MINSAMPLE;
+  evtreq.filter.data_type = DATATYPE_INT32;
+  evtreq.filter.numel     = 1;
+  evtreq.filter.bufsize   = sizeof(INT32_T);
+  evtreq.minsample        = -2147483647 - 1;
+  evtdef.version = VERSION;
+  evtdef.command = GET_EVT;
+  evtdef.bufsize = sizeof(evtrequest_t);
+  evtmsg.def = &evtdef;
+  evtmsg.buf = &evtreq;
+  request[nreq++] = &evtmsg;
+  
+  dmulti.what      = DATAMULTI_LATEST;
+  dmulti.nsel      = (UINT32_T) val[1];
+  dmulti.stride    = 1;
+  dmulti.data_type = DATATYPE_UNKNOWN;
+  dmulti.nchans    = 0;
+  datdef.version = VERSION;
+  datdef.command = GET_DAT_M;
+  datdef.bufsize = sizeof(datamulti_t);
+  datmsg.def = &datdef;
+  datmsg.buf = &dmulti;
+  request[nreq++] = &datmsg;
+  
+  result = buffer_clientrequest_multi(server, nreq, request, response);
+  if (result != 0) {
+    if (hdr) mxDestroyArray(hdr);
+    return result;
+  }
+  
+  /* the first error of the buffer is returned */
+  for (i=0; i<nreq && result==0; i++) {
+    if (response[i]->def->command != GET_OK)
+      result = response[i]->def->command;
+  }
+  if (result == 0 && first && (hdr = buffer_gethdr_response(server, response[0])) == NULL)
+    result = GET_ERR;
+  if (result == 0)
+    evt = buffer_getevt_struct(response[first]);
+  if (result == 0)
+    result = data_from_response(response[first+1], &dat);
+  
+  for (i=0; i<nreq; i++)
+    cleanup_message((void **) &response[i]);
+  
+  if (result != 0) {
+    if (hdr) mxDestroyArray(hdr);
+    if (evt) mxDestroyArray(evt);
+    return result;
+  }
+  
+  plhs[0] = mxCreateStructMatrix(1, 1, NUMBER_OF_FIELDS, field_names);
+  mxSetFieldByNumber(plhs[0], 0, 0, hdr);
+  mxSetFieldByNumber(plhs[0], 0, 1, evt);
+  mxSetFieldByNumber(plhs[0], 0, 2, dat);
+  return 0;
+}
@@ -114,46 +114,18 @@ mxArray *matrix_from_ft_type_data(UINT32_T type, UINT32_T rows, UINT32_T cols, c
 			}
 			break;
         case DATATYPE_UINT8:
-			A = mxCreateNumericMatrix(rows, cols, mxUINT8_CLASS, mxREAL);
-			memcpy(mxGetData(A), data, rows*cols*WORDSIZE_UINT8);
-			break;
         case DATATYPE_UINT16:
-			A = mxCreateNumericMatrix(rows, cols, mxUINT16_CLASS, mxREAL);
-			memcpy(mxGetData(A), data, rows*cols*WORDSIZE_UINT16);
-			break;
         case DATATYPE_UINT32:
-			A = mxCreateNumericMatrix(rows, cols, mxUINT32_CLASS, mxREAL);
-			memcpy(mxGetData(A), data, rows*cols*WORDSIZE_UINT32);
-			break;
         case DATATYPE_UINT64:
-			A = mxCreateNumericMatrix(rows, cols, mxUINT64_CLASS, mxREAL);
-			memcpy(mxGetData(A), data, rows*cols*WORDSIZE_UINT64);
-			break;
-			
         case DATATYPE_INT8:
-			A = mxCreateNumericMatrix(rows, cols, mxINT8_CLASS, mxREAL);
-			memcpy(mxGetData(A), data, rows*cols*WORDSIZE_INT8);
-			break;
         case DATATYPE_INT16:
-			A = mxCreateNumericMatrix(rows, cols, mxINT16_CLASS, mxREAL);
-			memcpy(mxGetData(A), data, rows*cols*WORDSIZE_INT16);
-			break;
         case DATATYPE_INT32:
-			A = mxCreateNumericMatrix(rows, cols, mxINT32_CLASS, mxREAL);
-			memcpy(mxGetData(A), data, rows*cols*WORDSIZE_INT32);
-			break;
         case DATATYPE_INT64:
-			A = mxCreateNumericMatrix(rows, cols, mxINT64_CLASS, mxREAL);
-			memcpy(mxGetData(A), data, rows*cols*WORDSIZE_INT64);
-			break;
-			
         case DATATYPE_FLOAT32:
-			A = mxCreateNumericMatrix(rows, cols, mxSINGLE_CLASS, mxREAL);
-			memcpy(mxGetData(A), data, rows*cols*WORDSIZE_FLOAT32);
-			break;
         case DATATYPE_FLOAT64:
-			A = mxCreateNumericMatrix(rows, cols, mxDOUBLE_CLASS, mxREAL);
-			memcpy(mxGetData(A), data, rows*cols*WORDSIZE_FLOAT64);
+			/* the numeric types are stored in the same way in Matlab */
+			A = mxCreateNumericMatrix(rows, cols, class_id_from_ft_type(type), mxREAL);
+			memcpy(mxGetData(A), data, rows*cols*wordsize_from_type(type));
 			break;
 			
         default:
@@ -0,0 +1,573 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ * Background thread that copies the newest samples and events of a buffer into
+ * a local ring, see buffer_prefetch.h
+ */
+
+#include <pthread.h>
+#include <sys/time.h>
+#include <errno.h>
+
+#include "buffer.h"
+#include "buffer_prefetch.h"
+
+#define PREFETCH_MAXEVENTS  1024   /* number of events that are kept in the ring */
+#define PREFETCH_POLL         100  /* timeout of WAIT_DAT in milliseconds */
+#define PREFETCH_RETRY        500  /* pause after a failed request in milliseconds */
+#define PREFETCH_INFLIGHT      50  /* how long a request waits for samples that are being fetched */
+
+struct ft_prefetch {
+	ft_connection_t *conn;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;    /* signalled after new samples or events were stored */
+	int stop;
+	int running;
+
+	/* everything below is protected by the mutex */
+	UINT32_T maxbytes;
+	UINT32_T generation;
+	UINT32_T nchans;
+	UINT32_T data_type;
+	UINT32_T rowsize;       /* bytes per sample, 0 if the samples are not kept */
+	UINT32_T capacity;      /* number of samples that fit in the ring */
+	char *ring;
+	UINT32_T firstsample, nsamples;
+	UINT32_T available;     /* number of samples in the buffer at the last poll */
+	UINT32_T availevents;
+
+	void *event[PREFETCH_MAXEVENTS];
+	UINT32_T eventsize[PREFETCH_MAXEVENTS];
+	UINT32_T firstevent, nevents;
+
+	UINT32_T epoch;         /* increased when the ring is emptied by ft_prefetch_observe */
+	UINT32_T hits, misses;
+};
+
+static void sleep_ms(unsigned int ms) {
+	ft_clock_sleep((UINT64_T) ms * 1000000);
+}
+
+static void clear_events(ft_prefetch_t *P) {
+	UINT32_T i;
+	for (i=0; i<P->nevents; i++) {
+		UINT32_T k = (P->firstevent + i) % PREFETCH_MAXEVENTS;
+		FREE(P->event[k]);
+	}
+	P->nevents = 0;
+}
+
+/* empties the ring, and prepares it for the samples of a new header. The
+   next fetch starts with the oldest samples and events that fit in the ring. */
+static void reset_cache(ft_prefetch_t *P, const headerdef_t *def, UINT32_T generation) {
+	UINT32_T rowsize = def->nchans * wordsize_from_type(def->data_type);
+
+	if (rowsize != P->rowsize) {
+		FREE(P->ring);
+		P->capacity = 0;
+		P->rowsize  = rowsize;
+		if (rowsize > 0 && P->maxbytes >= rowsize) {
+			P->capacity = P->maxbytes / rowsize;
+			P->ring = (char *) malloc((size_t) P->capacity * rowsize);
+			if (P->ring == NULL) P->capacity = 0;
+		}
+	}
+	P->generation  = generation;
+	P->nchans      = def->nchans;
+	P->data_type   = def->data_type;
+	P->firstsample = 0;
+	P->nsamples    = 0;
+	P->available   = def->nsamples;
+	P->availevents = def->nevents;
+	clear_events(P);
+	P->firstevent  = 0;
+}
+
+/* reads the counters of the header, returns 0 on success. The generation
+   is 0 for servers that do not know GET_HDR_GEN. */
+static int read_counters(ft_prefetch_t *P, headerdef_t *def, UINT32_T *generation) {
+	message_t request, *response = NULL;
+	messagedef_t reqdef;
+	int status;
+
+	reqdef.version = VERSION;
+	reqdef.command = GET_HDR_GEN;
+	reqdef.bufsize = 0;
+	request.def = &reqdef;
+	request.buf = NULL;
+
+	status = ft_connection_request(P->conn, &request, &response);
+	if (status == 0 && response->def->command == GET_OK && response->def->bufsize >= sizeof(headergen_t)) {
+		headergen_t *hgen = (headergen_t *) response->buf;
+		*def = hgen->def;
+		*generation = hgen->generation;
+		cleanup_message((void **) &response);
+		return 0;
+	}
+	if (response != NULL) cleanup_message((void **) &response);
+	if (status != 0) return -1;
+
+	reqdef.command = GET_HDR;
+	status = ft_connection_request(P->conn, &request, &response);
+	if (status == 0 && response->def->command == GET_OK && response->def->bufsize >= sizeof(headerdef_t)) {
+		*def = *(headerdef_t *) response->buf;
+		*generation = 0;
+		cleanup_message((void **) &response);
+		return 0;
+	}
+	if (response != NULL) cleanup_message((void **) &response);
+	return -1;
+}
+
+/* copies the samples begsample onwards into the ring */
+static void store_samples(ft_prefetch_t *P, UINT32_T begsample, const datadef_t *ddef, const char *data) {
+	UINT32_T n = ddef->nsamples, endsample, first, pos, part;
+
+	if (P->capacity == 0 || ddef->nchans != P->nchans || ddef->data_type != P->data_type) return;
+	if (ddef->bufsize < n * P->rowsize) return;
+
+	/* only the last samples that fit are kept */
+	if (n > P->capacity) {
+		data += (n - P->capacity) * P->rowsize;
+		begsample += n - P->capacity;
+		n = P->capacity;
+	}
+	endsample = begsample + n;
+
+	pos = begsample % P->capacity;
+	part = P->capacity - pos;
+	if (part > n) part = n;
+	memcpy(P->ring + pos * P->rowsize, data, part * P->rowsize);
+	memcpy(P->ring, data + part * P->rowsize, (n - part) * P->rowsize);
+
+	first = P->firstsample;
+	if (P->nsamples == 0 || first + P->nsamples != begsample) first = begsample;
+	if (endsample - first > P->capacity) first = endsample - P->capacity;
+	P->firstsample = first;
+	P->nsamples = endsample - first;
+}
+
+static void store_events(ft_prefetch_t *P, UINT32_T begevent, const char *buf, UINT32_T size) {
+	UINT32_T offset = 0;
+
+	if (P->nevents == 0 || P->firstevent + P->nevents != begevent) {
+		clear_events(P);
+		P->firstevent = begevent;
+	}
+	while (offset + sizeof(eventdef_t) <= size) {
+		const eventdef_t *evdef = (const eventdef_t *) (buf + offset);
+		UINT32_T evsize = sizeof(eventdef_t) + evdef->bufsize;
+		UINT32_T k;
+		void *copy;
+
+		if (offset + evsize > size) break;
+		copy = malloc(evsize);
+		if (copy == NULL) break;
+		memcpy(copy, evdef, evsize);
+
+		if (P->nevents == PREFETCH_MAXEVENTS) {
+			/* the oldest event makes room */
+			FREE(P->event[P->firstevent % PREFETCH_MAXEVENTS]);
+			P->firstevent++;
+			P->nevents--;
+		}
+		k = (P->firstevent + P->nevents) % PREFETCH_MAXEVENTS;
+		P->event[k] = copy;
+		P->eventsize[k] = evsize;
+		P->nevents++;
+		offset += evsize;
+	}
+}
+
+/* fetches the samples and events that are not in the ring yet, returns 0 on success */
+static int fetch(ft_prefetch_t *P, const headerdef_t *def) {
+	message_t request, *response = NULL;
+	messagedef_t reqdef;
+	datasel_t datasel;
+	eventsel_t eventsel;
+	UINT32_T beg, epoch;
+	int status;
+
+	request.def = &reqdef;
+	reqdef.version = VERSION;
+
+	pthread_mutex_lock(&P->mutex);
+	beg = P->firstsample + P->nsamples;
+	if (def->nsamples > P->capacity && beg < def->nsamples - P->capacity)
+		beg = def->nsamples - P->capacity;
+	epoch = P->epoch;
+	pthread_mutex_unlock(&P->mutex);
+
+	if (P->capacity > 0 && beg < def->nsamples) {
+		datasel.begsample = beg;
+		datasel.endsample = def->nsamples - 1;
+		reqdef.command = GET_DAT;
+		reqdef.bufsize = sizeof(datasel_t);
+		request.buf = &datasel;
+
+		status = ft_connection_request(P->conn, &request, &response);
+		if (status != 0) return -1;
+		pthread_mutex_lock(&P->mutex);
+		if (P->epoch != epoch) {
+			/* the client saw that the buffer was flushed while the samples were on their way */
+		}
+		else if (response->def->command == GET_OK && response->def->bufsize >= sizeof(datadef_t)) {
+			store_samples(P, beg, (const datadef_t *) response->buf, (const char *) response->buf + sizeof(datadef_t));
+		}
+		else {
+			/* these samples are no longer in the buffer, start over at the newest one */
+			P->firstsample = def->nsamples;
+			P->nsamples = 0;
+		}
+		pthread_cond_broadcast(&P->cond);
+		pthread_mutex_unlock(&P->mutex);
+		cleanup_message((void **) &response);
+	}
+
+	pthread_mutex_lock(&P->mutex);
+	beg = P->firstevent + P->nevents;
+	if (def->nevents > PREFETCH_MAXEVENTS && beg < def->nevents - PREFETCH_MAXEVENTS)
+		beg = def->nevents - PREFETCH_MAXEVENTS;
+	epoch = P->epoch;
+	pthread_mutex_unlock(&P->mutex);
+
+	if (beg < def->nevents) {
+		eventsel.begevent = beg;
+		eventsel.endevent = def->nevents - 1;
+		reqdef.command = GET_EVT;
+		reqdef.bufsize = sizeof(eventsel_t);
+		request.buf = &eventsel;
+
+		status = ft_connection_request(P->conn, &request, &response);
+		if (status != 0) return -1;
+		pthread_mutex_lock(&P->mutex);
+		if (P->epoch != epoch) {
+			/* see above */
+		}
+		else if (response->def->command == GET_OK) {
+			store_events(P, beg, (const char *) response->buf, response->def->bufsize);
+		}
+		else {
+			clear_events(P);
+			P->firstevent = def->nevents;
+		}
+		pthread_cond_broadcast(&P->cond);
+		pthread_mutex_unlock(&P->mutex);
+		cleanup_message((void **) &response);
+	}
+	return 0;
+}
+
+static int wait_for_data(ft_prefetch_t *P, const headerdef_t *def) {
+	message_t request, *response = NULL;
+	messagedef_t reqdef;
+	waitdef_t waitdef;
+	int status;
+
+	reqdef.version = VERSION;
+	reqdef.command = WAIT_DAT;
+	reqdef.bufsize = sizeof(waitdef_t);
+	request.def = &reqdef;
+	request.buf = &waitdef;
+	waitdef.threshold.nsamples = def->nsamples;
+	waitdef.threshold.nevents  = def->nevents;
+	waitdef.milliseconds = PREFETCH_POLL;
+
+	status = ft_connection_request(P->conn, &request, &response);
+	if (status != 0) return status;
+	if (response->def->command == WAIT_OK && response->def->bufsize >= sizeof(samples_events_t)) {
+		const samples_events_t *nse = (const samples_events_t *) response->buf;
+		/* requests for these can wait for the next fetch, instead of going to the server */
+		pthread_mutex_lock(&P->mutex);
+		P->available = nse->nsamples;
+		P->availevents = nse->nevents;
+		if (nse->nsamples < P->firstsample + P->nsamples || nse->nevents < P->firstevent + P->nevents) {
+			/* the buffer was flushed, the ring is reset after reading the new header */
+			P->nsamples = 0;
+			clear_events(P);
+		}
+		pthread_mutex_unlock(&P->mutex);
+	}
+	cleanup_message((void **) &response);
+	return 0;
+}
+
+static void *prefetch_thread(void *arg) {
+	ft_prefetch_t *P = (ft_prefetch_t *) arg;
+	int stop = 0;
+
+	while (!stop) {
+		headerdef_t def;
+		UINT32_T generation;
+		int ok = (read_counters(P, &def, &generation) == 0);
+
+		pthread_mutex_lock(&P->mutex);
+		P->running = ok;
+		if (ok) {
+			/* a new header, or a server that was restarted */
+			if (generation != P->generation || def.nchans != P->nchans || def.data_type != P->data_type ||
+					def.nsamples < P->firstsample + P->nsamples || def.nevents < P->firstevent + P->nevents)
+				reset_cache(P, &def, generation);
+			P->available = def.nsamples;
+			P->availevents = def.nevents;
+		}
+		else {
+			P->nsamples = 0;
+			clear_events(P);
+		}
+		pthread_cond_broadcast(&P->cond);
+		stop = P->stop;
+		pthread_mutex_unlock(&P->mutex);
+
+		if (stop) break;
+		if (!ok || fetch(P, &def) != 0 || wait_for_data(P, &def) != 0) sleep_ms(PREFETCH_RETRY);
+
+		pthread_mutex_lock(&P->mutex);
+		stop = P->stop;
+		pthread_mutex_unlock(&P->mutex);
+	}
+	return NULL;
+}
+
+ft_prefetch_t *ft_prefetch_start(const char *hostname, int port, UINT32_T maxbytes) {
+	ft_prefetch_t *P;
+	ft_connopt_t opt;
+
+	P = (ft_prefetch_t *) calloc(1, sizeof(ft_prefetch_t));
+	if (P == NULL) return NULL;
+
+	ft_connection_defaults(&opt);
+	P->conn = ft_connection_create(&opt);
+	if (P->conn == NULL) {
+		free(P);
+		return NULL;
+	}
+	/* if the server is not there yet, the thread keeps trying */
+	if (port == 0)
+		ft_connection_unix(P->conn, hostname);
+	else
+		ft_connection_tcp(P->conn, hostname, port);
+
+	P->maxbytes = maxbytes;
+	pthread_mutex_init(&P->mutex, NULL);
+	pthread_cond_init(&P->cond, NULL);
+
+	if (pthread_create(&P->thread, NULL, prefetch_thread, P) != 0) {
+		pthread_cond_destroy(&P->cond);
+		pthread_mutex_destroy(&P->mutex);
+		ft_connection_destroy(P->conn);
+		free(P);
+		return NULL;
+	}
+	return P;
+}
+
+void ft_prefetch_stop(ft_prefetch_t *P) {
+	if (P == NULL) return;
+
+	pthread_mutex_lock(&P->mutex);
+	P->stop = 1;
+	pthread_mutex_unlock(&P->mutex);
+	pthread_join(P->thread, NULL);
+
+	clear_events(P);
+	FREE(P->ring);
+	ft_connection_destroy(P->conn);
+	pthread_cond_destroy(&P->cond);
+	pthread_mutex_destroy(&P->mutex);
+	free(P);
+}
+
+static message_t *create_response(UINT32_T bufsize) {
+	message_t *response = (message_t *) malloc(sizeof(message_t));
+	if (response == NULL) return NULL;
+	response->def = (messagedef_t *) malloc(sizeof(messagedef_t));
+	response->buf = malloc(bufsize > 0 ? bufsize : 1);
+	if (response->def == NULL || response->buf == NULL) {
+		FREE(response->def);
+		FREE(response->buf);
+		free(response);
+		return NULL;
+	}
+	response->def->version = VERSION;
+	response->def->command = GET_OK;
+	response->def->bufsize = bufsize;
+	return response;
+}
+
+/* copies a range of samples from the ring, the mutex should be locked */
+static message_t *samples_response(ft_prefetch_t *P, UINT32_T begsample, UINT32_T endsample) {
+	UINT32_T n = endsample - begsample + 1;
+	UINT32_T pos = begsample % P->capacity;
+	UINT32_T part = P->capacity - pos;
+	message_t *response = create_response(sizeof(datadef_t) + n * P->rowsize);
+	datadef_t *ddef;
+	char *data;
+
+	if (response == NULL) return NULL;
+	ddef = (datadef_t *) response->buf;
+	ddef->nchans    = P->nchans;
+	ddef->nsamples  = n;
+	ddef->data_type = P->data_type;
+	ddef->bufsize   = n * P->rowsize;
+	data = (char *) (ddef + 1);
+
+	if (part > n) part = n;
+	memcpy(data, P->ring + pos * P->rowsize, part * P->rowsize);
+	memcpy(data + part * P->rowsize, P->ring, (n - part) * P->rowsize);
+	return response;
+}
+
+static message_t *events_response(ft_prefetch_t *P, UINT32_T begevent, UINT32_T endevent) {
+	UINT32_T i, size = 0;
+	message_t *response;
+	char *buf;
+
+	for (i=begevent; i<=endevent; i++) size += P->eventsize[i % PREFETCH_MAXEVENTS];
+	response = create_response(size);
+	if (response == NULL) return NULL;
+
+	buf = (char *) response->buf;
+	for (i=begevent; i<=endevent; i++) {
+		UINT32_T k = i % PREFETCH_MAXEVENTS;
+		memcpy(buf, P->event[k], P->eventsize[k]);
+		buf += P->eventsize[k];
+	}
+	return response;
+}
+
+static void inflight_deadline(struct timespec *ts) {
+	struct timeval tp;
+
+	gettimeofday(&tp, NULL);
+	ts->tv_sec  = tp.tv_sec;
+	ts->tv_nsec = tp.tv_usec * 1000 + PREFETCH_INFLIGHT * 1000000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+int ft_prefetch_request(ft_prefetch_t *P, const message_t *request, message_t **response_ptr) {
+	message_t *response = NULL;
+	struct timespec deadline;
+	int timedout = 0;
+
+	if (P == NULL || (request->def->command != GET_DAT && request->def->command != GET_EVT)) return -1;
+
+	deadline.tv_sec = 0;
+	pthread_mutex_lock(&P->mutex);
+	if (request->def->command == GET_DAT && request->def->bufsize == sizeof(datasel_t)) {
+		const datasel_t *sel = (const datasel_t *) request->buf;
+
+		while (P->running && sel->begsample <= sel->endsample && sel->begsample >= P->firstsample) {
+			if (sel->endsample < P->firstsample + P->nsamples) {
+				response = samples_response(P, sel->begsample, sel->endsample);
+				break;
+			}
+			/* the samples are in the buffer, and the thread is about to fetch them */
+			if (timedout || P->capacity == 0 || sel->endsample >= P->available) break;
+			if (deadline.tv_sec == 0) inflight_deadline(&deadline);
+			timedout = (pthread_cond_timedwait(&P->cond, &P->mutex, &deadline) == ETIMEDOUT);
+		}
+	}
+	else if (request->def->command == GET_EVT && request->def->bufsize == sizeof(eventsel_t)) {
+		const eventsel_t *sel = (const eventsel_t *) request->buf;
+
+		while (P->running && sel->begevent <= sel->endevent && sel->begevent >= P->firstevent) {
+			if (sel->endevent < P->firstevent + P->nevents) {
+				response = events_response(P, sel->begevent, sel->endevent);
+				break;
+			}
+			if (timedout || sel->endevent >= P->availevents) break;
+			if (deadline.tv_sec == 0) inflight_deadline(&deadline);
+			timedout = (pthread_cond_timedwait(&P->cond, &P->mutex, &deadline) == ETIMEDOUT);
+		}
+	}
+
+	if (response != NULL)
+		P->hits++;
+	else
+		P->misses++;
+	pthread_mutex_unlock(&P->mutex);
+
+	*response_ptr = response;
+	return (response != NULL) ? 0 : -1;
+}
+
+/* empties the ring if the request or its response shows that the buffer
+   was flushed or got a new header, the mutex should be locked */
+static void observe(ft_prefetch_t *P, const message_t *request, const message_t *response) {
+	int samples = 0, events = 0;
+	const samples_events_t *nse = NULL;
+	samples_events_t counts;
+
+	switch (request->def->command) {
+		case PUT_HDR:
+		case FLUSH_HDR:
+			samples = events = 1;
+			break;
+		case FLUSH_DAT:
+			samples = 1;
+			break;
+		case FLUSH_EVT:
+			events = 1;
+			break;
+		case GET_HDR:
+			if (response->def->command == GET_OK && response->def->bufsize >= sizeof(headerdef_t)) {
+				counts.nsamples = ((const headerdef_t *) response->buf)->nsamples;
+				counts.nevents  = ((const headerdef_t *) response->buf)->nevents;
+				nse = &counts;
+			}
+			break;
+		case GET_HDR_GEN:
+			if (response->def->command == GET_OK && response->def->bufsize >= sizeof(headergen_t)) {
+				const headergen_t *hgen = (const headergen_t *) response->buf;
+				if (P->generation != 0 && hgen->generation != P->generation) samples = events = 1;
+				counts.nsamples = hgen->def.nsamples;
+				counts.nevents  = hgen->def.nevents;
+				nse = &counts;
+			}
+			break;
+		case WAIT_DAT:
+			if (response->def->command == WAIT_OK && response->def->bufsize >= sizeof(samples_events_t))
+				nse = (const samples_events_t *) response->buf;
+			break;
+	}
+	if (nse != NULL) {
+		if (nse->nsamples < P->firstsample + P->nsamples) samples = 1;
+		if (nse->nevents < P->firstevent + P->nevents) events = 1;
+	}
+	if (samples) {
+		P->firstsample = 0;
+		P->nsamples = 0;
+		P->available = 0;
+	}
+	if (events) {
+		clear_events(P);
+		P->firstevent = 0;
+		P->availevents = 0;
+	}
+	if (samples || events) P->epoch++;
+}
+
+void ft_prefetch_observe(ft_prefetch_t *P, const message_t *request, const message_t *response) {
+	if (P == NULL || response == NULL || response->def == NULL) return;
+	pthread_mutex_lock(&P->mutex);
+	observe(P, request, response);
+	pthread_mutex_unlock(&P->mutex);
+}
+
+void ft_prefetch_get_status(ft_prefetch_t *P, ft_prefetch_status_t *status) {
+	pthread_mutex_lock(&P->mutex);
+	status->running     = P->running;
+	status->firstsample = P->firstsample;
+	status->nsamples    = P->nsamples;
+	status->firstevent  = P->firstevent;
+	status->nevents     = P->nevents;
+	status->hits        = P->hits;
+	status->misses      = P->misses;
+	pthread_mutex_unlock(&P->mutex);
+}
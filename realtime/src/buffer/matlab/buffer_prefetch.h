@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+#ifndef __buffer_prefetch_h
+#define __buffer_prefetch_h
+
+#include "buffer.h"
+
+/* A prefetch thread keeps its own connection to the buffer, waits for new
+   samples and events, and copies them into a local ring. GET_DAT and GET_EVT
+   requests for the samples and events in the ring can then be answered without
+   a round trip to the server. The ring is emptied when the thread notices
+   that the header of the buffer has changed, or when the client sees that
+   in one of its own responses, see ft_prefetch_observe. A PUT_HDR of another
+   client can therefore go unnoticed for at most one polling interval.
+*/
+typedef struct ft_prefetch ft_prefetch_t;
+
+typedef struct {
+	int running;           /* 1 while the thread is connected to the buffer */
+	UINT32_T firstsample;  /* number of the first sample in the ring */
+	UINT32_T nsamples;     /* number of samples in the ring */
+	UINT32_T firstevent;
+	UINT32_T nevents;
+	UINT32_T hits;         /* number of requests that were answered from the ring */
+	UINT32_T misses;       /* number of GET_DAT and GET_EVT requests that went to the server */
+} ft_prefetch_status_t;
+
+/* starts the thread, the ring holds at most maxbytes of samples. Port 0 means
+   that hostname is the name of a UNIX domain socket. Returns NULL on failure. */
+ft_prefetch_t *ft_prefetch_start(const char *hostname, int port, UINT32_T maxbytes);
+
+/* stops the thread and releases the ring */
+void ft_prefetch_stop(ft_prefetch_t *P);
+
+/* answers the request from the ring if possible, in that case 0 is returned
+   and the response should be released like any response of clientrequest.
+   Returns -1 if the request has to be sent to the server. */
+int ft_prefetch_request(ft_prefetch_t *P, const message_t *request, message_t **response_ptr);
+
+/* should be called with the responses of the server to the other requests
+   on the connection, so that the ring is emptied as soon as the client sees
+   that the header has changed or the buffer was flushed */
+void ft_prefetch_observe(ft_prefetch_t *P, const message_t *request, const message_t *response);
+
+void ft_prefetch_get_status(ft_prefetch_t *P, ft_prefetch_status_t *status);
+
+/* like clientrequest, but tries the prefetch thread of the connection first, see buffer.c.
+   All helper functions send their requests through this. */
+int buffer_clientrequest(int server, const message_t *request, message_t **response_ptr);
+
+/* like clientrequest_multi, the requests go one by one through buffer_clientrequest if there is a prefetch thread */
+int buffer_clientrequest_multi(int server, int nreq, const message_t **request, message_t **response);
+
+#endif
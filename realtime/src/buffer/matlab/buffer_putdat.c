@@ -9,6 +9,7 @@
 #include "mex.h"
 #include "matrix.h"
 #include "buffer.h"
+#include "buffer_prefetch.h"
 
 int buffer_putdat(int server, mxArray * plhs[], const mxArray * prhs[])
 {
@@ -108,7 +109,7 @@ int buffer_putdat(int server, mxArray * plhs[], const mxArray * prhs[])
 	request_def.bufsize = append(&request.buf, request_def.bufsize, data.buf, data_def.bufsize);
   
   /* write the request, read the response */
-	result = clientrequest(server, &request, &response);
+	result = buffer_clientrequest(server, &request, &response);
   
   /* the request structure is not needed any more, we free ->buf, the rest is local */
 	if (request.buf) {
@@ -9,6 +9,7 @@
 #include "mex.h"
 #include "matrix.h"
 #include "buffer.h"
+#include "buffer_prefetch.h"
 #include "buffer_mxutils.h"
 
 static int fieldnum_type, fieldnum_value, fieldnum_sample, fieldnum_offset, fieldnum_duration;
@@ -156,7 +157,7 @@ int buffer_putevt(int server, mxArray * plhs[], const mxArray * prhs[])
 	}
   
   /* write the request, read the response */
-	result = clientrequest(server, &request, &response);
+	result = buffer_clientrequest(server, &request, &response);
   
   /* the request structure is not needed any more, everything apart from request.buf is local */
 	mxFree(request.buf);
@@ -9,6 +9,7 @@
 #include "mex.h"
 #include "matrix.h"
 #include "buffer.h"
+#include "buffer_prefetch.h"
 
 #define SIZE_NIFTI_1   348
 
@@ -251,7 +252,7 @@ int buffer_puthdr(int server, mxArray * plhs[], const mxArray * prhs[])
   ((headerdef_t *) request.buf)->bufsize = request_def.bufsize - sizeof(headerdef_t);
 
   /* write the request, read the response */
-  result = clientrequest(server, &request, &response);
+  result = buffer_clientrequest(server, &request, &response);
 
   /* the request structure is not needed any more, but only .buf needs to be free'd */
   if (request.buf != NULL) mxFree(request.buf);
@@ -8,6 +8,7 @@
 #include "mex.h"
 #include "matrix.h"
 #include "buffer.h"
+#include "buffer_prefetch.h"
 
 int buffer_waitdat(int server, mxArray * plhs[], const mxArray * prhs[])
 {
@@ -39,7 +40,7 @@ int buffer_waitdat(int server, mxArray * plhs[], const mxArray * prhs[])
 	waitdef.milliseconds = (pr[2]<0) ? 0 : (UINT32_T) pr[2];
 	
 	/* write the request, read the response */
-	result = clientrequest(server, &request, &response);
+	result = buffer_clientrequest(server, &request, &response);
   	
 	if (result == 0) {
 		/* check that the response is WAIT_OK */
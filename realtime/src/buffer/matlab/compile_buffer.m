@@ -109,6 +109,10 @@ if ispc
 else
   % On POSIX systems such as MacOS X and Linux, the following should work without tweaking
   ldflags = '-lpthread';
+  if ~ismac
+    % shm_open is in librt for glibc versions before 2.34
+    ldflags = [ldflags ' -lrt'];
+  end
   extra_cflags = '';
   suffix = 'o';
 end
@@ -126,6 +130,19 @@ libfuncs = {
   'endianutil'
   'cleanup'
   'clock_gettime'
+  'shmbuffer'
+  'eventindex'
+  'bufstats'
+  'asyncrequest'
+  'compress'
+  'spillfile'
+  'ringfile'
+  'placement'
+  'convert'
+  'qos'
+  'msgpool'
+  'ftclock'
+  'fttrace'
   };
 
 % If you want to add a new helper function to the MEX file, you should just add
@@ -133,6 +150,7 @@ libfuncs = {
 helpers = {'buffer_gethdr'
   'buffer_getdat'
   'buffer_getevt'
+  'buffer_getlatest'
   'buffer_puthdr'
   'buffer_putdat'
   'buffer_putevt'
@@ -141,6 +159,7 @@ helpers = {'buffer_gethdr'
   'buffer_flushevt'
   'buffer_waitdat'
   'buffer_mxutils'
+  'buffer_prefetch'
   };
 
 
@@ -20,7 +20,7 @@ LIBFLAGS = /MACHINE:X86
 
 all: libbuffer.lib
 
-libbuffer.lib: tcpserver.obj tcpsocket.obj tcprequest.obj clientrequest.obj dmarequest.obj cleanup.obj util.obj printstruct.obj swapbytes.obj extern.obj endianutil.obj  socketserver.obj
+libbuffer.lib: tcpserver.obj tcpsocket.obj tcprequest.obj clientrequest.obj dmarequest.obj cleanup.obj util.obj printstruct.obj swapbytes.obj extern.obj endianutil.obj  socketserver.obj shmbuffer.obj eventindex.obj bufstats.obj asyncrequest.obj compress.obj spillfile.obj ringfile.obj placement.obj convert.obj qos.obj msgpool.obj ftclock.obj fttrace.obj
 	lib $(LIBFLAGS) /OUT:libbuffer.lib $**
 	
 %.obj: %.c buffer.h message.h swapbytes.h socket_includes.h unix_includes.h
@@ -0,0 +1,313 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ * Asynchronous client requests with pipelining, see asyncrequest.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "buffer.h"
+#include "asyncrequest.h"
+
+#ifdef MSG_NOSIGNAL
+  #define SEND_FLAGS MSG_NOSIGNAL  /* report a closed connection as an error instead of raising SIGPIPE */
+#else
+  #define SEND_FLAGS 0
+#endif
+
+struct ft_async_req {
+	ft_async_req_t *next;
+	char *data;               /* copy of the request def and buf, NULL once it has been sent */
+	unsigned int size;
+	unsigned int sent;
+	ft_async_callback_t callback;
+	void *user_data;
+};
+
+/* returns 1 if the last socket operation would have blocked */
+static int would_block(void) {
+#ifdef WIN32
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+	return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+/* Takes over a socket that was opened with open_connection or
+   open_unix_connection, and puts it in non-blocking mode. Returns NULL on
+   error, in which case the socket is left alone.
+ */
+ft_async_conn_t *ft_async_open(int sock) {
+	ft_async_conn_t *A;
+#ifdef WIN32
+	unsigned long enable = 1;
+#else
+	int optval;
+#endif
+
+	if (sock <= 0) {
+		fprintf(stderr, "ft_async_open: invalid socket (%d)\n", sock);
+		return NULL;
+	}
+
+#ifdef WIN32
+	if (ioctlsocket(sock, FIONBIO, &enable) != 0) {
+		fprintf(stderr, "ft_async_open: cannot make the socket non-blocking\n");
+		return NULL;
+	}
+#else
+	optval = fcntl(sock, F_GETFL, NULL);
+	if (fcntl(sock, F_SETFL, optval | O_NONBLOCK) < 0) {
+		perror("ft_async_open, fcntl");
+		return NULL;
+	}
+#endif
+
+	A = (ft_async_conn_t *) malloc(sizeof(ft_async_conn_t));
+	if (A == NULL) return NULL;
+	A->sock = sock;
+	A->failed = 0;
+	A->head = A->tail = A->unsent = NULL;
+	A->npending = 0;
+	A->respbuf = NULL;
+	A->bytesDone = 0;
+	return A;
+}
+
+/* calls the callbacks of all outstanding requests with an error */
+static void fail_all(ft_async_conn_t *A) {
+	ft_async_req_t *R;
+
+	/* callbacks that submit new requests will see that the connection has failed */
+	A->failed = 1;
+	while ((R = A->head) != NULL) {
+		A->head = R->next;
+		A->npending--;
+		if (R->callback) R->callback(-1, NULL, R->user_data);
+		free(R->data);
+		free(R);
+	}
+	A->tail = A->unsent = NULL;
+	if (A->respbuf) free(A->respbuf);
+	A->respbuf = NULL;
+	A->bytesDone = 0;
+}
+
+/* fails the outstanding requests, closes the socket and releases the connection */
+void ft_async_close(ft_async_conn_t *A) {
+	if (A == NULL) return;
+	fail_all(A);
+	closesocket(A->sock);
+	free(A);
+}
+
+/* Queues a copy of the request, so the request can be freed or reused right
+   away. Returns 0 on success, in which case the callback will be called
+   exactly once, or -1 if the connection has already failed.
+ */
+int ft_async_submit(ft_async_conn_t *A, const message_t *request, ft_async_callback_t callback, void *user_data) {
+	ft_async_req_t *R;
+
+	if (A->failed) return -1;
+
+	R = (ft_async_req_t *) malloc(sizeof(ft_async_req_t));
+	if (R == NULL) return -1;
+	R->size = sizeof(messagedef_t) + request->def->bufsize;
+	R->data = (char *) malloc(R->size);
+	if (R->data == NULL) {
+		free(R);
+		return -1;
+	}
+	memcpy(R->data, request->def, sizeof(messagedef_t));
+	if (request->def->bufsize > 0)
+		memcpy(R->data + sizeof(messagedef_t), request->buf, request->def->bufsize);
+	R->sent = 0;
+	R->callback = callback;
+	R->user_data = user_data;
+	R->next = NULL;
+
+	if (A->tail) A->tail->next = R;
+	else A->head = R;
+	A->tail = R;
+	if (A->unsent == NULL) A->unsent = R;
+	A->npending++;
+	return 0;
+}
+
+/* sends as much of the queued requests as the socket accepts, returns -1 on error */
+static int send_pending(ft_async_conn_t *A) {
+	ft_async_req_t *R;
+	int n;
+
+	while ((R = A->unsent) != NULL) {
+		n = send(A->sock, R->data + R->sent, R->size - R->sent, SEND_FLAGS);
+		if (n < 0 && would_block()) return 0;
+		if (n <= 0) {
+			fprintf(stderr, "ft_async_process: cannot write to socket\n");
+			return -1;
+		}
+		R->sent += n;
+		if (R->sent < R->size) continue;
+		free(R->data);
+		R->data = NULL;
+		A->unsent = R->next;
+	}
+	return 0;
+}
+
+/* reads what is available of the responses, returns the number of completed requests or -1 on error */
+static int read_responses(ft_async_conn_t *A) {
+	ft_async_req_t *R;
+	message_t *response;
+	char *ptr;
+	unsigned int total;
+	int n, ncompleted = 0;
+
+	/* the server only answers requests that it has read completely */
+	while (A->head != NULL && A->head != A->unsent) {
+		if (A->bytesDone < sizeof(messagedef_t)) {
+			ptr = (char *) &A->respdef + A->bytesDone;
+			total = sizeof(messagedef_t);
+		} else {
+			ptr = (char *) A->respbuf + (A->bytesDone - sizeof(messagedef_t));
+			total = sizeof(messagedef_t) + A->respdef.bufsize;
+		}
+
+		if (A->bytesDone < total) {
+			n = recv(A->sock, ptr, total - A->bytesDone, 0);
+			if (n < 0 && would_block()) break;
+			if (n <= 0) {
+				fprintf(stderr, "ft_async_process: cannot read from socket\n");
+				return -1;
+			}
+			A->bytesDone += n;
+			if (A->bytesDone < total) continue;
+		}
+
+		if (total == sizeof(messagedef_t)) {
+			/* the def is complete, now we know how much follows */
+			if (A->respdef.version != VERSION) {
+				fprintf(stderr, "ft_async_process: incorrect version\n");
+				return -1;
+			}
+			if (A->respdef.bufsize > 0) {
+				A->respbuf = malloc(A->respdef.bufsize);
+				if (A->respbuf == NULL) {
+					fprintf(stderr, "ft_async_process: out of memory\n");
+					return -1;
+				}
+				continue;
+			}
+		}
+
+		/* the response is complete, hand it over to the callback of the oldest request */
+		response = (message_t *) malloc(sizeof(message_t));
+		if (response != NULL) response->def = (messagedef_t *) malloc(sizeof(messagedef_t));
+		if (response == NULL || response->def == NULL) {
+			fprintf(stderr, "ft_async_process: out of memory\n");
+			FREE(response);
+			return -1;
+		}
+		memcpy(response->def, &A->respdef, sizeof(messagedef_t));
+		response->buf = A->respbuf;
+		A->respbuf = NULL;
+		A->bytesDone = 0;
+
+		R = A->head;
+		A->head = R->next;
+		if (A->head == NULL) A->tail = NULL;
+		A->npending--;
+		ncompleted++;
+
+		if (R->callback)
+			R->callback(0, response, R->user_data);
+		else
+			cleanup_message((void **) &response);
+		free(R);
+	}
+	return ncompleted;
+}
+
+/* Sends and receives without blocking, and calls the callbacks of the
+   requests whose response has arrived. Returns the number of completed
+   requests, or -1 if the connection failed, in which case the callbacks of
+   the outstanding requests have been called with an error. Callbacks can
+   submit new requests, but should not close the connection.
+ */
+int ft_async_process(ft_async_conn_t *A) {
+	int ncompleted;
+
+	if (A->failed) return -1;
+	if (send_pending(A) < 0) {
+		fail_all(A);
+		return -1;
+	}
+	ncompleted = read_responses(A);
+	if (ncompleted < 0) {
+		fail_all(A);
+		return -1;
+	}
+	/* the callbacks may have submitted new requests */
+	if (A->unsent && send_pending(A) < 0) {
+		fail_all(A);
+		return -1;
+	}
+	return ncompleted;
+}
+
+int ft_async_fd(const ft_async_conn_t *A) {
+	return A->sock;
+}
+
+/* returns 1 if there is data to be sent, in which case the socket should also be watched for writing */
+int ft_async_wants_write(const ft_async_conn_t *A) {
+	return !A->failed && A->unsent != NULL;
+}
+
+unsigned int ft_async_pending(const ft_async_conn_t *A) {
+	return A->npending;
+}
+
+/* Waits at most the given time until one of the connections can make
+   progress, and then processes them. Returns the number of completed
+   requests (0 on timeout, or if there are no outstanding requests), or -1
+   if select failed. Connections that fail are reported through the
+   callbacks of their requests.
+ */
+int ft_async_poll(ft_async_conn_t **conns, int nconns, int milliseconds) {
+	fd_set readSet, writeSet;
+	struct timeval tv;
+	int i, n, sel, maxfd = -1, ncompleted = 0;
+
+	FD_ZERO(&readSet);
+	FD_ZERO(&writeSet);
+	for (i=0; i<nconns; i++) {
+		if (conns[i] == NULL || conns[i]->failed || conns[i]->npending == 0) continue;
+		FD_SET(conns[i]->sock, &readSet);
+		if (ft_async_wants_write(conns[i])) FD_SET(conns[i]->sock, &writeSet);
+		if (conns[i]->sock > maxfd) maxfd = conns[i]->sock;
+	}
+	if (maxfd < 0) return 0;
+
+	tv.tv_sec  = milliseconds / 1000;
+	tv.tv_usec = 1000 * (milliseconds % 1000);
+	sel = select(maxfd+1, &readSet, &writeSet, NULL, &tv);
+	if (sel < 0) {
+		if (would_block()) return 0;
+		perror("ft_async_poll, select");
+		return -1;
+	}
+
+	for (i=0; i<nconns && sel>0; i++) {
+		if (conns[i] == NULL || conns[i]->failed || conns[i]->npending == 0) continue;
+		if (!FD_ISSET(conns[i]->sock, &readSet) && !FD_ISSET(conns[i]->sock, &writeSet)) continue;
+		n = ft_async_process(conns[i]);
+		if (n > 0) ncompleted += n;
+	}
+	return ncompleted;
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+
+#ifndef ASYNCREQUEST_H
+#define ASYNCREQUEST_H
+
+#include "message.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Asynchronous client requests. A connection that has been opened with
+  open_connection or open_unix_connection is put in non-blocking mode, after
+  which any number of requests can be submitted without waiting for the
+  responses. The server handles the requests of a connection one by one, so
+  the responses arrive in the order in which the requests were submitted,
+  and each response is passed to the callback of its request.
+
+  Nothing happens in the background: the requests are sent and the responses
+  are read in ft_async_process, which never blocks. The socket can be watched
+  with poll or select (see ft_async_fd and ft_async_wants_write) to combine
+  several connections, or other file descriptors, in one thread.
+  ft_async_poll does that for a number of connections.
+*/
+
+/* Called with status 0 and the response once it has been read completely,
+   the callback becomes the owner of the response and should release it with
+   cleanup_message. If the connection fails, the callbacks of the outstanding
+   requests are called with status -1 and a NULL response. The same happens
+   for the requests that are still outstanding in ft_async_close.
+ */
+typedef void (*ft_async_callback_t)(int status, message_t *response, void *user_data);
+
+typedef struct ft_async_req ft_async_req_t;
+
+typedef struct {
+	int sock;
+	int failed;               /* set once the connection has failed, all further requests fail as well */
+	ft_async_req_t *head;     /* oldest request that is waiting for its response */
+	ft_async_req_t *tail;     /* most recently submitted request */
+	ft_async_req_t *unsent;   /* oldest request that has not been sent completely */
+	unsigned int npending;    /* number of requests that are waiting for their response */
+	messagedef_t respdef;     /* the response that is being read */
+	void *respbuf;
+	unsigned int bytesDone;   /* of the response def, followed by the response buf */
+} ft_async_conn_t;
+
+ft_async_conn_t *ft_async_open(int sock);
+void ft_async_close(ft_async_conn_t *A);
+int ft_async_submit(ft_async_conn_t *A, const message_t *request, ft_async_callback_t callback, void *user_data);
+int ft_async_process(ft_async_conn_t *A);
+int ft_async_fd(const ft_async_conn_t *A);
+int ft_async_wants_write(const ft_async_conn_t *A);
+unsigned int ft_async_pending(const ft_async_conn_t *A);
+int ft_async_poll(ft_async_conn_t **conns, int nconns, int milliseconds);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ASYNCREQUEST_H */
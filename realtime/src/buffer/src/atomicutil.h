@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+
+#ifndef ATOMICUTIL_H
+#define ATOMICUTIL_H
+
+#include "platform_includes.h"
+
+/* A full memory barrier, this is used for publishing shared state (e.g. the
+ * sequence counter of the sample ring in dmarequest.c) to threads that read
+ * it without taking a mutex.
+ */
+#if defined(COMPILER_MSVC)
+  #define MEMORY_BARRIER() MemoryBarrier()
+#elif defined(COMPILER_BORLAND) || defined(COMPILER_LCC)
+  /* these compilers only target x86, where a locked exchange acts as a full barrier */
+  #define MEMORY_BARRIER() { LONG barrier_; InterlockedExchange(&barrier_, 0); }
+#else
+  #define MEMORY_BARRIER() __sync_synchronize()
+#endif
+
+/* Atomic increments of 32 and 64 bit counters, and a compare-and-swap that
+ * returns non-zero on success. These are used for the statistics in
+ * bufstats.c, which are updated from all threads without taking a mutex.
+ */
+#if defined(COMPILER_MSVC)
+  #define ATOMIC_ADD32(p, n)       InterlockedExchangeAdd((volatile LONG *) (p), (LONG) (n))
+  #define ATOMIC_ADD64(p, n)       InterlockedExchangeAdd64((volatile LONGLONG *) (p), (LONGLONG) (n))
+  #define ATOMIC_CAS32(p, o, n)    (InterlockedCompareExchange((volatile LONG *) (p), (LONG) (n), (LONG) (o)) == (LONG) (o))
+#elif defined(COMPILER_BORLAND) || defined(COMPILER_LCC)
+  /* there is no 64 bit interlocked add on these compilers, an occasional increment may get lost */
+  #define ATOMIC_ADD32(p, n)       InterlockedExchangeAdd((LONG *) (p), (LONG) (n))
+  #define ATOMIC_ADD64(p, n)       (*(p) += (n))
+  #define ATOMIC_CAS32(p, o, n)    (InterlockedCompareExchange((LONG *) (p), (LONG) (n), (LONG) (o)) == (LONG) (o))
+#else
+  #define ATOMIC_ADD32(p, n)       __sync_fetch_and_add((p), (n))
+  #define ATOMIC_ADD64(p, n)       __sync_fetch_and_add((p), (n))
+  #define ATOMIC_CAS32(p, o, n)    __sync_bool_compare_and_swap((p), (o), (n))
+#endif
+
+#endif /* ATOMICUTIL_H */
@@ -16,10 +16,16 @@
 #include "message.h"
 
 #include "cleanup.h"
+#include "compress.h"
+#include "convert.h"
 #include "endianutil.h"
+#include "ftclock.h"
+#include "fttrace.h"
 #include "interface.h"
 #include "message.h"
+#include "msgpool.h"
 #include "printstruct.h"
+#include "qos.h"
 #include "swapbytes.h"
 #include "util.h"
 
@@ -44,18 +50,28 @@
 #define DEFAULT_PORT      1972
 #define HOSTNAME_LENGTH   256
 
+/* fixed socket buffer sizes, these are not used by the servers any more, see ft_socket_fit in util.c */
 #define SO_RCVBUF_SIZE 16384
 #define SO_SNDBUF_SIZE 16384
 
+/* socket buffers are only enlarged for messages above FT_SOCKBUF_FIT bytes, and not beyond FT_SOCKBUF_MAX unless configured otherwise */
+#define FT_SOCKBUF_FIT    (64*1024)
+#define FT_SOCKBUF_MAX    (4*1024*1024)
+
 /* this is because the function has been renamed, but is perhaps already in use in other software */
 #define open_remotehost open_connection
 
-/* FIXME these should be variable */
+/* default sizes of the ring, these can be changed with set_buffer_capacity */
 #define MAXNUMBYTE      (512*1024*1024)
 #define MAXNUMSAMPLE    600000
 #define MAXNUMEVENT     100
 
-#define WRAP(x,y) ((x) - ((int)((float)(x)/(y)))*(y))
+/* placement of the sample ring, see set_buffer_memory */
+#define FT_MEM_HUGEPAGES  1  /* ask for transparent huge pages */
+#define FT_MEM_HUGETLB    2  /* use explicit huge pages if they have been reserved */
+
+/* position of element x in a ring of y elements, both should be unsigned */
+#define WRAP(x,y) ((x) % (y))
 #define FREE(x) {if (x) {free(x); x=NULL;}}
 #define DIE_BAD_MALLOC(ptr) if ((ptr)==NULL) { fprintf(stderr, "Out of memory in line %d", __LINE__); exit(1); }
 
@@ -64,6 +80,45 @@ typedef struct {
 	int  port;
 } host_t;
 
+/* statistics of the latency between new data or events exceeding the threshold of a WAIT_DAT request and the waiting client being woken up */
+typedef struct {
+	UINT64_T count;     /* number of WAIT_DAT requests that were woken up */
+	double   total;     /* sum of the wakeup latencies in seconds */
+	double   maximum;   /* largest wakeup latency in seconds */
+} waitstats_t;
+
+/* a client that wants to be notified about new data or events, see register_wait in dmarequest.c */
+typedef struct waiter_s waiter_t;
+
+/* writes n samples, starting at sample first of the block, to dest in the
+   layout of the ring, see ft_put_data_direct in dmarequest.c */
+typedef void (*ft_fill_data_t)(void *dest, UINT32_T first, UINT32_T n, void *arg);
+
+/* options of a persistent client connection, see ft_connection_defaults in clientrequest.c */
+typedef struct {
+	int nodelay;        /* disable Nagle's algorithm on TCP connections */
+	int keepalive;      /* let the operating system send keep-alive probes on idle connections */
+	int keepidle;       /* idle time in seconds before the first keep-alive probe, 0 for the system default */
+	int sendtimeout;    /* timeout for sending a request in milliseconds, 0 to block */
+	int recvtimeout;    /* timeout for receiving a response in milliseconds, 0 to block */
+	int retry;          /* number of additional attempts when (re)connecting */
+	int retrydelay;     /* time between these attempts in milliseconds */
+	int reconnect;      /* re-establish a broken connection and replay idempotent requests */
+	int compress;       /* compress the samples on TCP connections if the server supports it, see compress.h */
+} ft_connopt_t;
+
+/* a persistent client connection, see ft_connection_request in clientrequest.c */
+typedef struct {
+	int sock;           /* 0 for direct memory access, -1 if not connected */
+	int type;           /* 0 for direct memory access, 1 for TCP, 2 for a UNIX domain socket, -1 if never connected */
+	char name[HOSTNAME_LENGTH]; /* hostname or name of the UNIX domain socket */
+	int port;
+	ft_connopt_t opt;
+	UINT32_T reconnects; /* number of times that the connection was re-established */
+	UINT32_T replays;    /* number of requests that were sent again after a broken connection */
+	UINT32_T codecs;     /* codecs that were negotiated with the server, 0 if the samples are sent as they are */
+} ft_connection_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -71,9 +126,55 @@ extern "C" {
 	/* definition of the functions that implement the network transparent server */
 	void *tcpserver(void *);
 	void *tcpsocket(void *);
+	/* stops the tcpserver thread and the threads of its clients without cancelling them, see tcpserver.c */
+	int tcpserver_stop(void);
+	int tcpserver_wait(int fd, double timeout);
 	int clientrequest(int, const message_t *, message_t**);
+	int streamrequest(int server, const char *stream, const message_t *request, message_t **response_ptr);
 	int dmarequest(const message_t *, message_t**);
+	/* same as dmarequest, but with swapdata set the samples of a PUT_DAT request are still in the opposite byte order */
+	int dmarequest_swap(const message_t *, message_t**, int swapdata);
+	/* same as dmarequest_swap, but the response is taken from the pool of the connection, see msgpool.h */
+	int dmarequest_pool(const message_t *, message_t**, int swapdata, ft_msgpool_t *pool);
+	/* writes nsamples into the ring of the local buffer without a request, see ft_fill_data_t */
+	int ft_put_data_direct(UINT32_T nchans, UINT32_T nsamples, UINT32_T data_type, ft_fill_data_t fill, void *arg);
 	int tcprequest(int, const message_t *, message_t**);
+	/* these send nreq requests in one go and then read the responses, see tcprequest.c */
+	int tcprequest_multi(int server, int nreq, const message_t **request, message_t **response);
+	int clientrequest_multi(int server, int nreq, const message_t **request, message_t **response);
+
+	/* persistent client connections, see clientrequest.c */
+	void ft_connection_defaults(ft_connopt_t *opt);
+	ft_connection_t *ft_connection_create(const ft_connopt_t *opt);
+	void ft_connection_destroy(ft_connection_t *C);
+	int ft_connection_tcp(ft_connection_t *C, const char *hostname, int port);
+	int ft_connection_unix(ft_connection_t *C, const char *name);
+	int ft_connection_direct(ft_connection_t *C);
+	int ft_connection_reconnect(ft_connection_t *C);
+	int ft_connection_configure(ft_connection_t *C);
+	int ft_connection_negotiate(ft_connection_t *C);
+	void ft_connection_close(ft_connection_t *C);
+	int ft_connection_request(ft_connection_t *C, const message_t *request, message_t **response_ptr);
+	int ft_connection_ping(ft_connection_t *C);
+	UINT32_T get_overwrite_count(void);
+	int enable_shared_memory(const char *name);
+	void disable_shared_memory(void);
+	int enable_spill_file(const char *filename);
+	void disable_spill_file(void);
+	int enable_ring_file(const char *filename);
+	void disable_ring_file(void);
+	void get_wait_statistics(waitstats_t *stats);
+	void set_buffer_capacity(UINT32_T nsamples, UINT64_T nbytes, UINT32_T nevents);
+	void set_buffer_memory(int flags, int numa_node);
+	int set_cpu_affinity(const char *cpulist);
+	int grow_buffer(UINT32_T nsamples, UINT32_T nevents);
+	int set_buffer_origin(UINT32_T nsamples, UINT32_T nevents);
+	waiter_t *register_wait(UINT32_T nsamples, UINT32_T nevents, void (*notify)(void *), void *arg);
+	waiter_t *register_stream_wait(const char *name, UINT32_T nsamples, UINT32_T nevents, void (*notify)(void *), void *arg);
+	waiter_t *register_stream_wait_event(const char *name, UINT32_T nsamples, UINT32_T nevents, const waitevt_t *waitevt, UINT32_T filtersize, const void *filter, void (*notify)(void *), void *arg);
+	void unregister_wait(waiter_t *waiter);
+	/* ends the WAIT_DAT requests that are blocking, so that their threads can stop, see tcpserver_stop */
+	void wake_waiters(void);
 
 #ifdef __cplusplus
 }
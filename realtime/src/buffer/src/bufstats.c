@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ * Counters and latency histograms of the buffer server, which are returned
+ * by GET_STATS. See bufstats.h and message.h for the details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "buffer.h"
+#include "platform_includes.h"
+#include "atomicutil.h"
+#include "bufstats.h"
+
+/* the commands that are counted separately, all others end up in the last slot */
+static const UINT16_T commands[] = {
+	PUT_HDR, PUT_DAT, PUT_EVT, PUT_BATCH, PUT_DAT_T,
+	GET_HDR, GET_DAT, GET_EVT, GET_SHM, GET_CAP, GET_STATS, GET_TIME, GET_HDR_GEN, GET_DAT_M,
+	FLUSH_HDR, FLUSH_DAT, FLUSH_EVT,
+	WAIT_DAT, STREAM_REQ,
+	0
+};
+
+#define NCOMMANDS (sizeof(commands)/sizeof(commands[0]))
+
+typedef struct {
+	volatile UINT64_T count;
+	volatile UINT64_T errors;
+	volatile UINT64_T bytes_in;
+	volatile UINT64_T bytes_out;
+	volatile UINT64_T latency[FT_STATS_NBINS];
+} cmdslot_t;
+
+static cmdslot_t cmdslot[NCOMMANDS];
+static volatile UINT64_T lockwait[FT_STATS_NBINS];
+static volatile UINT64_T roundtrip[FT_STATS_NBINS];
+
+static volatile UINT32_T connections = 0;
+static volatile UINT32_T accepted    = 0;
+static volatile UINT32_T active      = 0;
+static volatile UINT32_T maxactive   = 0;
+static volatile UINT32_T waiting     = 0;
+static volatile UINT32_T queued      = 0;
+static volatile UINT32_T maxqueued   = 0;
+static volatile UINT32_T inlined     = 0;
+static volatile UINT32_T busy        = 0;
+
+/* bin 0 is for durations below 1 us, bin k for [2^(k-1), 2^k) us */
+static int bin_of(UINT64_T duration) {
+	int b = 0;
+	while (duration && b < FT_STATS_NBINS-1) {
+		duration >>= 1;
+		b++;
+	}
+	return b;
+}
+
+static int slot_of(UINT16_T command) {
+	UINT32_T i;
+	for (i=0; i<NCOMMANDS-1; i++) {
+		if (commands[i] == command) break;
+	}
+	return i;
+}
+
+/* returns the monotonic time in microseconds, see ftclock.h */
+UINT64_T ft_stats_clock(void) {
+	return ft_clock_ns() / 1000;
+}
+
+/* returns the number of microseconds since start */
+UINT64_T ft_stats_elapsed(UINT64_T start) {
+	UINT64_T now = ft_stats_clock();
+	return now > start ? now - start : 0;
+}
+
+void ft_stats_request_begin(void) {
+	UINT32_T n = ATOMIC_ADD32(&active, 1) + 1;
+	UINT32_T m;
+	while ((m = maxactive) < n && !ATOMIC_CAS32(&maxactive, m, n));
+}
+
+void ft_stats_request_end(void) {
+	ATOMIC_ADD32(&active, -1);
+}
+
+/* the result is the command of the response, the sizes exclude the messagedef_t */
+void ft_stats_command(UINT16_T command, UINT16_T result, UINT32_T bytes_in, UINT32_T bytes_out, UINT64_T duration) {
+	cmdslot_t *S = &cmdslot[slot_of(command)];
+
+	ATOMIC_ADD64(&S->count, 1);
+	if ((result & 0x00FF) == 0x0005) ATOMIC_ADD64(&S->errors, 1);
+	ATOMIC_ADD64(&S->bytes_in,  bytes_in  + sizeof(messagedef_t));
+	ATOMIC_ADD64(&S->bytes_out, bytes_out + sizeof(messagedef_t));
+	ATOMIC_ADD64(&S->latency[bin_of(duration)], 1);
+}
+
+void ft_stats_lockwait(UINT64_T duration) {
+	ATOMIC_ADD64(&lockwait[bin_of(duration)], 1);
+}
+
+void ft_stats_roundtrip(UINT64_T duration) {
+	ATOMIC_ADD64(&roundtrip[bin_of(duration)], 1);
+}
+
+void ft_stats_connect(void) {
+	ATOMIC_ADD32(&connections, 1);
+	ATOMIC_ADD32(&accepted, 1);
+}
+
+void ft_stats_disconnect(void) {
+	ATOMIC_ADD32(&connections, -1);
+}
+
+void ft_stats_wait_begin(void) {
+	ATOMIC_ADD32(&waiting, 1);
+}
+
+void ft_stats_wait_end(void) {
+	ATOMIC_ADD32(&waiting, -1);
+}
+
+/* a request has been queued for the workers of an event loop server */
+void ft_stats_queue_begin(void) {
+	UINT32_T n = ATOMIC_ADD32(&queued, 1) + 1;
+	UINT32_T m;
+	while ((m = maxqueued) < n && !ATOMIC_CAS32(&maxqueued, m, n));
+}
+
+/* a worker has taken the request from the queue */
+void ft_stats_queue_end(void) {
+	ATOMIC_ADD32(&queued, -1);
+	ATOMIC_ADD32(&busy, 1);
+}
+
+/* the worker is done with the request */
+void ft_stats_queue_done(void) {
+	ATOMIC_ADD32(&busy, -1);
+}
+
+/* the queue was full, so the request is handled by the event loop itself */
+void ft_stats_queue_full(void) {
+	ATOMIC_ADD32(&inlined, 1);
+}
+
+/* Returns a newly allocated copy of the statistics in the layout of the
+ * GET_STATS response, or NULL if out of memory. The counters are read one
+ * by one while other threads keep on updating them, so they are not an
+ * exact snapshot. The fields of statsdef_t that are not maintained here
+ * (overwrites, lostsamples, lostevents) are set to zero.
+ */
+void *ft_stats_serialize(UINT32_T *size) {
+	statsdef_t *sdef;
+	UINT64_T *hist;
+	cmdstats_t *cdef;
+	char *buf, *ptr;
+	UINT32_T i, j;
+
+	*size = sizeof(statsdef_t) + 2*FT_STATS_NBINS*sizeof(UINT64_T) + NCOMMANDS*(sizeof(cmdstats_t) + FT_STATS_NBINS*sizeof(UINT64_T));
+	buf = (char *) malloc(*size);
+	if (buf == NULL) return NULL;
+
+	sdef = (statsdef_t *) buf;
+	memset(sdef, 0, sizeof(statsdef_t));
+	sdef->nbins       = FT_STATS_NBINS;
+	sdef->ncommands   = NCOMMANDS;
+	sdef->connections = connections;
+	sdef->accepted    = accepted;
+	sdef->active      = active;
+	sdef->maxactive   = maxactive;
+	sdef->waiting     = waiting;
+	sdef->queued      = queued;
+	sdef->maxqueued   = maxqueued;
+	sdef->inlined     = inlined;
+	sdef->busy        = busy;
+
+	hist = (UINT64_T *) (buf + sizeof(statsdef_t));
+	for (j=0; j<FT_STATS_NBINS; j++) hist[j] = lockwait[j];
+	hist += FT_STATS_NBINS;
+	for (j=0; j<FT_STATS_NBINS; j++) hist[j] = roundtrip[j];
+
+	ptr = (char *) (hist + FT_STATS_NBINS);
+	for (i=0; i<NCOMMANDS; i++) {
+		cdef = (cmdstats_t *) ptr;
+		cdef->command   = commands[i];
+		cdef->reserved  = 0;
+		cdef->count     = cmdslot[i].count;
+		cdef->errors    = cmdslot[i].errors;
+		cdef->bytes_in  = cmdslot[i].bytes_in;
+		cdef->bytes_out = cmdslot[i].bytes_out;
+		hist = (UINT64_T *) (ptr + sizeof(cmdstats_t));
+		for (j=0; j<FT_STATS_NBINS; j++) hist[j] = cmdslot[i].latency[j];
+		ptr += sizeof(cmdstats_t) + FT_STATS_NBINS*sizeof(UINT64_T);
+	}
+	return buf;
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+
+#ifndef BUFSTATS_H
+#define BUFSTATS_H
+
+#include "message.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Counters and latency histograms of the buffer server, these are returned by
+  GET_STATS (see message.h for the layout of the response). All functions can
+  be called from any thread, the counters are updated with atomic operations
+  rather than with a mutex to keep the overhead on the hot path low. Durations
+  are in microseconds, as measured with ft_stats_clock.
+*/
+#define FT_STATS_NBINS  24   /* the last bin starts at 2^22 us, i.e. about 4 seconds */
+
+UINT64_T ft_stats_clock(void);
+UINT64_T ft_stats_elapsed(UINT64_T start);
+
+void ft_stats_request_begin(void);
+void ft_stats_request_end(void);
+void ft_stats_command(UINT16_T command, UINT16_T result, UINT32_T bytes_in, UINT32_T bytes_out, UINT64_T duration);
+void ft_stats_lockwait(UINT64_T duration);
+void ft_stats_roundtrip(UINT64_T duration);
+void ft_stats_connect(void);
+void ft_stats_disconnect(void);
+void ft_stats_wait_begin(void);
+void ft_stats_wait_end(void);
+void ft_stats_queue_begin(void);
+void ft_stats_queue_end(void);
+void ft_stats_queue_done(void);
+void ft_stats_queue_full(void);
+
+void *ft_stats_serialize(UINT32_T *size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BUFSTATS_H */
@@ -7,6 +7,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "buffer.h"
 
@@ -39,6 +40,382 @@ int clientrequest(int server, const message_t *request, message_t **response_ptr
 
 	if (verbose>0) print_response((*response_ptr)->def);
 
+	/* the samples that the client asked for have arrived, see fttrace.h */
+	if (request->def->command == GET_DAT && request->def->bufsize >= sizeof(datasel_t) && ft_trace_enabled()) {
+		const message_t *response = *response_ptr;
+		/* a compressed response has the datadef_t after the compdef_t */
+		UINT32_T offset = (response->def->command == GET_OK_Z) ? sizeof(compdef_t) : 0;
+		if ((response->def->command == GET_OK || response->def->command == GET_OK_Z) && response->def->bufsize >= offset + sizeof(datadef_t)) {
+			const datadef_t *datadef = (const datadef_t *) ((const char *) response->buf + offset);
+			UINT32_T begsample = ((const datasel_t *) request->buf)->begsample;
+			ft_trace_point(FT_TRACE_DELIVER, begsample, begsample + datadef->nsamples, 0);
+		}
+	}
+
 	/* everything went fine */
 	return 0;
 }
+
+/*******************************************************************************
+ * like clientrequest, but for a number of requests whose responses are read
+ * after all requests have been sent, see tcprequest_multi
+ *******************************************************************************/
+int clientrequest_multi(int server, int nreq, const message_t **request, message_t **response) {
+	int i;
+
+	if (server<0) {
+		fprintf(stderr, "clientrequest_multi: invalid value for server (%d)\n", server);
+		return -1;
+	}
+
+	else if (server==0) {
+		/* use direct memory acces to the buffer, one request after the other */
+		for (i=0; i<nreq; i++) {
+			if (dmarequest(request[i], &response[i])!=0) {
+				while (i-- > 0) cleanup_message((void **) &response[i]);
+				return -2;
+			}
+		}
+	}
+
+	else if (server>0) {
+		/* use TCP connection to the buffer */
+		if (tcprequest_multi(server, nreq, request, response)!=0)
+			return -3;
+	}
+
+	return 0;
+}
+
+/*******************************************************************************
+ * like clientrequest, but for the named stream on the buffer
+ * the request is wrapped in a STREAM_REQ, see message.h
+ *******************************************************************************/
+int streamrequest(int server, const char *stream, const message_t *request, message_t **response_ptr) {
+	message_t wrapped;
+	messagedef_t def;
+	streamdef_t *sdef;
+	int status;
+
+	if (strlen(stream) >= FT_STREAM_NAMELEN) {
+		fprintf(stderr, "streamrequest: the name of the stream is too long\n");
+		return -1;
+	}
+	def.version = VERSION;
+	def.command = STREAM_REQ;
+	def.bufsize = sizeof(streamdef_t) + sizeof(messagedef_t) + request->def->bufsize;
+	wrapped.def = &def;
+	wrapped.buf = malloc(def.bufsize);
+	if (wrapped.buf == NULL) return -1;
+
+	sdef = (streamdef_t *) wrapped.buf;
+	memset(sdef->name, 0, FT_STREAM_NAMELEN);
+	strcpy(sdef->name, stream);
+	memcpy((char *) wrapped.buf + sizeof(streamdef_t), request->def, sizeof(messagedef_t));
+	if (request->def->bufsize > 0)
+		memcpy((char *) wrapped.buf + sizeof(streamdef_t) + sizeof(messagedef_t), request->buf, request->def->bufsize);
+
+	status = clientrequest(server, &wrapped, response_ptr);
+	free(wrapped.buf);
+	return status;
+}
+
+/*******************************************************************************
+ * Persistent client connections
+ *
+ * An ft_connection_t remembers where it is connected to, so that it can be
+ * re-established if the server closes it or if the network fails. A request
+ * that fails halfway is only sent again if it does not change the buffer
+ * (GET_HDR, GET_HDR_GEN, GET_DAT, GET_DAT_M, GET_EVT, GET_CAP, GET_STATS,
+ * GET_TIME and WAIT_DAT), other requests return an error but the next request
+ * goes over a new connection.
+ * With the compress option, the samples of PUT_DAT and GET_DAT are compressed
+ * on TCP connections to servers that support it (see compress.h).
+ *
+ * Note that a write to a socket that was closed by the other side raises
+ * SIGPIPE on most UNIX systems, applications that want to survive a server
+ * restart should ignore that signal.
+ *******************************************************************************/
+
+void ft_connection_defaults(ft_connopt_t *opt) {
+	opt->nodelay     = 1;
+	opt->keepalive   = 1;
+	opt->keepidle    = 0;
+	opt->sendtimeout = 0;
+	opt->recvtimeout = 0;
+	opt->retry       = 0;
+	opt->retrydelay  = 5;
+	opt->reconnect   = 1;
+	opt->compress    = 0;
+}
+
+ft_connection_t *ft_connection_create(const ft_connopt_t *opt) {
+	ft_connection_t *C = (ft_connection_t *) malloc(sizeof(ft_connection_t));
+	if (C == NULL) return NULL;
+	if (opt != NULL)
+		C->opt = *opt;
+	else
+		ft_connection_defaults(&C->opt);
+	C->sock = -1;
+	C->type = -1;
+	C->name[0] = 0;
+	C->port = 0;
+	C->reconnects = 0;
+	C->replays = 0;
+	C->codecs = 0;
+	return C;
+}
+
+void ft_connection_destroy(ft_connection_t *C) {
+	if (C == NULL) return;
+	ft_connection_close(C);
+	free(C);
+}
+
+/* closes the socket, but keeps the address so that the connection can be re-established */
+void ft_connection_close(ft_connection_t *C) {
+	if (C->sock > 0) closesocket(C->sock);
+	C->sock = -1;
+	C->codecs = 0;
+}
+
+static void set_timeout(int sock, int option, int milliseconds) {
+#ifdef PLATFORM_WINDOWS
+	DWORD tv = milliseconds;
+#else
+	struct timeval tv;
+	tv.tv_sec  = milliseconds / 1000;
+	tv.tv_usec = 1000 * (milliseconds % 1000);
+#endif
+	if (setsockopt(sock, SOL_SOCKET, option, (const char*)&tv, sizeof(tv)) < 0)
+		perror("ft_connection: setsockopt timeout");
+}
+
+/* applies the options to the current socket, returns 0 on success */
+int ft_connection_configure(ft_connection_t *C) {
+	int optval;
+
+	if (C->sock <= 0) return -1;
+
+	if (C->type == 1) {
+		optval = C->opt.nodelay ? 1 : 0;
+		if (setsockopt(C->sock, IPPROTO_TCP, TCP_NODELAY, (const char*)&optval, sizeof(optval)) < 0)
+			perror("ft_connection: setsockopt TCP_NODELAY");
+
+		optval = C->opt.keepalive ? 1 : 0;
+		if (setsockopt(C->sock, SOL_SOCKET, SO_KEEPALIVE, (const char*)&optval, sizeof(optval)) < 0)
+			perror("ft_connection: setsockopt SO_KEEPALIVE");
+
+		if (C->opt.keepalive && C->opt.keepidle > 0) {
+			optval = C->opt.keepidle;
+#if defined(TCP_KEEPIDLE)
+			if (setsockopt(C->sock, IPPROTO_TCP, TCP_KEEPIDLE, (const char*)&optval, sizeof(optval)) < 0)
+				perror("ft_connection: setsockopt TCP_KEEPIDLE");
+#elif defined(TCP_KEEPALIVE)
+			/* this is what it is called on OS X */
+			if (setsockopt(C->sock, IPPROTO_TCP, TCP_KEEPALIVE, (const char*)&optval, sizeof(optval)) < 0)
+				perror("ft_connection: setsockopt TCP_KEEPALIVE");
+#endif
+		}
+	}
+
+	set_timeout(C->sock, SO_SNDTIMEO, C->opt.sendtimeout);
+	set_timeout(C->sock, SO_RCVTIMEO, C->opt.recvtimeout);
+	return 0;
+}
+
+/* opens the socket to the remembered address, returns 0 on success */
+static int establish(ft_connection_t *C) {
+	int attempt, s = -1;
+
+	for (attempt=0; attempt<=C->opt.retry; attempt++) {
+		if (attempt>0) usleep(1000*C->opt.retrydelay);
+		if (C->type == 1)
+			s = open_connection(C->name, C->port);
+		else if (C->type == 2)
+			s = open_unix_connection(C->name);
+		if (s > 0) break;
+	}
+	if (s <= 0) {
+		fprintf(stderr, "ft_connection: cannot connect to %s:%d\n", C->name, C->port);
+		return -1;
+	}
+	C->sock = s;
+	ft_connection_configure(C);
+	return 0;
+}
+
+/* Asks the server which codecs it accepts, if compression is enabled for
+   this TCP connection. Servers that do not know GET_CODEC reject it, but
+   some older ones break the connection, which is then opened once more
+   without compression. Returns 0 on success, also if there is no compression.
+ */
+int ft_connection_negotiate(ft_connection_t *C) {
+	message_t request, *response = NULL;
+	messagedef_t def;
+	UINT32_T codecs = FT_CODEC_ALL;
+	int status;
+
+	C->codecs = 0;
+	if (!C->opt.compress || C->type != 1 || C->sock <= 0) return 0;
+
+	def.version = VERSION;
+	def.command = GET_CODEC;
+	def.bufsize = sizeof(UINT32_T);
+	request.def = &def;
+	request.buf = &codecs;
+
+	status = clientrequest(C->sock, &request, &response);
+	if (status == 0 && response != NULL && response->def->command == GET_OK && response->def->bufsize == sizeof(UINT32_T))
+		C->codecs = ft_codec_accept(*(UINT32_T *) response->buf);
+	if (response != NULL) cleanup_message((void **) &response);
+	if (status == 0) return 0;
+
+	ft_connection_close(C);
+	return establish(C);
+}
+
+int ft_connection_tcp(ft_connection_t *C, const char *hostname, int port) {
+	ft_connection_close(C);
+	if (port == 0) return ft_connection_direct(C);
+	strncpy(C->name, hostname, HOSTNAME_LENGTH-1);
+	C->name[HOSTNAME_LENGTH-1] = 0;
+	C->port = port;
+	C->type = 1;
+	if (establish(C) != 0) return -1;
+	return ft_connection_negotiate(C);
+}
+
+int ft_connection_unix(ft_connection_t *C, const char *name) {
+	ft_connection_close(C);
+	strncpy(C->name, name, HOSTNAME_LENGTH-1);
+	C->name[HOSTNAME_LENGTH-1] = 0;
+	C->port = 0;
+	C->type = 2;
+	return establish(C);
+}
+
+/* use direct memory access to a buffer that runs in the same process */
+int ft_connection_direct(ft_connection_t *C) {
+	ft_connection_close(C);
+	C->name[0] = 0;
+	C->port = 0;
+	C->type = 0;
+	C->sock = 0;
+	return 0;
+}
+
+int ft_connection_reconnect(ft_connection_t *C) {
+	if (C->type == 0) return ft_connection_direct(C);
+	if (C->type < 0) return -1;
+	ft_connection_close(C);
+	if (establish(C) != 0 || ft_connection_negotiate(C) != 0) return -1;
+	C->reconnects++;
+	return 0;
+}
+
+/* Between two requests the server has nothing to send, so a socket that
+   is readable has been closed or reset by the other side (or the stream
+   is out of sync, which is just as bad).
+ */
+static int is_broken(int sock) {
+	fd_set readSet;
+	struct timeval tv;
+
+#ifndef PLATFORM_WINDOWS
+	if (sock >= FD_SETSIZE) return 0;
+#endif
+	FD_ZERO(&readSet);
+	FD_SET(sock, &readSet);
+	tv.tv_sec  = 0;
+	tv.tv_usec = 0;
+	return select(sock+1, &readSet, NULL, NULL, &tv) != 0;
+}
+
+static int is_idempotent(UINT16_T command) {
+	switch (command) {
+		case GET_HDR:
+		case GET_HDR_GEN:
+		case GET_DAT:
+		case GET_DAT_M:
+		case GET_EVT:
+		case GET_CAP:
+		case GET_STATS:
+		case GET_TIME:
+		case WAIT_DAT:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+/*******************************************************************************
+ * like clientrequest, but over a persistent connection
+ * returns 0 on success, -1 if not connected, or the error of clientrequest
+ *******************************************************************************/
+int ft_connection_request(ft_connection_t *C, const message_t *request, message_t **response_ptr) {
+	message_t zrequest;
+	messagedef_t zdef;
+	int attempt, status, wait = 0;
+
+	if (C->sock == 0)
+		return clientrequest(0, request, response_ptr);
+
+	/* a blocking WAIT_DAT should not run into the receive timeout */
+	if (request->def->command == WAIT_DAT && request->def->bufsize == sizeof(waitdef_t) && C->opt.recvtimeout > 0)
+		wait = ((const waitdef_t *) request->buf)->milliseconds;
+
+	for (attempt=0; ; attempt++) {
+		/* a connection that broke while idle is detected before anything is
+		   sent, so every request can go over the new connection */
+		if (C->sock > 0 && C->opt.reconnect && is_broken(C->sock))
+			ft_connection_close(C);
+		if (C->sock < 0) {
+			if (!C->opt.reconnect || ft_connection_reconnect(C) != 0) {
+				*response_ptr = NULL;
+				return -1;
+			}
+		}
+
+		if (wait > 0) set_timeout(C->sock, SO_RCVTIMEO, C->opt.recvtimeout + wait);
+		zrequest.buf = NULL;
+		if (C->codecs && request->def->command == PUT_DAT) {
+			zrequest.buf = ft_compress_data(request->buf, request->def->bufsize, C->codecs, &zdef.bufsize);
+			zdef.version = VERSION;
+			zdef.command = PUT_DAT_Z;
+			zrequest.def = &zdef;
+		}
+		status = clientrequest(C->sock, zrequest.buf ? &zrequest : request, response_ptr);
+		FREE(zrequest.buf);
+		if (wait > 0 && status == 0) set_timeout(C->sock, SO_RCVTIMEO, C->opt.recvtimeout);
+		if (status == 0 && ft_decompress_message(*response_ptr, C->codecs) != 0) {
+			fprintf(stderr, "ft_connection_request: cannot expand the compressed samples\n");
+			cleanup_message((void **) response_ptr);
+			return -1;
+		}
+		if (status == 0) return 0;
+
+		/* the state of the stream is unknown, start over with a new connection */
+		ft_connection_close(C);
+		if (!C->opt.reconnect || attempt > 0 || !is_idempotent(request->def->command))
+			return status;
+		C->replays++;
+	}
+}
+
+/* sends a small request to check that the server is still there, returns 0 on success */
+int ft_connection_ping(ft_connection_t *C) {
+	message_t request, *response = NULL;
+	messagedef_t def;
+	int status;
+
+	def.version = VERSION;
+	def.command = GET_CAP;
+	def.bufsize = 0;
+	request.def = &def;
+	request.buf = NULL;
+
+	status = ft_connection_request(C, &request, &response);
+	if (response != NULL) cleanup_message((void **) &response);
+	return status;
+}
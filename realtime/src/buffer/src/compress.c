@@ -0,0 +1,409 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ * Compression of the samples on the wire, see compress.h
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer.h"
+#include "compress.h"
+
+/* the LZ coder follows the LZ4 block format */
+#define LZ_HASHLOG      12
+#define LZ_MINMATCH     4
+#define LZ_MFLIMIT      12     /* the last match starts at least this many bytes before the end */
+#define LZ_LASTLITERALS 5      /* the last bytes are always literals */
+#define LZ_MAXOFFSET    65535
+
+UINT32_T ft_codec_accept(UINT32_T codecs) {
+	return codecs & FT_CODEC_ALL;
+}
+
+static UINT32_T read32(const UINT8_T *p) {
+	UINT32_T v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static UINT8_T *lz_length(UINT8_T *op, UINT32_T len) {
+	for (; len >= 255; len -= 255) *op++ = 255;
+	*op++ = (UINT8_T) len;
+	return op;
+}
+
+/* returns the size of the compressed data, or 0 if it does not fit in the given capacity */
+static UINT32_T lz_compress(const UINT8_T *src, UINT32_T n, UINT8_T *dst, UINT32_T capacity) {
+	UINT32_T table[1<<LZ_HASHLOG];
+	const UINT8_T *ip = src, *anchor = src, *ref, *iend = src + n;
+	UINT8_T *op = dst, *oend = dst + capacity, *token;
+	UINT32_T seq, h, litlen, matchlen;
+
+	if (n > LZ_MFLIMIT) {
+		const UINT8_T *mflimit = iend - LZ_MFLIMIT, *matchlimit = iend - LZ_LASTLITERALS;
+
+		memset(table, 0, sizeof(table));
+		ip++;
+		while (ip < mflimit) {
+			seq = read32(ip);
+			h = (seq * 2654435761u) >> (32 - LZ_HASHLOG);
+			ref = src + table[h];
+			table[h] = (UINT32_T) (ip - src);
+			if (ref >= ip || ip - ref > LZ_MAXOFFSET || read32(ref) != seq) {
+				/* skip faster through data that does not compress */
+				ip += 1 + ((ip - anchor) >> 6);
+				continue;
+			}
+
+			while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+				ip--;
+				ref--;
+			}
+			matchlen = LZ_MINMATCH;
+			while (ip + matchlen < matchlimit && ip[matchlen] == ref[matchlen]) matchlen++;
+
+			litlen = (UINT32_T) (ip - anchor);
+			if (op + 1 + litlen/255 + 1 + litlen + 2 + (matchlen - LZ_MINMATCH)/255 + 1 > oend) return 0;
+			token = op++;
+			*token = (UINT8_T) ((litlen >= 15 ? 15 : litlen) << 4);
+			if (litlen >= 15) op = lz_length(op, litlen - 15);
+			memcpy(op, anchor, litlen);
+			op += litlen;
+			*op++ = (UINT8_T) ((ip - ref) & 0xFF);
+			*op++ = (UINT8_T) ((ip - ref) >> 8);
+			if (matchlen - LZ_MINMATCH >= 15) {
+				*token |= 15;
+				op = lz_length(op, matchlen - LZ_MINMATCH - 15);
+			} else {
+				*token |= (UINT8_T) (matchlen - LZ_MINMATCH);
+			}
+
+			ip += matchlen;
+			anchor = ip;
+			if (ip < mflimit) table[(read32(ip-2) * 2654435761u) >> (32 - LZ_HASHLOG)] = (UINT32_T) (ip - 2 - src);
+		}
+	}
+
+	/* the remainder goes out as literals */
+	litlen = (UINT32_T) (iend - anchor);
+	if (op + 1 + litlen/255 + 1 + litlen > oend) return 0;
+	token = op++;
+	*token = (UINT8_T) ((litlen >= 15 ? 15 : litlen) << 4);
+	if (litlen >= 15) op = lz_length(op, litlen - 15);
+	memcpy(op, anchor, litlen);
+	op += litlen;
+	return (UINT32_T) (op - dst);
+}
+
+/* returns 0 if the compressed data decodes to exactly n bytes, -1 if it is malformed */
+static int lz_decompress(const UINT8_T *src, UINT32_T size, UINT8_T *dst, UINT32_T n) {
+	const UINT8_T *ip = src, *iend = src + size;
+	UINT8_T *op = dst, *oend = dst + n;
+	UINT32_T token, len, offset, b;
+
+	while (ip < iend) {
+		token = *ip++;
+		len = token >> 4;
+		if (len == 15) {
+			do {
+				if (ip >= iend) return -1;
+				b = *ip++;
+				len += b;
+			} while (b == 255);
+		}
+		if (len > (UINT32_T) (iend - ip) || len > (UINT32_T) (oend - op)) return -1;
+		memcpy(op, ip, len);
+		ip += len;
+		op += len;
+		if (ip == iend) break;
+
+		if (iend - ip < 2) return -1;
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (UINT32_T) (op - dst)) return -1;
+		len = token & 15;
+		if (len == 15) {
+			do {
+				if (ip >= iend) return -1;
+				b = *ip++;
+				len += b;
+			} while (b == 255);
+		}
+		len += LZ_MINMATCH;
+		if (len > (UINT32_T) (oend - op)) return -1;
+		if (offset >= len) {
+			memcpy(op, op - offset, len);
+			op += len;
+		} else {
+			/* the match overlaps with what it produces */
+			for (; len > 0; len--, op++) *op = *(op - offset);
+		}
+	}
+	return (op == oend) ? 0 : -1;
+}
+
+/* groups the bytes of the n words by significance, the loops have a fixed stride so they can be vectorized */
+static void shuffle(UINT32_T wordsize, UINT32_T n, const UINT8_T *src, UINT8_T *dst) {
+	UINT32_T i, b;
+	switch (wordsize) {
+		case 2:
+			for (i=0; i<n; i++) { dst[i] = src[2*i]; dst[n+i] = src[2*i+1]; }
+			break;
+		case 4:
+			for (b=0; b<4; b++) for (i=0; i<n; i++) dst[b*n+i] = src[4*i+b];
+			break;
+		case 8:
+			for (b=0; b<8; b++) for (i=0; i<n; i++) dst[b*n+i] = src[8*i+b];
+			break;
+		default:
+			memcpy(dst, src, (size_t) n*wordsize);
+	}
+}
+
+static void unshuffle(UINT32_T wordsize, UINT32_T n, const UINT8_T *src, UINT8_T *dst) {
+	UINT32_T i, b;
+	switch (wordsize) {
+		case 2:
+			for (i=0; i<n; i++) { dst[2*i] = src[i]; dst[2*i+1] = src[n+i]; }
+			break;
+		case 4:
+			for (b=0; b<4; b++) for (i=0; i<n; i++) dst[4*i+b] = src[b*n+i];
+			break;
+		case 8:
+			for (b=0; b<8; b++) for (i=0; i<n; i++) dst[8*i+b] = src[b*n+i];
+			break;
+		default:
+			memcpy(dst, src, (size_t) n*wordsize);
+	}
+}
+
+/* The difference with the same channel in the previous sample, zigzag coded
+   so that small negative differences become small positive numbers. This is
+   done with unsigned integers of the same size, which wrap around, so that
+   it is exact for signed and unsigned samples alike. */
+#define DELTA_ENCODE(T, BITS) { \
+	const T *x = (const T *) src; \
+	T *d = (T *) dst; \
+	T v; \
+	for (i=0; i<n; i++) { \
+		v = (i < nchans) ? x[i] : (T) (x[i] - x[i-nchans]); \
+		d[i] = (T) ((T) (v << 1) ^ (T) (0 - (v >> (BITS-1)))); \
+	} \
+}
+
+#define DELTA_DECODE(T) { \
+	const T *d = (const T *) src; \
+	T *x = (T *) dst; \
+	for (i=0; i<n && i<nchans; i++) \
+		x[i] = (T) ((d[i] >> 1) ^ (T) (0 - (d[i] & 1))); \
+	for (; i<n; i++) \
+		x[i] = (T) (x[i-nchans] + (T) ((d[i] >> 1) ^ (T) (0 - (d[i] & 1)))); \
+}
+
+static void delta_encode(UINT32_T wordsize, UINT32_T nchans, UINT32_T n, const void *src, void *dst) {
+	UINT32_T i;
+	switch (wordsize) {
+		case 1: DELTA_ENCODE(UINT8_T, 8);   break;
+		case 2: DELTA_ENCODE(UINT16_T, 16); break;
+		case 4: DELTA_ENCODE(UINT32_T, 32); break;
+		case 8: DELTA_ENCODE(UINT64_T, 64); break;
+	}
+}
+
+static void delta_decode(UINT32_T wordsize, UINT32_T nchans, UINT32_T n, const void *src, void *dst) {
+	UINT32_T i;
+	switch (wordsize) {
+		case 1: DELTA_DECODE(UINT8_T);  break;
+		case 2: DELTA_DECODE(UINT16_T); break;
+		case 4: DELTA_DECODE(UINT32_T); break;
+		case 8: DELTA_DECODE(UINT64_T); break;
+	}
+}
+
+static int is_integer_type(UINT32_T data_type) {
+	return data_type >= DATATYPE_UINT8 && data_type <= DATATYPE_INT64;
+}
+
+/* checks that the datadef_t describes the samples that follow it, returns the word size or 0 */
+static UINT32_T check_datadef(const datadef_t *ddef, UINT32_T size) {
+	UINT32_T wordsize = wordsize_from_type(ddef->data_type);
+	if (wordsize == 0 || ddef->nchans == 0 || ddef->bufsize != size) return 0;
+	if ((UINT64_T) ddef->nchans * ddef->nsamples * wordsize != size) return 0;
+	return wordsize;
+}
+
+/* Compresses the samples of a PUT_DAT request or GET_DAT response, which
+   consist of a datadef_t followed by the samples, with one of the given
+   codecs. Returns the compdef_t, datadef_t and compressed samples in a newly
+   allocated buffer of size *zsize, or NULL if that would not save enough. */
+void *ft_compress_data(const void *buf, UINT32_T bufsize, UINT32_T codecs, UINT32_T *zsize) {
+	const datadef_t *ddef = (const datadef_t *) buf;
+	const UINT8_T *samples = (const UINT8_T *) buf + sizeof(datadef_t);
+	UINT8_T *zbuf, *tmp, *filtered;
+	compdef_t cdef;
+	UINT32_T wordsize, size, n;
+
+	if (bufsize < sizeof(datadef_t) + FT_CODEC_MINSIZE) return NULL;
+	size = bufsize - sizeof(datadef_t);
+	if ((wordsize = check_datadef(ddef, size)) == 0) return NULL;
+	n = size / wordsize;
+
+	if (is_integer_type(ddef->data_type) && (codecs & FT_CODEC_BIT(FT_CODEC_DELTA)))
+		cdef.codec = FT_CODEC_DELTA;
+	else if (codecs & FT_CODEC_BIT(FT_CODEC_SHUFFLE))
+		cdef.codec = FT_CODEC_SHUFFLE;
+	else
+		return NULL;
+
+	/* anything that is not at least 1/16 smaller goes out as it is */
+	tmp  = (UINT8_T *) malloc(2*(size_t) size);
+	zbuf = (UINT8_T *) malloc(sizeof(compdef_t) + sizeof(datadef_t) + size - size/16);
+	if (tmp == NULL || zbuf == NULL) {
+		FREE(tmp);
+		FREE(zbuf);
+		return NULL;
+	}
+
+	filtered = tmp + size;
+	if (cdef.codec == FT_CODEC_DELTA) {
+		delta_encode(wordsize, ddef->nchans, n, samples, tmp);
+		shuffle(wordsize, n, tmp, filtered);
+	} else {
+		shuffle(wordsize, n, samples, filtered);
+	}
+	cdef.bufsize = lz_compress(filtered, size, zbuf + sizeof(compdef_t) + sizeof(datadef_t), size - size/16);
+	free(tmp);
+	if (cdef.bufsize == 0) {
+		free(zbuf);
+		return NULL;
+	}
+
+	memcpy(zbuf, &cdef, sizeof(compdef_t));
+	memcpy(zbuf + sizeof(compdef_t), ddef, sizeof(datadef_t));
+	*zsize = sizeof(compdef_t) + sizeof(datadef_t) + cdef.bufsize;
+	return zbuf;
+}
+
+/* The reverse of ft_compress_data, returns the datadef_t and samples in a
+   newly allocated buffer of size *bufsize, or NULL if the compressed data is
+   malformed or uses a codec that is not in the given set. */
+void *ft_decompress_data(const void *zbuf, UINT32_T zsize, UINT32_T codecs, UINT32_T *bufsize) {
+	compdef_t cdef;
+	datadef_t ddef;
+	UINT8_T *buf, *tmp;
+	UINT32_T wordsize, n;
+
+	if (zsize < sizeof(compdef_t) + sizeof(datadef_t)) return NULL;
+	memcpy(&cdef, zbuf, sizeof(compdef_t));
+	memcpy(&ddef, (const UINT8_T *) zbuf + sizeof(compdef_t), sizeof(datadef_t));
+	if (cdef.codec == FT_CODEC_NONE || cdef.codec > 31 || !(codecs & FT_CODEC_BIT(cdef.codec))) return NULL;
+	if (cdef.bufsize != zsize - sizeof(compdef_t) - sizeof(datadef_t)) return NULL;
+	if ((wordsize = check_datadef(&ddef, ddef.bufsize)) == 0) return NULL;
+	n = ddef.bufsize / wordsize;
+
+	buf = (UINT8_T *) malloc(sizeof(datadef_t) + (size_t) ddef.bufsize);
+	tmp = (UINT8_T *) malloc(2*(size_t) ddef.bufsize);
+	if (buf == NULL || tmp == NULL) {
+		FREE(buf);
+		FREE(tmp);
+		return NULL;
+	}
+
+	if (lz_decompress((const UINT8_T *) zbuf + sizeof(compdef_t) + sizeof(datadef_t), cdef.bufsize, tmp, ddef.bufsize) != 0) {
+		free(buf);
+		free(tmp);
+		return NULL;
+	}
+	if (cdef.codec == FT_CODEC_DELTA) {
+		unshuffle(wordsize, n, tmp, tmp + ddef.bufsize);
+		delta_decode(wordsize, ddef.nchans, n, tmp + ddef.bufsize, buf + sizeof(datadef_t));
+	} else {
+		unshuffle(wordsize, n, tmp, buf + sizeof(datadef_t));
+	}
+	free(tmp);
+
+	memcpy(buf, &ddef, sizeof(datadef_t));
+	*bufsize = sizeof(datadef_t) + ddef.bufsize;
+	return buf;
+}
+
+/* Turns a PUT_DAT request or the GET_OK response to a GET_DAT request into
+   PUT_DAT_Z or GET_OK_Z, if one of the codecs saves enough. Returns 1 if the
+   message was compressed and 0 if it was left alone. */
+int ft_compress_message(message_t *msg, UINT32_T codecs) {
+	void *zbuf;
+	UINT32_T zsize;
+
+	if (msg->def->command != PUT_DAT && msg->def->command != GET_OK) return 0;
+	zbuf = ft_compress_data(msg->buf, msg->def->bufsize, codecs, &zsize);
+	if (zbuf == NULL) return 0;
+	free(msg->buf);
+	msg->buf = zbuf;
+	msg->def->bufsize = zsize;
+	msg->def->command = (msg->def->command == PUT_DAT) ? PUT_DAT_Z : GET_OK_Z;
+	return 1;
+}
+
+/* Turns PUT_DAT_Z or GET_OK_Z back into PUT_DAT or GET_OK, other messages
+   are left alone. Returns 0 on success and -1 if the message is malformed. */
+int ft_decompress_message(message_t *msg, UINT32_T codecs) {
+	void *buf;
+	UINT32_T bufsize;
+
+	if (msg->def->command != PUT_DAT_Z && msg->def->command != GET_OK_Z) return 0;
+	buf = ft_decompress_data(msg->buf, msg->def->bufsize, codecs, &bufsize);
+	if (buf == NULL) return -1;
+	free(msg->buf);
+	msg->buf = buf;
+	msg->def->bufsize = bufsize;
+	msg->def->command = (msg->def->command == PUT_DAT_Z) ? PUT_DAT : GET_OK;
+	return 0;
+}
+
+/* Handles the compression on the server side of a connection, before the
+   request is passed on to dmarequest. GET_CODEC is answered here with the
+   codecs that are accepted for the rest of the connection, which are stored
+   in *codecs, and PUT_DAT_Z is turned into PUT_DAT. Returns 1 if the response
+   is ready, 0 if the request should be handled as usual, and -1 if out of
+   memory. */
+int ft_codec_serve(message_t *request, int swap, UINT32_T *codecs, message_t **response) {
+	message_t *msg;
+	UINT16_T command;
+	UINT32_T accepted = 0;
+
+	if (request->def->command == GET_CODEC) {
+		if (request->def->bufsize != sizeof(UINT32_T)) {
+			command = GET_ERR;
+		} else {
+			/* the filters work on the samples in the byte order of the client */
+			if (!swap) memcpy(&accepted, request->buf, sizeof(UINT32_T));
+			accepted = ft_codec_accept(accepted);
+			*codecs = accepted;
+			command = GET_OK;
+		}
+	} else if (request->def->command == PUT_DAT_Z) {
+		if (ft_decompress_message(request, *codecs) == 0) return 0;
+		command = PUT_ERR;
+	} else {
+		return 0;
+	}
+
+	msg = (message_t *) malloc(sizeof(message_t));
+	if (msg == NULL) return -1;
+	msg->def = (messagedef_t *) malloc(sizeof(messagedef_t));
+	msg->buf = (command == GET_OK) ? malloc(sizeof(UINT32_T)) : NULL;
+	if (msg->def == NULL || (command == GET_OK && msg->buf == NULL)) {
+		FREE(msg->def);
+		FREE(msg->buf);
+		free(msg);
+		return -1;
+	}
+	msg->def->version = VERSION;
+	msg->def->command = command;
+	msg->def->bufsize = (command == GET_OK) ? sizeof(UINT32_T) : 0;
+	if (command == GET_OK) memcpy(msg->buf, &accepted, sizeof(UINT32_T));
+	*response = msg;
+	return 1;
+}
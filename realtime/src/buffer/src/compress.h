@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ */
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include "message.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Compression of the samples of PUT_DAT requests and GET_DAT responses.
+
+  A client that wants to use this sends GET_CODEC with the codecs that it
+  supports, and the server answers with the codecs that it accepts for the
+  rest of the connection. From then on, the client can send PUT_DAT_Z
+  instead of PUT_DAT, and the server answers GET_DAT with GET_OK_Z instead
+  of GET_OK whenever that saves enough bytes. Compression is never used
+  between machines with a different byte order, and servers that do not
+  know GET_CODEC simply reject it.
+
+  Both codecs consist of SIMD-friendly filters that rearrange the bytes,
+  followed by a fast LZ77 coder in the LZ4 block format:
+    FT_CODEC_SHUFFLE - groups the bytes of the samples by significance
+    FT_CODEC_DELTA   - replaces the integer samples of each channel by the
+                       zigzag-coded difference to the previous sample, and
+                       then shuffles the bytes
+*/
+
+#define FT_CODEC_NONE     0
+#define FT_CODEC_SHUFFLE  1
+#define FT_CODEC_DELTA    2
+
+#define FT_CODEC_BIT(codec)  (1u << (codec))
+#define FT_CODEC_ALL      (FT_CODEC_BIT(FT_CODEC_SHUFFLE) | FT_CODEC_BIT(FT_CODEC_DELTA))
+
+/* smaller sample blocks are always sent as they are */
+#define FT_CODEC_MINSIZE  1024
+
+UINT32_T ft_codec_accept(UINT32_T codecs);
+void *ft_compress_data(const void *buf, UINT32_T bufsize, UINT32_T codecs, UINT32_T *zsize);
+void *ft_decompress_data(const void *zbuf, UINT32_T zsize, UINT32_T codecs, UINT32_T *bufsize);
+int ft_compress_message(message_t *msg, UINT32_T codecs);
+int ft_decompress_message(message_t *msg, UINT32_T codecs);
+int ft_codec_serve(message_t *request, int swap, UINT32_T *codecs, message_t **response);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COMPRESS_H */
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ * Conversion of samples to floating point, see convert.h
+ */
+
+#include <string.h>
+
+#include "buffer.h"
+#include "convert.h"
+
+/*
+ * The generic loops are simple enough for the compiler to vectorize them.
+ * The 16 and 32-bit integers that most amplifiers deliver are converted to
+ * single precision with SSE2, which is always available on x86-64, followed
+ * by the generic loop for the remaining values.
+ */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define CONVERT_SSE2
+  #include <emmintrin.h>
+#endif
+
+#define CONVERT_LOOP(ST, DT) { \
+	const ST *s = (const ST *) src; \
+	DT *d = (DT *) dest; \
+	if (gain) { for (i=0; i<n; i++) d[i] = (DT) s[i] * gain[i]; } \
+	else { for (i=0; i<n; i++) d[i] = (DT) s[i]; } \
+}
+
+#define CONVERT_SWITCH(DT) \
+	switch (src_type) { \
+		case DATATYPE_CHAR:    CONVERT_LOOP(CHAR_T,    DT); break; \
+		case DATATYPE_UINT8:   CONVERT_LOOP(UINT8_T,   DT); break; \
+		case DATATYPE_UINT16:  CONVERT_LOOP(UINT16_T,  DT); break; \
+		case DATATYPE_UINT32:  CONVERT_LOOP(UINT32_T,  DT); break; \
+		case DATATYPE_UINT64:  CONVERT_LOOP(UINT64_T,  DT); break; \
+		case DATATYPE_INT8:    CONVERT_LOOP(INT8_T,    DT); break; \
+		case DATATYPE_INT16:   CONVERT_LOOP(INT16_T,   DT); break; \
+		case DATATYPE_INT32:   CONVERT_LOOP(INT32_T,   DT); break; \
+		case DATATYPE_INT64:   CONVERT_LOOP(INT64_T,   DT); break; \
+		case DATATYPE_FLOAT32: CONVERT_LOOP(FLOAT32_T, DT); break; \
+		case DATATYPE_FLOAT64: CONVERT_LOOP(FLOAT64_T, DT); break; \
+		default: return -1; \
+	}
+
+#ifdef CONVERT_SSE2
+/* returns the number of values that have been converted */
+static UINT32_T convert_int16_sse2(UINT32_T n, FLOAT32_T *d, const INT16_T *s, const FLOAT32_T *gain) {
+	UINT32_T i;
+	for (i=0; i+8<=n; i+=8) {
+		__m128i v  = _mm_loadu_si128((const __m128i *) (s+i));
+		/* sign-extend the 16-bit words by interleaving them with themselves and shifting back */
+		__m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+		__m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+		if (gain) {
+			lo = _mm_mul_ps(lo, _mm_loadu_ps(gain+i));
+			hi = _mm_mul_ps(hi, _mm_loadu_ps(gain+i+4));
+		}
+		_mm_storeu_ps(d+i,   lo);
+		_mm_storeu_ps(d+i+4, hi);
+	}
+	return i;
+}
+
+static UINT32_T convert_int32_sse2(UINT32_T n, FLOAT32_T *d, const INT32_T *s, const FLOAT32_T *gain) {
+	UINT32_T i;
+	for (i=0; i+4<=n; i+=4) {
+		__m128 v = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *) (s+i)));
+		if (gain) v = _mm_mul_ps(v, _mm_loadu_ps(gain+i));
+		_mm_storeu_ps(d+i, v);
+	}
+	return i;
+}
+#endif /* CONVERT_SSE2 */
+
+int ft_convert_float32(UINT32_T n, void *dest, UINT32_T src_type, const void *src, const FLOAT32_T *gain) {
+	UINT32_T i;
+
+	if (src_type == DATATYPE_FLOAT32 && gain == NULL) {
+		memcpy(dest, src, (size_t) n*sizeof(FLOAT32_T));
+		return 0;
+	}
+#ifdef CONVERT_SSE2
+	if (src_type == DATATYPE_INT16 || src_type == DATATYPE_INT32) {
+		UINT32_T done;
+		if (src_type == DATATYPE_INT16)
+			done = convert_int16_sse2(n, (FLOAT32_T *) dest, (const INT16_T *) src, gain);
+		else
+			done = convert_int32_sse2(n, (FLOAT32_T *) dest, (const INT32_T *) src, gain);
+		dest = (FLOAT32_T *) dest + done;
+		src  = (const char *) src + (size_t) done*wordsize_from_type(src_type);
+		if (gain) gain += done;
+		n   -= done;
+	}
+#endif
+	CONVERT_SWITCH(FLOAT32_T);
+	return 0;
+}
+
+int ft_convert_float64(UINT32_T n, void *dest, UINT32_T src_type, const void *src, const FLOAT64_T *gain) {
+	UINT32_T i;
+
+	if (src_type == DATATYPE_FLOAT64 && gain == NULL) {
+		memcpy(dest, src, (size_t) n*sizeof(FLOAT64_T));
+		return 0;
+	}
+	CONVERT_SWITCH(FLOAT64_T);
+	return 0;
+}
@@ -0,0 +1,30 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+
+#ifndef CONVERT_H
+#define CONVERT_H
+
+#include "message.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Conversion of n values of src_type to single or double precision, with an
+  optional gain per value (e.g. the resolution of each channel in a row of
+  samples). The gain can be NULL, in which case the values are only converted.
+  Source and destination should not overlap, and should be aligned to their
+  word size. Unknown source types leave the destination untouched and return -1.
+*/
+int ft_convert_float32(UINT32_T n, void *dest, UINT32_T src_type, const void *src, const FLOAT32_T *gain);
+int ft_convert_float64(UINT32_T n, void *dest, UINT32_T src_type, const void *src, const FLOAT64_T *gain);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CONVERT_H */
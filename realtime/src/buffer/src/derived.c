@@ -0,0 +1,672 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "buffer.h"
+#include "platform_includes.h"
+#include "derived.h"
+#include "ftclock.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+typedef struct ft_derived_stream {
+	ft_derived_pool_t *pool;
+	const ft_plugin_t *plugin;
+	char output[FT_STREAM_NAMELEN];
+	char source[FT_STREAM_NAMELEN];
+	char *args;
+	void *state;          /* of the plugin, NULL if it could not be initialised */
+	UINT32_T generation;  /* of the header of the source, 0 if there is none */
+	UINT32_T nchans;      /* of the source */
+	UINT32_T outchans;    /* of the derived stream */
+	UINT32_T next;        /* first sample of the source that has not been processed */
+	float *src, *dest;    /* room for FT_DERIVED_BLOCK rows */
+	waiter_t *waiter;
+	int queued;           /* in the queue of the pool */
+	int busy;             /* being processed by a worker */
+	int again;            /* notified while it was busy */
+	int restart;          /* the plugin returned FT_DERIVED_RESTART */
+} ft_derived_stream_t;
+
+struct ft_derived_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t threadID[FT_DERIVED_MAXTHREADS];
+	int numThreads;
+	int stop;
+	ft_derived_stream_t *streams[FT_DERIVED_MAXSTREAMS];
+	int numStreams;
+	ft_derived_stream_t *queue[FT_DERIVED_MAXSTREAMS];  /* every stream is queued at most once */
+	int head, count;
+	double lastPoll;
+};
+
+static const ft_plugin_t *plugins[FT_DERIVED_MAXPLUGINS];
+static int numPlugins = 0;
+static pthread_mutex_t mutexplugins = PTHREAD_MUTEX_INITIALIZER;
+
+/*****************************************************************************
+ * built-in plugins
+ *****************************************************************************/
+
+/* common average reference, subtracts the mean over the channels from every channel */
+static void *car_init(const headerdef_t *hdr, const char *labels, UINT32_T labelsize, const char *args, ft_derived_hdr_t *out) {
+	UINT32_T *nchans = (UINT32_T *) malloc(sizeof(UINT32_T));
+	if (nchans == NULL) return NULL;
+	*nchans = hdr->nchans;
+	out->nchans    = hdr->nchans;
+	out->fsample   = hdr->fsample;
+	out->labels    = labels;
+	out->labelsize = labelsize;
+	return nchans;
+}
+
+static UINT32_T car_process(void *state, UINT32_T nsamples, const float *src, float *dest) {
+	UINT32_T nchans = *((UINT32_T *) state), i, j;
+
+	for (j=0; j<nsamples; j++) {
+		const float *x = src + j*nchans;
+		float *y = dest + j*nchans;
+		double mean = 0;
+		for (i=0; i<nchans; i++) mean += x[i];
+		mean /= nchans;
+		for (i=0; i<nchans; i++) y[i] = (float) (x[i] - mean);
+	}
+	return nsamples;
+}
+
+/* second order Butterworth high- and lowpass and bandpass filters, see
+ * the Audio EQ Cookbook by R. Bristow-Johnson, and the band power as the
+ * mean square of the bandpass filtered signal over a window of samples */
+typedef struct {
+	UINT32_T nchans;
+	double b0, b1, b2, a1, a2;
+	double *z;            /* two per channel */
+	double *sum;          /* for the band power, one per channel */
+	UINT32_T window, count;
+} biquad_t;
+
+static void biquad_free(void *state) {
+	biquad_t *S = (biquad_t *) state;
+	FREE(S->z);
+	FREE(S->sum);
+	free(S);
+}
+
+static void *biquad_init(const headerdef_t *hdr, const char *labels, UINT32_T labelsize, int type, const char *args, ft_derived_hdr_t *out) {
+	double f1 = 0, f2 = 0, w0, alpha, a0, cw;
+	UINT32_T window = 0;
+	biquad_t *S;
+
+	if (type <= 1) {
+		if (args == NULL || sscanf(args, "%lf", &f1) != 1 || !(f1 > 0 && f1 < hdr->fsample/2)) return NULL;
+		w0 = 2*M_PI*f1/hdr->fsample;
+		alpha = sin(w0)/sqrt(2.0);
+	} else {
+		if (args == NULL || sscanf(args, "%lf,%lf,%u", &f1, &f2, &window) < 2 || !(f1 > 0 && f1 < f2 && f2 < hdr->fsample/2)) return NULL;
+		w0 = 2*M_PI*sqrt(f1*f2)/hdr->fsample;
+		alpha = sin(w0)/(2*sqrt(f1*f2)/(f2-f1));
+	}
+
+	S = (biquad_t *) calloc(1, sizeof(biquad_t));
+	if (S == NULL) return NULL;
+	S->nchans = hdr->nchans;
+	S->z = (double *) calloc(2*hdr->nchans, sizeof(double));
+	if (type == 3) {
+		/* by default ten values of the band power per second */
+		S->window = (window > 0) ? window : (UINT32_T) (hdr->fsample/10 + 0.5);
+		if (S->window == 0) S->window = 1;
+		S->sum = (double *) calloc(hdr->nchans, sizeof(double));
+	}
+	if (S->z == NULL || (type == 3 && S->sum == NULL)) {
+		biquad_free(S);
+		return NULL;
+	}
+
+	cw = cos(w0);
+	a0 = 1 + alpha;
+	switch (type) {
+		case 0: /* highpass */
+			S->b0 = S->b2 = (1 + cw)/2/a0;
+			S->b1 = -(1 + cw)/a0;
+			break;
+		case 1: /* lowpass */
+			S->b0 = S->b2 = (1 - cw)/2/a0;
+			S->b1 = (1 - cw)/a0;
+			break;
+		default: /* bandpass with a gain of 1 at the center frequency */
+			S->b0 = alpha/a0;
+			S->b1 = 0;
+			S->b2 = -alpha/a0;
+	}
+	S->a1 = -2*cw/a0;
+	S->a2 = (1 - alpha)/a0;
+
+	out->nchans    = hdr->nchans;
+	out->fsample   = (type == 3) ? hdr->fsample/S->window : hdr->fsample;
+	out->labels    = labels;
+	out->labelsize = labelsize;
+	return S;
+}
+
+static UINT32_T biquad_process(void *state, UINT32_T nsamples, const float *src, float *dest) {
+	biquad_t *S = (biquad_t *) state;
+	UINT32_T nchans = S->nchans, i, j, nout = 0;
+
+	for (j=0; j<nsamples; j++) {
+		const float *x = src + j*nchans;
+		for (i=0; i<nchans; i++) {
+			/* transposed direct form II */
+			double *z = S->z + 2*i;
+			double y = S->b0*x[i] + z[0];
+			z[0] = S->b1*x[i] - S->a1*y + z[1];
+			z[1] = S->b2*x[i] - S->a2*y;
+			if (S->sum) {
+				S->sum[i] += y*y;
+			} else {
+				dest[j*nchans + i] = (float) y;
+			}
+		}
+		if (S->sum && ++S->count == S->window) {
+			for (i=0; i<nchans; i++) {
+				dest[nout*nchans + i] = (float) (S->sum[i]/S->window);
+				S->sum[i] = 0;
+			}
+			S->count = 0;
+			nout++;
+		}
+	}
+	return S->sum ? nout : nsamples;
+}
+
+static void *highpass_init(const headerdef_t *hdr, const char *labels, UINT32_T labelsize, const char *args, ft_derived_hdr_t *out) {
+	return biquad_init(hdr, labels, labelsize, 0, args, out);
+}
+
+static void *lowpass_init(const headerdef_t *hdr, const char *labels, UINT32_T labelsize, const char *args, ft_derived_hdr_t *out) {
+	return biquad_init(hdr, labels, labelsize, 1, args, out);
+}
+
+static void *bandpass_init(const headerdef_t *hdr, const char *labels, UINT32_T labelsize, const char *args, ft_derived_hdr_t *out) {
+	return biquad_init(hdr, labels, labelsize, 2, args, out);
+}
+
+static void *bandpower_init(const headerdef_t *hdr, const char *labels, UINT32_T labelsize, const char *args, ft_derived_hdr_t *out) {
+	return biquad_init(hdr, labels, labelsize, 3, args, out);
+}
+
+/* arguments: none */
+static const ft_plugin_t plugin_car       = {"car", car_init, car_process, free};
+/* arguments: cutoff frequency in Hz */
+static const ft_plugin_t plugin_highpass  = {"highpass", highpass_init, biquad_process, biquad_free};
+static const ft_plugin_t plugin_lowpass   = {"lowpass", lowpass_init, biquad_process, biquad_free};
+/* arguments: lower and upper frequency in Hz, e.g. "8,12" */
+static const ft_plugin_t plugin_bandpass  = {"bandpass", bandpass_init, biquad_process, biquad_free};
+/* arguments: lower and upper frequency in Hz, and optionally the window in samples, e.g. "8,12,100" */
+static const ft_plugin_t plugin_bandpower = {"bandpower", bandpower_init, biquad_process, biquad_free};
+
+/*****************************************************************************
+ * registry of the plugins
+ *****************************************************************************/
+
+static void register_builtin(void) {
+	if (numPlugins > 0) return;
+	plugins[numPlugins++] = &plugin_car;
+	plugins[numPlugins++] = &plugin_highpass;
+	plugins[numPlugins++] = &plugin_lowpass;
+	plugins[numPlugins++] = &plugin_bandpass;
+	plugins[numPlugins++] = &plugin_bandpower;
+	plugins[numPlugins++] = &ft_plugin_montage;
+}
+
+int ft_derived_register(const ft_plugin_t *plugin) {
+	int i, result = 0;
+
+	if (plugin == NULL || plugin->name == NULL || plugin->init == NULL || plugin->process == NULL || plugin->free == NULL) return -1;
+	pthread_mutex_lock(&mutexplugins);
+	register_builtin();
+	for (i=0; i<numPlugins; i++) {
+		if (strcmp(plugins[i]->name, plugin->name) == 0) break;
+	}
+	if (i < numPlugins) {
+		/* a new version replaces the previous one */
+		plugins[i] = plugin;
+	} else if (numPlugins < FT_DERIVED_MAXPLUGINS) {
+		plugins[numPlugins++] = plugin;
+	} else {
+		result = -1;
+	}
+	pthread_mutex_unlock(&mutexplugins);
+	return result;
+}
+
+static const ft_plugin_t *find_plugin(const char *name) {
+	const ft_plugin_t *plugin = NULL;
+	int i;
+
+	pthread_mutex_lock(&mutexplugins);
+	register_builtin();
+	for (i=0; i<numPlugins; i++) {
+		if (strcmp(plugins[i]->name, name) == 0) plugin = plugins[i];
+	}
+	pthread_mutex_unlock(&mutexplugins);
+	return plugin;
+}
+
+/*****************************************************************************
+ * requests for the source and the derived stream
+ *****************************************************************************/
+
+static void free_response(message_t *response) {
+	if (response) {
+		FREE(response->buf);
+		FREE(response->def);
+		free(response);
+	}
+}
+
+/* gets the counters and the generation of the header of the source, and
+ * optionally a copy of its channel names, returns 0 on success */
+static int get_source_header(const char *source, headergen_t *hdr, char **labels, UINT32_T *labelsize) {
+	message_t request, *response = NULL;
+	messagedef_t def;
+	UINT32_T known = 0;
+	int result = -1;
+
+	def.version = VERSION;
+	def.command = GET_HDR_GEN;
+	def.bufsize = labels ? sizeof(UINT32_T) : 0;
+	request.def = &def;
+	request.buf = labels ? &known : NULL;
+
+	if (streamrequest(0, source, &request, &response) < 0) return -1;
+	if (response != NULL && response->def != NULL && response->buf != NULL &&
+		response->def->command == GET_OK && response->def->bufsize >= sizeof(headergen_t)) {
+		memcpy(hdr, response->buf, sizeof(headergen_t));
+		result = 0;
+	}
+	if (result == 0 && labels != NULL) {
+		const char *chunks = (const char *) response->buf + sizeof(headergen_t);
+		UINT32_T size = response->def->bufsize - sizeof(headergen_t), offset = 0;
+
+		*labels = NULL;
+		*labelsize = 0;
+		while (offset + sizeof(ft_chunkdef_t) <= size) {
+			const ft_chunkdef_t *cdef = (const ft_chunkdef_t *) (chunks + offset);
+			if (cdef->size > size - offset - sizeof(ft_chunkdef_t)) break;
+			if (cdef->type == FT_CHUNK_CHANNEL_NAMES && (*labels = (char *) malloc(cdef->size)) != NULL) {
+				memcpy(*labels, cdef + 1, cdef->size);
+				*labelsize = cdef->size;
+				break;
+			}
+			offset += sizeof(ft_chunkdef_t) + cdef->size;
+		}
+	}
+	free_response(response);
+	return result;
+}
+
+/* writes the header of the derived stream, returns 0 on success */
+static int put_derived_header(ft_derived_stream_t *D, const ft_derived_hdr_t *out) {
+	message_t request, *response = NULL;
+	messagedef_t def;
+	headerdef_t *hdef;
+	ft_chunkdef_t *cdef;
+	int result = -1;
+
+	def.version = VERSION;
+	def.command = PUT_HDR;
+	def.bufsize = sizeof(headerdef_t) + (out->labels ? sizeof(ft_chunkdef_t) + out->labelsize : 0);
+	request.def = &def;
+	request.buf = malloc(def.bufsize);
+	if (request.buf == NULL) return -1;
+
+	hdef = (headerdef_t *) request.buf;
+	hdef->nchans    = out->nchans;
+	hdef->nsamples  = 0;
+	hdef->nevents   = 0;
+	hdef->fsample   = out->fsample;
+	hdef->data_type = DATATYPE_FLOAT32;
+	hdef->bufsize   = def.bufsize - sizeof(headerdef_t);
+	if (out->labels) {
+		cdef = (ft_chunkdef_t *) (hdef + 1);
+		cdef->type = FT_CHUNK_CHANNEL_NAMES;
+		cdef->size = out->labelsize;
+		memcpy(cdef + 1, out->labels, out->labelsize);
+	}
+
+	if (streamrequest(0, D->output, &request, &response) >= 0 && response != NULL &&
+		response->def != NULL && response->def->command == PUT_OK) result = 0;
+	free_response(response);
+	free(request.buf);
+	return result;
+}
+
+/* reads n samples of the source into D->src, returns 0 on success */
+static int get_source_data(ft_derived_stream_t *D, UINT32_T begsample, UINT32_T n) {
+	message_t request, *response = NULL;
+	messagedef_t def;
+	datasel_ext_t sel;
+	const datadef_t *ddef;
+	int result = -1;
+
+	sel.begsample = begsample;
+	sel.endsample = begsample + n - 1;
+	sel.stride    = 1;
+	sel.data_type = DATATYPE_FLOAT32 + DATASEL_CALIBRATE;
+	sel.nchans    = 0;
+
+	def.version = VERSION;
+	def.command = GET_DAT;
+	def.bufsize = sizeof(datasel_ext_t);
+	request.def = &def;
+	request.buf = &sel;
+
+	if (streamrequest(0, D->source, &request, &response) >= 0 && response != NULL && response->def != NULL &&
+		response->buf != NULL && response->def->command == GET_OK && response->def->bufsize >= sizeof(datadef_t)) {
+		ddef = (const datadef_t *) response->buf;
+		if (ddef->nsamples == n && ddef->nchans == D->nchans && ddef->bufsize == n*D->nchans*sizeof(float) &&
+			response->def->bufsize >= sizeof(datadef_t) + ddef->bufsize) {
+			memcpy(D->src, ddef + 1, ddef->bufsize);
+			result = 0;
+		}
+	}
+	free_response(response);
+	return result;
+}
+
+/* writes n rows of D->dest to the derived stream, returns 0 on success */
+static int put_derived_data(ft_derived_stream_t *D, UINT32_T n) {
+	message_t request, *response = NULL;
+	messagedef_t def;
+	datadef_t *ddef;
+	int result = -1;
+
+	def.version = VERSION;
+	def.command = PUT_DAT;
+	def.bufsize = sizeof(datadef_t) + n*D->outchans*sizeof(float);
+	request.def = &def;
+	request.buf = malloc(def.bufsize);
+	if (request.buf == NULL) return -1;
+
+	ddef = (datadef_t *) request.buf;
+	ddef->nchans    = D->outchans;
+	ddef->nsamples  = n;
+	ddef->data_type = DATATYPE_FLOAT32;
+	ddef->bufsize   = n*D->outchans*sizeof(float);
+	memcpy(ddef + 1, D->dest, ddef->bufsize);
+
+	if (streamrequest(0, D->output, &request, &response) >= 0 && response != NULL &&
+		response->def != NULL && response->def->command == PUT_OK) result = 0;
+	free_response(response);
+	free(request.buf);
+	return result;
+}
+
+/*****************************************************************************
+ * the pool of workers
+ *****************************************************************************/
+
+/* the caller should hold the lock of the pool */
+static void enqueue(ft_derived_pool_t *P, ft_derived_stream_t *D) {
+	P->queue[(P->head + P->count) % FT_DERIVED_MAXSTREAMS] = D;
+	P->count++;
+	D->queued = 1;
+	pthread_cond_signal(&P->cond);
+}
+
+/* called by dmarequest, in the thread that writes the samples of the source */
+static void derived_notify(void *arg) {
+	ft_derived_stream_t *D = (ft_derived_stream_t *) arg;
+	ft_derived_pool_t *P = D->pool;
+
+	pthread_mutex_lock(&P->lock);
+	if (D->busy) {
+		D->again = 1;
+	} else if (!D->queued) {
+		enqueue(P, D);
+	}
+	pthread_mutex_unlock(&P->lock);
+}
+
+static void release_state(ft_derived_stream_t *D) {
+	if (D->state) D->plugin->free(D->state);
+	D->state = NULL;
+	FREE(D->src);
+	FREE(D->dest);
+}
+
+/* replaces the state of a derived stream by STATE of a plugin that was initialised
+   for NCHANS channels of the source, and writes the new header, returns 0 on success.
+   On failure, STATE is released and the previous state stays. */
+static int start_state(ft_derived_stream_t *D, void *state, UINT32_T nchans, const ft_derived_hdr_t *out) {
+	float *src, *dest;
+
+	src  = (nchans > 0) ? (float *) malloc(FT_DERIVED_BLOCK*nchans*sizeof(float)) : NULL;
+	dest = (out->nchans > 0) ? (float *) malloc(FT_DERIVED_BLOCK*out->nchans*sizeof(float)) : NULL;
+	if (src == NULL || dest == NULL || put_derived_header(D, out) != 0) {
+		FREE(src);
+		FREE(dest);
+		D->plugin->free(state);
+		return -1;
+	}
+	release_state(D);
+	D->state    = state;
+	D->src      = src;
+	D->dest     = dest;
+	D->nchans   = nchans;
+	D->outchans = out->nchans;
+	return 0;
+}
+
+/* processes the new samples of the source, returns 1 if there may be more already */
+static int derived_step(ft_derived_stream_t *D) {
+	headergen_t hdr;
+	UINT32_T n, nout;
+
+	unregister_wait(D->waiter);
+	D->waiter = NULL;
+
+	/* without a source, the poll of the pool tries again */
+	if (get_source_header(D->source, &hdr, NULL, NULL) != 0) return 0;
+
+	if (hdr.generation != D->generation || D->restart) {
+		int restart = D->restart && hdr.generation == D->generation;
+		ft_derived_hdr_t out;
+		char *labels = NULL;
+		UINT32_T labelsize = 0;
+		void *state;
+		int started;
+
+		D->restart = 0;
+		if (!restart) release_state(D);
+		if (get_source_header(D->source, &hdr, &labels, &labelsize) != 0) return 0;
+		if (restart && hdr.generation != D->generation) {
+			/* the source got a new header in the meantime */
+			release_state(D);
+			restart = 0;
+		}
+		D->generation = hdr.generation;
+
+		memset(&out, 0, sizeof(out));
+		state = D->plugin->init(&hdr.def, labels, labelsize, D->args, &out);
+		started = (state != NULL && start_state(D, state, hdr.def.nchans, &out) == 0);
+		FREE(labels);
+		if (!started) {
+			if (D->state == NULL) {
+				fprintf(stderr, "derived: cannot derive %s with %s from the stream '%s'\n", D->output, D->plugin->name, D->source);
+				return 0;
+			}
+			/* a restarted plugin continues with its previous state */
+			fprintf(stderr, "derived: cannot restart %s, keeping the previous configuration\n", D->output);
+		}
+		/* only the samples that arrive from now on are processed, but a restarted
+		   plugin continues with the block that it returned */
+		if (!restart) D->next = hdr.def.nsamples;
+	}
+	if (D->state == NULL) return 0;
+
+	while (D->next < hdr.def.nsamples) {
+		n = hdr.def.nsamples - D->next;
+		if (n > FT_DERIVED_BLOCK) n = FT_DERIVED_BLOCK;
+		if (get_source_data(D, D->next, n) != 0) {
+			/* the samples have been pushed out of the ring, continue with the newest */
+			D->next = hdr.def.nsamples;
+			break;
+		}
+		nout = D->plugin->process(D->state, n, D->src, D->dest);
+		if (nout == FT_DERIVED_RESTART) {
+			D->restart = 1;
+			return 1;
+		}
+		if (nout > 0 && put_derived_data(D, nout) != 0) {
+			fprintf(stderr, "derived: cannot write to the stream '%s'\n", D->output);
+		}
+		D->next += n;
+	}
+
+	/* NULL means that more samples have arrived in the mean time */
+	D->waiter = register_stream_wait(D->source, D->next, 0xFFFFFFFF, derived_notify, D);
+	return (D->waiter == NULL);
+}
+
+static void *derived_worker(void *arg) {
+	ft_derived_pool_t *P = (ft_derived_pool_t *) arg;
+
+	pthread_mutex_lock(&P->lock);
+	while (!P->stop) {
+		ft_derived_stream_t *D;
+		int again;
+
+		if (P->count == 0) {
+			struct timeval tp;
+			struct timespec ts;
+			double now;
+			int i;
+
+			gettimeofday(&tp, NULL);
+			ts.tv_sec  = tp.tv_sec;
+			ts.tv_nsec = 1000 * (tp.tv_usec + FT_DERIVED_POLL*1000);
+			while (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&P->cond, &P->lock, &ts);
+
+			now = ft_clock_seconds();
+			if (P->count == 0 && !P->stop && now - P->lastPoll >= FT_DERIVED_POLL/1000.0) {
+				/* look for new sources and headers */
+				P->lastPoll = now;
+				for (i=0; i<P->numStreams; i++) {
+					if (!P->streams[i]->queued && !P->streams[i]->busy) enqueue(P, P->streams[i]);
+				}
+			}
+			continue;
+		}
+
+		D = P->queue[P->head];
+		P->head = (P->head + 1) % FT_DERIVED_MAXSTREAMS;
+		P->count--;
+		D->queued = 0;
+		D->busy = 1;
+		D->again = 0;
+		pthread_mutex_unlock(&P->lock);
+
+		again = derived_step(D);
+
+		pthread_mutex_lock(&P->lock);
+		D->busy = 0;
+		if ((again || D->again) && !D->queued) enqueue(P, D);
+	}
+	pthread_mutex_unlock(&P->lock);
+	return NULL;
+}
+
+ft_derived_pool_t *ft_derived_start(int numThreads) {
+	ft_derived_pool_t *P;
+	int i;
+
+	if (numThreads < 1) numThreads = 1;
+	if (numThreads > FT_DERIVED_MAXTHREADS) numThreads = FT_DERIVED_MAXTHREADS;
+
+	P = (ft_derived_pool_t *) calloc(1, sizeof(ft_derived_pool_t));
+	if (P == NULL) return NULL;
+	pthread_mutex_init(&P->lock, NULL);
+	pthread_cond_init(&P->cond, NULL);
+
+	for (i=0; i<numThreads; i++) {
+		if (pthread_create(&P->threadID[i], NULL, derived_worker, P) != 0) break;
+		P->numThreads++;
+	}
+	if (P->numThreads == 0) {
+		ft_derived_stop(P);
+		return NULL;
+	}
+	return P;
+}
+
+/* adds a derived stream that runs the plugin on the samples of the source
+ * stream (the empty name for the default stream), returns 0 on success */
+int ft_derived_add(ft_derived_pool_t *P, const char *output, const char *plugin, const char *source, const char *args) {
+	ft_derived_stream_t *D;
+	const ft_plugin_t *pl = find_plugin(plugin);
+
+	if (P == NULL || pl == NULL || output[0] == 0 || strlen(output) >= FT_STREAM_NAMELEN || strlen(source) >= FT_STREAM_NAMELEN || strcmp(output, source) == 0) return -1;
+
+	D = (ft_derived_stream_t *) calloc(1, sizeof(ft_derived_stream_t));
+	if (D == NULL) return -1;
+	D->pool = P;
+	D->plugin = pl;
+	strcpy(D->output, output);
+	strcpy(D->source, source);
+	if (args != NULL && (D->args = strdup(args)) == NULL) {
+		free(D);
+		return -1;
+	}
+
+	pthread_mutex_lock(&P->lock);
+	if (P->numStreams == FT_DERIVED_MAXSTREAMS) {
+		pthread_mutex_unlock(&P->lock);
+		FREE(D->args);
+		free(D);
+		return -1;
+	}
+	P->streams[P->numStreams++] = D;
+	enqueue(P, D);
+	pthread_mutex_unlock(&P->lock);
+	return 0;
+}
+
+void ft_derived_stop(ft_derived_pool_t *P) {
+	int i;
+
+	if (P == NULL) return;
+	pthread_mutex_lock(&P->lock);
+	P->stop = 1;
+	pthread_cond_broadcast(&P->cond);
+	pthread_mutex_unlock(&P->lock);
+	for (i=0; i<P->numThreads; i++) pthread_join(P->threadID[i], NULL);
+
+	/* after this, dmarequest does not call derived_notify anymore */
+	for (i=0; i<P->numStreams; i++) {
+		ft_derived_stream_t *D = P->streams[i];
+		unregister_wait(D->waiter);
+		release_state(D);
+		FREE(D->args);
+		free(D);
+	}
+	pthread_cond_destroy(&P->cond);
+	pthread_mutex_destroy(&P->lock);
+	free(P);
+}
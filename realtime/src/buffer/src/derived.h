@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+
+#ifndef DERIVED_H
+#define DERIVED_H
+
+#include "message.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  A derived stream is computed once in the buffer process from the samples of
+  another stream, e.g. re-referenced, filtered or as band power, and written
+  to a named stream (see STREAM_REQ) from which any number of clients can
+  read it. Each derived stream runs a plugin.
+
+  The plugins run in a pool of worker threads. A derived stream registers a
+  waiter for the samples of its source (see register_stream_wait), which hands
+  it to a worker as soon as new samples arrive. The worker reads the samples
+  that arrived since the previous block as calibrated floats (GET_DAT with
+  DATASEL_CALIBRATE), passes them to the plugin, and writes the result to
+  the derived stream with PUT_DAT. The blocks of one derived stream are
+  processed in order and by one worker at a time, but different derived
+  streams are processed in parallel. A derived stream can be the source of
+  another one.
+
+  Whenever the header of the source changes, including the first time, the
+  previous state of the plugin is released, init is called for the new
+  header, and the derived stream gets a new header with PUT_HDR. The derived
+  stream starts with the samples of the source that arrive after that. If
+  the worker falls so far behind that samples are pushed out of the ring of
+  the source, it skips them, and the plugin continues with the samples that
+  are still there.
+
+  The workers also look at all derived streams every FT_DERIVED_POLL ms, so
+  that a source that does not exist yet, or that is flushed, is picked up.
+*/
+
+#define FT_DERIVED_MAXPLUGINS 32
+#define FT_DERIVED_MAXSTREAMS 32
+#define FT_DERIVED_MAXTHREADS 16
+#define FT_DERIVED_BLOCK      4096  /* largest number of samples that is passed to the plugin at once */
+#define FT_DERIVED_POLL       100   /* in ms */
+#define FT_DERIVED_RESTART    0xFFFFFFFF  /* returned by process, see ft_plugin_t */
+
+/* the header of the derived stream, as set by the init function of a plugin */
+typedef struct {
+	UINT32_T nchans;
+	float fsample;
+	const char *labels;   /* nchans zero-terminated names, or NULL for none */
+	UINT32_T labelsize;   /* size of the labels in bytes */
+} ft_derived_hdr_t;
+
+/*
+  init     is called for every new header of the source, with the labels of its
+           channels (NULL if it has none) and the arguments of the derived
+           stream. It fills in OUT and returns the state of the plugin, or
+           NULL if the source or the arguments are not suitable. The labels
+           in OUT have to remain valid until the next call of the plugin.
+  process  is called for every block of samples of the source, with nsamples
+           rows of hdr->nchans floats. It writes at most nsamples rows of
+           out->nchans floats to DEST, and returns the number of rows. It can
+           return FT_DERIVED_RESTART instead if the derived stream needs a new
+           header, e.g. because its configuration changed. Init is then called
+           again, and the same block is processed with the new state. If init
+           fails, the previous state is kept and processes the block instead.
+  free     releases the state.
+*/
+typedef struct {
+	const char *name;
+	void *(*init)(const headerdef_t *hdr, const char *labels, UINT32_T labelsize, const char *args, ft_derived_hdr_t *out);
+	UINT32_T (*process)(void *state, UINT32_T nsamples, const float *src, float *dest);
+	void (*free)(void *state);
+} ft_plugin_t;
+
+typedef struct ft_derived_pool ft_derived_pool_t;
+
+/* adds a plugin to those that derived streams can use, besides the built-in
+ * "car", "highpass", "lowpass", "bandpass" and "bandpower", see derived.c,
+ * and "montage", see montage.c */
+int ft_derived_register(const ft_plugin_t *plugin);
+
+extern const ft_plugin_t ft_plugin_montage;
+
+ft_derived_pool_t *ft_derived_start(int numThreads);
+int ft_derived_add(ft_derived_pool_t *P, const char *output, const char *plugin, const char *source, const char *args);
+void ft_derived_stop(ft_derived_pool_t *P);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DERIVED_H */
@@ -14,20 +14,46 @@
 
 #include "buffer.h"
 #include "platform_includes.h"
-
-/* FIXME should these be static? */
-static header_t   *header   = NULL;
-static data_t     *data     = NULL;
-static event_t    *event    = NULL;
-
-/* these are used for fine-tuning the sample number of incoming events */
-struct timespec putdat_clock;
-struct timespec putevt_clock;
-
-static unsigned int current_max_num_sample = 0;
-
-static int thissample = 0;    /* points at the buffer */
-static int thisevent = 0;     /* points at the buffer */
+#include "atomicutil.h"
+#include "shmbuffer.h"
+#include "eventindex.h"
+#include "bufstats.h"
+#include "endianutil.h"
+#include "spillfile.h"
+#include "placement.h"
+#include "ringfile.h"
+
+/* Clients that are waiting for data or events (WAIT_DAT) are registered in two
+ * lists, one sorted on the sample threshold and one sorted on the event
+ * threshold. Whenever samples or events come in, only the waiters at the head
+ * of the lists whose threshold has been exceeded are woken up. All of this is
+ * protected by mutexwait, which also protects the copies of the number of
+ * samples and events that are used for evaluating the thresholds.
+ *
+ * Waiters with an event filter (see waitevt_t) are also kept in a third list
+ * until a matching event has come in, which is evaluated by store_events. The
+ * sample threshold of the waiter is then lowered to the sample of that event
+ * plus the requested number of samples after it. The order of locking is
+ * mutexheader, mutexevent and then mutexwait.
+ */
+struct waiter_s {
+	samples_events_t threshold;     /* wake up if MORE samples or MORE events than this */
+	int woken;                      /* set once the threshold has been exceeded */
+	double wakeup_time;             /* time at which the threshold was exceeded */
+	pthread_cond_t *cond;           /* used by blocking waiters (WAIT_DAT in dmarequest) */
+	void (*notify)(void *);         /* used by asynchronous waiters, see register_wait */
+	void *arg;
+	struct ft_stream_s *stream;     /* the stream in whose lists the waiter is registered */
+	struct waiter_s *prevS, *nextS; /* list sorted on threshold.nsamples */
+	struct waiter_s *prevE, *nextE; /* list sorted on threshold.nevents */
+	struct waiter_s *prevF, *nextF; /* list of waiters with a filter that have not matched yet */
+	const void *filter;             /* the event filter, or NULL */
+	UINT32_T filtersize;
+	waitevt_t waitevt;
+	int matched;                    /* set once an event has matched the filter */
+	UINT32_T matchevent;            /* the number of that event */
+	UINT32_T matchsample;           /* the sample threshold that belongs to that event */
+};
 
 /* Note that there have been problems with the order of the mutexes (e.g.
  * http://bugzilla.fcdonders.nl/show_bug.cgi?id=933).
@@ -44,110 +70,2172 @@ static int thisevent = 0;     /* points at the buffer */
  * -- Boris
  */
 
-pthread_mutex_t mutexheader   = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t mutexdata     = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t mutexevent    = PTHREAD_MUTEX_INITIALIZER;
+/* The sample ring has a single writer (PUT_DAT, serialized by mutexdata) and
+ * many readers (GET_DAT). Readers do not take mutexheader or mutexdata, but
+ * only hold rwlockring in shared mode, just like the writer does. The ring
+ * geometry can therefore only change (PUT_HDR, FLUSH_HDR, FLUSH_DAT) when
+ * neither readers nor the writer are active.
+ *
+ * The writer publishes its progress through a sequence counter: ring->seq is
+ * odd while the counters below are being updated. Before copying a block
+ * into the ring, the writer announces the range that it is about to
+ * overwrite by increasing ring->writelimit. A reader takes a consistent
+ * snapshot of ring->nsamples, copies the samples, and afterwards checks
+ * ring->writelimit to determine whether the writer has overwritten (part of)
+ * the selection while it was copying. In that case the reader returns
+ * GET_ERR rather than torn data, and the condition is counted in
+ * ring_overwrites.
+ */
+
+/* Everything that belongs to one header, its sample ring and its events is
+ * kept in a stream. Besides the default stream, which has an empty name and
+ * which is used by all requests that do not select a stream, a client can
+ * create named streams with a PUT_HDR wrapped in a STREAM_REQ (see message.h).
+ * The streams have their own locks, so requests for different streams never
+ * wait for each other. Streams are never removed, FLUSH_HDR only removes
+ * their header, data and events.
+ */
+typedef struct ft_stream_s {
+	char name[FT_STREAM_NAMELEN];
+
+	header_t   *header;
+	data_t     *data;
+	event_t    *event;
+
+	/* increased whenever the header is replaced or flushed, protected by mutexheader */
+	UINT32_T   header_generation;
+
+	/* the number of bytes that fit behind the eventdef_t of each event slot */
+	UINT32_T   *eventslot;
+
+	/* this is used for selecting events on the server, it is protected by mutexevent */
+	ft_event_index_t event_index;
+
+	/* these are used for fine-tuning the sample number of incoming events */
+	UINT64_T putdat_clock;          /* in nanoseconds, see ftclock.h */
+	UINT64_T putevt_clock;
+
+	unsigned int current_max_num_sample;
+	unsigned int current_max_num_event;
+
+	int thissample;    /* points at the buffer */
+	int thisevent;     /* points at the buffer */
+
+	/* the side ring with the times of the blocks that were written with PUT_DAT_T, protected by mutexdata */
+	timestamp_t *stamps;
+	UINT32_T numstamps;  /* number of timestamps since the data was last flushed */
+
+	pthread_mutex_t mutexheader;
+	pthread_mutex_t mutexdata;
+	pthread_mutex_t mutexevent;
+	pthread_rwlock_t rwlockring;
+
+	waiter_t *waitlist_samples;
+	waiter_t *waitlist_events;
+	waiter_t *waitlist_filter;
+	UINT32_T wait_nsamples;
+	UINT32_T wait_nevents;
+	pthread_mutex_t mutexwait;
+
+	/* The counters of the sample and event ring are kept in a control block,
+	 * which is moved to shared memory if enable_shared_memory has been called.
+	 * Clients on the same host can then read the ring directly, see shmbuffer.c
+	 * This is only possible for the default stream.
+	 */
+	ft_shm_control_t ring_local;
+	ft_shm_control_t *ring;
+	int ring_shared;
+
+	/* the memory of data->buf if the ring is not shared, see set_buffer_memory */
+	ft_ringmem_t ringmem;
+
+	/* The header, the ring and a copy of the events can also be kept in a
+	 * memory mapped file, in which case the control block is part of the
+	 * file as well, see enable_ring_file. This is only possible for the
+	 * default stream, and not together with shared memory.
+	 */
+	ft_ringfile_t *ringfile;
+
+	/* The samples can also be copied to a spill file by a background thread,
+	 * so that GET_DAT can still return them after they have been overwritten
+	 * in the ring, see enable_spill_file. The samples from spill_first up to
+	 * spill_end can be read from the file. The generation is increased
+	 * whenever the samples are numbered from 0 again.
+	 */
+	ft_spill_t *spill;
+	pthread_t spill_thread;
+	pthread_mutex_t mutexspill;  /* protects the fields below */
+	pthread_cond_t condspill;
+	int spill_pending;
+	int spill_stop;
+	UINT32_T spill_generation;
+	UINT32_T spill_first;
+	UINT32_T spill_end;
+
+	struct ft_stream_s *next;
+} ft_stream_t;
+
+/* the default stream is the first in the list, new streams are appended while
+ * holding mutexstreams and are only published once they have been initialized
+ */
+static ft_stream_t default_stream;
+static ft_stream_t *last_stream = &default_stream;
+static unsigned int num_streams = 1;
+static pthread_once_t streams_once = PTHREAD_ONCE_INIT;
+
+/* this also protects the capacity settings below */
+pthread_mutex_t mutexstreams = PTHREAD_MUTEX_INITIALIZER;
+
+/* the size of the ring that is created on the next PUT_HDR, see set_buffer_capacity */
+static UINT32_T max_num_sample = MAXNUMSAMPLE;
+static UINT64_T max_num_byte   = 0;   /* memory budget for the sample ring, 0 for the default heuristic in init_data */
+static UINT32_T max_num_event  = MAXNUMEVENT;
 
-pthread_cond_t getData_cond   = PTHREAD_COND_INITIALIZER;
-pthread_mutex_t getData_mutex = PTHREAD_MUTEX_INITIALIZER;
+static waitstats_t wait_statistics = {0, 0.0, 0.0};
+
+pthread_mutex_t mutexwaitstats = PTHREAD_MUTEX_INITIALIZER;
+
+static volatile UINT32_T ring_overwrites = 0; /* number of GET_DAT requests that were overwritten during the copy */
+
+pthread_mutex_t mutexoverwrites = PTHREAD_MUTEX_INITIALIZER;
 
 /*****************************************************************************/
 
-void free_header() {
+static void init_stream(ft_stream_t *st, const char *name) {
+	memset(st, 0, sizeof(ft_stream_t));
+	strncpy(st->name, name, FT_STREAM_NAMELEN-1);
+	pthread_mutex_init(&st->mutexheader, NULL);
+	pthread_mutex_init(&st->mutexdata, NULL);
+	pthread_mutex_init(&st->mutexevent, NULL);
+	pthread_rwlock_init(&st->rwlockring, NULL);
+	pthread_mutex_init(&st->mutexwait, NULL);
+	pthread_mutex_init(&st->mutexspill, NULL);
+	pthread_cond_init(&st->condspill, NULL);
+	st->ring = &st->ring_local;
+}
+
+static void init_default_stream(void) {
+	init_stream(&default_stream, "");
+}
+
+static ft_stream_t *get_default_stream(void) {
+	pthread_once(&streams_once, init_default_stream);
+	return &default_stream;
+}
+
+/* returns the stream with the given name, which is created if it does not
+ * exist yet and create is set. Returns NULL if the stream does not exist, or
+ * if it could not be created.
+ */
+static ft_stream_t *find_stream(const char *name, int create) {
+	ft_stream_t *st;
+
+	/* the list is only appended to, so it can be searched without locking */
+	for (st = get_default_stream(); st != NULL; st = st->next) {
+		if (strcmp(st->name, name) == 0) return st;
+	}
+	if (!create) return NULL;
+
+	pthread_mutex_lock(&mutexstreams);
+	/* another thread may have created it in the meantime */
+	for (st = &default_stream; st != NULL; st = st->next) {
+		if (strcmp(st->name, name) == 0) break;
+	}
+	if (st == NULL && num_streams < FT_MAXNUMSTREAM) {
+		st = (ft_stream_t *) malloc(sizeof(ft_stream_t));
+		if (st != NULL) {
+			init_stream(st, name);
+			MEMORY_BARRIER();
+			last_stream->next = st;
+			last_stream = st;
+			num_streams++;
+		}
+	}
+	pthread_mutex_unlock(&mutexstreams);
+	if (st == NULL) fprintf(stderr, "dmarequest: could not create stream '%s'\n", name);
+	return st;
+}
+
+/*****************************************************************************/
+
+/* These take the locks of the header, data, events and sample ring, and
+ * keep track of the time spent waiting for them (see GET_STATS). The lock
+ * is first tried without blocking, so the clock is only read under contention.
+ */
+static void lock_mutex(pthread_mutex_t *mutex) {
+	UINT64_T start;
+	if (pthread_mutex_trylock(mutex) == 0) {
+		ft_stats_lockwait(0);
+		return;
+	}
+	start = ft_stats_clock();
+	pthread_mutex_lock(mutex);
+	ft_stats_lockwait(ft_stats_elapsed(start));
+}
+
+static void lock_ring_shared(ft_stream_t *st) {
+	UINT64_T start;
+	if (pthread_rwlock_tryrdlock(&st->rwlockring) == 0) {
+		ft_stats_lockwait(0);
+		return;
+	}
+	start = ft_stats_clock();
+	pthread_rwlock_rdlock(&st->rwlockring);
+	ft_stats_lockwait(ft_stats_elapsed(start));
+}
+
+static void lock_ring_exclusive(ft_stream_t *st) {
+	UINT64_T start;
+	if (pthread_rwlock_trywrlock(&st->rwlockring) == 0) {
+		ft_stats_lockwait(0);
+		return;
+	}
+	start = ft_stats_clock();
+	pthread_rwlock_wrlock(&st->rwlockring);
+	ft_stats_lockwait(ft_stats_elapsed(start));
+}
+
+/*****************************************************************************/
+
+/* announce that the samples up to writelimit are about to be written */
+static void ring_begin_write(ft_stream_t *st, UINT32_T writelimit) {
+	st->ring->writelimit = writelimit;
+	MEMORY_BARRIER();
+}
+
+/* publish the samples that have been written */
+static void ring_end_write(ft_stream_t *st, UINT32_T nsamples) {
+	MEMORY_BARRIER();
+	st->ring->seq++;
+	MEMORY_BARRIER();
+	st->ring->nsamples = nsamples;
+	MEMORY_BARRIER();
+	st->ring->seq++;
+	MEMORY_BARRIER();
+}
+
+/* empty the sample ring, this is only called while rwlockring is held exclusively */
+static void ring_reset(ft_stream_t *st) {
+	MEMORY_BARRIER();
+	st->ring->seq++;
+	MEMORY_BARRIER();
+	st->ring->nflush++;
+	st->ring->nsamples    = 0;
+	st->ring->writelimit  = 0;
+	st->ring->firstsample = 0;
+	MEMORY_BARRIER();
+	st->ring->seq++;
+	MEMORY_BARRIER();
+
+	/* the samples in the spill file no longer belong to this ring */
+	pthread_mutex_lock(&st->mutexspill);
+	st->spill_generation++;
+	st->spill_first = st->spill_end = 0;
+	pthread_mutex_unlock(&st->mutexspill);
+}
+
+/* publish the events that have been written, there is a single writer (PUT_EVT, serialized by mutexevent) */
+static void ring_end_event(ft_stream_t *st, UINT32_T nevents) {
+	MEMORY_BARRIER();
+	st->ring->nevents = nevents;
+	MEMORY_BARRIER();
+}
+
+/* empty the event ring */
+static void ring_reset_event(ft_stream_t *st) {
+	MEMORY_BARRIER();
+	st->ring->evtflush++;
+	st->ring->evtwritelimit = 0;
+	st->ring->nevents = 0;
+	st->ring->firstevent = 0;
+	MEMORY_BARRIER();
+}
+
+/* returns a consistent snapshot of the number of readable samples */
+static UINT32_T ring_snapshot(ft_stream_t *st) {
+	UINT32_T seq, nsamples;
+	for (;;) {
+		seq = st->ring->seq;
+		MEMORY_BARRIER();
+		if (seq & 1) continue; /* the writer is updating the counters */
+		nsamples = st->ring->nsamples;
+		MEMORY_BARRIER();
+		if (seq == st->ring->seq) return nsamples;
+	}
+}
+
+/* returns the oldest sample that is still in the ring, given the number of samples */
+static UINT32_T oldest_sample(ft_stream_t *st, UINT32_T nsamples) {
+	UINT32_T first = (nsamples > st->current_max_num_sample) ? nsamples - st->current_max_num_sample : 0;
+	return (first > st->ring->firstsample) ? first : st->ring->firstsample;
+}
+
+/* returns the oldest event that is still in the ring, given the number of events */
+static UINT32_T oldest_event(ft_stream_t *st, UINT32_T nevents) {
+	UINT32_T first = (nevents > st->current_max_num_event) ? nevents - st->current_max_num_event : 0;
+	return (first > st->ring->firstevent) ? first : st->ring->firstevent;
+}
+
+/* copies n samples from the ring, the caller should hold rwlockring and has to check for overwrites afterwards */
+static void copy_ring_samples(ft_stream_t *st, void *dest, UINT32_T begsample, UINT32_T n) {
+	unsigned int chansize = wordsize_from_type(st->data->def->data_type) * st->data->def->nchans;
+	unsigned int start = begsample % st->current_max_num_sample;
+	unsigned int na = (start + n <= st->current_max_num_sample) ? n : st->current_max_num_sample - start;
+
+	memcpy(dest, (char *) st->data->buf + (size_t) start*chansize, (size_t) na*chansize);
+	if (na < n) memcpy((char *) dest + (size_t) na*chansize, st->data->buf, (size_t) (n-na)*chansize);
+}
+
+/* returns the number of GET_DAT requests that failed because the data was overwritten during the copy */
+UINT32_T get_overwrite_count(void) {
+	UINT32_T count;
+	pthread_mutex_lock(&mutexoverwrites);
+	count = ring_overwrites;
+	pthread_mutex_unlock(&mutexoverwrites);
+	return count;
+}
+
+/*****************************************************************************/
+
+static double wait_time(void) {
+	return ft_clock_seconds();
+}
+
+/* insert waiter W in both sorted lists, this should be called with mutexwait locked */
+static void waitlist_insert(waiter_t *W) {
+	ft_stream_t *st = W->stream;
+	waiter_t **P, *prev;
+
+	prev = NULL;
+	for (P = &st->waitlist_samples; *P != NULL && (*P)->threshold.nsamples < W->threshold.nsamples; P = &(*P)->nextS) prev = *P;
+	W->prevS = prev;
+	W->nextS = *P;
+	if (*P) (*P)->prevS = W;
+	*P = W;
+
+	prev = NULL;
+	for (P = &st->waitlist_events; *P != NULL && (*P)->threshold.nevents < W->threshold.nevents; P = &(*P)->nextE) prev = *P;
+	W->prevE = prev;
+	W->nextE = *P;
+	if (*P) (*P)->prevE = W;
+	*P = W;
+
+	W->prevF = W->nextF = NULL;
+	if (W->filter != NULL && !W->matched) {
+		W->nextF = st->waitlist_filter;
+		if (st->waitlist_filter) st->waitlist_filter->prevF = W;
+		st->waitlist_filter = W;
+	}
+}
+
+/* remove waiter W from both lists, this should be called with mutexwait locked */
+static void waitlist_remove(waiter_t *W) {
+	ft_stream_t *st = W->stream;
+	if (W->prevS) W->prevS->nextS = W->nextS; else st->waitlist_samples = W->nextS;
+	if (W->nextS) W->nextS->prevS = W->prevS;
+	if (W->prevE) W->prevE->nextE = W->nextE; else st->waitlist_events = W->nextE;
+	if (W->nextE) W->nextE->prevE = W->prevE;
+	if (W->prevF || st->waitlist_filter == W) {
+		if (W->prevF) W->prevF->nextF = W->nextF; else st->waitlist_filter = W->nextF;
+		if (W->nextF) W->nextF->prevF = W->prevF;
+	}
+	W->prevS = W->nextS = W->prevE = W->nextE = W->prevF = W->nextF = NULL;
+}
+
+static void waitlist_wake(waiter_t *W, double now) {
+	waitlist_remove(W);
+	W->woken = 1;
+	W->wakeup_time = now;
+	if (W->cond) pthread_cond_signal(W->cond);
+	if (W->notify) W->notify(W->arg);
+}
+
+/* update the number of samples and events, and wake up the waiters whose threshold has been exceeded */
+static void notify_waiters(ft_stream_t *st, UINT32_T nsamples, UINT32_T nevents) {
+	double now = 0;
+	if (st->spill) {
+		/* the spill writer copies the new samples without blocking the caller */
+		pthread_mutex_lock(&st->mutexspill);
+		st->spill_pending = 1;
+		pthread_cond_signal(&st->condspill);
+		pthread_mutex_unlock(&st->mutexspill);
+	}
+	pthread_mutex_lock(&st->mutexwait);
+	st->wait_nsamples = nsamples;
+	st->wait_nevents  = nevents;
+	if ((st->waitlist_samples && st->waitlist_samples->threshold.nsamples < nsamples) || (st->waitlist_events && st->waitlist_events->threshold.nevents < nevents)) {
+		now = wait_time();
+		while (st->waitlist_samples && st->waitlist_samples->threshold.nsamples < nsamples) waitlist_wake(st->waitlist_samples, now);
+		while (st->waitlist_events && st->waitlist_events->threshold.nevents < nevents) waitlist_wake(st->waitlist_events, now);
+	}
+	pthread_mutex_unlock(&st->mutexwait);
+}
+
+/* Looks for the first event from begevent onwards that matches the filter of
+ * W, and lowers the sample threshold of W accordingly. MATCH should have room
+ * for the numbers of the events from begevent onwards. W should not be in the
+ * lists, and the caller should hold mutexheader and mutexevent.
+ */
+static void waiter_match_event(ft_stream_t *st, waiter_t *W, UINT32_T begevent, UINT32_T *match) {
+	UINT32_T nevents, sample;
+	INT32_T evsample;
+
+	if (W->matched || st->header==NULL || st->event==NULL) return;
+	nevents = st->header->def->nevents;
+	if (begevent < W->waitevt.begevent) begevent = W->waitevt.begevent;
+	if (begevent < oldest_event(st, nevents)) begevent = oldest_event(st, nevents);
+	if (begevent >= nevents) return;
+	if (ft_evidx_find(&st->event_index, st->event, begevent, nevents-1, W->filtersize, W->filter, match) == 0) return;
+
+	evsample = st->event[match[0] % st->current_max_num_event].def->sample;
+	sample = (evsample < 0) ? 0 : (UINT32_T) evsample;
+	W->matched = 1;
+	W->matchevent = match[0];
+	/* wake up once there are MORE samples than the event and the samples after it */
+	W->matchsample = (W->waitevt.postsamples < 0xFFFFFFFF - sample) ? sample + W->waitevt.postsamples : 0xFFFFFFFF;
+	if (W->matchsample < W->threshold.nsamples) W->threshold.nsamples = W->matchsample;
+}
+
+/* evaluates the filters of the waiters on the events from begevent onwards,
+ * which have just been stored. The caller should hold mutexheader and mutexevent.
+ */
+static void match_filter_waiters(ft_stream_t *st, UINT32_T begevent) {
+	waiter_t *W, *next;
+	UINT32_T *match = NULL;
+
+	pthread_mutex_lock(&st->mutexwait);
+	for (W = st->waitlist_filter; W != NULL; W = next) {
+		next = W->nextF;
+		if (match == NULL) {
+			match = (UINT32_T *) malloc((st->header->def->nevents - begevent) * sizeof(UINT32_T));
+			if (match == NULL) break;
+		}
+		/* the threshold may change, which changes the position in the sorted lists */
+		waitlist_remove(W);
+		waiter_match_event(st, W, begevent, match);
+		waitlist_insert(W);
+		if (st->wait_nsamples > W->threshold.nsamples) waitlist_wake(W, wait_time());
+	}
+	pthread_mutex_unlock(&st->mutexwait);
+	FREE(match);
+}
+
+/* prepares W for a WAIT_DAT with an event filter, and matches the filter
+ * against the events that are in the buffer already. The caller should hold
+ * mutexheader and mutexevent. Returns -1 if out of memory.
+ */
+static int waiter_init_filter(ft_stream_t *st, waiter_t *W, const waitevt_t *waitevt, UINT32_T filtersize, const void *filter) {
+	UINT32_T begevent, *match;
+
+	W->filter     = filter;
+	W->filtersize = filtersize;
+	W->waitevt    = *waitevt;
+	W->matched    = 0;
+	if (st->header==NULL || st->event==NULL) return 0;
+
+	begevent = oldest_event(st, st->header->def->nevents);
+	if (begevent < waitevt->begevent) begevent = waitevt->begevent;
+	if (begevent >= st->header->def->nevents) return 0;
+	match = (UINT32_T *) malloc((st->header->def->nevents - begevent) * sizeof(UINT32_T));
+	if (match == NULL) return -1;
+	waiter_match_event(st, W, begevent, match);
+	free(match);
+	return 0;
+}
+
+/* fills in the response to WAIT_DAT, followed by the matching event if
+ * the wakeup was caused by one. The caller should not hold any of the locks.
+ */
+static void wait_response(ft_stream_t *st, message_t *response, const samples_events_t *nse, int matched, UINT32_T matchevent, ft_msgpool_t *pool) {
+	const event_t *ev = NULL;
+	UINT32_T size = sizeof(samples_events_t);
+	char *ptr;
+
+	if (matched) {
+		size += sizeof(UINT32_T);
+		lock_mutex(&st->mutexheader);
+		lock_mutex(&st->mutexevent);
+		if (st->header && st->event && matchevent < st->header->def->nevents && matchevent >= oldest_event(st, st->header->def->nevents)) {
+			ev = &st->event[matchevent % st->current_max_num_event];
+			size += sizeof(eventdef_t) + ev->def->bufsize;
+		}
+	}
+	ptr = (char *) ft_msgpool_alloc(pool, size);
+	if (ptr == NULL) {
+		/* highly unlikely, but we cannot allocate the response - return an error */
+		response->def->command = WAIT_ERR;
+		response->def->bufsize = 0;
+	} else {
+		memcpy(ptr, nse, sizeof(samples_events_t));
+		if (matched) memcpy(ptr + sizeof(samples_events_t), &matchevent, sizeof(UINT32_T));
+		if (ev) {
+			memcpy(ptr + sizeof(samples_events_t) + sizeof(UINT32_T), ev->def, sizeof(eventdef_t));
+			memcpy(ptr + sizeof(samples_events_t) + sizeof(UINT32_T) + sizeof(eventdef_t), ev->buf, ev->def->bufsize);
+		}
+		response->def->command = WAIT_OK;
+		response->def->bufsize = size;
+		response->buf = ptr;
+	}
+	if (matched) {
+		pthread_mutex_unlock(&st->mutexevent);
+		pthread_mutex_unlock(&st->mutexheader);
+	}
+}
+
+/* records the samples above the threshold of a WAIT_DAT request that returns */
+static void trace_wakeup(const ft_stream_t *st, const samples_events_t *threshold, const samples_events_t *nse) {
+	if (st == &default_stream && nse->nsamples > threshold->nsamples) {
+		ft_trace_point(FT_TRACE_WAKEUP, threshold->nsamples, nse->nsamples, 0);
+	}
+}
+
+/* keep track of the latency between exceeding the threshold and the waiter being woken up */
+static void update_wait_statistics(double latency) {
+	pthread_mutex_lock(&mutexwaitstats);
+	wait_statistics.count++;
+	wait_statistics.total += latency;
+	if (latency > wait_statistics.maximum) wait_statistics.maximum = latency;
+	pthread_mutex_unlock(&mutexwaitstats);
+}
+
+/* returns the statistics of the WAIT_DAT wakeup latency, of all streams together */
+void get_wait_statistics(waitstats_t *stats) {
+	pthread_mutex_lock(&mutexwaitstats);
+	*stats = wait_statistics;
+	pthread_mutex_unlock(&mutexwaitstats);
+}
+
+/* Register an asynchronous waiter that calls NOTIFY(ARG) once there are more
+ * samples or events than the given thresholds. The callback is executed
+ * from the thread that writes the data or events, and should return quickly.
+ * Returns NULL if the threshold has already been exceeded (NOTIFY is not called
+ * in that case), or a handle that should be passed to unregister_wait.
+ */
+waiter_t *register_wait(UINT32_T nsamples, UINT32_T nevents, void (*notify)(void *), void *arg) {
+	return register_stream_wait("", nsamples, nevents, notify, arg);
+}
+
+/* The same for the stream with the given name, the empty name is the default
+ * stream. If the stream does not exist, this also returns NULL.
+ */
+waiter_t *register_stream_wait(const char *name, UINT32_T nsamples, UINT32_T nevents, void (*notify)(void *), void *arg) {
+	return register_stream_wait_event(name, nsamples, nevents, NULL, 0, NULL, notify, arg);
+}
+
+/* The same with an event filter as in WAIT_DAT (see waitevt_t), which should
+ * have been checked with ft_evidx_check_filter. The filter is copied. This
+ * returns NULL if a matching event and the samples after it are already in
+ * the buffer. Without a waitevt_t, the filter is ignored.
+ */
+waiter_t *register_stream_wait_event(const char *name, UINT32_T nsamples, UINT32_T nevents, const waitevt_t *waitevt, UINT32_T filtersize, const void *filter, void (*notify)(void *), void *arg) {
+	ft_stream_t *st = find_stream(name, 0);
+	waiter_t *W;
+
+	if (st == NULL) return NULL;
+	W = (waiter_t *) malloc(sizeof(waiter_t) + (waitevt ? filtersize : 0));
+	DIE_BAD_MALLOC(W);
+	W->threshold.nsamples = nsamples;
+	W->threshold.nevents  = nevents;
+	W->woken  = 0;
+	W->cond   = NULL;
+	W->notify = notify;
+	W->arg    = arg;
+	W->stream = st;
+	W->filter = NULL;
+	W->matched = 0;
+
+	if (waitevt) {
+		memcpy(W+1, filter, filtersize);
+		lock_mutex(&st->mutexheader);
+		lock_mutex(&st->mutexevent);
+		if (waiter_init_filter(st, W, waitevt, filtersize, W+1) != 0) W->filter = NULL;
+		pthread_mutex_lock(&st->mutexwait);
+		pthread_mutex_unlock(&st->mutexevent);
+		pthread_mutex_unlock(&st->mutexheader);
+	}
+	else {
+		pthread_mutex_lock(&st->mutexwait);
+	}
+	if (st->wait_nsamples > W->threshold.nsamples || st->wait_nevents > W->threshold.nevents) {
+		pthread_mutex_unlock(&st->mutexwait);
+		free(W);
+		return NULL;
+	}
+	waitlist_insert(W);
+	pthread_mutex_unlock(&st->mutexwait);
+	ft_stats_wait_begin();
+	return W;
+}
+
+/* Remove an asynchronous waiter, this is safe to call after it has been notified */
+void unregister_wait(waiter_t *W) {
+	double latency = -1;
+	if (W == NULL) return;
+	pthread_mutex_lock(&W->stream->mutexwait);
+	if (W->woken) {
+		latency = wait_time() - W->wakeup_time;
+	} else {
+		waitlist_remove(W);
+	}
+	pthread_mutex_unlock(&W->stream->mutexwait);
+	if (latency >= 0) update_wait_statistics(latency);
+	ft_stats_wait_end();
+	free(W);
+}
+
+/* Wakes up the WAIT_DAT requests that block in dmarequest, they respond with
+ * the current number of samples and events as if their timeout had passed.
+ * The waiters of register_wait are left alone.
+ */
+void wake_waiters(void) {
+	ft_stream_t *st;
+	waiter_t *W, *next;
+	double now = wait_time();
+
+	for (st = get_default_stream(); st != NULL; st = st->next) {
+		pthread_mutex_lock(&st->mutexwait);
+		for (W = st->waitlist_samples; W != NULL; W = next) {
+			next = W->nextS;
+			if (W->cond) waitlist_wake(W, now);
+		}
+		pthread_mutex_unlock(&st->mutexwait);
+	}
+}
+
+/*****************************************************************************/
+
+static void free_stream_header(ft_stream_t *st) {
 	int verbose = 0;
 	if (verbose>0) fprintf(stderr, "free_header: freeing header buffer\n");
-	if (header) {
-		FREE(header->def);
-		FREE(header->buf);
-		FREE(header);
+	if (st->header) {
+		FREE(st->header->def);
+		FREE(st->header->buf);
+		FREE(st->header);
 	}
+	/* the generation is never 0, see GET_HDR_GEN */
+	if (++st->header_generation == 0) st->header_generation = 1;
 }
 
-void free_data() {
+/* with keep, the memory of a ring that is not shared is kept for the next
+ * PUT_HDR, see init_data */
+static void free_stream_data(ft_stream_t *st, int keep) {
 	int verbose = 0;
 	if (verbose>0) fprintf(stderr, "free_data: freeing data buffer\n");
-	if (data) {
-		FREE(data->def);
-		FREE(data->buf);
-		FREE(data);
+	if (st->data) {
+		FREE(st->data->def);
+		if (st->ring_shared) {
+			ft_shm_server_free();
+		}
+		else if (st->ringfile) {
+			ft_ringfile_free(st->ringfile);
+		}
+		else if (!keep) {
+			ft_ringmem_free(&st->ringmem);
+		}
+		st->data->buf = NULL;
+		FREE(st->data);
 	}
-	thissample = 0;
-	if (header) header->def->nsamples = 0;
+	FREE(st->stamps);
+	st->numstamps = 0;
+	st->thissample = 0;
+	ring_reset(st);
+	if (st->header) st->header->def->nsamples = 0;
 }
 
-void free_event() {
+/* Each event is kept in a single allocation, in which the eventdef_t is
+ * followed by its type and value. The size of that is rounded up to a power
+ * of two, and slots keep their allocation when their event is overwritten or
+ * flushed, so that storing events does not allocate once the ring is in use.
+ */
+#define EVENT_SLOT_MINSIZE 64
+
+static void free_event_slot(ft_stream_t *st, UINT32_T i) {
+	FREE(st->event[i].def);
+	st->event[i].buf = NULL;
+	st->eventslot[i] = 0;
+}
+
+/* makes sure that slot i can hold an event with the given bufsize, returns 0 on success */
+static int reserve_event_slot(ft_stream_t *st, UINT32_T i, UINT32_T bufsize) {
+	UINT32_T size = EVENT_SLOT_MINSIZE;
+	eventdef_t *def;
+
+	if (st->event[i].def != NULL && st->eventslot[i] >= bufsize)
+		return 0;
+	while (size < bufsize && size < 0x80000000u)
+		size <<= 1;
+	if (size < bufsize)
+		size = bufsize;
+	def = (eventdef_t *) malloc(sizeof(eventdef_t) + size);
+	if (def == NULL)
+		return -1;
+	free_event_slot(st, i);
+	st->event[i].def = def;
+	st->event[i].buf = def + 1;
+	st->eventslot[i] = size;
+	return 0;
+}
+
+/* with keep, the event slots and the index are kept for the next PUT_HDR,
+ * see init_event_slots */
+static void free_stream_event(ft_stream_t *st, int keep) {
 	int verbose = 0;
 	int i;
 	if (verbose>0) fprintf(stderr, "free_event: freeing event buffer\n");
-	if (event) {
-		for (i=0; i<MAXNUMEVENT; i++) {
-			FREE(event[i].def);
-			FREE(event[i].buf);
+	if (st->event && !keep) {
+		for (i=0; i<st->current_max_num_event; i++) {
+			free_event_slot(st, i);
+		}
+		FREE(st->event);
+		FREE(st->eventslot);
+		ft_evidx_free(&st->event_index);
+	}
+	st->thisevent = 0;
+	ring_reset_event(st);
+	if (st->header) st->header->def->nevents = 0;
+}
+
+/* these free the header, data and events of all streams */
+void free_header() {
+	ft_stream_t *st;
+	for (st = get_default_stream(); st != NULL; st = st->next) free_stream_header(st);
+}
+
+void free_data() {
+	ft_stream_t *st;
+	for (st = get_default_stream(); st != NULL; st = st->next) free_stream_data(st, 0);
+}
+
+void free_event() {
+	ft_stream_t *st;
+	for (st = get_default_stream(); st != NULL; st = st->next) free_stream_event(st, 0);
+}
+
+/*****************************************************************************/
+
+/* returns the capacity settings for a new ring, see set_buffer_capacity */
+static void get_buffer_capacity(UINT32_T *nsamples, UINT64_T *nbytes, UINT32_T *nevents) {
+	pthread_mutex_lock(&mutexstreams);
+	if (nsamples) *nsamples = max_num_sample;
+	if (nbytes)   *nbytes   = max_num_byte;
+	if (nevents)  *nevents  = max_num_event;
+	pthread_mutex_unlock(&mutexstreams);
+}
+
+/* returns the number of samples that fit in the memory budget, or nsamples if that is less */
+static UINT32_T limit_to_budget(UINT32_T nsamples, UINT64_T rowsize) {
+	UINT64_T nbytes;
+	get_buffer_capacity(NULL, &nbytes, NULL);
+	if (nbytes > 0 && rowsize > 0 && nsamples > nbytes / rowsize)
+		nsamples = (UINT32_T) (nbytes / rowsize);
+	return nsamples;
+}
+
+/* returns the number of samples of the ring for a header with samples of WORDSIZE bytes */
+static UINT32_T ring_num_samples(const headerdef_t *def, unsigned int wordsize) {
+	UINT32_T nsamples;
+	UINT64_T nbytes;
+
+	get_buffer_capacity(&nsamples, &nbytes, NULL);
+	/* heuristic of choosing size of buffer, if no memory budget has been set:
+		 set current_max_num_sample to max_num_sample if nchans <= 256
+		 otherwise, allocate about MAXNUMBYTE and calculate current_max_num_sample from nchans + wordsize
+	 */
+	if (nbytes == 0) {
+		if (def->nchans <= 256)
+			return nsamples;
+		else
+			return (UINT32_T) (MAXNUMBYTE / ((UINT64_T) wordsize * def->nchans));
+	}
+	return limit_to_budget(nsamples, (UINT64_T) wordsize * def->nchans);
+}
+
+/* returns 0 if the ring for a new header fits in the address space, so that
+ * PUT_HDR can refuse the header before it replaces the previous one */
+static int check_ring_size(const headerdef_t *def) {
+	unsigned int wordsize = wordsize_from_type(def->data_type);
+	/* an unsupported data type is reported by init_data */
+	if (wordsize == 0) return 0;
+	return ((UINT64_T) def->nchans*ring_num_samples(def, wordsize)*wordsize > (size_t) -1) ? -1 : 0;
+}
+
+static void init_data(ft_stream_t *st) {
+	int verbose = 0;
+	if (verbose>0) fprintf(stderr, "init_data: creating data buffer\n");
+	if (st->header) {
+		unsigned int wordsize = wordsize_from_type(st->header->def->data_type);
+		size_t nrowbytes;
+
+		if (wordsize==0) {
+			fprintf(stderr, "init_data: unsupported data type (%u)\n", st->header->def->data_type);
+			return;
+		}
+		st->current_max_num_sample = ring_num_samples(st->header->def, wordsize);
+		if (st->current_max_num_sample == 0) {
+			fprintf(stderr, "init_data: the memory budget is too small for a single sample\n");
+			return;
+		}
+		st->data = (data_t*)malloc(sizeof(data_t));
+
+		DIE_BAD_MALLOC(st->data);
+
+		st->data->def = (datadef_t*)malloc(sizeof(datadef_t));
+
+		DIE_BAD_MALLOC(st->data->def);
+
+		st->data->def->nchans    = st->header->def->nchans;
+		st->data->def->nsamples  = st->current_max_num_sample;
+		st->data->def->data_type = st->header->def->data_type;
+		if (st->ring_shared) {
+			/* the ring and a copy of the events are placed in a new shared memory segment */
+			st->data->buf = ft_shm_server_alloc(st->header->def->nchans, st->header->def->data_type, st->current_max_num_sample, st->current_max_num_event);
+			if (st->data->buf == NULL) {
+				fprintf(stderr, "init_data: could not create the shared memory segment\n");
+				FREE(st->data->def);
+				FREE(st->data);
+			}
+			return;
+		}
+		if (st->ringfile) {
+			/* the header, the ring and a copy of the events are placed in the ring file */
+			st->data->buf = ft_ringfile_alloc(st->ringfile, st->header->def, st->header->buf, st->current_max_num_sample, st->current_max_num_event);
+			if (st->data->buf == NULL) {
+				fprintf(stderr, "init_data: could not lay out the ring file\n");
+				FREE(st->data->def);
+				FREE(st->data);
+			}
+			return;
+		}
+		/* checked by PUT_HDR already, see check_ring_size */
+		if ((UINT64_T) st->header->def->nchans*st->current_max_num_sample*wordsize > (size_t) -1) {
+			fprintf(stderr, "init_data: the sample ring does not fit in the address space\n");
+			FREE(st->data->def);
+			FREE(st->data);
+			return;
+		}
+		nrowbytes = (size_t) st->header->def->nchans*st->current_max_num_sample*wordsize;
+		if (st->ringmem.ptr == NULL || st->ringmem.capacity < nrowbytes) {
+			/* the memory of the previous ring is only replaced if it is too small */
+			ft_ringmem_free(&st->ringmem);
+			if (ft_ringmem_alloc(&st->ringmem, nrowbytes) != 0) {
+				fprintf(stderr, "init_data: could not allocate the sample ring\n");
+				FREE(st->data->def);
+				FREE(st->data);
+				return;
+			}
+		}
+		st->data->buf = st->ringmem.ptr;
+	}
+}
+
+/* creates the given number of event slots, the slots of the previous header
+ * are reused if there are as many */
+static void init_event_slots(ft_stream_t *st, UINT32_T nevents) {
+	int i;
+	if (st->event != NULL) {
+		if (st->current_max_num_event == nevents) {
+			ft_evidx_clear(&st->event_index, 0);
+			return;
+		}
+		free_stream_event(st, 0);
+	}
+	st->current_max_num_event = nevents;
+	st->event = (event_t*)malloc(st->current_max_num_event*sizeof(event_t));
+	DIE_BAD_MALLOC(st->event);
+	st->eventslot = (UINT32_T*)calloc(st->current_max_num_event, sizeof(UINT32_T));
+	DIE_BAD_MALLOC(st->eventslot);
+	for (i=0; i<st->current_max_num_event; i++) {
+		st->event[i].def = NULL;
+		st->event[i].buf = NULL;
+		/* small events are stored without allocating */
+		if (reserve_event_slot(st, i, 0) != 0) {
+			fprintf(stderr, "init_event: could not allocate the event slots\n");
+			exit(1);
+		}
+	}
+	if (ft_evidx_init(&st->event_index, st->current_max_num_event) != 0) {
+		fprintf(stderr, "init_event: could not create the event index\n");
+		exit(1);
+	}
+}
+
+static void init_event(ft_stream_t *st) {
+	int verbose = 0;
+	if (verbose>0) fprintf(stderr, "init_event: creating event buffer\n");
+	if (st->header) {
+		UINT32_T nevents;
+		get_buffer_capacity(NULL, NULL, &nevents);
+		init_event_slots(st, nevents);
+	}
+}
+
+
+/*****************************************************************************/
+
+/* places the sample ring and a copy of the events in shared memory, so that
+ * clients on the same host can read them without copying through the socket.
+ * The name should start with a slash, see shm_open. This should be called
+ * before the first PUT_HDR, returns 0 on success. This only applies to the
+ * default stream.
+ */
+int enable_shared_memory(const char *name) {
+	ft_stream_t *st = get_default_stream();
+	ft_shm_control_t *control;
+	int result = -1;
+
+	lock_ring_exclusive(st);
+	lock_mutex(&st->mutexheader);
+	lock_mutex(&st->mutexdata);
+	lock_mutex(&st->mutexevent);
+	if (st->header != NULL || st->ring_shared) {
+		fprintf(stderr, "enable_shared_memory: should be called once, before the header is written\n");
+	}
+	else if (st->ringfile) {
+		fprintf(stderr, "enable_shared_memory: the ring is already kept in a ring file\n");
+	}
+	else if ((control = ft_shm_server_init(name)) != NULL) {
+		/* memory that was reserved by set_buffer_capacity is not used */
+		ft_ringmem_free(&st->ringmem);
+		st->ring = control;
+		st->ring_shared = 1;
+		result = 0;
+	}
+	pthread_mutex_unlock(&st->mutexevent);
+	pthread_mutex_unlock(&st->mutexdata);
+	pthread_mutex_unlock(&st->mutexheader);
+	pthread_rwlock_unlock(&st->rwlockring);
+	return result;
+}
+
+/* removes the shared memory segments, together with the header, data and events */
+void disable_shared_memory(void) {
+	ft_stream_t *st = get_default_stream();
+	lock_ring_exclusive(st);
+	lock_mutex(&st->mutexheader);
+	lock_mutex(&st->mutexdata);
+	lock_mutex(&st->mutexevent);
+	if (st->ring_shared) {
+		free_stream_header(st);
+		free_stream_data(st, 0);
+		free_stream_event(st, 0);
+		ft_shm_server_exit();
+		memset(&st->ring_local, 0, sizeof(st->ring_local));
+		st->ring = &st->ring_local;
+		st->ring_shared = 0;
+	}
+	pthread_mutex_unlock(&st->mutexevent);
+	pthread_mutex_unlock(&st->mutexdata);
+	pthread_mutex_unlock(&st->mutexheader);
+	pthread_rwlock_unlock(&st->rwlockring);
+}
+
+/*****************************************************************************/
+
+/* continues with the header, samples and events that a previous server left
+ * in the ring file. The samples are used where they are, only the header and
+ * the events are copied. The caller should hold all locks.
+ */
+static void restore_ring_file(ft_stream_t *st) {
+	const ft_ringfile_super_t *S = ft_ringfile_super(st->ringfile);
+	const eventdef_t *def;
+	UINT32_T i, nevents;
+
+	if (!S->valid) return;
+
+	st->header      = (header_t*)malloc(sizeof(header_t));
+	DIE_BAD_MALLOC(st->header);
+	st->header->def = (headerdef_t*)malloc(sizeof(headerdef_t));
+	DIE_BAD_MALLOC(st->header->def);
+	st->header->buf = malloc(S->hdr.bufsize);
+	DIE_BAD_MALLOC(st->header->buf);
+	memcpy(st->header->def, &S->hdr, sizeof(headerdef_t));
+	memcpy(st->header->buf, ft_ringfile_header(st->ringfile), S->hdr.bufsize);
+	st->header->def->nsamples = st->ring->nsamples;
+	st->header->def->nevents  = st->ring->nevents;
+
+	st->data = (data_t*)malloc(sizeof(data_t));
+	DIE_BAD_MALLOC(st->data);
+	st->data->def = (datadef_t*)malloc(sizeof(datadef_t));
+	DIE_BAD_MALLOC(st->data->def);
+	st->data->def->nchans    = S->hdr.nchans;
+	st->data->def->nsamples  = S->capacity;
+	st->data->def->data_type = S->hdr.data_type;
+	st->data->buf = ft_ringfile_data(st->ringfile);
+	st->current_max_num_sample = S->capacity;
+	st->thissample = st->ring->nsamples % st->current_max_num_sample;
+
+	init_event_slots(st, S->maxevents);
+	nevents = st->ring->nevents;
+	ft_evidx_clear(&st->event_index, oldest_event(st, nevents));
+	for (i=oldest_event(st, nevents); i<nevents; i++) {
+		UINT32_T slot = i % st->current_max_num_event;
+		def = ft_ringfile_get_event(st->ringfile, i);
+		if (reserve_event_slot(st, slot, def->bufsize) != 0) {
+			fprintf(stderr, "restore_ring_file: could not allocate the event slots\n");
+			exit(1);
 		}
-		FREE(event);
+		memcpy(st->event[slot].def, def, sizeof(eventdef_t) + def->bufsize);
+		ft_evidx_add(&st->event_index, st->event[slot].def, st->event[slot].buf);
+	}
+	st->thisevent = nevents % st->current_max_num_event;
+
+	/* the generation is never 0, see GET_HDR_GEN */
+	if (++st->header_generation == 0) st->header_generation = 1;
+	fprintf(stderr, "restore_ring_file: continuing with %u samples and %u events\n", st->ring->nsamples, nevents);
+}
+
+/* keeps the header, the sample ring and a copy of the events of the default
+ * stream in a memory mapped file, so that a new server can take over without
+ * waiting for the acquisition to send the header again. If the file contains
+ * the ring of a previous server, that is served right away. This should be
+ * called before the first PUT_HDR, returns 0 on success.
+ */
+int enable_ring_file(const char *filename) {
+	ft_stream_t *st = get_default_stream();
+	int result = -1;
+
+	lock_ring_exclusive(st);
+	lock_mutex(&st->mutexheader);
+	lock_mutex(&st->mutexdata);
+	lock_mutex(&st->mutexevent);
+	if (st->header != NULL || st->ringfile != NULL) {
+		fprintf(stderr, "enable_ring_file: should be called once, before the header is written\n");
+	}
+	else if (st->ring_shared) {
+		fprintf(stderr, "enable_ring_file: the ring is already in shared memory\n");
 	}
-	thisevent = 0;
-	if (header) header->def->nevents = 0;
+	else if ((st->ringfile = ft_ringfile_open(filename)) != NULL) {
+		/* memory that was reserved by set_buffer_capacity is not used */
+		ft_ringmem_free(&st->ringmem);
+		st->ring = &ft_ringfile_super(st->ringfile)->control;
+		restore_ring_file(st);
+		result = 0;
+	}
+	pthread_mutex_unlock(&st->mutexevent);
+	pthread_mutex_unlock(&st->mutexdata);
+	pthread_mutex_unlock(&st->mutexheader);
+	pthread_rwlock_unlock(&st->rwlockring);
+	return result;
+}
+
+/* closes the ring file, which keeps the header, samples and events for the
+ * next server. They are removed from this server.
+ */
+void disable_ring_file(void) {
+	ft_stream_t *st = get_default_stream();
+	ft_ringfile_t *ringfile;
+
+	lock_ring_exclusive(st);
+	lock_mutex(&st->mutexheader);
+	lock_mutex(&st->mutexdata);
+	lock_mutex(&st->mutexevent);
+	if ((ringfile = st->ringfile) != NULL) {
+		/* detach the ring from the file before freeing, the file should not change */
+		st->ringfile = NULL;
+		if (st->data) st->data->buf = NULL;
+		memset(&st->ring_local, 0, sizeof(st->ring_local));
+		st->ring = &st->ring_local;
+		free_stream_header(st);
+		free_stream_data(st, 0);
+		free_stream_event(st, 0);
+		ft_ringfile_close(ringfile);
+	}
+	pthread_mutex_unlock(&st->mutexevent);
+	pthread_mutex_unlock(&st->mutexdata);
+	pthread_mutex_unlock(&st->mutexheader);
+	pthread_rwlock_unlock(&st->rwlockring);
 }
 
 /*****************************************************************************/
 
-void init_data(void) {
-	int verbose = 0;
-	if (verbose>0) fprintf(stderr, "init_data: creating data buffer\n");
-	if (header) {
-		unsigned int wordsize = wordsize_from_type(header->def->data_type);
+/* the spill writer copies at most this many bytes from the ring at a time */
+#define SPILL_CHUNKSIZE (1024*1024)
+
+/* This thread copies the samples from the ring to the spill file. It only
+ * holds rwlockring in shared mode while copying them to its own buffer, and
+ * writes them to the file without holding any lock. If PUT_DAT overwrites
+ * samples that have not been copied yet, these are skipped, and the older
+ * samples in the file are no longer used.
+ */
+static void *spill_writer(void *arg) {
+	ft_stream_t *st = (ft_stream_t *) arg;
+	UINT32_T generation = 0, next = 0;
+	int synced = 0, failed = 0;
+	char *rows = NULL;
+
+	rows = (char *) malloc(SPILL_CHUNKSIZE);
+	if (rows == NULL) {
+		fprintf(stderr, "spill_writer: out of memory\n");
+		return NULL;
+	}
+
+	for (;;) {
+		pthread_mutex_lock(&st->mutexspill);
+		while (!st->spill_pending && !st->spill_stop) pthread_cond_wait(&st->condspill, &st->mutexspill);
+		st->spill_pending = 0;
+		if (st->spill_stop) {
+			pthread_mutex_unlock(&st->mutexspill);
+			break;
+		}
+		pthread_mutex_unlock(&st->mutexspill);
+
+		/* copy everything that has been written since the last time */
+		for (;;) {
+			UINT32_T nsamples, first, chansize, gen, n;
+			int overwritten;
+
+			lock_ring_shared(st);
+			if (st->header==NULL || st->data==NULL) {
+				pthread_rwlock_unlock(&st->rwlockring);
+				break;
+			}
+			chansize = wordsize_from_type(st->data->def->data_type) * st->data->def->nchans;
+			nsamples = ring_snapshot(st);
+			first    = oldest_sample(st, nsamples);
+
+			/* the generation can not change while rwlockring is held */
+			pthread_mutex_lock(&st->mutexspill);
+			gen = st->spill_generation;
+			pthread_mutex_unlock(&st->mutexspill);
+
+			if (!synced || gen != generation) {
+				/* start with an empty file for the new samples */
+				pthread_rwlock_unlock(&st->rwlockring);
+				if (failed && gen == generation) {
+					/* wait for the next header before trying again */
+					break;
+				}
+				if (chansize == 0 || chansize > SPILL_CHUNKSIZE || ft_spill_truncate(st->spill, chansize, first) != 0) {
+					fprintf(stderr, "spill_writer: can not spill samples of %u bytes\n", chansize);
+					generation = gen;
+					failed = 1;
+					break;
+				}
+				pthread_mutex_lock(&st->mutexspill);
+				if (st->spill_generation == gen) st->spill_first = st->spill_end = first;
+				pthread_mutex_unlock(&st->mutexspill);
+				generation = gen;
+				next = first;
+				synced = 1;
+				failed = 0;
+				continue;
+			}
+
+			if (next < first) {
+				/* the samples in the file are no longer followed by those in the ring */
+				pthread_rwlock_unlock(&st->rwlockring);
+				fprintf(stderr, "spill_writer: %u samples were overwritten before they could be written to disk\n", first - next);
+				synced = 0;
+				continue;
+			}
+
+			if (next >= nsamples) {
+				pthread_rwlock_unlock(&st->rwlockring);
+				break;
+			}
+
+			n = nsamples - next;
+			if (n > SPILL_CHUNKSIZE / chansize) n = SPILL_CHUNKSIZE / chansize;
+			copy_ring_samples(st, rows, next, n);
+
+			/* check whether the writer has started overwriting them while we were copying */
+			MEMORY_BARRIER();
+			overwritten = (st->ring->writelimit - next > st->current_max_num_sample);
+			pthread_rwlock_unlock(&st->rwlockring);
+			if (overwritten) continue;
+
+			if (ft_spill_write(st->spill, next, rows, n) != 0) {
+				fprintf(stderr, "spill_writer: could not write to the spill file\n");
+				synced = 0;
+				failed = 1;
+				break;
+			}
+			next += n;
+
+			pthread_mutex_lock(&st->mutexspill);
+			if (st->spill_generation == generation) st->spill_end = next;
+			pthread_mutex_unlock(&st->mutexspill);
+		}
+	}
+	free(rows);
+	return NULL;
+}
+
+/* copies the samples of the default stream to the given file, so that GET_DAT
+ * can also return the samples that have been overwritten in the ring. The file
+ * is written by a background thread, PUT_DAT does not wait for the disk.
+ * Returns 0 on success.
+ */
+int enable_spill_file(const char *filename) {
+	ft_stream_t *st = get_default_stream();
+	ft_spill_t *spill;
+
+	if (st->spill != NULL) {
+		fprintf(stderr, "enable_spill_file: the samples are already being spilled\n");
+		return -1;
+	}
+	if ((spill = ft_spill_open(filename)) == NULL)
+		return -1;
+
+	st->spill_stop = 0;
+	st->spill_pending = 1;
+	st->spill = spill;
+	if (pthread_create(&st->spill_thread, NULL, spill_writer, st) != 0) {
+		fprintf(stderr, "enable_spill_file: could not start the spill writer\n");
+		st->spill = NULL;
+		ft_spill_close(spill);
+		return -1;
+	}
+	return 0;
+}
+
+/* stops the spill writer, the samples in the spill file can no longer be read */
+void disable_spill_file(void) {
+	ft_stream_t *st = get_default_stream();
+	ft_spill_t *spill;
+
+	if (st->spill == NULL) return;
+	pthread_mutex_lock(&st->mutexspill);
+	st->spill_stop = 1;
+	pthread_cond_signal(&st->condspill);
+	pthread_mutex_unlock(&st->mutexspill);
+	pthread_join(st->spill_thread, NULL);
+
+	/* wait for the readers that are still using the file */
+	lock_ring_exclusive(st);
+	pthread_mutex_lock(&st->mutexspill);
+	spill = st->spill;
+	st->spill = NULL;
+	st->spill_first = st->spill_end = 0;
+	pthread_mutex_unlock(&st->mutexspill);
+	pthread_rwlock_unlock(&st->rwlockring);
+	ft_spill_close(spill);
+}
+
+/* copies the n samples starting at begsample, of which the older ones are read
+ * from the spill file and the newer ones from the ring, into a GET_DAT response
+ * buffer. The caller should hold rwlockring. Returns NULL if the samples are not
+ * available, or if they were overwritten while copying.
+ */
+static datadef_t *copy_spilled(ft_stream_t *st, UINT32_T begsample, UINT32_T n, UINT32_T nsamples) {
+	unsigned int chansize = wordsize_from_type(st->data->def->data_type) * st->data->def->nchans;
+	UINT32_T first, end, ndisk;
+	datadef_t *ddef;
+
+	if (st->spill == NULL) return NULL;
+	pthread_mutex_lock(&st->mutexspill);
+	first = st->spill_first;
+	end   = st->spill_end;
+	pthread_mutex_unlock(&st->mutexspill);
+
+	/* the file should cover everything up to the samples that are still in the ring */
+	if (begsample < first || end <= begsample || (end < begsample + n && end < oldest_sample(st, nsamples)))
+		return NULL;
+	ndisk = (end - begsample < n) ? end - begsample : n;
+	if ((UINT64_T) n*chansize > 0xFFFFFFFFu - sizeof(datadef_t)) return NULL;
+
+	ddef = (datadef_t *) malloc(sizeof(datadef_t) + (size_t) n*chansize);
+	if (ddef == NULL) return NULL;
+	ddef->nchans    = st->data->def->nchans;
+	ddef->data_type = st->data->def->data_type;
+	ddef->nsamples  = n;
+	ddef->bufsize   = n*chansize;
+
+	if (ft_spill_read(st->spill, begsample, ddef+1, ndisk) != 0) {
+		free(ddef);
+		return NULL;
+	}
+	if (ndisk < n) {
+		copy_ring_samples(st, (char *) (ddef+1) + (size_t) ndisk*chansize, begsample + ndisk, n - ndisk);
+		MEMORY_BARRIER();
+		if (st->ring->writelimit - (begsample + ndisk) > st->current_max_num_sample) {
+			fprintf(stderr, "dmarequest: data was overwritten during GET_DAT\n");
+			pthread_mutex_lock(&mutexoverwrites);
+			ring_overwrites++;
+			pthread_mutex_unlock(&mutexoverwrites);
+			free(ddef);
+			return NULL;
+		}
+	}
+	return ddef;
+}
+
+/*****************************************************************************/
+
+/* allocates the memory of the sample ring of a stream without a header, so
+ * that it is mapped before the acquisition starts rather than on the first
+ * PUT_HDR, see init_data. This does not apply to a ring in shared memory or
+ * in a ring file.
+ */
+static void reserve_ring(ft_stream_t *st, size_t nbytes) {
+	lock_ring_exclusive(st);
+	lock_mutex(&st->mutexheader);
+	lock_mutex(&st->mutexdata);
+	lock_mutex(&st->mutexevent);
+	if (st->header == NULL && !st->ring_shared && st->ringfile == NULL && st->ringmem.capacity < nbytes) {
+		ft_ringmem_free(&st->ringmem);
+		if (ft_ringmem_alloc(&st->ringmem, nbytes) != 0)
+			fprintf(stderr, "set_buffer_capacity: could not reserve %.0f MB for the sample ring\n", nbytes / 1048576.0);
+	}
+	pthread_mutex_unlock(&st->mutexevent);
+	pthread_mutex_unlock(&st->mutexdata);
+	pthread_mutex_unlock(&st->mutexheader);
+	pthread_rwlock_unlock(&st->rwlockring);
+}
+
+/* sets the number of samples and events that fit in the ring, and the memory
+ * budget for the samples in bytes. These take effect on the next PUT_HDR. The
+ * number of samples is reduced if the samples do not fit in the budget. A
+ * value of 0 selects the default, in which case the budget only applies to
+ * headers with more than 256 channels (see init_data).
+ */
+void set_buffer_capacity(UINT32_T nsamples, UINT64_T nbytes, UINT32_T nevents) {
+	pthread_mutex_lock(&mutexstreams);
+	max_num_sample = nsamples ? nsamples : MAXNUMSAMPLE;
+	max_num_byte   = nbytes;
+	max_num_event  = nevents ? nevents : MAXNUMEVENT;
+	pthread_mutex_unlock(&mutexstreams);
+	if (nbytes > 0 && nbytes <= (size_t) -1) reserve_ring(get_default_stream(), (size_t) nbytes);
+}
+
+/* moves the samples and events that are in the ring to a ring of the given
+ * size, the caller should hold rwlockring exclusively and all mutexes
+ */
+static int resize_ring(ft_stream_t *st, UINT32_T nsamples, UINT32_T nevents) {
+	unsigned int chansize = wordsize_from_type(st->data->def->data_type) * st->data->def->nchans;
+	UINT32_T firstsample = oldest_sample(st, st->header->def->nsamples);
+	UINT32_T firstevent  = oldest_event(st, st->header->def->nevents);
+	event_t *newevent;
+	UINT32_T *newslot;
+	ft_event_index_t newindex;
+	void *newbuf;
+	UINT32_T i, j;
+
+	/* the ring file has a fixed layout */
+	if (st->ringfile)
+		return -1;
+
+	/* all of these should fit, the ring is not made smaller */
+	if (st->header->def->nsamples - firstsample > nsamples || st->header->def->nevents - firstevent > nevents)
+		return -1;
+
+	newevent = (event_t*)malloc(nevents*sizeof(event_t));
+	if (newevent == NULL) return -1;
+	newslot = (UINT32_T*)calloc(nevents, sizeof(UINT32_T));
+	if (newslot == NULL) {
+		free(newevent);
+		return -1;
+	}
+	for (i=0; i<nevents; i++) {
+		newevent[i].def = NULL;
+		newevent[i].buf = NULL;
+	}
+	if (ft_evidx_init(&newindex, nevents) != 0) {
+		free(newslot);
+		free(newevent);
+		return -1;
+	}
+
+	if (st->ring_shared) {
+		/* this also copies the samples and the shared copy of the events */
+		newbuf = ft_shm_server_resize(nsamples, nevents, firstsample, firstevent);
+		if (newbuf == NULL) {
+			ft_evidx_free(&newindex);
+			free(newslot);
+			free(newevent);
+			return -1;
+		}
+	}
+	else {
+		ft_ringmem_t newmem;
+		if (ft_ringmem_alloc(&newmem, (size_t) chansize*nsamples) != 0) {
+			ft_evidx_free(&newindex);
+			free(newslot);
+			free(newevent);
+			return -1;
+		}
+		newbuf = newmem.ptr;
+		for (i=firstsample; i<st->header->def->nsamples; i++) {
+			memcpy((char*)newbuf + (size_t) (i % nsamples)*chansize, (char*)st->data->buf + (size_t) (i % st->current_max_num_sample)*chansize, chansize);
+		}
+		ft_ringmem_free(&st->ringmem);
+		st->ringmem = newmem;
+		st->ring->firstsample = firstsample;
+		st->ring->firstevent  = firstevent;
+	}
+
+	/* move the events that are still in the ring */
+	ft_evidx_clear(&newindex, firstevent);
+	for (i=firstevent; i<st->header->def->nevents; i++) {
+		newevent[i % nevents] = st->event[i % st->current_max_num_event];
+		newslot[i % nevents]  = st->eventslot[i % st->current_max_num_event];
+		st->event[i % st->current_max_num_event].def = NULL;
+		st->event[i % st->current_max_num_event].buf = NULL;
+		st->eventslot[i % st->current_max_num_event] = 0;
+		ft_evidx_add(&newindex, newevent[i % nevents].def, newevent[i % nevents].buf);
+	}
+	/* the slots of the older events are reused for the empty part of the new ring */
+	j = 0;
+	for (i=0; i<nevents; i++) {
+		if (newevent[i].def != NULL) continue;
+		while (j<st->current_max_num_event && st->event[j].def == NULL) j++;
+		if (j<st->current_max_num_event) {
+			newevent[i] = st->event[j];
+			newslot[i]  = st->eventslot[j];
+			st->event[j].def = NULL;
+			st->event[j].buf = NULL;
+			st->eventslot[j] = 0;
+		}
+	}
+	for (i=0; i<st->current_max_num_event; i++) {
+		free_event_slot(st, i);
+	}
+	free(st->event);
+	free(st->eventslot);
+	ft_evidx_free(&st->event_index);
+	st->event_index = newindex;
+
+	st->data->buf = newbuf;
+	st->data->def->nsamples = st->current_max_num_sample = nsamples;
+	st->event = newevent;
+	st->eventslot = newslot;
+	st->current_max_num_event = nevents;
+	st->thissample = st->header->def->nsamples % st->current_max_num_sample;
+	st->thisevent  = st->header->def->nevents % st->current_max_num_event;
+	return 0;
+}
+
+/* increases the number of samples and events that fit in the current ring,
+ * without dropping the samples and events that are in it. Values that are
+ * smaller than the current size are ignored, and the number of samples is
+ * limited by the memory budget. Returns 0 on success, -1 if there is no
+ * header or if the memory could not be allocated. This applies to the
+ * default stream.
+ */
+int grow_buffer(UINT32_T nsamples, UINT32_T nevents) {
+	ft_stream_t *st = get_default_stream();
+	int result = -1;
+
+	lock_ring_exclusive(st);
+	lock_mutex(&st->mutexheader);
+	lock_mutex(&st->mutexdata);
+	lock_mutex(&st->mutexevent);
+	if (st->header && st->data && st->event) {
+		nsamples = limit_to_budget(nsamples, wordsize_from_type(st->data->def->data_type) * st->data->def->nchans);
+		if (nsamples < st->current_max_num_sample) nsamples = st->current_max_num_sample;
+		if (nevents < st->current_max_num_event) nevents = st->current_max_num_event;
+		if (nsamples == st->current_max_num_sample && nevents == st->current_max_num_event)
+			result = 0;
+		else
+			result = resize_ring(st, nsamples, nevents);
+		if (result != 0) fprintf(stderr, "grow_buffer: could not allocate a ring of %u samples and %u events\n", nsamples, nevents);
+	}
+	pthread_mutex_unlock(&st->mutexevent);
+	pthread_mutex_unlock(&st->mutexdata);
+	pthread_mutex_unlock(&st->mutexheader);
+	pthread_rwlock_unlock(&st->rwlockring);
+	return result;
+}
+
+/* lets the empty ring start at the given sample and event numbers, as if all
+ * the samples and events before them had already been overwritten. This is
+ * used by a relay (see buffer_relay.c) to keep the numbering of the buffer
+ * that it replicates. Returns 0 on success, -1 if there is no header or if
+ * the ring is not empty. This applies to the default stream.
+ */
+int set_buffer_origin(UINT32_T nsamples, UINT32_T nevents) {
+	ft_stream_t *st = get_default_stream();
+	int result = -1;
+
+	lock_ring_exclusive(st);
+	lock_mutex(&st->mutexheader);
+	lock_mutex(&st->mutexdata);
+	lock_mutex(&st->mutexevent);
+	if (st->header && st->data && st->event && st->header->def->nsamples == 0 && st->header->def->nevents == 0) {
+		MEMORY_BARRIER();
+		st->ring->seq++;
+		MEMORY_BARRIER();
+		st->ring->nsamples    = nsamples;
+		st->ring->writelimit  = nsamples;
+		st->ring->firstsample = nsamples;
+		MEMORY_BARRIER();
+		st->ring->seq++;
+		MEMORY_BARRIER();
+		st->ring->evtwritelimit = nevents;
+		st->ring->nevents       = nevents;
+		st->ring->firstevent    = nevents;
+		MEMORY_BARRIER();
+
+		ft_evidx_clear(&st->event_index, nevents);
+		st->header->def->nsamples = nsamples;
+		st->header->def->nevents  = nevents;
+		st->thissample = nsamples % st->current_max_num_sample;
+		st->thisevent  = nevents % st->current_max_num_event;
+		result = 0;
+	}
+	pthread_mutex_unlock(&st->mutexevent);
+	pthread_mutex_unlock(&st->mutexdata);
+	pthread_mutex_unlock(&st->mutexheader);
+	pthread_rwlock_unlock(&st->rwlockring);
+	if (result == 0) notify_waiters(st, nsamples, nevents);
+	return result;
+}
+
+/*****************************************************************************/
+
+/* checks the buf of a PUT_DAT request against the header, returns 0 if the
+ * samples can be stored. The caller should hold rwlockring.
+ */
+static int check_put_data(ft_stream_t *st, const void *buf, UINT32_T bufsize) {
+	const datadef_t *datadef = (const datadef_t *) buf;
+	unsigned int wordsize;
+
+	if (bufsize < sizeof(datadef_t))
+		return -1;
+	if (st->header==NULL || st->data==NULL)
+		return -1;
+	if (st->header->def->nchans != datadef->nchans)
+		return -1;
+	if (st->header->def->data_type != datadef->data_type)
+		return -1;
+	if (datadef->nsamples > st->current_max_num_sample)
+		return -1;
+	if (st->ring->nsamples + datadef->nsamples < st->ring->nsamples) {
+		/* the sample counter is a UINT32_T and the ring position is taken modulo the ring size, so this lasts 2^32 samples, 39 hours at 30 kHz */
+		fprintf(stderr, "dmarequest: the number of samples would exceed 2^32, the header should be written again\n");
+		return -1;
+	}
+
+	wordsize = wordsize_from_type(st->header->def->data_type);
+	if (wordsize == 0) {
+		fprintf(stderr, "dmarequest: unsupported data type (%d)\n", datadef->data_type);
+		return -1;
+	}
+	if ((UINT64_T) wordsize * datadef->nsamples * datadef->nchans > datadef->bufsize || ((UINT64_T) datadef->bufsize + sizeof(datadef_t)) > bufsize) {
+		fprintf(stderr, "dmarequest: invalid size definitions in PUT_DAT request\n");
+		return -1;
+	}
+	return 0;
+}
+
+/* copies the samples of a checked PUT_DAT request into the ring, the caller
+ * should hold rwlockring and mutexdata. The caller also has to update
+ * header->def->nsamples. If swapdata is set, the datadef_t is already in
+ * native byte order but the samples are not, and they are swapped while
+ * being copied. Returns 0 on success.
+ */
+static int store_data(ft_stream_t *st, const void *buf, int swapdata) {
+	const datadef_t *datadef = (const datadef_t *) buf;
+	unsigned int n, remaining;
+	UINT32_T begsample;
+	/* number of bytes per sample (all channels) is given by wordsize x number of channels */
+	unsigned int chansize = wordsize_from_type(st->data->def->data_type) * st->data->def->nchans;
+	/* request_data points to actual data samples within the request, use char* for convenience */
+	const char *request_data = (const char *) buf + sizeof(datadef_t);
+	char *buffer_data = (char *)st->data->buf;
+
+	/* record the time at which the data was received */
+	st->putdat_clock = ft_clock_ns();
+
+	/* tell the readers which samples are about to be overwritten */
+	ring_begin_write(st, st->ring->nsamples + datadef->nsamples);
+
+	/* the samples end up in at most two contiguous pieces of the ring */
+	remaining = datadef->nsamples;
+	while (remaining > 0) {
+		n = st->current_max_num_sample - st->thissample;
+		if (n > remaining) n = remaining;
+		if (swapdata)
+			ft_swap_copy_data(n * st->data->def->nchans, st->data->def->data_type, buffer_data + (size_t) st->thissample*chansize, request_data);
+		else
+			memcpy(buffer_data + (size_t) st->thissample*chansize, request_data, n*chansize);
+		request_data += n*chansize;
+		remaining    -= n;
+		st->thissample   += n;
+		if (st->thissample == st->current_max_num_sample) st->thissample = 0;
+	}
+
+	/* make the new samples visible to the readers */
+	begsample = st->ring->nsamples;
+	ring_end_write(st, begsample + datadef->nsamples);
+
+	if (st == &default_stream && ft_trace_enabled()) {
+		UINT64_T received = ft_trace_get_received();
+		ft_trace_point(FT_TRACE_RECEIVE, begsample, begsample + datadef->nsamples, received ? received : st->putdat_clock);
+		ft_trace_point(FT_TRACE_INSERT, begsample, begsample + datadef->nsamples, 0);
+	}
+	return 0;
+}
+
+/* adds the time of a block of samples to the side ring, the caller should hold mutexdata */
+static void store_timestamp(ft_stream_t *st, UINT64_T time, UINT32_T sample, UINT32_T nsamples) {
+	timestamp_t *stamp;
+
+	if (nsamples == 0) return;
+	if (st->stamps == NULL) {
+		st->stamps = (timestamp_t *) malloc(FT_MAXNUMTIMESTAMP * sizeof(timestamp_t));
+		if (st->stamps == NULL) {
+			fprintf(stderr, "dmarequest: out of memory for the timestamps\n");
+			return;
+		}
+	}
+	stamp = &st->stamps[st->numstamps % FT_MAXNUMTIMESTAMP];
+	stamp->time     = time;
+	stamp->sample   = sample;
+	stamp->nsamples = nsamples;
+	st->numstamps++;
+}
+
+/* returns the k-th timestamp that is still in the side ring, the oldest is 0 */
+static const timestamp_t *get_timestamp(const ft_stream_t *st, UINT32_T k) {
+	UINT32_T n = (st->numstamps < FT_MAXNUMTIMESTAMP) ? st->numstamps : FT_MAXNUMTIMESTAMP;
+	return &st->stamps[(st->numstamps - n + k) % FT_MAXNUMTIMESTAMP];
+}
+
+static INT64_T round_to_int64(double x) {
+	return (x >= 0) ? (INT64_T) (x + 0.5) : -(INT64_T) (0.5 - x);
+}
+
+/* fills in the time or the sample of a timepoint, using the timestamps of the
+ * neighbouring blocks. The caller should hold rwlockring and mutexdata.
+ * Returns 0 on success, -1 if there are not enough timestamps.
+ */
+static int map_timepoint(ft_stream_t *st, timepoint_t *tp) {
+	UINT32_T n = (st->numstamps < FT_MAXNUMTIMESTAMP) ? st->numstamps : FT_MAXNUMTIMESTAMP;
+	UINT32_T lo, hi, mid;
+	const timestamp_t *a, *b, *e;
+	double rate;   /* samples per nanosecond */
+	double x;
+
+	if (n == 0 || st->header == NULL) return -1;
+	if (tp->what != FT_TIME_OF_SAMPLE && tp->what != FT_SAMPLE_AT_TIME) return -1;
+
+	/* find the number of blocks that start at or before the given point */
+	lo = 0;
+	hi = n;
+	while (lo < hi) {
+		mid = lo + (hi - lo)/2;
+		e = get_timestamp(st, mid);
+		if (tp->what == FT_TIME_OF_SAMPLE ? e->sample <= tp->sample : e->time <= tp->time)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (n > 1 && lo > 0 && lo < n) {
+		/* between two blocks, interpolate */
+		a = get_timestamp(st, lo-1);
+		b = get_timestamp(st, lo);
+	} else {
+		/* outside of the blocks, extrapolate from the nearest one over all blocks */
+		a = get_timestamp(st, 0);
+		b = get_timestamp(st, n-1);
+	}
+	if (b->sample != a->sample && b->time != a->time)
+		rate = (double) (b->sample - a->sample) / (double) (INT64_T) (b->time - a->time);
+	else if (st->header->def->fsample > 0)
+		rate = st->header->def->fsample * 1e-9;
+	else
+		return -1;
+	/* after the last block, start from that one */
+	if (lo >= n) a = b;
+
+	if (tp->what == FT_TIME_OF_SAMPLE) {
+		x = ((double) tp->sample - (double) a->sample) / rate;
+		tp->time = a->time + (UINT64_T) round_to_int64(x);
+	} else {
+		x = (double) a->sample + (double) (INT64_T) (tp->time - a->time) * rate;
+		if (x < 0 || x > 4294967295.0) return -1;
+		tp->sample = (UINT32_T) round_to_int64(x);
+	}
+	return 0;
+}
+
+/* checks an extended data selection against the ring, the caller should hold rwlockring */
+static int check_datasel_ext(ft_stream_t *st, const datasel_ext_t *sel, const UINT32_T *chanlist, UINT32_T bufsize) {
+	UINT32_T i;
+
+	if (bufsize != sizeof(datasel_ext_t) + sel->nchans*sizeof(UINT32_T))
+		return -1;
+	for (i=0; i<sel->nchans; i++) {
+		if (chanlist[i] >= st->data->def->nchans) return -1;
+	}
+	if (sel->data_type == DATATYPE_UNKNOWN || sel->data_type == st->data->def->data_type)
+		return 0;
+	/* calibration is only possible when converting to floating point */
+	if ((sel->data_type & ~DATASEL_CALIBRATE) != DATATYPE_FLOAT32 && (sel->data_type & ~DATASEL_CALIBRATE) != DATATYPE_FLOAT64)
+		return -1;
+	return 0;
+}
+
+/* fills in the resolution of each selected channel, or 1 if the header has
+ * no FT_CHUNK_RESOLUTIONS chunk. The caller should hold rwlockring.
+ */
+static void get_resolutions(ft_stream_t *st, UINT32_T dest_type, const UINT32_T *chanlist, UINT32_T nsel, void *gain) {
+	const ft_chunk_t *chunk = NULL;
+	UINT32_T i;
+
+	if (st->header->buf != NULL)
+		chunk = find_chunk(st->header->buf, 0, st->header->def->bufsize, FT_CHUNK_RESOLUTIONS);
+	if (chunk != NULL && chunk->def.size < st->header->def->nchans*sizeof(FLOAT64_T))
+		chunk = NULL;
+
+	for (i=0; i<nsel; i++) {
+		FLOAT64_T r = 1.0;
+		/* the chunk is not necessarily aligned */
+		if (chunk != NULL) memcpy(&r, chunk->data + (chanlist ? chanlist[i] : i)*sizeof(FLOAT64_T), sizeof(FLOAT64_T));
+		if (dest_type == DATATYPE_FLOAT32)
+			((FLOAT32_T *) gain)[i] = (FLOAT32_T) r;
+		else
+			((FLOAT64_T *) gain)[i] = r;
+	}
+}
+
+/* copies the values of nsel channels in one sample, converting them from
+ * src_type to dest_type. The channels are given by chanlist, or are 0..nsel-1
+ * if chanlist is NULL.
+ */
+#define COPY_CHANNELS(ST, DT) { \
+	const ST *s = (const ST *) src; \
+	DT *d = (DT *) dest; \
+	if (chanlist) { for (i=0; i<nsel; i++) d[i] = (DT) s[chanlist[i]]; } \
+	else { for (i=0; i<nsel; i++) d[i] = (DT) s[i]; } \
+}
+
+#define CONVERT_CHANNELS(DT) \
+	switch (src_type) { \
+		case DATATYPE_CHAR:    COPY_CHANNELS(CHAR_T,    DT); break; \
+		case DATATYPE_UINT8:   COPY_CHANNELS(UINT8_T,   DT); break; \
+		case DATATYPE_UINT16:  COPY_CHANNELS(UINT16_T,  DT); break; \
+		case DATATYPE_UINT32:  COPY_CHANNELS(UINT32_T,  DT); break; \
+		case DATATYPE_UINT64:  COPY_CHANNELS(UINT64_T,  DT); break; \
+		case DATATYPE_INT8:    COPY_CHANNELS(INT8_T,    DT); break; \
+		case DATATYPE_INT16:   COPY_CHANNELS(INT16_T,   DT); break; \
+		case DATATYPE_INT32:   COPY_CHANNELS(INT32_T,   DT); break; \
+		case DATATYPE_INT64:   COPY_CHANNELS(INT64_T,   DT); break; \
+		case DATATYPE_FLOAT32: COPY_CHANNELS(FLOAT32_T, DT); break; \
+		case DATATYPE_FLOAT64: COPY_CHANNELS(FLOAT64_T, DT); break; \
+	}
+
+static void copy_channels(void *dest, UINT32_T dest_type, const void *src, UINT32_T src_type, const UINT32_T *chanlist, UINT32_T nsel, const void *gain) {
+	UINT32_T i;
+
+	if (chanlist == NULL && dest_type == DATATYPE_FLOAT32) {
+		/* a contiguous row, which is converted and calibrated in one go */
+		ft_convert_float32(nsel, dest, src_type, src, (const FLOAT32_T *) gain);
+	}
+	else if (chanlist == NULL && dest_type == DATATYPE_FLOAT64) {
+		ft_convert_float64(nsel, dest, src_type, src, (const FLOAT64_T *) gain);
+	}
+	else if (dest_type == src_type && gain == NULL) {
+		/* no conversion, copy the channels as raw words */
+		switch (wordsize_from_type(src_type)) {
+			case 1: COPY_CHANNELS(UINT8_T,  UINT8_T);  break;
+			case 2: COPY_CHANNELS(UINT16_T, UINT16_T); break;
+			case 4: COPY_CHANNELS(UINT32_T, UINT32_T); break;
+			case 8: COPY_CHANNELS(UINT64_T, UINT64_T); break;
+		}
+	}
+	else if (dest_type == DATATYPE_FLOAT32) {
+		CONVERT_CHANNELS(FLOAT32_T);
+		if (gain) for (i=0; i<nsel; i++) ((FLOAT32_T *) dest)[i] *= ((const FLOAT32_T *) gain)[i];
+	}
+	else if (dest_type == DATATYPE_FLOAT64) {
+		CONVERT_CHANNELS(FLOAT64_T);
+		if (gain) for (i=0; i<nsel; i++) ((FLOAT64_T *) dest)[i] *= ((const FLOAT64_T *) gain)[i];
+	}
+}
+
+#undef CONVERT_CHANNELS
+#undef COPY_CHANNELS
+
+/* copies nout samples of the checked selection to dest, every stride-th
+ * sample starting at begsample. The samples are taken from src_buf, which
+ * holds wrap samples in the format of the ring.
+ */
+static void copy_selected_samples(ft_stream_t *st, const datasel_ext_t *sel, const UINT32_T *chanlist, const void *gain, const void *src_buf, UINT32_T wrap, UINT32_T begsample, UINT32_T nout, void *dest) {
+	UINT32_T stride    = (sel->stride > 1) ? sel->stride : 1;
+	UINT32_T nsel      = (sel->nchans > 0) ? sel->nchans : st->data->def->nchans;
+	UINT32_T dest_type = (sel->data_type == DATATYPE_UNKNOWN) ? st->data->def->data_type : (sel->data_type & ~DATASEL_CALIBRATE);
+	UINT32_T chansize  = wordsize_from_type(st->data->def->data_type) * st->data->def->nchans;
+	UINT32_T rowsize   = wordsize_from_type(dest_type) * nsel;
+	char *ptr = (char *) dest;
+	UINT32_T j;
+
+	for (j=0; j<nout; j++) {
+		const char *src = (const char *) src_buf + (size_t) ((begsample + j*stride) % wrap)*chansize;
+		copy_channels(ptr, dest_type, src, st->data->def->data_type, (sel->nchans > 0) ? chanlist : NULL, nsel, gain);
+		ptr += rowsize;
+	}
+}
+
+/* allocates a GET_DAT response buffer (datadef_t followed by the samples) and
+ * fills it with every stride-th of the n samples starting at begsample, using
+ * the channels and data type of the checked selection. The samples are taken
+ * from src, which holds wrap samples in the format of the ring. The caller
+ * should hold rwlockring, and has to check for overwrites afterwards.
+ */
+static void *copy_selection(ft_stream_t *st, const datasel_ext_t *sel, const UINT32_T *chanlist, const void *src_buf, UINT32_T wrap, UINT32_T begsample, UINT32_T n, ft_msgpool_t *pool) {
+	UINT32_T stride    = (sel->stride > 1) ? sel->stride : 1;
+	UINT32_T nsel      = (sel->nchans > 0) ? sel->nchans : st->data->def->nchans;
+	UINT32_T dest_type = (sel->data_type == DATATYPE_UNKNOWN) ? st->data->def->data_type : (sel->data_type & ~DATASEL_CALIBRATE);
+	UINT32_T nout      = (n + stride - 1) / stride;
+	UINT32_T rowsize   = wordsize_from_type(dest_type) * nsel;
+	void *gain = NULL;
+	datadef_t *ddef;
+
+	/* the response should fit in the messagedef_t */
+	if ((UINT64_T) nout*rowsize > 0xFFFFFFFFu - sizeof(datadef_t))
+		return NULL;
+
+	if (sel->data_type != DATATYPE_UNKNOWN && (sel->data_type & DATASEL_CALIBRATE)) {
+		gain = malloc(nsel*sizeof(FLOAT64_T));
+		if (gain == NULL) return NULL;
+		get_resolutions(st, dest_type, (sel->nchans > 0) ? chanlist : NULL, nsel, gain);
+	}
+
+	ddef = (datadef_t *) ft_msgpool_alloc(pool, sizeof(datadef_t) + (size_t) nout*rowsize);
+	if (ddef == NULL) {
+		FREE(gain);
+		return NULL;
+	}
+
+	ddef->nchans    = nsel;
+	ddef->nsamples  = nout;
+	ddef->data_type = dest_type;
+	ddef->bufsize   = nout*rowsize;
+
+	copy_selected_samples(st, sel, chanlist, gain, src_buf, wrap, begsample, nout, ddef+1);
+	FREE(gain);
+	return ddef;
+}
+
+/* stores the events of a checked PUT_EVT request, the caller should hold
+ * mutexheader and mutexevent. Returns 0 on success.
+ */
+static int store_events(ft_stream_t *st, const void *buf, UINT32_T bufsize) {
+	int verbose = 0;
+	unsigned int offset;
+	const eventdef_t *eventdef;
+	UINT32_T firstevent = st->header->def->nevents;
+
+	/* record the time at which the event was received */
+	st->putevt_clock = ft_clock_ns();
+
+	offset = 0; /* this represents the offset of the event in the buffer */
+	while (offset<bufsize) {
+		eventdef = (const eventdef_t*)((const char*)buf+offset);
+		if (verbose>1) print_eventdef((eventdef_t*)eventdef);
+
+		/* this only allocates if the event does not fit in the slot that it overwrites */
+		if (reserve_event_slot(st, st->thisevent, eventdef->bufsize) != 0) {
+			fprintf(stderr, "store_events: out of memory\n");
+			exit(1);
+		}
+		memcpy(st->event[st->thisevent].def, (const char*)buf+offset, sizeof(eventdef_t));
+
+		if (st->event[st->thisevent].def->sample == EVENT_AUTO_SAMPLE) {
+			/* automatically convert event->def->sample to current sample number */
+			/* make some fine adjustment of the assigned sample number */
+			double adjust = 1e-9 * (double) (INT64_T) (st->putevt_clock - st->putdat_clock);
+			st->event[st->thisevent].def->sample = st->header->def->nsamples + (int)(st->header->def->fsample*adjust);
+		}
+
+		offset += sizeof(eventdef_t);
+		memcpy(st->event[st->thisevent].buf, (const char*)buf+offset, eventdef->bufsize);
+		offset += eventdef->bufsize;
+		if (verbose>1) print_eventdef(st->event[st->thisevent].def);
+		if (st->ring_shared) ft_shm_server_put_event(st->header->def->nevents, st->event[st->thisevent].def, st->event[st->thisevent].buf);
+		if (st->ringfile) ft_ringfile_put_event(st->ringfile, st->header->def->nevents, st->event[st->thisevent].def, st->event[st->thisevent].buf);
+		ft_evidx_add(&st->event_index, st->event[st->thisevent].def, st->event[st->thisevent].buf);
+		st->thisevent = (st->thisevent + 1) % st->current_max_num_event;
+		st->header->def->nevents++;
+	}
+	ring_end_event(st, st->header->def->nevents);
+	if (st->header->def->nevents > firstevent) match_filter_waiters(st, firstevent);
+	return 0;
+}
+
+/* handles a GET_EVT request with a filter, the caller should hold mutexheader and mutexevent */
+static void get_filtered_events(ft_stream_t *st, const void *buf, UINT32_T bufsize, message_t *response, ft_msgpool_t *pool) {
+	eventsel_t eventsel;
+	const void *filter = (const char *) buf + sizeof(eventsel_t);
+	UINT32_T filtersize = bufsize - sizeof(eventsel_t);
+	UINT32_T begevent, endevent, nmatch, size, j;
+	UINT32_T *match;
+	char *ptr;
+
+	response->def->version = VERSION;
+	response->def->command = GET_ERR;
+	response->def->bufsize = 0;
+
+	if (st->header==NULL || st->event==NULL) return;
+	if (ft_evidx_check_filter(filtersize, filter) != 0) {
+		fprintf(stderr, "dmarequest: invalid filter in GET_EVT\n");
+		return;
+	}
+	response->def->command = GET_OK;
+	if (st->header->def->nevents == 0) return;
+
+	/* limit the selection to the events that are still in the buffer */
+	memcpy(&eventsel, buf, sizeof(eventsel_t));
+	begevent = eventsel.begevent;
+	endevent = eventsel.endevent;
+	if (begevent < oldest_event(st, st->header->def->nevents))
+		begevent = oldest_event(st, st->header->def->nevents);
+	if (endevent >= st->header->def->nevents)
+		endevent = st->header->def->nevents - 1;
+	if (begevent > endevent) return;
+
+	match = (UINT32_T *) malloc((endevent - begevent + 1) * sizeof(UINT32_T));
+	if (match == NULL) {
+		response->def->command = GET_ERR;
+		return;
+	}
+	nmatch = ft_evidx_find(&st->event_index, st->event, begevent, endevent, filtersize, filter, match);
+
+	size = 0;
+	for (j=0; j<nmatch; j++) {
+		size += sizeof(eventdef_t) + st->event[match[j] % st->current_max_num_event].def->bufsize;
+	}
+	if (size > 0) {
+		response->buf = ft_msgpool_alloc(pool, size);
+		if (response->buf == NULL) {
+			response->def->command = GET_ERR;
+			free(match);
+			return;
+		}
+		ptr = (char *) response->buf;
+		for (j=0; j<nmatch; j++) {
+			const event_t *thisev = &st->event[match[j] % st->current_max_num_event];
+			memcpy(ptr, thisev->def, sizeof(eventdef_t));
+			ptr += sizeof(eventdef_t);
+			memcpy(ptr, thisev->buf, thisev->def->bufsize);
+			ptr += thisev->def->bufsize;
+		}
+	}
+	response->def->bufsize = size;
+	free(match);
+}
+
+/* determines the ranges of the epochs of a GET_DAT_M request around the last
+ * nsel matching events, of which all samples are in the ring from firstsample
+ * up to nsamples. The ranges are returned in the order of the events, in a
+ * list that the caller should free. Returns the number of ranges, or -1 on
+ * error. The caller should hold rwlockring.
+ */
+static int select_epochs(ft_stream_t *st, const epochsel_t *esel, UINT32_T filtersize, const void *filter, UINT32_T nsel, UINT32_T firstsample, UINT32_T nsamples, datasel_t **range) {
+	UINT32_T begevent, endevent, nmatch, nrange = 0, j;
+	UINT32_T *match;
+
+	*range = NULL;
+	if (esel->nsamples == 0 || ft_evidx_check_filter(filtersize, filter) != 0)
+		return -1;
+
+	lock_mutex(&st->mutexheader);
+	lock_mutex(&st->mutexevent);
+	if (st->event == NULL || st->header->def->nevents == 0) {
+		pthread_mutex_unlock(&st->mutexevent);
+		pthread_mutex_unlock(&st->mutexheader);
+		return 0;
+	}
+
+	/* limit the selection to the events that are still in the buffer */
+	begevent = esel->begevent;
+	endevent = esel->endevent;
+	if (begevent < oldest_event(st, st->header->def->nevents))
+		begevent = oldest_event(st, st->header->def->nevents);
+	if (endevent >= st->header->def->nevents)
+		endevent = st->header->def->nevents - 1;
+	if (begevent > endevent) {
+		pthread_mutex_unlock(&st->mutexevent);
+		pthread_mutex_unlock(&st->mutexheader);
+		return 0;
+	}
+
+	match = (UINT32_T *) malloc((endevent - begevent + 1) * sizeof(UINT32_T));
+	if (match == NULL) {
+		pthread_mutex_unlock(&st->mutexevent);
+		pthread_mutex_unlock(&st->mutexheader);
+		return -1;
+	}
+	nmatch = ft_evidx_find(&st->event_index, st->event, begevent, endevent, filtersize, filter, match);
+	if (nsel == 0 || nsel > nmatch) nsel = nmatch;
+
+	*range = (datasel_t *) malloc((nsel > 0 ? nsel : 1) * sizeof(datasel_t));
+	if (*range == NULL) {
+		pthread_mutex_unlock(&st->mutexevent);
+		pthread_mutex_unlock(&st->mutexheader);
+		free(match);
+		return -1;
+	}
+
+	/* go back from the last match, and fill in the ranges from the end */
+	for (j=nmatch; j>0 && nrange<nsel; j--) {
+		INT64_T begsample = (INT64_T) st->event[match[j-1] % st->current_max_num_event].def->sample + esel->offset;
+		INT64_T endsample = begsample + esel->nsamples - 1;
+		if (begsample < firstsample || endsample >= nsamples) continue;
+		nrange++;
+		(*range)[nsel - nrange].begsample = (UINT32_T) begsample;
+		(*range)[nsel - nrange].endsample = (UINT32_T) endsample;
+	}
+	pthread_mutex_unlock(&st->mutexevent);
+	pthread_mutex_unlock(&st->mutexheader);
+	free(match);
+
+	if (nrange < nsel) memmove(*range, *range + (nsel - nrange), nrange * sizeof(datasel_t));
+	return (int) nrange;
+}
+
+/* handles a GET_DAT_M request, the caller should hold rwlockring in shared
+ * mode. All ranges are copied from one snapshot of the ring into a single
+ * response, see datamulti_t.
+ */
+static void get_data_ranges(ft_stream_t *st, const void *buf, UINT32_T bufsize, message_t *response, ft_msgpool_t *pool) {
+	datamulti_t dmulti;
+	datasel_ext_t sel;
+	const UINT32_T *chanlist;
+	datasel_t *range = NULL;
+	UINT32_T nsamples, firstsample, begsample, stride, nsel, dest_type, rowsize, offset, nrange, i;
+	UINT64_T size;
+	void *gain = NULL;
+	char *ptr;
+
+	response->def->version = VERSION;
+	response->def->command = GET_ERR;
+	response->def->bufsize = 0;
+
+	if (bufsize < sizeof(datamulti_t)) return;
+	memcpy(&dmulti, buf, sizeof(datamulti_t));
+	if (dmulti.nchans > (bufsize - sizeof(datamulti_t)) / sizeof(UINT32_T)) return;
+	chanlist = (const UINT32_T *) ((const char *) buf + sizeof(datamulti_t));
+	offset   = sizeof(datamulti_t) + dmulti.nchans*sizeof(UINT32_T);
+
+	/* the channels and the data type are checked as in GET_DAT */
+	sel.begsample = 0;
+	sel.endsample = 0;
+	sel.stride    = dmulti.stride;
+	sel.data_type = dmulti.data_type;
+	sel.nchans    = dmulti.nchans;
+	if (check_datasel_ext(st, &sel, chanlist, sizeof(datasel_ext_t) + sel.nchans*sizeof(UINT32_T)) != 0) {
+		fprintf(stderr, "dmarequest: invalid channel selection or data type in GET_DAT_M\n");
+		return;
+	}
 
-		if (wordsize==0) {
-			fprintf(stderr, "init_data: unsupported data type (%u)\n", header->def->data_type);
-			return;
-		}
-		/* heuristic of choosing size of buffer:
-			 set current_max_num_sample to MAXNUMSAMPLE if nchans <= 256
-			 otherwise, allocate about MAXNUMBYTE and calculate current_max_num_sample from nchans + wordsize
-		 */
-		if (header->def->nchans <= 256) {
-			current_max_num_sample = MAXNUMSAMPLE;
-		} else {
-			current_max_num_sample = MAXNUMBYTE / (wordsize * header->def->nchans);
+	/* take a consistent snapshot of the number of samples in the ring */
+	nsamples    = ring_snapshot(st);
+	firstsample = oldest_sample(st, nsamples);
+
+	if (dmulti.what == DATAMULTI_RANGES) {
+		if ((bufsize - offset) % sizeof(datasel_t) != 0 || (bufsize - offset) / sizeof(datasel_t) != dmulti.nsel) return;
+		nrange = dmulti.nsel;
+		range  = (datasel_t *) malloc((nrange > 0 ? nrange : 1) * sizeof(datasel_t));
+		if (range == NULL) return;
+		memcpy(range, (const char *) buf + offset, nrange * sizeof(datasel_t));
+		for (i=0; i<nrange; i++) {
+			if (range[i].begsample > range[i].endsample || range[i].begsample < firstsample || range[i].endsample >= nsamples) {
+				free(range);
+				return;
+			}
 		}
-		data = (data_t*)malloc(sizeof(data_t));
-
-		DIE_BAD_MALLOC(data);
+	}
+	else if (dmulti.what == DATAMULTI_EPOCHS && bufsize - offset >= sizeof(epochsel_t)) {
+		epochsel_t esel;
+		int result;
+		memcpy(&esel, (const char *) buf + offset, sizeof(epochsel_t));
+		offset += sizeof(epochsel_t);
+		result = select_epochs(st, &esel, bufsize - offset, (const char *) buf + offset, dmulti.nsel, firstsample, nsamples, &range);
+		if (result < 0) return;
+		nrange = (UINT32_T) result;
+	}
+	else if (dmulti.what == DATAMULTI_LATEST && bufsize == offset) {
+		nrange = (dmulti.nsel > 0 && nsamples > firstsample) ? 1 : 0;
+		range  = (datasel_t *) malloc(sizeof(datasel_t));
+		if (range == NULL) return;
+		range[0].endsample = nsamples - 1;
+		range[0].begsample = (nsamples - firstsample > dmulti.nsel) ? nsamples - dmulti.nsel : firstsample;
+	}
+	else {
+		return;
+	}
 
-		data->def = (datadef_t*)malloc(sizeof(datadef_t));
+	stride    = (sel.stride > 1) ? sel.stride : 1;
+	nsel      = (sel.nchans > 0) ? sel.nchans : st->data->def->nchans;
+	dest_type = (sel.data_type == DATATYPE_UNKNOWN) ? st->data->def->data_type : (sel.data_type & ~DATASEL_CALIBRATE);
+	rowsize   = wordsize_from_type(dest_type) * nsel;
 
-		DIE_BAD_MALLOC(data->def);
+	/* the size of the response, which should fit in the messagedef_t */
+	size = 0;
+	for (i=0; i<nrange; i++) {
+		UINT32_T n = range[i].endsample - range[i].begsample + 1;
+		size += sizeof(datasel_t) + sizeof(datadef_t) + (UINT64_T) ((n + stride - 1) / stride) * rowsize;
+	}
+	if (size > 0xFFFFFFFFu) {
+		fprintf(stderr, "dmarequest: the response to GET_DAT_M is too large\n");
+		FREE(range);
+		return;
+	}
 
-		data->def->nchans    = header->def->nchans;
-		data->def->nsamples  = current_max_num_sample;
-		data->def->data_type = header->def->data_type;
-		data->buf = malloc(header->def->nchans*current_max_num_sample*wordsize);
+	response->def->command = GET_OK;
+	if (nrange == 0) {
+		FREE(range);
+		return;
+	}
 
-		DIE_BAD_MALLOC(data->buf);
+	if (sel.data_type != DATATYPE_UNKNOWN && (sel.data_type & DATASEL_CALIBRATE)) {
+		gain = malloc(nsel*sizeof(FLOAT64_T));
+		if (gain != NULL) get_resolutions(st, dest_type, (sel.nchans > 0) ? chanlist : NULL, nsel, gain);
+	}
+	response->buf = ft_msgpool_alloc(pool, (size_t) size);
+	if (response->buf == NULL || (gain == NULL && sel.data_type != DATATYPE_UNKNOWN && (sel.data_type & DATASEL_CALIBRATE))) {
+		fprintf(stderr, "dmarequest: out of memory\n");
+		FREE(response->buf);
+		FREE(gain);
+		FREE(range);
+		response->def->command = GET_ERR;
+		return;
 	}
-}
 
-void init_event(void) {
-	int verbose = 0;
-	int i;
-	if (verbose>0) fprintf(stderr, "init_event: creating event buffer\n");
-	if (header) {
-		event = (event_t*)malloc(MAXNUMEVENT*sizeof(event_t));
-		DIE_BAD_MALLOC(event);
-		for (i=0; i<MAXNUMEVENT; i++) {
-			event[i].def = NULL;
-			event[i].buf = NULL;
-		}
+	/* copy all ranges in one go, the oldest sample decides whether any was overwritten */
+	ptr = (char *) response->buf;
+	begsample = range[0].begsample;
+	for (i=0; i<nrange; i++) {
+		UINT32_T n = range[i].endsample - range[i].begsample + 1;
+		datadef_t *ddef = (datadef_t *) (ptr + sizeof(datasel_t));
+		memcpy(ptr, &range[i], sizeof(datasel_t));
+		ddef->nchans    = nsel;
+		ddef->nsamples  = (n + stride - 1) / stride;
+		ddef->data_type = dest_type;
+		ddef->bufsize   = ddef->nsamples * rowsize;
+		if (stride == 1 && sel.nchans == 0 && dest_type == st->data->def->data_type && gain == NULL)
+			copy_ring_samples(st, ddef+1, range[i].begsample, n);
+		else
+			copy_selected_samples(st, &sel, chanlist, gain, st->data->buf, st->current_max_num_sample, range[i].begsample, ddef->nsamples, ddef+1);
+		ptr += sizeof(datasel_t) + sizeof(datadef_t) + ddef->bufsize;
+		if (range[i].begsample < begsample) begsample = range[i].begsample;
+	}
+	FREE(gain);
+	FREE(range);
+
+	/* check whether the writer has started overwriting the selection while we were copying */
+	MEMORY_BARRIER();
+	if (st->ring->writelimit - begsample > st->current_max_num_sample) {
+		fprintf(stderr, "dmarequest: data was overwritten during GET_DAT_M\n");
+		pthread_mutex_lock(&mutexoverwrites);
+		ring_overwrites++;
+		pthread_mutex_unlock(&mutexoverwrites);
+		FREE(response->buf);
+		response->def->command = GET_ERR;
+		return;
 	}
+	response->def->bufsize = (UINT32_T) size;
 }
 
-
 /*****************************************************************************
  * this function handles the direct memory access to the buffer
  * and copies objects to and from memory
  *****************************************************************************/
-int dmarequest(const message_t *request, message_t **response_ptr) {
+static int handle_request(ft_stream_t *st, const message_t *request, message_t **response_ptr, int swapdata, ft_msgpool_t *pool) {
 	unsigned int offset;
 	/*
 		 int blockrequest = 0;
@@ -158,33 +2246,35 @@ int dmarequest(const message_t *request, message_t **response_ptr) {
 	struct timeval tp;
 	struct timespec ts;
 
-	/* use a local variable for datasel (in GET_DAT) */
+	/* use a local variable for datasel and the sample count (in GET_DAT) */
 	datasel_t datasel;
+	datasel_ext_t datasel_ext;
+	const UINT32_T *chanlist;
+	UINT32_T nsamples, nevents;
+
+	/* the event filter of WAIT_DAT */
+	const waitevt_t *waitevt = NULL;
+	UINT32_T filtersize = 0;
+
+	/* the samples of PUT_DAT and PUT_DAT_T, and the time of the first sample */
+	const char *databuf;
+	UINT32_T datasize;
+	UINT64_T blocktime = 0;
 
 	/* these are for typecasting */
 	headerdef_t    *headerdef;
 	datadef_t      *datadef;
-	eventdef_t     *eventdef;
 	eventsel_t     *eventsel;
 
 	/* this will hold the response */
 	message_t *response;
-	response      = (message_t*)malloc(sizeof(message_t));
+	response      = ft_msgpool_message(pool);
 
 	/* check for "out of memory" problems */
 	if (response == NULL) {
 		*response_ptr = NULL;
 		return -1;
 	}
-	response->def = (messagedef_t*)malloc(sizeof(messagedef_t));
-
-	/* check for "out of memory" problems */
-	if (response->def == NULL) {
-		*response_ptr = NULL;
-		free(response);
-		return -1;
-	}
-	response->buf = NULL;
 	/* the response should be passed to the calling function, where it should be freed */
 	*response_ptr = response;
 
@@ -194,124 +2284,129 @@ int dmarequest(const message_t *request, message_t **response_ptr) {
 
 		case PUT_HDR:
 			if (verbose>1) fprintf(stderr, "dmarequest: PUT_HDR\n");
-			pthread_mutex_lock(&mutexheader);
-			pthread_mutex_lock(&mutexdata);
-			pthread_mutex_lock(&mutexevent);
+			lock_ring_exclusive(st);
+			lock_mutex(&st->mutexheader);
+			lock_mutex(&st->mutexdata);
+			lock_mutex(&st->mutexevent);
 
 			headerdef = (headerdef_t*)request->buf;
 			if (verbose>1) print_headerdef(headerdef);
 
-			/* delete the old header, data and events */
-			free_header();
-			free_data();
-			free_event();
+			/* a header of which the ring cannot be addressed is refused, the old one stays */
+			if (check_ring_size(headerdef) != 0) {
+				fprintf(stderr, "dmarequest: the sample ring does not fit in the address space\n");
+				response->def->version = VERSION;
+				response->def->command = PUT_ERR;
+				response->def->bufsize = 0;
+				pthread_mutex_unlock(&st->mutexevent);
+				pthread_mutex_unlock(&st->mutexdata);
+				pthread_mutex_unlock(&st->mutexheader);
+				pthread_rwlock_unlock(&st->rwlockring);
+				break;
+			}
+
+			/* delete the old header, data and events, their memory is reused if the new header fits */
+			free_stream_header(st);
+			free_stream_data(st, 1);
+			free_stream_event(st, 1);
 
 			/* store the header and re-initialize */
-			header      = (header_t*)malloc(sizeof(header_t));
-			DIE_BAD_MALLOC(header);
-			header->def = (headerdef_t*)malloc(sizeof(headerdef_t));
-			DIE_BAD_MALLOC(header->def);
-			header->buf = malloc(headerdef->bufsize);
-			DIE_BAD_MALLOC(header->buf);
-			memcpy(header->def, request->buf, sizeof(headerdef_t));
-			memcpy(header->buf, (char*)request->buf+sizeof(headerdef_t), headerdef->bufsize);
-			header->def->nsamples = 0;
-			header->def->nevents  = 0;
-
-			init_data();
-			init_event();
+			st->header      = (header_t*)malloc(sizeof(header_t));
+			DIE_BAD_MALLOC(st->header);
+			st->header->def = (headerdef_t*)malloc(sizeof(headerdef_t));
+			DIE_BAD_MALLOC(st->header->def);
+			st->header->buf = malloc(headerdef->bufsize);
+			DIE_BAD_MALLOC(st->header->buf);
+			memcpy(st->header->def, request->buf, sizeof(headerdef_t));
+			memcpy(st->header->buf, (char*)request->buf+sizeof(headerdef_t), headerdef->bufsize);
+			st->header->def->nsamples = 0;
+			st->header->def->nevents  = 0;
+
+			/* the events go first, since init_data also creates their copy in shared memory */
+			init_event(st);
+			init_data(st);
 
 			response->def->version = VERSION;
 			response->def->bufsize = 0;
 			/* check whether memory could indeed be allocated */
-			if (data!= NULL && data->buf != NULL && data->def != NULL) {
+			if (st->data!= NULL && st->data->buf != NULL && st->data->def != NULL) {
 				response->def->command = PUT_OK;
 			} else {
 				/* let's at least tell the client that something's wrong */
 				response->def->command = PUT_ERR;
 			}
 
-			pthread_mutex_unlock(&mutexevent);
-			pthread_mutex_unlock(&mutexdata);
-			pthread_mutex_unlock(&mutexheader);
+			pthread_mutex_unlock(&st->mutexevent);
+			pthread_mutex_unlock(&st->mutexdata);
+			nsamples = st->header ? st->header->def->nsamples : 0;
+			nevents  = st->header ? st->header->def->nevents  : 0;
+			pthread_mutex_unlock(&st->mutexheader);
+			pthread_rwlock_unlock(&st->rwlockring);
+			notify_waiters(st, nsamples, nevents);
 			break;
 
 		case PUT_DAT:
+		case PUT_DAT_T:
 			if (verbose>1) fprintf(stderr, "dmarequest: PUT_DAT\n");
-			pthread_mutex_lock(&mutexheader);
-			pthread_mutex_lock(&mutexdata);
+			/* PUT_DAT_T has the time of the first sample in front of the datadef_t */
+			databuf  = (const char *) request->buf;
+			datasize = request->def->bufsize;
+			if (request->def->command == PUT_DAT_T) {
+				if (datasize < sizeof(UINT64_T)) {
+					datasize = 0;
+				} else {
+					memcpy(&blocktime, databuf, sizeof(UINT64_T));
+					databuf  += sizeof(UINT64_T);
+					datasize -= sizeof(UINT64_T);
+				}
+			}
 
-			datadef = (datadef_t*)request->buf;
-			if (verbose>1) print_datadef(datadef);
-			if (verbose>2) print_buf(request->buf, request->def->bufsize);
+			/* the header and ring geometry cannot change while we hold the ring lock,
+			   so mutexheader is only needed for updating the number of samples */
+			lock_ring_shared(st);
+			lock_mutex(&st->mutexdata);
+
+			if (verbose>1 && datasize >= sizeof(datadef_t)) print_datadef((datadef_t*)databuf);
+			if (verbose>2) print_buf((void*)databuf, datasize);
 
 			response->def->version = VERSION;
 			response->def->bufsize = 0;
-			if (request->def->bufsize < sizeof(datadef_t))
-				response->def->command = PUT_ERR;
-			else if (header==NULL || data==NULL)
-				response->def->command = PUT_ERR;
-			else if (header->def->nchans != datadef->nchans)
-				response->def->command = PUT_ERR;
-			else if (header->def->data_type != datadef->data_type)
-				response->def->command = PUT_ERR;
-			else if (datadef->nsamples > current_max_num_sample)
+			if (check_put_data(st, databuf, datasize) != 0)
 				response->def->command = PUT_ERR;
 			else {
-				unsigned int i;
-				unsigned int wordsize = wordsize_from_type(header->def->data_type);
-				unsigned int datasize = wordsize * datadef->nsamples * datadef->nchans;
-
 				response->def->command = PUT_OK;
 
-				if (wordsize == 0) {
-					fprintf(stderr, "dmarequest: unsupported data type (%d)\n", datadef->data_type);
-					response->def->command = PUT_ERR;
-				} else if (datasize > datadef->bufsize || (datadef->bufsize + sizeof(datadef_t)) > request->def->bufsize) {
-					fprintf(stderr, "dmarequest: invalid size definitions in PUT_DAT request\n");
-					response->def->command = PUT_ERR;
-				} else {
+				if (store_data(st, databuf, swapdata) != 0) {
+					pthread_mutex_unlock(&st->mutexdata);
+					pthread_rwlock_unlock(&st->rwlockring);
+					return -1;
+				}
+				if (request->def->command == PUT_DAT_T) {
+					UINT32_T n = ((const datadef_t *) databuf)->nsamples;
+					store_timestamp(st, blocktime, st->ring->nsamples - n, n);
+				}
 
-					/* record the time at which the data was received */
-					if (clock_gettime(CLOCK_REALTIME, &putdat_clock) != 0) {
-						perror("clock_gettime");
-						return -1;
-					}
+				lock_mutex(&st->mutexheader);
+				st->header->def->nsamples = st->ring->nsamples;
+				nsamples = st->header->def->nsamples;
+				nevents  = st->header->def->nevents;
+				pthread_mutex_unlock(&st->mutexheader);
 
-					/* number of bytes per sample (all channels) is given by wordsize x number of channels */
-					unsigned int chansize = wordsize * data->def->nchans;
-					/* request_data points to actual data samples within the request, use char* for convenience */
-					const char *request_data = (const char *) request->buf + sizeof(datadef_t);
-					char *buffer_data = (char *)data->buf;
-
-					for (i=0; i<datadef->nsamples; i++) {
-						memcpy(buffer_data+(thissample*chansize), request_data+(i*chansize), chansize);
-						header->def->nsamples++;
-						thissample++;
-						thissample = WRAP(thissample, current_max_num_sample);
-					}
-					/* Signal possibly waiting threads that we have received data */
-					pthread_cond_broadcast(&getData_cond);
-				}
+				/* wake up the waiting clients whose threshold has been exceeded */
+				notify_waiters(st, nsamples, nevents);
 			}
 
-			pthread_mutex_unlock(&mutexdata);
-			pthread_mutex_unlock(&mutexheader);
+			pthread_mutex_unlock(&st->mutexdata);
+			pthread_rwlock_unlock(&st->rwlockring);
 			break;
 
 		case PUT_EVT:
 			if (verbose>1) fprintf(stderr, "dmarequest: PUT_EVT\n");
-			pthread_mutex_lock(&mutexheader);
-			pthread_mutex_lock(&mutexevent);
-
-			/* record the time at which the event was received */
-			if (clock_gettime(CLOCK_REALTIME, &putevt_clock) != 0) {
-				perror("clock_gettime");
-				return -1;
-			}
+			lock_mutex(&st->mutexheader);
+			lock_mutex(&st->mutexevent);
 
 			/* Give an error message if there is no header, or if the given event array is defined badly */
-			if (header==NULL || event==NULL || check_event_array(request->def->bufsize, request->buf) < 0) {
+			if (st->header==NULL || st->event==NULL || check_event_array(request->def->bufsize, request->buf) < 0) {
 				response->def->version = VERSION;
 				response->def->command = PUT_ERR;
 				response->def->bufsize = 0;
@@ -321,72 +2416,290 @@ int dmarequest(const message_t *request, message_t **response_ptr) {
 				response->def->command = PUT_OK;
 				response->def->bufsize = 0;
 
-				offset = 0; /* this represents the offset of the event in the buffer */
-				while (offset<request->def->bufsize) {
-					FREE(event[thisevent].def);
-					FREE(event[thisevent].buf);
+				if (store_events(st, request->buf, request->def->bufsize) != 0) {
+					pthread_mutex_unlock(&st->mutexevent);
+					pthread_mutex_unlock(&st->mutexheader);
+					return -1;
+				}
+			}
+
+			nsamples = st->header ? st->header->def->nsamples : 0;
+			nevents  = st->header ? st->header->def->nevents  : 0;
+			pthread_mutex_unlock(&st->mutexevent);
+			pthread_mutex_unlock(&st->mutexheader);
 
-					eventdef = (eventdef_t*)((char*)request->buf+offset);
-					if (verbose>1) print_eventdef(eventdef);
+			/* wake up the waiting clients whose threshold has been exceeded */
+			notify_waiters(st, nsamples, nevents);
+			break;
 
-					event[thisevent].def = (eventdef_t*)malloc(sizeof(eventdef_t));
-					DIE_BAD_MALLOC(event[thisevent].def);
-					memcpy(event[thisevent].def, (char*)request->buf+offset, sizeof(eventdef_t));
+		case PUT_BATCH:
+			/* a sequence of PUT_DAT, PUT_DAT_T and PUT_EVT messages, which are all checked
+			   before any of them is applied, and which are applied while holding
+			   the locks of both, so that events end up with their samples */
+			if (verbose>1) fprintf(stderr, "dmarequest: PUT_BATCH\n");
+			lock_ring_shared(st);
+			lock_mutex(&st->mutexdata);
+			lock_mutex(&st->mutexheader);
+			lock_mutex(&st->mutexevent);
 
-					if (event[thisevent].def->sample == EVENT_AUTO_SAMPLE) {
-						/* automatically convert event->def->sample to current sample number */
-						/* make some fine adjustment of the assigned sample number */
-						double adjust = (putevt_clock.tv_sec - putdat_clock.tv_sec) + (double)(putevt_clock.tv_nsec - putdat_clock.tv_nsec) / 1000000000L;
-						event[thisevent].def->sample = header->def->nsamples + (int)(header->def->fsample*adjust);
-					}
+			response->def->version = VERSION;
+			response->def->bufsize = 0;
+			response->def->command = PUT_OK;
+
+			/* first pass: check all messages */
+			offset = 0;
+			while (offset < request->def->bufsize) {
+				const messagedef_t *subdef = (const messagedef_t *) ((char*)request->buf + offset);
+				const void *subbuf = (char*)request->buf + offset + sizeof(messagedef_t);
+
+				if (offset + sizeof(messagedef_t) > request->def->bufsize || offset + sizeof(messagedef_t) + subdef->bufsize > request->def->bufsize) {
+					response->def->command = PUT_ERR;
+				}
+				else if (subdef->command == PUT_DAT) {
+					if (check_put_data(st, subbuf, subdef->bufsize) != 0) response->def->command = PUT_ERR;
+				}
+				else if (subdef->command == PUT_DAT_T) {
+					if (subdef->bufsize < sizeof(UINT64_T) || check_put_data(st, (const char *) subbuf + sizeof(UINT64_T), subdef->bufsize - sizeof(UINT64_T)) != 0) response->def->command = PUT_ERR;
+				}
+				else if (subdef->command == PUT_EVT) {
+					if (st->header==NULL || st->event==NULL || check_event_array(subdef->bufsize, subbuf) < 0) response->def->command = PUT_ERR;
+				}
+				else {
+					response->def->command = PUT_ERR;
+				}
+				if (response->def->command == PUT_ERR) {
+					fprintf(stderr, "dmarequest: invalid message in PUT_BATCH request\n");
+					break;
+				}
+				offset += sizeof(messagedef_t) + subdef->bufsize;
+			}
 
-					offset += sizeof(eventdef_t);
-					event[thisevent].buf = malloc(eventdef->bufsize);
-					DIE_BAD_MALLOC(event[thisevent].buf);
-					memcpy(event[thisevent].buf, (char*)request->buf+offset, eventdef->bufsize);
-					offset += eventdef->bufsize;
-					if (verbose>1) print_eventdef(event[thisevent].def);
-					thisevent++;
-					thisevent = WRAP(thisevent, MAXNUMEVENT);
-					header->def->nevents++;
+			/* second pass: store them */
+			offset = 0;
+			while (response->def->command == PUT_OK && offset < request->def->bufsize) {
+				const messagedef_t *subdef = (const messagedef_t *) ((char*)request->buf + offset);
+				const void *subbuf = (char*)request->buf + offset + sizeof(messagedef_t);
+				int status;
+
+				if (subdef->command == PUT_DAT) {
+					status = store_data(st, subbuf, 0);
+					st->header->def->nsamples = st->ring->nsamples;
+				} else if (subdef->command == PUT_DAT_T) {
+					const datadef_t *subdat = (const datadef_t *) ((const char *) subbuf + sizeof(UINT64_T));
+					memcpy(&blocktime, subbuf, sizeof(UINT64_T));
+					status = store_data(st, subdat, 0);
+					if (status == 0) store_timestamp(st, blocktime, st->ring->nsamples - subdat->nsamples, subdat->nsamples);
+					st->header->def->nsamples = st->ring->nsamples;
+				} else {
+					status = store_events(st, subbuf, subdef->bufsize);
+				}
+				if (status != 0) {
+					pthread_mutex_unlock(&st->mutexevent);
+					pthread_mutex_unlock(&st->mutexheader);
+					pthread_mutex_unlock(&st->mutexdata);
+					pthread_rwlock_unlock(&st->rwlockring);
+					return -1;
 				}
+				offset += sizeof(messagedef_t) + subdef->bufsize;
 			}
 
-			pthread_mutex_unlock(&mutexevent);
-			pthread_mutex_unlock(&mutexheader);
+			nsamples = st->header ? st->header->def->nsamples : 0;
+			nevents  = st->header ? st->header->def->nevents  : 0;
+			pthread_mutex_unlock(&st->mutexevent);
+			pthread_mutex_unlock(&st->mutexheader);
+			pthread_mutex_unlock(&st->mutexdata);
+			pthread_rwlock_unlock(&st->rwlockring);
+
+			/* wake up the waiting clients whose threshold has been exceeded */
+			if (response->def->command == PUT_OK) notify_waiters(st, nsamples, nevents);
 			break;
 
 		case GET_HDR:
 			if (verbose>1) fprintf(stderr, "dmarequest: GET_HDR\n");
-			if (header==NULL) {
+			if (st->header==NULL) {
 				response->def->version = VERSION;
 				response->def->command = GET_ERR;
 				response->def->bufsize = 0;
 				break;
 			}
 
-			pthread_mutex_lock(&mutexheader);
+			lock_mutex(&st->mutexheader);
 
 			response->def->version = VERSION;
 			response->def->command = GET_OK;
 			response->def->bufsize = 0;
-			response->def->bufsize = append(&response->buf, response->def->bufsize, header->def, sizeof(headerdef_t));
-			response->def->bufsize = append(&response->buf, response->def->bufsize, header->buf, header->def->bufsize);
+			response->def->bufsize = append(&response->buf, response->def->bufsize, st->header->def, sizeof(headerdef_t));
+			response->def->bufsize = append(&response->buf, response->def->bufsize, st->header->buf, st->header->def->bufsize);
 
-			pthread_mutex_unlock(&mutexheader);
+			pthread_mutex_unlock(&st->mutexheader);
+			break;
+
+		case GET_HDR_GEN:
+			/* the chunks are only sent if the client does not have the current ones */
+			if (verbose>1) fprintf(stderr, "dmarequest: GET_HDR_GEN\n");
+			lock_mutex(&st->mutexheader);
+			if (st->header==NULL || (request->def->bufsize != 0 && request->def->bufsize != sizeof(UINT32_T))) {
+				pthread_mutex_unlock(&st->mutexheader);
+				response->def->version = VERSION;
+				response->def->command = GET_ERR;
+				response->def->bufsize = 0;
+				break;
+			}
+			else {
+				headergen_t hgen;
+				UINT32_T generation;
+
+				hgen.def = *st->header->def;
+				hgen.generation = st->header_generation;
+				response->def->version = VERSION;
+				response->def->command = GET_OK;
+				response->def->bufsize = 0;
+				response->def->bufsize = append(&response->buf, response->def->bufsize, &hgen, sizeof(headergen_t));
+				if (request->def->bufsize == sizeof(UINT32_T)) {
+					memcpy(&generation, request->buf, sizeof(UINT32_T));
+					if (generation != hgen.generation)
+						response->def->bufsize = append(&response->buf, response->def->bufsize, st->header->buf, st->header->def->bufsize);
+				}
+			}
+			pthread_mutex_unlock(&st->mutexheader);
+			break;
+
+		case GET_CAP:
+			/* the size of the ring only changes while rwlockring is held exclusively */
+			if (verbose>1) fprintf(stderr, "dmarequest: GET_CAP\n");
+			lock_ring_shared(st);
+			lock_mutex(&st->mutexheader);
+			response->def->version = VERSION;
+			response->def->command = GET_OK;
+			response->def->bufsize = sizeof(buffercap_t);
+			response->buf = malloc(sizeof(buffercap_t));
+			if (response->buf == NULL) {
+				response->def->command = GET_ERR;
+				response->def->bufsize = 0;
+			}
+			else {
+				buffercap_t *cap = (buffercap_t *) response->buf;
+				if (st->header && st->data && st->event) {
+					UINT64_T nbytes = (UINT64_T) st->current_max_num_sample * wordsize_from_type(st->data->def->data_type) * st->data->def->nchans;
+					cap->nsamples = st->current_max_num_sample;
+					cap->nevents  = st->current_max_num_event;
+					cap->nbytes   = (nbytes < 0xFFFFFFFFu) ? (UINT32_T) nbytes : 0xFFFFFFFFu;
+				} else {
+					cap->nsamples = 0;
+					cap->nevents  = 0;
+					cap->nbytes   = 0;
+				}
+				cap->maxbytes = (max_num_byte < 0xFFFFFFFFu) ? (UINT32_T) max_num_byte : 0xFFFFFFFFu;
+			}
+			pthread_mutex_unlock(&st->mutexheader);
+			pthread_rwlock_unlock(&st->rwlockring);
+			break;
+
+		case GET_TIME:
+			/* the header only changes while rwlockring is held exclusively, mutexdata protects the timestamps */
+			if (verbose>1) fprintf(stderr, "dmarequest: GET_TIME\n");
+			lock_ring_shared(st);
+			lock_mutex(&st->mutexdata);
+			response->def->version = VERSION;
+			response->def->command = GET_ERR;
+			response->def->bufsize = 0;
+			if (request->def->bufsize == 0) {
+				/* return all timestamps, the oldest first */
+				UINT32_T i, n = (st->numstamps < FT_MAXNUMTIMESTAMP) ? st->numstamps : FT_MAXNUMTIMESTAMP;
+				response->def->command = GET_OK;
+				if (n > 0) {
+					response->buf = malloc(n * sizeof(timestamp_t));
+					if (response->buf == NULL) {
+						response->def->command = GET_ERR;
+					} else {
+						for (i=0; i<n; i++) ((timestamp_t *) response->buf)[i] = *get_timestamp(st, i);
+						response->def->bufsize = n * sizeof(timestamp_t);
+					}
+				}
+			}
+			else if (request->def->bufsize == sizeof(timepoint_t)) {
+				timepoint_t tp;
+				memcpy(&tp, request->buf, sizeof(timepoint_t));
+				if (map_timepoint(st, &tp) == 0) {
+					response->def->bufsize = append(&response->buf, 0, &tp, sizeof(timepoint_t));
+					if (response->buf != NULL) response->def->command = GET_OK;
+				}
+			}
+			pthread_mutex_unlock(&st->mutexdata);
+			pthread_rwlock_unlock(&st->rwlockring);
+			break;
+
+		case GET_STATS:
+			if (verbose>1) fprintf(stderr, "dmarequest: GET_STATS\n");
+			response->def->version = VERSION;
+			response->buf = ft_stats_serialize(&response->def->bufsize);
+			if (response->buf == NULL) {
+				response->def->command = GET_ERR;
+				response->def->bufsize = 0;
+			}
+			else {
+				statsdef_t *sdef = (statsdef_t *) response->buf;
+				response->def->command = GET_OK;
+				sdef->overwrites = get_overwrite_count();
+				/* the ring control block is only replaced while rwlockring is held exclusively */
+				lock_ring_shared(st);
+				if (st->header) {
+					sdef->lostsamples = st->ring->firstsample;
+					sdef->lostevents  = st->ring->firstevent;
+				}
+				pthread_rwlock_unlock(&st->rwlockring);
+			}
+			break;
+
+		case GET_SHM:
+			/* return the name of the control segment, the socket servers only pass this on for local clients */
+			if (verbose>1) fprintf(stderr, "dmarequest: GET_SHM\n");
+			response->def->version = VERSION;
+			if (st->ring_shared) {
+				const char *name = ft_shm_server_name();
+				response->def->command = GET_OK;
+				response->def->bufsize = 0;
+				response->def->bufsize = append(&response->buf, response->def->bufsize, (void *) name, strlen(name)+1);
+			} else {
+				response->def->command = GET_ERR;
+				response->def->bufsize = 0;
+			}
 			break;
 
 		case GET_DAT:
 			if (verbose>1) fprintf(stderr, "dmarequest: GET_DAT\n");
-			if (header==NULL || data==NULL) {
+
+			/* this does not block the writer, see the comments at rwlockring */
+			lock_ring_shared(st);
+
+			if (st->header==NULL || st->data==NULL) {
+				pthread_rwlock_unlock(&st->rwlockring);
 				response->def->version = VERSION;
 				response->def->command = GET_ERR;
 				response->def->bufsize = 0;
 				break;
 			}
 
-			pthread_mutex_lock(&mutexheader);
-			pthread_mutex_lock(&mutexdata);
+			/* take a consistent snapshot of the number of samples in the ring */
+			nsamples = ring_snapshot(st);
+
+			/* the extended selection defaults to all channels and samples, in the original type */
+			datasel_ext.stride    = 1;
+			datasel_ext.data_type = DATATYPE_UNKNOWN;
+			datasel_ext.nchans    = 0;
+			chanlist = NULL;
+			if (request->def->bufsize >= sizeof(datasel_ext_t)) {
+				memcpy(&datasel_ext, request->buf, sizeof(datasel_ext_t));
+				chanlist = (const UINT32_T *) ((char*)request->buf + sizeof(datasel_ext_t));
+				if (check_datasel_ext(st, &datasel_ext, chanlist, request->def->bufsize) != 0) {
+					fprintf(stderr, "dmarequest: invalid channel selection or data type in GET_DAT\n");
+					pthread_rwlock_unlock(&st->rwlockring);
+					response->def->version = VERSION;
+					response->def->command = GET_ERR;
+					response->def->bufsize = 0;
+					break;
+				}
+			}
 
 			if (request->def->bufsize) {
 				/* the selection has been specified */
@@ -394,21 +2707,13 @@ int dmarequest(const message_t *request, message_t **response_ptr) {
 				/* If endsample is -1 read the buffer to the end */
 				if(datasel.endsample == -1)
 				{
-					datasel.endsample = header->def->nsamples - 1;
+					datasel.endsample = nsamples - 1;
 				}
 			}
 			else {
 				/* determine a valid selection */
-				if (header->def->nsamples>current_max_num_sample) {
-					/* the ringbuffer is completely full */
-					datasel.begsample = header->def->nsamples - current_max_num_sample;
-					datasel.endsample = header->def->nsamples - 1;
-				}
-				else {
-					/* the ringbuffer is not yet completely full */
-					datasel.begsample = 0;
-					datasel.endsample = header->def->nsamples - 1;
-				}
+				datasel.begsample = oldest_sample(st, nsamples);
+				datasel.endsample = nsamples - 1;
 			}
 
 			/*
@@ -433,15 +2738,14 @@ int dmarequest(const message_t *request, message_t **response_ptr) {
 			pthread_mutex_unlock(&getData_mutex);
 
 			// Lock the mutexes again
-			pthread_mutex_lock(&mutexheader);
-			pthread_mutex_lock(&mutexdata);
+			lock_mutex(&mutexheader);
+			lock_mutex(&mutexdata);
 			if(datasel.begsample == (datasel.endsample+1))
 			datasel.endsample = header->def->nsamples - 1;
 			}
 			}
 			 */
 
-			if (verbose>1) print_headerdef(header->def);
 			if (verbose>1) print_datasel(&datasel);
 
 			if (datasel.begsample < 0 || datasel.endsample < 0) {
@@ -450,22 +2754,39 @@ int dmarequest(const message_t *request, message_t **response_ptr) {
 				response->def->command = GET_ERR;
 				response->def->bufsize = 0;
 			}
-			else if (datasel.begsample >= header->def->nsamples || datasel.endsample >= header->def->nsamples) {
+			else if (datasel.begsample >= nsamples || datasel.endsample >= nsamples) {
 				fprintf(stderr, "dmarequest: err2\n");
 				response->def->version = VERSION;
 				response->def->command = GET_ERR;
 				response->def->bufsize = 0;
 			}
-			else if ((header->def->nsamples - datasel.begsample) > current_max_num_sample) {
-				fprintf(stderr, "dmarequest: err3\n");
+			else if (datasel.begsample < oldest_sample(st, nsamples)) {
+				/* these samples are no longer in the ring, but may be in the spill file */
+				datadef = copy_spilled(st, datasel.begsample, datasel.endsample - datasel.begsample + 1, nsamples);
 				response->def->version = VERSION;
 				response->def->command = GET_ERR;
 				response->def->bufsize = 0;
+				if (datadef == NULL) {
+					fprintf(stderr, "dmarequest: err3\n");
+				}
+				else if (datasel_ext.stride > 1 || datasel_ext.nchans > 0 || (datasel_ext.data_type != DATATYPE_UNKNOWN && datasel_ext.data_type != st->data->def->data_type)) {
+					response->buf = copy_selection(st, &datasel_ext, chanlist, datadef+1, datadef->nsamples, 0, datadef->nsamples, pool);
+					free(datadef);
+					if (response->buf != NULL) {
+						response->def->command = GET_OK;
+						response->def->bufsize = sizeof(datadef_t) + ((datadef_t *) response->buf)->bufsize;
+					}
+				}
+				else {
+					response->buf = datadef;
+					response->def->command = GET_OK;
+					response->def->bufsize = sizeof(datadef_t) + datadef->bufsize;
+				}
 			}
 			else {
-				unsigned int wordsize = wordsize_from_type(data->def->data_type);
+				unsigned int wordsize = wordsize_from_type(st->data->def->data_type);
 				if (wordsize==0) {
-					fprintf(stderr, "dmarequest: unsupported data type (%d)\n", data->def->data_type);
+					fprintf(stderr, "dmarequest: unsupported data type (%d)\n", st->data->def->data_type);
 					response->def->version = VERSION;
 					response->def->command = GET_ERR;
 					response->def->bufsize = 0;
@@ -478,64 +2799,122 @@ int dmarequest(const message_t *request, message_t **response_ptr) {
 					/* determine the number of samples to return */
 					n = datasel.endsample - datasel.begsample + 1;
 
-					response->buf = malloc(sizeof(datadef_t) + n*data->def->nchans*wordsize);
-					if (response->buf == NULL) {
-						/* not enough space for copying data into response */
-						fprintf(stderr, "dmarequest: out of memory\n");
-						response->def->command = GET_ERR;
+					if (datasel_ext.stride > 1 || datasel_ext.nchans > 0 || (datasel_ext.data_type != DATATYPE_UNKNOWN && datasel_ext.data_type != st->data->def->data_type)) {
+						/* pick the selected channels and samples, and convert them if requested */
+						response->buf = copy_selection(st, &datasel_ext, chanlist, st->data->buf, st->current_max_num_sample, datasel.begsample, n, pool);
+						if (response->buf == NULL) {
+							fprintf(stderr, "dmarequest: out of memory\n");
+							response->def->command = GET_ERR;
+						}
+						else {
+							response->def->bufsize = sizeof(datadef_t) + ((datadef_t *) response->buf)->bufsize;
+						}
 					}
 					else {
-						/* number of bytes per sample (all channels) */
-						unsigned int chansize = data->def->nchans * wordsize;
-
-						/* convenience pointer to start of actual data in response */
-						char *resp_data = ((char *) response->buf) + sizeof(datadef_t);
-
-						/* this is the location of begsample within the ringbuffer */
-						unsigned int start_index = 	WRAP(datasel.begsample, current_max_num_sample);
-
-						/* have datadef point into the freshly allocated response buffer and directly
-							 fill in the information */
-						datadef = (datadef_t *) response->buf;
-						datadef->nchans    = data->def->nchans;
-						datadef->data_type = data->def->data_type;
-						datadef->nsamples  = n;
-						datadef->bufsize   = n*chansize;
-
-						response->def->bufsize = sizeof(datadef_t) + datadef->bufsize;
-
-						if (start_index + n <= current_max_num_sample) {
-							/* we can copy everything in one go */
-							memcpy(resp_data, (char*)(data->buf) + start_index*chansize, n*chansize);
-						} else {
-							/* need to wrap around at current_max_num_sample */
-							unsigned int na = current_max_num_sample - start_index;
-							unsigned int nb = n - na;
-
-							memcpy(resp_data, (char*)(data->buf) + start_index*chansize, na*chansize);
-							memcpy(resp_data + na*chansize, (char*)(data->buf), nb*chansize);
+						if ((UINT64_T) n*st->data->def->nchans*wordsize > 0xFFFFFFFFu - sizeof(datadef_t)) {
+							/* the response would not fit in the messagedef_t */
+							fprintf(stderr, "dmarequest: the selection of GET_DAT is too large\n");
+							response->buf = NULL;
+						}
+						else {
+							response->buf = ft_msgpool_alloc(pool, sizeof(datadef_t) + (size_t) n*st->data->def->nchans*wordsize);
+						}
+						if (response->buf == NULL) {
+							/* not enough space for copying data into response */
+							fprintf(stderr, "dmarequest: out of memory\n");
+							response->def->command = GET_ERR;
+						}
+						else {
+							/* number of bytes per sample (all channels) */
+							unsigned int chansize = st->data->def->nchans * wordsize;
+
+							/* convenience pointer to start of actual data in response */
+							char *resp_data = ((char *) response->buf) + sizeof(datadef_t);
+
+							/* this is the location of begsample within the ringbuffer */
+							unsigned int start_index = datasel.begsample % st->current_max_num_sample;
+
+							/* have datadef point into the freshly allocated response buffer and directly
+								 fill in the information */
+							datadef = (datadef_t *) response->buf;
+							datadef->nchans    = st->data->def->nchans;
+							datadef->data_type = st->data->def->data_type;
+							datadef->nsamples  = n;
+							datadef->bufsize   = n*chansize;
+
+							response->def->bufsize = sizeof(datadef_t) + datadef->bufsize;
+
+							if (start_index + n <= st->current_max_num_sample) {
+								/* we can copy everything in one go */
+								memcpy(resp_data, (char*)(st->data->buf) + (size_t) start_index*chansize, n*chansize);
+							} else {
+								/* need to wrap around at current_max_num_sample */
+								unsigned int na = st->current_max_num_sample - start_index;
+								unsigned int nb = n - na;
+
+								memcpy(resp_data, (char*)(st->data->buf) + (size_t) start_index*chansize, na*chansize);
+								memcpy(resp_data + na*chansize, (char*)(st->data->buf), nb*chansize);
+
+								/* printf("Wrapped around!\n"); */
+							}
+						}
+					}
 
-							/* printf("Wrapped around!\n"); */
+					if (response->buf != NULL) {
+						/* check whether the writer has started overwriting the selection while we were copying */
+						MEMORY_BARRIER();
+						if (st->ring->writelimit - datasel.begsample > st->current_max_num_sample) {
+							fprintf(stderr, "dmarequest: data was overwritten during GET_DAT\n");
+							pthread_mutex_lock(&mutexoverwrites);
+							ring_overwrites++;
+							pthread_mutex_unlock(&mutexoverwrites);
+							FREE(response->buf);
+							response->def->command = GET_ERR;
+							response->def->bufsize = 0;
 						}
 					}
 				}
 			}
 
-			pthread_mutex_unlock(&mutexdata);
-			pthread_mutex_unlock(&mutexheader);
+			pthread_rwlock_unlock(&st->rwlockring);
+			break;
+
+		case GET_DAT_M:
+			if (verbose>1) fprintf(stderr, "dmarequest: GET_DAT_M\n");
+
+			/* like GET_DAT, this does not block the writer */
+			lock_ring_shared(st);
+			if (st->header==NULL || st->data==NULL) {
+				response->def->version = VERSION;
+				response->def->command = GET_ERR;
+				response->def->bufsize = 0;
+			}
+			else {
+				get_data_ranges(st, request->buf, request->def->bufsize, response, pool);
+			}
+			pthread_rwlock_unlock(&st->rwlockring);
 			break;
 
 		case GET_EVT:
 			if (verbose>1) fprintf(stderr, "dmarequest: GET_EVT\n");
-			if (header==NULL || event==NULL || header->def->nevents==0) {
+			if (request->def->bufsize > sizeof(eventsel_t)) {
+				/* the selection is followed by a filter */
+				lock_mutex(&st->mutexheader);
+				lock_mutex(&st->mutexevent);
+				get_filtered_events(st, request->buf, request->def->bufsize, response, pool);
+				pthread_mutex_unlock(&st->mutexevent);
+				pthread_mutex_unlock(&st->mutexheader);
+				break;
+			}
+			if (st->header==NULL || st->event==NULL || st->header->def->nevents==0) {
 				response->def->version = VERSION;
 				response->def->command = GET_ERR;
 				response->def->bufsize = 0;
 				break;
 			}
 
-			pthread_mutex_lock(&mutexheader);
-			pthread_mutex_lock(&mutexevent);
+			lock_mutex(&st->mutexheader);
+			lock_mutex(&st->mutexevent);
 
 			eventsel = (eventsel_t*)malloc(sizeof(eventsel_t));
 			DIE_BAD_MALLOC(eventsel);
@@ -547,19 +2926,11 @@ int dmarequest(const message_t *request, message_t **response_ptr) {
 			}
 			else {
 				/* determine a valid selection */
-				if (header->def->nevents>MAXNUMEVENT) {
-					/* the ringbuffer is completely full */
-					eventsel->begevent = header->def->nevents - MAXNUMEVENT;
-					eventsel->endevent = header->def->nevents - 1;
-				}
-				else {
-					/* the ringbuffer is not yet completely full */
-					eventsel->begevent = 0;
-					eventsel->endevent = header->def->nevents - 1;
-				}
+				eventsel->begevent = oldest_event(st, st->header->def->nevents);
+				eventsel->endevent = st->header->def->nevents - 1;
 			}
 
-			if (verbose>1) print_headerdef(header->def);
+			if (verbose>1) print_headerdef(st->header->def);
 			if (verbose>1) print_eventsel(eventsel);
 
 			if (eventsel==NULL) {
@@ -573,20 +2944,22 @@ int dmarequest(const message_t *request, message_t **response_ptr) {
 				response->def->command = GET_ERR;
 				response->def->bufsize = 0;
 			}
-			else if (eventsel->begevent >= header->def->nevents || eventsel->endevent >= header->def->nevents) {
+			else if (eventsel->begevent >= st->header->def->nevents || eventsel->endevent >= st->header->def->nevents) {
 				fprintf(stderr, "dmarequest: err5\n");
 				response->def->version = VERSION;
 				response->def->command = GET_ERR;
 				response->def->bufsize = 0;
 			}
-			else if ((header->def->nevents-eventsel->begevent) > MAXNUMEVENT) {
+			else if (eventsel->begevent < oldest_event(st, st->header->def->nevents)) {
 				fprintf(stderr, "dmarequest: err6\n");
 				response->def->version = VERSION;
 				response->def->command = GET_ERR;
 				response->def->bufsize = 0;
 			}
 			else {
-				unsigned int j,n;
+				unsigned int j,n,size;
+				event_t *thisev;
+				char *ptr;
 
 				response->def->version = VERSION;
 				response->def->command = GET_OK;
@@ -595,26 +2968,43 @@ int dmarequest(const message_t *request, message_t **response_ptr) {
 				/* determine the number of events to return */
 				n = eventsel->endevent - eventsel->begevent + 1;
 
+				/* determine the size of the response, so that it can be allocated in one go */
+				size = 0;
 				for (j=0; j<n; j++) {
-					if (verbose>1) print_eventdef(event[WRAP(eventsel->begevent+j, MAXNUMEVENT)].def);
-					response->def->bufsize = append(&response->buf, response->def->bufsize, event[WRAP(eventsel->begevent+j, MAXNUMEVENT)].def, sizeof(eventdef_t));
-					response->def->bufsize = append(&response->buf, response->def->bufsize, event[WRAP(eventsel->begevent+j, MAXNUMEVENT)].buf, event[WRAP(eventsel->begevent+j, MAXNUMEVENT)].def->bufsize);
+					size += sizeof(eventdef_t) + st->event[(eventsel->begevent+j) % st->current_max_num_event].def->bufsize;
+				}
+				response->buf = ft_msgpool_alloc(pool, size);
+				if (response->buf == NULL) {
+					response->def->command = GET_ERR;
+				}
+				else {
+					ptr = (char *) response->buf;
+					for (j=0; j<n; j++) {
+						thisev = &st->event[(eventsel->begevent+j) % st->current_max_num_event];
+						if (verbose>1) print_eventdef(thisev->def);
+						memcpy(ptr, thisev->def, sizeof(eventdef_t));
+						ptr += sizeof(eventdef_t);
+						memcpy(ptr, thisev->buf, thisev->def->bufsize);
+						ptr += thisev->def->bufsize;
+					}
+					response->def->bufsize = size;
 				}
 			}
 
 			FREE(eventsel);
-			pthread_mutex_unlock(&mutexevent);
-			pthread_mutex_unlock(&mutexheader);
+			pthread_mutex_unlock(&st->mutexevent);
+			pthread_mutex_unlock(&st->mutexheader);
 			break;
 
 		case FLUSH_HDR:
-			pthread_mutex_lock(&mutexheader);
-			pthread_mutex_lock(&mutexdata);
-			pthread_mutex_lock(&mutexevent);
-			if (header) {
-				free_header();
-				free_data();
-				free_event();
+			lock_ring_exclusive(st);
+			lock_mutex(&st->mutexheader);
+			lock_mutex(&st->mutexdata);
+			lock_mutex(&st->mutexevent);
+			if (st->header) {
+				free_stream_header(st);
+				free_stream_data(st, 0);
+				free_stream_event(st, 0);
 				response->def->version = VERSION;
 				response->def->command = FLUSH_OK;
 				response->def->bufsize = 0;
@@ -624,16 +3014,23 @@ int dmarequest(const message_t *request, message_t **response_ptr) {
 				response->def->command = FLUSH_ERR;
 				response->def->bufsize = 0;
 			}
-			pthread_mutex_unlock(&mutexevent);
-			pthread_mutex_unlock(&mutexdata);
-			pthread_mutex_unlock(&mutexheader);
+			pthread_mutex_unlock(&st->mutexevent);
+			pthread_mutex_unlock(&st->mutexdata);
+			nsamples = st->header ? st->header->def->nsamples : 0;
+			nevents  = st->header ? st->header->def->nevents  : 0;
+			pthread_mutex_unlock(&st->mutexheader);
+			pthread_rwlock_unlock(&st->rwlockring);
+			notify_waiters(st, nsamples, nevents);
 			break;
 
 		case FLUSH_DAT:
-			pthread_mutex_lock(&mutexheader);
-			pthread_mutex_lock(&mutexdata);
-			if (header && data) {
-				header->def->nsamples = thissample = 0;
+			lock_ring_exclusive(st);
+			lock_mutex(&st->mutexheader);
+			lock_mutex(&st->mutexdata);
+			if (st->header && st->data) {
+				st->header->def->nsamples = st->thissample = 0;
+				st->numstamps = 0;
+				ring_reset(st);
 				response->def->version = VERSION;
 				response->def->command = FLUSH_OK;
 				response->def->bufsize = 0;
@@ -643,21 +3040,22 @@ int dmarequest(const message_t *request, message_t **response_ptr) {
 				response->def->command = FLUSH_ERR;
 				response->def->bufsize = 0;
 			}
-			pthread_mutex_unlock(&mutexdata);
-			pthread_mutex_unlock(&mutexheader);
+			pthread_mutex_unlock(&st->mutexdata);
+			nsamples = st->header ? st->header->def->nsamples : 0;
+			nevents  = st->header ? st->header->def->nevents  : 0;
+			pthread_mutex_unlock(&st->mutexheader);
+			pthread_rwlock_unlock(&st->rwlockring);
+			notify_waiters(st, nsamples, nevents);
 			break;
 
 		case FLUSH_EVT:
-			pthread_mutex_lock(&mutexheader);
-			pthread_mutex_lock(&mutexevent);
-			if (header && event) {
-				unsigned int i;
-
-				header->def->nevents = thisevent = 0;
-				for (i=0; i<MAXNUMEVENT; i++) {
-					FREE(event[i].def);
-					FREE(event[i].buf);
-				}
+			lock_mutex(&st->mutexheader);
+			lock_mutex(&st->mutexevent);
+			if (st->header && st->event) {
+				/* the slots keep their allocation for the next events */
+				st->header->def->nevents = st->thisevent = 0;
+				ring_reset_event(st);
+				ft_evidx_clear(&st->event_index, 0);
 				response->def->version = VERSION;
 				response->def->command = FLUSH_OK;
 				response->def->bufsize = 0;
@@ -667,8 +3065,11 @@ int dmarequest(const message_t *request, message_t **response_ptr) {
 				response->def->command = FLUSH_ERR;
 				response->def->bufsize = 0;
 			}
-			pthread_mutex_unlock(&mutexevent);
-			pthread_mutex_unlock(&mutexheader);
+			nsamples = st->header ? st->header->def->nsamples : 0;
+			nevents  = st->header ? st->header->def->nevents  : 0;
+			pthread_mutex_unlock(&st->mutexevent);
+			pthread_mutex_unlock(&st->mutexheader);
+			notify_waiters(st, nsamples, nevents);
 			break;
 
 		case WAIT_DAT:
@@ -679,40 +3080,57 @@ int dmarequest(const message_t *request, message_t **response_ptr) {
 				 only for the time given in waitdef_t.milliseconds.
 				 The response is just the number of samples and events
 				 in the buffer as described by samples_events_t.
+				 With a waitevt_t and a filter after the waitdef_t, the
+				 client also waits for a matching event, see message.h
 			 */
 			response->def->version = VERSION;
-			if (header==NULL || request->def->bufsize!=sizeof(waitdef_t)) {
+			if (request->def->bufsize > sizeof(waitdef_t)) {
+				waitevt = (const waitevt_t *) ((const char *) request->buf + sizeof(waitdef_t));
+				filtersize = request->def->bufsize - sizeof(waitdef_t) - sizeof(waitevt_t);
+			}
+			if (st->header==NULL || (request->def->bufsize!=sizeof(waitdef_t) && (request->def->bufsize < sizeof(waitdef_t) + sizeof(waitevt_t) || ft_evidx_check_filter(filtersize, waitevt+1) != 0))) {
 				response->def->command = WAIT_ERR;
 				response->def->bufsize = 0;
 			} else {
-				int waiterr;
+				int waiterr = 0;
 				waitdef_t *wd = (waitdef_t *) request->buf;
-				samples_events_t *nret = malloc(sizeof(samples_events_t));
-				UINT32_T nsmp, nevt;
-
-				if (nret == NULL) {
-					/* highly unlikely, but we cannot allocate a sample_event_t - return an error */
-					response->def->command = WAIT_ERR;
-					response->def->bufsize = 0;
-					break;
+				samples_events_t nret;
+				waiter_t W;
+				pthread_cond_t cond;
+
+				W.threshold = wd->threshold;
+				W.filter    = NULL;
+				W.matched   = 0;
+				W.matchevent = 0;
+				if (waitevt) {
+					/* look at the events that are in the buffer already */
+					lock_mutex(&st->mutexheader);
+					lock_mutex(&st->mutexevent);
+					waiterr = waiter_init_filter(st, &W, waitevt, filtersize, waitevt+1);
+					pthread_mutex_lock(&st->mutexwait);
+					pthread_mutex_unlock(&st->mutexevent);
+					pthread_mutex_unlock(&st->mutexheader);
+					if (waiterr != 0) {
+						pthread_mutex_unlock(&st->mutexwait);
+						response->def->command = WAIT_ERR;
+						response->def->bufsize = 0;
+						break;
+					}
+				}
+				else {
+					/* get current number of samples */
+					pthread_mutex_lock(&st->mutexwait);
 				}
-				/* Let response->buf point to the new sample_event_t structure */
-				response->def->command = WAIT_OK;
-				response->def->bufsize = sizeof(samples_events_t);
-				response->buf = nret;
-
-				/* get current number of samples */
-				pthread_mutex_lock(&mutexheader);
-				nsmp = header->def->nsamples;
-				nevt = header->def->nevents;
-				pthread_mutex_unlock(&mutexheader);
 
-				if (wd->milliseconds == 0 || nsmp > wd->threshold.nsamples || nevt > wd->threshold.nevents) {
+				if (wd->milliseconds == 0 || st->wait_nsamples > W.threshold.nsamples || st->wait_nevents > W.threshold.nevents) {
 					/* the client doesn't want to wait, or
 						 we're already above the threshold:
 						 return immediately */
-					nret->nsamples = nsmp;
-					nret->nevents = nevt;
+					nret.nsamples = st->wait_nsamples;
+					nret.nevents  = st->wait_nevents;
+					pthread_mutex_unlock(&st->mutexwait);
+					trace_wakeup(st, &W.threshold, &nret);
+					wait_response(st, response, &nret, W.matched && nret.nsamples > W.matchsample, W.matchevent, pool);
 					break;
 				}
 				gettimeofday(&tp, NULL);
@@ -723,29 +3141,161 @@ int dmarequest(const message_t *request, message_t **response_ptr) {
 					ts.tv_nsec-=1000000000;
 				}
 
-				/* FIXME: The getData condition variable is only triggered by incoming data, not events */
-				do {
-					pthread_mutex_lock(&getData_mutex);
-					waiterr = pthread_cond_timedwait(&getData_cond, &getData_mutex, &ts);
-					pthread_mutex_unlock(&getData_mutex);
-
-					/* get current number of samples */
-					pthread_mutex_lock(&mutexheader);
-					nsmp = header->def->nsamples;
-					nevt = header->def->nevents;
-					pthread_mutex_unlock(&mutexheader);
-				} while (nsmp <= wd->threshold.nsamples && nevt <= wd->threshold.nevents && waiterr==0);
-				nret->nsamples = nsmp;
-				nret->nevents = nevt;
+				/* register ourselves, we will only be woken up once our threshold has been exceeded */
+				pthread_cond_init(&cond, NULL);
+				W.woken  = 0;
+				W.cond   = &cond;
+				W.notify = NULL;
+				W.stream = st;
+				waitlist_insert(&W);
+
+				ft_stats_wait_begin();
+				while (!W.woken && waiterr==0) {
+					waiterr = pthread_cond_timedwait(&cond, &st->mutexwait, &ts);
+				}
+				ft_stats_wait_end();
+				if (W.woken) {
+					update_wait_statistics(wait_time() - W.wakeup_time);
+				} else {
+					/* timeout */
+					waitlist_remove(&W);
+				}
+				nret.nsamples = st->wait_nsamples;
+				nret.nevents  = st->wait_nevents;
+				pthread_mutex_unlock(&st->mutexwait);
+				pthread_cond_destroy(&cond);
+				trace_wakeup(st, &W.threshold, &nret);
+				wait_response(st, response, &nret, W.matched && nret.nsamples > W.matchsample, W.matchevent, pool);
 			}
 			break;
 
 		default:
 			fprintf(stderr, "dmarequest: unknown command\n");
+			/* PUT_ERR, GET_ERR, FLUSH_ERR or WAIT_ERR, depending on the group of the command */
+			response->def->version = VERSION;
+			response->def->command = (request->def->command & 0xFF00) | 0x0005;
+			response->def->bufsize = 0;
 	}
 
-	if (verbose>0) fprintf(stderr, "dmarequest: thissample = %u, thisevent = %u\n", thissample, thisevent);
+	if (verbose>0) fprintf(stderr, "dmarequest: thissample = %u, thisevent = %u\n", st->thissample, st->thisevent);
 
 	/* everything went fine */
 	return 0;
 }
+
+/* responds with PUT_ERR, GET_ERR, FLUSH_ERR or WAIT_ERR, depending on the group of the command */
+static int error_response(message_t **response_ptr, UINT16_T command) {
+	message_t *response = (message_t*)malloc(sizeof(message_t));
+
+	*response_ptr = NULL;
+	if (response == NULL) return -1;
+	response->def = (messagedef_t*)malloc(sizeof(messagedef_t));
+	if (response->def == NULL) {
+		free(response);
+		return -1;
+	}
+	response->buf = NULL;
+	response->def->version = VERSION;
+	response->def->command = (command & 0xFF00) | 0x0005;
+	response->def->bufsize = 0;
+	*response_ptr = response;
+	return 0;
+}
+
+/* handles a STREAM_REQ, which wraps a request for a named stream (see
+ * message.h). The wrapped request is handled like any other, but with the
+ * header, data and events of that stream.
+ */
+static int handle_stream_request(const message_t *request, message_t **response_ptr, int swapdata, ft_msgpool_t *pool) {
+	const streamdef_t *streamdef = (const streamdef_t *) request->buf;
+	message_t inner;
+	ft_stream_t *st;
+
+	if (request->def->bufsize < sizeof(streamdef_t) + sizeof(messagedef_t)) {
+		fprintf(stderr, "dmarequest: invalid STREAM_REQ request\n");
+		return error_response(response_ptr, GET_ERR);
+	}
+	inner.def = (messagedef_t *) ((char *) request->buf + sizeof(streamdef_t));
+	inner.buf = (char *) request->buf + sizeof(streamdef_t) + sizeof(messagedef_t);
+	if (inner.def->bufsize != request->def->bufsize - sizeof(streamdef_t) - sizeof(messagedef_t) || inner.def->command == STREAM_REQ || memchr(streamdef->name, 0, FT_STREAM_NAMELEN) == NULL) {
+		fprintf(stderr, "dmarequest: invalid STREAM_REQ request\n");
+		return error_response(response_ptr, inner.def->command);
+	}
+
+	/* only PUT_HDR creates a stream */
+	st = find_stream(streamdef->name, inner.def->command == PUT_HDR);
+	if (st == NULL) return error_response(response_ptr, inner.def->command);
+	return handle_request(st, &inner, response_ptr, swapdata, pool);
+}
+
+int dmarequest_pool(const message_t *request, message_t **response_ptr, int swapdata, ft_msgpool_t *pool) {
+	int res;
+	/* keep track of the number of requests that are being handled, see GET_STATS */
+	ft_stats_request_begin();
+	if (request->def->command == STREAM_REQ)
+		res = handle_stream_request(request, response_ptr, swapdata, pool);
+	else
+		res = handle_request(get_default_stream(), request, response_ptr, swapdata, pool);
+	ft_stats_request_end();
+	return res;
+}
+
+int dmarequest_swap(const message_t *request, message_t **response_ptr, int swapdata) {
+	return dmarequest_pool(request, response_ptr, swapdata, NULL);
+}
+
+int dmarequest(const message_t *request, message_t **response_ptr) {
+	return dmarequest_swap(request, response_ptr, 0);
+}
+
+/* like a PUT_DAT request to the default stream, but the samples are written
+ * into the ring by the fill function, which is called for at most two
+ * contiguous pieces. This lets a local acquisition convert its samples in
+ * place instead of building a request that is copied again.
+ */
+int ft_put_data_direct(UINT32_T nchans, UINT32_T nsamples, UINT32_T data_type, ft_fill_data_t fill, void *arg) {
+	ft_stream_t *st = get_default_stream();
+	datadef_t datadef;
+	unsigned int n, done, chansize;
+	UINT32_T nevents, total;
+
+	datadef.nchans    = nchans;
+	datadef.nsamples  = nsamples;
+	datadef.data_type = data_type;
+	datadef.bufsize   = wordsize_from_type(data_type) * nchans * nsamples;
+
+	ft_stats_request_begin();
+	lock_ring_shared(st);
+	lock_mutex(&st->mutexdata);
+
+	if (check_put_data(st, &datadef, sizeof(datadef_t) + datadef.bufsize) != 0) {
+		pthread_mutex_unlock(&st->mutexdata);
+		pthread_rwlock_unlock(&st->rwlockring);
+		ft_stats_request_end();
+		return -1;
+	}
+
+	chansize = wordsize_from_type(data_type) * nchans;
+	st->putdat_clock = ft_clock_ns();
+	ring_begin_write(st, st->ring->nsamples + nsamples);
+	for (done = 0; done < nsamples; done += n) {
+		n = st->current_max_num_sample - st->thissample;
+		if (n > nsamples - done) n = nsamples - done;
+		fill((char *) st->data->buf + (size_t) st->thissample*chansize, done, n, arg);
+		st->thissample += n;
+		if (st->thissample == st->current_max_num_sample) st->thissample = 0;
+	}
+	ring_end_write(st, st->ring->nsamples + nsamples);
+
+	lock_mutex(&st->mutexheader);
+	st->header->def->nsamples = st->ring->nsamples;
+	total   = st->header->def->nsamples;
+	nevents = st->header->def->nevents;
+	pthread_mutex_unlock(&st->mutexheader);
+	notify_waiters(st, total, nevents);
+
+	pthread_mutex_unlock(&st->mutexdata);
+	pthread_rwlock_unlock(&st->rwlockring);
+	ft_stats_request_end();
+	return 0;
+}
@@ -7,52 +7,346 @@
 
 #include "buffer.h"
 
-/* TODO: see if these can be optimized using compiler intrinsics etc. */
-void ft_swap16(unsigned int numel, void *data) {
+/*
+ * The byte swapping is done by one of several implementations, which is
+ * selected on first use depending on the features of the CPU: a portable
+ * one, SSE2 and AVX2 on x86 and NEON on ARM. All of them process the data
+ * in blocks of 16 or 32 bytes, followed by the portable code for the
+ * remaining elements. Each implementation copies while swapping, the
+ * in-place functions simply pass the same pointer as source and destination.
+ * Partially overlapping source and destination are not supported.
+ */
+#if (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+  /* the target attribute allows compiling the SSE2 and AVX2 code without changing the compiler flags */
+  #define SWAP_X86
+  #define SWAP_TARGET(x) __attribute__((target(x)))
+  #include <immintrin.h>
+#elif defined(COMPILER_MSVC) && (defined(_M_X64) || defined(_M_IX86))
+  #define SWAP_X86
+  #define SWAP_TARGET(x)
+  #include <intrin.h>
+  #include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  #define SWAP_NEON
+  #include <arm_neon.h>
+#endif
+
+typedef void (*swap_copy_t)(unsigned int numel, void *dest, const void *src);
+
+static swap_copy_t swap_copy16 = NULL;
+static swap_copy_t swap_copy32 = NULL;
+static swap_copy_t swap_copy64 = NULL;
+
+static void swap_copy16_scalar(unsigned int numel, void *dest, const void *src) {
+	const char *s = (const char *) src;
+	char *d = (char *) dest;
 	unsigned int n;
-	char *d = (char *) data;
+	UINT16_T x;
 	for (n=0;n<numel;n++) {
-		char t = d[0];
-		d[0] = d[1];
-		d[1] = t;
+		memcpy(&x, s, 2);
+		x = (UINT16_T) ((x >> 8) | (x << 8));
+		memcpy(d, &x, 2);
+		s+=2;
 		d+=2;
 	}
 }
 
-void ft_swap32(unsigned int numel, void *data) {
+static void swap_copy32_scalar(unsigned int numel, void *dest, const void *src) {
+	const char *s = (const char *) src;
+	char *d = (char *) dest;
 	unsigned int n;
-	char *d = (char *) data;
+	UINT32_T x;
 	for (n=0;n<numel;n++) {
-		char t0 = d[0];
-		char t1 = d[1];
-		d[0] = d[3];
-		d[1] = d[2];
-		d[2] = t1;
-		d[3] = t0;
+		memcpy(&x, s, 4);
+		x = (x >> 24) | ((x >> 8) & 0x0000FF00) | ((x << 8) & 0x00FF0000) | (x << 24);
+		memcpy(d, &x, 4);
+		s+=4;
 		d+=4;
 	}
 }
-		
-void ft_swap64(unsigned int numel, void *data) {
+
+static void swap_copy64_scalar(unsigned int numel, void *dest, const void *src) {
+	const char *s = (const char *) src;
+	char *d = (char *) dest;
 	unsigned int n;
-	char *d = (char *) data;
+	UINT32_T lo, hi;
 	for (n=0;n<numel;n++) {
-		char t0 = d[0];
-		char t1 = d[1];
-		char t2 = d[2];
-		char t3 = d[3];
-		d[0] = d[7];
-		d[1] = d[6];
-		d[2] = d[5];
-		d[3] = d[4];
-		d[4] = t3;
-		d[5] = t2;
-		d[6] = t1;
-		d[7] = t0;
+		memcpy(&lo, s, 4);
+		memcpy(&hi, s+4, 4);
+		lo = (lo >> 24) | ((lo >> 8) & 0x0000FF00) | ((lo << 8) & 0x00FF0000) | (lo << 24);
+		hi = (hi >> 24) | ((hi >> 8) & 0x0000FF00) | ((hi << 8) & 0x00FF0000) | (hi << 24);
+		memcpy(d, &hi, 4);
+		memcpy(d+4, &lo, 4);
+		s+=8;
 		d+=8;
 	}
 }
 
+#ifdef SWAP_X86
+/* SSE2 has no byte shuffle, so the bytes are swapped within 16-bit words
+ * using shifts, after the 16-bit words have been shuffled */
+SWAP_TARGET("sse2")
+static void swap_copy16_sse2(unsigned int numel, void *dest, const void *src) {
+	const char *s = (const char *) src;
+	char *d = (char *) dest;
+	unsigned int n = numel/8;
+	while (n--) {
+		__m128i v = _mm_loadu_si128((const __m128i *) s);
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		_mm_storeu_si128((__m128i *) d, v);
+		s+=16;
+		d+=16;
+	}
+	swap_copy16_scalar(numel%8, d, s);
+}
+
+SWAP_TARGET("sse2")
+static void swap_copy32_sse2(unsigned int numel, void *dest, const void *src) {
+	const char *s = (const char *) src;
+	char *d = (char *) dest;
+	unsigned int n = numel/4;
+	while (n--) {
+		__m128i v = _mm_loadu_si128((const __m128i *) s);
+		v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(2,3,0,1)), _MM_SHUFFLE(2,3,0,1));
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		_mm_storeu_si128((__m128i *) d, v);
+		s+=16;
+		d+=16;
+	}
+	swap_copy32_scalar(numel%4, d, s);
+}
+
+SWAP_TARGET("sse2")
+static void swap_copy64_sse2(unsigned int numel, void *dest, const void *src) {
+	const char *s = (const char *) src;
+	char *d = (char *) dest;
+	unsigned int n = numel/2;
+	while (n--) {
+		__m128i v = _mm_loadu_si128((const __m128i *) s);
+		v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(0,1,2,3)), _MM_SHUFFLE(0,1,2,3));
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		_mm_storeu_si128((__m128i *) d, v);
+		s+=16;
+		d+=16;
+	}
+	swap_copy64_scalar(numel%2, d, s);
+}
+
+/* AVX2 shuffles the bytes within each 128-bit lane according to a mask */
+SWAP_TARGET("avx2")
+static void swap_copy_avx2(unsigned int nbytes, void *dest, const void *src, __m256i mask) {
+	const char *s = (const char *) src;
+	char *d = (char *) dest;
+	unsigned int n = nbytes/32;
+	while (n--) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) s);
+		_mm256_storeu_si256((__m256i *) d, _mm256_shuffle_epi8(v, mask));
+		s+=32;
+		d+=32;
+	}
+}
+
+SWAP_TARGET("avx2")
+static void swap_copy16_avx2(unsigned int numel, void *dest, const void *src) {
+	const __m256i mask = _mm256_setr_epi8(1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14, 1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14);
+	unsigned int done = numel - numel%16;
+	swap_copy_avx2(2*done, dest, src, mask);
+	swap_copy16_scalar(numel - done, (char *) dest + 2*done, (const char *) src + 2*done);
+}
+
+SWAP_TARGET("avx2")
+static void swap_copy32_avx2(unsigned int numel, void *dest, const void *src) {
+	const __m256i mask = _mm256_setr_epi8(3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12, 3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12);
+	unsigned int done = numel - numel%8;
+	swap_copy_avx2(4*done, dest, src, mask);
+	swap_copy32_scalar(numel - done, (char *) dest + 4*done, (const char *) src + 4*done);
+}
+
+SWAP_TARGET("avx2")
+static void swap_copy64_avx2(unsigned int numel, void *dest, const void *src) {
+	const __m256i mask = _mm256_setr_epi8(7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8, 7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8);
+	unsigned int done = numel - numel%4;
+	swap_copy_avx2(8*done, dest, src, mask);
+	swap_copy64_scalar(numel - done, (char *) dest + 8*done, (const char *) src + 8*done);
+}
+
+static int cpu_has_sse2(void) {
+#if defined(__x86_64__) || defined(_M_X64)
+	return 1;
+#elif defined(COMPILER_MSVC)
+	int info[4];
+	__cpuid(info, 1);
+	return (info[3] >> 26) & 1;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2");
+#endif
+}
+
+static int cpu_has_avx2(void) {
+#if defined(COMPILER_MSVC)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) return 0;
+	__cpuid(info, 1);
+	/* the operating system should save the AVX registers */
+	if (!((info[2] >> 27) & 1) || (_xgetbv(0) & 6) != 6) return 0;
+	__cpuidex(info, 7, 0);
+	return (info[1] >> 5) & 1;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif /* SWAP_X86 */
+
+#ifdef SWAP_NEON
+static void swap_copy16_neon(unsigned int numel, void *dest, const void *src) {
+	const UINT8_T *s = (const UINT8_T *) src;
+	UINT8_T *d = (UINT8_T *) dest;
+	unsigned int n = numel/8;
+	while (n--) {
+		vst1q_u8(d, vrev16q_u8(vld1q_u8(s)));
+		s+=16;
+		d+=16;
+	}
+	swap_copy16_scalar(numel%8, d, s);
+}
+
+static void swap_copy32_neon(unsigned int numel, void *dest, const void *src) {
+	const UINT8_T *s = (const UINT8_T *) src;
+	UINT8_T *d = (UINT8_T *) dest;
+	unsigned int n = numel/4;
+	while (n--) {
+		vst1q_u8(d, vrev32q_u8(vld1q_u8(s)));
+		s+=16;
+		d+=16;
+	}
+	swap_copy32_scalar(numel%4, d, s);
+}
+
+static void swap_copy64_neon(unsigned int numel, void *dest, const void *src) {
+	const UINT8_T *s = (const UINT8_T *) src;
+	UINT8_T *d = (UINT8_T *) dest;
+	unsigned int n = numel/2;
+	while (n--) {
+		vst1q_u8(d, vrev64q_u8(vld1q_u8(s)));
+		s+=16;
+		d+=16;
+	}
+	swap_copy64_scalar(numel%2, d, s);
+}
+#endif /* SWAP_NEON */
+
+/* Selects the implementation of the byte swapping, FT_SWAP_AUTO picks the
+ * fastest one that is supported by the CPU. Returns the implementation that
+ * is used from now on, which is FT_SWAP_SCALAR if the requested one is not
+ * available. This is mainly meant for testing, the default is FT_SWAP_AUTO.
+ */
+int ft_swap_select(int implementation) {
+	int selected = FT_SWAP_SCALAR;
+
+#ifdef SWAP_X86
+	if ((implementation == FT_SWAP_AUTO || implementation == FT_SWAP_AVX2) && cpu_has_avx2()) {
+		selected = FT_SWAP_AVX2;
+	} else if ((implementation == FT_SWAP_AUTO || implementation == FT_SWAP_SSE2 || implementation == FT_SWAP_AVX2) && cpu_has_sse2()) {
+		selected = FT_SWAP_SSE2;
+	}
+#endif
+#ifdef SWAP_NEON
+	if (implementation == FT_SWAP_AUTO || implementation == FT_SWAP_NEON) {
+		selected = FT_SWAP_NEON;
+	}
+#endif
+
+	switch (selected) {
+#ifdef SWAP_X86
+		case FT_SWAP_AVX2:
+			swap_copy16 = swap_copy16_avx2;
+			swap_copy32 = swap_copy32_avx2;
+			swap_copy64 = swap_copy64_avx2;
+			break;
+		case FT_SWAP_SSE2:
+			swap_copy16 = swap_copy16_sse2;
+			swap_copy32 = swap_copy32_sse2;
+			swap_copy64 = swap_copy64_sse2;
+			break;
+#endif
+#ifdef SWAP_NEON
+		case FT_SWAP_NEON:
+			swap_copy16 = swap_copy16_neon;
+			swap_copy32 = swap_copy32_neon;
+			swap_copy64 = swap_copy64_neon;
+			break;
+#endif
+		default:
+			swap_copy16 = swap_copy16_scalar;
+			swap_copy32 = swap_copy32_scalar;
+			swap_copy64 = swap_copy64_scalar;
+	}
+	return selected;
+}
+
+/* Selecting twice from different threads is harmless, since both end up with the same functions */
+#define SWAP_INIT(func) if (func == NULL) ft_swap_select(FT_SWAP_AUTO)
+
+void ft_swap16(unsigned int numel, void *data) {
+	SWAP_INIT(swap_copy16);
+	swap_copy16(numel, data, data);
+}
+
+void ft_swap32(unsigned int numel, void *data) {
+	SWAP_INIT(swap_copy32);
+	swap_copy32(numel, data, data);
+}
+
+void ft_swap64(unsigned int numel, void *data) {
+	SWAP_INIT(swap_copy64);
+	swap_copy64(numel, data, data);
+}
+
+void ft_swap_copy16(unsigned int numel, void *dest, const void *src) {
+	SWAP_INIT(swap_copy16);
+	swap_copy16(numel, dest, src);
+}
+
+void ft_swap_copy32(unsigned int numel, void *dest, const void *src) {
+	SWAP_INIT(swap_copy32);
+	swap_copy32(numel, dest, src);
+}
+
+void ft_swap_copy64(unsigned int numel, void *dest, const void *src) {
+	SWAP_INIT(swap_copy64);
+	swap_copy64(numel, dest, src);
+}
+
+/* copies numel elements of the given type from src to dest, and swaps their byte order on the way */
+void ft_swap_copy_data(UINT32_T numel, UINT32_T datatype, void *dest, const void *src) {
+	switch(datatype) {
+		case DATATYPE_CHAR:
+		case DATATYPE_UINT8:
+		case DATATYPE_INT8:
+			if (dest != src) memcpy(dest, src, numel);
+			return;
+		case DATATYPE_UINT16:
+		case DATATYPE_INT16:
+			ft_swap_copy16(numel, dest, src);
+			return;
+		case DATATYPE_UINT32:
+		case DATATYPE_INT32:
+		case DATATYPE_FLOAT32:
+			ft_swap_copy32(numel, dest, src);
+			return;
+		case DATATYPE_UINT64:
+		case DATATYPE_INT64:
+		case DATATYPE_FLOAT64:
+			ft_swap_copy64(numel, dest, src);
+			return;
+	}
+}
+
 void ft_swap_data(UINT32_T numel, UINT32_T datatype, void *data) {
 	switch(datatype) {
 		case DATATYPE_CHAR:
@@ -128,25 +422,104 @@ int ft_swap_events_to_native(UINT32_T size, void *buf) {
 }
 
 
+/* returns 0 on success, -1 on error */
+int ft_swap_eventfilter_to_native(UINT32_T size, void *buf) {
+	UINT32_T offset = 0;
+
+	while (offset + sizeof(eventfilter_t) <= size) {
+		eventfilter_t *F = (eventfilter_t *) ((char *) buf + offset);
+		ft_swap32(4, F); /* all fields are 32-bit */
+
+		offset += sizeof(eventfilter_t);
+		if (offset + F->bufsize > size) return -1; /* this criterion is too big for "buf" */
+		if (F->numel * wordsize_from_type(F->data_type) > F->bufsize) return -1;
+
+		ft_swap_data(F->numel, F->data_type, (char *) buf + offset);
+		offset += F->bufsize;
+	}
+	return 0;
+}
+
+/* returns 0 on success, -1 on error */
+int ft_swap_batch_to_native(UINT32_T size, void *buf) {
+	UINT32_T offset = 0;
+
+	while (offset + sizeof(messagedef_t) <= size) {
+		messagedef_t *mdef = (messagedef_t *) ((char *) buf + offset);
+		ft_swap16(2, mdef); /* version + command */
+		ft_swap32(1, &mdef->bufsize);
+
+		offset += sizeof(messagedef_t);
+		if (offset + mdef->bufsize > size) return -1; /* this message is too big for "buf" */
+
+		/* only PUT_DAT, PUT_DAT_T and PUT_EVT can be part of a batch */
+		if (mdef->command != PUT_DAT && mdef->command != PUT_DAT_T && mdef->command != PUT_EVT) return -1;
+		if (ft_swap_buf_to_native(mdef->command, mdef->bufsize, (char *) buf + offset) != 0) return -1;
+		offset += mdef->bufsize;
+	}
+	return 0;
+}
+
 /* returns 0 on success, -1 on error */
 int ft_swap_buf_to_native(UINT16_T command, UINT32_T bufsize, void *buf) {
 	datadef_t *ddef;
+	datamulti_t *dmulti;
+	messagedef_t *mdef;
+	UINT32_T offset;
 	
 	switch(command) {
 		case GET_HDR:
 			/* This should not have a buf attached */
 			return 0;
+		case GET_HDR_GEN:
+			/* buf is empty, or contains the generation that the client has */
+			if (bufsize == sizeof(UINT32_T)) ft_swap32(1, buf);
+			return 0;
+		case GET_QOS:
+			/* buf contains the service class */
+			if (bufsize == sizeof(UINT32_T)) ft_swap32(1, buf);
+			return 0;
 		case GET_DAT:
 			/* buf contains a datsel_t = 2x UINT32_T */
 			if (bufsize == 8) ft_swap32(2, buf);
+			/* or a datasel_ext_t followed by channel indices, all UINT32_T */
+			if (bufsize >= sizeof(datasel_ext_t)) ft_swap32(bufsize/4, buf);
 			return 0;
+		case GET_DAT_M:
+			/* buf contains a datamulti_t followed by channel indices, all UINT32_T */
+			if (bufsize < sizeof(datamulti_t)) return -1;
+			ft_swap32(5, buf);
+			dmulti = (datamulti_t *) buf;
+			offset = sizeof(datamulti_t) + dmulti->nchans*sizeof(UINT32_T);
+			if (dmulti->nchans > bufsize/sizeof(UINT32_T) || offset > bufsize) return -1;
+			ft_swap32(dmulti->nchans, dmulti + 1);
+			/* followed by the datasel_t of the ranges, or an epochsel_t and a filter */
+			if (dmulti->what == DATAMULTI_RANGES) {
+				ft_swap32((bufsize - offset)/4, (char *) buf + offset);
+				return 0;
+			}
+			if (dmulti->what == DATAMULTI_LATEST) return 0;
+			if (bufsize - offset < sizeof(epochsel_t)) return -1;
+			ft_swap32(4, (char *) buf + offset);
+			return ft_swap_eventfilter_to_native(bufsize - offset - sizeof(epochsel_t), (char *) buf + offset + sizeof(epochsel_t));
 		case GET_EVT:
 			/* buf contains a datsel_t = 2x UINT32_T */
 			if (bufsize == 8) ft_swap32(2, buf);
+			/* optionally followed by a filter */
+			if (bufsize > 8) {
+				ft_swap32(2, buf);
+				return ft_swap_eventfilter_to_native(bufsize - 8, (char *) buf + 8);
+			}
 			return 0;
 		case WAIT_DAT:
 			/* buf contains a waitdef_t = 3x UINT32_T */
 			ft_swap32(3, buf);
+			/* optionally followed by a waitevt_t and a filter */
+			if (bufsize > sizeof(waitdef_t)) {
+				if (bufsize < sizeof(waitdef_t) + sizeof(waitevt_t)) return -1;
+				ft_swap32(2, (char *) buf + sizeof(waitdef_t));
+				return ft_swap_eventfilter_to_native(bufsize - sizeof(waitdef_t) - sizeof(waitevt_t), (char *) buf + sizeof(waitdef_t) + sizeof(waitevt_t));
+			}
 			return 0;
 		case PUT_DAT:
 			/* buf contains a datadef_t and after that the data */
@@ -154,6 +527,18 @@ int ft_swap_buf_to_native(UINT16_T command, UINT32_T bufsize, void *buf) {
 			ft_swap32(4, ddef);	/* this is for datadef_t */
 			ft_swap_data(ddef->nchans*ddef->nsamples, ddef->data_type, (char *)ddef + sizeof(datadef_t)); /* ddef+1 points to first data byte */
 			return 0;
+		case PUT_DAT_T:
+			/* buf contains the time of the first sample, followed by the buf of a PUT_DAT */
+			if (bufsize < sizeof(UINT64_T) + sizeof(datadef_t)) return -1;
+			ft_swap64(1, buf);
+			return ft_swap_buf_to_native(PUT_DAT, bufsize - sizeof(UINT64_T), (char *) buf + sizeof(UINT64_T));
+		case GET_TIME:
+			/* buf is empty, or contains a timepoint_t */
+			if (bufsize == sizeof(timepoint_t)) {
+				ft_swap64(1, buf);
+				ft_swap32(2, (char *) buf + 8);
+			}
+			return 0;
 		case PUT_HDR:
 			/* buf contains a headerdef_t and optionally chunks */
 			ft_swap32(6, buf);	/* all fields are 32-bit values */
@@ -161,6 +546,17 @@ int ft_swap_buf_to_native(UINT16_T command, UINT32_T bufsize, void *buf) {
 		case PUT_EVT:
 			/* buf contains multiple eventdef_t and buf's */
 			return ft_swap_events_to_native(bufsize, buf);
+		case PUT_BATCH:
+			/* buf contains a sequence of messagedef_t and buf's */
+			return ft_swap_batch_to_native(bufsize, buf);
+		case STREAM_REQ:
+			/* buf contains a streamdef_t, followed by the messagedef_t and the buf of the wrapped request */
+			if (bufsize < sizeof(streamdef_t) + sizeof(messagedef_t)) return -1;
+			mdef = (messagedef_t *) ((char *) buf + sizeof(streamdef_t));
+			ft_swap16(2, mdef); /* version + command */
+			ft_swap32(1, &mdef->bufsize);
+			if (mdef->command == STREAM_REQ || mdef->bufsize != bufsize - sizeof(streamdef_t) - sizeof(messagedef_t)) return -1;
+			return ft_swap_buf_to_native(mdef->command, mdef->bufsize, (char *) mdef + sizeof(messagedef_t));
 	}
 	return -1;
 }
@@ -209,9 +605,32 @@ int ft_swap_events_from_native(UINT32_T size, void *buf) {
 }
 
 
+/* The response of GET_STATS, see message.h for the layout */
+int ft_swap_stats_from_native(UINT32_T size, void *buf) {
+	statsdef_t *sdef = (statsdef_t *) buf;
+	char *ptr = (char *) buf + sizeof(statsdef_t);
+	UINT32_T nbins, ncommands, i;
+
+	if (size < sizeof(statsdef_t)) return -1;
+	nbins     = sdef->nbins;
+	ncommands = sdef->ncommands;
+	if (size != sizeof(statsdef_t) + (2 + ncommands) * nbins * sizeof(UINT64_T) + ncommands * sizeof(cmdstats_t)) return -1;
+
+	ft_swap32(14, sdef);  /* all fields are 32-bit */
+	ft_swap64(2*nbins, ptr);
+	ptr += 2*nbins*sizeof(UINT64_T);
+	for (i=0; i<ncommands; i++) {
+		ft_swap32(2, ptr);                  /* command + reserved */
+		ft_swap64(4 + nbins, ptr + 8);      /* counters + latency histogram */
+		ptr += sizeof(cmdstats_t) + nbins*sizeof(UINT64_T);
+	}
+	return 0;
+}
+
 int ft_swap_from_native(UINT16_T orgCommand, message_t *msg) {
 	datadef_t *ddef;
 	UINT32_T nchans;
+	UINT32_T offset, size;
 	UINT32_T bufsize = msg->def->bufsize;
 	
 	ft_swap16(1, &msg->def->version);
@@ -225,15 +644,48 @@ int ft_swap_from_native(UINT16_T orgCommand, message_t *msg) {
 			nchans = ((headerdef_t *) msg->buf)->nchans;
 			ft_swap32(6, msg->buf);	/* all fields are 32-bit values */
 			return ft_swap_chunks_from_native(bufsize - sizeof(headerdef_t), nchans, (char *) msg->buf + sizeof(headerdef_t));
+		case GET_HDR_GEN:
+			/* a headergen_t, optionally followed by the chunks */
+			nchans = ((headergen_t *) msg->buf)->def.nchans;
+			ft_swap32(7, msg->buf);	/* all fields are 32-bit values */
+			return ft_swap_chunks_from_native(bufsize - sizeof(headergen_t), nchans, (char *) msg->buf + sizeof(headergen_t));
 		case GET_DAT:
 			ddef = (datadef_t *) msg->buf;
 			ft_swap_data(ddef->nchans*ddef->nsamples, ddef->data_type, (char *)ddef + sizeof(datadef_t)); /* ddef+1 points to first data byte */
 			ft_swap32(4, ddef); /* all fields are 32-bit */
 			return 0;
+		case GET_DAT_M:
+			/* a datasel_t, datadef_t and the samples for each range */
+			for (offset=0; offset + sizeof(datasel_t) + sizeof(datadef_t) <= bufsize; ) {
+				ddef = (datadef_t *) ((char *) msg->buf + offset + sizeof(datasel_t));
+				size = ddef->bufsize;
+				ft_swap_data(ddef->nchans*ddef->nsamples, ddef->data_type, (char *)ddef + sizeof(datadef_t));
+				ft_swap32(2 + 4, (char *) msg->buf + offset);
+				offset += sizeof(datasel_t) + sizeof(datadef_t) + size;
+			}
+			return 0;
 		case GET_EVT:
 			return ft_swap_events_from_native(bufsize, msg->buf);
 		case WAIT_DAT:
 			ft_swap32(2, msg->buf);	/* nsamples + nevents = 32bit */
+			/* optionally followed by the number of the matching event and the event */
+			if (bufsize >= sizeof(samples_events_t) + sizeof(UINT32_T)) ft_swap32(1, (char *) msg->buf + sizeof(samples_events_t));
+			if (bufsize > sizeof(samples_events_t) + sizeof(UINT32_T)) return ft_swap_events_from_native(bufsize - sizeof(samples_events_t) - sizeof(UINT32_T), (char *) msg->buf + sizeof(samples_events_t) + sizeof(UINT32_T));
+			return 0;
+		case GET_CAP:
+			ft_swap32(4, msg->buf);	/* buffercap_t = 4x UINT32_T */
+			return 0;
+		case GET_QOS:
+			ft_swap32(4, msg->buf);	/* qosdef_t = 4x UINT32_T */
+			return 0;
+		case GET_STATS:
+			return ft_swap_stats_from_native(bufsize, msg->buf);
+		case GET_TIME:
+			/* a timepoint_t or a number of timestamp_t, which have the same layout */
+			for (offset=0; offset + sizeof(timestamp_t) <= bufsize; offset += sizeof(timestamp_t)) {
+				ft_swap64(1, (char *) msg->buf + offset);
+				ft_swap32(2, (char *) msg->buf + offset + 8);
+			}
 			return 0;
 	}
 	return -1;
@@ -7,12 +7,28 @@
 extern "C" {
 #endif
 
+/* the implementations of the byte swapping, see ft_swap_select */
+#define FT_SWAP_AUTO    0
+#define FT_SWAP_SCALAR  1
+#define FT_SWAP_SSE2    2
+#define FT_SWAP_AVX2    3
+#define FT_SWAP_NEON    4
+
 /* definition of functions to assist with big/little endian conversion, see endianutil.c */
+int ft_swap_select(int implementation);
 void ft_swap16(unsigned int numel, void *data);
 void ft_swap32(unsigned int numel, void *data);
 void ft_swap64(unsigned int numel, void *data);
+void ft_swap_copy16(unsigned int numel, void *dest, const void *src);
+void ft_swap_copy32(unsigned int numel, void *dest, const void *src);
+void ft_swap_copy64(unsigned int numel, void *dest, const void *src);
+void ft_swap_data(UINT32_T numel, UINT32_T datatype, void *data);
+void ft_swap_copy_data(UINT32_T numel, UINT32_T datatype, void *dest, const void *src);
 int ft_swap_buf_to_native(UINT16_T command, UINT32_T bufsize, void *buf);
+int ft_swap_batch_to_native(UINT32_T size, void *buf);
+int ft_swap_eventfilter_to_native(UINT32_T size, void *buf);
 int ft_convert_chunks_from_native(UINT32_T size, UINT32_T nchans, void *buf);
+int ft_swap_stats_from_native(UINT32_T size, void *buf);
 int ft_swap_from_native(UINT16_T orgCommand, message_t *msg);
 
 #ifdef __cplusplus
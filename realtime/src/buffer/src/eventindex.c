@@ -0,0 +1,291 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ * Index of the event ring, used for selecting events on type, value and
+ * sample number in GET_EVT. See eventindex.h for the details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer.h"
+#include "eventindex.h"
+
+/* these are the criteria of a filter, as found in GET_EVT */
+typedef struct {
+	UINT32_T ntype, nvalue, nsample;
+	const eventfilter_t *type[FT_EVIDX_MAXCRIT];
+	const eventfilter_t *value[FT_EVIDX_MAXCRIT];
+	const eventfilter_t *sample[FT_EVIDX_MAXCRIT];
+	int hasmin, hasmax;
+	INT32_T minsample, maxsample;
+} criteria_t;
+
+/* FNV-1a hash of the type of an event */
+static UINT32_T hash_type(UINT32_T type_type, UINT32_T type_numel, const void *buf) {
+	const unsigned char *p = (const unsigned char *) buf;
+	UINT32_T n = type_numel * wordsize_from_type(type_type);
+	UINT32_T h = 2166136261u;
+	UINT32_T i;
+
+	h = (h ^ type_type) * 16777619u;
+	h = (h ^ type_numel) * 16777619u;
+	for (i=0; i<n; i++) {
+		h = (h ^ p[i]) * 16777619u;
+	}
+	return h;
+}
+
+/* returns a power of two that is somewhat larger than the number of distinct types that can be expected */
+static UINT32_T num_buckets(UINT32_T capacity) {
+	UINT32_T n = 16;
+	while (n < capacity && n < 4096) n <<= 1;
+	return n;
+}
+
+int ft_evidx_init(ft_event_index_t *X, UINT32_T capacity) {
+	memset(X, 0, sizeof(ft_event_index_t));
+	if (capacity == 0) return -1;
+
+	X->capacity = capacity;
+	X->nbuckets = num_buckets(capacity);
+	X->head   = (INT32_T *) malloc(X->nbuckets * sizeof(INT32_T));
+	X->tail   = (INT32_T *) malloc(X->nbuckets * sizeof(INT32_T));
+	X->next   = (INT32_T *) malloc(capacity * sizeof(INT32_T));
+	X->hash   = (UINT32_T *) malloc(capacity * sizeof(UINT32_T));
+	X->sample = (INT32_T *) malloc(capacity * sizeof(INT32_T));
+	if (X->head == NULL || X->tail == NULL || X->next == NULL || X->hash == NULL || X->sample == NULL) {
+		ft_evidx_free(X);
+		return -1;
+	}
+	ft_evidx_clear(X, 0);
+	return 0;
+}
+
+void ft_evidx_free(ft_event_index_t *X) {
+	FREE(X->head);
+	FREE(X->tail);
+	FREE(X->next);
+	FREE(X->hash);
+	FREE(X->sample);
+	X->capacity = 0;
+}
+
+/* removes all events, the next event that is added gets the given number */
+void ft_evidx_clear(ft_event_index_t *X, UINT32_T first) {
+	UINT32_T i;
+	for (i=0; i<X->nbuckets; i++) {
+		X->head[i] = -1;
+		X->tail[i] = -1;
+	}
+	X->first     = first;
+	X->nevents   = first;
+	X->unordered = 0;
+}
+
+/* adds the next event, this replaces the oldest one if the ring is full */
+void ft_evidx_add(ft_event_index_t *X, const eventdef_t *def, const void *buf) {
+	INT32_T slot, b;
+
+	if (X->capacity == 0) return;
+	slot = X->nevents % X->capacity;
+
+	if (X->nevents - X->first == X->capacity) {
+		/* the oldest event is also the oldest in its bucket */
+		b = X->hash[slot] & (X->nbuckets-1);
+		X->head[b] = X->next[slot];
+		if (X->head[b] < 0) X->tail[b] = -1;
+		/* it is no longer the neighbour of the second-oldest one */
+		if (X->capacity > 1 && X->sample[(X->first+1) % X->capacity] < X->sample[slot]) X->unordered--;
+		X->first++;
+	}
+
+	X->hash[slot]   = hash_type(def->type_type, def->type_numel, buf);
+	X->sample[slot] = def->sample;
+	X->next[slot]   = -1;
+	b = X->hash[slot] & (X->nbuckets-1);
+	if (X->tail[b] < 0) {
+		X->head[b] = slot;
+	} else {
+		X->next[X->tail[b]] = slot;
+	}
+	X->tail[b] = slot;
+
+	if (X->nevents > X->first && def->sample < X->sample[(X->nevents-1) % X->capacity]) X->unordered++;
+	X->nevents++;
+}
+
+/* checks the criteria of a GET_EVT filter, returns 0 if they are valid */
+int ft_evidx_check_filter(UINT32_T size, const void *filter) {
+	UINT32_T offset = 0;
+	UINT32_T ncrit = 0;
+
+	while (offset < size) {
+		const eventfilter_t *F = (const eventfilter_t *) ((const char *) filter + offset);
+
+		if (offset + sizeof(eventfilter_t) > size) return -1;
+		if (offset + sizeof(eventfilter_t) + F->bufsize > size) return -1;
+		if (wordsize_from_type(F->data_type) == 0 || F->numel * wordsize_from_type(F->data_type) != F->bufsize) return -1;
+
+		switch (F->what) {
+			case EVENTSEL_TYPE:
+			case EVENTSEL_VALUE:
+				break;
+			case EVENTSEL_SAMPLE:
+			case EVENTSEL_MINSAMPLE:
+			case EVENTSEL_MAXSAMPLE:
+				if (F->data_type != DATATYPE_INT32 || F->numel != 1) return -1;
+				break;
+			default:
+				return -1;
+		}
+		if (++ncrit > FT_EVIDX_MAXCRIT) return -1;
+		offset += sizeof(eventfilter_t) + F->bufsize;
+	}
+	return 0;
+}
+
+static void parse_filter(UINT32_T size, const void *filter, criteria_t *C) {
+	UINT32_T offset = 0;
+
+	memset(C, 0, sizeof(criteria_t));
+	while (offset < size) {
+		const eventfilter_t *F = (const eventfilter_t *) ((const char *) filter + offset);
+		INT32_T sample;
+
+		switch (F->what) {
+			case EVENTSEL_TYPE:
+				C->type[C->ntype++] = F;
+				break;
+			case EVENTSEL_VALUE:
+				C->value[C->nvalue++] = F;
+				break;
+			case EVENTSEL_SAMPLE:
+				C->sample[C->nsample++] = F;
+				break;
+			case EVENTSEL_MINSAMPLE:
+				memcpy(&sample, F+1, sizeof(INT32_T));
+				if (!C->hasmin || sample > C->minsample) C->minsample = sample;
+				C->hasmin = 1;
+				break;
+			case EVENTSEL_MAXSAMPLE:
+				memcpy(&sample, F+1, sizeof(INT32_T));
+				if (!C->hasmax || sample < C->maxsample) C->maxsample = sample;
+				C->hasmax = 1;
+				break;
+		}
+		offset += sizeof(eventfilter_t) + F->bufsize;
+	}
+}
+
+/* does the type or value of an event equal the element(s) of a criterion */
+static int equals(const eventfilter_t *F, UINT32_T data_type, UINT32_T numel, const void *buf) {
+	return F->data_type == data_type && F->numel == numel && memcmp(F+1, buf, F->bufsize) == 0;
+}
+
+static int matches(const criteria_t *C, const event_t *E) {
+	const eventdef_t *def = E->def;
+	const char *value = (const char *) E->buf + def->type_numel * wordsize_from_type(def->type_type);
+	UINT32_T i;
+	INT32_T sample;
+
+	if (C->hasmin && def->sample < C->minsample) return 0;
+	if (C->hasmax && def->sample > C->maxsample) return 0;
+	if (C->nsample) {
+		for (i=0; i<C->nsample; i++) {
+			memcpy(&sample, C->sample[i]+1, sizeof(INT32_T));
+			if (def->sample == sample) break;
+		}
+		if (i == C->nsample) return 0;
+	}
+	if (C->ntype) {
+		for (i=0; i<C->ntype; i++) {
+			if (equals(C->type[i], def->type_type, def->type_numel, E->buf)) break;
+		}
+		if (i == C->ntype) return 0;
+	}
+	if (C->nvalue) {
+		for (i=0; i<C->nvalue; i++) {
+			if (equals(C->value[i], def->value_type, def->value_numel, value)) break;
+		}
+		if (i == C->nvalue) return 0;
+	}
+	return 1;
+}
+
+/* returns the first event number in [beg, end] whose sample is not smaller than the given one, the ring should be ordered */
+static UINT32_T lower_bound(const ft_event_index_t *X, UINT32_T beg, UINT32_T end, INT32_T sample) {
+	end++;
+	while (beg < end) {
+		UINT32_T mid = beg + (end-beg)/2;
+		if (X->sample[mid % X->capacity] < sample) beg = mid+1; else end = mid;
+	}
+	return beg;
+}
+
+/* returns the first event number in [beg, end] whose sample is larger than the given one, the ring should be ordered */
+static UINT32_T upper_bound(const ft_event_index_t *X, UINT32_T beg, UINT32_T end, INT32_T sample) {
+	end++;
+	while (beg < end) {
+		UINT32_T mid = beg + (end-beg)/2;
+		if (X->sample[mid % X->capacity] <= sample) beg = mid+1; else end = mid;
+	}
+	return beg;
+}
+
+static int compare_number(const void *a, const void *b) {
+	UINT32_T x = *(const UINT32_T *) a;
+	UINT32_T y = *(const UINT32_T *) b;
+	return (x > y) - (x < y);
+}
+
+/* Writes the numbers of the events from begevent to endevent (inclusive)
+ * that match the checked filter into match, which should have room for
+ * endevent-begevent+1 numbers. The events should still be in the ring.
+ * Returns the number of matching events, in increasing order.
+ */
+UINT32_T ft_evidx_find(const ft_event_index_t *X, const event_t *ring, UINT32_T begevent, UINT32_T endevent, UINT32_T size, const void *filter, UINT32_T *match) {
+	criteria_t C;
+	UINT32_T i, n = 0;
+
+	if (X->capacity == 0 || begevent > endevent || begevent < X->first || endevent >= X->nevents) return 0;
+	parse_filter(size, filter, &C);
+
+	if (C.ntype > 0) {
+		/* only visit the buckets of the selected types */
+		for (i=0; i<C.ntype; i++) {
+			UINT32_T b = hash_type(C.type[i]->data_type, C.type[i]->numel, C.type[i]+1) & (X->nbuckets-1);
+			UINT32_T j;
+			INT32_T slot;
+
+			/* skip buckets that have been visited for another type already */
+			for (j=0; j<i; j++) {
+				if ((hash_type(C.type[j]->data_type, C.type[j]->numel, C.type[j]+1) & (X->nbuckets-1)) == b) break;
+			}
+			if (j < i) continue;
+
+			for (slot = X->head[b]; slot >= 0; slot = X->next[slot]) {
+				/* the number of the event in this slot, given that it is in the ring */
+				UINT32_T number = X->first + ((UINT32_T) slot + X->capacity - X->first % X->capacity) % X->capacity;
+				if (number < begevent) continue;
+				if (number > endevent) break;
+				if (matches(&C, &ring[slot])) match[n++] = number;
+			}
+		}
+		if (C.ntype > 1) qsort(match, n, sizeof(UINT32_T), compare_number);
+	}
+	else {
+		UINT32_T first = begevent, last = endevent+1;
+		if (X->unordered == 0) {
+			/* bisect on the sample numbers */
+			if (C.hasmin) first = lower_bound(X, begevent, endevent, C.minsample);
+			if (C.hasmax) last  = upper_bound(X, begevent, endevent, C.maxsample);
+		}
+		for (i=first; i<last; i++) {
+			if (matches(&C, &ring[i % X->capacity])) match[n++] = i;
+		}
+	}
+	return n;
+}
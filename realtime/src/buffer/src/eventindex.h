@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+
+#ifndef EVENTINDEX_H
+#define EVENTINDEX_H
+
+#include "message.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Index of the events in the event ring of dmarequest.c, which is used for
+  selecting events on the server (GET_EVT with an eventfilter_t).
+
+  Events with the same type are chained per hash bucket, in order of arrival,
+  so that looking up a type only visits the events of that type (and of the
+  few types that share its bucket). Events are kept in order of arrival, but
+  as long as their sample numbers are non-decreasing (which is always the case
+  for EVENT_AUTO_SAMPLE) the ring itself is ordered on sample number and can
+  be searched with bisection. The number of out-of-order neighbours is tracked
+  for that purpose.
+*/
+#define FT_EVIDX_MAXCRIT  32   /* maximum number of criteria in a filter */
+
+typedef struct {
+	UINT32_T capacity;    /* number of slots, the same as the event ring */
+	UINT32_T nbuckets;    /* a power of two */
+	UINT32_T first;       /* number of the oldest event in the index */
+	UINT32_T nevents;     /* number of the next event that will be added */
+	UINT32_T unordered;   /* number of neighbouring events in the ring with decreasing sample numbers */
+	INT32_T *head;        /* per bucket, the oldest slot in the bucket or -1 */
+	INT32_T *tail;        /* per bucket, the newest slot in the bucket or -1 */
+	INT32_T *next;        /* per slot, the next slot in the same bucket or -1 */
+	UINT32_T *hash;       /* per slot, hash of the event type */
+	INT32_T *sample;      /* per slot, sample number of the event */
+} ft_event_index_t;
+
+int ft_evidx_init(ft_event_index_t *X, UINT32_T capacity);
+void ft_evidx_free(ft_event_index_t *X);
+void ft_evidx_clear(ft_event_index_t *X, UINT32_T first);
+void ft_evidx_add(ft_event_index_t *X, const eventdef_t *def, const void *buf);
+int ft_evidx_check_filter(UINT32_T size, const void *filter);
+UINT32_T ft_evidx_find(const ft_event_index_t *X, const event_t *ring, UINT32_T begevent, UINT32_T endevent, UINT32_T size, const void *filter, UINT32_T *match);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EVENTINDEX_H */
@@ -26,8 +26,12 @@ pthread_mutex_t mutexthreadcount = PTHREAD_MUTEX_INITIALIZER;
 int threadcount = 0;
 
 pthread_mutex_t mutexsocketcount = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t condsocketcount = PTHREAD_COND_INITIALIZER;
 int socketcount = 0;
 
+/* pipe that wakes up the tcpserver thread and the tcpsocket threads, see tcpserver_stop */
+int tcpserverWakeup[2] = {-1, -1};
+
 pthread_mutex_t mutexappendcount = PTHREAD_MUTEX_INITIALIZER;
 int appendcount = 0;
 
@@ -17,8 +17,11 @@ extern pthread_mutex_t mutexthreadcount;
 extern int threadcount;
 
 extern pthread_mutex_t mutexsocketcount;
+extern pthread_cond_t condsocketcount;
 extern int socketcount;
 
+extern int tcpserverWakeup[2];
+
 extern pthread_mutex_t mutexthreadcount;
 extern int threadcount;
 
@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ * Monotonic nanosecond clock and calibrated sleep, see ftclock.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "buffer.h"
+#include "ftclock.h"
+
+#if defined(PLATFORM_OSX)
+#include <mach/mach_time.h>
+#endif
+
+#ifndef PLATFORM_WINDOWS
+#include <time.h>
+#include <sys/time.h>
+#endif
+
+/* the margin that is spun instead of slept is kept within these bounds (in ns) */
+#define SLACK_MIN          ((INT64_T) 2000)
+#define SLACK_MAX          ((INT64_T) 20000000)
+#define CALIBRATE_SLEEP    ((UINT64_T) 100000)
+#define CALIBRATE_REPEAT   8
+
+static volatile INT64_T sleep_slack = -1;
+
+UINT64_T ft_clock_ns(void) {
+#if defined(PLATFORM_OSX)
+	static mach_timebase_info_data_t tb;
+	if (tb.denom == 0) mach_timebase_info(&tb);
+	return mach_absolute_time() * tb.numer / tb.denom;
+#elif defined(PLATFORM_WINDOWS)
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+	if (freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	/* in two parts, so that the multiplication does not overflow */
+	return (UINT64_T) (now.QuadPart / freq.QuadPart) * 1000000000 + (UINT64_T) (now.QuadPart % freq.QuadPart) * 1000000000 / freq.QuadPart;
+#elif defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (UINT64_T) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (UINT64_T) tv.tv_sec * 1000000000 + (UINT64_T) tv.tv_usec * 1000;
+#endif
+}
+
+double ft_clock_seconds(void) {
+	return 1e-9 * (double) ft_clock_ns();
+}
+
+UINT64_T ft_clock_resolution(void) {
+#if defined(PLATFORM_OSX)
+	mach_timebase_info_data_t tb;
+	mach_timebase_info(&tb);
+	return (tb.numer + tb.denom - 1) / tb.denom;
+#elif defined(PLATFORM_WINDOWS)
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency(&freq);
+	return (UINT64_T) (1000000000 + freq.QuadPart - 1) / freq.QuadPart;
+#elif defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+	if (clock_getres(CLOCK_MONOTONIC, &ts) != 0) return 1000;
+	return (UINT64_T) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+	return 1000;
+#endif
+}
+
+/* the sleep of the operating system, which may take longer */
+static void os_sleep(UINT64_T ns) {
+#ifdef PLATFORM_WINDOWS
+	Sleep((DWORD) (ns / 1000000));
+#else
+	struct timespec req, rem;
+	req.tv_sec  = (time_t) (ns / 1000000000);
+	req.tv_nsec = (long) (ns % 1000000000);
+	while (nanosleep(&req, &rem) != 0 && errno == EINTR) req = rem;
+#endif
+}
+
+static void cpu_relax(void) {
+#if defined(_MSC_VER)
+	YieldProcessor();
+#elif defined(__i386__) || defined(__x86_64__)
+	__asm__ __volatile__("pause");
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+/* measures by how much the sleep of the operating system overshoots */
+static INT64_T calibrate_slack(void) {
+	INT64_T slack = 0;
+	int i;
+
+	for (i=0; i<CALIBRATE_REPEAT; i++) {
+		UINT64_T start = ft_clock_ns();
+		INT64_T over;
+		os_sleep(CALIBRATE_SLEEP);
+		over = (INT64_T) (ft_clock_ns() - start) - (INT64_T) CALIBRATE_SLEEP;
+		if (over > slack) slack = over;
+	}
+	/* some headroom for a busier system than during the calibration */
+	slack += slack/2 + (INT64_T) ft_clock_resolution();
+	if (slack < SLACK_MIN) slack = SLACK_MIN;
+	if (slack > SLACK_MAX) slack = SLACK_MAX;
+	return slack;
+}
+
+static INT64_T get_slack(void) {
+	/* a race between two threads only means that the calibration is done twice */
+	INT64_T slack = sleep_slack;
+	if (slack < 0) sleep_slack = slack = calibrate_slack();
+	return slack;
+}
+
+void ft_clock_sleep_until(UINT64_T deadline) {
+	INT64_T slack = get_slack();
+	UINT64_T now;
+
+	now = ft_clock_ns();
+	while (now < deadline && deadline - now > (UINT64_T) slack) {
+		os_sleep(deadline - now - slack);
+		now = ft_clock_ns();
+	}
+	while (now < deadline) {
+		cpu_relax();
+		now = ft_clock_ns();
+	}
+}
+
+void ft_clock_sleep(UINT64_T ns) {
+	/* the first call calibrates, which should not count towards the interval */
+	get_slack();
+	ft_clock_sleep_until(ft_clock_ns() + ns);
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+
+#ifndef FTCLOCK_H
+#define FTCLOCK_H
+
+#include "message.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  The monotonic clock that is used for all intervals and latencies within the
+  buffer, in nanoseconds since an arbitrary point. It is based on the fastest
+  monotonic clock of the operating system, which reads the TSC without a
+  system call where the TSC is stable: CLOCK_MONOTONIC on Linux and BSD,
+  mach_absolute_time on OS X and the performance counter on Windows. For the
+  time since the epoch or since boot, see get_monotonic_time in timestamp.h.
+
+  ft_clock_sleep_until sleeps until shortly before the deadline, and spins for
+  the remainder. The margin is calibrated on first use against the overshoot
+  of the sleep of the operating system, so that the deadline is met to within
+  a few microseconds at the cost of some CPU time.
+*/
+
+UINT64_T ft_clock_ns(void);
+double ft_clock_seconds(void);
+
+/* returns the resolution of ft_clock_ns in nanoseconds */
+UINT64_T ft_clock_resolution(void);
+
+/* waits until ft_clock_ns reaches the deadline, or for ns nanoseconds */
+void ft_clock_sleep_until(UINT64_T deadline);
+void ft_clock_sleep(UINT64_T ns);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FTCLOCK_H */
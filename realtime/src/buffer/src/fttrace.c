@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ * Trace points of the latency of the blocks of samples, see fttrace.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "buffer.h"
+#include "fttrace.h"
+
+#if defined(PLATFORM_WINDOWS)
+#define trace_pid()  ((int) GetCurrentProcessId())
+#define TRACE_THREAD __declspec(thread)
+#else
+#define trace_pid()  ((int) getpid())
+#define TRACE_THREAD __thread
+#endif
+
+static const char *stage_names[FT_TRACE_NUMSTAGES] = {"read", "handle", "send", "receive", "insert", "wakeup", "deliver"};
+
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static FILE *trace_file = NULL;
+static UINT32_T trace_every = 1000;
+static int trace_pid_value = 0;
+
+static TRACE_THREAD UINT64_T received_time = 0;
+
+/* replaces %p in the name by the process id */
+static void trace_filename(char *dest, size_t size, const char *name) {
+	size_t n = 0;
+	while (*name && n + 16 < size) {
+		if (name[0] == '%' && name[1] == 'p') {
+			n += sprintf(dest + n, "%d", trace_pid_value);
+			name += 2;
+		} else {
+			dest[n++] = *name++;
+		}
+	}
+	dest[n] = 0;
+}
+
+static void trace_init(void) {
+	const char *name = getenv("FT_TRACE");
+	const char *every = getenv("FT_TRACE_EVERY");
+	char filename[1024];
+	int i;
+
+	if (name == NULL || name[0] == 0) return;
+	if (every != NULL && atoi(every) > 0) trace_every = (UINT32_T) atoi(every);
+	trace_pid_value = trace_pid();
+	trace_filename(filename, sizeof(filename), name);
+
+	trace_file = fopen(filename, "w");
+	if (trace_file == NULL) {
+		fprintf(stderr, "fttrace: cannot open trace file %s\n", filename);
+		return;
+	}
+	/* the trailing comma of the last event is allowed by the trace format, so the file is valid at any time */
+	fprintf(trace_file, "[\n");
+	fprintf(trace_file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"ftbuffer %d\",\"every\":%u}},\n", trace_pid_value, trace_pid_value, trace_every);
+	for (i=0;i<FT_TRACE_NUMSTAGES;i++) {
+		fprintf(trace_file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n", trace_pid_value, i, stage_names[i]);
+	}
+	fflush(trace_file);
+	fprintf(stderr, "fttrace: writing trace of every %u samples to %s\n", trace_every, filename);
+}
+
+int ft_trace_enabled(void) {
+	pthread_once(&trace_once, trace_init);
+	return trace_file != NULL;
+}
+
+UINT32_T ft_trace_every(void) {
+	pthread_once(&trace_once, trace_init);
+	return trace_every;
+}
+
+void ft_trace_point(int stage, UINT32_T begsample, UINT32_T endsample, UINT64_T time) {
+	UINT32_T marker;
+
+	if (!ft_trace_enabled() || stage < 0 || stage >= FT_TRACE_NUMSTAGES) return;
+	/* the first multiple of trace_every that is not below begsample */
+	marker = ((begsample + trace_every - 1) / trace_every) * trace_every;
+	if (marker < begsample || marker >= endsample) return;
+	if (time == 0) time = ft_clock_ns();
+
+	pthread_mutex_lock(&trace_mutex);
+	fprintf(trace_file, "{\"name\":\"%s\",\"cat\":\"ftbuffer\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"begsample\":%u,\"endsample\":%u,\"every\":%u}},\n",
+			stage_names[stage], 1e-3 * (double) time, trace_pid_value, stage, begsample, endsample, trace_every);
+	fflush(trace_file);
+	pthread_mutex_unlock(&trace_mutex);
+}
+
+void ft_trace_set_received(UINT64_T time) {
+	received_time = time;
+}
+
+UINT64_T ft_trace_get_received(void) {
+	return received_time;
+}
+
+const char *ft_trace_stage_name(int stage) {
+	return (stage >= 0 && stage < FT_TRACE_NUMSTAGES) ? stage_names[stage] : "";
+}
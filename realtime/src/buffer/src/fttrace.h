@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+
+#ifndef FTTRACE_H
+#define FTTRACE_H
+
+#include "message.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Optional trace points for following blocks of samples from the device to
+  the client, enabled with the environment variable FT_TRACE, which gives the
+  name of the trace file (a %p in it is replaced by the process id). Every
+  process that takes part writes its own file, in the JSON format of the
+  Chrome trace viewer (chrome://tracing, Perfetto), with one instant event per
+  stage and block, timestamped with ft_clock_ns in microseconds.
+
+  A block is identified by the first multiple of FT_TRACE_EVERY (default 1000)
+  among its samples, counted since the header was written. All stages already
+  know which samples they handle, so this marker identifies the same block in
+  the driver, the buffer server and the client without extra information in
+  the protocol. Blocks without a marker are not traced, which limits the size
+  of the trace files. Since ft_clock_ns is the same in all processes on one
+  computer (except on OS X, where it is the same since boot), buffer_trace can
+  combine the files of all processes into the latency of every stage.
+*/
+
+#define FT_TRACE_READ       0   /* the driver read the first sample of a block from the device */
+#define FT_TRACE_HANDLE     1   /* OnlineDataManager got the block */
+#define FT_TRACE_SEND       2   /* OnlineDataManager sends the block to the buffer */
+#define FT_TRACE_RECEIVE    3   /* the server read the PUT_DAT request */
+#define FT_TRACE_INSERT     4   /* the samples were inserted in the ring buffer */
+#define FT_TRACE_WAKEUP     5   /* a WAIT_DAT request returns with the samples */
+#define FT_TRACE_DELIVER    6   /* the client got the samples of GET_DAT */
+#define FT_TRACE_NUMSTAGES  7
+
+/* returns 1 if FT_TRACE is set, and the trace file could be opened */
+int ft_trace_enabled(void);
+
+/* returns the number of samples that the markers are spaced by, see FT_TRACE_EVERY */
+UINT32_T ft_trace_every(void);
+
+/* Records the stage of the samples begsample to endsample-1 if they contain
+   a marker, at the given time of ft_clock_ns, or now if time is 0. */
+void ft_trace_point(int stage, UINT32_T begsample, UINT32_T endsample, UINT64_T time);
+
+/* The time at which the server read the request that is handled by the
+   calling thread, which is recorded as the RECEIVE stage of PUT_DAT. */
+void ft_trace_set_received(UINT64_T time);
+UINT64_T ft_trace_get_received(void);
+
+const char *ft_trace_stage_name(int stage);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FTTRACE_H */
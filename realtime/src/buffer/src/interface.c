@@ -133,12 +133,7 @@ int open_connection(const char *hostname, int port) {
 	if (verbose>0)
 		fprintf(stderr, "open_connection: connected to %s:%d on socket %d\n", hostname, port, s);
 
-#ifdef DISABLE_NAGLE
-	{
-		int optval = 1;
-		setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
-	}
-#endif
+	ft_socket_init(s);
 
 	return s;
 }
@@ -290,6 +285,169 @@ int write_data(int server, UINT32_T datatype, unsigned int nchans, unsigned int
 	return 0;
 };
 
+/*******************************************************************************
+ * WRITE DATA WITHOUT COPYING
+ * the first WRITE_DATA_RESERVED bytes of the buffer are reserved for the
+ * datadef_t, the samples follow them. The buffer is then sent as the PUT_DAT
+ * request as it is, so a client can keep a few of these buffers and read its
+ * samples straight into them.
+ * returns 0 on success
+ *******************************************************************************/
+#define WRITE_DATA_RESERVED 16 /* as in interface.h, which is not included here */
+
+int write_data_reserved(int server, UINT32_T datatype, unsigned int nchans, unsigned int nsamples, void *buffer) {
+	int status = 0;
+	message_t    request;
+	messagedef_t reqdef;
+	message_t    *response = NULL;
+	datadef_t    *datadef  = (datadef_t *)buffer;
+
+	if (sizeof(datadef_t) != WRITE_DATA_RESERVED) {
+		fprintf(stderr, "write_data_reserved: datadef_t does not match WRITE_DATA_RESERVED\n");
+		return -1;
+	}
+
+	datadef->nchans    = nchans;
+	datadef->nsamples  = nsamples;
+	datadef->data_type = datatype;
+	datadef->bufsize   = wordsize_from_type(datatype)*nchans*nsamples;
+
+	reqdef.version = VERSION;
+	reqdef.command = PUT_DAT;
+	reqdef.bufsize = sizeof(datadef_t) + datadef->bufsize;
+	request.def = &reqdef;
+	request.buf = buffer;
+
+	status = clientrequest(server, &request, &response);
+	if (status) {
+		fprintf(stderr, "Error when sending samples.\n");
+		return -1;
+	}
+
+	if (response == NULL || response->def == NULL || response->def->command!=PUT_OK) {
+		fprintf(stderr, "Error when writing samples.\n");
+		status = -1;
+	}
+	cleanup_message((void **)&response);
+
+	return status;
+}
+
+/*******************************************************************************
+ * WRITE DATA AND EVENTS
+ * sends the samples together with an array of events (each an eventdef_t
+ * followed by its buf, evtsize bytes in total) in a single PUT_BATCH request,
+ * so that both are stored in one go
+ * returns 0 on success
+ *******************************************************************************/
+int write_data_events(int server, UINT32_T datatype, unsigned int nchans, unsigned int nsamples, void *buffer, unsigned int evtsize, const void *events) {
+	int status = 0, verbose = 0;
+
+	/* these are used in the communication and represent statefull information */
+	message_t    *request  = NULL;
+	message_t    *response = NULL;
+	messagedef_t subdef;
+	datadef_t    datadef;
+
+	datadef.nchans    = nchans;
+	datadef.nsamples  = nsamples;
+	datadef.data_type = datatype;
+	datadef.bufsize   = wordsize_from_type(datatype)*nchans*nsamples;
+
+	/* create the request */
+	request      = (message_t *)malloc(sizeof(message_t));
+	request->def = (messagedef_t *)malloc(sizeof(messagedef_t));
+	request->buf = NULL;
+	request->def->bufsize = 0;
+	request->def->version = VERSION;
+	request->def->command = PUT_BATCH;
+
+	subdef.version = VERSION;
+	subdef.command = PUT_DAT;
+	subdef.bufsize = sizeof(datadef_t) + datadef.bufsize;
+	request->def->bufsize = append(&request->buf, request->def->bufsize, &subdef, sizeof(messagedef_t));
+	request->def->bufsize = append(&request->buf, request->def->bufsize, &datadef, sizeof(datadef_t));
+	request->def->bufsize = append(&request->buf, request->def->bufsize, buffer, datadef.bufsize);
+
+	if (evtsize > 0) {
+		subdef.command = PUT_EVT;
+		subdef.bufsize = evtsize;
+		request->def->bufsize = append(&request->buf, request->def->bufsize, &subdef, sizeof(messagedef_t));
+		request->def->bufsize = append(&request->buf, request->def->bufsize, (void *)events, evtsize);
+	}
+
+	/* send the request */
+	status = clientrequest(server, request, &response);
+	cleanup_message((void **)&request);
+
+	if (verbose>0) fprintf(stderr, "DEBUG: clientrequest returned %d\n", status);
+	if (status) {
+		fprintf(stderr, "DEBUG: err3\n");
+		exit(1);
+	}
+
+	/* deal with the response */
+	status = 0;
+	if (response == NULL || response->def == NULL || response->def->command!=PUT_OK) {
+		fprintf(stderr, "Error when writing samples and events.\n");
+		status = -1;
+	}
+	cleanup_message((void **)&response);
+
+	return status;
+}
+
+/*******************************************************************************
+ * WRITE DATA WITH TIMESTAMP
+ * like write_data, but the block carries the time of its first sample in
+ * nanoseconds (PUT_DAT_T), see read_sample_time and read_time_sample
+ * returns 0 on success
+ *******************************************************************************/
+int write_data_timestamp(int server, UINT32_T datatype, unsigned int nchans, unsigned int nsamples, void *buffer, UINT64_T timestamp) {
+	int status = 0, verbose = 0;
+
+	/* these are used in the communication and represent statefull information */
+	message_t    *request  = NULL;
+	message_t    *response = NULL;
+	datadef_t    datadef;
+
+	datadef.nchans    = nchans;
+	datadef.nsamples  = nsamples;
+	datadef.data_type = datatype;
+	datadef.bufsize   = wordsize_from_type(datatype)*nchans*nsamples;
+
+	/* create the request */
+	request      = (message_t *)malloc(sizeof(message_t));
+	request->def = (messagedef_t *)malloc(sizeof(messagedef_t));
+	request->buf = NULL;
+	request->def->bufsize = 0;
+	request->def->version = VERSION;
+	request->def->command = PUT_DAT_T;
+	request->def->bufsize = append(&request->buf, request->def->bufsize, &timestamp, sizeof(UINT64_T));
+	request->def->bufsize = append(&request->buf, request->def->bufsize, &datadef, sizeof(datadef_t));
+	request->def->bufsize = append(&request->buf, request->def->bufsize, buffer, datadef.bufsize);
+
+	/* send the request */
+	status = clientrequest(server, request, &response);
+	cleanup_message((void **)&request);
+
+	if (verbose>0) fprintf(stderr, "DEBUG: clientrequest returned %d\n", status);
+	if (status) {
+		fprintf(stderr, "DEBUG: err3\n");
+		exit(1);
+	}
+
+	/* deal with the response */
+	status = 0;
+	if (response == NULL || response->def == NULL || response->def->command!=PUT_OK) {
+		fprintf(stderr, "Error when writing samples.\n");
+		status = -1;
+	}
+	cleanup_message((void **)&response);
+
+	return status;
+}
+
 /*******************************************************************************
  * READ HEADER
  * returns 0 on success
@@ -351,6 +509,73 @@ int read_header(int server, UINT32_T *datatype, unsigned int *nchans, float *fsa
 	return status;
 }
 
+/*******************************************************************************
+ * READ HEADER GENERATION
+ * only reads the number of samples and events, and the generation of the
+ * header, which changes whenever the header is replaced. This is much cheaper
+ * than read_header for headers with large chunks.
+ * returns 0 on success
+ *******************************************************************************/
+int read_header_generation(int server, unsigned int *nsamples, unsigned int *nevents, unsigned int *generation) {
+	int status = 0;
+	message_t    request;
+	messagedef_t def;
+	message_t    *response = NULL;
+
+	def.version = VERSION;
+	def.command = GET_HDR_GEN;
+	def.bufsize = 0;
+	request.def = &def;
+	request.buf = NULL;
+
+	status = clientrequest(server, &request, &response);
+	if (status) {
+		fprintf(stderr, "DEBUG: err4\n");
+		exit(1);
+	}
+
+	status = response->def->command;
+	if (response->def->command==GET_OK && response->def->bufsize>=sizeof(headergen_t)) {
+		headergen_t *hgen = (headergen_t *) response->buf;
+		*nsamples   = hgen->def.nsamples;
+		*nevents    = hgen->def.nevents;
+		*generation = hgen->generation;
+		status = 0;
+	}
+	cleanup_message((void **)&response);
+
+	return status;
+}
+
+/*******************************************************************************
+ * SELECT QOS CLASS
+ * selects the service class of this connection, one of the FT_QOS_* classes
+ * in qos.h, e.g. FT_QOS_VIEWER for a client that only displays the data.
+ * returns 0 on success
+ *******************************************************************************/
+int select_qos_class(int server, unsigned int qosclass) {
+	int status = 0;
+	message_t    request;
+	messagedef_t def;
+	message_t    *response = NULL;
+	UINT32_T     buf = qosclass;
+
+	def.version = VERSION;
+	def.command = GET_QOS;
+	def.bufsize = sizeof(UINT32_T);
+	request.def = &def;
+	request.buf = &buf;
+
+	status = clientrequest(server, &request, &response);
+	if (status) return status;
+
+	status = response->def->command;
+	if (response->def->command==GET_OK && response->def->bufsize==sizeof(qosdef_t)) status = 0;
+	cleanup_message((void **)&response);
+
+	return status;
+}
+
 /*******************************************************************************
  * READ DATA
  * returns 0 on success
@@ -414,6 +639,64 @@ int read_data(int server, unsigned int begsample, unsigned int endsample, void *
 	return status;
 }
 
+/*******************************************************************************
+ * READ DATA RANGES
+ * reads several ranges of samples with a single GET_DAT_M request, the
+ * samples of all ranges are copied to the buffer after each other
+ * returns 0 on success
+ *******************************************************************************/
+int read_data_ranges(int server, unsigned int nranges, const unsigned int *begsample, const unsigned int *endsample, void *buffer) {
+	int status = 0;
+	unsigned int i;
+	message_t    request;
+	messagedef_t def;
+	message_t    *response = NULL;
+	datamulti_t  *dmulti;
+	datasel_t    *range;
+
+	dmulti = (datamulti_t *) malloc(sizeof(datamulti_t) + nranges*sizeof(datasel_t));
+	if (dmulti == NULL) return -1;
+	dmulti->what      = DATAMULTI_RANGES;
+	dmulti->nsel      = nranges;
+	dmulti->stride    = 1;
+	dmulti->data_type = DATATYPE_UNKNOWN;
+	dmulti->nchans    = 0;
+	range = (datasel_t *) (dmulti + 1);
+	for (i=0; i<nranges; i++) {
+		range[i].begsample = begsample[i];
+		range[i].endsample = endsample[i];
+	}
+
+	def.version = VERSION;
+	def.command = GET_DAT_M;
+	def.bufsize = sizeof(datamulti_t) + nranges*sizeof(datasel_t);
+	request.def = &def;
+	request.buf = dmulti;
+
+	status = clientrequest(server, &request, &response);
+	free(dmulti);
+	if (status) return status;
+
+	status = response->def->command;
+	if (response->def->command==GET_OK) {
+		UINT32_T offset = 0;
+		char *dest = (char *) buffer;
+
+		/* the response holds a datasel_t and a datadef_t with the samples for each range */
+		for (i=0; i<nranges && offset + sizeof(datasel_t) + sizeof(datadef_t) <= response->def->bufsize; i++) {
+			const datadef_t *ddef = (const datadef_t *) ((char *) response->buf + offset + sizeof(datasel_t));
+			memcpy(dest, ddef + 1, ddef->bufsize);
+			dest   += ddef->bufsize;
+			offset += sizeof(datasel_t) + sizeof(datadef_t) + ddef->bufsize;
+		}
+		/* all ranges should be there, a server with a limit on the connection may have left some out */
+		status = (i == nranges) ? 0 : -1;
+	}
+	cleanup_message((void **)&response);
+
+	return status;
+}
+
 /*******************************************************************************
  * WAIT FOR DATA
  * returns 0 on success
@@ -473,3 +756,68 @@ int wait_data(int server, unsigned int nsamples, unsigned int nevents, unsigned
 
 	return status;
 }
+
+/* sends a GET_TIME request with the given timepoint, which is updated with the response */
+static int map_time(int server, timepoint_t *timepoint) {
+	int status = 0;
+	message_t    request;
+	messagedef_t def;
+	message_t    *response = NULL;
+
+	def.version = VERSION;
+	def.command = GET_TIME;
+	def.bufsize = sizeof(timepoint_t);
+	request.def = &def;
+	request.buf = timepoint;
+
+	status = clientrequest(server, &request, &response);
+	if (status) {
+		fprintf(stderr, "DEBUG: err7\n");
+		exit(1);
+	}
+
+	status = -1;
+	if (response->def->command==GET_OK && response->def->bufsize==sizeof(timepoint_t)) {
+		memcpy(timepoint, response->buf, sizeof(timepoint_t));
+		status = 0;
+	}
+	cleanup_message((void **)&response);
+
+	return status;
+}
+
+/*******************************************************************************
+ * READ SAMPLE TIME
+ * determines the time of a sample from the timestamps of the blocks that were
+ * written with write_data_timestamp
+ * returns 0 on success
+ *******************************************************************************/
+int read_sample_time(int server, unsigned int sample, UINT64_T *timestamp) {
+	timepoint_t timepoint;
+	int status;
+
+	timepoint.time   = 0;
+	timepoint.sample = sample;
+	timepoint.what   = FT_TIME_OF_SAMPLE;
+	status = map_time(server, &timepoint);
+	if (status == 0) *timestamp = timepoint.time;
+	return status;
+}
+
+/*******************************************************************************
+ * READ TIME SAMPLE
+ * determines the sample that is nearest to the given time, the opposite of
+ * read_sample_time
+ * returns 0 on success
+ *******************************************************************************/
+int read_time_sample(int server, UINT64_T timestamp, unsigned int *sample) {
+	timepoint_t timepoint;
+	int status;
+
+	timepoint.time   = timestamp;
+	timepoint.sample = 0;
+	timepoint.what   = FT_SAMPLE_AT_TIME;
+	status = map_time(server, &timepoint);
+	if (status == 0) *sample = timepoint.sample;
+	return status;
+}
@@ -19,15 +19,27 @@ extern "C" {
 #define DATATYPE_FLOAT32 (uint32_t)9
 #define DATATYPE_FLOAT64 (uint32_t)10
 
+/* bytes in front of the samples in the buffer of write_data_reserved */
+#define WRITE_DATA_RESERVED 16
+
 /* definition of simplified interface functions, see interface.c */
 int start_server(int port);
 int open_connection(const char *hostname, int port);
+int open_unix_connection(const char *name);
 int close_connection(int s);
 int read_header(int server, uint32_t *datatype, unsigned int *nchans, float *fsample, unsigned int *nsamples, unsigned int *nevents);
+int read_header_generation(int server, unsigned int *nsamples, unsigned int *nevents, unsigned int *generation);
+int select_qos_class(int server, unsigned int qosclass);
 int read_data(int server, unsigned int begsample, unsigned int endsample, void *buffer);
+int read_data_ranges(int server, unsigned int nranges, const unsigned int *begsample, const unsigned int *endsample, void *buffer);
 int write_header(int server, uint32_t datatype, unsigned int nchans, float fsample);
 int write_data(int server, uint32_t datatype, unsigned int nchans, unsigned int nsamples, void *buffer);
+int write_data_reserved(int server, uint32_t datatype, unsigned int nchans, unsigned int nsamples, void *buffer);
+int write_data_timestamp(int server, uint32_t datatype, unsigned int nchans, unsigned int nsamples, void *buffer, uint64_t timestamp);
+int write_data_events(int server, uint32_t datatype, unsigned int nchans, unsigned int nsamples, void *buffer, unsigned int evtsize, const void *events);
 int wait_data(int server, unsigned int nsamples, unsigned int nevents, unsigned int milliseconds);
+int read_sample_time(int server, unsigned int sample, uint64_t *timestamp);
+int read_time_sample(int server, uint64_t timestamp, unsigned int *sample);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,316 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mcastserver.h"
+#include "util.h"
+
+#ifdef PLATFORM_WINDOWS
+#include <ws2tcpip.h>
+#else
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+/** Asks the FieldTrip buffer for the counters of the header and its generation
+	@return 0 on success, -1 on error (e.g. if there is no header yet)
+*/
+static int mcast_aux_get_hdr_gen(int ft_buffer, headergen_t *hdr) {
+	message_t req, *resp = NULL;
+	messagedef_t msg_def;
+	int r = -1;
+
+	req.def = &msg_def;
+	req.buf = NULL;
+	msg_def.version = VERSION;
+	msg_def.command = GET_HDR_GEN;
+	msg_def.bufsize = 0;
+
+	if (clientrequest(ft_buffer, &req, &resp) < 0) return -1;
+
+	if (resp != NULL && resp->def != NULL && resp->buf != NULL &&
+		resp->def->command == GET_OK && resp->def->bufsize >= sizeof(headergen_t)) {
+		memcpy(hdr, resp->buf, sizeof(headergen_t));
+		r = 0;
+	}
+	if (resp) {
+		FREE(resp->buf);
+		FREE(resp->def);
+		free(resp);
+	}
+	return r;
+}
+
+/** Wait until the buffer holds more than nsamples samples
+	@return 0 on success (also on timeout), -1 on error
+*/
+static int mcast_aux_wait_dat(int ft_buffer, UINT32_T nsamples, int ms) {
+	message_t req, *resp = NULL;
+	messagedef_t msg_def;
+	waitdef_t wait_def;
+	int r = -1;
+
+	wait_def.threshold.nsamples = nsamples;
+	wait_def.threshold.nevents = 0xFFFFFFFF;
+	wait_def.milliseconds = ms;
+
+	req.def = &msg_def;
+	req.buf = &wait_def;
+	msg_def.version = VERSION;
+	msg_def.command = WAIT_DAT;
+	msg_def.bufsize = sizeof(waitdef_t);
+
+	if (clientrequest(ft_buffer, &req, &resp) < 0) return -1;
+
+	if (resp != NULL && resp->def != NULL && resp->def->command == WAIT_OK) r = 0;
+	if (resp) {
+		FREE(resp->buf);
+		FREE(resp->def);
+		free(resp);
+	}
+	return r;
+}
+
+/** Reads the samples of one datagram with GET_DAT, and sends them to the group
+	@return 0 on success, -1 if the samples could not be read, 1 if they could not be sent
+*/
+static int mcast_aux_publish(mcast_server_ctrl_t *SC, const headergen_t *hdr, UINT32_T begsample, UINT32_T endsample, datasel_ext_t *sel, char *packet) {
+	message_t req, *resp = NULL;
+	messagedef_t msg_def;
+	datadef_t *ddef;
+	mcastdef_t *mdef = (mcastdef_t *) packet;
+	int r = -1;
+
+	/* the channel indices follow sel already */
+	sel->begsample = begsample;
+	sel->endsample = endsample;
+	sel->stride    = SC->stride;
+	sel->data_type = SC->data_type;
+	sel->nchans    = SC->nchans;
+
+	req.def = &msg_def;
+	req.buf = sel;
+	msg_def.version = VERSION;
+	msg_def.command = GET_DAT;
+	msg_def.bufsize = sizeof(datasel_ext_t) + SC->nchans*sizeof(UINT32_T);
+
+	if (clientrequest(SC->ft_buffer, &req, &resp) < 0) return -1;
+
+	if (resp == NULL || resp->def == NULL || resp->buf == NULL || resp->def->command != GET_OK ||
+		resp->def->bufsize < sizeof(datadef_t)) goto cleanup;
+
+	ddef = (datadef_t *) resp->buf;
+	if (ddef->bufsize > FT_MCAST_MAXPAYLOAD || ddef->bufsize > resp->def->bufsize - sizeof(datadef_t)) goto cleanup;
+
+	mdef->magic      = FT_MCAST_MAGIC;
+	mdef->sequence   = SC->sequence;
+	mdef->generation = hdr->generation;
+	mdef->begsample  = begsample;
+	mdef->nsamples   = ddef->nsamples;
+	mdef->stride     = SC->stride;
+	mdef->nchans     = ddef->nchans;
+	mdef->data_type  = ddef->data_type;
+	mdef->bufsize    = ddef->bufsize;
+	memcpy(mdef + 1, ddef + 1, ddef->bufsize);
+
+	/* the sequence also advances if the datagram is dropped, so that the clients see the gap */
+	SC->sequence++;
+	if (send(SC->sock, packet, sizeof(mcastdef_t) + ddef->bufsize, 0) < 0) {
+		SC->dropped++;
+		r = 1;
+	} else {
+		r = 0;
+	}
+cleanup:
+	if (resp) {
+		FREE(resp->buf);
+		FREE(resp->def);
+		free(resp);
+	}
+	return r;
+}
+
+void *_mcastserver_thread(void *arg) {
+	mcast_server_ctrl_t *SC = (mcast_server_ctrl_t *) arg;
+	headergen_t hdr;
+	UINT32_T generation = 0;
+	UINT32_T next = 0;
+	datasel_ext_t *sel;
+	char *packet;
+
+	sel = (datasel_ext_t *) malloc(sizeof(datasel_ext_t) + SC->nchans*sizeof(UINT32_T));
+	packet = (char *) malloc(sizeof(mcastdef_t) + FT_MCAST_MAXPAYLOAD);
+	if (sel == NULL || packet == NULL) {
+		fprintf(stderr, "mcastserver: out of memory\n");
+		FREE(sel);
+		FREE(packet);
+		return NULL;
+	}
+	if (SC->nchans > 0) memcpy(sel + 1, SC->chans, SC->nchans*sizeof(UINT32_T));
+
+	while (!SC->should_exit) {
+		UINT32_T nchans, wordsize, block, begsample, endsample;
+		int r;
+
+		if (mcast_aux_get_hdr_gen(SC->ft_buffer, &hdr) != 0) {
+			/* no header yet */
+			usleep(FT_MCAST_WAIT_TIMEOUT*1000);
+			continue;
+		}
+
+		if (hdr.generation != generation) {
+			/* a new header, only the samples that arrive from now on are published */
+			generation = hdr.generation;
+			next = hdr.def.nsamples;
+			if (SC->verbosity > 0) {
+				printf("mcastserver: header of generation %u with %u channels\n", generation, hdr.def.nchans);
+			}
+		}
+
+		/* the samples per datagram follow from the size of the selected and converted samples */
+		nchans = (SC->nchans > 0) ? SC->nchans : hdr.def.nchans;
+		switch (SC->data_type & ~DATASEL_CALIBRATE) {
+			case DATATYPE_FLOAT32: wordsize = 4; break;
+			case DATATYPE_FLOAT64: wordsize = 8; break;
+			default: wordsize = wordsize_from_type(hdr.def.data_type);
+		}
+		if (nchans == 0 || wordsize == 0 || nchans*wordsize > FT_MCAST_MAXPAYLOAD) {
+			usleep(FT_MCAST_WAIT_TIMEOUT*1000);
+			continue;
+		}
+		block = FT_MCAST_PAYLOAD / (nchans*wordsize);
+		if (block == 0) block = 1;
+
+		while (!SC->should_exit && next < hdr.def.nsamples) {
+			begsample = next;
+			endsample = hdr.def.nsamples - 1;
+			if ((endsample - begsample)/SC->stride >= block) {
+				endsample = begsample + (block - 1)*SC->stride;
+			}
+
+			r = mcast_aux_publish(SC, &hdr, begsample, endsample, sel, packet);
+			if (r < 0) {
+				/* the samples have been pushed out of the ring, skip to those that are still there */
+				if (mcast_aux_get_hdr_gen(SC->ft_buffer, &hdr) != 0 || hdr.generation != generation) break;
+				if (SC->verbosity > 0) {
+					printf("mcastserver: could not read samples %u-%u, skipping\n", begsample, endsample);
+				}
+				next = hdr.def.nsamples;
+				break;
+			}
+			/* the first sample of the next datagram is a multiple of the stride after this one */
+			next = begsample + ((endsample - begsample)/SC->stride + 1)*SC->stride;
+		}
+
+		if (mcast_aux_wait_dat(SC->ft_buffer, next, FT_MCAST_WAIT_TIMEOUT) != 0) {
+			usleep(FT_MCAST_WAIT_TIMEOUT*1000);
+		}
+	}
+
+	free(sel);
+	free(packet);
+	return NULL;
+}
+
+/* see header file for documentation */
+mcast_server_ctrl_t *mcast_start_server(int ft_buffer, const char *group, int port, int ttl, UINT32_T stride, UINT32_T data_type, UINT32_T nchans, const UINT32_T *chans, int *errval) {
+	mcast_server_ctrl_t *SC = NULL;
+	SOCKET s = INVALID_SOCKET;
+	struct sockaddr_in sa;
+#ifdef PLATFORM_WINDOWS
+	int optval;
+#else
+	unsigned char optval;
+#endif
+	int interr = FT_ERR_SOCKET;
+
+#ifdef PLATFORM_WINDOWS
+	WSADATA wsa;
+ 	if(WSAStartup(MAKEWORD(2, 2), &wsa))
+	{
+		fprintf(stderr, "mcastserver: cannot start sockets\n");
+		goto cleanup;
+	}
+#endif
+
+	/* allocate the control structure */
+	SC = (mcast_server_ctrl_t *) calloc(1, sizeof(mcast_server_ctrl_t));
+	if (SC == NULL || (nchans > 0 && (SC->chans = (UINT32_T *) malloc(nchans*sizeof(UINT32_T))) == NULL)) {
+		fprintf(stderr, "mcast_start_server: out of memory\n");
+		interr = FT_ERR_OUT_OF_MEM;
+		goto cleanup;
+	}
+
+	/* create UDP socket */
+	s = socket(PF_INET, SOCK_DGRAM, 0);
+	if (s == INVALID_SOCKET) {
+		perror("mcast_start_server socket");
+		goto cleanup;
+	}
+
+	optval = (ttl > 0) ? ttl : 1;
+	if (setsockopt(s, IPPROTO_IP, IP_MULTICAST_TTL, (const char*)&optval, sizeof(optval)) < 0) {
+		perror("mcast_start_server setsockopt");
+		/* not really critical - we go on */
+	}
+
+	/* connect the socket to the group, the datagrams are then sent with send */
+	bzero(&sa, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port   = htons(port);
+	sa.sin_addr.s_addr = inet_addr(group);
+
+	if (sa.sin_addr.s_addr == INADDR_NONE || connect(s, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+		fprintf(stderr, "mcast_start_server: cannot send to %s:%i\n", group, port);
+		goto cleanup;
+	}
+
+	/* set some control variables */
+	SC->should_exit = 0;
+	SC->sock = s;
+	SC->ft_buffer = ft_buffer;
+	SC->stride = (stride > 0) ? stride : 1;
+	SC->data_type = data_type;
+	SC->nchans = nchans;
+	if (nchans > 0) memcpy(SC->chans, chans, nchans*sizeof(UINT32_T));
+	SC->sequence = 0;
+	SC->dropped = 0;
+	SC->verbosity = 1;
+
+	/* if things go wrong after this, it's because of pthread issues */
+	interr = FT_ERR_THREADING;
+
+	if (pthread_create(&SC->thread, NULL, _mcastserver_thread, SC) == 0) {
+		/* everything went fine - thread should be running now */
+		if (errval != NULL) *errval = FT_NO_ERROR;
+		return SC;
+	}
+
+cleanup:
+	if (errval!=NULL) *errval = interr;
+	if (SC != NULL) {
+		FREE(SC->chans);
+		free(SC);
+	}
+	if (s != INVALID_SOCKET) closesocket(s);
+	return NULL;
+}
+
+/* see header file for documentation */
+int mcast_stop_server(mcast_server_ctrl_t *SC) {
+	if (SC==NULL) return -1;
+
+	SC->should_exit = 1;
+	pthread_join(SC->thread, NULL);
+
+	closesocket(SC->sock);
+	FREE(SC->chans);
+	free(SC);
+	return 0;
+}
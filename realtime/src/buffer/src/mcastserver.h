@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+
+#ifndef MCASTSERVER_H
+#define MCASTSERVER_H
+
+#include <pthread.h>
+#include "platform.h"
+#include "buffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* as in rdaserver.h, which may have been included already */
+#if !defined(PLATFORM_WINDOWS) && !defined(INVALID_SOCKET)
+typedef int SOCKET;
+#define INVALID_SOCKET  -1
+#endif
+
+/** Error values as returned by mcast_start_server, the same as for rda_start_server */
+#define FT_NO_ERROR         0
+#define FT_ERR_OUT_OF_MEM   1
+#define FT_ERR_SOCKET       2
+#define FT_ERR_THREADING    3
+
+#define FT_MCAST_MAGIC      (UINT32_T)0x4D435446 /* "FTCM" in little endian */
+
+/** Samples are packed into datagrams of about this many bytes, which fits in a
+    single Ethernet frame. A datagram has at least one sample, and is therefore
+    larger if a single sample does not fit. */
+#define FT_MCAST_PAYLOAD    1400
+
+/** Largest datagram that can be sent over UDP */
+#define FT_MCAST_MAXPAYLOAD 65000
+
+/** Timeout (in ms) of the WAIT_DAT with which the publisher waits for new samples */
+#define FT_MCAST_WAIT_TIMEOUT 100
+
+/**
+  Every datagram consists of an mcastdef_t, followed by bufsize bytes with
+  nsamples samples of nchans channels, as in the response to GET_DAT. The
+  fields are in the byte order of the server, a client that reads the magic
+  in reversed order has to swap all fields and the samples.
+
+  The sequence is incremented by one for every datagram, so that a client can
+  detect the datagrams that it missed. The samples of a missed datagram can be
+  fetched over TCP with GET_DAT, using a datasel_ext_t with the same stride
+  and channels, starting at the begsample that follows those of the previous
+  datagram. If the publisher falls behind so far that the samples are pushed
+  out of the ring, it skips them, in which case begsample jumps ahead although
+  the sequence does not. The generation is that of GET_HDR_GEN, and changes
+  whenever the header is replaced or flushed.
+*/
+typedef struct {
+	UINT32_T magic;      /* FT_MCAST_MAGIC */
+	UINT32_T sequence;   /* number of the datagram */
+	UINT32_T generation; /* generation of the header */
+	UINT32_T begsample;  /* first sample in this datagram, numbered as in the buffer */
+	UINT32_T nsamples;   /* number of samples in this datagram, i.e. after the stride */
+	UINT32_T stride;     /* number of samples in the buffer per sample in this datagram */
+	UINT32_T nchans;
+	UINT32_T data_type;
+	UINT32_T bufsize;    /* number of bytes of samples that follow */
+} mcastdef_t;
+
+/** Multicast publisher control structure for starting, inspecting, and stopping a publisher */
+typedef struct {
+	pthread_t thread;               /**< Thread handle */
+	SOCKET sock;                    /**< UDP socket, connected to the group */
+	int ft_buffer;                  /**< Connection to FieldTrip buffer (socket or 0 for dmarequests) */
+	volatile int should_exit;       /**< Flag to notify the publisher thread that it should stop */
+	UINT32_T stride;                /**< Every stride-th sample is published */
+	UINT32_T data_type;             /**< DATATYPE_UNKNOWN for the type of the buffer, or as in datasel_ext_t */
+	UINT32_T nchans;                /**< Number of selected channels, 0 for all channels */
+	UINT32_T *chans;                /**< The indices of the selected channels */
+	volatile UINT32_T sequence;     /**< Number of datagrams that were published */
+	volatile UINT32_T dropped;      /**< Number of datagrams that could not be sent */
+	int verbosity;                  /**< Option that determines how much status information is printed during operation */
+} mcast_server_ctrl_t;
+
+/** Starts publishing the new samples of a FieldTrip buffer to a UDP multicast group,
+    so that any number of viewers can follow the data at the cost of a single stream.
+	@param ft_buffer        FieldTrip connection (0 for DMA, or socket for TCP connection)
+	@param group            Address of the multicast group, e.g. "239.255.19.72"
+	@param port             UDP port of the group
+	@param ttl              Number of router hops the datagrams may take, 1 keeps them on the local network
+	@param stride           Only every stride-th sample is published (0 or 1 for all samples)
+	@param data_type        DATATYPE_UNKNOWN to publish the samples as they are in the buffer,
+	                        or DATATYPE_FLOAT32/64, possibly with DATASEL_CALIBRATE, see datasel_ext_t
+	@param nchans           Number of selected channels, 0 to publish all channels
+	@param chans            Zero-offset indices of the selected channels (ignored if nchans=0)
+	@param errval           Optional pointer to an integer error value. Will contain either
+	                        FT_NO_ERROR, FT_ERR_SOCKET, FT_OUT_OF_MEM or FT_THREADING on exit.
+	@return                 Pointer to the control structure, or NULL if an error occured
+*/
+mcast_server_ctrl_t *mcast_start_server(int ft_buffer, const char *group, int port, int ttl, UINT32_T stride, UINT32_T data_type, UINT32_T nchans, const UINT32_T *chans, int *errval);
+
+/** Stops a multicast publisher, closes its socket, and deallocates the control structure
+	@param  SC      Must point to a control structure as created by mcast_start_server
+	@return -1      if SC is NULL
+	         0      on success
+*/
+int mcast_stop_server(mcast_server_ctrl_t *SC);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MCASTSERVER_H */
@@ -78,12 +78,24 @@ typedef uint64_t UINT64_T;
 #define PUT_EVT    (UINT16_T)0x0103 /* decimal 259 */
 #define PUT_OK     (UINT16_T)0x0104 /* decimal 260 */
 #define PUT_ERR    (UINT16_T)0x0105 /* decimal 261 */
+#define PUT_BATCH  (UINT16_T)0x0106 /* decimal 262, a sequence of PUT_DAT, PUT_DAT_T and PUT_EVT messages */
+#define PUT_DAT_Z  (UINT16_T)0x0107 /* decimal 263, a PUT_DAT with compressed samples, see compress.h */
+#define PUT_DAT_T  (UINT16_T)0x0108 /* decimal 264, a PUT_DAT preceded by the time of the first sample, see timestamp_t */
 
 #define GET_HDR    (UINT16_T)0x0201 /* decimal 513 */
 #define GET_DAT    (UINT16_T)0x0202 /* decimal 514 */
 #define GET_EVT    (UINT16_T)0x0203 /* decimal 515 */
 #define GET_OK     (UINT16_T)0x0204 /* decimal 516 */
 #define GET_ERR    (UINT16_T)0x0205 /* decimal 517 */
+#define GET_SHM    (UINT16_T)0x0206 /* decimal 518, only for clients on the same host, see shmbuffer.h */
+#define GET_CAP    (UINT16_T)0x0207 /* decimal 519, returns a buffercap_t */
+#define GET_STATS  (UINT16_T)0x0208 /* decimal 520, returns a statsdef_t followed by the histograms */
+#define GET_CODEC  (UINT16_T)0x0209 /* decimal 521, negotiates the compression on this connection, see compress.h */
+#define GET_OK_Z   (UINT16_T)0x020A /* decimal 522, a GET_OK response to GET_DAT with compressed samples */
+#define GET_TIME   (UINT16_T)0x020B /* decimal 523, maps between sample numbers and time, see timepoint_t */
+#define GET_HDR_GEN (UINT16_T)0x020C /* decimal 524, returns the counters of the header and its generation, see headergen_t */
+#define GET_QOS    (UINT16_T)0x020D /* decimal 525, selects the service class of this connection, see qosdef_t */
+#define GET_DAT_M  (UINT16_T)0x020E /* decimal 526, returns several ranges of samples at once, see datamulti_t */
 
 #define FLUSH_HDR  (UINT16_T)0x0301 /* decimal 769 */
 #define FLUSH_DAT  (UINT16_T)0x0302 /* decimal 770 */
@@ -95,6 +107,8 @@ typedef uint64_t UINT64_T;
 #define WAIT_OK    (UINT16_T)0x0404 /* decimal 1027 */
 #define WAIT_ERR   (UINT16_T)0x0405 /* decimal 1028 */
 
+#define STREAM_REQ (UINT16_T)0x0501 /* decimal 1281, a request for a named stream, see streamdef_t */
+
 /* these are used in the data_t and event_t structure */
 #define DATATYPE_CHAR    (UINT32_T)0
 #define DATATYPE_UINT8   (UINT32_T)1
@@ -237,11 +251,86 @@ typedef struct {
     UINT32_T endsample; /* indexing starts with 0, should be <header.nsamples */
 } datasel_t;
 
+/*
+  extended selection for GET_DAT, this is followed by nchans UINT32_T channel
+  indices (zero-offset). The server returns every stride-th sample of the
+  selected channels, converted to data_type. If DATASEL_CALIBRATE is added
+  to DATATYPE_FLOAT32/64, the values are also multiplied by the resolutions
+  in the FT_CHUNK_RESOLUTIONS chunk of the header (1 if there is none).
+*/
+#define DATASEL_CALIBRATE (UINT32_T)0x00010000
+
+typedef struct {
+    UINT32_T begsample; /* indexing starts with 0, should be >=0 */
+    UINT32_T endsample; /* indexing starts with 0, should be <header.nsamples */
+    UINT32_T stride;    /* 0 or 1 for all samples, N for every N-th sample starting at begsample */
+    UINT32_T data_type; /* DATATYPE_UNKNOWN for the type in the buffer, or DATATYPE_FLOAT32/64 */
+    UINT32_T nchans;    /* number of channel indices that follow, 0 for all channels */
+} datasel_ext_t;
+
 typedef struct {
     UINT32_T begevent;
     UINT32_T endevent;
 } eventsel_t;
 
+/*
+  GET_DAT_M returns several ranges of samples in one response, for example
+  the epochs around the last few triggers. The request is a datamulti_t,
+  followed by nchans UINT32_T channel indices as in datasel_ext_t, followed by
+
+    DATAMULTI_RANGES  nsel datasel_t
+    DATAMULTI_EPOCHS  an epochsel_t, optionally followed by a filter as in GET_EVT
+    DATAMULTI_LATEST  nothing, the range is the last nsel samples
+
+  For DATAMULTI_EPOCHS, the epochs are taken around the last nsel events from
+  begevent to endevent that match the filter (all of them if nsel is 0). An
+  event is skipped if its epoch is not completely in the ring. For
+  DATAMULTI_LATEST, the range is shorter if fewer samples are in the ring, and
+  there is none if the ring is empty. Since the client does not have to know
+  the number of samples, it can send this together with GET_HDR_GEN and
+  GET_EVT without waiting for the header. All ranges are
+  taken from the same snapshot of the ring, and have to be in the ring, i.e.
+  the spill file is not used. The response is a sequence of blocks, one for
+  each range in the order of the ranges, or of the events. Each block is a
+  datasel_t with the range, followed by a datadef_t and its samples as in the
+  response to GET_DAT. The stride is applied to each range separately.
+*/
+#define DATAMULTI_RANGES 1
+#define DATAMULTI_EPOCHS 2
+#define DATAMULTI_LATEST 3
+
+typedef struct {
+    UINT32_T what;      /* DATAMULTI_RANGES or DATAMULTI_EPOCHS */
+    UINT32_T nsel;      /* number of ranges, or the maximum number of epochs */
+    UINT32_T stride;    /* as in datasel_ext_t */
+    UINT32_T data_type;
+    UINT32_T nchans;
+} datamulti_t;
+
+typedef struct {
+    UINT32_T begevent;
+    UINT32_T endevent;
+    INT32_T  offset;    /* first sample of the epoch relative to the sample of the event */
+    UINT32_T nsamples;  /* number of samples in each epoch */
+} epochsel_t;
+
+/*
+  GET_EVT can have a filter after the eventsel_t, which consists of one or
+  more criteria. Each criterion is an eventfilter_t followed by bufsize bytes,
+  holding numel elements of data_type. Only the selected events that match
+  all kinds of criteria are returned, multiple criteria of the same kind (e.g.
+  two EVENTSEL_TYPE) match if either of them does. With a filter, the
+  selection is limited to the events that are still in the buffer, and an
+  empty result is not an error. For EVENTSEL_SAMPLE, EVENTSEL_MINSAMPLE and
+  EVENTSEL_MAXSAMPLE the element is a single DATATYPE_INT32.
+*/
+typedef struct {
+    UINT32_T what;      /* one of EVENTSEL_* */
+    UINT32_T data_type; /* type of the elements that follow */
+    UINT32_T numel;     /* number of elements that follow */
+    UINT32_T bufsize;   /* size of the elements in bytes */
+} eventfilter_t;
+
 typedef struct {
     UINT32_T nsamples;
     UINT32_T nevents;
@@ -252,6 +341,151 @@ typedef struct {
     UINT32_T milliseconds;
 } waitdef_t;
 
+/*
+  WAIT_DAT can have a waitevt_t after the waitdef_t, followed by a filter as
+  in GET_EVT. The client is then also woken up once an event from begevent
+  onwards matches the filter, and the sample of that event as well as the
+  postsamples samples after it are in the buffer. Set the thresholds in the waitdef_t
+  to 0xFFFFFFFF to only wait for the event. If it was the event that caused
+  the wakeup, the samples_events_t in the response is followed by the number
+  of that event (UINT32_T), and by the event itself (eventdef_t and buf) if
+  it is still in the buffer.
+*/
+typedef struct {
+    UINT32_T begevent;    /* only events with this number or higher are considered */
+    UINT32_T postsamples; /* number of samples that have to follow the event */
+} waitevt_t;
+
+/* the response to GET_CAP, sizes are 0 if there is no header, and 0xFFFFFFFF if they exceed 4 GiB */
+typedef struct {
+    UINT32_T nsamples;  /* number of samples that fit in the ring */
+    UINT32_T nevents;   /* number of events that fit in the ring */
+    UINT32_T nbytes;    /* size of the sample ring in bytes */
+    UINT32_T maxbytes;  /* memory budget for the sample ring, 0 if none has been set */
+} buffercap_t;
+
+/*
+  The response to GET_HDR_GEN is a headergen_t, in which def.bufsize is the
+  size of the chunks of the header. The generation is increased whenever the
+  header is replaced or flushed, and is never 0. Without a buf, the response
+  contains only the headergen_t. If the request contains the UINT32_T
+  generation that the client already has, the chunks follow the headergen_t
+  if that generation is no longer the current one. A client that does not
+  have the chunks yet can send 0.
+*/
+typedef struct {
+    headerdef_t def;
+    UINT32_T generation;
+} headergen_t;
+
+/*
+  The request of GET_QOS is a single UINT32_T with one of the FT_QOS_*
+  service classes, see qos.h. The response is a qosdef_t with the limits
+  that apply to the connection from now on, 0 means that there is no limit.
+  Servers that do not know GET_QOS reject it.
+*/
+typedef struct {
+    UINT32_T qosclass;  /* FT_QOS_WRITER, FT_QOS_CLASSIFIER or FT_QOS_VIEWER */
+    UINT32_T maxbytes;  /* larger GET_DAT, GET_DAT_M and GET_EVT responses are cut short */
+    UINT32_T rate;      /* average number of response bytes per second */
+    UINT32_T maxstall;  /* the connection is closed if a response can not be written for this many ms */
+} qosdef_t;
+
+/*
+  PUT_DAT_Z and GET_OK_Z carry a compdef_t, followed by the datadef_t of the
+  uncompressed samples, followed by the compressed samples. The request and
+  the response of GET_CODEC consist of a single UINT32_T with a bit for each
+  of the FT_CODEC_* codecs.
+*/
+typedef struct {
+    UINT32_T codec;     /* one of FT_CODEC_*, see compress.h */
+    UINT32_T bufsize;   /* size of the compressed samples in bytes */
+} compdef_t;
+
+/*
+  A STREAM_REQ carries a streamdef_t, followed by the messagedef_t and the
+  buf of a request for the stream with the given name. The response is the
+  response to that request. The name is terminated by a zero, and the empty
+  name selects the default stream, which is also used by requests that are
+  not wrapped. A stream is created by the first PUT_HDR for it, all other
+  requests for an unknown stream result in PUT_ERR, GET_ERR, FLUSH_ERR or
+  WAIT_ERR.
+*/
+#define FT_STREAM_NAMELEN 32
+#define FT_MAXNUMSTREAM   64
+
+typedef struct {
+    CHAR_T name[FT_STREAM_NAMELEN];
+} streamdef_t;
+
+/*
+  PUT_DAT_T carries a UINT64_T with the time of the first sample, followed by
+  the datadef_t and the samples like PUT_DAT. The time is in nanoseconds of a
+  clock that is chosen by the client, e.g. a monotonic or PTP-disciplined
+  clock, and all blocks should use the same clock. The server keeps the
+  timestamp_t of the last FT_MAXNUMTIMESTAMP blocks that carried a time.
+
+  GET_TIME without a buf returns these timestamp_t, the oldest first. With a
+  timepoint_t it returns the same timepoint_t with the sample or the time
+  filled in. This interpolates between the neighbouring blocks, and
+  extrapolates with the average rate of all blocks (or with the sample
+  rate in the header, if there is only one) outside of them.
+*/
+#define FT_MAXNUMTIMESTAMP 1024
+
+#define FT_TIME_OF_SAMPLE 1   /* determine timepoint_t.time from timepoint_t.sample */
+#define FT_SAMPLE_AT_TIME 2   /* determine timepoint_t.sample from timepoint_t.time */
+
+typedef struct {
+    UINT64_T time;      /* of the first sample of the block, in nanoseconds */
+    UINT32_T sample;    /* number of the first sample of the block */
+    UINT32_T nsamples;  /* number of samples in the block */
+} timestamp_t;
+
+typedef struct {
+    UINT64_T time;      /* in nanoseconds */
+    UINT32_T sample;    /* rounded to the nearest sample */
+    UINT32_T what;      /* FT_TIME_OF_SAMPLE or FT_SAMPLE_AT_TIME */
+} timepoint_t;
+
+/*
+  The response to GET_STATS consists of a statsdef_t, followed by two
+  histograms of nbins UINT64_T each (lockwait and roundtrip), followed by
+  ncommands blocks of a cmdstats_t and its latency histogram of nbins UINT64_T.
+  The histograms have logarithmic bins in microseconds: bin 0 counts the
+  durations below 1 us, bin k counts those in [2^(k-1), 2^k) us, and the last
+  bin counts everything that does not fit in the other bins.
+
+  lockwait  - time spent waiting for the locks of the header, data and events in dmarequest
+  roundtrip - time between receiving a request and sending out the response over the network
+  latency   - time between receiving a request and the response being ready, this includes blocking in WAIT_DAT
+*/
+typedef struct {
+    UINT32_T nbins;       /* number of bins in each histogram */
+    UINT32_T ncommands;   /* number of cmdstats_t blocks */
+    UINT32_T connections; /* number of open client connections */
+    UINT32_T accepted;    /* number of client connections since the start */
+    UINT32_T active;      /* number of requests that are being handled in dmarequest */
+    UINT32_T maxactive;   /* largest number of requests that were handled at the same time */
+    UINT32_T waiting;     /* number of WAIT_DAT requests that are blocked */
+    UINT32_T overwrites;  /* number of GET_DAT requests that were overwritten during the copy */
+    UINT32_T lostsamples; /* number of samples that have been pushed out of the ring */
+    UINT32_T lostevents;  /* number of events that have been pushed out of the ring */
+    UINT32_T queued;      /* number of requests that wait for a worker of the event loop, see socketserver.h */
+    UINT32_T maxqueued;   /* largest number of requests that waited for a worker at the same time */
+    UINT32_T inlined;     /* number of requests that were handled by the event loop itself, because the queue was full */
+    UINT32_T busy;        /* number of requests that are being handled by the workers */
+} statsdef_t;
+
+typedef struct {
+    UINT32_T command;     /* one of the request commands, or 0 for the unknown ones */
+    UINT32_T reserved;
+    UINT64_T count;       /* number of requests */
+    UINT64_T errors;      /* number of requests that resulted in PUT_ERR, GET_ERR, FLUSH_ERR or WAIT_ERR */
+    UINT64_T bytes_in;    /* size of the requests, including the messagedef_t */
+    UINT64_T bytes_out;   /* size of the responses, including the messagedef_t */
+} cmdstats_t;
+
 typedef struct {
     UINT32_T type;      /* One of FT_CHUNK_** (see above) */
     UINT32_T size;      /* Size of chunk.data, total size is given by adding sizeof(ft_chunkdef_t)=8 */
@@ -0,0 +1,410 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ * The "montage" plugin of the derived streams, which applies a spatial filter
+ * (re-referencing, bipolar derivations, Laplacians, ICA or beamformer unmixing)
+ * to the samples of the source, see derived.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/stat.h>
+
+#include "buffer.h"
+#include "derived.h"
+#include "ftclock.h"
+
+/*
+  The argument of the plugin is the name of a montage file, in which every line
+  defines an output channel as a weighted sum of the channels of the source,
+  either with the channels that contribute, e.g.
+
+    Cz-Pz = Cz - Pz
+    C3lap = C3 - 0.25*FC3 - 0.25*CP3 - 0.25*C1 - 0.25*C5
+
+  or with one weight for every channel of the source, e.g. for the rows of an
+  unmixing matrix
+
+    IC1 : 0.12 -0.31 0.05 ...
+
+  Channels are given by their label, or as #n for the n-th channel (starting at
+  1). The + and - between the terms are separated by spaces, since labels such
+  as "Cz-Pz" can contain them. Empty lines and lines starting with # are ignored.
+
+  The file is checked for changes every MONTAGE_CHECK seconds, and a new montage
+  is used from the next block of samples onwards, so without a gap. If it has
+  other output channels, the derived stream gets a new header. A montage with
+  errors is reported and ignored, the previous one stays in use.
+
+  A montage in which at most a quarter of the weights are not zero, such as a
+  bipolar montage or a Laplacian, is applied as a sparse matrix. Otherwise the
+  block of samples is multiplied with the full matrix in tiles that fit in the
+  cache, with SSE2 where available.
+*/
+
+#define MONTAGE_CHECK      1.0   /* in seconds */
+#define MONTAGE_TILE_IN    64    /* inputs per tile of the dense product */
+#define MONTAGE_TILE_OUT   256   /* outputs per tile */
+#define MONTAGE_TILE_SMP   64    /* samples per tile */
+#define MONTAGE_MAXLINE    65536
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define MONTAGE_SSE2
+  #include <emmintrin.h>
+#endif
+
+typedef struct {
+	UINT32_T nin, nout;
+	float *wt;            /* dense: nin rows of nout weights, i.e. the transposed matrix, or NULL */
+	UINT32_T *row;        /* sparse: the weights of output o are val[row[o]] to val[row[o+1]-1] */
+	UINT32_T *col;
+	float *val;
+} montage_matrix_t;
+
+typedef struct {
+	char *path;
+	time_t mtime;         /* of the file that was read last */
+	off_t size;
+	double checked;       /* time of the last check */
+	UINT32_T nin;
+	const char **inlabels;
+	char *labels;         /* copy of the labels of the source */
+	char *outlabels;      /* labels of the outputs, nout zero-terminated names */
+	UINT32_T outlabelsize;
+	montage_matrix_t M;
+} montage_t;
+
+static void matrix_free(montage_matrix_t *M) {
+	FREE(M->wt);
+	FREE(M->row);
+	FREE(M->col);
+	FREE(M->val);
+}
+
+/* returns the index of the channel, or -1 if there is none */
+static int find_channel(const montage_t *S, const char *name) {
+	UINT32_T i;
+	char *end;
+	long n;
+
+	for (i=0; i<S->nin; i++) {
+		if (S->inlabels[i] && strcmp(S->inlabels[i], name) == 0) return i;
+	}
+	if (name[0] == '#') {
+		n = strtol(name+1, &end, 10);
+		if (end != name+1 && *end == 0 && n >= 1 && n <= (long) S->nin) return n-1;
+	}
+	return -1;
+}
+
+/* returns the next word of the line and terminates it, or NULL at the end,
+ * strtok cannot be used since the workers may read montages at the same time */
+static char *next_token(char **p) {
+	char *tok;
+
+	while (**p && isspace((unsigned char) **p)) (*p)++;
+	if (**p == 0) return NULL;
+	tok = *p;
+	while (**p && !isspace((unsigned char) **p)) (*p)++;
+	if (**p) *(*p)++ = 0;
+	return tok;
+}
+
+/* parses the weights of one output, returns 0 on success */
+static int parse_row(const montage_t *S, char *expr, int dense, double *w) {
+	char *tok, *end;
+	double sign = 1, weight;
+	UINT32_T count = 0;
+	int k;
+
+	while ((tok = next_token(&expr)) != NULL) {
+		if (dense) {
+			if (count == S->nin) return -1;
+			w[count++] = strtod(tok, &end);
+			if (end == tok || *end != 0) return -1;
+			continue;
+		}
+		if (strcmp(tok, "+") == 0 || strcmp(tok, "-") == 0) {
+			sign = (tok[0] == '-') ? -sign : sign;
+			continue;
+		}
+		/* label, weight*label, or a label with a sign in front */
+		weight = 1;
+		if ((k = find_channel(S, tok)) < 0) {
+			weight = strtod(tok, &end);
+			if (end != tok && *end == '*') {
+				k = find_channel(S, end+1);
+			} else if (tok[0] == '-' || tok[0] == '+') {
+				weight = (tok[0] == '-') ? -1 : 1;
+				k = find_channel(S, tok+1);
+			}
+			if (k < 0) {
+				fprintf(stderr, "montage: unknown channel '%s'\n", tok);
+				return -1;
+			}
+		}
+		w[k] += sign*weight;
+		sign = 1;
+	}
+	return (dense && count != S->nin) ? -1 : 0;
+}
+
+/* reads the montage file, returns 0 on success */
+static int montage_read(const montage_t *S, montage_matrix_t *M, char **outlabels, UINT32_T *outlabelsize) {
+	FILE *f;
+	char *line = NULL, *sep, *name, *names;
+	double *W = NULL, *Wn;
+	UINT32_T nout = 0, nnz = 0, size = 0, i, o, lineno = 0;
+	int err = 0;
+
+	memset(M, 0, sizeof(montage_matrix_t));
+	*outlabels = NULL;
+	*outlabelsize = 0;
+
+	if ((f = fopen(S->path, "r")) == NULL) {
+		fprintf(stderr, "montage: cannot open %s\n", S->path);
+		return -1;
+	}
+	line = (char *) malloc(MONTAGE_MAXLINE);
+	if (line == NULL) err = -1;
+
+	while (!err && fgets(line, MONTAGE_MAXLINE, f) != NULL) {
+		lineno++;
+		for (name = line; isspace((unsigned char) *name); name++) {}
+		if (*name == 0 || *name == '#') continue;
+
+		/* the first = or : separates the name from the weights */
+		sep = name + strcspn(name, "=:");
+		if (*sep == 0) {
+			err = -1;
+			break;
+		}
+		Wn = (double *) realloc(W, (nout+1)*S->nin*sizeof(double));
+		if (Wn == NULL) {
+			err = -1;
+			break;
+		}
+		W = Wn;
+		memset(W + nout*S->nin, 0, S->nin*sizeof(double));
+		if (parse_row(S, sep+1, *sep == ':', W + nout*S->nin) != 0) {
+			err = -1;
+			break;
+		}
+
+		/* the name without the spaces around it */
+		*sep = 0;
+		while (sep > name && isspace((unsigned char) sep[-1])) *--sep = 0;
+		if (*name == 0) {
+			err = -1;
+			break;
+		}
+		names = (char *) realloc(*outlabels, size + strlen(name) + 1);
+		if (names == NULL) {
+			err = -1;
+			break;
+		}
+		*outlabels = names;
+		strcpy(*outlabels + size, name);
+		size += strlen(name) + 1;
+		nout++;
+	}
+	if (err && lineno > 0) fprintf(stderr, "montage: error in line %u of %s\n", lineno, S->path);
+	if (!err && nout == 0) {
+		fprintf(stderr, "montage: %s has no channels\n", S->path);
+		err = -1;
+	}
+	fclose(f);
+	FREE(line);
+
+	if (!err) {
+		for (i=0; i<nout*S->nin; i++) nnz += (W[i] != 0);
+		M->nin  = S->nin;
+		M->nout = nout;
+		if (4*nnz <= nout*S->nin) {
+			M->row = (UINT32_T *) malloc((nout+1)*sizeof(UINT32_T));
+			M->col = (UINT32_T *) malloc((nnz ? nnz : 1)*sizeof(UINT32_T));
+			M->val = (float *) malloc((nnz ? nnz : 1)*sizeof(float));
+			if (M->row && M->col && M->val) {
+				for (o=0, nnz=0; o<nout; o++) {
+					M->row[o] = nnz;
+					for (i=0; i<S->nin; i++) {
+						if (W[o*S->nin + i] == 0) continue;
+						M->col[nnz] = i;
+						M->val[nnz++] = (float) W[o*S->nin + i];
+					}
+				}
+				M->row[nout] = nnz;
+			} else {
+				err = -1;
+			}
+		} else {
+			M->wt = (float *) malloc(S->nin*nout*sizeof(float));
+			if (M->wt) {
+				for (o=0; o<nout; o++) {
+					for (i=0; i<S->nin; i++) M->wt[i*nout + o] = (float) W[o*S->nin + i];
+				}
+			} else {
+				err = -1;
+			}
+		}
+	}
+	FREE(W);
+	if (err) {
+		matrix_free(M);
+		FREE(*outlabels);
+		return -1;
+	}
+	*outlabelsize = size;
+	return 0;
+}
+
+/* y[0..n-1] += a*w[0..n-1] */
+static void axpy(UINT32_T n, float a, const float *w, float *y) {
+	UINT32_T o = 0;
+#ifdef MONTAGE_SSE2
+	__m128 va = _mm_set1_ps(a);
+	for (; o+8<=n; o+=8) {
+		__m128 y0 = _mm_add_ps(_mm_loadu_ps(y+o),   _mm_mul_ps(va, _mm_loadu_ps(w+o)));
+		__m128 y1 = _mm_add_ps(_mm_loadu_ps(y+o+4), _mm_mul_ps(va, _mm_loadu_ps(w+o+4)));
+		_mm_storeu_ps(y+o,   y0);
+		_mm_storeu_ps(y+o+4, y1);
+	}
+#endif
+	for (; o<n; o++) y[o] += a*w[o];
+}
+
+static void matrix_apply(const montage_matrix_t *M, UINT32_T nsamples, const float *src, float *dest) {
+	UINT32_T t, t0, t1, i, i0, i1, o, o0, on, k;
+
+	if (M->wt == NULL) {
+		for (t=0; t<nsamples; t++) {
+			const float *x = src + t*M->nin;
+			float *y = dest + t*M->nout;
+			for (o=0; o<M->nout; o++) {
+				float sum = 0;
+				for (k=M->row[o]; k<M->row[o+1]; k++) sum += M->val[k]*x[M->col[k]];
+				y[o] = sum;
+			}
+		}
+		return;
+	}
+
+	/* Y = X*Wt, a tile of the weights stays in the cache for a tile of samples */
+	memset(dest, 0, nsamples*M->nout*sizeof(float));
+	for (t0=0; t0<nsamples; t0+=MONTAGE_TILE_SMP) {
+		t1 = (t0 + MONTAGE_TILE_SMP < nsamples) ? t0 + MONTAGE_TILE_SMP : nsamples;
+		for (o0=0; o0<M->nout; o0+=MONTAGE_TILE_OUT) {
+			on = (M->nout - o0 < MONTAGE_TILE_OUT) ? M->nout - o0 : MONTAGE_TILE_OUT;
+			for (i0=0; i0<M->nin; i0+=MONTAGE_TILE_IN) {
+				i1 = (i0 + MONTAGE_TILE_IN < M->nin) ? i0 + MONTAGE_TILE_IN : M->nin;
+				for (t=t0; t<t1; t++) {
+					const float *x = src + t*M->nin;
+					float *y = dest + t*M->nout + o0;
+					for (i=i0; i<i1; i++) {
+						if (x[i] != 0) axpy(on, x[i], M->wt + i*M->nout + o0, y);
+					}
+				}
+			}
+		}
+	}
+}
+
+static void montage_free(void *state) {
+	montage_t *S = (montage_t *) state;
+	matrix_free(&S->M);
+	FREE(S->path);
+	FREE(S->inlabels);
+	FREE(S->labels);
+	FREE(S->outlabels);
+	free(S);
+}
+
+static void montage_stat(montage_t *S) {
+	struct stat st;
+	if (stat(S->path, &st) == 0) {
+		S->mtime = st.st_mtime;
+		S->size  = st.st_size;
+	}
+}
+
+static void *montage_init(const headerdef_t *hdr, const char *labels, UINT32_T labelsize, const char *args, ft_derived_hdr_t *out) {
+	montage_t *S;
+	UINT32_T i, p;
+
+	if (args == NULL || args[0] == 0) return NULL;
+	S = (montage_t *) calloc(1, sizeof(montage_t));
+	if (S == NULL) return NULL;
+	S->nin = hdr->nchans;
+	S->path = strdup(args);
+	S->inlabels = (const char **) calloc(hdr->nchans, sizeof(char *));
+	if (S->path == NULL || S->inlabels == NULL) {
+		montage_free(S);
+		return NULL;
+	}
+	if (labels != NULL && labelsize > 0) {
+		S->labels = (char *) malloc(labelsize + 1);
+		if (S->labels == NULL) {
+			montage_free(S);
+			return NULL;
+		}
+		memcpy(S->labels, labels, labelsize);
+		S->labels[labelsize] = 0;
+		for (i=0, p=0; i<hdr->nchans && p<labelsize; i++) {
+			S->inlabels[i] = S->labels + p;
+			p += strlen(S->labels + p) + 1;
+		}
+	}
+
+	montage_stat(S);
+	S->checked = ft_clock_seconds();
+	if (montage_read(S, &S->M, &S->outlabels, &S->outlabelsize) != 0) {
+		montage_free(S);
+		return NULL;
+	}
+	out->nchans    = S->M.nout;
+	out->fsample   = hdr->fsample;
+	out->labels    = S->outlabels;
+	out->labelsize = S->outlabelsize;
+	return S;
+}
+
+static UINT32_T montage_process(void *state, UINT32_T nsamples, const float *src, float *dest) {
+	montage_t *S = (montage_t *) state;
+	double now = ft_clock_seconds();
+
+	if (now - S->checked >= MONTAGE_CHECK) {
+		time_t mtime = S->mtime;
+		off_t size = S->size;
+
+		S->checked = now;
+		montage_stat(S);
+		if (S->mtime != mtime || S->size != size) {
+			montage_matrix_t M;
+			char *outlabels;
+			UINT32_T outlabelsize;
+
+			if (montage_read(S, &M, &outlabels, &outlabelsize) == 0) {
+				int same = (outlabelsize == S->outlabelsize && memcmp(outlabels, S->outlabels, outlabelsize) == 0);
+				if (!same) {
+					/* the derived stream needs a new header, init reads the file again */
+					matrix_free(&M);
+					free(outlabels);
+					return FT_DERIVED_RESTART;
+				}
+				matrix_free(&S->M);
+				S->M = M;
+				free(outlabels);
+			} else {
+				fprintf(stderr, "montage: keeping the previous montage\n");
+			}
+		}
+	}
+	matrix_apply(&S->M, nsamples, src, dest);
+	return nsamples;
+}
+
+/* arguments: the name of the montage file */
+const ft_plugin_t ft_plugin_montage = {"montage", montage_init, montage_process, montage_free};
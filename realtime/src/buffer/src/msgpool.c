@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ * Spare messages and buffers of a connection, see msgpool.h
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer.h"
+#include "msgpool.h"
+
+void ft_msgpool_init(ft_msgpool_t *P) {
+	memset(P, 0, sizeof(ft_msgpool_t));
+}
+
+void ft_msgpool_clear(ft_msgpool_t *P) {
+	int i;
+	for (i=0; i<FT_MSGPOOL_NUMSPARE; i++) {
+		FREE(P->msg[i]);
+		FREE(P->def[i]);
+		FREE(P->buf[i]);
+		P->size[i] = 0;
+	}
+}
+
+/* takes a spare object from one of the slots, or returns NULL */
+static void *take_spare(void **slot) {
+	int i;
+	for (i=0; i<FT_MSGPOOL_NUMSPARE; i++) {
+		if (slot[i] != NULL) {
+			void *ptr = slot[i];
+			slot[i] = NULL;
+			return ptr;
+		}
+	}
+	return NULL;
+}
+
+/* keeps the object in a free slot, or frees it */
+static void put_spare(void **slot, void *ptr) {
+	int i;
+	for (i=0; i<FT_MSGPOOL_NUMSPARE; i++) {
+		if (slot[i] == NULL) {
+			slot[i] = ptr;
+			return;
+		}
+	}
+	free(ptr);
+}
+
+message_t *ft_msgpool_message(ft_msgpool_t *P) {
+	message_t *msg = NULL;
+	messagedef_t *def = NULL;
+
+	if (P != NULL) {
+		msg = (message_t *) take_spare((void **) P->msg);
+		def = (messagedef_t *) take_spare((void **) P->def);
+	}
+	if (msg == NULL) msg = (message_t *) malloc(sizeof(message_t));
+	if (def == NULL) def = (messagedef_t *) malloc(sizeof(messagedef_t));
+	if (msg == NULL || def == NULL) {
+		FREE(msg);
+		FREE(def);
+		return NULL;
+	}
+	msg->def = def;
+	msg->buf = NULL;
+	return msg;
+}
+
+void *ft_msgpool_alloc(ft_msgpool_t *P, size_t size) {
+	int i, best = -1;
+
+	if (size == 0) size = 1;
+	if (P != NULL) {
+		/* the smallest spare buffer that is large enough */
+		for (i=0; i<FT_MSGPOOL_NUMSPARE; i++) {
+			if (P->buf[i] != NULL && P->size[i] >= size && (best < 0 || P->size[i] < P->size[best])) best = i;
+		}
+		if (best >= 0) {
+			void *buf = P->buf[best];
+			P->buf[best] = NULL;
+			P->size[best] = 0;
+			return buf;
+		}
+	}
+	return malloc(size);
+}
+
+void ft_msgpool_put(ft_msgpool_t *P, void *buf, size_t size) {
+	int i, smallest = 0;
+
+	if (buf == NULL) return;
+	if (P == NULL || size > FT_MSGPOOL_MAXKEEP) {
+		free(buf);
+		return;
+	}
+	/* keep the largest buffers, these are the most expensive to allocate */
+	for (i=0; i<FT_MSGPOOL_NUMSPARE; i++) {
+		if (P->buf[i] == NULL || P->size[i] < P->size[smallest]) smallest = i;
+		if (P->buf[i] == NULL) break;
+	}
+	if (P->buf[smallest] != NULL && P->size[smallest] >= size) {
+		free(buf);
+		return;
+	}
+	FREE(P->buf[smallest]);
+	P->buf[smallest]  = buf;
+	P->size[smallest] = size;
+}
+
+void ft_msgpool_release(ft_msgpool_t *P, message_t *msg, size_t bufsize) {
+	if (msg == NULL) return;
+	ft_msgpool_put(P, msg->buf, bufsize);
+	if (P == NULL) {
+		FREE(msg->def);
+		free(msg);
+		return;
+	}
+	if (msg->def != NULL) put_spare((void **) P->def, msg->def);
+	put_spare((void **) P->msg, msg);
+}
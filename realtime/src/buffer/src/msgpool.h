@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+
+#ifndef MSGPOOL_H
+#define MSGPOOL_H
+
+#include <stddef.h>
+#include "message.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  A pool of spare messages and buffers for a single connection, so that the
+  memory of one request and its response is reused by the next one instead of
+  going through malloc and free. The socket layer passes the pool of the
+  connection to dmarequest_pool, which takes the response from it, and gives
+  the response back with ft_msgpool_release once it has been written out.
+
+  Everything in the pool comes from malloc, so a message that was taken from
+  it may also be freed with cleanup_message, and any message allocated with
+  malloc may be given to it. A pool is used by one thread at a time, and each
+  function can be called with a NULL pool to just use malloc and free.
+*/
+
+#define FT_MSGPOOL_NUMSPARE 2
+/* larger buffers are not kept */
+#define FT_MSGPOOL_MAXKEEP  ((size_t) 64*1024*1024)
+
+typedef struct {
+	message_t    *msg[FT_MSGPOOL_NUMSPARE];
+	messagedef_t *def[FT_MSGPOOL_NUMSPARE];
+	void         *buf[FT_MSGPOOL_NUMSPARE];
+	size_t        size[FT_MSGPOOL_NUMSPARE];   /* number of bytes that were allocated for buf */
+} ft_msgpool_t;
+
+void ft_msgpool_init(ft_msgpool_t *P);
+void ft_msgpool_clear(ft_msgpool_t *P);
+
+/* returns a message with a def and without buf, or NULL if out of memory */
+message_t *ft_msgpool_message(ft_msgpool_t *P);
+
+/* returns a buffer of at least size bytes, the spare buffers are tried first */
+void *ft_msgpool_alloc(ft_msgpool_t *P, size_t size);
+
+/* gives back a buffer of which at least size bytes were allocated */
+void ft_msgpool_put(ft_msgpool_t *P, void *buf, size_t size);
+
+/* gives back a message, its def and its buf, which holds at least bufsize bytes */
+void ft_msgpool_release(ft_msgpool_t *P, message_t *msg, size_t bufsize);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MSGPOOL_H */
@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ * Placement of the sample ring in memory (huge pages, NUMA node) and of the
+ * threads on the processor cores.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "buffer.h"
+#include "placement.h"
+
+#ifndef PLATFORM_WINDOWS
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef PLATFORM_LINUX
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+
+#define HUGEPAGE_SIZE  ((size_t) 2*1024*1024)
+#define MAXNUMANODE    1024
+
+static pthread_mutex_t mutexplacement = PTHREAD_MUTEX_INITIALIZER;
+static int memory_flags = 0;
+static int memory_node  = -1;
+
+/* selects how the sample rings that are created from now on are allocated.
+ * Flags is a combination of FT_MEM_HUGEPAGES and FT_MEM_HUGETLB, and the
+ * ring is bound to the given NUMA node unless that is negative.
+ */
+void set_buffer_memory(int flags, int numa_node) {
+	pthread_mutex_lock(&mutexplacement);
+	memory_flags = flags;
+	memory_node  = (numa_node < MAXNUMANODE) ? numa_node : -1;
+	pthread_mutex_unlock(&mutexplacement);
+}
+
+/* touches every page, so that the page faults happen now rather than during the acquisition */
+static void prefault(void *ptr, size_t size) {
+	volatile char *p = (volatile char *) ptr;
+	size_t offset;
+	for (offset = 0; offset < size; offset += 4096) p[offset] = 0;
+	if (size > 0) p[size-1] = 0;
+}
+
+#ifndef PLATFORM_WINDOWS
+
+/* binds the pages of the mapping to a NUMA node, this only fails with a warning */
+static void bind_to_node(void *ptr, size_t size, int node) {
+#if defined(PLATFORM_LINUX) && defined(SYS_mbind)
+	unsigned long nodemask[MAXNUMANODE / (8*sizeof(unsigned long))];
+
+	memset(nodemask, 0, sizeof(nodemask));
+	nodemask[node / (8*sizeof(unsigned long))] = 1UL << (node % (8*sizeof(unsigned long)));
+	if (syscall(SYS_mbind, ptr, size, MPOL_BIND, nodemask, (unsigned long) MAXNUMANODE, 0) != 0)
+		perror("ft_ringmem_alloc: could not bind the ring to the NUMA node");
+#else
+	fprintf(stderr, "ft_ringmem_alloc: NUMA nodes are not supported on this platform\n");
+#endif
+}
+
+int ft_ringmem_alloc(ft_ringmem_t *mem, size_t size) {
+	int flags, node;
+	void *ptr = MAP_FAILED;
+	size_t mapsize;
+
+	pthread_mutex_lock(&mutexplacement);
+	flags = memory_flags;
+	node  = memory_node;
+	pthread_mutex_unlock(&mutexplacement);
+
+	if (flags == 0 && node < 0) {
+		mem->ptr  = malloc(size);
+		mem->size = 0;
+		mem->capacity = size;
+		if (mem->ptr == NULL) return -1;
+		prefault(mem->ptr, size);
+		return 0;
+	}
+
+	/* the mapping should consist of whole huge pages */
+	mapsize = (size + HUGEPAGE_SIZE - 1) & ~(HUGEPAGE_SIZE - 1);
+	if (mapsize == 0) mapsize = HUGEPAGE_SIZE;
+
+#ifdef MAP_HUGETLB
+	if (flags & FT_MEM_HUGETLB) {
+		/* explicit huge pages have to be reserved by the administrator, see /proc/sys/vm/nr_hugepages */
+		ptr = mmap(NULL, mapsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (ptr == MAP_FAILED) fprintf(stderr, "ft_ringmem_alloc: no huge pages available, using normal pages\n");
+	}
+#endif
+	if (ptr == MAP_FAILED) {
+		ptr = mmap(NULL, mapsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (ptr == MAP_FAILED) return -1;
+#ifdef MADV_HUGEPAGE
+		/* ask for transparent huge pages, this is only a hint */
+		if (flags & (FT_MEM_HUGEPAGES | FT_MEM_HUGETLB)) madvise(ptr, mapsize, MADV_HUGEPAGE);
+#endif
+	}
+	/* this has to be done before the pages are touched */
+	if (node >= 0) bind_to_node(ptr, mapsize, node);
+
+	mem->ptr  = ptr;
+	mem->size = mapsize;
+	mem->capacity = mapsize;
+	prefault(ptr, mapsize);
+	return 0;
+}
+
+void ft_ringmem_free(ft_ringmem_t *mem) {
+	if (mem->ptr == NULL) return;
+	if (mem->size > 0)
+		munmap(mem->ptr, mem->size);
+	else
+		free(mem->ptr);
+	mem->ptr  = NULL;
+	mem->size = 0;
+	mem->capacity = 0;
+}
+
+#else /* PLATFORM_WINDOWS */
+
+int ft_ringmem_alloc(ft_ringmem_t *mem, size_t size) {
+	mem->ptr  = malloc(size);
+	mem->size = 0;
+	mem->capacity = size;
+	if (mem->ptr == NULL) return -1;
+	prefault(mem->ptr, size);
+	return 0;
+}
+
+void ft_ringmem_free(ft_ringmem_t *mem) {
+	FREE(mem->ptr);
+	mem->size = 0;
+	mem->capacity = 0;
+}
+
+#endif
+
+/* restricts the calling thread, and the threads that it creates afterwards,
+ * to the cores in the list, e.g. "0,2-3". Returns 0 on success.
+ */
+int set_cpu_affinity(const char *cpulist) {
+#ifdef PLATFORM_LINUX
+	cpu_set_t set;
+	const char *ptr = cpulist;
+
+	CPU_ZERO(&set);
+	while (*ptr) {
+		char *end;
+		long first, last;
+
+		first = strtol(ptr, &end, 10);
+		if (end == ptr || first < 0 || first >= CPU_SETSIZE) break;
+		last = first;
+		if (*end == '-') {
+			ptr  = end + 1;
+			last = strtol(ptr, &end, 10);
+			if (end == ptr || last < first || last >= CPU_SETSIZE) break;
+		}
+		for (; first <= last; first++) CPU_SET(first, &set);
+		ptr = end;
+		if (*ptr == ',') ptr++;
+		else if (*ptr) break;
+	}
+	if (*ptr || CPU_COUNT(&set) == 0) {
+		fprintf(stderr, "set_cpu_affinity: invalid list of cores '%s'\n", cpulist);
+		return -1;
+	}
+	if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+		perror("set_cpu_affinity");
+		return -1;
+	}
+	return 0;
+#else
+	fprintf(stderr, "set_cpu_affinity: not supported on this platform\n");
+	return -1;
+#endif
+}
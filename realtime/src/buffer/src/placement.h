@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Memory for the sample ring. If huge pages or a NUMA node have been requested
+  with set_buffer_memory, the ring is mapped directly, otherwise it is taken
+  from malloc. The size is 0 in the latter case. The pages are touched when
+  the memory is allocated, so that writing to the ring does not page-fault.
+  A ring that needs at most capacity bytes can reuse the memory.
+*/
+typedef struct {
+	void  *ptr;
+	size_t size;
+	size_t capacity;
+} ft_ringmem_t;
+
+int ft_ringmem_alloc(ft_ringmem_t *mem, size_t size);
+void ft_ringmem_free(ft_ringmem_t *mem);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PLACEMENT_H */
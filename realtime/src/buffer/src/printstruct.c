@@ -82,3 +82,80 @@ void print_buf(void *buf, int bufsize) {
 	/* FIXME: fprint expects uint. */
 	fprintf(stderr, "\n");
 }
+
+/* returns the upper edge in microseconds of the bin that contains the given fraction of the histogram */
+static UINT64_T hist_percentile(const UINT64_T *hist, UINT32_T nbins, double fraction) {
+	UINT64_T total = 0, sum = 0;
+	UINT32_T i;
+	for (i=0; i<nbins; i++) total += hist[i];
+	for (i=0; i<nbins; i++) {
+		sum += hist[i];
+		if (sum > 0 && sum >= fraction*total) break;
+	}
+	return (UINT64_T) 1 << (i < nbins ? i : nbins-1);
+}
+
+static void print_hist(const char *name, const UINT64_T *hist, UINT32_T nbins) {
+	UINT64_T total = 0;
+	UINT32_T i;
+	for (i=0; i<nbins; i++) total += hist[i];
+	if (total == 0) {
+		fprintf(stderr, "%-10s empty\n", name);
+		return;
+	}
+	fprintf(stderr, "%-10s p50 < %llu us, p99 < %llu us, p999 < %llu us\n", name,
+			(unsigned long long) hist_percentile(hist, nbins, 0.5),
+			(unsigned long long) hist_percentile(hist, nbins, 0.99),
+			(unsigned long long) hist_percentile(hist, nbins, 0.999));
+	for (i=0; i<nbins; i++) {
+		if (hist[i] == 0) continue;
+		if (i == 0)
+			fprintf(stderr, "             < 1 us: %llu\n", (unsigned long long) hist[i]);
+		else if (i == nbins-1)
+			fprintf(stderr, "  >= %8llu us: %llu\n", (unsigned long long) 1 << (i-1), (unsigned long long) hist[i]);
+		else
+			fprintf(stderr, "   < %8llu us: %llu\n", (unsigned long long) 1 << i, (unsigned long long) hist[i]);
+	}
+}
+
+/* prints the response to GET_STATS, see message.h for the layout */
+void print_stats(void *buf, UINT32_T bufsize) {
+	statsdef_t *sdef = (statsdef_t *) buf;
+	const char *ptr;
+	UINT32_T i;
+
+	if (buf==NULL || bufsize < sizeof(statsdef_t) || bufsize != sizeof(statsdef_t) + (2 + sdef->ncommands) * sdef->nbins * sizeof(UINT64_T) + sdef->ncommands * sizeof(cmdstats_t)) {
+		fprintf(stderr, "stats are invalid\n");
+		return;
+	}
+	fprintf(stderr, "stats.connections = %u\n", sdef->connections);
+	fprintf(stderr, "stats.accepted    = %u\n", sdef->accepted);
+	fprintf(stderr, "stats.active      = %u\n", sdef->active);
+	fprintf(stderr, "stats.maxactive   = %u\n", sdef->maxactive);
+	fprintf(stderr, "stats.waiting     = %u\n", sdef->waiting);
+	fprintf(stderr, "stats.overwrites  = %u\n", sdef->overwrites);
+	fprintf(stderr, "stats.lostsamples = %u\n", sdef->lostsamples);
+	fprintf(stderr, "stats.lostevents  = %u\n", sdef->lostevents);
+	fprintf(stderr, "stats.queued      = %u\n", sdef->queued);
+	fprintf(stderr, "stats.maxqueued   = %u\n", sdef->maxqueued);
+	fprintf(stderr, "stats.inlined     = %u\n", sdef->inlined);
+	fprintf(stderr, "stats.busy        = %u\n", sdef->busy);
+
+	ptr = (const char *) buf + sizeof(statsdef_t);
+	print_hist("lockwait", (const UINT64_T *) ptr, sdef->nbins);
+	ptr += sdef->nbins * sizeof(UINT64_T);
+	print_hist("roundtrip", (const UINT64_T *) ptr, sdef->nbins);
+	ptr += sdef->nbins * sizeof(UINT64_T);
+
+	for (i=0; i<sdef->ncommands; i++) {
+		const cmdstats_t *cdef = (const cmdstats_t *) ptr;
+		ptr += sizeof(cmdstats_t);
+		if (cdef->count > 0) {
+			fprintf(stderr, "command 0x%04x: count = %llu, errors = %llu, bytes_in = %llu, bytes_out = %llu\n", cdef->command,
+					(unsigned long long) cdef->count, (unsigned long long) cdef->errors,
+					(unsigned long long) cdef->bytes_in, (unsigned long long) cdef->bytes_out);
+			print_hist("latency", (const UINT64_T *) ptr, sdef->nbins);
+		}
+		ptr += sdef->nbins * sizeof(UINT64_T);
+	}
+}
@@ -19,6 +19,7 @@ void print_eventdef(eventdef_t *);
 void print_datasel(datasel_t *);
 void print_eventsel(eventsel_t *);
 void print_buf(void *, int);
+void print_stats(void *, UINT32_T);
 
 #ifdef __cplusplus
 }
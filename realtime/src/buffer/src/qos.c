@@ -0,0 +1,281 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ * Service classes and per-connection limits of the buffer server, see qos.h
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "buffer.h"
+#include "bufstats.h"
+#include "qos.h"
+
+#ifdef PLATFORM_LINUX
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+#define NICE_UNKNOWN 100
+
+typedef struct {
+	UINT32_T maxbytes;
+	UINT32_T rate;
+	UINT32_T maxstall;
+	int nice;
+} qos_policy_t;
+
+static pthread_mutex_t mutexqos = PTHREAD_MUTEX_INITIALIZER;
+static qos_policy_t policy[FT_QOS_NUMCLASSES];
+
+/* sets the limits of a class, 0 means no limit. Returns 0 on success. */
+int set_qos_policy(UINT32_T qosclass, UINT32_T maxbytes, UINT32_T rate, UINT32_T maxstall, int nice) {
+	if (qosclass >= FT_QOS_NUMCLASSES || nice < 0 || nice > 19) {
+		fprintf(stderr, "set_qos_policy: invalid class or niceness\n");
+		return -1;
+	}
+	pthread_mutex_lock(&mutexqos);
+	policy[qosclass].maxbytes = maxbytes;
+	policy[qosclass].rate     = rate;
+	policy[qosclass].maxstall = maxstall;
+	policy[qosclass].nice     = nice;
+	pthread_mutex_unlock(&mutexqos);
+	return 0;
+}
+
+/* returns 1 if any class has a rate limit or a stall timeout, which the event loop then has to check periodically */
+int ft_qos_active(void) {
+	int i, active = 0;
+	pthread_mutex_lock(&mutexqos);
+	for (i=0; i<FT_QOS_NUMCLASSES; i++) {
+		if (policy[i].rate > 0 || policy[i].maxstall > 0) active = 1;
+	}
+	pthread_mutex_unlock(&mutexqos);
+	return active;
+}
+
+static qos_policy_t get_policy(const ft_qos_conn_t *Q) {
+	qos_policy_t p;
+	pthread_mutex_lock(&mutexqos);
+	p = policy[Q->qosclass];
+	pthread_mutex_unlock(&mutexqos);
+	return p;
+}
+
+void ft_qos_init(ft_qos_conn_t *Q) {
+	Q->qosclass = FT_QOS_CLASSIFIER;
+	Q->declared = 0;
+	Q->nice     = 0;
+	Q->basenice = NICE_UNKNOWN;
+	Q->sndtimeo = 0;
+	Q->tokens   = 0;
+	Q->last     = 0;
+}
+
+/* the command of a request, or that of the request wrapped in a STREAM_REQ */
+static UINT16_T request_command(const message_t *request) {
+	if (request->def->command == STREAM_REQ && request->def->bufsize >= sizeof(streamdef_t) + sizeof(messagedef_t))
+		return ((const messagedef_t *) ((const char *) request->buf + sizeof(streamdef_t)))->command;
+	return request->def->command;
+}
+
+/* answers GET_QOS, returns 1 if the request was answered, 0 if it should be
+ * passed on, and -1 if the response could not be allocated
+ */
+int ft_qos_serve(const message_t *request, ft_qos_conn_t *Q, message_t **response) {
+	message_t *msg;
+	qosdef_t *qdef = NULL;
+	UINT32_T qosclass = FT_QOS_NUMCLASSES;
+
+	if (request->def->command != GET_QOS) return 0;
+	if (request->def->bufsize == sizeof(UINT32_T)) memcpy(&qosclass, request->buf, sizeof(UINT32_T));
+
+	msg = (message_t *) malloc(sizeof(message_t));
+	if (msg == NULL) return -1;
+	msg->def = (messagedef_t *) malloc(sizeof(messagedef_t));
+	msg->buf = NULL;
+	if (msg->def == NULL) {
+		free(msg);
+		return -1;
+	}
+	msg->def->version = VERSION;
+	msg->def->command = GET_ERR;
+	msg->def->bufsize = 0;
+
+	if (qosclass < FT_QOS_NUMCLASSES) {
+		qdef = (qosdef_t *) malloc(sizeof(qosdef_t));
+		if (qdef == NULL) {
+			free(msg->def);
+			free(msg);
+			return -1;
+		}
+		Q->qosclass = qosclass;
+		Q->declared = 1;
+		{
+			qos_policy_t p = get_policy(Q);
+			qdef->qosclass = qosclass;
+			qdef->maxbytes = p.maxbytes;
+			qdef->rate     = p.rate;
+			qdef->maxstall = p.maxstall;
+		}
+		msg->buf = qdef;
+		msg->def->command = GET_OK;
+		msg->def->bufsize = sizeof(qosdef_t);
+	}
+	*response = msg;
+	return 1;
+}
+
+/* keeps as many samples of a GET_DAT response as fit in maxbytes, but at least one */
+static void truncate_samples(message_t *response, UINT32_T maxbytes) {
+	datadef_t *ddef = (datadef_t *) response->buf;
+	UINT32_T rowsize, keep;
+
+	if (response->def->bufsize < sizeof(datadef_t) || ddef->nsamples == 0) return;
+	rowsize = ddef->bufsize / ddef->nsamples;
+	if (rowsize == 0) return;
+	keep = (maxbytes > sizeof(datadef_t)) ? (maxbytes - sizeof(datadef_t)) / rowsize : 0;
+	if (keep == 0) keep = 1;
+	if (keep >= ddef->nsamples) return;
+	ddef->nsamples = keep;
+	ddef->bufsize  = keep * rowsize;
+	response->def->bufsize = sizeof(datadef_t) + ddef->bufsize;
+}
+
+/* keeps as many events of a GET_EVT response as fit in maxbytes, but at least one */
+static void truncate_events(message_t *response, UINT32_T maxbytes) {
+	UINT32_T offset = 0;
+
+	while (offset + sizeof(eventdef_t) <= response->def->bufsize) {
+		const eventdef_t *edef = (const eventdef_t *) ((const char *) response->buf + offset);
+		UINT32_T size = sizeof(eventdef_t) + edef->bufsize;
+		if (offset > 0 && offset + size > maxbytes) break;
+		offset += size;
+	}
+	if (offset < response->def->bufsize) response->def->bufsize = offset;
+}
+
+/* keeps as many ranges of a GET_DAT_M response as fit in maxbytes, but at least one */
+static void truncate_ranges(message_t *response, UINT32_T maxbytes) {
+	UINT32_T offset = 0;
+
+	while (offset + sizeof(datasel_t) + sizeof(datadef_t) <= response->def->bufsize) {
+		const datadef_t *ddef = (const datadef_t *) ((const char *) response->buf + offset + sizeof(datasel_t));
+		UINT32_T size = sizeof(datasel_t) + sizeof(datadef_t) + ddef->bufsize;
+		if (offset > 0 && offset + size > maxbytes) break;
+		offset += size;
+	}
+	if (offset < response->def->bufsize) response->def->bufsize = offset;
+}
+
+/* adds the tokens that were earned since the last update, up to one second worth */
+static void refill(ft_qos_conn_t *Q, UINT32_T rate) {
+	double now = 1e-6 * (double) ft_stats_clock();
+	if (Q->last == 0) Q->tokens = rate;
+	else Q->tokens += (now - Q->last) * rate;
+	if (Q->tokens > rate) Q->tokens = rate;
+	Q->last = now;
+}
+
+/* applies the limits of the class of the connection to a response, before
+ * it is compressed or swapped. Requests that write to the buffer make the
+ * connection the writer, unless it selected its class itself.
+ */
+void ft_qos_limit(ft_qos_conn_t *Q, const message_t *request, message_t *response) {
+	UINT16_T command = request_command(request);
+	qos_policy_t p;
+
+	if (!Q->declared) {
+		switch (command) {
+			case PUT_HDR:
+			case PUT_DAT:
+			case PUT_EVT:
+			case PUT_BATCH:
+			case PUT_DAT_Z:
+			case PUT_DAT_T:
+				Q->qosclass = FT_QOS_WRITER;
+		}
+	}
+	p = get_policy(Q);
+
+	if (p.maxbytes > 0 && response->def->command == GET_OK && response->def->bufsize > p.maxbytes) {
+		if (command == GET_DAT) truncate_samples(response, p.maxbytes);
+		if (command == GET_EVT) truncate_events(response, p.maxbytes);
+		if (command == GET_DAT_M) truncate_ranges(response, p.maxbytes);
+	}
+	if (p.rate > 0) {
+		refill(Q, p.rate);
+		Q->tokens -= sizeof(messagedef_t) + response->def->bufsize;
+	}
+}
+
+/* returns the number of seconds to wait before the next request of the connection is read */
+double ft_qos_delay(ft_qos_conn_t *Q) {
+	qos_policy_t p = get_policy(Q);
+
+	if (p.rate == 0) return 0;
+	refill(Q, p.rate);
+	return (Q->tokens >= 0) ? 0 : -Q->tokens / p.rate;
+}
+
+/* returns the stall timeout of the connection in ms, 0 if there is none */
+UINT32_T ft_qos_maxstall(const ft_qos_conn_t *Q) {
+	return get_policy(Q).maxstall;
+}
+
+/* lets blocking writes on the socket give up after the stall timeout */
+void ft_qos_socket(ft_qos_conn_t *Q, int sock) {
+	UINT32_T maxstall = ft_qos_maxstall(Q);
+
+	if (maxstall == Q->sndtimeo) return;
+	Q->sndtimeo = maxstall;
+#ifdef PLATFORM_WINDOWS
+	{
+		DWORD ms = maxstall;
+		setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (const char *) &ms, sizeof(ms));
+	}
+#else
+	{
+		struct timeval tv;
+		tv.tv_sec  = maxstall / 1000;
+		tv.tv_usec = (maxstall % 1000) * 1000;
+		setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (const char *) &tv, sizeof(tv));
+	}
+#endif
+}
+
+/* gives the calling thread the niceness of the class, relative to that of
+ * the thread when it was first called, this is only done on Linux where the
+ * niceness is a property of the thread. Lowering the niceness again requires
+ * privileges, so a connection that becomes the writer after it has been a
+ * viewer may keep the lower priority.
+ */
+void ft_qos_thread(ft_qos_conn_t *Q) {
+#ifdef PLATFORM_LINUX
+	int nice = get_policy(Q).nice;
+	pid_t tid;
+
+	if (nice == Q->nice) return;
+	tid = (pid_t) syscall(SYS_gettid);
+	if (Q->basenice == NICE_UNKNOWN) {
+		errno = 0;
+		Q->basenice = getpriority(PRIO_PROCESS, tid);
+		if (Q->basenice == -1 && errno != 0) {
+			Q->basenice = NICE_UNKNOWN;
+			return;
+		}
+	}
+	if (setpriority(PRIO_PROCESS, tid, Q->basenice + nice) != 0) {
+		perror("ft_qos_thread: could not change the priority of the thread");
+	}
+	/* this is not retried */
+	Q->nice = nice;
+#endif
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+
+#ifndef QOS_H
+#define QOS_H
+
+#include "message.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Every client connection belongs to one of the following service classes.
+  A connection starts as a classifier, becomes the writer once it sends
+  samples, events or a header, and can select its class itself with GET_QOS.
+  The limits of each class are set with set_qos_policy, by default there are
+  none. They are meant to keep slow readers from degrading the latency of
+  the acquisition:
+
+  maxbytes   GET_DAT, GET_DAT_M and GET_EVT responses are cut short to at
+             most this many bytes (but at least one sample, range or event).
+             The client can tell from the datadef_t, the ranges or the events
+             how much it got, and ask for the remainder with the next request.
+  rate       the server reads the next request of the connection only when
+             the average number of response bytes per second is below this.
+  maxstall   the connection is closed if its response can not be written for
+             this many milliseconds, i.e. if the client does not read it.
+  nice       niceness of the thread that serves the connection relative to
+             the rest of the server, only used with one thread per client on
+             Linux. The event loop serves the writer before the others.
+
+  The server functions below are called by tcpsocket.c and socketserver.c
+  for every request, similar to ft_codec_serve.
+*/
+
+#define FT_QOS_WRITER      0
+#define FT_QOS_CLASSIFIER  1
+#define FT_QOS_VIEWER      2
+#define FT_QOS_NUMCLASSES  3
+
+/* the state of a single connection */
+typedef struct {
+	UINT32_T qosclass;
+	int declared;       /* the class was selected with GET_QOS, so it does not change by itself */
+	int nice;           /* niceness that was given to the thread by ft_qos_thread */
+	int basenice;       /* niceness of the thread before that */
+	UINT32_T sndtimeo;  /* send timeout that was given to the socket by ft_qos_socket */
+	double tokens;      /* number of response bytes that can be sent before the rate limit applies */
+	double last;        /* time at which the tokens were updated, in seconds */
+} ft_qos_conn_t;
+
+int set_qos_policy(UINT32_T qosclass, UINT32_T maxbytes, UINT32_T rate, UINT32_T maxstall, int nice);
+int ft_qos_active(void);
+
+void ft_qos_init(ft_qos_conn_t *Q);
+int ft_qos_serve(const message_t *request, ft_qos_conn_t *Q, message_t **response);
+void ft_qos_limit(ft_qos_conn_t *Q, const message_t *request, message_t *response);
+double ft_qos_delay(ft_qos_conn_t *Q);
+UINT32_T ft_qos_maxstall(const ft_qos_conn_t *Q);
+void ft_qos_socket(ft_qos_conn_t *Q, int sock);
+void ft_qos_thread(ft_qos_conn_t *Q);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QOS_H */
@@ -32,8 +32,6 @@ rda_buffer_item_t *rda_aux_alloc_item(size_t size) {
 		return NULL;
 	}
 	item->size = size;
-	item->next = NULL;
-	item->refCount = 0;
 	return item;
 }
 
@@ -198,68 +196,7 @@ cleanup:
 
 
 void rda_aux_convert_to_float(UINT32_T N, void *dest, UINT32_T data_type, const void *src) {
-	UINT32_T n;
-	float *d = (float *) dest;
-	switch(data_type) {
-		case DATATYPE_CHAR:
-		case DATATYPE_UINT8:
-			{
-				const UINT8_T *s = (const UINT8_T *) src;
-				for (n=0;n<N;n++) d[n] = (float) s[n];
-			}
-			break;
-		case DATATYPE_UINT16:
-			{
-				const UINT16_T *s = (const UINT16_T *) src;
-				for (n=0;n<N;n++) d[n] = (float) s[n];
-			}
-			break;
-		case DATATYPE_UINT32:
-			{
-				const UINT32_T *s = (const UINT32_T *) src;
-				for (n=0;n<N;n++) d[n] = (float) s[n];
-			}
-			break;
-		case DATATYPE_UINT64:
-			{
-				const UINT64_T *s = (const UINT64_T *) src;
-				for (n=0;n<N;n++) d[n] = (float) s[n];
-			}
-			break;
-		case DATATYPE_INT8:
-			{
-				const INT8_T *s = (const INT8_T *) src;
-				for (n=0;n<N;n++) d[n] = (float) s[n];
-			}
-			break;
-		case DATATYPE_INT16:
-			{
-				const INT16_T *s = (const INT16_T *) src;
-				for (n=0;n<N;n++) d[n] = (float) s[n];
-			}
-			break;
-		case DATATYPE_INT32:
-			{
-				const INT32_T *s = (const INT32_T *) src;
-				for (n=0;n<N;n++) d[n] = (float) s[n];
-			}
-			break;
-		case DATATYPE_INT64:
-			{
-				const INT64_T *s = (const INT64_T *) src;
-				for (n=0;n<N;n++) d[n] = (float) s[n];
-			}
-			break;
-		case DATATYPE_FLOAT32:
-			memcpy(dest,src,N*sizeof(float));
-			break;
-		case DATATYPE_FLOAT64:
-			{
-				const double *s = (const double *) src;
-				for (n=0;n<N;n++) d[n] = (float) s[n];
-			}
-			break;
-	}
+	ft_convert_float32(N, dest, data_type, src, NULL);
 }
 
 
@@ -479,42 +416,110 @@ cleanup:
 	return item;
 }
 
+/** Number of encoded packets that are kept. A client that lags more than
+	RDA_MAX_LAG blocks behind is disconnected before its packet is replaced.
+*/
+#define RDA_RING_SIZE (RDA_MAX_LAG+1)
+
+/** Ring of the encoded start/data/stop packets. Every block is converted and
+	encoded once when it comes in, and all clients send it from here, each with
+	its own cursor. Block number n is kept in slot n % RDA_RING_SIZE, and the
+	ring contains the blocks first ... next-1.
+*/
+typedef struct {
+	rda_buffer_item_t *item[RDA_RING_SIZE];
+	unsigned int first;
+	unsigned int next;
+} rda_packet_ring_t;
+
+/** Frees the packets in the ring. If restart is set, the block numbers start at 0 again. */
+static void rda_aux_ring_clear(rda_packet_ring_t *R, int restart) {
+	while (R->first != R->next) {
+		rda_buffer_item_t *item = R->item[R->first % RDA_RING_SIZE];
+		free(item->data);
+		free(item);
+		R->first++;
+	}
+	if (restart) R->first = R->next = 0;
+}
+
+/** Appends a packet to the ring, and frees the oldest one if the ring is full.
+	The clients that still need that one must have been disconnected already,
+	see rda_aux_check_slow_clients.
+*/
+static void rda_aux_ring_add(rda_packet_ring_t *R, rda_buffer_item_t *item) {
+	unsigned int slot = R->next % RDA_RING_SIZE;
+
+	if (R->next - R->first == RDA_RING_SIZE) {
+		free(R->item[slot]->data);
+		free(R->item[slot]);
+		R->first++;
+	}
+	item->blockNumber = R->next;
+	R->item[slot] = item;
+	R->next++;
+}
+
+/** Returns the packet that a client should send now, or NULL if there is none */
+static const rda_buffer_item_t *rda_aux_pending_item(const rda_client_job_t *C, const rda_buffer_item_t *startItem, const rda_packet_ring_t *R) {
+	if (C->state == RDA_CLIENT_START) return startItem;
+	if (C->state == RDA_CLIENT_DATA && C->block != R->next) return R->item[C->block % RDA_RING_SIZE];
+	return NULL;
+}
+
+/** Returns 1 if the client has sent everything that is in the ring, or fails anyway */
+static int rda_aux_caught_up(const rda_client_job_t *C, const rda_packet_ring_t *R) {
+	if (C->state == RDA_CLIENT_START) return 0;
+	if (C->state == RDA_CLIENT_DATA) return C->block == R->next;
+	return 1;
+}
+
 /** Check for sockets that are ready to be written to, and write out as much of the corresponding job
     as possible.
 	@param 	remSelect	Number of remaining sockets to deal with
 	@param	writeSet	The socket set to check for writable clients
 	@param	numClients	The number of elements in the 'clients' array
 	@param	clients		Array describing the clients and their jobs
+	@param	startItem	The start packet (header info)
+	@param	R			The ring with the data and stop packets
 	@param	verbosity	Determines how much status/error message to print
 	@return	the remaining number of sockets to deal with (non-write operations)
 */
-int rda_aux_check_writing(int remSelect, const fd_set *writeSet, int numClients, rda_client_job_t *clients, int verbosity) {
+int rda_aux_check_writing(int remSelect, const fd_set *writeSet, int numClients, rda_client_job_t *clients, const rda_buffer_item_t *startItem, const rda_packet_ring_t *R, int verbosity) {
 	int i;
 
 	for (i=0 ; i<numClients && remSelect>0 ; i++) {
 		int sent;
 		rda_client_job_t *C = &clients[i];
+		const rda_buffer_item_t *item;
 
 		if (!FD_ISSET(C->sock, writeSet)) continue;	/* skip to next client in set */
 
-		/* printf("Sending out data (%i bytes)...\n", C->item->size - C->written); */
-		sent = send(C->sock, (char *) C->item->data + C->written, C->item->size - C->written, 0);
+		item = rda_aux_pending_item(C, startItem, R);
+		if (item == NULL) {
+			--remSelect;
+			continue;
+		}
+		/* printf("Sending out data (%i bytes)...\n", item->size - C->written); */
+		sent = send(C->sock, (char *) item->data + C->written, item->size - C->written, 0);
 
 		if (sent > 0) {
 			C->written += sent;
-			if (C->written == C->item->size) {
+			if (C->written == item->size) {
 				/* printf("Done with this packet on client %i\n", C->sock); */
-				C->item->refCount--;
 				C->written = 0;
-				C->item = C->item->next;
-				if (C->item != NULL) {
-					C->item->refCount++;
+				if (C->state == RDA_CLIENT_START) {
+					/* continue with the latest packet that the other clients got */
+					C->state = RDA_CLIENT_DATA;
+					C->block = (R->next != R->first) ? R->next - 1 : R->next;
+				} else {
+					C->block++;
 				}
 			}
 		} else {
 			if (verbosity>0)
 				fprintf(stderr, "rdaserver check_writing: write error on socket %i\n",C->sock);
-			C->item = NULL;	/* do not attempt to send more data, will probably be closed later on */
+			C->state = RDA_CLIENT_FAILED;	/* do not attempt to send more data, will probably be closed later on */
 		}
 		--remSelect;
 	}
@@ -557,10 +562,6 @@ int rda_aux_check_closure(int remSelect, const fd_set *readSet, int numClients,
 
 		closesocket(clients[i].sock);
 
-		if (clients[i].item != NULL) {
-			/* apparently we lost this connection during transmission */
-			clients[i].item->refCount--;
-		}
 		/* Remove clients from list by moving the last one in its place */
 		if (i < numClients - 1) {
 			clients[i] = clients[numClients-1];
@@ -574,17 +575,18 @@ int rda_aux_check_closure(int remSelect, const fd_set *readSet, int numClients,
 
 
 /** Check for sockets that are lagging behind significantly, and close them.
-	@param 	minBlock    Threshold on block number of keeping the client alive
+	The lag of a client is the distance of its cursor to the newest block in the ring.
+	@param	R			The ring with the data and stop packets
 	@param	numClients	The number of elements in the 'clients' array
 	@param	clients		Array describing the clients and their jobs
 	@param	verbosity	Determines how much status/error message to print
 	@return	the remaining number of clients
 */
-int rda_aux_check_slow_clients(int minBlock, int numClients, rda_client_job_t *clients, int verbosity) {
+int rda_aux_check_slow_clients(const rda_packet_ring_t *R, int numClients, rda_client_job_t *clients, int verbosity) {
 	int i = 0;	/* index of client we're looking at */
 
 	while (i<numClients) {
-		if (clients[i].item != NULL && clients[i].item->blockNumber < minBlock) {
+		if (clients[i].state == RDA_CLIENT_DATA && R->next - clients[i].block > RDA_MAX_LAG) {
 			if (verbosity > 0) {
 				fprintf(stderr, "rdaserver_thread: disconnecting too slow client (%i)\n", clients[i].sock);
 			}
@@ -593,7 +595,6 @@ int rda_aux_check_slow_clients(int minBlock, int numClients, rda_client_job_t *c
 			if (i < numClients - 1) {
 				clients[i] = clients[numClients-1];
 			}
-			clients[i].item->refCount--;
 			--numClients;
 			/* no increase of i here */
 		} else {
@@ -604,31 +605,52 @@ int rda_aux_check_slow_clients(int minBlock, int numClients, rda_client_job_t *c
 }
 
 
+#ifndef PLATFORM_WINDOWS
+/** Called by dmarequest (in the thread that writes the data) once there are new samples or events,
+	wakes up the select call of the server thread by writing to its pipe.
+*/
+static void rda_aux_notify(void *arg) {
+	char wake = 0;
+	/* the pipe is non-blocking, if it is full the thread will wake up anyway */
+	if (write(*((int *) arg), &wake, 1) < 0) {}
+}
+#endif
+
 /** Thread function of the RDA server. Can handle multiple clients in parallel.
 
 	Incoming data (from the FieldTrip buffer) is first converted to "items" in a form that RDA clients expect,
-	and a linked list of these items is kept. Each item has a reference count that determines on how many client
-	sockets it's currently being streamed out. At the end of the main server loop, the linked list is inspected
-	for unreferenced items at the start of the list, and those are removed.
+	and these are kept in a ring of the last RDA_RING_SIZE packets. So the conversion and the encoding of the
+	markers happen once per block, regardless of the number of clients. Every client only keeps the number of
+	the block that it is sending, and how much of it has been written. A client that lags too far behind is
+	disconnected before its block is replaced.
 
 	On top of the data items, also a "start item" is kept that contains the header information (RDA start packet).
-	This is necessary for being able to write out the header information to newly connecting clients.
+	This is necessary for being able to write out the header information to newly connecting clients, which then
+	continue with the latest block in the ring.
 
-	Initially, both the "start item" and the "first data item" are empty, indicating that no header information
+	Initially, both the "start item" and the ring are empty, indicating that no header information
 	and data/events	have been read yet.
+
+	If the server runs in the same process as the buffer (ft_buffer == 0), the thread registers
+	with dmarequest for the next block of samples or events, and only sleeps in select. New data
+	then wakes it up through a pipe, and is streamed out right away. A decreasing sample count
+	does not wake up the thread, so it still looks at the buffer every RDA_NOTIFY_TIMEOUT ms.
+	With a remote buffer, the thread alternates between select and a WAIT_DAT request.
 */
 void *_rdaserver_thread(void *arg) {
 	rda_server_ctrl_t *SC = (rda_server_ctrl_t *) arg;		/* our control structure */
 	rda_client_job_t clients[RDA_MAX_NUM_CLIENTS];			/* list of clients and their current jobs */
 	rda_buffer_item_t *startItem = NULL;				 	/* item containing start packet (header info) */
-	rda_buffer_item_t *firstDataItem = NULL;				/* first item in list of (mostly) data packets */
-	rda_buffer_item_t *latestItem = NULL;
+	rda_packet_ring_t ring;									/* the last data (and stop) packets */
 
 	headerdef_t ftHdr;			/* contains header information */
 	int i,typeOk;				/* typeOk is only interesting for 16-bit servers */
 	int ftTimeout = 20;			/* in milliseconds, wait up to 20ms for new data/events */
 	int selTimeout = 0;			/* in microseconds, for select */
-	unsigned int numBlock = 0;	/* running count of data blocks received */
+	int useNotify = 0;			/* 1 if new data is signalled through the pipe */
+	int ftReady = 0;			/* 1 if there may be new data, in the useNotify mode */
+	int wakeup[2] = {-1, -1};	/* pipe for waking up the select call */
+	waiter_t *ftWait = NULL;	/* registration with dmarequest, in the useNotify mode */
 	samples_events_t lastNum = {0,0};	/* number of samples + events handled so far */
 	samples_events_t curNum = {0,0};	/* ... currently available */
 	fd_set readSet, writeSet;	/* for select on server + child sockets */
@@ -644,6 +666,7 @@ void *_rdaserver_thread(void *arg) {
 	if (SC==NULL) return NULL;
 
 	SC->is_running = 1;
+	ring.first = ring.next = 0;
 	/* Set typeOk flag to 1 for floats, 0 for int16
 		(in the latter case we need to check the FT header first)
 	*/
@@ -653,6 +676,19 @@ void *_rdaserver_thread(void *arg) {
 	fdMax = SC->server_socket;
 	#endif
 
+	#ifndef PLATFORM_WINDOWS
+	if (SC->ft_buffer == 0) {
+		if (pipe(wakeup) == 0) {
+			fcntl(wakeup[0], F_SETFL, fcntl(wakeup[0], F_GETFL, 0) | O_NONBLOCK);
+			fcntl(wakeup[1], F_SETFL, fcntl(wakeup[1], F_GETFL, 0) | O_NONBLOCK);
+			if (wakeup[0] > fdMax) fdMax = wakeup[0];
+			useNotify = 1;
+		} else {
+			perror("rdaserver_thread -- pipe");
+		}
+	}
+	#endif
+
 	/* Loop this until errors occur or this flag is set from another thread */
 	while (!SC->should_exit) {
 		int sel;
@@ -670,6 +706,7 @@ void *_rdaserver_thread(void *arg) {
 				}
 				/* don't wait in select call, but inside FT polling */
 				selTimeout = 0;
+				ftReady = 1;
 				/* set 'typeOk' flag if we're running a 16 bit server */
 				if (SC->use16bit) {
 					typeOk = (ftHdr.data_type == DATATYPE_INT16) || (ftHdr.data_type == DATATYPE_UINT16);
@@ -677,18 +714,18 @@ void *_rdaserver_thread(void *arg) {
 				/* start from the numbers of samples + events currently in the buffer */
 				lastNum.nsamples = ftHdr.nsamples;
 				lastNum.nevents  = ftHdr.nevents;
+				/* reset block counter */
+				rda_aux_ring_clear(&ring, 1);
+				startItem->blockNumber = -1;
 				/* if we already have clients, change operation state */
 				if (numClients > 0) {
 					opState = 1;
 					/* add start packet to all clients */
 					for (i=0;i<numClients;i++) {
-						clients[i].item = startItem;
+						clients[i].state = RDA_CLIENT_START;
 						clients[i].written = 0;
 					}
 				}
-				/* reset block counter */
-				numBlock = 0;
-				startItem->blockNumber = -1;
 			}
 		}
 
@@ -705,18 +742,55 @@ void *_rdaserver_thread(void *arg) {
 			/* Every client is listened to (for disconnection!) */
 			FD_SET(clients[i].sock, &readSet);
 			/* But only clients with a pending start/data/stop item	are added to the write set */
-			if (clients[i].item != NULL) FD_SET(clients[i].sock, &writeSet);
+			if (rda_aux_pending_item(&clients[i], startItem, &ring) != NULL) FD_SET(clients[i].sock, &writeSet);
 		}
 
-		/* Check server and client sockets for possible read and write operations */
 		tv.tv_sec  = 0;
-		tv.tv_usec = selTimeout;
+		/* while the clients get the stop packet, the FT buffer is not polled */
+		tv.tv_usec = (opState == 2) ? 10000 : selTimeout;
+
+		#ifndef PLATFORM_WINDOWS
+		if (useNotify && startItem != NULL && opState != 2) {
+			/* ask dmarequest to wake us up once there is enough for a new block */
+			if (!ftReady && ftWait == NULL) {
+				if (SC->blocksize > 0) {
+					ftWait = register_wait(lastNum.nsamples + SC->blocksize - 1, 0xFFFFFFFF, rda_aux_notify, &wakeup[1]);
+				} else {
+					ftWait = register_wait(lastNum.nsamples, lastNum.nevents, rda_aux_notify, &wakeup[1]);
+				}
+				/* NULL means that the threshold has been exceeded already */
+				if (ftWait == NULL) ftReady = 1;
+			}
+			tv.tv_usec = ftReady ? 0 : RDA_NOTIFY_TIMEOUT*1000;
+		}
+		if (useNotify) FD_SET(wakeup[0], &readSet);
+		#endif
+
+		/* Check server and client sockets for possible read and write operations */
 		sel = select(fdMax + 1, &readSet, &writeSet, NULL, &tv);
 		if (sel == -1) {
 			perror("rdaserver_thread -- select");
 			continue; /* TODO: think about stopping operation instead */
 		}
 
+		#ifndef PLATFORM_WINDOWS
+		if (useNotify) {
+			if (sel>0 && FD_ISSET(wakeup[0], &readSet)) {
+				char dummy[64];
+				while (read(wakeup[0], dummy, sizeof(dummy)) > 0) {}
+				--sel;
+				ftReady = 1;
+			} else if (sel == 0) {
+				/* timeout, check for a decreased sample count */
+				ftReady = 1;
+			}
+			if (ftReady && ftWait != NULL) {
+				unregister_wait(ftWait);
+				ftWait = NULL;
+			}
+		}
+		#endif
+
 		/* Check if we have a new client connection */
 		if (sel>0 && FD_ISSET(SC->server_socket, &readSet)) {
 			struct sockaddr_in sa;
@@ -732,7 +806,9 @@ void *_rdaserver_thread(void *arg) {
 				}
 
 				clients[numClients].sock = newSock;
-				clients[numClients].item = startItem;
+				/* during a stop, new clients wait for the next header */
+				clients[numClients].state = (startItem != NULL && opState != 2) ? RDA_CLIENT_START : RDA_CLIENT_WAITING;
+				clients[numClients].block = 0;
 				clients[numClients].written = 0;
 				numClients++;
 				pthread_mutex_lock(&SC->mutex);
@@ -743,7 +819,7 @@ void *_rdaserver_thread(void *arg) {
 				#endif
 			}
 			--sel;
-			if (numClients > 0 && startItem != NULL) {
+			if (numClients > 0 && startItem != NULL && opState == 0) {
 				/* let's go running */
 				opState = 1;
 			}
@@ -751,7 +827,7 @@ void *_rdaserver_thread(void *arg) {
 
 		/* Check for sockets that are ready to be written to */
 		if (sel>0) {
-			sel = rda_aux_check_writing(sel, &writeSet, numClients, clients, SC->verbosity);
+			sel = rda_aux_check_writing(sel, &writeSet, numClients, clients, startItem, &ring, SC->verbosity);
 		}
 
 		/* Check for sockets on which we can read (=> read 0 bytes means closure ) */
@@ -760,9 +836,10 @@ void *_rdaserver_thread(void *arg) {
 		} else {
 			newNumClients = numClients;
 		}
-		/* Check for clients that lag behind */
+		/* Check for clients that lag behind. Since at most one packet is added to the
+		   ring below, the block of every remaining client is still there afterwards. */
 		if (newNumClients > 0) {
-			newNumClients = rda_aux_check_slow_clients(numBlock - RDA_MAX_LAG, newNumClients, clients, SC->verbosity);
+			newNumClients = rda_aux_check_slow_clients(&ring, newNumClients, clients, SC->verbosity);
 		}
 
 		if (newNumClients < numClients) {
@@ -777,19 +854,29 @@ void *_rdaserver_thread(void *arg) {
 			pthread_mutex_unlock(&SC->mutex);
 		}
 		if (numClients == 0) {
-			/* no clients any more - wait */
+			/* no clients any more - wait, new clients start with the latest block */
+			rda_aux_ring_clear(&ring, 0);
+			if (opState == 2) {
+				free(startItem->data);
+				free(startItem);
+				startItem = NULL;
+			}
 			opState = 0;
 		}
 
 		/* Ok, (client) network stuff is done, let's see if there is more data */
 
 		/* If we already have the header, check for new data (samples / events) */
-		if (startItem != NULL && !rda_aux_wait_dat(SC->ft_buffer, &lastNum, &curNum, ftTimeout)) {
+		if (startItem != NULL && opState != 2 && (!useNotify || ftReady) &&
+			!rda_aux_wait_dat(SC->ft_buffer, &lastNum, &curNum, useNotify ? 0 : ftTimeout)) {
 			int newBlock;
 
+			ftReady = 0;
+
 			if (SC->blocksize > 0) {
-				/* only send out a DATA packet if there are enough new samples */
-				newBlock = (curNum.nsamples - lastNum.nsamples) >= SC->blocksize;
+				/* only send out a DATA packet if there are enough new samples
+				   (the counts are unsigned, so do not subtract them) */
+				newBlock = curNum.nsamples >= lastNum.nsamples + SC->blocksize;
 				if (newBlock) {
 					curNum.nsamples = lastNum.nsamples + SC->blocksize;
 				}
@@ -811,10 +898,6 @@ void *_rdaserver_thread(void *arg) {
 			if (curNum.nsamples < lastNum.nsamples) {
 				rda_buffer_item_t *stopItem;
 
-				free(startItem->data);
-				free(startItem);
-				startItem = NULL;
-
 				if (opState == 1) {
 					if (SC->verbosity > 4) {
 						printf("Sample count in FieldTrip buffer decreased, sending STOP packet to all clients.\n");
@@ -827,37 +910,22 @@ void *_rdaserver_thread(void *arg) {
 						break;
 					}
 
-					/* First add a STOP message to be sent to the list */
+					/* Add a STOP message to the ring, the clients that are currently waiting get it right away */
 					memcpy(stopItem->data, _rda_guid, sizeof(_rda_guid));
 					((rda_msg_hdr_t *) stopItem->data)->nSize = sizeof(rda_msg_hdr_t);
 					((rda_msg_hdr_t *) stopItem->data)->nType = RDA_STOP_MSG;
-					stopItem->blockNumber = numBlock++;
-					stopItem->next = NULL;	/* restart from opState=0 here */
-					latestItem = stopItem;
+					rda_aux_ring_add(&ring, stopItem);
 
-					/* Add stop item to data packet list */
-					if (firstDataItem == NULL) {
-						firstDataItem = stopItem;
-					} else {
-						rda_buffer_item_t *last = firstDataItem;
-						while (last->next != NULL) {
-							last = last->next;
-						}
-						last->next = stopItem;
-					}
-					/* ... and also add it to clients that are currently waiting */
-					for (i=0;i<numClients;i++) {
-						if (clients[i].item == NULL) {
-							clients[i].item = stopItem;
-							stopItem->refCount++;
-						}
-					}
-					/* switch to waiting-for-stop operation mode */
+					/* switch to waiting-for-stop operation mode, the old start packet
+					   is kept for the clients that are still sending it */
 					opState = 2;
 				} else {
 					if (SC->verbosity > 4) {
 						printf("Sample count in FieldTrip buffer decreased, will re-read header.\n");
 					}
+					free(startItem->data);
+					free(startItem);
+					startItem = NULL;
 				}
 			}
 
@@ -869,68 +937,35 @@ void *_rdaserver_thread(void *arg) {
 					then read this block and start streaming it out
 				*/
 				if (typeOk && newBlock && opState==1) {
-					/* There's new data to stream out */
+					/* There's new data to stream out, the clients that are waiting get it right away */
 					rda_buffer_item_t *item;
 
-					item = rda_aux_get_samples_and_markers(SC->ft_buffer, &lastNum, &curNum, numBlock, SC->use16bit);
+					item = rda_aux_get_samples_and_markers(SC->ft_buffer, &lastNum, &curNum, ring.next, SC->use16bit);
 					if (item != NULL) {
-						if (firstDataItem == NULL) {
-							firstDataItem = item;
-						} else {
-							rda_buffer_item_t *last = firstDataItem;
-							while (last->next != NULL) last = last->next;
-							last->next = item;
-						}
-						for (i=0;i<numClients;i++) {
-							if (clients[i].item == NULL) {
-								if (SC->verbosity>6) {
-									printf("Adding new job for client %i\n", clients[i].sock);
-								}
-								clients[i].item = item;
-								item->refCount++;
-							}
-						}
+						rda_aux_ring_add(&ring, item);
 						lastNum = curNum;
-						latestItem = item;
-						/* modify startItem's block number (for new clients),
-						   then increase block number
-						*/
-						startItem->blockNumber = numBlock++;
 					} else {
 						fprintf(stderr, "Could not get data from FT buffer or allocate memory\n");
 					}
+				} else if (!typeOk) {
+					/* nothing is streamed out, so don't wait for these samples again */
+					lastNum = curNum;
 				}
 			}
 		}
 
-
-		/* just for debugging - this will be removed */
-		if (0) {
-			rda_buffer_item_t *item = firstDataItem;
-
-			while (item!=NULL) {
-				printf("Item at 0x%lX has refcount %i and points at 0x%lX\n", (long) (void *) item,  item->refCount, (long) (void *) item->next);
-				item = item->next;
+		/* Once all clients got the STOP packet, the header is read again */
+		if (opState == 2) {
+			for (i=0;i<numClients;i++) {
+				if (!rda_aux_caught_up(&clients[i], &ring)) break;
 			}
-		}
-
-		/* Done with the network-specific stuff, now clean up the data items */
-		while (firstDataItem != NULL && firstDataItem->refCount == 0) {
-			rda_buffer_item_t *next = firstDataItem->next;
-			free(firstDataItem->data);
-			free(firstDataItem);
-			firstDataItem = next;
-		}
-
-		if (firstDataItem == NULL) {
-			latestItem = NULL;
-			if (opState == 2) {
+			if (i == numClients) {
+				free(startItem->data);
+				free(startItem);
+				startItem = NULL;
 				opState = 0;
 			}
 		}
-
-		/* Update the startItem's (=header) next pointer */
-		if (startItem != NULL) startItem->next = latestItem;
 	}
 	/* shutdown clients */
 	for (i=0;i<numClients;i++) {
@@ -947,13 +982,15 @@ void *_rdaserver_thread(void *arg) {
 		free(startItem->data);
 		free(startItem);
 	}
-	/* ... and firstDataItem (including following list elements) */
-	while (firstDataItem!=NULL) {
-		rda_buffer_item_t *next = firstDataItem->next;
-		free(firstDataItem->data);
-		free(firstDataItem);
-		firstDataItem = next;
+	/* ... and the packets in the ring */
+	rda_aux_ring_clear(&ring, 1);
+	#ifndef PLATFORM_WINDOWS
+	unregister_wait(ftWait);
+	if (useNotify) {
+		close(wakeup[0]);
+		close(wakeup[1]);
 	}
+	#endif
 	SC->is_running = 0;
 	return NULL;
 }
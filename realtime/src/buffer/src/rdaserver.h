@@ -45,6 +45,15 @@ typedef int SOCKET;
 /** Number of blocks any client can lag behind before being disconnected */
 #define RDA_MAX_LAG 5
 
+/** Interval (in ms) at which a server in the same process as the buffer checks for a new header */
+#define RDA_NOTIFY_TIMEOUT 100
+
+/** States of a client, see rda_client_job_t */
+#define RDA_CLIENT_WAITING  0           /**< Waiting for the header (start packet) */
+#define RDA_CLIENT_START    1           /**< Sending the start packet */
+#define RDA_CLIENT_DATA     2           /**< Sending the data and stop packets, starting at 'block' */
+#define RDA_CLIENT_FAILED   3           /**< Write error, nothing is sent any more */
+
 /** RDA server control structure for starting, inspecting, and stopping a server */
 typedef struct {
         pthread_t thread;               /**< Thread handle */
@@ -59,21 +68,20 @@ typedef struct {
         int verbosity;                  /**< Option that determines how much status information is printed during operation */
 } rda_server_ctrl_t;
 
-/** Internally used data structure to keep a linked list of
-        data packets that need to be sent out */
+/** Internally used data structure for an encoded packet that
+        is sent out to all clients */
 typedef struct rda_buffer_item {
         void *data;                     /**< Points to complete RDA packet */
         size_t size;                    /**< Size of the packet (=allocated memory block) */
         int blockNumber;                /**< Number of this data block (or -1 for start packet) */
-        unsigned int refCount;          /**< Reference count (multiple clients get the same data) */
-        struct rda_buffer_item *next;   /**< Next item in list or NULL */
 } rda_buffer_item_t;
 
 /** Internally used data structure to describe a client and its pending jobs */
 typedef struct {
         SOCKET sock;                    /**< Client socket */
-        rda_buffer_item_t *item;        /**< Points to the current/next packet to be written */
-        size_t written;                 /**< Number of bytes that have been written (from item->data) */
+        int state;                      /**< One of the RDA_CLIENT_xxx constants */
+        unsigned int block;             /**< Number of the data block that is written (next), if state is RDA_CLIENT_DATA */
+        size_t written;                 /**< Number of bytes that have been written of the current packet */
 } rda_client_job_t;
 
 /** Helper function for converting any FieldTrip data type to single precision floats
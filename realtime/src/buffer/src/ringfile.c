@@ -0,0 +1,241 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ * Memory mapped file with the header, samples and events, see ringfile.h
+ */
+
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer.h"
+#include "atomicutil.h"
+#include "ringfile.h"
+
+#ifndef PLATFORM_WINDOWS
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+struct ft_ringfile_s {
+	int fd;
+	ft_ringfile_super_t *super;  /* mapping of the superblock, this does not move */
+	char  *map;                  /* mapping of the rest of the file, or NULL */
+	size_t mapsize;
+};
+
+static UINT64_T round_to_page(UINT64_T size) {
+	UINT64_T page = (UINT64_T) sysconf(_SC_PAGESIZE);
+	return (size + page - 1) / page * page;
+}
+
+/* maps the part of the file behind the superblock, returns 0 on success */
+static int map_rest(ft_ringfile_t *R, UINT64_T filesize) {
+	R->mapsize = (size_t) (filesize - FT_RINGFILE_SUPERSIZE);
+	R->map = (char *) mmap(NULL, R->mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, R->fd, FT_RINGFILE_SUPERSIZE);
+	if (R->map == MAP_FAILED) {
+		perror("ft_ringfile");
+		R->map = NULL;
+		R->mapsize = 0;
+		return -1;
+	}
+	return 0;
+}
+
+static void unmap_rest(ft_ringfile_t *R) {
+	if (R->map != NULL) munmap(R->map, R->mapsize);
+	R->map = NULL;
+	R->mapsize = 0;
+}
+
+/* Opens or creates the file. If it contains a complete ring from a previous
+ * server, that is mapped again and the counters of the ring are made
+ * consistent, a write that was interrupted is discarded. Files that are not
+ * empty and that are not a ring file are refused.
+ */
+ft_ringfile_t *ft_ringfile_open(const char *filename) {
+	ft_ringfile_t *R;
+	ft_ringfile_super_t *S;
+	struct stat st;
+	int fresh;
+
+	R = (ft_ringfile_t *) calloc(1, sizeof(ft_ringfile_t));
+	if (R == NULL) return NULL;
+	R->fd = open(filename, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+	if (R->fd < 0 || fstat(R->fd, &st) != 0) {
+		perror("ft_ringfile_open");
+		if (R->fd >= 0) close(R->fd);
+		free(R);
+		return NULL;
+	}
+	fresh = (st.st_size == 0);
+	if (!fresh && st.st_size < FT_RINGFILE_SUPERSIZE) {
+		fprintf(stderr, "ft_ringfile_open: %s is not a ring file\n", filename);
+		close(R->fd);
+		free(R);
+		return NULL;
+	}
+	if (fresh && ftruncate(R->fd, FT_RINGFILE_SUPERSIZE) != 0) {
+		perror("ft_ringfile_open");
+		close(R->fd);
+		free(R);
+		return NULL;
+	}
+	S = (ft_ringfile_super_t *) mmap(NULL, FT_RINGFILE_SUPERSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, R->fd, 0);
+	if (S == MAP_FAILED) {
+		perror("ft_ringfile_open");
+		close(R->fd);
+		free(R);
+		return NULL;
+	}
+	R->super = S;
+
+	if (fresh) {
+		memset(S, 0, sizeof(ft_ringfile_super_t));
+		S->magic   = FT_RINGFILE_MAGIC;
+		S->version = FT_RINGFILE_VERSION;
+		S->eventslot = FT_RINGFILE_EVENTSLOT;
+		S->control.magic = FT_SHM_MAGIC;
+		return R;
+	}
+	if (S->magic != FT_RINGFILE_MAGIC || S->version != FT_RINGFILE_VERSION) {
+		fprintf(stderr, "ft_ringfile_open: %s is not a ring file of this version\n", filename);
+		munmap(S, FT_RINGFILE_SUPERSIZE);
+		close(R->fd);
+		free(R);
+		return NULL;
+	}
+	if (S->valid && ((UINT64_T) st.st_size != S->filesize || map_rest(R, S->filesize) != 0)) {
+		fprintf(stderr, "ft_ringfile_open: the ring in %s is incomplete, starting without a header\n", filename);
+		S->valid = 0;
+	}
+	if (!S->valid) {
+		memset(&S->control, 0, sizeof(S->control));
+		S->control.magic = FT_SHM_MAGIC;
+		return R;
+	}
+
+	/* the previous server may have stopped while it was writing */
+	if (S->control.seq & 1) S->control.seq++;
+	S->control.writelimit    = S->control.nsamples;
+	S->control.evtwritelimit = S->control.nevents;
+	return R;
+}
+
+/* closes the file, its contents remain for the next server */
+void ft_ringfile_close(ft_ringfile_t *R) {
+	if (R == NULL) return;
+	ft_ringfile_sync(R);
+	unmap_rest(R);
+	munmap(R->super, FT_RINGFILE_SUPERSIZE);
+	close(R->fd);
+	free(R);
+}
+
+ft_ringfile_super_t *ft_ringfile_super(ft_ringfile_t *R) {
+	return R->super;
+}
+
+/* lays out the file for a new header, returns a pointer to the sample ring or NULL */
+void *ft_ringfile_alloc(ft_ringfile_t *R, const headerdef_t *def, const void *hdrbuf, UINT32_T capacity, UINT32_T maxevents) {
+	ft_ringfile_super_t *S = R->super;
+	UINT64_T rowsize = (UINT64_T) wordsize_from_type(def->data_type) * def->nchans;
+
+	ft_ringfile_free(R);
+
+	/* the offsets are relative to the start of the file, the parts are page aligned */
+	S->eventslot  = FT_RINGFILE_EVENTSLOT;
+	S->capacity   = capacity;
+	S->maxevents  = maxevents;
+	S->hdroffset  = FT_RINGFILE_SUPERSIZE;
+	S->dataoffset = S->hdroffset + round_to_page(def->bufsize);
+	S->evtoffset  = S->dataoffset + round_to_page(rowsize * capacity);
+	S->filesize   = S->evtoffset + round_to_page((UINT64_T) S->eventslot * maxevents);
+	if (((UINT64_T) (size_t) S->filesize) != S->filesize || ftruncate(R->fd, (off_t) S->filesize) != 0 || map_rest(R, S->filesize) != 0) {
+		fprintf(stderr, "ft_ringfile_alloc: could not extend the ring file to %llu bytes\n", (unsigned long long) S->filesize);
+		ft_ringfile_free(R);
+		return NULL;
+	}
+	memcpy(&S->hdr, def, sizeof(headerdef_t));
+	if (def->bufsize > 0) memcpy(R->map + (S->hdroffset - FT_RINGFILE_SUPERSIZE), hdrbuf, def->bufsize);
+	MEMORY_BARRIER();
+	S->valid = 1;
+	return R->map + (S->dataoffset - FT_RINGFILE_SUPERSIZE);
+}
+
+/* removes the header, the file only keeps its superblock */
+void ft_ringfile_free(ft_ringfile_t *R) {
+	R->super->valid = 0;
+	MEMORY_BARRIER();
+	unmap_rest(R);
+	if (ftruncate(R->fd, FT_RINGFILE_SUPERSIZE) != 0) perror("ft_ringfile_free");
+}
+
+const void *ft_ringfile_header(ft_ringfile_t *R) {
+	if (!R->super->valid) return NULL;
+	return R->map + (R->super->hdroffset - FT_RINGFILE_SUPERSIZE);
+}
+
+void *ft_ringfile_data(ft_ringfile_t *R) {
+	if (!R->super->valid) return NULL;
+	return R->map + (R->super->dataoffset - FT_RINGFILE_SUPERSIZE);
+}
+
+/* copies event number index to its slot, this is done before the event is published */
+void ft_ringfile_put_event(ft_ringfile_t *R, UINT32_T index, const eventdef_t *def, const void *buf) {
+	ft_ringfile_super_t *S = R->super;
+	eventdef_t *slot;
+
+	if (!S->valid || S->maxevents == 0) return;
+	slot = (eventdef_t *) (R->map + (S->evtoffset - FT_RINGFILE_SUPERSIZE) + (size_t) (index % S->maxevents) * S->eventslot);
+	memcpy(slot, def, sizeof(eventdef_t));
+	if (sizeof(eventdef_t) + def->bufsize <= S->eventslot) {
+		memcpy(slot + 1, buf, def->bufsize);
+	}
+	else {
+		/* this event keeps its sample, offset and duration */
+		slot->type_numel  = 0;
+		slot->value_numel = 0;
+		slot->bufsize     = 0;
+	}
+}
+
+const eventdef_t *ft_ringfile_get_event(ft_ringfile_t *R, UINT32_T index) {
+	ft_ringfile_super_t *S = R->super;
+	if (!S->valid || S->maxevents == 0) return NULL;
+	return (const eventdef_t *) (R->map + (S->evtoffset - FT_RINGFILE_SUPERSIZE) + (size_t) (index % S->maxevents) * S->eventslot);
+}
+
+/* writes the mapped pages back to disk, returns 0 on success */
+int ft_ringfile_sync(ft_ringfile_t *R) {
+	int result = 0;
+	if (R->map != NULL && msync(R->map, R->mapsize, MS_SYNC) != 0) result = -1;
+	if (msync(R->super, FT_RINGFILE_SUPERSIZE, MS_SYNC) != 0) result = -1;
+	return result;
+}
+
+#else /* PLATFORM_WINDOWS */
+
+/* memory mapped files are not supported here, the ring is only kept in memory */
+
+ft_ringfile_t *ft_ringfile_open(const char *filename) {
+	fprintf(stderr, "ft_ringfile_open: ring files are not supported on this platform\n");
+	return NULL;
+}
+
+void ft_ringfile_close(ft_ringfile_t *R) {}
+ft_ringfile_super_t *ft_ringfile_super(ft_ringfile_t *R) { return NULL; }
+void *ft_ringfile_alloc(ft_ringfile_t *R, const headerdef_t *def, const void *hdrbuf, UINT32_T capacity, UINT32_T maxevents) { return NULL; }
+void ft_ringfile_free(ft_ringfile_t *R) {}
+const void *ft_ringfile_header(ft_ringfile_t *R) { return NULL; }
+void *ft_ringfile_data(ft_ringfile_t *R) { return NULL; }
+void ft_ringfile_put_event(ft_ringfile_t *R, UINT32_T index, const eventdef_t *def, const void *buf) {}
+const eventdef_t *ft_ringfile_get_event(ft_ringfile_t *R, UINT32_T index) { return NULL; }
+int ft_ringfile_sync(ft_ringfile_t *R) { return -1; }
+
+#endif
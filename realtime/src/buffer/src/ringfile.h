@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+
+#ifndef RINGFILE_H
+#define RINGFILE_H
+
+#include "message.h"
+#include "shmbuffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FT_RINGFILE_MAGIC      (UINT32_T)0x46525446 /* "FTRF" in little endian */
+#define FT_RINGFILE_VERSION    1
+#define FT_RINGFILE_SUPERSIZE  65536 /* bytes that are reserved for the superblock, a multiple of the page size */
+#define FT_RINGFILE_EVENTSLOT  1024  /* size of each event slot in bytes, including the eventdef_t */
+
+/*
+  The ring file holds the header, the sample ring and a copy of the events of
+  the default stream in a memory mapped file, so that a new server process
+  can continue where a previous one stopped, see enable_ring_file in
+  dmarequest.c. The file consists of
+
+    the superblock, FT_RINGFILE_SUPERSIZE bytes
+    the buf of the header, rounded up to the page size
+    capacity rows of nchans samples of the given data type
+    maxevents slots of eventslot bytes, each with an eventdef_t and its buf
+
+  The counters of the ring are kept in the control block in the superblock,
+  which dmarequest.c updates in the same way as the control block in shared
+  memory. The samples and events are written to the mapping before their
+  counters are published, hence the file is consistent whenever the server
+  process stops, also if it crashes. Events that do not fit in their slot are
+  stored without their type and value. Changes that the operating system has
+  not written back yet are lost if the machine itself goes down, unless
+  ft_ringfile_sync has been called.
+*/
+typedef struct {
+	UINT32_T magic;
+	UINT32_T version;
+	volatile UINT32_T valid;  /* set once the layout and the header below are complete */
+	UINT32_T eventslot;
+	UINT32_T capacity;        /* number of samples in the ring */
+	UINT32_T maxevents;       /* number of event slots */
+	UINT64_T hdroffset;       /* offsets of the parts of the file, in bytes */
+	UINT64_T dataoffset;
+	UINT64_T evtoffset;
+	UINT64_T filesize;
+	headerdef_t hdr;          /* nsamples and nevents are given by the control block */
+	ft_shm_control_t control;
+} ft_ringfile_super_t;
+
+typedef struct ft_ringfile_s ft_ringfile_t;
+
+ft_ringfile_t *ft_ringfile_open(const char *filename);
+void ft_ringfile_close(ft_ringfile_t *R);
+ft_ringfile_super_t *ft_ringfile_super(ft_ringfile_t *R);
+void *ft_ringfile_alloc(ft_ringfile_t *R, const headerdef_t *def, const void *hdrbuf, UINT32_T capacity, UINT32_T maxevents);
+void ft_ringfile_free(ft_ringfile_t *R);
+const void *ft_ringfile_header(ft_ringfile_t *R);
+void *ft_ringfile_data(ft_ringfile_t *R);
+void ft_ringfile_put_event(ft_ringfile_t *R, UINT32_T index, const eventdef_t *def, const void *buf);
+const eventdef_t *ft_ringfile_get_event(ft_ringfile_t *R, UINT32_T index);
+int ft_ringfile_sync(ft_ringfile_t *R);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RINGFILE_H */
@@ -0,0 +1,481 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ * Shared memory transport for clients that run on the same host as the
+ * buffer server. The server keeps its sample ring and a copy of the events in
+ * POSIX shared memory, clients map this read-only and copy the data directly,
+ * without sending it through the socket. See shmbuffer.h for the layout.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer.h"
+#include "shmbuffer.h"
+#include "atomicutil.h"
+
+#ifndef PLATFORM_WINDOWS
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* state of the server side, this is protected by the locks in dmarequest.c */
+static ft_shm_control_t *server_control = NULL;
+static char   server_name[FT_SHM_NAMELEN];
+static char  *server_data = NULL;
+static size_t server_datsize = 0;
+static size_t server_ringsize = 0;
+
+/* creates a shared memory segment of the given size and maps it read-write */
+static void *create_segment(const char *name, size_t size) {
+	void *ptr;
+	int fd;
+
+	/* remove a stale segment, e.g. from a server that crashed */
+	shm_unlink(name);
+	fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+	if (fd < 0) {
+		perror("create_segment: shm_open");
+		return NULL;
+	}
+	if (ftruncate(fd, size) != 0) {
+		perror("create_segment: ftruncate");
+		close(fd);
+		shm_unlink(name);
+		return NULL;
+	}
+	ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) {
+		perror("create_segment: mmap");
+		shm_unlink(name);
+		return NULL;
+	}
+	return ptr;
+}
+
+/* maps an existing shared memory segment read-only */
+static void *open_segment(const char *name, size_t size) {
+	void *ptr;
+	int fd;
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) return NULL;
+	ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) return NULL;
+	return ptr;
+}
+
+/*****************************************************************************
+ * server side
+ *****************************************************************************/
+
+/* creates the control segment, returns NULL on failure */
+ft_shm_control_t *ft_shm_server_init(const char *name) {
+	if (server_control != NULL) {
+		fprintf(stderr, "ft_shm_server_init: shared memory is already enabled\n");
+		return NULL;
+	}
+	/* leave room for the ".<generation>" suffix of the data segment */
+	if (name == NULL || name[0] != '/' || strlen(name) > FT_SHM_NAMELEN-12) {
+		fprintf(stderr, "ft_shm_server_init: invalid name for the shared memory segment\n");
+		return NULL;
+	}
+	server_control = (ft_shm_control_t *) create_segment(name, sizeof(ft_shm_control_t));
+	if (server_control == NULL) return NULL;
+
+	memset(server_control, 0, sizeof(ft_shm_control_t));
+	server_control->magic     = FT_SHM_MAGIC;
+	server_control->eventslot = FT_SHM_EVENTSLOT;
+	strcpy(server_name, name);
+	MEMORY_BARRIER();
+	return server_control;
+}
+
+/* returns the name of the control segment, or NULL if shared memory is not used */
+const char *ft_shm_server_name(void) {
+	return server_control ? server_name : NULL;
+}
+
+/* writes the name of the data segment of the given generation, which has
+ * room for FT_SHM_NAMELEN characters, returns 0 on success */
+static int data_name(char *name, UINT32_T generation) {
+	int n = snprintf(name, FT_SHM_NAMELEN, "%s.%u", server_name, generation);
+	if (n < 0 || n >= FT_SHM_NAMELEN) {
+		fprintf(stderr, "ft_shm_server: the name of the data segment is too long\n");
+		return -1;
+	}
+	return 0;
+}
+
+/* creates a new data segment for the given geometry and returns a pointer to the ring */
+void *ft_shm_server_alloc(UINT32_T nchans, UINT32_T data_type, UINT32_T capacity, UINT32_T maxevents) {
+	ft_shm_control_t *C = server_control;
+	char name[FT_SHM_NAMELEN];
+	void *ptr;
+	size_t ringsize = (size_t) nchans * capacity * wordsize_from_type(data_type);
+	size_t datsize  = ringsize + (size_t) maxevents * FT_SHM_EVENTSLOT;
+
+	if (C == NULL) return NULL;
+	if (server_data != NULL) ft_shm_server_free();
+
+	/* each data segment gets a new name, so that clients can not map a stale one */
+	if (data_name(name, C->generation+1) != 0) return NULL;
+	ptr = create_segment(name, datsize);
+	if (ptr == NULL) return NULL;
+
+	server_data     = (char *) ptr;
+	server_datsize  = datsize;
+	server_ringsize = ringsize;
+
+	MEMORY_BARRIER();
+	C->seq++;
+	MEMORY_BARRIER();
+	C->nchans    = nchans;
+	C->data_type = data_type;
+	C->capacity  = capacity;
+	C->maxevents = maxevents;
+	strcpy(C->datname, name);
+	C->generation++;
+	MEMORY_BARRIER();
+	C->seq++;
+	MEMORY_BARRIER();
+	return ptr;
+}
+
+/* replaces the data segment by one with room for more samples and events,
+ * keeping the samples from firstsample and the events from firstevent up to
+ * the current number, which should all fit. The old segment is kept if the
+ * new one can not be created, in which case NULL is returned. This should
+ * only be called while the ring is not being written.
+ */
+void *ft_shm_server_resize(UINT32_T capacity, UINT32_T maxevents, UINT32_T firstsample, UINT32_T firstevent) {
+	ft_shm_control_t *C = server_control;
+	char name[FT_SHM_NAMELEN], oldname[FT_SHM_NAMELEN];
+	char *ptr;
+	size_t rowsize, ringsize, datsize;
+	UINT32_T i;
+
+	if (C == NULL || server_data == NULL || capacity == 0 || maxevents == 0) return NULL;
+
+	rowsize  = (size_t) C->nchans * wordsize_from_type(C->data_type);
+	ringsize = rowsize * capacity;
+	datsize  = ringsize + (size_t) maxevents * FT_SHM_EVENTSLOT;
+
+	if (data_name(name, C->generation+1) != 0) return NULL;
+	ptr = (char *) create_segment(name, datsize);
+	if (ptr == NULL) return NULL;
+
+	/* fill the new segment before publishing it, clients may map it right away */
+	for (i=firstsample; i<C->nsamples; i++) {
+		memcpy(ptr + (i % capacity) * rowsize, server_data + (i % C->capacity) * rowsize, rowsize);
+	}
+	for (i=firstevent; i<C->nevents; i++) {
+		memcpy(ptr + ringsize + (size_t) (i % maxevents) * FT_SHM_EVENTSLOT, server_data + server_ringsize + (size_t) (i % C->maxevents) * FT_SHM_EVENTSLOT, FT_SHM_EVENTSLOT);
+	}
+	strcpy(oldname, C->datname);
+
+	MEMORY_BARRIER();
+	C->seq++;
+	MEMORY_BARRIER();
+	C->capacity    = capacity;
+	C->maxevents   = maxevents;
+	C->firstsample = firstsample;
+	C->firstevent  = firstevent;
+	strcpy(C->datname, name);
+	C->generation++;
+	MEMORY_BARRIER();
+	C->seq++;
+	MEMORY_BARRIER();
+
+	munmap(server_data, server_datsize);
+	shm_unlink(oldname);
+	server_data     = ptr;
+	server_datsize  = datsize;
+	server_ringsize = ringsize;
+	return ptr;
+}
+
+/* removes the data segment, clients that still have it mapped can continue to use it until they notice the new generation */
+void ft_shm_server_free(void) {
+	ft_shm_control_t *C = server_control;
+	char name[FT_SHM_NAMELEN];
+
+	if (C == NULL || server_data == NULL) return;
+	strcpy(name, C->datname);
+
+	MEMORY_BARRIER();
+	C->seq++;
+	MEMORY_BARRIER();
+	C->datname[0] = 0;
+	C->generation++;
+	MEMORY_BARRIER();
+	C->seq++;
+	MEMORY_BARRIER();
+
+	munmap(server_data, server_datsize);
+	shm_unlink(name);
+	server_data     = NULL;
+	server_datsize  = 0;
+	server_ringsize = 0;
+}
+
+/* removes the data and control segment */
+void ft_shm_server_exit(void) {
+	if (server_control == NULL) return;
+	ft_shm_server_free();
+	munmap(server_control, sizeof(ft_shm_control_t));
+	shm_unlink(server_name);
+	server_control = NULL;
+}
+
+/* copies an event into its slot, index is the total number of events before this one */
+void ft_shm_server_put_event(UINT32_T index, const eventdef_t *def, const void *buf) {
+	ft_shm_control_t *C = server_control;
+	char *slot;
+
+	if (C == NULL || server_data == NULL || C->maxevents == 0) return;
+
+	C->evtwritelimit = index+1;
+	MEMORY_BARRIER();
+
+	slot = server_data + server_ringsize + (size_t) (index % C->maxevents) * FT_SHM_EVENTSLOT;
+	memcpy(slot, def, sizeof(eventdef_t));
+	/* events that do not fit are flagged by their bufsize, clients have to use GET_EVT for those */
+	if (sizeof(eventdef_t) + def->bufsize <= FT_SHM_EVENTSLOT) {
+		memcpy(slot + sizeof(eventdef_t), buf, def->bufsize);
+	}
+}
+
+/*****************************************************************************
+ * client side
+ *****************************************************************************/
+
+/* asks the server for the name of the control segment and maps it */
+ft_shm_client_t *ft_shm_attach(int server) {
+	message_t request, *response = NULL;
+	messagedef_t reqdef;
+	ft_shm_client_t *client;
+	ft_shm_control_t *control;
+	char name[FT_SHM_NAMELEN];
+
+	reqdef.version = VERSION;
+	reqdef.command = GET_SHM;
+	reqdef.bufsize = 0;
+	request.def = &reqdef;
+	request.buf = NULL;
+
+	if (clientrequest(server, &request, &response) != 0) return NULL;
+
+	if (response == NULL || response->def == NULL) {
+		if (response) free(response);
+		return NULL;
+	}
+	if (response->def->command != GET_OK || response->def->bufsize == 0 || response->def->bufsize > FT_SHM_NAMELEN) {
+		FREE(response->buf);
+		FREE(response->def);
+		free(response);
+		return NULL;
+	}
+	memcpy(name, response->buf, response->def->bufsize);
+	name[response->def->bufsize-1] = 0;
+	FREE(response->buf);
+	FREE(response->def);
+	free(response);
+
+	control = (ft_shm_control_t *) open_segment(name, sizeof(ft_shm_control_t));
+	if (control == NULL) {
+		perror("ft_shm_attach: could not map the control segment");
+		return NULL;
+	}
+	if (control->magic != FT_SHM_MAGIC) {
+		fprintf(stderr, "ft_shm_attach: invalid control segment\n");
+		munmap(control, sizeof(ft_shm_control_t));
+		return NULL;
+	}
+
+	client = (ft_shm_client_t *) calloc(1, sizeof(ft_shm_client_t));
+	if (client == NULL) {
+		munmap(control, sizeof(ft_shm_control_t));
+		return NULL;
+	}
+	client->control = control;
+	return client;
+}
+
+void ft_shm_detach(ft_shm_client_t *client) {
+	if (client == NULL) return;
+	if (client->data) munmap(client->data, client->datasize);
+	if (client->control) munmap(client->control, sizeof(ft_shm_control_t));
+	free(client);
+}
+
+/* makes sure that the current data segment is mapped */
+static int ft_shm_remap(ft_shm_client_t *client) {
+	ft_shm_control_t *C = client->control;
+	ft_shm_client_t geom;
+	char name[FT_SHM_NAMELEN];
+	UINT32_T seq;
+
+	/* take a consistent snapshot of the geometry */
+	for (;;) {
+		seq = C->seq;
+		MEMORY_BARRIER();
+		if (seq & 1) continue;
+		geom.generation = C->generation;
+		geom.nchans     = C->nchans;
+		geom.data_type  = C->data_type;
+		geom.capacity   = C->capacity;
+		geom.maxevents  = C->maxevents;
+		geom.eventslot  = C->eventslot;
+		memcpy(name, C->datname, FT_SHM_NAMELEN);
+		MEMORY_BARRIER();
+		if (seq == C->seq) break;
+	}
+	name[FT_SHM_NAMELEN-1] = 0;
+
+	if (client->data != NULL && geom.generation == client->generation) return FT_SHM_OK;
+
+	if (client->data != NULL) {
+		munmap(client->data, client->datasize);
+		client->data = NULL;
+	}
+	if (name[0] == 0) return FT_SHM_ERR; /* there is no header */
+
+	geom.wordsize = wordsize_from_type(geom.data_type);
+	geom.datasize = (size_t) geom.nchans * geom.capacity * geom.wordsize + (size_t) geom.maxevents * geom.eventslot;
+	geom.data = (char *) open_segment(name, geom.datasize);
+	if (geom.data == NULL) return FT_SHM_RETRY; /* the server has already replaced it */
+
+	geom.control = C;
+	*client = geom;
+	return FT_SHM_OK;
+}
+
+/* returns the number of samples and events that can be read */
+int ft_shm_get_count(ft_shm_client_t *client, UINT32_T *nsamples, UINT32_T *nevents) {
+	ft_shm_control_t *C;
+	UINT32_T seq;
+
+	if (client == NULL) return FT_SHM_ERR;
+	C = client->control;
+	for (;;) {
+		seq = C->seq;
+		MEMORY_BARRIER();
+		if (seq & 1) continue;
+		if (nsamples) *nsamples = C->nsamples;
+		if (nevents)  *nevents  = C->nevents;
+		MEMORY_BARRIER();
+		if (seq == C->seq) return FT_SHM_OK;
+	}
+}
+
+/* copies samples begsample to endsample (inclusive, zero-offset) into buffer, which should be large enough */
+int ft_shm_read_data(ft_shm_client_t *client, UINT32_T begsample, UINT32_T endsample, void *buffer) {
+	ft_shm_control_t *C;
+	UINT32_T seq, nsamples, nflush, generation, firstsample;
+	UINT32_T begring, n, n1;
+	size_t rowsize;
+	int status;
+
+	if (client == NULL || buffer == NULL || endsample < begsample) return FT_SHM_ERR;
+	if ((status = ft_shm_remap(client)) != FT_SHM_OK) return status;
+
+	C = client->control;
+	for (;;) {
+		seq = C->seq;
+		MEMORY_BARRIER();
+		if (seq & 1) continue;
+		nsamples    = C->nsamples;
+		nflush      = C->nflush;
+		generation  = C->generation;
+		firstsample = C->firstsample;
+		MEMORY_BARRIER();
+		if (seq == C->seq) break;
+	}
+	if (generation != client->generation) return FT_SHM_RETRY;
+
+	/* the same checks as for GET_DAT in dmarequest.c */
+	if (endsample >= nsamples) return FT_SHM_ERR;
+	if (nsamples - begsample > client->capacity || begsample < firstsample) return FT_SHM_ERR;
+
+	n       = endsample - begsample + 1;
+	rowsize = (size_t) client->nchans * client->wordsize;
+	begring = begsample % client->capacity;
+	n1      = (begring + n > client->capacity) ? client->capacity - begring : n;
+	memcpy(buffer, client->data + begring * rowsize, n1 * rowsize);
+	if (n1 < n) {
+		memcpy((char *) buffer + n1 * rowsize, client->data, (n - n1) * rowsize);
+	}
+
+	/* check whether the server overwrote the selection while we were copying */
+	MEMORY_BARRIER();
+	if (C->writelimit - begsample > client->capacity) return FT_SHM_RETRY;
+	if (C->nflush != nflush || C->generation != generation) return FT_SHM_RETRY;
+	return FT_SHM_OK;
+}
+
+/* copies event number index (zero-offset), the event's buf is copied into buf if it fits in bufsize */
+int ft_shm_read_event(ft_shm_client_t *client, UINT32_T index, eventdef_t *def, void *buf, UINT32_T bufsize) {
+	ft_shm_control_t *C;
+	UINT32_T nevents, evtflush, generation;
+	char *slot;
+	int status;
+
+	if (client == NULL || def == NULL) return FT_SHM_ERR;
+	if ((status = ft_shm_remap(client)) != FT_SHM_OK) return status;
+
+	C = client->control;
+	generation = C->generation;
+	evtflush   = C->evtflush;
+	MEMORY_BARRIER();
+	nevents = C->nevents;
+	MEMORY_BARRIER();
+
+	if (generation != client->generation) return FT_SHM_RETRY;
+	if (index >= nevents || nevents - index > client->maxevents || index < C->firstevent) return FT_SHM_ERR;
+
+	slot = client->data + (size_t) client->nchans * client->capacity * client->wordsize + (size_t) (index % client->maxevents) * client->eventslot;
+	memcpy(def, slot, sizeof(eventdef_t));
+	if (sizeof(eventdef_t) + def->bufsize > client->eventslot) {
+		status = FT_SHM_TOOBIG;
+	} else if (def->bufsize > bufsize || (def->bufsize > 0 && buf == NULL)) {
+		status = FT_SHM_ERR;
+	} else {
+		memcpy(buf, slot + sizeof(eventdef_t), def->bufsize);
+	}
+
+	MEMORY_BARRIER();
+	if (C->evtwritelimit - index > client->maxevents) return FT_SHM_RETRY;
+	if (C->evtflush != evtflush || C->generation != generation) return FT_SHM_RETRY;
+	return status;
+}
+
+#else /* PLATFORM_WINDOWS */
+
+/* POSIX shared memory is not available, clients will have to use the socket */
+
+ft_shm_control_t *ft_shm_server_init(const char *name) {
+	fprintf(stderr, "ft_shm_server_init: shared memory is not supported on this platform\n");
+	return NULL;
+}
+
+const char *ft_shm_server_name(void) { return NULL; }
+void *ft_shm_server_alloc(UINT32_T nchans, UINT32_T data_type, UINT32_T capacity, UINT32_T maxevents) { return NULL; }
+void *ft_shm_server_resize(UINT32_T capacity, UINT32_T maxevents, UINT32_T firstsample, UINT32_T firstevent) { return NULL; }
+void ft_shm_server_free(void) {}
+void ft_shm_server_exit(void) {}
+void ft_shm_server_put_event(UINT32_T index, const eventdef_t *def, const void *buf) {}
+
+ft_shm_client_t *ft_shm_attach(int server) { return NULL; }
+void ft_shm_detach(ft_shm_client_t *client) {}
+int ft_shm_get_count(ft_shm_client_t *client, UINT32_T *nsamples, UINT32_T *nevents) { return FT_SHM_ERR; }
+int ft_shm_read_data(ft_shm_client_t *client, UINT32_T begsample, UINT32_T endsample, void *buffer) { return FT_SHM_ERR; }
+int ft_shm_read_event(ft_shm_client_t *client, UINT32_T index, eventdef_t *def, void *buf, UINT32_T bufsize) { return FT_SHM_ERR; }
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+
+#ifndef SHMBUFFER_H
+#define SHMBUFFER_H
+
+#include "message.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FT_SHM_MAGIC      (UINT32_T)0x48535446 /* "FTSH" in little endian */
+#define FT_SHM_NAMELEN    64
+#define FT_SHM_EVENTSLOT  256  /* size of each event slot in bytes, including the eventdef_t */
+
+/* return values of the client functions */
+#define FT_SHM_OK          0
+#define FT_SHM_ERR        -1   /* invalid arguments, or no header/data present */
+#define FT_SHM_RETRY      -2   /* the selection was overwritten during the copy, or the header changed */
+#define FT_SHM_TOOBIG     -3   /* the event does not fit in its slot, use GET_EVT instead */
+
+/*
+  The control block is the first (and only) part of the control segment. It
+  contains the state of the sample and event ring (see dmarequest.c) in a
+  form that can be read by other processes on the same host. The sample
+  counters are protected by a sequence counter: seq is odd while the server
+  updates them. The event counters have their own writer (PUT_EVT) and are
+  published without a sequence counter, readers check evtwritelimit and
+  evtflush after copying an event. The geometry of the ring and the name of the data segment only change
+  on PUT_HDR and FLUSH_HDR, in which case the generation is increased and a new
+  data segment is created.
+
+  The data segment contains capacity*nchans samples of the given data type,
+  followed by maxevents slots of FT_SHM_EVENTSLOT bytes, each of which holds
+  an eventdef_t followed by the event's buf.
+*/
+typedef struct {
+	UINT32_T magic;
+	volatile UINT32_T seq;            /* odd while the counters or geometry are being updated */
+	volatile UINT32_T generation;     /* increased whenever the data segment is replaced */
+	volatile UINT32_T nsamples;       /* number of samples that can be read */
+	volatile UINT32_T writelimit;     /* number of samples that can be read, plus those being written */
+	volatile UINT32_T nflush;         /* increased whenever the sample ring is emptied */
+	volatile UINT32_T nevents;        /* number of events that can be read */
+	volatile UINT32_T evtwritelimit;  /* number of events that can be read, plus those being written */
+	volatile UINT32_T evtflush;       /* increased whenever the event ring is emptied */
+	volatile UINT32_T firstsample;    /* oldest sample that can be read, if the ring has been resized */
+	volatile UINT32_T firstevent;     /* oldest event that can be read, if the ring has been resized */
+	UINT32_T nchans;
+	UINT32_T data_type;
+	UINT32_T capacity;                /* number of samples in the ring */
+	UINT32_T maxevents;               /* number of event slots */
+	UINT32_T eventslot;               /* size of each event slot in bytes */
+	char datname[FT_SHM_NAMELEN];     /* name of the data segment, empty if there is no header */
+} ft_shm_control_t;
+
+/* a client that has attached to the shared memory of a buffer server */
+typedef struct {
+	ft_shm_control_t *control;
+	char *data;                       /* read-only mapping of the data segment */
+	size_t datasize;
+	UINT32_T generation;              /* generation of the current mapping */
+	UINT32_T nchans;
+	UINT32_T data_type;
+	UINT32_T wordsize;
+	UINT32_T capacity;
+	UINT32_T maxevents;
+	UINT32_T eventslot;
+} ft_shm_client_t;
+
+/* functions for the server side, these are used in dmarequest.c */
+ft_shm_control_t *ft_shm_server_init(const char *name);
+void *ft_shm_server_alloc(UINT32_T nchans, UINT32_T data_type, UINT32_T capacity, UINT32_T maxevents);
+void *ft_shm_server_resize(UINT32_T capacity, UINT32_T maxevents, UINT32_T firstsample, UINT32_T firstevent);
+void ft_shm_server_free(void);
+void ft_shm_server_exit(void);
+void ft_shm_server_put_event(UINT32_T index, const eventdef_t *def, const void *buf);
+const char *ft_shm_server_name(void);
+
+/* functions for the client side */
+ft_shm_client_t *ft_shm_attach(int server);
+void ft_shm_detach(ft_shm_client_t *client);
+int ft_shm_get_count(ft_shm_client_t *client, UINT32_T *nsamples, UINT32_T *nevents);
+int ft_shm_read_data(ft_shm_client_t *client, UINT32_T begsample, UINT32_T endsample, void *buffer);
+int ft_shm_read_event(ft_shm_client_t *client, UINT32_T index, eventdef_t *def, void *buf, UINT32_T bufsize);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SHMBUFFER_H */
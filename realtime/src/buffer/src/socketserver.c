@@ -7,14 +7,47 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <sys/time.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <socketserver.h>
+#include "bufstats.h"
+
+#ifndef WIN32
+  #include <sys/uio.h> /* for writev */
+#endif
+
+#if defined(PLATFORM_LINUX)
+  #define USE_EPOLL
+  #include <sys/epoll.h>
+  /* the io_uring backend uses the system calls directly, it needs the headers of Linux 5.11 or later */
+  #if defined(__has_include)
+    #if __has_include(<linux/io_uring.h>)
+      #include <linux/io_uring.h>
+      #ifdef IORING_FEAT_EXT_ARG
+        #define USE_URING
+        #include <sys/mman.h>
+        #include <sys/syscall.h>
+        #include <poll.h>
+        #include <signal.h>
+      #endif
+    #endif
+  #endif
+#elif defined(PLATFORM_OSX) || defined(PLATFORM_BSD)
+  #define USE_KQUEUE
+  #include <sys/event.h>
+#elif defined(PLATFORM_WINDOWS) && (defined(COMPILER_MSVC) || defined(COMPILER_MINGW_W64))
+  /* the event loop waits on an I/O completion port, see _buffer_iocp_loop_func */
+  #define USE_IOCP
+#endif
+
+#if defined(USE_EPOLL) || defined(USE_KQUEUE) || defined(USE_IOCP)
+  #define USE_EVENTLOOP
+#endif
 
 /************************************************************************
- * This function deals with the incoming client requests in a loop until
- * the user requests to stop the server, or until the remote side closes
- * the connection. The implementation follows the idea of a state machine
+ * The following functions deal with the incoming client requests on a
+ * single connection. The implementation follows the idea of a state machine
  * with the four different states:
  *   state = 0 means we are waiting for a request to come in, or we are
  *             in the process of reading the first 8 bytes (the "def" part)
@@ -28,222 +61,2000 @@
  * the current state, and how many bytes we need to process in total,
  * and a variable "curPtr" which points to the memory region we currently
  * need to read into, or write from. Whether any action is actually taken
- * inside the while loop also depends on the state of the socket which
- * we find out using "select" (and then set "canRead" + "canWrite" flags).
+ * also depends on the state of the socket, which we find out using "select"
+ * in the thread-per-client server, or using epoll/kqueue in the event loop.
  *
  * Depending on the nature of the request, we might skip states 1 and 3.
  * This is the case if there is no "buf" attached to the message, or if
  * an outgoing message can be merged in to a single packet.
- * 
+ *
  * The actual processing of the message happens before moving to state 2
- * and consists of 
+ * and consists of
  *   1) possibly swapping the message to native endianness
  *   2) calling dmarequest or the user-supplied callback function
  *   3) possibly swapping back to remote endianness
+ *
+ * The event loop uses an additional state:
+ *   state = 4 means that a WAIT_DAT request is parked until its threshold
+ *             is reached or its timeout expires, see _conn_check_wait
+ *
+ * and both servers use
+ *   state = 5 means that the next request is not read until resumeTime,
+ *             because the connection exceeded the rate limit of its
+ *             service class, see qos.h
+ *
+ * and if the event loop has workers (see ft_start_buffer_server_pool)
+ *   state = 6 means that the request is handled by a worker, the event
+ *             loop does not touch the connection until the worker is done
+ ************************************************************************/
+
+/* returns the monotonic time in seconds, used for the timeout of parked WAIT_DAT requests */
+double _server_time(void) {
+	return ft_clock_seconds();
+}
+
+int _conn_received(ft_buffer_conn_t *C, int n, int parkWaits);
+int _conn_sent(ft_buffer_conn_t *C, int n);
+#ifdef USE_EVENTLOOP
+int _pool_submit(ft_buffer_conn_t *C);
+#endif
+
+void _conn_init(ft_buffer_conn_t *C, ft_buffer_server_t *SC, SOCKET sock, int mergePackets) {
+	C->server = SC;
+	C->sock = sock;
+	C->mergePackets = mergePackets;
+	C->request.def = &C->reqdef;
+	C->request.buf = NULL;
+	C->response = NULL;
+	C->swap = 0;
+	C->swapData = 0;
+	C->codecs = 0;
+	C->state = 0;
+	C->bytesDone = 0;
+	C->bytesTotal = sizeof(messagedef_t);
+	C->curPtr = (char *) C->request.def;
+	C->waitHandle = NULL;
+	C->waitNotified = 0;
+	C->loop = NULL;
+	C->next = NULL;
+	C->done = NULL;
+	C->workResult = 0;
+	C->uring = NULL;
+	C->iocp = NULL;
+	ft_qos_init(&C->qos);
+	ft_msgpool_init(&C->pool);
+	if (!SC->isUnixDomain) ft_socket_init(sock);
+	ft_stats_connect();
+}
+
+void _conn_cleanup(ft_buffer_conn_t *C) {
+	unregister_wait(C->waitHandle);
+	C->waitHandle = NULL;
+	closesocket(C->sock);
+	if (C->request.buf!=NULL) free(C->request.buf);
+	C->request.buf = NULL;
+	if (C->response!=NULL) {
+		if (C->response->buf!=NULL) free(C->response->buf);
+		if (C->response->def!=NULL) free(C->response->def);
+		free(C->response);
+	}
+	C->response = NULL;
+	ft_msgpool_clear(&C->pool);
+	ft_stats_disconnect();
+}
+
+/* Prepare writing back the response. We move to state=2, transmit
+   response->def, move to state=3, and there transmit response->buf. Where
+   writev is available, both parts are handed to the kernel in one call (see
+   _conn_on_writable), so that they go out in one go over TCP without having
+   to be copied. Otherwise, to reduce latency, we try to merge response->def
+   and response->buf if they are small. To fit the merged packet into our
+   state machine logic, we apply a trick and jump to state=3 directly, where
+   "curPtr" points to the merged packet.
+*/
+void _conn_start_response(ft_buffer_conn_t *C) {
+	/* we can give back the memory pointed to by request.buf ... */
+	if (C->request.buf != NULL) {
+		ft_msgpool_put(&C->pool, C->request.buf, C->reqdef.bufsize);
+		C->request.buf = NULL;
+	}
+
+	/* ... swap the response to the remote endianness, if necessary ... */
+	C->respBufSize = C->response->def->bufsize;
+	ft_stats_command(C->reqdef.command, C->response->def->command, C->reqdef.bufsize, C->respBufSize, ft_stats_elapsed(C->requestTime));
+	if (C->swap) ft_swap_from_native(C->reqCommand, C->response);
+
+	/* ... and then start writing back the response */
+	if (!C->server->isUnixDomain) ft_socket_fit(C->sock, SO_SNDBUF, C->respBufSize);
+#ifdef WIN32
+	if (C->mergePackets && C->respBufSize > 0 && C->respBufSize + sizeof(messagedef_t) <= MERGE_THRESHOLD) {
+		memcpy(C->mergeBuffer, C->response->def, sizeof(messagedef_t));
+		memcpy(C->mergeBuffer + sizeof(messagedef_t), C->response->buf, C->respBufSize);
+
+		C->curPtr = C->mergeBuffer;
+		C->bytesDone = 0;
+		C->bytesTotal = C->respBufSize + sizeof(messagedef_t);
+		C->state = 3;
+		return;
+	}
+#endif
+	C->curPtr = (char *) C->response->def;
+	C->bytesDone = 0;
+	C->bytesTotal = sizeof(messagedef_t);
+	C->state = 2;
+	C->lastProgress = _server_time();
+}
+
+/* Pass the request on to dmarequest or the user-supplied callback, returns 0 on success */
+int _conn_handle_request(ft_buffer_conn_t *C) {
+	ft_buffer_server_t *SC = C->server;
+	int res;
+
+	if (C->request.def->command == GET_SHM && !SC->isUnixDomain) {
+		/* shared memory is only offered to clients on the same host, i.e. those using a UNIX domain socket */
+		C->response = ft_msgpool_message(&C->pool);
+		if (C->response == NULL) return -1;
+		C->response->def->version = VERSION;
+		C->response->def->command = GET_ERR;
+		C->response->def->bufsize = 0;
+		return 0;
+	}
+
+	/* GET_CODEC is answered here, and compressed samples are expanded before anyone else sees them */
+	res = ft_codec_serve(&C->request, C->swap, &C->codecs, &C->response);
+	if (res < 0) return -1;
+	if (res > 0) return 0;
+
+	/* GET_QOS selects the service class of the connection */
+	res = ft_qos_serve(&C->request, &C->qos, &C->response);
+	if (res < 0) return -1;
+	if (res > 0) return 0;
+
+	if (SC->callback != NULL) {
+		/* User supplied a callback function in ft_start_buffer_server */
+		res = SC->callback(&C->request, &C->response, SC->user_data);
+		if (res != 0 || C->response == NULL || C->response->def == NULL) {
+			fprintf(stderr, "buffer_socket_func: an unexpected error occurred in user-defined request handler\n");
+			return -1;
+		}
+	} else {
+		/* No callback, use normal dmarequest */
+		ft_trace_set_received(1000 * C->requestTime);
+		res = dmarequest_pool(&C->request, &C->response, C->swapData, &C->pool);
+		C->swapData = 0;
+		if (res != 0 || C->response == NULL || C->response->def == NULL) {
+			fprintf(stderr, "buffer_socket_func: an unexpected error occurred in dmarequest\n");
+			return -1;
+		}
+	}
+	ft_qos_limit(&C->qos, &C->request, C->response);
+	ft_qos_socket(&C->qos, C->sock);
+	if (C->loop == NULL) ft_qos_thread(&C->qos);
+	if (C->codecs && C->reqdef.command == GET_DAT) ft_compress_message(C->response, C->codecs);
+	return 0;
+}
+
+/* Returns 1 if the response has not been written to for longer than the
+   stall timeout of the connection, which should then be closed.
+*/
+int _conn_stalled(ft_buffer_conn_t *C, double now) {
+	UINT32_T maxstall;
+
+	if (C->state != 2 && C->state != 3) return 0;
+	maxstall = ft_qos_maxstall(&C->qos);
+	if (maxstall == 0 || now - C->lastProgress <= 0.001*maxstall) return 0;
+	fprintf(stderr, "Client does not read its response -- closing client connection.\n");
+	return 1;
+}
+
+/* Returns the waitdef_t of a WAIT_DAT request, which can also be wrapped in a
+   STREAM_REQ, or NULL for other requests. If stream is not NULL, it is set to
+   the name of the stream, which is empty for the default stream. If bufsize
+   is not NULL, it is set to the size of the WAIT_DAT request, which is larger
+   than the waitdef_t if it has an event filter.
+*/
+waitdef_t *_conn_waitdef(ft_buffer_conn_t *C, const char **stream, UINT32_T *bufsize) {
+	const messagedef_t *def = &C->reqdef;
+	char *buf = (char *) C->request.buf;
+
+	if (stream) *stream = "";
+	if (def->command == STREAM_REQ && def->bufsize >= sizeof(streamdef_t) + sizeof(messagedef_t) + sizeof(waitdef_t)) {
+		const streamdef_t *sdef = (const streamdef_t *) buf;
+		if (memchr(sdef->name, 0, FT_STREAM_NAMELEN) == NULL) return NULL;
+		if (stream) *stream = sdef->name;
+		def = (const messagedef_t *) (buf + sizeof(streamdef_t));
+		buf += sizeof(streamdef_t) + sizeof(messagedef_t);
+		if (def->bufsize != C->reqdef.bufsize - sizeof(streamdef_t) - sizeof(messagedef_t)) return NULL;
+	}
+	if (def->command != WAIT_DAT || def->bufsize < sizeof(waitdef_t)) return NULL;
+	if (bufsize) *bufsize = def->bufsize;
+	return (waitdef_t *) buf;
+}
+
+/* Re-evaluate a parked WAIT_DAT request without blocking, returns 1 if the
+   response is ready to be written, 0 if the request stays parked, and -1 on
+   errors.
+*/
+int _conn_check_wait(ft_buffer_conn_t *C, double now) {
+	samples_events_t *nret;
+	waitdef_t *wd = _conn_waitdef(C, NULL, NULL);
+
+	wd->milliseconds = 0;
+	if (_conn_handle_request(C) != 0) return -1;
+
+	/* a longer response means that a matching event has been found */
+	if (C->response->def->command == WAIT_OK && C->response->def->bufsize == sizeof(samples_events_t) && now < C->waitDeadline) {
+		nret = (samples_events_t *) C->response->buf;
+		if (nret->nsamples <= C->waitThreshold.nsamples && nret->nevents <= C->waitThreshold.nevents) {
+			/* not there yet, discard this response and keep waiting */
+			ft_msgpool_release(&C->pool, C->response, C->response->def->bufsize);
+			C->response = NULL;
+			return 0;
+		}
+	}
+	unregister_wait(C->waitHandle);
+	C->waitHandle = NULL;
+	_conn_start_response(C);
+	return 1;
+}
+
+/* Read from the socket, returns 1 if the caller should continue, 0 if the
+   socket would block, and -1 if the connection should be closed.
+*/
+int _conn_on_readable(ft_buffer_conn_t *C, int parkWaits) {
+	int n;
+
+	n = recv(C->sock, C->curPtr + C->bytesDone, C->bytesTotal - C->bytesDone, 0);
+	if (n<0) {
+#ifdef WIN32
+		if (WSAGetLastError() == WSAEWOULDBLOCK) return 0;
+#else
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+#endif
+	}
+	if (n<=0) {
+		/* socket was closed */
+		if (C->server->verbosity>0) {
+			printf("Remote side closed client connection\n");
+		}
+		return -1;
+	}
+	return _conn_received(C, n, parkWaits);
+}
+
+/* Continue the state machine after n bytes have been read into curPtr, with
+   the same return values as _conn_on_readable. This is also used by the
+   io_uring backend, which reads the bytes asynchronously.
+*/
+int _conn_received(ft_buffer_conn_t *C, int n, int parkWaits) {
+	ft_buffer_server_t *SC = C->server;
+
+	C->bytesDone+=n;
+	if (C->bytesDone<C->bytesTotal) return 1;
+
+	if (C->state == 0) {
+		/* we've read the request.def completely */
+		if (C->reqdef.version==VERSION_OE) {
+			C->swap = 1;
+			ft_swap16(2, &C->reqdef.version); /* version + command */
+			ft_swap32(1, &C->reqdef.bufsize);
+			C->reqCommand = C->reqdef.command;
+		}
+		if (C->reqdef.version!=VERSION) {
+			fprintf(stderr,"Incorrect version requested - closing socket.\n");
+			return -1;
+		}
+		if (C->reqdef.bufsize > 0) {
+			C->request.buf = ft_msgpool_alloc(&C->pool, C->reqdef.bufsize);
+			if (C->request.buf == NULL) {
+				fprintf(stderr, "Out of memory\n");
+				return -1;
+			}
+			if (!SC->isUnixDomain) ft_socket_fit(C->sock, SO_RCVBUF, C->reqdef.bufsize);
+			C->curPtr = C->request.buf;
+			C->bytesDone = 0;
+			C->bytesTotal = C->reqdef.bufsize;
+			C->state = 1;
+			return 1;
+		}
+	} else {
+		/* Reaching this point means that the state=1, and that we've
+		   read request.buf completely, so swap the endianness if
+		   necessary, and then move on to handling the request.
+		*/
+		if (C->swap && C->reqCommand == PUT_DAT && SC->callback == NULL && C->reqdef.bufsize >= sizeof(datadef_t)) {
+			/* let dmarequest swap the samples while copying them into the ring */
+			ft_swap32(4, C->request.buf);
+			C->swapData = 1;
+		} else if (C->swap) {
+			ft_swap_buf_to_native(C->reqCommand, C->reqdef.bufsize, C->request.buf);
+			/* the response to a STREAM_REQ is that of the wrapped request */
+			if (C->reqCommand == STREAM_REQ && C->reqdef.bufsize >= sizeof(streamdef_t) + sizeof(messagedef_t))
+				C->reqCommand = ((messagedef_t *) ((char *) C->request.buf + sizeof(streamdef_t)))->command;
+		}
+	}
+	C->requestTime = ft_stats_clock();
+
+	/* In the event loop we cannot afford to block inside dmarequest, so
+	   blocking WAIT_DAT requests are parked and re-evaluated later on. */
+	if (parkWaits) {
+		waitdef_t *wd = _conn_waitdef(C, NULL, NULL);
+		if (wd != NULL && wd->milliseconds > 0) {
+			C->waitThreshold = wd->threshold;
+			C->waitDeadline = _server_time() + 0.001*wd->milliseconds;
+			C->state = 4;
+			return _conn_check_wait(C, _server_time()) < 0 ? -1 : 1;
+		}
+	}
+
+#ifdef USE_EVENTLOOP
+	/* hand the request to a worker, the event loop continues once it is done */
+	if (C->loop != NULL && SC->pool != NULL && _pool_submit(C) == 0) {
+		C->state = 6;
+		return 1;
+	}
+#endif
+
+	/* Request has been read completely, now deal with it */
+	if (_conn_handle_request(C) != 0) return -1;
+
+	/* Ok, the request has been handled, results are in response */
+	_conn_start_response(C);
+	return 1;
+}
+
+/* Write to the socket, same return values as _conn_on_readable */
+int _conn_on_writable(ft_buffer_conn_t *C) {
+	int n;
+
+#ifndef WIN32
+	if (C->state==2 && C->respBufSize > 0) {
+		/* gather the remainder of response->def and response->buf into one write */
+		struct iovec iov[2];
+		iov[0].iov_base = C->curPtr + C->bytesDone;
+		iov[0].iov_len  = C->bytesTotal - C->bytesDone;
+		iov[1].iov_base = C->response->buf;
+		iov[1].iov_len  = C->respBufSize;
+		n = writev(C->sock, iov, 2);
+	} else
+#endif
+	n = send(C->sock, C->curPtr + C->bytesDone, C->bytesTotal - C->bytesDone, 0);
+	if (n<0) {
+#ifdef WIN32
+		if (WSAGetLastError() == WSAEWOULDBLOCK) return 0;
+#else
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+#endif
+	}
+	if (n<=0) {
+		/* socket was closed */
+		fprintf(stderr, "Cannot write to socket -- closing client connection.\n");
+		return -1;
+	}
+	return _conn_sent(C, n);
+}
+
+/* Continue the state machine after n bytes of the response have been written,
+   with the same return values as _conn_on_readable.
+*/
+int _conn_sent(ft_buffer_conn_t *C, int n) {
+	double delay;
+
+	C->lastProgress = _server_time();
+	if (C->state==2 && C->bytesDone + n > C->bytesTotal) {
+		/* the gathered write went beyond response->def, continue within response->buf */
+		n -= C->bytesTotal - C->bytesDone;
+		C->curPtr = (char *) C->response->buf;
+		C->bytesDone = n;
+		C->bytesTotal = C->respBufSize;
+		C->state = 3;
+	} else {
+		C->bytesDone+=n;
+	}
+	if (C->bytesDone < C->bytesTotal) return 1;
+	if (C->state==2 && C->respBufSize > 0) {
+		C->curPtr = (char *) C->response->buf;
+		C->bytesDone = 0;
+		C->bytesTotal = C->respBufSize;
+		C->state = 3;
+		return 1;
+	}
+	/* Reaching this point means we are done with writing out the response,
+	   so we will now free the allocated memory, and reset to state=0.
+	*/
+	ft_stats_roundtrip(ft_stats_elapsed(C->requestTime));
+	ft_msgpool_release(&C->pool, C->response, C->respBufSize);
+	C->response = NULL;
+	C->state = 0;
+	C->swap = 0;
+	C->curPtr = (char *) C->request.def;
+	C->bytesDone = 0;
+	C->bytesTotal = sizeof(messagedef_t);
+
+	/* a connection that exceeds its rate limit has to wait for its next request */
+	delay = ft_qos_delay(&C->qos);
+	if (delay > 0) {
+		C->resumeTime = _server_time() + delay;
+		C->state = 5;
+	}
+	return 1;
+}
+
+/************************************************************************
+ * This function runs in a separate thread for each client connection of
+ * a server in FT_SERVER_THREADED mode. It handles the incoming requests
+ * in a loop until the user requests to stop the server, or until the
+ * remote side closes the connection.
  ************************************************************************/
 void *_buffer_socket_func(void *arg) {
-	SOCKET sock;
 	ft_buffer_server_t *SC;
-	int mergePackets;
-	messagedef_t reqdef;
-	message_t request;
-	message_t *response = NULL;
-	int state=0; /* 0 = reading def, 1=reading buf, 2=writing def, 3=writing buf */
-	int bytesDone, bytesTotal;
-	char mergeBuffer[MERGE_THRESHOLD];
-	char *curPtr;	/* points at buffer that needs to be filled or written out */
-	int swap = 0;	
-	int canRead, canWrite;
-	UINT16_T reqCommand;
-	UINT32_T respBufSize;
+	ft_buffer_conn_t C;
 	fd_set readSet, writeSet;
 
-	if (arg==NULL) return NULL;
-		
-	/* copy over necessary variables and free the given structure */
-	SC 			 = ((ft_buffer_socket_t *) arg)->server;
-	sock 		 = ((ft_buffer_socket_t *) arg)->clientSocket;
-	mergePackets = ((ft_buffer_socket_t *) arg)->mergePackets;
-	free(arg);
-	
-	if (SC->verbosity > 0) {
-		printf("Started new client thread with packet merging = %i\n", mergePackets);
+	if (arg==NULL) return NULL;
+
+	/* copy over necessary variables and free the given structure */
+	SC = ((ft_buffer_socket_t *) arg)->server;
+	_conn_init(&C, SC, ((ft_buffer_socket_t *) arg)->clientSocket, ((ft_buffer_socket_t *) arg)->mergePackets);
+	free(arg);
+
+	if (SC->verbosity > 0) {
+		printf("Started new client thread with packet merging = %i\n", C.mergePackets);
+	}
+
+	pthread_mutex_lock(&SC->lock);
+	SC->numClients++;
+	pthread_mutex_unlock(&SC->lock);
+
+	while (SC->keepRunning) {
+		int sel, res;
+		struct timeval tv = {0, 10000}; /* 10ms */
+
+		if (C.state == 5) {
+			/* held back by the rate limit, but keep an eye on keepRunning */
+			double wait = C.resumeTime - _server_time();
+			if (wait > 0) {
+				usleep(wait < 0.01 ? (unsigned int) (1e6*wait) + 1 : 10000);
+				continue;
+			}
+			C.state = 0;
+		}
+
+		FD_ZERO(&readSet);
+		FD_ZERO(&writeSet);
+		if (C.state < 2) {
+			FD_SET(C.sock, &readSet);
+		} else {
+			FD_SET(C.sock, &writeSet);
+		}
+		sel = select((int) C.sock+1, &readSet, &writeSet, NULL, &tv);
+		if (sel == 0) {
+			if (_conn_stalled(&C, _server_time())) break;
+			continue;
+		}
+		if (sel < 0) {
+			fprintf(stderr, "Error in 'select' operation - closing client connection.\n");
+			break;
+		}
+
+		if (FD_ISSET(C.sock, &readSet)) {
+			res = _conn_on_readable(&C, 0);
+			if (res < 0) break;
+			/* try to write the response right away */
+			if (C.state < 2) continue;
+		}
+
+		if (C.state >= 2 && C.state < 4) {
+			if (_conn_on_writable(&C) < 0) break;
+			if (_conn_stalled(&C, _server_time())) break;
+		}
+	}
+
+	pthread_mutex_lock(&SC->lock);
+	SC->numClients--;
+	pthread_mutex_unlock(&SC->lock);
+
+	_conn_cleanup(&C);
+	return NULL;
+}
+
+#ifdef USE_EVENTLOOP
+
+#define POLLER_READ   1
+#define POLLER_WRITE  2
+#define POLLER_EVENTS 64
+
+/* interval at which parked WAIT_DAT requests are re-evaluated if they cannot be registered with dmarequest (in ms) */
+#define PARKED_WAIT_INTERVAL 1
+
+/* interval at which the connections are checked for the limits of their service class, if there are any (in ms) */
+#define QOS_CHECK_INTERVAL 10
+
+#ifdef USE_IOCP
+/* completion key of a handover or wakeup posted by _loop_wakeup, the sockets have their connection as key */
+#define IOCP_WAKEUP 1
+#endif
+
+/** Each event loop runs in its own thread and owns the connections it serves.
+    New connections are accepted by the first loop, and handed over to the
+    other loops by writing the connection pointer into their wakeup pipe.
+    On Windows, a separate thread accepts the connections, and hands them
+    over by posting them to the completion port of the loop.
+*/
+#ifdef USE_URING
+struct ft_uring;
+#endif
+
+typedef struct ft_buffer_loop {
+	ft_buffer_server_t *server;
+	int pollfd;                     /* epoll or kqueue descriptor, -1 in FT_SERVER_URING mode */
+#ifdef USE_URING
+	struct ft_uring *uring;         /* io_uring in FT_SERVER_URING mode, or NULL */
+#endif
+#ifdef USE_IOCP
+	HANDLE iocp;                    /* I/O completion port, which also takes the place of the wakeup pipe */
+#endif
+	int wakeup[2];                  /* pipe for handing over connections, and for waking up the loop */
+	pthread_t threadID;
+	ft_buffer_conn_t *conns;        /* linked list of connections served by this loop */
+	int numParked;                  /* number of connections with a parked WAIT_DAT request */
+	int numPolled;                  /* number of parked connections that are not registered with dmarequest */
+	pthread_mutex_t doneLock;       /* protects the list below, which is appended to by the workers */
+	ft_buffer_conn_t *done;         /* linked list of connections of which a worker has handled the request */
+} ft_buffer_loop_t;
+
+/** The workers take the requests from a bounded queue, which is filled by all
+    loops of the server. A connection has at most one request in the queue,
+    since it does not read the next one before its response is written.
+*/
+typedef struct ft_buffer_pool {
+	pthread_mutex_t lock;           /* protects the members below */
+	pthread_cond_t cond;            /* signalled when a request is queued, or when the workers should stop */
+	pthread_t threadID[FT_WORKERS_MAXTHREADS];
+	int numWorkers;
+	int stop;                       /* 1: the workers exit, and no more requests are queued */
+	int head, count;                /* first request, and number of requests in the queue */
+	ft_buffer_conn_t *queue[FT_WORKERS_QUEUE];
+} ft_buffer_pool_t;
+
+#ifndef USE_IOCP
+/* markers for the non-client descriptors in the poll set */
+static char _marker_listen, _marker_wakeup;
+
+int _poller_create(void) {
+#ifdef USE_EPOLL
+	return epoll_create(FT_EVENTLOOP_MAXTHREADS);
+#else
+	return kqueue();
+#endif
+}
+
+/* add (or modify, if add=0) the descriptor FD to the poll set, with the given POLLER_READ/WRITE interest */
+int _poller_set(ft_buffer_loop_t *L, int fd, void *ptr, int interest, int add) {
+#ifdef USE_EPOLL
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = ((interest & POLLER_READ) ? EPOLLIN : 0) | ((interest & POLLER_WRITE) ? EPOLLOUT : 0);
+	ev.data.ptr = ptr;
+	return epoll_ctl(L->pollfd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev);
+#else
+	struct kevent ev[2];
+	EV_SET(&ev[0], fd, EVFILT_READ,  EV_ADD | ((interest & POLLER_READ)  ? EV_ENABLE : EV_DISABLE), 0, 0, ptr);
+	EV_SET(&ev[1], fd, EVFILT_WRITE, EV_ADD | ((interest & POLLER_WRITE) ? EV_ENABLE : EV_DISABLE), 0, 0, ptr);
+	return kevent(L->pollfd, ev, 2, NULL, 0, NULL);
+#endif
+}
+
+void _poller_remove(ft_buffer_loop_t *L, int fd) {
+#ifdef USE_EPOLL
+	struct epoll_event ev;
+	epoll_ctl(L->pollfd, EPOLL_CTL_DEL, fd, &ev);
+#else
+	struct kevent ev[2];
+	EV_SET(&ev[0], fd, EVFILT_READ,  EV_DELETE, 0, 0, NULL);
+	EV_SET(&ev[1], fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+	kevent(L->pollfd, ev, 2, NULL, 0, NULL);
+#endif
+}
+#endif /* USE_IOCP */
+
+/* the interest of a connection follows from the state of its state machine */
+int _state_interest(int state) {
+	if (state < 2) return POLLER_READ;
+	if (state < 4) return POLLER_WRITE;
+	return 0;
+}
+
+/* hand connection C over to loop L, or just wake it up if C is NULL, returns 0 on success */
+int _loop_wakeup(ft_buffer_loop_t *L, ft_buffer_conn_t *C) {
+#ifdef USE_IOCP
+	return PostQueuedCompletionStatus(L->iocp, 0, IOCP_WAKEUP, (LPOVERLAPPED) C) ? 0 : -1;
+#else
+	return (write(L->wakeup[1], &C, sizeof(C)) == sizeof(C)) ? 0 : -1;
+#endif
+}
+
+/* called by dmarequest (in the thread that writes data or events) once the threshold of a parked request was exceeded */
+void _loop_notify(void *arg) {
+	ft_buffer_conn_t *C = (ft_buffer_conn_t *) arg;
+	C->waitNotified = 1;
+	/* the pipe is non-blocking, if it is full the loop will wake up anyway */
+	_loop_wakeup(C->loop, NULL);
+}
+
+/* Register a parked request with dmarequest, so that we get notified instead
+   of having to poll. This only works if there is no user-defined callback. */
+void _loop_park(ft_buffer_loop_t *L, ft_buffer_conn_t *C) {
+	const char *stream;
+	UINT32_T size;
+	waitdef_t *wd;
+	if (C->waitHandle != NULL) return;
+	if (L->server->callback != NULL) {
+		L->numPolled++;
+		return;
+	}
+	C->waitNotified = 0;
+	wd = _conn_waitdef(C, &stream, &size);
+	if (size > sizeof(waitdef_t)) {
+		/* the event filter has been checked by dmarequest already, see _conn_check_wait */
+		const waitevt_t *waitevt = (const waitevt_t *) (wd+1);
+		C->waitHandle = register_stream_wait_event(stream, C->waitThreshold.nsamples, C->waitThreshold.nevents, waitevt, size - sizeof(waitdef_t) - sizeof(waitevt_t), waitevt+1, _loop_notify, C);
+	}
+	else {
+		C->waitHandle = register_stream_wait(stream, C->waitThreshold.nsamples, C->waitThreshold.nevents, _loop_notify, C);
+	}
+	/* a NULL handle means that the threshold has been exceeded in the meantime */
+	if (C->waitHandle == NULL) C->waitNotified = 1;
+}
+
+void _loop_unpark(ft_buffer_loop_t *L, ft_buffer_conn_t *C) {
+	L->numParked--;
+	if (L->server->callback != NULL) L->numPolled--;
+}
+
+/* returns the timeout for waiting on the poll set, in ms */
+int _loop_timeout(ft_buffer_loop_t *L) {
+	ft_buffer_conn_t *C;
+	double now, first = -1;
+	int timeout, qos = (L->conns != NULL && ft_qos_active()) ? QOS_CHECK_INTERVAL : -1;
+
+	if (L->numParked == 0) return qos;
+	if (L->numPolled > 0) return PARKED_WAIT_INTERVAL;
+
+	for (C = L->conns; C != NULL; C = C->next) {
+		if (C->state != 4) continue;
+		if (C->waitNotified) return 0;
+		if (first < 0 || C->waitDeadline < first) first = C->waitDeadline;
+	}
+	if (first < 0) return qos;
+	now = _server_time();
+	/* round up, so we do not wake up just before the deadline */
+	timeout = (first <= now) ? 0 : (int) (1000.0*(first - now)) + 1;
+	return (qos >= 0 && qos < timeout) ? qos : timeout;
+}
+
+void _loop_serve_conn(ft_buffer_loop_t *L, ft_buffer_conn_t *C, int canRead, int canWrite, int oldInterest);
+#ifdef USE_URING
+int _uring_add_conn(ft_buffer_loop_t *L, ft_buffer_conn_t *C);
+void _uring_arm(ft_buffer_loop_t *L, ft_buffer_conn_t *C);
+void _uring_close(ft_buffer_loop_t *L, ft_buffer_conn_t *C);
+void _uring_free_conn(ft_buffer_conn_t *C);
+#endif
+#ifdef USE_IOCP
+int _iocp_add_conn(ft_buffer_loop_t *L, ft_buffer_conn_t *C);
+void _iocp_arm(ft_buffer_loop_t *L, ft_buffer_conn_t *C);
+void _iocp_close(ft_buffer_loop_t *L, ft_buffer_conn_t *C);
+void _iocp_free_conn(ft_buffer_conn_t *C);
+#endif
+
+void _loop_add_conn(ft_buffer_loop_t *L, ft_buffer_conn_t *C) {
+	int res;
+
+	C->loop = L;
+#if defined(USE_IOCP)
+	res = _iocp_add_conn(L, C);
+#else
+#ifdef USE_URING
+	if (L->uring != NULL)
+		res = _uring_add_conn(L, C);
+	else
+#endif
+	res = _poller_set(L, C->sock, C, POLLER_READ, 1);
+#endif
+	if (res < 0) {
+		perror("buffer_event_loop, add connection");
+		pthread_mutex_lock(&L->server->lock);
+		L->server->numClients--;
+		pthread_mutex_unlock(&L->server->lock);
+		_conn_cleanup(C);
+		free(C);
+		return;
+	}
+	C->next = L->conns;
+	L->conns = C;
+#ifdef USE_URING
+	if (L->uring != NULL) _uring_arm(L, C);
+#endif
+#ifdef USE_IOCP
+	_iocp_arm(L, C);
+#endif
+}
+
+void _loop_close_conn(ft_buffer_loop_t *L, ft_buffer_conn_t *C) {
+	ft_buffer_conn_t **P;
+
+	for (P = &L->conns; *P != NULL; P = &(*P)->next) {
+		if (*P == C) {
+			*P = C->next;
+			break;
+		}
+	}
+	if (C->state == 4) _loop_unpark(L, C);
+#ifdef USE_IOCP
+	_iocp_free_conn(C);
+#else
+	if (L->pollfd >= 0) _poller_remove(L, C->sock);
+#endif
+#ifdef USE_URING
+	_uring_free_conn(C);
+#endif
+	_conn_cleanup(C);
+	free(C);
+
+	pthread_mutex_lock(&L->server->lock);
+	L->server->numClients--;
+	pthread_mutex_unlock(&L->server->lock);
+}
+
+/* close a connection from outside of its I/O, with io_uring or IOCP this waits for the outstanding operations */
+void _loop_drop(ft_buffer_loop_t *L, ft_buffer_conn_t *C) {
+#ifdef USE_IOCP
+	_iocp_close(L, C);
+	return;
+#endif
+#ifdef USE_URING
+	if (L->uring != NULL) {
+		_uring_close(L, C);
+		return;
+	}
+#endif
+	_loop_close_conn(L, C);
+}
+
+/* continue with a connection that was parked or held back */
+void _loop_resume(ft_buffer_loop_t *L, ft_buffer_conn_t *C) {
+#ifdef USE_IOCP
+	_iocp_arm(L, C);
+#else
+#ifdef USE_URING
+	if (L->uring != NULL) {
+		_uring_arm(L, C);
+		return;
+	}
+#endif
+	/* the poll set does not watch a parked connection, so the write interest
+	   is set again if the response does not go out at once */
+	if (C->state >= 2)
+		_loop_serve_conn(L, C, 0, 1, 0);
+	else
+		_poller_set(L, C->sock, C, _state_interest(C->state), 0);
+#endif
+}
+
+#ifndef USE_IOCP
+
+/* drive the state machine of a connection as far as the socket allows,
+   oldInterest is what the poll set currently watches for C */
+void _loop_serve_conn(ft_buffer_loop_t *L, ft_buffer_conn_t *C, int canRead, int canWrite, int oldInterest) {
+	int res = 1, oldState = C->state;
+
+	while (res > 0 && (canRead || canWrite)) {
+		if (C->state < 2) {
+			if (!canRead) break;
+			res = _conn_on_readable(C, 1);
+			if (res == 0) canRead = 0;
+			/* try writing the response right away */
+			if (C->state >= 2) canWrite = 1;
+		} else if (C->state < 4) {
+			if (!canWrite) break;
+			res = _conn_on_writable(C);
+			if (res == 0) canWrite = 0;
+			/* the client will probably send its next request soon */
+			if (C->state == 0) canRead = 1;
+		} else {
+			break;
+		}
+	}
+	if (res < 0) {
+		_loop_close_conn(L, C);
+		return;
+	}
+	if (C->state == 4 && oldState != 4) {
+		L->numParked++;
+		_loop_park(L, C);
+	}
+	if (C->state == 6) {
+		/* not even a hangup may close the connection while the worker uses it, see _loop_collect */
+		if (L->pollfd >= 0) _poller_remove(L, C->sock);
+		return;
+	}
+	if (_state_interest(C->state) != oldInterest) {
+		_poller_set(L, C->sock, C, _state_interest(C->state), 0);
+	}
+}
+
+/* accept all pending connections on the listening socket, and distribute them over the loops */
+void _loop_accept(ft_buffer_loop_t *L) {
+	ft_buffer_server_t *SC = L->server;
+	static unsigned int next = 0;
+
+	for (;;) {
+		SOCKET c;
+		int merge, optval;
+		ft_buffer_conn_t *C;
+		ft_buffer_loop_t *T;
+
+		if (SC->isUnixDomain) {
+			struct sockaddr_un sa;
+			socklen_t size_sa = sizeof(sa);
+			c = accept(SC->serverSocket, (struct sockaddr *)&sa, &size_sa);
+			/* never merge packets for (local) UNIX sockets */
+			merge = 0;
+		} else {
+			struct sockaddr_in sa;
+			socklen_t size_sa = sizeof(sa);
+			c = accept(SC->serverSocket, (struct sockaddr *)&sa, &size_sa);
+			/* enable packet merging only if it's not localhost */
+			merge = (c != INVALID_SOCKET && sa.sin_addr.s_addr != htonl(INADDR_LOOPBACK)) ? 1 : 0;
+		}
+		if (c == INVALID_SOCKET) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) perror("buffer_event_loop, accept");
+			return;
+		}
+
+		/* the event loop requires non-blocking client sockets */
+		optval = fcntl(c, F_GETFL, NULL);
+		if (fcntl(c, F_SETFL, optval | O_NONBLOCK) < 0) {
+			perror("buffer_event_loop, fcntl");
+			closesocket(c);
+			continue;
+		}
+
+		C = (ft_buffer_conn_t *) malloc(sizeof(ft_buffer_conn_t));
+		if (C==NULL) {
+			fprintf(stderr, "Out of memory\n");
+			closesocket(c);
+			continue;
+		}
+		_conn_init(C, SC, c, merge);
+
+		pthread_mutex_lock(&SC->lock);
+		SC->numClients++;
+		pthread_mutex_unlock(&SC->lock);
+
+		if (SC->verbosity > 0) {
+			printf("Accepted new client connection with packet merging = %i\n", merge);
+		}
+
+		/* distribute the connections round-robin over the loops */
+		T = &SC->loops[(next++) % SC->numLoops];
+		if (T == L) {
+			_loop_add_conn(L, C);
+		} else if (_loop_wakeup(T, C) != 0) {
+			perror("buffer_event_loop, handover");
+			pthread_mutex_lock(&SC->lock);
+			SC->numClients--;
+			pthread_mutex_unlock(&SC->lock);
+			_conn_cleanup(C);
+			free(C);
+		}
+	}
+}
+
+/* read connections that were handed over by the accepting loop, a NULL pointer just wakes us up */
+void _loop_handover(ft_buffer_loop_t *L) {
+	ft_buffer_conn_t *C;
+	while (read(L->wakeup[0], &C, sizeof(C)) == sizeof(C)) {
+		if (C != NULL) _loop_add_conn(L, C);
+	}
+}
+
+#endif /* USE_IOCP */
+
+/* re-evaluate the parked WAIT_DAT requests that were notified, or that timed out */
+void _loop_check_parked(ft_buffer_loop_t *L) {
+	ft_buffer_conn_t *C, *N;
+	double now = _server_time();
+
+	for (C = L->conns; C != NULL; C = N) {
+		N = C->next;
+		if (C->state != 4) continue;
+		if (C->waitHandle != NULL && !C->waitNotified && now < C->waitDeadline) continue;
+		switch (_conn_check_wait(C, now)) {
+			case 0:
+				if (C->waitNotified) {
+					/* the counts went down in the meantime (e.g. FLUSH_DAT), so register once more */
+					unregister_wait(C->waitHandle);
+					C->waitHandle = NULL;
+					_loop_park(L, C);
+				}
+				break;
+			case 1:
+				_loop_unpark(L, C);
+				_loop_resume(L, C);
+				break;
+			default:
+				_loop_drop(L, C);
+		}
+	}
+}
+
+/* resume the connections that were held back by the rate limit, and close those that stalled */
+void _loop_check_qos(ft_buffer_loop_t *L) {
+	ft_buffer_conn_t *C, *N;
+	double now = _server_time();
+
+	for (C = L->conns; C != NULL; C = N) {
+		N = C->next;
+		if (C->state == 5 && now >= C->resumeTime) {
+			C->state = 0;
+			_loop_resume(L, C);
+		} else if (_conn_stalled(C, now)) {
+			_loop_drop(L, C);
+		}
+	}
+}
+
+/* queue the request of a connection for the workers, returns 0 on success and -1 if the queue is full */
+int _pool_submit(ft_buffer_conn_t *C) {
+	ft_buffer_pool_t *P = C->server->pool;
+	int res = -1;
+
+	pthread_mutex_lock(&P->lock);
+	if (!P->stop && P->count < FT_WORKERS_QUEUE) {
+		P->queue[(P->head + P->count) % FT_WORKERS_QUEUE] = C;
+		P->count++;
+		ft_stats_queue_begin();
+		pthread_cond_signal(&P->cond);
+		res = 0;
+	} else if (!P->stop) {
+		ft_stats_queue_full();
+	}
+	pthread_mutex_unlock(&P->lock);
+	return res;
+}
+
+/***********************************************************************
+ * this thread handles the requests that were read by the event loops,
+ * and gives the connections back to their loop
+ ***********************************************************************/
+void *_pool_worker_func(void *arg) {
+	ft_buffer_pool_t *P = (ft_buffer_pool_t *) arg;
+
+	for (;;) {
+		ft_buffer_conn_t *C;
+		ft_buffer_loop_t *L;
+
+		pthread_mutex_lock(&P->lock);
+		while (P->count == 0 && !P->stop) pthread_cond_wait(&P->cond, &P->lock);
+		if (P->stop) {
+			pthread_mutex_unlock(&P->lock);
+			break;
+		}
+		C = P->queue[P->head];
+		P->head = (P->head + 1) % FT_WORKERS_QUEUE;
+		P->count--;
+		pthread_mutex_unlock(&P->lock);
+		ft_stats_queue_end();
+
+		C->workResult = _conn_handle_request(C);
+		ft_stats_queue_done();
+
+		L = C->loop;
+		pthread_mutex_lock(&L->doneLock);
+		C->done = L->done;
+		L->done = C;
+		pthread_mutex_unlock(&L->doneLock);
+		/* the pipe is non-blocking, if it is full the loop will wake up anyway */
+		_loop_wakeup(L, NULL);
+	}
+	return NULL;
+}
+
+/* Stop the workers of server SC. This waits for the requests that are being
+   handled, so it has to be called before the loops close their connections.
+   From then on the loops handle the requests themselves, and the requests
+   that are still in the queue are dropped together with their connections
+   once the loops stop.
+*/
+void _stop_pool(ft_buffer_server_t *SC) {
+	ft_buffer_pool_t *P = SC->pool;
+	int i;
+
+	if (P == NULL) return;
+	pthread_mutex_lock(&P->lock);
+	P->stop = 1;
+	pthread_cond_broadcast(&P->cond);
+	pthread_mutex_unlock(&P->lock);
+	for (i=0; i<P->numWorkers; i++) pthread_join(P->threadID[i], NULL);
+	P->numWorkers = 0;
+}
+
+/* release the pool of server SC, once the loops have stopped as well */
+void _release_pool(ft_buffer_server_t *SC) {
+	ft_buffer_pool_t *P = SC->pool;
+
+	if (P == NULL) return;
+	_stop_pool(SC);
+	pthread_cond_destroy(&P->cond);
+	pthread_mutex_destroy(&P->lock);
+	free(P);
+	SC->pool = NULL;
+}
+
+/* start the workers of server SC, returns 0 on success */
+int _start_pool(ft_buffer_server_t *SC, int numWorkers) {
+	ft_buffer_pool_t *P;
+
+	P = (ft_buffer_pool_t *) calloc(1, sizeof(ft_buffer_pool_t));
+	if (P == NULL) return -1;
+	if (pthread_mutex_init(&P->lock, NULL) != 0) {
+		free(P);
+		return -1;
+	}
+	if (pthread_cond_init(&P->cond, NULL) != 0) {
+		pthread_mutex_destroy(&P->lock);
+		free(P);
+		return -1;
+	}
+	for (P->numWorkers=0; P->numWorkers<numWorkers; P->numWorkers++) {
+		if (pthread_create(&P->threadID[P->numWorkers], NULL, _pool_worker_func, P) != 0) {
+			fprintf(stderr, "ft_start_buffer_server: could not spawn worker thread\n");
+			break;
+		}
+	}
+	/* the loops are not running yet, so they see the pool only from now on */
+	SC->pool = P;
+	if (P->numWorkers == numWorkers) return 0;
+	_release_pool(SC);
+	return -1;
+}
+
+/* write the responses of the requests that were handled by the workers */
+void _loop_collect(ft_buffer_loop_t *L) {
+	ft_buffer_conn_t *C, *N;
+
+	pthread_mutex_lock(&L->doneLock);
+	C = L->done;
+	L->done = NULL;
+	pthread_mutex_unlock(&L->doneLock);
+
+	for (; C != NULL; C = N) {
+		N = C->done;
+		C->done = NULL;
+		if (C->workResult != 0) {
+			_loop_drop(L, C);
+			continue;
+		}
+		_conn_start_response(C);
+#ifndef USE_IOCP
+		/* the socket is watched again, with the interest of the new state */
+		if (L->pollfd >= 0 && _poller_set(L, C->sock, C, _state_interest(C->state), 1) < 0) {
+			perror("buffer_event_loop, poller");
+			_loop_close_conn(L, C);
+			continue;
+		}
+#endif
+		_loop_resume(L, C);
+	}
+}
+
+#ifndef USE_IOCP
+/* handle a single event of the poll set */
+void _loop_dispatch(ft_buffer_loop_t *L, void *ptr, int canRead, int canWrite) {
+	if (ptr == &_marker_listen) {
+		_loop_accept(L);
+	} else if (ptr == &_marker_wakeup) {
+		_loop_handover(L);
+	} else {
+		ft_buffer_conn_t *C = (ft_buffer_conn_t *) ptr;
+		if (C->state == 6) {
+			/* an event that was reported before the socket was removed from the poll set, see _loop_serve_conn */
+		} else if (C->state >= 4) {
+			/* the client closed the connection while waiting, or sent unexpected data */
+			_loop_close_conn(L, C);
+		} else {
+			_loop_serve_conn(L, C, canRead, canWrite, _state_interest(C->state));
+		}
+	}
+}
+
+/***********************************************************************
+ * this thread runs an event loop that serves many client connections,
+ * the first loop of a server also accepts the incoming connections
+ ***********************************************************************/
+void *_buffer_event_loop_func(void *arg) {
+	ft_buffer_loop_t *L = (ft_buffer_loop_t *) arg;
+	ft_buffer_server_t *SC = L->server;
+#ifdef USE_EPOLL
+	struct epoll_event events[POLLER_EVENTS];
+#else
+	struct kevent events[POLLER_EVENTS];
+#endif
+
+	while (SC->keepRunning) {
+		int i, n, pass;
+		int timeout = _loop_timeout(L);
+
+#ifdef USE_EPOLL
+		n = epoll_wait(L->pollfd, events, POLLER_EVENTS, timeout);
+#else
+		struct timespec ts;
+		ts.tv_sec  = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000;
+		n = kevent(L->pollfd, NULL, 0, events, POLLER_EVENTS, timeout < 0 ? NULL : &ts);
+#endif
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			perror("buffer_event_loop, wait");
+			break;
+		}
+
+		/* the writer is served in the first pass, so that the readers do not add to its latency */
+		for (pass=0; pass<2; pass++) {
+			for (i=0; i<n && SC->keepRunning; i++) {
+#ifdef USE_EPOLL
+				void *ptr = events[i].data.ptr;
+				int canRead  = (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0;
+				int canWrite = (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) != 0;
+#else
+				void *ptr = events[i].udata;
+				int canRead  = (events[i].filter == EVFILT_READ);
+				int canWrite = (events[i].filter == EVFILT_WRITE);
+#endif
+				if (ptr == NULL) continue;
+				if (pass == 0 && (ptr == &_marker_listen || ptr == &_marker_wakeup || ((ft_buffer_conn_t *) ptr)->qos.qosclass != FT_QOS_WRITER)) continue;
+				_loop_dispatch(L, ptr, canRead, canWrite);
+				/* this event has been dealt with */
+#ifdef USE_EPOLL
+				events[i].data.ptr = NULL;
+#else
+				events[i].udata = NULL;
+#endif
+			}
+		}
+
+		if (SC->pool != NULL) _loop_collect(L);
+		if (L->numParked > 0) _loop_check_parked(L);
+		if (ft_qos_active()) _loop_check_qos(L);
+	}
+
+	/* close all remaining connections */
+	while (L->conns != NULL) _loop_close_conn(L, L->conns);
+	return NULL;
+}
+#endif /* USE_IOCP */
+
+#ifdef USE_URING
+
+/***********************************************************************
+ * In FT_SERVER_URING mode, the loops do not wait for the sockets to become
+ * ready, but submit the reads and writes to an io_uring and continue the state
+ * machines once they have completed. The next operation of a connection is
+ * queued while handling the completion of the previous one, and is submitted
+ * together with the wait for the next completions, so that a request and its
+ * response take a single system call. Large responses are sent without
+ * copying them into the socket buffer (IORING_OP_SEND_ZC, Linux 6.0), their
+ * memory is released once the kernel has notified us that it is done with it.
+ *
+ * The rings are set up with the system calls, so that we do not depend on
+ * liburing. The kernel only looks at the submission queue within
+ * io_uring_enter, which is called from the loop thread that owns the ring.
+ ***********************************************************************/
+
+#define URING_ENTRIES       256
+#define URING_BATCH         POLLER_EVENTS
+/* responses from this size on are sent with zero-copy */
+#define URING_ZC_MINSIZE    65536
+/* number of times that the loop waits 10 ms for the operations of the sockets that are closed on exit */
+#define URING_DRAIN_TRIES   100
+
+/* the user_data of the operations is a connection pointer with the type of operation in the lowest bits */
+#define URING_RECV     0
+#define URING_SEND     1
+#define URING_SEND_ZC  2
+#define URING_OPMASK   3
+/* polls on the listening socket and the wakeup pipe */
+#define URING_LISTEN   1
+#define URING_WAKEUP   2
+
+typedef struct ft_uring {
+	int fd;
+	unsigned int entries;
+	void *sqmap, *cqmap;
+	size_t sqmapsize, cqmapsize;
+	struct io_uring_sqe *sqes;
+	size_t sqesize;
+	unsigned int *sqhead, *sqtail, *sqmask, *sqarray;
+	unsigned int *cqhead, *cqtail, *cqmask;
+	struct io_uring_cqe *cqes;
+	unsigned int toSubmit;          /* number of queued entries that the kernel has not seen yet */
+	int zerocopy;                   /* cleared if the kernel or the socket type does not support it */
+} ft_uring_t;
+
+/* state of a single connection */
+typedef struct {
+	struct iovec iov[2];
+	struct msghdr msg;
+	int busy;                       /* a read or write is in flight */
+	int notif;                      /* number of zero-copy notifications that are still to come */
+	int closing;                    /* the connection is closed once nothing is in flight anymore */
+	void *zcBuf;                    /* response buffer that may still be referenced by a zero-copy send */
+} ft_uring_conn_t;
+
+void _uring_destroy(ft_uring_t *U) {
+	if (U == NULL) return;
+	if (U->sqes != NULL) munmap(U->sqes, U->sqesize);
+	if (U->cqmap != NULL && U->cqmap != U->sqmap) munmap(U->cqmap, U->cqmapsize);
+	if (U->sqmap != NULL) munmap(U->sqmap, U->sqmapsize);
+	close(U->fd);
+	free(U);
+}
+
+/* set up a ring, returns NULL if the kernel does not support the features that we need */
+ft_uring_t *_uring_create(ft_buffer_server_t *SC) {
+	const unsigned int features = IORING_FEAT_FAST_POLL | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+	struct io_uring_params p;
+	ft_uring_t *U;
+	char *sq, *cq;
+
+	U = (ft_uring_t *) calloc(1, sizeof(ft_uring_t));
+	if (U == NULL) return NULL;
+
+	memset(&p, 0, sizeof(p));
+	U->fd = (int) syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+	if (U->fd < 0) {
+		perror("ft_start_buffer_server, io_uring_setup");
+		free(U);
+		return NULL;
+	}
+	if ((p.features & features) != features) {
+		fprintf(stderr, "ft_start_buffer_server: this kernel's io_uring is too old\n");
+		close(U->fd);
+		free(U);
+		return NULL;
+	}
+
+	U->entries   = p.sq_entries;
+	U->sqmapsize = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	U->cqmapsize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (U->cqmapsize > U->sqmapsize) U->sqmapsize = U->cqmapsize;
+		U->cqmapsize = U->sqmapsize;
+	}
+	U->sqmap = mmap(NULL, U->sqmapsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, U->fd, IORING_OFF_SQ_RING);
+	if (U->sqmap == MAP_FAILED) {
+		U->sqmap = NULL;
+		goto error;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		U->cqmap = U->sqmap;
+	} else {
+		U->cqmap = mmap(NULL, U->cqmapsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, U->fd, IORING_OFF_CQ_RING);
+		if (U->cqmap == MAP_FAILED) {
+			U->cqmap = NULL;
+			goto error;
+		}
+	}
+	U->sqesize = p.sq_entries * sizeof(struct io_uring_sqe);
+	U->sqes = (struct io_uring_sqe *) mmap(NULL, U->sqesize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, U->fd, IORING_OFF_SQES);
+	if (U->sqes == MAP_FAILED) {
+		U->sqes = NULL;
+		goto error;
+	}
+
+	sq = (char *) U->sqmap;
+	cq = (char *) U->cqmap;
+	U->sqhead  = (unsigned int *) (sq + p.sq_off.head);
+	U->sqtail  = (unsigned int *) (sq + p.sq_off.tail);
+	U->sqmask  = (unsigned int *) (sq + p.sq_off.ring_mask);
+	U->sqarray = (unsigned int *) (sq + p.sq_off.array);
+	U->cqhead  = (unsigned int *) (cq + p.cq_off.head);
+	U->cqtail  = (unsigned int *) (cq + p.cq_off.tail);
+	U->cqmask  = (unsigned int *) (cq + p.cq_off.ring_mask);
+	U->cqes    = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+	/* zero-copy does not work for UNIX domain sockets */
+	U->zerocopy = !SC->isUnixDomain;
+	return U;
+
+error:
+	perror("ft_start_buffer_server, io_uring mmap");
+	_uring_destroy(U);
+	return NULL;
+}
+
+/* submit the queued entries, and wait for at most timeout ms (or forever, if negative) if wait is set */
+int _uring_enter(ft_uring_t *U, int wait, int timeout) {
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned int flags = 0;
+	int res;
+
+	if (!wait && U->toSubmit == 0) return 0;
+	memset(&arg, 0, sizeof(arg));
+	if (wait) {
+		flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+		if (timeout >= 0) {
+			ts.tv_sec  = timeout / 1000;
+			ts.tv_nsec = (timeout % 1000) * 1000000;
+			arg.ts = (__u64) (uintptr_t) &ts;
+		}
 	}
-	
-    pthread_mutex_lock(&SC->lock);
-    SC->numClients++;
-    pthread_mutex_unlock(&SC->lock);
+	res = (int) syscall(__NR_io_uring_enter, U->fd, U->toSubmit, wait ? 1 : 0, flags, wait ? &arg : NULL, sizeof(arg));
+	U->toSubmit = *U->sqtail - __atomic_load_n(U->sqhead, __ATOMIC_ACQUIRE);
+	if (res < 0 && errno != ETIME && errno != EINTR && errno != EBUSY && errno != EAGAIN) {
+		perror("buffer_event_loop, io_uring_enter");
+		return -1;
+	}
+	return 0;
+}
 
-	request.def = &reqdef;
-	request.buf = NULL;
-	bytesDone = 0;
-	bytesTotal = sizeof(messagedef_t);
-	curPtr = (char *) request.def;
+/* returns the next free submission queue entry, it is seen by the kernel on the next call of _uring_enter */
+struct io_uring_sqe *_uring_sqe(ft_uring_t *U) {
+	struct io_uring_sqe *sqe;
+	unsigned int tail = *U->sqtail, index;
 
-	while (SC->keepRunning) {
-		int sel, res, n;
-		struct timeval tv = {0, 10000}; /* 10ms */
-	
-		FD_ZERO(&readSet);
-		FD_ZERO(&writeSet);
-		if (state < 2) {
-			FD_SET(sock, &readSet);
-		} else {
-			FD_SET(sock, &writeSet);
+	if (tail - __atomic_load_n(U->sqhead, __ATOMIC_ACQUIRE) >= U->entries) {
+		_uring_enter(U, 0, 0);
+		if (tail - __atomic_load_n(U->sqhead, __ATOMIC_ACQUIRE) >= U->entries) return NULL;
+	}
+	index = tail & *U->sqmask;
+	sqe = &U->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	U->sqarray[index] = index;
+	__atomic_store_n(U->sqtail, tail + 1, __ATOMIC_RELEASE);
+	U->toSubmit++;
+	return sqe;
+}
+
+/* wait for the descriptor to become readable, this is queued again after each completion */
+void _uring_poll(ft_buffer_loop_t *L, int fd, __u64 which) {
+	struct io_uring_sqe *sqe = _uring_sqe(L->uring);
+	if (sqe == NULL) {
+		fprintf(stderr, "buffer_event_loop: io_uring submission queue is full\n");
+		return;
+	}
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = POLLIN;
+	sqe->user_data = which;
+}
+
+int _uring_add_conn(ft_buffer_loop_t *L, ft_buffer_conn_t *C) {
+	/* the operations wait within the kernel, so the socket should be blocking again */
+	int optval = fcntl(C->sock, F_GETFL, NULL);
+	fcntl(C->sock, F_SETFL, optval & ~O_NONBLOCK);
+	C->uring = calloc(1, sizeof(ft_uring_conn_t));
+	return (C->uring != NULL) ? 0 : -1;
+}
+
+void _uring_free_conn(ft_buffer_conn_t *C) {
+	ft_uring_conn_t *R = (ft_uring_conn_t *) C->uring;
+	if (R == NULL) return;
+	if (R->zcBuf != NULL) free(R->zcBuf);
+	free(R);
+	C->uring = NULL;
+}
+
+/* close the connection, or shut down its socket so that the operation in flight completes */
+void _uring_close(ft_buffer_loop_t *L, ft_buffer_conn_t *C) {
+	ft_uring_conn_t *R = (ft_uring_conn_t *) C->uring;
+	if (R->closing) return;
+	R->closing = 1;
+	if (!R->busy && R->notif == 0) {
+		_loop_close_conn(L, C);
+	} else {
+		shutdown(C->sock, SHUT_RDWR);
+	}
+}
+
+/* queue the read or write that follows from the state of the connection */
+void _uring_arm(ft_buffer_loop_t *L, ft_buffer_conn_t *C) {
+	ft_uring_t *U = L->uring;
+	ft_uring_conn_t *R = (ft_uring_conn_t *) C->uring;
+	struct io_uring_sqe *sqe;
+	int zerocopy;
+
+	if (R->busy || R->closing || C->state >= 4) return;
+	sqe = _uring_sqe(U);
+	if (sqe == NULL) {
+		fprintf(stderr, "buffer_event_loop: io_uring submission queue is full -- closing client connection.\n");
+		_loop_close_conn(L, C);
+		return;
+	}
+	sqe->fd = C->sock;
+	/* only one response buffer at a time can wait for its notifications */
+	zerocopy = U->zerocopy && R->zcBuf == NULL && C->respBufSize >= URING_ZC_MINSIZE;
+
+	if (C->state < 2) {
+		sqe->opcode = IORING_OP_RECV;
+		sqe->addr = (__u64) (uintptr_t) (C->curPtr + C->bytesDone);
+		sqe->len = C->bytesTotal - C->bytesDone;
+		sqe->user_data = (__u64) (uintptr_t) C | URING_RECV;
+	} else if (C->state == 2 && C->respBufSize > 0 && !zerocopy) {
+		/* the same as the writev in _conn_on_writable */
+		R->iov[0].iov_base = C->curPtr + C->bytesDone;
+		R->iov[0].iov_len  = C->bytesTotal - C->bytesDone;
+		R->iov[1].iov_base = C->response->buf;
+		R->iov[1].iov_len  = C->respBufSize;
+		memset(&R->msg, 0, sizeof(R->msg));
+		R->msg.msg_iov = R->iov;
+		R->msg.msg_iovlen = 2;
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->addr = (__u64) (uintptr_t) &R->msg;
+		sqe->len = 1;
+		sqe->user_data = (__u64) (uintptr_t) C | URING_SEND;
+	} else {
+		sqe->opcode = IORING_OP_SEND;
+		sqe->addr = (__u64) (uintptr_t) (C->curPtr + C->bytesDone);
+		sqe->len = C->bytesTotal - C->bytesDone;
+		sqe->user_data = (__u64) (uintptr_t) C | URING_SEND;
+#ifdef IORING_CQE_F_NOTIF
+		if (C->state == 3 && zerocopy) {
+			sqe->opcode = IORING_OP_SEND_ZC;
+			sqe->user_data = (__u64) (uintptr_t) C | URING_SEND_ZC;
 		}
-		sel = select((int) sock+1, &readSet, &writeSet, NULL, &tv);
-		if (sel == 0) continue;
-		if (sel < 0) {
-			fprintf(stderr, "Error in 'select' operation - closing client connection.\n");
-			break;
+#endif
+	}
+	R->busy = 1;
+}
+
+/* continue the state machine of a connection once its operation has completed */
+void _uring_complete(ft_buffer_loop_t *L, ft_buffer_conn_t *C, int op, int res, unsigned int flags) {
+	ft_uring_conn_t *R = (ft_uring_conn_t *) C->uring;
+	int ret;
+
+#ifdef IORING_CQE_F_NOTIF
+	if (flags & IORING_CQE_F_NOTIF) {
+		/* the kernel no longer references the buffer of a zero-copy send */
+		if (--R->notif == 0 && R->zcBuf != NULL) {
+			free(R->zcBuf);
+			R->zcBuf = NULL;
 		}
-		canRead = FD_ISSET(sock, &readSet);
-		canWrite = FD_ISSET(sock, &writeSet);
-		
-		if (canRead) {
-			n = recv(sock, curPtr + bytesDone, bytesTotal - bytesDone, 0);
-			if (n<=0) {
-				/* socket was closed */
-				if (SC->verbosity>0) {
-					printf("Remote side closed client connection\n");
-				}
-				break;
-			}
-			bytesDone+=n;
-			if (bytesDone<bytesTotal) continue;
-			
-			if (state == 0) {
-				/* we've read the request.def completely */
-				if (reqdef.version==VERSION_OE) {
-					swap = 1;
-					ft_swap16(2, &reqdef.version); /* version + command */
-					ft_swap32(1, &reqdef.bufsize);
-					reqCommand = reqdef.command;		
-				}
-				if (reqdef.version!=VERSION) {
-					fprintf(stderr,"Incorrect version requested - closing socket.\n");
-					break;
-				}
-				if (reqdef.bufsize > 0) {
-					request.buf = malloc(reqdef.bufsize);
-					if (request.buf == NULL) {
-						fprintf(stderr, "Out of memory\n");
-						break;
+		if (R->closing && !R->busy && R->notif == 0) _loop_close_conn(L, C);
+		return;
+	}
+	if (op == URING_SEND_ZC && (flags & IORING_CQE_F_MORE)) R->notif++;
+#endif
+	R->busy = 0;
+	if (R->closing) {
+		if (R->notif == 0) _loop_close_conn(L, C);
+		return;
+	}
+	if (res == -EAGAIN || res == -EINTR) {
+		_uring_arm(L, C);
+		return;
+	}
+	if (op == URING_SEND_ZC && (res == -EINVAL || res == -EOPNOTSUPP)) {
+		/* send with copying from now on */
+		L->uring->zerocopy = 0;
+		_uring_arm(L, C);
+		return;
+	}
+	if (res <= 0) {
+		if (op != URING_RECV) {
+			fprintf(stderr, "Cannot write to socket -- closing client connection.\n");
+		} else if (C->server->verbosity>0) {
+			printf("Remote side closed client connection\n");
+		}
+		_uring_close(L, C);
+		return;
+	}
+
+	if (op == URING_RECV) {
+		ret = _conn_received(C, res, 1);
+	} else {
+		/* keep the response buffer until its last notification if this completes the response */
+		if (C->state == 3 && R->notif > 0 && R->zcBuf == NULL && C->bytesDone + res >= C->bytesTotal) {
+			R->zcBuf = C->response->buf;
+			C->response->buf = NULL;
+		}
+		ret = _conn_sent(C, res);
+	}
+	if (ret < 0) {
+		_uring_close(L, C);
+		return;
+	}
+	if (C->state == 4) {
+		L->numParked++;
+		_loop_park(L, C);
+		return;
+	}
+	_uring_arm(L, C);
+}
+
+/* handle the completions, the writer is served first as in _buffer_event_loop_func */
+void _uring_reap(ft_buffer_loop_t *L) {
+	ft_buffer_server_t *SC = L->server;
+	ft_uring_t *U = L->uring;
+	struct io_uring_cqe events[URING_BATCH];
+	unsigned int head, tail;
+	int i, n, pass;
+
+	for (;;) {
+		head = *U->cqhead;
+		tail = __atomic_load_n(U->cqtail, __ATOMIC_ACQUIRE);
+		for (n=0; head != tail && n < URING_BATCH; n++, head++) {
+			events[n] = U->cqes[head & *U->cqmask];
+		}
+		__atomic_store_n(U->cqhead, head, __ATOMIC_RELEASE);
+		if (n == 0) break;
+
+		for (pass=0; pass<2; pass++) {
+			for (i=0; i<n; i++) {
+				__u64 ud = events[i].user_data;
+				ft_buffer_conn_t *C;
+
+				if (ud == 0) continue;
+				if (ud == URING_LISTEN || ud == URING_WAKEUP) {
+					if (pass == 0) continue;
+					if (ud == URING_LISTEN) {
+						if (SC->keepRunning) _loop_accept(L);
+						_uring_poll(L, SC->serverSocket, URING_LISTEN);
+					} else {
+						_loop_handover(L);
+						_uring_poll(L, L->wakeup[0], URING_WAKEUP);
 					}
-					curPtr = request.buf;
-					bytesDone = 0;
-					bytesTotal = reqdef.bufsize;
-					state = 1;
-					continue;
-				} 
-			} else {
-				/* Reaching this point means that the state=1, and that we've 
-				   read request.buf completely, so swap the endianness if 
-				   necessary, and then move on to handling the request.
-				*/	
-				if (swap) ft_swap_buf_to_native(reqCommand, reqdef.bufsize, request.buf);
-			}
-			
-			/* Request has been read completely, now deal with it */
-			if (SC->callback != NULL) {
-				/* User supplied a callback function in ft_start_buffer_server */
-				res = SC->callback(&request, &response, SC->user_data);
-				if (res != 0 || response == NULL || response->def == NULL) {
-					fprintf(stderr, "buffer_socket_func: an unexpected error occurred in user-defined request handler\n");
-					break;
-				}
-			} else {
-				/* No callback, use normal dmarequest */
-				res = dmarequest(&request, &response);
-				if (res != 0 || response == NULL || response->def == NULL) {
-					fprintf(stderr, "buffer_socket_func: an unexpected error occurred in dmarequest\n");
-					break;
+				} else {
+					C = (ft_buffer_conn_t *) (uintptr_t) (ud & ~(__u64) URING_OPMASK);
+					if (pass == 0 && C->qos.qosclass != FT_QOS_WRITER) continue;
+					_uring_complete(L, C, (int) (ud & URING_OPMASK), events[i].res, events[i].flags);
 				}
+				/* this completion has been dealt with */
+				events[i].user_data = 0;
 			}
-			
-			/* Ok, the request has been handled, results are in response.
-			   We can free the memory pointed to by request.buf ...
-			*/
-			if (request.buf != NULL) {
-				free(request.buf);
-				request.buf = NULL;
-			}
-			
-			/* ... swap the response to the remote endianness, if necessary ... */
-			respBufSize = response->def->bufsize;
-			if (swap) ft_swap_from_native(reqCommand, response);
-		
-			/* ... and then start writing back the response. To reduce latency,
-			   we try to merge response->def and response->buf if they are small, 
-			   so we can send it in one go over TCP. To fit the merged packet into 
-			   our state machine logic, we apply a trick and jump to state=3 directly,
-			   where "curPtr" points to the merged packet.
-			   Otherwise, we move to state=2, transmit response->def, move to state=3,
-			   and there transmit response->buf.
-			*/
-			if (mergePackets && respBufSize > 0 && respBufSize + sizeof(messagedef_t) <= MERGE_THRESHOLD) {
-				memcpy(mergeBuffer, response->def, sizeof(messagedef_t));
-				memcpy(mergeBuffer + sizeof(messagedef_t), response->buf, respBufSize);
-				
-				curPtr = mergeBuffer;
-				bytesDone = 0;
-				bytesTotal = respBufSize + sizeof(messagedef_t);
-				state = 3;
+		}
+	}
+}
+
+/***********************************************************************
+ * this thread runs an event loop in FT_SERVER_URING mode
+ ***********************************************************************/
+void *_buffer_uring_loop_func(void *arg) {
+	ft_buffer_loop_t *L = (ft_buffer_loop_t *) arg;
+	ft_buffer_server_t *SC = L->server;
+	ft_buffer_conn_t *C, *N;
+	int i;
+
+	_uring_poll(L, L->wakeup[0], URING_WAKEUP);
+	if (L == &SC->loops[0]) _uring_poll(L, SC->serverSocket, URING_LISTEN);
+
+	while (SC->keepRunning) {
+		if (_uring_enter(L->uring, 1, _loop_timeout(L)) < 0) break;
+		_uring_reap(L);
+		if (SC->pool != NULL) _loop_collect(L);
+		if (L->numParked > 0) _loop_check_parked(L);
+		if (ft_qos_active()) _loop_check_qos(L);
+	}
+
+	/* close all remaining connections, this has to wait for the operations in flight */
+	for (C = L->conns; C != NULL; C = N) {
+		N = C->next;
+		_uring_close(L, C);
+	}
+	for (i=0; i<URING_DRAIN_TRIES && L->conns != NULL; i++) {
+		if (_uring_enter(L->uring, 1, 10) < 0) break;
+		_uring_reap(L);
+	}
+	/* the pages of zero-copy sends are pinned by the kernel, so these can be freed anyway */
+	while (L->conns != NULL) _loop_close_conn(L, L->conns);
+	return NULL;
+}
+
+#endif /* USE_URING */
+
+#ifdef USE_IOCP
+
+/***********************************************************************
+ * On Windows, the loops wait on an I/O completion port instead of a poll
+ * set. As in FT_SERVER_URING mode, the next read or write of a connection
+ * is started as an overlapped WSARecv or WSASend once the previous one has
+ * completed, and the state machine continues when its completion has been
+ * dequeued. The response is gathered from response->def and response->buf
+ * in a single WSASend, as with writev. A connection has at most one
+ * operation in flight, which is started and completed by its own loop.
+ ***********************************************************************/
+
+#define IOCP_RECV 0
+#define IOCP_SEND 1
+
+/* number of times the loop waits 10 ms for the operations in flight when it stops */
+#define IOCP_DRAIN_TRIES 100
+
+/* state of a connection with the completion port */
+typedef struct {
+	WSAOVERLAPPED ov;               /* the operation in flight */
+	WSABUF buf[2];                  /* what is read or written, see _iocp_arm */
+	int op;                         /* IOCP_RECV or IOCP_SEND */
+	int busy;                       /* 1 while the operation is in flight */
+	int closing;                    /* 1 once the connection should be closed */
+} ft_iocp_conn_t;
+
+/* a completion that has been dequeued */
+typedef struct {
+	BOOL ok;
+	DWORD bytes;
+	ULONG_PTR key;
+	LPOVERLAPPED ov;
+} ft_iocp_event_t;
+
+int _iocp_add_conn(ft_buffer_loop_t *L, ft_buffer_conn_t *C) {
+	C->iocp = calloc(1, sizeof(ft_iocp_conn_t));
+	if (C->iocp == NULL) return -1;
+	/* the completions of the socket carry the connection as their key */
+	if (CreateIoCompletionPort((HANDLE) C->sock, L->iocp, (ULONG_PTR) C, 0) == NULL) {
+		free(C->iocp);
+		C->iocp = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+void _iocp_free_conn(ft_buffer_conn_t *C) {
+	ft_iocp_conn_t *R = (ft_iocp_conn_t *) C->iocp;
+	if (R == NULL) return;
+	/* the kernel still writes to the WSAOVERLAPPED of an operation that did not complete */
+	if (!R->busy) free(R);
+	C->iocp = NULL;
+}
+
+/* close the connection, or cancel the operation in flight and close it once that completes */
+void _iocp_close(ft_buffer_loop_t *L, ft_buffer_conn_t *C) {
+	ft_iocp_conn_t *R = (ft_iocp_conn_t *) C->iocp;
+	if (R->closing) return;
+	R->closing = 1;
+	if (!R->busy) {
+		_loop_close_conn(L, C);
+	} else {
+		/* the operation was started by this thread, so CancelIo aborts it */
+		CancelIo((HANDLE) C->sock);
+	}
+}
+
+/* start the read or write that follows from the state of the connection */
+void _iocp_arm(ft_buffer_loop_t *L, ft_buffer_conn_t *C) {
+	ft_iocp_conn_t *R = (ft_iocp_conn_t *) C->iocp;
+	DWORD flags = 0;
+	int res, nbuf = 1;
+
+	if (R->busy || R->closing || C->state >= 4) return;
+	memset(&R->ov, 0, sizeof(R->ov));
+	R->buf[0].buf = C->curPtr + C->bytesDone;
+	R->buf[0].len = C->bytesTotal - C->bytesDone;
+
+	if (C->state < 2) {
+		R->op = IOCP_RECV;
+		res = WSARecv(C->sock, R->buf, 1, NULL, &flags, &R->ov, NULL);
+	} else {
+		if (C->state == 2 && C->respBufSize > 0) {
+			R->buf[1].buf = (char *) C->response->buf;
+			R->buf[1].len = C->respBufSize;
+			nbuf = 2;
+		}
+		R->op = IOCP_SEND;
+		res = WSASend(C->sock, R->buf, nbuf, NULL, 0, &R->ov, NULL);
+	}
+	/* the completion is queued also if the operation completes right away */
+	if (res == SOCKET_ERROR && WSAGetLastError() != WSA_IO_PENDING) {
+		if (C->server->verbosity>0) {
+			printf("Socket error %d -- closing client connection\n", WSAGetLastError());
+		}
+		_loop_close_conn(L, C);
+		return;
+	}
+	R->busy = 1;
+}
+
+/* continue the state machine of a connection once its operation has completed */
+void _iocp_complete(ft_buffer_loop_t *L, ft_buffer_conn_t *C, BOOL ok, DWORD bytes) {
+	ft_iocp_conn_t *R = (ft_iocp_conn_t *) C->iocp;
+	int ret;
+
+	R->busy = 0;
+	if (R->closing) {
+		_loop_close_conn(L, C);
+		return;
+	}
+	if (!ok || bytes == 0) {
+		if (R->op != IOCP_RECV) {
+			fprintf(stderr, "Cannot write to socket -- closing client connection.\n");
+		} else if (C->server->verbosity>0) {
+			printf("Remote side closed client connection\n");
+		}
+		_loop_close_conn(L, C);
+		return;
+	}
+
+	if (R->op == IOCP_RECV) {
+		ret = _conn_received(C, (int) bytes, 1);
+	} else {
+		ret = _conn_sent(C, (int) bytes);
+	}
+	if (ret < 0) {
+		_loop_close_conn(L, C);
+		return;
+	}
+	if (C->state == 4) {
+		L->numParked++;
+		_loop_park(L, C);
+		return;
+	}
+	_iocp_arm(L, C);
+}
+
+/* handle the completions that are ready, waiting at most timeout ms for the first one */
+void _iocp_reap(ft_buffer_loop_t *L, int timeout) {
+	ft_iocp_event_t events[POLLER_EVENTS];
+	int i, n, pass;
+
+	for (n=0; n<POLLER_EVENTS; n++) {
+		ft_iocp_event_t *E = &events[n];
+		E->ov = NULL;
+		E->ok = GetQueuedCompletionStatus(L->iocp, &E->bytes, &E->key, &E->ov, n > 0 ? 0 : timeout < 0 ? INFINITE : (DWORD) timeout);
+		/* a failed operation also gives a completion, but without one nothing was dequeued */
+		if (!E->ok && E->ov == NULL) break;
+	}
+
+	/* the writer is served in the first pass, as in _buffer_event_loop_func */
+	for (pass=0; pass<2; pass++) {
+		for (i=0; i<n; i++) {
+			ft_iocp_event_t *E = &events[i];
+
+			if (E->key == 0) continue;
+			if (E->key == IOCP_WAKEUP) {
+				if (pass == 0) continue;
+				/* a connection that was handed over, or NULL to just wake us up */
+				if (E->ov != NULL) _loop_add_conn(L, (ft_buffer_conn_t *) E->ov);
 			} else {
-				curPtr = (char *) response->def;
-				bytesDone = 0;
-				bytesTotal = sizeof(messagedef_t);
-				state = 2;
+				ft_buffer_conn_t *C = (ft_buffer_conn_t *) E->key;
+				if (pass == 0 && C->qos.qosclass != FT_QOS_WRITER) continue;
+				_iocp_complete(L, C, E->ok, E->bytes);
 			}
-			canWrite = 1;
+			/* this completion has been dealt with */
+			E->key = 0;
 		}
-		
-		if (state >= 2 && canWrite) {
-			n = send(sock, curPtr + bytesDone, bytesTotal - bytesDone, 0);
-			if (n<=0) {
-				/* socket was closed */
-				fprintf(stderr, "Cannot write to socket -- closing client connection.\n");
-				break;
+	}
+}
+
+/***********************************************************************
+ * this thread accepts the connections of a server with IOCP loops, and
+ * distributes them over the loops
+ ***********************************************************************/
+void *_buffer_iocp_accept_func(void *arg) {
+	ft_buffer_server_t *SC = (ft_buffer_server_t *) arg;
+	unsigned int next = 0;
+
+	while (SC->keepRunning) {
+		SOCKET c;
+		fd_set readSet;
+		struct sockaddr_in sa;
+		socklen_t size_sa = sizeof(sa);
+		struct timeval tv = {0,10000};	/* 10 ms for select timeout */
+		ft_buffer_conn_t *C;
+		int merge;
+
+		FD_ZERO(&readSet);
+		FD_SET(SC->serverSocket, &readSet);
+		if (select((int) SC->serverSocket + 1, &readSet, NULL, NULL, &tv) <= 0) continue;
+
+		c = accept(SC->serverSocket, (struct sockaddr *)&sa, &size_sa);
+		if (c == INVALID_SOCKET) {
+			perror("buffer_server, accept");
+			continue;
+		}
+		/* enable packet merging only if it's not localhost */
+		merge = (sa.sin_addr.s_addr == htonl(INADDR_LOOPBACK)) ? 0 : 1;
+
+		C = (ft_buffer_conn_t *) malloc(sizeof(ft_buffer_conn_t));
+		if (C==NULL) {
+			fprintf(stderr, "Out of memory\n");
+			closesocket(c);
+			continue;
+		}
+		_conn_init(C, SC, c, merge);
+
+		pthread_mutex_lock(&SC->lock);
+		SC->numClients++;
+		pthread_mutex_unlock(&SC->lock);
+
+		if (SC->verbosity > 0) {
+			printf("Accepted new client connection with packet merging = %i\n", merge);
+		}
+
+		/* distribute the connections round-robin over the loops */
+		if (_loop_wakeup(&SC->loops[(next++) % SC->numLoops], C) != 0) {
+			fprintf(stderr, "buffer_event_loop: could not hand over the connection\n");
+			pthread_mutex_lock(&SC->lock);
+			SC->numClients--;
+			pthread_mutex_unlock(&SC->lock);
+			_conn_cleanup(C);
+			free(C);
+		}
+	}
+	return NULL;
+}
+
+/***********************************************************************
+ * this thread runs an event loop on Windows
+ ***********************************************************************/
+void *_buffer_iocp_loop_func(void *arg) {
+	ft_buffer_loop_t *L = (ft_buffer_loop_t *) arg;
+	ft_buffer_server_t *SC = L->server;
+	ft_buffer_conn_t *C, *N;
+	int i;
+
+	while (SC->keepRunning) {
+		_iocp_reap(L, _loop_timeout(L));
+		if (SC->pool != NULL) _loop_collect(L);
+		if (L->numParked > 0) _loop_check_parked(L);
+		if (ft_qos_active()) _loop_check_qos(L);
+	}
+
+	/* close all remaining connections, this has to wait for the operations in flight */
+	for (C = L->conns; C != NULL; C = N) {
+		N = C->next;
+		_iocp_close(L, C);
+	}
+	for (i=0; i<IOCP_DRAIN_TRIES && L->conns != NULL; i++) {
+		_iocp_reap(L, 10);
+	}
+	while (L->conns != NULL) _loop_close_conn(L, L->conns);
+	return NULL;
+}
+
+#endif /* USE_IOCP */
+
+void _stop_event_loops(ft_buffer_server_t *SC, int numRunning);
+
+/* release the poll set or ring of a loop */
+void _loop_release(ft_buffer_loop_t *L) {
+#ifdef USE_IOCP
+	if (L->iocp != NULL) CloseHandle(L->iocp);
+	L->iocp = NULL;
+#else
+	if (L->pollfd >= 0) close(L->pollfd);
+#endif
+	L->pollfd = -1;
+#ifdef USE_URING
+	_uring_destroy(L->uring);
+	L->uring = NULL;
+#endif
+}
+
+/* set up the loops of server SC, returns 0 on success */
+int _start_event_loops(ft_buffer_server_t *SC, int numLoops) {
+	int i, optval;
+
+	SC->loops = (ft_buffer_loop_t *) calloc(numLoops, sizeof(ft_buffer_loop_t));
+	if (SC->loops == NULL) return -1;
+	SC->numLoops = 0;
+
+	for (i=0; i<numLoops; i++) {
+		ft_buffer_loop_t *L = &SC->loops[i];
+
+		L->server = SC;
+		L->pollfd = -1;
+#ifdef USE_URING
+		if (SC->mode == FT_SERVER_URING) {
+			L->uring = _uring_create(SC);
+			if (L->uring == NULL && i > 0) goto error;
+			if (L->uring == NULL) {
+				fprintf(stderr, "ft_start_buffer_server: io_uring not available, using epoll\n");
+				SC->mode = FT_SERVER_EVENTLOOP;
 			}
-			bytesDone+=n;
-			if (bytesDone < bytesTotal) continue;
-			if (state==2 && respBufSize > 0) {
-				curPtr = (char *) response->buf;
-				bytesDone = 0;
-				bytesTotal = respBufSize;
-				state = 3;
-				continue;
+		}
+#else
+		if (SC->mode == FT_SERVER_URING) {
+			fprintf(stderr, "ft_start_buffer_server: io_uring not supported on this platform, using the event loop\n");
+			SC->mode = FT_SERVER_EVENTLOOP;
+		}
+#endif
+#ifdef USE_IOCP
+		L->iocp = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+		if (L->iocp == NULL) {
+			fprintf(stderr, "ft_start_buffer_server: could not create I/O completion port\n");
+			goto error;
+		}
+#else
+		if (SC->mode == FT_SERVER_EVENTLOOP) {
+			L->pollfd = _poller_create();
+			if (L->pollfd < 0) {
+				perror("ft_start_buffer_server, poller");
+				goto error;
 			}
-			/* Reaching this point means we are done with writing out the response,
-			   so we will now free the allocated memory, and reset to state=0.
-			*/
-			if (response->buf) free(response->buf);
-			free(response->def);
-			free(response);
-			response = NULL;
-			state = 0;
-			curPtr = (char *) request.def;
-			bytesDone = 0;
-			bytesTotal = sizeof(messagedef_t);
 		}
+		if (pipe(L->wakeup) < 0) {
+			perror("ft_start_buffer_server, pipe");
+			_loop_release(L);
+			goto error;
+		}
+		optval = fcntl(L->wakeup[0], F_GETFL, NULL);
+		fcntl(L->wakeup[0], F_SETFL, optval | O_NONBLOCK);
+		optval = fcntl(L->wakeup[1], F_GETFL, NULL);
+		fcntl(L->wakeup[1], F_SETFL, optval | O_NONBLOCK);
+
+		/* in FT_SERVER_URING mode, the loop thread queues the polls on these itself */
+		if (L->pollfd >= 0 && (_poller_set(L, L->wakeup[0], &_marker_wakeup, POLLER_READ, 1) < 0 ||
+				(i==0 && _poller_set(L, SC->serverSocket, &_marker_listen, POLLER_READ, 1) < 0))) {
+			perror("ft_start_buffer_server, poller");
+			close(L->wakeup[0]);
+			close(L->wakeup[1]);
+			_loop_release(L);
+			goto error;
+		}
+#endif
+		pthread_mutex_init(&L->doneLock, NULL);
+		SC->numLoops++;
 	}
-	
-    pthread_mutex_lock(&SC->lock);
-    SC->numClients--;
-    pthread_mutex_unlock(&SC->lock);
-	
-	closesocket(sock);
-	if (request.buf!=NULL) free(request.buf);
-    if (response!=NULL) {
-		if (response->buf!=NULL) free(response->buf);
-		if (response->def!=NULL) free(response->def);
-		free(response);
+
+	for (i=0; i<SC->numLoops; i++) {
+#ifdef USE_IOCP
+		void *(*func)(void *) = _buffer_iocp_loop_func;
+#else
+		void *(*func)(void *) = _buffer_event_loop_func;
+#endif
+#ifdef USE_URING
+		if (SC->mode == FT_SERVER_URING) func = _buffer_uring_loop_func;
+#endif
+		if (pthread_create(&SC->loops[i].threadID, NULL, func, &SC->loops[i]) != 0) {
+			fprintf(stderr, "ft_start_buffer_server: could not spawn event loop thread\n");
+			_stop_pool(SC);
+			SC->keepRunning = 0;
+			_stop_event_loops(SC, i);
+			return -1;
+		}
 	}
-	
-	return NULL;
+#ifdef USE_IOCP
+	/* the loops do not accept connections themselves, see _buffer_iocp_accept_func */
+	if (pthread_create(&SC->threadID, NULL, _buffer_iocp_accept_func, SC) != 0) {
+		fprintf(stderr, "ft_start_buffer_server: could not spawn thread for accepting connections\n");
+		_stop_pool(SC);
+		SC->keepRunning = 0;
+		_stop_event_loops(SC, SC->numLoops);
+		return -1;
+	}
+#endif
+	return 0;
+
+error:
+	_stop_event_loops(SC, 0);
+	return -1;
 }
 
+/* stops the first numRunning loops, and releases the resources of all loops */
+void _stop_event_loops(ft_buffer_server_t *SC, int numRunning) {
+	int i;
+	for (i=0; i<SC->numLoops; i++) {
+		ft_buffer_loop_t *L = &SC->loops[i];
+		if (i < numRunning) {
+			if (_loop_wakeup(L, NULL) != 0) {
+				perror("ft_stop_buffer_server, wakeup");
+			}
+			pthread_join(L->threadID, NULL);
+		}
+		_loop_release(L);
+#ifndef USE_IOCP
+		close(L->wakeup[0]);
+		close(L->wakeup[1]);
+#endif
+		pthread_mutex_destroy(&L->doneLock);
+	}
+	free(SC->loops);
+	SC->loops = NULL;
+	SC->numLoops = 0;
+}
 
+#endif /* USE_EVENTLOOP */
 
 /***********************************************************************
  * this thread listens to incoming TCP/UNIX domain socket connections
@@ -339,6 +2150,14 @@ void *_buffer_server_func(void *arg) {
 
 
 ft_buffer_server_t *ft_start_buffer_server(int port, const char *name, ft_request_callback_t callback, void *user_data) {
+	return ft_start_buffer_server_mode(port, name, callback, user_data, FT_SERVER_THREADED, 1);
+}
+
+ft_buffer_server_t *ft_start_buffer_server_mode(int port, const char *name, ft_request_callback_t callback, void *user_data, int mode, int numThreads) {
+	return ft_start_buffer_server_pool(port, name, callback, user_data, mode, numThreads, 0);
+}
+
+ft_buffer_server_t *ft_start_buffer_server_pool(int port, const char *name, ft_request_callback_t callback, void *user_data, int mode, int numThreads, int numWorkers) {
 	ft_buffer_server_t *SC;
 	int optval;
 	SOCKET s = INVALID_SOCKET;
@@ -348,6 +2167,21 @@ ft_buffer_server_t *ft_start_buffer_server(int port, const char *name, ft_reques
 	
 	SC->callback = callback;
 	SC->user_data = user_data;
+	SC->numLoops = 0;
+	SC->loops = NULL;
+	SC->pool = NULL;
+
+#ifdef USE_EVENTLOOP
+	SC->mode = mode;
+	if (numThreads < 1) numThreads = 1;
+	if (numThreads > FT_EVENTLOOP_MAXTHREADS) numThreads = FT_EVENTLOOP_MAXTHREADS;
+	if (numWorkers > FT_WORKERS_MAXTHREADS) numWorkers = FT_WORKERS_MAXTHREADS;
+#else
+	if (mode != FT_SERVER_THREADED) {
+		fprintf(stderr, "ft_start_buffer_server: event loop not supported on this platform, using one thread per client\n");
+	}
+	SC->mode = FT_SERVER_THREADED;
+#endif
 
 #ifdef WIN32
 	{
@@ -381,7 +2215,7 @@ ft_buffer_server_t *ft_start_buffer_server(int port, const char *name, ft_reques
 			perror("ft_start_buffer_server, bind");
 			goto cleanup;
 		}
-		SC->isUnixDomain = 0;
+		SC->isUnixDomain = 1;
 #endif
 	} else {
 		/* TCP socket */
@@ -442,6 +2276,18 @@ ft_buffer_server_t *ft_start_buffer_server(int port, const char *name, ft_reques
 		goto cleanup;
 	}
 	
+#ifdef USE_EVENTLOOP
+	if (SC->mode != FT_SERVER_THREADED) {
+		if ((numWorkers <= 0 || _start_pool(SC, numWorkers) == 0) && _start_event_loops(SC, numThreads) == 0) {
+			/* everything went fine - event loops should be running now */
+			return SC;
+		}
+		_release_pool(SC);
+		pthread_mutex_destroy(&SC->lock);
+		goto cleanup;
+	}
+#endif
+
 	/* create thread with default attributes */
 	if (pthread_create(&SC->threadID, NULL, _buffer_server_func, SC) == 0) {
 		/* everything went fine - thread should be running now */
@@ -467,8 +2313,55 @@ cleanup:
 void ft_stop_buffer_server(ft_buffer_server_t *S) {
 	if (S==NULL) return;
 	
+#ifdef USE_EVENTLOOP
+	if (S->mode != FT_SERVER_THREADED) {
+		/* the workers may use the connections until they are stopped */
+		_stop_pool(S);
+		S->keepRunning = 0;
+#ifdef USE_IOCP
+		/* no more connections are handed over to the loops once this has stopped */
+		pthread_join(S->threadID, NULL);
+#endif
+		/* the loops close their client connections before they exit */
+		_stop_event_loops(S, S->numLoops);
+		_release_pool(S);
+		closesocket(S->serverSocket);
+		pthread_mutex_destroy(&S->lock);
+		free(S);
+		return;
+	}
+#endif
 	S->keepRunning = 0;
 	pthread_join(S->threadID, NULL);
 	pthread_detach(S->threadID);
+	/* release the port, so that a server can be started on it again */
+	closesocket(S->serverSocket);
+	pthread_mutex_destroy(&S->lock);
 	free(S);
 }
+
+int ft_open_buffer(const char *hostname, int port, ft_buffer_server_t **server) {
+	int ftSocket;
+
+	*server = NULL;
+	if (strcmp(hostname, "-") == 0) {
+		*server = ft_start_buffer_server(port, NULL, NULL, NULL);
+		if (*server == NULL) {
+			fprintf(stderr, "Could not start up a FieldTrip buffer serving at port %i\n", port);
+			return -1;
+		}
+		return 0; /* dma */
+	}
+
+	ftSocket = open_connection(hostname, port);
+	if (ftSocket < 0) {
+		fprintf(stderr, "Could not connect to FieldTrip buffer at %s:%i\n", hostname, port);
+		return -1;
+	}
+	return ftSocket;
+}
+
+void ft_close_buffer(int ftSocket, ft_buffer_server_t *server) {
+	if (ftSocket > 0) close_connection(ftSocket);
+	ft_stop_buffer_server(server);
+}
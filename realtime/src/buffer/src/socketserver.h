@@ -11,7 +11,7 @@
 #include <pthread.h>
 #include "buffer.h"
 
-#define MERGE_THRESHOLD 4096    /* TODO: optimize this value? Maybe look at MTU size */
+#define MERGE_THRESHOLD 4096    /* only used where writev is not available, see _conn_start_response */
 
 #ifdef __cplusplus
 extern "C" {
@@ -27,6 +27,18 @@ typedef int socklen_t;
 
 typedef int (*ft_request_callback_t)(const message_t *request, message_t **response, void *user_data);
 
+/** Server modes that can be passed to ft_start_buffer_server_mode */
+#define FT_SERVER_THREADED   0  /**< one thread per client connection (default) */
+#define FT_SERVER_EVENTLOOP  1  /**< a few I/O threads multiplex all client connections using epoll, kqueue or an I/O completion port */
+#define FT_SERVER_URING      2  /**< like FT_SERVER_EVENTLOOP, but the I/O is submitted to io_uring (Linux 5.11 or later) */
+
+#define FT_EVENTLOOP_MAXTHREADS 16
+#define FT_WORKERS_MAXTHREADS   64
+#define FT_WORKERS_QUEUE        256  /* requests that can wait for a worker, further requests are handled by the event loop itself */
+
+struct ft_buffer_loop;
+struct ft_buffer_pool;
+
 /** The following structure is used for managing a server. The structure is
     allocated and filled in ft_start_buffer_server and then passed on to the
     actual server thread, as well as to all threads handling the client 
@@ -44,6 +56,10 @@ typedef struct {
         pthread_mutex_t lock;           /**< Mutex to protect the "numClients" member, commonly used by all threads */
         ft_request_callback_t callback; /**< Callback function to be called *instead* of dmarequest */
         void *user_data;                /**< Pointer to user-defined data structure, passed on to callback */
+        int mode;                       /**< FT_SERVER_THREADED, FT_SERVER_EVENTLOOP or FT_SERVER_URING */
+        int numLoops;                   /**< Number of I/O threads in FT_SERVER_EVENTLOOP mode */
+        struct ft_buffer_loop *loops;   /**< Array of numLoops event loops, the first one also accepts new connections */
+        struct ft_buffer_pool *pool;    /**< Workers that handle the requests for the event loops, or NULL */
 } ft_buffer_server_t;
 
 /** Small helper structure that is passed to client threads. Get's allocated
@@ -56,6 +72,45 @@ typedef struct {
         int mergePackets;               /**< 1: merge packets if total size below threshold, 0: never merge (=>local host) */
 } ft_buffer_socket_t;
 
+/** State of a single client connection, see the description of the state
+        machine in socketserver.c. This lives on the stack of the client thread
+        in FT_SERVER_THREADED mode, or is allocated by the event loop that
+        serves the connection in FT_SERVER_EVENTLOOP mode.
+*/
+typedef struct ft_buffer_conn {
+        ft_buffer_server_t *server;     /**< Pointer to the common control structure */
+        SOCKET sock;                    /**< The client socket */
+        int mergePackets;               /**< 1: merge packets if total size below threshold, 0: never merge */
+        int state;                      /**< 0 = reading def, 1=reading buf, 2=writing def, 3=writing buf, 4=parked WAIT_DAT, 5=held back by the rate limit, 6=handled by a worker */
+        int bytesDone;                  /**< Number of bytes read/written within the current state */
+        int bytesTotal;                 /**< Number of bytes to read/write within the current state */
+        char *curPtr;                   /**< Points at buffer that needs to be filled or written out */
+        int swap;                       /**< 1: the remote side has the other endianness */
+        int swapData;                   /**< 1: the samples of the current PUT_DAT request still need to be swapped */
+        UINT32_T codecs;                /**< Codecs that were negotiated with GET_CODEC, see compress.h */
+        UINT16_T reqCommand;            /**< Command of the current request (before swapping) */
+        UINT32_T respBufSize;           /**< Size of the current response->buf (in native endianness) */
+        messagedef_t reqdef;            /**< Definition of the current request */
+        message_t request;              /**< The current request, request.def points to reqdef */
+        message_t *response;            /**< The response that is being written out */
+        samples_events_t waitThreshold; /**< Threshold of a parked WAIT_DAT request */
+        double waitDeadline;            /**< Time at which a parked WAIT_DAT request times out */
+        waiter_t *waitHandle;           /**< Registration of a parked WAIT_DAT request with dmarequest, or NULL */
+        volatile int waitNotified;      /**< Set by dmarequest once the threshold of the parked request was exceeded */
+        UINT64_T requestTime;           /**< Time at which the current request was read completely, see bufstats.h */
+        ft_qos_conn_t qos;              /**< Service class and rate limit of this connection, see qos.h */
+        ft_msgpool_t pool;              /**< Spare messages and buffers for the next request, see msgpool.h */
+        double lastProgress;            /**< Time at which the response was last written to, for the stall timeout */
+        double resumeTime;              /**< Time at which a connection in state 5 may read its next request */
+        struct ft_buffer_loop *loop;    /**< Event loop that serves this connection, or NULL */
+        void *uring;                    /**< State of the connection in FT_SERVER_URING mode, or NULL */
+        void *iocp;                     /**< State of the connection with the I/O completion port on Windows, or NULL */
+        struct ft_buffer_conn *next;    /**< Next connection served by the same event loop */
+        struct ft_buffer_conn *done;    /**< Next connection of which a worker has handled the request */
+        int workResult;                 /**< Result of _conn_handle_request in the worker */
+        char mergeBuffer[MERGE_THRESHOLD];
+} ft_buffer_conn_t;
+
 /** Creates a server socket, binds it to the specified UNIX domain name or port,
         starts listening on this socket, and spawns a background thread to serve
         requests on this socket.
@@ -72,11 +127,57 @@ typedef struct {
 */      
 ft_buffer_server_t *ft_start_buffer_server(int port, const char *name, ft_request_callback_t callback, void *user_data);
 
+/** Same as ft_start_buffer_server, but lets you select the server MODE. With
+        mode=FT_SERVER_EVENTLOOP, all client connections are multiplexed over
+        NUMTHREADS I/O threads (epoll on Linux, kqueue on OSX/BSD) instead of
+        spawning one thread per client. Blocking WAIT_DAT requests are parked
+        by the event loop, and are re-evaluated without blocking other clients
+        once dmarequest signals that their threshold has been exceeded (or
+        periodically, if a user-defined callback is used).
+        On Windows, the event loops wait on an I/O completion port, and the
+        reads and writes are overlapped WSARecv and WSASend calls.
+        On platforms without epoll, kqueue or completion ports, this falls back
+        to FT_SERVER_THREADED.
+        With mode=FT_SERVER_URING, the event loops hand the reads and writes to
+        io_uring, so that many requests cost a single system call. This falls
+        back to FT_SERVER_EVENTLOOP if the kernel does not support io_uring.
+*/
+ft_buffer_server_t *ft_start_buffer_server_mode(int port, const char *name, ft_request_callback_t callback, void *user_data, int mode, int numThreads);
+
+/** Same as ft_start_buffer_server_mode, but in FT_SERVER_EVENTLOOP and
+        FT_SERVER_URING mode the requests are handled by NUMWORKERS separate
+        threads, so that a slow callback (or a slow dmarequest) does not hold
+        up the other connections of the same event loop. The I/O threads still
+        read the requests and write the responses, and a connection does not
+        read its next request before the response to the previous one has been
+        written, so that the requests of a connection are handled in order.
+        At most FT_WORKERS_QUEUE requests wait for a worker, if the queue is
+        full the event loop handles the request itself. The depth of the queue
+        is reported by GET_STATS. With numWorkers=0, or in FT_SERVER_THREADED
+        mode, where every connection has its own thread anyway, this is the
+        same as ft_start_buffer_server_mode.
+*/
+ft_buffer_server_t *ft_start_buffer_server_pool(int port, const char *name, ft_request_callback_t callback, void *user_data, int mode, int numThreads, int numWorkers);
+
 /** Stops background thread(s), closes the sockets, and disposes the control structure S.
         S cannot be used anymore after this call. 
 */
 void ft_stop_buffer_server(ft_buffer_server_t *S);
 
+/** Opens the buffer that an acquisition driver writes to. If HOSTNAME is a minus (-),
+        a buffer server is started in this process on PORT, and 0 is returned. Requests
+        to socket 0 go to dmarequest directly (see clientrequest), so the samples go
+        straight into the ring, while other clients connect to PORT over TCP as usual.
+        Otherwise a TCP connection to HOSTNAME:PORT is opened.
+
+        *SERVER receives the embedded server, or NULL for a TCP connection.
+        Returns the socket for clientrequest, or -1 in case of errors.
+*/
+int ft_open_buffer(const char *hostname, int port, ft_buffer_server_t **server);
+
+/** Closes what ft_open_buffer opened, the connection or the embedded server */
+void ft_close_buffer(int ftSocket, ft_buffer_server_t *server);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ * Disk-backed copy of the sample ring, see spillfile.h
+ */
+
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "buffer.h"
+#include "spillfile.h"
+
+#ifndef PLATFORM_WINDOWS
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+/* the mapping is extended by at least this many bytes at a time */
+#define SPILL_MAPSTEP  ((size_t) 64*1024*1024)
+
+struct ft_spill_s {
+	int fd;
+	UINT32_T rowsize;       /* number of bytes per sample */
+	UINT32_T firstsample;   /* sample that is stored at the start of the file */
+	UINT32_T nsamples;      /* number of samples that have been written */
+	char  *map;             /* read-only mapping of the file, or NULL */
+	size_t mapsize;
+	int    nomap;           /* set if the file could not be mapped, it is then read with pread */
+	pthread_rwlock_t maplock;  /* protects the fields above, readers hold it while copying */
+};
+
+ft_spill_t *ft_spill_open(const char *filename) {
+	ft_spill_t *S;
+
+	S = (ft_spill_t *) calloc(1, sizeof(ft_spill_t));
+	if (S == NULL) return NULL;
+	S->fd = open(filename, O_CREAT | O_TRUNC | O_RDWR, S_IRUSR | S_IWUSR);
+	if (S->fd < 0) {
+		perror("ft_spill_open");
+		free(S);
+		return NULL;
+	}
+	pthread_rwlock_init(&S->maplock, NULL);
+	return S;
+}
+
+void ft_spill_close(ft_spill_t *S) {
+	if (S == NULL) return;
+	if (S->map != NULL) munmap(S->map, S->mapsize);
+	close(S->fd);
+	pthread_rwlock_destroy(&S->maplock);
+	free(S);
+}
+
+/* empties the file, the next sample that is written should be firstsample */
+int ft_spill_truncate(ft_spill_t *S, UINT32_T rowsize, UINT32_T firstsample) {
+	int result = 0;
+
+	pthread_rwlock_wrlock(&S->maplock);
+	if (S->map != NULL) munmap(S->map, S->mapsize);
+	S->map = NULL;
+	S->mapsize = 0;
+	S->nomap = 0;
+	S->rowsize = rowsize;
+	S->firstsample = firstsample;
+	S->nsamples = 0;
+	if (ftruncate(S->fd, 0) != 0) {
+		perror("ft_spill_truncate");
+		result = -1;
+	}
+	pthread_rwlock_unlock(&S->maplock);
+	return result;
+}
+
+/* appends the samples to the file, begsample should follow the samples that were written before */
+int ft_spill_write(ft_spill_t *S, UINT32_T begsample, const void *buf, UINT32_T nsamples) {
+	const char *ptr = (const char *) buf;
+	size_t remaining = (size_t) nsamples * S->rowsize;
+	off_t offset;
+	size_t size;
+
+	if (begsample != S->firstsample + S->nsamples) return -1;
+
+	/* this is done without any lock, the readers only look at the samples that have been published */
+	offset = (off_t) (begsample - S->firstsample) * S->rowsize;
+	while (remaining > 0) {
+		ssize_t n = pwrite(S->fd, ptr, remaining, offset);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			perror("ft_spill_write");
+			return -1;
+		}
+		ptr       += n;
+		offset    += n;
+		remaining -= n;
+	}
+
+	size = (size_t) (S->nsamples + nsamples) * S->rowsize;
+
+	pthread_rwlock_wrlock(&S->maplock);
+	if (size > S->mapsize && !S->nomap) {
+		/* the mapping may extend beyond the end of the file, these pages are never read */
+		size_t mapsize = S->mapsize + ((S->mapsize > SPILL_MAPSTEP) ? S->mapsize : SPILL_MAPSTEP);
+		if (mapsize < size) mapsize = size;
+		if (S->map != NULL) munmap(S->map, S->mapsize);
+		S->map = (char *) mmap(NULL, mapsize, PROT_READ, MAP_SHARED, S->fd, 0);
+		if (S->map == MAP_FAILED) {
+			S->map = NULL;
+			S->mapsize = 0;
+			S->nomap = 1;
+		}
+		else {
+			S->mapsize = mapsize;
+		}
+	}
+	S->nsamples += nsamples;
+	pthread_rwlock_unlock(&S->maplock);
+	return 0;
+}
+
+/* copies samples that have been written before, returns -1 if they are not in the file */
+int ft_spill_read(ft_spill_t *S, UINT32_T begsample, void *buf, UINT32_T nsamples) {
+	int result = 0;
+
+	pthread_rwlock_rdlock(&S->maplock);
+	if (begsample < S->firstsample || begsample - S->firstsample > S->nsamples || nsamples > S->nsamples - (begsample - S->firstsample)) {
+		result = -1;
+	}
+	else if (S->map != NULL) {
+		memcpy(buf, S->map + (size_t) (begsample - S->firstsample) * S->rowsize, (size_t) nsamples * S->rowsize);
+	}
+	else {
+		char *ptr = (char *) buf;
+		size_t remaining = (size_t) nsamples * S->rowsize;
+		off_t offset = (off_t) (begsample - S->firstsample) * S->rowsize;
+		while (remaining > 0) {
+			ssize_t n = pread(S->fd, ptr, remaining, offset);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) {
+				result = -1;
+				break;
+			}
+			ptr       += n;
+			offset    += n;
+			remaining -= n;
+		}
+	}
+	pthread_rwlock_unlock(&S->maplock);
+	return result;
+}
+
+#else /* PLATFORM_WINDOWS */
+
+/* memory mapped files are not supported here, the ring can not be spilled to disk */
+
+ft_spill_t *ft_spill_open(const char *filename) {
+	fprintf(stderr, "ft_spill_open: spill files are not supported on this platform\n");
+	return NULL;
+}
+
+void ft_spill_close(ft_spill_t *S) {}
+int ft_spill_truncate(ft_spill_t *S, UINT32_T rowsize, UINT32_T firstsample) { return -1; }
+int ft_spill_write(ft_spill_t *S, UINT32_T begsample, const void *buf, UINT32_T nsamples) { return -1; }
+int ft_spill_read(ft_spill_t *S, UINT32_T begsample, void *buf, UINT32_T nsamples) { return -1; }
+
+#endif
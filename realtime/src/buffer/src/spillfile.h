@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+
+#ifndef SPILLFILE_H
+#define SPILLFILE_H
+
+#include "message.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  The spill file keeps a copy of the samples that have been written to the
+  sample ring, so that GET_DAT can still return them after they have been
+  overwritten in memory. The samples are stored as they are in the ring, one
+  row of nchans values per sample, starting at the sample that was given to
+  ft_spill_truncate. See enable_spill_file in dmarequest.c for the thread
+  that writes them.
+
+  There is a single writer, which calls ft_spill_truncate and ft_spill_write.
+  Other threads can call ft_spill_read at the same time, but should only ask
+  for samples that have already been written. The file is read through a
+  read-only memory mapping, which is extended as the file grows. If the file
+  can not be mapped (e.g. on a 32-bit system), it is read with pread.
+*/
+
+typedef struct ft_spill_s ft_spill_t;
+
+ft_spill_t *ft_spill_open(const char *filename);
+void ft_spill_close(ft_spill_t *S);
+int ft_spill_truncate(ft_spill_t *S, UINT32_T rowsize, UINT32_T firstsample);
+int ft_spill_write(ft_spill_t *S, UINT32_T begsample, const void *buf, UINT32_T nsamples);
+int ft_spill_read(ft_spill_t *S, UINT32_T begsample, void *buf, UINT32_T nsamples);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SPILLFILE_H */
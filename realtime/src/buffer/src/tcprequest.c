@@ -7,9 +7,37 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "buffer.h"
 
-#define MERGE_THRESHOLD 4096 /* TODO: optimize this value? Maybe look at MTU size */
+#define MERGE_THRESHOLD 4096 /* larger requests are written in two pieces, see ft_socket_cork */
+
+/* reads the def and buf of a response, returns 0 on success, -1 on error */
+static int read_response(int server, message_t *response) {
+  unsigned int n;
+
+  /* read the response from the server, first the message definition */
+  if ((n = bufread(server, response->def, sizeof(messagedef_t))) != sizeof(messagedef_t)) {
+    fprintf(stderr, "packet size = %d, should be %lu\n", n, sizeof(messagedef_t));
+    return -1;
+  }
+
+  if (response->def->version!=VERSION) {
+    fprintf(stderr, "incorrect version\n");
+    return -1;
+  }
+
+  /* read the response from the server, then the message payload */
+  if (response->def->bufsize>0) {
+    response->buf = malloc(response->def->bufsize);
+    ft_socket_fit(server, SO_RCVBUF, response->def->bufsize);
+    if ((n = bufread(server, response->buf, response->def->bufsize)) != response->def->bufsize) {
+      fprintf(stderr, "read size = %d, should be %d\n", n, response->def->bufsize);
+      return -1;
+    }
+  }
+  return 0;
+}
 
 /*******************************************************************************
  * communicate with the buffer through TCP
@@ -52,10 +80,12 @@ int tcprequest(int server, const message_t *request, message_t **response_ptr) {
       goto cleanup;
     }
   }
-  /* Otherwise, send "def" and "buf" in separate pieces. This might introduce latencies
-     if the other end runs Windows :-(
+  /* Otherwise, send "def" and "buf" in separate pieces. Where possible, the socket
+     is corked so that "def" does not go out as a separate small packet.
    */
      else {
+       ft_socket_fit(server, SO_SNDBUF, request->def->bufsize);
+       ft_socket_cork(server, 1);
        /* send the request to the server, first the message definition */
        /* FIXME: bufwrite expects unsigned int, gets size_t. Similar for return. */
        if ((n = bufwrite(server, request->def, sizeof(messagedef_t)))!=sizeof(messagedef_t)) {
@@ -68,27 +98,11 @@ int tcprequest(int server, const message_t *request, message_t **response_ptr) {
          fprintf(stderr, "write size = %d, should be %u\n", n, request->def->bufsize);
          goto cleanup;
        }
+       ft_socket_cork(server, 0);
      }
 
-     /* read the response from the server, first the message definition */
-     if ((n = bufread(server, response->def, sizeof(messagedef_t))) != sizeof(messagedef_t)) {
-       fprintf(stderr, "packet size = %d, should be %lu\n", n, sizeof(messagedef_t));
-       goto cleanup;
-     }
-
-     if (response->def->version!=VERSION) {
-       fprintf(stderr, "incorrect version\n");
+     if (read_response(server, response) != 0)
        goto cleanup;
-     }
-
-     /* read the response from the server, then the message payload */
-     if (response->def->bufsize>0) {
-       response->buf = malloc(response->def->bufsize);
-       if ((n = bufread(server, response->buf, response->def->bufsize)) != response->def->bufsize) {
-         fprintf(stderr, "read size = %d, should be %d\n", n, response->def->bufsize);
-         goto cleanup;
-       }
-     }
 
      /* everything went fine, return with the response */
      /* print_response(response->def); */
@@ -102,3 +116,63 @@ cleanup:
      *response_ptr = NULL;
      return -1;
 }
+
+/*******************************************************************************
+ * like tcprequest, but for a number of requests that are written in one go,
+ * after which the responses are read. The server handles the requests of a
+ * connection in order, so this takes a single round trip. The requests should
+ * be small, e.g. GET_HDR_GEN, GET_EVT or GET_DAT_M, since they are copied to
+ * contiguous memory. On success the nreq responses should be freed by the
+ * calling function, on error none is returned.
+ * returns 0 on success, -1 on error
+ *******************************************************************************/
+int tcprequest_multi(int server, int nreq, const message_t **request, message_t **response) {
+  unsigned int n, total = 0, offset = 0;
+  char *merged;
+  int i;
+
+  /* nothing is sent for no requests, as with direct memory access */
+  if (nreq <= 0)
+    return (nreq == 0) ? 0 : -1;
+
+  for (i=0; i<nreq; i++) {
+    response[i] = NULL;
+    total += sizeof(messagedef_t) + request[i]->def->bufsize;
+  }
+
+  if ((merged = (char *) malloc(total)) == NULL)
+    return -1;
+  for (i=0; i<nreq; i++) {
+    memcpy(merged + offset, request[i]->def, sizeof(messagedef_t));
+    offset += sizeof(messagedef_t);
+    if (request[i]->def->bufsize > 0)
+      memcpy(merged + offset, request[i]->buf, request[i]->def->bufsize);
+    offset += request[i]->def->bufsize;
+  }
+  n = bufwrite(server, merged, total);
+  free(merged);
+  if (n != total) {
+    fprintf(stderr, "write size = %u, should be %u\n", n, total);
+    return -1;
+  }
+
+  for (i=0; i<nreq; i++) {
+    response[i]      = (message_t*)malloc(sizeof(message_t));
+    DIE_BAD_MALLOC(response[i]);
+    response[i]->def = (messagedef_t*)malloc(sizeof(messagedef_t));
+    DIE_BAD_MALLOC(response[i]->def);
+    response[i]->buf = NULL;
+    if (read_response(server, response[i]) != 0)
+      break;
+  }
+  if (i == nreq)
+    return 0;
+
+  /* there was a problem, the connection is out of step and all responses are discarded */
+  for (; i>=0; i--) {
+    FREE(response[i]->def);
+    FREE(response[i]->buf);
+    FREE(response[i]);
+  }
+  return -1;
+}
@@ -18,7 +18,13 @@
 #include "buffer.h"
 #include "extern.h"
 
+#if !defined(PLATFORM_WIN32) && !defined(PLATFORM_WIN64)
+#include <poll.h>
+#include <sys/time.h>
+#endif
+
 #define ACCEPTSLEEP 1000
+#define STOPTIMEOUT 1.0   /* in seconds, tcpserver_stop waits this long for the clients to be disconnected */
 
 typedef struct {
   int fd;
@@ -82,6 +88,16 @@ void *tcpserver(void *arg) {
   pthread_mutex_lock(&mutexstatus);
   if (tcpserverStatus==0) {
     tcpserverStatus = 1;
+#if !defined(PLATFORM_WIN32) && !defined(PLATFORM_WIN64)
+    if (tcpserverWakeup[0]<0 && pipe(tcpserverWakeup)==0) {
+      fcntl(tcpserverWakeup[0], F_SETFL, fcntl(tcpserverWakeup[0], F_GETFL, NULL) | O_NONBLOCK);
+    }
+    else if (tcpserverWakeup[0]>=0) {
+      /* the clients of the previous server did not all stop, the pipe may still be written to */
+      char dummy;
+      while (read(tcpserverWakeup[0], &dummy, 1)==1);
+    }
+#endif
     pthread_mutex_unlock(&mutexstatus);
   }
   else {
@@ -156,6 +172,12 @@ void *tcpserver(void *arg) {
   }
 
   for (;;) {
+#if !defined(PLATFORM_WIN32) && !defined(PLATFORM_WIN64)
+    /* this returns immediately when tcpserver_stop is called */
+    if (tcpserver_wait(s, -1)<0)
+      goto cleanup;
+#endif
+
     /*
      * If no pending connections are present on the queue, and the socket
      * is not marked as non-blocking, accept() blocks the caller until a
@@ -181,9 +203,9 @@ void *tcpserver(void *arg) {
         goto cleanup;
       }
 #else
-      if (errno==EWOULDBLOCK) {
+      if (errno==EWOULDBLOCK || errno==ECONNABORTED) {
+        /* the client went away before the connection was accepted */
         pthread_testcancel();
-        usleep(ACCEPTSLEEP);
       }
       else {
         perror("tcpserver accept");
@@ -208,19 +230,8 @@ void *tcpserver(void *arg) {
       }
 
 
-      /* set larger buffer */
-      optval = SO_RCVBUF_SIZE;
-      if (setsockopt(c, SOL_SOCKET, SO_RCVBUF, (const char*)&optval, sizeof(optval)) < 0) {
-        perror("tcpserver setsockopt");
-        goto cleanup;
-      }
-
-      /* set larger buffer */
-      optval = SO_SNDBUF_SIZE;
-      if (setsockopt(c, SOL_SOCKET, SO_SNDBUF, (const char*)&optval, sizeof(optval)) < 0) {
-        perror("tcpserver setsockopt");
-        goto cleanup;
-      }
+      /* disable the Nagle buffering algorithm, the socket buffers are enlarged by tcpsocket when needed */
+      ft_socket_init(c);
 
       /* place the socket back in blocking mode, this is needed for tcpsocket  */
 #if defined(PLATFORM_WIN32) || defined(PLATFORM_WIN64) 
@@ -235,15 +246,6 @@ void *tcpserver(void *arg) {
       }
 #endif
 
-#ifdef DISABLE_NAGLE
-      /* disable the Nagle buffering algorithm */
-      optval = 1;
-      if (setsockopt(c, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval)) < 0) {
-        perror("tcpserver setsockopt");
-        goto cleanup;
-      }
-#endif
-
       /* deal with the incoming connection on the TCP socket in a seperate thread */
       /* rc = pthread_create(&tid, &attr, tcpsocket, (void *)c); */
       rc = pthread_create(&tid, NULL, tcpsocket, (void *)c);
@@ -268,3 +270,114 @@ cleanup:
   pthread_cleanup_pop(1);
   return NULL;
 }
+
+/***********************************************************************
+ * this waits until the socket can be read, the timeout in seconds has
+ * passed or tcpserver_stop is called, and returns 1, 0 or -1 respectively.
+ * With fd<0 it only waits for the timeout, a negative timeout is infinite.
+ ***********************************************************************/
+int tcpserver_wait(int fd, double timeout) {
+#if defined(PLATFORM_WIN32) || defined(PLATFORM_WIN64)
+  /* the pipe cannot be used in select, the server thread is cancelled and the clients block in recv */
+  if (fd<0 && timeout>0)
+    usleep((unsigned int) (1e6*timeout) + 1);
+  return (fd<0 ? 0 : 1);
+#else
+  struct pollfd fds[2];
+  int n, nfds = 0, wakeup;
+
+  pthread_mutex_lock(&mutexstatus);
+  wakeup = tcpserverWakeup[0];
+  pthread_mutex_unlock(&mutexstatus);
+
+  if (fd>=0) {
+    fds[nfds].fd     = fd;
+    fds[nfds].events = POLLIN;
+    nfds++;
+  }
+  if (wakeup>=0) {
+    fds[nfds].fd     = wakeup;
+    fds[nfds].events = POLLIN;
+    nfds++;
+  }
+
+  while ((n = poll(fds, nfds, timeout<0 ? -1 : (int) (1000*timeout) + 1))<0 && errno==EINTR);
+  if (n<0) {
+    perror("tcpserver poll");
+    return -1;
+  }
+  if (wakeup>=0 && fds[nfds-1].revents)
+    return -1;
+  if (n==0)
+    return 0;
+  /* a closed connection is also readable, the next read detects it */
+  return 1;
+#endif
+}
+
+/***********************************************************************
+ * this wakes up the tcpserver thread and the tcpsocket threads, which
+ * finish the request that they are handling and close the connection,
+ * and the WAIT_DAT requests that are blocking. It returns the number of
+ * clients that are still connected after STOPTIMEOUT seconds. The caller
+ * should join the thread of the server afterwards.
+ ***********************************************************************/
+int tcpserver_stop(void) {
+#if defined(PLATFORM_WIN32) || defined(PLATFORM_WIN64)
+  /* there is no pipe, the server thread has to be cancelled */
+  return 0;
+#else
+  char wakeup = 0;
+  int running, remaining, fd[2];
+  struct timeval tp;
+  struct timespec ts;
+  double deadline;
+
+  /* the byte is never read, hence all threads that wait see it */
+  pthread_mutex_lock(&mutexstatus);
+  fd[0] = tcpserverWakeup[0];
+  fd[1] = tcpserverWakeup[1];
+  pthread_mutex_unlock(&mutexstatus);
+  if (fd[1]<0)
+    return 0;
+  if (write(fd[1], &wakeup, 1)!=1)
+    perror("tcpserver_stop write");
+
+  deadline = ft_clock_seconds() + STOPTIMEOUT;
+
+  do {
+    /* a WAIT_DAT request may have arrived just before the pipe was written to */
+    wake_waiters();
+
+    gettimeofday(&tp, NULL);
+    ts.tv_sec  = tp.tv_sec;
+    ts.tv_nsec = 1000 * tp.tv_usec + 10000000;
+    if (ts.tv_nsec >= 1000000000) {
+      ts.tv_sec++;
+      ts.tv_nsec -= 1000000000;
+    }
+    pthread_mutex_lock(&mutexsocketcount);
+    if (socketcount>0)
+      pthread_cond_timedwait(&condsocketcount, &mutexsocketcount, &ts);
+    remaining = socketcount;
+    pthread_mutex_unlock(&mutexsocketcount);
+
+    pthread_mutex_lock(&mutexstatus);
+    running = tcpserverStatus;
+    pthread_mutex_unlock(&mutexstatus);
+    if (running && remaining==0)
+      usleep(1000);
+  } while ((running || remaining>0) && ft_clock_seconds() < deadline);
+
+  if (!running && remaining==0) {
+    /* none of the threads uses the pipe any more, the next server creates a new one */
+    pthread_mutex_lock(&mutexstatus);
+    tcpserverWakeup[0] = -1;
+    tcpserverWakeup[1] = -1;
+    pthread_mutex_unlock(&mutexstatus);
+    close(fd[0]);
+    close(fd[1]);
+  }
+  return remaining;
+#endif
+}
@@ -13,14 +13,9 @@
 #include "buffer.h"
 #include <pthread.h>
 #include "extern.h"
+#include "bufstats.h"
 
-#ifdef ENABLE_POLLING
-  #include <poll.h>
-#endif
-
-#define THREADSLEEP      1000000  /* in microseconds */
-#define POLLSLEEP        100      /* in microseconds */
-#define MERGE_THRESHOLD  4096     /* TODO: optimize this value? Maybe look at MTU size */
+#define MERGE_THRESHOLD  4096     /* larger responses are written in two pieces, see ft_socket_cork */
 
 typedef struct {
         void *message;
@@ -37,9 +32,12 @@ void cleanup_tcpsocket(void *arg) {
                 closesocket(threadlocal->fd);
                 threadlocal->fd = -1;
         }
+        ft_stats_disconnect();
 
         pthread_mutex_lock(&mutexsocketcount);
         socketcount--;
+        /* tcpserver_stop waits for all clients to be disconnected */
+        pthread_cond_broadcast(&condsocketcount);
         pthread_mutex_unlock(&mutexsocketcount);
 
         pthread_mutex_lock(&mutexthreadcount);
@@ -52,13 +50,12 @@ void *tcpsocket(void *arg) {
 	int n;
 	int status = 0, verbose = 0;
 
-#ifdef ENABLE_POLLING
-	struct pollfd fds;
-#endif
-
 	/* these are used for communication over the TCP socket */
 	int client = 0;
 	message_t *request = NULL, *response = NULL;
+	UINT32_T codecs = 0;    /* negotiated with GET_CODEC, see compress.h */
+	ft_qos_conn_t qos;      /* service class of the client, see qos.h */
+	ft_msgpool_t pool;      /* memory of the previous request and response, see msgpool.h */
 
     threadlocal_t threadlocal;
     threadlocal.message = NULL;
@@ -69,6 +66,8 @@ void *tcpsocket(void *arg) {
 
     /* this will be closed at cleanup */
     threadlocal.fd = client;
+    ft_qos_init(&qos);
+    ft_msgpool_init(&pool);
 
     pthread_cleanup_push(cleanup_tcpsocket, &threadlocal);
 
@@ -76,46 +75,31 @@ void *tcpsocket(void *arg) {
     pthread_mutex_lock(&mutexsocketcount);
     socketcount++;
     pthread_mutex_unlock(&mutexsocketcount);
+    ft_stats_connect();
 
     if (verbose>1) fprintf(stderr, "tcpsocket: client = %d, socketcount = %d, threadcount = %d\n", client, socketcount, threadcount);
 
 	/* keep processing messages untill the connection is closed */
 	while (1) {
-		int swap = 0;
+		int swap = 0, swapData = 0, served;
 		UINT16_T reqCommand;
 		UINT32_T respBufSize;
+		UINT64_T requestTime;
+		double delay;
 
-		request       = (message_t*)malloc(sizeof(message_t));
-		DIE_BAD_MALLOC(request);
-		
-		request->def  = (messagedef_t*)malloc(sizeof(messagedef_t));
-		DIE_BAD_MALLOC(request->def);
-		request->buf  = NULL;
-
-#ifdef ENABLE_POLLING
-		/* wait for data to become available or until the connection is closed */
-		/* thohar: i think this is not neccessary as we dont need a timeout. */
-		/* roboos: we need it to detect when the socket is closed by the client */
-		while (1) {
-			fds.fd      = client;
-			fds.events  = POLLIN | POLLRDNORM | POLLRDBAND | POLLPRI | POLLOUT | POLLWRNORM | POLLWRBAND | POLLERR | POLLNVAL;
-			fds.revents = 0;
-
-			if (poll(&fds, 1, 1)==-1) {
-				perror("poll");
+		/* a client that exceeds its rate limit has to wait for its next request */
+		while ((delay = ft_qos_delay(&qos)) > 0) {
+			if (tcpserver_wait(-1, delay) < 0)
 				goto cleanup;
-			}
-
-			if (fds.revents & POLLHUP)
-				goto cleanup;				/* the connection has been closed */
-			else if (fds.revents & POLLERR)
-				goto cleanup;				/* the connection has been closed */
-			else if (fds.revents & POLLIN)
-				break;						/* data is available, process the message */
-			else
-				usleep(POLLSLEEP);			/* wait for data or closed connection */
 		}
-#endif
+
+		request = ft_msgpool_message(&pool);
+		DIE_BAD_MALLOC(request);
+
+		/* wait for the next request, this also detects that the connection has been closed and */
+		/* returns immediately when tcpserver_stop is called */
+		if (tcpserver_wait(client, -1) < 0)
+			goto cleanup;
 
 		if ((n = bufread(client, request->def, sizeof(messagedef_t))) != sizeof(messagedef_t)) {
 			if (verbose>0) fprintf(stderr, "tcpsocket: packet size = %d, should be %lu\n", n, sizeof(messagedef_t));
@@ -135,54 +119,88 @@ void *tcpsocket(void *arg) {
 		}
 		
 		if (request->def->bufsize>0) {
-			request->buf = malloc(request->def->bufsize);
+			request->buf = ft_msgpool_alloc(&pool, request->def->bufsize);
 			DIE_BAD_MALLOC(request->buf);
+			ft_socket_fit(client, SO_RCVBUF, request->def->bufsize);
 			if ((n = bufread(client, request->buf, request->def->bufsize)) != request->def->bufsize) {
 				if (verbose>0) fprintf(stderr, "tcpsocket: read size = %d, should be %d\n", n, request->def->bufsize);
 				goto cleanup;
 			}
 		}
 		
-		if (swap && request->def->bufsize > 0) ft_swap_buf_to_native(reqCommand, request->def->bufsize, request->buf);
+		if (swap && reqCommand == PUT_DAT && request->def->bufsize >= sizeof(datadef_t)) {
+			/* let dmarequest swap the samples while copying them into the ring */
+			ft_swap32(4, request->buf);
+			swapData = 1;
+		}
+		else if (swap && request->def->bufsize > 0) {
+			ft_swap_buf_to_native(reqCommand, request->def->bufsize, request->buf);
+			/* the response to a STREAM_REQ is that of the wrapped request */
+			if (reqCommand == STREAM_REQ && request->def->bufsize >= sizeof(streamdef_t) + sizeof(messagedef_t))
+				reqCommand = ((messagedef_t *) ((char *) request->buf + sizeof(streamdef_t)))->command;
+		}
+		requestTime = ft_stats_clock();
+		ft_trace_set_received(1000 * requestTime);
 
 		if (verbose>1) print_request(request->def);
 		if (verbose>1) print_buf(request->buf, request->def->bufsize);
 
-		if ((status = dmarequest(request, &response)) != 0) {
+		if (request->def->command == GET_SHM) {
+			/* shared memory is only offered to clients on a UNIX domain socket, see socketserver.c */
+			response = ft_msgpool_message(&pool);
+			DIE_BAD_MALLOC(response);
+			response->def->version = VERSION;
+			response->def->command = GET_ERR;
+			response->def->bufsize = 0;
+		}
+		else if ((served = ft_codec_serve(request, swap, &codecs, &response)) != 0) {
+			/* negotiation of the compression, or a PUT_DAT_Z that could not be expanded */
+			if (served < 0) goto cleanup;
+		}
+		else if ((served = ft_qos_serve(request, &qos, &response)) != 0) {
+			/* selection of the service class */
+			if (served < 0) goto cleanup;
+		}
+		else if ((status = dmarequest_pool(request, &response, swapData, &pool)) != 0) {
 			if (verbose>0) fprintf(stderr, "tcpsocket: an unexpected error occurred\n");
 			goto cleanup;
 		}
 		
 		DIE_BAD_MALLOC(response);
 		DIE_BAD_MALLOC(response->def);
+		/* a slow reader gets a shorter response, and is disconnected if it does not read it */
+		ft_qos_limit(&qos, request, response);
+		ft_qos_socket(&qos, client);
+		ft_qos_thread(&qos);
+		if (codecs && request->def->command == GET_DAT) ft_compress_message(response, codecs);
 		
 		if (verbose>1) print_response(response->def);
 		if (verbose>1) print_buf(request->buf, request->def->bufsize);
 		
 		respBufSize = response->def->bufsize;
+		ft_stats_command(request->def->command, response->def->command, request->def->bufsize, respBufSize, ft_stats_elapsed(requestTime));
 		if (swap) ft_swap_from_native(reqCommand, response);
 
 		/* we don't need the request anymore */
-		cleanup_message(&request);
+		ft_msgpool_release(&pool, request, request->def->bufsize);
 		request = NULL;
 		
 		/* merge response->def and response->buf if they are small, so we can send it in one go over TCP */
 		if (respBufSize + sizeof(messagedef_t) <= MERGE_THRESHOLD) {
 			int msize = respBufSize + sizeof(messagedef_t);
-			void *merged = NULL;
+			char merged[MERGE_THRESHOLD];
 			
-			append(&merged, 0, response->def, sizeof(messagedef_t));
-			DIE_BAD_MALLOC(merged);
-			append(&merged, sizeof(messagedef_t), response->buf, respBufSize);
-			DIE_BAD_MALLOC(merged);
+			memcpy(merged, response->def, sizeof(messagedef_t));
+			if (respBufSize > 0) memcpy(merged + sizeof(messagedef_t), response->buf, respBufSize);
 						
 			if ((n=bufwrite(client, merged, msize) != msize)) {
 				if (verbose>0) fprintf(stderr, "tcpsocket: write size = %d, should be %d\n", n, msize);
-				FREE(merged);
 				goto cleanup;
 			}
-			FREE(merged);
 		} else {
+			/* the def should not go out as a separate small packet */
+			ft_socket_fit(client, SO_SNDBUF, respBufSize);
+			ft_socket_cork(client, 1);
 			if ((n = bufwrite(client, response->def, sizeof(messagedef_t)))!=sizeof(messagedef_t)) {
 				if (verbose>0) fprintf(stderr, "tcpsocket: write size = %d, should be %lu\n", n, sizeof(messagedef_t));
 				goto cleanup;
@@ -191,9 +209,12 @@ void *tcpsocket(void *arg) {
 				if (verbose>0) fprintf(stderr, "tcpsocket: write size = %d, should be %u\n", n, respBufSize);
 				goto cleanup;
 			}
+			ft_socket_cork(client, 0);
 		}
 
-		cleanup_message(&response);
+		ft_stats_roundtrip(ft_stats_elapsed(requestTime));
+
+		ft_msgpool_release(&pool, response, respBufSize);
         response = NULL;
 
 	} /* while (1) */
@@ -204,19 +225,14 @@ cleanup:
 	if (response!=NULL) 
 		cleanup_message(&response);
 	response = NULL;	/* SK: prevent double free in following pthread_cleanup_pop */
+	if (request!=NULL)
+		cleanup_message(&request);
+	request = NULL;
+	ft_msgpool_clear(&pool);
 
+	/* this also decrements the socketcount and threadcount */
 	pthread_cleanup_pop(1);
 
-    /* this is for debugging */
-    pthread_mutex_lock(&mutexsocketcount);
-    socketcount--;
-    pthread_mutex_unlock(&mutexsocketcount);
-
-    /* this is for debugging */
-    pthread_mutex_lock(&mutexthreadcount);
-    threadcount--;
-    pthread_mutex_unlock(&mutexthreadcount);
-
 	pthread_exit(NULL);
 	return NULL;
 }
@@ -68,6 +68,90 @@ unsigned int bufwrite(int s, const void *buf, unsigned int numel) {
 		return numwrite;
 }
 
+/* Sizes of the socket buffers, see ft_set_socket_buffers. Linux and OS X
+   tune the buffers of a TCP connection themselves, as long as they are not
+   set explicitly (on Linux, an explicit size is also limited to wmem_max and
+   rmem_max, which are much smaller than what the automatic tuning reaches).
+   On those platforms we leave the buffers alone unless the application asks
+   for specific sizes.
+ */
+static unsigned int sockbuf_initial = 0;
+static unsigned int sockbuf_maximum = 0;
+
+/* Sets the buffer size of newly connected TCP sockets (0 for the system default), and
+   the size up to which the buffers are enlarged for large messages (0 for automatic).
+ */
+void ft_set_socket_buffers(unsigned int initial, unsigned int maximum) {
+		sockbuf_initial = initial;
+		sockbuf_maximum = maximum;
+}
+
+static unsigned int sockbuf_limit(void) {
+		if (sockbuf_maximum > 0 || sockbuf_initial > 0)
+				return sockbuf_maximum > sockbuf_initial ? sockbuf_maximum : sockbuf_initial;
+#if defined(PLATFORM_LINUX) || defined(PLATFORM_OSX)
+		return 0;
+#else
+		return FT_SOCKBUF_MAX;
+#endif
+}
+
+/* Disables the Nagle algorithm and sets the initial buffer sizes of a newly
+   connected TCP socket. All messages are written in one go (or corked, see
+   ft_socket_cork), so waiting for more data only delays small requests and
+   responses.
+ */
+void ft_socket_init(int s) {
+		int optval = 1;
+
+		if (setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&optval, sizeof(optval)) < 0)
+				perror("ft_socket_init, TCP_NODELAY");
+
+		if (sockbuf_initial > 0) {
+				optval = sockbuf_initial;
+				if (setsockopt(s, SOL_SOCKET, SO_RCVBUF, (const char*)&optval, sizeof(optval)) < 0)
+						perror("ft_socket_init, SO_RCVBUF");
+				if (setsockopt(s, SOL_SOCKET, SO_SNDBUF, (const char*)&optval, sizeof(optval)) < 0)
+						perror("ft_socket_init, SO_SNDBUF");
+		}
+}
+
+/* Enlarges the send (option=SO_SNDBUF) or receive (option=SO_RCVBUF) buffer
+   of a TCP socket, so that a message of the given size fits in it. Small
+   messages and buffers that are already large enough are left alone, so this
+   costs at most one getsockopt per large message.
+ */
+void ft_socket_fit(int s, int option, unsigned int size) {
+		unsigned int limit = sockbuf_limit(), wanted = FT_SOCKBUF_FIT;
+		int current = 0;
+#ifdef PLATFORM_WINDOWS
+		int len = sizeof(current);
+#else
+		socklen_t len = sizeof(current);
+#endif
+
+		if (size < FT_SOCKBUF_FIT || limit == 0) return;
+		if (getsockopt(s, SOL_SOCKET, option, (char*)&current, &len) < 0) return;
+		if (current >= (int) size || current >= (int) limit) return;
+
+		while (wanted < size && wanted < limit) wanted *= 2;
+		if (wanted > limit) wanted = limit;
+		current = wanted;
+		if (setsockopt(s, SOL_SOCKET, option, (const char*)&current, sizeof(current)) < 0)
+				perror("ft_socket_fit, setsockopt");
+}
+
+/* Holds back partial packets while a message is written in several pieces,
+   clearing the option again sends out what is pending immediately. This only
+   does something where TCP_CORK is available.
+ */
+void ft_socket_cork(int s, int on) {
+#ifdef TCP_CORK
+		int optval = on ? 1 : 0;
+		setsockopt(s, IPPROTO_TCP, TCP_CORK, (const char*)&optval, sizeof(optval));
+#endif
+}
+
 unsigned int append(void **buf1, unsigned int bufsize1, void *buf2, unsigned int bufsize2) {
 		int verbose = 0;
 
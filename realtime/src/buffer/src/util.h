@@ -10,6 +10,10 @@ extern "C" {
 /* definition of various utility functions, see util.c */
 unsigned int bufread(int s, void *buf, unsigned int numel);
 unsigned int bufwrite(int s, const void *buf, unsigned int numel);
+void ft_set_socket_buffers(unsigned int initial, unsigned int maximum);
+void ft_socket_init(int s);
+void ft_socket_fit(int s, int option, unsigned int size);
+void ft_socket_cork(int s, int on);
 unsigned int append(void **buf1, unsigned int bufsize1, void *buf2, unsigned int bufsize2);
 void check_datatypes();
 unsigned int wordsize_from_type(UINT32_T data_type);
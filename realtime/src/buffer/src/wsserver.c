@@ -0,0 +1,863 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "wsserver.h"
+#include "ftclock.h"
+
+#ifdef MSG_NOSIGNAL
+  #define SEND_FLAGS MSG_NOSIGNAL  /* report a closed connection as an error instead of raising SIGPIPE */
+#else
+  #define SEND_FLAGS 0
+#endif
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+#define WS_OP_TEXT    1
+#define WS_OP_BINARY  2
+#define WS_OP_CLOSE   8
+#define WS_OP_PING    9
+#define WS_OP_PONG    10
+
+#define WS_ROL(x,n) (((x) << (n)) | ((x) >> (32-(n))))
+
+/* SHA-1 of a message, only for the Sec-WebSocket-Accept of the handshake */
+static void ws_aux_sha1(const unsigned char *msg, size_t len, unsigned char *digest) {
+	UINT32_T h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+	UINT64_T bits = (UINT64_T) len*8;
+	size_t i, numBlocks = (len + 9 + 63)/64; /* including the padding and the length */
+	unsigned char block[64];
+
+	for (i=0; i<numBlocks; i++) {
+		UINT32_T w[80], a, b, c, d, e, f, k, t;
+		int j;
+
+		for (j=0; j<64; j++) {
+			size_t p = i*64 + j;
+			block[j] = (p < len) ? msg[p] : ((p == len) ? 0x80 : 0);
+		}
+		if (i == numBlocks-1) {
+			for (j=0; j<8; j++) block[56+j] = (unsigned char) (bits >> (56 - 8*j));
+		}
+		for (j=0; j<16; j++) {
+			w[j] = ((UINT32_T) block[4*j] << 24) | ((UINT32_T) block[4*j+1] << 16) | ((UINT32_T) block[4*j+2] << 8) | block[4*j+3];
+		}
+		for (j=16; j<80; j++) {
+			t = w[j-3] ^ w[j-8] ^ w[j-14] ^ w[j-16];
+			w[j] = WS_ROL(t, 1);
+		}
+
+		a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4];
+		for (j=0; j<80; j++) {
+			if (j < 20) {
+				f = (b & c) | (~b & d); k = 0x5A827999;
+			} else if (j < 40) {
+				f = b ^ c ^ d; k = 0x6ED9EBA1;
+			} else if (j < 60) {
+				f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC;
+			} else {
+				f = b ^ c ^ d; k = 0xCA62C1D6;
+			}
+			t = WS_ROL(a, 5) + f + e + k + w[j];
+			e = d; d = c; c = WS_ROL(b, 30); b = a; a = t;
+		}
+		h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+	}
+	for (i=0; i<20; i++) digest[i] = (unsigned char) (h[i/4] >> (24 - 8*(i%4)));
+}
+
+static void ws_aux_base64(const unsigned char *src, size_t len, char *dest) {
+	static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	size_t i;
+
+	for (i=0; i<len; i+=3) {
+		UINT32_T v = (UINT32_T) src[i] << 16;
+		if (i+1 < len) v |= (UINT32_T) src[i+1] << 8;
+		if (i+2 < len) v |= src[i+2];
+		*dest++ = table[(v >> 18) & 63];
+		*dest++ = table[(v >> 12) & 63];
+		*dest++ = (i+1 < len) ? table[(v >> 6) & 63] : '=';
+		*dest++ = (i+2 < len) ? table[v & 63] : '=';
+	}
+	*dest = 0;
+}
+
+static int ws_aux_nonblocking(SOCKET s) {
+#ifdef PLATFORM_WINDOWS
+	unsigned long optval = 1;
+	return (ioctlsocket(s, FIONBIO, &optval) != 0) ? -1 : 0;
+#else
+	return (fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK) < 0) ? -1 : 0;
+#endif
+}
+
+/* appends len bytes to the output of the client, returns 0 on success */
+static int ws_aux_append(ws_client_t *C, const void *data, size_t len) {
+	if (len == 0) return 0;
+	if (C->outlen + len > C->outsize) {
+		size_t size = C->outsize ? C->outsize : 4096;
+		char *out;
+		while (size < C->outlen + len) size *= 2;
+		out = (char *) realloc(C->out, size);
+		if (out == NULL) return -1;
+		C->out = out;
+		C->outsize = size;
+	}
+	memcpy(C->out + C->outlen, data, len);
+	C->outlen += len;
+	return 0;
+}
+
+/* appends a frame from the server with a payload in two parts, frames of the server are never masked */
+static int ws_aux_frame_parts(ws_client_t *C, int opcode, const void *part1, size_t len1, const void *part2, size_t len2) {
+	unsigned char head[10];
+	size_t hlen = 2, len = len1 + len2;
+	int i;
+
+	head[0] = 0x80 | opcode; /* FIN */
+	if (len < 126) {
+		head[1] = (unsigned char) len;
+	} else if (len < 65536) {
+		head[1] = 126;
+		head[2] = (unsigned char) (len >> 8);
+		head[3] = (unsigned char) len;
+		hlen = 4;
+	} else {
+		head[1] = 127;
+		for (i=0; i<8; i++) head[2+i] = (unsigned char) ((UINT64_T) len >> (56 - 8*i));
+		hlen = 10;
+	}
+	if (ws_aux_append(C, head, hlen) != 0 || ws_aux_append(C, part1, len1) != 0) return -1;
+	return ws_aux_append(C, part2, len2);
+}
+
+/* appends a frame from the server, returns 0 on success */
+static int ws_aux_frame(ws_client_t *C, int opcode, const void *payload, size_t len) {
+	return ws_aux_frame_parts(C, opcode, payload, len, NULL, 0);
+}
+
+/* sends a close frame with the given status, after which nothing is read from the client anymore */
+static void ws_aux_close(ws_client_t *C, int status, const char *reason) {
+	char payload[128];
+	size_t len = strlen(reason);
+
+	if (len > sizeof(payload)-2) len = sizeof(payload)-2;
+	payload[0] = (char) (status >> 8);
+	payload[1] = (char) status;
+	memcpy(payload+2, reason, len);
+	ws_aux_frame(C, WS_OP_CLOSE, payload, len+2);
+	C->state = WS_CLIENT_CLOSING;
+	C->inlen = 0;
+}
+
+/* parses parameters such as "chans=0,1,2&decimate=10&rate=20", returns 0 on success */
+static int ws_aux_params(ws_client_t *C, const char *str) {
+	while (*str && *str != ' ') {
+		const char *value = strchr(str, '=');
+		size_t len = strcspn(str, "&= ");
+
+		if (value == NULL || str[len] != '=') return -1;
+		value++;
+		if (len == 5 && strncmp(str, "chans", 5) == 0) {
+			UINT32_T n = 0, i, *chans;
+			const char *p;
+			/* count the channels first */
+			for (p = value; *p && *p != '&' && *p != ' '; p++) {
+				if (*p == ',') n++;
+			}
+			n += (p > value);
+			chans = (n > 0) ? (UINT32_T *) malloc(n*sizeof(UINT32_T)) : NULL;
+			if (n > 0 && chans == NULL) return -1;
+			for (p = value, n = 0; *p && *p != '&' && *p != ' '; n++) {
+				char *end;
+				chans[n] = (UINT32_T) strtoul(p, &end, 10);
+				if (end == p || (*end != ',' && *end != '&' && *end != ' ' && *end != 0)) {
+					free(chans);
+					return -1;
+				}
+				/* a channel that is selected twice would only duplicate the data */
+				for (i=0; i<n; i++) {
+					if (chans[i] == chans[n]) break;
+				}
+				if (i < n) {
+					free(chans);
+					return -1;
+				}
+				p = (*end == ',') ? end + 1 : end;
+			}
+			FREE(C->chans);
+			C->chans = chans;
+			C->nchans = n;
+			/* the client gets the header again, with the new selection */
+			C->generation = 0;
+		} else if (len == 8 && strncmp(str, "decimate", 8) == 0) {
+			long d = atol(value);
+			if (d < 1 || d > WS_MAX_DECIMATE) return -1;
+			C->mindecimate = C->decimate = (UINT32_T) d;
+			C->calm = 0;
+		} else if (len == 4 && strncmp(str, "rate", 4) == 0) {
+			double rate = atof(value);
+			if (!(rate > 0 && rate <= 1000)) return -1;
+			C->interval = (UINT64_T) (1e9/rate);
+		} else {
+			return -1;
+		}
+		str = value + strcspn(value, "& ");
+		if (*str == '&') str++;
+	}
+	return 0;
+}
+
+/* case-insensitive comparison of the start of a line */
+static int ws_aux_prefix(const char *line, const char *prefix) {
+	while (*prefix) {
+		if (tolower((unsigned char) *line++) != *prefix++) return 0;
+	}
+	return 1;
+}
+
+/* handles the HTTP upgrade request once it is complete, returns -1 on errors */
+static int ws_aux_handshake(ws_server_ctrl_t *SC, ws_client_t *C) {
+	static const char badRequest[] = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+	char key[128] = "", accept[32], reply[256], *end, *line, *query;
+	unsigned char digest[20];
+	size_t used;
+
+	C->in[C->inlen < WS_MAX_REQUEST ? C->inlen : WS_MAX_REQUEST-1] = 0;
+	end = strstr(C->in, "\r\n\r\n");
+	if (end == NULL) {
+		/* the request is not complete yet, but has to fit */
+		return (C->inlen >= WS_MAX_REQUEST-1) ? -1 : 0;
+	}
+	used = end + 4 - C->in;
+	*end = 0;
+
+	if (strncmp(C->in, "GET ", 4) != 0) return -1;
+
+	for (line = strstr(C->in, "\r\n"); line != NULL; line = strstr(line, "\r\n")) {
+		line += 2;
+		if (ws_aux_prefix(line, "sec-websocket-key:")) {
+			line += 18;
+			while (*line == ' ') line++;
+			sscanf(line, "%60[A-Za-z0-9+/=]", key);
+		}
+	}
+
+	query = C->in + 4 + strcspn(C->in + 4, "? ");
+	if (key[0] == 0 || (*query == '?' && ws_aux_params(C, query+1) != 0)) {
+		ws_aux_append(C, badRequest, sizeof(badRequest)-1);
+		C->state = WS_CLIENT_CLOSING;
+		C->inlen = 0;
+		return 0;
+	}
+
+	strcat(key, WS_GUID);
+	ws_aux_sha1((const unsigned char *) key, strlen(key), digest);
+	ws_aux_base64(digest, 20, accept);
+	sprintf(reply, "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n", accept);
+	if (ws_aux_append(C, reply, strlen(reply)) != 0) return -1;
+
+	if (SC->verbosity > 0) {
+		printf("wsserver: client %i selected %u channels, decimation %u, %.1f frames/s\n", (int) C->sock, C->nchans, C->mindecimate, 1e9/C->interval);
+	}
+
+	/* the client may already have sent its first frames */
+	C->inlen -= used;
+	memmove(C->in, C->in + used, C->inlen);
+	C->state = WS_CLIENT_OPEN;
+	C->generation = 0;
+	return 0;
+}
+
+/* handles the complete frames that the client sent, returns -1 on errors */
+static int ws_aux_frames(ws_client_t *C) {
+	while (C->state == WS_CLIENT_OPEN && C->inlen >= 2) {
+		unsigned char *p = (unsigned char *) C->in;
+		int opcode = p[0] & 0x0F;
+		UINT64_T len = p[1] & 0x7F;
+		size_t hlen = 2, i;
+		unsigned char *data;
+
+		if (!(p[1] & 0x80)) {
+			/* the frames of a client have to be masked */
+			ws_aux_close(C, 1002, "unmasked frame");
+			return 0;
+		}
+		if (len == 126) {
+			if (C->inlen < 4) return 0;
+			len = ((UINT64_T) p[2] << 8) | p[3];
+			hlen = 4;
+		} else if (len == 127) {
+			if (C->inlen < 10) return 0;
+			for (len = 0, i = 0; i < 8; i++) len = (len << 8) | p[2+i];
+			hlen = 10;
+		}
+		if (len > WS_MAX_REQUEST - hlen - 5) {
+			ws_aux_close(C, 1009, "frame too large");
+			return 0;
+		}
+		if (C->inlen < hlen + 4 + len) return 0;
+
+		data = p + hlen + 4;
+		for (i=0; i<len; i++) data[i] ^= p[hlen + (i & 3)];
+
+		switch (opcode) {
+			case WS_OP_TEXT:
+				data[len] = 0;
+				if (ws_aux_params(C, (const char *) data) != 0) {
+					ws_aux_close(C, 1008, "invalid parameters");
+					return 0;
+				}
+				break;
+			case WS_OP_CLOSE:
+				ws_aux_close(C, 1000, "");
+				return 0;
+			case WS_OP_PING:
+				if (ws_aux_frame(C, WS_OP_PONG, data, len) != 0) return -1;
+				break;
+			default:
+				/* binary messages, pongs and continuations are ignored */
+				break;
+		}
+		C->inlen -= hlen + 4 + len;
+		memmove(C->in, C->in + hlen + 4 + len, C->inlen);
+	}
+	return 0;
+}
+
+/* reads from a client, returns -1 if the connection should be closed */
+static int ws_aux_read(ws_server_ctrl_t *SC, ws_client_t *C) {
+	char dummy[256];
+	int r;
+
+	if (C->state == WS_CLIENT_CLOSING) {
+		/* only check whether the connection is still there */
+		return (recv(C->sock, dummy, sizeof(dummy), 0) <= 0) ? -1 : 0;
+	}
+	r = recv(C->sock, C->in + C->inlen, WS_MAX_REQUEST - 1 - C->inlen, 0);
+	if (r <= 0) return -1;
+	C->inlen += r;
+
+	if (C->state == WS_CLIENT_HANDSHAKE && ws_aux_handshake(SC, C) != 0) return -1;
+	if (C->state == WS_CLIENT_OPEN) return ws_aux_frames(C);
+	return 0;
+}
+
+/* writes the pending output of a client, returns -1 if the connection should be closed */
+static int ws_aux_write(ws_client_t *C) {
+	int r = send(C->sock, C->out, C->outlen, SEND_FLAGS);
+
+	if (r < 0) {
+#ifdef PLATFORM_WINDOWS
+		return (WSAGetLastError() == WSAEWOULDBLOCK) ? 0 : -1;
+#else
+		return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+#endif
+	}
+	C->outlen -= r;
+	memmove(C->out, C->out + r, C->outlen);
+	return (C->outlen == 0 && C->state == WS_CLIENT_CLOSING) ? -1 : 0;
+}
+
+/* asks the FieldTrip buffer for the counters of the header and its generation, returns 0 on success */
+static int ws_aux_get_hdr_gen(int ft_buffer, headergen_t *hdr, char **labels, UINT32_T *labelsize) {
+	message_t req, *resp = NULL;
+	messagedef_t msg_def;
+	UINT32_T known = 0;
+	int r = -1;
+
+	req.def = &msg_def;
+	msg_def.version = VERSION;
+	msg_def.command = GET_HDR_GEN;
+	if (labels != NULL) {
+		/* also ask for the chunks */
+		req.buf = &known;
+		msg_def.bufsize = sizeof(UINT32_T);
+	} else {
+		req.buf = NULL;
+		msg_def.bufsize = 0;
+	}
+
+	if (clientrequest(ft_buffer, &req, &resp) < 0) return -1;
+
+	if (resp != NULL && resp->def != NULL && resp->buf != NULL &&
+		resp->def->command == GET_OK && resp->def->bufsize >= sizeof(headergen_t)) {
+		memcpy(hdr, resp->buf, sizeof(headergen_t));
+		r = 0;
+	}
+	if (r == 0 && labels != NULL) {
+		/* look for the channel names among the chunks */
+		const char *chunks = (const char *) resp->buf + sizeof(headergen_t);
+		UINT32_T size = resp->def->bufsize - sizeof(headergen_t), offset = 0;
+
+		while (offset + sizeof(ft_chunkdef_t) <= size) {
+			const ft_chunkdef_t *cdef = (const ft_chunkdef_t *) (chunks + offset);
+			if (cdef->size > size - offset - sizeof(ft_chunkdef_t)) break;
+			if (cdef->type == FT_CHUNK_CHANNEL_NAMES) {
+				*labels = (char *) malloc(cdef->size + 1);
+				if (*labels != NULL) {
+					memcpy(*labels, cdef + 1, cdef->size);
+					(*labels)[cdef->size] = 0;
+					*labelsize = cdef->size;
+				}
+				break;
+			}
+			offset += sizeof(ft_chunkdef_t) + cdef->size;
+		}
+	}
+	if (resp) {
+		FREE(resp->buf);
+		FREE(resp->def);
+		free(resp);
+	}
+	return r;
+}
+
+/* reads n samples starting at begsample of the selected channels as floats, returns 0 on success */
+static int ws_aux_get_dat(int ft_buffer, const ws_client_t *C, UINT32_T begsample, UINT32_T n, UINT32_T nchans, float *dest) {
+	message_t req, *resp = NULL;
+	messagedef_t msg_def;
+	datasel_ext_t *sel;
+	const datadef_t *ddef;
+	int r = -1;
+
+	sel = (datasel_ext_t *) malloc(sizeof(datasel_ext_t) + C->nchans*sizeof(UINT32_T));
+	if (sel == NULL) return -1;
+	sel->begsample = begsample;
+	sel->endsample = begsample + n - 1;
+	sel->stride    = 1;
+	sel->data_type = DATATYPE_FLOAT32;
+	sel->nchans    = C->nchans;
+	if (C->nchans > 0) memcpy(sel + 1, C->chans, C->nchans*sizeof(UINT32_T));
+
+	req.def = &msg_def;
+	req.buf = sel;
+	msg_def.version = VERSION;
+	msg_def.command = GET_DAT;
+	msg_def.bufsize = sizeof(datasel_ext_t) + C->nchans*sizeof(UINT32_T);
+
+	if (clientrequest(ft_buffer, &req, &resp) >= 0 && resp != NULL && resp->def != NULL && resp->buf != NULL &&
+		resp->def->command == GET_OK && resp->def->bufsize >= sizeof(datadef_t)) {
+		ddef = (const datadef_t *) resp->buf;
+		if (ddef->nsamples == n && ddef->nchans == nchans && ddef->bufsize == n*nchans*sizeof(float) &&
+			resp->def->bufsize >= sizeof(datadef_t) + ddef->bufsize) {
+			memcpy(dest, ddef + 1, ddef->bufsize);
+			r = 0;
+		}
+	}
+	free(sel);
+	if (resp) {
+		FREE(resp->buf);
+		FREE(resp->def);
+		free(resp);
+	}
+	return r;
+}
+
+/* sends the header to the client, in JSON, returns -1 on errors */
+static int ws_aux_send_header(ws_client_t *C, const headergen_t *hdr, const char *labels, UINT32_T labelsize) {
+	UINT32_T nchans = C->nchans ? C->nchans : hdr->def.nchans;
+	const char **names;
+	char *json, *p, *end;
+	size_t size;
+	UINT32_T i;
+	int r;
+
+	names = (const char **) calloc(hdr->def.nchans + 1, sizeof(char *));
+	if (names == NULL) return -1;
+	if (labels != NULL) {
+		const char *s = labels;
+		for (i=0; i<hdr->def.nchans && s < labels + labelsize; i++) {
+			names[i] = s;
+			s += strlen(s) + 1;
+		}
+	}
+
+	/* the number and quotes take at most 16 characters, every character of a label at most 6 */
+	size = 256 + (size_t) nchans*16;
+	for (i=0; i<nchans; i++) {
+		UINT32_T chan = C->nchans ? C->chans[i] : i;
+		const char *s = (chan < hdr->def.nchans) ? names[chan] : NULL;
+		if (s != NULL) size += 6*strlen(s);
+	}
+	json = (char *) malloc(size);
+	if (json == NULL) {
+		free(names);
+		return -1;
+	}
+	end = json + size;
+
+	p = json + snprintf(json, size, "{\"generation\":%u,\"nchans\":%u,\"fsample\":%g,\"chans\":[", hdr->generation, nchans, hdr->def.fsample);
+	/* every write below checks the space that is left */
+	for (i=0; i<nchans && end - p > 16; i++) {
+		p += snprintf(p, end - p, i ? ",%u" : "%u", C->nchans ? C->chans[i] : i);
+	}
+	if (end - p > 16) p += snprintf(p, end - p, "],\"labels\":[");
+	for (i=0; i<nchans && end - p > 8; i++) {
+		UINT32_T chan = C->nchans ? C->chans[i] : i;
+		const char *s = (chan < hdr->def.nchans) ? names[chan] : NULL;
+		if (i) *p++ = ',';
+		*p++ = '"';
+		/* keep room for the longest escape, the closing quote and the brackets */
+		for (; s != NULL && *s && end - p > 8; s++) {
+			if (*s == '"' || *s == '\\') {
+				*p++ = '\\';
+				*p++ = *s;
+			} else if ((unsigned char) *s < 0x20) {
+				p += snprintf(p, end - p, "\\u%04x", (unsigned char) *s);
+			} else {
+				*p++ = *s;
+			}
+		}
+		*p++ = '"';
+	}
+	if (i < nchans || end - p < 3) {
+		/* cannot happen with the size computed above */
+		free(json);
+		free(names);
+		return -1;
+	}
+	p += snprintf(p, end - p, "]}");
+
+	r = ws_aux_frame(C, WS_OP_TEXT, json, p - json);
+	free(json);
+	free(names);
+	return r;
+}
+
+/* makes the next frame of a client, if its output is not congested, returns -1 on errors */
+static int ws_aux_update(ws_server_ctrl_t *SC, ws_client_t *C, const headergen_t *hdr, const char *labels, UINT32_T labelsize) {
+	UINT32_T nchans, avail, numBuckets, total, s, n, i, j;
+	float *work, *pairs;
+	wsframe_t frame;
+	int r = 0;
+
+	if (C->generation != hdr->generation) {
+		for (i=0; i<C->nchans; i++) {
+			if (C->chans[i] >= hdr->def.nchans) {
+				ws_aux_close(C, 1008, "invalid channel");
+				return 0;
+			}
+		}
+		if (hdr->def.nchans == 0 || ws_aux_send_header(C, hdr, labels, labelsize) != 0) return -1;
+		/* only the samples that arrive from now on are sent */
+		C->generation = hdr->generation;
+		C->next = hdr->def.nsamples;
+		return 0;
+	}
+
+	/* rate adaptation */
+	if (C->outlen >= WS_MAX_QUEUED) {
+		/* hold back this frame, and halve the bandwidth of the next */
+		if (C->decimate < WS_MAX_DECIMATE) C->decimate *= 2;
+		C->calm = 0;
+		return 0;
+	} else if (C->outlen > 0) {
+		C->calm = 0;
+	} else if (++C->calm >= WS_CALM_FRAMES && C->decimate > C->mindecimate) {
+		C->decimate /= 2;
+		if (C->decimate < C->mindecimate) C->decimate = C->mindecimate;
+		C->calm = 0;
+	}
+
+	if (hdr->def.nsamples < C->next) {
+		C->next = hdr->def.nsamples;
+		return 0;
+	}
+	avail = hdr->def.nsamples - C->next;
+	while (avail / C->decimate > WS_MAX_BUCKETS && C->decimate < WS_MAX_DECIMATE) {
+		C->decimate *= 2;
+		C->calm = 0;
+	}
+	numBuckets = avail / C->decimate;
+	if (numBuckets > WS_MAX_BUCKETS) {
+		/* skip the oldest samples */
+		C->next += (numBuckets - WS_MAX_BUCKETS)*C->decimate;
+		numBuckets = WS_MAX_BUCKETS;
+	}
+	if (numBuckets == 0) return 0;
+
+	nchans = C->nchans ? C->nchans : hdr->def.nchans;
+	total = numBuckets*C->decimate;
+	work  = (float *) malloc(WS_READ_SAMPLES*nchans*sizeof(float));
+	pairs = (float *) malloc(numBuckets*nchans*2*sizeof(float));
+	if (work == NULL || pairs == NULL) {
+		r = -1;
+		goto cleanup;
+	}
+
+	for (s=0; s<total; s+=n) {
+		n = (total - s < WS_READ_SAMPLES) ? total - s : WS_READ_SAMPLES;
+		if (ws_aux_get_dat(SC->ft_buffer, C, C->next + s, n, nchans, work) != 0) {
+			/* the samples have been pushed out of the ring, continue with the newest */
+			C->next = hdr->def.nsamples;
+			goto cleanup;
+		}
+		for (j=0; j<n; j++) {
+			float *p = pairs + ((s+j)/C->decimate)*nchans*2;
+			const float *x = work + j*nchans;
+			if ((s+j) % C->decimate == 0) {
+				for (i=0; i<nchans; i++) p[2*i] = p[2*i+1] = x[i];
+			} else {
+				for (i=0; i<nchans; i++) {
+					if (x[i] < p[2*i])   p[2*i]   = x[i];
+					if (x[i] > p[2*i+1]) p[2*i+1] = x[i];
+				}
+			}
+		}
+	}
+
+	frame.magic      = WS_FRAME_MAGIC;
+	frame.generation = hdr->generation;
+	frame.begsample  = C->next;
+	frame.nbuckets   = numBuckets;
+	frame.nchans     = nchans;
+	frame.decimate   = C->decimate;
+
+	/* the frame is sent as a single message */
+	r = ws_aux_frame_parts(C, WS_OP_BINARY, &frame, sizeof(frame), pairs, numBuckets*nchans*2*sizeof(float));
+	C->next += total;
+cleanup:
+	FREE(work);
+	FREE(pairs);
+	return r;
+}
+
+void *_wsserver_thread(void *arg) {
+	ws_server_ctrl_t *SC = (ws_server_ctrl_t *) arg;
+	ws_client_t *clients[WS_MAX_NUM_CLIENTS];
+	int numClients = 0;
+	headergen_t hdr;
+	UINT32_T labelGen = 0;          /* generation of the header of which the labels are known */
+	char *labels = NULL;
+	UINT32_T labelsize = 0;
+	int i, j;
+
+	while (!SC->should_exit) {
+		UINT64_T now = ft_clock_ns();
+		fd_set readSet, writeSet;
+		struct timeval tv;
+		int sel, fdMax = (int) SC->server_socket;
+
+		/* first, make the frames of the clients whose interval has passed */
+		if (numClients > 0 && ws_aux_get_hdr_gen(SC->ft_buffer, &hdr, NULL, NULL) == 0) {
+			if (hdr.generation != labelGen) {
+				FREE(labels);
+				labelsize = 0;
+				if (ws_aux_get_hdr_gen(SC->ft_buffer, &hdr, &labels, &labelsize) != 0) continue;
+				labelGen = hdr.generation;
+			}
+			for (i=0; i<numClients; i++) {
+				ws_client_t *C = clients[i];
+				if (C->state != WS_CLIENT_OPEN || now < C->due) continue;
+				C->due = now + C->interval;
+				if (ws_aux_update(SC, C, &hdr, labels, labelsize) != 0) {
+					ws_aux_close(C, 1011, "out of memory");
+				}
+			}
+		}
+
+		/* second, the network */
+		FD_ZERO(&readSet);
+		FD_ZERO(&writeSet);
+		if (numClients < WS_MAX_NUM_CLIENTS) FD_SET(SC->server_socket, &readSet);
+		for (i=0; i<numClients; i++) {
+			FD_SET(clients[i]->sock, &readSet);
+			if (clients[i]->outlen > 0) FD_SET(clients[i]->sock, &writeSet);
+			if ((int) clients[i]->sock > fdMax) fdMax = (int) clients[i]->sock;
+		}
+
+		tv.tv_sec  = 0;
+		tv.tv_usec = WS_POLL_TIMEOUT*1000;
+		sel = select(fdMax + 1, &readSet, &writeSet, NULL, &tv);
+		if (sel == -1) {
+			perror("wsserver_thread -- select");
+			usleep(WS_POLL_TIMEOUT*1000);
+			continue;
+		}
+		if (sel == 0) continue;
+
+		if (FD_ISSET(SC->server_socket, &readSet)) {
+			struct sockaddr_in sa;
+			unsigned int size_sa = sizeof(sa);
+			SOCKET newSock;
+			ws_client_t *C;
+
+			newSock = accept(SC->server_socket, (struct sockaddr *)&sa, &size_sa);
+			if (newSock == INVALID_SOCKET) {
+				perror("wsserver_thread - accept");
+			} else if (ws_aux_nonblocking(newSock) != 0 || (C = (ws_client_t *) calloc(1, sizeof(ws_client_t))) == NULL) {
+				closesocket(newSock);
+			} else {
+				if (SC->verbosity > 0) {
+					printf("wsserver: opened connection (%i) to client at %s\n", (int) newSock, inet_ntoa(sa.sin_addr));
+				}
+				C->sock = newSock;
+				C->state = WS_CLIENT_HANDSHAKE;
+				C->mindecimate = C->decimate = 1;
+				C->interval = 1000000000 / WS_DEFAULT_RATE;
+				clients[numClients++] = C;
+				pthread_mutex_lock(&SC->mutex);
+				SC->num_clients = numClients;
+				pthread_mutex_unlock(&SC->mutex);
+			}
+		}
+
+		for (i=j=0; i<numClients; i++) {
+			ws_client_t *C = clients[i];
+			int closed = 0;
+
+			if (FD_ISSET(C->sock, &readSet)) closed = (ws_aux_read(SC, C) != 0);
+			if (!closed && FD_ISSET(C->sock, &writeSet)) closed = (ws_aux_write(C) != 0);
+			if (closed) {
+				if (SC->verbosity > 0) {
+					printf("wsserver: closed connection (%i)\n", (int) C->sock);
+				}
+				closesocket(C->sock);
+				FREE(C->out);
+				FREE(C->chans);
+				free(C);
+			} else {
+				clients[j++] = C;
+			}
+		}
+		if (j < numClients) {
+			pthread_mutex_lock(&SC->mutex);
+			SC->num_clients = numClients = j;
+			pthread_mutex_unlock(&SC->mutex);
+		}
+	}
+
+	for (i=0; i<numClients; i++) {
+		closesocket(clients[i]->sock);
+		FREE(clients[i]->out);
+		FREE(clients[i]->chans);
+		free(clients[i]);
+	}
+	FREE(labels);
+	return NULL;
+}
+
+/* see header file for documentation */
+ws_server_ctrl_t *ws_start_server(int ft_buffer, int port, int *errval) {
+	ws_server_ctrl_t *SC = NULL;
+	SOCKET s = INVALID_SOCKET;
+	struct sockaddr_in sa;
+	unsigned long optval;
+	int interr = FT_ERR_SOCKET;
+
+#ifdef PLATFORM_WINDOWS
+	WSADATA wsa;
+ 	if(WSAStartup(MAKEWORD(1, 1), &wsa))
+	{
+		fprintf(stderr, "wsserver: cannot start sockets\n");
+		goto cleanup;
+	}
+#endif
+
+	/* allocate the control structure */
+	SC = (ws_server_ctrl_t *) malloc(sizeof(ws_server_ctrl_t));
+	if (SC == NULL) {
+		fprintf(stderr, "ws_start_server: out of memory\n");
+		interr = FT_ERR_OUT_OF_MEM;
+		goto cleanup;
+	}
+
+	/* create TCP socket */
+	s = socket(PF_INET, SOCK_STREAM, 0);
+	if (s == INVALID_SOCKET) {
+		perror("ws_start_server socket");
+		goto cleanup;
+	}
+
+	/* prevent "bind: address already in use" */
+	optval = 1;
+	if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*)&optval, sizeof(optval)) < 0) {
+		perror("ws_start_server setsockopt");
+		/* not really critical - we go on */
+	}
+
+	/* bind socket to the specified port (all interfaces) */
+	bzero(&sa, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port   = htons(port);
+	sa.sin_addr.s_addr = htonl(INADDR_ANY);
+
+	if (bind(s, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+		perror("ws_start_server bind");
+		goto cleanup;
+	}
+
+	if (ws_aux_nonblocking(s) != 0) {
+		fprintf(stderr, "ws_start_server: could not set non-blocking mode\n");
+		goto cleanup;
+	}
+
+	if (listen(s, BACKLOG)<0) {
+		perror("ws_start_server listen");
+		goto cleanup;
+	}
+
+	/* set some control variables */
+	SC->num_clients = 0;
+	SC->should_exit = 0;
+	SC->server_socket = s;
+	SC->ft_buffer = ft_buffer;
+	SC->verbosity = 1;
+
+	/* if things go wrong after this, it's because of pthread issues */
+	interr = FT_ERR_THREADING;
+
+	if (pthread_mutex_init(&SC->mutex, NULL) != 0) {
+		fprintf(stderr, "ws_start_server: mutex could not be initialised\n");
+		goto cleanup;
+	}
+
+	if (pthread_create(&SC->thread, NULL, _wsserver_thread, SC) == 0) {
+		/* everything went fine - thread should be running now */
+		if (errval != NULL) *errval = FT_NO_ERROR;
+		return SC;
+	}
+
+	pthread_mutex_destroy(&SC->mutex);
+cleanup:
+	if (errval!=NULL) *errval = interr;
+	if (SC != NULL) free(SC);
+	if (s != INVALID_SOCKET) closesocket(s);
+	return NULL;
+}
+
+/* see header file for documentation */
+int ws_stop_server(ws_server_ctrl_t *SC) {
+	if (SC==NULL) return -1;
+
+	pthread_mutex_lock(&SC->mutex);
+	SC->should_exit = 1;
+	pthread_mutex_unlock(&SC->mutex);
+
+	pthread_join(SC->thread, NULL);
+	pthread_mutex_destroy(&SC->mutex);
+
+	closesocket(SC->server_socket);
+	free(SC);
+	return 0;
+}
+
+/* see header file for documentation */
+int ws_get_num_clients(ws_server_ctrl_t *SC) {
+	int nc;
+	if (SC==NULL) return 0;
+	pthread_mutex_lock(&SC->mutex);
+	nc = SC->num_clients;
+	pthread_mutex_unlock(&SC->mutex);
+	return nc;
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+
+#ifndef WSSERVER_H
+#define WSSERVER_H
+
+#include <pthread.h>
+#include "platform.h"
+#include "buffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* as in rdaserver.h, which may have been included already */
+#if !defined(PLATFORM_WINDOWS) && !defined(INVALID_SOCKET)
+typedef int SOCKET;
+#define INVALID_SOCKET  -1
+#endif
+
+/** Error values as returned by ws_start_server, the same as for rda_start_server */
+#define FT_NO_ERROR         0
+#define FT_ERR_OUT_OF_MEM   1
+#define FT_ERR_SOCKET       2
+#define FT_ERR_THREADING    3
+
+/** 'select' cannot handle more than 64 elements on Windows, see rdaserver.h */
+#define WS_MAX_NUM_CLIENTS  32
+
+/** Size of the HTTP request, and of the largest frame that a client may send */
+#define WS_MAX_REQUEST      4096
+
+/** Number of bytes that may be queued for a client before its frames are held back
+    and its decimation is increased */
+#define WS_MAX_QUEUED       262144
+
+/** Largest number of min/max pairs per channel in a frame, if there are more
+    samples the decimation is increased, or the oldest samples are skipped */
+#define WS_MAX_BUCKETS      4096
+
+/** Largest decimation of the rate adaptation */
+#define WS_MAX_DECIMATE     65536
+
+/** Number of samples that are read from the buffer at once */
+#define WS_READ_SAMPLES     4096
+
+/** Number of frames that have to be sent without delay before the decimation is decreased again */
+#define WS_CALM_FRAMES      8
+
+/** Default number of frames per second */
+#define WS_DEFAULT_RATE     20
+
+/** Interval (in ms) at which the thread checks for new samples */
+#define WS_POLL_TIMEOUT     10
+
+#define WS_FRAME_MAGIC      (UINT32_T)0x53575446 /* "FTWS" in little endian */
+
+/** States of a client, see ws_client_t */
+#define WS_CLIENT_HANDSHAKE 0           /**< Waiting for the HTTP upgrade request */
+#define WS_CLIENT_OPEN      1           /**< Receiving frames */
+#define WS_CLIENT_CLOSING   2           /**< Sending the remaining output, then closing */
+
+/**
+  A browser connects to ws://host:port/?chans=0,1,2&decimate=10&rate=20, in
+  which all parameters are optional. chans are the zero-offset indices of the
+  channels (all channels by default), decimate is the smallest number of
+  samples that is summarised in one min/max pair (1 by default), and rate the
+  largest number of frames per second. The same parameters can be changed
+  later on by sending them as a text message, e.g. "decimate=100".
+
+  Whenever the header changes, and when the connection opens, the client
+  receives a text message with the header in JSON, e.g.
+    {"generation":1,"nchans":2,"fsample":1000,"chans":[0,1],"labels":["Cz","Pz"]}
+  and the samples that arrive from then on follow in binary messages, each with
+  a wsframe_t and nbuckets*nchans pairs of single precision floats. The pairs
+  are ordered per bucket and then per channel, min before max, and each pair
+  covers decimate samples, starting at begsample. The fields and the floats are
+  in the byte order of the server, a client that reads the magic in reversed
+  order has to swap them.
+
+  If the frames of a client cannot be sent as fast as they are made, its
+  decimation is doubled, which halves the bandwidth. Once the frames go out
+  without delay again, the decimation is halved until it is back at the
+  requested value. A client can therefore see the decimation change from
+  frame to frame.
+*/
+typedef struct {
+	UINT32_T magic;      /* WS_FRAME_MAGIC */
+	UINT32_T generation; /* generation of the header, see GET_HDR_GEN */
+	UINT32_T begsample;  /* first sample of the first bucket */
+	UINT32_T nbuckets;   /* number of min/max pairs per channel */
+	UINT32_T nchans;
+	UINT32_T decimate;   /* number of samples per bucket */
+} wsframe_t;
+
+/** Internally used data structure to describe a client */
+typedef struct {
+	SOCKET sock;                    /**< Client socket */
+	int state;                      /**< One of the WS_CLIENT_xxx constants */
+	char in[WS_MAX_REQUEST];        /**< Request or frames that have been received */
+	size_t inlen;
+	char *out;                      /**< Frames that still have to be sent */
+	size_t outlen, outsize;
+	UINT32_T nchans;                /**< Number of selected channels, 0 for all channels */
+	UINT32_T *chans;                /**< The indices of the selected channels */
+	UINT32_T mindecimate;           /**< Decimation that the client asked for */
+	UINT32_T decimate;              /**< Current decimation, at least mindecimate */
+	UINT32_T calm;                  /**< Number of frames that were sent without delay */
+	UINT32_T generation;            /**< Generation of the header that the client has, 0 if none */
+	UINT32_T next;                  /**< First sample of the next frame */
+	UINT64_T interval;              /**< Time between frames in ns */
+	UINT64_T due;                   /**< Time at which the next frame can be made */
+} ws_client_t;
+
+/** WebSocket server control structure for starting, inspecting, and stopping a server */
+typedef struct {
+	pthread_t thread;               /**< Thread handle */
+	pthread_mutex_t mutex;          /**< Mutex for protecting num_clients */
+	SOCKET server_socket;           /**< The server socket that clients connect to */
+	int ft_buffer;                  /**< Connection to FieldTrip buffer (socket or 0 for dmarequests) */
+	volatile int num_clients;       /**< Current number of clients */
+	volatile int should_exit;       /**< Flag to notify the server thread that it should stop */
+	int verbosity;                  /**< Option that determines how much status information is printed during operation */
+} ws_server_ctrl_t;
+
+/** Starts a server that streams the samples of a FieldTrip buffer to WebSocket clients,
+    usually browsers, each with its own channel selection, decimation and frame rate.
+	@param ft_buffer        FieldTrip connection (0 for DMA, or socket for TCP connection)
+	@param port             Port number to bind to
+	@param errval           Optional pointer to an integer error value. Will contain either
+	                        FT_NO_ERROR, FT_ERR_SOCKET, FT_OUT_OF_MEM or FT_THREADING on exit.
+	@return                 Pointer to the control structure, or NULL if an error occured
+*/
+ws_server_ctrl_t *ws_start_server(int ft_buffer, int port, int *errval);
+
+/** Stops a WebSocket server, closes all connections, and deallocates the control structure
+	@param  SC      Must point to a control structure as created by ws_start_server
+	@return -1      if SC is NULL
+	         0      on success
+*/
+int ws_stop_server(ws_server_ctrl_t *SC);
+
+/** Returns the current number of clients of a WebSocket server */
+int ws_get_num_clients(ws_server_ctrl_t *SC);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WSSERVER_H */
@@ -26,7 +26,7 @@ SUFFIX = .exe
 
 all: demo
 
-test: test_gethdr.exe test_getdat.exe test_getevt.exe test_flushhdr.exe test_flushdat.exe test_flushevt.exe test_connect.exe test_nslookup.exe test_benchmark.exe test_waitdat.exe
+test: test_gethdr.exe test_getdat.exe test_getevt.exe test_flushhdr.exe test_flushdat.exe test_flushevt.exe test_connect.exe test_nslookup.exe test_benchmark.exe test_waitdat.exe test_getstats.exe test_swap.exe test_compress.exe test_async.exe test_streams.exe test_waitwake.exe test_ringpos.exe
 
 demo: demo_sinewave$(SUFFIX) demo_event$(SUFFIX) demo_buffer$(SUFFIX) demo_combined$(SUFFIX) demo_buffer_unix$(SUFFIX)
 
@@ -80,6 +80,27 @@ test_connect.exe: test_connect.obj
 	
 test_waitdat.exe: test_waitdat.obj
 	$(LD) /OUT:$@ $** $(LIBS)
+
+test_getstats.exe: test_getstats.obj
+	$(LD) /OUT:$@ $** $(LIBS)
+
+test_swap.exe: test_swap.obj
+	$(LD) /OUT:$@ $** $(LIBS)
+
+test_compress.exe: test_compress.obj
+	$(LD) /OUT:$@ $** $(LIBS)
+
+test_async.exe: test_async.obj
+	$(LD) /OUT:$@ $** $(LIBS)
+
+test_streams.exe: test_streams.obj
+	$(LD) /OUT:$@ $** $(LIBS)
+
+test_waitwake.exe: test_waitwake.obj
+	$(LD) /OUT:$@ $** $(LIBS)
+
+test_ringpos.exe: test_ringpos.obj
+	$(LD) /OUT:$@ $** $(LIBS)
 		
 clean:
 	del *.obj *$(SUFFIX)
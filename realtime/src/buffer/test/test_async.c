@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ * Starts a buffer server with an event loop, submits many requests at once with
+ * the asynchronous client of asyncrequest.c, and checks that every callback gets
+ * the same response, and in the same order, as the requests sent one by one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "buffer.h"
+#include "socketserver.h"
+#include "asyncrequest.h"
+
+#define NCHANS   4
+#define NSAMPLES 200
+#define NREQ     60
+
+typedef struct {
+	int status;
+	int order;       /* the number of callbacks that were called before this one */
+	message_t *response;
+} slot_t;
+
+static int numCalled = 0;
+
+static void callback(int status, message_t *response, void *user_data) {
+	slot_t *slot = (slot_t *) user_data;
+	slot->status   = status;
+	slot->order    = numCalled++;
+	slot->response = response;
+}
+
+/* writes a request with the given command and buffer over a blocking connection */
+static message_t *request_sync(int sock, UINT16_T command, void *buf, UINT32_T bufsize) {
+	message_t request, *response = NULL;
+	messagedef_t def;
+
+	def.version = VERSION;
+	def.command = command;
+	def.bufsize = bufsize;
+	request.def = &def;
+	request.buf = buf;
+	if (tcprequest(sock, &request, &response) < 0) cleanup_message((void **) &response);
+	return response;
+}
+
+/* every third request asks for the header, the others for a range of samples, some beyond the end */
+static void make_request(int k, messagedef_t *def, datasel_t *sel, message_t *request) {
+	def->version = VERSION;
+	request->def = def;
+	if (k % 3 == 0) {
+		def->command = GET_HDR;
+		def->bufsize = 0;
+		request->buf = NULL;
+	} else {
+		sel->begsample = (k*7) % NSAMPLES;
+		sel->endsample = sel->begsample + k;
+		def->command = GET_DAT;
+		def->bufsize = sizeof(datasel_t);
+		request->buf = sel;
+	}
+}
+
+static int same_response(const message_t *a, const message_t *b) {
+	if (a == NULL || b == NULL) return 0;
+	if (a->def->command != b->def->command || a->def->bufsize != b->def->bufsize) return 0;
+	return a->def->bufsize == 0 || memcmp(a->buf, b->buf, a->def->bufsize) == 0;
+}
+
+int main(int argc, char *argv[]) {
+	static slot_t slots[NREQ];
+	char buf[sizeof(datadef_t) + NSAMPLES*NCHANS*sizeof(float)];
+	headerdef_t header;
+	datadef_t *ddef = (datadef_t *) buf;
+	float *x = (float *) (ddef + 1);
+	ft_buffer_server_t *S;
+	ft_async_conn_t *A;
+	message_t request, *response;
+	messagedef_t def;
+	datasel_t sel;
+	int port = (argc > 1) ? atoi(argv[1]) : 1986;
+	int sock, k, failed = 0;
+
+	if ((S = ft_start_buffer_server_mode(port, NULL, NULL, NULL, FT_SERVER_EVENTLOOP, 1)) == NULL) {
+		fprintf(stderr, "ERROR; failed to start the buffer server\n");
+		exit(1);
+	}
+	if ((sock = open_connection("localhost", port)) < 0) {
+		fprintf(stderr, "ERROR; failed to connect to the buffer server\n");
+		ft_stop_buffer_server(S);
+		exit(1);
+	}
+
+	memset(&header, 0, sizeof(header));
+	header.nchans    = NCHANS;
+	header.fsample   = 100;
+	header.data_type = DATATYPE_FLOAT32;
+	ddef->nchans    = NCHANS;
+	ddef->nsamples  = NSAMPLES;
+	ddef->data_type = DATATYPE_FLOAT32;
+	ddef->bufsize   = NSAMPLES*NCHANS*sizeof(float);
+	for (k=0; k<NSAMPLES*NCHANS; k++) x[k] = (float) k;
+	response = request_sync(sock, PUT_HDR, &header, sizeof(header));
+	if (response == NULL || response->def->command != PUT_OK) failed = 1;
+	cleanup_message((void **) &response);
+	response = request_sync(sock, PUT_DAT, buf, sizeof(buf));
+	if (response == NULL || response->def->command != PUT_OK) failed = 1;
+	cleanup_message((void **) &response);
+	if (failed) {
+		fprintf(stderr, "ERROR; failed to write the header and the samples\n");
+		closesocket(sock);
+		ft_stop_buffer_server(S);
+		exit(1);
+	}
+
+	/* all requests are submitted before any of them is sent */
+	if ((A = ft_async_open(open_connection("localhost", port))) == NULL) {
+		fprintf(stderr, "ERROR; failed to open the asynchronous connection\n");
+		closesocket(sock);
+		ft_stop_buffer_server(S);
+		exit(1);
+	}
+	for (k=0; k<NREQ; k++) {
+		make_request(k, &def, &sel, &request);
+		slots[k].status = 1;
+		if (ft_async_submit(A, &request, callback, &slots[k]) != 0) failed = 1;
+	}
+	if (ft_async_pending(A) != NREQ) failed = 1;
+	for (k=0; k<500 && ft_async_pending(A) > 0; k++) {
+		if (ft_async_poll(&A, 1, 100) < 0) break;
+	}
+	if (ft_async_pending(A) != 0) {
+		fprintf(stderr, "FAILED: %u requests did not get a response\n", ft_async_pending(A));
+		failed = 1;
+	}
+
+	for (k=0; k<NREQ; k++) {
+		make_request(k, &def, &sel, &request);
+		response = NULL;
+		if (tcprequest(sock, &request, &response) < 0 || slots[k].status != 0 || slots[k].order != k || !same_response(slots[k].response, response)) {
+			fprintf(stderr, "FAILED: the response to request %i differs\n", k);
+			failed = 1;
+		}
+		cleanup_message((void **) &response);
+		cleanup_message((void **) &slots[k].response);
+	}
+
+	/* requests that are outstanding when the connection is closed fail */
+	numCalled = 0;
+	for (k=0; k<3; k++) {
+		make_request(k, &def, &sel, &request);
+		slots[k].status = 1;
+		ft_async_submit(A, &request, callback, &slots[k]);
+	}
+	ft_async_close(A);
+	for (k=0; k<3; k++) {
+		if (slots[k].status != -1 || slots[k].response != NULL || slots[k].order != k) {
+			fprintf(stderr, "FAILED: request %i did not fail when the connection was closed\n", k);
+			failed = 1;
+		}
+	}
+
+	closesocket(sock);
+	ft_stop_buffer_server(S);
+	if (!failed) printf("OK\n");
+	exit(failed);
+}
@@ -1,6 +1,39 @@
 /*
- * Use as
+ * Benchmark of the buffer, which measures the throughput and the round-trip
+ * latency of PUT_DAT, GET_DAT and WAIT_DAT requests for a range of channel
+ * counts, block sizes and data types. Use as
+ *    ./test_benchmark [options]
+ * with the following options, lists are separated by commas
+ *    -host <name>          hostname of the buffer, default localhost
+ *    -port <number>        port of the buffer, default 1972
+ *    -socket <path>        UNIX domain socket of the buffer, default /tmp/fieldtrip_buffer
+ *    -transport <name>     tcp, unix or local (dmarequest in this process), default tcp
+ *    -server               start a buffer server in this process, for tcp and unix
+ *    -eventloop <number>   let the buffer server use an event loop with this many threads
+ *    -uring                let the event loop of the buffer server use io_uring (Linux)
+ *    -nchans <list>        number of channels, default 32
+ *    -nsamples <list>      number of samples per PUT_DAT and GET_DAT, default 64
+ *    -type <list>          uint8, int16, int32, float32, float64, etc., default float32
+ *    -writers <number>     number of clients that write data, default 1
+ *    -readers <number>     number of clients that read the newest data, default 0
+ *    -waiters <number>     number of clients that wait for new data, default 0
+ *    -duration <seconds>   duration of each configuration, default 2
+ *    -stateless            open a new connection for each request
+ *    -format <name>        text, csv or json (one object per line), default text
+ *
+ * For example
+ *    ./test_benchmark -transport unix -server -nchans 32,256 -nsamples 1,64,512 -readers 2 -format csv
+ *
+ * Every combination of nchans, nsamples and type is measured in turn, and
+ * results in one line per role (writer, reader and waiter). The latency of
+ * the waiters is the time between a writer starting to send the first block
+ * since the previous wakeup, and the waiter returning from WAIT_DAT. The CPU time is that of the whole process,
+ * including the buffer server for the local transport or with -server, and
+ * is divided over the samples that have been written.
+ *
+ * The old positional arguments are still supported, i.e.
  *    ./test_benchmark localhost 1972 32 512 1
+ * for host, port, nchans, nsamples and stateless.
  *
  * Copyright (C) 2008, Christian Hesse & Robert Oostenveld
  * F.C. Donders Centre for Cognitive Neuroimaging, Radboud University Nijmegen,
@@ -10,182 +43,561 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include "buffer.h"
+#include "socketserver.h"
 #include <pthread.h>
 
-int main(int argc, char *argv[]) {
-  host_t host;
-  
-    /* these variables are for the threading */
-  int rc;
-  pthread_t tid;
-  
-    /* these variables are for writing the data */
-  int i, j, k, status = 0, verbose = 0, samplecount = 0;
-  time_t tic, toc;
-  time_t elapsed;
-  
-  /* these represent the acquisition system properties */
-  int fsample        = 512; /* this is just for the header */
-  int nchans         = 32;
-  int nsamples       = 64;
-  int stateless      = 0;	  /* boolean */
-  
-  /* these are used in the communication and represent statefull information */
-  int server             = -1;
-  message_t    *request  = NULL;
-  message_t    *response = NULL;
-  header_t     *header   = NULL;
-  data_t       *data     = NULL;
-  event_t      *event    = NULL;
-    
-  
-    /* start with defaults */
-  sprintf(host.name, DEFAULT_HOSTNAME);
-  host.port = DEFAULT_PORT;
-  
-  if (argc>1)
-    sprintf(host.name, argv[1]);
-  
-  if (argc>2)
-    host.port = atoi(argv[2]);
-  
-  if (argc>3)
-    nchans = atoi(argv[3]);
-  
-  if (argc>4)
-    nsamples = atoi(argv[4]);
-  
-  if (argc>5)
-    stateless = atoi(argv[5]);
-  
-
-  check_datatypes();
-  
-  if (verbose>0) fprintf(stderr, "test_benchmark: host.name =  %s\n", host.name);
-  if (verbose>0) fprintf(stderr, "test_benchmark: host.port =  %d\n", host.port);
-
-  /* allocate the elements that will be used in the communication */
-  request      = malloc(sizeof(message_t));
-  request->def = malloc(sizeof(messagedef_t));
-  request->buf = NULL;
-  request->def->version = VERSION;
-  request->def->bufsize = 0;
-  
-  header      = malloc(sizeof(header_t));
-  header->def = malloc(sizeof(headerdef_t));
-  header->buf = NULL;
-  
-  data      = malloc(sizeof(data_t));
-  data->def = malloc(sizeof(datadef_t));
-  data->buf = NULL;
-  
-  event      = malloc(sizeof(event_t));
-  event->def = malloc(sizeof(eventdef_t));
-  event->buf = NULL;
-  
-  /* define the header */
-  header->def->nchans    = nchans;
-  header->def->nsamples  = 0;
-  header->def->nevents   = 0;
-  header->def->fsample   = fsample;
-  header->def->data_type = DATATYPE_FLOAT32;
-  header->def->bufsize   = 0;
-  FREE(header->buf);
-  
-  /* define the constant part of the data and allocate space for the variable part */
-  data->def->nchans    = nchans;
-  data->def->nsamples  = nsamples;
-  data->def->data_type = DATATYPE_FLOAT32;
-  data->def->bufsize   = WORDSIZE_FLOAT32*nchans*nsamples;
-  FREE(data->buf);
-  data->buf            = malloc(WORDSIZE_FLOAT32*nchans*nsamples);
-    
-    /* create the random data */
-    for (j=0; j<nsamples; j++)
-      for (i=0; i<nchans;    i++)
-        ((FLOAT32_T *)(data->buf))[j*nchans+i] = 2.0*((FLOAT32_T)rand())/RAND_MAX - 1.0;
-  
-  /* initialization phase, send the header */
-  request->def->command = PUT_HDR;
-  request->def->bufsize = append(&request->buf, request->def->bufsize, header->def, sizeof(headerdef_t));
-  request->def->bufsize = append(&request->buf, request->def->bufsize, header->buf, header->def->bufsize);
-  
-  server = open_connection(host.name, host.port);
-  status = clientrequest(server, request, &response);
-  if (verbose>0) fprintf(stderr, "test_benchmark: clientrequest returned %d\n", status);
-  if (status) {
-    fprintf(stderr, "random: err1\n");
-    goto cleanup;
-  }
-  
-  if (stateless) {
-    status = close_connection(server);
-    if (status) {
-      fprintf(stderr, "random: err2\n");
-      goto cleanup;
-    }
-  }
-  
-  cleanup_message(&request);
-  cleanup_message(&response);
-  request = NULL;
-  response = NULL;
-  
-  tic = time(NULL);
-  
-  while (1) {
-    
-    /* create the request */
-    request      = malloc(sizeof(message_t));
-    request->def = malloc(sizeof(messagedef_t));
-    request->buf = NULL;
-    request->def->version = VERSION;
-    request->def->bufsize = 0;
-    request->def->command = PUT_DAT;
-    request->def->bufsize = append(&request->buf, request->def->bufsize, data->def, sizeof(datadef_t));
-    request->def->bufsize = append(&request->buf, request->def->bufsize, data->buf, data->def->bufsize);
-    
-    if (stateless)
-      server = open_connection(host.name, host.port);
-    
-    status = clientrequest(server, request, &response);
-    if (verbose>0) fprintf(stderr, "random: clientrequest returned %d\n", status);
-    if (status) {
-      fprintf(stderr, "random: err3\n");
-      goto cleanup;
-    }
-
-    if (stateless) {
-      status = close_connection(server);
-      if (status) {
-        fprintf(stderr, "random: err4\n");
-        goto cleanup;
-      }
-    }
-
-    cleanup_message(&request);
-    cleanup_message(&response);
-    request = NULL;
-    response = NULL;
-    
-    samplecount += nsamples*nchans;
-    toc = time(NULL);
-    elapsed = toc-tic;
-    
-   fprintf(stderr, "samplecount = %d, elapsed = %d, samples/sec = %f\n", samplecount, elapsed, ((float)(samplecount))/((float)elapsed));
-    
-  } /* while(1) */
-  
-  cleanup:
-    cleanup_event(&event);
-    cleanup_data(&data);
-    cleanup_header(&header);
-    cleanup_message(&request);
-    cleanup_message(&response);
-    
-    pthread_exit(0);
-    return 0;
+#define MAXLIST   32
+#define MAXCLIENT 64
+#define PUTRING   1024
+
+#define TRANSPORT_TCP   0
+#define TRANSPORT_UNIX  1
+#define TRANSPORT_LOCAL 2
+
+#define ROLE_WRITER 0
+#define ROLE_READER 1
+#define ROLE_WAITER 2
+
+#define FORMAT_TEXT 0
+#define FORMAT_CSV  1
+#define FORMAT_JSON 2
+
+static const char *role_name[] = {"writer", "reader", "waiter"};
+static const char *transport_name[] = {"tcp", "unix", "local"};
+static const char *type_name[] = {"char", "uint8", "uint16", "uint32", "uint64", "int8", "int16", "int32", "int64", "float32", "float64"};
+
+/* the settings of the benchmark */
+typedef struct {
+	char hostname[HOSTNAME_LENGTH];
+	int port;
+	char socket[256];
+	int transport;
+	int server;
+	int eventloop;
+	int uring;
+	int nchans[MAXLIST], num_nchans;
+	int nsamples[MAXLIST], num_nsamples;
+	UINT32_T type[MAXLIST];
+	int num_type;
+	int writers, readers, waiters;
+	double duration;
+	int stateless;
+	int format;
+} settings_t;
+
+/* the state of one client, which runs in its own thread */
+typedef struct {
+	int role;
+	int nchans, nsamples;
+	UINT32_T type;
+	UINT64_T ops, errors, samples;
+	float *latency;          /* in microseconds, one for each request */
+	UINT64_T numlatency, maxlatency;
+	pthread_t tid;
+} client_t;
+
+static settings_t settings;
+
+/* this is shared between the clients of one configuration */
+static volatile int keep_running = 0;
+static pthread_mutex_t mutexwritten = PTHREAD_MUTEX_INITIALIZER;
+static UINT32_T written = 0;          /* number of samples that have been written */
+static UINT64_T putcount = 0;         /* number of PUT_DAT requests that have been started */
+static double put_start[PUTRING];     /* time at which the most recent PUT_DAT requests were started */
+
+/* returns the time in seconds since some unspecified starting point, this is the clock of the buffer itself */
+static double wall_time(void) {
+	return ft_clock_seconds();
+}
+
+/* returns the CPU time of this process in seconds */
+static double cpu_time(void) {
+#ifdef CLOCK_PROCESS_CPUTIME_ID
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + 1e-9*ts.tv_nsec;
+#else
+	return (double) clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+static int parse_type(const char *name, UINT32_T *type) {
+	UINT32_T i;
+	for (i=0; i<sizeof(type_name)/sizeof(type_name[0]); i++) {
+		if (strcmp(name, type_name[i]) == 0) {
+			*type = i;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* parses a comma-separated list of numbers, returns the number of elements or -1 */
+static int parse_list(const char *str, int *list) {
+	int n = 0;
+	while (*str) {
+		if (n == MAXLIST) return -1;
+		list[n] = atoi(str);
+		if (list[n] <= 0) return -1;
+		n++;
+		while (*str && *str != ',') str++;
+		if (*str == ',') str++;
+	}
+	return n;
+}
+
+static int parse_type_list(const char *str, UINT32_T *list) {
+	char name[32];
+	int n = 0, k;
+	while (*str) {
+		if (n == MAXLIST) return -1;
+		for (k=0; *str && *str != ',' && k<31; k++) name[k] = *str++;
+		name[k] = 0;
+		if (parse_type(name, &list[n++]) != 0) return -1;
+		if (*str == ',') str++;
+	}
+	return n;
+}
+
+static void usage(void) {
+	fprintf(stderr, "USAGE: test_benchmark [-host <name>] [-port <number>] [-socket <path>] [-transport tcp|unix|local] [-server] [-eventloop <number>] [-uring]\n");
+	fprintf(stderr, "                      [-nchans <list>] [-nsamples <list>] [-type <list>] [-writers <number>] [-readers <number>] [-waiters <number>]\n");
+	fprintf(stderr, "                      [-duration <seconds>] [-stateless] [-format text|csv|json]\n");
+	exit(1);
+}
+
+static void parse_arguments(int argc, char *argv[]) {
+	int i;
+
+	sprintf(settings.hostname, DEFAULT_HOSTNAME);
+	settings.port = DEFAULT_PORT;
+	sprintf(settings.socket, "/tmp/fieldtrip_buffer");
+	settings.transport    = TRANSPORT_TCP;
+	settings.server       = 0;
+	settings.eventloop    = 0;
+	settings.uring        = 0;
+	settings.nchans[0]    = 32;
+	settings.num_nchans   = 1;
+	settings.nsamples[0]  = 64;
+	settings.num_nsamples = 1;
+	settings.type[0]      = DATATYPE_FLOAT32;
+	settings.num_type     = 1;
+	settings.writers      = 1;
+	settings.readers      = 0;
+	settings.waiters      = 0;
+	settings.duration     = 2;
+	settings.stateless    = 0;
+	settings.format       = FORMAT_TEXT;
+
+	if (argc>1 && argv[1][0] != '-') {
+		/* the old positional arguments */
+		if (argc>1) strncpy(settings.hostname, argv[1], HOSTNAME_LENGTH-1);
+		if (argc>2) settings.port = atoi(argv[2]);
+		if (argc>3) settings.nchans[0] = atoi(argv[3]);
+		if (argc>4) settings.nsamples[0] = atoi(argv[4]);
+		if (argc>5) settings.stateless = atoi(argv[5]);
+		return;
+	}
+
+	for (i=1; i<argc; i++) {
+		const char *value = (i+1<argc) ? argv[i+1] : NULL;
+
+		if (strcmp(argv[i], "-server") == 0) {
+			settings.server = 1;
+			continue;
+		}
+		if (strcmp(argv[i], "-stateless") == 0) {
+			settings.stateless = 1;
+			continue;
+		}
+		if (strcmp(argv[i], "-uring") == 0) {
+			settings.uring = 1;
+			continue;
+		}
+		if (value == NULL) usage();
+		i++;
+
+		if (strcmp(argv[i-1], "-host") == 0) {
+			strncpy(settings.hostname, value, HOSTNAME_LENGTH-1);
+		} else if (strcmp(argv[i-1], "-port") == 0) {
+			settings.port = atoi(value);
+		} else if (strcmp(argv[i-1], "-socket") == 0) {
+			strncpy(settings.socket, value, sizeof(settings.socket)-1);
+		} else if (strcmp(argv[i-1], "-transport") == 0) {
+			for (settings.transport=0; settings.transport<3; settings.transport++) {
+				if (strcmp(value, transport_name[settings.transport]) == 0) break;
+			}
+			if (settings.transport == 3) usage();
+		} else if (strcmp(argv[i-1], "-eventloop") == 0) {
+			settings.eventloop = atoi(value);
+		} else if (strcmp(argv[i-1], "-nchans") == 0) {
+			if ((settings.num_nchans = parse_list(value, settings.nchans)) <= 0) usage();
+		} else if (strcmp(argv[i-1], "-nsamples") == 0) {
+			if ((settings.num_nsamples = parse_list(value, settings.nsamples)) <= 0) usage();
+		} else if (strcmp(argv[i-1], "-type") == 0) {
+			if ((settings.num_type = parse_type_list(value, settings.type)) <= 0) usage();
+		} else if (strcmp(argv[i-1], "-writers") == 0) {
+			settings.writers = atoi(value);
+		} else if (strcmp(argv[i-1], "-readers") == 0) {
+			settings.readers = atoi(value);
+		} else if (strcmp(argv[i-1], "-waiters") == 0) {
+			settings.waiters = atoi(value);
+		} else if (strcmp(argv[i-1], "-duration") == 0) {
+			settings.duration = atof(value);
+		} else if (strcmp(argv[i-1], "-format") == 0) {
+			if (strcmp(value, "text") == 0) settings.format = FORMAT_TEXT;
+			else if (strcmp(value, "csv") == 0) settings.format = FORMAT_CSV;
+			else if (strcmp(value, "json") == 0) settings.format = FORMAT_JSON;
+			else usage();
+		} else {
+			usage();
+		}
+	}
+
+	if (settings.writers < 1 || settings.readers < 0 || settings.waiters < 0 || settings.writers + settings.readers + settings.waiters > MAXCLIENT || settings.duration <= 0) {
+		fprintf(stderr, "test_benchmark: there should be at least one writer, and at most %d clients\n", MAXCLIENT);
+		exit(1);
+	}
+}
+
+/* returns a connection to the buffer, 0 for the local transport, or a negative number on errors */
+static int connect_buffer(void) {
+	switch (settings.transport) {
+		case TRANSPORT_TCP:
+			return open_connection(settings.hostname, settings.port);
+		case TRANSPORT_UNIX:
+			return open_unix_connection(settings.socket);
+		default:
+			return 0;
+	}
+}
+
+static void disconnect_buffer(int server) {
+	if (server > 0) close_connection(server);
+}
+
+/* sends the request, copies the first SIZE bytes of the response into RESULT,
+ * and returns the command of the response or 0 on errors */
+static int do_request(int *server, message_t *request, void *result, UINT32_T size) {
+	message_t *response = NULL;
+	int command = 0;
+
+	if (settings.stateless && (*server = connect_buffer()) < 0) return 0;
+	if (clientrequest(*server, request, &response) == 0 && response != NULL && response->def != NULL) {
+		command = response->def->command;
+		if (size > 0) {
+			if (response->def->bufsize >= size)
+				memcpy(result, response->buf, size);
+			else
+				command = 0;
+		}
+	}
+	cleanup_message((void **) &response);
+	if (settings.stateless) disconnect_buffer(*server);
+	return command;
+}
+
+static void add_latency(client_t *C, double latency) {
+	if (C->numlatency == C->maxlatency) {
+		C->maxlatency = C->maxlatency ? 2*C->maxlatency : 4096;
+		C->latency = (float *) realloc(C->latency, C->maxlatency * sizeof(float));
+		DIE_BAD_MALLOC(C->latency);
+	}
+	C->latency[C->numlatency++] = (float) (1e6*latency);
 }
 
+static void *client_thread(void *arg) {
+	client_t *C = (client_t *) arg;
+	int server = 0;
+	message_t request;
+	messagedef_t def;
+	datadef_t *ddef;
+	datasel_t datasel;
+	waitdef_t waitdef;
+	samples_events_t nret;
+	UINT32_T wordsize = wordsize_from_type(C->type);
+	UINT32_T seen = 0, n;
+	UINT64_T nextput = 0, started;
+	double t0, put;
+	char *buf = NULL;
+	int i;
+
+	if (!settings.stateless && (server = connect_buffer()) < 0) {
+		fprintf(stderr, "test_benchmark: cannot connect to the buffer\n");
+		C->errors++;
+		return NULL;
+	}
+
+	def.version = VERSION;
+	request.def = &def;
+
+	if (C->role == ROLE_WRITER) {
+		/* the data is random, but always the same */
+		buf = (char *) malloc(sizeof(datadef_t) + wordsize*C->nchans*C->nsamples);
+		DIE_BAD_MALLOC(buf);
+		ddef = (datadef_t *) buf;
+		ddef->nchans    = C->nchans;
+		ddef->nsamples  = C->nsamples;
+		ddef->data_type = C->type;
+		ddef->bufsize   = wordsize*C->nchans*C->nsamples;
+		for (i=0; i<ddef->bufsize; i++) buf[sizeof(datadef_t)+i] = (char) rand();
+		def.command = PUT_DAT;
+		def.bufsize = sizeof(datadef_t) + ddef->bufsize;
+		request.buf = buf;
+	}
+
+	while (keep_running) {
+		switch (C->role) {
+			case ROLE_WRITER:
+				t0 = wall_time();
+				pthread_mutex_lock(&mutexwritten);
+				put_start[putcount++ % PUTRING] = t0;
+				pthread_mutex_unlock(&mutexwritten);
+				if (do_request(&server, &request, NULL, 0) == PUT_OK) {
+					add_latency(C, wall_time() - t0);
+					pthread_mutex_lock(&mutexwritten);
+					written += C->nsamples;
+					pthread_mutex_unlock(&mutexwritten);
+					C->samples += C->nsamples;
+				} else {
+					C->errors++;
+				}
+				C->ops++;
+				break;
+
+			case ROLE_READER:
+				/* read the newest block */
+				pthread_mutex_lock(&mutexwritten);
+				n = written;
+				pthread_mutex_unlock(&mutexwritten);
+				if (n < C->nsamples) {
+					usleep(1000);
+					continue;
+				}
+				datasel.begsample = n - C->nsamples;
+				datasel.endsample = n - 1;
+				def.command = GET_DAT;
+				def.bufsize = sizeof(datasel_t);
+				request.buf = &datasel;
+				t0 = wall_time();
+				if (do_request(&server, &request, NULL, 0) == GET_OK) {
+					add_latency(C, wall_time() - t0);
+					C->samples += C->nsamples;
+				} else {
+					C->errors++;
+				}
+				C->ops++;
+				break;
+
+			case ROLE_WAITER:
+				waitdef.threshold.nsamples = seen;
+				waitdef.threshold.nevents  = 0xFFFFFFFF;
+				waitdef.milliseconds = 100;
+				def.command = WAIT_DAT;
+				def.bufsize = sizeof(waitdef_t);
+				request.buf = &waitdef;
+				if (do_request(&server, &request, &nret, sizeof(nret)) != WAIT_OK) {
+					C->errors++;
+					C->ops++;
+					break;
+				}
+				t0 = wall_time();
+				if (nret.nsamples > seen) {
+					/* this wakeup is due to the first PUT_DAT that was started after the previous one */
+					pthread_mutex_lock(&mutexwritten);
+					started = putcount;
+					if (started > nextput) {
+						put = put_start[(started - nextput > PUTRING ? started - PUTRING : nextput) % PUTRING];
+						add_latency(C, t0 - put);
+					}
+					nextput = started;
+					pthread_mutex_unlock(&mutexwritten);
+					C->samples += nret.nsamples - seen;
+					seen = nret.nsamples;
+				}
+				C->ops++;
+				break;
+		}
+	}
+
+	FREE(buf);
+	if (!settings.stateless) disconnect_buffer(server);
+	return NULL;
+}
+
+static int compare_float(const void *a, const void *b) {
+	float x = *(const float *) a;
+	float y = *(const float *) b;
+	return (x > y) - (x < y);
+}
+
+static double percentile(const float *sorted, UINT64_T n, double fraction) {
+	UINT64_T i;
+	if (n == 0) return 0;
+	i = (UINT64_T) (fraction * n);
+	if (i >= n) i = n-1;
+	return sorted[i];
+}
+
+static void print_header(void) {
+	if (settings.format == FORMAT_CSV) {
+		printf("transport,nchans,nsamples,type,writers,readers,waiters,stateless,role,duration,ops,errors,samples_per_sec,mbytes_per_sec,p50_us,p99_us,p999_us,cpu_ns_per_sample\n");
+	} else if (settings.format == FORMAT_TEXT) {
+		printf("%-9s %6s %8s %-7s %-6s %9s %6s %13s %9s %9s %9s %9s %9s\n", "transport", "nchans", "nsamples", "type", "role", "ops", "errors", "samples/sec", "MB/sec", "p50 us", "p99 us", "p999 us", "cpu ns");
+	}
+	fflush(stdout);
+}
+
+/* merges the results of the clients with the given role and prints them */
+static void print_result(client_t *clients, int nclients, int role, double elapsed, double cpu, UINT64_T totalwritten) {
+	UINT64_T ops = 0, errors = 0, samples = 0, n = 0;
+	float *latency = NULL;
+	double rate, mbytes, p50, p99, p999, cpu_ns;
+	int i, present = 0, nchans = 0, nsamples = 0;
+	UINT32_T type = 0;
+
+	for (i=0; i<nclients; i++) {
+		if (clients[i].role != role) continue;
+		present = 1;
+		nchans   = clients[i].nchans;
+		nsamples = clients[i].nsamples;
+		type     = clients[i].type;
+		ops     += clients[i].ops;
+		errors  += clients[i].errors;
+		samples += clients[i].samples;
+		n       += clients[i].numlatency;
+	}
+	if (!present) return;
+
+	if (n > 0) {
+		latency = (float *) malloc(n * sizeof(float));
+		DIE_BAD_MALLOC(latency);
+		n = 0;
+		for (i=0; i<nclients; i++) {
+			if (clients[i].role != role) continue;
+			memcpy(latency + n, clients[i].latency, clients[i].numlatency * sizeof(float));
+			n += clients[i].numlatency;
+		}
+		qsort(latency, n, sizeof(float), compare_float);
+	}
+	p50  = percentile(latency, n, 0.5);
+	p99  = percentile(latency, n, 0.99);
+	p999 = percentile(latency, n, 0.999);
+	FREE(latency);
+
+	rate   = samples / elapsed;
+	mbytes = rate * nchans * wordsize_from_type(type) / (1024.0*1024.0);
+	cpu_ns = totalwritten ? 1e9 * cpu / totalwritten : 0;
+
+	switch (settings.format) {
+		case FORMAT_CSV:
+			printf("%s,%d,%d,%s,%d,%d,%d,%d,%s,%.3f,%llu,%llu,%.1f,%.3f,%.1f,%.1f,%.1f,%.1f\n",
+					transport_name[settings.transport], nchans, nsamples, type_name[type],
+					settings.writers, settings.readers, settings.waiters, settings.stateless, role_name[role], elapsed,
+					(unsigned long long) ops, (unsigned long long) errors, rate, mbytes, p50, p99, p999, cpu_ns);
+			break;
+		case FORMAT_JSON:
+			printf("{\"transport\": \"%s\", \"nchans\": %d, \"nsamples\": %d, \"type\": \"%s\", \"writers\": %d, \"readers\": %d, \"waiters\": %d, \"stateless\": %d, "
+					"\"role\": \"%s\", \"duration\": %.3f, \"ops\": %llu, \"errors\": %llu, \"samples_per_sec\": %.1f, \"mbytes_per_sec\": %.3f, "
+					"\"p50_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f, \"cpu_ns_per_sample\": %.1f}\n",
+					transport_name[settings.transport], nchans, nsamples, type_name[type],
+					settings.writers, settings.readers, settings.waiters, settings.stateless, role_name[role], elapsed,
+					(unsigned long long) ops, (unsigned long long) errors, rate, mbytes, p50, p99, p999, cpu_ns);
+			break;
+		default:
+			printf("%-9s %6d %8d %-7s %-6s %9llu %6llu %13.1f %9.3f %9.1f %9.1f %9.1f %9.1f\n",
+					transport_name[settings.transport], nchans, nsamples, type_name[type], role_name[role],
+					(unsigned long long) ops, (unsigned long long) errors, rate, mbytes, p50, p99, p999, cpu_ns);
+	}
+	fflush(stdout);
+}
+
+/* runs one configuration, returns 0 on success */
+static int run_benchmark(int nchans, int nsamples, UINT32_T type) {
+	client_t clients[MAXCLIENT];
+	int nclients = settings.writers + settings.readers + settings.waiters;
+	int server, i, rc;
+	double tic, toc, cpu;
+	UINT64_T totalwritten = 0;
+
+	/* start with an empty buffer, this also writes the header */
+	if ((server = connect_buffer()) < 0) {
+		fprintf(stderr, "test_benchmark: cannot connect to the buffer\n");
+		return -1;
+	}
+	if (write_header(server, type, nchans, 1000) != 0) {
+		fprintf(stderr, "test_benchmark: cannot write the header\n");
+		disconnect_buffer(server);
+		return -1;
+	}
+	disconnect_buffer(server);
+	written  = 0;
+	putcount = 0;
+
+	memset(clients, 0, sizeof(clients));
+	for (i=0; i<nclients; i++) {
+		clients[i].role     = i < settings.writers ? ROLE_WRITER : (i < settings.writers + settings.readers ? ROLE_READER : ROLE_WAITER);
+		clients[i].nchans   = nchans;
+		clients[i].nsamples = nsamples;
+		clients[i].type     = type;
+	}
+
+	keep_running = 1;
+	tic = wall_time();
+	cpu = cpu_time();
+	for (i=0; i<nclients; i++) {
+		if ((rc = pthread_create(&clients[i].tid, NULL, client_thread, &clients[i])) != 0) {
+			fprintf(stderr, "test_benchmark: cannot start client thread (return code %d)\n", rc);
+			exit(1);
+		}
+	}
+	usleep((unsigned int) (settings.duration * 1000000));
+	keep_running = 0;
+	for (i=0; i<nclients; i++) pthread_join(clients[i].tid, NULL);
+	toc = wall_time();
+	cpu = cpu_time() - cpu;
+
+	for (i=0; i<nclients; i++) {
+		if (clients[i].role == ROLE_WRITER) totalwritten += clients[i].samples;
+	}
+	print_result(clients, nclients, ROLE_WRITER, toc-tic, cpu, totalwritten);
+	print_result(clients, nclients, ROLE_READER, toc-tic, cpu, totalwritten);
+	print_result(clients, nclients, ROLE_WAITER, toc-tic, cpu, totalwritten);
+
+	for (i=0; i<nclients; i++) FREE(clients[i].latency);
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	ft_buffer_server_t *server = NULL;
+	int i, j, k, status = 0;
+
+	parse_arguments(argc, argv);
+	check_datatypes();
+
+	if (settings.server && settings.transport != TRANSPORT_LOCAL) {
+		int port = settings.transport == TRANSPORT_TCP ? settings.port : 0;
+		if (settings.eventloop > 0 || settings.uring)
+			server = ft_start_buffer_server_mode(port, settings.socket, NULL, NULL, settings.uring ? FT_SERVER_URING : FT_SERVER_EVENTLOOP, settings.eventloop);
+		else
+			server = ft_start_buffer_server(port, settings.socket, NULL, NULL);
+		if (server == NULL) {
+			fprintf(stderr, "test_benchmark: cannot start the buffer server\n");
+			exit(1);
+		}
+		/* keep the output clean */
+		server->verbosity = 0;
+	}
+
+	print_header();
+	for (i=0; i<settings.num_nchans && status==0; i++)
+		for (j=0; j<settings.num_nsamples && status==0; j++)
+			for (k=0; k<settings.num_type && status==0; k++)
+				status = run_benchmark(settings.nchans[i], settings.nsamples[j], settings.type[k]);
+
+	if (server) ft_stop_buffer_server(server);
+	return status ? 1 : 0;
+}
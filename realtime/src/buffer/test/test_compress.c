@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ * Compresses blocks of samples of all data types with the codecs of compress.c,
+ * and checks that decompressing them gives back exactly the same block, and
+ * that malformed or truncated blocks are refused.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "buffer.h"
+#include "compress.h"
+
+#define NSAMPLES 500
+
+static const UINT32_T types[] = {DATATYPE_UINT8, DATATYPE_UINT16, DATATYPE_UINT32, DATATYPE_UINT64,
+	DATATYPE_INT8, DATATYPE_INT16, DATATYPE_INT32, DATATYPE_INT64, DATATYPE_FLOAT32, DATATYPE_FLOAT64};
+
+/* writes sample j of channel i of a signal that is smooth (0), noise (1), or jumps between the extremes (2) */
+static void set_sample(UINT32_T type, void *dest, int signal, int i, int j) {
+	double x;
+	unsigned long r = (unsigned long) rand();
+
+	if (signal == 0)
+		x = 1000*sin(0.01*j*(i+1)) + 10*i;
+	else if (signal == 1)
+		x = (double) (r % 200000) - 100000;
+	else
+		x = ((i+j) % 2) ? 1e30 : -1e30;
+
+	switch (type) {
+		/* the jumping signal alternates between the smallest and the largest integer */
+		case DATATYPE_UINT8:   *(UINT8_T *)  dest = (UINT8_T)  (signal == 2 ? (x > 0 ? 255 : 0) : (long) x); break;
+		case DATATYPE_UINT16:  *(UINT16_T *) dest = (UINT16_T) (signal == 2 ? (x > 0 ? 65535 : 0) : (long) x); break;
+		case DATATYPE_UINT32:  *(UINT32_T *) dest = (UINT32_T) (signal == 2 ? (x > 0 ? 0xFFFFFFFFu : 0) : (long) x); break;
+		case DATATYPE_UINT64:  *(UINT64_T *) dest = (UINT64_T) (signal == 2 ? (x > 0 ? ~(UINT64_T) 0 : 0) : (INT64_T) x); break;
+		case DATATYPE_INT8:    *(INT8_T *)   dest = (INT8_T)   (signal == 2 ? (x > 0 ? 127 : -128) : (long) x); break;
+		case DATATYPE_INT16:   *(INT16_T *)  dest = (INT16_T)  (signal == 2 ? (x > 0 ? 32767 : -32768) : (long) x); break;
+		case DATATYPE_INT32:   *(INT32_T *)  dest = (INT32_T)  (signal == 2 ? (x > 0 ? 0x7FFFFFFF : -0x7FFFFFFF-1) : (long) x); break;
+		case DATATYPE_INT64:   *(INT64_T *)  dest = (signal == 2 ? (x > 0 ? (INT64_T) (~(UINT64_T) 0 >> 1) : -(INT64_T) (~(UINT64_T) 0 >> 1) - 1) : (INT64_T) x); break;
+		case DATATYPE_FLOAT32: *(float *)    dest = (float) x; break;
+		case DATATYPE_FLOAT64: *(double *)   dest = x; break;
+	}
+}
+
+/* returns the number of round trips that did not give back the block */
+static int check(UINT32_T type, UINT32_T nchans, int signal, UINT32_T codecs, int *compressed) {
+	UINT32_T wordsize = wordsize_from_type(type);
+	UINT32_T bufsize = sizeof(datadef_t) + NSAMPLES*nchans*wordsize, zsize, size;
+	char *buf = (char *) malloc(bufsize), *zbuf, *out;
+	datadef_t *ddef = (datadef_t *) buf;
+	int i, j, errors = 0;
+
+	ddef->nchans    = nchans;
+	ddef->nsamples  = NSAMPLES;
+	ddef->data_type = type;
+	ddef->bufsize   = NSAMPLES*nchans*wordsize;
+	for (j=0; j<NSAMPLES; j++) {
+		for (i=0; i<(int) nchans; i++) set_sample(type, buf + sizeof(datadef_t) + (j*nchans + i)*wordsize, signal, i, j);
+	}
+
+	/* NULL means that the block is sent as it is */
+	zbuf = (char *) ft_compress_data(buf, bufsize, codecs, &zsize);
+	if (zbuf != NULL) {
+		(*compressed)++;
+		out = (char *) ft_decompress_data(zbuf, zsize, codecs, &size);
+		if (out == NULL || size != bufsize || memcmp(out, buf, bufsize) != 0) errors++;
+		FREE(out);
+
+		/* a truncated block and a codec that was not negotiated are refused */
+		out = (char *) ft_decompress_data(zbuf, zsize - 1, codecs, &size);
+		if (out != NULL) errors++;
+		FREE(out);
+		out = (char *) ft_decompress_data(zbuf, zsize, 0, &size);
+		if (out != NULL) errors++;
+		FREE(out);
+		free(zbuf);
+	}
+	if (errors) fprintf(stderr, "FAILED: type %u, %u channels, signal %i, codecs %u\n", type, nchans, signal, codecs);
+	free(buf);
+	return errors;
+}
+
+int main(int argc, char *argv[]) {
+	static const UINT32_T codecs[] = {FT_CODEC_BIT(FT_CODEC_SHUFFLE), FT_CODEC_BIT(FT_CODEC_DELTA), FT_CODEC_ALL};
+	static const UINT32_T nchans[] = {1, 3, 17};
+	int t, c, n, signal, errors = 0, compressed = 0, smooth = 0;
+
+	srand(1);
+	for (t=0; t<(int) (sizeof(types)/sizeof(types[0])); t++) {
+		for (c=0; c<3; c++) {
+			for (n=0; n<3; n++) {
+				for (signal=0; signal<3; signal++) {
+					int before = compressed;
+					errors += check(types[t], nchans[n], signal, codecs[c], &compressed);
+					/* the smooth signal of the types that the codec handles should get smaller */
+					if (signal == 0 && compressed > before) smooth++;
+				}
+			}
+		}
+	}
+	printf("%i of the blocks were compressed, %i of them smooth\n", compressed, smooth);
+	if (smooth == 0) {
+		fprintf(stderr, "FAILED: none of the smooth signals was compressed\n");
+		errors++;
+	}
+
+	if (errors == 0) printf("OK\n");
+	exit(errors != 0);
+}
@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ * Computes derived streams of the local buffer with the "car" and "montage"
+ * plugins, and with a plugin that cannot be restarted, and compares them with
+ * the expected samples.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "buffer.h"
+#include "derived.h"
+
+#define NCHANS   3
+#define NSAMPLES 10
+
+/* a plugin that copies the first channel, and asks for a restart on its first
+ * block, where the second init fails, so that it continues with its first state */
+static int numInit = 0;
+
+static void *restart_init(const headerdef_t *hdr, const char *labels, UINT32_T labelsize, const char *args, ft_derived_hdr_t *out) {
+	int *restarted;
+	if (numInit++ == 1 || (restarted = (int *) calloc(1, sizeof(int))) == NULL) return NULL;
+	out->nchans  = 1;
+	out->fsample = hdr->fsample;
+	return restarted;
+}
+
+static UINT32_T restart_process(void *state, UINT32_T nsamples, const float *src, float *dest) {
+	int *restarted = (int *) state;
+	UINT32_T j;
+	if (!*restarted) {
+		*restarted = 1;
+		return FT_DERIVED_RESTART;
+	}
+	for (j=0; j<nsamples; j++) dest[j] = src[j*NCHANS];
+	return nsamples;
+}
+
+static const ft_plugin_t plugin_restart = {"restart", restart_init, restart_process, free};
+
+/* writes the samples of the source, x[j] = (j+1)*(1, 2, 6) */
+static int put_dat(void) {
+	message_t request, *response = NULL;
+	messagedef_t def;
+	char buf[sizeof(datadef_t) + NSAMPLES*NCHANS*sizeof(float)];
+	datadef_t *ddef = (datadef_t *) buf;
+	float *x = (float *) (ddef + 1);
+	int j, r;
+
+	ddef->nchans    = NCHANS;
+	ddef->nsamples  = NSAMPLES;
+	ddef->data_type = DATATYPE_FLOAT32;
+	ddef->bufsize   = NSAMPLES*NCHANS*sizeof(float);
+	for (j=0; j<NSAMPLES; j++) {
+		x[j*NCHANS + 0] = 1*(j+1);
+		x[j*NCHANS + 1] = 2*(j+1);
+		x[j*NCHANS + 2] = 6*(j+1);
+	}
+	def.version = VERSION;
+	def.command = PUT_DAT;
+	def.bufsize = sizeof(buf);
+	request.def = &def;
+	request.buf = buf;
+	r = (clientrequest(0, &request, &response) == 0 && response != NULL && response->def->command == PUT_OK) ? 0 : -1;
+	cleanup_message((void **) &response);
+	return r;
+}
+
+/* returns the number of channels of a stream once it has at least the given number of samples, or -1 */
+static int wait_stream(const char *stream, int nsamples) {
+	message_t request, *response = NULL;
+	messagedef_t def;
+	int k, nchans = -1;
+
+	def.version = VERSION;
+	def.command = GET_HDR;
+	def.bufsize = 0;
+	request.def = &def;
+	request.buf = NULL;
+	for (k=0; k<200 && nchans < 0; k++) {
+		if (streamrequest(0, stream, &request, &response) == 0 && response != NULL && response->def->command == GET_OK) {
+			headerdef_t *hdef = (headerdef_t *) response->buf;
+			if ((int) hdef->nsamples >= nsamples) nchans = hdef->nchans;
+		}
+		cleanup_message((void **) &response);
+		if (nchans < 0) usleep(10000);
+	}
+	return nchans;
+}
+
+/* reads the samples of a stream, and compares them with the expected ones */
+static int check_stream(const char *stream, int nchans, const float *expected) {
+	message_t request, *response = NULL;
+	messagedef_t def;
+	datasel_t sel;
+	int i, r = -1;
+
+	sel.begsample = 0;
+	sel.endsample = NSAMPLES-1;
+	def.version = VERSION;
+	def.command = GET_DAT;
+	def.bufsize = sizeof(sel);
+	request.def = &def;
+	request.buf = &sel;
+	if (streamrequest(0, stream, &request, &response) == 0 && response != NULL && response->def->command == GET_OK) {
+		datadef_t *ddef = (datadef_t *) response->buf;
+		const float *y = (const float *) (ddef + 1);
+		if (ddef->nchans == nchans && ddef->nsamples == NSAMPLES && ddef->data_type == DATATYPE_FLOAT32) {
+			for (i=0; i<nchans*NSAMPLES; i++) {
+				if (fabs(y[i] - expected[i]) > 1e-4) break;
+			}
+			if (i == nchans*NSAMPLES) r = 0;
+		}
+	}
+	cleanup_message((void **) &response);
+	if (r != 0) fprintf(stderr, "FAILED: the samples of %s differ\n", stream);
+	return r;
+}
+
+int main(int argc, char *argv[]) {
+	static const char labels[] = "A\0B\0C";
+	const char *path = (argc > 1) ? argv[1] : "test_derived.txt";
+	message_t request, *response = NULL;
+	messagedef_t def;
+	char buf[sizeof(headerdef_t) + sizeof(ft_chunkdef_t) + sizeof(labels)];
+	headerdef_t *header = (headerdef_t *) buf;
+	ft_chunkdef_t *chunk = (ft_chunkdef_t *) (header + 1);
+	float car[NSAMPLES*NCHANS], montage[NSAMPLES*2], first[NSAMPLES];
+	ft_derived_pool_t *P;
+	FILE *f;
+	int j, failed = 0;
+
+	/* two bipolar channels, the second one by the number of the channels */
+	if ((f = fopen(path, "w")) == NULL) {
+		fprintf(stderr, "ERROR; failed to write %s\n", path);
+		exit(1);
+	}
+	fprintf(f, "# bipolar\nA-B = A - B\nC-A = 0.5*#3 - 2*#1\n");
+	fclose(f);
+
+	memset(buf, 0, sizeof(buf));
+	header->nchans    = NCHANS;
+	header->fsample   = 100;
+	header->data_type = DATATYPE_FLOAT32;
+	header->bufsize   = sizeof(ft_chunkdef_t) + sizeof(labels);
+	chunk->type = FT_CHUNK_CHANNEL_NAMES;
+	chunk->size = sizeof(labels);
+	memcpy(chunk + 1, labels, sizeof(labels));
+	def.version = VERSION;
+	def.command = PUT_HDR;
+	def.bufsize = sizeof(buf);
+	request.def = &def;
+	request.buf = buf;
+	if (clientrequest(0, &request, &response) != 0 || response == NULL || response->def->command != PUT_OK) {
+		fprintf(stderr, "ERROR; failed to write the header\n");
+		exit(1);
+	}
+	cleanup_message((void **) &response);
+
+	if (ft_derived_register(&plugin_restart) != 0 || (P = ft_derived_start(2)) == NULL || ft_derived_add(P, "car", "car", "", NULL) != 0 ||
+		ft_derived_add(P, "bipolar", "montage", "", path) != 0 || ft_derived_add(P, "restart", "restart", "", NULL) != 0) {
+		fprintf(stderr, "ERROR; failed to start the derived streams\n");
+		exit(1);
+	}
+
+	/* the derived streams start with the samples that arrive after their header */
+	if (wait_stream("car", 0) != NCHANS || wait_stream("bipolar", 0) != 2 || wait_stream("restart", 0) != 1) {
+		fprintf(stderr, "FAILED: the derived streams have no or a wrong header\n");
+		failed = 1;
+	} else if (put_dat() != 0) {
+		fprintf(stderr, "ERROR; failed to write the samples\n");
+		failed = 1;
+	} else if (wait_stream("car", NSAMPLES) < 0 || wait_stream("bipolar", NSAMPLES) < 0 || wait_stream("restart", NSAMPLES) < 0) {
+		fprintf(stderr, "FAILED: the derived streams have not been computed\n");
+		failed = 1;
+	} else {
+		for (j=0; j<NSAMPLES; j++) {
+			/* the average of the source is 3*(j+1) */
+			car[j*NCHANS + 0] = -2*(j+1);
+			car[j*NCHANS + 1] = -1*(j+1);
+			car[j*NCHANS + 2] =  3*(j+1);
+			montage[j*2 + 0]  = -1*(j+1);
+			montage[j*2 + 1]  =  1*(j+1);
+			first[j] = j+1;
+		}
+		failed |= (check_stream("car", NCHANS, car) != 0);
+		failed |= (check_stream("bipolar", 2, montage) != 0);
+		failed |= (check_stream("restart", 1, first) != 0);
+	}
+
+	ft_derived_stop(P);
+	remove(path);
+	if (!failed) printf("OK\n");
+	exit(failed);
+}
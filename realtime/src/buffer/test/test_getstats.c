@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "buffer.h"
+
+int main(int argc, char *argv[]) {
+	int server;
+	int n;
+	messagedef_t request, response;
+	void *buf = NULL;
+
+	if (argc != 3) {
+		fprintf(stderr, "USAGE: application <server_ip> <port>\n");
+		exit(1);
+	}
+
+	/* open the TCP socket */
+	if ((server = open_connection(argv[1], atoi(argv[2]))) < 0) {
+		fprintf(stderr, "ERROR; failed to create socket\n");
+		exit(1);
+	}
+
+	request.version = VERSION;
+	request.command = GET_STATS;
+	request.bufsize = 0;
+
+	bufwrite(server, &request, sizeof(messagedef_t));
+	bufread(server, &response, sizeof(messagedef_t));
+
+	if (response.command==GET_OK) {
+		buf = malloc(response.bufsize);
+		if ((n = bufread(server, buf, response.bufsize)) < response.bufsize) {
+			fprintf(stderr, "problem reading enough bytes (%d)\n", n);
+		}
+		else {
+			print_stats(buf, response.bufsize);
+		}
+		FREE(buf);
+	}
+	else {
+		print_response(&response);
+	}
+
+	close(server);
+	exit(0);
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ * Writes more than 2^24 samples to the local buffer, beyond which the position
+ * in the ring could not be computed in single precision, and checks that the
+ * samples around that point and at the end are read back correctly.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "buffer.h"
+
+#define NCHANS   2
+#define BLOCK    100000
+#define NSAMPLES (170*BLOCK)
+
+/* every sample gets a value that follows from its number */
+static UINT8_T value(UINT32_T sample, UINT32_T chan) {
+	return (UINT8_T) ((sample*7 + chan) % 251);
+}
+
+static int request(UINT16_T command, void *buf, UINT32_T bufsize, UINT16_T expected, message_t **response) {
+	message_t req;
+	messagedef_t def;
+
+	def.version = VERSION;
+	def.command = command;
+	def.bufsize = bufsize;
+	req.def = &def;
+	req.buf = buf;
+	*response = NULL;
+	if (clientrequest(0, &req, response) != 0 || *response == NULL || (*response)->def->command != expected) {
+		cleanup_message((void **) response);
+		return -1;
+	}
+	return 0;
+}
+
+/* reads samples begsample to endsample, and compares them with the values that were written */
+static int check(UINT32_T begsample, UINT32_T endsample) {
+	message_t *response;
+	datasel_t sel;
+	UINT32_T j, i;
+	int failed = 0;
+
+	sel.begsample = begsample;
+	sel.endsample = endsample;
+	if (request(GET_DAT, &sel, sizeof(sel), GET_OK, &response) != 0) {
+		failed = 1;
+	} else {
+		const UINT8_T *x = (const UINT8_T *) response->buf + sizeof(datadef_t);
+		for (j=0; j<=endsample-begsample; j++) {
+			for (i=0; i<NCHANS; i++) failed |= (x[j*NCHANS + i] != value(begsample + j, i));
+		}
+	}
+	cleanup_message((void **) &response);
+	if (failed) fprintf(stderr, "FAILED: samples %u to %u differ from what was written\n", begsample, endsample);
+	return failed;
+}
+
+int main(int argc, char *argv[]) {
+	char *buf = (char *) malloc(sizeof(datadef_t) + BLOCK*NCHANS);
+	datadef_t *ddef = (datadef_t *) buf;
+	UINT8_T *x = (UINT8_T *) (ddef + 1);
+	headerdef_t header;
+	message_t *response;
+	UINT32_T b, j, i;
+	int failed = 0;
+
+	memset(&header, 0, sizeof(header));
+	header.nchans    = NCHANS;
+	header.fsample   = 30000;
+	header.data_type = DATATYPE_UINT8;
+	if (request(PUT_HDR, &header, sizeof(header), PUT_OK, &response) != 0) {
+		fprintf(stderr, "ERROR; failed to write the header\n");
+		exit(1);
+	}
+	cleanup_message((void **) &response);
+
+	ddef->nchans    = NCHANS;
+	ddef->nsamples  = BLOCK;
+	ddef->data_type = DATATYPE_UINT8;
+	ddef->bufsize   = BLOCK*NCHANS;
+	for (b=0; b<NSAMPLES/BLOCK; b++) {
+		for (j=0; j<BLOCK; j++) {
+			for (i=0; i<NCHANS; i++) x[j*NCHANS + i] = value(b*BLOCK + j, i);
+		}
+		if (request(PUT_DAT, buf, sizeof(datadef_t) + BLOCK*NCHANS, PUT_OK, &response) != 0) {
+			fprintf(stderr, "ERROR; failed to write block %u\n", b);
+			exit(1);
+		}
+		cleanup_message((void **) &response);
+	}
+
+	/* 2^24 is 16777216, the position in the ring is computed for the first sample of each selection */
+	failed |= check(16777216 - 1000, 16777216 + 1000);
+	for (j=16799990; j<16800010; j++) failed |= check(j, j);
+	failed |= check(NSAMPLES - 1, NSAMPLES - 1);
+	failed |= check(NSAMPLES - BLOCK, NSAMPLES - 1);
+
+	free(buf);
+	if (!failed) printf("OK\n");
+	exit(failed);
+}
@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ * Starts a buffer server that keeps its sample ring in shared memory, writes
+ * samples and events with PUT_DAT and PUT_BATCH, and checks that reading them
+ * from the shared memory gives the same as GET_DAT and GET_EVT. The shared memory
+ * is only offered over a UNIX domain socket.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "buffer.h"
+#include "socketserver.h"
+#include "shmbuffer.h"
+
+#define NCHANS 4
+#define EVTSIZE (sizeof(eventdef_t) + 2)
+
+static message_t *request(int sock, UINT16_T command, void *buf, UINT32_T bufsize) {
+	message_t req, *response = NULL;
+	messagedef_t def;
+
+	def.version = VERSION;
+	def.command = command;
+	def.bufsize = bufsize;
+	req.def = &def;
+	req.buf = buf;
+	if (tcprequest(sock, &req, &response) < 0) cleanup_message((void **) &response);
+	return response;
+}
+
+/* the messagedef_t and datadef_t of a PUT_DAT with the samples from begsample on, returns its size */
+static UINT32_T make_data(char *buf, UINT32_T begsample, UINT32_T nsamples) {
+	messagedef_t *def = (messagedef_t *) buf;
+	datadef_t *ddef = (datadef_t *) (def + 1);
+	float *x = (float *) (ddef + 1);
+	UINT32_T i;
+
+	ddef->nchans    = NCHANS;
+	ddef->nsamples  = nsamples;
+	ddef->data_type = DATATYPE_FLOAT32;
+	ddef->bufsize   = nsamples*NCHANS*sizeof(float);
+	for (i=0; i<nsamples*NCHANS; i++) x[i] = (float) (begsample*NCHANS + i);
+	def->version = VERSION;
+	def->command = PUT_DAT;
+	def->bufsize = sizeof(datadef_t) + ddef->bufsize;
+	return sizeof(messagedef_t) + def->bufsize;
+}
+
+/* the messagedef_t of a PUT_EVT, followed by numevt events at the given sample */
+static UINT32_T make_events(char *buf, UINT32_T numevt, INT32_T sample) {
+	messagedef_t *def = (messagedef_t *) buf;
+	UINT32_T e;
+
+	memset(buf + sizeof(messagedef_t), 0, numevt*EVTSIZE);
+	for (e=0; e<numevt; e++) {
+		char *evt = buf + sizeof(messagedef_t) + e*EVTSIZE;
+		eventdef_t *edef = (eventdef_t *) evt;
+		edef->type_type   = DATATYPE_CHAR;
+		edef->type_numel  = 1;
+		edef->value_type  = DATATYPE_UINT8;
+		edef->value_numel = 1;
+		edef->sample      = sample;
+		edef->bufsize     = 2;
+		evt[sizeof(eventdef_t)]     = 't';
+		evt[sizeof(eventdef_t) + 1] = (char) e;
+	}
+	def->version = VERSION;
+	def->command = PUT_EVT;
+	def->bufsize = numevt*EVTSIZE;
+	return sizeof(messagedef_t) + def->bufsize;
+}
+
+/* compares the samples in shared memory with those of GET_DAT */
+static int check_data(int sock, ft_shm_client_t *client, UINT32_T begsample, UINT32_T endsample) {
+	UINT32_T size = (endsample - begsample + 1)*NCHANS*sizeof(float);
+	char *buf = (char *) malloc(size);
+	message_t *response;
+	datasel_t sel;
+	int status, k, failed = 0;
+
+	/* the server is idle, so the copy is not overwritten */
+	for (k=0; k<10 && (status = ft_shm_read_data(client, begsample, endsample, buf)) == FT_SHM_RETRY; k++);
+	sel.begsample = begsample;
+	sel.endsample = endsample;
+	response = request(sock, GET_DAT, &sel, sizeof(sel));
+	if (status != FT_SHM_OK || response == NULL || response->def->command != GET_OK || response->def->bufsize != sizeof(datadef_t) + size) {
+		failed = 1;
+	} else if (memcmp((char *) response->buf + sizeof(datadef_t), buf, size) != 0) {
+		failed = 1;
+	}
+	if (failed) fprintf(stderr, "FAILED: samples %u to %u in shared memory differ from GET_DAT\n", begsample, endsample);
+	cleanup_message((void **) &response);
+	free(buf);
+	return failed;
+}
+
+/* compares the events in shared memory with those of GET_EVT */
+static int check_events(int sock, ft_shm_client_t *client, UINT32_T nevents) {
+	char value[2];
+	eventdef_t edef;
+	eventsel_t sel;
+	message_t *response;
+	UINT32_T e;
+	int failed = 0;
+
+	sel.begevent = 0;
+	sel.endevent = nevents-1;
+	response = request(sock, GET_EVT, &sel, sizeof(sel));
+	if (response == NULL || response->def->command != GET_OK || response->def->bufsize != nevents*EVTSIZE) {
+		failed = 1;
+	} else {
+		for (e=0; e<nevents; e++) {
+			const char *evt = (const char *) response->buf + e*EVTSIZE;
+			if (ft_shm_read_event(client, e, &edef, value, sizeof(value)) != FT_SHM_OK || memcmp(&edef, evt, sizeof(eventdef_t)) != 0 || memcmp(value, evt + sizeof(eventdef_t), 2) != 0) failed = 1;
+		}
+	}
+	if (failed) fprintf(stderr, "FAILED: the events in shared memory differ from GET_EVT\n");
+	cleanup_message((void **) &response);
+	return failed;
+}
+
+int main(int argc, char *argv[]) {
+	char buf[sizeof(messagedef_t) + sizeof(datadef_t) + 64*NCHANS*sizeof(float)], batch[2*sizeof(buf) + sizeof(messagedef_t) + 3*EVTSIZE];
+	char name[FT_SHM_NAMELEN];
+	ft_buffer_server_t *S;
+	ft_shm_client_t *client;
+	headerdef_t header;
+	eventdef_t edef;
+	message_t *response;
+	UINT32_T size, nsamples, nevents;
+	const char *path = (argc > 1) ? argv[1] : "/tmp/test_shm.sock";
+	int sock, failed = 0;
+
+	sprintf(name, "/ft_test_shm_%i", (int) getpid());
+	if (enable_shared_memory(name) != 0) {
+		fprintf(stderr, "ERROR; failed to put the buffer in shared memory\n");
+		exit(1);
+	}
+	if ((S = ft_start_buffer_server_mode(0, path, NULL, NULL, FT_SERVER_EVENTLOOP, 1)) == NULL || (sock = open_unix_connection(path)) < 0) {
+		fprintf(stderr, "ERROR; failed to start the buffer server\n");
+		disable_shared_memory();
+		exit(1);
+	}
+
+	memset(&header, 0, sizeof(header));
+	header.nchans    = NCHANS;
+	header.fsample   = 100;
+	header.data_type = DATATYPE_FLOAT32;
+	response = request(sock, PUT_HDR, &header, sizeof(header));
+	failed |= (response == NULL || response->def->command != PUT_OK);
+	cleanup_message((void **) &response);
+
+	/* 50 samples with PUT_DAT, then 30 samples, 3 events and 20 samples in one PUT_BATCH */
+	size = make_data(buf, 0, 50);
+	response = request(sock, PUT_DAT, buf + sizeof(messagedef_t), size - sizeof(messagedef_t));
+	failed |= (response == NULL || response->def->command != PUT_OK);
+	cleanup_message((void **) &response);
+	size  = make_data(batch, 50, 30);
+	size += make_events(batch + size, 3, 60);
+	size += make_data(batch + size, 80, 20);
+	response = request(sock, PUT_BATCH, batch, size);
+	failed |= (response == NULL || response->def->command != PUT_OK);
+	cleanup_message((void **) &response);
+	if (failed) {
+		fprintf(stderr, "ERROR; failed to write the header, samples and events\n");
+		closesocket(sock);
+		ft_stop_buffer_server(S);
+		disable_shared_memory();
+		exit(1);
+	}
+
+	if ((client = ft_shm_attach(sock)) == NULL) {
+		fprintf(stderr, "FAILED: cannot attach to the shared memory\n");
+		failed = 1;
+	} else {
+		if (ft_shm_get_count(client, &nsamples, &nevents) != FT_SHM_OK || nsamples != 100 || nevents != 3) {
+			fprintf(stderr, "FAILED: the shared memory has the wrong number of samples and events\n");
+			failed = 1;
+		}
+		failed |= check_data(sock, client, 0, 99);
+		failed |= check_data(sock, client, 0, 49);
+		failed |= check_data(sock, client, 45, 85);
+		failed |= check_data(sock, client, 99, 99);
+		failed |= check_events(sock, client, 3);
+
+		/* beyond the last sample and event */
+		if (ft_shm_read_data(client, 90, 100, buf) != FT_SHM_ERR || ft_shm_read_event(client, 3, &edef, NULL, 0) != FT_SHM_ERR) {
+			fprintf(stderr, "FAILED: reading beyond the end was not refused\n");
+			failed = 1;
+		}
+		ft_shm_detach(client);
+	}
+
+	closesocket(sock);
+	ft_stop_buffer_server(S);
+	disable_shared_memory();
+	remove(path);
+	if (!failed) printf("OK\n");
+	exit(failed);
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ * Writes a header, samples and events to the default stream and to two named
+ * streams of the local buffer, and checks that the header, data, events and
+ * flushes of each stream do not affect the others.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "buffer.h"
+
+#define NSTREAM 3
+
+typedef struct {
+	const char *name;     /* the empty name is the default stream */
+	UINT32_T nchans;
+	UINT32_T nsamples;
+	UINT32_T data_type;
+	UINT32_T nevents;
+} stream_t;
+
+static stream_t streams[NSTREAM] = {
+	{"",  2,  5, DATATYPE_FLOAT32, 0},
+	{"a", 3, 20, DATATYPE_INT16,   4},
+	{"b", 1,  7, DATATYPE_FLOAT64, 0},
+};
+
+/* returns the response to a request for the stream, or NULL */
+static message_t *request(const char *stream, UINT16_T command, void *buf, UINT32_T bufsize) {
+	message_t request, *response = NULL;
+	messagedef_t def;
+
+	def.version = VERSION;
+	def.command = command;
+	def.bufsize = bufsize;
+	request.def = &def;
+	request.buf = buf;
+	if (streamrequest(0, stream, &request, &response) != 0) cleanup_message((void **) &response);
+	return response;
+}
+
+/* the samples of a stream differ from those of all other streams */
+static void *make_data(const stream_t *s, int k, UINT32_T *size) {
+	UINT32_T wordsize = wordsize_from_type(s->data_type), n = s->nchans*s->nsamples, i;
+	char *buf = (char *) malloc(sizeof(datadef_t) + n*wordsize);
+	datadef_t *ddef = (datadef_t *) buf;
+
+	ddef->nchans    = s->nchans;
+	ddef->nsamples  = s->nsamples;
+	ddef->data_type = s->data_type;
+	ddef->bufsize   = n*wordsize;
+	for (i=0; i<n; i++) {
+		char *x = buf + sizeof(datadef_t) + i*wordsize;
+		if (s->data_type == DATATYPE_INT16)   *(INT16_T *) x   = (INT16_T) (1000*k + i);
+		if (s->data_type == DATATYPE_FLOAT32) *(FLOAT32_T *) x = (FLOAT32_T) (1000*k + i);
+		if (s->data_type == DATATYPE_FLOAT64) *(FLOAT64_T *) x = (FLOAT64_T) (1000*k + i);
+	}
+	*size = sizeof(datadef_t) + n*wordsize;
+	return buf;
+}
+
+static int put_stream(const stream_t *s, int k) {
+	char evbuf[sizeof(eventdef_t) + 2];
+	eventdef_t *edef = (eventdef_t *) evbuf;
+	headerdef_t header;
+	message_t *response;
+	void *buf;
+	UINT32_T size, e;
+	int failed = 0;
+
+	memset(&header, 0, sizeof(header));
+	header.nchans    = s->nchans;
+	header.fsample   = 100*(k+1);
+	header.data_type = s->data_type;
+	response = request(s->name, PUT_HDR, &header, sizeof(header));
+	failed |= (response == NULL || response->def->command != PUT_OK);
+	cleanup_message((void **) &response);
+
+	buf = make_data(s, k, &size);
+	response = request(s->name, PUT_DAT, buf, size);
+	failed |= (response == NULL || response->def->command != PUT_OK);
+	cleanup_message((void **) &response);
+	free(buf);
+
+	memset(evbuf, 0, sizeof(evbuf));
+	edef->type_type   = DATATYPE_CHAR;
+	edef->type_numel  = 1;
+	edef->value_type  = DATATYPE_CHAR;
+	edef->value_numel = 1;
+	edef->bufsize     = 2;
+	evbuf[sizeof(eventdef_t)] = s->name[0] ? s->name[0] : 'x';
+	for (e=0; e<s->nevents; e++) {
+		edef->sample = e;
+		response = request(s->name, PUT_EVT, evbuf, sizeof(evbuf));
+		failed |= (response == NULL || response->def->command != PUT_OK);
+		cleanup_message((void **) &response);
+	}
+	return failed;
+}
+
+/* compares the header, samples and events of the stream with what was written */
+static int check_stream(const stream_t *s, int k) {
+	message_t *response;
+	eventsel_t evsel;
+	datasel_t sel;
+	void *expected;
+	UINT32_T size;
+	int failed = 0;
+
+	response = request(s->name, GET_HDR, NULL, 0);
+	if (response == NULL || response->def->command != GET_OK) {
+		failed = 1;
+	} else {
+		headerdef_t *hdef = (headerdef_t *) response->buf;
+		failed |= (hdef->nchans != s->nchans || hdef->nsamples != s->nsamples || hdef->nevents != s->nevents);
+		failed |= (hdef->data_type != s->data_type || hdef->fsample != 100*(k+1));
+	}
+	cleanup_message((void **) &response);
+
+	if (s->nsamples > 0) {
+		sel.begsample = 0;
+		sel.endsample = s->nsamples-1;
+		expected = make_data(s, k, &size);
+		response = request(s->name, GET_DAT, &sel, sizeof(sel));
+		failed |= (response == NULL || response->def->command != GET_OK || response->def->bufsize != size || memcmp(response->buf, expected, size) != 0);
+		cleanup_message((void **) &response);
+		free(expected);
+	}
+
+	if (s->nevents > 0) {
+		evsel.begevent = 0;
+		evsel.endevent = s->nevents-1;
+		response = request(s->name, GET_EVT, &evsel, sizeof(evsel));
+		if (response == NULL || response->def->command != GET_OK || response->def->bufsize != s->nevents*(sizeof(eventdef_t) + 2)) {
+			failed = 1;
+		} else {
+			/* the event type is the first letter of the name of the stream */
+			failed |= (((char *) response->buf)[sizeof(eventdef_t)] != s->name[0]);
+		}
+		cleanup_message((void **) &response);
+	}
+
+	if (failed) fprintf(stderr, "FAILED: stream '%s' differs from what was written\n", s->name);
+	return failed;
+}
+
+int main(int argc, char *argv[]) {
+	message_t *response, req, *plain = NULL;
+	messagedef_t def;
+	int k, failed = 0;
+
+	for (k=0; k<NSTREAM; k++) {
+		if (put_stream(&streams[k], k) != 0) {
+			fprintf(stderr, "ERROR; failed to write stream '%s'\n", streams[k].name);
+			exit(1);
+		}
+	}
+	for (k=0; k<NSTREAM; k++) failed |= check_stream(&streams[k], k);
+
+	/* the empty name is the same as a request that is not wrapped */
+	def.version = VERSION;
+	def.command = GET_HDR;
+	def.bufsize = 0;
+	req.def = &def;
+	req.buf = NULL;
+	response = request("", GET_HDR, NULL, 0);
+	if (clientrequest(0, &req, &plain) != 0 || response == NULL || plain == NULL || response->def->bufsize != plain->def->bufsize || memcmp(response->buf, plain->buf, plain->def->bufsize) != 0) {
+		fprintf(stderr, "FAILED: the default stream differs from the unwrapped requests\n");
+		failed = 1;
+	}
+	cleanup_message((void **) &response);
+	cleanup_message((void **) &plain);
+
+	/* flushing one stream leaves the others as they are */
+	response = request("b", FLUSH_DAT, NULL, 0);
+	failed |= (response == NULL || response->def->command != FLUSH_OK);
+	cleanup_message((void **) &response);
+	streams[2].nsamples = 0;
+	for (k=0; k<NSTREAM; k++) failed |= check_stream(&streams[k], k);
+
+	/* a stream that has no header yet does not exist */
+	response = request("c", GET_HDR, NULL, 0);
+	if (response == NULL || response->def->command != GET_ERR) {
+		fprintf(stderr, "FAILED: a stream without a header was not refused\n");
+		failed = 1;
+	}
+	cleanup_message((void **) &response);
+
+	if (!failed) printf("OK\n");
+	exit(failed);
+}
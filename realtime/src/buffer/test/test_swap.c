@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ * Compares the vectorized byte swapping of endianutil.c, and the scalar one, with
+ * bytes that are reversed one by one, for all lengths up to a few vectors and for
+ * source and destination that are not aligned, both in place and while copying.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "buffer.h"
+#include "endianutil.h"
+
+#define MAXNUMEL 300
+#define MAXSIZE  (8*MAXNUMEL + 16)
+
+typedef void (*swap_copy_t)(unsigned int numel, void *dest, const void *src);
+
+/* indexed by FT_SWAP_xxx */
+static const char *names[] = {"auto", "scalar", "SSE2", "AVX2", "NEON"};
+
+/* the expected result, every element with its bytes in reverse order */
+static void reference(unsigned int numel, unsigned int wordsize, unsigned char *dest, const unsigned char *src) {
+	unsigned int i, j;
+	for (i=0; i<numel; i++) {
+		for (j=0; j<wordsize; j++) dest[i*wordsize + j] = src[i*wordsize + wordsize-1-j];
+	}
+}
+
+/* returns the number of cases in which the selected implementation differs from the reference */
+static int check(const char *name, unsigned int wordsize, swap_copy_t copy) {
+	static unsigned char src[MAXSIZE], dest[MAXSIZE], expected[MAXSIZE];
+	unsigned int numel, offset, i;
+	int errors = 0;
+
+	for (i=0; i<MAXSIZE; i++) src[i] = (unsigned char) (i*7 + 3);
+
+	for (numel=0; numel<=MAXNUMEL; numel++) {
+		for (offset=0; offset<8; offset++) {
+			reference(numel, wordsize, expected, src + offset);
+
+			/* while copying, with the destination at another offset */
+			memset(dest, 0xAA, MAXSIZE);
+			copy(numel, dest + (offset+3)%8, src + offset);
+			if (memcmp(dest + (offset+3)%8, expected, numel*wordsize) != 0) errors++;
+			/* nothing is written after the last element */
+			if (dest[(offset+3)%8 + numel*wordsize] != 0xAA) errors++;
+
+			/* in place */
+			memcpy(dest + offset, src + offset, numel*wordsize);
+			copy(numel, dest + offset, dest + offset);
+			if (memcmp(dest + offset, expected, numel*wordsize) != 0) errors++;
+		}
+	}
+	if (errors) fprintf(stderr, "FAILED: %s differs for %u byte words in %i cases\n", name, wordsize, errors);
+	return errors;
+}
+
+int main(int argc, char *argv[]) {
+	int impl, selected, errors, failed = 0;
+
+	for (impl=FT_SWAP_SCALAR; impl<=FT_SWAP_NEON; impl++) {
+		selected = ft_swap_select(impl);
+		if (selected != impl) {
+			printf("%s is not available\n", names[impl]);
+			continue;
+		}
+		errors  = check(names[impl], 2, ft_swap_copy16);
+		errors += check(names[impl], 4, ft_swap_copy32);
+		errors += check(names[impl], 8, ft_swap_copy64);
+		if (errors == 0) printf("%s swaps all bytes correctly\n", names[impl]);
+		failed |= (errors != 0);
+	}
+	ft_swap_select(FT_SWAP_AUTO);
+
+	if (!failed) printf("OK\n");
+	exit(failed != 0);
+}
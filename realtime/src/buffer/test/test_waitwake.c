@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ * Lets a number of threads wait with WAIT_DAT on the local buffer for different
+ * numbers of samples and events, and checks that each of them, and each waiter
+ * of register_wait, is woken up once its own threshold is exceeded, and not before.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "buffer.h"
+
+#define NCHANS  2
+#define NWAIT   5
+#define NEVER   0xFFFFFFFF
+
+typedef struct {
+	waitdef_t waitdef;
+	pthread_t thread;
+	volatile int done;
+	samples_events_t result;
+} wait_t;
+
+/* more than 10, 20 and 30 samples, more than 1 event, and a timeout */
+static wait_t waits[NWAIT] = {
+	{{{10, NEVER}, 5000}},
+	{{{20, NEVER}, 5000}},
+	{{{30, NEVER}, 5000}},
+	{{{NEVER, 1}, 5000}},
+	{{{NEVER, NEVER}, 900}},
+};
+
+static volatile int numNotified[2] = {0, 0};
+
+static void notify(void *arg) {
+	numNotified[(int) (size_t) arg]++;
+}
+
+static int request(UINT16_T command, void *buf, UINT32_T bufsize, message_t **response) {
+	message_t req;
+	messagedef_t def;
+
+	def.version = VERSION;
+	def.command = command;
+	def.bufsize = bufsize;
+	req.def = &def;
+	req.buf = buf;
+	*response = NULL;
+	return clientrequest(0, &req, response);
+}
+
+static void *wait_thread(void *arg) {
+	wait_t *W = (wait_t *) arg;
+	message_t *response;
+
+	if (request(WAIT_DAT, &W->waitdef, sizeof(waitdef_t), &response) == 0 && response != NULL && response->def->command == WAIT_OK)
+		W->result = *(samples_events_t *) response->buf;
+	cleanup_message((void **) &response);
+	W->done = 1;
+	return NULL;
+}
+
+static int put_dat(UINT32_T nsamples) {
+	char buf[sizeof(datadef_t) + 100*NCHANS*sizeof(float)];
+	datadef_t *ddef = (datadef_t *) buf;
+	message_t *response;
+	int r;
+
+	memset(buf, 0, sizeof(buf));
+	ddef->nchans    = NCHANS;
+	ddef->nsamples  = nsamples;
+	ddef->data_type = DATATYPE_FLOAT32;
+	ddef->bufsize   = nsamples*NCHANS*sizeof(float);
+	r = (request(PUT_DAT, buf, sizeof(datadef_t) + ddef->bufsize, &response) == 0 && response != NULL && response->def->command == PUT_OK) ? 0 : -1;
+	cleanup_message((void **) &response);
+	return r;
+}
+
+static int put_evt(void) {
+	char buf[sizeof(eventdef_t) + 2];
+	eventdef_t *edef = (eventdef_t *) buf;
+	message_t *response;
+	int r;
+
+	memset(buf, 0, sizeof(buf));
+	edef->type_type   = DATATYPE_CHAR;
+	edef->type_numel  = 1;
+	edef->value_type  = DATATYPE_CHAR;
+	edef->value_numel = 1;
+	edef->bufsize     = 2;
+	r = (request(PUT_EVT, buf, sizeof(buf), &response) == 0 && response != NULL && response->def->command == PUT_OK) ? 0 : -1;
+	cleanup_message((void **) &response);
+	return r;
+}
+
+/* gives the woken threads some time, and compares which of them are done */
+static int check_done(const char *step, const int *expected) {
+	int k, failed = 0;
+	usleep(200000);
+	for (k=0; k<NWAIT; k++) {
+		if (waits[k].done != expected[k]) {
+			fprintf(stderr, "FAILED: after %s, waiter %i is %s\n", step, k, waits[k].done ? "woken up too early" : "still waiting");
+			failed = 1;
+		}
+	}
+	return failed;
+}
+
+int main(int argc, char *argv[]) {
+	static const int none[NWAIT]    = {0, 0, 0, 0, 0};
+	static const int first[NWAIT]   = {1, 0, 0, 0, 0};
+	static const int second[NWAIT]  = {1, 1, 0, 0, 0};
+	static const int timeout[NWAIT] = {1, 1, 0, 0, 1};
+	static const int events[NWAIT]  = {1, 1, 0, 1, 1};
+	static const int all[NWAIT]     = {1, 1, 1, 1, 1};
+	headerdef_t header;
+	message_t *response;
+	waiter_t *async[2];
+	int k, failed = 0;
+
+	memset(&header, 0, sizeof(header));
+	header.nchans    = NCHANS;
+	header.fsample   = 100;
+	header.data_type = DATATYPE_FLOAT32;
+	if (request(PUT_HDR, &header, sizeof(header), &response) != 0 || response == NULL || response->def->command != PUT_OK) {
+		fprintf(stderr, "ERROR; failed to write the header\n");
+		exit(1);
+	}
+	cleanup_message((void **) &response);
+
+	/* the timeout of the last waiter starts now */
+	for (k=0; k<NWAIT; k++) pthread_create(&waits[k].thread, NULL, wait_thread, &waits[k]);
+	async[0] = register_wait(15, NEVER, notify, (void *) 0);
+	async[1] = register_wait(NEVER, 1, notify, (void *) 1);
+	failed |= (async[0] == NULL || async[1] == NULL);
+	failed |= check_done("starting", none);
+
+	/* 15 samples, 25 samples and 31 samples in total */
+	failed |= (put_dat(15) != 0);
+	failed |= check_done("15 samples", first);
+	failed |= (put_dat(10) != 0);
+	failed |= check_done("25 samples", second);
+	failed |= (numNotified[0] != 1 || numNotified[1] != 0);
+	usleep(400000);
+	failed |= check_done("the timeout", timeout);
+
+	/* the first event exceeds no threshold, the second one does */
+	failed |= (put_evt() != 0);
+	failed |= check_done("1 event", timeout);
+	failed |= (put_evt() != 0);
+	failed |= check_done("2 events", events);
+	failed |= (numNotified[0] != 1 || numNotified[1] != 1);
+	failed |= (put_dat(6) != 0);
+	failed |= check_done("31 samples", all);
+	if (numNotified[0] != 1 || numNotified[1] != 1) {
+		fprintf(stderr, "FAILED: the asynchronous waiters were notified %i and %i times\n", numNotified[0], numNotified[1]);
+		failed = 1;
+	}
+
+	/* each waiter gets the numbers of samples and events at the moment it was woken up */
+	for (k=0; k<NWAIT; k++) pthread_join(waits[k].thread, NULL);
+	if (waits[0].result.nsamples != 15 || waits[1].result.nsamples != 25 || waits[2].result.nsamples != 31 ||
+		waits[3].result.nevents != 2 || waits[4].result.nsamples != 25 || waits[4].result.nevents != 0) {
+		fprintf(stderr, "FAILED: the waiters returned %u, %u, %u samples and %u events\n", waits[0].result.nsamples, waits[1].result.nsamples, waits[2].result.nsamples, waits[3].result.nevents);
+		failed = 1;
+	}
+
+	/* the waiters that have been notified are gone from the lists, this does not notify them again */
+	unregister_wait(async[0]);
+	unregister_wait(async[1]);
+
+	if (!failed) printf("OK\n");
+	exit(failed);
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ * Starts a WebSocket server on the local buffer, and checks that it copes with
+ * long labels and with a channel selection that lists the same channel many times.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "buffer.h"
+#include "wsserver.h"
+
+#define LABELSIZE 200
+#define REPEATS   1500
+
+/* finds a string in the reply, of which the frames can contain zero bytes */
+static char *find(char *reply, int size, const char *str) {
+	int i, len = strlen(str);
+	for (i=0; i+len<=size; i++) {
+		if (memcmp(reply+i, str, len) == 0) return reply+i;
+	}
+	return NULL;
+}
+
+/* sends the handshake with the given query, and returns the number of bytes of the reply */
+static int handshake(int port, const char *query, char *reply, int size) {
+	static char request[WS_MAX_REQUEST];
+	int sock, n, total = 0;
+
+	if ((sock = open_connection("localhost", port)) < 0) {
+		fprintf(stderr, "ERROR; failed to connect to the WebSocket server\n");
+		return -1;
+	}
+	sprintf(request, "GET /?%s HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n", query);
+	if (bufwrite(sock, request, strlen(request)) != strlen(request)) {
+		closesocket(sock);
+		return -1;
+	}
+	/* read the reply and the header frame, which arrives within a few polls */
+	while (total < size-1) {
+		fd_set readSet;
+		struct timeval tv;
+
+		FD_ZERO(&readSet);
+		FD_SET(sock, &readSet);
+		tv.tv_sec  = 1;
+		tv.tv_usec = 0;
+		if (select(sock+1, &readSet, NULL, NULL, &tv) <= 0) break;
+		if ((n = recv(sock, reply + total, size - 1 - total, 0)) <= 0) break;
+		total += n;
+		if (find(reply, total, "\"]}") != NULL) break;
+	}
+	reply[total] = 0;
+	closesocket(sock);
+	return total;
+}
+
+int main(int argc, char *argv[]) {
+	ws_server_ctrl_t *SC;
+	message_t request, *response = NULL;
+	messagedef_t def;
+	headerdef_t *header;
+	ft_chunkdef_t *chunk;
+	char *buf, *query, reply[65536];
+	int port = (argc > 1) ? atoi(argv[1]) : 1985;
+	int i, n, errval, failed = 0;
+
+	/* a header with one channel, with a long label */
+	buf = (char *) calloc(1, sizeof(headerdef_t) + sizeof(ft_chunkdef_t) + LABELSIZE + 1);
+	header = (headerdef_t *) buf;
+	header->nchans    = 1;
+	header->fsample   = 1000;
+	header->data_type = DATATYPE_FLOAT32;
+	header->bufsize   = sizeof(ft_chunkdef_t) + LABELSIZE + 1;
+	chunk = (ft_chunkdef_t *) (header + 1);
+	chunk->type = FT_CHUNK_CHANNEL_NAMES;
+	chunk->size = LABELSIZE + 1;
+	memset(chunk + 1, 'x', LABELSIZE);
+
+	def.version = VERSION;
+	def.command = PUT_HDR;
+	def.bufsize = sizeof(headerdef_t) + header->bufsize;
+	request.def = &def;
+	request.buf = buf;
+	if (clientrequest(0, &request, &response) != 0 || response == NULL || response->def->command != PUT_OK) {
+		fprintf(stderr, "ERROR; failed to write the header\n");
+		exit(1);
+	}
+	cleanup_message((void **) &response);
+
+	if ((SC = ws_start_server(0, port, &errval)) == NULL) {
+		fprintf(stderr, "ERROR; failed to start the WebSocket server (%i)\n", errval);
+		exit(1);
+	}
+
+	/* the same channel selected many times is refused */
+	query = (char *) malloc(6 + 2*REPEATS);
+	strcpy(query, "chans=0");
+	for (i=1; i<REPEATS; i++) strcat(query, ",0");
+	n = handshake(port, query, reply, sizeof(reply));
+	if (n < 0 || strncmp(reply, "HTTP/1.1 400", 12) != 0) {
+		fprintf(stderr, "FAILED: repeated channels were not refused\n");
+		failed = 1;
+	}
+
+	/* the label is sent in full */
+	n = handshake(port, "chans=0", reply, sizeof(reply));
+	if (n < 0 || strncmp(reply, "HTTP/1.1 101", 12) != 0 || find(reply, n, "\"labels\":[\"") == NULL) {
+		fprintf(stderr, "FAILED: no header after the handshake\n");
+		failed = 1;
+	} else {
+		char *label = find(reply, n, "\"labels\":[\"") + 11;
+		if (strspn(label, "x") != LABELSIZE || label[LABELSIZE] != '"') {
+			fprintf(stderr, "FAILED: the label was not sent in full\n");
+			failed = 1;
+		}
+	}
+
+	ws_stop_server(SC);
+	free(query);
+	free(buf);
+	if (!failed) printf("OK\n");
+	exit(failed);
+}
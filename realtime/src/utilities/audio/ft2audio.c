@@ -3,6 +3,13 @@
  * to the sound card. This is based on PortAudio. The FieldTrip buffer
  * should contain one or two channels at an appropriate sampling frequency.
  *
+ * The samples are passed from the main thread, which waits for them in the
+ * buffer, to the PortAudio callback through a single-producer single-consumer
+ * ring that needs no locks. The callback plays the samples with a ratio that
+ * is slightly adjusted, so that the number of samples in the ring stays at the
+ * configured latency although the clocks of the sound card and the
+ * acquisition drift apart.
+ *
  * (C) 2017, Robert Oostenveld
 */
 
@@ -10,12 +17,15 @@
 #include <math.h>
 #include <sys/time.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "portaudio.h"
 #include "message.h"
 #include "buffer.h"
 #include "interface.h"
 #include "socketserver.h"
+#include "convert.h"
+#include "atomicutil.h"
 #include "ini.h"
 
 #define TRUE          (1)
@@ -23,21 +33,29 @@
 #define MAX(x,y) 			(x>y ? x : y)
 #define MATCH(s, n) 	(strcasecmp(section, s) == 0 && strcasecmp(name, n) == 0)
 
+#define RATIO_TAU      0.5    /* time constant of the average fill level, in seconds */
+#define RATIO_KP       0.5    /* relative change in the ratio per second of deviation from the latency */
+#define RATIO_KI       0.05   /* same, for the integrated deviation, this compensates the drift */
+#define RATIO_MAX      0.005  /* the ratio stays within 1 +/- this, i.e. 5000 ppm */
+
 typedef struct
 {
-	float *block1;
-	float *block2;
-	char refresh1;
-	char refresh2;
-	unsigned int current;
-	unsigned int nsamples;
-	float fsample;
+	float *data;              /* size frames of nchans samples */
+	unsigned int size;        /* power of two */
 	unsigned int nchans;
-	unsigned int datatype;
-	unsigned int sample;
-	unsigned int nput;
-	unsigned int nget;
-	unsigned int skipped;
+	volatile UINT32_T head;   /* number of frames written, only changed by the main thread */
+	volatile UINT32_T tail;   /* number of frames played, only changed by the callback */
+	/* the remainder is only used by the callback, or read by the main thread for the messages */
+	unsigned int target;      /* desired number of frames in the ring */
+	unsigned int maxfill;     /* frames beyond this are dropped */
+	float fsample;
+	int primed;               /* 0 until the ring has been filled up to the target */
+	double phase;             /* fractional position between the frames tail and tail+1 */
+	double fill;              /* average number of frames in the ring */
+	double integral;          /* integrated deviation of the fill from the target, in seconds*seconds */
+	double ratio;             /* number of input frames per output frame */
+	volatile unsigned int underruns;
+	volatile unsigned int dropped;
 }
 callbackData_t;
 
@@ -52,6 +70,7 @@ typedef struct
 	float  	   calibration;
 	int        blocksize;
 	int        callbacksize;
+	int        latency;
 } configuration_t;
 
 static char usage[] =
@@ -98,6 +117,8 @@ static int iniHandler(void* external, const char* section, const char* name, con
 		local->blocksize = atoi(value);
 	} else if (MATCH("General", "callbacksize")) {
 		local->callbacksize = atoi(value);
+	} else if (MATCH("General", "latency")) {
+		local->latency = atoi(value);
 
 	} else {
     return 0;  /* unknown section/name, error */
@@ -106,6 +127,16 @@ static int iniHandler(void* external, const char* section, const char* name, con
 }
 
 
+/*******************************************************************/
+/* cubic Hermite interpolation between x1 and x2 */
+static float interpolate(float x0, float x1, float x2, float x3, float t)
+{
+	float c1 = 0.5f*(x2 - x0);
+	float c2 = x0 - 2.5f*x1 + 2.0f*x2 - 0.5f*x3;
+	float c3 = 0.5f*(x3 - x0) + 1.5f*(x1 - x2);
+	return ((c3*t + c2)*t + c1)*t + x1;
+}
+
 /*******************************************************************/
 static int paWriteCallback(const void *inputBuffer,
 		void *outputBuffer,
@@ -119,61 +150,126 @@ static int paWriteCallback(const void *inputBuffer,
 	/* Cast data passed through stream to our structure. */
 	callbackData_t *transfer = ptr;
 	float *output = (float *)outputBuffer;
+	unsigned int nchans = transfer->nchans, mask = transfer->size-1;
+	UINT32_T head, tail = transfer->tail;
+	unsigned long frame = 0;
+	double dt = (double) framesPerBuffer/transfer->fsample;
+	double alpha = dt/RATIO_TAU, deviation;
+
+	head = transfer->head;
+	MEMORY_BARRIER(); /* the frames up to head are complete */
+
+	if (head-tail > transfer->maxfill) {
+		/* far too many frames, e.g. after the sound card stalled, skip to the target */
+		transfer->dropped += head-tail-transfer->target;
+		tail = head-transfer->target;
+		transfer->fill = transfer->target;
+	}
 
-  /* this is to get started */
-  if (transfer->current==0 && transfer->refresh1==0)
-	  transfer->current = 1; /* switch to the first available block */
-	else if (transfer->current==0 && transfer->refresh2==0)
-		transfer->current = 2; /* switch to the second available block */
-
-	while (framesPerBuffer>0) {
-		framesPerBuffer--;
-
-		if (transfer->current==1) {
-			for (unsigned int chan=0; chan<transfer->nchans; chan++)
-				output[chan] = transfer->block1[(transfer->sample)*transfer->nchans+chan];
-			transfer->sample++;
-			transfer->nget++;
-		}
-		else if (transfer->current==2) {
-			for (unsigned int chan=0; chan<transfer->nchans; chan++)
-				output[chan] = transfer->block2[(transfer->sample)*transfer->nchans+chan];
-			transfer->sample++;
-			transfer->nget++;
+	/* adjust the ratio to the average fill level */
+	transfer->fill += alpha*((double) (head-tail) - transfer->fill);
+	if (alpha > 1) transfer->fill = head-tail;
+	deviation = (transfer->fill - transfer->target)/transfer->fsample;
+	if (transfer->primed) {
+		double ratio = 1.0 + RATIO_KP*deviation + RATIO_KI*(transfer->integral + deviation*dt);
+		if (ratio > 1.0-RATIO_MAX && ratio < 1.0+RATIO_MAX) {
+			/* the integral only grows while the ratio is not limited */
+			transfer->integral += deviation*dt;
+			transfer->ratio = ratio;
+		} else {
+			transfer->ratio = (ratio < 1.0) ? 1.0-RATIO_MAX : 1.0+RATIO_MAX;
 		}
-		else {
-			for (unsigned int chan=0; chan<transfer->nchans; chan++)
-				output[chan] = 0;
-			transfer->skipped++;
+	}
+	else if (head-tail >= transfer->target) {
+		/* start playing, or continue after an underrun, without more than twice
+		   the target, the ratio takes care of the remainder */
+		if (head-tail > 2*transfer->target) {
+			transfer->dropped += head-tail-2*transfer->target;
+			tail = head-2*transfer->target;
 		}
+		transfer->primed = 1;
+		transfer->phase = 0;
+		transfer->fill = head-tail;
+	}
 
-		for (unsigned int chan=0; chan<transfer->nchans; chan++)
-			output++;
+	while (transfer->primed && frame<framesPerBuffer) {
+		/* the frame before tail is kept in the ring for the interpolation */
+		const float *x0 = transfer->data + ((tail-1) & mask)*nchans;
+		const float *x1 = transfer->data + ((tail  ) & mask)*nchans;
+		const float *x2 = transfer->data + ((tail+1) & mask)*nchans;
+		const float *x3 = transfer->data + ((tail+2) & mask)*nchans;
+		float t = (float) transfer->phase;
+
+		if (head-tail < 3) {
+			/* ran out of samples, wait until the ring is filled again */
+			transfer->primed = 0;
+			transfer->underruns++;
+			break;
+		}
+		for (unsigned int chan=0; chan<nchans; chan++)
+			output[chan] = interpolate(x0[chan], x1[chan], x2[chan], x3[chan], t);
+		output += nchans;
+		frame++;
+
+		transfer->phase += transfer->ratio;
+		while (transfer->phase >= 1.0) {
+			transfer->phase -= 1.0;
+			tail++;
+		}
+	} /* while frames */
 
-		if (transfer->sample==transfer->nsamples) {
-			if (transfer->current==1) {
-				/* switch to the start of the other block */
-				transfer->refresh1 = 1;
-				transfer->current = (transfer->refresh2 ? 0 : 2);
-				transfer->sample = 0;
-			}
-			else if (transfer->current==2) {
-				/* switch to the start of the other block */
-				transfer->refresh2 = 1;
-				transfer->current = (transfer->refresh1 ? 0 : 1);
-				transfer->sample = 0;
-			}
-			else {
-				/* both blocks are not available */
-				transfer->current = 0;
-				transfer->sample = 0;
-			}
-		} /* if switch to other block */
-	} /* while framesPerBuffer */
+	/* silence when there are no samples */
+	for (; frame<framesPerBuffer; frame++)
+		for (unsigned int chan=0; chan<nchans; chan++)
+			*output++ = 0;
 
+	MEMORY_BARRIER(); /* done with the frames before tail */
+	transfer->tail = tail;
 	return 0;
 } /* paWriteCallback */
 
+/*******************************************************************/
+/* increases the priority of the main thread, which reads from the buffer */
+static void increasePriority(void)
+{
+#if defined(PLATFORM_WINDOWS)
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+#else
+	struct sched_param param;
+	param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+	if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0)
+		printf("ft2audio: no permission for real-time scheduling, using the normal priority\n");
+#endif
+}
+
+/*******************************************************************/
+/* waits for samples beyond nsamples, returns the number of samples in the buffer or -1 */
+static int waitSamples(int ftSocket, unsigned int nsamples, unsigned int milliseconds, unsigned int *available)
+{
+	message_t request, *response = NULL;
+	messagedef_t def;
+	waitdef_t waitdef;
+	int status = -1;
+
+	waitdef.threshold.nsamples = nsamples;
+	waitdef.threshold.nevents  = 0xFFFFFFFF;
+	waitdef.milliseconds = milliseconds;
+	def.version = VERSION;
+	def.command = WAIT_DAT;
+	def.bufsize = sizeof(waitdef_t);
+	request.def = &def;
+	request.buf = &waitdef;
+
+	if (clientrequest(ftSocket, &request, &response) != 0 || response == NULL)
+		return -1;
+	if (response->def->command == WAIT_OK && response->def->bufsize >= sizeof(samples_events_t)) {
+		*available = ((samples_events_t *) response->buf)->nsamples;
+		status = 0;
+	}
+	cleanup_message((void **)&response);
+	return status;
+}
+
 /*******************************************************************/
 int file_exists(const char *fname) {
   /* see http://stackoverflow.com/questions/230062/whats-the-best-way-to-check-if-a-file-exists-in-c-cross-platform */
@@ -209,10 +305,11 @@ int main(int argc, char *argv[])
 	struct timeval timeout, monitor;
 	int ftSocket, status, retry;
 	ft_buffer_server_t *ftServer;
-	UINT32_T datatype;
+	UINT32_T datatype, firsttype;
 	float fsample;
-	unsigned int nchans, nsamples, nevents, begsample, endsample;
+	unsigned int nchans, nsamples, nevents, begsample, endsample, maxread, overflows = 0;
 	void *bufdata;
+	PaStreamParameters outputParameters;
   configuration_t config;
 	host_t host;
 
@@ -223,8 +320,9 @@ int main(int argc, char *argv[])
 	config.monitor       = 2000;	/* in milliseconds */
 	config.timeout       = 60000;	/* in milliseconds */
 	config.slip          = 5000;	/* in milliseconds */
-	config.blocksize     = 1000;	/* in milliseconds */
-	config.callbacksize  = 100;		/* in milliseconds */
+	config.blocksize     = 100;	/* in milliseconds, the maximum that is read at once */
+	config.callbacksize  = 2;		/* in milliseconds */
+	config.latency       = 10;	/* in milliseconds */
 	config.calibration   = 1.0f;
 
 	if (argc==1) {
@@ -301,41 +399,30 @@ int main(int argc, char *argv[])
 		printf("ft2audio: nsamples = %d\n", nsamples);
 	}
 
-	/* Initialize the structure that is shared with the callback. */
-	transfer.refresh1 = 1; /* needs new data */
-	transfer.refresh2 = 1; /* needs new data */
-	transfer.current  = 0; /* neither one contains data */
-	transfer.datatype = datatype;
+	/* Initialize the ring that is shared with the callback, with room for the latency and the slip */
+	firsttype = datatype;
+	maxread = MAX(1, fsample*config.blocksize/1000);
+	memset(&transfer, 0, sizeof(transfer));
 	transfer.nchans   = nchans;
 	transfer.fsample  = fsample;
-	transfer.nsamples = fsample*config.blocksize/1000;
-	transfer.sample   = 0;
-	transfer.nput     = 0; /* how many samples are read from the data stream */
-	transfer.nget     = 0; /* how many samples are written to the audio stream */
-	transfer.skipped  = 0; /* how often was a sample skipped in the audio stream */
-	transfer.block1   = malloc(transfer.nchans*transfer.nsamples*sizeof(float));
-	transfer.block2   = malloc(transfer.nchans*transfer.nsamples*sizeof(float));
-	DIE_BAD_MALLOC(transfer.block1);
-	DIE_BAD_MALLOC(transfer.block2);
-	bzero(transfer.block1, transfer.nchans*transfer.nsamples*sizeof(float));
-	bzero(transfer.block2, transfer.nchans*transfer.nsamples*sizeof(float));
+	transfer.target   = MAX(4, fsample*config.latency/1000);
+	transfer.maxfill  = transfer.target + fsample*config.slip/1000;
+	transfer.ratio    = 1.0;
+	transfer.size     = 1;
+	while (transfer.size < transfer.maxfill + maxread + 1)
+		transfer.size *= 2;
+	transfer.data     = malloc(transfer.nchans*transfer.size*sizeof(float));
+	DIE_BAD_MALLOC(transfer.data);
+	bzero(transfer.data, transfer.nchans*transfer.size*sizeof(float));
 
 	/* Initialize to read the data from the buffer. */
 	switch (datatype) {
 		case DATATYPE_INT16:
-			bufdata = malloc(transfer.nchans*transfer.nsamples*WORDSIZE_INT16);
-			break;
 		case DATATYPE_INT32:
-			bufdata = malloc(transfer.nchans*transfer.nsamples*WORDSIZE_INT32);
-			break;
 		case DATATYPE_INT64:
-			bufdata = malloc(transfer.nchans*transfer.nsamples*WORDSIZE_INT64);
-			break;
 		case DATATYPE_FLOAT32:
-			bufdata = malloc(transfer.nchans*transfer.nsamples*WORDSIZE_FLOAT32);
-			break;
 		case DATATYPE_FLOAT64:
-			bufdata = malloc(transfer.nchans*transfer.nsamples*WORDSIZE_FLOAT64);
+			bufdata = malloc(transfer.nchans*maxread*WORDSIZE_FLOAT64);
 			break;
 		default:
 			printf("ft2audio: unsupported datatype = %d\n", datatype);
@@ -355,12 +442,21 @@ int main(int argc, char *argv[])
 	if (config.verbose>0)
 		printf("ft2audio: initialized PortAudio\n");
 
-	/* Open an audio I/O stream. */
-	err = Pa_OpenDefaultStream(&stream, 0, nchans, paFloat32, fsample, fsample*config.callbacksize/1000, paWriteCallback, &transfer);
+	/* Open an audio I/O stream on the default device, with its lowest latency. */
+	outputParameters.device = Pa_GetDefaultOutputDevice();
+	if (outputParameters.device == paNoDevice) {
+		err = paDeviceUnavailable;
+		goto error;
+	}
+	outputParameters.channelCount = nchans;
+	outputParameters.sampleFormat = paFloat32;
+	outputParameters.suggestedLatency = Pa_GetDeviceInfo(outputParameters.device)->defaultLowOutputLatency;
+	outputParameters.hostApiSpecificStreamInfo = NULL;
+	err = Pa_OpenStream(&stream, NULL, &outputParameters, fsample, MAX(1, fsample*config.callbacksize/1000), paNoFlag, paWriteCallback, &transfer);
 	if (err != paNoError) goto error;
 
 	if (config.verbose>0)
-		printf("ft2audio: opened PortAudio stream\n");
+		printf("ft2audio: opened PortAudio stream, latency of the sound card = %.1f ms\n", 1000*Pa_GetStreamInfo(stream)->outputLatency);
 
 	err = Pa_StartStream(stream);
 	if (err != paNoError) goto error;
@@ -368,9 +464,10 @@ int main(int argc, char *argv[])
 	if (config.verbose>0)
 		printf("ft2audio: started PortAudio stream\n");
 
-	/* Jump to the end of the available data, the case of "no data" will be dealt with further down. */
-	begsample = nsamples-transfer.nsamples;
-	endsample = nsamples-1;
+	increasePriority();
+
+	/* Jump to the end of the available data, the latency is built up from there. */
+	begsample = nsamples;
 
 	/* initialize the timers */
 	tic(&timeout);
@@ -389,7 +486,7 @@ int main(int argc, char *argv[])
 				printf("read_header: datatype = %d, nchans = %d, fsample = %.0f, nsamples = %d, nevents = %d\n", datatype, nchans, fsample, nsamples, nevents);
 
 			/* these should not change once this application is running */
-			if (datatype!=transfer.datatype) {
+			if (datatype!=firsttype) {
 				fprintf(stderr, "Error: unexpected change in datatype\n");
 				goto error;
 			}
@@ -402,163 +499,65 @@ int main(int argc, char *argv[])
 				goto error;
 			}
 
-			long data_lead = (long)endsample-(nsamples-1);
-			long audio_lag = (long)transfer.nput-transfer.nget-transfer.skipped;
-			char jump_to_last = 0, jump_to_next = 0;
-
 			if (config.verbose>0)
-				printf("ft2audio: data lead = %ld, audio lag = %ld, skipped = %d, read = %d\n", data_lead, audio_lag, transfer.skipped, transfer.nput);
+				printf("ft2audio: latency = %.1f ms, ratio = %+.0f ppm, underruns = %d, dropped = %d, overflows = %d\n",
+						1000.0*transfer.fill/fsample, 1e6*(transfer.ratio-1.0), transfer.underruns, transfer.dropped, overflows);
+		} /* if monitor */
 
-			if (data_lead > +fsample*config.slip/1000) {
-				/* reading data too far in the future, data is coming in too slow */
-				printf("ft2audio: data lead too large, reverting to the end\n");
-				jump_to_next = 1;
-			}
-			else if (data_lead < -fsample*config.slip/1000) {
-				/* reading data too far in the past, playback is too slow */
-				printf("ft2audio: data lag too large, skipping to the end\n");
-				jump_to_last = 1;
-			}
-			else if (audio_lag > +fsample*config.slip/1000) {
-				/* writing data slower than it is arriving, playback is too slow */
-				printf("ft2audio: audio lag too large, skipping to the end\n");
-				jump_to_last = 1;
-			}
-			else if (audio_lag < -fsample*config.slip/1000) {
-				/* writing data faster than it is arriving, data is coming in too slow */
-				printf("ft2audio: audio lead too large, reverting to the end\n");
-				jump_to_next = 1;
-			}
+		/* wait for the next samples, this returns as soon as there are any */
+		status = waitSamples(ftSocket, begsample, MIN(config.timeout, 100), &nsamples);
+		if (status!=0)
+			break;
 
-			if (jump_to_last) {
-				/* jump to the last available block */
-				begsample = nsamples-transfer.nsamples;
-				endsample = nsamples-1;
-				/* reset the audio stream counters */
-				transfer.nput = 0;
-				transfer.nget = 0;
-				transfer.skipped = 0;
-				printf("ft2audio: new endsample = %d\n", endsample);
-			}
-			else if (jump_to_next) {
-				/* jump to the first non-available block */
-				begsample = nsamples;
-				endsample = nsamples+transfer.nsamples-1;
-				/* reset the audio stream counters */
-				transfer.nput = 0;
-				transfer.nget = 0;
-				transfer.skipped = 0;
-				printf("ft2audio: new endsample = %d\n", endsample);
-			}
+		if (nsamples < begsample) {
+			/* the buffer was flushed or restarted */
+			printf("ft2audio: buffer was restarted, continuing at sample %d\n", nsamples);
+			begsample = nsamples;
+			continue;
+		}
+		if (nsamples - begsample > transfer.maxfill) {
+			/* reading data too far in the past, playback is too slow */
+			printf("ft2audio: data lag too large, skipping to the end\n");
+			begsample = nsamples - transfer.target;
+		}
 
-		} /* if monitor */
+		while (begsample < nsamples) {
+			UINT32_T head = transfer.head;
+			unsigned int space = transfer.size - 1 - (head - transfer.tail); /* one frame is kept for the interpolation */
+			unsigned int count = MIN(MIN(nsamples - begsample, maxread), space);
+			unsigned int first;
 
-		if (transfer.refresh1) {
-			status = wait_data(ftSocket, endsample, 0, 1200.*transfer.nsamples/fsample);
-			if (config.verbose>1)
-				printf("wait_data: block = 1, endsample = %d, status = %d\n", endsample, status);
-			if (status!=0)
-			  break;
+			if (count==0) {
+				/* the ring is full, the audio is not being played */
+				overflows++;
+				begsample = nsamples;
+				break;
+			}
+			endsample = begsample + count - 1;
 			status = read_data(ftSocket, begsample, endsample, bufdata);
 			if (config.verbose>1)
-				printf("read_data: block = 1, endsample = %d, status = %d\n", endsample, status);
-			/* status ==0 when new data or !=0 when data not (yet) available */
-			if (status==0) {
-				tic(&timeout);
-				begsample += transfer.nsamples; // in samples
-				endsample += transfer.nsamples;
-
-				for (unsigned int sample=0; sample<transfer.nsamples; sample++) {
-					for (unsigned int chan=0; chan<transfer.nchans; chan++) {
-						unsigned int i = (sample*transfer.nchans)+chan;
-						switch (datatype) {
-							case DATATYPE_INT16:
-								transfer.block1[i] = ((INT16_T *)bufdata)[i];
-								break;
-							case DATATYPE_INT32:
-								transfer.block1[i] = ((INT32_T *)bufdata)[i];
-								break;
-							case DATATYPE_INT64:
-								transfer.block1[i] = ((INT64_T *)bufdata)[i];
-								break;
-							case DATATYPE_FLOAT32:
-								transfer.block1[i] = ((FLOAT32_T *)bufdata)[i];
-								break;
-							case DATATYPE_FLOAT64:
-								transfer.block1[i] = ((FLOAT64_T *)bufdata)[i];
-								break;
-							default:
-								printf("ft2audio: unsupported datatype = %d\n", datatype);
-								goto error;
-						}
-						transfer.block1[i] *= config.calibration;
-					}
-				}
-				transfer.refresh1 = 0;
-				transfer.nput += transfer.nsamples;
+				printf("read_data: begsample = %d, endsample = %d, status = %d\n", begsample, endsample, status);
+			if (status!=0) {
+				printf("ft2audio: reading data failed, timeout in %d seconds\n", (config.timeout-toc(timeout))/1000);
+				break;
 			}
-			else {
-				printf("ft2audio: reading block2 failed, timeout in %d seconds\n", (config.timeout-toc(timeout))/1000);
-			}
-		}
 
-		if (transfer.refresh2) {
-			status = wait_data(ftSocket, endsample, 0, 1200.*transfer.nsamples/fsample);
-			if (config.verbose>1)
-				printf("wait_data: block = 2, endsample = %d, status = %d\n", endsample, status);
-			if (status!=0)
-			  break;
-			status = read_data(ftSocket, begsample, endsample, bufdata);
-			if (config.verbose>1)
-				printf("read_data: block = 2, endsample = %d, status = %d\n", endsample, status);
-			/* status ==0 when new data or !=0 when data not (yet) available */
-			if (status==0) {
-				tic(&timeout);
-				begsample += transfer.nsamples; // in samples
-				endsample += transfer.nsamples;
-
-				for (unsigned int sample=0; sample<transfer.nsamples; sample++) {
-					for (unsigned int chan=0; chan<transfer.nchans; chan++) {
-						unsigned int i = (sample*transfer.nchans)+chan;
-						switch (datatype) {
-							case DATATYPE_INT16:
-								transfer.block2[i] = ((INT16_T *)bufdata)[i];
-								break;
-							case DATATYPE_INT32:
-								transfer.block2[i] = ((INT32_T *)bufdata)[i];
-								break;
-							case DATATYPE_INT64:
-								transfer.block2[i] = ((INT64_T *)bufdata)[i];
-								break;
-							case DATATYPE_FLOAT32:
-								transfer.block2[i] = ((FLOAT32_T *)bufdata)[i];
-								break;
-							case DATATYPE_FLOAT64:
-								transfer.block2[i] = ((FLOAT64_T *)bufdata)[i];
-								break;
-							default:
-								printf("ft2audio: unsupported datatype = %d\n", datatype);
-								goto error;
-						}
-						transfer.block2[i] *= config.calibration;
-					}
+			/* copy in at most two pieces, up to the end of the ring and from its start */
+			first = MIN(count, transfer.size - (head & (transfer.size-1)));
+			ft_convert_float32(first*nchans, transfer.data + (head & (transfer.size-1))*nchans, datatype, bufdata, NULL);
+			ft_convert_float32((count-first)*nchans, transfer.data, datatype, (char *)bufdata + first*nchans*wordsize_from_type(datatype), NULL);
+			if (config.calibration != 1.0f) {
+				for (unsigned int i=0; i<count; i++) {
+					float *frame = transfer.data + ((head+i) & (transfer.size-1))*nchans;
+					for (unsigned int chan=0; chan<nchans; chan++)
+						frame[chan] *= config.calibration;
 				}
-				transfer.refresh2 = 0;
-				transfer.nput += transfer.nsamples;
-			}
-			else {
-				printf("ft2audio: reading block2 failed, timeout in %d seconds\n", (config.timeout-toc(timeout))/1000);
 			}
-		}
-
-		if (transfer.refresh1==0 && transfer.refresh2==0) {
-			/* Both blocks have fresh data, sleep for some time. */
-			Pa_Sleep(500.*transfer.nsamples/fsample);
-		}
 
-		if (transfer.refresh1!=0 && transfer.refresh2!=0) {
-			/* Both blocks need fresh data, sleep for some time. */
-			Pa_Sleep(100);
+			MEMORY_BARRIER(); /* the frames are complete before the callback can see them */
+			transfer.head = head + count;
+			begsample += count;
+			tic(&timeout);
 		}
 
 		if (toc(timeout)>config.timeout) {
@@ -575,8 +574,8 @@ int main(int argc, char *argv[])
 	if (err != paNoError) goto error;
 	Pa_Terminate();
 
-	free(transfer.block1);
-	free(transfer.block2);
+	free(transfer.data);
+	free(bufdata);
 
 	if (ftSocket > 0)
     close_connection(ftSocket);
@@ -7,24 +7,498 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <signal.h>
 #include <time.h>
 #include "buffer.h"
+#include "socketserver.h"
+#include "rdaserver.h"
+#include "mcastserver.h"
+#include "wsserver.h"
+#include "derived.h"
+
+#define MAXLINE      1024
+#define MAXLISTENERS 16
+
+/* a listener on TCP (port>0), on a UNIX domain socket (path), or for RDA or WebSocket clients */
+typedef struct {
+	int port;
+	char path[256];
+	int mode, threads;     /* see ft_start_buffer_server_mode */
+	int workers;           /* see ft_start_buffer_server_pool */
+	int use16bit, blocksize;
+} listener_t;
+
+/* a publisher of the samples to a UDP multicast group, see mcast_start_server */
+typedef struct {
+	char group[64];
+	int port, ttl;
+	UINT32_T stride, data_type;
+} publisher_t;
+
+/* a derived stream, see ft_derived_add */
+typedef struct {
+	char output[FT_STREAM_NAMELEN];
+	char plugin[32];
+	char source[FT_STREAM_NAMELEN];
+	char args[256];
+} derive_t;
+
+/* the settings from a configuration file, see buffer.conf */
+typedef struct {
+	listener_t sock[MAXLISTENERS];
+	int numSock;
+	listener_t rda[MAXLISTENERS];
+	int numRda;
+	listener_t ws[MAXLISTENERS];
+	int numWs;
+	publisher_t mcast[MAXLISTENERS];
+	int numMcast;
+	derive_t derive[FT_DERIVED_MAXSTREAMS];
+	int numDerive, deriveThreads;
+	char shmname[64];
+	char spillfile[256];
+	char ringfile[256];
+	char cpus[256];
+	UINT32_T nsamples, nevents, megabytes;
+	int memflags, numanode;
+} config_t;
+
+volatile int keepRunning = 1;
+
+void abortHandler(int sig) {
+	keepRunning = 0;
+}
+
+/* parses the limits of a service class, e.g. "viewer,1048576,4194304,2000", returns 0 on success */
+int parse_qos(const char *str) {
+	char name[16];
+	unsigned int maxbytes = 0, rate = 0, maxstall = 0;
+	int qosclass, nice = 0;
+	if (sscanf(str, "%15[a-z],%u,%u,%u,%d", name, &maxbytes, &rate, &maxstall, &nice) < 2) name[0] = 0;
+	qosclass = strcmp(name, "writer")==0 ? FT_QOS_WRITER : strcmp(name, "classifier")==0 ? FT_QOS_CLASSIFIER : strcmp(name, "viewer")==0 ? FT_QOS_VIEWER : -1;
+	if (qosclass < 0 || set_qos_policy(qosclass, maxbytes, rate, maxstall, nice) != 0) {
+		fprintf(stderr, "Invalid service class '%s', the format is class,maxbytes[,rate[,maxstall[,nice]]]\n", str);
+		return -1;
+	}
+	printf("Limits for %s: %u bytes per response, %u bytes/s, %u ms stall, niceness %d\n", name, maxbytes, rate, maxstall, nice);
+	return 0;
+}
+
+/* parses the optional ":mode:threads:workers" of a tcp or unix listener, returns 0 on success */
+int parse_mode(const char *str, listener_t *L) {
+	char mode[16];
+	L->mode    = FT_SERVER_THREADED;
+	L->threads = 0;
+	L->workers = 0;
+	if (str == NULL) return 0;
+	if (sscanf(str, ":%15[a-z]:%d:%d", mode, &L->threads, &L->workers) < 1) return -1;
+	if (strcmp(mode, "threaded")==0) L->mode = FT_SERVER_THREADED;
+	else if (strcmp(mode, "eventloop")==0) L->mode = FT_SERVER_EVENTLOOP;
+	else if (strcmp(mode, "uring")==0) L->mode = FT_SERVER_URING;
+	else return -1;
+	return (L->threads >= 0 && L->workers >= 0) ? 0 : -1;
+}
+
+/* Reads the configuration file, the service classes are set while reading.
+   Returns 0 if ok, -1 if the file can't be opened, or the number of errors */
+int parse_config(const char *filename, config_t *C) {
+	FILE *f;
+	char line[MAXLINE];
+	int numErrs = 0, lineNr = 0;
+
+	memset(C, 0, sizeof(config_t));
+	C->numanode = -1;
+
+	f = fopen(filename, "r");
+	if (f==NULL) {
+		fprintf(stderr, "Configuration file %s could not be opened\n", filename);
+		return -1;
+	}
+
+	while (fgets(line, MAXLINE, f) != NULL) {
+		char *value;
+		int len, err = 0;
+
+		++lineNr;
+
+		/* strip trailing whitespace, silently ignore comments and empty lines */
+		len = strlen(line);
+		while (len>0 && (line[len-1]=='\r' || line[len-1]=='\n' || line[len-1]==' ' || line[len-1]=='\t')) --len;
+		line[len] = 0;
+		if (line[0]=='#' || len==0) continue;
+
+		value = strchr(line, '=');
+		if (value == NULL) {
+			fprintf(stderr, "Ignoring faulty line %i\n", lineNr);
+			++numErrs;
+			continue;
+		}
+		*value++ = 0;
+
+		if (strcmp(line, "tcp")==0 || strcmp(line, "unix")==0) {
+			listener_t *L = &C->sock[C->numSock];
+			char *colon = strchr(value, ':');
+			if (C->numSock == MAXLISTENERS) {
+				err = 1;
+			} else {
+				memset(L, 0, sizeof(listener_t));
+				err = (parse_mode(colon, L) != 0);
+				if (colon) *colon = 0;
+				if (line[0]=='t') {
+					L->port = atoi(value);
+					err |= (L->port <= 0);
+				} else {
+					strncpy(L->path, value, sizeof(L->path)-1);
+					err |= (L->path[0] == 0);
+				}
+				if (!err) C->numSock++;
+			}
+		} else if (strcmp(line, "rda")==0) {
+			listener_t *L = &C->rda[C->numRda];
+			char format[16] = "float";
+			if (C->numRda == MAXLISTENERS) {
+				err = 1;
+			} else {
+				memset(L, 0, sizeof(listener_t));
+				if (sscanf(value, "%d:%15[a-z0-9]:%d", &L->port, format, &L->blocksize) < 1) err = 1;
+				if (strcmp(format, "int16")==0) L->use16bit = 1;
+				else if (strcmp(format, "float")!=0) err = 1;
+				if (L->port < 0 || L->blocksize < 0) err = 1;
+				if (!err) C->numRda++;
+			}
+		} else if (strcmp(line, "ws")==0) {
+			listener_t *L = &C->ws[C->numWs];
+			if (C->numWs == MAXLISTENERS) {
+				err = 1;
+			} else {
+				memset(L, 0, sizeof(listener_t));
+				L->port = atoi(value);
+				if (L->port <= 0) err = 1;
+				if (!err) C->numWs++;
+			}
+		} else if (strcmp(line, "mcast")==0) {
+			publisher_t *P = &C->mcast[C->numMcast];
+			char format[16] = "native";
+			if (C->numMcast == MAXLISTENERS) {
+				err = 1;
+			} else {
+				memset(P, 0, sizeof(publisher_t));
+				P->stride = 1;
+				P->ttl = 1;
+				if (sscanf(value, "%63[0-9.]:%d:%u:%d:%15[a-z]", P->group, &P->port, &P->stride, &P->ttl, format) < 2) err = 1;
+				if (strcmp(format, "float")==0) P->data_type = DATATYPE_FLOAT32;
+				else if (strcmp(format, "calibrated")==0) P->data_type = DATATYPE_FLOAT32 + DATASEL_CALIBRATE;
+				else if (strcmp(format, "native")==0) P->data_type = DATATYPE_UNKNOWN;
+				else err = 1;
+				if (P->port <= 0 || P->ttl <= 0) err = 1;
+				if (!err) C->numMcast++;
+			}
+		} else if (strcmp(line, "derive")==0) {
+			derive_t *D = &C->derive[C->numDerive];
+			char *field[4] = {NULL, NULL, NULL, NULL};
+			int k;
+			if (C->numDerive == FT_DERIVED_MAXSTREAMS) {
+				err = 1;
+			} else {
+				memset(D, 0, sizeof(derive_t));
+				/* output:plugin[:source[:args]], the source may be empty */
+				field[0] = value;
+				for (k=1; k<4 && field[k-1] != NULL; k++) {
+					field[k] = strchr(field[k-1], ':');
+					if (field[k]) *field[k]++ = 0;
+				}
+				if (field[1] == NULL || strlen(field[0]) >= sizeof(D->output) || strlen(field[1]) >= sizeof(D->plugin)) err = 1;
+				else if ((field[2] && strlen(field[2]) >= sizeof(D->source)) || (field[3] && strlen(field[3]) >= sizeof(D->args))) err = 1;
+				else {
+					strcpy(D->output, field[0]);
+					strcpy(D->plugin, field[1]);
+					if (field[2]) strcpy(D->source, field[2]);
+					if (field[3]) strcpy(D->args, field[3]);
+					C->numDerive++;
+				}
+			}
+		} else if (strcmp(line, "derivethreads")==0) {
+			C->deriveThreads = atoi(value);
+			if (C->deriveThreads < 1) err = 1;
+		} else if (strcmp(line, "shm")==0) {
+			strncpy(C->shmname, value, sizeof(C->shmname)-1);
+		} else if (strcmp(line, "capacity")==0) {
+			if (sscanf(value, "%u:%u:%u", &C->nsamples, &C->nevents, &C->megabytes) < 1) err = 1;
+		} else if (strcmp(line, "spill")==0) {
+			strncpy(C->spillfile, value, sizeof(C->spillfile)-1);
+		} else if (strcmp(line, "ringfile")==0) {
+			strncpy(C->ringfile, value, sizeof(C->ringfile)-1);
+		} else if (strcmp(line, "hugepages")==0) {
+			if (atoi(value)) C->memflags |= FT_MEM_HUGEPAGES;
+		} else if (strcmp(line, "hugetlb")==0) {
+			if (atoi(value)) C->memflags |= FT_MEM_HUGETLB;
+		} else if (strcmp(line, "numa")==0) {
+			C->numanode = atoi(value);
+		} else if (strcmp(line, "cpus")==0) {
+			strncpy(C->cpus, value, sizeof(C->cpus)-1);
+		} else if (strcmp(line, "qos")==0) {
+			err = (parse_qos(value) != 0);
+		} else {
+			fprintf(stderr, "Ignoring unknown key '%s' at line %i\n", line, lineNr);
+			++numErrs;
+			continue;
+		}
+		if (err) {
+			fprintf(stderr, "Ignoring faulty %s definition at line %i\n", line, lineNr);
+			++numErrs;
+		}
+	}
+	fclose(f);
+
+	if (C->numSock == 0 && C->numRda == 0) {
+		fprintf(stderr, "The configuration file %s does not contain any tcp, unix or rda listener\n", filename);
+		++numErrs;
+	}
+	return numErrs;
+}
+
+/* serves the buffer on all listeners of the configuration file, until Ctrl-C is pressed */
+int run_config(const char *filename) {
+	config_t C;
+	ft_buffer_server_t *server[MAXLISTENERS];
+	rda_server_ctrl_t *rda[MAXLISTENERS];
+	ws_server_ctrl_t *ws[MAXLISTENERS];
+	mcast_server_ctrl_t *mcast[MAXLISTENERS];
+	ft_derived_pool_t *derived = NULL;
+	int i, numServer = 0, numRda = 0, numWs = 0, numMcast = 0, status = 0, haveUnix = 0;
+#ifndef PLATFORM_WINDOWS
+	sigset_t sigInt;
+#endif
+
+	if (parse_config(filename, &C) != 0) {
+		fprintf(stderr, "Errors during parsing the configuration file\n");
+		return 1;
+	}
+
+	/* these have to be set before the first listener is started */
+	if (C.cpus[0]) {
+		/* the threads of the servers inherit this */
+		if (set_cpu_affinity(C.cpus) != 0) return 1;
+		printf("Running on cores %s\n", C.cpus);
+	}
+	if (C.memflags != 0 || C.numanode >= 0) {
+		set_buffer_memory(C.memflags, C.numanode);
+	}
+	if (C.nsamples || C.nevents || C.megabytes) {
+		set_buffer_capacity(C.nsamples, (UINT64_T) C.megabytes*1024*1024, C.nevents);
+		printf("Ring of %u samples (memory budget %u MB) and %u events\n", C.nsamples ? C.nsamples : MAXNUMSAMPLE, C.megabytes, C.nevents ? C.nevents : MAXNUMEVENT);
+	}
+	if (C.spillfile[0]) {
+		if (enable_spill_file(C.spillfile) != 0) {
+			fprintf(stderr, "Could not use %s as spill file\n", C.spillfile);
+			return 1;
+		}
+		printf("Spilling the samples to %s\n", C.spillfile);
+	}
+	if (C.ringfile[0]) {
+		if (enable_ring_file(C.ringfile) != 0) {
+			fprintf(stderr, "Could not use %s as ring file\n", C.ringfile);
+			return 1;
+		}
+		printf("Keeping the ring in %s\n", C.ringfile);
+	}
+	for (i=0; i<C.numSock; i++) {
+		if (C.sock[i].port == 0) haveUnix = 1;
+	}
+	if (C.shmname[0]) {
+		/* the clients get the name of the shared memory over a UNIX domain socket */
+		if (!haveUnix) {
+			fprintf(stderr, "Shared memory needs a unix listener, clients would not be able to find it\n");
+		} else if (enable_shared_memory(C.shmname) != 0) {
+			fprintf(stderr, "Could not enable shared memory, clients will have to use the socket\n");
+			C.shmname[0] = 0;
+		} else {
+			printf("Sharing the ring as %s\n", C.shmname);
+		}
+	}
+
+#ifndef PLATFORM_WINDOWS
+	/* the threads of the servers should not receive Ctrl-C, they are stopped from here */
+	sigemptyset(&sigInt);
+	sigaddset(&sigInt, SIGINT);
+	sigprocmask(SIG_BLOCK, &sigInt, NULL);
+#endif
+
+	/* all listeners go through dmarequest, i.e. to the same ring */
+	for (i=0; i<C.numSock && status==0; i++) {
+		const listener_t *L = &C.sock[i];
+		server[numServer] = ft_start_buffer_server_pool(L->port, L->port ? NULL : L->path, NULL, NULL, L->mode, L->threads, L->workers);
+		if (server[numServer] == NULL) {
+			if (L->port) fprintf(stderr, "Could not start the buffer server on port %d\n", L->port);
+			else fprintf(stderr, "Could not start the buffer server on %s\n", L->path);
+			status = 1;
+		} else {
+			if (L->port) printf("Serving TCP clients on port %d\n", L->port);
+			else printf("Serving UNIX domain clients on %s\n", L->path);
+			numServer++;
+		}
+	}
+	for (i=0; i<C.numRda && status==0; i++) {
+		const listener_t *L = &C.rda[i];
+		int errval;
+		rda[numRda] = rda_start_server(0, L->use16bit, L->port, L->blocksize, &errval);
+		if (rda[numRda] == NULL || errval != 0) {
+			fprintf(stderr, "Could not start the RDA server on port %d: %i\n", L->port, errval);
+			status = 1;
+		} else {
+			printf("Serving RDA clients (%s) on port %d\n", L->use16bit ? "int16" : "float", L->port ? L->port : (L->use16bit ? 51234 : 51244));
+			numRda++;
+		}
+	}
+	if (C.numDerive > 0 && status==0) {
+		derived = ft_derived_start(C.deriveThreads ? C.deriveThreads : 2);
+		if (derived == NULL) {
+			fprintf(stderr, "Could not start the workers for the derived streams\n");
+			status = 1;
+		}
+	}
+	for (i=0; i<C.numDerive && status==0; i++) {
+		const derive_t *D = &C.derive[i];
+		if (ft_derived_add(derived, D->output, D->plugin, D->source, D->args) != 0) {
+			fprintf(stderr, "Could not derive the stream %s with %s\n", D->output, D->plugin);
+			status = 1;
+		} else {
+			printf("Deriving the stream %s with %s(%s) from the %s stream\n", D->output, D->plugin, D->args, D->source[0] ? D->source : "default");
+		}
+	}
+	for (i=0; i<C.numWs && status==0; i++) {
+		int errval;
+		ws[numWs] = ws_start_server(0, C.ws[i].port, &errval);
+		if (ws[numWs] == NULL || errval != 0) {
+			fprintf(stderr, "Could not start the WebSocket server on port %d: %i\n", C.ws[i].port, errval);
+			status = 1;
+		} else {
+			printf("Serving WebSocket clients on port %d\n", C.ws[i].port);
+			numWs++;
+		}
+	}
+	for (i=0; i<C.numMcast && status==0; i++) {
+		const publisher_t *P = &C.mcast[i];
+		int errval;
+		mcast[numMcast] = mcast_start_server(0, P->group, P->port, P->ttl, P->stride, P->data_type, 0, NULL, &errval);
+		if (mcast[numMcast] == NULL || errval != 0) {
+			fprintf(stderr, "Could not start publishing to %s:%d: %i\n", P->group, P->port, errval);
+			status = 1;
+		} else {
+			printf("Publishing the samples with stride %u to %s:%d\n", P->stride ? P->stride : 1, P->group, P->port);
+			numMcast++;
+		}
+	}
+
+#ifndef PLATFORM_WINDOWS
+	sigprocmask(SIG_UNBLOCK, &sigInt, NULL);
+#endif
+	signal(SIGINT, abortHandler);
+
+	while (keepRunning && status==0) {
+		usleep(100000);
+	}
+	if (status==0) printf("Ctrl-C pressed -- stopping buffer server...\n");
+
+	for (i=0; i<numMcast; i++) mcast_stop_server(mcast[i]);
+	for (i=0; i<numWs; i++) ws_stop_server(ws[i]);
+	ft_derived_stop(derived);
+	for (i=0; i<numRda; i++) rda_stop_server(rda[i]);
+	for (i=0; i<numServer; i++) ft_stop_buffer_server(server[i]);
+	if (C.shmname[0]) disable_shared_memory();
+	if (C.ringfile[0]) disable_ring_file();
+	return status;
+}
 
 int main(int argc, char *argv[]) {
 	host_t host;
+	int memflags = 0, numanode = -1;
+	const char *ringfile = NULL;
 
     /* verify that all datatypes have the expected syze in bytes */
     check_datatypes();
 
+	/* the options for the placement in memory and on the cores come first */
+	while (argc>1 && argv[1][0]=='-') {
+		if (strcmp(argv[1], "-config")==0 && argc>2) {
+			/* all listeners and settings are in the configuration file */
+			return run_config(argv[2]);
+		}
+		else if (strcmp(argv[1], "-hugepages")==0) {
+			memflags |= FT_MEM_HUGEPAGES;
+		}
+		else if (strcmp(argv[1], "-hugetlb")==0) {
+			memflags |= FT_MEM_HUGETLB;
+		}
+		else if (strcmp(argv[1], "-numa")==0 && argc>2) {
+			numanode = atoi(argv[2]);
+			argc--; argv++;
+		}
+		else if (strcmp(argv[1], "-cpus")==0 && argc>2) {
+			/* the threads of the server inherit this */
+			if (set_cpu_affinity(argv[2]) != 0) return 1;
+			printf("Running on cores %s\n", argv[2]);
+			argc--; argv++;
+		}
+		else if (strcmp(argv[1], "-ringfile")==0 && argc>2) {
+			/* this continues with the header, samples and events of a previous server */
+			ringfile = argv[2];
+			argc--; argv++;
+		}
+		else if (strcmp(argv[1], "-qos")==0 && argc>2) {
+			/* limits of a service class, e.g. "viewer,1048576,4194304,2000" */
+			if (parse_qos(argv[2]) != 0) return 1;
+			argc--; argv++;
+		}
+		else {
+			fprintf(stderr, "Usage: buffer -config <file>\n");
+			fprintf(stderr, "   or: buffer [-hugepages] [-hugetlb] [-numa node] [-cpus list] [-qos class,maxbytes,rate,maxstall,nice] [-ringfile file] [port [nsamples [nevents [megabytes [spillfile]]]]]\n");
+			return 1;
+		}
+		argc--; argv++;
+	}
+	if (memflags != 0 || numanode >= 0) {
+		set_buffer_memory(memflags, numanode);
+	}
+
 	sprintf(host.name, DEFAULT_HOSTNAME);
 	if (argc>1) {
 		host.port = atoi(argv[1]);
 	}
 	else {
-	    printf("Using default port, recommended usage 'buffer [port]'. \n");
+	    printf("Using default port, recommended usage 'buffer [port [nsamples [nevents [megabytes [spillfile]]]]]'. \n");
 		host.port = DEFAULT_PORT;
 	}
 
+	/* the size of the ring, 0 selects the default */
+	if (argc>2) {
+		UINT32_T nsamples = atoi(argv[2]);
+		UINT32_T nevents  = (argc>3) ? atoi(argv[3]) : 0;
+		UINT32_T nbytes   = (argc>4) ? atoi(argv[4]) : 0;
+
+		set_buffer_capacity(nsamples, (UINT64_T) nbytes*1024*1024, nevents);
+		printf("Ring of %u samples (memory budget %u MB) and %u events\n", nsamples ? nsamples : MAXNUMSAMPLE, nbytes, nevents ? nevents : MAXNUMEVENT);
+	}
+
+	/* keep the samples that drop out of the ring on disk */
+	if (argc>5) {
+		if (enable_spill_file(argv[5]) != 0) {
+			fprintf(stderr, "Could not use %s as spill file\n", argv[5]);
+			return 1;
+		}
+		printf("Spilling the samples to %s\n", argv[5]);
+	}
+
+	/* the ring file is laid out on the next PUT_HDR, so this comes after the capacity */
+	if (ringfile) {
+		if (enable_ring_file(ringfile) != 0) {
+			fprintf(stderr, "Could not use %s as ring file\n", ringfile);
+			return 1;
+		}
+		printf("Keeping the ring in %s\n", ringfile);
+	}
+
 	/* start the buffer */
 	printf("Starting FieldTrip buffer on port %d... \n", host.port);
 	tcpserver((void *)(&host));
@@ -0,0 +1,734 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ * Merges the streams of several buffers (e.g. EEG, eye tracker and audio)
+ * into one stream in a local buffer, with all channels on a common clock.
+ *
+ * Every input is followed by its own thread, which waits for new samples
+ * with WAIT_DAT, converts them to single precision and keeps the last
+ * RING_SECONDS of them. The thread also fits a line through the times of the
+ * samples. These times are the timestamps of the blocks if the input was
+ * written with PUT_DAT_T, and otherwise the times at which the samples came
+ * in, taking the earliest arrival in every ANCHOR_INTERVAL. All inputs that
+ * use PUT_DAT_T should use the same clock, and mixing them with inputs
+ * without timestamps only makes sense if that is the monotonic clock of
+ * this host (see ft_clock_ns).
+ *
+ * The merged stream has its own sample rate. For every output sample, the
+ * fit of each input gives the fractional input sample at that time, which
+ * is interpolated with a Lanczos kernel. When an input has a higher rate
+ * than the output, the kernel is widened so that it also acts as the
+ * anti-aliasing filter. The merged blocks are written with PUT_DAT_T, with
+ * the time of their first sample.
+ *
+ * A block goes out once all inputs have the samples for it. An input that
+ * is more than MAX_LATENCY behind the other inputs does not hold up the
+ * merged stream, its channels are NaN until it catches up. The delay and
+ * the drift of every input relative to its nominal rate are reported every
+ * CHECK_INTERVAL. Events are not merged.
+ *
+ * Clients of the merged buffer can only read, all PUT and FLUSH requests
+ * are refused.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "buffer.h"
+#include "socketserver.h"
+
+#define MAX_INPUTS      16
+#define WAIT_TIMEOUT    500      /* milliseconds per WAIT_DAT request to an input */
+#define CHECK_INTERVAL  1.0      /* seconds between header checks and reports */
+#define BLOCK_BYTES     1048576  /* maximum size of the data copied in one request */
+#define RING_SECONDS    10       /* seconds of samples that are kept of every input */
+#define NUM_ANCHORS     64       /* number of (sample, time) pairs for the fit of the clock */
+#define ANCHOR_INTERVAL 250000000 /* nanoseconds between the anchors based on arrival times */
+#define LANCZOS_A       4        /* half the width of the interpolation kernel, in samples */
+#define OUT_BLOCK       0.02     /* duration of a merged block, in seconds */
+#define MAX_LATENCY     500000000 /* nanoseconds that an input may lag behind the others */
+#define MAX_DRIFT_PPM   1000.0   /* larger deviations from the nominal rate are reported */
+
+typedef struct {
+	double sample;
+	double time;             /* in nanoseconds, relative to the base of the input */
+} anchor_t;
+
+typedef struct {
+	char address[HOSTNAME_LENGTH];
+	ft_connection_t *conn;
+	pthread_t thread;
+	pthread_mutex_t mutex;   /* protects everything below */
+	UINT32_T generation;     /* increased whenever the input is synchronised, 0 if it has no header */
+	headerdef_t *hdr;        /* header of the input including the chunks, with the counts set to 0 */
+	UINT32_T nchans;
+	double fsample;
+	float *ring;             /* ringsize samples of nchans values */
+	UINT32_T ringsize;
+	UINT32_T nsamples;       /* number of samples of the input that have been read */
+	UINT64_T base;           /* the anchor times are relative to this */
+	anchor_t anchors[NUM_ANCHORS];
+	int numanchors;
+	int timestamps;          /* 1 if the anchors are the timestamps of the blocks */
+	double fitsample, fittime, period; /* time = fittime + period*(sample - fitsample) */
+	UINT32_T missing;        /* number of output samples without data of this input */
+} merge_input_t;
+
+volatile int keepRunning = 1;
+merge_input_t inputs[MAX_INPUTS];
+int numInputs = 0;
+pthread_mutex_t mergeMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t mergeCond = PTHREAD_COND_INITIALIZER;
+
+void abortHandler(int sig) {
+	keepRunning = 0;
+}
+
+/* the merger is the only one that writes to the local buffer */
+int merge_request_handler(const message_t *request, message_t **response, void *user_data) {
+	UINT16_T command = 0;
+
+	switch (request->def->command) {
+		case PUT_HDR:
+		case PUT_DAT:
+		case PUT_DAT_T:
+		case PUT_EVT:
+		case PUT_BATCH:
+			command = PUT_ERR;
+			break;
+		case FLUSH_HDR:
+		case FLUSH_DAT:
+		case FLUSH_EVT:
+			command = FLUSH_ERR;
+			break;
+	}
+	if (command == 0)
+		return dmarequest(request, response);
+
+	*response = (message_t *) malloc(sizeof(message_t));
+	if (*response == NULL) return -1;
+	(*response)->def = (messagedef_t *) malloc(sizeof(messagedef_t));
+	if ((*response)->def == NULL) {
+		FREE(*response);
+		return -1;
+	}
+	(*response)->def->version = VERSION;
+	(*response)->def->command = command;
+	(*response)->def->bufsize = 0;
+	(*response)->buf = NULL;
+	return 0;
+}
+
+/* sends a request to an input, returns 0 if the response has the expected command
+   and -1 otherwise, in which case there is no response to clean up */
+int request_input(merge_input_t *I, UINT16_T command, void *buf, UINT32_T bufsize, UINT16_T expected, message_t **response) {
+	message_t request;
+	messagedef_t def;
+
+	def.version = VERSION;
+	def.command = command;
+	def.bufsize = bufsize;
+	request.def = &def;
+	request.buf = buf;
+
+	*response = NULL;
+	if (ft_connection_request(I->conn, &request, response) != 0 || *response == NULL)
+		return -1;
+	if ((*response)->def->command != expected) {
+		cleanup_message((void **) response);
+		return -1;
+	}
+	return 0;
+}
+
+/* least-squares fit of the time as a function of the sample, this should be called with the mutex locked */
+void fit_clock(merge_input_t *I) {
+	double ms = 0.0, mt = 0.0, sst = 0.0, sss = 0.0;
+	int i, n = I->numanchors;
+
+	if (n == 0) return;
+	for (i=0;i<n;i++) {
+		ms += I->anchors[i].sample;
+		mt += I->anchors[i].time;
+	}
+	ms /= n;
+	mt /= n;
+	for (i=0;i<n;i++) {
+		double ds = I->anchors[i].sample - ms;
+		sss += ds*ds;
+		sst += ds*(I->anchors[i].time - mt);
+	}
+	I->fitsample = ms;
+	I->fittime   = mt;
+	/* with a single anchor, or all of them in a short time, the nominal rate is better */
+	if (n < 2 || sss < I->fsample*I->fsample) {
+		I->period = 1.0e9 / I->fsample;
+	} else {
+		I->period = sst / sss;
+	}
+}
+
+/* adds the arrival of the samples up to nsamples at the given time, this should be called with the mutex locked */
+void add_arrival(merge_input_t *I, UINT32_T nsamples, UINT64_T now) {
+	anchor_t A;
+	anchor_t *last = (I->numanchors > 0) ? &I->anchors[I->numanchors-1] : NULL;
+
+	if (I->numanchors == 0) I->base = now;
+	A.sample = nsamples;
+	A.time   = (double) (INT64_T) (now - I->base);
+
+	if (last != NULL && A.time - last->time < ANCHOR_INTERVAL) {
+		/* the earliest arrival relative to the nominal rate has the smallest delay */
+		if (A.time - last->time < (A.sample - last->sample) * 1.0e9 / I->fsample) *last = A;
+		return;
+	}
+	if (I->numanchors == NUM_ANCHORS) {
+		memmove(I->anchors, I->anchors+1, (NUM_ANCHORS-1)*sizeof(anchor_t));
+		I->numanchors--;
+	}
+	I->anchors[I->numanchors++] = A;
+}
+
+/* replaces the anchors by (a selection of) the timestamps of the blocks of the input */
+int read_timestamps(merge_input_t *I) {
+	message_t *response;
+	const timestamp_t *ts;
+	int i, n, step;
+
+	if (request_input(I, GET_TIME, NULL, 0, GET_OK, &response) != 0) return -1;
+	ts = (const timestamp_t *) response->buf;
+	n = response->def->bufsize / sizeof(timestamp_t);
+	if (n == 0) {
+		cleanup_message((void **) &response);
+		return -1;
+	}
+	step = (n + NUM_ANCHORS - 1) / NUM_ANCHORS;
+
+	pthread_mutex_lock(&I->mutex);
+	if (!I->timestamps) I->base = ts[0].time;
+	I->timestamps = 1;
+	I->numanchors = 0;
+	/* the newest block is always included */
+	for (i = (n-1) % step; i < n; i += step) {
+		I->anchors[I->numanchors].sample = ts[i].sample;
+		I->anchors[I->numanchors].time   = (double) (INT64_T) (ts[i].time - I->base);
+		I->numanchors++;
+	}
+	fit_clock(I);
+	pthread_mutex_unlock(&I->mutex);
+	cleanup_message((void **) &response);
+	return 0;
+}
+
+/* returns 1 if the header of the input differs from the copy, apart from the counts */
+int header_changed(const merge_input_t *I, const message_t *hdr) {
+	const headerdef_t *hdef = (const headerdef_t *) hdr->buf;
+
+	if (I->hdr == NULL || hdr->def->bufsize != sizeof(headerdef_t) + I->hdr->bufsize)
+		return 1;
+	if (hdef->nchans != I->hdr->nchans || hdef->fsample != I->hdr->fsample || hdef->data_type != I->hdr->data_type)
+		return 1;
+	return memcmp(hdef+1, I->hdr+1, I->hdr->bufsize) != 0;
+}
+
+/* reads the header of the input and starts following it from its current sample */
+int sync_input(merge_input_t *I) {
+	message_t *hdr;
+	headerdef_t *hdef;
+	float *ring;
+	UINT32_T ringsize;
+
+	if (request_input(I, GET_HDR, NULL, 0, GET_OK, &hdr) != 0)
+		return -1;
+	hdef = (headerdef_t *) hdr->buf;
+	if (hdef->fsample <= 0 || hdef->nchans == 0 || wordsize_from_type(hdef->data_type) == 0) {
+		fprintf(stderr, "buffer_merge: %s has an unusable header\n", I->address);
+		cleanup_message((void **) &hdr);
+		return -1;
+	}
+	ringsize = (UINT32_T) (RING_SECONDS * hdef->fsample) + 1;
+	ring = (float *) malloc((size_t) ringsize * hdef->nchans * sizeof(float));
+	if (ring == NULL) {
+		cleanup_message((void **) &hdr);
+		return -1;
+	}
+
+	pthread_mutex_lock(&I->mutex);
+	FREE(I->hdr);
+	FREE(I->ring);
+	I->hdr = hdef;
+	I->nchans   = hdef->nchans;
+	I->fsample  = hdef->fsample;
+	I->ring     = ring;
+	I->ringsize = ringsize;
+	I->nsamples = hdef->nsamples;
+	I->numanchors = 0;
+	I->timestamps = 0;
+	I->missing = 0;
+	I->generation++;
+	if (I->generation == 0) I->generation = 1;
+	pthread_mutex_unlock(&I->mutex);
+
+	/* the header is kept, the message itself is not */
+	hdr->buf = NULL;
+	cleanup_message((void **) &hdr);
+	hdef->nsamples = hdef->nevents = 0;
+
+	printf("%s: %u channels at %g Hz, starting at sample %u\n", I->address, I->nchans, I->fsample, I->nsamples);
+	return 0;
+}
+
+/* copies the samples of the input up to nsamples into the ring */
+int read_samples(merge_input_t *I, UINT32_T nsamples) {
+	UINT32_T blocksize = BLOCK_BYTES / (wordsize_from_type(I->hdr->data_type) * I->nchans);
+	UINT32_T begsample = I->nsamples;
+
+	if (blocksize == 0) blocksize = 1;
+	if (blocksize > I->ringsize) blocksize = I->ringsize;
+	/* samples that would not fit in the ring anyway are skipped */
+	if (nsamples - begsample > I->ringsize) begsample = nsamples - I->ringsize;
+
+	while (begsample < nsamples) {
+		message_t *response;
+		datasel_t datasel;
+		const datadef_t *ddef;
+		const char *src;
+		UINT32_T i, n, wordsize;
+
+		datasel.begsample = begsample;
+		datasel.endsample = (nsamples - begsample > blocksize) ? begsample + blocksize - 1 : nsamples - 1;
+		if (request_input(I, GET_DAT, &datasel, sizeof(datasel), GET_OK, &response) != 0)
+			return -1;
+		ddef = (const datadef_t *) response->buf;
+		src  = (const char *) (ddef+1);
+		n = datasel.endsample - datasel.begsample + 1;
+		wordsize = wordsize_from_type(ddef->data_type) * I->nchans;
+		if (ddef->nsamples != n || ddef->nchans != I->nchans) {
+			cleanup_message((void **) &response);
+			return -1;
+		}
+
+		pthread_mutex_lock(&I->mutex);
+		for (i=0;i<n;) {
+			/* up to the end of the ring at once */
+			UINT32_T slot = (begsample + i) % I->ringsize;
+			UINT32_T m = (n - i < I->ringsize - slot) ? n - i : I->ringsize - slot;
+			ft_convert_float32(m * I->nchans, I->ring + (size_t) slot * I->nchans, ddef->data_type, src + (size_t) i * wordsize, NULL);
+			i += m;
+		}
+		I->nsamples = datasel.endsample + 1;
+		pthread_mutex_unlock(&I->mutex);
+
+		cleanup_message((void **) &response);
+		begsample = datasel.endsample + 1;
+	}
+	return 0;
+}
+
+void *input_thread(void *arg) {
+	merge_input_t *I = (merge_input_t *) arg;
+	message_t *response;
+	waitdef_t waitdef;
+	samples_events_t counts;
+	int synced = 0, status;
+	UINT32_T reconnects = 0;
+	UINT64_T lastcheck = 0;
+
+	while (keepRunning) {
+		if (!synced) {
+			if (sync_input(I) != 0) {
+				usleep(1000*I->conn->opt.retrydelay);
+				continue;
+			}
+			synced = 1;
+			reconnects = I->conn->reconnects;
+			lastcheck = ft_clock_ns();
+		}
+
+		waitdef.threshold.nsamples = I->nsamples;
+		waitdef.threshold.nevents  = 0xFFFFFFFF;
+		waitdef.milliseconds = WAIT_TIMEOUT;
+		status = request_input(I, WAIT_DAT, &waitdef, sizeof(waitdef), WAIT_OK, &response);
+		if (!keepRunning) break;
+		if (status != 0 || I->conn->reconnects != reconnects) {
+			if (I->conn->sock < 0 || I->conn->reconnects != reconnects) fprintf(stderr, "buffer_merge: lost the connection to %s\n", I->address);
+			if (response) cleanup_message((void **) &response);
+			synced = 0;
+			usleep(1000*I->conn->opt.retrydelay);
+			continue;
+		}
+		memcpy(&counts, response->buf, sizeof(counts));
+		cleanup_message((void **) &response);
+
+		if (counts.nsamples < I->nsamples) {
+			/* the input has been flushed or restarted */
+			synced = 0;
+			continue;
+		}
+		if (counts.nsamples > I->nsamples) {
+			UINT64_T now = ft_clock_ns();
+			if (read_samples(I, counts.nsamples) != 0) {
+				fprintf(stderr, "buffer_merge: cannot read the samples of %s, starting over\n", I->address);
+				synced = 0;
+				continue;
+			}
+			/* the timestamps of the blocks are better than the arrival times, if there are any */
+			if (read_timestamps(I) != 0) {
+				pthread_mutex_lock(&I->mutex);
+				add_arrival(I, counts.nsamples, now);
+				fit_clock(I);
+				pthread_mutex_unlock(&I->mutex);
+			}
+			pthread_mutex_lock(&mergeMutex);
+			pthread_cond_signal(&mergeCond);
+			pthread_mutex_unlock(&mergeMutex);
+		}
+
+		if (ft_clock_ns() - lastcheck >= (UINT64_T) (1.0e9*CHECK_INTERVAL)) {
+			lastcheck = ft_clock_ns();
+			if (request_input(I, GET_HDR, NULL, 0, GET_OK, &response) != 0) continue;
+			if (header_changed(I, response)) synced = 0;
+			cleanup_message((void **) &response);
+		}
+	}
+	return NULL;
+}
+
+/* the fractional sample of the input at the given time, this should be called with the mutex locked */
+double sample_at(const merge_input_t *I, UINT64_T time) {
+	return I->fitsample + ((double) (INT64_T) (time - I->base) - I->fittime) / I->period;
+}
+
+/* the time of a sample of the input, this should be called with the mutex locked */
+UINT64_T time_of(const merge_input_t *I, double sample) {
+	return I->base + (INT64_T) (I->fittime + I->period * (sample - I->fitsample));
+}
+
+/* half the width of the kernel, in samples of the input */
+double kernel_halfwidth(const merge_input_t *I, double fsample) {
+	return (I->fsample > fsample) ? LANCZOS_A * I->fsample / fsample : LANCZOS_A;
+}
+
+/* interpolates the channels of input I at the fractional sample pos into out,
+   returns -1 (and leaves out untouched) if the samples are not in the ring */
+int interpolate(const merge_input_t *I, double pos, double fsample, float *out) {
+	double cutoff = (I->fsample > fsample) ? fsample / I->fsample : 1.0;
+	double hw = LANCZOS_A / cutoff, wsum = 0.0;
+	double acc[1024], *sum = acc;
+	INT64_T first = (INT64_T) floor(pos - hw) + 1, last = (INT64_T) floor(pos + hw), k;
+	UINT32_T c;
+
+	if (first < 0 || last >= I->nsamples || I->nsamples - first > I->ringsize) return -1;
+	if (I->nchans > 1024) {
+		sum = (double *) malloc(I->nchans * sizeof(double));
+		if (sum == NULL) return -1;
+	}
+	for (c=0;c<I->nchans;c++) sum[c] = 0.0;
+
+	for (k=first;k<=last;k++) {
+		/* Lanczos kernel, stretched by 1/cutoff for anti-aliasing */
+		double x = cutoff * (pos - k), w;
+		const float *row = I->ring + (size_t) (k % I->ringsize) * I->nchans;
+		if (fabs(x) < 1e-9) {
+			w = 1.0;
+		} else {
+			w = LANCZOS_A * sin(M_PI*x) * sin(M_PI*x/LANCZOS_A) / (M_PI*M_PI*x*x);
+		}
+		wsum += w;
+		for (c=0;c<I->nchans;c++) sum[c] += w * row[c];
+	}
+	/* normalise the gain, which deviates a little from 1 for fractional positions */
+	for (c=0;c<I->nchans;c++) out[c] = (float) (sum[c] / wsum);
+	if (sum != acc) free(sum);
+	return 0;
+}
+
+/* writes the merged header to the local buffer, with the channel names of all inputs */
+int put_header(double fsample, UINT32_T nchans) {
+	message_t request, *response = NULL;
+	messagedef_t def;
+	headerdef_t *hdef;
+	ft_chunkdef_t *chunk;
+	char *names;
+	UINT32_T size = 0, c;
+	int i, ok;
+
+	for (i=0;i<numInputs;i++) size += inputs[i].nchans * 16;
+	hdef = (headerdef_t *) calloc(1, sizeof(headerdef_t) + sizeof(ft_chunkdef_t) + size);
+	if (hdef == NULL) return -1;
+	chunk = (ft_chunkdef_t *) (hdef+1);
+	names = (char *) (chunk+1);
+
+	size = 0;
+	for (i=0;i<numInputs;i++) {
+		merge_input_t *I = &inputs[i];
+		const ft_chunk_t *cnc = find_chunk(I->hdr+1, 0, I->hdr->bufsize, FT_CHUNK_CHANNEL_NAMES);
+		const char *name = cnc ? (const char *) cnc->data : NULL;
+
+		for (c=0;c<I->nchans;c++) {
+			char generated[16];
+			UINT32_T len;
+			if (name == NULL || name >= (const char *) cnc->data + cnc->def.size) {
+				sprintf(generated, "in%i_%u", i+1, c+1);
+				name = NULL;
+			}
+			len = strlen(name ? name : generated) + 1;
+			if (len > 16) len = 16;
+			memcpy(names + size, name ? name : generated, len-1);
+			names[size + len-1] = 0;
+			size += len;
+			if (name) name += strlen(name) + 1;
+		}
+	}
+
+	hdef->nchans    = nchans;
+	hdef->fsample   = (float) fsample;
+	hdef->data_type = DATATYPE_FLOAT32;
+	hdef->bufsize   = sizeof(ft_chunkdef_t) + size;
+	chunk->type = FT_CHUNK_CHANNEL_NAMES;
+	chunk->size = size;
+
+	def.version = VERSION;
+	def.command = PUT_HDR;
+	def.bufsize = sizeof(headerdef_t) + hdef->bufsize;
+	request.def = &def;
+	request.buf = hdef;
+	ok = (dmarequest(&request, &response) == 0 && response != NULL && response->def->command == PUT_OK);
+	if (response) cleanup_message((void **) &response);
+	free(hdef);
+	return ok ? 0 : -1;
+}
+
+/* writes a merged block to the local buffer, with the time of its first sample */
+int put_block(UINT64_T time, UINT32_T nchans, UINT32_T nsamples, const void *buf) {
+	message_t request, *response = NULL;
+	messagedef_t def;
+	int ok;
+
+	((UINT64_T *) buf)[0] = time;
+	def.version = VERSION;
+	def.command = PUT_DAT_T;
+	def.bufsize = sizeof(UINT64_T) + sizeof(datadef_t) + nsamples * nchans * sizeof(float);
+	request.def = &def;
+	request.buf = (void *) buf;
+	ok = (dmarequest(&request, &response) == 0 && response != NULL && response->def->command == PUT_OK);
+	if (response) cleanup_message((void **) &response);
+	return ok ? 0 : -1;
+}
+
+void report(double fsample, UINT64_T lastTime) {
+	int i;
+
+	for (i=0;i<numInputs;i++) {
+		merge_input_t *I = &inputs[i];
+		double delay, drift;
+
+		pthread_mutex_lock(&I->mutex);
+		/* how far the input is ahead of the merged stream, and how its rate deviates from the header */
+		delay = 1.0e-6 * (double) (INT64_T) (time_of(I, I->nsamples - 1) - lastTime);
+		drift = 1.0e6 * (I->period * I->fsample / 1.0e9 - 1.0);
+		printf("%s: %u samples, %.1f ms ahead of the merged stream, drift %+.1f ppm%s, %u samples missing\n",
+			I->address, I->nsamples, delay, drift, I->timestamps ? " (timestamps)" : "", I->missing);
+		if (fabs(drift) > MAX_DRIFT_PPM) {
+			fprintf(stderr, "buffer_merge: the rate of %s deviates %.0f ppm from its header\n", I->address, drift);
+		}
+		pthread_mutex_unlock(&I->mutex);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	ft_buffer_server_t *S;
+	ft_connopt_t opt;
+	UINT32_T generations[MAX_INPUTS];
+	UINT32_T nchans = 0, outBlock = 1, outSample = 0, j, c;
+	UINT64_T T0 = 0, lastcheck = 0, lastTime = 0;
+	double fsample, period = 0;
+	char *name = NULL, *colon;
+	float *block = NULL;
+	int port, merged = 0, lagging = 0, i, status;
+
+	/* verify that all datatypes have the expected syze in bytes */
+	check_datatypes();
+
+	if (argc<4) {
+		fprintf(stderr, "Usage: buffer_merge <port | unixsocket> <fsample> <host:port | unixsocket> [host:port | unixsocket ...]\n");
+		fprintf(stderr, "With fsample 0, the merged stream has the rate of the first input.\n");
+		return 1;
+	}
+
+	port = atoi(argv[1]);
+	if (port == 0) name = argv[1];
+	fsample = strtod(argv[2], NULL);
+
+	ft_connection_defaults(&opt);
+	opt.recvtimeout = 5000;
+	opt.retrydelay  = 1000;
+	for (i=3;i<argc && numInputs<MAX_INPUTS;i++) {
+		merge_input_t *I = &inputs[numInputs];
+
+		memset(I, 0, sizeof(merge_input_t));
+		strncpy(I->address, argv[i], HOSTNAME_LENGTH-1);
+		I->conn = ft_connection_create(&opt);
+		if (I->conn == NULL) return 1;
+		colon = strrchr(I->address, ':');
+		if (colon != NULL) {
+			*colon = 0;
+			status = ft_connection_tcp(I->conn, I->address, atoi(colon+1));
+			*colon = ':';
+		} else {
+			status = ft_connection_unix(I->conn, I->address);
+		}
+		if (status != 0) {
+			fprintf(stderr, "buffer_merge: cannot connect to %s\n", argv[i]);
+			return 1;
+		}
+		pthread_mutex_init(&I->mutex, NULL);
+		numInputs++;
+	}
+
+	S = ft_start_buffer_server(port, name, merge_request_handler, NULL);
+	if (S==NULL) return 1;
+	signal(SIGINT, abortHandler);
+
+	for (i=0;i<numInputs;i++) {
+		if (pthread_create(&inputs[i].thread, NULL, input_thread, &inputs[i]) != 0) {
+			fprintf(stderr, "buffer_merge: cannot start the thread for %s\n", inputs[i].address);
+			return 1;
+		}
+	}
+
+	while (keepRunning) {
+		UINT64_T tEnd, newest = 0;
+		int waiting = 0, late = 0;
+
+		if (!merged) {
+			/* all inputs need a header and at least one block of samples */
+			for (i=0;i<numInputs;i++) {
+				pthread_mutex_lock(&inputs[i].mutex);
+				if (inputs[i].generation == 0 || inputs[i].numanchors == 0) waiting = 1;
+				pthread_mutex_unlock(&inputs[i].mutex);
+			}
+			if (!waiting) {
+				if (argv[2][0] == '0' || fsample <= 0) fsample = inputs[0].fsample;
+				period = 1.0e9 / fsample;
+				outBlock = (UINT32_T) ceil(OUT_BLOCK * fsample);
+				nchans = 0;
+				/* the merged stream starts at the newest sample that all inputs have */
+				for (i=0;i<numInputs;i++) {
+					merge_input_t *I = &inputs[i];
+					pthread_mutex_lock(&I->mutex);
+					generations[i] = I->generation;
+					nchans += I->nchans;
+					tEnd = time_of(I, I->nsamples - 1 - kernel_halfwidth(I, fsample));
+					if (i == 0 || (INT64_T) (tEnd - T0) < 0) T0 = tEnd;
+					I->missing = 0;
+					pthread_mutex_unlock(&I->mutex);
+				}
+				FREE(block);
+				block = (float *) malloc(sizeof(UINT64_T) + sizeof(datadef_t) + (size_t) outBlock * nchans * sizeof(float));
+				if (block == NULL || put_header(fsample, nchans) != 0) {
+					fprintf(stderr, "buffer_merge: cannot write the merged header\n");
+					break;
+				}
+				printf("Merging %i inputs into %u channels at %g Hz\n", numInputs, nchans, fsample);
+				merged = 1;
+				outSample = 0;
+				lastcheck = ft_clock_ns();
+			}
+		}
+		if (merged) {
+			for (i=0;i<numInputs;i++) {
+				pthread_mutex_lock(&inputs[i].mutex);
+				if (inputs[i].generation != generations[i]) merged = 0;
+				pthread_mutex_unlock(&inputs[i].mutex);
+			}
+			if (!merged) printf("The header of an input has changed, starting over\n");
+		}
+		if (!merged) {
+			usleep(100000);
+			continue;
+		}
+
+		/* the block is ready once every input has the samples up to its last sample, plus the kernel */
+		tEnd = T0 + (UINT64_T) ((outSample + outBlock - 1) * period);
+		for (i=0;i<numInputs;i++) {
+			merge_input_t *I = &inputs[i];
+			UINT64_T t;
+			pthread_mutex_lock(&I->mutex);
+			t = time_of(I, I->nsamples - 1 - kernel_halfwidth(I, fsample));
+			if ((INT64_T) (t - tEnd) < 0) waiting = 1;
+			if (i == 0 || (INT64_T) (t - newest) > 0) newest = t;
+			pthread_mutex_unlock(&I->mutex);
+		}
+		/* do not wait for an input that lags too far behind the others */
+		if (waiting && (INT64_T) (newest - tEnd) > MAX_LATENCY) {
+			waiting = 0;
+			late = 1;
+		}
+		if (waiting) {
+			struct timespec ts;
+			struct timeval tv;
+			gettimeofday(&tv, NULL);
+			ts.tv_sec  = tv.tv_sec + (tv.tv_usec + 10000) / 1000000;
+			ts.tv_nsec = ((tv.tv_usec + 10000) % 1000000) * 1000;
+			pthread_mutex_lock(&mergeMutex);
+			pthread_cond_timedwait(&mergeCond, &mergeMutex, &ts);
+			pthread_mutex_unlock(&mergeMutex);
+		} else {
+			datadef_t *ddef = (datadef_t *) ((char *) block + sizeof(UINT64_T));
+			float *out = (float *) (ddef+1);
+			UINT32_T offset = 0;
+
+			for (i=0;i<numInputs;i++) {
+				merge_input_t *I = &inputs[i];
+				pthread_mutex_lock(&I->mutex);
+				for (j=0;j<outBlock;j++) {
+					UINT64_T t = T0 + (UINT64_T) ((outSample + j) * period);
+					float *row = out + (size_t) j * nchans + offset;
+					if (interpolate(I, sample_at(I, t), fsample, row) != 0) {
+						for (c=0;c<I->nchans;c++) row[c] = (float) NAN;
+						I->missing++;
+					}
+				}
+				offset += I->nchans;
+				pthread_mutex_unlock(&I->mutex);
+			}
+			if (late && !lagging) fprintf(stderr, "buffer_merge: an input lags more than %d ms behind, its channels are NaN\n", MAX_LATENCY/1000000);
+			lagging = late;
+
+			ddef->nchans    = nchans;
+			ddef->nsamples  = outBlock;
+			ddef->data_type = DATATYPE_FLOAT32;
+			ddef->bufsize   = outBlock * nchans * sizeof(float);
+			lastTime = T0 + (UINT64_T) (outSample * period);
+			if (put_block(lastTime, nchans, outBlock, block) != 0) {
+				fprintf(stderr, "buffer_merge: cannot write to the merged buffer\n");
+			}
+			outSample += outBlock;
+		}
+
+		if (ft_clock_ns() - lastcheck >= (UINT64_T) (1.0e9*CHECK_INTERVAL)) {
+			lastcheck = ft_clock_ns();
+			printf("Merged %u samples\n", outSample);
+			report(fsample, lastTime);
+		}
+	}
+
+	printf("Ctrl-C pressed -- stopping buffer merge...\n");
+	keepRunning = 0;
+	for (i=0;i<numInputs;i++) {
+		pthread_join(inputs[i].thread, NULL);
+		ft_connection_destroy(inputs[i].conn);
+		FREE(inputs[i].hdr);
+		FREE(inputs[i].ring);
+	}
+	ft_stop_buffer_server(S);
+	FREE(block);
+	printf("Done.\n");
+	return 0;
+}
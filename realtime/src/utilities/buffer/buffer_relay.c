@@ -0,0 +1,370 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ * Relay that replicates a primary buffer into a local buffer, so that slow
+ * or remote readers can connect to the relay instead of to the acquisition
+ * host. The relay subscribes to the primary with WAIT_DAT and copies the
+ * header, data and events with GET_HDR, GET_DAT and GET_EVT. The sample and
+ * event numbers of the primary are preserved, so relays can be cascaded.
+ *
+ * Clients of the relay can only read, all PUT and FLUSH requests are refused.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include "buffer.h"
+#include "socketserver.h"
+
+#define WAIT_TIMEOUT    500      /* milliseconds per WAIT_DAT request to the primary */
+#define CHECK_INTERVAL  1.0      /* seconds between header checks and lag reports */
+#define BLOCK_BYTES     1048576  /* maximum size of the data copied in one request */
+#define BLOCK_EVENTS    1000     /* maximum number of events copied in one request */
+
+volatile int keepRunning = 1;
+
+ft_connection_t *primary = NULL;
+UINT32_T nextsample = 0;         /* number of samples in the local buffer, i.e. the next one to copy */
+UINT32_T nextevent  = 0;
+UINT32_T blocksize  = 1;         /* number of samples copied in one request */
+headerdef_t *hdrcopy = NULL;     /* header of the primary with the counts set to 0, to detect changes */
+
+void abortHandler(int sig) {
+	keepRunning = 0;
+}
+
+double now(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+/* the relay is the only one that writes to the local buffer */
+int relay_request_handler(const message_t *request, message_t **response, void *user_data) {
+	UINT16_T command = 0;
+
+	switch (request->def->command) {
+		case PUT_HDR:
+		case PUT_DAT:
+		case PUT_EVT:
+		case PUT_BATCH:
+			command = PUT_ERR;
+			break;
+		case FLUSH_HDR:
+		case FLUSH_DAT:
+		case FLUSH_EVT:
+			command = FLUSH_ERR;
+			break;
+	}
+	if (command == 0)
+		return dmarequest(request, response);
+
+	*response = (message_t *) malloc(sizeof(message_t));
+	if (*response == NULL) return -1;
+	(*response)->def = (messagedef_t *) malloc(sizeof(messagedef_t));
+	if ((*response)->def == NULL) {
+		FREE(*response);
+		return -1;
+	}
+	(*response)->def->version = VERSION;
+	(*response)->def->command = command;
+	(*response)->def->bufsize = 0;
+	(*response)->buf = NULL;
+	return 0;
+}
+
+/* sends a request to the primary, returns 0 if the response has the expected command
+   and -1 otherwise, in which case there is no response to clean up */
+int request_primary(UINT16_T command, void *buf, UINT32_T bufsize, UINT16_T expected, message_t **response) {
+	message_t request;
+	messagedef_t def;
+
+	def.version = VERSION;
+	def.command = command;
+	def.bufsize = bufsize;
+	request.def = &def;
+	request.buf = buf;
+
+	*response = NULL;
+	if (ft_connection_request(primary, &request, response) != 0 || *response == NULL)
+		return -1;
+	if ((*response)->def->command != expected) {
+		cleanup_message((void **) response);
+		return -1;
+	}
+	return 0;
+}
+
+/* passes a response of the primary on to the local buffer as the given PUT request */
+int put_local(message_t *message, UINT16_T command) {
+	message_t *response = NULL;
+	int ok;
+
+	message->def->command = command;
+	ok = (dmarequest(message, &response) == 0 && response != NULL && response->def->command == PUT_OK);
+	if (response) cleanup_message((void **) &response);
+	return ok ? 0 : -1;
+}
+
+/* returns 1 if the header of the primary differs from the copy, apart from the counts */
+int header_changed(const message_t *hdr) {
+	const headerdef_t *hdef = (const headerdef_t *) hdr->buf;
+
+	if (hdrcopy == NULL || hdr->def->bufsize != sizeof(headerdef_t) + hdrcopy->bufsize)
+		return 1;
+	if (hdef->nchans != hdrcopy->nchans || hdef->fsample != hdrcopy->fsample || hdef->data_type != hdrcopy->data_type)
+		return 1;
+	return memcmp(hdef+1, hdrcopy+1, hdrcopy->bufsize) != 0;
+}
+
+/* returns 1 if the primary still has the given sample and event */
+int primary_has(UINT32_T sample, UINT32_T nsamples, UINT32_T evt, UINT32_T nevents) {
+	message_t *response;
+	datasel_t datasel;
+	eventsel_t evtsel;
+
+	if (sample < nsamples) {
+		datasel.begsample = datasel.endsample = sample;
+		if (request_primary(GET_DAT, &datasel, sizeof(datasel), GET_OK, &response) != 0) return 0;
+		cleanup_message((void **) &response);
+	}
+	if (evt < nevents) {
+		evtsel.begevent = evtsel.endevent = evt;
+		if (request_primary(GET_EVT, &evtsel, sizeof(evtsel), GET_OK, &response) != 0) return 0;
+		cleanup_message((void **) &response);
+	}
+	return 1;
+}
+
+/* Copies the header of the primary to the local buffer, and lets the local
+   ring start at the oldest sample and event of the primary that fit in it.
+   Returns 0 on success and -1 if the primary has no header (yet).
+ */
+int sync_header(void) {
+	message_t *hdr = NULL, *capmsg = NULL, request, *response = NULL;
+	messagedef_t def;
+	buffercap_t primcap, localcap;
+	headerdef_t *hdef;
+	UINT32_T nsamples, nevents, keepsamples, keepevents, wordsize;
+
+	if (request_primary(GET_HDR, NULL, 0, GET_OK, &hdr) != 0)
+		return -1;
+	hdef = (headerdef_t *) hdr->buf;
+	nsamples = hdef->nsamples;
+	nevents  = hdef->nevents;
+
+	FREE(hdrcopy);
+	hdrcopy = (headerdef_t *) malloc(hdr->def->bufsize);
+	if (hdrcopy == NULL) {
+		cleanup_message((void **) &hdr);
+		return -1;
+	}
+	memcpy(hdrcopy, hdr->buf, hdr->def->bufsize);
+	hdrcopy->nsamples = hdrcopy->nevents = 0;
+
+	/* older servers do not know GET_CAP, then only new samples and events are copied */
+	if (request_primary(GET_CAP, NULL, 0, GET_OK, &capmsg) == 0 && capmsg->def->bufsize >= sizeof(buffercap_t)) {
+		memcpy(&primcap, capmsg->buf, sizeof(buffercap_t));
+	} else {
+		primcap.nsamples = primcap.nevents = 0;
+	}
+	if (capmsg) cleanup_message((void **) &capmsg);
+
+	if (put_local(hdr, PUT_HDR) != 0) {
+		fprintf(stderr, "buffer_relay: cannot write the header to the local buffer\n");
+		cleanup_message((void **) &hdr);
+		return -1;
+	}
+	cleanup_message((void **) &hdr);
+
+	def.version = VERSION;
+	def.command = GET_CAP;
+	def.bufsize = 0;
+	request.def = &def;
+	request.buf = NULL;
+	if (dmarequest(&request, &response) != 0 || response == NULL || response->def->bufsize < sizeof(buffercap_t)) {
+		if (response) cleanup_message((void **) &response);
+		return -1;
+	}
+	memcpy(&localcap, response->buf, sizeof(buffercap_t));
+	cleanup_message((void **) &response);
+
+	keepsamples = (primcap.nsamples < localcap.nsamples) ? primcap.nsamples : localcap.nsamples;
+	keepevents  = (primcap.nevents  < localcap.nevents)  ? primcap.nevents  : localcap.nevents;
+	nextsample  = (nsamples > keepsamples) ? nsamples - keepsamples : 0;
+	nextevent   = (nevents  > keepevents)  ? nevents  - keepevents  : 0;
+	/* the oldest samples may already be gone on the primary, e.g. after its ring was resized */
+	if (!primary_has(nextsample, nsamples, nextevent, nevents)) {
+		nextsample = nsamples;
+		nextevent  = nevents;
+	}
+	if (set_buffer_origin(nextsample, nextevent) != 0) {
+		fprintf(stderr, "buffer_relay: cannot set the first sample of the local buffer\n");
+		return -1;
+	}
+
+	wordsize  = wordsize_from_type(hdrcopy->data_type) * hdrcopy->nchans;
+	blocksize = (wordsize > 0) ? BLOCK_BYTES / wordsize : 1;
+	if (blocksize == 0) blocksize = 1;
+	if (blocksize > localcap.nsamples) blocksize = localcap.nsamples;
+
+	printf("Header of %u channels at %g Hz, starting at sample %u and event %u\n", hdrcopy->nchans, hdrcopy->fsample, nextsample, nextevent);
+	return 0;
+}
+
+/* copies the samples and events up to the given counts, returns -1 if they are no longer available */
+int copy_until(UINT32_T nsamples, UINT32_T nevents) {
+	message_t *response;
+	datasel_t datasel;
+	eventsel_t evtsel;
+
+	/* the samples go first, so the events refer to samples that can be read */
+	while (nextsample < nsamples) {
+		datasel.begsample = nextsample;
+		datasel.endsample = (nsamples - nextsample > blocksize) ? nextsample + blocksize - 1 : nsamples - 1;
+		if (request_primary(GET_DAT, &datasel, sizeof(datasel), GET_OK, &response) != 0)
+			return -1;
+		/* the response of GET_DAT is a valid PUT_DAT request */
+		if (put_local(response, PUT_DAT) != 0) {
+			cleanup_message((void **) &response);
+			return -1;
+		}
+		cleanup_message((void **) &response);
+		nextsample = datasel.endsample + 1;
+	}
+
+	while (nextevent < nevents) {
+		evtsel.begevent = nextevent;
+		evtsel.endevent = (nevents - nextevent > BLOCK_EVENTS) ? nextevent + BLOCK_EVENTS - 1 : nevents - 1;
+		if (request_primary(GET_EVT, &evtsel, sizeof(evtsel), GET_OK, &response) != 0)
+			return -1;
+		if (put_local(response, PUT_EVT) != 0) {
+			cleanup_message((void **) &response);
+			return -1;
+		}
+		cleanup_message((void **) &response);
+		nextevent = evtsel.endevent + 1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	ft_buffer_server_t *S;
+	ft_connopt_t opt;
+	message_t *response;
+	waitdef_t waitdef;
+	samples_events_t counts;
+	char hostname[HOSTNAME_LENGTH], *colon;
+	char *name = NULL;
+	int port = DEFAULT_PORT, synced = 0, status;
+	UINT32_T reconnects = 0;
+	double lastcheck = 0.0;
+
+	/* verify that all datatypes have the expected syze in bytes */
+	check_datatypes();
+
+	if (argc<2) {
+		fprintf(stderr, "Usage: buffer_relay <host:port | unixsocket> [port | unixsocket [nsamples [nevents]]]\n");
+		return 1;
+	}
+
+	ft_connection_defaults(&opt);
+	opt.recvtimeout = 5000;
+	opt.retrydelay  = 1000;
+	primary = ft_connection_create(&opt);
+	if (primary == NULL) return 1;
+
+	strncpy(hostname, argv[1], HOSTNAME_LENGTH-1);
+	hostname[HOSTNAME_LENGTH-1] = 0;
+	colon = strrchr(hostname, ':');
+	if (colon != NULL) {
+		*colon = 0;
+		status = ft_connection_tcp(primary, hostname, atoi(colon+1));
+	} else {
+		status = ft_connection_unix(primary, hostname);
+	}
+	if (status != 0) {
+		fprintf(stderr, "buffer_relay: cannot connect to the primary buffer at %s\n", argv[1]);
+		ft_connection_destroy(primary);
+		return 1;
+	}
+
+	if (argc>2) {
+		port = atoi(argv[2]);
+		if (port == 0) name = argv[2];
+	}
+	if (argc>3) {
+		set_buffer_capacity(atoi(argv[3]), 0, (argc>4) ? atoi(argv[4]) : 0);
+	}
+
+	S = ft_start_buffer_server(port, name, relay_request_handler, NULL);
+	if (S==NULL) {
+		ft_connection_destroy(primary);
+		return 1;
+	}
+	signal(SIGINT, abortHandler);
+	if (name) printf("Relaying %s on %s\n", argv[1], name);
+	else printf("Relaying %s on port %d\n", argv[1], port);
+
+	while (keepRunning) {
+		if (!synced) {
+			if (sync_header() != 0) {
+				usleep(1000*opt.retrydelay);
+				continue;
+			}
+			synced = 1;
+			reconnects = primary->reconnects;
+			lastcheck = now();
+		}
+
+		/* wait for anything beyond what has been copied so far */
+		waitdef.threshold.nsamples = nextsample;
+		waitdef.threshold.nevents  = nextevent;
+		waitdef.milliseconds = WAIT_TIMEOUT;
+		status = request_primary(WAIT_DAT, &waitdef, sizeof(waitdef), WAIT_OK, &response);
+		if (!keepRunning) break;
+		if (status != 0 || primary->reconnects != reconnects) {
+			/* the primary lost its header, or it may have been restarted */
+			if (primary->sock < 0 || primary->reconnects != reconnects) fprintf(stderr, "buffer_relay: lost the connection to the primary\n");
+			if (response) cleanup_message((void **) &response);
+			synced = 0;
+			usleep(1000*opt.retrydelay);
+			continue;
+		}
+		memcpy(&counts, response->buf, sizeof(counts));
+		cleanup_message((void **) &response);
+
+		if (counts.nsamples < nextsample || counts.nevents < nextevent) {
+			/* the primary has been flushed or restarted */
+			synced = 0;
+			continue;
+		}
+		if (copy_until(counts.nsamples, counts.nevents) != 0) {
+			fprintf(stderr, "buffer_relay: fell behind the primary, starting over\n");
+			synced = 0;
+			continue;
+		}
+
+		if (now() - lastcheck >= CHECK_INTERVAL) {
+			lastcheck = now();
+			if (request_primary(GET_HDR, NULL, 0, GET_OK, &response) != 0) continue;
+			if (header_changed(response)) {
+				synced = 0;
+			} else {
+				const headerdef_t *hdef = (const headerdef_t *) response->buf;
+				UINT32_T lag = (hdef->nsamples > nextsample) ? hdef->nsamples - nextsample : 0;
+				printf("Replicated %u samples and %u events, lag %u samples (%.1f ms)\n", nextsample, nextevent, lag, (hdef->fsample > 0) ? 1000.0*lag/hdef->fsample : 0.0);
+			}
+			cleanup_message((void **) &response);
+		}
+	}
+
+	printf("Ctrl-C pressed -- stopping buffer relay...\n");
+	ft_stop_buffer_server(S);
+	ft_connection_destroy(primary);
+	FREE(hdrcopy);
+	printf("Done.\n");
+	return 0;
+}
@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ * Prints the latency of the stages that the blocks of samples go through,
+ * from the trace files that the acquisition driver, the buffer server and
+ * the clients write when FT_TRACE is set (see fttrace.h). Run for example
+ *
+ *   FT_TRACE=/tmp/trace_%p.json buffer
+ *   FT_TRACE=/tmp/trace_%p.json <acquisition driver>
+ *   FT_TRACE=/tmp/trace_%p.json <client>
+ *   buffer_trace /tmp/trace_*.json
+ *
+ * The files are also valid input for chrome://tracing or Perfetto.
+ *
+ * The blocks are identified by their marker, the first multiple of
+ * FT_TRACE_EVERY among their samples. A record of a range of samples counts
+ * for every marker in the range, e.g. a WAIT_DAT that returns several blocks
+ * at once. For every marker, the earliest time of each stage is taken, and
+ * the latency of a stage is the time since the previous stage that was
+ * traced for that marker ("step"), and since the first one ("total"). The
+ * traces should cover a single header, since the samples are counted from 0
+ * again after every PUT_HDR.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "buffer.h"
+
+#define MAX_LINE 1024
+
+typedef struct {
+	UINT32_T marker;
+	int stage;
+	double time;             /* in microseconds */
+} record_t;
+
+static record_t *records = NULL;
+static size_t numRecords = 0, allocRecords = 0;
+
+static int add_record(UINT32_T marker, int stage, double time) {
+	if (numRecords == allocRecords) {
+		size_t n = allocRecords ? 2*allocRecords : 65536;
+		record_t *r = (record_t *) realloc(records, n * sizeof(record_t));
+		if (r == NULL) return -1;
+		records = r;
+		allocRecords = n;
+	}
+	records[numRecords].marker = marker;
+	records[numRecords].stage  = stage;
+	records[numRecords].time   = time;
+	numRecords++;
+	return 0;
+}
+
+/* returns the number that follows the key, or -1 if the key is not in the line */
+static double get_number(const char *line, const char *key) {
+	const char *p = strstr(line, key);
+	if (p == NULL) return -1;
+	return atof(p + strlen(key));
+}
+
+static int get_stage(const char *line) {
+	const char *p = strstr(line, "\"name\":\"");
+	int i;
+	if (p == NULL) return -1;
+	p += 8;
+	for (i=0;i<FT_TRACE_NUMSTAGES;i++) {
+		const char *name = ft_trace_stage_name(i);
+		size_t n = strlen(name);
+		if (strncmp(p, name, n) == 0 && p[n] == '"') return i;
+	}
+	return -1;
+}
+
+/* reads the instant events of one trace file, returns the number of records or -1 */
+static long read_trace(const char *filename) {
+	char line[MAX_LINE];
+	long num = 0;
+	FILE *f = fopen(filename, "r");
+
+	if (f == NULL) {
+		fprintf(stderr, "buffer_trace: cannot open %s\n", filename);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		double ts, beg, end, every;
+		UINT32_T marker;
+		int stage;
+
+		if (strstr(line, "\"ph\":\"i\"") == NULL) continue;
+		stage = get_stage(line);
+		ts    = get_number(line, "\"ts\":");
+		beg   = get_number(line, "\"begsample\":");
+		end   = get_number(line, "\"endsample\":");
+		every = get_number(line, "\"every\":");
+		if (stage < 0 || ts < 0 || beg < 0 || end <= beg || every < 1) continue;
+
+		/* the first marker in the range, and the others that follow it */
+		marker = (UINT32_T) (((UINT32_T) beg + (UINT32_T) every - 1) / (UINT32_T) every) * (UINT32_T) every;
+		for (; marker < (UINT32_T) end && marker >= (UINT32_T) beg; marker += (UINT32_T) every) {
+			if (add_record(marker, stage, ts) != 0) {
+				fprintf(stderr, "buffer_trace: out of memory\n");
+				fclose(f);
+				return -1;
+			}
+		}
+		num++;
+	}
+	fclose(f);
+	return num;
+}
+
+static int compare_records(const void *a, const void *b) {
+	const record_t *ra = (const record_t *) a;
+	const record_t *rb = (const record_t *) b;
+	if (ra->marker != rb->marker) return ra->marker < rb->marker ? -1 : 1;
+	if (ra->stage != rb->stage) return ra->stage < rb->stage ? -1 : 1;
+	if (ra->time != rb->time) return ra->time < rb->time ? -1 : 1;
+	return 0;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+	double da = *(const double *) a, db = *(const double *) b;
+	return (da < db) ? -1 : (da > db) ? 1 : 0;
+}
+
+typedef struct {
+	double *values;
+	size_t num;
+} series_t;
+
+static void add_value(series_t *S, double value, size_t maxnum) {
+	if (S->values == NULL) S->values = (double *) malloc(maxnum * sizeof(double));
+	if (S->values != NULL) S->values[S->num++] = value;
+}
+
+static double percentile(const series_t *S, double p) {
+	return S->values[(size_t) (p * (S->num - 1) + 0.5)];
+}
+
+static void print_series(const char *title, series_t *series) {
+	int i;
+
+	printf("\n%s (microseconds)\n", title);
+	printf("%-8s %8s %10s %10s %10s %10s %10s\n", "stage", "count", "min", "p50", "p90", "p99", "max");
+	for (i=0;i<FT_TRACE_NUMSTAGES;i++) {
+		series_t *S = &series[i];
+		if (S->num == 0) {
+			printf("%-8s %8u\n", ft_trace_stage_name(i), 0);
+			continue;
+		}
+		qsort(S->values, S->num, sizeof(double), compare_doubles);
+		printf("%-8s %8lu %10.1f %10.1f %10.1f %10.1f %10.1f\n", ft_trace_stage_name(i), (unsigned long) S->num,
+				S->values[0], percentile(S, 0.5), percentile(S, 0.9), percentile(S, 0.99), S->values[S->num-1]);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	series_t step[FT_TRACE_NUMSTAGES], total[FT_TRACE_NUMSTAGES];
+	size_t i, j, numMarkers = 0;
+	int k;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: buffer_trace <trace file> [<trace file> ...]\n");
+		return 1;
+	}
+	for (k=1;k<argc;k++) {
+		long n = read_trace(argv[k]);
+		if (n < 0) return 1;
+		printf("%s: %ld records\n", argv[k], n);
+	}
+	if (numRecords == 0) {
+		fprintf(stderr, "buffer_trace: no trace points found\n");
+		return 1;
+	}
+	qsort(records, numRecords, sizeof(record_t), compare_records);
+
+	memset(step, 0, sizeof(step));
+	memset(total, 0, sizeof(total));
+	for (i=0;i<numRecords;i=j) {
+		double first = -1, prev = -1;
+
+		/* the records of one marker, sorted by stage and time */
+		for (j=i;j<numRecords && records[j].marker == records[i].marker;j++) {
+			double t;
+			/* only the earliest time of each stage */
+			if (j > i && records[j].stage == records[j-1].stage) continue;
+			t = records[j].time;
+			if (first < 0) {
+				first = t;
+			} else {
+				add_value(&step[records[j].stage], t - prev, numRecords);
+				add_value(&total[records[j].stage], t - first, numRecords);
+			}
+			prev = t;
+		}
+		numMarkers++;
+	}
+
+	printf("%lu blocks\n", (unsigned long) numMarkers);
+	print_series("Latency since the previous stage", step);
+	print_series("Latency since the first stage", total);
+
+	for (k=0;k<FT_TRACE_NUMSTAGES;k++) {
+		free(step[k].values);
+		free(total[k].values);
+	}
+	free(records);
+	return 0;
+}
@@ -68,6 +68,15 @@ int my_request_handler(const message_t *request, message_t **response, void *use
 		case FLUSH_EVT:
 			printf("Flush events ... ");
 			break;
+		case GET_SHM:
+			printf("Get shared memory ... ");
+			break;
+		case GET_CAP:
+			printf("Get capacity ... ");
+			break;
+		case GET_STATS:
+			printf("Get statistics ... ");
+			break;
 		case WAIT_DAT:
 			if (request->def->bufsize >= sizeof(waitdef_t)) {
 				const waitdef_t *wd = (const waitdef_t *) request->buf;
@@ -116,6 +125,7 @@ void abortHandler(int sig) {
 int main(int argc, char *argv[]) {
 	int port;
 	char *name = NULL;
+	char shmname[32];
 	
     /* verify that all datatypes have the expected syze in bytes */
     check_datatypes();
@@ -129,6 +139,14 @@ int main(int argc, char *argv[]) {
 		port = 1972;
 	}
 	
+	/* clients on the UNIX domain socket can read the data directly from shared memory */
+	if (name != NULL) {
+		sprintf(shmname, "/ftbuffer.%d", (int) getpid());
+		if (enable_shared_memory(shmname) != 0) {
+			fprintf(stderr, "Could not enable shared memory, clients will have to use the socket\n");
+		}
+	}
+
 	/* with enabled debug output */
 	S = ft_start_buffer_server(port, name, my_request_handler, NULL);
 	/* plain server without extra output */
@@ -142,6 +160,7 @@ int main(int argc, char *argv[]) {
 	}
 	printf("Ctrl-C pressed -- stopping buffer server...\n");
 	ft_stop_buffer_server(S);
+	if (name != NULL) disable_shared_memory();
 	printf("Done.\n");
 	return 0;
 }
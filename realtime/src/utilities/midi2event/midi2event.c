@@ -0,0 +1,621 @@
+/* Convert incoming MIDI messages to events in a remote FieldTrip buffer.
+ * Errors when writing to the buffer will be printed, but otherwise ignored.
+ * Please look at midi2event.conf for an example of how to set up the tool,
+ * e.g., which MIDI device to listen on, and how to write events.
+ *
+ * The messages are read by the PortTime callback, which runs every
+ * millisecond in a thread of its own. It notes the time at which every
+ * message came in, using the PortMidi timestamp, and puts the messages in a
+ * queue. The main thread sends all messages that have come in since its last
+ * request as events in a single PUT_EVT. Since this runs independently of
+ * MATLAB, the timing does not depend on how often MATLAB polls the device,
+ * as it does for midiIn.
+ *
+ * The type of the event is the kind of message (e.g. "note_on"), the value is
+ * an int32 vector with the channel, the first and the second data byte, like
+ * the columns that midiIn returns. With sample=time, the sample of an event
+ * is found by mapping the time of the message with GET_TIME, i.e. with the
+ * timestamps of the blocks that were written with PUT_DAT_T.
+ *
+ * Copyright (C) 2017, Robert Oostenveld
+ */
+#include <portmidi.h>
+#include <porttime.h>
+#include <buffer.h>
+#include <socketserver.h>
+#include <ftclock.h>
+#include <signal.h>
+#include <pthread.h>
+#if defined(PLATFORM_LINUX) || defined(PLATFORM_OSX)
+#include <sys/time.h>
+#endif
+
+#define MAXLINE 256
+#define MAXREAD 64         /* messages per Pm_Read */
+#define QUEUESIZE 4096     /* messages that can wait for the main thread */
+#define MAXBATCH 256       /* events per PUT_EVT request */
+#define MAXTYPE 16         /* characters in the type of an event */
+
+/* the status byte has the command in the highest 4 bits and the channel in the lowest 4 bits */
+#define MIDI_CODE_MASK          0xf0
+#define MIDI_CHN_MASK           0x0f
+
+typedef struct {
+	int code;
+	const char *name;
+} MidiCommand;
+
+/* the channel messages, see also midiIn.c */
+const MidiCommand commands[] = {
+	{0x80, "note_off"},
+	{0x90, "note_on"},
+	{0xa0, "poly_touch"},
+	{0xb0, "control"},
+	{0xc0, "program"},
+	{0xd0, "touch"},
+	{0xe0, "bend"}
+};
+#define NUMCOMMANDS (sizeof(commands)/sizeof(commands[0]))
+
+typedef struct {
+	char hostname[256];
+	int port;
+
+	int device;                 /* index of the PortMidi device, starting at 1, or 0 to look for the name */
+	char device_name[MAXLINE];  /* part of the name of the device */
+	int command[NUMCOMMANDS];   /* non-zero for the commands that are converted to events */
+
+	int set_type;               /* non-zero: the type is the name of the command */
+	char type_buf[MAXTYPE];
+	UINT32_T type_numel;
+
+	int sample_time;            /* non-zero: the sample is taken from the time at which the message came in */
+	INT32_T sample_start;
+	INT32_T sample_increase;
+	INT32_T offset, duration;
+} MidiEventConfig;
+
+typedef struct {
+	UINT64_T time;     /* ft_clock_ns when the message came in */
+	PmMessage message;
+} MidiInput;
+
+int keepRunning = 1;
+MidiEventConfig conf;
+PortMidiStream *inStream = NULL;
+UINT64_T timeOffset = 0; /* ft_clock_ns minus the PortTime clock */
+INT32_T sample;
+
+/* messages that have been read, but not sent yet */
+MidiInput queue[QUEUESIZE];
+unsigned int queueHead = 0, queueTail = 0, queueDropped = 0;
+int readerFailed = 0;
+pthread_mutex_t queueMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t queueCond = PTHREAD_COND_INITIALIZER;
+
+
+/* returns the index in commands of the command in the status byte, or -1 */
+int findCommand(int status) {
+	unsigned int i;
+	for (i=0;i<NUMCOMMANDS;i++) {
+		if (commands[i].code == (status & MIDI_CODE_MASK)) return i;
+	}
+	return -1;
+}
+
+/* The following function is used for turning a configuration file (see midi2event.conf)
+   into a MidiEventConfig struct as defined above.
+   Returns
+	 0 if ok,
+	-1 if C==NULL,
+	-2 if file can't be opened,
+	positive number = #errors
+*/
+int parseConfig(MidiEventConfig *C, const char *filename) {
+	FILE *f;
+	char line[MAXLINE];
+	int numErrs = 0;
+	int lineNr = 0;
+	unsigned int i;
+
+	if (C==NULL) return -1;
+
+	/* set defaults */
+	strcpy(C->hostname, "localhost");
+	C->port = 1972;
+	C->device = 1;
+	C->device_name[0] = 0;
+	for (i=0;i<NUMCOMMANDS;i++) C->command[i] = 1;
+	C->set_type = 1;
+	C->type_numel = 0;
+	C->sample_time = 0;
+	C->sample_start = 0;
+	C->sample_increase = 1;
+	C->offset = C->duration = 0;
+
+	f = fopen(filename, "r");
+	if (f==NULL) {
+		printf("Configuration file %s could not be opened\n", filename);
+		return -2;
+	}
+
+	while (!feof(f)) {
+		int len;
+		char *value;
+
+		if (fgets(line, MAXLINE, f) == NULL) break;
+
+		++lineNr;
+
+		/* silently ignore comments */
+		if (line[0]=='#') continue;
+
+		len = strlen(line);
+		/* strip trailing newline, carriage return */
+		while (len>0) {
+			int c = line[len-1];
+			if (c=='\r' || c=='\n') {
+				--len;
+			} else {
+				break;
+			}
+		}
+		line[len]=0;
+
+		/* silently ignore empty lines */
+		if (len==0) continue;
+
+		value = strchr(line,'=');
+		if (value == NULL) {
+			++numErrs;
+			printf("Ignoring faulty line %i\n", lineNr);
+			continue;
+		}
+		*value++ = 0;
+		if (!strcmp(line, "buffer")) {
+			char *pc;
+			long lv = 0;
+
+			pc = strchr(value, ':');
+			if (pc != NULL) {
+				lv = strtol(pc+1, NULL, 10);
+			}
+			if (lv<=0 || pc == value) {
+				printf("Ignoring faulty buffer target defintion at line %i\n", lineNr);
+				++numErrs;
+			} else {
+				*pc = '\0'; /* replace ':' by terminator */
+				strcpy(C->hostname, value);
+				C->port = lv;
+			}
+		} else if (!strcmp(line, "device")) {
+			char *p1, *p2;
+			long lv;
+
+			p1 = strchr(value, '"');
+			if (p1!=NULL) {
+				p1++;
+				p2 = strchr(p1, '"');
+				if (p2==NULL) {
+					++numErrs;
+					printf("Unterminated string in device field, line %i\n", lineNr);
+				} else {
+					*p2 = 0;
+					strcpy(C->device_name, p1);
+					C->device = 0;
+				}
+				continue;
+			}
+			lv = strtol(value, &p2, 10);
+			if (p2==value || lv<1) {
+				++numErrs;
+				printf("Ignoring faulty device index in line %i\n", lineNr);
+				continue;
+			}
+			C->device = lv;
+		} else if (!strcmp(line, "command")) {
+			/* comma separated list of the commands that are converted */
+			char *tok;
+			for (i=0;i<NUMCOMMANDS;i++) C->command[i] = 0;
+			for (tok = strtok(value, ", "); tok != NULL; tok = strtok(NULL, ", ")) {
+				for (i=0;i<NUMCOMMANDS;i++) {
+					if (!strcmp(tok, commands[i].name)) break;
+				}
+				if (i==NUMCOMMANDS) {
+					++numErrs;
+					printf("Ignoring unknown MIDI command '%s' in line %i\n", tok, lineNr);
+				} else {
+					C->command[i] = 1;
+				}
+			}
+		} else if (!strcmp(line, "type")) {
+			char *p1,*p2;
+			if (*value == '@') {
+				C->set_type = 1;
+				continue;
+			}
+			p1 = strchr(value, '"');
+			p2 = (p1 ? strchr(p1+1, '"') : NULL);
+			if (p2==NULL) {
+				++numErrs;
+				printf("The type should be @ or a string, line %i\n", lineNr);
+			} else if (p2-p1-1 > MAXTYPE) {
+				++numErrs;
+				printf("The type can have at most %i characters, line %i\n", MAXTYPE, lineNr);
+			} else {
+				C->set_type = 0;
+				C->type_numel = p2-p1-1;
+				memcpy(C->type_buf, p1+1, C->type_numel);
+			}
+		} else if (!strcmp(line, "sample")) {
+			char *p1, *p2;
+			long lva,lvb;
+
+			if (!strcmp(value, "time")) {
+				C->sample_time = 1;
+				continue;
+			}
+			C->sample_time = 0;
+			p1 = strchr(value, '+');
+			if (p1!=NULL) {
+				*p1++ = 0; /* replace '+' by '\0' */
+			}
+
+			lva = strtol(value, &p2, 10);
+			if (p2==value) {
+				++numErrs;
+				printf("Ignoring faulty sample index in line %i\n", lineNr);
+				continue;
+			}
+
+			if (p1==NULL) {
+				C->sample_increase = 0;
+				C->sample_start = (INT32_T) lva;
+				continue;
+			}
+
+			lvb = strtol(p1, &p2, 10);
+			if (p2==p1) {
+				++numErrs;
+				printf("Ignoring faulty sample increase in line %i\n", lineNr);
+				continue;
+			}
+			C->sample_start = lva;
+			C->sample_increase = lvb;
+		} else if (!strcmp(line, "offset")) {
+			char *p;
+			long lv;
+
+			lv = strtol(value, &p, 10);
+			if (value==p) {
+				++numErrs;
+				printf("Ignoring faulty offset in line %i\n", lineNr);
+				continue;
+			}
+			C->offset = lv;
+		} else if (!strcmp(line, "duration")) {
+			char *p;
+			long lv;
+
+			lv = strtol(value, &p, 10);
+			if (value==p) {
+				++numErrs;
+				printf("Ignoring faulty duration in line %i\n", lineNr);
+				continue;
+			}
+			C->duration = lv;
+		} else {
+			printf("Ignoring unknown field defintion in line %i\n", lineNr);
+		}
+	}
+	fclose(f);
+
+	printf("\nEvent definition\n----------------\n");
+	if (C->sample_time) {
+		printf("Sample....: <from the time of the message>\n");
+	} else {
+		printf("Sample....: %i + %i\n", C->sample_start, C->sample_increase);
+	}
+	printf("Offset....: %i\n", C->offset);
+	printf("Duration..: %i\n", C->duration);
+	if (C->set_type) {
+		printf("Type......: <from the MIDI command>\n");
+	} else {
+		printf("Type......: '%.*s' (%i characters)\n", C->type_numel, C->type_buf, C->type_numel);
+	}
+	printf("Value.....: [channel data1 data2] (int32)\n");
+
+	printf("\nMIDI input\n----------\n");
+	if (C->device) {
+		printf("Device....: %i\n", C->device);
+	} else {
+		printf("Device....: '%s'\n", C->device_name);
+	}
+	printf("Commands..:");
+	for (i=0;i<NUMCOMMANDS;i++) {
+		if (C->command[i]) printf(" %s", commands[i].name);
+	}
+	printf("\n\nWill write to buffer at %s:%i\n\n", C->hostname, C->port);
+	return numErrs;
+}
+
+/* Returns the PortMidi device ID of the input device in the configuration, or -1 */
+PmDeviceID findDevice(const MidiEventConfig *C) {
+	int i, numDevs = Pm_CountDevices();
+
+	for (i=0;i<numDevs;i++) {
+		const PmDeviceInfo *info = Pm_GetDeviceInfo(i);
+		if (info == NULL || !info->input) continue;
+		if (C->device ? (i+1 == C->device) : (strstr(info->name, C->device_name) != NULL)) return i;
+	}
+	return -1;
+}
+
+/** Called by PortTime every millisecond. The messages that came in are put
+	in the queue for the main thread, with the time at which they came in.
+	The PortMidi timestamps are in milliseconds of the PortTime clock,
+	which is mapped onto ft_clock_ns with the offset that was determined
+	when the stream was opened.
+*/
+void receive_poll(PtTimestamp ts, void *userData) {
+	PmEvent events[MAXREAD];
+	int i, n;
+
+	if (inStream==NULL || !keepRunning) return;
+
+	while (Pm_Poll(inStream) == TRUE) {
+		n = Pm_Read(inStream, events, MAXREAD);
+		if (n<0) {
+			printf("Error while reading from MIDI device: %s\n", Pm_GetErrorText(n));
+			if (n != pmBufferOverflow) {
+				pthread_mutex_lock(&queueMutex);
+				readerFailed = 1;
+				pthread_cond_signal(&queueCond);
+				pthread_mutex_unlock(&queueMutex);
+			}
+			return;
+		}
+		if (n==0) return;
+
+		pthread_mutex_lock(&queueMutex);
+		for (i=0;i<n;i++) {
+			int k = findCommand(Pm_MessageStatus(events[i].message));
+			/* there can be a constant stream of messages, not all of which are interesting */
+			if (k<0 || !conf.command[k]) continue;
+			if (queueHead - queueTail == QUEUESIZE) {
+				queueDropped++;
+				continue;
+			}
+			queue[queueHead % QUEUESIZE].time    = timeOffset + (UINT64_T) events[i].timestamp * 1000000;
+			queue[queueHead % QUEUESIZE].message = events[i].message;
+			queueHead++;
+		}
+		pthread_cond_signal(&queueCond);
+		pthread_mutex_unlock(&queueMutex);
+	}
+}
+
+/** Maps the time at which a message came in to a sample, using the
+	timestamps of the blocks in the buffer. Returns 0 on success.
+*/
+int sampleAtTime(int ftBuffer, UINT64_T time, INT32_T *sampleAtTime) {
+	messagedef_t reqdef;
+	message_t request, *response = NULL;
+	timepoint_t timepoint;
+	int status = -1;
+
+	timepoint.time   = time;
+	timepoint.sample = 0;
+	timepoint.what   = FT_SAMPLE_AT_TIME;
+	reqdef.version = VERSION;
+	reqdef.command = GET_TIME;
+	reqdef.bufsize = sizeof(timepoint_t);
+	request.def = &reqdef;
+	request.buf = &timepoint;
+
+	if (clientrequest(ftBuffer, &request, &response) < 0 || response == NULL) return -1;
+	if (response->def != NULL && response->def->command == GET_OK && response->def->bufsize == sizeof(timepoint_t)) {
+		*sampleAtTime = ((timepoint_t *) response->buf)->sample;
+		status = 0;
+	}
+	FREE(response->def);
+	FREE(response->buf);
+	free(response);
+	return status;
+}
+
+/** Function that is called when the user presses CTRL-C */
+void abortHandler(int sig) {
+	printf("Ctrl-C pressed -- stopping...\n");
+	keepRunning = 0;
+}
+
+int main(int argc, char **argv) {
+	int ftBuffer = -1;
+	ft_buffer_server_t *ftServer = NULL;
+	UINT32_T bufsize;
+	char *batch;
+	messagedef_t reqdef;
+	message_t request, *response;
+	char *confname;
+	PmDeviceID device;
+	PmError err;
+	int warnedTime = 0;
+
+	if (argc < 2) {
+		confname = "midi2event.conf";
+	} else {
+		confname = argv[1];
+	}
+
+	if (parseConfig(&conf, confname) != 0) {
+		printf("Errors during parsing the configuration file\n");
+		exit(1);
+	}
+
+	/* every event has room for the longest type, the value is [channel data1 data2] */
+	bufsize = sizeof(eventdef_t) + MAXTYPE + 3*sizeof(INT32_T);
+	batch = (char *) malloc(MAXBATCH * bufsize);
+	if (batch == NULL) {
+		printf("Out of memory\n");
+		exit(1);
+	}
+
+	/* prepare fixed fields */
+	reqdef.version = VERSION;
+	reqdef.command = PUT_EVT;
+	request.def = &reqdef;
+	request.buf = batch;
+
+	err = Pm_Initialize();
+	if (err != pmNoError) {
+		printf("Could not initialise PortMidi: %s\n", Pm_GetErrorText(err));
+		exit(1);
+	}
+
+	device = findDevice(&conf);
+	if (device < 0) {
+		printf("Could not find the MIDI input device, the following devices are available\n");
+		for (device=0; device<Pm_CountDevices(); device++) {
+			const PmDeviceInfo *info = Pm_GetDeviceInfo(device);
+			if (info && info->input) printf("%3i: %s\n", device+1, info->name);
+		}
+		Pm_Terminate();
+		exit(1);
+	}
+	printf("Opening MIDI input device '%s'\n", Pm_GetDeviceInfo(device)->name);
+
+	/* a minus as hostname spawns a buffer server in this process, see ft_open_buffer */
+	ftBuffer = ft_open_buffer(conf.hostname, conf.port, &ftServer);
+	if (ftBuffer < 0) {
+		printf("Connection to FieldTrip buffer failed.\n");
+		Pm_Terminate();
+		exit(1);
+	}
+
+	sample = conf.sample_start;
+
+	/* register CTRL-C handler */
+	signal(SIGINT, abortHandler);
+
+	/* the PortMidi timestamps come from the PortTime clock, which has to be started first */
+	if (Pt_Start(1, receive_poll, NULL) != ptNoError) {
+		printf("Could not start the PortTime clock.\n");
+		exit(1);
+	}
+	timeOffset = ft_clock_ns() - (UINT64_T) Pt_Time() * 1000000;
+
+	err = Pm_OpenInput(&inStream, device, NULL, QUEUESIZE, NULL, NULL);
+	if (err != pmNoError) {
+		printf("Could not open the MIDI input device: %s\n", Pm_GetErrorText(err));
+		inStream = NULL;
+		keepRunning = 0;
+	} else {
+		/* active sensing, clock and sysex messages are not needed */
+		Pm_SetFilter(inStream, PM_FILT_ACTIVE | PM_FILT_CLOCK | PM_FILT_SYSEX);
+		printf("Starting to listen - press CTRL-C to quit\n");
+	}
+
+	while (keepRunning) {
+		MidiInput inputs[MAXBATCH];
+		unsigned int dropped;
+		int i, n, numInputs, numEvents = 0;
+		UINT32_T size = 0;
+
+		/* wait for messages, up to 100 ms to notice CTRL-C */
+		pthread_mutex_lock(&queueMutex);
+		if (queueHead == queueTail && !readerFailed) {
+			struct timespec ts;
+			UINT64_T deadline;
+			struct timeval tv;
+			gettimeofday(&tv, NULL);
+			deadline = (UINT64_T) tv.tv_sec*1000000000 + (UINT64_T) tv.tv_usec*1000 + 100000000;
+			ts.tv_sec  = deadline / 1000000000;
+			ts.tv_nsec = deadline % 1000000000;
+			pthread_cond_timedwait(&queueCond, &queueMutex, &ts);
+		}
+		for (numInputs=0; numInputs<MAXBATCH && queueTail != queueHead; numInputs++) {
+			inputs[numInputs] = queue[queueTail % QUEUESIZE];
+			queueTail++;
+		}
+		dropped = queueDropped;
+		queueDropped = 0;
+		if (readerFailed) keepRunning = 0;
+		pthread_mutex_unlock(&queueMutex);
+
+		if (dropped > 0) {
+			printf("Ignoring %u MIDI messages that came in faster than they could be sent\n", dropped);
+		}
+
+		/* all messages that came in since the last request go out together */
+		for (i=0;i<numInputs;i++) {
+			eventdef_t *ev = (eventdef_t *) (batch + size);
+			char *buf = (char *) (ev+1);
+			INT32_T value[3];
+			int status = Pm_MessageStatus(inputs[i].message);
+			const char *name = commands[findCommand(status)].name;
+
+			ev->type_type   = DATATYPE_CHAR;
+			ev->type_numel  = (conf.set_type ? strlen(name) : conf.type_numel);
+			ev->value_type  = DATATYPE_INT32;
+			ev->value_numel = 3;
+			ev->offset      = conf.offset;
+			ev->duration    = conf.duration;
+			ev->bufsize     = ev->type_numel + sizeof(value);
+			memcpy(buf, (conf.set_type ? name : conf.type_buf), ev->type_numel);
+			value[0] = status & MIDI_CHN_MASK;
+			value[1] = Pm_MessageData1(inputs[i].message);
+			value[2] = Pm_MessageData2(inputs[i].message);
+			memcpy(buf + ev->type_numel, value, sizeof(value));
+
+			if (conf.sample_time) {
+				ev->sample = EVENT_AUTO_SAMPLE;
+				if (sampleAtTime(ftBuffer, inputs[i].time, &ev->sample) != 0 && !warnedTime) {
+					printf("Could not map the time to a sample, the buffer needs timestamps (PUT_DAT_T) - using the current sample instead\n");
+					warnedTime = 1;
+				}
+			} else {
+				ev->sample = sample;
+				sample += conf.sample_increase;
+
+				if (ev->sample < 0) {
+					printf("Ignoring negative sample (%i) event...\n", ev->sample);
+					continue;
+				}
+			}
+			size += sizeof(eventdef_t) + ev->bufsize;
+			numEvents++;
+		}
+		if (numEvents == 0) continue;
+
+		reqdef.bufsize = size;
+		n = clientrequest(ftBuffer, &request, &response);
+
+		if (n<0 || response == NULL) {
+			printf("Error in FieldTrip connection\n");
+		} else {
+			if (response->def == NULL || response->def->command != PUT_OK) {
+				printf("FieldTrip server returned an error\n");
+			} else {
+				printf("Sent off %i events\n", numEvents);
+			}
+			FREE(response->def);
+			FREE(response->buf);
+			free(response);
+		}
+	}
+
+	/* the callback returns immediately once keepRunning is cleared */
+	keepRunning = 0;
+	Pt_Stop();
+	if (inStream != NULL) {
+		Pm_Close(inStream);
+		inStream = NULL;
+	}
+	Pm_Terminate();
+
+	ft_close_buffer(ftBuffer, ftServer);
+	free(batch);
+
+	return 0;
+}
@@ -1,5 +1,6 @@
 /*
- * Collection of routines for saving FieldTrip buffer data to disk.
+ * Collection of routines for saving FieldTrip buffer data to disk, and for
+ * reading it back, see ft_storage.h for the layout of a recording.
  *
  * (C) 2010 S. Klanke
  */
@@ -11,6 +12,9 @@
 #else
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 
 static char *datatype_names[]={"char","uint8","uint16","uint32","uint64","int8","int16","int32","int64","float32","float64"};
@@ -75,6 +79,10 @@ ft_storage_t *ft_storage_create(const char *directory, const headerdef_t *hdef,
 	S->fEvents = fopen(S->dirName, "wb");
 	if (S->fEvents == NULL) goto cannotWrite;
 
+	strcpy(S->dirName + S->dirLen, "/events.idx");
+	S->fIndex = fopen(S->dirName, "wb");
+	if (S->fIndex == NULL) goto cannotWrite;
+
 	strcpy(S->dirName + S->dirLen, "/timing");
 	S->fTime = fopen(S->dirName, "wb");
 	if (S->fTime == NULL) goto cannotWrite;
@@ -126,15 +134,23 @@ cleanup:
 	if (S->fHeaderTxt) fclose(S->fHeaderTxt);
 	if (S->fSamples)   fclose(S->fSamples);
 	if (S->fEvents)    fclose(S->fEvents);
+	if (S->fIndex)     fclose(S->fIndex);
 	if (S->fTime)      fclose(S->fTime);
 	if (S->dirName)    free(S->dirName);
 	free(S);
 	return NULL;
 }
 
+static void close_reader(ft_storage_t *S);
+
 void ft_storage_close(ft_storage_t *S) {
+	if (!S->created) {
+		close_reader(S);
+		return;
+	}
 	fclose(S->fSamples);
 	fclose(S->fEvents);
+	fclose(S->fIndex);
 	fclose(S->fTime);
 	
 	if (S->created) {
@@ -180,14 +196,38 @@ int ft_storage_add_samples(ft_storage_t *S, int numSamples, const void *data) {
 }
 
 
+/* appends an entry for the event at the end of the events file to the index */
+static int add_index(ft_storage_t *S, const eventdef_t *event) {
+	ft_storage_index_t entry;
+
+	entry.offset = S->eventsSize;
+	entry.sample = event->sample;
+	entry.size   = sizeof(eventdef_t) + event->bufsize;
+	if (fwrite(&entry, sizeof(entry), 1, S->fIndex) != 1) return FT_FILE_ERROR;
+	S->eventsSize += entry.size;
+	S->numEvents++;
+	return 0;
+}
+
 int ft_storage_add_events(ft_storage_t *S, int size, const void *events) {
+	int offset = 0;
+
 	if (fwrite(events, 1, size, S->fEvents) != size) return FT_FILE_ERROR;
 	fflush(S->fEvents);
+
+	while (offset + sizeof(eventdef_t) <= size) {
+		const eventdef_t *evdef = (const eventdef_t *) ((const char *) events + offset);
+		if (add_index(S, evdef) != 0) return FT_FILE_ERROR;
+		offset += sizeof(eventdef_t) + evdef->bufsize;
+	}
+	fflush(S->fIndex);
 	return 0;
 }
 
 int ft_storage_add_event(ft_storage_t *S, const eventdef_t *event, const void *type, const void *value) {
 	UINT32_T siz = sizeof(eventdef_t);
+	if (add_index(S, event) != 0) return FT_FILE_ERROR;
+	fflush(S->fIndex);
 	if (fwrite(event, 1, siz, S->fEvents) != siz) return FT_FILE_ERROR;
 	
 	siz = wordsize_from_type(event->type_type) * event->type_numel;
@@ -210,3 +250,300 @@ int ft_storage_add_timing(ft_storage_t *S, const ft_timing_element_t *te) {
 }
 
 	
+
+/*****************************************************************************/
+
+/* Opens the file S->dirName for reading. Except on WIN32, it is mapped into memory
+   and closed again. F->data is NULL for an empty file. */
+static int open_mapped(ft_storage_t *S, ft_storage_file_t *F) {
+#ifdef WIN32
+	F->file = fopen(S->dirName, "rb");
+	if (F->file == NULL) return -1;
+	_fseeki64(F->file, 0, SEEK_END);
+	F->size = _ftelli64(F->file);
+	F->data = NULL;
+	return 0;
+#else
+	struct stat st;
+	int fd = open(S->dirName, O_RDONLY);
+
+	if (fd < 0) return -1;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return -1;
+	}
+	F->file = NULL;
+	F->size = st.st_size;
+	F->data = NULL;
+	if (F->size > 0) {
+		void *map = mmap(NULL, F->size, PROT_READ, MAP_SHARED, fd, 0);
+		if (map == MAP_FAILED) {
+			close(fd);
+			return -1;
+		}
+		F->data = (const char *) map;
+	}
+	close(fd);
+	return 0;
+#endif
+}
+
+static void close_mapped(ft_storage_file_t *F) {
+#ifdef WIN32
+	if (F->file) fclose(F->file);
+#else
+	if (F->data) munmap((void *) F->data, F->size);
+#endif
+}
+
+/* copies size bytes from the given offset of F */
+static int read_mapped(ft_storage_file_t *F, UINT64_T offset, UINT64_T size, void *dest) {
+#ifdef WIN32
+	if (_fseeki64(F->file, offset, SEEK_SET) != 0) return FT_FILE_ERROR;
+	if (fread(dest, 1, size, F->file) != size) return FT_FILE_ERROR;
+#else
+	memcpy(dest, F->data + offset, size);
+#endif
+	return 0;
+}
+
+/* reads the events.idx file, and adds the events that are not in it from the events file */
+static int read_index(ft_storage_t *S, const char *events, UINT64_T eventsSize) {
+	UINT32_T allocated = 0, i;
+	UINT64_T offset = 0;
+	FILE *f;
+
+	S->numEvents = 0;
+	S->index = NULL;
+
+	strcpy(S->dirName + S->dirLen, "/events.idx");
+	f = fopen(S->dirName, "rb");
+	if (f != NULL) {
+		long size;
+		fseek(f, 0, SEEK_END);
+		size = ftell(f);
+		fseek(f, 0, SEEK_SET);
+		allocated = size / sizeof(ft_storage_index_t);
+		if (allocated > 0) {
+			S->index = (ft_storage_index_t *) malloc(allocated * sizeof(ft_storage_index_t));
+			if (S->index == NULL) {
+				fclose(f);
+				return FT_OUT_OF_MEMORY;
+			}
+			allocated = fread(S->index, sizeof(ft_storage_index_t), allocated, f);
+		}
+		fclose(f);
+		/* only use the entries that describe consecutive events in the file */
+		while (S->numEvents < allocated && S->index[S->numEvents].offset == offset
+				&& S->index[S->numEvents].size >= sizeof(eventdef_t)
+				&& offset + S->index[S->numEvents].size <= eventsSize) {
+			offset += S->index[S->numEvents].size;
+			S->numEvents++;
+		}
+	}
+
+	/* the remaining events, e.g. the recording was made without an index */
+	while (offset + sizeof(eventdef_t) <= eventsSize) {
+		eventdef_t evdef;
+		ft_storage_index_t *entry;
+
+		memcpy(&evdef, events + offset, sizeof(eventdef_t));
+		if (offset + sizeof(eventdef_t) + evdef.bufsize > eventsSize) break;
+
+		if (S->numEvents == allocated) {
+			UINT32_T newSize = allocated > 0 ? 2*allocated : 1024;
+			ft_storage_index_t *newIndex = (ft_storage_index_t *) realloc(S->index, newSize * sizeof(ft_storage_index_t));
+			if (newIndex == NULL) return FT_OUT_OF_MEMORY;
+			S->index = newIndex;
+			allocated = newSize;
+		}
+		entry = &S->index[S->numEvents++];
+		entry->offset = offset;
+		entry->sample = evdef.sample;
+		entry->size   = sizeof(eventdef_t) + evdef.bufsize;
+		offset += entry->size;
+	}
+
+	S->eventsSize = offset;
+	S->eventsSorted = 1;
+	for (i=1;i<S->numEvents;i++) {
+		if (S->index[i].sample < S->index[i-1].sample) {
+			S->eventsSorted = 0;
+			break;
+		}
+	}
+	return 0;
+}
+
+ft_storage_t *ft_storage_open(const char *directory, int *errCode) {
+	ft_storage_t *S;
+	FILE *f;
+	long size;
+	int r;
+
+	S = (ft_storage_t *) calloc(1, sizeof(ft_storage_t));
+	if (S==NULL) {
+		if (errCode) *errCode=FT_OUT_OF_MEMORY;
+		return NULL;
+	}
+	S->dirLen = strlen(directory);
+	S->dirName = (char *) malloc(S->dirLen + 16);
+	if (S->dirName==NULL) {
+		if (errCode) *errCode=FT_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+	strcpy(S->dirName, directory);
+	if (errCode) *errCode = FT_FILE_ERROR;
+
+	/* the header, including the chunks */
+	strcpy(S->dirName + S->dirLen, "/header");
+	f = fopen(S->dirName, "rb");
+	if (f == NULL) goto cannotRead;
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (size < sizeof(headerdef_t)) {
+		fclose(f);
+		goto cannotRead;
+	}
+	S->header = (headerdef_t *) malloc(size);
+	if (S->header == NULL) {
+		fclose(f);
+		if (errCode) *errCode=FT_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+	r = fread(S->header, 1, size, f);
+	fclose(f);
+	if (r != size) goto cannotRead;
+	S->headerSize  = size;
+	S->numChannels = S->header->nchans;
+	S->sampleSize  = wordsize_from_type(S->header->data_type) * S->header->nchans;
+	if (S->sampleSize == 0) {
+		fprintf(stderr, "ERROR: invalid data type or number of channels in %s\n", S->dirName);
+		goto cleanup;
+	}
+
+	/* the samples files, which are all mapped */
+	while (1) {
+		ft_storage_file_t F, *newFiles;
+
+		if (S->numFiles == 0) {
+			strcpy(S->dirName + S->dirLen, "/samples");
+		} else {
+			sprintf(S->dirName + S->dirLen, "/samples%i", S->numFiles);
+		}
+		if (open_mapped(S, &F) != 0) {
+			if (S->numFiles == 0) goto cannotRead;
+			break;
+		}
+		newFiles = (ft_storage_file_t *) realloc(S->files, (S->numFiles + 1) * sizeof(ft_storage_file_t));
+		if (newFiles == NULL) {
+			close_mapped(&F);
+			if (errCode) *errCode=FT_OUT_OF_MEMORY;
+			goto cleanup;
+		}
+		F.firstSample = S->numSamples;
+		F.numSamples  = F.size / S->sampleSize;
+		S->files = newFiles;
+		S->files[S->numFiles++] = F;
+		S->numSamples += F.numSamples;
+	}
+
+	/* the events are always kept in memory */
+	strcpy(S->dirName + S->dirLen, "/events");
+	if (open_mapped(S, &S->eventsFile) == 0) {
+		#ifdef WIN32
+		if (S->eventsFile.size > 0) {
+			S->events = (const char *) malloc(S->eventsFile.size);
+			if (S->events == NULL || read_mapped(&S->eventsFile, 0, S->eventsFile.size, (void *) S->events) != 0) goto cannotRead;
+		}
+		#else
+		S->events = S->eventsFile.data;
+		#endif
+		S->eventsSize = S->eventsFile.size;
+	}
+	r = read_index(S, S->events, S->eventsSize);
+	if (r != 0) {
+		if (errCode) *errCode = r;
+		goto cleanup;
+	}
+
+	S->curSampleFile = 0;
+	if (errCode) *errCode = 0;
+	return S;
+
+cannotRead:
+	fprintf(stderr, "ERROR: cannot read file %s\n", S->dirName);
+cleanup:
+	close_reader(S);
+	return NULL;
+}
+
+static void close_reader(ft_storage_t *S) {
+	UINT32_T i;
+
+	for (i=0;i<S->numFiles;i++) close_mapped(&S->files[i]);
+	close_mapped(&S->eventsFile);
+	#ifdef WIN32
+	if (S->events) free((void *) S->events);
+	#endif
+	if (S->files)   free(S->files);
+	if (S->index)   free(S->index);
+	if (S->header)  free(S->header);
+	if (S->dirName) free(S->dirName);
+	free(S);
+}
+
+const headerdef_t *ft_storage_read_header(const ft_storage_t *S) {
+	return S->header;
+}
+
+int ft_storage_read_data(ft_storage_t *S, UINT32_T begsample, UINT32_T endsample, void *data) {
+	UINT32_T lo = 0, hi = S->numFiles;
+	char *dest = (char *) data;
+
+	if (endsample < begsample || endsample >= S->numSamples) return FT_INVALID_RANGE;
+
+	/* look for the file that contains begsample */
+	while (hi - lo > 1) {
+		UINT32_T mid = (lo + hi)/2;
+		if (S->files[mid].firstSample <= begsample) lo = mid; else hi = mid;
+	}
+
+	for (S->curSampleFile = lo; begsample <= endsample && S->curSampleFile < S->numFiles; S->curSampleFile++) {
+		ft_storage_file_t *F = &S->files[S->curSampleFile];
+		UINT32_T last = F->firstSample + F->numSamples - 1;
+		UINT32_T num;
+
+		if (F->numSamples == 0) continue;
+		if (last > endsample) last = endsample;
+		num = last - begsample + 1;
+		if (read_mapped(F, (UINT64_T) (begsample - F->firstSample) * S->sampleSize, (UINT64_T) num * S->sampleSize, dest) != 0) return FT_FILE_ERROR;
+		dest += (UINT64_T) num * S->sampleSize;
+		begsample += num;
+	}
+	return 0;
+}
+
+const void *ft_storage_read_events(ft_storage_t *S, UINT32_T begevent, UINT32_T endevent, UINT32_T *size) {
+	const ft_storage_index_t *last;
+
+	if (endevent < begevent || endevent >= S->numEvents) return NULL;
+	last = &S->index[endevent];
+	if (size) *size = last->offset + last->size - S->index[begevent].offset;
+	return S->events + S->index[begevent].offset;
+}
+
+UINT32_T ft_storage_find_event(const ft_storage_t *S, INT32_T sample) {
+	UINT32_T lo = 0, hi = S->numEvents;
+
+	if (!S->eventsSorted) {
+		while (lo < hi && S->index[lo].sample < sample) lo++;
+		return lo;
+	}
+	while (lo < hi) {
+		UINT32_T mid = lo + (hi - lo)/2;
+		if (S->index[mid].sample < sample) lo = mid + 1; else hi = mid;
+	}
+	return lo;
+}
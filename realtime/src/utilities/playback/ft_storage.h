@@ -1,5 +1,19 @@
 /*
- * Collection of routines for saving FieldTrip buffer data to disk.
+ * Collection of routines for saving FieldTrip buffer data to disk, and for
+ * reading it back.
+ *
+ * A recording is a directory with the files
+ *   header      headerdef_t followed by the chunks
+ *   header.txt  the same in ASCII
+ *   samples     the samples, samples1, samples2, ... once a file gets to 2 GB
+ *   events      the events as in PUT_EVT (eventdef_t followed by type and value)
+ *   events.idx  one ft_storage_index_t per event
+ *   timing      when the samples and events came in, see ft_storage_add_timing
+ *
+ * The samples have a fixed size, so the place of a sample in the samples
+ * files follows from the sizes of the files. The index of the events is
+ * rebuilt from the events file if it is missing or incomplete, e.g. for
+ * recordings that were made before it existed.
  *
  * (C) 2010 S. Klanke
  */
@@ -17,6 +31,23 @@ extern "C" {
 /* FIXME: move this somewhere else */
 #define FT_OUT_OF_MEMORY 1000
 #define FT_FILE_ERROR    1001
+#define FT_INVALID_RANGE 1002
+
+/* entry of the event index */
+typedef struct {
+	UINT64_T offset;   /* offset of the eventdef_t in the events file */
+	INT32_T  sample;   /* the sample of the event */
+	UINT32_T size;     /* sizeof(eventdef_t) + bufsize */
+} ft_storage_index_t;
+
+/* one of the samples files, for reading */
+typedef struct {
+	UINT32_T firstSample;
+	UINT32_T numSamples;
+	FILE *file;        /* only on WIN32, elsewhere the file is mapped */
+	const char *data;
+	UINT64_T size;
+} ft_storage_file_t;
 
 typedef struct {
 	int created;
@@ -25,6 +56,8 @@ typedef struct {
 	FILE *fSamples;
 	FILE *fEvents;
 	FILE *fTime;
+	FILE *fIndex;
+	UINT64_T eventsSize; /* size of the events file */
 	char *dirName;
 	int dirLen;
 	int curSampleFile;
@@ -32,6 +65,15 @@ typedef struct {
 	UINT32_T numChannels;
 	UINT32_T numSamples;
 	UINT32_T numEvents;
+	/* the following are only used for reading, see ft_storage_open */
+	headerdef_t *header; /* followed by the chunks */
+	UINT32_T headerSize;
+	UINT32_T numFiles;
+	ft_storage_file_t *files;
+	ft_storage_file_t eventsFile;
+	const char *events;
+	ft_storage_index_t *index;
+	int eventsSorted;    /* 1 if the samples of the events do not decrease */
 } ft_storage_t;
 
 typedef struct {
@@ -47,12 +89,25 @@ int  ft_storage_add_events  (ft_storage_t *S, int size, const void *events);
 int  ft_storage_add_event   (ft_storage_t *S, const eventdef_t *event, const void *type, const void *value);
 int  ft_storage_add_timing  (ft_storage_t *S, const ft_timing_element_t *te);
 
-/*
-ft_storage_t *ft_storage_open(const char *directory);
-headerdef_t *ft_storage_read_header(const ft_storage_t *S);
-int ft_storage_read_data(ft_storage_t *S, int begsample, int endsample, void *data);
-void *ft_storage_read_events(ft_storage_t *S);
-*/
+/* Opens a recording for reading. The samples and events files are mapped
+   into memory (except on WIN32), so reading any range costs no more than
+   reading it from the start of the recording. ft_storage_close releases it. */
+ft_storage_t *ft_storage_open(const char *directory, int *errCode);
+
+/* returns the header of an opened recording, followed by the chunks (S->headerSize bytes in total) */
+const headerdef_t *ft_storage_read_header(const ft_storage_t *S);
+
+/* copies the samples begsample ... endsample (zero-offset, inclusive) to data,
+   which should have room for S->sampleSize bytes per sample */
+int ft_storage_read_data(ft_storage_t *S, UINT32_T begsample, UINT32_T endsample, void *data);
+
+/* returns the events begevent ... endevent (inclusive) in the form of PUT_EVT,
+   and their size in bytes. The memory belongs to S, NULL means an invalid range. */
+const void *ft_storage_read_events(ft_storage_t *S, UINT32_T begevent, UINT32_T endevent, UINT32_T *size);
+
+/* returns the number of the first event whose sample is at least the given
+   sample, or S->numEvents if there is none */
+UINT32_T ft_storage_find_event(const ft_storage_t *S, INT32_T sample);
 
 #ifdef __cplusplus
 }
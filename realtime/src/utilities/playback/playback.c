@@ -13,7 +13,9 @@
 #endif
 
 #include "buffer.h"
+#include "socketserver.h"
 #include "rdadefs.h"
+#include "ft_storage.h"
 
 #define MAXLINE 256
 #define MAX_PRINT_CHN  300
@@ -28,62 +30,22 @@ typedef struct {
 
 char directory[MAXLINE];
 int ftSocket = -1;
+ft_buffer_server_t *ftServer = NULL;
 int numWriteOps, allocedWriteOps;
 INT64_T totalSamples, totalEvents;
-INT64_T sizeSamples, sizeEvents;
-int curSamplesFile = 0, numSamplesFiles = 1;
 unsigned int bytesPerSample;
 
 WriteOperation *writeOps = NULL;
-FILE *fSamples;
-headerdef_t *header = NULL;
-char *eventBuffer = NULL;
+ft_storage_t *storage = NULL;
+const headerdef_t *header = NULL;
+const char *eventBuffer = NULL;
 UINT32_T headerSize;
+UINT32_T nextSample = 0;
+int asFastAsPossible = 0;
 
-static char usage[] = "Usage: playback <directory> [hostname=localhost [port=1972]]\n";
-
-double getCurrentTime() {
-#if defined(WIN32) && !defined(COMPILER_MINGW)
-	return timeGetTime() * 0.001;
-#else
-	struct timeval tv;
-	gettimeofday(&tv, NULL);
-	return tv.tv_sec + tv.tv_usec*1e-6;
-#endif
-}
-
-int readHeader(const char *directory) {
-	char filename[MAXLINE];
-	FILE *f;
-	long size;
-
-	snprintf(filename, MAXLINE, "%s/header", directory);
-	f = fopen(filename, "rb");
-	if (f == NULL) {
-		fprintf(stderr, "Can not read file %s\n", filename);
-		return -1;
-	}
-
-	fseek(f, 0, SEEK_END);
-	size = ftell(f);
-	fseek(f, 0, SEEK_SET);
-
-	if (header != NULL) free(header);
-	header = (headerdef_t *) malloc(size);
-
-	if (header == NULL) {
-		fprintf(stderr, "Cannot allocate %li bytes for reading the header.\n", size);
-		exit(1);
-	}
-
-	fread(header, 1, size, f);
-	fclose(f);
-
-	headerSize = size;
-
-	return headerSize;
-}
-
+static char usage[] = "Usage: playback <directory> [hostname=localhost [port=1972 [speed=1]]]\n"
+	"The speed is a factor (e.g. 0.5 or 10), or 'max' for writing the blocks as fast as possible.\n"
+	"Use - as hostname to spawn a buffer server in playback itself, on the given port.\n";
 
 int readTiming(const char *directory, double speedup) {
 	FILE *f;
@@ -113,7 +75,7 @@ int readTiming(const char *directory, double speedup) {
 		double time;
 		int num, r, i;
 		WriteOperation *wop;
-		eventdef_t *evdef;
+		const eventdef_t *evdef;
 
 		r = fscanf(f, "%c %i %lf\n", &type, &num, &time);
 
@@ -146,7 +108,11 @@ int readTiming(const char *directory, double speedup) {
 				for (i=0;i<num;i++) {
 					int siz;
 
-					evdef = (eventdef_t *) (eventBuffer+offEvts);
+					if (totalEvents >= storage->numEvents) {
+						fputs("Error: 'events' file too small for given 'timing' definition\n", stderr);
+						exit(1);
+					}
+					evdef = (const eventdef_t *) (eventBuffer+offEvts);
 					siz = sizeof(eventdef_t) + evdef->bufsize;
 
 					totalEvents++;
@@ -166,100 +132,123 @@ int readTiming(const char *directory, double speedup) {
 	return numWriteOps;
 }
 
-INT64_T openSamplesFile(const char *directory, int counter) {
-	char filename[MAXLINE];
-	long size;
+/* reads the samples of the given write operation into the data definition */
+int readSamples(datadef_t *ddef, const WriteOperation *wop) {
+	ddef->nchans    = header->nchans;
+	ddef->data_type = header->data_type;
+	ddef->bufsize   = wop->numSamples * bytesPerSample;
+	ddef->nsamples  = wop->numSamples;
 
-	if (counter < 1) {
-		snprintf(filename, MAXLINE, "%s/samples", directory);
-	} else {
-		snprintf(filename, MAXLINE, "%s/samples%i", directory, counter);
-	}
-	fSamples = fopen(filename, "rb");
-	if (fSamples == NULL) {
-		if (counter < numSamplesFiles) {
-			fprintf(stderr, "Can not read file %s\n", filename);
-		}
+	if (ft_storage_read_data(storage, nextSample, nextSample + wop->numSamples - 1, ddef+1) != 0) {
+		fprintf(stderr, "Error reading samples!\n");
 		return -1;
 	}
-
-	fseek(fSamples, 0, SEEK_END);
-	size = ftell(fSamples);
-	fseek(fSamples, 0, SEEK_SET);
-	return size;
+	nextSample += wop->numSamples;
+	return 0;
 }
 
-int readAllEvents(const char *directory) {
-	char filename[MAXLINE];
-	FILE *f;
+/* The samples are read by a separate thread, which fills two buffers in turn,
+   so that the next block is ready in memory when its time has come */
+typedef struct {
+	datadef_t *ddef[2];
+	int full[2];
+	int error;   /* set by the reader thread if the samples could not be read */
+	int stop;    /* set by the main thread to stop the reader thread */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+} SampleReader;
 
-	snprintf(filename, MAXLINE, "%s/events", directory);
-	f = fopen(filename, "rb");
-	if (f == NULL) {
-		fprintf(stderr, "Can not read file %s\n", filename);
-		return -1;
-	}
+SampleReader reader;
 
-	fseek(f, 0, SEEK_END);
-	sizeEvents = ftell(f);
-	fseek(f, 0, SEEK_SET);
-	if (sizeEvents > 0) {
-		eventBuffer = (char *) malloc(sizeEvents);
-		if (eventBuffer == NULL) {
-			fprintf(stderr, "Cannot allocate %li bytes for reading events\n", (long) sizeEvents);
-		}
+void *readerThread(void *arg) {
+	int op, slot = 0;
+
+	for (op = 0; op < numWriteOps; op++) {
+		int r;
+
+		if (writeOps[op].numSamples == 0) continue;
+
+		pthread_mutex_lock(&reader.mutex);
+		while (reader.full[slot] && !reader.stop) pthread_cond_wait(&reader.cond, &reader.mutex);
+		pthread_mutex_unlock(&reader.mutex);
+		if (reader.stop) break;
 
-		fread(eventBuffer, 1, sizeEvents, f);
+		r = readSamples(reader.ddef[slot], &writeOps[op]);
+
+		pthread_mutex_lock(&reader.mutex);
+		if (r != 0) reader.error = 1;
+		reader.full[slot] = 1;
+		pthread_cond_broadcast(&reader.cond);
+		pthread_mutex_unlock(&reader.mutex);
+		if (r != 0) break;
+		slot = 1 - slot;
 	}
-	fclose(f);
-	return sizeEvents;
+	return NULL;
+}
+
+/* waits until the reader thread has filled the given buffer, returns NULL on errors */
+datadef_t *waitSamples(int slot) {
+	datadef_t *ddef;
+
+	pthread_mutex_lock(&reader.mutex);
+	while (!reader.full[slot]) pthread_cond_wait(&reader.cond, &reader.mutex);
+	ddef = reader.error ? NULL : reader.ddef[slot];
+	pthread_mutex_unlock(&reader.mutex);
+	return ddef;
+}
+
+/* hands the buffer back to the reader thread */
+void releaseSamples(int slot) {
+	pthread_mutex_lock(&reader.mutex);
+	reader.full[slot] = 0;
+	pthread_cond_broadcast(&reader.cond);
+	pthread_mutex_unlock(&reader.mutex);
 }
 
 void run() {
 	datadef_t *ddef;
 	int maxSize = 0;
-	int r;
-	int nextSampleOp = numWriteOps;
+	int r, slot = 0;
 	messagedef_t reqdef;
 	message_t request, *response;
-	double T0, t;
+	pthread_t readerHandle;
+	UINT64_T T0, deadline, now;
+	double t, late, sumLate = 0.0, maxLate = 0.0;
+	int numLate = 0, numBlocks = 0;
 	int op;
 
-	/* search for first sample operation */
-	for (op = 0; op < numWriteOps; op++) {
-		if (writeOps[op].numSamples > 0) {
-			nextSampleOp = op;
-			break;
-		}
-	}
-
 	for (op = 0; op < numWriteOps; op++) {
 		if (writeOps[op].numSamples > 0 && writeOps[op].size > maxSize) {
 			maxSize = writeOps[op].size;
 		}
 	}
 
+	memset(&reader, 0, sizeof(reader));
+	pthread_mutex_init(&reader.mutex, NULL);
+	pthread_cond_init(&reader.cond, NULL);
 	if (maxSize > 0) {
-		ddef = (datadef_t *) malloc(sizeof(datadef_t) + maxSize);
-		if (ddef == NULL) {
+		reader.ddef[0] = (datadef_t *) malloc(sizeof(datadef_t) + maxSize);
+		reader.ddef[1] = (datadef_t *) malloc(sizeof(datadef_t) + maxSize);
+		if (reader.ddef[0] == NULL || reader.ddef[1] == NULL) {
 			printf("Cannot allocate temporary buffer for writing samples\n");
 			exit(1);
 		}
-		ddef->nchans    = header->nchans;
-		ddef->data_type = header->data_type;
-		ddef->bufsize   = writeOps[nextSampleOp].numSamples * bytesPerSample;
-		ddef->nsamples  = writeOps[nextSampleOp].numSamples;
-		fread(ddef+1, bytesPerSample, writeOps[nextSampleOp].numSamples, fSamples);
 	}
+	if (pthread_create(&readerHandle, NULL, readerThread, NULL) != 0) {
+		fprintf(stderr, "Cannot start the thread for reading samples\n");
+		exit(1);
+	}
+	/* the first block should be in memory before the clock starts */
+	if (maxSize > 0 && waitSamples(0) == NULL) exit(1);
 
 	/* write out header */
 	request.def = &reqdef;
 	reqdef.version = VERSION;
 	reqdef.command = PUT_HDR;
 	reqdef.bufsize = headerSize;
-	request.buf = header;
+	request.buf = (void *) header;
 
-	T0 = getCurrentTime();
+	T0 = ft_clock_ns();
 	printf("Writing header...\n");
 	r = clientrequest(ftSocket, &request, &response);
 
@@ -270,25 +259,32 @@ void run() {
 	free(response->def);
 	free(response);
 
-	op=0;
-
 	for (op=0;op<numWriteOps;op++) {
-		t = getCurrentTime() - T0;
-		if (writeOps[op].time > t) {
-			usleep(1.0e6*(writeOps[op].time -  t));
-			t = getCurrentTime() - T0;
+		/* the deadlines are relative to the header, so being late once does not shift the rest */
+		deadline = T0 + (UINT64_T) (1.0e9*writeOps[op].time);
+		if (asFastAsPossible) {
+			now = ft_clock_ns();
+			late = 0.0;
+		} else {
+			/* this spins for the last bit, so that the blocks go out at the recorded intervals */
+			ft_clock_sleep_until(deadline);
+			now = ft_clock_ns();
+			late = 1.0e-6 * (double) (INT64_T) (now - deadline);
 		}
+		t = 1.0e-9 * (double) (now - T0);
 
 		if (writeOps[op].numSamples > 0) {
+			ddef = waitSamples(slot);
+			if (ddef == NULL) break;
 			reqdef.command = PUT_DAT;
 			reqdef.bufsize = sizeof(datadef_t) + writeOps[op].size;
 			request.buf = ddef;
-			printf("%.3f: Writing %i sample(s)\n", t, writeOps[op].numSamples);
+			printf("%.3f: Writing %i sample(s) (%+.3f ms)\n", t, writeOps[op].numSamples, late);
 		} else {
 			reqdef.command = PUT_EVT;
 			reqdef.bufsize = writeOps[op].size;
-			request.buf = eventBuffer + writeOps[op].offset;
-			printf("%.3f: Writing %i event(s)\n", t, writeOps[op].numEvents);
+			request.buf = (void *) (eventBuffer + writeOps[op].offset);
+			printf("%.3f: Writing %i event(s) (%+.3f ms)\n", t, writeOps[op].numEvents, late);
 		}
 		r = clientrequest(ftSocket, &request, &response);
 
@@ -300,49 +296,44 @@ void run() {
 		free(response);
 
 		if (writeOps[op].numSamples > 0) {
-			/* pre-load next bunch of samples */
-			for (nextSampleOp = op+1; nextSampleOp < numWriteOps; nextSampleOp++) {
-				if (writeOps[nextSampleOp].numSamples > 0) break;
-			}
-			if (nextSampleOp < numWriteOps) {
-				INT64_T numSamplesRead;
-				char *sampleBuffer;
-
-				ddef->nchans    = header->nchans;
-				ddef->data_type = header->data_type;
-				ddef->bufsize   = writeOps[nextSampleOp].numSamples * bytesPerSample;
-				ddef->nsamples  = writeOps[nextSampleOp].numSamples;
-
-				sampleBuffer = (char *) (ddef+1);
-
-				numSamplesRead = fread(sampleBuffer, bytesPerSample, writeOps[nextSampleOp].numSamples, fSamples);
-				if (numSamplesRead < writeOps[nextSampleOp].numSamples) {
-					if (curSamplesFile == numSamplesFiles) {
-						fprintf(stderr, "Error reading samples!\n");
-						break;
-					} else {
-						int remain = writeOps[nextSampleOp].numSamples - numSamplesRead;
-
-						fclose(fSamples);
-						if (openSamplesFile(directory, ++curSamplesFile) < 0) break;
-
-						sampleBuffer += bytesPerSample * numSamplesRead;
-						numSamplesRead = fread(sampleBuffer, bytesPerSample, remain, fSamples);
-						if (numSamplesRead < remain) {
-							fprintf(stderr, "Error reading samples!\n");
-							break;
-						}
-					}
-				}
-			}
+			/* the reader thread can now load the block after the next one */
+			releaseSamples(slot);
+			slot = 1 - slot;
 		}
+
+		numBlocks++;
+		sumLate += late;
+		if (late > maxLate) maxLate = late;
+		if (late > 1.0) numLate++;
+	}
+
+	pthread_mutex_lock(&reader.mutex);
+	reader.stop = 1;
+	pthread_cond_broadcast(&reader.cond);
+	pthread_mutex_unlock(&reader.mutex);
+	pthread_join(readerHandle, NULL);
+	pthread_cond_destroy(&reader.cond);
+	pthread_mutex_destroy(&reader.mutex);
+	free(reader.ddef[0]);
+	free(reader.ddef[1]);
+
+	if (op < numWriteOps) {
+		fprintf(stderr, "Stopped after %i of %i write operations\n", op, numWriteOps);
+	}
+	if (asFastAsPossible) {
+		t = 1.0e-9 * (double) (ft_clock_ns() - T0);
+		printf("Done! Wrote %i blocks in %.3f s\n", numBlocks, t);
+	} else if (numBlocks > 0) {
+		printf("Done! Timing error per block: mean %.3f ms, max %.3f ms, %i of %i blocks more than 1 ms late\n",
+			sumLate / numBlocks, maxLate, numLate, numBlocks);
+	} else {
+		printf("Done!\n");
 	}
-	printf("Done!\n");
 }
 
 int main(int argc, char **argv) {
 	char hostname[MAXLINE] = "localhost";
-	int port, nops;
+	int port, nops, err;
 	double speed = 1.0;
 
 	#if defined(WIN32) && !defined(COMPILER_MINGW)
@@ -365,35 +356,28 @@ int main(int argc, char **argv) {
 	}
 
 	if (argc>4) {
-		speed = strtod(argv[4], NULL);
+		if (strcmp(argv[4], "max") == 0) {
+			asFastAsPossible = 1;
+		} else {
+			speed = strtod(argv[4], NULL);
+		}
 		if (speed <= 0.0) {
-			fprintf(stderr, "4th argument, if given, must be positive speedup-factor\n");
+			fprintf(stderr, "4th argument, if given, must be positive speedup-factor or 'max'\n");
 			exit(1);
 		}
 	}
 
-	if (readHeader(directory) < 0) {
-		exit(1);
-	}
-	bytesPerSample = header->nchans * wordsize_from_type(header->data_type);
-
-	sizeSamples = openSamplesFile(directory, 0);
-	if (sizeSamples < 0) {
+	storage = ft_storage_open(directory, &err);
+	if (storage == NULL) {
 		exit(1);
 	}
-	fclose(fSamples);
-	while (1) {
-		INT64_T addSize = openSamplesFile(directory, numSamplesFiles);
-		if (addSize < 0) break;
-		numSamplesFiles++;
-		sizeSamples += addSize;
-		fclose(fSamples);
+	header = ft_storage_read_header(storage);
+	headerSize = storage->headerSize;
+	bytesPerSample = storage->sampleSize;
+	printf("Total size of samples: %li MB\n", (long) (((INT64_T) storage->numSamples * bytesPerSample) >> 20));
+	if (storage->numEvents > 0) {
+		eventBuffer = (const char *) ft_storage_read_events(storage, 0, storage->numEvents - 1, NULL);
 	}
-	printf("Total size of samples: %li MB\n", (long) (sizeSamples >> 20));
-	/* re-open first samples file */
-	if (openSamplesFile(directory, 0) < 0) exit(1);
-
-	if (readAllEvents(directory) < 0) exit(1);
 
 	nops = readTiming(directory, speed);
 	if (nops < 0) {
@@ -403,33 +387,33 @@ int main(int argc, char **argv) {
 		printf("No samples or events defined\n");
 		exit(0);
 	} else {
-		INT64_T siz = totalSamples * (INT64_T) bytesPerSample;
-
 		printf("Total samples: %li  events: %li\n", (long) totalSamples, (long) totalEvents);
 
-		if (siz > sizeSamples) {
+		if (totalSamples > storage->numSamples) {
 			fputs("Error: 'samples' file(s) too small for given 'timing' definition\n", stderr);
 			exit(1);
 		}
-		if (siz < sizeSamples) {
-			printf("Warning: 'samples' file contains %li bytes, but 'timing' definition specifies %li bytes\n", (long) sizeSamples, (long) siz);
+		if (totalSamples < storage->numSamples) {
+			printf("Warning: 'samples' file contains %li samples, but 'timing' definition specifies %li samples\n", (long) storage->numSamples, (long) totalSamples);
 		}
 	}
 
-	printf("Trying to connect to %s:%i...\n", hostname, port);
-	ftSocket = open_connection(hostname, port);
+	if (strcmp(hostname, "-") == 0) {
+		printf("Starting a buffer server on port %i...\n", port);
+	} else {
+		printf("Trying to connect to %s:%i...\n", hostname, port);
+	}
+	ftSocket = ft_open_buffer(hostname, port, &ftServer);
 	if (ftSocket < 0) {
 		exit(1);
 	}
 
 	run();
 
-	close_connection(ftSocket);
+	ft_close_buffer(ftSocket, ftServer);
 
-	fclose(fSamples);
 	free(writeOps);
-	free(header);
-	if (eventBuffer != NULL) free(eventBuffer);
+	ft_storage_close(storage);
 
 	#if defined(WIN32) && !defined(COMPILER_MINGW)
 	timeEndPeriod(1);
@@ -12,6 +12,7 @@
 
 #include "buffer.h"
 #include "socketserver.h"
+#include "atomicutil.h"
 #include <ft_storage.h>
 
 #if !defined(PLATFORM_WINDOWS) && defined(COMPILER_MINGW)
@@ -21,7 +22,12 @@
 #include <sys/time.h>
 #endif
 
-#define QUEUE_SIZE  100
+/* number of write operations that can be queued for the thread that saves them */
+#define QUEUE_SIZE  4096
+/* maximum number of write operations that are saved at once */
+#define BATCH_SIZE  256
+/* how long the saving thread sleeps if there is nothing to do, in microseconds */
+#define SAVE_INTERVAL  10000
 
 char content_descr[]=
 "This directory contains FieldTrip buffer data in V1 format.\n" \
@@ -39,15 +45,29 @@ char content_descr[]=
 "E 2 0.124\n" \
 "means that 124ms after writing the header, 2 events were written.\n";
 
+/* The request handler runs in the threads of the buffer server, and only puts the
+   successful write operations in a queue. The main thread takes them out in batches,
+   reads the samples and events back from the buffer, and saves them. The queue is a
+   bounded ring without locks: a handler reserves a position by incrementing qWritePos,
+   and the sequence of an element tells whether it is free (sequence == position) or
+   filled (sequence == position+1).
+*/
 typedef struct {
-	volatile int command;
+	volatile UINT32_T sequence;
+	int command;
 	int quantity;
 	double t;
 } QueueElement;
 
 QueueElement queue[QUEUE_SIZE];
-int qWritePos = 0, qReadPos = 0;
-pthread_mutex_t qMutex = PTHREAD_MUTEX_INITIALIZER;
+volatile UINT32_T qWritePos = 0;
+UINT32_T qReadPos = 0;
+
+/* to see whether the saving thread keeps up, also with the capacity of the buffer */
+volatile UINT32_T samplesQueued = 0, eventsQueued = 0;
+UINT32_T samplesSaved = 0, eventsSaved = 0;
+UINT32_T samplesKept = MAXNUMSAMPLE;
+int alarmQueue = 0, alarmSamples = 0, alarmEvents = 0;
 
 ft_buffer_server_t *S;
 ft_storage_t *OS = NULL;
@@ -60,20 +80,53 @@ int eventCounter = 0;
 char endianness[10];
 
 double getCurrentTime() {
-#if defined(PLATFORM_WINDOWS) && !defined(COMPILER_MINGW)
-	return timeGetTime() * 0.001;
-#else
-	struct timeval tv;
-	gettimeofday(&tv, NULL);
-	return tv.tv_sec + tv.tv_usec*1e-6;
-#endif
+	return ft_clock_seconds();
+}
+
+/* adds a write operation to the queue, returns -1 if it is full */
+int queue_push(int command, int quantity, double t) {
+	QueueElement *E;
+	UINT32_T pos;
+
+	while (1) {
+		pos = qWritePos;
+		E = &queue[pos % QUEUE_SIZE];
+		MEMORY_BARRIER();
+		if (E->sequence == pos) {
+			if (ATOMIC_CAS32(&qWritePos, pos, pos+1)) break;
+		} else if ((INT32_T) (E->sequence - pos) < 0) {
+			/* the element still belongs to the previous round */
+			return -1;
+		}
+	}
+	E->command  = command;
+	E->quantity = quantity;
+	E->t        = t;
+	if (command == PUT_DAT) ATOMIC_ADD32(&samplesQueued, quantity);
+	if (command == PUT_EVT) ATOMIC_ADD32(&eventsQueued, quantity);
+	MEMORY_BARRIER();
+	E->sequence = pos+1;
+	return 0;
+}
+
+/* takes the next write operation out of the queue, returns 0 if it is empty */
+int queue_pop(QueueElement *out) {
+	QueueElement *E = &queue[qReadPos % QUEUE_SIZE];
+
+	if (E->sequence != qReadPos+1) return 0;
+	MEMORY_BARRIER();
+	*out = *E;
+	MEMORY_BARRIER();
+	E->sequence = qReadPos + QUEUE_SIZE;
+	qReadPos++;
+	return 1;
 }
 
 int my_request_handler(const message_t *request, message_t **response, void *user_data) {
 
 	double tAbs, tRel;
 	int res;
-	int quantity;
+	int quantity = 0;
 
 	tAbs = getCurrentTime();
 	tRel = tAbs - timePutHeader;
@@ -148,16 +201,9 @@ int my_request_handler(const message_t *request, message_t **response, void *use
 				break;
 			case PUT_OK:
 				printf("OK\n");
-				pthread_mutex_lock(&qMutex);
-				if (queue[qWritePos].command == 0) {
-					queue[qWritePos].command = request->def->command;
-					queue[qWritePos].quantity = quantity;
-					queue[qWritePos].t = tRel;
-					if (++qWritePos == QUEUE_SIZE) qWritePos = 0;
-				} else {
-					printf("WARNING - saving thread does not keep up!\n");
+				if (queue_push(request->def->command, quantity, tRel) != 0) {
+					printf("ERROR - saving thread does not keep up, the queue is full!\n");
 				}
-				pthread_mutex_unlock(&qMutex);
 				break;
 			case GET_OK:
 			case FLUSH_OK:
@@ -234,6 +280,10 @@ int write_header_to_disk() {
 	}
 
 	hdef = (headerdef_t *) response->buf;
+	if (wordsize_from_type(hdef->data_type) * hdef->nchans > 0) {
+		samplesKept = MAXNUMBYTE / (wordsize_from_type(hdef->data_type) * hdef->nchans);
+		if (samplesKept > MAXNUMSAMPLE) samplesKept = MAXNUMSAMPLE;
+	}
 
 	setCounter++;
 	sampleCounter = eventCounter = 0;
@@ -251,16 +301,23 @@ cleanup:
 }
 
 
-int write_samples_to_disk(int nsamps, double t) {
+/* saves the samples of the PUT_DAT operations ops[0] ... ops[nops-1] at once */
+int write_samples_to_disk(const QueueElement *ops, int nops) {
 	messagedef_t reqdef;
 	datasel_t ds;
 	message_t request;
 	message_t *response;
 	datadef_t *ddef;
-	int r;
+	int i, r, nsamps = 0;
+
+	for (i=0;i<nops;i++) nsamps += ops[i].quantity;
+	samplesSaved += nsamps;
+	if (nsamps == 0) return 0;
 
 	ds.begsample = sampleCounter;
 	ds.endsample = sampleCounter + nsamps - 1;
+	/* if these samples are lost, continue with the next ones */
+	sampleCounter += nsamps;
 	reqdef.version = VERSION;
 	reqdef.command = GET_DAT;
 	reqdef.bufsize = sizeof(ds);
@@ -269,19 +326,18 @@ int write_samples_to_disk(int nsamps, double t) {
 
 	r = dmarequest(&request, &response);
 	if (r!=0 || response == NULL || response->def == NULL || response->buf == NULL) {
-		fprintf(stderr, "ERROR: Cannot retrieve samples for writing to disk\n");
+		fprintf(stderr, "ERROR: Cannot retrieve %i samples for writing to disk\n", nsamps);
 		goto cleanup;
 	}
 
-	sampleCounter += nsamps;
-
 	ddef = (datadef_t *) response->buf;
 	r = ft_storage_add_samples(OS, nsamps, ddef+1);
-	if (r==0) {
+	/* the timing keeps the original blocks */
+	for (i=0;i<nops && r==0;i++) {
 		ft_timing_element_t te;
-		te.numSamples = nsamps;
+		te.numSamples = ops[i].quantity;
 		te.numEvents = 0;
-		te.time = t;
+		te.time = ops[i].t;
 		r = ft_storage_add_timing(OS, &te);
 	}
 
@@ -294,15 +350,22 @@ cleanup:
 	return r;
 }
 
-int write_events_to_disk(int nevs, double t) {
+/* saves the events of the PUT_EVT operations ops[0] ... ops[nops-1] at once */
+int write_events_to_disk(const QueueElement *ops, int nops) {
 	messagedef_t reqdef;
 	eventsel_t es;
 	message_t request;
 	message_t *response;
-	int r;
+	int i, r, nevs = 0;
+
+	for (i=0;i<nops;i++) nevs += ops[i].quantity;
+	eventsSaved += nevs;
+	if (nevs == 0) return 0;
 
 	es.begevent = eventCounter;
 	es.endevent = eventCounter + nevs - 1;
+	/* if these events are lost, continue with the next ones */
+	eventCounter += nevs;
 	reqdef.version = VERSION;
 	reqdef.command = GET_EVT;
 	reqdef.bufsize = sizeof(es);
@@ -311,18 +374,16 @@ int write_events_to_disk(int nevs, double t) {
 
 	r = dmarequest(&request, &response);
 	if (r!=0 || response == NULL || response->def == NULL || response->buf == NULL) {
-		fprintf(stderr, "ERROR: Cannot retrieve events for writing to disk\n");
+		fprintf(stderr, "ERROR: Cannot retrieve %i events for writing to disk\n", nevs);
 		goto cleanup;
 	}
 
-	eventCounter += nevs;
-
 	r = ft_storage_add_events(OS, response->def->bufsize, response->buf);
-	if (r==0) {
+	for (i=0;i<nops && r==0;i++) {
 		ft_timing_element_t te;
 		te.numSamples = 0;
-		te.numEvents = nevs;
-		te.time = t;
+		te.numEvents = ops[i].quantity;
+		te.time = ops[i].t;
 		r = ft_storage_add_timing(OS, &te);
 	}
 cleanup:
@@ -336,8 +397,32 @@ cleanup:
 
 
 
+/* warns (once, until it is fine again) if the saving thread lags so far behind that
+   the queue could run full, or that the buffer could drop samples or events before
+   they are saved */
+void check_fill_level(void) {
+	UINT32_T fill = qWritePos - qReadPos;
+	UINT32_T samplesLag = samplesQueued - samplesSaved;
+	UINT32_T eventsLag = eventsQueued - eventsSaved;
+
+	if (fill > QUEUE_SIZE/2 && !alarmQueue) {
+		fprintf(stderr, "WARNING - %u of %u write operations are waiting to be saved\n", fill, QUEUE_SIZE);
+	}
+	alarmQueue = fill > QUEUE_SIZE/4 && (alarmQueue || fill > QUEUE_SIZE/2);
+
+	if (samplesLag > samplesKept/2 && !alarmSamples) {
+		fprintf(stderr, "WARNING - %u samples are waiting to be saved, the buffer keeps only %u\n", samplesLag, samplesKept);
+	}
+	alarmSamples = samplesLag > samplesKept/4 && (alarmSamples || samplesLag > samplesKept/2);
+
+	if (eventsLag > MAXNUMEVENT/2 && !alarmEvents) {
+		fprintf(stderr, "WARNING - %u events are waiting to be saved, the buffer keeps only %i\n", eventsLag, MAXNUMEVENT);
+	}
+	alarmEvents = eventsLag > MAXNUMEVENT/4 && (alarmEvents || eventsLag > MAXNUMEVENT/2);
+}
+
 int main(int argc, char *argv[]) {
-	int port;
+	int port, i;
 	char *name = NULL;
 	union {
 		short word;
@@ -376,7 +461,7 @@ int main(int argc, char *argv[]) {
 		port = 1972;
 	}
 
-	memset(queue, sizeof(queue), 0);
+	for (i=0;i<QUEUE_SIZE;i++) queue[i].sequence = i;
 
 	if (!write_contents()) goto cleanup;
 
@@ -385,12 +470,23 @@ int main(int argc, char *argv[]) {
 
 	signal(SIGINT, abortHandler);
 	while (keepRunning) {
-		if (queue[qReadPos].command == 0) {
-			usleep(1000);
-		} else {
-			switch(queue[qReadPos].command) {
+		QueueElement batch[BATCH_SIZE];
+		int n = 0, j;
+
+		while (n < BATCH_SIZE && queue_pop(&batch[n])) n++;
+		if (n == 0) {
+			usleep(SAVE_INTERVAL);
+			continue;
+		}
+		check_fill_level();
+
+		for (i=0;i<n;i=j) {
+			/* consecutive operations of the same kind are saved at once */
+			for (j=i+1;j<n && batch[j].command == batch[i].command && batch[i].command != PUT_HDR;j++);
+
+			switch(batch[i].command) {
 				case PUT_HDR:
-					if (setCounter>0) ft_storage_close(OS);
+					if (setCounter>0 && OS!=NULL) ft_storage_close(OS);
 					write_header_to_disk();
 					if (OS==NULL) {
 						fprintf(stderr, "!!!!!!!!!!!!! WARNING !!!!!!!!!!\n");
@@ -399,14 +495,20 @@ int main(int argc, char *argv[]) {
 					}
 					break;
 				case PUT_DAT:
-					if (OS) write_samples_to_disk(queue[qReadPos].quantity, queue[qReadPos].t);
+					if (OS) {
+						write_samples_to_disk(batch+i, j-i);
+					} else {
+						for (;i<j;i++) samplesSaved += batch[i].quantity;
+					}
 					break;
 				case PUT_EVT:
-					if (OS) write_events_to_disk(queue[qReadPos].quantity, queue[qReadPos].t);
+					if (OS) {
+						write_events_to_disk(batch+i, j-i);
+					} else {
+						for (;i<j;i++) eventsSaved += batch[i].quantity;
+					}
 					break;
 			}
-			queue[qReadPos].command = 0;
-			if (++qReadPos == QUEUE_SIZE) qReadPos = 0;
 		}
 	}
 	printf("Ctrl-C pressed -- stopping buffer server...\n");
@@ -0,0 +1,446 @@
+/* Simple serial port library for Windows and Linux, written in plain C
+ * (C) 2008 Stefan Klanke
+ */
+
+#include <serial.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "platform.h"
+#include "compiler.h"
+#include "platform_includes.h"
+
+static const char serialErrOpen[]="Could not open the serial port.\n";
+static const char serialErrGetP[]="Could not read serial port parameters.\n";
+
+#if defined(PLATFORM_WINDOWS)
+
+#include <windows.h>
+
+/* Waits for an overlapped operation, which is bounded by the timeouts of the port */
+static int serialOverlappedResult(SerialPort *SP, OVERLAPPED *ov, BOOL ok, DWORD *num) {
+  if (!ok) {
+    if (GetLastError() != ERROR_IO_PENDING) return -1;
+    if (!GetOverlappedResult(SP->comPort, ov, num, TRUE)) return -1;
+  }
+  return *num;
+}
+
+int serialOpenByNumber(SerialPort *SP, int port) {
+  char device[32];
+
+  sprintf(device,"\\\\.\\COM%d",port);
+
+  return serialOpenByName(SP, device);
+}
+
+int serialOpenByName(SerialPort *SP, const char *device) {
+  memset(SP, 0, sizeof(SerialPort));
+
+  SP->comPort = CreateFile(device, GENERIC_READ|GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+  if (SP->comPort == INVALID_HANDLE_VALUE) {
+    fputs(serialErrOpen,stderr);
+    SP->comPort = NULL;
+    return 0;
+  }
+
+  if (!GetCommState(SP->comPort, &(SP->oldDCB))) {
+    fputs(serialErrGetP,stderr);
+    CloseHandle(SP->comPort);
+    SP->comPort=NULL;
+    return 0;
+  }
+  if (!GetCommTimeouts(SP->comPort, &(SP->oldTimeOuts))) {
+    fputs(serialErrGetP,stderr);
+    CloseHandle(SP->comPort);
+    SP->comPort=NULL;
+    return 0;
+  }
+
+  /* manual-reset events, as required by GetOverlappedResult */
+  SP->readOv.hEvent  = CreateEvent(NULL, TRUE, FALSE, NULL);
+  SP->writeOv.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+  SP->waitOv.hEvent  = CreateEvent(NULL, TRUE, FALSE, NULL);
+  SetCommMask(SP->comPort, EV_RXCHAR);
+  /* a larger driver queue, so the input survives while the application is busy */
+  SetupComm(SP->comPort, 65536, 4096);
+
+  PurgeComm(SP->comPort, PURGE_RXCLEAR | PURGE_TXCLEAR);
+  return 1;
+}
+
+
+int serialSetParameters(SerialPort *SP, int baudrate, int bits, int parity, int stops, int timeout) {
+  DCB newDCB;
+  COMMTIMEOUTS newTO;
+
+  memcpy(&newDCB, &(SP->oldDCB), sizeof(DCB));
+
+  newDCB.BaudRate = baudrate;
+  newDCB.ByteSize = bits;
+  if (parity==1) {
+    newDCB.Parity = EVENPARITY;
+    newDCB.fParity = TRUE;
+  } else {
+    newDCB.Parity = NOPARITY;
+    newDCB.fParity = FALSE;
+  }
+  /*
+     newDCB.fOutX = FALSE;
+     newDCB.fInX = FALSE;
+     newDCB.fTXContinueOnXoff = TRUE;
+     newDCB.fNull = FALSE;
+   */
+  switch(stops) {
+    case 1:
+      newDCB.StopBits = ONESTOPBIT;
+      break;
+    case 2:
+      newDCB.StopBits = TWOSTOPBITS;
+      break;
+    default:
+      newDCB.StopBits = ONESTOPBIT;
+  }
+
+  if (!SetCommState(SP->comPort, &newDCB)) {
+    fprintf(stderr,"Couldn't change serial port settings, error = %li\n",GetLastError());
+    return 0;
+  }
+
+  if (timeout > 0) {
+    /* return as soon as any characters have arrived, or after the timeout */
+    newTO.ReadIntervalTimeout = MAXDWORD;
+    newTO.ReadTotalTimeoutMultiplier = MAXDWORD;
+    newTO.ReadTotalTimeoutConstant = timeout*100; /* ms */
+  } else {
+    /* return right away with the characters that have arrived already */
+    newTO.ReadIntervalTimeout = MAXDWORD;
+    newTO.ReadTotalTimeoutMultiplier = 0;
+    newTO.ReadTotalTimeoutConstant = 0;
+  }
+  newTO.WriteTotalTimeoutMultiplier = 0;
+  newTO.WriteTotalTimeoutConstant = timeout*100; /* ms */
+
+  if (!SetCommTimeouts(SP->comPort, &newTO)) {
+    fputs("Couldn't set serial port timeouts\n",stderr);
+    return 0;
+  }
+  return 1;
+}
+
+int serialClose(SerialPort *SP) {
+  if (SP->comPort == NULL) return 0;
+
+  /* also completes a pending WaitCommEvent */
+  SetCommMask(SP->comPort, 0);
+  PurgeComm(SP->comPort, PURGE_RXCLEAR | PURGE_TXCLEAR);
+
+  SetCommState(SP->comPort, &(SP->oldDCB));
+  SetCommTimeouts(SP->comPort, &(SP->oldTimeOuts));
+  CloseHandle(SP->comPort);
+  CloseHandle(SP->readOv.hEvent);
+  CloseHandle(SP->writeOv.hEvent);
+  CloseHandle(SP->waitOv.hEvent);
+  SP->comPort = NULL;
+  /* TODO: think about error values */
+  return 1;
+}
+
+int serialWrite(SerialPort *SP, int size, void *buffer) {
+  DWORD numWritten = 0;
+  BOOL ok = WriteFile(SP->comPort, buffer, size, &numWritten, &SP->writeOv);
+
+  return serialOverlappedResult(SP, &SP->writeOv, ok, &numWritten);
+}
+
+void serialFlushInput(SerialPort *SP) {
+  PurgeComm(SP->comPort, PURGE_RXCLEAR);
+}
+
+void serialFlushOutput(SerialPort *SP) {
+  PurgeComm(SP->comPort, PURGE_TXCLEAR);
+}
+
+int serialRead(SerialPort *SP, int size, void *buffer) {
+  DWORD numRead = 0;
+  BOOL ok = ReadFile(SP->comPort, buffer, size, &numRead, &SP->readOv);
+
+  return serialOverlappedResult(SP, &SP->readOv, ok, &numRead);
+}
+
+int serialInputPending(SerialPort *SP) {
+  DWORD numErrors;
+  COMSTAT stat;
+
+  if (!ClearCommError(SP->comPort, &numErrors, &stat)) return -1;
+  if (numErrors > 0) return -1;
+  return stat.cbInQue;
+}
+
+int serialWaitInput(SerialPort *SP, int milliseconds) {
+  DWORD num;
+  int pending = serialInputPending(SP);
+
+  if (pending != 0) return (pending > 0) ? 1 : -1;
+
+  /* a WaitCommEvent that timed out the last time is still outstanding, and is reused */
+  if (!SP->waitPending) {
+    SP->waitMask = 0;
+    if (WaitCommEvent(SP->comPort, &SP->waitMask, &SP->waitOv)) {
+      return 1;
+    }
+    if (GetLastError() != ERROR_IO_PENDING) return -1;
+    SP->waitPending = 1;
+  }
+  switch (WaitForSingleObject(SP->waitOv.hEvent, milliseconds)) {
+    case WAIT_OBJECT_0:
+      SP->waitPending = 0;
+      if (!GetOverlappedResult(SP->comPort, &SP->waitOv, &num, FALSE)) return -1;
+      return 1;
+    case WAIT_TIMEOUT:
+      return 0;
+    default:
+      return -1;
+  }
+}
+
+#else /* Linux, POSIX */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/serial.h>
+#endif
+
+int serialOpenByNumber(SerialPort *SP, int port) {
+  char device[16];
+
+  snprintf(device,16,"/dev/ttyS%d",port);
+  return serialOpenByName(SP, device);
+}
+
+
+int serialOpenByName(SerialPort *SP, const char *device) {
+
+  /*
+   * Without O_NDELAY the open call can block until the carrier is detected,
+   * which fails to work for the openbci implementation. The reads should block
+   * according to VMIN and VTIME however, so the flag is cleared again below.
+   */
+  SP->comPort = open(device, O_RDWR | O_NOCTTY | O_NDELAY);
+
+  if (SP->comPort < 0) {
+    fputs(serialErrOpen, stderr);
+    SP->comPort=0;
+    return 0;
+  }
+  fcntl(SP->comPort, F_SETFL, fcntl(SP->comPort, F_GETFL) & ~O_NONBLOCK);
+
+  if (tcgetattr(SP->comPort, &(SP->oldTermios))) {
+    perror("tcgetattr");
+    fputs(serialErrGetP, stderr);
+    close(SP->comPort);
+    SP->comPort=0;
+    return 0;
+  }
+#ifdef __linux__
+  {
+    /* ask the driver not to hold back incoming characters, e.g. the
+       latency timer of FTDI USB adapters, this is ignored if not supported */
+    struct serial_struct ss;
+    if (ioctl(SP->comPort, TIOCGSERIAL, &ss) == 0) {
+      ss.flags |= ASYNC_LOW_LATENCY;
+      ioctl(SP->comPort, TIOCSSERIAL, &ss);
+    }
+  }
+#endif
+  tcflush(SP->comPort, TCIOFLUSH);
+  return 1;
+}
+
+
+int serialSetParameters(SerialPort *SP, int baudrate, int bits, int parity, int stops, int timeout) {
+  struct termios newtio;
+  speed_t speed;
+
+  memset(&newtio, 0, sizeof(newtio)); /* clear struct for new port settings */
+
+  newtio.c_cflag = CLOCAL | CREAD;
+
+  if (stops>1) {
+    newtio.c_cflag |= CSTOPB;
+  }
+
+  switch(baudrate) {
+    case    300: speed = B300; break;
+    case    600: speed = B600; break;
+    case   1200: speed = B1200; break;
+    case   2400: speed = B2400; break;
+    case   4800: speed = B4800; break;
+    case   9600: speed = B9600; break;
+    case  19200: speed = B19200; break;
+    case  38400: speed = B38400; break;
+    case  57600: speed = B57600; break;
+    case 115200: speed = B115200; break;
+    case 230400: speed = B230400; break;
+#ifdef B460800
+    case 460800: speed = B460800; break;
+#endif
+#ifdef B921600
+    case 921600: speed = B921600; break;
+#endif
+    default: fputs("Unrecognized baudrate\n.",stderr); return 0;
+  }
+  cfsetispeed(&newtio, speed);
+  cfsetospeed(&newtio, speed);
+
+  switch(bits) {
+    case 5: newtio.c_cflag |= CS5; break;
+    case 6: newtio.c_cflag |= CS6; break;
+    case 7: newtio.c_cflag |= CS7; break;
+    case 8: newtio.c_cflag |= CS8; break;
+    default: fputs("Unrecognized number of bits\n.",stderr); return 0;
+  }
+
+  if (parity) {
+    newtio.c_cflag |= PARENB;
+  }
+
+  newtio.c_iflag = IGNBRK | IXOFF;
+  newtio.c_oflag = 0;
+  newtio.c_lflag = 0;
+
+  newtio.c_cc[VTIME]    = timeout;     /* deciseconds */
+  newtio.c_cc[VMIN ]    = 0;
+
+  if (tcsetattr(SP->comPort, TCSANOW, &newtio)) {
+    perror("tcsetattr");
+    fputs("Couldn't change serial port settings\n",stderr);
+    return 0;
+  }
+  return 1;
+}
+
+int serialClose(SerialPort *SP) {
+
+  tcflush(SP->comPort, TCIOFLUSH);
+  tcsetattr(SP->comPort,TCSANOW,&(SP->oldTermios));
+  close(SP->comPort);
+  return 1; /* TODO: think about error values */
+}
+
+int serialWrite(SerialPort *SP, int size, void *buffer) {
+  int numWrite = write(SP->comPort, buffer, size);;
+
+  return numWrite;
+}
+
+int serialRead(SerialPort *SP, int size, void *buffer) {
+  return read(SP->comPort, buffer, size);
+}
+
+void serialFlushInput(SerialPort *SP) {
+  tcflush(SP->comPort, TCIFLUSH);
+}
+
+void serialFlushOutput(SerialPort *SP) {
+  tcflush(SP->comPort, TCOFLUSH);
+}
+
+int serialInputPending(SerialPort *SP) {
+  int bytesWaiting, res;
+  res = ioctl(SP->comPort, FIONREAD, &bytesWaiting);
+  if (res < 0) return res;
+  return bytesWaiting;
+}
+
+int serialWaitInput(SerialPort *SP, int milliseconds) {
+  struct pollfd pfd;
+  int res;
+
+  pfd.fd = SP->comPort;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+
+  res = poll(&pfd, 1, milliseconds);
+  if (res < 0) return (errno == EINTR) ? 0 : -1;
+  if (res == 0) return 0;
+  if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) return -1;
+  return 1;
+}
+
+#endif
+
+
+int serialStreamInit(SerialStream *S, SerialPort *SP, int size) {
+  S->port = SP;
+  S->buf = (unsigned char *) malloc(size);
+  S->size = (S->buf != NULL) ? size : 0;
+  S->start = S->end = 0;
+  S->skipped = 0;
+  return (S->buf != NULL);
+}
+
+void serialStreamFree(SerialStream *S) {
+  free(S->buf);
+  S->buf = NULL;
+  S->size = S->start = S->end = 0;
+}
+
+int serialStreamFill(SerialStream *S, int milliseconds) {
+  int pending, space, numRead;
+
+  /* the unparsed bytes are less than a packet, so this is a small move */
+  if (S->start > 0) {
+    memmove(S->buf, S->buf + S->start, S->end - S->start);
+    S->end -= S->start;
+    S->start = 0;
+  }
+  space = S->size - S->end;
+  if (space == 0) {
+    fputs("Serial receive buffer is full\n", stderr);
+    return -1;
+  }
+
+  pending = serialInputPending(S->port);
+  if (pending < 0) return -1;
+  if (pending == 0) {
+    int res = serialWaitInput(S->port, milliseconds);
+    if (res <= 0) return res;
+    pending = serialInputPending(S->port);
+    if (pending < 0) return -1;
+    if (pending == 0) return 0;
+  }
+
+  /* this returns right away, since the bytes have arrived already */
+  numRead = serialRead(S->port, (pending < space) ? pending : space, S->buf + S->end);
+  if (numRead < 0) return -1;
+  S->end += numRead;
+  return numRead;
+}
+
+const unsigned char *serialStreamNext(SerialStream *S, serialFrameFunc frame, void *user, int *length) {
+  while (S->start < S->end) {
+    const unsigned char *data = S->buf + S->start;
+    int len = frame(data, S->end - S->start, user);
+
+    if (len > 0) {
+      S->start += len;
+      *length = len;
+      return data;
+    }
+    if (len == 0) break;
+    /* not the start of a packet, look from the next byte */
+    S->start++;
+    S->skipped++;
+  }
+  return NULL;
+}
@@ -0,0 +1,100 @@
+/* Simple serial port library for Windows and Linux, written in plain C
+ * (C) 2008 Stefan Klanke
+ *
+ * This is shared by the acquisition tools for serial devices, e.g.
+ * openbci2ft, modeeg2ft, thinkgear2ft and serial2event.
+ */
+
+#ifndef __SERIAL_H
+#define __SERIAL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#ifdef WIN32
+
+#include <windows.h>
+
+typedef struct {
+   HANDLE comPort;
+   DCB oldDCB;
+   COMMTIMEOUTS oldTimeOuts;
+   OVERLAPPED readOv, writeOv, waitOv;  /* the port is opened for overlapped I/O */
+   DWORD waitMask;
+   int waitPending;                     /* WaitCommEvent has not completed yet */
+} SerialPort;
+
+#else
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+typedef struct {
+   int comPort;
+   struct termios oldTermios;
+} SerialPort;
+
+#endif
+
+int serialOpenByNumber(SerialPort *SP, int port);
+int serialOpenByName(SerialPort *SP, const char *name);
+int serialClose(SerialPort *SP);
+int serialWrite(SerialPort *SP, int size, void *buffer);
+int serialRead(SerialPort *SP, int size, void *buffer);
+int serialSetParameters(SerialPort *SP, int baudrate, int bits, int parity, int stops, int timeout);
+void serialFlushInput(SerialPort *SP);
+void serialFlushOutput(SerialPort *SP);
+int serialInputPending(SerialPort *SP);
+
+/* Waits until input is available, for at most the given number of milliseconds.
+ * Returns 1 if there is input, 0 on timeout and -1 on error. This uses poll on
+ * POSIX systems and an overlapped WaitCommEvent on Windows, so it does not spin.
+ */
+int serialWaitInput(SerialPort *SP, int milliseconds);
+
+/* Receive buffer on top of a serial port. serialStreamFill reads everything
+ * the driver has queued in one call, and serialStreamNext hands out the
+ * packets in the buffer without copying them. The device specific part is
+ * the frame function, which is called with the unparsed bytes and returns
+ *   >0   the length of the packet that starts at data,
+ *    0   if the packet is not complete yet,
+ *   -1   if data does not start with a packet, the byte is then skipped.
+ * Bytes that are skipped while looking for the start of a packet are counted
+ * in 'skipped'. The size of the buffer should be several times that of the
+ * largest packet.
+ */
+typedef int (*serialFrameFunc)(const unsigned char *data, int length, void *user);
+
+typedef struct {
+   SerialPort *port;
+   unsigned char *buf;
+   int size;
+   int start;              /* first byte that has not been handed out */
+   int end;                /* one past the last byte that was read */
+   unsigned long skipped;
+} SerialStream;
+
+int serialStreamInit(SerialStream *S, SerialPort *SP, int size);
+void serialStreamFree(SerialStream *S);
+
+/* Waits for at most the given number of milliseconds if there is no input yet,
+ * and appends all pending bytes to the buffer. This moves the unparsed bytes to
+ * the start of the buffer, so pointers returned by serialStreamNext become
+ * invalid. Returns the number of bytes read, 0 on timeout and -1 on error.
+ */
+int serialStreamFill(SerialStream *S, int milliseconds);
+
+/* Returns a pointer to the next complete packet in the buffer and sets length,
+ * or returns NULL if there is none.
+ */
+const unsigned char *serialStreamNext(SerialStream *S, serialFrameFunc frame, void *user, int *length);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif
@@ -2,14 +2,29 @@
  * Errors when writing to the buffer will be printed, but otherwise ignored.
  * Please look at serial2event.conf for an example of how to set up the tool,
  * e.g., which port to listen on, and how to write events.
+ *
+ * A separate thread reads the serial port and notes the time at which every
+ * character came in. The main thread sends all characters that have come in
+ * since its last request as events in a single PUT_EVT. With sample=time,
+ * the sample of an event is found by mapping that time with GET_TIME, i.e.
+ * with the timestamps of the blocks that were written with PUT_DAT_T, instead
+ * of counting the characters.
  * (C) 2010 Stefan Klanke
  */
 #include <serial.h>
 #include <buffer.h>
+#include <socketserver.h>
+#include <ftclock.h>
 #include <signal.h>
 #include <pthread.h>
+#if defined(PLATFORM_LINUX) || defined(PLATFORM_OSX)
+#include <sys/time.h>
+#endif
 
 #define MAXLINE 256
+#define MAXREAD 64         /* characters per read from the serial port */
+#define QUEUESIZE 1024     /* characters that can wait for the main thread */
+#define MAXBATCH 64        /* events per PUT_EVT request */
 
 typedef struct {
 	char hostname[256];
@@ -23,6 +38,7 @@ typedef struct {
 	
 	int udp_port;
 	
+	int sample_time; /* non-zero: the sample is taken from the time at which the character came in */
 	INT32_T sample_start;
 	INT32_T sample_increase;
 	INT32_T offset, duration;
@@ -35,7 +51,10 @@ typedef struct {
 	char value_buf[MAXLINE];
 } SerialEventConfig;
 
-
+typedef struct {
+	UINT64_T time;     /* ft_clock_ns when the character came in */
+	char input;
+} SerialInput;
 
 int keepRunning = 1;
 int udp_socket;
@@ -44,6 +63,14 @@ INT32_T sample;
 pthread_mutex_t sampleMutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_t udpThread;
 
+/* characters that have been read, but not sent yet */
+SerialInput queue[QUEUESIZE];
+unsigned int queueHead = 0, queueTail = 0, queueDropped = 0;
+int readerFailed = 0;
+pthread_mutex_t queueMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t queueCond = PTHREAD_COND_INITIALIZER;
+pthread_t readerThread;
+
 
 /* The following function is used for turning a configuration file (see serial2event.conf)
    into a SerialEventConfig struct as defined above.
@@ -66,6 +93,7 @@ int parseConfig(SerialEventConfig *C, const char *filename) {
 	C->port = 1972;
 	C->character = -1;
 	C->set_value = 1;
+	C->sample_time = 0;
 	C->sample_start = 0;
 	C->sample_increase = 1;
 	C->offset = C->duration = 0;
@@ -138,6 +166,11 @@ int parseConfig(SerialEventConfig *C, const char *filename) {
 			char *p1, *p2;
 			long lva,lvb;
 	
+			if (!strcmp(value, "time")) {
+				C->sample_time = 1;
+				continue;
+			}
+			C->sample_time = 0;
 			p1 = strchr(value, '+');
 			if (p1!=NULL) {
 				*p1++ = 0; /* replace '+' by '\0' */
@@ -320,7 +353,11 @@ int parseConfig(SerialEventConfig *C, const char *filename) {
 	fclose(f);
 	
 	printf("\nEvent definition\n----------------\n");
-	printf("Sample....: %i + %i\n", C->sample_start, C->sample_increase);
+	if (C->sample_time) {
+		printf("Sample....: <from the time of the character>\n");
+	} else {
+		printf("Sample....: %i + %i\n", C->sample_start, C->sample_increase);
+	}
 	printf("Offset....: %i\n", C->offset);
 	printf("Duration..: %i\n", C->duration);
 	printf("Type......: ");
@@ -453,6 +490,82 @@ void *_udp_thread(void *arg) {
 }
 
 
+/** Main function of the thread that reads the serial port. Every character
+	gets the time at which it came in, and is put in the queue for the main
+	thread. Characters that come in together in one read are spaced by the
+	time it takes to transmit them, the last one being the most recent.
+*/
+void *_reader_thread(void *arg) {
+	SerialPort *SP = (SerialPort *) arg;
+	char input[MAXREAD];
+	/* start bit, data bits, parity bit and stop bits */
+	UINT64_T charTime = (UINT64_T) (1 + conf.databits + conf.parity + conf.stopbits) * 1000000000 / conf.baudrate;
+	
+	while (keepRunning) {
+		UINT64_T now;
+		int i, n;
+		
+		n = serialRead(SP, MAXREAD, input);
+		now = ft_clock_ns();
+		if (n<0) {
+			printf("Error while reading from serial port - exiting\n");
+			pthread_mutex_lock(&queueMutex);
+			readerFailed = 1;
+			pthread_cond_signal(&queueCond);
+			pthread_mutex_unlock(&queueMutex);
+			break;
+		}
+		if (n==0) continue; /* timeout - just wait longer */
+		
+		pthread_mutex_lock(&queueMutex);
+		for (i=0;i<n;i++) {
+			if (conf.character != -1 && conf.character != input[i]) {
+				printf("Ignoring input %c\n", input[i]);
+				continue;
+			}
+			if (queueHead - queueTail == QUEUESIZE) {
+				queueDropped++;
+				continue;
+			}
+			queue[queueHead % QUEUESIZE].time  = now - (n-1-i)*charTime;
+			queue[queueHead % QUEUESIZE].input = input[i];
+			queueHead++;
+		}
+		pthread_cond_signal(&queueCond);
+		pthread_mutex_unlock(&queueMutex);
+	}
+	return NULL;
+}
+
+/** Maps the time at which a character came in to a sample, using the
+	timestamps of the blocks in the buffer. Returns 0 on success.
+*/
+int sampleAtTime(int ftBuffer, UINT64_T time, INT32_T *sampleAtTime) {
+	messagedef_t reqdef;
+	message_t request, *response = NULL;
+	timepoint_t timepoint;
+	int status = -1;
+	
+	timepoint.time   = time;
+	timepoint.sample = 0;
+	timepoint.what   = FT_SAMPLE_AT_TIME;
+	reqdef.version = VERSION;
+	reqdef.command = GET_TIME;
+	reqdef.bufsize = sizeof(timepoint_t);
+	request.def = &reqdef;
+	request.buf = &timepoint;
+	
+	if (clientrequest(ftBuffer, &request, &response) < 0 || response == NULL) return -1;
+	if (response->def != NULL && response->def->command == GET_OK && response->def->bufsize == sizeof(timepoint_t)) {
+		*sampleAtTime = ((timepoint_t *) response->buf)->sample;
+		status = 0;
+	}
+	FREE(response->def);
+	FREE(response->buf);
+	free(response);
+	return status;
+}
+
 /** Function that is called when the user presses CTRL-C */
 void abortHandler(int sig) {
 	printf("Ctrl-C pressed -- stopping...\n");
@@ -462,12 +575,14 @@ void abortHandler(int sig) {
 int main(int argc, char **argv) {
 	SerialPort SP;
 	int ftBuffer = -1;
+	ft_buffer_server_t *ftServer = NULL;
 	eventdef_t *evdef;
 	UINT32_T sizetype, sizevalue, bufsize;
-	char *valBuf;
+	char *valBuf, *batch;
 	messagedef_t reqdef;
 	message_t request, *response;
 	char *confname;
+	int warnedTime = 0;
 	
 	if (argc < 2) {
 		confname = "serial2event.conf";
@@ -485,18 +600,18 @@ int main(int argc, char **argv) {
 	
 	bufsize = sizeof(eventdef_t) + sizetype + sizevalue;
 	evdef = (eventdef_t *) malloc(bufsize);
+	batch = (char *) malloc(MAXBATCH * bufsize);
 	
-	if (evdef == NULL) {
+	if (evdef == NULL || batch == NULL) {
 		printf("Out of memory\n");
 		exit(1);
 	}
 	
 	/* prepare fixed fields */
 	reqdef.version = VERSION;
-	reqdef.bufsize = bufsize;
 	reqdef.command = PUT_EVT;
 	request.def = &reqdef;
-	request.buf = evdef;
+	request.buf = batch;
 	
 	evdef->offset = conf.offset;
 	evdef->duration = conf.duration;
@@ -522,7 +637,8 @@ int main(int argc, char **argv) {
 		exit(1);
 	}
 	
-	ftBuffer = open_connection(conf.hostname, conf.port);
+	/* a minus as hostname spawns a buffer server in this process, see ft_open_buffer */
+	ftBuffer = ft_open_buffer(conf.hostname, conf.port, &ftServer);
 	if (ftBuffer < 0) {
 		printf("Connection to FieldTrip buffer failed.\n");
 		exit(1);
@@ -543,61 +659,106 @@ int main(int argc, char **argv) {
 	/* register CTRL-C handler */
 	signal(SIGINT, abortHandler);
 	
+	if (pthread_create(&readerThread, NULL, _reader_thread, &SP)) {
+		printf("Serial port thread could not be spawned.\n");
+		exit(1);
+	}
+	
 	printf("Starting to listen - press CTRL-C to quit\n");
 	while (keepRunning) {
-		char input;
-		int n;
-				
-		n = serialRead(&SP, 1, &input);
-		if (n<0) {
-			printf("Error while reading from serial port - exiting\n");
-			break;
+		SerialInput inputs[MAXBATCH];
+		unsigned int dropped;
+		int i, n, numInputs, numEvents = 0;
+		
+		/* wait for characters, up to 100 ms to notice CTRL-C */
+		pthread_mutex_lock(&queueMutex);
+		if (queueHead == queueTail && !readerFailed) {
+			struct timespec ts;
+			UINT64_T deadline;
+			struct timeval tv;
+			gettimeofday(&tv, NULL);
+			deadline = (UINT64_T) tv.tv_sec*1000000000 + (UINT64_T) tv.tv_usec*1000 + 100000000;
+			ts.tv_sec  = deadline / 1000000000;
+			ts.tv_nsec = deadline % 1000000000;
+			pthread_cond_timedwait(&queueCond, &queueMutex, &ts);
 		}
-		if (n==0) continue; /* timeout - just wait longer */
+		for (numInputs=0; numInputs<MAXBATCH && queueTail != queueHead; numInputs++) {
+			inputs[numInputs] = queue[queueTail % QUEUESIZE];
+			queueTail++;
+		}
+		dropped = queueDropped;
+		queueDropped = 0;
+		if (readerFailed) keepRunning = 0;
+		pthread_mutex_unlock(&queueMutex);
 		
-		/* we got one */
-		if (conf.character != -1 && conf.character != input) {
-			printf("Ignoring input %c\n", input);
-			continue;
+		if (dropped > 0) {
+			printf("Ignoring %u characters that came in faster than they could be sent\n", dropped);
 		}
 		
-		if (conf.set_value) *valBuf = input;
-		pthread_mutex_lock(&sampleMutex);
-		evdef->sample = sample;
-		pthread_mutex_unlock(&sampleMutex);
+		/* all characters that came in since the last request go out together */
+		for (i=0;i<numInputs;i++) {
+			eventdef_t *ev = (eventdef_t *) (batch + numEvents*bufsize);
+			
+			if (conf.set_value) *valBuf = inputs[i].input;
+			if (conf.sample_time) {
+				evdef->sample = EVENT_AUTO_SAMPLE;
+				if (sampleAtTime(ftBuffer, inputs[i].time, &evdef->sample) != 0 && !warnedTime) {
+					printf("Could not map the time to a sample, the buffer needs timestamps (PUT_DAT_T) - using the current sample instead\n");
+					warnedTime = 1;
+				}
+			} else {
+				pthread_mutex_lock(&sampleMutex);
+				evdef->sample = sample;
+				sample += conf.sample_increase;
+				pthread_mutex_unlock(&sampleMutex);
+				
+				if (evdef->sample < 0) {
+					printf("Ignoring negative sample (%i) event...\n", evdef->sample);
+					continue;
+				}
+			}
+			memcpy(ev, evdef, bufsize);
+			numEvents++;
+		}
+		if (numEvents == 0) continue;
 		
-		if (evdef->sample < 0) {
-			printf("Ignoring negative sample (%i) event...\n", evdef->sample);
-		} else {
-			n = tcprequest(ftBuffer, &request, &response);
+		reqdef.bufsize = numEvents*bufsize;
+		n = clientrequest(ftBuffer, &request, &response);
 		
-			if (n<0 || response == NULL) {
-				printf("Error in FieldTrip connection\n");
+		if (n<0 || response == NULL) {
+			printf("Error in FieldTrip connection\n");
+		} else {
+			if (response->def == NULL || response->def->command != PUT_OK) {
+				printf("FieldTrip server returned an error\n");
 			} else {
-				if (response->def == NULL || response->def->command != PUT_OK) {
-					printf("FieldTrip server returned an error\n");
-				} else {
-					printf("Sent off event (sample = %i, input = %c)\n", evdef->sample, input);
+				for (i=0;i<numEvents;i++) {
+					const eventdef_t *ev = (const eventdef_t *) (batch + i*bufsize);
+					if (conf.set_value) {
+						printf("Sent off event (sample = %i, input = %c)\n", ev->sample, *((const char *) (ev+1) + sizetype));
+					} else {
+						printf("Sent off event (sample = %i)\n", ev->sample);
+					}
 				}
-				FREE(response->def);
-				FREE(response->buf);
-				free(response);
 			}
+			FREE(response->def);
+			FREE(response->buf);
+			free(response);
 		}
-		
-		pthread_mutex_lock(&sampleMutex);
-		sample += conf.sample_increase;
-		pthread_mutex_unlock(&sampleMutex);
 	}
 	
+	/* the reader notices within the timeout of the serial port */
+	keepRunning = 0;
+	pthread_join(readerThread, NULL);
+	
 	if (udp_socket!=-1) {
 		pthread_join(udpThread, NULL);
 		closesocket(udp_socket);
 	}
 
-	close_connection(ftBuffer);
+	ft_close_buffer(ftBuffer, ftServer);
 	serialClose(&SP);
 	free(evdef);
+	free(batch);
 	
 	return 0;
 }
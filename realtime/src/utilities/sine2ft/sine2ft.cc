@@ -38,6 +38,7 @@ int port, numChannels, blockSize;
 float fSample;
 int blocksWritten;
 int ftSocket = -1;
+ft_buffer_server_t *ftServer = NULL;   // spawned if the hostname is a minus (-)
 int curSample;
 bool active = false;
 float phase = 0.0;
@@ -83,11 +84,12 @@ void startStopCallback(Fl_Widget *widget) {
 	char lab[20];
 
 	if (active) {
-		close_connection(ftSocket);
+		ft_close_buffer(ftSocket, ftServer);
 		infoBox->label("Not connected\n");
 		infoBox->redraw();
 
 		ftSocket = -1;
+		ftServer = NULL;
 		active = false;
 	} else {
 		port = atoi(inpPort->value());
@@ -120,7 +122,7 @@ void startStopCallback(Fl_Widget *widget) {
 		inpFSample->redraw();
 
 
-		ftSocket = open_connection(hostname, port);
+		ftSocket = ft_open_buffer(hostname, port, &ftServer);
 		if (ftSocket == -1) {
 			infoBox->label("Could not connect\n");
 			infoBox->redraw();
@@ -131,7 +133,7 @@ void startStopCallback(Fl_Widget *widget) {
 
 			req.prepPutHeader(numChannels, DATATYPE_FLOAT32, fSample);
 
-			r = tcprequest(ftSocket, req.out(), resp.in());
+			r = clientrequest(ftSocket, req.out(), resp.in());
 			if (r<0 || !resp.checkPut()) {
 				infoBox->label("Could not write header\n");
 				infoBox->redraw();
@@ -246,7 +248,7 @@ int main(int argc, char *argv[]) {
 					infoBox->label("Out of memory\n");
 					infoBox->redraw();
 				} else {
-					int r = tcprequest(ftSocket, req.out(), resp.in());
+					int r = clientrequest(ftSocket, req.out(), resp.in());
 					if (r < 0 || !resp.checkPut()) {
 						startStopCallback(NULL); // this will disconnect
 					} else {
@@ -259,7 +261,7 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
-	if (ftSocket != -1) close_connection(ftSocket);
+	if (ftSocket != -1) ft_close_buffer(ftSocket, ftServer);
 
 	delete window;
 
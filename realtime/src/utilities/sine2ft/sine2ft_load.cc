@@ -0,0 +1,527 @@
+/*
+ * Load generator that streams synthetic signals to a FieldTrip buffer, for
+ * testing the buffer and its clients at high channel counts and sampling
+ * rates. Use as
+ *    sine2ft_load [options]
+ * with the following options
+ *    -host <name>          hostname of the buffer, or - to start one in this process, default localhost
+ *    -port <number>        port of the buffer, default 1972
+ *    -nchans <number>      number of channels of each writer, default 32
+ *    -fsample <number>     sampling rate in Hz, default 1000
+ *    -blocksize <number>   number of samples per block, default 32
+ *    -writers <number>     number of writers, each with its own connection and stream, default 1
+ *    -freq <min>,<max>     the frequencies of the channels are spread over this range, default 1,40
+ *    -amplitude <number>   amplitude of the sine waves, default 1
+ *    -noise <number>       standard deviation of the noise, default 0.1
+ *    -eventrate <number>   average number of events per second of each writer, default 0
+ *    -burst <on>,<off>     write the blocks for <on> seconds, then hold them back for
+ *                          <off> seconds and write them in one burst, default off
+ *    -timestamp            write the blocks with the time of their first sample (PUT_DAT_T)
+ *    -duration <seconds>   how long to write, 0 is until interrupted, default 10
+ *    -report <seconds>     interval between the reports, default 1
+ *    -format <name>        text or csv, default text
+ *
+ * For example
+ *    sine2ft_load -nchans 1024 -fsample 20000 -blocksize 200 -writers 4 -eventrate 10
+ *
+ * The first writer uses the default stream, the others use the streams
+ * sine2ft1, sine2ft2, etc. Each channel is a sine wave plus noise, the sine
+ * waves are computed by rotating a phasor for every channel, which takes a
+ * few multiplications instead of a call to sin for every sample. The events
+ * are written at random intervals, together with the block that contains
+ * their sample. Every block is written as soon as its last sample is due,
+ * based on the time at which the writers started, so that delays do not add up.
+ *
+ * The reports give the throughput of all writers together, and the latency
+ * from the moment a block is due until the buffer has acknowledged it.
+ *
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <buffer.h>
+#include <socketserver.h>
+#include <ftclock.h>
+#include <FtBuffer.h>
+
+#define FORMAT_TEXT 0
+#define FORMAT_CSV  1
+
+#define MAX_WRITERS 64
+
+/* the settings of the load generator */
+typedef struct {
+	char hostname[256];
+	int port;
+	int nchans, blocksize, writers;
+	double fsample;
+	double fmin, fmax;
+	double amplitude, noise;
+	double eventrate;
+	double burstOn, burstOff;
+	int timestamp;
+	double duration, report;
+	int format;
+} settings_t;
+
+/* the state of one writer, which runs in its own thread */
+struct Writer {
+	int index;
+	char stream[FT_STREAM_NAMELEN];
+	int ftSocket;
+	pthread_t thread;
+
+	// the oscillator bank, with one phasor and noise generator per channel
+	float *re, *im, *cosw, *sinw;
+	UINT32_T *rng;
+	double nextEvent;		// sample at which the next event is due
+	INT32_T numEvents;
+
+	// the statistics, protected by the mutex
+	pthread_mutex_t mutex;
+	UINT64_T samples, events, bytes, errors;
+	double sumLatency, maxLatency;
+	UINT64_T numLatency;
+	bool done;
+};
+
+static settings_t settings;
+static Writer writers[MAX_WRITERS];
+static UINT64_T startTime;	// the writers are paced relative to this time, see ft_clock_ns
+static ft_buffer_server_t *ftServer = NULL;
+
+static double cpu_time(void) {
+#ifdef CLOCK_PROCESS_CPUTIME_ID
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + 1e-9*ts.tv_nsec;
+#else
+	return (double) clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/* returns a uniformly distributed number between 0 and 1, excluding 0 */
+static double uniform(UINT32_T *state) {
+	UINT32_T x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return (x + 1.0) / 4294967296.0;
+}
+
+/* computes nsamples x nchans samples, the channels of each sample are contiguous like in the buffer */
+static void generate(Writer *W, float *dest, int nsamples) {
+	const int nchans = settings.nchans;
+	const float amplitude = (float) settings.amplitude;
+	// the sum of two uniform 16-bit numbers has a standard deviation of 65536/sqrt(6)
+	const float noiseScale = (float) (settings.noise * sqrt(6.0) / 65536.0);
+	float * __restrict re = W->re;
+	float * __restrict im = W->im;
+	const float * __restrict cosw = W->cosw;
+	const float * __restrict sinw = W->sinw;
+	UINT32_T * __restrict rng = W->rng;
+
+	for (int s=0;s<nsamples;s++) {
+		float * __restrict d = dest + (size_t) s*nchans;
+		for (int c=0;c<nchans;c++) {
+			float r = re[c]*cosw[c] - im[c]*sinw[c];
+			float i = im[c]*cosw[c] + re[c]*sinw[c];
+			UINT32_T x = rng[c];
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+			rng[c] = x;
+			re[c] = r;
+			im[c] = i;
+			d[c] = amplitude*r + noiseScale*((float) (x & 0xFFFF) + (float) (x >> 16) - 65535.0f);
+		}
+	}
+
+	// keep the phasors on the unit circle, the rounding errors would otherwise add up
+	for (int c=0;c<nchans;c++) {
+		float g = 1.5f - 0.5f*(re[c]*re[c] + im[c]*im[c]);
+		re[c] *= g;
+		im[c] *= g;
+	}
+}
+
+/* returns the time in seconds since the start at which a block that ends at the given sample is written */
+static double blockTime(UINT64_T endSample) {
+	double t = endSample / settings.fsample;
+	if (settings.burstOff > 0) {
+		double cycle = settings.burstOn + settings.burstOff;
+		double pos = fmod(t, cycle);
+		// blocks that are due while holding back are written at the start of the next cycle
+		if (pos > settings.burstOn) t += cycle - pos;
+	}
+	return t;
+}
+
+static int writerRequest(Writer *W, const message_t *request, FtBufferResponse &resp) {
+	if (W->stream[0] == 0) return clientrequest(W->ftSocket, request, resp.in());
+	return streamrequest(W->ftSocket, W->stream, request, resp.in());
+}
+
+static void *writerThread(void *arg) {
+	Writer *W = (Writer *) arg;
+	FtBufferRequest req, batch;
+	FtBufferResponse resp;
+	FtSampleBlock block(DATATYPE_FLOAT32);
+	FtEventList events;
+	float *samples = NULL;
+	UINT64_T sample = 0;
+	const UINT64_T numSamples = (UINT64_T) (settings.duration * settings.fsample);
+
+	req.prepPutHeader(settings.nchans, DATATYPE_FLOAT32, (float) settings.fsample);
+	if (writerRequest(W, req.out(), resp) < 0 || !resp.checkPut()) {
+		fprintf(stderr, "Writer %i could not write the header\n", W->index);
+		goto cleanup;
+	}
+
+	if (settings.timestamp) {
+		samples = (float *) malloc(sizeof(float) * settings.nchans * settings.blocksize);
+		if (samples == NULL) {
+			fprintf(stderr, "Writer %i is out of memory\n", W->index);
+			goto cleanup;
+		}
+	}
+
+	while (settings.duration == 0 || sample < numSamples) {
+		const message_t *request;
+		float *dest;
+		int n = settings.blocksize;
+		double latency;
+		UINT64_T deadline;
+		int r;
+
+		if (settings.duration > 0 && sample + n > numSamples) n = (int) (numSamples - sample);
+
+		dest = settings.timestamp ? samples : (float *) block.getMatrix(settings.nchans, n);
+		if (dest == NULL) {
+			fprintf(stderr, "Writer %i is out of memory\n", W->index);
+			break;
+		}
+		generate(W, dest, n);
+
+		events.clear();
+		while (settings.eventrate > 0 && W->nextEvent < sample + n) {
+			events.add((int) W->nextEvent, "sine2ft", W->numEvents++);
+			W->nextEvent += -log(uniform(W->rng)) * settings.fsample / settings.eventrate;
+		}
+
+		if (settings.timestamp) {
+			if (!req.prepPutDataTimestamp(settings.nchans, n, DATATYPE_FLOAT32, dest, startTime + (UINT64_T) (1e9 * sample / settings.fsample))) {
+				fprintf(stderr, "Writer %i is out of memory\n", W->index);
+				break;
+			}
+			request = req.out();
+		} else {
+			request = block.asRequest();
+		}
+		if (events.count() > 0) {
+			batch.prepPutBatch();
+			if (!batch.prepBatchAdd(request) || !batch.prepBatchAdd(events.asRequest())) {
+				fprintf(stderr, "Writer %i is out of memory\n", W->index);
+				break;
+			}
+			request = batch.out();
+		}
+
+		deadline = startTime + (UINT64_T) (1e9 * blockTime(sample + n));
+		ft_clock_sleep_until(deadline);
+
+		r = writerRequest(W, request, resp);
+		latency = (ft_clock_ns() - deadline) * 1e-6;
+		if (r < 0) {
+			fprintf(stderr, "Writer %i lost the connection to the buffer\n", W->index);
+			break;
+		}
+
+		pthread_mutex_lock(&W->mutex);
+		if (resp.checkPut()) {
+			W->samples += n;
+			W->events  += events.count();
+			W->bytes   += request->def->bufsize + sizeof(messagedef_t);
+		} else {
+			W->errors++;
+		}
+		W->sumLatency += latency;
+		W->numLatency++;
+		if (latency > W->maxLatency) W->maxLatency = latency;
+		pthread_mutex_unlock(&W->mutex);
+
+		sample += n;
+	}
+
+cleanup:
+	free(samples);
+	pthread_mutex_lock(&W->mutex);
+	W->done = true;
+	pthread_mutex_unlock(&W->mutex);
+	return NULL;
+}
+
+static void usage(void) {
+	fprintf(stderr, "USAGE: sine2ft_load [-host <name>] [-port <number>] [-nchans <number>] [-fsample <number>] [-blocksize <number>] [-writers <number>]\n");
+	fprintf(stderr, "                    [-freq <min>,<max>] [-amplitude <number>] [-noise <number>] [-eventrate <number>] [-burst <on>,<off>]\n");
+	fprintf(stderr, "                    [-timestamp] [-duration <seconds>] [-report <seconds>] [-format text|csv]\n");
+	exit(1);
+}
+
+static void parse_arguments(int argc, char *argv[]) {
+	int i;
+
+	sprintf(settings.hostname, DEFAULT_HOSTNAME);
+	settings.port      = DEFAULT_PORT;
+	settings.nchans    = 32;
+	settings.fsample   = 1000;
+	settings.blocksize = 32;
+	settings.writers   = 1;
+	settings.fmin      = 1;
+	settings.fmax      = 40;
+	settings.amplitude = 1;
+	settings.noise     = 0.1;
+	settings.eventrate = 0;
+	settings.burstOn   = 0;
+	settings.burstOff  = 0;
+	settings.timestamp = 0;
+	settings.duration  = 10;
+	settings.report    = 1;
+	settings.format    = FORMAT_TEXT;
+
+	for (i=1; i<argc; i++) {
+		const char *opt = argv[i];
+		const char *val = (i+1<argc) ? argv[i+1] : NULL;
+
+		if (strcmp(opt, "-timestamp") == 0) {
+			settings.timestamp = 1;
+			continue;
+		}
+		if (val == NULL) usage();
+		i++;
+
+		if (strcmp(opt, "-host") == 0) {
+			strncpy(settings.hostname, val, sizeof(settings.hostname)-1);
+		} else if (strcmp(opt, "-port") == 0) {
+			settings.port = atoi(val);
+		} else if (strcmp(opt, "-nchans") == 0) {
+			settings.nchans = atoi(val);
+		} else if (strcmp(opt, "-fsample") == 0) {
+			settings.fsample = atof(val);
+		} else if (strcmp(opt, "-blocksize") == 0) {
+			settings.blocksize = atoi(val);
+		} else if (strcmp(opt, "-writers") == 0) {
+			settings.writers = atoi(val);
+		} else if (strcmp(opt, "-freq") == 0) {
+			if (sscanf(val, "%lf,%lf", &settings.fmin, &settings.fmax) != 2) usage();
+		} else if (strcmp(opt, "-amplitude") == 0) {
+			settings.amplitude = atof(val);
+		} else if (strcmp(opt, "-noise") == 0) {
+			settings.noise = atof(val);
+		} else if (strcmp(opt, "-eventrate") == 0) {
+			settings.eventrate = atof(val);
+		} else if (strcmp(opt, "-burst") == 0) {
+			if (sscanf(val, "%lf,%lf", &settings.burstOn, &settings.burstOff) != 2) usage();
+		} else if (strcmp(opt, "-duration") == 0) {
+			settings.duration = atof(val);
+		} else if (strcmp(opt, "-report") == 0) {
+			settings.report = atof(val);
+		} else if (strcmp(opt, "-format") == 0) {
+			if (strcmp(val, "text") == 0) settings.format = FORMAT_TEXT;
+			else if (strcmp(val, "csv") == 0) settings.format = FORMAT_CSV;
+			else usage();
+		} else {
+			usage();
+		}
+	}
+
+	if (settings.nchans < 1 || settings.blocksize < 1 || settings.fsample <= 0) usage();
+	if (settings.writers < 1 || settings.writers > MAX_WRITERS) usage();
+	if (settings.burstOn < 0 || settings.burstOff < 0 || (settings.burstOff > 0 && settings.burstOn <= 0)) usage();
+	if (settings.duration < 0 || settings.report <= 0) usage();
+}
+
+static bool initWriter(Writer *W, int index) {
+	const int nchans = settings.nchans;
+
+	memset(W, 0, sizeof(Writer));
+	W->index = index;
+	if (index > 0) snprintf(W->stream, FT_STREAM_NAMELEN, "sine2ft%i", index);
+	pthread_mutex_init(&W->mutex, NULL);
+
+	W->re   = (float *) malloc(sizeof(float) * nchans);
+	W->im   = (float *) malloc(sizeof(float) * nchans);
+	W->cosw = (float *) malloc(sizeof(float) * nchans);
+	W->sinw = (float *) malloc(sizeof(float) * nchans);
+	W->rng  = (UINT32_T *) malloc(sizeof(UINT32_T) * nchans);
+	if (W->re == NULL || W->im == NULL || W->cosw == NULL || W->sinw == NULL || W->rng == NULL) return false;
+
+	for (int c=0;c<nchans;c++) {
+		double f = (nchans > 1) ? settings.fmin + (settings.fmax - settings.fmin) * c / (nchans - 1) : settings.fmin;
+		double w = 2.0 * M_PI * f / settings.fsample;
+		W->cosw[c] = (float) cos(w);
+		W->sinw[c] = (float) sin(w);
+		// start at a different phase for every channel and writer
+		W->re[c] = (float) cos(0.7 * c + 1.3 * index);
+		W->im[c] = (float) sin(0.7 * c + 1.3 * index);
+		W->rng[c] = 2463534242U ^ (UINT32_T) (c * 2654435761U + index * 40503U + 1);
+	}
+	if (settings.eventrate > 0) {
+		W->nextEvent = -log(uniform(W->rng)) * settings.fsample / settings.eventrate;
+	}
+	return true;
+}
+
+static void freeWriter(Writer *W) {
+	free(W->re);
+	free(W->im);
+	free(W->cosw);
+	free(W->sinw);
+	free(W->rng);
+	pthread_mutex_destroy(&W->mutex);
+}
+
+/* the totals over the whole run, for the summary at the end */
+static UINT64_T totalSamples = 0, totalEvents = 0, totalBytes = 0, totalErrors = 0;
+static UINT64_T totalNumLatency = 0;
+static double totalSumLatency = 0, totalMaxLatency = 0;
+
+static void printLine(const char *label, double elapsed, double interval, UINT64_T samples, UINT64_T events, UINT64_T bytes, UINT64_T errors, double meanLatency, double maxLatency, double cpu) {
+	double rate = samples / interval;
+	double target = settings.writers * settings.fsample;
+
+	if (settings.format == FORMAT_CSV) {
+		printf("%s,%.3f,%i,%i,%.1f,%i,%.1f,%.1f,%.3f,%.1f,%.3f,%.3f,%llu,%.3f\n", label, elapsed, settings.writers, settings.nchans, settings.fsample, settings.blocksize,
+			rate, rate * settings.nchans, bytes / interval / 1e6, events / interval, meanLatency, maxLatency, (unsigned long long) errors, cpu / interval);
+	} else {
+		printf("%-8s %8.1f s  %10.0f samples/s (%5.1f%%)  %10.0f values/s  %8.2f MB/s  %8.1f events/s  latency %7.3f / %7.3f ms (mean / max)  %llu errors  CPU %5.1f%%\n",
+			label, elapsed, rate, 100.0 * rate / target, rate * settings.nchans, bytes / interval / 1e6, events / interval, meanLatency, maxLatency, (unsigned long long) errors, 100.0 * cpu / interval);
+	}
+	fflush(stdout);
+}
+
+/* prints the throughput since the previous report, and resets the statistics */
+static void report(double elapsed, double interval, double cpu) {
+	UINT64_T samples = 0, events = 0, bytes = 0, errors = 0, numLatency = 0;
+	double sumLatency = 0, maxLatency = 0;
+
+	for (int k=0;k<settings.writers;k++) {
+		Writer *W = &writers[k];
+		pthread_mutex_lock(&W->mutex);
+		samples    += W->samples;
+		events     += W->events;
+		bytes      += W->bytes;
+		errors     += W->errors;
+		sumLatency += W->sumLatency;
+		numLatency += W->numLatency;
+		if (W->maxLatency > maxLatency) maxLatency = W->maxLatency;
+		W->samples = W->events = W->bytes = W->errors = W->numLatency = 0;
+		W->sumLatency = W->maxLatency = 0;
+		pthread_mutex_unlock(&W->mutex);
+	}
+
+	totalSamples += samples;
+	totalEvents  += events;
+	totalBytes   += bytes;
+	totalErrors  += errors;
+	totalSumLatency += sumLatency;
+	totalNumLatency += numLatency;
+	if (maxLatency > totalMaxLatency) totalMaxLatency = maxLatency;
+
+	printLine("interval", elapsed, interval, samples, events, bytes, errors, numLatency ? sumLatency / numLatency : 0, maxLatency, cpu);
+}
+
+int main(int argc, char *argv[]) {
+	int ftSocket = -1, numStarted = 0;
+	bool running;
+	double cpuPrev, cpuStart;
+	UINT64_T reportTime, prevTime;
+
+	parse_arguments(argc, argv);
+
+	// with a local server, all writers send their requests directly to it
+	if (strcmp(settings.hostname, "-") == 0) {
+		ftSocket = ft_open_buffer(settings.hostname, settings.port, &ftServer);
+		if (ftSocket == -1) {
+			fprintf(stderr, "Could not start a buffer server on port %i\n", settings.port);
+			return 1;
+		}
+	}
+
+	for (int k=0;k<settings.writers;k++) {
+		if (!initWriter(&writers[k], k)) {
+			fprintf(stderr, "Out of memory\n");
+			return 1;
+		}
+		writers[k].ftSocket = (ftServer != NULL) ? ftSocket : open_connection(settings.hostname, settings.port);
+		if (writers[k].ftSocket < 0) {
+			fprintf(stderr, "Could not connect to the buffer on %s:%i\n", settings.hostname, settings.port);
+			return 1;
+		}
+	}
+
+	if (settings.format == FORMAT_CSV) {
+		printf("report,time,writers,nchans,fsample,blocksize,samples_per_s,values_per_s,mbytes_per_s,events_per_s,latency_mean_ms,latency_max_ms,errors,cpu\n");
+	} else {
+		printf("Writing %i x %i channels at %.1f Hz in blocks of %i samples to %s:%i\n", settings.writers, settings.nchans, settings.fsample, settings.blocksize, settings.hostname, settings.port);
+	}
+
+	startTime = ft_clock_ns();
+	cpuStart = cpuPrev = cpu_time();
+	for (int k=0;k<settings.writers;k++) {
+		if (pthread_create(&writers[k].thread, NULL, writerThread, &writers[k]) != 0) {
+			fprintf(stderr, "Could not start writer %i\n", k);
+			break;
+		}
+		numStarted++;
+	}
+
+	prevTime = reportTime = startTime;
+	running = (numStarted > 0);
+	while (running) {
+		reportTime += (UINT64_T) (1e9 * settings.report);
+
+		// check every 10 ms whether the writers are done, so that the last report is not delayed
+		do {
+			UINT64_T now = ft_clock_ns();
+			ft_clock_sleep_until((reportTime > now + 10000000) ? now + 10000000 : reportTime);
+
+			running = false;
+			for (int k=0;k<numStarted;k++) {
+				pthread_mutex_lock(&writers[k].mutex);
+				if (!writers[k].done) running = true;
+				pthread_mutex_unlock(&writers[k].mutex);
+			}
+		} while (running && ft_clock_ns() < reportTime);
+
+		UINT64_T now = ft_clock_ns();
+		double cpu = cpu_time();
+		report((now - startTime) * 1e-9, (now - prevTime) * 1e-9, cpu - cpuPrev);
+		prevTime = now;
+		cpuPrev = cpu;
+	}
+
+	if (numStarted > 0) {
+		double elapsed = (prevTime - startTime) * 1e-9;
+		printLine("total", elapsed, elapsed, totalSamples, totalEvents, totalBytes, totalErrors, totalNumLatency ? totalSumLatency / totalNumLatency : 0, totalMaxLatency, cpu_time() - cpuStart);
+	}
+
+	for (int k=0;k<numStarted;k++) {
+		pthread_join(writers[k].thread, NULL);
+	}
+	for (int k=0;k<settings.writers;k++) {
+		if (ftServer == NULL && writers[k].ftSocket > 0) close_connection(writers[k].ftSocket);
+		freeWriter(&writers[k]);
+	}
+	if (ftServer != NULL) ft_close_buffer(ftSocket, ftServer);
+	return 0;
+}
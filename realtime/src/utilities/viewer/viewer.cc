@@ -25,6 +25,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <FtBuffer.h>
+#include <asyncrequest.h>
 #include <MultiChannelFilter.h>
 
 #define HPFILTORD 2
@@ -47,7 +48,7 @@ OnlineDataDisplay *oddis = 0;
 Fl_Slider *slideSpace, *slideScale;
 Fl_Scrollbar *scrollbar;
 ColorBrowser *browser;
-SimpleStorage rawStore,floatStore;
+SimpleStorage floatStore;
 Fl_Check_Button *hpButton, *lpButton;
 Fl_Button *conButton;
 Fl_Input *addrField;
@@ -57,12 +58,18 @@ bool useLowpass;
 MultiChannelFilter<float,float> *hpFilter = NULL;
 MultiChannelFilter<float,float> *lpFilter = NULL;
 FtConnection ftCon;
+ft_async_conn_t *asyncCon = NULL; // the socket of ftCon, once it is connected
+const char *asyncError = NULL;    // set in the callbacks, handled in socketCallback
+bool resetData = false;           // set when the buffer has been flushed or restarted
 
-bool readHeader();
+void requestHeader();
 
 /** This is the widget on which the channels are drawn.
   It maintains its own little ringbuffer and includes a
-  scrollbar widget.
+  scrollbar widget. When there are more samples than pixels,
+  the minimum and maximum of every channel in every pixel column
+  are kept up to date as the samples come in, and only those are
+  drawn, so that drawing does not depend on the sampling rate.
  */
 class OnlineDataDisplay : public Fl_Widget {
   public:
@@ -77,7 +84,9 @@ class OnlineDataDisplay : public Fl_Widget {
 
     // catch window resize events to recalibrate the scroll bar etc.
     void resize(int x, int y, int w, int h) {
+      int oldWidth = this->w();
       Fl_Widget::resize(x,y,w,h);
+      if (w != oldWidth) setColumns(w-44);
       if (height == h) return;
       height = h;
       do_callback();
@@ -87,6 +96,10 @@ class OnlineDataDisplay : public Fl_Widget {
       return height;
     }
 
+    int getNumSamples() const {
+      return nSamp;
+    }
+
     // set scrollbar parameter
     void setScrollSize(int sPos, float scale, int space) {
       yPos = sPos;
@@ -96,9 +109,18 @@ class OnlineDataDisplay : public Fl_Widget {
     }
 
   protected:
+    void setColumns(int width);
+    void updateColumns(int first, int N);
+
+    int columnOf(int sample) const {
+      return (int) ((long long) sample * nCols / nSamp);
+    }
+
     float *data;
+    float *envMin, *envMax; // nCols x nChans, per pixel column
     int nChans;
     int nSamp;
+    int nCols;              // 0 if the samples are drawn themselves
     int numTotal, pos;
     int yPos, ySpace;
     float yScale;
@@ -108,6 +130,10 @@ class OnlineDataDisplay : public Fl_Widget {
 
 OnlineDataDisplay::OnlineDataDisplay(int x,int y,int w,int h,const char *label) : Fl_Widget(x,y,w,h,label) {
   data = NULL;
+  envMin = envMax = NULL;
+  nCols = 0;
+  nSamp = 0;
+  numTotal = 0;
   pos = 0;
   yPos = 0;
   yScale = 1;
@@ -126,10 +152,57 @@ void OnlineDataDisplay::setSize(int nChans, int nSamples, int skip) {
   numTotal = 0;
   pos = 0;
   skipped = skip;
+  setColumns(w()-44);
 }
 
 OnlineDataDisplay::~OnlineDataDisplay() {
   delete[] data;
+  delete[] envMin;
+  delete[] envMax;
+}
+
+void OnlineDataDisplay::setColumns(int width) {
+  delete[] envMin;
+  delete[] envMax;
+  envMin = envMax = NULL;
+
+  // with only a few samples per pixel, drawing the samples is cheap enough
+  nCols = (nSamp > 2*width && width > 0) ? width : 0;
+  if (nCols == 0) return;
+
+  envMin = new float[nCols * nChans];
+  envMax = new float[nCols * nChans];
+  int numKept = (nSamp < numTotal) ? nSamp : numTotal;
+  updateColumns(0, numKept);
+}
+
+// extends the columns with the samples first ... first+N-1 of the ringbuffer
+void OnlineDataDisplay::updateColumns(int first, int N) {
+  for (int j=0;j<N;j++) {
+    int p = (first + j) % nSamp;
+    int col = columnOf(p);
+    float *mn = envMin + col*nChans;
+    float *mx = envMax + col*nChans;
+    const float *s = data + p*nChans;
+
+    if (p == 0 || columnOf(p-1) != col) {
+      // the column starts at the previous sample, so that it joins its neighbour
+      const float *prev = (p > 0) ? s - nChans : s;
+      for (int i=0;i<nChans;i++) mn[i] = mx[i] = prev[i];
+    }
+    for (int i=0;i<nChans;i++) {
+      if (s[i] < mn[i]) mn[i] = s[i];
+      if (s[i] > mx[i]) mx[i] = s[i];
+    }
+  }
+}
+
+// pixel row of a value, limited to a bit outside the widget
+static int pixelRow(int ypos, float value, float scale, int top, int bottom) {
+  float y = ypos - value*scale;
+  if (!(y >= top)) return top;
+  if (y > bottom) return bottom;
+  return (int) (y + 0.5f);
 }
 
 void OnlineDataDisplay::draw() {
@@ -166,6 +239,17 @@ void OnlineDataDisplay::draw() {
     fl_color(colorTable[i]);
     fl_draw(labels[i], x()+2, ypos);
 
+    if (nCols > 0) {
+      int numCols = (nSamp <= numTotal) ? nCols : (numTotal > 0 ? columnOf(numTotal-1)+1 : 0);
+      float scale = yScale*ySpace;
+      for (int c=0;c<numCols;c++) {
+        int y1 = pixelRow(ypos, envMax[i+c*nChans], scale, y()-1, y()+h());
+        int y2 = pixelRow(ypos, envMin[i+c*nChans], scale, y()-1, y()+h());
+        fl_yxline(x()+42+c, y1, y2);
+      }
+      continue;
+    }
+
     fl_push_matrix();
     fl_translate(x()+42, ypos);
     fl_scale(xScale, -yScale*ySpace);
@@ -208,17 +292,18 @@ void OnlineDataDisplay::draw() {
  */
 
 void OnlineDataDisplay::addSamples(int N, const float *sdata) {
-  /*
-     if (N>nSamp) {
-     data += nChans * (N-nSamp);
-     N = nSamp;
-     }
-   */
-  for (int j=0;j<N;j++) {
-    float *d = data + ((pos + j) % nSamp)*nChans;
-    const float *s = sdata + j*nChans;
-    for (int i=0;i<nChans;i++) d[i] = s[i];
+  if (N>nSamp) {
+    // only the last sweep can be shown
+    sdata += nChans * (N-nSamp);
+    pos = (pos + N-nSamp) % nSamp;
+    numTotal += N-nSamp;
+    N = nSamp;
   }
+  // in at most two pieces, up to the end of the ringbuffer and from its start
+  int N1 = (N < nSamp-pos) ? N : nSamp-pos;
+  memcpy(data + pos*nChans, sdata, sizeof(float)*N1*nChans);
+  memcpy(data, sdata + N1*nChans, sizeof(float)*(N-N1)*nChans);
+  if (nCols > 0) updateColumns(pos, N);
 
   pos=(pos + N) % nSamp;
   numTotal+=N;
@@ -345,18 +430,52 @@ void generalCallback(Fl_Widget*, void*)  {
   oddis->setScrollSize(sPos, yScale, ySpace);
 }
 
+void socketCallback(int fd, void*);
+void headerTimeout(void*);
+
+// sends the requests that were submitted outside socketCallback, and watches the socket for them
+void watchSocket() {
+  if (asyncCon == NULL) return;
+  if (ft_async_process(asyncCon) < 0 && asyncError == NULL) {
+    asyncError = "Error in communication. Buffer server aborted??";
+  }
+  if (ft_async_wants_write(asyncCon)) {
+    Fl::add_fd(ft_async_fd(asyncCon), FL_WRITE, socketCallback);
+  } else {
+    Fl::remove_fd(ft_async_fd(asyncCon), FL_WRITE);
+  }
+}
+
+void startAsync(int sock) {
+  asyncCon = ft_async_open(sock);
+  if (asyncCon == NULL) return;
+  Fl::add_fd(sock, FL_READ, socketCallback);
+  requestHeader();
+  watchSocket();
+}
+
+void stopAsync() {
+  if (asyncCon == NULL) return;
+  ft_async_conn_t *A = asyncCon;
+  Fl::remove_fd(ft_async_fd(A));
+  Fl::remove_timeout(headerTimeout);
+  asyncCon = NULL;
+  asyncError = NULL;
+  ft_async_close(A); // the callbacks of the outstanding requests see that asyncCon is NULL
+}
+
 void connectCallback(Fl_Widget*, void*) {
-  if (ftCon.isOpen()) {
-    ftCon.disconnect();
+  if (asyncCon != NULL) {
+    stopAsync();
     addrField->textcolor(FL_BLACK);
     addrField->redraw();
     conButton->label("Connect");
   } else {
     if (ftCon.connect(addrField->value())) {
+      startAsync(ftCon.releaseSocket());
       addrField->textcolor(FL_DARK_GREEN);
       addrField->redraw();
       conButton->label("Disconnect");
-      readHeader();
     }
   }
 }
@@ -376,7 +495,7 @@ void freeTables() {
 
 
 void errDisconnect(const char *msg) {
-  ftCon.disconnect();
+  stopAsync();
   numChannels = 0; // reset to enforce reading header next time
   addrField->textcolor(FL_BLACK);
   addrField->redraw();
@@ -384,20 +503,12 @@ void errDisconnect(const char *msg) {
   fl_alert(msg);
 }
 
-bool readHeader() {
-  SimpleStorage chunkBuffer;
+bool readHeader(const FtBufferResponse &response) {
   headerdef_t header_def;
-  FtBufferRequest request;
-  FtBufferResponse response;
-
-  request.prepGetHeader();
-
-  if (tcprequest(ftCon.getSocket(), request.out(), response.in()) < 0) {
-    errDisconnect("Error in communication - check buffer server");
-    return false;
-  }
+  unsigned int chunkSize;
 
-  if (!response.checkGetHeader(header_def, &chunkBuffer)) {
+  const void *chunks = response.getHeaderView(header_def, chunkSize);
+  if (chunks == NULL) {
     fprintf(stderr, "Could not read header.\n");
     return false;
   }
@@ -409,7 +520,7 @@ bool readHeader() {
   labels = (char **) calloc(numChannels, sizeof(char *));
   colorTable = (int *) calloc(numChannels, sizeof(int));
 
-  const ft_chunk_t *cnc = find_chunk(chunkBuffer.data(), 0, chunkBuffer.size(), FT_CHUNK_CHANNEL_NAMES);
+  const ft_chunk_t *cnc = find_chunk(chunks, 0, chunkSize, FT_CHUNK_CHANNEL_NAMES);
   if (cnc == NULL) {
     printf("No channel names found\n");
     for (int n=0;n<numChannels;n++) {
@@ -463,98 +574,157 @@ void convertToFloat(float *dest, const void *src, unsigned int nsamp, unsigned i
   }
 }
 
-// this will get called repeatedly from the GUI loop, use this to poll for new data
-void idleCall(void *dummy) {
-  datadef_t ddef;
+// called by FLTK when the socket can be read or written, this handles the responses
+void socketCallback(int fd, void*) {
+  watchSocket();
+  if (asyncError != NULL) {
+    errDisconnect(asyncError);
+  }
+}
+
+void submit(const FtBufferRequest &request, ft_async_callback_t callback) {
+  if (ft_async_submit(asyncCon, request.out(), callback, NULL) != 0 && asyncError == NULL) {
+    asyncError = "Error in communication. Buffer server aborted??";
+  }
+}
+
+// the responses of the requests below are handled while the GUI keeps running
+void headerCallback(int status, message_t *msg, void*);
+void waitCallback(int status, message_t *msg, void*);
+void dataCallback(int status, message_t *msg, void*);
+
+void requestHeader() {
   FtBufferRequest request;
-  FtBufferResponse response;
-  unsigned int newSamples, newEvents;
+  request.prepGetHeader();
+  submit(request, headerCallback);
+}
 
-  if (!ftCon.isOpen()) return;
+void headerTimeout(void*) {
+  requestHeader();
+  watchSocket();
+  if (asyncError != NULL) {
+    errDisconnect(asyncError);
+  }
+}
 
-  if (numChannels == 0) {
-    if (!readHeader()) {
-#ifdef WIN32
-      Sleep(50);
-#else
-      usleep(50000);
-#endif
-      return;
-    }
+void requestWait() {
+  FtBufferRequest request;
+  // wait for new samples, don't care about events
+  request.prepWaitData(numSamples, 0xFFFFFFFF, 500);
+  submit(request, waitCallback);
+}
+
+void requestData(unsigned int begSample, unsigned int endSample) {
+  FtBufferRequest request;
+  unsigned int numDisplay = oddis->getNumSamples();
+  // samples that would be overwritten in the display right away are not read at all
+  if (endSample - begSample > numDisplay) begSample = endSample - numDisplay;
+  request.prepGetData(begSample, endSample-1);
+  submit(request, dataCallback);
+}
+
+void headerCallback(int status, message_t *msg, void*) {
+  FtBufferResponse response;
+  *response.in() = msg;
+
+  if (asyncCon == NULL) return;
+  if (status != 0) {
+    if (asyncError == NULL) asyncError = "Error in communication - check buffer server";
+    return;
+  }
+  if (!readHeader(response)) {
+    // try again a bit later, e.g. when there is no header yet
+    Fl::add_timeout(0.05, headerTimeout);
+    return;
   }
+  if (resetData && numSamples > 0 && numSamples <= 1024 && numChannels <= 512) {
+    // read data from the start of the buffer right away, if there is not "lots" of it yet
+    requestData(0, numSamples);
+  }
+  resetData = false;
+  requestWait();
+}
 
-  // wait for new samples, don't care about events, up to 40ms
-  request.prepWaitData(numSamples, 0xFFFFFFFF, 40);
+void waitCallback(int status, message_t *msg, void*) {
+  FtBufferResponse response;
+  unsigned int newSamples, newEvents;
+  *response.in() = msg;
 
-  if (tcprequest(ftCon.getSocket(), request.out(), response.in()) < 0) {
-    errDisconnect("Error in communication. Buffer server aborted??");
+  if (asyncCon == NULL) return;
+  if (status != 0) {
+    if (asyncError == NULL) asyncError = "Error in communication. Buffer server aborted??";
     return;
   }
   if (!response.checkWait(newSamples, newEvents)) {
-    errDisconnect("Error in received packet - disconnecting...");
+    if (asyncError == NULL) asyncError = "Error in received packet - disconnecting...";
     return;
   }
 
-  if (newSamples == numSamples) return; // nothing new
   if (newSamples < numSamples) {
     // oops ? do we have a new header?
-    if (!readHeader()) return;
-    if (numSamples == 0) return; // no data yet
-    if (numSamples > 1024 || numChannels > 512) {
-      // "lots" of data already in the buffer
-      // -> don't do anything with that data
-      //    continue next idleCall
-      return;
-    }
-    // read data from the start of the buffer up to newSamples right away
-    newSamples = numSamples;
-    numSamples = 0;
+    resetData = true;
+    requestHeader();
+    return;
+  }
+  if (newSamples > numSamples) {
+    // the next wait goes out right away, the server answers it after the data
+    requestData(numSamples, newSamples);
+    numSamples = newSamples;
   }
+  requestWait();
+}
 
-  request.prepGetData(numSamples, newSamples-1);
+void dataCallback(int status, message_t *msg, void*) {
+  datadef_t ddef;
+  FtBufferResponse response;
+  *response.in() = msg;
 
-  if (tcprequest(ftCon.getSocket(), request.out(), response.in()) < 0) {
-    errDisconnect("Error in communication. Buffer server aborted??");
+  if (asyncCon == NULL) return;
+  if (status != 0) {
+    if (asyncError == NULL) asyncError = "Error in communication. Buffer server aborted??";
     return;
   }
-  if (!response.checkGetData(ddef, &rawStore)) {
-    errDisconnect("Error in received packet - disconnecting...");
+  // the samples are converted straight from the received message
+  const void *rawData = response.getDataView(ddef);
+  if (rawData == NULL) {
+    if (asyncError == NULL) asyncError = "Error in received packet - disconnecting...";
     return;
   }
+  if ((int) ddef.nchans != numChannels) return; // the header has changed, see waitCallback
 
   floatStore.resize(sizeof(float) * ddef.nsamples * ddef.nchans);
 
   float *fdata = (float *) floatStore.data();
   switch(ddef.data_type) {
     case DATATYPE_UINT8:
-      convertToFloat<uint8_t>(fdata, rawStore.data(), ddef.nsamples, ddef.nchans);
+      convertToFloat<uint8_t>(fdata, rawData, ddef.nsamples, ddef.nchans);
       break;
     case DATATYPE_INT8:
-      convertToFloat<int8_t>(fdata, rawStore.data(), ddef.nsamples, ddef.nchans);
+      convertToFloat<int8_t>(fdata, rawData, ddef.nsamples, ddef.nchans);
       break;
     case DATATYPE_UINT16:
-      convertToFloat<uint16_t>(fdata, rawStore.data(), ddef.nsamples, ddef.nchans);
+      convertToFloat<uint16_t>(fdata, rawData, ddef.nsamples, ddef.nchans);
       break;
     case DATATYPE_INT16:
-      convertToFloat<int16_t>(fdata, rawStore.data(), ddef.nsamples, ddef.nchans);
+      convertToFloat<int16_t>(fdata, rawData, ddef.nsamples, ddef.nchans);
       break;
     case DATATYPE_UINT32:
-      convertToFloat<uint32_t>(fdata, rawStore.data(), ddef.nsamples, ddef.nchans);
+      convertToFloat<uint32_t>(fdata, rawData, ddef.nsamples, ddef.nchans);
       break;
     case DATATYPE_INT32:
-      convertToFloat<int32_t>(fdata, rawStore.data(), ddef.nsamples, ddef.nchans);
+      convertToFloat<int32_t>(fdata, rawData, ddef.nsamples, ddef.nchans);
       break;
     case DATATYPE_UINT64:
-      convertToFloat<uint64_t>(fdata, rawStore.data(), ddef.nsamples, ddef.nchans);
+      convertToFloat<uint64_t>(fdata, rawData, ddef.nsamples, ddef.nchans);
       break;
     case DATATYPE_INT64:
-      convertToFloat<int64_t>(fdata, rawStore.data(), ddef.nsamples, ddef.nchans);
+      convertToFloat<int64_t>(fdata, rawData, ddef.nsamples, ddef.nchans);
       break;
   	case DATATYPE_FLOAT32:
-	  convertToFloat<float>(fdata, rawStore.data(), ddef.nsamples, ddef.nchans);
+	  convertToFloat<float>(fdata, rawData, ddef.nsamples, ddef.nchans);
       break;
     case DATATYPE_FLOAT64:
-      convertToFloat<double>(fdata, rawStore.data(), ddef.nsamples, ddef.nchans);
+      convertToFloat<double>(fdata, rawData, ddef.nsamples, ddef.nchans);
       break;
   }
   if (useHighpass) {
@@ -564,8 +734,6 @@ void idleCall(void *dummy) {
     lpFilter->process(ddef.nsamples, fdata, fdata); // in place
   }
   oddis->addSamples(ddef.nsamples, fdata);
-
-  numSamples = newSamples;
 }
 
 
@@ -625,7 +793,6 @@ int main(int argc, char **argv) {
   window->show();
 
   generalCallback(NULL, 0);
-  Fl::add_idle(idleCall);
 
   if (argc > 1) {
     addrField->value(argv[1]);
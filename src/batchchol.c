@@ -0,0 +1,73 @@
+#include <math.h>
+#include <mex.h>
+#include "smallmat.h"
+
+static void kernel(const smallmat_t *s, mwSize first, int nl)
+{
+  smallmat_block ar[SMALLMAT_MAXN*SMALLMAT_MAXN], ai[SMALLMAT_MAXN*SMALLMAT_MAXN];
+  smallmat_block rr[SMALLMAT_MAXN*SMALLMAT_MAXN], ri[SMALLMAT_MAXN*SMALLMAT_MAXN];
+  double xr[SMALLMAT_BLOCK], xi[SMALLMAT_BLOCK];
+  int i, j, k, l, n = s->n, nel = s->nela;
+  
+  smallmat_get(ar, s->ar, s->singlea, nel, first, nl);
+  memset(rr, 0, nel*sizeof(smallmat_block));
+  if (s->complex)
+  {
+    smallmat_get(ai, s->ai, s->singlea, nel, first, nl);
+    memset(ri, 0, nel*sizeof(smallmat_block));
+  }
+  
+  /*compute the upper triangular r with r'*r = a, the upper triangle of a is used*/
+  for (j=0; j<n; j++)
+  {
+    for (i=0; i<=j; i++)
+    {
+      LANES(l)
+      {
+        xr[l] = ar[i+j*n][l];
+        xi[l] = (s->complex ? ai[i+j*n][l] : 0);
+      }
+      for (k=0; k<i; k++)
+      {
+        /*subtract conj(r(k,i))*r(k,j)*/
+        LANES(l) xr[l] -= rr[k+i*n][l]*rr[k+j*n][l];
+        if (s->complex)
+          LANES(l)
+          {
+            xr[l] -= ri[k+i*n][l]*ri[k+j*n][l];
+            xi[l] -= rr[k+i*n][l]*ri[k+j*n][l] - ri[k+i*n][l]*rr[k+j*n][l];
+          }
+      }
+      if (i==j)
+      {
+        /*this results in NaN if the matrix is not positive definite*/
+        LANES(l) rr[j+j*n][l] = (xr[l]>0 ? sqrt(xr[l]) : NAN);
+      }
+      else
+      {
+        LANES(l) rr[i+j*n][l] = xr[l]/rr[i+i*n][l];
+        if (s->complex)
+          LANES(l) ri[i+j*n][l] = xi[l]/rr[i+i*n][l];
+      }
+    }
+  }
+  smallmat_put(s->cr, s->singlec, nel, first, nl, rr);
+  smallmat_put(s->ci, s->singlec, nel, first, nl, ri);
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  smallmat_t s;
+  int n;
+  
+  /*check inputs and associate output*/
+  if (nrhs!=1)
+    mexErrMsgTxt("Wrong number of input arguments");
+  n = smallmat_order(prhs[0]);
+  smallmat_init(&s, plhs, nrhs, prhs, 1, n*n, n*n);
+  s.n = n;
+  
+  /* do the computation*/
+  s.kernel = kernel;
+  smallmat_run(&s);
+}
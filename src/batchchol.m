@@ -0,0 +1,45 @@
+function r = batchchol(x)
+
+% BATCHCHOL computes the upper triangular Cholesky factor r with r'*r = x for the
+% Hermitian positive definite matrices in x, where size(x) = [N N K M] and N is
+% at most 8. The factor of a matrix that is not positive definite contains NaNs.
+%
+% This is the MATLAB implementation, the mex file is much faster.
+%
+% See also BATCHEIG, BATCHSQRTM, CHOL
+
+% Copyright (C) 2017, Donders Centre for Cognitive Neuroimaging, Nijmegen, NL
+%
+% This file is part of FieldTrip, see http://www.fieldtriptoolbox.org
+% for the documentation and details.
+%
+%    FieldTrip is free software: you can redistribute it and/or modify
+%    it under the terms of the GNU General Public License as published by
+%    the Free Software Foundation, either version 3 of the License, or
+%    (at your option) any later version.
+%
+%    FieldTrip is distributed in the hope that it will be useful,
+%    but WITHOUT ANY WARRANTY; without even the implied warranty of
+%    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+%    GNU General Public License for more details.
+%
+%    You should have received a copy of the GNU General Public License
+%    along with FieldTrip. If not, see <http://www.gnu.org/licenses/>.
+%
+% $Id$
+
+siz = size(x);
+if numel(siz)<2 || siz(1)~=siz(2)
+  ft_error('the input should consist of square matrices');
+end
+x = reshape(x, siz(1), siz(2), []);
+r = zeros(size(x), class(x));
+for k=1:size(x,3)
+  [y, p] = chol(x(:,:,k));
+  if p==0
+    r(:,:,k) = y;
+  else
+    r(:,:,k) = nan;
+  end
+end
+r = reshape(r, siz);
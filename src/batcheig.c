@@ -0,0 +1,97 @@
+#include <math.h>
+#include <mex.h>
+#include "smallmat.h"
+
+#define A(i,j)  ar[(i)+3*(j)][l]
+#define AI(i,j) (ai ? ai[(i)+3*(j)][l] : 0)
+
+/*eigenvalues of a block of Hermitian 3x3 matrices, using the trigonometric solution of the characteristic polynomial*/
+static void eigvals3x3(const smallmat_block *ar, const smallmat_block *ai, smallmat_block *d)
+{
+  double p1, p2, p, q, b00, b11, b22, r, phi, detr;
+  int l;
+  
+  LANES(l)
+  {
+    p1  = A(0,1)*A(0,1) + AI(0,1)*AI(0,1) + A(0,2)*A(0,2) + AI(0,2)*AI(0,2) + A(1,2)*A(1,2) + AI(1,2)*AI(1,2);
+    q   = (A(0,0) + A(1,1) + A(2,2))/3;
+    b00 = A(0,0) - q;
+    b11 = A(1,1) - q;
+    b22 = A(2,2) - q;
+    p2  = b00*b00 + b11*b11 + b22*b22 + 2*p1;
+    p   = sqrt(p2/6);
+    
+    /*the determinant of a Hermitian matrix is real, the p equal to zero means that all eigenvalues are the same*/
+    detr = b00*b11*b22 - b00*(A(1,2)*A(1,2)+AI(1,2)*AI(1,2)) - b11*(A(0,2)*A(0,2)+AI(0,2)*AI(0,2)) - b22*(A(0,1)*A(0,1)+AI(0,1)*AI(0,1))
+         + 2*(A(0,1)*(A(1,2)*A(0,2)+AI(1,2)*AI(0,2)) - AI(0,1)*(AI(1,2)*A(0,2)-A(1,2)*AI(0,2)));
+    r    = (p>0 ? detr/(2*p*p*p) : 0);
+    r    = (r<-1 ? -1 : (r>1 ? 1 : r));
+    phi  = acos(r)/3;
+    
+    d[2][l] = q + 2*p*cos(phi);
+    d[0][l] = q + 2*p*cos(phi + 2*M_PI/3);
+    d[1][l] = 3*q - d[0][l] - d[2][l];
+  }
+}
+
+static void kernel(const smallmat_t *s, mwSize first, int nl)
+{
+  smallmat_block ar[SMALLMAT_MAXN*SMALLMAT_MAXN], ai[SMALLMAT_MAXN*SMALLMAT_MAXN];
+  smallmat_block vr[SMALLMAT_MAXN*SMALLMAT_MAXN], vi[SMALLMAT_MAXN*SMALLMAT_MAXN];
+  smallmat_block d[SMALLMAT_MAXN];
+  int n = s->n, nel = s->nela;
+  
+  smallmat_get(ar, s->ar, s->singlea, nel, first, nl);
+  if (s->complex)
+    smallmat_get(ai, s->ai, s->singlea, nel, first, nl);
+  smallmat_hermitian(n, ar, (s->complex ? ai : NULL));
+  
+  if (s->cr == NULL && n == 3)
+  {
+    /*only the eigenvalues are needed*/
+    eigvals3x3(ar, (s->complex ? ai : NULL), d);
+  }
+  else
+  {
+    smallmat_eigh(n, ar, (s->complex ? ai : NULL), (s->cr ? vr : NULL), (s->cr && s->complex ? vi : NULL), d);
+    smallmat_put(s->cr, s->singlec, nel, first, nl, vr);
+    smallmat_put(s->ci, s->singlec, nel, first, nl, vi);
+  }
+  smallmat_put(s->dr, s->singlec, n, first, nl, d);
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  smallmat_t s;
+  mxClassID classid;
+  int n;
+  
+  /*check inputs*/
+  if (nrhs!=1)
+    mexErrMsgTxt("Wrong number of input arguments");
+  if (nlhs>2)
+    mexErrMsgTxt("Too many output arguments");
+  n = smallmat_order(prhs[0]);
+  smallmat_init(&s, plhs, nrhs, prhs, 1, n*n, 0);
+  s.n     = n;
+  classid = (s.singlec ? mxSINGLE_CLASS : mxDOUBLE_CLASS);
+  
+  /*associate outputs, these are [d] or [v, d]*/
+  if (nlhs<2)
+  {
+    plhs[0] = smallmat_create(prhs[0], n*n, n, classid, 0);
+    s.dr    = mxGetData(plhs[0]);
+  }
+  else
+  {
+    plhs[0] = smallmat_create(prhs[0], n*n, n*n, classid, s.complex);
+    plhs[1] = smallmat_create(prhs[0], n*n, n, classid, 0);
+    s.cr    = mxGetData(plhs[0]);
+    s.ci    = mxGetImagData(plhs[0]);
+    s.dr    = mxGetData(plhs[1]);
+  }
+  
+  /* do the computation*/
+  s.kernel = kernel;
+  smallmat_run(&s);
+}
@@ -0,0 +1,57 @@
+function [v, d] = batcheig(x)
+
+% BATCHEIG computes the eigenvalues and eigenvectors of the Hermitian matrices in
+% x, where size(x) = [N N K M] and N is at most 8.
+%
+% Use as
+%   d      = batcheig(x)
+%   [v, d] = batcheig(x)
+% where d contains the eigenvalues in ascending order with size [N 1 K M] and v
+% contains the eigenvectors in its columns with size [N N K M]. Note that d is a
+% vector and not a diagonal matrix like with EIG.
+%
+% This is the MATLAB implementation, the mex file is much faster.
+%
+% See also BATCHSQRTM, BATCHCHOL, EIG
+
+% Copyright (C) 2017, Donders Centre for Cognitive Neuroimaging, Nijmegen, NL
+%
+% This file is part of FieldTrip, see http://www.fieldtriptoolbox.org
+% for the documentation and details.
+%
+%    FieldTrip is free software: you can redistribute it and/or modify
+%    it under the terms of the GNU General Public License as published by
+%    the Free Software Foundation, either version 3 of the License, or
+%    (at your option) any later version.
+%
+%    FieldTrip is distributed in the hope that it will be useful,
+%    but WITHOUT ANY WARRANTY; without even the implied warranty of
+%    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+%    GNU General Public License for more details.
+%
+%    You should have received a copy of the GNU General Public License
+%    along with FieldTrip. If not, see <http://www.gnu.org/licenses/>.
+%
+% $Id$
+
+siz = size(x);
+if numel(siz)<2 || siz(1)~=siz(2)
+  ft_error('the input should consist of square matrices');
+end
+x  = reshape(x, siz(1), siz(2), []);
+dd = zeros(siz(1), 1, size(x,3), class(x));
+vv = zeros(size(x), class(x));
+for k=1:size(x,3)
+  y = (x(:,:,k) + x(:,:,k)')./2;
+  [u, e] = eig(y);
+  [e, indx] = sort(real(diag(e)));
+  dd(:,1,k) = e;
+  vv(:,:,k) = u(:,indx);
+end
+
+if nargout<2
+  v = reshape(dd, [siz(1) 1 siz(3:end)]);
+else
+  v = reshape(vv, siz);
+  d = reshape(dd, [siz(1) 1 siz(3:end)]);
+end
@@ -0,0 +1,52 @@
+#include <math.h>
+#include <mex.h>
+#include "smallmat.h"
+
+static void kernel(const smallmat_t *s, mwSize first, int nl)
+{
+  smallmat_block ar[SMALLMAT_MAXN*SMALLMAT_MAXN], ai[SMALLMAT_MAXN*SMALLMAT_MAXN];
+  smallmat_block vr[SMALLMAT_MAXN*SMALLMAT_MAXN], vi[SMALLMAT_MAXN*SMALLMAT_MAXN];
+  smallmat_block wr[SMALLMAT_MAXN*SMALLMAT_MAXN], wi[SMALLMAT_MAXN*SMALLMAT_MAXN];
+  smallmat_block d[SMALLMAT_MAXN];
+  int i, k, l, n = s->n, nel = s->nela;
+  
+  smallmat_get(ar, s->ar, s->singlea, nel, first, nl);
+  if (s->complex)
+    smallmat_get(ai, s->ai, s->singlea, nel, first, nl);
+  smallmat_hermitian(n, ar, (s->complex ? ai : NULL));
+  smallmat_eigh(n, ar, (s->complex ? ai : NULL), vr, (s->complex ? vi : NULL), d);
+  
+  /*scale the eigenvectors with the square root of the eigenvalues, negative eigenvalues due to rounding errors are set to zero*/
+  for (k=0; k<n; k++)
+  {
+    LANES(l) d[k][l] = sqrt(d[k][l]>0 ? d[k][l] : 0);
+    for (i=0; i<n; i++)
+    {
+      LANES(l) wr[i+k*n][l] = vr[i+k*n][l]*d[k][l];
+      if (s->complex)
+        LANES(l) wi[i+k*n][l] = vi[i+k*n][l]*d[k][l];
+    }
+  }
+  
+  /*the output is v*sqrt(d)*v', the input is not needed any more and holds the output*/
+  smallmat_mtimes(n, ar, (s->complex ? ai : NULL), wr, wi, vr, vi, 1);
+  smallmat_put(s->cr, s->singlec, nel, first, nl, ar);
+  smallmat_put(s->ci, s->singlec, nel, first, nl, ai);
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  smallmat_t s;
+  int n;
+  
+  /*check inputs and associate output*/
+  if (nrhs!=1)
+    mexErrMsgTxt("Wrong number of input arguments");
+  n = smallmat_order(prhs[0]);
+  smallmat_init(&s, plhs, nrhs, prhs, 1, n*n, n*n);
+  s.n = n;
+  
+  /* do the computation*/
+  s.kernel = kernel;
+  smallmat_run(&s);
+}
@@ -0,0 +1,42 @@
+function y = batchsqrtm(x)
+
+% BATCHSQRTM computes the square root of the positive semi-definite Hermitian
+% matrices in x, where size(x) = [N N K M] and N is at most 8. Negative
+% eigenvalues, which result from rounding errors, are set to zero.
+%
+% This is the MATLAB implementation, the mex file is much faster.
+%
+% See also BATCHEIG, BATCHCHOL, SQRTM
+
+% Copyright (C) 2017, Donders Centre for Cognitive Neuroimaging, Nijmegen, NL
+%
+% This file is part of FieldTrip, see http://www.fieldtriptoolbox.org
+% for the documentation and details.
+%
+%    FieldTrip is free software: you can redistribute it and/or modify
+%    it under the terms of the GNU General Public License as published by
+%    the Free Software Foundation, either version 3 of the License, or
+%    (at your option) any later version.
+%
+%    FieldTrip is distributed in the hope that it will be useful,
+%    but WITHOUT ANY WARRANTY; without even the implied warranty of
+%    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+%    GNU General Public License for more details.
+%
+%    You should have received a copy of the GNU General Public License
+%    along with FieldTrip. If not, see <http://www.gnu.org/licenses/>.
+%
+% $Id$
+
+siz = size(x);
+if numel(siz)<2 || siz(1)~=siz(2)
+  ft_error('the input should consist of square matrices');
+end
+x = reshape(x, siz(1), siz(2), []);
+y = zeros(size(x), class(x));
+for k=1:size(x,3)
+  [u, e] = eig((x(:,:,k) + x(:,:,k)')./2);
+  e = sqrt(max(real(diag(e)), 0));
+  y(:,:,k) = u*diag(e)*u';
+end
+y = reshape(y, siz);
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ * A minimal stand-in for the mxArray API of MATLAB, so that the mex files in
+ * src can be compiled and timed without MATLAB, see mexbench.c. It supports
+ * the numeric, logical and char arrays, the sparse double arrays and the
+ * functions that the mex files use, with the same names and semantics, but
+ * it is not complete and not meant to be. The memory of mxMalloc and mxCalloc is released by
+ * mxShimFreeAll after every call of a mex file, like MATLAB does.
+ */
+
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* the integer types of tmwtypes.h */
+typedef int8_t int8_T;
+typedef uint8_t uint8_T;
+typedef int16_t int16_T;
+typedef uint16_t uint16_T;
+typedef int32_t int32_T;
+typedef uint32_t uint32_T;
+typedef int64_t int64_T;
+typedef uint64_t uint64_T;
+typedef float real32_T;
+typedef double real64_T;
+
+typedef size_t mwSize;
+typedef size_t mwIndex;
+typedef ptrdiff_t mwSignedIndex;
+typedef unsigned short mxChar;
+typedef bool mxLogical;
+
+typedef enum {
+  mxUNKNOWN_CLASS = 0,
+  mxCELL_CLASS,
+  mxSTRUCT_CLASS,
+  mxLOGICAL_CLASS,
+  mxCHAR_CLASS,
+  mxVOID_CLASS,
+  mxDOUBLE_CLASS,
+  mxSINGLE_CLASS,
+  mxINT8_CLASS,
+  mxUINT8_CLASS,
+  mxINT16_CLASS,
+  mxUINT16_CLASS,
+  mxINT32_CLASS,
+  mxUINT32_CLASS,
+  mxINT64_CLASS,
+  mxUINT64_CLASS,
+  mxFUNCTION_CLASS
+} mxClassID;
+
+typedef enum {
+  mxREAL = 0,
+  mxCOMPLEX
+} mxComplexity;
+
+typedef struct mxArray_tag mxArray;
+
+/* creating and destroying arrays */
+mxArray *mxCreateNumericArray(mwSize ndim, const mwSize *dims, mxClassID classid, mxComplexity flag);
+mxArray *mxCreateNumericMatrix(mwSize m, mwSize n, mxClassID classid, mxComplexity flag);
+mxArray *mxCreateDoubleMatrix(mwSize m, mwSize n, mxComplexity flag);
+mxArray *mxCreateDoubleScalar(double value);
+mxArray *mxCreateLogicalMatrix(mwSize m, mwSize n);
+mxArray *mxCreateString(const char *str);
+mxArray *mxCreateSparse(mwSize m, mwSize n, mwSize nzmax, mxComplexity flag);
+void mxDestroyArray(mxArray *pa);
+
+/* the class and size */
+mxClassID mxGetClassID(const mxArray *pa);
+mwSize mxGetNumberOfDimensions(const mxArray *pa);
+const mwSize *mxGetDimensions(const mxArray *pa);
+size_t mxGetM(const mxArray *pa);
+size_t mxGetN(const mxArray *pa);
+size_t mxGetNumberOfElements(const mxArray *pa);
+size_t mxGetElementSize(const mxArray *pa);
+
+bool mxIsNumeric(const mxArray *pa);
+bool mxIsComplex(const mxArray *pa);
+bool mxIsEmpty(const mxArray *pa);
+bool mxIsDouble(const mxArray *pa);
+bool mxIsSingle(const mxArray *pa);
+bool mxIsLogical(const mxArray *pa);
+bool mxIsChar(const mxArray *pa);
+bool mxIsUint32(const mxArray *pa);
+bool mxIsSparse(const mxArray *pa);
+
+/* the contents */
+void *mxGetData(const mxArray *pa);
+void *mxGetImagData(const mxArray *pa);
+double *mxGetPr(const mxArray *pa);
+double *mxGetPi(const mxArray *pa);
+double mxGetScalar(const mxArray *pa);
+int mxGetString(const mxArray *pa, char *buf, mwSize buflen);
+char *mxArrayToString(const mxArray *pa);
+mwIndex *mxGetIr(const mxArray *pa);
+mwIndex *mxGetJc(const mxArray *pa);
+mwSize mxGetNzmax(const mxArray *pa);
+
+/* memory that is released after the mex file returns */
+void *mxMalloc(size_t n);
+void *mxCalloc(size_t n, size_t size);
+void *mxRealloc(void *ptr, size_t size);
+void mxFree(void *ptr);
+
+double mxGetEps(void);
+double mxGetNaN(void);
+double mxGetInf(void);
+
+/* not part of MATLAB: releases whatever the last mex file left of mxMalloc and mxCalloc */
+void mxShimFreeAll(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MATRIX_H */
@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ * A minimal stand-in for the MEX API of MATLAB, see matrix.h. The errors of
+ * mexErrMsgTxt return to the last mxShimTry, and mexCallMATLAB always fails.
+ */
+
+#ifndef MEX_H
+#define MEX_H
+
+#include <stdio.h>
+#include <setjmp.h>
+#include "matrix.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* every mex file implements this, mexbench.c renames it per mex file */
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]);
+
+void mexErrMsgTxt(const char *msg);
+void mexErrMsgIdAndTxt(const char *id, const char *fmt, ...);
+void mexWarnMsgTxt(const char *msg);
+int mexPrintf(const char *fmt, ...);
+int mexCallMATLAB(int nlhs, mxArray *plhs[], int nrhs, mxArray *prhs[], const char *name);
+int mexAtExit(void (*func)(void));
+
+/* not part of MATLAB: the place to which mexErrMsgTxt jumps, and the message */
+extern jmp_buf mxShimErrorJump;
+extern char mxShimErrorMessage[256];
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MEX_H */
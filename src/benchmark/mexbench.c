@@ -0,0 +1,653 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ * Micro-benchmark of the computational mex files in src, without MATLAB.
+ *
+ * The mex files are compiled unchanged against the stand-in for the MEX API
+ * in this directory (see matrix.h), with their mexFunction renamed, and are
+ * called here with generated inputs of representative shapes and types. The
+ * mex files divide their work over sysconf(_SC_NPROCESSORS_ONLN) threads,
+ * which is redirected to mexbench_sysconf, so that the same inputs can be
+ * timed with 1, 2, 4, ... threads. For every case this prints the best time
+ * per unit (an element, a matrix, an entry, ...) over repeated calls, and the
+ * speedup relative to a single thread. Compile with make, and use as
+ *
+ *   mexbench [-k kernel[,kernel...]] [-t maxthreads] [-m seconds] [-q] [-l]
+ *
+ * where -k selects the kernels (default all), -t is the largest number of
+ * threads (default the number of processors, at most 16), -m is the minimal
+ * time per measurement (default 0.2 s), -q leaves out the largest inputs
+ * and -l lists the kernels. The output is plain text with one line per
+ * measurement, so that the results of different versions can be compared
+ * with diff or a spreadsheet.
+ */
+
+#define _LARGEFILE_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "mex.h"
+
+typedef void (*mexfunc_t)(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]);
+
+/* the renamed mex files, see the Makefile */
+void mex_nanmean(int, mxArray *[], int, const mxArray *[]);
+void mex_nanstd(int, mxArray *[], int, const mxArray *[]);
+void mex_mtimes3x3(int, mxArray *[], int, const mxArray *[]);
+void mex_inv3x3(int, mxArray *[], int, const mxArray *[]);
+void mex_sandwich3x3(int, mxArray *[], int, const mxArray *[]);
+void mex_meg_leadfield1(int, mxArray *[], int, const mxArray *[]);
+void mex_combineClusters(int, mxArray *[], int, const mxArray *[]);
+void mex_splint_gh(int, mxArray *[], int, const mxArray *[]);
+void mex_solid_angle(int, mxArray *[], int, const mxArray *[]);
+void mex_read_24bit(int, mxArray *[], int, const mxArray *[]);
+void mex_meshinterp(int, mxArray *[], int, const mxArray *[]);
+
+#define MAXARGS    8
+#define MAXTHREADS 16
+
+typedef struct {
+  char shape[64];
+  const char *type;
+  double numunit;               /* number of units that the time is divided by */
+  int threaded;                 /* the mex file may use multiple threads for this input */
+  int nlhs, nrhs;
+  mxArray *prhs[MAXARGS];
+} bench_case_t;
+
+/* fills in case k of a kernel, returns 0 if there are no more cases */
+typedef int (*setup_t)(int k, bench_case_t *c);
+
+typedef struct {
+  const char *name;
+  mexfunc_t func;
+  const char *unit;
+  setup_t setup;
+} kernel_t;
+
+static int quick = 0;
+static int numthreads = 1;
+static double mintime = 0.2;
+static char datafile[256] = "";
+
+/* the number of processors that the mex files see */
+long mexbench_sysconf(int name) {
+  if (name == _SC_NPROCESSORS_ONLN)
+    return numthreads;
+  return sysconf(name);
+}
+
+static double now(void) {
+#if defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9*ts.tv_nsec;
+#else
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + 1e-6*tv.tv_usec;
+#endif
+}
+
+/* a simple and fast generator of uniform random numbers in [0,1), the same on all platforms */
+static unsigned long long rngstate = 88172645463325252ULL;
+static double uniform(void) {
+  rngstate ^= rngstate << 13;
+  rngstate ^= rngstate >> 7;
+  rngstate ^= rngstate << 17;
+  return (rngstate >> 11) * (1.0/9007199254740992.0);
+}
+
+/* creates an array with values in [lo,hi), of which a fraction are NaN */
+static mxArray *random_array(mwSize ndim, const mwSize *dims, mxClassID classid, mxComplexity flag, double lo, double hi, double nanfraction) {
+  mxArray *pa = mxCreateNumericArray(ndim, dims, classid, flag);
+  size_t i, n = mxGetNumberOfElements(pa);
+  int part;
+
+  for (part=0; part<(flag==mxCOMPLEX ? 2 : 1); part++) {
+    void *p = (part==0 ? mxGetData(pa) : mxGetImagData(pa));
+    for (i=0; i<n; i++) {
+      double v = lo + (hi-lo)*uniform();
+      if (nanfraction>0 && uniform()<nanfraction)
+        v = NAN;
+      if (classid == mxSINGLE_CLASS)
+        ((float *)p)[i] = (float)v;
+      else
+        ((double *)p)[i] = v;
+    }
+  }
+  return pa;
+}
+
+static mxArray *random_matrix(mwSize m, mwSize n, mxClassID classid, double lo, double hi) {
+  mwSize dims[2];
+  dims[0] = m;
+  dims[1] = n;
+  return random_array(2, dims, classid, mxREAL, lo, hi, 0);
+}
+
+/* nchan x 3 points at the given radius, and their normals if ori is given */
+static mxArray *sphere_points(mwSize n, double radius, mxClassID classid, mxArray **ori) {
+  mxArray *pnt = mxCreateNumericMatrix(n, 3, classid, mxREAL);
+  mwSize i;
+  int k;
+
+  if (ori)
+    *ori = mxCreateNumericMatrix(n, 3, classid, mxREAL);
+  for (i=0; i<n; i++) {
+    double v[3], r = 0;
+    for (k=0; k<3; k++) {
+      v[k] = 2*uniform() - 1;
+      r += v[k]*v[k];
+    }
+    r = sqrt(r) + 1e-9;
+    for (k=0; k<3; k++) {
+      double val = radius*uniform()*v[k]/r;
+      if (classid == mxSINGLE_CLASS) {
+        ((float *)mxGetData(pnt))[i+k*n] = (float)val;
+        if (ori) ((float *)mxGetData(*ori))[i+k*n] = (float)(v[k]/r);
+      } else {
+        ((double *)mxGetData(pnt))[i+k*n] = val;
+        if (ori) ((double *)mxGetData(*ori))[i+k*n] = v[k]/r;
+      }
+    }
+  }
+  return pnt;
+}
+
+static const char *class_name(mxClassID classid, int complex) {
+  if (classid == mxSINGLE_CLASS)
+    return (complex ? "csingle" : "single");
+  return (complex ? "cdouble" : "double");
+}
+
+/*******************************************************************************
+ * NANMEAN and NANSTD, along the first and second dimension
+ *******************************************************************************/
+
+static int setup_nan(int k, bench_case_t *c, int isstd) {
+  static const double sizes[] = {1e4, 1e6, 1e7};
+  int nsize = (quick ? 2 : 3);
+  int size = k % nsize, shape = (k / nsize) % 3, type = k / (3*nsize);
+  mwSize n = (mwSize)sizes[size], dims[2];
+  mxClassID classid = (type==0 ? mxDOUBLE_CLASS : mxSINGLE_CLASS);
+  double dim;
+
+  if (type > 1)
+    return 0;
+  if (shape == 0) {
+    /* a column vector */
+    dims[0] = n; dims[1] = 1; dim = 1;
+  } else {
+    /* channels by samples, along the samples or along the channels */
+    dims[0] = 64; dims[1] = n/64; dim = (shape==1 ? 2 : 1);
+  }
+  sprintf(c->shape, "%lux%lu dim=%d", (unsigned long)dims[0], (unsigned long)dims[1], (int)dim);
+  c->type     = class_name(classid, 0);
+  c->numunit  = (double)(dims[0]*dims[1]);
+  c->threaded = 1;
+  c->nlhs     = (isstd ? 1 : 2);
+  c->prhs[0]  = random_array(2, dims, classid, mxREAL, -1, 1, 0.1);
+  if (isstd) {
+    c->nrhs    = 3;
+    c->prhs[1] = mxCreateDoubleScalar(0);
+    c->prhs[2] = mxCreateDoubleScalar(dim);
+  } else {
+    c->nrhs    = 2;
+    c->prhs[1] = mxCreateDoubleScalar(dim);
+  }
+  return 1;
+}
+
+static int setup_nanmean(int k, bench_case_t *c) { return setup_nan(k, c, 0); }
+static int setup_nanstd(int k, bench_case_t *c) { return setup_nan(k, c, 1); }
+
+/*******************************************************************************
+ * MTIMES3X3, INV3X3 and SANDWICH3X3, on 3x3xN arrays
+ *******************************************************************************/
+
+static int setup_smallmat(int k, bench_case_t *c, int nrhs, int diagonal) {
+  static const double sizes[] = {1e3, 1e5, 1e6};
+  int nsize = (quick ? 2 : 3);
+  int size = k % nsize, type = k / nsize, i;
+  mwSize dims[3], j;
+  mxClassID classid = (type==1 ? mxSINGLE_CLASS : mxDOUBLE_CLASS);
+  mxComplexity flag = (type==2 ? mxCOMPLEX : mxREAL);
+
+  if (type > 2)
+    return 0;
+  dims[0] = 3;
+  dims[1] = 3;
+  dims[2] = (mwSize)sizes[size];
+  sprintf(c->shape, "3x3x%lu", (unsigned long)dims[2]);
+  c->type     = class_name(classid, flag==mxCOMPLEX);
+  c->numunit  = (double)dims[2];
+  c->threaded = 1;
+  c->nlhs     = 1;
+  c->nrhs     = nrhs;
+  for (i=0; i<nrhs; i++) {
+    c->prhs[i] = random_array(3, dims, classid, flag, -1, 1, 0);
+    if (diagonal) {
+      /* keep the matrices well away from singular */
+      for (j=0; j<dims[2]; j++) {
+        if (classid == mxSINGLE_CLASS) {
+          float *p = (float *)mxGetData(c->prhs[i]) + 9*j;
+          p[0] += 4; p[4] += 4; p[8] += 4;
+        } else {
+          double *p = (double *)mxGetData(c->prhs[i]) + 9*j;
+          p[0] += 4; p[4] += 4; p[8] += 4;
+        }
+      }
+    }
+  }
+  return 1;
+}
+
+static int setup_mtimes3x3(int k, bench_case_t *c) { return setup_smallmat(k, c, 2, 0); }
+static int setup_inv3x3(int k, bench_case_t *c) { return setup_smallmat(k, c, 1, 1); }
+static int setup_sandwich3x3(int k, bench_case_t *c) { return setup_smallmat(k, c, 2, 0); }
+
+/*******************************************************************************
+ * MEG_LEADFIELD1, of 300 channels for a growing number of dipoles
+ *******************************************************************************/
+
+static int setup_meg_leadfield1(int k, bench_case_t *c) {
+  static const double sizes[] = {1, 100, 2000};
+  int nsize = 3;
+  int size = k % nsize, type = k / nsize;
+  mwSize npos = (mwSize)sizes[size], nchan = 300;
+  mxClassID classid = (type==0 ? mxDOUBLE_CLASS : mxSINGLE_CLASS);
+
+  if (type > 1)
+    return 0;
+  if (quick && npos > 500)
+    npos = 500;
+  sprintf(c->shape, "%lu dipoles, %lu channels", (unsigned long)npos, (unsigned long)nchan);
+  c->type     = class_name(classid, 0);
+  c->numunit  = (double)(npos*nchan);
+  c->threaded = 1;
+  c->nlhs     = 1;
+  c->nrhs     = 3;
+  c->prhs[0]  = sphere_points(npos, 0.07, classid, NULL);
+  c->prhs[1]  = sphere_points(nchan, 0.12, classid, &c->prhs[2]);
+  return 1;
+}
+
+/*******************************************************************************
+ * COMBINECLUSTERS, of 128 channels with 8 neighbours each, for a number of
+ * permutations
+ *******************************************************************************/
+
+static int setup_combineClusters(int k, bench_case_t *c) {
+  static const double sizes[] = {1, 50, 500};
+  mwSize nchan = 128, ntf = 200, nrep, dims[3], i, j, r;
+  unsigned int *label, total = 0;
+  mxLogical *nb;
+
+  if (k >= (quick ? 2 : 3))
+    return 0;
+  nrep = (mwSize)sizes[k];
+  dims[0] = nchan;
+  dims[1] = ntf;
+  dims[2] = nrep;
+  sprintf(c->shape, "%lux%lux%lu", (unsigned long)nchan, (unsigned long)ntf, (unsigned long)nrep);
+  c->type     = "uint32";
+  c->numunit  = (double)(nchan*ntf*nrep);
+  c->threaded = 1;
+  c->nlhs     = 1;
+  c->nrhs     = 3;
+
+  /* the clusters are runs of channels in each time-frequency bin, which the neighbours join */
+  c->prhs[0] = mxCreateNumericArray(3, dims, mxUINT32_CLASS, mxREAL);
+  label = (unsigned int *)mxGetData(c->prhs[0]);
+  for (r=0; r<nrep; r++) {
+    unsigned int numlabel = 0;
+    for (j=0; j<ntf; j++) {
+      int inside = 0;
+      for (i=0; i<nchan; i++) {
+        if (uniform() < 0.2)
+          inside = !inside;
+        if (inside && (i==0 || label[r*nchan*ntf + j*nchan + i-1]==0))
+          numlabel++;
+        label[r*nchan*ntf + j*nchan + i] = (inside ? numlabel : 0);
+      }
+    }
+    if (numlabel > total)
+      total = numlabel;
+  }
+  c->prhs[1] = mxCreateLogicalMatrix(nchan, nchan);
+  nb = (mxLogical *)mxGetData(c->prhs[1]);
+  for (i=0; i<nchan; i++)
+    for (j=1; j<=4; j++)
+      nb[i*nchan + (i+j)%nchan] = nb[((i+j)%nchan)*nchan + i] = 1;
+  c->prhs[2] = mxCreateNumericMatrix(1, 1, mxUINT32_CLASS, mxREAL);
+  *(unsigned int *)mxGetData(c->prhs[2]) = total;
+  return 1;
+}
+
+/*******************************************************************************
+ * SPLINT_GH, of the cosines between all pairs of electrodes
+ *******************************************************************************/
+
+static int setup_splint_gh(int k, bench_case_t *c) {
+  static const double sizes[] = {64, 256, 1024};
+  mwSize n;
+
+  if (k >= 3)
+    return 0;
+  n = (mwSize)sizes[k];
+  if (quick && n > 512)
+    n = 512;
+  sprintf(c->shape, "%lux%lu", (unsigned long)n, (unsigned long)n);
+  c->type     = "double";
+  c->numunit  = (double)(n*n);
+  c->threaded = 1;
+  c->nlhs     = 2;
+  c->nrhs     = 1;
+  c->prhs[0]  = random_matrix(n, n, mxDOUBLE_CLASS, -1, 1);
+  return 1;
+}
+
+/*******************************************************************************
+ * SOLID_ANGLE, of a triangulated surface as seen from the origin
+ *******************************************************************************/
+
+static int setup_solid_angle(int k, bench_case_t *c) {
+  static const double sizes[] = {1e3, 1e5, 1e6};
+  mwSize npnt = 10000, ntri, i;
+  double *tri;
+
+  if (k >= (quick ? 2 : 3))
+    return 0;
+  ntri = (mwSize)sizes[k];
+  sprintf(c->shape, "%lu triangles", (unsigned long)ntri);
+  c->type     = "double";
+  c->numunit  = (double)ntri;
+  c->threaded = 0;
+  c->nlhs     = 1;
+  c->nrhs     = 2;
+  c->prhs[0]  = sphere_points(npnt, 1, mxDOUBLE_CLASS, NULL);
+  c->prhs[1]  = mxCreateDoubleMatrix(ntri, 3, mxREAL);
+  tri = mxGetPr(c->prhs[1]);
+  for (i=0; i<3*ntri; i++)
+    tri[i] = 1 + floor(npnt*uniform());
+  return 1;
+}
+
+/*******************************************************************************
+ * MESHINTERP, of a growing number of points near a sphere of 20200 triangles,
+ * the bounding box tree of the sphere is only built in the first call
+ *******************************************************************************/
+
+static int setup_meshinterp(int k, bench_case_t *c) {
+  static const double sizes[] = {100, 1e4, 1e5};
+  mwSize nlat = 100, nlon = 101, npnt, ntri, npos, i, j, n;
+  double *pnt, *tri, *pos, lat, lon;
+
+  if (k >= (quick ? 2 : 3))
+    return 0;
+  npos = (mwSize)sizes[k];
+  npnt = 2 + nlat*nlon;
+  ntri = 2*nlat*nlon;
+  sprintf(c->shape, "%lu points, %lu triangles", (unsigned long)npos, (unsigned long)ntri);
+  c->type     = "double";
+  c->numunit  = (double)npos;
+  c->threaded = 1;
+  c->nlhs     = 2;
+  c->nrhs     = 3;
+  c->prhs[0]  = mxCreateDoubleMatrix(npnt, 3, mxREAL);
+  c->prhs[1]  = mxCreateDoubleMatrix(ntri, 3, mxREAL);
+  c->prhs[2]  = sphere_points(npos, 1, mxDOUBLE_CLASS, NULL);
+
+  /* the points are moved to a shell around the sphere, like the vertices of another surface */
+  pos = mxGetPr(c->prhs[2]);
+  for (i=0; i<npos; i++) {
+    double r = sqrt(pos[i]*pos[i] + pos[i+npos]*pos[i+npos] + pos[i+2*npos]*pos[i+2*npos]) + 1e-9;
+    double f = (0.9 + 0.2*uniform())/r;
+    pos[i] *= f; pos[i+npos] *= f; pos[i+2*npos] *= f;
+  }
+
+  /* a sphere with a vertex at each pole and rings of vertices in between */
+  pnt = mxGetPr(c->prhs[0]);
+  tri = mxGetPr(c->prhs[1]);
+  pnt[2*npnt] = 1;
+  pnt[2*npnt+1] = -1;
+  for (i=0; i<nlat; i++)
+    for (j=0; j<nlon; j++) {
+      lat = M_PI*(i+1)/(nlat+1);
+      lon = 2*M_PI*j/nlon;
+      n = 2 + i*nlon + j;
+      pnt[n]        = sin(lat)*cos(lon);
+      pnt[n+npnt]   = sin(lat)*sin(lon);
+      pnt[n+2*npnt] = cos(lat);
+    }
+  n = 0;
+  for (i=0; i<=nlat; i++)
+    for (j=0; j<nlon; j++) {
+      /* the one-based vertex indices, the first and last ring are connected to the poles */
+      double a = (i==0 ? 1 : 3 + (i-1)*nlon + j), b = (i==0 ? 1 : 3 + (i-1)*nlon + (j+1)%nlon);
+      double d = (i==nlat ? 2 : 3 + i*nlon + j), e = (i==nlat ? 2 : 3 + i*nlon + (j+1)%nlon);
+      if (i>0) {
+        tri[n] = a; tri[n+ntri] = d; tri[n+2*ntri] = b; n++;
+      }
+      if (i<nlat) {
+        tri[n] = b; tri[n+ntri] = d; tri[n+2*ntri] = e; n++;
+      }
+    }
+  return 1;
+}
+
+/*******************************************************************************
+ * READ_24BIT, of a file with 64 channels in records of 512 samples, which is
+ * in the page cache after the first call
+ *******************************************************************************/
+
+#define BDF_NCHAN  64
+#define BDF_SPR    512
+#define BDF_NREC   300
+
+static int make_datafile(void) {
+  unsigned char *buf;
+  size_t i, n = (size_t)3*BDF_NCHAN*BDF_SPR;
+  int r, fd;
+  FILE *fp;
+
+  if (datafile[0])
+    return 0;
+  strcpy(datafile, "/tmp/mexbench_XXXXXX");
+  fd = mkstemp(datafile);
+  if (fd < 0 || (fp = fdopen(fd, "wb")) == NULL) {
+    fprintf(stderr, "cannot create a temporary file\n");
+    datafile[0] = 0;
+    return -1;
+  }
+  buf = (unsigned char *)malloc(n);
+  for (r=0; r<BDF_NREC; r++) {
+    for (i=0; i<n; i++)
+      buf[i] = (unsigned char)(256*uniform());
+    fwrite(buf, 1, n, fp);
+  }
+  free(buf);
+  fclose(fp);
+  return 0;
+}
+
+static int setup_read_24bit(int k, bench_case_t *c) {
+  mwSize i, nsel;
+  double *p;
+
+  if (k >= 3 || make_datafile() != 0)
+    return 0;
+  c->type    = "double";
+  c->nlhs    = 1;
+  c->prhs[0] = mxCreateString(datafile);
+  c->prhs[1] = mxCreateDoubleScalar(0);
+  if (k == 0) {
+    /* a contiguous stream of words */
+    c->numunit  = (double)BDF_NCHAN*BDF_SPR*BDF_NREC;
+    c->threaded = 0;
+    c->nrhs     = 3;
+    c->prhs[2]  = mxCreateDoubleScalar(c->numunit);
+    sprintf(c->shape, "%.0f words", c->numunit);
+    return 1;
+  }
+  /* all channels as single, or every fourth channel as double, of all records */
+  nsel = (k==1 ? BDF_NCHAN : BDF_NCHAN/4);
+  c->type     = (k==1 ? "single" : "double");
+  c->numunit  = (double)nsel*BDF_SPR*BDF_NREC;
+  c->threaded = 1;
+  c->nrhs     = 7;
+  c->prhs[2]  = mxCreateDoubleMatrix(1, BDF_NCHAN, mxREAL);
+  p = mxGetPr(c->prhs[2]);
+  for (i=0; i<BDF_NCHAN; i++)
+    p[i] = BDF_SPR;
+  c->prhs[3] = mxCreateDoubleMatrix(1, nsel, mxREAL);
+  p = mxGetPr(c->prhs[3]);
+  for (i=0; i<nsel; i++)
+    p[i] = 1 + i*(BDF_NCHAN/nsel);
+  c->prhs[4] = mxCreateDoubleScalar(1);
+  c->prhs[5] = mxCreateDoubleScalar((double)BDF_SPR*BDF_NREC);
+  c->prhs[6] = mxCreateString(c->type);
+  sprintf(c->shape, "%lu of %d channels", (unsigned long)nsel, BDF_NCHAN);
+  return 1;
+}
+
+static const kernel_t kernels[] = {
+  {"nanmean",        mex_nanmean,        "element",  setup_nanmean},
+  {"nanstd",         mex_nanstd,         "element",  setup_nanstd},
+  {"mtimes3x3",      mex_mtimes3x3,      "matrix",   setup_mtimes3x3},
+  {"inv3x3",         mex_inv3x3,         "matrix",   setup_inv3x3},
+  {"sandwich3x3",    mex_sandwich3x3,    "matrix",   setup_sandwich3x3},
+  {"meg_leadfield1", mex_meg_leadfield1, "chan*dip", setup_meg_leadfield1},
+  {"combineClusters",mex_combineClusters,"label",    setup_combineClusters},
+  {"splint_gh",      mex_splint_gh,      "entry",    setup_splint_gh},
+  {"solid_angle",    mex_solid_angle,    "triangle", setup_solid_angle},
+  {"read_24bit",     mex_read_24bit,     "word",     setup_read_24bit},
+  {"meshinterp",     mex_meshinterp,     "point",    setup_meshinterp},
+};
+#define NUMKERNELS (int)(sizeof(kernels)/sizeof(kernels[0]))
+
+/* calls the mex file once, returns the time in seconds or -1 on errors */
+static double call(const kernel_t *K, bench_case_t *c) {
+  mxArray *plhs[MAXARGS];
+  double t0, t1;
+  int i;
+
+  memset(plhs, 0, sizeof(plhs));
+  if (setjmp(mxShimErrorJump)) {
+    fprintf(stderr, "%s: %s\n", K->name, mxShimErrorMessage);
+    mxShimFreeAll();
+    return -1;
+  }
+  t0 = now();
+  K->func(c->nlhs, plhs, c->nrhs, (const mxArray **)c->prhs);
+  t1 = now();
+  for (i=0; i<MAXARGS; i++)
+    mxDestroyArray(plhs[i]);
+  mxShimFreeAll();
+  return t1 - t0;
+}
+
+/* the best of repeated calls, which take at least mintime together */
+static double measure(const kernel_t *K, bench_case_t *c) {
+  double best = -1, total = 0, t;
+  int n;
+
+  /* the first call warms up the caches and the page cache */
+  if (call(K, c) < 0)
+    return -1;
+  for (n=0; n<1000000 && (n<3 || total<mintime); n++) {
+    if ((t = call(K, c)) < 0)
+      return -1;
+    if (best < 0 || t < best)
+      best = t;
+    total += t;
+  }
+  return best;
+}
+
+static int selected(const char *list, const char *name) {
+  size_t n = strlen(name);
+  const char *p = list;
+  if (list == NULL)
+    return 1;
+  while ((p = strstr(p, name)) != NULL) {
+    if ((p == list || p[-1] == ',') && (p[n] == 0 || p[n] == ','))
+      return 1;
+    p += n;
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  const char *list = NULL;
+  int maxthreads, i, k, opt;
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+  maxthreads = (ncpu > MAXTHREADS ? MAXTHREADS : (ncpu < 1 ? 1 : (int)ncpu));
+  while ((opt = getopt(argc, argv, "k:t:m:ql")) != -1) {
+    switch (opt) {
+      case 'k':
+        list = optarg;
+        break;
+      case 't':
+        maxthreads = atoi(optarg);
+        if (maxthreads < 1) maxthreads = 1;
+        if (maxthreads > MAXTHREADS) maxthreads = MAXTHREADS;
+        break;
+      case 'm':
+        mintime = atof(optarg);
+        break;
+      case 'q':
+        quick = 1;
+        break;
+      case 'l':
+        for (i=0; i<NUMKERNELS; i++)
+          printf("%s\n", kernels[i].name);
+        return 0;
+      default:
+        fprintf(stderr, "Usage: %s [-k kernel[,kernel...]] [-t maxthreads] [-m seconds] [-q] [-l]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  printf("%-16s %-8s %-28s %8s %12s %8s\n", "kernel", "type", "shape", "threads", "ns/unit", "speedup");
+  for (i=0; i<NUMKERNELS; i++) {
+    const kernel_t *K = &kernels[i];
+    if (!selected(list, K->name))
+      continue;
+    for (k=0; ; k++) {
+      bench_case_t c;
+      double single = -1;
+      int a;
+
+      memset(&c, 0, sizeof(c));
+      if (!K->setup(k, &c))
+        break;
+      for (numthreads=1; ; numthreads = (numthreads*2 > maxthreads && numthreads < maxthreads ? maxthreads : numthreads*2)) {
+        double t = measure(K, &c);
+        if (t < 0)
+          break;
+        if (single < 0)
+          single = t;
+        printf("%-16s %-8s %-28s %8d %12.3f %8.2f   (ns per %s)\n", K->name, c.type, c.shape, numthreads, 1e9*t/c.numunit, single/t, K->unit);
+        fflush(stdout);
+        if (!c.threaded || numthreads >= maxthreads)
+          break;
+      }
+      for (a=0; a<MAXARGS; a++)
+        mxDestroyArray(c.prhs[a]);
+    }
+  }
+  numthreads = 1;
+  if (datafile[0])
+    unlink(datafile);
+  return 0;
+}
@@ -0,0 +1,310 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld
+ * Donders Institute for Brain, Cognition and Behaviour; Radboud University; NL
+ *
+ * Implementation of the stand-in for the mxArray and MEX API, see matrix.h
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <float.h>
+#include <math.h>
+#include "mex.h"
+
+struct mxArray_tag {
+  mxClassID classid;
+  mwSize ndim;
+  mwSize *dims;
+  size_t numel;
+  size_t elsize;
+  void *pr;
+  void *pi;
+  mwIndex *ir, *jc;             /* only for sparse arrays, numel is then nzmax */
+};
+
+/* every block of mxMalloc is preceded by this, so that it can be released later */
+typedef struct allocation_s {
+  struct allocation_s *prev, *next;
+  size_t align[2];              /* keeps the memory that follows aligned to 16 bytes */
+} allocation_t;
+
+static allocation_t allocations = {&allocations, &allocations, {0, 0}};
+
+jmp_buf mxShimErrorJump;
+char mxShimErrorMessage[256];
+
+static size_t element_size(mxClassID classid) {
+  switch (classid) {
+    case mxLOGICAL_CLASS:
+      return sizeof(mxLogical);
+    case mxCHAR_CLASS:
+      return sizeof(mxChar);
+    case mxDOUBLE_CLASS:
+    case mxINT64_CLASS:
+    case mxUINT64_CLASS:
+      return 8;
+    case mxSINGLE_CLASS:
+    case mxINT32_CLASS:
+    case mxUINT32_CLASS:
+      return 4;
+    case mxINT16_CLASS:
+    case mxUINT16_CLASS:
+      return 2;
+    case mxINT8_CLASS:
+    case mxUINT8_CLASS:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static mxArray *create_array(mwSize ndim, const mwSize *dims, mxClassID classid, mxComplexity flag) {
+  mxArray *pa;
+  mwSize i;
+
+  if (element_size(classid) == 0)
+    mexErrMsgTxt("mxshim: unsupported class");
+  pa = (mxArray *)malloc(sizeof(mxArray));
+  if (pa == NULL)
+    mexErrMsgTxt("mxshim: out of memory");
+  /* like MATLAB, there are at least two dimensions and the trailing singleton ones are removed */
+  while (ndim > 2 && dims[ndim-1] == 1)
+    ndim--;
+  pa->ndim = (ndim < 2 ? 2 : ndim);
+  pa->dims = (mwSize *)malloc(pa->ndim * sizeof(mwSize));
+  pa->numel = 1;
+  for (i=0; i<pa->ndim; i++) {
+    pa->dims[i] = (i < ndim ? dims[i] : 1);
+    pa->numel *= pa->dims[i];
+  }
+  pa->classid = classid;
+  pa->elsize  = element_size(classid);
+  pa->ir = pa->jc = NULL;
+  pa->pr = calloc(pa->numel ? pa->numel : 1, pa->elsize);
+  pa->pi = (flag == mxCOMPLEX ? calloc(pa->numel ? pa->numel : 1, pa->elsize) : NULL);
+  if (pa->dims == NULL || pa->pr == NULL || (flag == mxCOMPLEX && pa->pi == NULL))
+    mexErrMsgTxt("mxshim: out of memory");
+  return pa;
+}
+
+mxArray *mxCreateNumericArray(mwSize ndim, const mwSize *dims, mxClassID classid, mxComplexity flag) {
+  return create_array(ndim, dims, classid, flag);
+}
+
+mxArray *mxCreateNumericMatrix(mwSize m, mwSize n, mxClassID classid, mxComplexity flag) {
+  mwSize dims[2];
+  dims[0] = m;
+  dims[1] = n;
+  return create_array(2, dims, classid, flag);
+}
+
+mxArray *mxCreateDoubleMatrix(mwSize m, mwSize n, mxComplexity flag) {
+  return mxCreateNumericMatrix(m, n, mxDOUBLE_CLASS, flag);
+}
+
+mxArray *mxCreateDoubleScalar(double value) {
+  mxArray *pa = mxCreateDoubleMatrix(1, 1, mxREAL);
+  *(double *)pa->pr = value;
+  return pa;
+}
+
+mxArray *mxCreateLogicalMatrix(mwSize m, mwSize n) {
+  return mxCreateNumericMatrix(m, n, mxLOGICAL_CLASS, mxREAL);
+}
+
+mxArray *mxCreateString(const char *str) {
+  size_t i, n = strlen(str);
+  mxArray *pa = mxCreateNumericMatrix((n ? 1 : 0), n, mxCHAR_CLASS, mxREAL);
+  mxChar *c = (mxChar *)pa->pr;
+  for (i=0; i<n; i++)
+    c[i] = (unsigned char)str[i];
+  return pa;
+}
+
+mxArray *mxCreateSparse(mwSize m, mwSize n, mwSize nzmax, mxComplexity flag) {
+  mxArray *pa = mxCreateNumericMatrix((nzmax ? nzmax : 1), 1, mxDOUBLE_CLASS, flag);
+  pa->dims[0] = m;
+  pa->dims[1] = n;
+  pa->ir = (mwIndex *)calloc(pa->numel, sizeof(mwIndex));
+  pa->jc = (mwIndex *)calloc(n + 1, sizeof(mwIndex));
+  if (pa->ir == NULL || pa->jc == NULL)
+    mexErrMsgTxt("mxshim: out of memory");
+  return pa;
+}
+
+void mxDestroyArray(mxArray *pa) {
+  if (pa == NULL)
+    return;
+  free(pa->dims);
+  free(pa->pr);
+  free(pa->pi);
+  free(pa->ir);
+  free(pa->jc);
+  free(pa);
+}
+
+mxClassID mxGetClassID(const mxArray *pa) { return pa->classid; }
+mwSize mxGetNumberOfDimensions(const mxArray *pa) { return pa->ndim; }
+const mwSize *mxGetDimensions(const mxArray *pa) { return pa->dims; }
+size_t mxGetM(const mxArray *pa) { return pa->dims[0]; }
+size_t mxGetN(const mxArray *pa) { return pa->ir ? pa->dims[1] : (pa->dims[0] ? pa->numel / pa->dims[0] : 0); }
+size_t mxGetNumberOfElements(const mxArray *pa) { return pa->ir ? pa->dims[0]*pa->dims[1] : pa->numel; }
+size_t mxGetElementSize(const mxArray *pa) { return pa->elsize; }
+
+bool mxIsNumeric(const mxArray *pa) { return pa->classid >= mxDOUBLE_CLASS && pa->classid <= mxUINT64_CLASS; }
+bool mxIsComplex(const mxArray *pa) { return pa->pi != NULL; }
+bool mxIsEmpty(const mxArray *pa) { return mxGetNumberOfElements(pa) == 0; }
+bool mxIsDouble(const mxArray *pa) { return pa->classid == mxDOUBLE_CLASS; }
+bool mxIsSingle(const mxArray *pa) { return pa->classid == mxSINGLE_CLASS; }
+bool mxIsLogical(const mxArray *pa) { return pa->classid == mxLOGICAL_CLASS; }
+bool mxIsChar(const mxArray *pa) { return pa->classid == mxCHAR_CLASS; }
+bool mxIsUint32(const mxArray *pa) { return pa->classid == mxUINT32_CLASS; }
+bool mxIsSparse(const mxArray *pa) { return pa->ir != NULL; }
+
+void *mxGetData(const mxArray *pa) { return pa->pr; }
+void *mxGetImagData(const mxArray *pa) { return pa->pi; }
+double *mxGetPr(const mxArray *pa) { return (double *)pa->pr; }
+double *mxGetPi(const mxArray *pa) { return (double *)pa->pi; }
+
+double mxGetScalar(const mxArray *pa) {
+  if (pa->numel == 0)
+    return 0;
+  switch (pa->classid) {
+    case mxDOUBLE_CLASS:  return *(const double *)pa->pr;
+    case mxSINGLE_CLASS:  return *(const float *)pa->pr;
+    case mxINT8_CLASS:    return *(const signed char *)pa->pr;
+    case mxUINT8_CLASS:   return *(const unsigned char *)pa->pr;
+    case mxINT16_CLASS:   return *(const short *)pa->pr;
+    case mxUINT16_CLASS:  return *(const unsigned short *)pa->pr;
+    case mxINT32_CLASS:   return *(const int *)pa->pr;
+    case mxUINT32_CLASS:  return *(const unsigned int *)pa->pr;
+    case mxINT64_CLASS:   return (double)*(const long long *)pa->pr;
+    case mxUINT64_CLASS:  return (double)*(const unsigned long long *)pa->pr;
+    case mxLOGICAL_CLASS: return *(const mxLogical *)pa->pr;
+    case mxCHAR_CLASS:    return *(const mxChar *)pa->pr;
+    default:              return 0;
+  }
+}
+
+int mxGetString(const mxArray *pa, char *buf, mwSize buflen) {
+  const mxChar *c = (const mxChar *)pa->pr;
+  size_t i, n = pa->numel;
+
+  if (pa->classid != mxCHAR_CLASS || buflen == 0)
+    return 1;
+  for (i=0; i<n && i+1<buflen; i++)
+    buf[i] = (char)c[i];
+  buf[i] = 0;
+  return (i < n ? 1 : 0);
+}
+
+mwIndex *mxGetIr(const mxArray *pa) { return pa->ir; }
+mwIndex *mxGetJc(const mxArray *pa) { return pa->jc; }
+mwSize mxGetNzmax(const mxArray *pa) { return pa->ir ? pa->numel : 0; }
+
+char *mxArrayToString(const mxArray *pa) {
+  char *buf;
+  if (pa->classid != mxCHAR_CLASS)
+    return NULL;
+  buf = (char *)mxMalloc(pa->numel + 1);
+  mxGetString(pa, buf, pa->numel + 1);
+  return buf;
+}
+
+void *mxMalloc(size_t n) {
+  allocation_t *a = (allocation_t *)malloc(sizeof(allocation_t) + n);
+  if (a == NULL)
+    mexErrMsgTxt("mxshim: out of memory");
+  a->next = allocations.next;
+  a->prev = &allocations;
+  allocations.next->prev = a;
+  allocations.next = a;
+  return a + 1;
+}
+
+void *mxCalloc(size_t n, size_t size) {
+  void *ptr = mxMalloc(n * size);
+  memset(ptr, 0, n * size);
+  return ptr;
+}
+
+void *mxRealloc(void *ptr, size_t size) {
+  allocation_t *a, *b;
+  if (ptr == NULL)
+    return mxMalloc(size);
+  a = (allocation_t *)ptr - 1;
+  b = (allocation_t *)realloc(a, sizeof(allocation_t) + size);
+  if (b == NULL)
+    mexErrMsgTxt("mxshim: out of memory");
+  b->prev->next = b;
+  b->next->prev = b;
+  return b + 1;
+}
+
+void mxFree(void *ptr) {
+  allocation_t *a;
+  if (ptr == NULL)
+    return;
+  a = (allocation_t *)ptr - 1;
+  a->prev->next = a->next;
+  a->next->prev = a->prev;
+  free(a);
+}
+
+void mxShimFreeAll(void) {
+  while (allocations.next != &allocations)
+    mxFree(allocations.next + 1);
+}
+
+double mxGetEps(void) { return DBL_EPSILON; }
+double mxGetNaN(void) { return NAN; }
+double mxGetInf(void) { return INFINITY; }
+
+void mexErrMsgTxt(const char *msg) {
+  strncpy(mxShimErrorMessage, msg, sizeof(mxShimErrorMessage)-1);
+  mxShimErrorMessage[sizeof(mxShimErrorMessage)-1] = 0;
+  longjmp(mxShimErrorJump, 1);
+}
+
+void mexErrMsgIdAndTxt(const char *id, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(mxShimErrorMessage, sizeof(mxShimErrorMessage), fmt, args);
+  va_end(args);
+  longjmp(mxShimErrorJump, 1);
+}
+
+void mexWarnMsgTxt(const char *msg) {
+  fprintf(stderr, "Warning: %s\n", msg);
+}
+
+int mexPrintf(const char *fmt, ...) {
+  int n;
+  va_list args;
+  va_start(args, fmt);
+  n = vprintf(fmt, args);
+  va_end(args);
+  return n;
+}
+
+int mexCallMATLAB(int nlhs, mxArray *plhs[], int nrhs, mxArray *prhs[], const char *name) {
+  mexErrMsgTxt("mexCallMATLAB is not available without MATLAB");
+  return 1;
+}
+
+/* like MATLAB, a function is only registered once, even if the mex file is called many times */
+#define MAXATEXIT 32
+static void (*atexitfunc[MAXATEXIT])(void);
+static int numatexit = 0;
+
+int mexAtExit(void (*func)(void)) {
+  int i;
+  for (i=0; i<numatexit; i++)
+    if (atexitfunc[i] == func)
+      return 0;
+  if (numatexit == MAXATEXIT)
+    return 1;
+  atexitfunc[numatexit++] = func;
+  return atexit(func);
+}
@@ -0,0 +1,553 @@
+#include "mex.h"
+#include "platform.h"
+
+#include <math.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+#if !defined(PLATFORM_WINDOWS)
+#include <pthread.h>
+#include <unistd.h>
+#define CLUSTERPERM_THREADS
+#endif
+
+#define CLUSTERPERM_MAXTHREADS 16
+
+#define INDEPSAMPLEST 1
+#define DEPSAMPLEST   2
+
+typedef unsigned long long uint64;
+
+/* the data that is shared by all permutations */
+typedef struct {
+    const double *dat;          /* data, nsamples x nobs, or nsamples x nunit differences for depsamplesT */
+    const double *ssq;          /* sum of squares over all observations or units, nsamples x 1 */
+    const double *sum;          /* sum over all observations or units, nsamples x 1 */
+    mwSize nsamples, nobs;
+    mwSize nchan, nfreq, ntime;
+    int statistic;
+    double critpos, critneg;
+    const std::vector<mwSize> *pairs;   /* pairs of neighbouring channels */
+    const std::vector<int> *group;      /* condition of each observation, or 1 for each unit */
+    const int *resampled;               /* group of each observation in the user specified permutations, nrand x nobs, or NULL */
+    mwSize nrand;
+    uint64 seed;
+    double *posdist, *negdist;
+    mwSize begin, end;
+} clusterperm_t;
+
+/* splitmix64, this is used to give each permutation its own random number stream */
+static inline uint64 splitmix64(uint64 *x) {
+    uint64 z = (*x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/* find the root of a sample, with path halving */
+static inline mwSize findRoot(mwSize *parent, mwSize a) {
+    while (parent[a] != a) {
+        parent[a] = parent[parent[a]];
+        a = parent[a];
+    }
+    return a;
+}
+
+static inline void unionRoot(mwSize *parent, mwSize a, mwSize b) {
+    a = findRoot(parent, a);
+    b = findRoot(parent, b);
+    if (a < b) {
+        parent[b] = a;
+    } else if (b < a) {
+        parent[a] = b;
+    }
+}
+
+/*
+ * Label the clusters of samples that exceed the threshold, the samples are ordered as chan x freq x time.
+ * Samples are connected over time and frequency to the adjacent sample of the same channel, and over
+ * channels to the neighbouring channels at the same time and frequency. The root of each cluster is
+ * its first sample, samples that are not part of a cluster have parent[i]==nsamples.
+ */
+static void labelClusters(const clusterperm_t *s, const double *stat, int positive, mwSize *parent) {
+    mwSize nchan = s->nchan, nfreq = s->nfreq, ntime = s->ntime;
+    double crit = (positive ? s->critpos : s->critneg);
+    const std::vector<mwSize> &pairs = *s->pairs;
+
+    for (mwSize i = 0; i < s->nsamples; i++) {
+        parent[i] = ((positive ? stat[i] > crit : stat[i] < crit) ? i : s->nsamples);
+    }
+
+    for (mwSize t = 0; t < ntime; t++) {
+        for (mwSize f = 0; f < nfreq; f++) {
+            mwSize k = nchan*(f + nfreq*t);
+            for (mwSize c = 0; c < nchan; c++) {
+                if (parent[k+c] == s->nsamples) {
+                    continue;
+                }
+                if (f > 0 && parent[k+c-nchan] != s->nsamples) {
+                    unionRoot(parent, k+c-nchan, k+c);
+                }
+                if (t > 0 && parent[k+c-nchan*nfreq] != s->nsamples) {
+                    unionRoot(parent, k+c-nchan*nfreq, k+c);
+                }
+            }
+            for (size_t p = 0; p < pairs.size(); p += 2) {
+                mwSize a = k + pairs[p], b = k + pairs[p+1];
+                if (parent[a] != s->nsamples && parent[b] != s->nsamples) {
+                    unionRoot(parent, a, b);
+                }
+            }
+        }
+    }
+}
+
+/* sum the statistic over each cluster, the sum is stored at the root of the cluster, this returns the largest or the smallest sum */
+static double sumClusters(const clusterperm_t *s, const double *stat, int positive, mwSize *parent, double *clustersum) {
+    double extreme = 0;
+    for (mwSize i = 0; i < s->nsamples; i++) {
+        clustersum[i] = 0;
+    }
+    for (mwSize i = 0; i < s->nsamples; i++) {
+        if (parent[i] != s->nsamples) {
+            clustersum[findRoot(parent, i)] += stat[i];
+        }
+    }
+    for (mwSize i = 0; i < s->nsamples; i++) {
+        if (parent[i] == i) {
+            extreme = (positive ? std::max(extreme, clustersum[i]) : std::min(extreme, clustersum[i]));
+        }
+    }
+    return extreme;
+}
+
+/*
+ * Compute the statistic for one assignment of conditions to the observations. For the independent samples
+ * T-statistic the group is 1 or 2 for each observation and the pooled variance is used. For the dependent
+ * samples T-statistic the data contains the difference between the conditions for each unit and the group
+ * is +1 or -1 for each unit, the sum of squares does not depend on the sign.
+ */
+static void computeStat(const clusterperm_t *s, const int *group, double *stat, double *sum1, double *ssq1) {
+    mwSize nsamples = s->nsamples;
+    mwSize n1 = 0;
+
+    for (mwSize i = 0; i < nsamples; i++) {
+        sum1[i] = 0;
+        ssq1[i] = 0;
+    }
+
+    if (s->statistic == INDEPSAMPLEST) {
+        for (mwSize j = 0; j < s->nobs; j++) {
+            if (group[j] == 1) {
+                const double *x = s->dat + j*nsamples;
+                for (mwSize i = 0; i < nsamples; i++) {
+                    sum1[i] += x[i];
+                    ssq1[i] += x[i]*x[i];
+                }
+                n1++;
+            }
+        }
+        double na = (double)n1, nb = (double)(s->nobs - n1);
+        for (mwSize i = 0; i < nsamples; i++) {
+            double sum2 = s->sum[i] - sum1[i];
+            double ssq2 = s->ssq[i] - ssq1[i];
+            double m1 = sum1[i]/na, m2 = sum2/nb;
+            double pooled = ((ssq1[i] - na*m1*m1) + (ssq2 - nb*m2*m2)) / (na + nb - 2);
+            stat[i] = (m1 - m2) / sqrt(pooled*(1/na + 1/nb));
+        }
+    } else {
+        for (mwSize j = 0; j < s->nobs; j++) {
+            const double *x = s->dat + j*nsamples;
+            if (group[j] > 0) {
+                for (mwSize i = 0; i < nsamples; i++) {
+                    sum1[i] += x[i];
+                }
+            } else {
+                for (mwSize i = 0; i < nsamples; i++) {
+                    sum1[i] -= x[i];
+                }
+            }
+        }
+        double n = (double)s->nobs;
+        for (mwSize i = 0; i < nsamples; i++) {
+            double m = sum1[i]/n;
+            double var = (s->ssq[i] - n*m*m) / (n - 1);
+            stat[i] = m / sqrt(var/n);
+        }
+    }
+}
+
+/* apply one permutation to the groups, this is either a permutation that is specified by the user or a random one */
+static void permuteGroup(const clusterperm_t *s, mwSize r, int *group) {
+    const std::vector<int> &orig = *s->group;
+
+    if (s->resampled) {
+        for (mwSize j = 0; j < s->nobs; j++) {
+            group[j] = s->resampled[r + j*s->nrand];
+        }
+        return;
+    }
+
+    /* each permutation has its own random number stream, which makes the result independent of the number of threads */
+    uint64 state = s->seed ^ (0xD1B54A32D192ED03ULL * (uint64)(r+1));
+    for (mwSize j = 0; j < s->nobs; j++) {
+        group[j] = orig[j];
+    }
+    if (s->statistic == DEPSAMPLEST) {
+        /* exchanging the conditions within a unit flips the sign of the difference */
+        for (mwSize j = 0; j < s->nobs; j++) {
+            group[j] = ((splitmix64(&state) >> 63) ? -group[j] : group[j]);
+        }
+        return;
+    }
+    /* Fisher-Yates shuffle of the conditions over the observations */
+    for (mwSize j = s->nobs - 1; j > 0; j--) {
+        mwSize k = (mwSize)((double)(splitmix64(&state) >> 11) * (1.0/9007199254740992.0) * (j+1));
+        std::swap(group[j], group[k]);
+    }
+}
+
+/* compute the permutations begin to end */
+static void *clusterperm_range(void *arg) {
+    const clusterperm_t *s = (const clusterperm_t *)arg;
+    std::vector<double> stat(s->nsamples), sum1(s->nsamples), ssq1(s->nsamples);
+    std::vector<mwSize> parent(s->nsamples);
+    std::vector<int> group(s->nobs);
+
+    for (mwSize r = s->begin; r < s->end; r++) {
+        permuteGroup(s, r, &group[0]);
+        computeStat(s, &group[0], &stat[0], &sum1[0], &ssq1[0]);
+        labelClusters(s, &stat[0], 1, &parent[0]);
+        s->posdist[r] = sumClusters(s, &stat[0], 1, &parent[0], &sum1[0]);
+        labelClusters(s, &stat[0], 0, &parent[0]);
+        s->negdist[r] = sumClusters(s, &stat[0], 0, &parent[0], &sum1[0]);
+    }
+    return NULL;
+}
+
+/* label the observed clusters, these are numbered in the order of their sum, the largest (or most negative) sum first */
+static void observedClusters(const clusterperm_t *s, const double *stat, int positive, mxArray **labelmat, mxArray **clusterstat) {
+    std::vector<mwSize> parent(s->nsamples);
+    std::vector<double> clustersum(s->nsamples);
+    std::vector<std::pair<double, mwSize> > order;
+    std::vector<double> number(s->nsamples, 0);
+
+    labelClusters(s, stat, positive, &parent[0]);
+    sumClusters(s, stat, positive, &parent[0], &clustersum[0]);
+    for (mwSize i = 0; i < s->nsamples; i++) {
+        if (parent[i] == i) {
+            order.push_back(std::make_pair(positive ? -clustersum[i] : clustersum[i], i));
+        }
+    }
+    std::stable_sort(order.begin(), order.end());
+
+    *clusterstat = mxCreateDoubleMatrix(order.size(), 1, mxREAL);
+    double *cs = mxGetPr(*clusterstat);
+    for (size_t k = 0; k < order.size(); k++) {
+        cs[k] = clustersum[order[k].second];
+        number[order[k].second] = (double)(k+1);
+    }
+
+    *labelmat = mxCreateDoubleMatrix(s->nsamples, 1, mxREAL);
+    double *lm = mxGetPr(*labelmat);
+    for (mwSize i = 0; i < s->nsamples; i++) {
+        lm[i] = (parent[i] != s->nsamples ? number[findRoot(&parent[0], i)] : 0);
+    }
+}
+
+/* The gateway function */
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+    mwSize nsamples, nobs, nvar, nchan, nfreq, ntime, nrand;
+    const double *design, *dim, *resample = NULL;
+    std::vector<int> resampled;
+    char statistic[64];
+    clusterperm_t s;
+
+    /* check for proper number of arguments */
+    if (nrhs < 7 || nrhs > 8) {
+        mexErrMsgIdAndTxt("FieldTrip:clusterperm:nrhs", "seven or eight inputs required: dat, design, connectivity, dim, statistic, critval, nrand, seed");
+    }
+    if (nlhs > 7) {
+        mexErrMsgIdAndTxt("FieldTrip:clusterperm:nlhs", "too many output arguments");
+    }
+
+    if ((!mxIsDouble(prhs[0]) && !mxIsSingle(prhs[0])) || mxIsComplex(prhs[0]) || mxGetNumberOfDimensions(prhs[0]) != 2) {
+        mexErrMsgIdAndTxt("FieldTrip:clusterperm:dat", "the data must be a real-valued nsamples x nobs matrix");
+    }
+    if (!mxIsDouble(prhs[1]) || mxIsComplex(prhs[1])) {
+        mexErrMsgIdAndTxt("FieldTrip:clusterperm:design", "the design must be a real-valued double precision matrix");
+    }
+    nsamples = mxGetM(prhs[0]);
+    nobs = mxGetN(prhs[0]);
+    nvar = mxGetM(prhs[1]);
+    if (mxGetN(prhs[1]) != nobs || nvar < 1) {
+        mexErrMsgIdAndTxt("FieldTrip:clusterperm:design", "the design must have one column for each observation");
+    }
+    design = mxGetPr(prhs[1]);
+
+    if (!mxIsDouble(prhs[3]) || mxGetNumberOfElements(prhs[3]) < 1 || mxGetNumberOfElements(prhs[3]) > 3) {
+        mexErrMsgIdAndTxt("FieldTrip:clusterperm:dim", "the dimensions must be specified as [nchan], [nchan ntime] or [nchan nfreq ntime]");
+    }
+    dim = mxGetPr(prhs[3]);
+    nchan = (mwSize)dim[0];
+    nfreq = (mxGetNumberOfElements(prhs[3]) == 3 ? (mwSize)dim[1] : 1);
+    ntime = (mxGetNumberOfElements(prhs[3]) > 1 ? (mwSize)dim[mxGetNumberOfElements(prhs[3])-1] : 1);
+    if (nchan*nfreq*ntime != nsamples) {
+        mexErrMsgIdAndTxt("FieldTrip:clusterperm:dim", "the dimensions do not match the number of samples in the data");
+    }
+
+    if (!(mxIsLogical(prhs[2]) || mxIsDouble(prhs[2])) || mxGetM(prhs[2]) != nchan || mxGetN(prhs[2]) != nchan) {
+        mexErrMsgIdAndTxt("FieldTrip:clusterperm:connectivity", "the connectivity must be a logical matrix with one row and column for each channel");
+    }
+
+    if (!mxIsChar(prhs[4]) || mxGetString(prhs[4], statistic, sizeof(statistic)) != 0) {
+        mexErrMsgIdAndTxt("FieldTrip:clusterperm:statistic", "the statistic must be a string");
+    }
+    if (strcmp(statistic, "indepsamplesT") == 0 || strcmp(statistic, "ft_statfun_indepsamplesT") == 0) {
+        s.statistic = INDEPSAMPLEST;
+    } else if (strcmp(statistic, "depsamplesT") == 0 || strcmp(statistic, "ft_statfun_depsamplesT") == 0) {
+        s.statistic = DEPSAMPLEST;
+    } else {
+        mexErrMsgIdAndTxt("FieldTrip:clusterperm:statistic", "the statistic must be 'indepsamplesT' or 'depsamplesT'");
+    }
+
+    if (!mxIsDouble(prhs[5]) || (mxGetNumberOfElements(prhs[5]) != 1 && mxGetNumberOfElements(prhs[5]) != 2)) {
+        mexErrMsgIdAndTxt("FieldTrip:clusterperm:critval", "the critical value must be a scalar or a [negative positive] pair");
+    }
+    if (mxGetNumberOfElements(prhs[5]) == 1) {
+        s.critneg = -fabs(mxGetScalar(prhs[5]));
+        s.critpos = +fabs(mxGetScalar(prhs[5]));
+    } else {
+        s.critneg = mxGetPr(prhs[5])[0];
+        s.critpos = mxGetPr(prhs[5])[1];
+    }
+
+    if (!mxIsDouble(prhs[6])) {
+        mexErrMsgIdAndTxt("FieldTrip:clusterperm:nrand", "the number of randomizations must be a scalar or a nrand x nobs matrix");
+    }
+    if (mxGetNumberOfElements(prhs[6]) == 1) {
+        nrand = (mwSize)mxGetScalar(prhs[6]);
+    } else if (mxGetN(prhs[6]) == nobs) {
+        nrand = mxGetM(prhs[6]);
+        resample = mxGetPr(prhs[6]);
+        for (mwSize i = 0; i < nrand*nobs; i++) {
+            if (resample[i] < 1 || resample[i] > nobs || resample[i] != floor(resample[i])) {
+                mexErrMsgIdAndTxt("FieldTrip:clusterperm:nrand", "the randomizations must contain indices between 1 and nobs");
+            }
+        }
+    } else {
+        mexErrMsgIdAndTxt("FieldTrip:clusterperm:nrand", "the number of randomizations must be a scalar or a nrand x nobs matrix");
+    }
+    s.seed = (nrhs > 7 ? (uint64)mxGetScalar(prhs[7]) : 0);
+
+    /* make a sparse list of the neighbouring channels, the union is symmetric so each pair is only needed once */
+    std::vector<mwSize> pairs;
+    if (mxIsLogical(prhs[2])) {
+        const mxLogical *connectivity = mxGetLogicals(prhs[2]);
+        for (mwSize i = 0; i < nchan; i++) {
+            for (mwSize j = i+1; j < nchan; j++) {
+                if (connectivity[i*nchan + j] || connectivity[j*nchan + i]) {
+                    pairs.push_back(i);
+                    pairs.push_back(j);
+                }
+            }
+        }
+    } else {
+        const double *connectivity = mxGetPr(prhs[2]);
+        for (mwSize i = 0; i < nchan; i++) {
+            for (mwSize j = i+1; j < nchan; j++) {
+                if (connectivity[i*nchan + j] || connectivity[j*nchan + i]) {
+                    pairs.push_back(i);
+                    pairs.push_back(j);
+                }
+            }
+        }
+    }
+
+    /* get the data in double precision */
+    std::vector<double> dat(nsamples*nobs);
+    if (mxIsSingle(prhs[0])) {
+        const float *p = (const float *)mxGetData(prhs[0]);
+        for (mwSize i = 0; i < nsamples*nobs; i++) {
+            dat[i] = p[i];
+        }
+    } else if (nsamples*nobs > 0) {
+        memcpy(&dat[0], mxGetPr(prhs[0]), nsamples*nobs*sizeof(double));
+    }
+
+    std::vector<int> group(nobs);
+    if (s.statistic == INDEPSAMPLEST) {
+        /* the first row of the design contains the condition, 1 or 2 */
+        mwSize n1 = 0;
+        for (mwSize j = 0; j < nobs; j++) {
+            group[j] = (int)design[j*nvar];
+            if (group[j] != 1 && group[j] != 2) {
+                mexErrMsgIdAndTxt("FieldTrip:clusterperm:design", "the first row of the design must contain the condition, 1 or 2");
+            }
+            n1 += (group[j] == 1);
+        }
+        if (n1 < 1 || n1 == nobs || nobs < 3) {
+            mexErrMsgIdAndTxt("FieldTrip:clusterperm:design", "each condition must have at least one observation, with at least three observations in total");
+        }
+        /* the statistic does not depend on the overall mean, removing it improves the accuracy of the sum of squares */
+        for (mwSize i = 0; i < nsamples; i++) {
+            double m = 0;
+            for (mwSize j = 0; j < nobs; j++) {
+                m += dat[i + j*nsamples];
+            }
+            m /= nobs;
+            for (mwSize j = 0; j < nobs; j++) {
+                dat[i + j*nsamples] -= m;
+            }
+        }
+        if (resample) {
+            /* the columns of the design are reshuffled, i.e. observation j gets the condition of resample(r,j) */
+            resampled.resize(nrand*nobs);
+            for (mwSize i = 0; i < nrand*nobs; i++) {
+                resampled[i] = group[(mwSize)resample[i] - 1];
+            }
+        }
+    } else {
+        /* the first row of the design contains the condition and the second row the unit, each unit has one observation in each condition */
+        if (nvar < 2) {
+            mexErrMsgIdAndTxt("FieldTrip:clusterperm:design", "the design must contain the condition in the first and the unit in the second row");
+        }
+        std::vector<std::pair<double, mwSize> > unit1, unit2;
+        for (mwSize j = 0; j < nobs; j++) {
+            if (design[j*nvar] == 1) {
+                unit1.push_back(std::make_pair(design[j*nvar+1], j));
+            } else if (design[j*nvar] == 2) {
+                unit2.push_back(std::make_pair(design[j*nvar+1], j));
+            } else {
+                mexErrMsgIdAndTxt("FieldTrip:clusterperm:design", "the first row of the design must contain the condition, 1 or 2");
+            }
+        }
+        std::sort(unit1.begin(), unit1.end());
+        std::sort(unit2.begin(), unit2.end());
+        mwSize nunit = unit1.size();
+        if (unit2.size() != nunit || nunit < 2) {
+            mexErrMsgIdAndTxt("FieldTrip:clusterperm:design", "each unit must have one observation in each condition, with at least two units");
+        }
+        for (mwSize u = 0; u < nunit; u++) {
+            if (unit1[u].first != unit2[u].first || (u > 0 && unit1[u].first == unit1[u-1].first)) {
+                mexErrMsgIdAndTxt("FieldTrip:clusterperm:design", "each unit must have one observation in each condition, with at least two units");
+            }
+        }
+        if (resample) {
+            /* a reshuffled design must exchange the conditions within each unit, this is expressed as the sign of the difference */
+            resampled.resize(nrand*nunit);
+            for (mwSize r = 0; r < nrand; r++) {
+                for (mwSize j = 0; j < nobs; j++) {
+                    mwSize k = (mwSize)resample[r + j*nrand] - 1;
+                    if (design[j*nvar+1] != design[k*nvar+1]) {
+                        mexErrMsgIdAndTxt("FieldTrip:clusterperm:nrand", "the randomizations must exchange observations within each unit");
+                    }
+                }
+                for (mwSize u = 0; u < nunit; u++) {
+                    mwSize k = (mwSize)resample[r + unit1[u].second*nrand] - 1;
+                    resampled[r + u*nrand] = (design[k*nvar] == 1 ? 1 : -1);
+                }
+            }
+        }
+        /* replace the data by the difference between the conditions of each unit */
+        std::vector<double> diff(nsamples*nunit);
+        for (mwSize u = 0; u < nunit; u++) {
+            const double *x1 = &dat[0] + unit1[u].second*nsamples;
+            const double *x2 = &dat[0] + unit2[u].second*nsamples;
+            for (mwSize i = 0; i < nsamples; i++) {
+                diff[i + u*nsamples] = x1[i] - x2[i];
+            }
+        }
+        dat.swap(diff);
+        group.assign(nunit, 1);
+        nobs = nunit;
+    }
+
+    /* the sum and sum of squares over all observations do not depend on the permutation */
+    std::vector<double> sum(nsamples, 0), ssq(nsamples, 0);
+    for (mwSize j = 0; j < nobs; j++) {
+        const double *x = &dat[0] + j*nsamples;
+        for (mwSize i = 0; i < nsamples; i++) {
+            sum[i] += x[i];
+            ssq[i] += x[i]*x[i];
+        }
+    }
+
+    s.dat = (nsamples*nobs > 0 ? &dat[0] : NULL);
+    s.sum = (nsamples > 0 ? &sum[0] : NULL);
+    s.ssq = (nsamples > 0 ? &ssq[0] : NULL);
+    s.nsamples = nsamples;
+    s.nobs = nobs;
+    s.nchan = nchan;
+    s.nfreq = nfreq;
+    s.ntime = ntime;
+    s.pairs = &pairs;
+    s.group = &group;
+    s.resampled = (resample ? &resampled[0] : NULL);
+    s.nrand = nrand;
+
+    /* compute the observed statistic and clusters */
+    std::vector<double> sum1(nsamples), ssq1(nsamples);
+    plhs[0] = mxCreateDoubleMatrix(nsamples, 1, mxREAL);
+    computeStat(&s, &group[0], mxGetPr(plhs[0]), &sum1[0], &ssq1[0]);
+    if (nlhs > 3) {
+        observedClusters(&s, mxGetPr(plhs[0]), 1, &plhs[3], &plhs[4]);
+    }
+    if (nlhs > 5) {
+        observedClusters(&s, mxGetPr(plhs[0]), 0, &plhs[5], &plhs[6]);
+    }
+
+    /* compute the distribution of the largest cluster sum under the null hypothesis */
+    mxArray *posdist = mxCreateDoubleMatrix(1, nrand, mxREAL);
+    mxArray *negdist = mxCreateDoubleMatrix(1, nrand, mxREAL);
+    s.posdist = mxGetPr(posdist);
+    s.negdist = mxGetPr(negdist);
+    s.begin = 0;
+    s.end = nrand;
+
+    int nthreads = 1;
+#ifdef CLUSTERPERM_THREADS
+    if (nrand > 1) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = (ncpu > CLUSTERPERM_MAXTHREADS ? CLUSTERPERM_MAXTHREADS : (ncpu < 1 ? 1 : (int)ncpu));
+        nthreads = ((mwSize)nthreads > nrand ? (int)nrand : nthreads);
+    }
+
+    if (nthreads > 1) {
+        pthread_t thread[CLUSTERPERM_MAXTHREADS];
+        clusterperm_t part[CLUSTERPERM_MAXTHREADS];
+        bool started[CLUSTERPERM_MAXTHREADS];
+
+        /* divide the randomizations over the threads, each thread has its own work space */
+        for (int t = 0; t < nthreads; t++) {
+            part[t] = s;
+            part[t].begin = (nrand*t)/nthreads;
+            part[t].end = (nrand*(t+1))/nthreads;
+            started[t] = (pthread_create(&thread[t], NULL, clusterperm_range, &part[t]) == 0);
+        }
+        for (int t = 0; t < nthreads; t++) {
+            if (started[t]) {
+                pthread_join(thread[t], NULL);
+            } else {
+                clusterperm_range(&part[t]);
+            }
+        }
+    }
+#endif
+
+    if (nthreads == 1) {
+        clusterperm_range(&s);
+    }
+
+    if (nlhs > 1) {
+        plhs[1] = posdist;
+    } else {
+        mxDestroyArray(posdist);
+    }
+    if (nlhs > 2) {
+        plhs[2] = negdist;
+    } else {
+        mxDestroyArray(negdist);
+    }
+}
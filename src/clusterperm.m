@@ -0,0 +1,89 @@
+function [varargout] = clusterperm(varargin)
+
+% CLUSTERPERM computes a cluster-based permutation test on channel-time or
+% channel-frequency-time data in a single call, including the randomization of the
+% design, the single-sample statistic, the thresholding, the clustering and the
+% cluster statistic of each randomization.
+%
+% Use as
+%   [stat, posdistribution, negdistribution, poslabelmat, posclusterstat, neglabelmat, negclusterstat] = ...
+%      clusterperm(dat, design, connectivity, dim, statistic, critval, nrand, seed)
+% where
+%   dat          = Nsamples x Nobs matrix with the data, the samples are ordered as chan_freq_time
+%   design       = the first row contains the condition (1 or 2) of each observation, for
+%                  'depsamplesT' the second row contains the unit
+%   connectivity = Nchan x Nchan logical matrix with the neighbouring channels
+%   dim          = [Nchan], [Nchan Ntime] or [Nchan Nfreq Ntime]
+%   statistic    = 'indepsamplesT' or 'depsamplesT'
+%   critval      = threshold for the clustering, either a scalar or [negative positive]
+%   nrand        = number of random permutations, or a Nrand x Nobs matrix with
+%                  the permutations of the columns of the design, e.g. from RESAMPLEDESIGN
+%   seed         = seed for the random permutations (default = 0)
+%
+% The statistics are the same as FT_STATFUN_INDEPSAMPLEST and FT_STATFUN_DEPSAMPLEST,
+% and the cluster statistic is 'maxsum'. Samples are connected to the adjacent
+% sample in time and frequency of the same channel, and to the same time and
+% frequency of the neighbouring channels. The outputs are the observed statistic,
+% the largest positive and most negative cluster sum of each randomization (0 if
+% there is no cluster), and the observed clusters numbered in the order of their
+% cluster statistic. The probability of each observed cluster follows as
+%   posprob = (sum(posdistribution>=posclusterstat(i)) + 1) / (Nrand + 1)
+%   negprob = (sum(negdistribution<=negclusterstat(i)) + 1) / (Nrand + 1)
+%
+% The randomizations are distributed over multiple threads. Each random
+% permutation has its own random number stream, hence the result does not depend
+% on the number of threads.
+%
+% See also FT_STATISTICS_MONTECARLO, COMBINECLUSTERS
+
+% Copyright (C) 2017, Robert Oostenveld
+%
+% This file is part of FieldTrip, see http://www.fieldtriptoolbox.org
+% for the documentation and details.
+%
+%    FieldTrip is free software: you can redistribute it and/or modify
+%    it under the terms of the GNU General Public License as published by
+%    the Free Software Foundation, either version 3 of the License, or
+%    (at your option) any later version.
+%
+%    FieldTrip is distributed in the hope that it will be useful,
+%    but WITHOUT ANY WARRANTY; without even the implied warranty of
+%    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+%    GNU General Public License for more details.
+%
+%    You should have received a copy of the GNU General Public License
+%    along with FieldTrip. If not, see <http://www.gnu.org/licenses/>.
+%
+% $Id$
+
+% compile the missing mex file on the fly
+% remember the original working directory
+pwdir = pwd;
+
+% determine the name and full path of this function
+funname = mfilename('fullpath');
+mexsrc  = [funname '.cpp'];
+[mexdir, mexname] = fileparts(funname);
+
+try
+  % try to compile the mex file on the fly
+  warning('trying to compile MEX file from %s', mexsrc);
+  cd(mexdir);
+  mex(mexsrc);
+  cd(pwdir);
+  success = true;
+
+catch
+  % compilation failed
+  disp(lasterr);
+  error('could not locate MEX file for %s', mexname);
+  cd(pwdir);
+  success = false;
+end
+
+if success
+  % execute the mex file that was juist created
+  funname   = mfilename;
+  funhandle = str2func(funname);
+  [varargout{1:nargout}] = funhandle(varargin{:});
+end
@@ -1,106 +1,101 @@
 #include "mex.h"
+#include "platform.h"
 
-#include <algorithm>
 #include <vector>
 
-/* The computational routine */
-void combineClusters_impl(unsigned int *labelmat, unsigned int *total, mwSize spatdimlength, mwSize timefreqlength, mxLogical *neighbours, unsigned int *out) {
+#if !defined(PLATFORM_WINDOWS)
+#include <pthread.h>
+#include <unistd.h>
+#define COMBINE_THREADS
+#endif
+
+#define COMBINE_MAXTHREADS 16
+
+/* find the root of a label, with path halving */
+static inline unsigned int findRoot(unsigned int *parent, unsigned int a) {
+    while (parent[a] != a) {
+        parent[a] = parent[parent[a]];
+        a = parent[a];
+    }
+    return a;
+}
+
+/* The computational routine, this combines the clusters of a single channel x timefreq map */
+void combineClusters_impl(const unsigned int *labelmat, unsigned int total, mwSize spatdimlength, mwSize timefreqlength, const std::vector<mwSize> &pairs, unsigned int *out) {
     
     /* increase the total by one because indices in labelmat are 1-based and our array is zero-based */
-    (*total)++;
+    total++;
     
-    /* fill array with 1:total */
-    unsigned int *replaceby;
-    replaceby = (unsigned int *) malloc( (*total) * sizeof(unsigned int));
-    int n;
-    for (n = 0; n < *total; n++) {
-        replaceby[n] = n;
-    }
-
-    mwSize i;
-    mwSize j;
-    mwSize k;
-
-    /* iterate over channels */
-    for (i = 0; i < spatdimlength; i++) {
-
-        /* iterate over possible neighbours for this channel */
-        for (j = 0; j < spatdimlength; j++) {
-        
-            if ( *(neighbours + i*spatdimlength + j) ) {
-                /* channel is a neighbour */
-
-                for (k = 0; k < timefreqlength; k++) {
-                    unsigned int a = *(labelmat + k*spatdimlength + i);
-                    unsigned int b = *(labelmat + k*spatdimlength + j);
-                    if (a > 0 && b > 0) {
-                        if (replaceby[a] == replaceby[b]) {
-                            continue;
-                        } else if (replaceby[a] < replaceby[b]) {
-                            for (n = 0; n < *total; n++) {
-                                if (replaceby[n] == replaceby[b]) {
-                                    replaceby[n] = replaceby[a];
-                                }
-                            }
-                        } else if (replaceby[b] < replaceby[a]) {
-                            for (n = 0; n < *total; n++) {
-                                if (replaceby[n] == replaceby[a]) {
-                                    replaceby[n] = replaceby[b];
-                                }
-                            }
-                        }
-                    }
+    /* every label starts as a cluster of its own, the root of a cluster is its smallest label */
+    std::vector<unsigned int> parent(total);
+    for (unsigned int n = 0; n < total; n++) {
+        parent[n] = n;
+    }
+
+    /* iterate over the pairs of neighbouring channels */
+    for (size_t p = 0; p < pairs.size(); p += 2) {
+        const unsigned int *la = labelmat + pairs[p];
+        const unsigned int *lb = labelmat + pairs[p+1];
+        for (mwSize k = 0; k < timefreqlength; k++) {
+            unsigned int a = la[k*spatdimlength];
+            unsigned int b = lb[k*spatdimlength];
+            if (a > 0 && b > 0 && a < total && b < total) {
+                a = findRoot(&parent[0], a);
+                b = findRoot(&parent[0], b);
+                if (a < b) {
+                    parent[b] = a;
+                } else if (b < a) {
+                    parent[a] = b;
                 }
             }
         }
     }
     
-    /* copy and sort replaceby, retain only unique elements */
-    std::vector<int> replacebySorted (replaceby, replaceby+*total);
-    std::sort(replacebySorted.begin(), replacebySorted.end());
-    std::vector<int>::iterator it;
-    it = std::unique(replacebySorted.begin(), replacebySorted.end());
-    replacebySorted.resize(std::distance(replacebySorted.begin(), it));
-    
-    /* generate sequential cluster numbers */
-    unsigned int *clusternums;
-    unsigned int sortedSize = replacebySorted.size();
-
-    clusternums = (unsigned int *) malloc(sortedSize * sizeof(unsigned int));
-    for (n = 0; n < sortedSize; n++) {
-        clusternums[n] = n; /* the first element will be 0 (i.e. no cluster present), as is the case in replacebySorted */
-    }
-    
-    for (i = 0; i < spatdimlength; i++) {
-        for (j = 0; j < timefreqlength; j++) {
-            unsigned int val = *(labelmat + j*spatdimlength + i);
-            if (val > 0) {
-            
-                /* look for the cluster number */
-                for (n = 0; n < sortedSize; n++) {
-                    if (replacebySorted[n] == replaceby[val]) {
-                        *(out + j*spatdimlength + i) = clusternums[n];
-                        break;
-                    }
-                }
-            }
+    /* the cluster numbers are sequential in the order of their smallest label, 0 means that no cluster is present */
+    std::vector<unsigned int> clusternum(total, 0);
+    unsigned int count = 0;
+    for (unsigned int n = 1; n < total; n++) {
+        if (findRoot(&parent[0], n) == n) {
+            clusternum[n] = ++count;
         }
     }
     
-    /* clean up temp variables */
-    free((void *) replaceby);
-    free((void *) clusternums);
+    for (mwSize i = 0; i < spatdimlength*timefreqlength; i++) {
+        unsigned int val = labelmat[i];
+        out[i] = (val > 0 && val < total ? clusternum[findRoot(&parent[0], val)] : 0);
+    }
+}
+
+typedef struct {
+    const unsigned int *labelmat;
+    const unsigned int *total;
+    mwSize ntotal, spatdimlength, timefreqlength, begin, end;
+    const std::vector<mwSize> *pairs;
+    unsigned int *out;
+} combine_t;
+
+/* combine the clusters of the permutations begin to end */
+static void *combineClusters_range(void *arg) {
+    const combine_t *s = (const combine_t *)arg;
+    mwSize numel = s->spatdimlength * s->timefreqlength;
+    for (mwSize r = s->begin; r < s->end; r++) {
+        combineClusters_impl(s->labelmat + r*numel, s->total[s->ntotal==1 ? 0 : r], s->spatdimlength, s->timefreqlength, *s->pairs, s->out + r*numel);
+    }
+    return NULL;
 }
 
 /* The gateway function */
 void mexFunction( int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
-    unsigned int *labelmat;
-    unsigned int *total;
+    const unsigned int *labelmat;
+    const unsigned int *total;
     mwSize spatdimlength;
     mwSize timefreqlength;
-    mxLogical *neighbours;
+    mwSize nrepetition;
+    mwSize ntotal;
+    const mxLogical *neighbours;
     unsigned int *out;
-    unsigned int *replaceby;
+    const mwSize *dims;
+    mwSize numdims;
 
     /* check for proper number of arguments */
     if(nrhs != 3) {
@@ -119,13 +114,20 @@ void mexFunction( int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
         mexErrMsgIdAndTxt("FieldTrip:findcluster:notLogical", "second input must be logical matrix");
     }
     
-    if (!mxIsUint32(prhs[2]) || mxGetNumberOfElements(prhs[2]) > 1) {
-        mexErrMsgIdAndTxt("FieldTrip:findcluster:notUint32", "third input must be a scalar of uint32");
+    /* get dimensions of labelmat, the optional third dimension contains multiple maps, e.g. one for each permutation */
+    dims = mxGetDimensions(prhs[0]);
+    numdims = mxGetNumberOfDimensions(prhs[0]);
+    spatdimlength = dims[0];
+    timefreqlength = dims[1];
+    nrepetition = (numdims > 2 ? mxGetNumberOfElements(prhs[0]) / (spatdimlength*timefreqlength > 0 ? spatdimlength*timefreqlength : 1) : 1);
+    if (numdims > 3) {
+        mexErrMsgIdAndTxt("FieldTrip:findcluster:labelmatNotOK", "first input must be a channel x timefreq or channel x timefreq x repetition matrix");
     }
     
-    /* get dimensions of labelmat */
-    spatdimlength = (mwSize)mxGetM(prhs[0]);
-    timefreqlength = (mwSize)mxGetN(prhs[0]);
+    ntotal = mxGetNumberOfElements(prhs[2]);
+    if (!mxIsUint32(prhs[2]) || (ntotal != 1 && ntotal != nrepetition)) {
+        mexErrMsgIdAndTxt("FieldTrip:findcluster:notUint32", "third input must be a scalar of uint32, or a vector with one value for each repetition");
+    }
     
     /* perform dimension check */
     if (spatdimlength != mxGetM(prhs[1]) || spatdimlength != mxGetN(prhs[1])) {
@@ -133,14 +135,68 @@ void mexFunction( int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     }
     
     /* get the other inputs */
-    labelmat = (unsigned int *)mxGetData(prhs[0]);
-    neighbours = (mxLogical *)mxGetData(prhs[1]);
-    total = (unsigned int *)mxGetData(prhs[2]);
+    labelmat = (const unsigned int *)mxGetData(prhs[0]);
+    neighbours = (const mxLogical *)mxGetData(prhs[1]);
+    total = (const unsigned int *)mxGetData(prhs[2]);
+
+    /* make a sparse list of the neighbouring channels, the union is symmetric so each pair is only needed once */
+    std::vector<mwSize> pairs;
+    for (mwSize i = 0; i < spatdimlength; i++) {
+        for (mwSize j = i+1; j < spatdimlength; j++) {
+            if (neighbours[i*spatdimlength + j] || neighbours[j*spatdimlength + i]) {
+                pairs.push_back(i);
+                pairs.push_back(j);
+            }
+        }
+    }
 
     /* create the output matrix */
-    plhs[0] = mxCreateNumericMatrix(spatdimlength, timefreqlength, mxUINT32_CLASS, mxREAL);
+    plhs[0] = mxCreateNumericArray(numdims, dims, mxUINT32_CLASS, mxREAL);
     out = (unsigned int *)mxGetData(plhs[0]);
 
+    combine_t s;
+    s.labelmat = labelmat;
+    s.total = total;
+    s.ntotal = ntotal;
+    s.spatdimlength = spatdimlength;
+    s.timefreqlength = timefreqlength;
+    s.pairs = &pairs;
+    s.out = out;
+    s.begin = 0;
+    s.end = nrepetition;
+
+    int nthreads = 1;
+#ifdef COMBINE_THREADS
+    if (nrepetition > 1) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = (ncpu > COMBINE_MAXTHREADS ? COMBINE_MAXTHREADS : (ncpu < 1 ? 1 : (int)ncpu));
+        nthreads = ((mwSize)nthreads > nrepetition ? (int)nrepetition : nthreads);
+    }
+
+    if (nthreads > 1) {
+        pthread_t thread[COMBINE_MAXTHREADS];
+        combine_t part[COMBINE_MAXTHREADS];
+        bool started[COMBINE_MAXTHREADS];
+
+        /* divide the repetitions over the threads */
+        for (int t = 0; t < nthreads; t++) {
+            part[t] = s;
+            part[t].begin = (nrepetition*t)/nthreads;
+            part[t].end = (nrepetition*(t+1))/nthreads;
+            started[t] = (pthread_create(&thread[t], NULL, combineClusters_range, &part[t]) == 0);
+        }
+        for (int t = 0; t < nthreads; t++) {
+            if (started[t]) {
+                pthread_join(thread[t], NULL);
+            } else {
+                combineClusters_range(&part[t]);
+            }
+        }
+    }
+#endif
+
     /* call the computational routine */
-    combineClusters_impl(labelmat, total, spatdimlength, timefreqlength, neighbours, out);
+    if (nthreads == 1) {
+        combineClusters_range(&s);
+    }
 }
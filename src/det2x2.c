@@ -1,83 +1,44 @@
 #include <math.h>
 #include <mex.h>
+#include "smallmat.h"
 
-void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+static void kernel(const smallmat_t *s, mwSize first, int nl)
 {
-  /*declare variables*/
-  const mwSize *dims;
-  mwSize  *dimsout;
-  mwIndex indx;
-  int i, numdims;
-  int numelin;
-  mxClassID classid;
-  double *input1r, *input1i, *output1r, *output1i;
-  double a,  b,  c,  d;
-  double ai, bi, ci, di;
-  
-  /*figure out the classid*/
-  classid = mxGetClassID(prhs[0]);
-     
-  /*check inputs*/
-  if (nrhs>1)
-    mexErrMsgTxt("Too many input arguments");
+  smallmat_block xr[4], xi[4], yr[1], yi[1];
+  int l;
   
-  /*associate inputs*/
-  input1r = mxGetData(prhs[0]);
-  input1i = mxGetImagData(prhs[0]);
+  smallmat_get(xr, s->ar, s->singlea, 4, first, nl);
   
-  /*figure out dimension info and number of elements*/
-  dims    = mxGetDimensions(prhs[0]);
-  numdims = mxGetNumberOfDimensions(prhs[0]);
-  numelin = mxGetNumberOfElements(prhs[0]);
-  
-  dimsout    = mxMalloc(numdims * sizeof(mwSize));
-  for (i=0; i<numdims; i++)
+  if (!s->complex)
   {
-    dimsout[i] = dims[i];
+    LANES(l)
+      yr[0][l] = xr[0][l]*xr[3][l] - xr[1][l]*xr[2][l];
+    smallmat_put(s->cr, s->singlec, 1, first, nl, yr);
+    return;
   }
-  dimsout[0] = 1;
-  dimsout[1] = 1;
   
-  /*associate output*/
-  if (input1i == NULL)
-  {
-    plhs[0]  = mxCreateNumericArray(numdims, dimsout, classid, mxREAL);
-    output1r = mxGetData(plhs[0]);
-  }
-  else
+  smallmat_get(xi, s->ai, s->singlea, 4, first, nl);
+  
+  LANES(l)
   {
-    plhs[0]  = mxCreateNumericArray(numdims, dimsout, classid, mxCOMPLEX);
-    output1r = mxGetData(plhs[0]);
-    output1i = mxGetImagData(plhs[0]);
+    /*fill in the real part of the output matrix*/
+    yr[0][l] = (xr[0][l]*xr[3][l]-xi[0][l]*xi[3][l]) - (xr[1][l]*xr[2][l]-xi[1][l]*xi[2][l]);
+    
+    /*fill in the imaginary part of the output matrix*/
+    yi[0][l] = (xi[0][l]*xr[3][l]+xr[0][l]*xi[3][l]) - (xi[1][l]*xr[2][l]+xr[1][l]*xi[2][l]);
   }
+  smallmat_put(s->cr, s->singlec, 1, first, nl, yr);
+  smallmat_put(s->ci, s->singlec, 1, first, nl, yi);
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  smallmat_t s;
+  
+  /*check inputs and associate output*/
+  smallmat_init(&s, plhs, nrhs, prhs, 1, 4, 1);
   
   /* do the computation*/
-  if (input1i == NULL)
-  {  
-    for (i=0; i<numelin/4; i++)
-    {
-      a = input1r[i*4  ];
-      b = input1r[i*4+1];
-      c = input1r[i*4+2];
-      d = input1r[i*4+3];
-      output1r[i] = a*d - b*c;
-    }
-    return;
-  }
-  else
-  {  
-    for (i=0; i<numelin/4; i++)
-    {
-      /*matrix 1*/
-      a  = input1r[i*4  ]; b  = input1r[i*4+1]; c  = input1r[i*4+2]; d  = input1r[i*4+3];
-      ai = input1i[i*4  ]; bi = input1i[i*4+1]; ci = input1i[i*4+2]; di = input1i[i*4+3];
-      
-      /*fill in the real part of the output matrix*/
-      output1r[i] = (a*d-ai*di) - (b*c-bi*ci);
-      
-      /*fill in the imaginary part of the output matrix*/
-      output1i[i] = (ai*d+a*di) - (bi*c+b*ci);
-    }
-    return;
-  }
+  s.kernel = kernel;
+  smallmat_run(&s);
 }
@@ -0,0 +1,239 @@
+/* CrossCorrPairs
+ * Cross-correlation function for many pairs of spike trains
+ * MEX file
+ *
+ * input: t: nunit x ntrial cell-array with the spike times of each unit in each trial in seconds
+ * Important: the timeseries should be sorted!
+ *        pairs: npairs x 2 matrix with the indices of the units to cross correlate
+ *        binsize: the binsize for the cross corr histogram in seconds
+ *        nbins: the number of bins
+ *        keeptrials (optional): return the histogram of each trial rather than the sum over trials (default 0)
+ *        shift (optional): compute the shift predictor, i.e. correlate the first unit in trial k with the
+ *                          second unit in trial k+1 (default 0)
+ * output: C the cross correlation histograms, nbins x npairs or nbins x npairs x ntrial
+ *         B (optional) a vector with the times corresponding to the bins
+ *
+ * The histogram of each pair is the same as computed with ft_spike_sub_crossx. The pairs are
+ * distributed over multiple threads, each thread counts in its own bin array.
+ */
+
+#include "mex.h"
+#include "platform.h"
+#include <math.h>
+
+#if !defined(PLATFORM_WINDOWS)
+#include <pthread.h>
+#include <unistd.h>
+#define CROSSX_THREADS
+#endif
+
+#define CROSSX_MAXTHREADS 16
+#define CROSSX_MINSIZE    64    /* number of pairs below which a single thread is used */
+
+typedef struct {
+  const double **t;     /* spike times of each unit in each trial */
+  const mwSize *n;      /* number of spikes of each unit in each trial */
+  const double *pairs;
+  mwSize nunit, ntrial, npairs;
+  double binSize, minLag;
+  int nBins, keeptrials, shift;
+  double *C;
+  unsigned int *bins;   /* the bin array of this thread */
+  mwSize begin, end;    /* the pairs that are computed by this thread */
+} crossx_t;
+
+/* add the cross-correlation of two sorted spike trains to the histogram, using a sliding window over the second train */
+static void
+crossx(const double *tX, mwSize nX, const double *tY, mwSize nY, double minLag, double binSize, int nBins, unsigned int *C)
+{
+  mwSize iX, jY, yStartIndx = 0;
+  double d, t1, lBound;
+  int binNum;
+
+  for (iX=0; iX<nX; iX++)
+  {
+    /* first determine where to start, this only moves forward since tX is sorted */
+    t1 = tX[iX];
+    lBound = t1 + minLag;
+    while (yStartIndx<nY && tY[yStartIndx]<lBound)
+      yStartIndx++;
+    if (yStartIndx==nY)
+      break;
+
+    for (jY=yStartIndx; jY<nY; jY++)
+    {
+      /* find the binnumber associated with the distance */
+      d      = tY[jY] - t1;
+      binNum = (d - minLag)/binSize;
+      if (binNum>(nBins-1))
+        break;
+      C[binNum]++;
+    }
+  }
+}
+
+static void *
+crossx_pairs (void *arg)
+{
+  const crossx_t *s = (const crossx_t *)arg;
+  mwSize p, k, kY, b, ntrial = s->ntrial, npairs = s->npairs;
+  mwSize ux, uy, ix, iy;
+  unsigned int *C = s->bins;
+  double *out;
+
+  for (p=s->begin; p<s->end; p++)
+  {
+    ux = (mwSize)s->pairs[p] - 1;
+    uy = (mwSize)s->pairs[p+npairs] - 1;
+
+    for (k=0; k<ntrial; k++)
+    {
+      kY = (s->shift ? k+1 : k);
+      if (kY<ntrial)
+      {
+        ix = ux + k*s->nunit;
+        iy = uy + kY*s->nunit;
+        crossx(s->t[ix], s->n[ix], s->t[iy], s->n[iy], s->minLag, s->binSize, s->nBins, C);
+      }
+
+      if (s->keeptrials || k==ntrial-1)
+      {
+        out = s->C + (s->keeptrials ? (p + k*npairs) : p)*s->nBins;
+        for (b=0; b<(mwSize)s->nBins; b++)
+        {
+          out[b] = C[b];
+          C[b]   = 0;
+        }
+      }
+    }
+  }
+
+  return NULL;
+}
+
+void mexFunction(
+  int nOutputs, mxArray *pointerOutputs[],
+  int nInputs, const mxArray *pointerInputs[])
+{
+  crossx_t s;
+  const double **tp;
+  mwSize *tn;
+  unsigned int *work;
+  double *bins;
+  mwSize i, dims[3];
+  int iBin, t, nthreads = 1;
+  const mxArray *c;
+
+  if (nInputs<4 || nInputs>6)
+    mexErrMsgTxt("Invalid number of input arguments");
+  if (!mxIsCell(pointerInputs[0]))
+    mexErrMsgTxt("The spike times should be specified as a nunit x ntrial cell-array");
+  if (!mxIsDouble(pointerInputs[1]) || mxGetN(pointerInputs[1])!=2)
+    mexErrMsgTxt("The pairs should be specified as a npairs x 2 matrix");
+
+  s.nunit  = mxGetM(pointerInputs[0]);
+  s.ntrial = mxGetN(pointerInputs[0]);
+  s.pairs  = mxGetPr(pointerInputs[1]);
+  s.npairs = mxGetM(pointerInputs[1]);
+
+  for (i=0; i<2*s.npairs; i++)
+    if (s.pairs[i]<1 || s.pairs[i]>s.nunit)
+      mexErrMsgTxt("Invalid unit index in the pairs");
+
+  /* look up the spike trains only once, the mx functions are not called from the threads */
+  tp = mxMalloc((s.nunit*s.ntrial>0 ? s.nunit*s.ntrial : 1)*sizeof(const double *));
+  tn = mxMalloc((s.nunit*s.ntrial>0 ? s.nunit*s.ntrial : 1)*sizeof(mwSize));
+  for (i=0; i<s.nunit*s.ntrial; i++)
+  {
+    c = mxGetCell(pointerInputs[0], i);
+    if (c && !mxIsEmpty(c) && (!mxIsDouble(c) || mxIsComplex(c)))
+      mexErrMsgTxt("The spike times should be real-valued double precision");
+    tp[i] = (c ? mxGetPr(c) : NULL);
+    tn[i] = (c ? mxGetNumberOfElements(c) : 0);
+  }
+  s.t = tp;
+  s.n = tn;
+
+  s.binSize    = mxGetScalar(pointerInputs[2]);
+  s.nBins      = (int)mxGetScalar(pointerInputs[3]);
+  s.keeptrials = (nInputs>4 ? (mxGetScalar(pointerInputs[4])!=0) : 0);
+  s.shift      = (nInputs>5 ? (mxGetScalar(pointerInputs[5])!=0) : 0);
+
+  if (s.binSize<=0 || s.nBins<1)
+    mexErrMsgTxt("The binsize and the number of bins should be positive");
+
+  if ((s.nBins / 2) * 2 == s.nBins)
+  {
+    s.nBins++;
+  }
+
+  /* create the pointer to the first output matrix */
+  dims[0] = s.nBins;
+  dims[1] = s.npairs;
+  dims[2] = s.ntrial;
+  pointerOutputs[0] = mxCreateNumericArray((s.keeptrials ? 3 : 2), dims, mxDOUBLE_CLASS, mxREAL);
+  s.C               = mxGetPr(pointerOutputs[0]);
+
+  if (nOutputs == 2)
+  {
+    pointerOutputs[1] = mxCreateDoubleMatrix(s.nBins, 1, mxREAL);
+    bins              = mxGetPr(pointerOutputs[1]);
+
+    for (iBin = 0; iBin < s.nBins; iBin++)
+    {
+      bins[iBin] = -s.binSize*(s.nBins/2) + iBin*s.binSize;
+    }
+  }
+
+  /* compute the actual cross-correlations */
+  s.minLag = -s.nBins*s.binSize/2.0;
+
+#ifdef CROSSX_THREADS
+  if (s.npairs>=CROSSX_MINSIZE)
+  {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = (ncpu>CROSSX_MAXTHREADS ? CROSSX_MAXTHREADS : (ncpu<1 ? 1 : (int)ncpu));
+    nthreads = ((mwSize)nthreads>s.npairs ? (int)s.npairs : nthreads);
+  }
+
+  if (nthreads>1)
+  {
+    pthread_t thread[CROSSX_MAXTHREADS];
+    crossx_t part[CROSSX_MAXTHREADS];
+    int started[CROSSX_MAXTHREADS];
+
+    work = mxCalloc(nthreads*s.nBins, sizeof(unsigned int));
+
+    /* divide the pairs over the threads */
+    for (t=0; t<nthreads; t++)
+    {
+      part[t]       = s;
+      part[t].begin = (s.npairs*t)/nthreads;
+      part[t].end   = (s.npairs*(t+1))/nthreads;
+      part[t].bins  = work + t*s.nBins;
+      started[t]    = (pthread_create(&thread[t], NULL, crossx_pairs, &part[t])==0);
+    }
+    for (t=0; t<nthreads; t++)
+    {
+      if (started[t])
+        pthread_join(thread[t], NULL);
+      else
+        crossx_pairs(&part[t]);
+    }
+    mxFree(work);
+  }
+#endif
+
+  if (nthreads==1)
+  {
+    work    = mxCalloc(s.nBins, sizeof(unsigned int));
+    s.bins  = work;
+    s.begin = 0;
+    s.end   = s.npairs;
+    crossx_pairs(&s);
+    mxFree(work);
+  }
+
+  mxFree(tp);
+  mxFree(tn);
+}
@@ -1,95 +1,63 @@
 #include <math.h>
 #include <mex.h>
+#include "smallmat.h"
 
-void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+static void kernel(const smallmat_t *s, mwSize first, int nl)
 {
-  /*declare variables*/
-  const mwSize *dims;
-  mwIndex indx;
-  int i, numdims;
-  int numelin;
-  mxClassID classid;
-  double *input1r, *input1i, *output1r, *output1i;
-  double a,  b,  c,  d,  denom;
-  double ai, bi, ci, di, denomi, denomabs;
-  
-  /*figure out the classid*/
-  classid = mxGetClassID(prhs[0]);
-     
-  /*check inputs*/
-  if (nrhs>1)
-    mexErrMsgTxt("Too many input arguments");
+  smallmat_block xr[4], xi[4], yr[4], yi[4];
+  double denom, denomi, denomabs;
+  int l;
   
-  /*associate inputs*/
-  input1r = mxGetData(prhs[0]);
-  input1i = mxGetImagData(prhs[0]);
+  smallmat_get(xr, s->ar, s->singlea, 4, first, nl);
   
-  /*figure out dimension info and number of elements*/
-  dims    = mxGetDimensions(prhs[0]);
-  numdims = mxGetNumberOfDimensions(prhs[0]);
-  numelin = mxGetNumberOfElements(prhs[0]);
-  /*associate output*/
-  if (input1i == NULL)
-  {
-    plhs[0]  = mxCreateNumericArray(numdims, dims, classid, mxREAL);
-    output1r = mxGetData(plhs[0]);
-  }
-  else
+  if (!s->complex)
   {
-    plhs[0]  = mxCreateNumericArray(numdims, dims, classid, mxCOMPLEX);
-    output1r = mxGetData(plhs[0]);
-    output1i = mxGetImagData(plhs[0]);
-  }
-  
-  /* do the computation*/
-  if (input1i == NULL)
-  {  
-    for (i=0; i<numelin/4; i++)
+    LANES(l)
     {
-      a = input1r[i*4  ];
-      b = input1r[i*4+1];
-      c = input1r[i*4+2];
-      d = input1r[i*4+3];
-      denom = a*d - b*c;
-    
-      output1r[i*4  ] =  d/denom;
-      output1r[i*4+1] = -b/denom;
-      output1r[i*4+2] = -c/denom;
-      output1r[i*4+3] =  a/denom;
-    }
-    return;
-  }
-  else
-  {  
-    for (i=0; i<numelin/4; i++)
-    {
-      /*matrix 1*/
-      a  = input1r[i*4  ]; b  = input1r[i*4+1]; c  = input1r[i*4+2]; d  = input1r[i*4+3];
-      ai = input1i[i*4  ]; bi = input1i[i*4+1]; ci = input1i[i*4+2]; di = input1i[i*4+3];
-      
-      /*get the determinant*/
-      denom    = (a*d-ai*di) - (b*c-bi*ci);
-      denomi   = (ai*d+a*di) - (bi*c+b*ci);
-      denomabs = denom*denom + denomi*denomi;
+      denom = xr[0][l]*xr[3][l] - xr[1][l]*xr[2][l];
       
-      /*fill in the real part of the output matrix*/
-      output1r[i*4  ] =  (d*denom+di*denomi)/denomabs;
-      output1r[i*4+1] = -(b*denom+bi*denomi)/denomabs;
-      output1r[i*4+2] = -(c*denom+ci*denomi)/denomabs;
-      output1r[i*4+3] =  (a*denom+ai*denomi)/denomabs;
-      
-      /*fill in the imaginary part of the output matrix*/
-      output1i[i*4  ] = -(d*denomi-di*denom)/denomabs;
-      output1i[i*4+1] =  (b*denomi-bi*denom)/denomabs;
-      output1i[i*4+2] =  (c*denomi-ci*denom)/denomabs;
-      output1i[i*4+3] = -(a*denomi-ai*denom)/denomabs;
+      yr[0][l] =  xr[3][l]/denom;
+      yr[1][l] = -xr[1][l]/denom;
+      yr[2][l] = -xr[2][l]/denom;
+      yr[3][l] =  xr[0][l]/denom;
     }
+    smallmat_put(s->cr, s->singlec, 4, first, nl, yr);
     return;
   }
   
-  /* do the computation*/
-  for (i=0; i<numelin/4; i++)
+  smallmat_get(xi, s->ai, s->singlea, 4, first, nl);
+  
+  LANES(l)
   {
+    /*get the determinant*/
+    denom    = (xr[0][l]*xr[3][l]-xi[0][l]*xi[3][l]) - (xr[1][l]*xr[2][l]-xi[1][l]*xi[2][l]);
+    denomi   = (xi[0][l]*xr[3][l]+xr[0][l]*xi[3][l]) - (xi[1][l]*xr[2][l]+xr[1][l]*xi[2][l]);
+    denomabs = denom*denom + denomi*denomi;
+    
+    /*fill in the real part of the output matrix*/
+    yr[0][l] =  (xr[3][l]*denom+xi[3][l]*denomi)/denomabs;
+    yr[1][l] = -(xr[1][l]*denom+xi[1][l]*denomi)/denomabs;
+    yr[2][l] = -(xr[2][l]*denom+xi[2][l]*denomi)/denomabs;
+    yr[3][l] =  (xr[0][l]*denom+xi[0][l]*denomi)/denomabs;
+    
+    /*fill in the imaginary part of the output matrix*/
+    yi[0][l] = -(xr[3][l]*denomi-xi[3][l]*denom)/denomabs;
+    yi[1][l] =  (xr[1][l]*denomi-xi[1][l]*denom)/denomabs;
+    yi[2][l] =  (xr[2][l]*denomi-xi[2][l]*denom)/denomabs;
+    yi[3][l] = -(xr[0][l]*denomi-xi[0][l]*denom)/denomabs;
   }
-  return;
+  smallmat_put(s->cr, s->singlec, 4, first, nl, yr);
+  smallmat_put(s->ci, s->singlec, 4, first, nl, yi);
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  smallmat_t s;
+  
+  /*check inputs and associate output*/
+  smallmat_init(&s, plhs, nrhs, prhs, 1, 4, 4);
+  
+  /* do the computation*/
+  s.kernel = kernel;
+  smallmat_run(&s);
 }
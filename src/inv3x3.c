@@ -1,146 +1,93 @@
 #include <math.h>
 #include <matrix.h>
 #include <mex.h>
+#include "smallmat.h"
 
-void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
-{
-  /*declare variables*/
-  const mwSize *dims;
-  mwSize  *dimsout;
-  mwIndex indx;
-  int i, j, k, numdims;
-  int numelin;
-  mxClassID classid;
-  double *input1r, *input1i, *output1r, *output1i;
-  double x[3][3], adjx[3][3];
-  double xi[3][3], adjxi[3][3];
-  double D,Di,Dabs;
+/*element (r,c) of the matrices in the block, (r,c) of the adjugate is the cofactor of element (c,r)*/
+#define X(r,c)     xr[(r)+3*(c)][l]
+#define XI(r,c)    xi[(r)+3*(c)][l]
+#define ADJX(r,c)  adjx[(r)+3*(c)][l]
+#define ADJXI(r,c) adjxi[(r)+3*(c)][l]
 
-  /*figure out the classid*/
-  classid = mxGetClassID(prhs[0]);
-     
-  /*check inputs*/
-  if (nrhs>1)
-    mexErrMsgTxt("Too many input arguments");
-  
-  /*associate inputs*/
-  input1r = mxGetData(prhs[0]);
-  input1i = mxGetImagData(prhs[0]);
-  
-  /*figure out dimension info and number of elements*/
-  dims    = mxGetDimensions(prhs[0]);
-  numdims = mxGetNumberOfDimensions(prhs[0]);
-  numelin = mxGetNumberOfElements(prhs[0]);
+static void kernel(const smallmat_t *s, mwSize first, int nl)
+{
+  smallmat_block xr[9], xi[9], adjx[9], adjxi[9];
+  double D, Di, Dabs;
+  int k, l;
   
-  dimsout    = mxMalloc(numdims * sizeof(mwSize));
-  for (i=0; i<numdims; i++)
-  {
-    dimsout[i] = dims[i];
-  }
+  smallmat_get(xr, s->ar, s->singlea, 9, first, nl);
   
-  /*associate output*/
-  if (input1i == NULL)
+  if (!s->complex)
   {
-    plhs[0]  = mxCreateNumericArray(numdims, dimsout, classid, mxREAL);
-    output1r = mxGetData(plhs[0]);
-  }
-  else
-  {
-    plhs[0]  = mxCreateNumericArray(numdims, dimsout, classid, mxCOMPLEX);
-    output1r = mxGetData(plhs[0]);
-    output1i = mxGetImagData(plhs[0]);
-  }
-  
-  /* do the computation*/
-  if (input1i == NULL)
-  {  
-    for (i=0; i<numelin/9; i++)
+    LANES(l)
     {
-      for (j=0; j<3; j++)
-        for (k=0; k<3; k++)
-        {x[k][j]=input1r[i*9+j*3+k];}
-          
-      adjx[0][0] =  x[1][1]*x[2][2]-x[1][2]*x[2][1];
-      adjx[1][0] = -x[1][0]*x[2][2]+x[1][2]*x[2][0];
-      adjx[2][0] =  x[1][0]*x[2][1]-x[1][1]*x[2][0];
-      adjx[0][1] = -x[0][1]*x[2][2]+x[0][2]*x[2][1];
-      adjx[1][1] =  x[0][0]*x[2][2]-x[0][2]*x[2][0];
-      adjx[2][1] = -x[0][0]*x[2][1]+x[0][1]*x[2][0];
-      adjx[0][2] =  x[0][1]*x[1][2]-x[0][2]*x[1][1];
-      adjx[1][2] = -x[0][0]*x[1][2]+x[0][2]*x[1][0];
-      adjx[2][2] =  x[0][0]*x[1][1]-x[0][1]*x[1][0];
+      ADJX(0,0) =  X(1,1)*X(2,2)-X(1,2)*X(2,1);
+      ADJX(1,0) = -X(1,0)*X(2,2)+X(1,2)*X(2,0);
+      ADJX(2,0) =  X(1,0)*X(2,1)-X(1,1)*X(2,0);
+      ADJX(0,1) = -X(0,1)*X(2,2)+X(0,2)*X(2,1);
+      ADJX(1,1) =  X(0,0)*X(2,2)-X(0,2)*X(2,0);
+      ADJX(2,1) = -X(0,0)*X(2,1)+X(0,1)*X(2,0);
+      ADJX(0,2) =  X(0,1)*X(1,2)-X(0,2)*X(1,1);
+      ADJX(1,2) = -X(0,0)*X(1,2)+X(0,2)*X(1,0);
+      ADJX(2,2) =  X(0,0)*X(1,1)-X(0,1)*X(1,0);
       
-      D = adjx[0][0]*x[0][0]+adjx[1][0]*x[0][1]+adjx[2][0]*x[0][2];
+      D = ADJX(0,0)*X(0,0)+ADJX(1,0)*X(0,1)+ADJX(2,0)*X(0,2);
       
-      output1r[i*9   ] = adjx[0][0]/D;
-      output1r[i*9+1 ] = adjx[1][0]/D;
-      output1r[i*9+2 ] = adjx[2][0]/D;
-      output1r[i*9+3 ] = adjx[0][1]/D;
-      output1r[i*9+4 ] = adjx[1][1]/D;
-      output1r[i*9+5 ] = adjx[2][1]/D;
-      output1r[i*9+6 ] = adjx[0][2]/D;
-      output1r[i*9+7 ] = adjx[1][2]/D;
-      output1r[i*9+8 ] = adjx[2][2]/D;
+      for (k=0; k<9; k++)
+        adjx[k][l] /= D;
     }
+    smallmat_put(s->cr, s->singlec, 9, first, nl, adjx);
     return;
   }
-  else
-  {  
-    for (i=0; i<numelin/9; i++)
+  
+  smallmat_get(xi, s->ai, s->singlea, 9, first, nl);
+  
+  LANES(l)
+  {
+    ADJX(0,0)  =  X(1,1)*X(2,2)-X(1,2)*X(2,1)-XI(1,1)*XI(2,2)+XI(1,2)*XI(2,1);
+    ADJX(1,0)  = -X(1,0)*X(2,2)+X(1,2)*X(2,0)+XI(1,0)*XI(2,2)-XI(1,2)*XI(2,0);
+    ADJX(2,0)  =  X(1,0)*X(2,1)-X(1,1)*X(2,0)-XI(1,0)*XI(2,1)+XI(1,1)*XI(2,0);
+    ADJXI(0,0) =  X(1,1)*XI(2,2)-X(1,2)*XI(2,1)+XI(1,1)*X(2,2)-XI(1,2)*X(2,1);
+    ADJXI(1,0) = -X(1,0)*XI(2,2)+X(1,2)*XI(2,0)-XI(1,0)*X(2,2)+XI(1,2)*X(2,0);
+    ADJXI(2,0) =  X(1,0)*XI(2,1)-X(1,1)*XI(2,0)+XI(1,0)*X(2,1)-XI(1,1)*X(2,0);
+    
+    D  = ADJX(0,0)*X(0,0)+ADJX(1,0)*X(0,1)+ADJX(2,0)*X(0,2)-ADJXI(0,0)*XI(0,0)-ADJXI(1,0)*XI(0,1)-ADJXI(2,0)*XI(0,2);
+    Di = ADJX(0,0)*XI(0,0)+ADJX(1,0)*XI(0,1)+ADJX(2,0)*XI(0,2)+ADJXI(0,0)*X(0,0)+ADJXI(1,0)*X(0,1)+ADJXI(2,0)*X(0,2);
+    Dabs = D*D+Di*Di;
+    
+    ADJX(0,1)  = -X(0,1)*X(2,2)+X(0,2)*X(2,1)+XI(0,1)*XI(2,2)-XI(0,2)*XI(2,1);
+    ADJX(1,1)  =  X(0,0)*X(2,2)-X(0,2)*X(2,0)-XI(0,0)*XI(2,2)+XI(0,2)*XI(2,0);
+    ADJX(2,1)  = -X(0,0)*X(2,1)+X(0,1)*X(2,0)+XI(0,0)*XI(2,1)-XI(0,1)*XI(2,0);
+    ADJX(0,2)  =  X(0,1)*X(1,2)-X(0,2)*X(1,1)-XI(0,1)*XI(1,2)+XI(0,2)*XI(1,1);
+    ADJX(1,2)  = -X(0,0)*X(1,2)+X(0,2)*X(1,0)+XI(0,0)*XI(1,2)-XI(0,2)*XI(1,0);
+    ADJX(2,2)  =  X(0,0)*X(1,1)-X(0,1)*X(1,0)-XI(0,0)*XI(1,1)+XI(0,1)*XI(1,0);
+    
+    ADJXI(0,1) = -X(0,1)*XI(2,2)+X(0,2)*XI(2,1)-XI(0,1)*X(2,2)+XI(0,2)*X(2,1);
+    ADJXI(1,1) =  X(0,0)*XI(2,2)-X(0,2)*XI(2,0)+XI(0,0)*X(2,2)-XI(0,2)*X(2,0);
+    ADJXI(2,1) = -X(0,0)*XI(2,1)+X(0,1)*XI(2,0)-XI(0,0)*X(2,1)+XI(0,1)*X(2,0);
+    ADJXI(0,2) =  X(0,1)*XI(1,2)-X(0,2)*XI(1,1)+XI(0,1)*X(1,2)-XI(0,2)*X(1,1);
+    ADJXI(1,2) = -X(0,0)*XI(1,2)+X(0,2)*XI(1,0)-XI(0,0)*X(1,2)+XI(0,2)*X(1,0);
+    ADJXI(2,2) =  X(0,0)*XI(1,1)-X(0,1)*XI(1,0)+XI(0,0)*X(1,1)-XI(0,1)*X(1,0);
+    
+    /*divide by the determinant, the input is not needed any more and holds the real part*/
+    for (k=0; k<9; k++)
     {
-      for (j=0; j<3; j++)
-        for (k=0; k<3; k++)
-        {
-          x[k][j]  = input1r[i*9+j*3+k];
-          xi[k][j] = input1i[i*9+j*3+k];
-        }
-      
-      adjx[0][0] =  x[1][1]*x[2][2]-x[1][2]*x[2][1]-xi[1][1]*xi[2][2]+xi[1][2]*xi[2][1];
-      adjx[1][0] = -x[1][0]*x[2][2]+x[1][2]*x[2][0]+xi[1][0]*xi[2][2]-xi[1][2]*xi[2][0];
-      adjx[2][0] =  x[1][0]*x[2][1]-x[1][1]*x[2][0]-xi[1][0]*xi[2][1]+xi[1][1]*xi[2][0];
-      adjxi[0][0] =  x[1][1]*xi[2][2]-x[1][2]*xi[2][1]+xi[1][1]*x[2][2]-xi[1][2]*x[2][1];
-      adjxi[1][0] = -x[1][0]*xi[2][2]+x[1][2]*xi[2][0]-xi[1][0]*x[2][2]+xi[1][2]*x[2][0];
-      adjxi[2][0] =  x[1][0]*xi[2][1]-x[1][1]*xi[2][0]+xi[1][0]*x[2][1]-xi[1][1]*x[2][0];
-      
-      D  = adjx[0][0]*x[0][0]+adjx[1][0]*x[0][1]+adjx[2][0]*x[0][2]-adjxi[0][0]*xi[0][0]-adjxi[1][0]*xi[0][1]-adjxi[2][0]*xi[0][2];
-      Di = adjx[0][0]*xi[0][0]+adjx[1][0]*xi[0][1]+adjx[2][0]*xi[0][2]+adjxi[0][0]*x[0][0]+adjxi[1][0]*x[0][1]+adjxi[2][0]*x[0][2];
-      Dabs = D*D+Di*Di;
-      
-      adjx[0][1] = -x[0][1]*x[2][2]+x[0][2]*x[2][1]+xi[0][1]*xi[2][2]-xi[0][2]*xi[2][1];
-      adjx[1][1] =  x[0][0]*x[2][2]-x[0][2]*x[2][0]-xi[0][0]*xi[2][2]+xi[0][2]*xi[2][0];
-      adjx[2][1] = -x[0][0]*x[2][1]+x[0][1]*x[2][0]+xi[0][0]*xi[2][1]-xi[0][1]*xi[2][0];
-      adjx[0][2] =  x[0][1]*x[1][2]-x[0][2]*x[1][1]-xi[0][1]*xi[1][2]+xi[0][2]*xi[1][1];
-      adjx[1][2] = -x[0][0]*x[1][2]+x[0][2]*x[1][0]+xi[0][0]*xi[1][2]-xi[0][2]*xi[1][0];
-      adjx[2][2] =  x[0][0]*x[1][1]-x[0][1]*x[1][0]-xi[0][0]*xi[1][1]+xi[0][1]*xi[1][0];
-      
-      adjxi[0][1] = -x[0][1]*xi[2][2]+x[0][2]*xi[2][1]-xi[0][1]*x[2][2]+xi[0][2]*x[2][1];
-      adjxi[1][1] =  x[0][0]*xi[2][2]-x[0][2]*xi[2][0]+xi[0][0]*x[2][2]-xi[0][2]*x[2][0];
-      adjxi[2][1] = -x[0][0]*xi[2][1]+x[0][1]*xi[2][0]-xi[0][0]*x[2][1]+xi[0][1]*x[2][0];
-      adjxi[0][2] =  x[0][1]*xi[1][2]-x[0][2]*xi[1][1]+xi[0][1]*x[1][2]-xi[0][2]*x[1][1];
-      adjxi[1][2] = -x[0][0]*xi[1][2]+x[0][2]*xi[1][0]-xi[0][0]*x[1][2]+xi[0][2]*x[1][0];
-      adjxi[2][2] =  x[0][0]*xi[1][1]-x[0][1]*xi[1][0]+xi[0][0]*x[1][1]-xi[0][1]*x[1][0];
-      
-      output1r[i*9   ] = (D*adjx[0][0]+Di*adjxi[0][0])/Dabs;
-      output1r[i*9+1 ] = (D*adjx[1][0]+Di*adjxi[1][0])/Dabs;
-      output1r[i*9+2 ] = (D*adjx[2][0]+Di*adjxi[2][0])/Dabs;
-      output1r[i*9+3 ] = (D*adjx[0][1]+Di*adjxi[0][1])/Dabs;
-      output1r[i*9+4 ] = (D*adjx[1][1]+Di*adjxi[1][1])/Dabs;
-      output1r[i*9+5 ] = (D*adjx[2][1]+Di*adjxi[2][1])/Dabs;
-      output1r[i*9+6 ] = (D*adjx[0][2]+Di*adjxi[0][2])/Dabs;
-      output1r[i*9+7 ] = (D*adjx[1][2]+Di*adjxi[1][2])/Dabs;
-      output1r[i*9+8 ] = (D*adjx[2][2]+Di*adjxi[2][2])/Dabs;
-      
-      output1i[i*9   ] = (D*adjxi[0][0]-Di*adjx[0][0])/Dabs;
-      output1i[i*9+1 ] = (D*adjxi[1][0]-Di*adjx[1][0])/Dabs;
-      output1i[i*9+2 ] = (D*adjxi[2][0]-Di*adjx[2][0])/Dabs;
-      output1i[i*9+3 ] = (D*adjxi[0][1]-Di*adjx[0][1])/Dabs;
-      output1i[i*9+4 ] = (D*adjxi[1][1]-Di*adjx[1][1])/Dabs;
-      output1i[i*9+5 ] = (D*adjxi[2][1]-Di*adjx[2][1])/Dabs;
-      output1i[i*9+6 ] = (D*adjxi[0][2]-Di*adjx[0][2])/Dabs;
-      output1i[i*9+7 ] = (D*adjxi[1][2]-Di*adjx[1][2])/Dabs;
-      output1i[i*9+8 ] = (D*adjxi[2][2]-Di*adjx[2][2])/Dabs;
-              
+      xr[k][l]    = (D*adjx[k][l]+Di*adjxi[k][l])/Dabs;
+      adjxi[k][l] = (D*adjxi[k][l]-Di*adjx[k][l])/Dabs;
     }
-    return;
   }
+  smallmat_put(s->cr, s->singlec, 9, first, nl, xr);
+  smallmat_put(s->ci, s->singlec, 9, first, nl, adjxi);
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  smallmat_t s;
+  
+  /*check inputs and associate output*/
+  smallmat_init(&s, plhs, nrhs, prhs, 1, 9, 9);
+  
+  /* do the computation*/
+  s.kernel = kernel;
+  smallmat_run(&s);
 }
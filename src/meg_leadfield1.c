@@ -1,87 +1,214 @@
 #include <string.h>
 #include <math.h>
 #include "mex.h"
+#include "platform.h"
+
+#if !defined(PLATFORM_WINDOWS)
+#include <pthread.h>
+#include <unistd.h>
+#define LEADFIELD_THREADS
+#endif
+
+#define LEADFIELD_MAXTHREADS 16
+#define LEADFIELD_MINSIZE    (1<<16)  /* number of channels times dipoles below which a single thread is used */
+
+typedef struct {
+  const double *R;      /* dipole positions, npos x 3 */
+  const double *rm;     /* channel positions, nchan x 3 */
+  const double *um;     /* channel orientations, nchan x 3 */
+  const double *rn;     /* norm of the channel positions */
+  mwSize npos, nchan;
+  double eps;
+  void *lf;             /* leadfield, nchan x 3 x npos */
+  int single;
+  mwSize begin, end;    /* the dipoles that are computed by this thread */
+} leadfield_t;
+
+/* compute the leadfield of the dipoles begin to end, the loop over the channels has no branches and can be vectorized */
+static void *
+leadfield (void *arg)
+{
+  const leadfield_t *s = (const leadfield_t *)arg;
+  double tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7, alpha, beta, A, B, C;
+  double r[3], u[3], d[3], R[3], lf[3];
+  mwSize i, j, k, nchan = s->nchan;
+  double *lf_d;
+  float *lf_s;
+
+  for (j=s->begin; j<s->end; j++)
+  {
+    R[0] = s->R[j];
+    R[1] = s->R[j+s->npos];
+    R[2] = s->R[j+s->npos+s->npos];
+    lf_d = (double *)s->lf + j*3*nchan;
+    lf_s = (float *)s->lf + j*3*nchan;
+
+    tmp2 = sqrt(R[0]*R[0] + R[1]*R[1] + R[2]*R[2]);	/* norm(R) */
+
+    for (i=0; i<nchan; i++)
+    {
+      /* get the position of this single channel */
+      r[0] = s->rm[i];
+      r[1] = s->rm[i+nchan];
+      r[2] = s->rm[i+nchan+nchan];
+      /* get the orientation of this single channel */
+      u[0] = s->um[i];
+      u[1] = s->um[i+nchan];
+      u[2] = s->um[i+nchan+nchan];
+
+      /* compute the difference between this channel and the dipole position */
+      d[0] = r[0] - R[0];
+      d[1] = r[1] - R[1];
+      d[2] = r[2] - R[2];
+
+      tmp1 = s->rn[i];					/* norm(r), this does not depend on the dipole */
+      tmp3 = sqrt(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]);	/* norm(d) */
+      tmp4 = r[0]*R[0] + r[1]*R[1] + r[2]*R[2];		/* dot(r, R) */
+      tmp5 = r[0]*d[0] + r[1]*d[1] + r[2]*d[2];		/* dot(r, d) */
+      tmp6 = R[0]*d[0] + R[1]*d[1] + R[2]*d[2];		/* dot(R, d) */
+      tmp7 = tmp1*tmp2*tmp1*tmp2 - tmp4*tmp4;		/* norm(cross(r,R))^2 */
+
+      alpha = 1 / (-tmp3 * (tmp1*tmp3+tmp5));
+      A = 1/tmp3 - 2*alpha*tmp2*tmp2 - 1/tmp1;
+      B = 2*alpha*tmp4;
+      C = -tmp6/(tmp3*tmp3*tmp3);
+
+      beta = ((A*r[0] + B*R[0] + C*d[0])*u[0] +
+              (A*r[1] + B*R[1] + C*d[1])*u[1] +
+              (A*r[2] + B*R[2] + C*d[2])*u[2]) / tmp7;
+      beta = (tmp7<s->eps ? 0 : beta);
+
+      /* re-use the temporary array d for something else */
+      d[0] = alpha*u[0] + beta*r[0];
+      d[1] = alpha*u[1] + beta*r[1];
+      d[2] = alpha*u[2] + beta*r[2];
+
+      /* lf(i,:) = 1e-7 * cross(alpha*u  + beta*r, R) */
+      lf[0] = (d[1]*R[2] - d[2]*R[1])*1e-7;
+      lf[1] = (d[2]*R[0] - d[0]*R[2])*1e-7;
+      lf[2] = (d[0]*R[1] - d[1]*R[0])*1e-7;
+
+      if (s->single)
+        for (k=0; k<3; k++)
+          lf_s[i+k*nchan] = (float)lf[k];
+      else
+        for (k=0; k<3; k++)
+          lf_d[i+k*nchan] = lf[k];
+    }
+  }
+  return NULL;
+}
+
+/* return the input as double precision, a copy is made for single precision input */
+static const double *
+getdouble (const mxArray *x, double **copy)
+{
+  mwSize i, n = mxGetNumberOfElements(x);
+  const float *p;
+
+  *copy = NULL;
+  if (mxIsDouble(x))
+    return mxGetData(x);
+  p = mxGetData(x);
+  *copy = mxMalloc(n*sizeof(double));
+  for (i=0; i<n; i++)
+    (*copy)[i] = p[i];
+  return *copy;
+}
 
 void
 mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 {
   mxArray *lf;
-  double tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7, eps, alpha, beta, A, B, C;
-  double r[3], u[3], d[3];
-  double *lf_p, *rm_p, *um_p, *R;
-  int nchan, i;
-  char str[256];
+  leadfield_t s;
+  double *copy[3], *rn;
+  mwSize npos, nchan, dims[3], i;
+  int k, nthreads = 1;
 
   if (nrhs<3)
     mexErrMsgTxt("Not enough input arguments");
   if (nrhs>3)
     mexErrMsgTxt("Too many input arguments");
 
-  if (mxGetM(prhs[0])!=1 || mxGetN(prhs[0])!=3)
+  for (k=0; k<3; k++)
+    if (mxIsComplex(prhs[k]) || (!mxIsDouble(prhs[k]) && !mxIsSingle(prhs[k])))
+      mexErrMsgTxt ("The input arguments should be real-valued double or single precision");
+
+  if (mxGetN(prhs[0])!=3)
     mexErrMsgTxt ("Invalid dimension for input argument 1");
   if (mxGetN(prhs[1])!=3)
     mexErrMsgTxt ("Invalid dimension for input argument 2");
   if (mxGetN(prhs[2])!=3)
     mexErrMsgTxt ("Invalid dimension for input argument 3");
+  npos  = mxGetM(prhs[0]);
   nchan = mxGetM(prhs[1]);
   if (mxGetM(prhs[2])!=nchan)
     mexErrMsgTxt ("Number of channels does not match between argument 2 and 3");
 
-  lf = mxCreateDoubleMatrix(nchan, 3, mxREAL);
-  lf_p = mxGetData(lf);
-  R    = mxGetData(prhs[0]);
-  rm_p = mxGetData(prhs[1]);
-  um_p = mxGetData(prhs[2]);
-  eps  = mxGetEps();
+  /* a single dipole gives a nchan x 3 leadfield, multiple dipoles give nchan x 3 x npos */
+  dims[0] = nchan;
+  dims[1] = 3;
+  dims[2] = npos;
+  s.single = mxIsSingle(prhs[0]);
+  lf = mxCreateNumericArray((npos==1 ? 2 : 3), dims, (s.single ? mxSINGLE_CLASS : mxDOUBLE_CLASS), mxREAL);
 
-  tmp2 = sqrt(R[0]*R[0] + R[1]*R[1] + R[2]*R[2]);	/* norm(R) */
+  s.R     = getdouble(prhs[0], &copy[0]);
+  s.rm    = getdouble(prhs[1], &copy[1]);
+  s.um    = getdouble(prhs[2], &copy[2]);
+  s.npos  = npos;
+  s.nchan = nchan;
+  s.eps   = mxGetEps();
+  s.lf    = mxGetData(lf);
 
+  /* the norm of the channel positions is the same for all dipoles */
+  rn = mxMalloc((nchan>0 ? nchan : 1)*sizeof(double));
   for (i=0; i<nchan; i++)
+    rn[i] = sqrt(s.rm[i]*s.rm[i] + s.rm[i+nchan]*s.rm[i+nchan] + s.rm[i+2*nchan]*s.rm[i+2*nchan]);
+  s.rn = rn;
+
+#ifdef LEADFIELD_THREADS
+  if (npos>1 && npos*nchan>=LEADFIELD_MINSIZE)
   {
-    /* get the position of this single channel */
-    r[0] = rm_p[i];
-    r[1] = rm_p[i+nchan];
-    r[2] = rm_p[i+nchan+nchan];
-    /* get the orientation of this single channel */
-    u[0] = um_p[i];
-    u[1] = um_p[i+nchan];
-    u[2] = um_p[i+nchan+nchan];
-
-    /* compute the difference between this channel and the dipole position */
-    d[0] = r[0] - R[0];
-    d[1] = r[1] - R[1];
-    d[2] = r[2] - R[2];
-
-    tmp1 = sqrt(r[0]*r[0] + r[1]*r[1] + r[2]*r[2]);	/* norm(r) */
-    /* tmp2 = sqrt(R[0]*R[0] + R[1]*R[1] + R[2]*R[2]); */
-    tmp3 = sqrt(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]);	/* norm(d) */
-    tmp4 = r[0]*R[0] + r[1]*R[1] + r[2]*R[2];		/* dot(r, R) */
-    tmp5 = r[0]*d[0] + r[1]*d[1] + r[2]*d[2];		/* dot(r, d) */
-    tmp6 = R[0]*d[0] + R[1]*d[1] + R[2]*d[2];		/* dot(R, d) */
-    tmp7 = tmp1*tmp2*tmp1*tmp2 - tmp4*tmp4;		/* norm(cross(r,R))^2 */
-
-    alpha = 1 / (-tmp3 * (tmp1*tmp3+tmp5));
-    A = 1/tmp3 - 2*alpha*tmp2*tmp2 - 1/tmp1;
-    B = 2*alpha*tmp4;
-    C = -tmp6/(tmp3*tmp3*tmp3);
-    
-    if (tmp7<eps)
-      beta = 0;
-    else
-      beta = ((A*r[0] + B*R[0] + C*d[0])*u[0] +
-              (A*r[1] + B*R[1] + C*d[1])*u[1] +
-              (A*r[2] + B*R[2] + C*d[2])*u[2]) / tmp7;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = (ncpu>LEADFIELD_MAXTHREADS ? LEADFIELD_MAXTHREADS : (ncpu<1 ? 1 : (int)ncpu));
+    nthreads = ((mwSize)nthreads>npos ? (int)npos : nthreads);
+  }
 
-    /* re-use the temporary array d for something else */
-    d[0] = alpha*u[0] + beta*r[0];
-    d[1] = alpha*u[1] + beta*r[1];
-    d[2] = alpha*u[2] + beta*r[2];
+  if (nthreads>1)
+  {
+    pthread_t thread[LEADFIELD_MAXTHREADS];
+    leadfield_t part[LEADFIELD_MAXTHREADS];
+    int started[LEADFIELD_MAXTHREADS];
 
-    /* lf(i,:) = 1e-7 * cross(alpha*u  + beta*r, R) */
-    lf_p[i            ] = (d[1]*R[2] - d[2]*R[1])*1e-7; 
-    lf_p[i+nchan      ] = (d[2]*R[0] - d[0]*R[2])*1e-7; 
-    lf_p[i+nchan+nchan] = (d[0]*R[1] - d[1]*R[0])*1e-7; 
+    /* divide the dipoles over the threads */
+    for (k=0; k<nthreads; k++)
+    {
+      part[k]       = s;
+      part[k].begin = (npos*k)/nthreads;
+      part[k].end   = (npos*(k+1))/nthreads;
+      started[k]    = (pthread_create(&thread[k], NULL, leadfield, &part[k])==0);
+    }
+    for (k=0; k<nthreads; k++)
+    {
+      if (started[k])
+        pthread_join(thread[k], NULL);
+      else
+        leadfield(&part[k]);
+    }
   }
+#endif
+
+  if (nthreads==1)
+  {
+    s.begin = 0;
+    s.end   = npos;
+    leadfield(&s);
+  }
+
+  for (k=0; k<3; k++)
+    if (copy[k])
+      mxFree(copy[k]);
+  mxFree(rn);
 
   /* assign the output parameter */
   plhs[0] = lf;
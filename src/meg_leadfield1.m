@@ -12,6 +12,10 @@ function [varargout] = meg_leadfield1(varargin)
 % The center of the homogenous sphere is in the origin, the field
 % of the dipole is not dependent on the sphere radius.
 %
+% The MEX file also accepts multiple dipole positions as Npos x 3 matrix,
+% in which case the leadfield is returned as Nchan x 3 x Npos array. The
+% leadfield is single precision if the dipole positions are.
+%
 % This function is also implemented as MEX file.
 
 % adapted from Luetkenhoener, Habilschrift '92
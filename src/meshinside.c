@@ -0,0 +1,165 @@
+#include <math.h>
+#include "mex.h"
+#include "platform.h"
+#include "geometry.h"
+#include "meshtree.h"
+
+#if !defined(PLATFORM_WINDOWS)
+#include <pthread.h>
+#include <unistd.h>
+#define MESHINSIDE_THREADS
+#endif
+
+#define MESHINSIDE_MAXTHREADS 16
+#define MESHINSIDE_MINSIZE    1024    /* number of points below which a single thread is used */
+#define MESHINSIDE_NUMRAYS    3
+
+/* directions that are unlikely to be aligned with the edges of a regular mesh */
+static const double raydir[MESHINSIDE_NUMRAYS][3] = {
+  { 0.26726124191242440,  0.53452248382484879,  0.80178372573727319},
+  {-0.78446454055273618,  0.19611613513818404,  0.58834840541455213},
+  { 0.37974683544303800, -0.88607594936708867,  0.26582278481012661}
+};
+
+typedef struct {
+  const meshtree_t *tree;
+  const double *pos;
+  mwSize npos, begin, end;
+  double tol;
+  mxLogical *inside;
+} meshinside_t;
+
+static int
+solidangle (const meshtree_t *tree, const double *r)
+{
+  /* the exact test, the total solid angle is 4*pi inside a closed mesh and 0 outside */
+  double v1[3], v2[3], v3[3], sum = 0;
+  const double *v;
+  int on_triangle;
+  long i;
+  int k;
+
+  for (i=0; i<tree->ntri; i++)
+  {
+    v = tree->v+9*i;
+    for (k=0; k<3; k++)
+    {
+      v1[k] = v[k]   - r[k];
+      v2[k] = v[3+k] - r[k];
+      v3[k] = v[6+k] - r[k];
+    }
+    sum += solang(v1, v2, v3, &on_triangle);
+    if (on_triangle)
+      return 0;
+  }
+  return fabs(sum)>2*M_PI;
+}
+
+static void *
+inside (void *arg)
+{
+  const meshinside_t *s = (const meshinside_t *)arg;
+  double r[3];
+  mwSize i;
+  int k, c;
+
+  for (i=s->begin; i<s->end; i++)
+  {
+    for (k=0; k<3; k++)
+      r[k] = s->pos[i+k*s->npos];
+    /* an odd number of crossings of a ray means that the point is inside */
+    c = -1;
+    for (k=0; k<MESHINSIDE_NUMRAYS && c<0; k++)
+      c = meshtree_crossings(s->tree, r, raydir[k], s->tol);
+    if (c<0)
+      s->inside[i] = solidangle(s->tree, r);
+    else
+      s->inside[i] = (c%2==1);
+  }
+  return NULL;
+}
+
+void
+mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
+{
+  mxArray *result;
+  meshinside_t s;
+  const meshtree_t *tree;
+  double size;
+  int t, k, nthreads = 1;
+
+  if (nrhs!=3)
+    mexErrMsgTxt ("Invalid number of input arguments");
+  for (t=0; t<3; t++)
+    if (!mxIsDouble(prhs[t]) || mxIsComplex(prhs[t]))
+      mexErrMsgTxt ("The input arguments should be real-valued double precision");
+  for (t=0; t<3; t++)
+    if (mxGetN(prhs[t])!=3)
+    {
+      char str[256];
+      sprintf(str, "Invalid dimension for input argument %d", t+1);
+      mexErrMsgTxt (str);
+    }
+
+  s.pos  = mxGetData(prhs[2]);
+  s.npos = mxGetM(prhs[2]);
+
+  /* the tree is kept until the mex file is cleared, and is only rebuilt for another mesh */
+  mexAtExit(meshtree_clear);
+  tree = meshtree_cached(mxGetData(prhs[0]), mxGetM(prhs[0]), mxGetData(prhs[1]), mxGetM(prhs[1]));
+  if (tree==NULL)
+    mexErrMsgTxt ("Invalid vertex index in the triangles, or out of memory");
+  s.tree = tree;
+
+  /* points closer to the surface than this are tested with the solid angle */
+  size = 0;
+  for (k=0; k<3 && tree->ntri>0; k++)
+    size += (tree->node[0].max[k]-tree->node[0].min[k])*(tree->node[0].max[k]-tree->node[0].min[k]);
+  s.tol = 1e-10*sqrt(size);
+
+  result   = mxCreateLogicalMatrix (s.npos, 1);
+  s.inside = mxGetData(result);
+
+#ifdef MESHINSIDE_THREADS
+  if (s.npos>=MESHINSIDE_MINSIZE)
+  {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = (ncpu>MESHINSIDE_MAXTHREADS ? MESHINSIDE_MAXTHREADS : (ncpu<1 ? 1 : (int)ncpu));
+  }
+
+  if (nthreads>1)
+  {
+    pthread_t thread[MESHINSIDE_MAXTHREADS];
+    meshinside_t part[MESHINSIDE_MAXTHREADS];
+    int started[MESHINSIDE_MAXTHREADS];
+
+    /* divide the points over the threads, the tree is only read */
+    for (t=0; t<nthreads; t++)
+    {
+      part[t]       = s;
+      part[t].begin = (s.npos*t)/nthreads;
+      part[t].end   = (s.npos*(t+1))/nthreads;
+      started[t]    = (pthread_create(&thread[t], NULL, inside, &part[t])==0);
+    }
+    for (t=0; t<nthreads; t++)
+    {
+      if (started[t])
+        pthread_join(thread[t], NULL);
+      else
+        inside(&part[t]);
+    }
+  }
+#endif
+
+  if (nthreads==1)
+  {
+    s.begin = 0;
+    s.end   = s.npos;
+    inside(&s);
+  }
+
+  /* assign the output parameter */
+  plhs[0] = result;
+
+  return;
+}
@@ -0,0 +1,79 @@
+function [varargout] = meshinside(varargin)
+
+% MESHINSIDE determines which points are inside a closed triangulated mesh
+%
+% Use as
+%   inside = meshinside(pnt, tri, pos)
+% where pnt and tri describe the mesh and pos is a Npos x 3 matrix with the
+% points that are tested. The output is a Npos x 1 logical vector.
+%
+% The mex file counts the crossings of a ray from each point with the mesh,
+% using a bounding box tree of the mesh that is only built once for
+% consecutive calls with the same mesh. Points for which the ray passes
+% through an edge or vertex of the mesh are tested with another ray, and
+% points that are (nearly) on the surface with the total solid angle of the
+% mesh, like SOLID_ANGLE. Points exactly on the surface are outside.
+%
+% See also MESHTRISECT, MESHPROJ, SOLID_ANGLE
+
+% Copyright (C) 2017, Robert Oostenveld
+%
+% This file is part of FieldTrip, see http://www.fieldtriptoolbox.org
+% for the documentation and details.
+%
+%    FieldTrip is free software: you can redistribute it and/or modify
+%    it under the terms of the GNU General Public License as published by
+%    the Free Software Foundation, either version 3 of the License, or
+%    (at your option) any later version.
+%
+%    FieldTrip is distributed in the hope that it will be useful,
+%    but WITHOUT ANY WARRANTY; without even the implied warranty of
+%    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+%    GNU General Public License for more details.
+%
+%    You should have received a copy of the GNU General Public License
+%    along with FieldTrip. If not, see <http://www.gnu.org/licenses/>.
+%
+% $Id$
+
+% compile the missing mex file on the fly
+% remember the original working directory
+pwdir = pwd;
+
+% determine the name and full path of this function
+funname = mfilename('fullpath');
+mexsrc  = [funname '.c'];
+[mexdir, mexname] = fileparts(funname);
+
+try
+  % try to compile the mex file on the fly
+  warning('trying to compile MEX file from %s', mexsrc);
+  cd(mexdir);
+  
+  if ispc
+    mex -I. -c geometry.c
+    mex -I. -c meshtree.c
+    mex -I. -c meshinside.c ; mex meshinside.c meshinside.obj meshtree.obj geometry.obj
+  else
+    mex -I. -c geometry.c
+    mex -I. -c meshtree.c
+    mex -I. -c meshinside.c ; mex -o meshinside meshinside.o meshtree.o geometry.o
+  end
+  
+  cd(pwdir);
+  success = true;
+
+catch
+  % compilation failed
+  disp(lasterr);
+  error('could not locate MEX file for %s', mexname);
+  cd(pwdir);
+  success = false;
+end
+
+if success
+  % execute the mex file that was juist created
+  funname   = mfilename;
+  funhandle = str2func(funname);
+  [varargout{1:nargout}] = funhandle(varargin{:});
+end
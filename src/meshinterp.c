@@ -0,0 +1,197 @@
+#include <math.h>
+#include "mex.h"
+#include "platform.h"
+#include "meshtree.h"
+
+#if !defined(PLATFORM_WINDOWS)
+#include <pthread.h>
+#include <unistd.h>
+#define MESHINTERP_THREADS
+#endif
+
+#define MESHINTERP_MAXTHREADS 16
+#define MESHINTERP_MINSIZE    1024    /* number of points below which a single thread is used */
+
+typedef struct {
+  const meshtree_t *tree;
+  const double *pos;
+  mwSize npos, begin, end;
+  int *indx;
+  double *dist, *la, *mu;
+} meshinterp_t;
+
+static void *
+closest (void *arg)
+{
+  const meshinterp_t *s = (const meshinterp_t *)arg;
+  double r[3], p[3];
+  mwSize i;
+  int k;
+
+  for (i=s->begin; i<s->end; i++)
+  {
+    for (k=0; k<3; k++)
+      r[k] = s->pos[i+k*s->npos];
+    s->indx[i] = meshtree_closest(s->tree, r, p, &s->dist[i], &s->la[i], &s->mu[i]);
+  }
+  return NULL;
+}
+
+static int
+weights (const double *tri, mwSize ntri, const meshinterp_t *s, mwSize i, mwSize *col, double *w)
+{
+  /* the vertices of the triangle and their weights, each vertex of a degenerate triangle only once */
+  double la = s->la[i], mu = s->mu[i], v[3];
+  mwSize c;
+  int j, k, n = 0;
+
+  v[0] = 1-la-mu; v[1] = la; v[2] = mu;
+  for (j=0; j<3; j++)
+  {
+    c = (mwSize)tri[s->indx[i]+j*ntri] - 1;
+    for (k=0; k<n && col[k]!=c; k++);
+    if (k==n)
+    {
+      col[n] = c;
+      w[n++] = 0;
+    }
+    w[k] += v[j];
+  }
+  /* the vertices with a weight of zero are left out */
+  for (j=0, k=0; j<n; j++)
+    if (w[j]!=0)
+    {
+      col[k] = col[j];
+      w[k++] = w[j];
+    }
+  return k;
+}
+
+void
+mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
+{
+  mxArray *interp, *dist;
+  meshinterp_t s;
+  const meshtree_t *tree;
+  const double *tri;
+  double w[3], *pr;
+  mwIndex *ir, *jc, nz;
+  mwSize npnt, ntri, i, col[3];
+  int t, j, n, nthreads = 1;
+
+  if (nrhs!=3)
+    mexErrMsgTxt ("Invalid number of input arguments");
+  for (t=0; t<3; t++)
+    if (!mxIsDouble(prhs[t]) || mxIsComplex(prhs[t]))
+      mexErrMsgTxt ("The input arguments should be real-valued double precision");
+  for (t=0; t<3; t++)
+    if (mxGetN(prhs[t])!=3)
+    {
+      char str[256];
+      sprintf(str, "Invalid dimension for input argument %d", t+1);
+      mexErrMsgTxt (str);
+    }
+
+  npnt   = mxGetM(prhs[0]);
+  ntri   = mxGetM(prhs[1]);
+  tri    = mxGetData(prhs[1]);
+  s.pos  = mxGetData(prhs[2]);
+  s.npos = mxGetM(prhs[2]);
+  if (ntri==0)
+    mexErrMsgTxt ("The mesh should contain at least one triangle");
+
+  /* the tree is kept until the mex file is cleared, and is only rebuilt for another mesh */
+  mexAtExit(meshtree_clear);
+  tree = meshtree_cached(mxGetData(prhs[0]), npnt, tri, ntri);
+  if (tree==NULL)
+    mexErrMsgTxt ("Invalid vertex index in the triangles, or out of memory");
+  s.tree = tree;
+
+  dist   = mxCreateDoubleMatrix (s.npos, 1, mxREAL);
+  s.dist = mxGetData(dist);
+  s.indx = mxMalloc((s.npos>0 ? s.npos : 1)*sizeof(int));
+  s.la   = mxMalloc((s.npos>0 ? s.npos : 1)*sizeof(double));
+  s.mu   = mxMalloc((s.npos>0 ? s.npos : 1)*sizeof(double));
+
+#ifdef MESHINTERP_THREADS
+  if (s.npos>=MESHINTERP_MINSIZE)
+  {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = (ncpu>MESHINTERP_MAXTHREADS ? MESHINTERP_MAXTHREADS : (ncpu<1 ? 1 : (int)ncpu));
+  }
+
+  if (nthreads>1)
+  {
+    pthread_t thread[MESHINTERP_MAXTHREADS];
+    meshinterp_t part[MESHINTERP_MAXTHREADS];
+    int started[MESHINTERP_MAXTHREADS];
+
+    /* divide the points over the threads, the tree is only read */
+    for (t=0; t<nthreads; t++)
+    {
+      part[t]       = s;
+      part[t].begin = (s.npos*t)/nthreads;
+      part[t].end   = (s.npos*(t+1))/nthreads;
+      started[t]    = (pthread_create(&thread[t], NULL, closest, &part[t])==0);
+    }
+    for (t=0; t<nthreads; t++)
+    {
+      if (started[t])
+        pthread_join(thread[t], NULL);
+      else
+        closest(&part[t]);
+    }
+  }
+#endif
+
+  if (nthreads==1)
+  {
+    s.begin = 0;
+    s.end   = s.npos;
+    closest(&s);
+  }
+
+  /* the sparse matrix has a row for every point, with the weights of the vertices of its triangle */
+  interp = mxCreateSparse (s.npos, npnt, 3*s.npos, mxREAL);
+  pr = mxGetPr(interp);
+  ir = mxGetIr(interp);
+  jc = mxGetJc(interp);
+
+  /* count the weights in each column, the columns are filled in the second pass */
+  for (i=0; i<=npnt; i++)
+    jc[i] = 0;
+  for (i=0; i<s.npos; i++)
+  {
+    n = weights(tri, ntri, &s, i, col, w);
+    for (j=0; j<n; j++)
+      jc[col[j]+1]++;
+  }
+  for (i=0; i<npnt; i++)
+    jc[i+1] += jc[i];
+
+  /* the rows are visited in order, hence they are sorted within each column */
+  for (i=0; i<s.npos; i++)
+  {
+    n = weights(tri, ntri, &s, i, col, w);
+    for (j=0; j<n; j++)
+    {
+      nz = jc[col[j]]++;
+      ir[nz] = i;
+      pr[nz] = w[j];
+    }
+  }
+  /* the fill pointers are now at the start of the next column */
+  for (i=npnt; i>0; i--)
+    jc[i] = jc[i-1];
+  jc[0] = 0;
+
+  mxFree(s.indx);
+  mxFree(s.la);
+  mxFree(s.mu);
+
+  /* assign the output parameters */
+  plhs[0] = interp;
+  if (nlhs>1) plhs[1] = dist; else mxDestroyArray(dist);
+
+  return;
+}
@@ -0,0 +1,83 @@
+function [varargout] = meshinterp(varargin)
+
+% MESHINTERP computes the sparse matrix that interpolates the values at the
+% vertices of a triangulated mesh to other points
+%
+% Use as
+%   [interp, dist] = meshinterp(pnt, tri, pos)
+% where pnt and tri describe the mesh and pos is a Npos x 3 matrix with the
+% points, e.g. the vertices of another mesh or the electrode positions. Each
+% point is projected onto the closest point of the mesh, and its row of the
+% Npos x Npnt sparse matrix interp contains the barycentric weights of the
+% three vertices of that triangle, like LMOUTR. The second output is the
+% distance between the points and their projection.
+%
+% The values at the vertices are subsequently interpolated with
+%   val = interp * dat
+% where dat is Npnt x Ntime, which is much faster than repeating the search
+% for the closest triangle for every time point.
+%
+% The mex file uses a bounding box tree of the mesh, which is only built once
+% for consecutive calls with the same mesh.
+%
+% See also MESHPROJ, MESHTRISECT, LMOUTR, ROUTLM
+
+% Copyright (C) 2017, Robert Oostenveld
+%
+% This file is part of FieldTrip, see http://www.fieldtriptoolbox.org
+% for the documentation and details.
+%
+%    FieldTrip is free software: you can redistribute it and/or modify
+%    it under the terms of the GNU General Public License as published by
+%    the Free Software Foundation, either version 3 of the License, or
+%    (at your option) any later version.
+%
+%    FieldTrip is distributed in the hope that it will be useful,
+%    but WITHOUT ANY WARRANTY; without even the implied warranty of
+%    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+%    GNU General Public License for more details.
+%
+%    You should have received a copy of the GNU General Public License
+%    along with FieldTrip. If not, see <http://www.gnu.org/licenses/>.
+%
+% $Id$
+
+% compile the missing mex file on the fly
+% remember the original working directory
+pwdir = pwd;
+
+% determine the name and full path of this function
+funname = mfilename('fullpath');
+mexsrc  = [funname '.c'];
+[mexdir, mexname] = fileparts(funname);
+
+try
+  % try to compile the mex file on the fly
+  warning('trying to compile MEX file from %s', mexsrc);
+  cd(mexdir);
+  
+  if ispc
+    mex -I. -c meshtree.c
+    mex -I. -c meshinterp.c ; mex meshinterp.c meshinterp.obj meshtree.obj
+  else
+    mex -I. -c meshtree.c
+    mex -I. -c meshinterp.c ; mex -o meshinterp meshinterp.o meshtree.o
+  end
+  
+  cd(pwdir);
+  success = true;
+
+catch
+  % compilation failed
+  disp(lasterr);
+  error('could not locate MEX file for %s', mexname);
+  cd(pwdir);
+  success = false;
+end
+
+if success
+  % execute the mex file that was juist created
+  funname   = mfilename;
+  funhandle = str2func(funname);
+  [varargout{1:nargout}] = funhandle(varargin{:});
+end
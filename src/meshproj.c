@@ -0,0 +1,136 @@
+#include <math.h>
+#include "mex.h"
+#include "platform.h"
+#include "meshtree.h"
+
+#if !defined(PLATFORM_WINDOWS)
+#include <pthread.h>
+#include <unistd.h>
+#define MESHPROJ_THREADS
+#endif
+
+#define MESHPROJ_MAXTHREADS 16
+#define MESHPROJ_MINSIZE    1024    /* number of points below which a single thread is used */
+
+typedef struct {
+  const meshtree_t *tree;
+  const double *pos;
+  mwSize npos, begin, end;
+  double *proj, *dist, *indx, *la, *mu;
+} meshproj_t;
+
+static void *
+project (void *arg)
+{
+  const meshproj_t *s = (const meshproj_t *)arg;
+  double r[3], p[3], d, l, m, nan = mxGetNaN();
+  mwSize i, n = s->npos;
+  int k, t;
+
+  for (i=s->begin; i<s->end; i++)
+  {
+    r[0] = s->pos[i];
+    r[1] = s->pos[i+n];
+    r[2] = s->pos[i+n+n];
+    t = meshtree_closest(s->tree, r, p, &d, &l, &m);
+    if (t<0)
+    {
+      p[0] = p[1] = p[2] = d = l = m = nan;
+    }
+    for (k=0; k<3; k++)
+      s->proj[i+k*n] = p[k];
+    s->dist[i] = d;
+    s->indx[i] = (t<0 ? nan : t+1);
+    s->la[i]   = l;
+    s->mu[i]   = m;
+  }
+  return NULL;
+}
+
+void
+mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
+{
+  mxArray *proj, *dist, *indx, *la, *mu;
+  meshproj_t s;
+  const meshtree_t *tree;
+  int t, nthreads = 1;
+
+  if (nrhs!=3)
+    mexErrMsgTxt ("Invalid number of input arguments");
+  for (t=0; t<3; t++)
+    if (!mxIsDouble(prhs[t]) || mxIsComplex(prhs[t]))
+      mexErrMsgTxt ("The input arguments should be real-valued double precision");
+  if (mxGetN(prhs[0])!=3)
+    mexErrMsgTxt ("Invalid dimension for input argument 1");
+  if (mxGetN(prhs[1])!=3)
+    mexErrMsgTxt ("Invalid dimension for input argument 2");
+  if (mxGetN(prhs[2])!=3)
+    mexErrMsgTxt ("Invalid dimension for input argument 3");
+
+  /* the tree is kept until the mex file is cleared, and is only rebuilt for another mesh */
+  mexAtExit(meshtree_clear);
+  tree = meshtree_cached(mxGetData(prhs[0]), mxGetM(prhs[0]), mxGetData(prhs[1]), mxGetM(prhs[1]));
+  if (tree==NULL)
+    mexErrMsgTxt ("Invalid vertex index in the triangles, or out of memory");
+
+  s.tree = tree;
+  s.pos  = mxGetData(prhs[2]);
+  s.npos = mxGetM(prhs[2]);
+  proj   = mxCreateDoubleMatrix (s.npos, 3, mxREAL);
+  dist   = mxCreateDoubleMatrix (s.npos, 1, mxREAL);
+  indx   = mxCreateDoubleMatrix (s.npos, 1, mxREAL);
+  la     = mxCreateDoubleMatrix (s.npos, 1, mxREAL);
+  mu     = mxCreateDoubleMatrix (s.npos, 1, mxREAL);
+  s.proj = mxGetData(proj);
+  s.dist = mxGetData(dist);
+  s.indx = mxGetData(indx);
+  s.la   = mxGetData(la);
+  s.mu   = mxGetData(mu);
+
+#ifdef MESHPROJ_THREADS
+  if (s.npos>=MESHPROJ_MINSIZE)
+  {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = (ncpu>MESHPROJ_MAXTHREADS ? MESHPROJ_MAXTHREADS : (ncpu<1 ? 1 : (int)ncpu));
+  }
+
+  if (nthreads>1)
+  {
+    pthread_t thread[MESHPROJ_MAXTHREADS];
+    meshproj_t part[MESHPROJ_MAXTHREADS];
+    int started[MESHPROJ_MAXTHREADS];
+
+    /* divide the points over the threads, the tree is only read */
+    for (t=0; t<nthreads; t++)
+    {
+      part[t]       = s;
+      part[t].begin = (s.npos*t)/nthreads;
+      part[t].end   = (s.npos*(t+1))/nthreads;
+      started[t]    = (pthread_create(&thread[t], NULL, project, &part[t])==0);
+    }
+    for (t=0; t<nthreads; t++)
+    {
+      if (started[t])
+        pthread_join(thread[t], NULL);
+      else
+        project(&part[t]);
+    }
+  }
+#endif
+
+  if (nthreads==1)
+  {
+    s.begin = 0;
+    s.end   = s.npos;
+    project(&s);
+  }
+
+  /* assign the output parameters */
+  plhs[0] = proj;
+  if (nlhs>1) plhs[1] = dist; else mxDestroyArray(dist);
+  if (nlhs>2) plhs[2] = indx; else mxDestroyArray(indx);
+  if (nlhs>3) plhs[3] = la;   else mxDestroyArray(la);
+  if (nlhs>4) plhs[4] = mu;   else mxDestroyArray(mu);
+
+  return;
+}
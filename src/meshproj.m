@@ -0,0 +1,77 @@
+function [varargout] = meshproj(varargin)
+
+% MESHPROJ projects points onto the closest point of a triangulated mesh
+%
+% Use as
+%   [proj, dist, indx, la, mu] = meshproj(pnt, tri, pos)
+% where pnt and tri describe the mesh and pos is a Npos x 3 matrix with the
+% points that are projected. The outputs are the closest points on the mesh,
+% their distance to the points, the index of the triangle on which they lie and
+% the la/mu parameters of the closest point within that triangle, i.e.
+%   proj = (1-la-mu)*v1 + la*v2 + mu*v3
+%
+% The mex file uses a bounding box tree of the mesh, which is only built once
+% for consecutive calls with the same mesh. This is much faster than calling
+% PTRIPROJ for each of the triangles.
+%
+% See also MESHTRISECT, PTRIPROJ, LMOUTR
+
+% Copyright (C) 2017, Robert Oostenveld
+%
+% This file is part of FieldTrip, see http://www.fieldtriptoolbox.org
+% for the documentation and details.
+%
+%    FieldTrip is free software: you can redistribute it and/or modify
+%    it under the terms of the GNU General Public License as published by
+%    the Free Software Foundation, either version 3 of the License, or
+%    (at your option) any later version.
+%
+%    FieldTrip is distributed in the hope that it will be useful,
+%    but WITHOUT ANY WARRANTY; without even the implied warranty of
+%    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+%    GNU General Public License for more details.
+%
+%    You should have received a copy of the GNU General Public License
+%    along with FieldTrip. If not, see <http://www.gnu.org/licenses/>.
+%
+% $Id$
+
+% compile the missing mex file on the fly
+% remember the original working directory
+pwdir = pwd;
+
+% determine the name and full path of this function
+funname = mfilename('fullpath');
+mexsrc  = [funname '.c'];
+[mexdir, mexname] = fileparts(funname);
+
+try
+  % try to compile the mex file on the fly
+  warning('trying to compile MEX file from %s', mexsrc);
+  cd(mexdir);
+  
+  if ispc
+    mex -I. -c meshtree.c
+    mex -I. -c meshproj.c ; mex meshproj.c meshproj.obj meshtree.obj
+  else
+    mex -I. -c meshtree.c
+    mex -I. -c meshproj.c ; mex -o meshproj meshproj.o meshtree.o
+  end
+  
+  cd(pwdir);
+  success = true;
+
+catch
+  % compilation failed
+  disp(lasterr);
+  error('could not locate MEX file for %s', mexname);
+  cd(pwdir);
+  success = false;
+end
+
+if success
+  % execute the mex file that was juist created
+  funname   = mfilename;
+  funhandle = str2func(funname);
+  [varargout{1:nargout}] = funhandle(varargin{:});
+end
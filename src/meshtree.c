@@ -0,0 +1,529 @@
+/*
+ * meshtree_build      builds an axis aligned bounding box tree of a triangulated mesh
+ * meshtree_cached     returns the tree of the last mesh, or builds it if the mesh is different
+ * meshtree_closest    finds the closest point on the mesh
+ * meshtree_intersect  finds the intersection of a line with the mesh that is closest to its first point
+ * meshtree_crossings  counts the intersections of a ray with the mesh, for a point in mesh test
+ * ptriclosest         computes the closest point on a triangle and its la/mu parameters
+ *
+ * The tree is built by splitting the triangles at the median of their centroids along
+ * the longest side of the bounding box, which gives a balanced tree. The queries
+ * descend the tree depth first into the nearest child, and skip the nodes whose box
+ * cannot contain a better triangle than the one found so far.
+ *
+ *  (c) 2017 Robert Oostenveld
+ *
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "meshtree.h"
+
+#define MESHTREE_LEAFSIZE 4
+#define MESHTREE_MAXDEPTH 128
+
+/* the tree of the last mesh, this is shared between the calls to the mex file */
+static meshtree_t *cache = NULL;
+
+/****************************************************************************/
+unsigned long meshtree_checksum(const double *pnt, long npnt, const double *tri, long ntri)
+{
+  /* this is the FNV-1a hash of the binary representation */
+  const unsigned char *p;
+  unsigned long h = 2166136261UL;
+  long i;
+  p = (const unsigned char *)pnt;
+  for (i=0; i<npnt*3*(long)sizeof(double); i++)
+    h = (h ^ p[i]) * 16777619UL;
+  p = (const unsigned char *)tri;
+  for (i=0; i<ntri*3*(long)sizeof(double); i++)
+    h = (h ^ p[i]) * 16777619UL;
+  return h;
+}
+
+/****************************************************************************/
+static void bounds(const meshtree_t *tree, meshnode_t *node)
+{
+  int i, k;
+  const double *v;
+  for (k=0; k<3; k++)
+  {
+    node->min[k] = +HUGE_VAL;
+    node->max[k] = -HUGE_VAL;
+  }
+  for (i=node->first; i<node->first+node->count; i++)
+  {
+    v = tree->v + 9*i;
+    for (k=0; k<9; k++)
+    {
+      node->min[k%3] = (v[k]<node->min[k%3] ? v[k] : node->min[k%3]);
+      node->max[k%3] = (v[k]>node->max[k%3] ? v[k] : node->max[k%3]);
+    }
+  }
+}
+
+/****************************************************************************/
+static void swaptri(meshtree_t *tree, double *centroid, int i, int j)
+{
+  double tmp[9];
+  int k, t;
+  memcpy(tmp, tree->v+9*i, 9*sizeof(double));
+  memcpy(tree->v+9*i, tree->v+9*j, 9*sizeof(double));
+  memcpy(tree->v+9*j, tmp, 9*sizeof(double));
+  t = tree->indx[i]; tree->indx[i] = tree->indx[j]; tree->indx[j] = t;
+  for (k=0; k<3; k++)
+  {
+    tmp[0] = centroid[3*i+k]; centroid[3*i+k] = centroid[3*j+k]; centroid[3*j+k] = tmp[0];
+  }
+}
+
+/****************************************************************************/
+static void split(meshtree_t *tree, double *centroid, int n, int depth)
+{
+  meshnode_t *node = tree->node + n;
+  int axis, k, lo, hi, mid, i, j;
+  double size, pivot;
+
+  bounds(tree, node);
+  node->left  = -1;
+  node->right = -1;
+  if (node->count<=MESHTREE_LEAFSIZE || depth>=MESHTREE_MAXDEPTH-1)
+    return;
+
+  /* split along the longest side of the box */
+  axis = 0;
+  size = node->max[0] - node->min[0];
+  for (k=1; k<3; k++)
+    if (node->max[k] - node->min[k] > size)
+    {
+      axis = k;
+      size = node->max[k] - node->min[k];
+    }
+
+  /* partially sort the triangles such that the median centroid is in the middle */
+  lo  = node->first;
+  hi  = node->first + node->count - 1;
+  mid = node->first + node->count/2;
+  while (lo<hi)
+  {
+    pivot = centroid[3*((lo+hi)/2)+axis];
+    i = lo;
+    j = hi;
+    while (i<=j)
+    {
+      while (centroid[3*i+axis]<pivot) i++;
+      while (centroid[3*j+axis]>pivot) j--;
+      if (i<=j)
+        swaptri(tree, centroid, i++, j--);
+    }
+    if (mid<=j)
+      hi = j;
+    else if (mid>=i)
+      lo = i;
+    else
+      break;
+  }
+
+  node->left  = tree->nnode++;
+  node->right = tree->nnode++;
+  tree->node[node->left].first  = node->first;
+  tree->node[node->left].count  = mid - node->first;
+  tree->node[node->right].first = mid;
+  tree->node[node->right].count = node->first + node->count - mid;
+  split(tree, centroid, node->left, depth+1);
+  split(tree, centroid, tree->node[n].right, depth+1);
+}
+
+/****************************************************************************/
+meshtree_t *meshtree_build(const double *pnt, long npnt, const double *tri, long ntri)
+{
+  meshtree_t *tree;
+  double *centroid;
+  long i, k, t, indx;
+
+  tree = calloc(1, sizeof(meshtree_t));
+  if (tree==NULL)
+    return NULL;
+  tree->npnt     = npnt;
+  tree->ntri     = ntri;
+  tree->checksum = meshtree_checksum(pnt, npnt, tri, ntri);
+  tree->v        = malloc((ntri>0 ? ntri : 1)*9*sizeof(double));
+  tree->indx     = malloc((ntri>0 ? ntri : 1)*sizeof(int));
+  tree->node     = malloc((ntri>0 ? 2*ntri : 1)*sizeof(meshnode_t));
+  centroid       = malloc((ntri>0 ? ntri : 1)*3*sizeof(double));
+  if (tree->v==NULL || tree->indx==NULL || tree->node==NULL || centroid==NULL)
+  {
+    free(centroid);
+    meshtree_free(tree);
+    return NULL;
+  }
+
+  /* copy the vertices of each triangle, the indices are one-based */
+  for (i=0; i<ntri; i++)
+  {
+    tree->indx[i] = i;
+    for (t=0; t<3; t++)
+    {
+      indx = (long)(tri[i+t*ntri]) - 1;
+      if (indx<0 || indx>=npnt)
+      {
+        free(centroid);
+        meshtree_free(tree);
+        return NULL;
+      }
+      for (k=0; k<3; k++)
+        tree->v[9*i+3*t+k] = pnt[indx+k*npnt];
+    }
+    for (k=0; k<3; k++)
+      centroid[3*i+k] = (tree->v[9*i+k] + tree->v[9*i+3+k] + tree->v[9*i+6+k])/3;
+  }
+
+  tree->nnode = 1;
+  tree->node[0].first = 0;
+  tree->node[0].count = ntri;
+  split(tree, centroid, 0, 0);
+  free(centroid);
+  return tree;
+}
+
+/****************************************************************************/
+meshtree_t *meshtree_cached(const double *pnt, long npnt, const double *tri, long ntri)
+{
+  if (cache && cache->npnt==npnt && cache->ntri==ntri && cache->checksum==meshtree_checksum(pnt, npnt, tri, ntri))
+    return cache;
+  meshtree_clear();
+  cache = meshtree_build(pnt, npnt, tri, ntri);
+  return cache;
+}
+
+/****************************************************************************/
+void meshtree_free(meshtree_t *tree)
+{
+  if (tree==NULL)
+    return;
+  free(tree->v);
+  free(tree->indx);
+  free(tree->node);
+  free(tree);
+}
+
+/****************************************************************************/
+void meshtree_clear(void)
+{
+  meshtree_free(cache);
+  cache = NULL;
+}
+
+/****************************************************************************/
+double ptriclosest(const double *v1, const double *v2, const double *v3, const double *r, double *proj, double *la, double *mu)
+{
+  /* this determines the region of the triangle in which the projection lies, see Ericson (2005) Real-Time Collision Detection */
+  double ab[3], ac[3], ap[3], bp[3], cp[3];
+  double d1, d2, d3, d4, d5, d6, va, vb, vc, denom, l, m;
+  int k;
+  for (k=0; k<3; k++)
+  {
+    ab[k] = v2[k]-v1[k];
+    ac[k] = v3[k]-v1[k];
+    ap[k] = r[k]-v1[k];
+    bp[k] = r[k]-v2[k];
+    cp[k] = r[k]-v3[k];
+  }
+  d1 = ab[0]*ap[0] + ab[1]*ap[1] + ab[2]*ap[2];
+  d2 = ac[0]*ap[0] + ac[1]*ap[1] + ac[2]*ap[2];
+  d3 = ab[0]*bp[0] + ab[1]*bp[1] + ab[2]*bp[2];
+  d4 = ac[0]*bp[0] + ac[1]*bp[1] + ac[2]*bp[2];
+  d5 = ab[0]*cp[0] + ab[1]*cp[1] + ab[2]*cp[2];
+  d6 = ac[0]*cp[0] + ac[1]*cp[1] + ac[2]*cp[2];
+  vc = d1*d4 - d3*d2;
+  vb = d5*d2 - d1*d6;
+  va = d3*d6 - d5*d4;
+
+  if (d1<=0 && d2<=0)
+  {
+    /* first vertex */
+    l = 0; m = 0;
+  }
+  else if (d3>=0 && d4<=d3)
+  {
+    /* second vertex */
+    l = 1; m = 0;
+  }
+  else if (d6>=0 && d5<=d6)
+  {
+    /* third vertex */
+    l = 0; m = 1;
+  }
+  else if (vc<=0 && d1>=0 && d3<=0)
+  {
+    /* edge between the first and second vertex */
+    l = d1/(d1-d3); m = 0;
+  }
+  else if (vb<=0 && d2>=0 && d6<=0)
+  {
+    /* edge between the first and third vertex */
+    l = 0; m = d2/(d2-d6);
+  }
+  else if (va<=0 && (d4-d3)>=0 && (d5-d6)>=0)
+  {
+    /* edge between the second and third vertex */
+    m = (d4-d3)/((d4-d3)+(d5-d6)); l = 1-m;
+  }
+  else
+  {
+    /* inside the triangle */
+    denom = 1/(va+vb+vc);
+    l = vb*denom;
+    m = vc*denom;
+  }
+
+  for (k=0; k<3; k++)
+    proj[k] = (1-l-m)*v1[k] + l*v2[k] + m*v3[k];
+  *la = l;
+  *mu = m;
+  return sqrt((proj[0]-r[0])*(proj[0]-r[0]) + (proj[1]-r[1])*(proj[1]-r[1]) + (proj[2]-r[2])*(proj[2]-r[2]));
+}
+
+/****************************************************************************/
+static double boxdist(const meshnode_t *node, const double *r)
+{
+  /* squared distance between a point and a box, this is zero for a point inside the box */
+  double d, ss = 0;
+  int k;
+  for (k=0; k<3; k++)
+  {
+    d = (r[k]<node->min[k] ? node->min[k]-r[k] : (r[k]>node->max[k] ? r[k]-node->max[k] : 0));
+    ss += d*d;
+  }
+  return ss;
+}
+
+/****************************************************************************/
+int meshtree_closest(const meshtree_t *tree, const double *r, double *proj, double *dist, double *la, double *mu)
+{
+  int stack[MESHTREE_MAXDEPTH+1], nstack = 0, n, i, best = -1;
+  double d, l, m, p[3], bestd = HUGE_VAL, dl, dr;
+  const meshnode_t *node;
+
+  if (tree->ntri==0)
+    return -1;
+
+  stack[nstack++] = 0;
+  while (nstack>0)
+  {
+    node = tree->node + stack[--nstack];
+    if (boxdist(node, r) > bestd*bestd)
+      continue;
+    if (node->left<0)
+    {
+      for (i=node->first; i<node->first+node->count; i++)
+      {
+        d = ptriclosest(tree->v+9*i, tree->v+9*i+3, tree->v+9*i+6, r, p, &l, &m);
+        if (d<bestd)
+        {
+          bestd = d;
+          best  = i;
+          *la = l;
+          *mu = m;
+          proj[0] = p[0]; proj[1] = p[1]; proj[2] = p[2];
+        }
+      }
+    }
+    else
+    {
+      /* the nearest child is pushed last, so that it is visited first */
+      dl = boxdist(tree->node + node->left, r);
+      dr = boxdist(tree->node + node->right, r);
+      n  = (dl<dr ? node->left : node->right);
+      stack[nstack++] = (dl<dr ? node->right : node->left);
+      stack[nstack++] = n;
+    }
+  }
+  *dist = bestd;
+  return tree->indx[best];
+}
+
+/****************************************************************************/
+static int boxline(const meshnode_t *node, const double *l1, const double *dir, double *tmin, double *tmax)
+{
+  /* determine the range of the line parameter within the box, using the slab method */
+  double t0 = -HUGE_VAL, t1 = HUGE_VAL, a, b, tmp;
+  int k;
+  for (k=0; k<3; k++)
+  {
+    if (dir[k]==0)
+    {
+      if (l1[k]<node->min[k] || l1[k]>node->max[k])
+        return 0;
+      continue;
+    }
+    a = (node->min[k]-l1[k])/dir[k];
+    b = (node->max[k]-l1[k])/dir[k];
+    if (a>b)
+    {
+      tmp = a; a = b; b = tmp;
+    }
+    t0 = (a>t0 ? a : t0);
+    t1 = (b<t1 ? b : t1);
+  }
+  *tmin = t0;
+  *tmax = t1;
+  return t0<=t1;
+}
+
+/****************************************************************************/
+static double boxlinedist(const meshnode_t *node, const double *l1, const double *dir)
+{
+  /* smallest absolute value of the line parameter within the box, or infinite if the line misses */
+  double t0, t1;
+  if (!boxline(node, l1, dir, &t0, &t1))
+    return HUGE_VAL;
+  if (t0<=0 && t1>=0)
+    return 0;
+  return (t0>0 ? t0 : -t1);
+}
+
+/****************************************************************************/
+int meshtree_intersect(const meshtree_t *tree, const double *l1, const double *l2, double *proj, double *dist, double *la, double *mu)
+{
+  int stack[MESHTREE_MAXDEPTH+1], nstack = 0, n, i, k, best = -1;
+  double dir[3], e1[3], e2[3], h[3], s[3], q[3], a, f, u, v, t, bestt = HUGE_VAL, bestu = 0, bestv = 0, dl, dr, len;
+  const double *v1;
+  const meshnode_t *node;
+
+  for (k=0; k<3; k++)
+    dir[k] = l2[k]-l1[k];
+  len = sqrt(dir[0]*dir[0] + dir[1]*dir[1] + dir[2]*dir[2]);
+  if (tree->ntri==0 || len==0)
+    return -1;
+
+  stack[nstack++] = 0;
+  while (nstack>0)
+  {
+    node = tree->node + stack[--nstack];
+    if (boxlinedist(node, l1, dir) >= bestt)
+      continue;
+    if (node->left<0)
+    {
+      for (i=node->first; i<node->first+node->count; i++)
+      {
+        /* intersect the line with the triangle, see Moller and Trumbore (1997) */
+        v1 = tree->v+9*i;
+        for (k=0; k<3; k++)
+        {
+          e1[k] = v1[3+k]-v1[k];
+          e2[k] = v1[6+k]-v1[k];
+          s[k]  = l1[k]-v1[k];
+        }
+        h[0] = dir[1]*e2[2] - dir[2]*e2[1];
+        h[1] = dir[2]*e2[0] - dir[0]*e2[2];
+        h[2] = dir[0]*e2[1] - dir[1]*e2[0];
+        a = e1[0]*h[0] + e1[1]*h[1] + e1[2]*h[2];
+        if (a==0)
+          /* the line is parallel to the triangle */
+          continue;
+        f = 1/a;
+        u = f*(s[0]*h[0] + s[1]*h[1] + s[2]*h[2]);
+        if (u<0 || u>1)
+          continue;
+        q[0] = s[1]*e1[2] - s[2]*e1[1];
+        q[1] = s[2]*e1[0] - s[0]*e1[2];
+        q[2] = s[0]*e1[1] - s[1]*e1[0];
+        v = f*(dir[0]*q[0] + dir[1]*q[1] + dir[2]*q[2]);
+        if (v<0 || u+v>1)
+          continue;
+        t = f*(e2[0]*q[0] + e2[1]*q[1] + e2[2]*q[2]);
+        if (fabs(t)<bestt)
+        {
+          bestt = fabs(t);
+          best  = i;
+          bestu = u;
+          bestv = v;
+          proj[0] = l1[0] + t*dir[0];
+          proj[1] = l1[1] + t*dir[1];
+          proj[2] = l1[2] + t*dir[2];
+        }
+      }
+    }
+    else
+    {
+      dl = boxlinedist(tree->node + node->left, l1, dir);
+      dr = boxlinedist(tree->node + node->right, l1, dir);
+      n  = (dl<dr ? node->left : node->right);
+      stack[nstack++] = (dl<dr ? node->right : node->left);
+      stack[nstack++] = n;
+    }
+  }
+  if (best<0)
+    return -1;
+  *dist = bestt*len;
+  *la   = bestu;
+  *mu   = bestv;
+  return tree->indx[best];
+}
+
+/****************************************************************************/
+int meshtree_crossings(const meshtree_t *tree, const double *r, const double *dir, double tol)
+{
+  /* the barycentric margin around the edges, within which a crossing is not trusted */
+  const double eps = 1e-9;
+  int stack[MESHTREE_MAXDEPTH+1], nstack = 0, i, k, count = 0;
+  double e1[3], e2[3], h[3], s[3], q[3], a, f, u, v, t, t0, t1;
+  const double *v1;
+  const meshnode_t *node;
+
+  if (tree->ntri==0)
+    return 0;
+
+  stack[nstack++] = 0;
+  while (nstack>0)
+  {
+    node = tree->node + stack[--nstack];
+    if (!boxline(node, r, dir, &t0, &t1) || t1<-tol)
+      continue;
+    if (node->left<0)
+    {
+      for (i=node->first; i<node->first+node->count; i++)
+      {
+        /* the same as in meshtree_intersect, but with a margin */
+        v1 = tree->v+9*i;
+        for (k=0; k<3; k++)
+        {
+          e1[k] = v1[3+k]-v1[k];
+          e2[k] = v1[6+k]-v1[k];
+          s[k]  = r[k]-v1[k];
+        }
+        h[0] = dir[1]*e2[2] - dir[2]*e2[1];
+        h[1] = dir[2]*e2[0] - dir[0]*e2[2];
+        h[2] = dir[0]*e2[1] - dir[1]*e2[0];
+        a = e1[0]*h[0] + e1[1]*h[1] + e1[2]*h[2];
+        if (a==0)
+          continue;
+        f = 1/a;
+        u = f*(s[0]*h[0] + s[1]*h[1] + s[2]*h[2]);
+        if (u<-eps || u>1+eps)
+          continue;
+        q[0] = s[1]*e1[2] - s[2]*e1[1];
+        q[1] = s[2]*e1[0] - s[0]*e1[2];
+        q[2] = s[0]*e1[1] - s[1]*e1[0];
+        v = f*(dir[0]*q[0] + dir[1]*q[1] + dir[2]*q[2]);
+        if (v<-eps || u+v>1+eps)
+          continue;
+        t = f*(e2[0]*q[0] + e2[1]*q[1] + e2[2]*q[2]);
+        if (t<-tol)
+          continue;
+        if (t<=tol || u<=eps || v<=eps || u+v>=1-eps)
+          /* the point is on the surface, or the ray passes through an edge or vertex */
+          return -1;
+        count++;
+      }
+    }
+    else
+    {
+      stack[nstack++] = node->left;
+      stack[nstack++] = node->right;
+    }
+  }
+  return count;
+}
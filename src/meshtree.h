@@ -0,0 +1,28 @@
+#ifndef MESHTREE_H
+#define MESHTREE_H
+
+typedef struct {
+  double min[3], max[3];  /* axis aligned bounding box of the triangles in this node */
+  int left, right;        /* children, or -1 for a leaf */
+  int first, count;       /* triangles of a leaf, in tree order */
+} meshnode_t;
+
+typedef struct {
+  long npnt, ntri, nnode;
+  unsigned long checksum; /* of the vertices and triangles that the tree was built from */
+  double *v;              /* vertices of the triangles in tree order, ntri x 9 */
+  int *indx;              /* original (zero-based) index of the triangles in tree order */
+  meshnode_t *node;
+} meshtree_t;
+
+unsigned long meshtree_checksum(const double *pnt, long npnt, const double *tri, long ntri);
+meshtree_t *meshtree_build(const double *pnt, long npnt, const double *tri, long ntri);
+meshtree_t *meshtree_cached(const double *pnt, long npnt, const double *tri, long ntri);
+void meshtree_free(meshtree_t *tree);
+void meshtree_clear(void);
+double ptriclosest(const double *v1, const double *v2, const double *v3, const double *r, double *proj, double *la, double *mu);
+int meshtree_closest(const meshtree_t *tree, const double *r, double *proj, double *dist, double *la, double *mu);
+int meshtree_intersect(const meshtree_t *tree, const double *l1, const double *l2, double *proj, double *dist, double *la, double *mu);
+int meshtree_crossings(const meshtree_t *tree, const double *r, const double *dir, double tol);
+
+#endif
@@ -0,0 +1,147 @@
+#include <math.h>
+#include "mex.h"
+#include "platform.h"
+#include "meshtree.h"
+
+#if !defined(PLATFORM_WINDOWS)
+#include <pthread.h>
+#include <unistd.h>
+#define MESHTRISECT_THREADS
+#endif
+
+#define MESHTRISECT_MAXTHREADS 16
+#define MESHTRISECT_MINSIZE    1024    /* number of lines below which a single thread is used */
+
+typedef struct {
+  const meshtree_t *tree;
+  const double *l1, *l2;
+  mwSize n1, n2, nline, begin, end;    /* a single point is used for all lines */
+  double *sect, *dist, *indx, *la, *mu;
+} meshtrisect_t;
+
+static void *
+intersect (void *arg)
+{
+  const meshtrisect_t *s = (const meshtrisect_t *)arg;
+  double l1[3], l2[3], p[3], d, l, m, nan = mxGetNaN();
+  mwSize i, i1, i2, n = s->nline;
+  int k, t;
+
+  for (i=s->begin; i<s->end; i++)
+  {
+    i1 = (s->n1==1 ? 0 : i);
+    i2 = (s->n2==1 ? 0 : i);
+    for (k=0; k<3; k++)
+    {
+      l1[k] = s->l1[i1+k*s->n1];
+      l2[k] = s->l2[i2+k*s->n2];
+    }
+    t = meshtree_intersect(s->tree, l1, l2, p, &d, &l, &m);
+    if (t<0)
+    {
+      p[0] = p[1] = p[2] = d = l = m = nan;
+    }
+    for (k=0; k<3; k++)
+      s->sect[i+k*n] = p[k];
+    s->dist[i] = d;
+    s->indx[i] = (t<0 ? nan : t+1);
+    s->la[i]   = l;
+    s->mu[i]   = m;
+  }
+  return NULL;
+}
+
+void
+mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
+{
+  mxArray *sect, *dist, *indx, *la, *mu;
+  meshtrisect_t s;
+  const meshtree_t *tree;
+  int t, nthreads = 1;
+
+  if (nrhs!=4)
+    mexErrMsgTxt ("Invalid number of input arguments");
+  for (t=0; t<4; t++)
+    if (!mxIsDouble(prhs[t]) || mxIsComplex(prhs[t]))
+      mexErrMsgTxt ("The input arguments should be real-valued double precision");
+  for (t=0; t<4; t++)
+    if (mxGetN(prhs[t])!=3)
+    {
+      char str[256];
+      sprintf(str, "Invalid dimension for input argument %d", t+1);
+      mexErrMsgTxt (str);
+    }
+
+  s.l1    = mxGetData(prhs[2]);
+  s.l2    = mxGetData(prhs[3]);
+  s.n1    = mxGetM(prhs[2]);
+  s.n2    = mxGetM(prhs[3]);
+  s.nline = (s.n1==1 ? s.n2 : s.n1);
+  if ((s.n1!=1 && s.n1!=s.nline) || (s.n2!=1 && s.n2!=s.nline))
+    mexErrMsgTxt ("Number of points does not match between argument 3 and 4");
+
+  /* the tree is kept until the mex file is cleared, and is only rebuilt for another mesh */
+  mexAtExit(meshtree_clear);
+  tree = meshtree_cached(mxGetData(prhs[0]), mxGetM(prhs[0]), mxGetData(prhs[1]), mxGetM(prhs[1]));
+  if (tree==NULL)
+    mexErrMsgTxt ("Invalid vertex index in the triangles, or out of memory");
+  s.tree = tree;
+
+  sect   = mxCreateDoubleMatrix (s.nline, 3, mxREAL);
+  dist   = mxCreateDoubleMatrix (s.nline, 1, mxREAL);
+  indx   = mxCreateDoubleMatrix (s.nline, 1, mxREAL);
+  la     = mxCreateDoubleMatrix (s.nline, 1, mxREAL);
+  mu     = mxCreateDoubleMatrix (s.nline, 1, mxREAL);
+  s.sect = mxGetData(sect);
+  s.dist = mxGetData(dist);
+  s.indx = mxGetData(indx);
+  s.la   = mxGetData(la);
+  s.mu   = mxGetData(mu);
+
+#ifdef MESHTRISECT_THREADS
+  if (s.nline>=MESHTRISECT_MINSIZE)
+  {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = (ncpu>MESHTRISECT_MAXTHREADS ? MESHTRISECT_MAXTHREADS : (ncpu<1 ? 1 : (int)ncpu));
+  }
+
+  if (nthreads>1)
+  {
+    pthread_t thread[MESHTRISECT_MAXTHREADS];
+    meshtrisect_t part[MESHTRISECT_MAXTHREADS];
+    int started[MESHTRISECT_MAXTHREADS];
+
+    /* divide the lines over the threads, the tree is only read */
+    for (t=0; t<nthreads; t++)
+    {
+      part[t]       = s;
+      part[t].begin = (s.nline*t)/nthreads;
+      part[t].end   = (s.nline*(t+1))/nthreads;
+      started[t]    = (pthread_create(&thread[t], NULL, intersect, &part[t])==0);
+    }
+    for (t=0; t<nthreads; t++)
+    {
+      if (started[t])
+        pthread_join(thread[t], NULL);
+      else
+        intersect(&part[t]);
+    }
+  }
+#endif
+
+  if (nthreads==1)
+  {
+    s.begin = 0;
+    s.end   = s.nline;
+    intersect(&s);
+  }
+
+  /* assign the output parameters */
+  plhs[0] = sect;
+  if (nlhs>1) plhs[1] = dist; else mxDestroyArray(dist);
+  if (nlhs>2) plhs[2] = indx; else mxDestroyArray(indx);
+  if (nlhs>3) plhs[3] = la;   else mxDestroyArray(la);
+  if (nlhs>4) plhs[4] = mu;   else mxDestroyArray(mu);
+
+  return;
+}
@@ -0,0 +1,78 @@
+function [varargout] = meshtrisect(varargin)
+
+% MESHTRISECT computes the intersection of lines with a triangulated mesh
+%
+% Use as
+%   [sect, dist, indx, la, mu] = meshtrisect(pnt, tri, l1, l2)
+% where pnt and tri describe the mesh, and l1 and l2 are Nx3 matrices with two
+% points on each of the lines. Either l1 or l2 can also be a single point that
+% is used for all lines. Of all intersections of the line with the mesh, the one
+% that is closest to l1 is returned. The other outputs are its distance to l1,
+% the index of the triangle and the la/mu parameters of the intersection within
+% that triangle. Lines that do not intersect the mesh give NaN.
+%
+% The mex file uses a bounding box tree of the mesh, which is only built once
+% for consecutive calls with the same mesh. This is much faster than calling
+% LTRISECT for each of the triangles.
+%
+% See also MESHPROJ, LTRISECT, LMOUTR
+
+% Copyright (C) 2017, Robert Oostenveld
+%
+% This file is part of FieldTrip, see http://www.fieldtriptoolbox.org
+% for the documentation and details.
+%
+%    FieldTrip is free software: you can redistribute it and/or modify
+%    it under the terms of the GNU General Public License as published by
+%    the Free Software Foundation, either version 3 of the License, or
+%    (at your option) any later version.
+%
+%    FieldTrip is distributed in the hope that it will be useful,
+%    but WITHOUT ANY WARRANTY; without even the implied warranty of
+%    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+%    GNU General Public License for more details.
+%
+%    You should have received a copy of the GNU General Public License
+%    along with FieldTrip. If not, see <http://www.gnu.org/licenses/>.
+%
+% $Id$
+
+% compile the missing mex file on the fly
+% remember the original working directory
+pwdir = pwd;
+
+% determine the name and full path of this function
+funname = mfilename('fullpath');
+mexsrc  = [funname '.c'];
+[mexdir, mexname] = fileparts(funname);
+
+try
+  % try to compile the mex file on the fly
+  warning('trying to compile MEX file from %s', mexsrc);
+  cd(mexdir);
+  
+  if ispc
+    mex -I. -c meshtree.c
+    mex -I. -c meshtrisect.c ; mex meshtrisect.c meshtrisect.obj meshtree.obj
+  else
+    mex -I. -c meshtree.c
+    mex -I. -c meshtrisect.c ; mex -o meshtrisect meshtrisect.o meshtree.o
+  end
+  
+  cd(pwdir);
+  success = true;
+
+catch
+  % compilation failed
+  disp(lasterr);
+  error('could not locate MEX file for %s', mexname);
+  cd(pwdir);
+  success = false;
+end
+
+if success
+  % execute the mex file that was juist created
+  funname   = mfilename;
+  funhandle = str2func(funname);
+  [varargout{1:nargout}] = funhandle(varargin{:});
+end
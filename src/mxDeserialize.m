@@ -3,6 +3,12 @@ function [argout] = mxDeserialize(argin)
 % MXDESERIALIZE reconstructs a MATLAB object from a uint8 array suitable
 % for passing down a comms channel to be reconstructed at the other end.
 %
+% Use as
+%   argout = mxDeserialize(argin)
+% where argin is the uint8 array, or the name of the file that was written
+% with MXSERIALIZE(argin, filename). The file is mapped in memory and
+% deserialized from there, without reading it into MATLAB first.
+%
 % See also MXSERIALIZE
 
 % Copyright (C) 2005, Brad Phelan         http://xtargets.com
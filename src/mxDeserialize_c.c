@@ -26,6 +26,7 @@
  */
 
 #include "mex.h"
+#include "mxSerialize_file.h"
 
 /* Only define EXTERN_C if it hasn't been defined already. This allows
  * individual modules to have more control over managing their exports.
@@ -46,7 +47,14 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
    /* mxDeserialize is an undocumented Matlab function and should be
     * used assuming the Mathworks may change or remove this function
     * completely from future version of matlab */
-  if (nlhs && nrhs)
+  if (nlhs && nrhs && mxIsChar(prhs[0])) {
+    /* deserialize directly from the file that was written by mxSerialize */
+    serialize_map_t map;
+    serialize_map(prhs[0], &map);
+    plhs[0] = ( mxArray * ) mxDeserialize(map.data, map.size);
+    serialize_unmap(&map);
+  }
+  else if (nlhs && nrhs)
     plhs[0] = ( mxArray * ) mxDeserialize(mxGetData(prhs[0]), mxGetNumberOfElements(prhs[0]));
 }
 
@@ -1,4 +1,5 @@
 #include "mex.h"
+#include "mxSerialize_file.h"
  
 // MX_API_VER has unfortunately not changed between R2013b and R2014a,
 // so we use the new MATRIX_DLL_EXPORT_SYM as an ugly hack instead
@@ -18,7 +19,14 @@ EXTERN_C mxArray* mxDeserialize(const void *, size_t);
  
 void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 {
-    if (nlhs && nrhs) {
+    if (nlhs && nrhs && mxIsChar(prhs[0])) {
+        // deserialize directly from the file that was written by mxSerialize
+        serialize_map_t map;
+        serialize_map(prhs[0], &map);
+        plhs[0] = (mxArray *) mxDeserialize(map.data, map.size);
+        serialize_unmap(&map);
+    }
+    else if (nlhs && nrhs) {
         plhs[0] = (mxArray *) mxDeserialize(mxGetData(prhs[0]), mxGetNumberOfElements(prhs[0]));
     }
 }
@@ -1,8 +1,16 @@
-function [argout] = mxSerialize(argin)
+function [argout] = mxSerialize(varargin)
 
 % MXSERIALIZE converts any MATLAB object into a uint8 array suitable
 % for passing down a comms channel to be reconstructed at the other end.
 %
+% Use as
+%   argout = mxSerialize(argin)
+% or to write the serialized array directly to a file
+%   numbytes = mxSerialize(argin, filename)
+% The latter does not return the serialized array to MATLAB, which for large
+% structures avoids keeping another copy of it in memory. The file can be read
+% with MXDESERIALIZE(filename).
+%
 % See also MXDESERIALIZE
 
 % Copyright (C) 2005, Brad Phelan         http://xtargets.com
@@ -28,10 +36,10 @@ function [argout] = mxSerialize(argin)
 
 if ft_platform_supports('libmx_c_interface') % older than 2014a
   % use the original implementation of the mex file
-  argout = mxSerialize_c(argin);
+  argout = mxSerialize_c(varargin{:});
 else
   % use the C++ implementation of the mex file
   % see http://bugzilla.fieldtriptoolbox.org/show_bug.cgi?id=2452
-  argout = mxSerialize_cpp(argin);
+  argout = mxSerialize_cpp(varargin{:});
 end
 
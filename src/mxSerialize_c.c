@@ -26,6 +26,7 @@
  */
 
 #include "mex.h"
+#include "mxSerialize_file.h"
 
 /* Only define EXTERN_C if it hasn't been defined already. This allows
  * individual modules to have more control over managing their exports.
@@ -46,7 +47,15 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
    /* mxSerialize is an undocumented Matlab function and should be
     * used assuming the Mathworks may change or remove this function
     * completely from future version of matlab */
-  if (nlhs && nrhs)
+  if (nrhs>1) {
+    /* write the serialized array to a file, the output is the number of bytes */
+    mxArray *blob = (mxArray *) mxSerialize(prhs[0]);
+    double size = serialize_write(blob, prhs[1]);
+    mxDestroyArray(blob);
+    if (nlhs)
+      plhs[0] = mxCreateDoubleScalar(size);
+  }
+  else if (nlhs && nrhs)
     plhs[0] = (mxArray *) mxSerialize(prhs[0]);
 }
 
@@ -1,4 +1,5 @@
 #include "mex.h"
+#include "mxSerialize_file.h"
  
 // MX_API_VER has unfortunately not changed between R2013b and R2014a,
 // so we use the new MATRIX_DLL_EXPORT_SYM as an ugly hack instead
@@ -18,7 +19,15 @@ EXTERN_C mxArray* mxDeserialize(const void *, size_t);
  
 void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 {
-    if (nlhs && nrhs) {
+    if (nrhs>1) {
+        // write the serialized array to a file, the output is the number of bytes
+        mxArray *blob = (mxArray *) mxSerialize(prhs[0]);
+        double size = serialize_write(blob, prhs[1]);
+        mxDestroyArray(blob);
+        if (nlhs)
+            plhs[0] = mxCreateDoubleScalar(size);
+    }
+    else if (nlhs && nrhs) {
         plhs[0] = (mxArray *) mxSerialize(prhs[0]);
     }
 }
@@ -0,0 +1,150 @@
+/*
+ * Helper functions for mxSerialize_c, mxSerialize_cpp, mxDeserialize_c and mxDeserialize_cpp.
+ *
+ * For large structures the serialized uint8 array is as large as the structure itself. Writing it
+ * directly to a file, and deserializing directly from the memory-mapped file, avoids having the
+ * structure, the serialized array and a copy of it in the MATLAB workspace at the same time.
+ *
+ * Copyright (C) 2017, Robert Oostenveld   http://www.fcdonders.ru.nl
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef MXSERIALIZE_FILE_H
+#define MXSERIALIZE_FILE_H
+
+#include <stdio.h>
+#include "mex.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/* the array is written in pieces, a single write of several GB is not supported everywhere */
+#define SERIALIZE_CHUNK ((size_t)64*1024*1024)
+
+typedef struct {
+  const void *data;
+  size_t size;
+#if defined(_WIN32) || defined(_WIN64)
+  HANDLE file, mapping;
+#else
+  int fd;
+#endif
+} serialize_map_t;
+
+/* writes the serialized array to the file and returns the number of bytes */
+static double serialize_write(const mxArray *blob, const mxArray *filename)
+{
+  char *name = mxArrayToString(filename);
+  const char *data = (const char *)mxGetData(blob);
+  size_t size = mxGetNumberOfElements(blob), done = 0, n;
+  FILE *fp;
+
+  if (name==NULL)
+    mexErrMsgTxt("the filename should be a string");
+
+  fp = fopen(name, "wb");
+  mxFree(name);
+  if (fp==NULL)
+    mexErrMsgTxt("could not open the file for writing");
+
+  while (done<size) {
+    n = (size-done > SERIALIZE_CHUNK ? SERIALIZE_CHUNK : size-done);
+    if (fwrite(data+done, 1, n, fp)!=n) {
+      fclose(fp);
+      mexErrMsgTxt("could not write the serialized array to the file");
+    }
+    done += n;
+  }
+
+  if (fclose(fp)!=0)
+    mexErrMsgTxt("could not write the serialized array to the file");
+  return (double)size;
+}
+
+/* maps the file with the serialized array in memory, it is not read until it is deserialized */
+static void serialize_map(const mxArray *filename, serialize_map_t *map)
+{
+  char *name = mxArrayToString(filename);
+
+  if (name==NULL)
+    mexErrMsgTxt("the filename should be a string");
+
+#if defined(_WIN32) || defined(_WIN64)
+  {
+    LARGE_INTEGER size;
+    map->file = CreateFileA(name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    mxFree(name);
+    if (map->file==INVALID_HANDLE_VALUE)
+      mexErrMsgTxt("could not open the file for reading");
+    if (!GetFileSizeEx(map->file, &size) || size.QuadPart==0) {
+      CloseHandle(map->file);
+      mexErrMsgTxt("could not determine the size of the file, or the file is empty");
+    }
+    map->size    = (size_t)size.QuadPart;
+    map->mapping = CreateFileMapping(map->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    map->data    = (map->mapping ? MapViewOfFile(map->mapping, FILE_MAP_READ, 0, 0, 0) : NULL);
+    if (map->data==NULL) {
+      if (map->mapping)
+        CloseHandle(map->mapping);
+      CloseHandle(map->file);
+      mexErrMsgTxt("could not map the file in memory");
+    }
+  }
+#else
+  {
+    struct stat st;
+    void *data;
+    map->fd = open(name, O_RDONLY);
+    mxFree(name);
+    if (map->fd<0)
+      mexErrMsgTxt("could not open the file for reading");
+    if (fstat(map->fd, &st)!=0 || st.st_size==0) {
+      close(map->fd);
+      mexErrMsgTxt("could not determine the size of the file, or the file is empty");
+    }
+    map->size = (size_t)st.st_size;
+    data = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, map->fd, 0);
+    if (data==MAP_FAILED) {
+      close(map->fd);
+      mexErrMsgTxt("could not map the file in memory");
+    }
+#ifdef MADV_SEQUENTIAL
+    madvise(data, map->size, MADV_SEQUENTIAL);
+#endif
+    map->data = data;
+  }
+#endif
+}
+
+static void serialize_unmap(serialize_map_t *map)
+{
+#if defined(_WIN32) || defined(_WIN64)
+  UnmapViewOfFile(map->data);
+  CloseHandle(map->mapping);
+  CloseHandle(map->file);
+#else
+  munmap((void *)map->data, map->size);
+  close(map->fd);
+#endif
+}
+
+#endif
@@ -1,17 +1,438 @@
+/*
+ * This implements the accumulation that is shared by nansum, nanmean, nanvar
+ * and nanstd. The input array is considered as inner x len x outer, where len
+ * is the dimension that is reduced. For each output element the number of
+ * non-NaN values, their sum and optionally the sum of squared deviations from
+ * the mean are computed.
+ *
+ * The input is streamed in memory order: for a tile of contiguous inner
+ * elements all len rows are added, which does not require any index
+ * computations per element and allows the compiler to vectorize the inner
+ * loop. The variance is computed with the corrected two-pass algorithm, see
+ * Chan, Golub and LeVeque (1983). Algorithms for computing the sample
+ * variance: analysis and recommendations. The American Statistician 37:242-247.
+ *
+ * With onepass the input is read only once: the sum of squares is accumulated
+ * relative to the first non-NaN value, which is numerically accurate as long
+ * as this shift is not far from the mean. This pass can also keep track of the
+ * minimum and maximum of the real part.
+ *
+ * The tiles and the outer dimension are divided over multiple threads if the
+ * input is large enough.
+ *
+ * The loops are expanded for each class of the input, and the expansion that is
+ * used is selected once per call. For the integer, logical and char classes,
+ * which cannot contain NaNs, the test for NaN is left out, so that the loops
+ * reduce to plain sums.
+ */
+
+#ifndef NANACCUM_H
+#define NANACCUM_H
+
 #include <mex.h>
 #include <stdlib.h>
 #include <string.h>
-#include <assert.h>
 #include <math.h>
+#include "compiler.h"
+#include "platform.h"
+
+#if defined (COMPILER_MSVC)
+#define isnan _isnan
+#define INFINITY (HUGE_VAL+HUGE_VAL)
+#define NAN (INFINITY - INFINITY)
+#elif defined(COMPILER_LCC)
+#define INFINITY (DBL_MAX+DBL_MAX)
+#define NAN (INFINITY - INFINITY)
+#endif
+
+#if !defined(PLATFORM_WINDOWS)
+#include <pthread.h>
+#include <unistd.h>
+#define NANACCUM_THREADS
+#endif
+
+#define NANACCUM_TILE       256         /* number of contiguous inner elements that are processed together */
+#define NANACCUM_MAXTHREADS 16
+#define NANACCUM_MINSIZE    (1<<18)     /* number of input elements below which a single thread is used */
+
+typedef struct nanaccum_s nanaccum_t;
+
+/* the partial sums of a tile in the single pass, these are kept on the stack */
+typedef struct {
+    double shiftr[NANACCUM_TILE], shifti[NANACCUM_TILE], corr[NANACCUM_TILE], cori[NANACCUM_TILE];
+    double ssqr[NANACCUM_TILE], ssqi[NANACCUM_TILE], minr[NANACCUM_TILE], maxr[NANACCUM_TILE];
+} nanaccum_tile_t;
+
+/* the loops for one class of the input */
+typedef struct {
+    void (*row)(const nanaccum_t *a, mwSize offset, mwSize n, double *cnt, double *sumr, double *sumi);
+    void (*deviation)(const nanaccum_t *a, mwSize offset, mwSize n, const double *meanr, const double *meani,
+                      double *ssqr, double *ssqi, double *corr, double *cori);
+    void (*column)(const nanaccum_t *a, mwSize o);
+    void (*moments)(const nanaccum_t *a, mwSize offset, mwSize n, double *cnt, nanaccum_tile_t *t);
+} nanaccum_kernel_t;
+
+struct nanaccum_s {
+    /* the input */
+    const void *xr, *xi;        /* the imaginary part is NULL for real valued input */
+    int single;                 /* the input and output are single instead of double precision */
+    mxClassID classid;          /* the class of the input, if unknown it follows from single */
+    mwSize inner, len, outer;
+    /* the output, each of these has inner x outer elements */
+    double *cnt;                /* number of non-NaN values */
+    double *sumr, *sumi;        /* sum of the non-NaN values, sumi is only used for complex input */
+    double *ssqr, *ssqi;        /* sum of squared deviations from the mean, or NULL if not needed */
+    int onepass;                /* compute the sum of squares in the same pass as the sum */
+    double *min, *max;          /* of the real part, or NULL if not needed, this requires onepass */
+    /* the division of the work, which consists of outer x tiles units */
+    mwSize ntile, begin, end;
+    const nanaccum_kernel_t *kernel;
+};
+
+/* only floating point values can be NaN, for the other classes F is zero and the test is left out */
+#define NANACCUM_ISNUM(F, v) ((F) ? ((v) == (v)) : 1)
+
+/* the value is used if neither the real nor the imaginary part is NaN */
+#define NANACCUM_ROW(T, F)                                                      \
+    {                                                                           \
+        const T *xr = (const T *)a->xr + offset;                                \
+        const T *xi = (a->xi ? (const T *)a->xi + offset : NULL);               \
+        if (a->xi == NULL) {                                                    \
+            for (p=0; p<n; p++) {                                               \
+                double v = xr[p];                                               \
+                int    m = NANACCUM_ISNUM(F, v);                                \
+                cnt[p]  += m;                                                   \
+                sumr[p] += (m ? v : 0.0);                                       \
+            }                                                                   \
+        } else {                                                                \
+            for (p=0; p<n; p++) {                                               \
+                double v = xr[p], w = xi[p];                                    \
+                int    m = NANACCUM_ISNUM(F, v) && NANACCUM_ISNUM(F, w);        \
+                cnt[p]  += m;                                                   \
+                sumr[p] += (m ? v : 0.0);                                       \
+                sumi[p] += (m ? w : 0.0);                                       \
+            }                                                                   \
+        }                                                                       \
+    }
+
+/* the deviations from the mean are squared, their sum is used to correct for rounding errors */
+#define NANACCUM_DEVIATION(T, F)                                                \
+    {                                                                           \
+        const T *xr = (const T *)a->xr + offset;                                \
+        const T *xi = (a->xi ? (const T *)a->xi + offset : NULL);               \
+        if (a->xi == NULL) {                                                    \
+            for (p=0; p<n; p++) {                                               \
+                double d = xr[p] - meanr[p];                                    \
+                int    m = NANACCUM_ISNUM(F, d);                                \
+                ssqr[p] += (m ? d*d : 0.0);                                     \
+                corr[p] += (m ? d   : 0.0);                                     \
+            }                                                                   \
+        } else {                                                                \
+            for (p=0; p<n; p++) {                                               \
+                double d = xr[p] - meanr[p], e = xi[p] - meani[p];              \
+                int    m = NANACCUM_ISNUM(F, d) && NANACCUM_ISNUM(F, e);        \
+                ssqr[p] += (m ? d*d : 0.0);                                     \
+                ssqi[p] += (m ? e*e : 0.0);                                     \
+                corr[p] += (m ? d   : 0.0);                                     \
+                cori[p] += (m ? e   : 0.0);                                     \
+            }                                                                   \
+        }                                                                       \
+    }
+
+/* the reduced dimension is the first one, hence its values are contiguous */
+#define NANACCUM_COLUMN(T, F)                                                   \
+    {                                                                           \
+        const T *xr = (const T *)a->xr + o * a->len;                            \
+        const T *xi = (a->xi ? (const T *)a->xi + o * a->len : NULL);           \
+        double c = 0, sr = 0, si = 0, qr = 0, qi = 0, cr = 0, ci = 0, mr, mi;   \
+        for (k=0; k<a->len; k++) {                                              \
+            double v = xr[k], w = (xi ? xi[k] : 0.0);                           \
+            int    m = NANACCUM_ISNUM(F, v) && NANACCUM_ISNUM(F, w);            \
+            c  += m;                                                            \
+            sr += (m ? v : 0.0);                                                \
+            si += (m ? w : 0.0);                                                \
+        }                                                                       \
+        if (a->ssqr) {                                                          \
+            mr = sr / c;                                                        \
+            mi = si / c;                                                        \
+            for (k=0; k<a->len; k++) {                                          \
+                double d = xr[k] - mr, e = (xi ? xi[k] - mi : 0.0);             \
+                int    m = NANACCUM_ISNUM(F, d) && NANACCUM_ISNUM(F, e);        \
+                qr += (m ? d*d : 0.0);                                          \
+                qi += (m ? e*e : 0.0);                                          \
+                cr += (m ? d   : 0.0);                                          \
+                ci += (m ? e   : 0.0);                                          \
+            }                                                                   \
+            a->ssqr[o] = qr - cr*cr / c;                                        \
+            if (a->ssqi)                                                        \
+                a->ssqi[o] = qi - ci*ci / c;                                    \
+        }                                                                       \
+        a->cnt[o]  = c;                                                         \
+        a->sumr[o] = sr;                                                        \
+        if (a->sumi)                                                            \
+            a->sumi[o] = si;                                                    \
+    }
+
+/* the sums are relative to the first non-NaN value, which is determined on the fly */
+#define NANACCUM_MOMENTS(T, F)                                                  \
+    {                                                                           \
+        const T *xr = (const T *)a->xr + offset;                                \
+        const T *xi = (a->xi ? (const T *)a->xi + offset : NULL);               \
+        for (p=0; p<n; p++) {                                                   \
+            double v = xr[p], w = (xi ? xi[p] : 0.0), d, e;                     \
+            int    m = NANACCUM_ISNUM(F, v) && NANACCUM_ISNUM(F, w);            \
+            shiftr[p] = (m && cnt[p] == 0 ? v : shiftr[p]);                     \
+            shifti[p] = (m && cnt[p] == 0 ? w : shifti[p]);                     \
+            d = (m ? v - shiftr[p] : 0.0);                                      \
+            e = (m ? w - shifti[p] : 0.0);                                      \
+            cnt[p]  += m;                                                       \
+            corr[p] += d;                                                       \
+            cori[p] += e;                                                       \
+            ssqr[p] += d*d;                                                     \
+            ssqi[p] += e*e;                                                     \
+            minr[p]  = (m && v < minr[p] ? v : minr[p]);                        \
+            maxr[p]  = (m && v > maxr[p] ? v : maxr[p]);                        \
+        }                                                                       \
+    }
+
+/* expand the loops for one class of the input, S is appended to the names of the functions */
+#define NANACCUM_KERNEL(S, T, F)                                                \
+    static void nanaccum_row_##S(const nanaccum_t *a, mwSize offset, mwSize n,  \
+                                 double *cnt, double *sumr, double *sumi) {     \
+        mwSize p;                                                               \
+        NANACCUM_ROW(T, F)                                                      \
+    }                                                                           \
+    static void nanaccum_deviation_##S(const nanaccum_t *a, mwSize offset,      \
+                                       mwSize n, const double *meanr,           \
+                                       const double *meani, double *ssqr,       \
+                                       double *ssqi, double *corr,              \
+                                       double *cori) {                          \
+        mwSize p;                                                               \
+        NANACCUM_DEVIATION(T, F)                                                \
+    }                                                                           \
+    static void nanaccum_column_##S(const nanaccum_t *a, mwSize o) {            \
+        mwSize k;                                                               \
+        NANACCUM_COLUMN(T, F)                                                   \
+    }                                                                           \
+    static void nanaccum_moments_##S(const nanaccum_t *a, mwSize offset,        \
+                                     mwSize n, double *cnt,                     \
+                                     nanaccum_tile_t *t) {                      \
+        mwSize p;                                                               \
+        double *shiftr = t->shiftr, *shifti = t->shifti;                        \
+        double *corr = t->corr, *cori = t->cori, *ssqr = t->ssqr;               \
+        double *ssqi = t->ssqi, *minr = t->minr, *maxr = t->maxr;               \
+        NANACCUM_MOMENTS(T, F)                                                  \
+    }                                                                           \
+    static const nanaccum_kernel_t nanaccum_kernel_##S = {                      \
+        nanaccum_row_##S, nanaccum_deviation_##S,                               \
+        nanaccum_column_##S, nanaccum_moments_##S                               \
+    };
+
+NANACCUM_KERNEL(double, double, 1)
+NANACCUM_KERNEL(single, float, 1)
+NANACCUM_KERNEL(int8, int8_T, 0)
+NANACCUM_KERNEL(uint8, uint8_T, 0)
+NANACCUM_KERNEL(int16, int16_T, 0)
+NANACCUM_KERNEL(uint16, uint16_T, 0)
+NANACCUM_KERNEL(int32, int32_T, 0)
+NANACCUM_KERNEL(uint32, uint32_T, 0)
+NANACCUM_KERNEL(int64, int64_T, 0)
+NANACCUM_KERNEL(uint64, uint64_T, 0)
+NANACCUM_KERNEL(logical, mxLogical, 0)
+NANACCUM_KERNEL(char, mxChar, 0)
+
+/* select the loops for the class of the input, this returns NULL for an unsupported class */
+static const nanaccum_kernel_t *nanaccum_kernel(mxClassID classid) {
+    switch (classid) {
+        case mxDOUBLE_CLASS:  return &nanaccum_kernel_double;
+        case mxSINGLE_CLASS:  return &nanaccum_kernel_single;
+        case mxINT8_CLASS:    return &nanaccum_kernel_int8;
+        case mxUINT8_CLASS:   return &nanaccum_kernel_uint8;
+        case mxINT16_CLASS:   return &nanaccum_kernel_int16;
+        case mxUINT16_CLASS:  return &nanaccum_kernel_uint16;
+        case mxINT32_CLASS:   return &nanaccum_kernel_int32;
+        case mxUINT32_CLASS:  return &nanaccum_kernel_uint32;
+        case mxINT64_CLASS:   return &nanaccum_kernel_int64;
+        case mxUINT64_CLASS:  return &nanaccum_kernel_uint64;
+        case mxLOGICAL_CLASS: return &nanaccum_kernel_logical;
+        case mxCHAR_CLASS:    return &nanaccum_kernel_char;
+        default:              return NULL;
+    }
+}
+
+/* process one tile in a single pass, the partial sums are kept on the stack */
+static void nanaccum_onepass(const nanaccum_t *a, mwSize o, mwSize first, mwSize n) {
+    mwSize k, p, offset, out = o * a->inner + first;
+    double *cnt = a->cnt + out;
+    nanaccum_tile_t t;
 
-#ifdef _MSC_VER
-  /* Microsoft doesn't define isnan, but has an _isnan instead. Since it
-   * appears to be buggy, we simply do: */
-  #define isnan(x) !(x == x)
-  #define NAN sqrt(-1)
+    for (p=0; p<n; p++) {
+        t.shiftr[p] = t.shifti[p] = t.corr[p] = t.cori[p] = t.ssqr[p] = t.ssqi[p] = 0.0;
+        t.minr[p]   =  INFINITY;
+        t.maxr[p]   = -INFINITY;
+    }
+
+    for (k=0; k<a->len; k++) {
+        offset = (o * a->len + k) * a->inner + first;
+        a->kernel->moments(a, offset, n, cnt, &t);
+    }
+
+    for (p=0; p<n; p++) {
+        a->sumr[out+p] = t.corr[p] + cnt[p]*t.shiftr[p];
+        if (a->sumi)
+            a->sumi[out+p] = t.cori[p] + cnt[p]*t.shifti[p];
+        if (a->ssqr)
+            a->ssqr[out+p] = t.ssqr[p] - t.corr[p]*t.corr[p] / cnt[p];
+        if (a->ssqi)
+            a->ssqi[out+p] = t.ssqi[p] - t.cori[p]*t.cori[p] / cnt[p];
+        if (a->min)
+            a->min[out+p] = (cnt[p] > 0 ? t.minr[p] : NAN);
+        if (a->max)
+            a->max[out+p] = (cnt[p] > 0 ? t.maxr[p] : NAN);
+    }
+}
+
+/* process one tile of contiguous inner elements for one index in the outer dimension */
+static void nanaccum_unit(const nanaccum_t *a, mwSize unit) {
+    mwSize o = unit / a->ntile;
+    mwSize t = unit % a->ntile;
+    mwSize first = t * NANACCUM_TILE;
+    mwSize n = (a->inner - first < NANACCUM_TILE ? a->inner - first : NANACCUM_TILE);
+    mwSize k, p, offset, out = o * a->inner + first;
+    double *cnt  = a->cnt  + out;
+    double *sumr = a->sumr + out;
+    double *sumi = (a->sumi ? a->sumi + out : NULL);
+    double meanr[NANACCUM_TILE], meani[NANACCUM_TILE], corr[NANACCUM_TILE], cori[NANACCUM_TILE];
+    double *ssqr, *ssqi;
+
+    if (a->onepass) {
+        nanaccum_onepass(a, o, first, n);
+        return;
+    }
+
+    if (a->inner == 1) {
+        a->kernel->column(a, o);
+        return;
+    }
+
+    for (k=0; k<a->len; k++) {
+        offset = (o * a->len + k) * a->inner + first;
+        a->kernel->row(a, offset, n, cnt, sumr, sumi);
+    }
+
+    if (a->ssqr == NULL)
+        return;
+
+    ssqr = a->ssqr + out;
+    ssqi = (a->ssqi ? a->ssqi + out : NULL);
+    for (p=0; p<n; p++) {
+        meanr[p] = sumr[p] / cnt[p];
+        meani[p] = (sumi ? sumi[p] / cnt[p] : 0.0);
+        corr[p]  = 0.0;
+        cori[p]  = 0.0;
+    }
+
+    for (k=0; k<a->len; k++) {
+        offset = (o * a->len + k) * a->inner + first;
+        a->kernel->deviation(a, offset, n, meanr, meani, ssqr, ssqi, corr, cori);
+    }
+
+    for (p=0; p<n; p++) {
+        ssqr[p] -= corr[p]*corr[p] / cnt[p];
+        if (ssqi)
+            ssqi[p] -= cori[p]*cori[p] / cnt[p];
+    }
+}
+
+static void *nanaccum_work(void *arg) {
+    const nanaccum_t *a = (const nanaccum_t *)arg;
+    mwSize unit;
+    for (unit=a->begin; unit<a->end; unit++)
+        nanaccum_unit(a, unit);
+    return NULL;
+}
+
+/* the output arrays should have been allocated and set to zero by the caller */
+static void nanaccum(nanaccum_t *a) {
+    mwSize nunit;
+    int i, nthreads = 1;
+#ifdef NANACCUM_THREADS
+    pthread_t thread[NANACCUM_MAXTHREADS];
+    nanaccum_t part[NANACCUM_MAXTHREADS];
+    int started[NANACCUM_MAXTHREADS];
+#endif
+
+    if (a->inner == 0 || a->outer == 0)
+        return;
+
+    /* the loops for the class of the input are selected once */
+    if (a->classid == mxUNKNOWN_CLASS)
+        a->classid = (a->single ? mxSINGLE_CLASS : mxDOUBLE_CLASS);
+    a->kernel = nanaccum_kernel(a->classid);
+    if (a->kernel == NULL)
+        mexErrMsgTxt("Unsupported class of the input.");
+
+    a->ntile = (a->inner + NANACCUM_TILE - 1) / NANACCUM_TILE;
+    nunit    = a->outer * a->ntile;
+
+#ifdef NANACCUM_THREADS
+    if (a->inner * a->len * a->outer >= NANACCUM_MINSIZE) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = (ncpu > NANACCUM_MAXTHREADS ? NANACCUM_MAXTHREADS : (ncpu < 1 ? 1 : (int)ncpu));
+        if ((mwSize)nthreads > nunit)
+            nthreads = (int)nunit;
+    }
+
+    if (nthreads > 1) {
+        /* note that no MATLAB functions may be called from the threads */
+        for (i=0; i<nthreads; i++) {
+            part[i]       = *a;
+            part[i].begin = (nunit * i) / nthreads;
+            part[i].end   = (nunit * (i+1)) / nthreads;
+            started[i]    = (pthread_create(&thread[i], NULL, nanaccum_work, &part[i]) == 0);
+        }
+        for (i=0; i<nthreads; i++) {
+            if (started[i])
+                pthread_join(thread[i], NULL);
+            else
+                /* do the work of this part in the calling thread */
+                nanaccum_work(&part[i]);
+        }
+        return;
+    }
 #endif
 
+    a->begin = 0;
+    a->end   = nunit;
+    nanaccum_work(a);
+}
+
+/* copy the accumulated values to the output, which is either double or single precision */
+static void nanaccum_copy(void *dest, const double *src, mwSize n, int single) {
+    mwSize i;
+    if (single) {
+        for (i=0; i<n; i++)
+            ((float *)dest)[i] = (float)src[i];
+    } else {
+        memcpy(dest, src, n * sizeof(double));
+    }
+}
+
+/* determine the layout of the input as inner x len x outer, given the dimension to reduce */
+static void nanaccum_layout(nanaccum_t *a, const mwSize *dims, int numdims, mwSize numelin, int dim) {
+    int i;
+    if (dim+1 > numdims) {
+        /* this essentially means that no averaging is done */
+        a->inner = numelin;
+        a->len   = 1;
+        a->outer = 1;
+    } else {
+        a->inner = 1;
+        for (i=0; i<dim; i++)
+            a->inner *= dims[i];
+        a->len   = dims[dim];
+        a->outer = (a->inner * a->len > 0 ? numelin / (a->inner * a->len) : 0);
+    }
+}
 
-/* Shortcuts: */
-#define size(x) mxGetDimensions(x)
-#define ndim(x) mxGetNumberOfDimensions(x)
+#endif /* NANACCUM_H */
@@ -1,36 +1,14 @@
-#include <mex.h>
-#include <stdlib.h>
-#include <string.h>
-#include "compiler.h"
-
-#if defined (COMPILER_MSVC)
-#include <math.h>
-#define isnan _isnan
-#define INFINITY (HUGE_VAL+HUGE_VAL)
-#define NAN (INFINITY - INFINITY)
-#elif defined(COMPILER_LCC)
-#include <math.h>
-#define INFINITY (DBL_MAX+DBL_MAX)
-#define NAN (INFINITY - INFINITY)
-#else
-#include <math.h>
-#endif
-
+#include "nanaccum.h"
 
 void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     /* declare variables */
     const mwSize *dims;
     mwSize *dimsout;
-    mwIndex indx;
-    int i, numdims, dim;
-    int numelin, numelout, x0, x1, y1;
+    int i, numdims, dim, x0;
+    mwSize numelin, numelout;
+    mwIndex j;
     mxClassID classid;
-    
-    /* used with double precision input */
-    double *inputr_p,  *inputi_p,  *output1r_p,  *output1i_p,  *cnt;
-    
-    /* used with single precision input */
-    float  *inputr_ps, *inputi_ps, *output1r_ps, *output1i_ps, *cnts;
+    nanaccum_t a;
 
     /* figure out the classid */
     classid = mxGetClassID(prhs[0]);
@@ -98,148 +76,40 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
         numelout = numelin;
     }
 
-    /* compute helper variables x1 and y1 needed for the indexing */
-    if (dim+1 > numdims) {
-        /* this essentially means that no averaging is done */
-        x1 = numelin;
-        y1 = numelin;
-    } else {
-        x1 = 1;
-        for (i=0; i<numdims+x0; i++) {
-            if (i==dim) {
-                break;
-            }
-
-            x1 = x1 * dims[i];
+    if (classid == mxDOUBLE_CLASS || classid == mxSINGLE_CLASS) {
+        /* accumulate the non-NaN values in double precision */
+        memset(&a, 0, sizeof(a));
+        nanaccum_layout(&a, dims, numdims, numelin, dim);
+        a.xr     = mxGetData(prhs[0]);
+        a.xi     = mxGetImagData(prhs[0]);
+        a.single = (classid == mxSINGLE_CLASS);
+        a.cnt    = mxCalloc(numelout, sizeof(double));
+        a.sumr   = mxCalloc(numelout, sizeof(double));
+        a.sumi   = (a.xi ? mxCalloc(numelout, sizeof(double)) : NULL);
+        nanaccum(&a);
+
+        /* divide by the number of non-nan values per element */
+        for (j=0; j<numelout; j++) {
+            a.sumr[j] = a.sumr[j]/a.cnt[j];
+            if (a.sumi)
+                a.sumi[j] = a.sumi[j]/a.cnt[j];
         }
-        y1 = x1 * dims[dim];
-    }
-
-    if (classid == mxDOUBLE_CLASS) {
-        /* allocate memory for denominator */
-        /* why is this done as the second output argument? not needed, but can't hurt */
-        plhs[1] = mxCreateNumericArray((numdims+x0), dimsout, classid, mxREAL);
-        cnt     = mxGetData(plhs[1]);
-
-        /* associate inputs */
-        inputr_p = mxGetData(prhs[0]);
-        inputi_p = mxGetImagData(prhs[0]);
 
         /* assign the outputs */
-        if (inputi_p == NULL) {
-            plhs[0]    = mxCreateNumericArray((numdims+x0), dimsout, classid, mxREAL);
-            output1r_p = mxGetData(plhs[0]);
-        } else {
-            plhs[0]    = mxCreateNumericArray((numdims+x0), dimsout, classid, mxCOMPLEX);
-            output1r_p = mxGetData(plhs[0]);
-            output1i_p = mxGetImagData(plhs[0]);
-        }
-
-        if (inputi_p == NULL) {
-            /* compute running sum */
-            for (i=0; i<numelin; i++) {
-                if (!isnan(inputr_p[i])) {
-                    indx             = i%x1 + (i/y1) * x1;
-                    output1r_p[indx] = output1r_p[indx] + inputr_p[i];
-                    cnt[indx]        = cnt[indx] + 1.0;
-                } else if (dim+1 > numdims) {
-                    output1r_p[i] = inputr_p[i];
-                }
-
-            }
-
-            /* divide by the number of non-nan values per element */
-            for (i=0; i<numelout; i++) {
-                output1r_p[i] = output1r_p[i]/cnt[i];
-            }
-        } else {
-            /* handle the complex valued case separately */
-            
-            /* compute running sum */
-            for (i=0; i<numelin; i++) {
-                if (!isnan(inputr_p[i]) && !isnan(inputi_p[i])) {
-                    indx             = i%x1 + (i/y1) * x1;
-                    output1r_p[indx] = output1r_p[indx] + inputr_p[i];
-                    output1i_p[indx] = output1i_p[indx] + inputi_p[i];
-                    cnt[indx]  = cnt[indx]  + 1.0;
-                } else if (dim+1>numdims) {
-                    output1r_p[i] = inputr_p[i];
-                    output1i_p[i] = inputi_p[i];
-                }
-            }
-
-            /* divide by the number of non-nan values per element */
-            for (i=0; i<numelout; i++) {
-                output1r_p[i] = output1r_p[i]/cnt[i];
-                output1i_p[i] = output1i_p[i]/cnt[i];
-            }
-        }
+        plhs[0] = mxCreateNumericArray((numdims+x0), dimsout, classid, (a.xi ? mxCOMPLEX : mxREAL));
+        nanaccum_copy(mxGetData(plhs[0]), a.sumr, numelout, a.single);
+        if (a.xi)
+            nanaccum_copy(mxGetImagData(plhs[0]), a.sumi, numelout, a.single);
 
-        /* free memory */
-        mxFree(dimsout);
-
-        return;
-    }
-
-    else if (classid == mxSINGLE_CLASS) {
-        /* allocate memory for denominator */
+        /* the denominator is returned as the second output argument */
         plhs[1] = mxCreateNumericArray((numdims+x0), dimsout, classid, mxREAL);
-        cnts    = mxGetData(plhs[1]);
-
-        /* associate inputs */
-        inputr_ps = mxGetData(prhs[0]);
-        inputi_ps = mxGetImagData(prhs[0]);
-
-        /* assign the outputs */
-        if (inputi_ps == NULL) {
-            plhs[0]     = mxCreateNumericArray((numdims+x0), dimsout, classid, mxREAL);
-            output1r_ps = mxGetData(plhs[0]);
-        } else {
-            plhs[0]     = mxCreateNumericArray((numdims+x0), dimsout, classid, mxCOMPLEX);
-            output1r_ps = mxGetData(plhs[0]);
-            output1i_ps = mxGetImagData(plhs[0]);
-        }
-
-        if (inputi_ps == NULL) {
-            /* compute running sum */
-            for (i=0; i<numelin; i++) {
-                if (!isnan(inputr_ps[i])) {
-                    indx              = i%x1 + (i/y1) * x1;
-                    output1r_ps[indx] = output1r_ps[indx] + inputr_ps[i];
-                    cnts[indx]        = cnts[indx] + 1.0;
-                } else if (dim+1>numdims) {
-                    output1r_ps[i] = inputr_ps[i];
-                }
-            }
-
-            /* divide by the number of non-nan values per element */
-            for (i=0; i<numelout; i++) {
-                output1r_ps[i] = output1r_ps[i]/cnts[i];
-            }
-        } else {
-            /* handle the complex valued case separately */
-            
-            /* compute running sum */
-            for (i=0; i<numelin; i++) {
-                if (!isnan(inputr_ps[i]) && !isnan(inputi_ps[i])) {
-                    indx              = i%x1 + (i/y1) * x1;
-                    output1r_ps[indx] = output1r_ps[indx] + inputr_ps[i];
-                    output1i_ps[indx] = output1i_ps[indx] + inputi_ps[i];
-                    cnts[indx]        = cnts[indx]  + 1.0;
-                } else if (dim+1>numdims) {
-                    output1r_ps[i] = inputr_ps[i];
-                    output1i_ps[i] = inputi_ps[i];
-                }
-            }
-
-            /* divide by the number of non-nan values per element */
-            for (i=0; i<numelout; i++) {
-                output1r_ps[i] = output1r_ps[i]/cnts[i];
-                output1i_ps[i] = output1i_ps[i]/cnts[i];
-            }
-        }
+        nanaccum_copy(mxGetData(plhs[1]), a.cnt, numelout, a.single);
 
         /* free memory */
+        mxFree(a.cnt);
+        mxFree(a.sumr);
+        if (a.sumi)
+            mxFree(a.sumi);
         mxFree(dimsout);
 
         return;
@@ -0,0 +1,190 @@
+#include "nanaccum.h"
+
+/* the number of output arguments determines what is computed */
+#define NUMOUT 6
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+    /* declare variables */
+    const mxArray *x;
+    const mwSize *dims;
+    mwSize *dimsout;
+    int i, numdims, dim, x0;
+    mwSize numelin, numelout;
+    mwIndex j;
+    mxClassID classid, outclass;
+    nanaccum_t a;
+    double biasterm, *mean = NULL, *var = NULL;
+
+    /* check inputs */
+    if (nrhs > 3) {
+        mexErrMsgTxt("Too many input arguments, maximum of 3 supported.");
+    } else if (nrhs < 1) {
+        mexErrMsgTxt("Too few input arguments, at least 1 required.");
+    }
+    if (nlhs > NUMOUT) {
+        mexErrMsgTxt("Too many output arguments.");
+    }
+    if (nrhs >= 2 && !mxIsEmpty(prhs[1])) {
+        if (mxGetM(prhs[1])!=1 || mxGetN(prhs[1])!=1) {
+            mexErrMsgTxt ("Invalid dimension for input argument 2, scalar required.");
+        }
+        if (mxGetScalar(prhs[1])<=0) {
+            mexErrMsgTxt ("Invalid value for input argument 2, positive integer required.");
+        }
+    }
+
+    /* determine the normalisation term of the variance (either N or N-1) */
+    if (nrhs < 3 || mxIsEmpty(prhs[2])) {
+        biasterm = 1.0;
+    } else if (mxGetScalar(prhs[2])==1) {
+        biasterm = 0.0;
+    } else if (mxGetScalar(prhs[2])==0) {
+        biasterm = 1.0;
+    } else {
+        mexErrMsgTxt("Invalid value for third input argument: this should either be [], 0, or 1.");
+    }
+
+    x = prhs[0];
+    if (mxIsEmpty(x)) {
+        for (i=0; i<(nlhs>1 ? nlhs : 1); i++)
+            plhs[i] = mxCreateDoubleScalar(i==1 ? 0 : NAN);
+        return;
+    } else if (!mxIsNumeric(x) && !mxIsLogical(x) && !mxIsChar(x)) {
+        mexErrMsgTxt ("Input argument 1 should be either numeric or logical.");
+    }
+
+    /* the other classes cannot contain NaNs, these are accumulated as they are and the output is double precision */
+    classid  = mxGetClassID(x);
+    outclass = ((classid == mxSINGLE_CLASS) ? mxSINGLE_CLASS : mxDOUBLE_CLASS);
+
+    if (nlhs > 4 && mxIsComplex(x)) {
+        mexErrMsgTxt("The minimum and maximum are not supported for complex input.");
+    }
+
+    /* figure out dimension info and number of elements */
+    dims    = mxGetDimensions(x);
+    numdims = mxGetNumberOfDimensions(x);
+    numelin = mxGetNumberOfElements(x);
+
+    if (nrhs >= 2 && !mxIsEmpty(prhs[1])) {
+        dim = mxGetScalar(prhs[1]) - 1;
+    } else {
+        /* figure out the averaging dimension when it is not specified */
+        dim = 0;
+        for (i=0; i<numdims; i++) {
+            if (dims[i]>1) {
+                dim = i;
+                break;
+            }
+        }
+    }
+
+    /* helper variable needed to kick out the last dimension, if this is the averaging dimension */
+    x0 = 0;
+    if (numdims==dim+1) {
+        x0 = -1;
+    }
+
+    /* create the vector which contains the dimensionality of the output */
+    dimsout = mxMalloc((numdims+x0) * sizeof(mwSize));
+    for (i=0; i<numdims+x0; i++) {
+        dimsout[i] = dims[i];
+    }
+
+    /* make the dimension over which the averaging is done singleton in the output */
+    if (numdims>dim+1) {
+        dimsout[dim] = 1;
+    }
+
+    /* compute the number of output elements */
+    if (numdims>=dim+1) {
+        numelout = numelin / dims[dim];
+    } else {
+        numelout = numelin;
+    }
+
+    /* accumulate everything in a single pass over the input in double precision */
+    memset(&a, 0, sizeof(a));
+    nanaccum_layout(&a, dims, numdims, numelin, dim);
+    a.xr      = mxGetData(x);
+    a.xi      = mxGetImagData(x);
+    a.single  = (classid == mxSINGLE_CLASS);
+    a.classid = classid;
+    a.onepass = 1;
+    a.cnt     = mxCalloc(numelout, sizeof(double));
+    a.sumr    = mxCalloc(numelout, sizeof(double));
+    a.sumi    = (a.xi ? mxCalloc(numelout, sizeof(double)) : NULL);
+    if (nlhs > 3) {
+        a.ssqr = mxCalloc(numelout, sizeof(double));
+        a.ssqi = (a.xi ? mxCalloc(numelout, sizeof(double)) : NULL);
+    }
+    if (nlhs > 4) {
+        a.min  = mxCalloc(numelout, sizeof(double));
+        a.max  = (nlhs > 5 ? mxCalloc(numelout, sizeof(double)) : NULL);
+    }
+    nanaccum(&a);
+
+    /* the outputs have the same precision as the input */
+    plhs[0] = mxCreateNumericArray((numdims+x0), dimsout, outclass, (a.xi ? mxCOMPLEX : mxREAL));
+    nanaccum_copy(mxGetData(plhs[0]), a.sumr, numelout, a.single);
+    if (a.xi)
+        nanaccum_copy(mxGetImagData(plhs[0]), a.sumi, numelout, a.single);
+
+    if (nlhs > 1) {
+        plhs[1] = mxCreateNumericArray((numdims+x0), dimsout, outclass, mxREAL);
+        nanaccum_copy(mxGetData(plhs[1]), a.cnt, numelout, a.single);
+    }
+
+    if (nlhs > 2) {
+        /* the mean is computed in place, the sum has already been copied */
+        mean = a.sumr;
+        for (j=0; j<numelout; j++) {
+            mean[j] = a.sumr[j]/a.cnt[j];
+            if (a.sumi)
+                a.sumi[j] = a.sumi[j]/a.cnt[j];
+        }
+        plhs[2] = mxCreateNumericArray((numdims+x0), dimsout, outclass, (a.xi ? mxCOMPLEX : mxREAL));
+        nanaccum_copy(mxGetData(plhs[2]), mean, numelout, a.single);
+        if (a.xi)
+            nanaccum_copy(mxGetImagData(plhs[2]), a.sumi, numelout, a.single);
+    }
+
+    if (nlhs > 3) {
+        /* for complex input this is the sum of the variance of the real and imaginary part */
+        var = a.ssqr;
+        for (j=0; j<numelout; j++) {
+            if (a.ssqi)
+                var[j] = var[j] + a.ssqi[j];
+            var[j] = var[j]/(a.cnt[j] - biasterm);
+        }
+        plhs[3] = mxCreateNumericArray((numdims+x0), dimsout, outclass, mxREAL);
+        nanaccum_copy(mxGetData(plhs[3]), var, numelout, a.single);
+    }
+
+    if (nlhs > 4) {
+        plhs[4] = mxCreateNumericArray((numdims+x0), dimsout, outclass, mxREAL);
+        nanaccum_copy(mxGetData(plhs[4]), a.min, numelout, a.single);
+    }
+
+    if (nlhs > 5) {
+        plhs[5] = mxCreateNumericArray((numdims+x0), dimsout, outclass, mxREAL);
+        nanaccum_copy(mxGetData(plhs[5]), a.max, numelout, a.single);
+    }
+
+    /* free memory */
+    mxFree(a.cnt);
+    mxFree(a.sumr);
+    if (a.sumi)
+        mxFree(a.sumi);
+    if (a.ssqr)
+        mxFree(a.ssqr);
+    if (a.ssqi)
+        mxFree(a.ssqi);
+    if (a.min)
+        mxFree(a.min);
+    if (a.max)
+        mxFree(a.max);
+    mxFree(dimsout);
+
+    return;
+}
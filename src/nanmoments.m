@@ -0,0 +1,63 @@
+function [s, n, m, v, mn, mx] = nanmoments(x, dim, flag)
+
+% NANMOMENTS computes the sum, the number of non-NaN values, the mean, the
+% variance, the minimum and the maximum of the non-NaN values along one
+% dimension in a single pass over the data.
+%
+% Use as
+%   [s, n, m, v, mn, mx] = nanmoments(x, dim, flag)
+% where dim is the dimension along which the statistics are computed (default is
+% the first non-singleton dimension) and flag specifies the normalisation of the
+% variance, 0 for N-1 (default) or 1 for N. For complex input the variance is the
+% sum of the variance of the real and imaginary part, the minimum and maximum are
+% not supported.
+%
+% The outputs are single precision for single input, and double precision for
+% all other classes. This is the MATLAB implementation, the mex file is much
+% faster.
+%
+% See also NANSUM, NANMEAN, NANVAR, NANSTD
+
+if isempty(x)
+  s = NaN; n = 0; m = NaN; v = NaN; mn = NaN; mx = NaN;
+  return
+end
+
+if nargin < 2 || isempty(dim)
+  dim = find(size(x)~=1, 1, 'first');
+  if isempty(dim)
+    dim = 1;
+  end
+end
+
+if nargin < 3 || isempty(flag)
+  flag = 0;
+end
+
+if ~isfloat(x)
+  x = double(x);
+end
+
+sel = isnan(x);
+n   = cast(sum(~sel, dim), class(x));
+x(sel) = 0;
+s   = sum(x, dim);
+m   = s ./ n;
+
+if nargout>3
+  d = bsxfun(@minus, x, m);
+  d(sel) = 0;
+  v = sum(real(d).^2 + imag(d).^2, dim) ./ (n - (flag==0));
+end
+
+if nargout>4
+  if ~isreal(x)
+    error('the minimum and maximum are not supported for complex input');
+  end
+  y = x; y(sel) = inf;
+  mn = min(y, [], dim);
+  y = x; y(sel) = -inf;
+  mx = max(y, [], dim);
+  mn(n==0) = NaN;
+  mx(n==0) = NaN;
+end
@@ -1,35 +1,19 @@
-#include <mex.h>
-#include <stdlib.h>
-#include <string.h>
-#include "compiler.h"
-
-#if defined (COMPILER_MSVC)
-#include <math.h>
-#define isnan _isnan
-#define INFINITY (HUGE_VAL+HUGE_VAL)
-#define NAN (INFINITY - INFINITY)
-#elif defined(COMPILER_LCC)
-#include <math.h>
-#define INFINITY (DBL_MAX+DBL_MAX)
-#define NAN (INFINITY - INFINITY)
-#else
-#include <math.h>
-#endif
+#include "nanaccum.h"
 
 void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     /* declare variables */
     const mwSize *dims;
     mwSize *dimsout;
-    mwIndex indx;
-    int i, numdims, dim;
-    int numelin, numelout, x0, x1, y1;
+    int i, numdims, dim, x0;
+    mwSize numelin, numelout;
+    mwIndex j;
     mxClassID classid;
+    nanaccum_t a;
+    double bias;
     
-    /* used with double precision input */
-    double *inputr_p,  *inputi_p,  *output1r_p,  *cnt,  *ssqr,  *ssqi,  *sumi,  biasterm;
-    
-    /* used with single precision input */
-    float  *inputr_ps, *inputi_ps, *output1r_ps, *cnts, *ssqrs, *ssqis, *sumis, biasterms;
+    /* normalisation term, in double and single precision */
+    double biasterm  = 1.0;
+    float  biasterms = 1.0;
 
     /* figure out the classid */
     classid = mxGetClassID(prhs[0]);
@@ -125,214 +109,55 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
         numelout = numelin;
     }
 
-    /* compute helper variables x1 and y1 needed for the indexing */
-    if (dim+1>numdims)
-        /* this essentially means that no averaging is done */
-    {
-        x1 = numelin;
-        y1 = numelin;
-    } else {
-        x1 = 1;
-        for (i=0; i<numdims+x0; i++) {
-            if (i==dim) {
-                break;
-            }
-
-            x1 = x1 * dims[i];
-        }
-        y1 = x1 * dims[dim];
-    }
-
-    if (classid==mxDOUBLE_CLASS) {
-        /* allocate memory for denominator */
+    if (classid == mxDOUBLE_CLASS || classid == mxSINGLE_CLASS) {
+        /* accumulate the non-NaN values in double precision */
+        memset(&a, 0, sizeof(a));
+        nanaccum_layout(&a, dims, numdims, numelin, dim);
+        a.xr     = mxGetData(prhs[0]);
+        a.xi     = mxGetImagData(prhs[0]);
+        a.single = (classid == mxSINGLE_CLASS);
+        a.cnt    = mxCalloc(numelout, sizeof(double));
+        a.sumr   = mxCalloc(numelout, sizeof(double));
+        a.sumi   = (a.xi ? mxCalloc(numelout, sizeof(double)) : NULL);
+        a.ssqr   = mxCalloc(numelout, sizeof(double));
+        a.ssqi   = (a.xi ? mxCalloc(numelout, sizeof(double)) : NULL);
+        nanaccum(&a);
+
+        /* the sum of squares and the imaginary mean are returned as additional output arguments */
         plhs[1] = mxCreateNumericArray((numdims+x0), dimsout, classid, mxREAL);
-        cnt     = mxGetData(plhs[1]);
-
-        /* associate inputs */
-        inputr_p = mxGetData(prhs[0]);
-        inputi_p = mxGetImagData(prhs[0]);
-
-        /* assign the outputs */
-        if (inputi_p == NULL) {
-            plhs[0]    = mxCreateNumericArray((numdims+x0), dimsout, classid, mxREAL);
-            output1r_p = mxGetData(plhs[0]);
-            plhs[2]    = mxCreateNumericArray((numdims+x0), dimsout, classid, mxREAL);
-            ssqr       = mxGetData(plhs[2]);
-        } else {
-            plhs[0]    = mxCreateNumericArray((numdims+x0), dimsout, classid, mxREAL);
-            output1r_p = mxGetData(plhs[0]);
-            plhs[2]    = mxCreateNumericArray((numdims+x0), dimsout, classid, mxCOMPLEX);
-            ssqr       = mxGetData(plhs[2]);
-            ssqi       = mxGetImagData(plhs[2]);
-            plhs[3]    = mxCreateNumericArray((numdims+x0), dimsout, classid, mxREAL);
-            sumi       = mxGetData(plhs[3]);
+        nanaccum_copy(mxGetData(plhs[1]), a.cnt, numelout, a.single);
+        plhs[2] = mxCreateNumericArray((numdims+x0), dimsout, classid, (a.xi ? mxCOMPLEX : mxREAL));
+        nanaccum_copy(mxGetData(plhs[2]), a.ssqr, numelout, a.single);
+        if (a.xi) {
+            nanaccum_copy(mxGetImagData(plhs[2]), a.ssqi, numelout, a.single);
+            for (j=0; j<numelout; j++)
+                a.sumi[j] = a.sumi[j]/a.cnt[j];
+            plhs[3] = mxCreateNumericArray((numdims+x0), dimsout, classid, mxREAL);
+            nanaccum_copy(mxGetData(plhs[3]), a.sumi, numelout, a.single);
         }
 
-        if (inputi_p == NULL) { /* input data is real-valued */
-            
-            /* compute variance using 'online' algorithm */
-            /* Knuth (1998). The Art of Computer Programming, volume 2: Seminumerical Algorithms, 3rd edn., p. 232. */
-            double delta;
-            for (i=0; i<numelin; i++) {
-                if (!isnan(inputr_p[i])) {
-                    indx             = i%x1 + (i/y1) * x1;
-                    cnt[indx]        = cnt[indx]        + 1.0;
-                    
-                    delta = inputr_p[i] - output1r_p[indx];
-                    output1r_p[indx] = output1r_p[indx] + delta/cnt[indx];
-                    ssqr[indx]       = ssqr[indx] + delta*(inputr_p[i] - output1r_p[indx]);
-                    
-                } else if (dim+1>numdims) {
-                    output1r_p[i] = inputr_p[i];
-                    ssqr[i]       = inputr_p[i]*inputr_p[i];
-                    cnt[i]        = 1.0;
-                }
-
-            }
-            
-            /* compute the variance */
-            for (i=0; i<numelout; i++) {
-                output1r_p[i] = sqrt(ssqr[i]/(cnt[i] - biasterm));
-            }
-
-            
-        } else
-            /* handle the complex valued case separately */
-        {
-        
-            /* compute variance using 'online' algorithm */
-            /* Knuth (1998). The Art of Computer Programming, volume 2: Seminumerical Algorithms, 3rd edn., p. 232. */
-            double delta;
-            for (i=0; i<numelin; i++) {
-                if (!isnan(inputr_p[i]) && !isnan(inputi_p[i])) {
-                    indx             = i%x1 + (i/y1) * x1;
-                    cnt[indx]        = cnt[indx]        + 1.0;
-                    
-                    delta = inputr_p[i] - output1r_p[indx];
-                    output1r_p[indx] = output1r_p[indx] + delta/cnt[indx];
-                    ssqr[indx] = ssqr[indx] + delta*(inputr_p[i] - output1r_p[indx]);
-                    
-                    delta = inputi_p[i] - sumi[indx];
-                    sumi[indx] = sumi[indx] + delta/cnt[indx];
-                    ssqi[indx] = ssqi[indx] + delta*(inputi_p[i] - sumi[indx]);
-                    
-                } else if (dim+1>numdims) {
-                    output1r_p[i] = inputr_p[i];
-                    sumi[i] = inputi_p[i];
-                    ssqr[i]       = inputr_p[i]*inputr_p[i];
-                    ssqi[i]       = inputi_p[i]*inputi_p[i];
-                    cnt[i]        = 1.0;
-                }
-
-            }
-            
-            /* compute the variance */
-            for (i=0; i<numelout; i++) {
-                output1r_p[i] = sqrt((ssqr[i] + ssqi[i])/(cnt[i] - biasterm));
-            }
+        /* compute the standard deviation */
+        bias = (a.single ? biasterms : biasterm);
+        for (j=0; j<numelout; j++) {
+            if (a.ssqi)
+                a.ssqr[j] = a.ssqr[j] + a.ssqi[j];
+            a.ssqr[j] = sqrt(a.ssqr[j]/(a.cnt[j] - bias));
         }
+        plhs[0] = mxCreateNumericArray((numdims+x0), dimsout, classid, mxREAL);
+        nanaccum_copy(mxGetData(plhs[0]), a.ssqr, numelout, a.single);
 
         /* free memory */
+        mxFree(a.cnt);
+        mxFree(a.sumr);
+        if (a.sumi)
+            mxFree(a.sumi);
+        mxFree(a.ssqr);
+        if (a.ssqi)
+            mxFree(a.ssqi);
         mxFree(dimsout);
 
         return;
-    }
-
-    else if (classid==mxSINGLE_CLASS) {
-        /* allocate memory for denominator */
-        plhs[1] = mxCreateNumericArray((numdims+x0), dimsout, classid, mxREAL);
-        cnts    = mxGetData(plhs[1]);
-
-        /* associate inputs */
-        inputr_ps = mxGetData(prhs[0]);
-        inputi_ps = mxGetImagData(prhs[0]);
-
-        /* assign the outputs */
-        if (inputi_ps == NULL) {
-            plhs[0]     = mxCreateNumericArray((numdims+x0), dimsout, classid, mxREAL);
-            output1r_ps = mxGetData(plhs[0]);
-            plhs[2]     = mxCreateNumericArray((numdims+x0), dimsout, classid, mxREAL);
-            ssqrs       = mxGetData(plhs[2]);
-        } else {
-            plhs[0]     = mxCreateNumericArray((numdims+x0), dimsout, classid, mxREAL);
-            output1r_ps = mxGetData(plhs[0]);
-            plhs[2]     = mxCreateNumericArray((numdims+x0), dimsout, classid, mxCOMPLEX);
-            ssqrs       = mxGetData(plhs[2]);
-            ssqis       = mxGetImagData(plhs[2]);
-            plhs[3]     = mxCreateNumericArray((numdims+x0), dimsout, classid, mxREAL);
-            sumis       = mxGetData(plhs[3]);
-        }
-
-        if (inputi_ps == NULL) { /* real-valued input data */
-        
-            /* compute variance using 'online' algorithm */
-            /* Knuth (1998). The Art of Computer Programming, volume 2: Seminumerical Algorithms, 3rd edn., p. 232. */
-            double delta;
-            for (i=0; i<numelin; i++) {
-                if (!isnan(inputr_ps[i])) {
-                    indx             = i%x1 + (i/y1) * x1;
-                    cnts[indx]        = cnts[indx]        + 1.0;
-                    
-                    delta = inputr_ps[i] - output1r_ps[indx];
-                    output1r_ps[indx] = output1r_ps[indx] + delta/cnts[indx];
-                    ssqrs[indx]       = ssqrs[indx] + delta*(inputr_ps[i] - output1r_ps[indx]);
-                    
-                } else if (dim+1>numdims) {
-                    output1r_ps[i] = inputr_ps[i];
-                    ssqrs[i]       = inputr_ps[i]*inputr_ps[i];
-                    cnts[i]        = 1.0;
-                }
-
-            }
-            
-            /* compute the variance */
-            for (i=0; i<numelout; i++) {
-                output1r_ps[i] = sqrt(ssqrs[i]/(cnts[i] - biasterms));
-            }
-            
-        } else
-            /* handle the complex valued case separately */
-        {
-        
-            /* compute variance using 'online' algorithm */
-            /* Knuth (1998). The Art of Computer Programming, volume 2: Seminumerical Algorithms, 3rd edn., p. 232. */
-            double delta;
-            for (i=0; i<numelin; i++) {
-                if (!isnan(inputr_ps[i]) && !isnan(inputi_ps[i])) {
-                    indx             = i%x1 + (i/y1) * x1;
-                    cnts[indx]        = cnts[indx]        + 1.0;
-                    
-                    delta = inputr_ps[i] - output1r_ps[indx];
-                    output1r_ps[indx] = output1r_ps[indx] + delta/cnts[indx];
-                    ssqrs[indx] = ssqrs[indx] + delta*(inputr_ps[i] - output1r_ps[indx]);
-                    
-                    delta = inputi_ps[i] - sumis[indx];
-                    sumis[indx] = sumis[indx] + delta/cnts[indx];
-                    ssqis[indx] = ssqis[indx] + delta*(inputi_ps[i] - sumis[indx]);
-                    
-                } else if (dim+1>numdims) {
-                    output1r_ps[i] = inputr_ps[i];
-                    sumis[i] = inputi_ps[i];
-                    ssqrs[i]       = inputr_ps[i]*inputr_ps[i];
-                    ssqis[i]       = inputi_ps[i]*inputi_ps[i];
-                    cnts[i]        = 1.0;
-                }
-
-            }
-            
-            /* compute the variance */
-            for (i=0; i<numelout; i++) {
-                output1r_ps[i] = sqrt((ssqrs[i] + ssqis[i])/(cnts[i] - biasterms));
-            }
-        }
-
-        /* free memory */
-        mxFree(dimsout);
-
-        return;
-    }
-
-    else {
+    } else {
         /* we now at this point the input data is either numeric, char, or logical, but not double or single precision */
         /* since only double or single can be NaN, simply call matlab's std() function to do the work, we can safely ignore nans */
         mexCallMATLAB(nlhs, plhs, nrhs, prhs, "std");
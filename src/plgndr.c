@@ -101,23 +101,73 @@ double plgndr(int l, int m, double x)
   return result;
 }
 
+#define TILE 256   /* number of values for which the recurrence is done together */
+
+/*
+ * Compute P(l,m) for many values of x. The upward recurrence is done for a tile
+ * of values at once, the independent loops over the values can be vectorized.
+ * This gives the same result as calling plgndr for each value.
+ */
+static void plgndr_array(int l, int m, const double *x, double *p, mwSize n)
+{
+  double p_ellm2[TILE], p_ellm1[TILE], p_ell;
+  mwSize b, i, nt;
+  int ell;
+
+  for (b=0; b<n; b+=TILE)
+  {
+    nt = (n-b<TILE ? n-b : TILE);
+    for (i=0; i<nt; i++)
+    {
+      p_ellm2[i] = legendre_Pmm(m, x[b+i]);
+      p_ellm1[i] = x[b+i] * (2*m + 1) * p_ellm2[i];
+    }
+    if (l == m)
+    {
+      for (i=0; i<nt; i++)
+        p[b+i] = p_ellm2[i];
+      continue;
+    }
+    for (ell=m+2; ell <= l; ell++)
+      for (i=0; i<nt; i++)
+      {
+        p_ell = (x[b+i]*(2*ell-1)*p_ellm1[i] - (ell+m-1)*p_ellm2[i]) / (ell-m);
+        p_ellm2[i] = p_ellm1[i];
+        p_ellm1[i] = p_ell;
+      }
+    for (i=0; i<nt; i++)
+      p[b+i] = p_ellm1[i];
+  }
+}
+
 void
 mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 {
   int l, m;
-  double x;
+  const double *x;
   double *pd;
+  mwSize i, n;
   
   if (nrhs != 3)
     mexErrMsgTxt ("invalid number of arguments for PLGNDR");
+  if (!mxIsDouble(prhs[2]) || mxIsComplex(prhs[2]))
+    mexErrMsgTxt ("invalid type of argument x for PLGNDR");
   
   l = mxGetScalar (prhs[0]);
   m = mxGetScalar (prhs[1]);
-  x = mxGetScalar (prhs[2]);
   
-  plhs[0] = mxCreateDoubleMatrix (1, 1, mxREAL);
+  /* x can be an array, the output has the same size */
+  x = mxGetData (prhs[2]);
+  n = mxGetNumberOfElements (prhs[2]);
+  if (m < 0 || m > l)
+    mexErrMsgTxt ("Bad arguments in routine plgndr");
+  for (i=0; i<n; i++)
+    if (fabs(x[i]) > 1.0)
+      mexErrMsgTxt ("Bad arguments in routine plgndr");
+  
+  plhs[0] = mxCreateNumericArray (mxGetNumberOfDimensions(prhs[2]), mxGetDimensions(prhs[2]), mxDOUBLE_CLASS, mxREAL);
   pd = mxGetData (plhs[0]);
-  pd[0] = plgndr(l, m, x);
+  plgndr_array(l, m, x, pd, n);
   
   return;
 }
@@ -3,7 +3,8 @@ function [varargout] = plgndr(varargin)
 % PLGNDR associated Legendre function
 %
 % y = plgndr(n,k,x) computes the values of the associated Legendre functions
-% of degree N and order K
+% of degree N and order K. The input x can be an array, in which case y has
+% the same size.
 %
 % implemented as MEX file
 
@@ -1,7 +1,11 @@
+#define _LARGEFILE_SOURCE
+#define _FILE_OFFSET_BITS 64
+
 #include <math.h>
 #include <string.h>
 #include "mex.h"
 #include <stdio.h>
+#include "read_nbit.h"
 
 /*
  * Copyright (C) 2008, Robert Oostenveld, F.C. Donders Ccentre for Cognitive Neuroimaging
@@ -35,6 +39,13 @@ mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
   short int *buf;
   long int offset, numwords, fnlen, i, j, num, b1, b2, b3;
   
+  if (nrhs > 3)
+  {
+    /* read a selection of channels and samples from the data records */
+    plhs[0] = read_nbit(2, nrhs, prhs);
+    return;
+  }
+  
   if (nrhs != 3)
     mexErrMsgTxt ("Invalid number of input arguments");
   
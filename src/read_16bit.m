@@ -7,6 +7,17 @@ function [varargout] = read_16bit(varargin)
 % Use as
 %   [dat] = read_16bit(filename, offset, numwords);
 %
+% or to read a selection of channels and samples from the data records as
+%   [dat] = read_16bit(filename, offset, spr, chanindx, begsample, endsample, class);
+% where offset is the position of the first data record in bytes, spr is a vector
+% with the number of samples per record of each channel in the file, chanindx are
+% the indices of the channels to be read, which should all have the same number of
+% samples per record, and begsample and endsample specify the samples to be read.
+% The output is Nchan x Nsamples and of the specified class, which can be
+% double, single, int32 or int16 (default is double). Only the selected records are mapped into
+% memory, only the selected samples are converted and this is distributed over
+% multiple threads.
+%
 % See also READ_24BIT
 
 % Copyright (C) 2007, Robert Oostenveld
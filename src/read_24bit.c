@@ -27,11 +27,13 @@
  */
 
 #define _LARGEFILE_SOURCE
+#define _FILE_OFFSET_BITS 64
 
 #include <math.h>
 #include <sys/types.h>
 #include "mex.h"
 #include <stdio.h>
+#include "read_nbit.h"
 
 #if defined(_WIN32) || defined(_WIN64)
 #define int32_t INT32_T
@@ -55,6 +57,13 @@ mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
   size_t  num, numwords;
   off_t   offset;
   
+  if (nrhs > 3)
+  {
+    /* read a selection of channels and samples from the data records */
+    plhs[0] = read_nbit(3, nrhs, prhs);
+    return;
+  }
+  
   if (nrhs != 3)
     mexErrMsgTxt ("Invalid number of input arguments");
   
@@ -8,6 +8,20 @@
  * or
  *   [data] = read_ctf_shm(msgNumber);
  *   [data] = read_ctf_shm(msgNumber, numValues);
+ * or to read all packets that were written since the previous call
+ *   [msgType msgId sampleNumber numSamples numChannels data] = read_ctf_shm('next');
+ *   [msgType msgId sampleNumber numSamples numChannels data] = read_ctf_shm('next', maxPackets, consume);
+ *   read_ctf_shm('reset');
+ *
+ * The shared memory segment remains attached between calls and is detached
+ * when the mex file is cleared. The 'next' call starts at the packet that
+ * follows the last packet that was returned and continues along the ring of
+ * packets until it finds a packet that is invalid or that it has already
+ * returned. The data of all returned packets is concatenated into a single
+ * int32 vector, packet i contributing numSamples(i)*numChannels(i) values.
+ * If consume is true, the returned packets are marked as invalid, as the
+ * acquisition software expects from its client. The cursor is reset to the
+ * first packet with 'reset'.
  *
  * Copyright (C) 2007, Robert Oostenveld
  *
@@ -24,6 +38,7 @@
 #define ACQ_MSGQ_SHMKEY    0x39457f73
 #define ACQ_MSGQ_SHMPROJID 12345
 #define ACQ_MSGQ_SHMPATH   "/opt/ctf/bin/Acq"
+#define ACQ_BUFFER_SIZE    28160
 
 typedef enum
 {
@@ -40,17 +55,31 @@ typedef struct
   int sampleNumber;
   int numSamples;
   int numChannels;
-  int data[28160];
+  int data[ACQ_BUFFER_SIZE];
 } ACQ_MessagePacketType;
 
-void
-mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
+/* the attachment and the cursor persist between calls */
+static ACQ_MessagePacketType *packet = NULL;
+static int cursor = 0;
+static int returned[ACQ_MSGQ_SIZE];   /* whether the packet has been returned */
+static int returnedId[ACQ_MSGQ_SIZE]; /* the message id when it was returned */
+
+static void
+detach (void)
+{
+  if (packet)
+    shmdt(packet);
+  packet = NULL;
+}
+
+static void
+attach (void)
 {
   key_t key;
-  ACQ_MessagePacketType *packet;
-  int *msgType, *msgId, *sampleNumber, *numSamples, *numChannels;
-  int shmid, shmsize, i;
-  int numValues = 28160;
+  int shmid, shmsize;
+
+  if (packet)
+    return;
 
   shmsize = sizeof(ACQ_MessagePacketType) * ACQ_MSGQ_SIZE;
 
@@ -70,8 +99,96 @@ mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 
   /* attach to the segment to get a pointer to it */
   packet = shmat(shmid, (void *)0, 0);
-  if ((char *)packet == (char *)(-1))
+  if ((char *)packet == (char *)(-1)) {
+    packet = NULL;
     mexErrMsgTxt("shmat");
+  }
+
+  mexAtExit(detach);
+}
+
+/* return the packets that follow the cursor and that have not been returned yet */
+static void
+readnext (int nlhs, mxArray * plhs[], int maxPackets, int consume)
+{
+  int *msgType, *msgId, *sampleNumber, *numSamples, *numChannels, *data;
+  int i, k, n, num, numPackets = 0, numValues = 0;
+
+  /* determine the packets that are new */
+  for (k=0; k<maxPackets && k<ACQ_MSGQ_SIZE; k++) {
+    i = (cursor + k) % ACQ_MSGQ_SIZE;
+    if (packet[i].message_type == ACQ_MSGQ_INVALID)
+      break;
+    if (returned[i] && returnedId[i] == packet[i].messageId)
+      break;
+    num = packet[i].numSamples * packet[i].numChannels;
+    numValues += (num<0 ? 0 : (num>ACQ_BUFFER_SIZE ? ACQ_BUFFER_SIZE : num));
+    numPackets++;
+  }
+
+  plhs[0] = mxCreateNumericMatrix(1, numPackets, mxINT32_CLASS, mxREAL);
+  plhs[1] = mxCreateNumericMatrix(1, numPackets, mxINT32_CLASS, mxREAL);
+  plhs[2] = mxCreateNumericMatrix(1, numPackets, mxINT32_CLASS, mxREAL);
+  plhs[3] = mxCreateNumericMatrix(1, numPackets, mxINT32_CLASS, mxREAL);
+  plhs[4] = mxCreateNumericMatrix(1, numPackets, mxINT32_CLASS, mxREAL);
+  plhs[5] = mxCreateNumericMatrix(1, (nlhs>5 ? numValues : 0), mxINT32_CLASS, mxREAL);
+
+  msgType      = mxGetData(plhs[0]);
+  msgId        = mxGetData(plhs[1]);
+  sampleNumber = mxGetData(plhs[2]);
+  numSamples   = mxGetData(plhs[3]);
+  numChannels  = mxGetData(plhs[4]);
+  data         = mxGetData(plhs[5]);
+
+  /* copy the packets into a single block */
+  n = 0;
+  for (k=0; k<numPackets; k++) {
+    i = (cursor + k) % ACQ_MSGQ_SIZE;
+    msgType[k]      = (int)(packet[i].message_type);
+    msgId[k]        = packet[i].messageId;
+    sampleNumber[k] = packet[i].sampleNumber;
+    numSamples[k]   = packet[i].numSamples;
+    numChannels[k]  = packet[i].numChannels;
+    if (nlhs>5) {
+      num = numSamples[k] * numChannels[k];
+      num = (num<0 ? 0 : (num>ACQ_BUFFER_SIZE ? ACQ_BUFFER_SIZE : num));
+      memcpy(data+n, packet[i].data, num*sizeof(int));
+      n += num;
+    }
+    returned[i]   = 1;
+    returnedId[i] = packet[i].messageId;
+    if (consume)
+      packet[i].message_type = ACQ_MSGQ_INVALID;
+  }
+  cursor = (cursor + numPackets) % ACQ_MSGQ_SIZE;
+}
+
+void
+mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
+{
+  int *msgType, *msgId, *sampleNumber, *numSamples, *numChannels;
+  int i, maxPackets, consume;
+  int numValues = ACQ_BUFFER_SIZE;
+  char command[16];
+
+  attach();
+
+  if (nrhs>0 && mxIsChar(prhs[0])) {
+    if (mxGetString(prhs[0], command, sizeof(command))!=0)
+      mexErrMsgTxt("Invalid command");
+    if (strcmp(command, "reset")==0) {
+      cursor = 0;
+      memset(returned, 0, sizeof(returned));
+    }
+    else if (strcmp(command, "next")==0) {
+      maxPackets = (nrhs>1 ? (int)mxGetScalar(prhs[1]) : ACQ_MSGQ_SIZE);
+      consume    = (nrhs>2 ? (mxGetScalar(prhs[2])!=0) : 0);
+      readnext(nlhs, plhs, maxPackets, consume);
+    }
+    else
+      mexErrMsgTxt("Invalid command");
+    return;
+  }
 
   if (nrhs==0) {
     /* read the meta information from all packets */
@@ -98,8 +215,8 @@ mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
   else {
     if (nrhs==2) {
       numValues = (int)mxGetScalar(prhs[1]);
-      numValues = ( numValues>28160 ? 28160 : numValues );  /* check boundary */
-      numValues = ( numValues<0     ? 0     : numValues );  /* check boundary */
+      numValues = ( numValues>ACQ_BUFFER_SIZE ? ACQ_BUFFER_SIZE : numValues );  /* check boundary */
+      numValues = ( numValues<0               ? 0               : numValues );  /* check boundary */
     }
 
     /* read the data from the selected packet */
@@ -113,9 +230,4 @@ mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
     memcpy(mxGetData(plhs[0]), packet[i].data, numValues*sizeof(int));
   }
 
-  /* detach from the segment */
-  if (shmdt(packet) == -1)
-    mexErrMsgTxt("shmdt");
-
 } /* end of mexFunction */
-
@@ -9,6 +9,17 @@ function [varargout] = read_ctf_shm(varargin)
 % or
 %   [data] = read_ctf_shm(msgNumber);
 %   [data] = read_ctf_shm(msgNumber, numValues);
+% or to read all packets that were written since the previous call
+%   [msgType msgId sampleNumber numSamples numChannels data] = read_ctf_shm('next');
+%   [msgType msgId sampleNumber numSamples numChannels data] = read_ctf_shm('next', maxPackets, consume);
+%   read_ctf_shm('reset');
+%
+% The shared memory remains attached between calls. The 'next' call continues
+% along the ring of packets from where the previous call stopped, up to the first
+% packet that is invalid or that was already returned, and returns the data of all
+% new packets concatenated in a single int32 vector. If consume is true, these
+% packets are marked as invalid. The 'reset' call moves the cursor to the first
+% packet.
 %
 % See also WRITE_CTF_SHM
 
@@ -0,0 +1,330 @@
+/*
+ * Copyright (C) 2017, Robert Oostenveld, Donders Centre for Cognitive Neuroimaging
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *
+ * $Id$
+ */
+
+/*
+ * This implements reading a selection of channels and samples from the data records of an
+ * EDF (16 bit) or BDF (24 bit) file. Each data record contains the samples of all channels,
+ * channel after channel, and the words are little-endian. Only the records that contain the
+ * selected samples are mapped into memory, and only the selected words are converted. The
+ * records are divided over multiple threads, which write directly into the output array.
+ *
+ * It should be included after defining _LARGEFILE_SOURCE and _FILE_OFFSET_BITS.
+ */
+
+#ifndef READ_NBIT_H
+#define READ_NBIT_H
+
+#include <string.h>
+#include "mex.h"
+#include "platform.h"
+
+#if defined(PLATFORM_WINDOWS)
+#include <stdio.h>
+#include <stdint.h>
+#else
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#define READ_NBIT_THREADS
+#endif
+
+#define READ_NBIT_MAXTHREADS 16
+#define READ_NBIT_MINSIZE    (1<<20)  /* number of bytes below which a single thread is used */
+
+typedef struct {
+  const unsigned char *buf;   /* the first record that is read */
+  int wordsize;               /* 2 or 3 bytes */
+  mwSize recwords;            /* number of words in each record */
+  mwSize spr;                 /* number of samples per record of the selected channels */
+  const mwSize *chanoff;      /* offset in words of each selected channel within the record */
+  mwSize nchan;               /* number of selected channels */
+  mwSize begsample, nsample;  /* the selected samples, zero-based and relative to the first record that is read */
+  mxClassID classid;
+  void *dat;                  /* output, nchan x nsample */
+  mwSize begin, end;          /* the records that are converted by this thread, relative to the first record */
+} read_nbit_t;
+
+/* the 16 and 24 bit words are sign-extended with a shift, this has no branches and can be vectorized */
+static inline int32_t
+read_nbit_word (const unsigned char *b, int wordsize)
+{
+  if (wordsize==3)
+    return ((int32_t)(((uint32_t)b[0]<<8) | ((uint32_t)b[1]<<16) | ((uint32_t)b[2]<<24))) >> 8;
+  else
+    return ((int32_t)(((uint32_t)b[0]<<16) | ((uint32_t)b[1]<<24))) >> 16;
+}
+
+#define READ_NBIT_CONVERT(type) \
+  { \
+    type *out = (type *)s->dat + c + s->nchan*(r*s->spr + first - s->begsample); \
+    for (k=first; k<last; k++, p+=ws, out+=s->nchan) \
+      *out = (type)read_nbit_word(p, ws); \
+  }
+
+/* convert the selected channels and samples of the records begin to end */
+static void *
+read_nbit_records (void *arg)
+{
+  const read_nbit_t *s = (const read_nbit_t *)arg;
+  const unsigned char *p;
+  mwSize r, c, k, first, last;
+  int ws = s->wordsize;
+
+  for (r=s->begin; r<s->end; r++)
+  {
+    /* the samples of this record that are selected */
+    first = (r*s->spr < s->begsample ? s->begsample - r*s->spr : 0);
+    last  = ((r+1)*s->spr > s->begsample + s->nsample ? s->begsample + s->nsample - r*s->spr : s->spr);
+
+    for (c=0; c<s->nchan; c++)
+    {
+      p = s->buf + ws*(r*s->recwords + s->chanoff[c] + first);
+      switch (s->classid)
+      {
+        case mxDOUBLE_CLASS:
+          READ_NBIT_CONVERT(double);
+          break;
+        case mxSINGLE_CLASS:
+          READ_NBIT_CONVERT(float);
+          break;
+        case mxINT32_CLASS:
+          READ_NBIT_CONVERT(int32_t);
+          break;
+        case mxINT16_CLASS:
+          READ_NBIT_CONVERT(int16_t);
+          break;
+        default:
+          break;
+      }
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Read the selected channels and samples, the input arguments are
+ *   filename, offset, spr, chanindx, begsample, endsample, class
+ * where offset is the position of the first data record in bytes, spr is the number of samples
+ * per record of each channel in the file, chanindx are the one-based indices of the channels that
+ * should be read and begsample and endsample are one-based. The selected channels should have the
+ * same number of samples per record.
+ */
+static mxArray *
+read_nbit (int wordsize, int nrhs, const mxArray *prhs[])
+{
+  read_nbit_t s;
+  mxArray *dat;
+  char *filename, classname[16];
+  const double *spr, *chanindx;
+  mwSize nfilechan, i, *chanoff, *recoff, begrec, endrec, nrec, dims[2];
+  double begsample, endsample;
+  int64_t offset, start, length;
+  int t, nthreads = 1;
+
+  if (nrhs<6 || nrhs>7)
+    mexErrMsgTxt ("Invalid number of input arguments");
+  if (!mxIsChar(prhs[0]))
+    mexErrMsgTxt ("Invalid type for input argument 1");
+  for (t=1; t<6; t++)
+    if (!mxIsDouble(prhs[t]) || mxIsComplex(prhs[t]))
+      mexErrMsgTxt ("The input arguments 2 to 6 should be real-valued double precision");
+  if (mxGetNumberOfElements(prhs[1])!=1 || mxGetNumberOfElements(prhs[4])!=1 || mxGetNumberOfElements(prhs[5])!=1)
+    mexErrMsgTxt ("The offset, begsample and endsample should be scalars");
+
+  offset    = (int64_t)mxGetScalar(prhs[1]);
+  spr       = mxGetPr(prhs[2]);
+  nfilechan = mxGetNumberOfElements(prhs[2]);
+  chanindx  = mxGetPr(prhs[3]);
+  s.nchan   = mxGetNumberOfElements(prhs[3]);
+  begsample = mxGetScalar(prhs[4]);
+  endsample = mxGetScalar(prhs[5]);
+
+  /* determine the class of the output */
+  s.classid = mxDOUBLE_CLASS;
+  if (nrhs>6)
+  {
+    if (!mxIsChar(prhs[6]) || mxGetString(prhs[6], classname, sizeof(classname))!=0)
+      mexErrMsgTxt ("Invalid class for the output");
+    if (strcmp(classname, "double")==0)
+      s.classid = mxDOUBLE_CLASS;
+    else if (strcmp(classname, "single")==0)
+      s.classid = mxSINGLE_CLASS;
+    else if (strcmp(classname, "int32")==0)
+      s.classid = mxINT32_CLASS;
+    else if (strcmp(classname, "int16")==0 && wordsize==2)
+      s.classid = mxINT16_CLASS;
+    else
+      mexErrMsgTxt ("Unsupported class for the output");
+  }
+
+  /* determine the layout of the records */
+  recoff = mxCalloc(nfilechan+1, sizeof(mwSize));
+  for (i=0; i<nfilechan; i++)
+  {
+    if (spr[i]<0 || spr[i]!=(mwSize)spr[i])
+      mexErrMsgTxt ("Invalid number of samples per record");
+    recoff[i+1] = recoff[i] + (mwSize)spr[i];
+  }
+  s.recwords = recoff[nfilechan];
+
+  chanoff = mxCalloc(s.nchan>0 ? s.nchan : 1, sizeof(mwSize));
+  s.spr = 0;
+  for (i=0; i<s.nchan; i++)
+  {
+    if (chanindx[i]<1 || chanindx[i]>nfilechan || chanindx[i]!=(mwSize)chanindx[i])
+      mexErrMsgTxt ("Invalid channel index");
+    chanoff[i] = recoff[(mwSize)chanindx[i]-1];
+    if (i==0)
+      s.spr = (mwSize)spr[(mwSize)chanindx[i]-1];
+    else if (s.spr!=(mwSize)spr[(mwSize)chanindx[i]-1])
+      mexErrMsgTxt ("The selected channels should have the same number of samples per record");
+  }
+  mxFree(recoff);
+
+  if (s.nchan>0 && s.spr==0)
+    mexErrMsgTxt ("The selected channels have no samples");
+  if (begsample<1 || endsample<begsample-1 || begsample!=(mwSize)begsample || endsample!=(mwSize)endsample)
+    mexErrMsgTxt ("Invalid sample range");
+
+  dims[0] = s.nchan;
+  dims[1] = (mwSize)(endsample - begsample + 1);
+  dat = mxCreateNumericArray(2, dims, s.classid, mxREAL);
+  if (s.nchan==0 || dims[1]==0)
+  {
+    mxFree(chanoff);
+    return dat;
+  }
+
+  /* determine the records that should be read */
+  begrec      = ((mwSize)begsample - 1) / s.spr;
+  endrec      = ((mwSize)endsample - 1) / s.spr;
+  nrec        = endrec - begrec + 1;
+  s.begsample = (mwSize)begsample - 1 - begrec*s.spr;
+  s.nsample   = dims[1];
+  s.wordsize  = wordsize;
+  s.chanoff   = chanoff;
+  s.dat       = mxGetData(dat);
+  start       = offset + (int64_t)begrec*s.recwords*wordsize;
+  length      = (int64_t)nrec*s.recwords*wordsize;
+
+  filename = mxArrayToString(prhs[0]);
+
+#if defined(PLATFORM_WINDOWS)
+  {
+    FILE *fp;
+    unsigned char *buf;
+
+    /* read the records into memory */
+    fp = fopen(filename, "rb");
+    mxFree(filename);
+    if (fp==NULL)
+      mexErrMsgTxt ("Could not open the file");
+    buf = mxMalloc(length);
+    if (_fseeki64(fp, start, SEEK_SET)!=0 || fread(buf, 1, length, fp)!=(size_t)length)
+    {
+      fclose(fp);
+      mexErrMsgTxt ("Could not read the selected records from the file");
+    }
+    fclose(fp);
+
+    s.buf   = buf;
+    s.begin = 0;
+    s.end   = nrec;
+    read_nbit_records(&s);
+    mxFree(buf);
+  }
+#else
+  {
+    int fd;
+    struct stat st;
+    void *map;
+    int64_t pagestart, maplength;
+
+    fd = open(filename, O_RDONLY);
+    mxFree(filename);
+    if (fd<0)
+      mexErrMsgTxt ("Could not open the file");
+    if (fstat(fd, &st)!=0 || start+length>(int64_t)st.st_size)
+    {
+      close(fd);
+      mexErrMsgTxt ("The selected records extend beyond the end of the file");
+    }
+
+    /* only the selected records are mapped, starting at a page boundary */
+    pagestart = start - start % sysconf(_SC_PAGESIZE);
+    maplength = length + (start - pagestart);
+    map = mmap(NULL, maplength, PROT_READ, MAP_PRIVATE, fd, pagestart);
+    close(fd);
+    if (map==MAP_FAILED)
+      mexErrMsgTxt ("Could not map the file into memory");
+#ifdef MADV_SEQUENTIAL
+    madvise(map, maplength, MADV_SEQUENTIAL);
+#endif
+    s.buf = (const unsigned char *)map + (start - pagestart);
+
+    if (nrec>1 && length>=READ_NBIT_MINSIZE)
+    {
+      long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+      nthreads = (ncpu>READ_NBIT_MAXTHREADS ? READ_NBIT_MAXTHREADS : (ncpu<1 ? 1 : (int)ncpu));
+      nthreads = ((mwSize)nthreads>nrec ? (int)nrec : nthreads);
+    }
+
+    if (nthreads>1)
+    {
+      pthread_t thread[READ_NBIT_MAXTHREADS];
+      read_nbit_t part[READ_NBIT_MAXTHREADS];
+      int started[READ_NBIT_MAXTHREADS];
+
+      /* divide the records over the threads */
+      for (t=0; t<nthreads; t++)
+      {
+        part[t]       = s;
+        part[t].begin = (nrec*t)/nthreads;
+        part[t].end   = (nrec*(t+1))/nthreads;
+        started[t]    = (pthread_create(&thread[t], NULL, read_nbit_records, &part[t])==0);
+      }
+      for (t=0; t<nthreads; t++)
+      {
+        if (started[t])
+          pthread_join(thread[t], NULL);
+        else
+          read_nbit_records(&part[t]);
+      }
+    }
+    else
+    {
+      s.begin = 0;
+      s.end   = nrec;
+      read_nbit_records(&s);
+    }
+
+    munmap(map, maplength);
+  }
+#endif
+
+  mxFree(chanoff);
+  return dat;
+}
+
+#endif
@@ -17,6 +17,15 @@
  *  rfbevent('myserver:1', 'abc123', 'Pointer', [20 100 1],  1)   % mouse position and button 1, press only
  *  rfbevent('myserver:1', 'abc123', 'Pointer', [20 100 1], -1)   % mouse position and button 1, release only
  *
+ * The connection can be kept open between calls, which saves the time needed to connect and
+ * authenticate for every event
+ *  rfbevent('myserver:1', 'abc123', 'Open')                      % connect as shared client
+ *  rfbevent('myserver:1', 'abc123', 'Close')                     % close the connection
+ *
+ * Multiple events can be sent in one write with a struct array with the fields type, value and
+ * optionally press and time, the time in seconds is relative to the start of the call
+ *  rfbevent('myserver:1', 'abc123', 'Batch', struct('type', {'Pointer', 'Button'}, 'value', {[20 100 1], 'Return'}, 'time', {0, 0.1}))
+ *
  * This code is based on rbfplaymacro version 0.2.2, see http://cyberelk.net/tim/software/rfbplaymacro
  * or http://people.redhat.com/twaugh/rfbplaymacro
  *
@@ -56,6 +65,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
 #include <inttypes.h>
 #include <getopt.h>
 #include <netinet/in.h>
@@ -65,6 +75,7 @@
 #include <sys/socket.h>
 #include <sys/wait.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 
 #include "d3des.h"
@@ -75,6 +86,11 @@
 #define CTS_BUF_SIZE 20    /* size of 'buf' used in connect_to_server, please make sure it's bigger than CHALLENGESIZE */
 #define STRLEN 1024
 
+/* writing to a connection that was closed by the server should not raise SIGPIPE */
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
 static unsigned long int parse_keysym (const char *sym)
 {
   size_t len = 0;
@@ -161,7 +177,7 @@ static ssize_t write_exact (int fd, const void *buf, size_t len)
   ssize_t wrote;
   ssize_t need = len;
   do {
-    wrote = write (fd, buf, need);
+    wrote = send (fd, buf, need, MSG_NOSIGNAL);
     if (wrote > 0) {
       buf += wrote;
       need -= wrote;
@@ -237,7 +253,8 @@ static int connect_to_server (const char *display, int shared, const char *passw
         char msg[STRLEN];
         snprintf(msg, (STRLEN-1), "Unknown host: %s", server);
         mexWarnMsgTxt(msg);
-        exit (1);
+        close (s);
+        return -1;
       }
       memcpy (&sin.sin_addr.s_addr, hp->h_addr_list[0],
       hp->h_length);
@@ -347,47 +364,90 @@ static int connect_to_server (const char *display, int shared, const char *passw
   return s;
 }
 
-void
-mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
+/* the session that was opened with rfbevent(display, passwd, 'Open') is kept between calls */
+static int  session = -1;
+static char session_display[STRLEN], session_password[STRLEN];
+
+static void close_session (void)
 {
-  char display[STRLEN], password[STRLEN], type[STRLEN];
-  int shared = 0;
-  int socket, n, do_delay;
-  struct timeval delay;
+  if (session >= 0)
+    close (session);
+  session = -1;
+}
 
-  delay.tv_sec  = 0;
-  delay.tv_usec = 0;
+/* returns 1 if the server is still there, any messages that it sent are discarded */
+static int check_session (void)
+{
+  char buf[STRLEN];
+  ssize_t got;
+  while ((got = recv (session, buf, STRLEN, MSG_DONTWAIT)) > 0)
+    ;
+  return (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
 
-  if (nrhs<3)
-    mexErrMsgTxt ("Invalid number of input arguments");
-  
-  if (!mxIsChar(prhs[0]))
-    mexErrMsgTxt ("Invalid input argument #1");
-  if (!mxIsChar(prhs[1]))
-    mexErrMsgTxt ("Invalid input argument #2");
-  if (!mxIsChar(prhs[2]))
-    mexErrMsgTxt ("Invalid input argument #3");
+static int open_session (const char *display, const char *password)
+{
+  int flag = 1;
 
-  n = mxGetNumberOfElements(prhs[0]); n = ( n>(STRLEN-1) ? (STRLEN-1) : n );
-  mxGetString(prhs[0], display, n+1);
+  close_session ();
+  /* connect as a shared client, otherwise the viewer on the display would be disconnected */
+  session = connect_to_server (display, 1, password);
+  if (session < 0)
+    return -1;
 
-  n = mxGetNumberOfElements(prhs[1]); n = ( n>(STRLEN-1) ? (STRLEN-1) : n );
-  mxGetString(prhs[1], password, n+1);
+  /* the events are small and should not wait for the acknowledgement of the previous ones */
+  setsockopt (session, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof (flag));
+#ifdef SO_NOSIGPIPE
+  setsockopt (session, SOL_SOCKET, SO_NOSIGPIPE, &flag, sizeof (flag));
+#endif
 
-  n = mxGetNumberOfElements(prhs[2]); n = ( n>(STRLEN-1) ? (STRLEN-1) : n );
-  mxGetString(prhs[2], type, n+1);
+  strcpy (session_display, display);
+  strcpy (session_password, password);
+  mexAtExit (close_session);
+  return session;
+}
 
-  /* 
-   * mexPrintf("display  = %s\n", display);
-   * mexPrintf("password = %s\n", password);
-   * mexPrintf("type     = %s\n", type);
-   */
+/* the events are appended to one buffer, which is written in as few calls as possible */
+typedef struct {
+  char *buf;
+  size_t len, size;
+} packet_t;
 
-  socket = connect_to_server (display, shared, password);
-  if (socket < 0)
-    mexErrMsgTxt ("Could not connect to remote display");
+static void packet_append (packet_t *p, const char *msg, size_t len)
+{
+  if (p->len + len > p->size) {
+    p->size = 2*(p->len + len);
+    p->buf  = mxRealloc (p->buf, p->size);
+  }
+  memcpy (p->buf + p->len, msg, len);
+  p->len += len;
+}
+
+static void add_key (packet_t *p, unsigned long int key, int press)
+{
+  char packet[8];
+  uint32_t bit32;
+
+  packet[0] = '\4';
+  packet[2] = packet[3] = '\0';
+  bit32 = htonl (key);
+  memcpy (packet + 4, &bit32, 4);
+
+  if (press>=0)
+  {
+    packet[1] = '\1'; /* key press */
+    packet_append (p, packet, 8);
+  }
+  if (press<=0)
+  {
+    packet[1] = '\0'; /* key release */
+    packet_append (p, packet, 8);
+  }
+}
 
-  if (strcmp(type, "Key")==0)
+static void add_event (packet_t *p, const char *type, const mxArray *value, int press)
+{
+  if (strcmp(type, "Key")==0 || strcmp(type, "Button")==0)
   {
     /*****************************************************************************
      *   rfbevent('myserver:1', 'abc123', 'Button', 'Return')          % single key event, press and release
@@ -395,39 +455,15 @@ mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
      *   rfbevent('myserver:1', 'abc123', 'Button', 'Return',  1)      % single key event, press only
      *   rfbevent('myserver:1', 'abc123', 'Button', 'Return', -1)      % single key event, release only
      *****************************************************************************/
-    int n, key, press = 0;
-    char packet[20], str[STRLEN];
-    uint32_t bit32;
-    
-    if (nrhs<4)
-      mexErrMsgTxt ("Incorrect input arguments for Key event");
-    if (!mxIsChar(prhs[3]))
-      mexErrMsgTxt ("Incorrect input arguments for Key event");
-    if (mxGetNumberOfElements(prhs[3])<1)
+    int n;
+    char str[STRLEN];
+
+    if (value==NULL || !mxIsChar(value) || mxGetNumberOfElements(value)<1)
       mexErrMsgTxt ("Incorrect input arguments for Key event");
-    
-    n = mxGetNumberOfElements(prhs[3]); n = ( n>(STRLEN-1) ? (STRLEN-1) : n );
-    mxGetString(prhs[3], str, n+1);
-    key = parse_keysym (str);
-    
-    if (nrhs>4)
-      press = mxGetScalar(prhs[4]);
-    
-    packet[0] = '\4';
-    packet[2] = packet[3] = '\0';
-    bit32 = htonl (key);
-    memcpy (packet + 4, &bit32, 4);
-    
-    if (press>=0)
-    {
-      packet[1] = '\1'; /* key press */
-      write_exact (socket, packet, 8);
-    }
-    if (press<=0)
-    {
-      packet[1] = '\0'; /* key release */
-      write_exact (socket, packet, 8);
-    }
+
+    n = mxGetNumberOfElements(value); n = ( n>(STRLEN-1) ? (STRLEN-1) : n );
+    mxGetString(value, str, n+1);
+    add_key (p, parse_keysym (str), press);
   }
 
   else if (strcmp(type, "Pointer")==0)
@@ -439,38 +475,30 @@ mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
      *   rfbevent('myserver:1', 'abc123', 'Pointer', [20 100 1],  1)   % mouse position and button 1, press only
      *   rfbevent('myserver:1', 'abc123', 'Pointer', [20 100 1], -1)   % mouse position and button 1, release only
      *****************************************************************************/
-    char packet[20];
-    double *p;
-    int press = 0, number = 0, x, y;
+    char packet[6];
+    double *v;
+    int number = 0, x, y;
     uint16_t xx, yy;
     uint8_t buttons = 0;
 
-    if (nrhs<4)
-      mexErrMsgTxt ("Incorrect input arguments for Pointer event");
-    if (!mxIsDouble(prhs[3]))
-      mexErrMsgTxt ("Incorrect input arguments for Pointer event");
-    if (mxGetNumberOfElements(prhs[3])<2)
+    if (value==NULL || !mxIsDouble(value) || mxGetNumberOfElements(value)<2)
       mexErrMsgTxt ("Incorrect input arguments for Pointer event");
 
-    p = mxGetPr(prhs[3]);
-    x = (int)p[0];
-    y = (int)p[1];
+    v = mxGetPr(value);
+    x = (int)v[0];
+    y = (int)v[1];
     if (x < 0) x = 0;
     if (y < 0) y = 0;
 
     /* get the optional button number */
-    if (mxGetNumberOfElements(prhs[3])>2)
+    if (mxGetNumberOfElements(value)>2)
     {
-      number = (int)p[2];
+      number = (int)v[2];
       if ((number<1) || (number>8))
         mexErrMsgTxt ("Incorrect button number for Pointer event (should be between 1 and 8)");
       buttons = (1<<(number-1));  /* set the appropriate bit for the button state */
     }
 
-    /* get the press/release state of the button */
-    if (nrhs>4)
-      press = mxGetScalar(prhs[4]);
-
     /* construct the pointer event packet */
     packet[0] = '\5';
     xx = htons (x);
@@ -481,12 +509,12 @@ mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
     if (press>=0)
     {
       packet[1] = buttons;      /* do the button press */
-      write_exact (socket, packet, 6);
+      packet_append (p, packet, 6);
     }
     if (press<=0)
     {
       packet[1] = '\0';         /* do the button release, i.e. signal that no buttons are pressed */
-      write_exact (socket, packet, 6);
+      packet_append (p, packet, 6);
     }
   }
 
@@ -496,39 +524,193 @@ mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
      * this is not a native RFB event type, but is included here for convenience
      * rfbevent('myserver:1', 'abc123', 'Text', 'xclock');
      *****************************************************************************/
-    char packet[20], str[STRLEN];
-    int i, n;   
-    uint32_t bit32;
+    char str[STRLEN];
+    int i, n;
 
-    if (nrhs<4)
+    if (value==NULL || !mxIsChar(value) || mxGetNumberOfElements(value)<1)
       mexErrMsgTxt ("Incorrect input arguments for Text event");
-    if (!mxIsChar(prhs[3]))
-      mexErrMsgTxt ("Incorrect input arguments for Text event");
-    if (mxGetNumberOfElements(prhs[3])<1)
-      mexErrMsgTxt ("Incorrect input arguments for Text event");
-    
-    n = mxGetNumberOfElements(prhs[3]); n = ( n>(STRLEN-1) ? (STRLEN-1) : n );
-    mxGetString(prhs[3], str, n+1);
-    
-    packet[0] = '\4';
-    packet[2] = packet[3] = '\0';
+
+    n = mxGetNumberOfElements(value); n = ( n>(STRLEN-1) ? (STRLEN-1) : n );
+    mxGetString(value, str, n+1);
+
     for (i=0; i<n; i++)
+      add_key (p, (unsigned char)str[i], 0);
+  }
+
+  else
+  {
+    char msg[STRLEN];
+    snprintf(msg, (STRLEN-1), "Unknown event type \"%s\"", type);
+    mexErrMsgTxt(msg);
+  }
+}
+
+/* returns the value of an optional numeric field of the batch, or the default if it is missing or empty */
+static double get_field (const mxArray *batch, mwIndex i, const char *name, double value)
+{
+  const mxArray *field = mxGetField(batch, i, name);
+  if (field && !mxIsEmpty(field))
+  {
+    if (!mxIsNumeric(field) && !mxIsLogical(field))
+      mexErrMsgTxt ("Incorrect input arguments for Batch event");
+    value = mxGetScalar(field);
+  }
+  return value;
+}
+
+/* wait until the specified time, in seconds relative to the start */
+static void wait_until (const struct timeval *start, double time)
+{
+  struct timeval now, delay;
+  double remaining;
+
+  gettimeofday (&now, NULL);
+  remaining = time - ((now.tv_sec - start->tv_sec) + 1e-6*(now.tv_usec - start->tv_usec));
+  if (remaining > 0)
+  {
+    delay.tv_sec  = (long)remaining;
+    delay.tv_usec = (long)(1e6*(remaining - delay.tv_sec));
+    select (0, NULL, NULL, NULL, &delay);
+  }
+}
+
+void
+mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
+{
+  char display[STRLEN], password[STRLEN], type[STRLEN];
+  int shared = 0;
+  int socket, n, press = 0, persistent;
+  packet_t packet;
+  size_t *stop;
+  double *time;
+  mwIndex i, ngroup = 0;
+  struct timeval start;
+
+  if (nrhs<3)
+    mexErrMsgTxt ("Invalid number of input arguments");
+
+  if (!mxIsChar(prhs[0]))
+    mexErrMsgTxt ("Invalid input argument #1");
+  if (!mxIsChar(prhs[1]))
+    mexErrMsgTxt ("Invalid input argument #2");
+  if (!mxIsChar(prhs[2]))
+    mexErrMsgTxt ("Invalid input argument #3");
+
+  n = mxGetNumberOfElements(prhs[0]); n = ( n>(STRLEN-1) ? (STRLEN-1) : n );
+  mxGetString(prhs[0], display, n+1);
+
+  n = mxGetNumberOfElements(prhs[1]); n = ( n>(STRLEN-1) ? (STRLEN-1) : n );
+  mxGetString(prhs[1], password, n+1);
+
+  n = mxGetNumberOfElements(prhs[2]); n = ( n>(STRLEN-1) ? (STRLEN-1) : n );
+  mxGetString(prhs[2], type, n+1);
+
+  /* 
+   * mexPrintf("display  = %s\n", display);
+   * mexPrintf("password = %s\n", password);
+   * mexPrintf("type     = %s\n", type);
+   */
+
+  if (strcmp(type, "Open")==0)
+  {
+    if (open_session (display, password) < 0)
+      mexErrMsgTxt ("Could not connect to remote display");
+    return;
+  }
+  else if (strcmp(type, "Close")==0)
+  {
+    close_session ();
+    return;
+  }
+
+  /* construct all packets before anything is sent, which also checks the input arguments */
+  packet.len  = 0;
+  packet.size = 256;
+  packet.buf  = mxMalloc (packet.size);
+
+  if (strcmp(type, "Batch")==0)
+  {
+    /*****************************************************************************
+     * this is not a native RFB event type, the events are sent in one write,
+     * or in one write per time if the events have a time
+     *****************************************************************************/
+    const mxArray *batch, *field;
+    char str[STRLEN];
+    mwIndex nevent;
+
+    if (nrhs<4 || !mxIsStruct(prhs[3]))
+      mexErrMsgTxt ("Incorrect input arguments for Batch event");
+    batch  = prhs[3];
+    nevent = mxGetNumberOfElements(batch);
+    stop   = mxMalloc ((nevent>0 ? nevent : 1)*sizeof(size_t));
+    time   = mxMalloc ((nevent>0 ? nevent : 1)*sizeof(double));
+
+    for (i=0; i<nevent; i++)
     {
-      bit32 = htonl (str[i]);
-      memcpy (packet + 4, &bit32, 4);
-      packet[1] = '\1';  /* button press */
-      write_exact (socket, packet, 8);
-      packet[1] = '\0';  /* button release */
-      write_exact (socket, packet, 8);
+      double t = get_field (batch, i, "time", (ngroup>0 ? time[ngroup-1] : 0));
+
+      field = mxGetField(batch, i, "type");
+      if (field==NULL || !mxIsChar(field))
+        mexErrMsgTxt ("Each event in the batch should have a type");
+      n = mxGetNumberOfElements(field); n = ( n>(STRLEN-1) ? (STRLEN-1) : n );
+      mxGetString(field, str, n+1);
+
+      if (ngroup>0 && t<time[ngroup-1])
+        mexErrMsgTxt ("The time of the events in the batch should be increasing");
+      if (ngroup==0 || t>time[ngroup-1])
+        time[ngroup++] = t;
+
+      add_event (&packet, str, mxGetField(batch, i, "value"), (int)get_field (batch, i, "press", 0));
+      stop[ngroup-1] = packet.len;
     }
   }
-  
-  if (do_delay)
-    select (0, NULL, NULL, NULL, &delay);
-  
-  if (socket >= 0)
+  else
+  {
+    if (nrhs>4)
+      press = mxGetScalar(prhs[4]);
+    add_event (&packet, type, (nrhs>3 ? prhs[3] : NULL), press);
+
+    stop    = mxMalloc (sizeof(size_t));
+    time    = mxMalloc (sizeof(double));
+    stop[0] = packet.len;
+    time[0] = 0;
+    ngroup  = 1;
+  }
+
+  /* use the open session if it is for the same display, otherwise connect only for this call */
+  persistent = (session>=0 && strcmp(display, session_display)==0 && strcmp(password, session_password)==0);
+  if (persistent && !check_session ())
+  {
+    /* the server closed the connection in the mean time */
+    if (open_session (display, password) < 0)
+      mexErrMsgTxt ("Could not reconnect to remote display");
+  }
+  socket = (persistent ? session : connect_to_server (display, shared, password));
+  if (socket < 0)
+    mexErrMsgTxt ("Could not connect to remote display");
+
+  gettimeofday (&start, NULL);
+  for (i=0; i<ngroup; i++)
+  {
+    size_t begin = (i>0 ? stop[i-1] : 0);
+    if (begin==stop[i])
+      continue;
+    wait_until (&start, time[i]);
+    if (write_exact (socket, packet.buf + begin, stop[i] - begin) < 0)
+    {
+      if (persistent)
+        close_session ();
+      else
+        close (socket);
+      mexErrMsgTxt ("Could not send the events to the remote display");
+    }
+  }
+
+  if (!persistent)
     close (socket);
 
+  mxFree (packet.buf);
+  mxFree (stop);
+  mxFree (time);
   return;
 }
-
@@ -28,6 +28,20 @@ function [varargout] = rfbevent(varargin)
 %   rfbevent('vncserver:5901', 'yourpasswd', 'Pointer', [20 100 1],  1)   % mouse position and button 1, press only
 %   rfbevent('vncserver:5901', 'yourpasswd', 'Pointer', [20 100 1], -1)   % mouse position and button 1, release only
 %
+% The connection and authentication take a considerable amount of time. The
+% connection can therefore also be kept open between calls, as long as the
+% subsequent calls specify the same display and password
+%   rfbevent('vncserver:5901', 'yourpasswd', 'Open')                      % connect as shared client
+%   rfbevent('vncserver:5901', 'yourpasswd', 'Close')                     % close the connection
+%
+% Multiple events can be sent in a single write with a struct array with the
+% fields 'type', 'value' and optionally 'press' and 'time'. Events with a later
+% time, in seconds relative to the start of the call, are sent in a separate
+% write once that time has passed. A missing or empty time is the same as that
+% of the previous event.
+%   ev = struct('type', {'Pointer', 'Button'}, 'value', {[20 100 1], 'Return'}, 'time', {0, 0.1});
+%   rfbevent('vncserver:5901', 'yourpasswd', 'Batch', ev)
+%
 % Note that the password has to be represented as plain text in the matlab
 % script/function that is using RFBEVENT, which poses a potential security
 % problem. The password is sent over the network to the VNC server after
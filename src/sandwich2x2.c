@@ -1,141 +1,81 @@
 #include <math.h>
 #include <mex.h>
+#include "smallmat.h"
 
-void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+static void kernel(const smallmat_t *s, mwSize first, int nl)
 {
-  /*declare variables*/
-  const mwSize *dims;
-  mwIndex indx;
-  int i, numdims;
-  int numelin;
-  mxClassID classid;
-  double *input1r, *input1i, *input2r, *input2i, *output1r, *output1i;
-  double a,  b,  c,  d,  e,  f,  g,  h, absa, absb, absc, absd, offr, offi;
-  double ai, bi, ci, di, ei, fi, gi, hi;
-  
-  /*figure out the classid*/
-  classid = mxGetClassID(prhs[0]);
-     
-  /*check inputs*/
-  if (nrhs!=2)
-    mexErrMsgTxt("Wrong number of input arguments");
-  
-  /*associate inputs*/
-  input1r = mxGetData(prhs[0]);
-  input1i = mxGetImagData(prhs[0]);
+  smallmat_block xr[4], xi[4], yr[4], yi[4], zr[4], zi[4];
+  double a,  b,  c,  d,  e,  f,  h, absa, absb, absc, absd, offr, offi;
+  double ai, bi, ci, di, ei, fi, hi;
+  int l;
   
-  input2r = mxGetData(prhs[1]);
-  input2i = mxGetImagData(prhs[1]);
+  smallmat_get(xr, s->ar, s->singlea, 4, first, nl);
+  smallmat_get(yr, s->br, s->singleb, 4, first, nl);
   
-  /*figure out dimension info and number of elements*/
-  dims    = mxGetDimensions(prhs[0]);
-  numdims = mxGetNumberOfDimensions(prhs[0]);
-  numelin = mxGetNumberOfElements(prhs[0]);
-    
-  /*associate output*/
-  if (input1i == NULL && input2i == NULL)
+  if (!s->complex)
   {
-    plhs[0]  = mxCreateNumericArray(numdims, dims, classid, mxREAL);
-    output1r = mxGetData(plhs[0]);
-  }
-  else
-  {
-    plhs[0]  = mxCreateNumericArray(numdims, dims, classid, mxCOMPLEX);
-    output1r = mxGetData(plhs[0]);
-    output1i = mxGetImagData(plhs[0]);
-  }
-  
-  /* do the computation*/
-  if (input1i == NULL && input2i == NULL)
-  {  
-    for (i=0; i<numelin/4; i++)
+    LANES(l)
     {
-      a = input1r[i*4  ];
-      b = input1r[i*4+1];
-      c = input1r[i*4+2];
-      d = input1r[i*4+3];
-    
-      e = input2r[i*4  ];
-      f = input2r[i*4+1];
-      g = input2r[i*4+2];
-      h = input2r[i*4+3];
-    
-      output1r[i*4  ] = e*a*a + 2*f*a*c       + h*c*c;
-      output1r[i*4+1] = e*a*b + f*a*d + f*b*c + h*c*d;
-      output1r[i*4+2] = e*a*b + f*b*c + f*a*d + h*c*d;
-      output1r[i*4+3] = e*b*b + 2*f*b*d       + h*d*d;
+      a = xr[0][l]; b = xr[1][l]; c = xr[2][l]; d = xr[3][l];
+      e = yr[0][l]; f = yr[1][l]; h = yr[3][l];
+      
+      zr[0][l] = e*a*a + 2*f*a*c       + h*c*c;
+      zr[1][l] = e*a*b + f*a*d + f*b*c + h*c*d;
+      zr[2][l] = e*a*b + f*b*c + f*a*d + h*c*d;
+      zr[3][l] = e*b*b + 2*f*b*d       + h*d*d;
     }
+    smallmat_put(s->cr, s->singlec, 4, first, nl, zr);
     return;
   }
-  else if (input1i == NULL)
+  
+  /*a real-valued input has an imaginary part of zero*/
+  smallmat_get(xi, s->ai, s->singlea, 4, first, nl);
+  smallmat_get(yi, s->bi, s->singleb, 4, first, nl);
+  
+  LANES(l)
   {
-    for (i=0; i<numelin/4; i++)
-    {
-      /*matrix 1*/
-      a  = input1r[i*4  ]; b  = input1r[i*4+1]; c  = input1r[i*4+2]; d  = input1r[i*4+3];
-      
-      /*matrix 2*/
-      e  = input2r[i*4  ]; f  = input2r[i*4+1]; g  = input2r[i*4+2]; h  = input2r[i*4+3];
-      ei = input2i[i*4  ]; fi = input2i[i*4+1]; gi = input2i[i*4+2]; hi = input2i[i*4+3];
-      
-      /*compute some quantities only once*/
-      absa = a*a;
-      absb = b*b;
-      absc = c*c;
-      absd = (d*d+di*di);
-      offr = e*a*b + f*a*d + f*b*c + h*c*d;
-      offi = -ei*a*b - fi*a*d + fi*b*c - hi*c*d;
-      
-      /*fill in the real part of the output matrix*/
-      output1r[i*4  ] = e*absa + 2*f*a*c + h*absc;
-      output1r[i*4+1] = offr;
-      output1r[i*4+2] = offr;
-      output1r[i*4+3] = e*absb + 2*f*b*d + h*absd;
+    /*matrix 1*/
+    a  = xr[0][l]; b  = xr[1][l]; c  = xr[2][l]; d  = xr[3][l];
+    ai = xi[0][l]; bi = xi[1][l]; ci = xi[2][l]; di = xi[3][l];
     
-      /*fill in the imaginary part of the output matrix*/
-      output1i[i*4  ] = ei*absa + hi*absc;
-      output1i[i*4+1] = -offi;
-      output1i[i*4+2] =  offi;
-      output1i[i*4+3] = ei*absb + hi*absd;
+    /*matrix 2, the upper off-diagonal element follows from it being Hermitian*/
+    e  = yr[0][l]; f  = yr[1][l]; h  = yr[3][l];
+    ei = yi[0][l]; fi = yi[1][l]; hi = yi[3][l];
     
-    }
-  }
-  /*else if (input2i == NULL)*/
+    /*compute some quantities only once*/
+    absa = (a*a+ai*ai);
+    absb = (b*b+bi*bi);
+    absc = (c*c+ci*ci);
+    absd = (d*d+di*di);
+    offr = (e*a*b+e*ai*bi-ei*a*bi+ei*ai*b) + (f*a*d+f*ai*di-fi*a*di+fi*ai*d) + (f*b*c+f*bi*ci-fi*b*ci+fi*bi*c) + (h*c*d+h*ci*di-hi*c*di+hi*ci*d);
+    offi = (-ei*ai*bi-e*a*bi+e*ai*b-ei*a*b) + (-fi*ai*di-f*a*di+f*ai*d-fi*a*d) + (fi*bi*ci+f*b*ci-f*bi*c+fi*b*c) + (-hi*ci*di-h*c*di+h*ci*d-hi*c*d);
     
-  else
-  {  
-    for (i=0; i<numelin/4; i++)
-    {
-      /*matrix 1*/
-      a  = input1r[i*4  ]; b  = input1r[i*4+1]; c  = input1r[i*4+2]; d  = input1r[i*4+3];
-      ai = input1i[i*4  ]; bi = input1i[i*4+1]; ci = input1i[i*4+2]; di = input1i[i*4+3];
-      
-      /*matrix 2*/
-      e  = input2r[i*4  ]; f  = input2r[i*4+1]; g  = input2r[i*4+2]; h  = input2r[i*4+3];
-      ei = input2i[i*4  ]; fi = input2i[i*4+1]; gi = input2i[i*4+2]; hi = input2i[i*4+3];
+    /*fill in the real part of the output matrix*/
+    zr[0][l] = e*absa + 2*(f*a*c+f*ai*ci-fi*a*ci+fi*ai*c) + h*absc;
+    zr[1][l] = offr;
+    zr[2][l] = offr;
+    zr[3][l] = e*absb + 2*(f*b*d+f*bi*di-fi*b*di+fi*bi*d) + h*absd;
     
-      /*compute some quantities only once*/
-      absa = (a*a+ai*ai);
-      absb = (b*b+bi*bi);
-      absc = (c*c+ci*ci);
-      absd = (d*d+di*di);
-      offr = (e*a*b+e*ai*bi-ei*a*bi+ei*ai*b) + (f*a*d+f*ai*di-fi*a*di+fi*ai*d) + (f*b*c+f*bi*ci-fi*b*ci+fi*bi*c) + (h*c*d+h*ci*di-hi*c*di+hi*ci*d);
-      offi = (-ei*ai*bi-e*a*bi+e*ai*b-ei*a*b) + (-fi*ai*di-f*a*di+f*ai*d-fi*a*d) + (fi*bi*ci+f*b*ci-f*bi*c+fi*b*c) + (-hi*ci*di-h*c*di+h*ci*d-hi*c*d);
-      
-      /*fill in the real part of the output matrix*/
-      output1r[i*4  ] = e*absa + 2*(f*a*c+f*ai*ci-fi*a*ci+fi*ai*c) + h*absc;
-      output1r[i*4+1] = offr;
-      output1r[i*4+2] = offr;
-      output1r[i*4+3] = e*absb + 2*(f*b*d+f*bi*di-fi*b*di+fi*bi*d) + h*absd;
-    
-      /*fill in the imaginary part of the output matrix*/
-      output1i[i*4  ] = ei*absa + hi*absc;
-      output1i[i*4+1] = -offi;
-      output1i[i*4+2] =  offi;
-      output1i[i*4+3] = ei*absb + hi*absd;
-    }
-    return;
+    /*fill in the imaginary part of the output matrix*/
+    zi[0][l] = ei*absa + hi*absc;
+    zi[1][l] = -offi;
+    zi[2][l] =  offi;
+    zi[3][l] = ei*absb + hi*absd;
   }
+  smallmat_put(s->cr, s->singlec, 4, first, nl, zr);
+  smallmat_put(s->ci, s->singlec, 4, first, nl, zi);
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  smallmat_t s;
+  
+  /*check inputs and associate output*/
+  smallmat_init(&s, plhs, nrhs, prhs, 2, 4, 4);
+  
+  /* do the computation*/
+  s.kernel = kernel;
+  smallmat_run(&s);
 }
 
 /*in the following c and b are swapped with respect to the above
@@ -150,4 +90,3 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 %
 %e*abs(a)^2 + f*(a'*b) + f'*(a*b') + h*abs(b)^2    e*a*c'    + f*b*c'   + f'*a*d'   + h*b*d'
 %e*a'*c    + f*a'*d   + f'*b'*c   + h*b'*d       e*abs(c)^2 + f*(c'*d) + f'*(c*d') + h*abs(d)^2*/
-
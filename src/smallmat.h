@@ -0,0 +1,483 @@
+/*
+ * This implements the shared part of the mex files for 2x2 and 3x3 matrices,
+ * such as mtimes2x2, inv3x3 and sandwich2x2, which process many small matrices
+ * along the trailing dimensions at once.
+ *
+ * The matrices are processed in blocks of SMALLMAT_BLOCK. A block is first
+ * rearranged from one matrix after the other into one element after the other,
+ * i.e. x[element][lane]. The computations then loop over the lanes, which the
+ * compiler turns into vector instructions that handle multiple matrices at
+ * once. A real-valued input is represented with an imaginary part of zero when
+ * the other input is complex, so that only a real and a complex implementation
+ * are needed. Single precision input is converted to double precision in the
+ * block and back when writing the output.
+ *
+ * The blocks are divided over multiple threads if there are enough of them.
+ *
+ * The batched functions for Hermitian matrices, such as batcheig, use the same
+ * layout for matrices of up to SMALLMAT_MAXN x SMALLMAT_MAXN. Their
+ * eigendecomposition uses cyclic Jacobi rotations that are applied to all
+ * matrices in the block at once, a 2x2 matrix only takes a single rotation.
+ */
+
+#ifndef SMALLMAT_H
+#define SMALLMAT_H
+
+#include <mex.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include "platform.h"
+
+#if !defined(PLATFORM_WINDOWS)
+#include <pthread.h>
+#include <unistd.h>
+#define SMALLMAT_THREADS
+#endif
+
+#define SMALLMAT_BLOCK      8           /* number of matrices that are processed together */
+#define SMALLMAT_MAXTHREADS 16
+#define SMALLMAT_MINSIZE    (1<<15)     /* number of matrices below which a single thread is used */
+#define SMALLMAT_MAXN       8           /* largest matrices for the batched functions */
+#define SMALLMAT_SWEEPS     30          /* maximum number of Jacobi sweeps */
+
+/* loop over the matrices in the block */
+#define LANES(l) for (l=0; l<SMALLMAT_BLOCK; l++)
+
+typedef double smallmat_block[SMALLMAT_BLOCK];
+
+typedef struct smallmat_s {
+  /* the inputs and output, the imaginary parts are NULL for real-valued data */
+  const void *ar, *ai, *br, *bi;
+  void *cr, *ci;
+  int singlea, singleb, singlec;
+  int nela, nelb, nelc;         /* number of elements per matrix */
+  int complex;                  /* any of the inputs is complex */
+  int n;                        /* order of the matrices */
+  void *dr;                     /* optional second output, which is real-valued */
+  mwSize num;                   /* number of matrices */
+  /* this processes nl matrices starting at the specified one */
+  void (*kernel)(const struct smallmat_s *s, mwSize first, int nl);
+  /* the division of the work over the threads, in blocks */
+  mwSize begin, end;
+} smallmat_t;
+
+/* copy the elements of nl matrices into a block, the remaining lanes are set to zero */
+static inline void smallmat_get(smallmat_block *x, const void *src, int single, int nel, mwSize first, int nl)
+{
+  int e, l;
+  if (src == NULL || nl < SMALLMAT_BLOCK)
+    memset(x, 0, nel * sizeof(smallmat_block));
+  if (src == NULL)
+    return;
+  if (single)
+  {
+    const float *p = (const float *)src + first*nel;
+    for (l=0; l<nl; l++)
+      for (e=0; e<nel; e++)
+        x[e][l] = p[l*nel+e];
+  }
+  else
+  {
+    const double *p = (const double *)src + first*nel;
+    for (l=0; l<nl; l++)
+      for (e=0; e<nel; e++)
+        x[e][l] = p[l*nel+e];
+  }
+}
+
+/* copy the elements from a block into nl matrices of the output */
+static inline void smallmat_put(void *dst, int single, int nel, mwSize first, int nl, const smallmat_block *x)
+{
+  int e, l;
+  if (dst == NULL)
+    return;
+  if (single)
+  {
+    float *p = (float *)dst + first*nel;
+    for (l=0; l<nl; l++)
+      for (e=0; e<nel; e++)
+        p[l*nel+e] = (float)x[e][l];
+  }
+  else
+  {
+    double *p = (double *)dst + first*nel;
+    for (l=0; l<nl; l++)
+      for (e=0; e<nel; e++)
+        p[l*nel+e] = x[e][l];
+  }
+}
+
+/* c = a*b or c = a*b' for a block of n x n matrices, the imaginary parts are only used if ci is not NULL */
+static inline void smallmat_mtimes(int n, smallmat_block *cr, smallmat_block *ci,
+                            const smallmat_block *ar, const smallmat_block *ai,
+                            const smallmat_block *br, const smallmat_block *bi, int adjoint)
+{
+  int i, j, k, l, ia, ib, ic;
+  for (j=0; j<n; j++)
+    for (i=0; i<n; i++)
+    {
+      ic = i + j*n;
+      LANES(l) cr[ic][l] = 0;
+      if (ci)
+        LANES(l) ci[ic][l] = 0;
+      for (k=0; k<n; k++)
+      {
+        ia = i + k*n;
+        ib = (adjoint ? j + k*n : k + j*n);
+        if (ci == NULL)
+          LANES(l) cr[ic][l] += ar[ia][l]*br[ib][l];
+        else if (adjoint)
+          LANES(l)
+          {
+            cr[ic][l] += ar[ia][l]*br[ib][l] + ai[ia][l]*bi[ib][l];
+            ci[ic][l] += ai[ia][l]*br[ib][l] - ar[ia][l]*bi[ib][l];
+          }
+        else
+          LANES(l)
+          {
+            cr[ic][l] += ar[ia][l]*br[ib][l] - ai[ia][l]*bi[ib][l];
+            ci[ic][l] += ai[ia][l]*br[ib][l] + ar[ia][l]*bi[ib][l];
+          }
+      }
+    }
+}
+
+/* make a block of n x n matrices exactly Hermitian by averaging them with their conjugate transpose */
+static inline void smallmat_hermitian(int n, smallmat_block *ar, smallmat_block *ai)
+{
+  int i, j, l;
+  double x;
+  for (j=0; j<n; j++)
+    for (i=j; i<n; i++)
+      LANES(l)
+      {
+        x = 0.5*(ar[i+j*n][l] + ar[j+i*n][l]);
+        ar[i+j*n][l] = x;
+        ar[j+i*n][l] = x;
+        if (ai)
+        {
+          x = (i==j ? 0 : 0.5*(ai[i+j*n][l] - ai[j+i*n][l]));
+          ai[i+j*n][l] =  x;
+          ai[j+i*n][l] = -x;
+        }
+      }
+}
+
+/*
+ * Compute the eigenvalues d in ascending order and the eigenvectors v of a block
+ * of Hermitian n x n matrices. The matrices a are overwritten. The imaginary
+ * parts ai and vi are NULL for real-valued matrices, the eigenvectors are not
+ * computed if vr is NULL.
+ *
+ * Each rotation first multiplies row and column q with a phase factor that makes
+ * a(p,q) real, and subsequently zeros a(p,q) with a real-valued rotation.
+ */
+static inline void smallmat_eigh(int n, smallmat_block *ar, smallmat_block *ai, smallmat_block *vr, smallmat_block *vi, smallmat_block *d)
+{
+  double cp[SMALLMAT_BLOCK], sp[SMALLMAT_BLOCK], c[SMALLMAT_BLOCK], s[SMALLMAT_BLOCK];
+  double x, y, r, t, tau, off, nrm, tmp;
+  int i, j, k, l, p, q, sweep, done;
+
+  if (vr)
+  {
+    for (i=0; i<n*n; i++)
+      LANES(l) vr[i][l] = (i%(n+1)==0);
+    if (vi)
+      memset(vi, 0, n*n*sizeof(smallmat_block));
+  }
+
+  for (sweep=0; sweep<SMALLMAT_SWEEPS; sweep++)
+  {
+    /* stop when the off-diagonal elements of all matrices are negligible */
+    done = 1;
+    LANES(l)
+    {
+      off = 0;
+      nrm = 0;
+      for (j=0; j<n; j++)
+        for (i=0; i<n; i++)
+        {
+          x = ar[i+j*n][l]*ar[i+j*n][l] + (ai ? ai[i+j*n][l]*ai[i+j*n][l] : 0);
+          if (i==j)
+            nrm += x;
+          else
+            off += x;
+        }
+      if (off > DBL_EPSILON*DBL_EPSILON*nrm)
+        done = 0;
+    }
+    if (done)
+      break;
+
+    for (p=0; p<n-1; p++)
+      for (q=p+1; q<n; q++)
+      {
+        /* determine the phase of a(p,q) and the rotation, a zero element gives the identity */
+        LANES(l)
+        {
+          x     = ar[p+q*n][l];
+          y     = (ai ? ai[p+q*n][l] : 0);
+          r     = sqrt(x*x + y*y);
+          cp[l] = (r>0 ? x/r : 1);
+          sp[l] = (r>0 ? y/r : 0);
+          tau   = (ar[q+q*n][l] - ar[p+p*n][l]) / (r>0 ? 2*r : 1);
+          t     = (tau>=0 ? 1 : -1) / (fabs(tau) + sqrt(1 + tau*tau));
+          t     = (r>0 ? t : 0);
+          c[l]  = 1/sqrt(1 + t*t);
+          s[l]  = t*c[l];
+        }
+
+        /* multiply column q with exp(-i*phi) and row q with exp(i*phi) */
+        for (k=0; k<n; k++)
+        {
+          if (ai)
+            LANES(l)
+            {
+              tmp              = ar[k+q*n][l]*cp[l] + ai[k+q*n][l]*sp[l];
+              ai[k+q*n][l]     = ai[k+q*n][l]*cp[l] - ar[k+q*n][l]*sp[l];
+              ar[k+q*n][l]     = tmp;
+            }
+          else
+            LANES(l) ar[k+q*n][l] *= cp[l];
+          if (vr && vi)
+            LANES(l)
+            {
+              tmp              = vr[k+q*n][l]*cp[l] + vi[k+q*n][l]*sp[l];
+              vi[k+q*n][l]     = vi[k+q*n][l]*cp[l] - vr[k+q*n][l]*sp[l];
+              vr[k+q*n][l]     = tmp;
+            }
+          else if (vr)
+            LANES(l) vr[k+q*n][l] *= cp[l];
+        }
+        for (k=0; k<n; k++)
+        {
+          if (ai)
+            LANES(l)
+            {
+              tmp              = ar[q+k*n][l]*cp[l] - ai[q+k*n][l]*sp[l];
+              ai[q+k*n][l]     = ai[q+k*n][l]*cp[l] + ar[q+k*n][l]*sp[l];
+              ar[q+k*n][l]     = tmp;
+            }
+          else
+            LANES(l) ar[q+k*n][l] *= cp[l];
+        }
+
+        /* rotate columns p and q, and subsequently rows p and q */
+        for (k=0; k<n; k++)
+        {
+          LANES(l)
+          {
+            tmp              = c[l]*ar[k+p*n][l] - s[l]*ar[k+q*n][l];
+            ar[k+q*n][l]     = s[l]*ar[k+p*n][l] + c[l]*ar[k+q*n][l];
+            ar[k+p*n][l]     = tmp;
+          }
+          if (ai)
+            LANES(l)
+            {
+              tmp              = c[l]*ai[k+p*n][l] - s[l]*ai[k+q*n][l];
+              ai[k+q*n][l]     = s[l]*ai[k+p*n][l] + c[l]*ai[k+q*n][l];
+              ai[k+p*n][l]     = tmp;
+            }
+          if (vr)
+            LANES(l)
+            {
+              tmp              = c[l]*vr[k+p*n][l] - s[l]*vr[k+q*n][l];
+              vr[k+q*n][l]     = s[l]*vr[k+p*n][l] + c[l]*vr[k+q*n][l];
+              vr[k+p*n][l]     = tmp;
+            }
+          if (vi)
+            LANES(l)
+            {
+              tmp              = c[l]*vi[k+p*n][l] - s[l]*vi[k+q*n][l];
+              vi[k+q*n][l]     = s[l]*vi[k+p*n][l] + c[l]*vi[k+q*n][l];
+              vi[k+p*n][l]     = tmp;
+            }
+        }
+        for (k=0; k<n; k++)
+        {
+          LANES(l)
+          {
+            tmp              = c[l]*ar[p+k*n][l] - s[l]*ar[q+k*n][l];
+            ar[q+k*n][l]     = s[l]*ar[p+k*n][l] + c[l]*ar[q+k*n][l];
+            ar[p+k*n][l]     = tmp;
+          }
+          if (ai)
+            LANES(l)
+            {
+              tmp              = c[l]*ai[p+k*n][l] - s[l]*ai[q+k*n][l];
+              ai[q+k*n][l]     = s[l]*ai[p+k*n][l] + c[l]*ai[q+k*n][l];
+              ai[p+k*n][l]     = tmp;
+            }
+        }
+
+        /* these are zero up to rounding errors */
+        LANES(l)
+        {
+          ar[p+q*n][l] = 0;
+          ar[q+p*n][l] = 0;
+        }
+        if (ai)
+          LANES(l)
+          {
+            ai[p+q*n][l] = 0;
+            ai[q+p*n][l] = 0;
+          }
+      }
+  }
+
+  for (i=0; i<n; i++)
+    LANES(l) d[i][l] = ar[i+i*n][l];
+
+  /* sort the eigenvalues in ascending order, and the eigenvectors along with them */
+  for (l=0; l<SMALLMAT_BLOCK; l++)
+    for (i=1; i<n; i++)
+      for (j=i; j>0 && d[j-1][l]>d[j][l]; j--)
+      {
+        tmp = d[j][l]; d[j][l] = d[j-1][l]; d[j-1][l] = tmp;
+        if (vr)
+          for (k=0; k<n; k++)
+          {
+            tmp = vr[k+j*n][l]; vr[k+j*n][l] = vr[k+(j-1)*n][l]; vr[k+(j-1)*n][l] = tmp;
+            if (vi)
+            {
+              tmp = vi[k+j*n][l]; vi[k+j*n][l] = vi[k+(j-1)*n][l]; vi[k+(j-1)*n][l] = tmp;
+            }
+          }
+      }
+}
+
+static inline void *smallmat_work(void *arg)
+{
+  const smallmat_t *s = (const smallmat_t *)arg;
+  mwSize block, first;
+  for (block=s->begin; block<s->end; block++)
+  {
+    first = block*SMALLMAT_BLOCK;
+    s->kernel(s, first, (s->num-first < SMALLMAT_BLOCK ? (int)(s->num-first) : SMALLMAT_BLOCK));
+  }
+  return NULL;
+}
+
+/* apply the kernel to all matrices, note that no MATLAB functions may be called from the kernel */
+static inline void smallmat_run(smallmat_t *s)
+{
+  mwSize nblock = (s->num + SMALLMAT_BLOCK - 1) / SMALLMAT_BLOCK;
+  int i, nthreads = 1;
+#ifdef SMALLMAT_THREADS
+  pthread_t thread[SMALLMAT_MAXTHREADS];
+  smallmat_t part[SMALLMAT_MAXTHREADS];
+  int started[SMALLMAT_MAXTHREADS];
+
+  if (s->num >= SMALLMAT_MINSIZE)
+  {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = (ncpu > SMALLMAT_MAXTHREADS ? SMALLMAT_MAXTHREADS : (ncpu < 1 ? 1 : (int)ncpu));
+  }
+
+  if (nthreads > 1)
+  {
+    for (i=0; i<nthreads; i++)
+    {
+      part[i]       = *s;
+      part[i].begin = (nblock * i) / nthreads;
+      part[i].end   = (nblock * (i+1)) / nthreads;
+      started[i]    = (pthread_create(&thread[i], NULL, smallmat_work, &part[i]) == 0);
+    }
+    for (i=0; i<nthreads; i++)
+    {
+      if (started[i])
+        pthread_join(thread[i], NULL);
+      else
+        /* do the work of this part in the calling thread */
+        smallmat_work(&part[i]);
+    }
+    return;
+  }
+#endif
+
+  s->begin = 0;
+  s->end   = nblock;
+  smallmat_work(s);
+}
+
+/* create an output with nelc elements per matrix, the first two dimensions are nelc x 1 if it has less elements than the input */
+static inline mxArray *smallmat_create(const mxArray *x, int nel, int nelc, mxClassID classid, int complex)
+{
+  const mwSize *dims = mxGetDimensions(x);
+  mwSize *dimsout, numdims = mxGetNumberOfDimensions(x);
+  mwIndex i;
+  mxArray *y;
+
+  dimsout = mxMalloc(numdims * sizeof(mwSize));
+  for (i=0; i<numdims; i++)
+    dimsout[i] = dims[i];
+  if (nelc < nel)
+  {
+    dimsout[0] = nelc;
+    dimsout[1] = 1;
+  }
+  y = mxCreateNumericArray(numdims, dimsout, classid, (complex ? mxCOMPLEX : mxREAL));
+  mxFree(dimsout);
+  return y;
+}
+
+/* check the input and set up the output with nelc elements per matrix, no output is created if nelc is 0 */
+static inline void smallmat_init(smallmat_t *s, mxArray *plhs[], int nrhs, const mxArray *prhs[], int nrequired, int nel, int nelc)
+{
+  mwIndex i;
+  mxClassID classid;
+
+  memset(s, 0, sizeof(smallmat_t));
+
+  if (nrhs != nrequired)
+    mexErrMsgTxt("Wrong number of input arguments");
+
+  for (i=0; i<(mwIndex)nrhs; i++)
+  {
+    if (!mxIsDouble(prhs[i]) && !mxIsSingle(prhs[i]))
+      mexErrMsgTxt("The input should be double or single precision");
+    if (mxGetNumberOfElements(prhs[i]) != mxGetNumberOfElements(prhs[0]))
+      mexErrMsgTxt("The inputs should have the same size");
+  }
+
+  s->num     = mxGetNumberOfElements(prhs[0]) / nel;
+  s->nela    = nel;
+  s->ar      = mxGetData(prhs[0]);
+  s->ai      = mxGetImagData(prhs[0]);
+  s->singlea = mxIsSingle(prhs[0]);
+  s->complex = (s->ai != NULL);
+  if (nrhs > 1)
+  {
+    s->nelb    = nel;
+    s->br      = mxGetData(prhs[1]);
+    s->bi      = mxGetImagData(prhs[1]);
+    s->singleb = mxIsSingle(prhs[1]);
+    s->complex = s->complex || (s->bi != NULL);
+  }
+
+  /* the output is single precision if any of the inputs is */
+  classid    = ((s->singlea || s->singleb) ? mxSINGLE_CLASS : mxDOUBLE_CLASS);
+  s->singlec = (classid == mxSINGLE_CLASS);
+  s->nelc    = nelc;
+
+  if (nelc > 0)
+  {
+    plhs[0] = smallmat_create(prhs[0], nel, nelc, classid, s->complex);
+    s->cr   = mxGetData(plhs[0]);
+    s->ci   = mxGetImagData(plhs[0]);
+  }
+}
+
+/* check that the input consists of square matrices that are supported by the batched functions and return their order */
+static inline int smallmat_order(const mxArray *x)
+{
+  const mwSize *dims = mxGetDimensions(x);
+  if (mxGetNumberOfDimensions(x) < 2 || dims[0] != dims[1])
+    mexErrMsgTxt("The input should consist of square matrices along the first two dimensions");
+  if (dims[0] < 1 || dims[0] > SMALLMAT_MAXN)
+    mexErrMsgTxt("The matrices should be at most 8x8");
+  return (int)dims[0];
+}
+
+#endif /* SMALLMAT_H */
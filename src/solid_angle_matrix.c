@@ -0,0 +1,170 @@
+#include <math.h>
+#include "mex.h"
+#include "platform.h"
+
+#if !defined(PLATFORM_WINDOWS)
+#include <pthread.h>
+#include <unistd.h>
+#define SOLANG_THREADS
+#endif
+
+#define SOLANG_BLOCK      512       /* number of observation points that are processed together */
+#define SOLANG_MAXTHREADS 16
+#define SOLANG_MINSIZE    (1<<16)   /* number of points times triangles below which a single thread is used */
+
+typedef struct {
+  const double *obs;    /* observation points, nobs x 3 */
+  const double *v;      /* vertices of the triangles, ntri x 9 with the x, y and z of each of the three vertices */
+  mwSize nobs, ntri;
+  double *sa;           /* solid angles, nobs x ntri */
+  mwSize begin, end;    /* the observation points that are computed by this thread */
+} solang_t;
+
+/*
+ * Compute the solid angles of all triangles for a range of observation points.
+ * This is the same computation as solang in geometry.c. The points are processed
+ * in blocks that remain in the cache while looping over the triangles, and the
+ * loop over the points in a block has no branches and writes contiguously to the
+ * output, so that it can be vectorized.
+ */
+static void *
+solang_matrix (void *arg)
+{
+  const solang_t *s = (const solang_t *)arg;
+  double r1[3], r2[3], r3[3], cp23_x, cp23_y, cp23_z, n1, n2, n3, ip12, ip23, ip13, nom, den, nan = mxGetNaN();
+  const double *ox = s->obs, *oy = s->obs + s->nobs, *oz = s->obs + 2*s->nobs;
+  const double *v;
+  double *sa;
+  mwSize b, bend, i, j;
+
+  for (b=s->begin; b<s->end; b+=SOLANG_BLOCK)
+  {
+    bend = (b+SOLANG_BLOCK < s->end ? b+SOLANG_BLOCK : s->end);
+    for (j=0; j<s->ntri; j++)
+    {
+      v  = s->v + 9*j;
+      sa = s->sa + j*s->nobs;
+      for (i=b; i<bend; i++)
+      {
+        /* the vertices relative to the observation point */
+        r1[0] = v[0] - ox[i]; r1[1] = v[1] - oy[i]; r1[2] = v[2] - oz[i];
+        r2[0] = v[3] - ox[i]; r2[1] = v[4] - oy[i]; r2[2] = v[5] - oz[i];
+        r3[0] = v[6] - ox[i]; r3[1] = v[7] - oy[i]; r3[2] = v[8] - oz[i];
+
+        cp23_x = r2[1] * r3[2] - r2[2] * r3[1];
+        cp23_y = r2[2] * r3[0] - r2[0] * r3[2];
+        cp23_z = r2[0] * r3[1] - r2[1] * r3[0];
+        nom = cp23_x*r1[0] + cp23_y*r1[1] + cp23_z*r1[2];
+        n1 = sqrt(r1[0]*r1[0] + r1[1]*r1[1] + r1[2]*r1[2]);
+        n2 = sqrt(r2[0]*r2[0] + r2[1]*r2[1] + r2[2]*r2[2]);
+        n3 = sqrt(r3[0]*r3[0] + r3[1]*r3[1] + r3[2]*r3[2]);
+        ip12 = r1[0]*r2[0] + r1[1]*r2[1] + r1[2]*r2[2];
+        ip23 = r2[0]*r3[0] + r2[1]*r3[1] + r2[2]*r3[2];
+        ip13 = r1[0]*r3[0] + r1[1]*r3[1] + r1[2]*r3[2];
+        den = n1*n2*n3 + ip12*n3 + ip23*n1 + ip13*n2;
+
+        /* the solid angle is not defined for a point on the triangle */
+        sa[i] = ((nom==0 && den<=0) ? nan : -2.*atan2 (nom,den));
+      }
+    }
+  }
+  return NULL;
+}
+
+void
+mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
+{
+  mxArray *sa;
+  solang_t s;
+  double *pnt, *tri, *v;
+  mwSize npnt, i, k;
+  int t, nthreads = 1;
+  long indx;
+
+  if (nrhs!=3)
+    mexErrMsgTxt ("Invalid number of input arguments");
+  for (t=0; t<3; t++)
+    if (!mxIsDouble(prhs[t]) || mxIsComplex(prhs[t]))
+      mexErrMsgTxt ("The input arguments should be real-valued double precision");
+  if (mxGetN(prhs[0])!=3)
+    mexErrMsgTxt ("Invalid dimension for input argument 1");
+  if (mxGetN(prhs[1])!=3)
+    mexErrMsgTxt ("Invalid dimension for input argument 2");
+  if (mxGetN(prhs[2])!=3)
+    mexErrMsgTxt ("Invalid dimension for input argument 3");
+
+  s.obs  = mxGetData(prhs[0]);
+  s.nobs = mxGetM(prhs[0]);
+  pnt    = mxGetData(prhs[1]);
+  npnt   = mxGetM(prhs[1]);
+  tri    = mxGetData(prhs[2]);
+  s.ntri = mxGetM(prhs[2]);
+
+  /* look up the vertices of each triangle only once */
+  v = mxMalloc((s.ntri>0 ? 9*s.ntri : 1)*sizeof(double));
+  for (i=0; i<s.ntri; i++)
+    for (t=0; t<3; t++)
+    {
+      indx = (long)(tri[i+t*s.ntri]) - 1;
+      if (indx<0 || indx>=(long)npnt)
+      {
+        mxFree(v);
+        mexErrMsgTxt ("Invalid vertex index in the triangles");
+      }
+      for (k=0; k<3; k++)
+        v[9*i+3*t+k] = pnt[indx+k*npnt];
+    }
+  s.v = v;
+
+  sa   = mxCreateDoubleMatrix (s.nobs, s.ntri, mxREAL);
+  s.sa = mxGetData(sa);
+
+#ifdef SOLANG_THREADS
+  if (s.nobs>SOLANG_BLOCK && s.nobs*s.ntri>=SOLANG_MINSIZE)
+  {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    mwSize nblock = (s.nobs + SOLANG_BLOCK - 1)/SOLANG_BLOCK;
+    nthreads = (ncpu>SOLANG_MAXTHREADS ? SOLANG_MAXTHREADS : (ncpu<1 ? 1 : (int)ncpu));
+    nthreads = ((mwSize)nthreads>nblock ? (int)nblock : nthreads);
+  }
+
+  if (nthreads>1)
+  {
+    pthread_t thread[SOLANG_MAXTHREADS];
+    solang_t part[SOLANG_MAXTHREADS];
+    int started[SOLANG_MAXTHREADS];
+    mwSize nblock = (s.nobs + SOLANG_BLOCK - 1)/SOLANG_BLOCK;
+
+    /* divide the blocks of observation points over the threads */
+    for (t=0; t<nthreads; t++)
+    {
+      part[t]       = s;
+      part[t].begin = ((nblock*t)/nthreads)*SOLANG_BLOCK;
+      part[t].end   = ((nblock*(t+1))/nthreads)*SOLANG_BLOCK;
+      part[t].end   = (part[t].end>s.nobs ? s.nobs : part[t].end);
+      started[t]    = (pthread_create(&thread[t], NULL, solang_matrix, &part[t])==0);
+    }
+    for (t=0; t<nthreads; t++)
+    {
+      if (started[t])
+        pthread_join(thread[t], NULL);
+      else
+        solang_matrix(&part[t]);
+    }
+  }
+#endif
+
+  if (nthreads==1)
+  {
+    s.begin = 0;
+    s.end   = s.nobs;
+    solang_matrix(&s);
+  }
+
+  mxFree(v);
+
+  /* assign the output parameter */
+  plhs[0] = sa;
+
+  return;
+}
@@ -0,0 +1,55 @@
+function [w] = solid_angle_matrix(obs, pnt, tri)
+
+% SOLID_ANGLE_MATRIX computes the solid angle of all triangles of a mesh as
+% seen from each of the observation points, such as needed for assembling the
+% system matrix of a boundary element method.
+%
+% Use:
+%   [w] = solid_angle_matrix(obs, pnt, tri)
+% where obs is a Nobs x 3 matrix with the observation points, and pnt and tri
+% contain a description of a triangular mesh. The output is a Nobs x Ntri
+% matrix. The solid angle is NaN for observation points that lie on the
+% triangle, such as its vertices.
+%
+% This is the same as calling SOLID_ANGLE for each observation point after
+% shifting the mesh, but the mex file is much faster.
+%
+% See also SOLID_ANGLE
+
+% Copyright (C) 2017, Robert Oostenveld
+%
+% This file is part of FieldTrip, see http://www.fieldtriptoolbox.org
+% for the documentation and details.
+%
+%    FieldTrip is free software: you can redistribute it and/or modify
+%    it under the terms of the GNU General Public License as published by
+%    the Free Software Foundation, either version 3 of the License, or
+%    (at your option) any later version.
+%
+%    FieldTrip is distributed in the hope that it will be useful,
+%    but WITHOUT ANY WARRANTY; without even the implied warranty of
+%    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+%    GNU General Public License for more details.
+%
+%    You should have received a copy of the GNU General Public License
+%    along with FieldTrip. If not, see <http://www.gnu.org/licenses/>.
+%
+% $Id$
+
+nobs = size(obs,1);
+ntri = size(tri,1);
+w    = zeros(nobs, ntri);
+
+for i=1:nobs
+  r1 = bsxfun(@minus, pnt(tri(:,1),:), obs(i,:));
+  r2 = bsxfun(@minus, pnt(tri(:,2),:), obs(i,:));
+  r3 = bsxfun(@minus, pnt(tri(:,3),:), obs(i,:));
+  nom = sum(cross(r2, r3, 2) .* r1, 2);
+  n1  = sqrt(sum(r1.^2, 2));
+  n2  = sqrt(sum(r2.^2, 2));
+  n3  = sqrt(sum(r3.^2, 2));
+  den = n1.*n2.*n3 + sum(r1.*r2, 2).*n3 + sum(r2.*r3, 2).*n1 + sum(r1.*r3, 2).*n2;
+  sa  = -2 * atan2(nom, den);
+  sa(nom==0 & den<=0) = nan;
+  w(i,:) = sa;
+end
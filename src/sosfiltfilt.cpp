@@ -0,0 +1,290 @@
+#include "mex.h"
+#include "platform.h"
+
+#include <string.h>
+#include <vector>
+
+/* the second-order sections of the realtime buffer, see realtime/src/buffer/cpp */
+#include "MultiChannelFilter.h"
+
+#if !defined(PLATFORM_WINDOWS)
+#include <pthread.h>
+#include <unistd.h>
+#define SOSFILTFILT_THREADS
+#endif
+
+#define SOSFILTFILT_MAXTHREADS 16
+#define SOSFILTFILT_BLOCK      64    /* number of channels that are filtered together */
+
+#define FILTER_SOS      0
+#define FILTER_LOWPASS  1
+#define FILTER_HIGHPASS 2
+#define FILTER_BANDPASS 3
+#define FILTER_NOTCH    4
+
+/* the data and filter that are shared by all threads */
+template <typename T>
+struct sosfiltfilt_t {
+    const T *x;
+    T *y;
+    mwSize nchan, ntime, nblock;
+    int type, order, nsos, nfact;
+    double freq[2];
+    const double *sos;          /* nsos x 6, stored per section */
+    mwSize begin, end;          /* the blocks of channels and trials that are filtered by this thread */
+};
+
+template <typename T>
+static void designFilter(MultiChannelFilter<T,T> &filt, const sosfiltfilt_t<T> *s) {
+    switch (s->type) {
+        case FILTER_SOS:
+            filt.setSOS(s->nsos, s->sos);
+            break;
+        case FILTER_LOWPASS:
+            filt.setButterLP(s->freq[0]);
+            break;
+        case FILTER_HIGHPASS:
+            filt.setButterHP(s->freq[0]);
+            break;
+        case FILTER_BANDPASS:
+            filt.setButterBP(s->freq[0], s->freq[1]);
+            break;
+        case FILTER_NOTCH:
+            filt.addNotch(s->freq[0], s->freq[1]);
+            break;
+    }
+}
+
+/* reverse the order of the samples, each sample has nc channels */
+template <typename T>
+static void reverseSamples(T *buf, mwSize nsamples, mwSize nc) {
+    for (mwSize t = 0; t < nsamples/2; t++) {
+        T *a = buf + t*nc;
+        T *b = buf + (nsamples-1-t)*nc;
+        for (mwSize i = 0; i < nc; i++) {
+            T tmp = a[i];
+            a[i] = b[i];
+            b[i] = tmp;
+        }
+    }
+}
+
+/*
+ * Filter a range of blocks forwards and backwards. The signal of each block is extended at both
+ * ends with nfact samples, which are reflected around the first and last sample, and the filter
+ * starts in the steady state of the first sample of each pass. This is the same as FILTFILT.
+ */
+template <typename T>
+static void *filterRange(void *arg) {
+    const sosfiltfilt_t<T> *s = (const sosfiltfilt_t<T> *)arg;
+    mwSize nchan = s->nchan, ntime = s->ntime, nfact = s->nfact;
+    mwSize ntot = ntime + 2*nfact;
+    std::vector<T> work(SOSFILTFILT_BLOCK*ntot);
+    T *buf = &work[0];
+
+    for (mwSize u = s->begin; u < s->end; u++) {
+        mwSize trial = u / s->nblock;
+        mwSize c0 = (u % s->nblock) * SOSFILTFILT_BLOCK;
+        mwSize nc = (nchan-c0 < SOSFILTFILT_BLOCK ? nchan-c0 : SOSFILTFILT_BLOCK);
+        const T *x = s->x + trial*nchan*ntime + c0;
+        T *y = s->y + trial*nchan*ntime + c0;
+        MultiChannelFilter<T,T> filt((int)nc, s->order);
+
+        designFilter(filt, s);
+
+        for (mwSize t = 0; t < ntime; t++) {
+            for (mwSize i = 0; i < nc; i++) {
+                buf[(nfact+t)*nc+i] = x[t*nchan+i];
+            }
+        }
+        for (mwSize t = 1; t <= nfact; t++) {
+            for (mwSize i = 0; i < nc; i++) {
+                buf[(nfact-t)*nc+i] = 2*x[i] - x[t*nchan+i];
+                buf[(nfact+ntime-1+t)*nc+i] = 2*x[(ntime-1)*nchan+i] - x[(ntime-1-t)*nchan+i];
+            }
+        }
+
+        /* forward */
+        filt.setSteadyState(buf);
+        filt.process((int)ntot, buf, buf);
+
+        /* backward */
+        reverseSamples(buf, ntot, nc);
+        filt.setSteadyState(buf);
+        filt.process((int)ntot, buf, buf);
+        reverseSamples(buf, ntot, nc);
+
+        for (mwSize t = 0; t < ntime; t++) {
+            for (mwSize i = 0; i < nc; i++) {
+                y[t*nchan+i] = buf[(nfact+t)*nc+i];
+            }
+        }
+    }
+    return NULL;
+}
+
+template <typename T>
+static void filterAll(sosfiltfilt_t<T> &s, mwSize nunit) {
+    int nthreads = 1;
+
+    s.begin = 0;
+    s.end = nunit;
+
+#ifdef SOSFILTFILT_THREADS
+    {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = (ncpu > SOSFILTFILT_MAXTHREADS ? SOSFILTFILT_MAXTHREADS : (ncpu < 1 ? 1 : (int)ncpu));
+        nthreads = ((mwSize)nthreads > nunit ? (int)nunit : nthreads);
+    }
+
+    if (nthreads > 1) {
+        pthread_t thread[SOSFILTFILT_MAXTHREADS];
+        sosfiltfilt_t<T> part[SOSFILTFILT_MAXTHREADS];
+        int started[SOSFILTFILT_MAXTHREADS];
+
+        for (int t = 0; t < nthreads; t++) {
+            part[t] = s;
+            part[t].begin = (nunit*t)/nthreads;
+            part[t].end = (nunit*(t+1))/nthreads;
+            started[t] = (pthread_create(&thread[t], NULL, filterRange<T>, &part[t]) == 0);
+        }
+        for (int t = 0; t < nthreads; t++) {
+            if (started[t])
+                pthread_join(thread[t], NULL);
+            else
+                filterRange<T>(&part[t]);
+        }
+    }
+#endif
+
+    if (nthreads <= 1) {
+        filterRange<T>(&s);
+    }
+}
+
+template <typename T>
+static void filterArray(const mxArray *input, mxArray *output, int type, int order, const double *freq, const std::vector<double> &sos) {
+    sosfiltfilt_t<T> s;
+    const mwSize *dim = mxGetDimensions(input);
+    mwSize nchan = dim[0];
+    mwSize ntime = (mxGetNumberOfDimensions(input) > 1 ? dim[1] : 1);
+    mwSize ntrial, nsection;
+
+    if (nchan == 0 || ntime == 0) {
+        return;
+    }
+    ntrial = mxGetNumberOfElements(input) / (nchan*ntime);
+
+    s.x = (const T *)mxGetData(input);
+    s.y = (T *)mxGetData(output);
+    s.nchan = nchan;
+    s.ntime = ntime;
+    s.nblock = (nchan + SOSFILTFILT_BLOCK - 1) / SOSFILTFILT_BLOCK;
+    s.type = type;
+    s.order = order;
+    s.nsos = (int)(sos.size()/6);
+    s.sos = (sos.empty() ? NULL : &sos[0]);
+    s.freq[0] = freq[0];
+    s.freq[1] = freq[1];
+
+    /* the length of the reflections at the edges, as in FILTFILT this is three times the filter order */
+    {
+        MultiChannelFilter<T,T> probe(1, order);
+        designFilter(probe, &s);
+        nsection = probe.getNumSections();
+    }
+    s.nfact = (int)(6*nsection < ntime ? 6*nsection : ntime-1);
+
+    filterAll<T>(s, ntrial*s.nblock);
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+    int type = FILTER_SOS, order = 0;
+    double freq[2] = {0, 0};
+    std::vector<double> sos;
+    char str[16];
+
+    if (nrhs != 2 && nrhs != 4) {
+        mexErrMsgIdAndTxt("FieldTrip:sosfiltfilt:nrhs", "use as sosfiltfilt(dat, sos) or sosfiltfilt(dat, type, order, freq)");
+    }
+    if (nlhs > 1) {
+        mexErrMsgIdAndTxt("FieldTrip:sosfiltfilt:nlhs", "too many output arguments");
+    }
+    if ((!mxIsDouble(prhs[0]) && !mxIsSingle(prhs[0])) || mxIsComplex(prhs[0]) || mxIsSparse(prhs[0]) || mxGetNumberOfDimensions(prhs[0]) > 3) {
+        mexErrMsgIdAndTxt("FieldTrip:sosfiltfilt:dat", "the data must be a real-valued chan x time x trial array in single or double precision");
+    }
+
+    if (nrhs == 2) {
+        /* second-order sections, one per row */
+        const double *p;
+        mwSize nsos;
+        if (!mxIsDouble(prhs[1]) || mxIsComplex(prhs[1]) || mxGetN(prhs[1]) != 6) {
+            mexErrMsgIdAndTxt("FieldTrip:sosfiltfilt:sos", "the second-order sections must be a real-valued L x 6 matrix");
+        }
+        nsos = mxGetM(prhs[1]);
+        p = mxGetPr(prhs[1]);
+        sos.resize(6*nsos);
+        for (mwSize k = 0; k < nsos; k++) {
+            for (int j = 0; j < 6; j++) {
+                sos[6*k+j] = p[k+j*nsos];
+            }
+            if (sos[6*k+3] == 0) {
+                mexErrMsgIdAndTxt("FieldTrip:sosfiltfilt:sos", "the leading denominator coefficient of each section must be nonzero");
+            }
+        }
+    }
+    else {
+        /* Butterworth or notch filter */
+        if (!mxIsChar(prhs[1]) || mxGetString(prhs[1], str, sizeof(str)) != 0) {
+            mexErrMsgIdAndTxt("FieldTrip:sosfiltfilt:type", "the filter type must be 'lp', 'hp', 'bp' or 'notch'");
+        }
+        if (strcmp(str, "lp") == 0) {
+            type = FILTER_LOWPASS;
+        }
+        else if (strcmp(str, "hp") == 0) {
+            type = FILTER_HIGHPASS;
+        }
+        else if (strcmp(str, "bp") == 0) {
+            type = FILTER_BANDPASS;
+        }
+        else if (strcmp(str, "notch") == 0) {
+            type = FILTER_NOTCH;
+        }
+        else {
+            mexErrMsgIdAndTxt("FieldTrip:sosfiltfilt:type", "the filter type must be 'lp', 'hp', 'bp' or 'notch'");
+        }
+        if (!mxIsNumeric(prhs[2]) || mxGetNumberOfElements(prhs[2]) != 1 || !(mxGetScalar(prhs[2]) > 0)) {
+            mexErrMsgIdAndTxt("FieldTrip:sosfiltfilt:order", "the filter order or notch bandwidth must be a positive scalar");
+        }
+        if (!mxIsDouble(prhs[3]) || mxIsComplex(prhs[3]) || mxGetNumberOfElements(prhs[3]) != (type == FILTER_BANDPASS ? 2 : 1)) {
+            mexErrMsgIdAndTxt("FieldTrip:sosfiltfilt:freq", "the frequency must be a scalar, or [low high] for a bandpass filter");
+        }
+        freq[0] = mxGetPr(prhs[3])[0];
+        freq[1] = (type == FILTER_BANDPASS ? mxGetPr(prhs[3])[1] : freq[0]);
+        if (!(freq[0] > 0 && freq[0] < 1 && freq[1] > 0 && freq[1] < 1 && freq[0] <= freq[1])) {
+            mexErrMsgIdAndTxt("FieldTrip:sosfiltfilt:freq", "the frequencies must be normalised to the Nyquist frequency, between 0 and 1");
+        }
+        if (type == FILTER_NOTCH) {
+            /* the bandwidth takes the place of the order */
+            freq[1] = mxGetScalar(prhs[2]);
+            if (!(freq[1] < 1)) {
+                mexErrMsgIdAndTxt("FieldTrip:sosfiltfilt:order", "the notch bandwidth must be normalised to the Nyquist frequency, between 0 and 1");
+            }
+        }
+        else {
+            order = (int)mxGetScalar(prhs[2]);
+            if (order < 1 || order != mxGetScalar(prhs[2])) {
+                mexErrMsgIdAndTxt("FieldTrip:sosfiltfilt:order", "the filter order must be a positive integer");
+            }
+        }
+    }
+
+    plhs[0] = mxCreateNumericArray(mxGetNumberOfDimensions(prhs[0]), mxGetDimensions(prhs[0]), mxGetClassID(prhs[0]), mxREAL);
+
+    if (mxIsSingle(prhs[0])) {
+        filterArray<float>(prhs[0], plhs[0], type, order, freq, sos);
+    }
+    else {
+        filterArray<double>(prhs[0], plhs[0], type, order, freq, sos);
+    }
+}
@@ -0,0 +1,77 @@
+function [varargout] = sosfiltfilt(varargin)
+
+% SOSFILTFILT applies a zero-phase forward and reverse IIR filter, specified as a
+% cascade of second-order sections, to each channel of each trial. The filter is
+% the same as the MultiChannelFilter that is used in the realtime buffer, hence
+% offline and online filtering give the same result.
+%
+% Use as
+%   dat = sosfiltfilt(dat, sos)
+%   dat = sosfiltfilt(dat, type, order, freq)
+% where
+%   dat   = Nchan x Ntime or Nchan x Ntime x Ntrial array, single or double precision
+%   sos   = L x 6 matrix with the sections [b0 b1 b2 a0 a1 a2], e.g. from ZP2SOS
+%   type  = 'lp', 'hp', 'bp' or 'notch'
+%   order = order of the Butterworth filter, or the -3 dB bandwidth of the notch
+%   freq  = cutoff frequency, [low high] for 'bp', or the frequency of the notch,
+%           normalised to the Nyquist frequency
+%
+% As in FILTFILT, the data is extended at both ends with a reflection of three times
+% the filter order, and the filter starts in its steady state. The effective order
+% is hence twice the filter order, and the Butterworth response is -6 dB at the
+% cutoff frequency. The output has the same precision as the input. The
+% trials and blocks of channels are distributed over multiple threads.
+%
+% See also FT_PREPROC_LOWPASSFILTER, FT_PREPROC_HIGHPASSFILTER, FILTFILT
+
+% Copyright (C) 2017, Robert Oostenveld
+%
+% This file is part of FieldTrip, see http://www.fieldtriptoolbox.org
+% for the documentation and details.
+%
+%    FieldTrip is free software: you can redistribute it and/or modify
+%    it under the terms of the GNU General Public License as published by
+%    the Free Software Foundation, either version 3 of the License, or
+%    (at your option) any later version.
+%
+%    FieldTrip is distributed in the hope that it will be useful,
+%    but WITHOUT ANY WARRANTY; without even the implied warranty of
+%    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+%    GNU General Public License for more details.
+%
+%    You should have received a copy of the GNU General Public License
+%    along with FieldTrip. If not, see <http://www.gnu.org/licenses/>.
+%
+% $Id$
+
+% compile the missing mex file on the fly
+% remember the original working directory
+pwdir = pwd;
+
+% determine the name and full path of this function
+funname = mfilename('fullpath');
+mexsrc  = [funname '.cpp'];
+[mexdir, mexname] = fileparts(funname);
+
+try
+  % try to compile the mex file on the fly
+  warning('trying to compile MEX file from %s', mexsrc);
+  cd(mexdir);
+  mex(mexsrc, ['-I' fullfile(mexdir, '..', 'realtime', 'src', 'buffer', 'cpp')]);
+  cd(pwdir);
+  success = true;
+
+catch
+  % compilation failed
+  disp(lasterr);
+  error('could not locate MEX file for %s', mexname);
+  cd(pwdir);
+  success = false;
+end
+
+if success
+  % execute the mex file that was juist created
+  funname   = mfilename;
+  funhandle = str2func(funname);
+  [varargout{1:nargout}] = funhandle(varargin{:});
+end
@@ -25,137 +25,151 @@
 
 #include <math.h>
 #include "mex.h"
+#include "platform.h"
 
-double legendre_Pmm(double m, double x)
+#if !defined(PLATFORM_WINDOWS)
+#include <pthread.h>
+#include <unistd.h>
+#define SPLINT_THREADS
+#endif
+
+#define M 4		/* constant in denominator              */
+#define N 9		/* number of terms for series expansion */
+
+/* these ratios for the series summation were computed in Matlab for M=4, N=9 */
+#define GXQ {0.1875, 0.0038580246913580244772, 0.00033757716049382714175, 5.624999999999999846e-05, 1.3580246913580246623e-05, 4.177786004802525277e-06, 1.5252433881715951896e-06, 6.3258506706294770457e-07, 2.8959000152415790233e-07}
+#define HXQ {0.375, 0.023148148148148146863, 0.0040509259259259257011, 0.001124999999999999915, 0.00040740740740740738176, 0.00017546701220170606841, 8.5413629737609325534e-05, 4.5546124828532236423e-05, 2.6063100137174212163e-05}
+
+#define TILE       256          /* number of entries for which the series is computed together */
+#define MAXTHREADS 16
+#define MINSIZE    (1<<16)      /* number of entries below which a single thread is used */
+
+typedef struct {
+  const double *xd;
+  double *gxd, *hxd;
+  mwSize begin, end;
+} splint_t;
+
+/*
+ * Compute the series for a range of entries. Rather than calling plgndr for each
+ * order, which repeats the recurrence from the start, the upward recurrence
+ * P(l,0) = ((2l-1) x P(l-1,0) - (l-1) P(l-2,0)) / l is done once for a tile of
+ * entries. The loops over the entries in a tile are independent and can be
+ * vectorized, the result is the same as with plgndr.
+ */
+static void *
+splint_series (void *arg)
 {
-  if(m == 0)
-  {
-    return 1.0;
-  }
-  else
+  const splint_t *s = (const splint_t *)arg;
+  double x[TILE], p_ellm2[TILE], p_ellm1[TILE], p_ell, gx[TILE], hx[TILE];
+  double gxq[] = GXQ;
+  double hxq[] = HXQ;
+  mwSize b, i, n;
+  int ell;
+
+  for (b=s->begin; b<s->end; b+=TILE)
   {
-    double p_mm = 1.0;
-    double root_factor = sqrt(1.0-x)*sqrt(1.0+x);
-    double fact_coeff = 1.0;
-    int i;
-    for(i=1; i<=m; i++)
+    n = (s->end-b<TILE ? s->end-b : TILE);
+
+    for (i=0; i<n; i++)
     {
-      p_mm *= -fact_coeff * root_factor;
-      fact_coeff += 2.0;
+      /* to avoid rounding off errors */
+      x[i] = s->xd[b+i];
+      x[i] = ( x[i] >  1 ?   1 : x[i] );
+      x[i] = ( x[i] < -1 ?  -1 : x[i] );
+      /* start at P(0,0) and P(1,0) */
+      p_ellm2[i] = 1.0;
+      p_ellm1[i] = x[i] * 1 * 1.0;
+      gx[i] = gxq[0]*p_ellm1[i];
+      hx[i] = -hxq[0]*p_ellm1[i];
     }
-    return p_mm;
-  }
-}
 
-double plgndr(int l, int m, double x)
-{
-  /* these are constant, but can only be assigned after checking the input arguments */
-  double dif, sum, t_d, t_s, exp_check, err_amp;
-  
-  double p_mm, p_mmp1;
-  double result;
-  
-  /* determine whether we have correct input arguments */
-  if (m < 0 || m > l || fabs(x) > 1.0)
-    mexErrMsgTxt ("Bad arguments in routine plgndr");
-  
-  dif = l-m;
-  sum = l+m;
-  t_d = ( dif == 0.0 ? 0.0 : 0.5 * dif * (log(dif)-1.0) );
-  t_s = ( dif == 0.0 ? 0.0 : 0.5 * sum * (log(sum)-1.0) );
-  exp_check = 0.5 * log(2.0*l+1.0) + t_d - t_s;
-  err_amp = 1.0 / (0.00000000001 + fabs(1.0-fabs(x)));
-  p_mm   = legendre_Pmm(m, x);
-  p_mmp1 = x * (2*m + 1) * p_mm;
-  
-  /* P_m^m(x) and P_{m+1}^m(x) */
-  
-  if(l == m)
-  {
-    result = p_mm;
-  }
-  else if(l == m + 1)
-  {
-    result = p_mmp1;
-  }
-  else
-  {
-    /*
-     * upward recurrence: (l-m) P(l,m) = (2l-1) z P(l-1,m) - (l+m-1) P(l-2,m)
-     * start at P(m,m), P(m+1,m)
-     */
-    
-    double p_ellm2 = p_mm;
-    double p_ellm1 = p_mmp1;
-    double p_ell = 0.0;
-    int ell;
-    
-    for(ell=(int)m+2; ell <= l; ell++)
+    for (ell=2; ell<=N; ell++)
+      for (i=0; i<n; i++)
+      {
+        p_ell = (x[i]*(2*ell-1)*p_ellm1[i] - (ell-1)*p_ellm2[i]) / ell;
+        p_ellm2[i] = p_ellm1[i];
+        p_ellm1[i] = p_ell;
+        gx[i] += gxq[ell-1]*p_ell;
+        hx[i] -= hxq[ell-1]*p_ell;
+      }
+
+    for (i=0; i<n; i++)
     {
-      p_ell = (x*(2*ell-1)*p_ellm1 - (ell+m-1)*p_ellm2) / (ell-m);
-      p_ellm2 = p_ellm1;
-      p_ellm1 = p_ell;
+      s->gxd[b+i] = gx[i] / 12.566370614359172464;
+      s->hxd[b+i] = hx[i] / 12.566370614359172464;
     }
-    result = p_ell;
   }
-  return result;
+  return NULL;
 }
 
-#define M 4		/* constant in denominator              */
-#define N 9		/* number of terms for series expansion */
-
-/* these ratios for the series summation were computed in Matlab for M=4, N=9 */
-#define GXQ {0.1875, 0.0038580246913580244772, 0.00033757716049382714175, 5.624999999999999846e-05, 1.3580246913580246623e-05, 4.177786004802525277e-06, 1.5252433881715951896e-06, 6.3258506706294770457e-07, 2.8959000152415790233e-07}
-#define HXQ {0.375, 0.023148148148148146863, 0.0040509259259259257011, 0.001124999999999999915, 0.00040740740740740738176, 0.00017546701220170606841, 8.5413629737609325534e-05, 4.5546124828532236423e-05, 2.6063100137174212163e-05}
-
 void
 mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 {
-  int i, j, k;
-  int index, nrows, ncols;
+  mwSize nrows, ncols, numel;
   const mxArray *x;
   mxArray *gx, *hx;
-  double *xd, *gxd, *hxd;
-  double p[N];
-  double gxq[] = GXQ;
-  double hxq[] = HXQ;
-  
+  splint_t s;
+  int t, nthreads = 1;
+
   if (nrhs != 1)
     mexErrMsgTxt ("invalid number of arguments for SPLINT_GH");
-  
+  if (!mxIsDouble(prhs[0]) || mxIsComplex(prhs[0]))
+    mexErrMsgTxt ("the input to SPLINT_GH should be real-valued double precision");
+
   x  = prhs[0];
-  xd = mxGetData (x);
   nrows = mxGetM (x);
   ncols = mxGetN (x);
-  
+  numel = nrows*ncols;
+
   gx = mxCreateDoubleMatrix (nrows, ncols, mxREAL);
   hx = mxCreateDoubleMatrix (nrows, ncols, mxREAL);
-  gxd = mxGetData (gx);
-  hxd = mxGetData (hx);
-  
-  /* iterate over all matrix entries */
-  for (i=0; i<(nrows*ncols); i++)
+  s.xd  = mxGetData (x);
+  s.gxd = mxGetData (gx);
+  s.hxd = mxGetData (hx);
+
+#ifdef SPLINT_THREADS
+  if (numel>=MINSIZE)
+  {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = (ncpu>MAXTHREADS ? MAXTHREADS : (ncpu<1 ? 1 : (int)ncpu));
+  }
+
+  if (nthreads>1)
   {
-    /* to avoid rounding off errors */
-    xd[i] = ( xd[i] >  1 ?   1 : xd[i] );
-    xd[i] = ( xd[i] < -1 ?  -1 : xd[i] );
-    
-    for (k=0; k<N; k++)
-      p[k] = plgndr(k+1, 0, xd[i]);
-    
-    gxd[i] = 0;
-    hxd[i] = 0;
-    for (k=0; k<N; k++)
+    pthread_t thread[MAXTHREADS];
+    splint_t part[MAXTHREADS];
+    int started[MAXTHREADS];
+    mwSize ntile = (numel + TILE - 1)/TILE;
+
+    /* divide the tiles over the threads */
+    for (t=0; t<nthreads; t++)
+    {
+      part[t]       = s;
+      part[t].begin = ((ntile*t)/nthreads)*TILE;
+      part[t].end   = ((ntile*(t+1))/nthreads)*TILE;
+      part[t].end   = (part[t].end>numel ? numel : part[t].end);
+      started[t]    = (pthread_create(&thread[t], NULL, splint_series, &part[t])==0);
+    }
+    for (t=0; t<nthreads; t++)
     {
-      gxd[i] += gxq[k]*p[k];
-      hxd[i] -= hxq[k]*p[k];
+      if (started[t])
+        pthread_join(thread[t], NULL);
+      else
+        splint_series(&part[t]);
     }
-    gxd[i] /= 12.566370614359172464;
-    hxd[i] /= 12.566370614359172464;
   }
-  
+#endif
+
+  if (nthreads==1)
+  {
+    s.begin = 0;
+    s.end   = numel;
+    splint_series(&s);
+  }
+
   plhs[0] = gx;
   plhs[1] = hx;
-  
+
   return;
 }
@@ -5,6 +5,12 @@
  * Use as
  *   write_ctf_shm(msgNumber, msgType, msgId, sampleNumber, numSamples, numChannels, data);
  *
+ * Multiple packets are written in a single call if msgNumber is a vector. The
+ * other meta-information is then either a scalar or a vector with a value for
+ * each packet, and the data contains the concatenated numSamples(i)*numChannels(i)
+ * values of all packets. The shared memory segment remains attached between
+ * calls and is detached when the mex file is cleared.
+ *
  * Copyright (C) 2007, Robert Oostenveld
  *
  * $Id$
@@ -20,6 +26,7 @@
 #define ACQ_MSGQ_SHMKEY    0x39457f73
 #define ACQ_MSGQ_SHMPROJID 12345
 #define ACQ_MSGQ_SHMPATH   "/opt/ctf/bin/Acq"
+#define ACQ_BUFFER_SIZE    28160
 
 typedef enum
 {
@@ -36,17 +43,28 @@ typedef struct
   int sampleNumber;
   int numSamples;
   int numChannels;
-  int data[28160];
+  int data[ACQ_BUFFER_SIZE];
 } ACQ_MessagePacketType;
 
-void
-mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
+/* the attachment persists between calls */
+static ACQ_MessagePacketType *packet = NULL;
+
+static void
+detach (void)
+{
+  if (packet)
+    shmdt(packet);
+  packet = NULL;
+}
+
+static void
+attach (void)
 {
   key_t key;
-  ACQ_MessagePacketType *packet;
-  int msgNumber, msgType, msgId, sampleNumber, numSamples, numChannels, *data;
   int shmid, shmsize;
-  int numValues = 28160;
+
+  if (packet)
+    return;
 
   shmsize = sizeof(ACQ_MessagePacketType) * ACQ_MSGQ_SIZE;
 
@@ -66,46 +84,91 @@ mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 
   /* attach to the segment to get a pointer to it */
   packet = shmat(shmid, (void *)0, 0);
-  if ((char *)packet == (char *)(-1))
+  if ((char *)packet == (char *)(-1)) {
+    packet = NULL;
     mexErrMsgTxt("shmat");
+  }
+
+  mexAtExit(detach);
+}
+
+/* get the value of the meta-information for the k-th packet */
+static int
+getvalue (const mxArray *x, int k)
+{
+  if (mxGetNumberOfElements(x)==1)
+    return (int)mxGetScalar(x);
+  else
+    return (int)(mxGetPr(x)[k]);
+}
+
+void
+mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
+{
+  int msgNumber, numPackets, numValues, k, n, i;
+  const int *data;
 
   if (nrhs<7)
     mexErrMsgTxt("Not enough input arguments");
 
-  msgNumber    = (int)mxGetScalar(prhs[0])-1; /* one offset in Matlab, zero offset in C */
-  /*
-  msgType      = (int)mxGetScalar(prhs[1]);
-  msgId        = (int)mxGetScalar(prhs[2]);
-  sampleNumber = (int)mxGetScalar(prhs[3]);
-  numSamples   = (int)mxGetScalar(prhs[4]);
-  numChannels  = (int)mxGetScalar(prhs[5]);
-  */
-
   if (mxGetClassID(prhs[6]) != mxINT32_CLASS)
     mexErrMsgTxt("Invalid type of data, should be int32");
 
-  if (msgNumber<0)
-    mexErrMsgTxt("Cannot write before the first packet");
-  if (msgNumber>=ACQ_MSGQ_SIZE)
-    mexErrMsgTxt("Cannot write after the last packet");
+  numPackets = mxGetNumberOfElements(prhs[0]);
+  for (i=0; i<6; i++) {
+    if (mxGetNumberOfElements(prhs[i])>1 && !mxIsDouble(prhs[i]))
+      mexErrMsgTxt("Invalid type of meta-information for multiple packets, should be double");
+    if (i>0 && mxGetNumberOfElements(prhs[i])!=1 && mxGetNumberOfElements(prhs[i])!=numPackets)
+      mexErrMsgTxt("The meta-information should be a scalar or have one value for each packet");
+  }
+  for (k=0; k<numPackets; k++) {
+    msgNumber = getvalue(prhs[0], k)-1; /* one offset in Matlab, zero offset in C */
+    if (msgNumber<0)
+      mexErrMsgTxt("Cannot write before the first packet");
+    if (msgNumber>=ACQ_MSGQ_SIZE)
+      mexErrMsgTxt("Cannot write after the last packet");
+  }
+
+  attach();
+
+  data = (const int *)mxGetData(prhs[6]);
+
+  if (numPackets==1) {
+    /* the data of a single packet is written as it is */
+    numValues = mxGetNumberOfElements(prhs[6]);
+    numValues = ( numValues>ACQ_BUFFER_SIZE ? ACQ_BUFFER_SIZE : numValues );  /* check boundary */
+    numValues = ( numValues<0               ? 0               : numValues );  /* check boundary */
+  }
+  else {
+    /* the data of multiple packets is concatenated */
+    n = 0;
+    for (k=0; k<numPackets; k++) {
+      numValues = getvalue(prhs[4], k) * getvalue(prhs[5], k);
+      if (numValues<0 || numValues>ACQ_BUFFER_SIZE)
+        mexErrMsgTxt("Invalid number of samples or channels in the packet");
+      n += numValues;
+    }
+    if (n!=mxGetNumberOfElements(prhs[6]))
+      mexErrMsgTxt("The number of data values does not match the number of samples and channels of the packets");
+  }
 
-  numValues = mxGetNumberOfElements(prhs[6]);
-  numValues = ( numValues>28160 ? 28160 : numValues );  /* check boundary */
-  numValues = ( numValues<0     ? 0     : numValues );  /* check boundary */
+  for (k=0; k<numPackets; k++) {
+    msgNumber = getvalue(prhs[0], k)-1;
+    if (numPackets>1)
+      numValues = getvalue(prhs[4], k) * getvalue(prhs[5], k);
 
-   /* write the meta-information to the packet */
-  packet[msgNumber].message_type = (int)mxGetScalar(prhs[1]);
-  packet[msgNumber].messageId    = (int)mxGetScalar(prhs[2]);
-  packet[msgNumber].sampleNumber = (int)mxGetScalar(prhs[3]);
-  packet[msgNumber].numSamples   = (int)mxGetScalar(prhs[4]);
-  packet[msgNumber].numChannels  = (int)mxGetScalar(prhs[5]);
+    /* write the data to the packet */
+    memcpy(packet[msgNumber].data, data, numValues*sizeof(int));
+    data += numValues;
 
-   /* write the data to the packet */
-  memcpy(packet[msgNumber].data, mxGetData(prhs[6]), numValues*sizeof(int));
+    /* write the meta-information to the packet */
+    packet[msgNumber].messageId    = getvalue(prhs[2], k);
+    packet[msgNumber].sampleNumber = getvalue(prhs[3], k);
+    packet[msgNumber].numSamples   = getvalue(prhs[4], k);
+    packet[msgNumber].numChannels  = getvalue(prhs[5], k);
 
-  /* detach from the segment */
-  if (shmdt(packet) == -1)
-    mexErrMsgTxt("shmdt");
+    /* the message type is written last, since a reader uses it to detect a new packet */
+    packet[msgNumber].message_type = getvalue(prhs[1], k);
+  }
 
 } /* end of mexFunction */
-
@@ -5,7 +5,12 @@ function [varargout] = write_ctf_shm(varargin)
 % being acquired.
 %
 % Use as
-%   write_ctf_shm(msgType, msgId, sampleNumber, numSamples, numChannels, data);
+%   write_ctf_shm(msgNumber, msgType, msgId, sampleNumber, numSamples, numChannels, data);
+%
+% Multiple packets are written at once if msgNumber is a vector. The other
+% meta-information is then either a scalar or has a value for each packet, and
+% the data contains the concatenated numSamples(i)*numChannels(i) values of all
+% packets. The shared memory remains attached between calls.
 %
 % See also READ_CTF_SHM
 